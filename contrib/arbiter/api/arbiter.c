@@ -37,14 +37,26 @@ static int leader = 0;
 static int connum = 0;
 static ArbiterConnData conns[MAX_SERVERS];
 static char *arbiter_unix_sock_dir;
+static ArbiterSendHook transport_send;
+static ArbiterRecvHook transport_recv;
 
 typedef unsigned xid_t;
 
+/*
+ * The last snapshot received on the current connection: base for the
+ * delta encoded snapshots sent by the arbiter.
+ */
+static xid_t last_active[MAX_TRANSACTIONS];
+static int last_nactive;
+static xid_t last_snapshot_seq = 0;
+
 static void DiscardConnection()
 {
+	last_snapshot_seq = 0;
 	if (connected)
 	{
-		close(conns[leader].sock);
+		if (!transport_send)
+			close(conns[leader].sock);
 		conns[leader].sock = -1;
 		connected = false;
 	}
@@ -58,6 +70,19 @@ static int arbiter_recv_results(ArbiterConn arbiter, int maxlen, xid_t *results)
 	int recved;
 	int needed;
 
+	if (transport_recv)
+	{
+		needed = transport_recv(results, maxlen * sizeof(xid_t));
+		if (needed < 0)
+		{
+			DiscardConnection();
+			elog(WARNING, "Lost connection to arbiter");
+			return 0;
+		}
+		assert(needed % sizeof(xid_t) == 0);
+		return needed / sizeof(xid_t);
+	}
+
 	recved = 0;
 	needed = sizeof(ShubMessageHdr);
 	while (recved < needed)
@@ -111,6 +136,12 @@ static bool ArbiterConnect(ArbiterConn conn)
 {
 	int sd;
 
+	if (transport_send)
+	{
+		// the messages are passed to the transport functions
+		return (connected = true);
+	}
+
 	if (conn->host == NULL)
 	{
 		// use a UNIX socket
@@ -187,18 +218,35 @@ static bool ArbiterConnect(ArbiterConn conn)
 	return false;
 }
 
+static bool arbiter_send(ArbiterConn arbiter, char *buf, int datasize)
+{
+	int sent;
+
+	if (transport_send)
+		return transport_send(buf, datasize);
+
+	sent = 0;
+	while (sent < datasize)
+	{
+		int newbytes = write(arbiter->sock, buf + sent, datasize - sent);
+		if (newbytes == -1)
+			return false;
+		sent += newbytes;
+	}
+	return true;
+}
+
 static bool arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
 {
 	va_list argv;
 	int i;
-	int sent;
 	char buf[COMMAND_BUFFER_SIZE];
 	int datasize;
 	char *cursor = buf;
 
 	ShubMessageHdr *msg = (ShubMessageHdr*)cursor;
 	msg->chan = 0;
-	msg->code = MSG_FIRST_USER_CODE;
+	msg->code = (cmd == CMD_FOR || cmd == CMD_AGAINST) ? MSG_COMBINE : MSG_FIRST_USER_CODE;
 	msg->size = sizeof(xid_t) * (argc + 1);
 	cursor += sizeof(ShubMessageHdr);
 
@@ -217,17 +265,11 @@ static bool arbiter_send_command(ArbiterConn arbiter, xid_t cmd, int argc, ...)
 	assert(msg->size + sizeof(ShubMessageHdr) == datasize);
 	assert(datasize <= COMMAND_BUFFER_SIZE);
 
-	sent = 0;
-	while (sent < datasize)
+	if (!arbiter_send(arbiter, buf, datasize))
 	{
-		int newbytes = write(arbiter->sock, buf + sent, datasize - sent);
-		if (newbytes == -1)
-		{
-			DiscardConnection();
-			elog(ERROR, "Failed to send a command to arbiter");
-			return false;
-		}
-		sent += newbytes;
+		DiscardConnection();
+		elog(ERROR, "Failed to send a command to arbiter");
+		return false;
 	}
 	return true;
 }
@@ -275,6 +317,27 @@ void ArbiterConfig(char *servers, char *sock_dir)
 	arbiter_unix_sock_dir = sock_dir;
 }
 
+void ArbiterSetTransport(ArbiterSendHook send, ArbiterRecvHook recv)
+{
+	if (connected)
+		DiscardConnection();
+	transport_send = send;
+	transport_recv = recv;
+}
+
+int ArbiterOpenSocket(void)
+{
+	Assert(!transport_send);
+	if (!connected && !ArbiterConnect(conns + leader))
+		return -1;
+	return conns[leader].sock;
+}
+
+void ArbiterCloseSocket(void)
+{
+	DiscardConnection();
+}
+
 static ArbiterConn GetConnection()
 {
 	int tries = 3 * connum;
@@ -321,6 +384,79 @@ static ArbiterConn GetConnection()
 	return conns + leader;
 }
 
+/*
+ * Decode the snapshot sent by the arbiter in response to BEGIN or SNAPSHOT
+ * sent with SNAPSHOT_DELTA. 'results' points to xmin. Returns false if the
+ * response is malformed.
+ */
+static bool arbiter_decode_snapshot(xid_t *results, int reslen, Snapshot snapshot)
+{
+	int i, j, k;
+	int nremoved;
+	xid_t *removed;
+	xid_t *added;
+	int nadded;
+	int n;
+
+	if (reslen < 3)
+		return false;
+
+	ArbiterInitSnapshot(snapshot);
+	snapshot->xmin = results[0];
+	snapshot->xmax = results[1];
+
+	if (results[2] == SNAPSHOT_FULL)
+	{
+		n = reslen - 3;
+		if (n > MAX_TRANSACTIONS)
+			return false;
+		memcpy(last_active, results + 3, n * sizeof(xid_t));
+		last_snapshot_seq = 0; /* the full snapshot is number 1 for both sides */
+	}
+	else
+	{
+		static xid_t merged[MAX_TRANSACTIONS];
+
+		nremoved = results[2];
+		if (last_snapshot_seq == 0 || nremoved > reslen - 3)
+			return false;
+		removed = results + 3;
+		added = removed + nremoved;
+		nadded = reslen - 3 - nremoved;
+
+		/* merged = (last - removed) + added, all the lists are sorted */
+		for (i = 0, j = 0, k = 0, n = 0; i < last_nactive || k < nadded;)
+		{
+			if (i < last_nactive && j < nremoved && last_active[i] == removed[j])
+			{
+				i += 1;
+				j += 1;
+			}
+			else if (k == nadded || (i < last_nactive && last_active[i] < added[k]))
+			{
+				if (n == MAX_TRANSACTIONS)
+					return false;
+				merged[n++] = last_active[i++];
+			}
+			else
+			{
+				if (n == MAX_TRANSACTIONS)
+					return false;
+				merged[n++] = added[k++];
+			}
+		}
+		if (j != nremoved)
+			return false;
+		memcpy(last_active, merged, n * sizeof(xid_t));
+	}
+	last_nactive = n;
+	last_snapshot_seq += 1;
+
+	snapshot->xcnt = n;
+	memcpy(snapshot->xip, last_active, n * sizeof(xid_t));
+	return true;
+}
+
 void ArbiterInitSnapshot(Snapshot snapshot)
 {
 	if (snapshot->xip == NULL)
@@ -347,7 +483,6 @@ void ArbiterInitSnapshot(Snapshot snapshot)
 
 TransactionId ArbiterStartTransaction(Snapshot snapshot, TransactionId *gxmin, int nParticipants)
 {
-	int i;
 	xid_t xid;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
@@ -359,28 +494,16 @@ TransactionId ArbiterStartTransaction(Snapshot snapshot, TransactionId *gxmin, i
 	assert(snapshot != NULL);
 
 	// command
-	if (nParticipants) {
-		if (!arbiter_send_command(arbiter, CMD_BEGIN, 1, nParticipants)) goto failure;
-	} else {
-		if (!arbiter_send_command(arbiter, CMD_BEGIN, 0)) goto failure;
-	}
+	if (!arbiter_send_command(arbiter, CMD_BEGIN, 3, nParticipants, SNAPSHOT_DELTA, last_snapshot_seq)) goto failure;
 
 	// results
 	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
-	if (reslen < 5) goto failure;
+	if (reslen < 6) goto failure;
 	if (results[0] != RES_OK) goto failure;
 	xid = results[1];
 	*gxmin = results[2];
 
-	ArbiterInitSnapshot(snapshot);
-	snapshot->xmin = results[3];
-	snapshot->xmax = results[4];
-	snapshot->xcnt = reslen - 5;
-
-	for (i = 0; i < snapshot->xcnt; i++)
-	{
-		snapshot->xip[i] = results[5 + i];
-	}
+	if (!arbiter_decode_snapshot(results + 3, reslen - 3, snapshot)) goto failure;
 
 	return xid;
 failure:
@@ -391,7 +514,6 @@ failure:
 
 void ArbiterGetSnapshot(TransactionId xid, Snapshot snapshot, TransactionId *gxmin)
 {
-	int i;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
@@ -402,22 +524,15 @@ void ArbiterGetSnapshot(TransactionId xid, Snapshot snapshot, TransactionId *gxm
 	assert(snapshot != NULL);
 
 	// command
-	if (!arbiter_send_command(arbiter, CMD_SNAPSHOT, 1, xid)) goto failure;
+	if (!arbiter_send_command(arbiter, CMD_SNAPSHOT, 3, xid, SNAPSHOT_DELTA, last_snapshot_seq)) goto failure;
 
 	// response
 	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
-	if (reslen < 4) goto failure;
+	if (reslen < 5) goto failure;
 	if (results[0] != RES_OK) goto failure;
 	*gxmin = results[1];
-	ArbiterInitSnapshot(snapshot);
-	snapshot->xmin = results[2];
-	snapshot->xmax = results[3];
-	snapshot->xcnt = reslen - 4;
 
-	for (i = 0; i < snapshot->xcnt; i++)
-	{
-		snapshot->xip[i] = results[4 + i];
-	}
+	if (!arbiter_decode_snapshot(results + 2, reslen - 2, snapshot)) goto failure;
 
 	return;
 failure:
@@ -516,6 +631,62 @@ failure:
 	return -1;
 }
 
+bool ArbiterGetTransStatuses(TransactionId *xids, int n, XidStatus *statuses)
+{
+	static const XidStatus unpacked[] = {
+		TRANSACTION_STATUS_UNKNOWN,     // BLANK
+		TRANSACTION_STATUS_COMMITTED,   // POSITIVE
+		TRANSACTION_STATUS_ABORTED,     // NEGATIVE
+		TRANSACTION_STATUS_IN_PROGRESS  // DOUBT
+	};
+	int done;
+	int reslen;
+	xid_t results[RESULTS_SIZE];
+	char *buf = malloc(sizeof(ShubMessageHdr) + (MAX_STATUSES + 1) * sizeof(xid_t));
+	ShubMessageHdr *msg = (ShubMessageHdr*)buf;
+	xid_t *body = (xid_t*)(msg + 1);
+	ArbiterConn arbiter = GetConnection();
+	if (!arbiter) {
+		goto failure;
+	}
+
+	for (done = 0; done < n; done += MAX_STATUSES)
+	{
+		int i;
+		int count = Min(n - done, MAX_STATUSES);
+
+		// command
+		msg->chan = 0;
+		msg->code = MSG_FIRST_USER_CODE;
+		msg->size = (count + 1) * sizeof(xid_t);
+		body[0] = CMD_STATUSES;
+		memcpy(body + 1, xids + done, count * sizeof(xid_t));
+		if (!arbiter_send(arbiter, buf, sizeof(ShubMessageHdr) + msg->size)) goto failure;
+
+		// response
+		reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
+		if (reslen != 1 + (count + STATUSES_PER_WORD - 1) / STATUSES_PER_WORD) goto failure;
+		if (results[0] != RES_OK) goto failure;
+		for (i = 0; i < count; i++)
+		{
+			xid_t word = results[1 + i / STATUSES_PER_WORD];
+			statuses[done + i] = unpacked[(word >> (2 * (i % STATUSES_PER_WORD))) & 3];
+		}
+	}
+	free(buf);
+	return true;
+failure:
+	free(buf);
+	DiscardConnection();
+	fprintf(
+		stderr,
+		"ArbiterGetTransStatuses: failed to get"
+		" the statuses of %d xids\n",
+		n
+	);
+	return false;
+}
+
 int ArbiterReserve(TransactionId xid, int nXids, TransactionId *first)
 {
 	xid_t xmin, xmax;
@@ -560,7 +731,6 @@ bool ArbiterDetectDeadLock(int port, TransactionId xid, void* data, int size)
 	char* buf = (char*)malloc(data_size);
 	ShubMessageHdr* msg = (ShubMessageHdr*)buf;
 	xid_t* body = (xid_t*)(msg+1);
-	int sent;
 	int reslen;
 	xid_t results[RESULTS_SIZE];
 	ArbiterConn arbiter = GetConnection();
@@ -574,16 +744,10 @@ bool ArbiterDetectDeadLock(int port, TransactionId xid, void* data, int size)
 	*body++ = xid;
 	memcpy(body, data, size);
 
-	sent = 0;
-	while (sent < data_size)
+	if (!arbiter_send(arbiter, buf, data_size))
 	{
-		int new_bytes = write(arbiter->sock, buf + sent, data_size - sent);
-		if (new_bytes == -1)
-		{
-			elog(ERROR, "Failed to send a command to arbiter");
-			return false;
-		}
-		sent += new_bytes;
+		elog(ERROR, "Failed to send a command to arbiter");
+		return false;
 	}
 
 	reslen = arbiter_recv_results(arbiter, RESULTS_SIZE, results);
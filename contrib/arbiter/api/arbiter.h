@@ -13,6 +13,33 @@
  */
 void ArbiterConfig(char *servers, char *sock_dir);
 
+/**
+ * Functions used to exchange messages with the arbiter instead of a socket.
+ * 'send' is passed a complete message with ShubMessageHdr, 'recv' stores the
+ * body of the reply and returns its size in bytes, or -1 if the connection
+ * was lost.
+ */
+typedef bool (*ArbiterSendHook)(void *msg, int size);
+typedef int (*ArbiterRecvHook)(void *body, int maxsize);
+
+/**
+ * Routes all the requests of this process through the given functions.
+ * Passing NULLs restores the socket connection.
+ */
+void ArbiterSetTransport(ArbiterSendHook send, ArbiterRecvHook recv);
+
+/**
+ * Connects to the current arbiter candidate and returns the socket, or -1 on
+ * failure. Used by the process which multiplexes the requests of others.
+ */
+int ArbiterOpenSocket(void);
+
+/**
+ * Closes the socket returned by ArbiterOpenSocket and switches to the next
+ * arbiter candidate.
+ */
+void ArbiterCloseSocket(void);
+
 void ArbiterInitSnapshot(Snapshot snapshot);
 
 /**
@@ -44,6 +71,12 @@ XidStatus ArbiterSetTransStatus(TransactionId xid, XidStatus status, bool wait);
  */
 XidStatus ArbiterGetTransStatus(TransactionId xid, bool wait);
 
+/**
+ * Gets the statuses of 'n' transactions at once, as ArbiterGetTransStatus
+ * would return them without waiting. Returns true on success.
+ */
+bool ArbiterGetTransStatuses(TransactionId *xids, int n, XidStatus *statuses);
+
 /**
  * Reserves at least 'nXids' successive xids for local transactions. The xids
  * reserved are not less than 'xid' in value. Returns the actual number of xids
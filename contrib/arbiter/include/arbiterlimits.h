@@ -19,7 +19,10 @@
 #define HEARTBEAT_TIMEOUT_MS 20
 #define ELECTION_TIMEOUT_MS_MIN 150
 #define ELECTION_TIMEOUT_MS_MAX 300
+#define LEASE_TIMEOUT_MS 100 /* how long a reply from the leader or to the leader allows serving reads */
 #define RAFT_LOGLEN 1024
 #define RAFT_KEEP_APPLIED 512 /* how many applied entries to keep during compaction */
+#define RAFT_BATCH_SIZE 64 /* max number of updates carried by one raft entry */
+#define RAFT_PIPELINE_DEPTH 32 /* max number of unacked entries sent to a server */
 
 #endif
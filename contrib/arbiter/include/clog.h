@@ -27,10 +27,18 @@ clog_t clog_open(char *datadir);
 // Get the status of the specified global commit.
 int clog_read(clog_t clog, xid_t xid);
 
+// Get the statuses of 'n' global commits packed by 2 bits: status of xids[i]
+// is stored at bit 2 * (i % 16) of packed[i / 16].
+void clog_read_packed(clog_t clog, xid_t *xids, int n, xid_t *packed);
+
 // Set the status of the specified global commit. Return 'true' on success,
 // 'false' otherwise.
 bool clog_write(clog_t clog, xid_t xid, int status);
 
+// Make the status changes durable: all the changes since the previous call are
+// flushed at once. Return 'true' on success, 'false' otherwise.
+bool clog_sync(clog_t clog);
+
 // Forget about the commits before the given one ('until'), and free the
 // occupied space if possible. Return 'true' on success, 'false' otherwise.
 bool clog_forget(clog_t clog, xid_t until);
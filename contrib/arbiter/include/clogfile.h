@@ -22,12 +22,23 @@ typedef struct clogfile_t {
 	xid_t min;
 	xid_t max;
 	void *data; // ptr for mmap
+	off64_t dirty_min; // the range of bytes changed since the last sync,
+	off64_t dirty_max; // empty if dirty_min > dirty_max
 } clogfile_t;
 
 // Open a clog file with the gived id. Create before opening if 'create' is
 // true. Return 'true' on success, 'false' otherwise.
 bool clogfile_open_by_id(clogfile_t *clogfile, char *datadir, int fileid, bool create);
 
+// Create and map a clog file with the given id under a temporary name, so
+// that it can be installed later without any delay. Return 'true' on
+// success, 'false' otherwise.
+bool clogfile_prepare_by_id(clogfile_t *clogfile, char *datadir, int fileid);
+
+// Give the prepared clog file its permanent name. Fails if the file already
+// exists. Return 'true' on success, 'false' otherwise.
+bool clogfile_install(clogfile_t *clogfile);
+
 // Close and remove the given clog file. Return 'true' on success, 'false'
 // otherwise.
 bool clogfile_remove(clogfile_t *clogfile);
@@ -42,4 +53,8 @@ int clogfile_get_status(clogfile_t *clogfile, xid_t xid);
 // 'true' on success, 'false' otherwise.
 bool clogfile_set_status(clogfile_t *clogfile, xid_t xid, int status);
 
+// Flush the pages changed since the last sync to the disk. Return 'true' on
+// success, 'false' otherwise.
+bool clogfile_sync(clogfile_t *clogfile);
+
 #endif
@@ -1,15 +1,20 @@
 #ifndef PROTO_H
 #define PROTO_H
 
-#define CMD_HELLO    'h'
+#define CMD_HELLO    'h' /* optional argument: nonzero if the client only sends STATUS */
 #define CMD_RESERVE  'r'
 #define CMD_BEGIN    'b'
 #define CMD_FOR      'y'
 #define CMD_AGAINST  'n'
 #define CMD_SNAPSHOT 't'
 #define CMD_STATUS   's'
+#define CMD_STATUSES 'S'
 #define CMD_DEADLOCK 'd'
 
+/* the 2-bit statuses replied to STATUSES: BLANK, POSITIVE, NEGATIVE, DOUBT */
+#define STATUSES_PER_WORD 16
+#define MAX_STATUSES 4096
+
 #define RES_FAILED 0xDEADBEEF
 #define RES_OK 0xC0FFEE
 #define RES_REDIRECT 404
@@ -19,4 +24,13 @@
 #define RES_TRANSACTION_INPROGRESS 3
 #define RES_TRANSACTION_UNKNOWN 4
 
+/*
+ * BEGIN and SNAPSHOT accept two extra arguments: SNAPSHOT_DELTA and the
+ * sequence number of the last snapshot received by the client on this
+ * connection (0 if none). The snapshot is then sent as a difference with that
+ * snapshot, or in full prefixed with SNAPSHOT_FULL.
+ */
+#define SNAPSHOT_DELTA 1
+#define SNAPSHOT_FULL  0xFFFFFFFF
+
 #endif
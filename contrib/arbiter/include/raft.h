@@ -7,8 +7,6 @@
 
 #define NOBODY -1
 
-#define MAJORITY_IS_NOT_ENOUGH // wait for unanimous ack for applying a new entry
-
 #define DEFAULT_LISTENHOST "0.0.0.0"
 #define DEFAULT_LISTENPORT 5431
 
@@ -24,18 +22,27 @@
 #error please ensure HEARTBEAT_TIMEOUT_MS < ELECTION_TIMEOUT_MS_MIN (considerably)
 #endif
 
+#if LEASE_TIMEOUT_MS >= ELECTION_TIMEOUT_MS_MIN
+#error please ensure LEASE_TIMEOUT_MS < ELECTION_TIMEOUT_MS_MIN (by more than the message delay)
+#endif
+
 #if ELECTION_TIMEOUT_MS_MIN >= ELECTION_TIMEOUT_MS_MAX
 #error please ensure ELECTION_TIMEOUT_MS_MIN < ELECTION_TIMEOUT_MS_MAX
 #endif
 
 // raft module does not care what you mean by action and argument
+typedef struct raft_update_t {
+	int action;
+	int argument;
+} raft_update_t;
+
 typedef struct raft_entry_t {
 	int term;
 	bool snapshot; // true if this is a snapshot entry
 	union {
 		struct { // snapshot == false
-			int action;
-			int argument;
+			int nupdates;
+			raft_update_t updates[RAFT_BATCH_SIZE];
 		};
 		struct { // snapshot == true
 			int minarg;
@@ -56,8 +63,9 @@ typedef struct raft_log_t {
 
 typedef struct raft_server_t {
 	int seqno;  // the rpc sequence number
-	int tosend; // index of the next entry to send
+	int tosend; // index of the next entry to send, entries from 'acked' are in flight
 	int acked;  // index of the highest entry known to be replicated
+	int heard;  // ms since the last reply in the current term (if we are the leader)
 
 	char *host;
 	int port;
@@ -79,6 +87,10 @@ typedef struct raft_t {
 	raft_server_t servers[MAX_SERVERS];
 
 	int timer;
+	int heard;  // ms since the last message from the leader (if we are a follower)
+
+	bool unanimous; // wait for all servers to ack an entry instead of the majority
+	raft_entry_t pending; // updates emitted but not yet appended to the log
 
 	raft_applier_t applier;
 } raft_t;
@@ -102,17 +114,18 @@ typedef struct raft_msg_update_t {
 	int previndex; // the index of the preceding log entry
 	int prevterm;  // the term of the preceding log entry
 
-	bool empty;    // the message is just a heartbeat if empty
-	raft_entry_t entry;
-
 	int acked;     // the leader's acked number
+
+	bool empty;    // the message is just a heartbeat if empty
+	raft_entry_t entry; // must be the last: only used updates are sent
 } raft_msg_update_t;
 
 typedef struct raft_msg_done_t {
 	raft_msg_t msg;
-	int index; // the index of the appended entry
+	int index; // the index of the appended entry, or of the last entry if refused
 	int term;  // the term of the appended entry
 	bool success;
+	bool beat; // the reply to a heartbeat, only refreshes the leader lease
 } raft_msg_done_t;
 
 typedef struct raft_msg_claim_t {
@@ -133,6 +146,7 @@ bool raft_set_myid(raft_t *r, int myid);
 
 // log actions
 bool raft_emit(raft_t *r, int action, int argument);
+bool raft_flush(raft_t *r);
 int raft_apply(raft_t *r, raft_applier_t applier);
 
 // control
@@ -142,4 +156,11 @@ raft_msg_t *raft_recv_message(raft_t *r);
 int raft_create_udp_socket(raft_t *r);
 void raft_ensure_term(raft_t *r, int term);
 
+// Returns true if reads can be served from the local state without a raft
+// round: the leader has heard from the majority, or the follower has heard
+// from the leader, within LEASE_TIMEOUT_MS. A follower does not vote for
+// others within ELECTION_TIMEOUT_MS_MIN after hearing from the leader, so
+// no other leader can be elected while either lease is valid.
+bool raft_has_lease(raft_t *r);
+
 #endif
@@ -28,6 +28,12 @@ typedef void (*onconnect_callback_t)(client_t client);
  */
 typedef void (*ondisconnect_callback_t)(client_t client);
 
+/*
+ * The server will call this function before sending the replies collected
+ * during 'server_tick', e.g. to make the state changes durable first.
+ */
+typedef void (*onflush_callback_t)(void);
+
 /*
  * Creates a new server that will listen on 'host:port' and call the specified
  * callbacks. Returns the server handle to use in other methods.
@@ -46,6 +52,11 @@ server_t server_init(
  */
 void server_set_raft_socket(server_t server, int sock);
 
+/*
+ * Sets the callback to call before sending the replies.
+ */
+void server_set_onflush(server_t server, onflush_callback_t onflush);
+
 /*
  * Starts the server. Returns 'true' on success, 'false' otherwise.
  */
@@ -80,6 +91,13 @@ void server_set_enabled(server_t server, bool enable);
 void client_set_userdata(client_t client, void *userdata);
 void *client_get_userdata(client_t client);
 
+/*
+ * Returns the client connected through the same socket as 'client' with the
+ * given 'chan', or NULL if there is no such client. Used to serve requests
+ * merged by the sockhub on behalf of several clients.
+ */
+client_t client_get_sibling(client_t client, unsigned chan);
+
 /*
  * Puts an empty message header into the output buffer of the corresponding
  * socket. The message will not be sent until you call the _finish() method.
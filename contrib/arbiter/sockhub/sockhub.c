@@ -20,6 +20,7 @@
 #include "sockhub.h"
 
 #define SOCKHUB_BUFFER_SIZE (1024*1024)
+#define SOCKHUB_MAX_IOV 1024
 #define ERR_BUF_SIZE 1024
 
 #define SHUB_TRACE(fmt, ...)
@@ -192,6 +193,27 @@ int ShubWriteSocket(int sd, void const* buf, int size)
     return 1;
 }
 
+int ShubWriteSocketv(int sd, struct iovec* iov, int iovcnt)
+{
+    while (iovcnt != 0) {
+        ssize_t n = writev(sd, iov, iovcnt);
+        if (n <= 0) {
+            return 0;
+        }
+        /* skip sent part */
+        while (iovcnt != 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov += 1;
+            iovcnt -= 1;
+        }
+        if (iovcnt != 0) {
+            iov->iov_base = (char*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+    return 1;
+}
+
 static void reconnect(Shub* shub)
 {
     struct sockaddr_in sock_inet;
@@ -278,6 +300,136 @@ static void notify_disconnect(Shub* shub, int chan)
             reconnect(shub);
         }
         shub->in_buffer_used = 0;
+        shub->in_buffer_partial = 0;
+    }
+}
+
+/*
+ * Replies are forwarded directly from the receive buffer: all replies to the
+ * same local socket received in one batch are sent by a single writev call.
+ */
+static void queue_reply(Shub* shub, ShubMessageHdr* first, char* end)
+{
+    ShubReply* reply = &shub->replies[shub->n_replies++];
+    reply->chan = first->chan;
+    reply->data.iov_base = first;
+    reply->data.iov_len = end - (char*)first;
+}
+
+static void flush_replies(Shub* shub)
+{
+    struct iovec iov[SOCKHUB_MAX_IOV];
+    int i, j, n = shub->n_replies;
+    ShubReply* replies = shub->replies;
+
+    for (i = 0; i < n; i++) {
+        int chan = replies[i].chan;
+        int n_iov = 0;
+        int ok = 1;
+        if (chan < 0) {
+            continue;
+        }
+        for (j = i; j < n; j++) {
+            if (replies[j].chan == chan) {
+                replies[j].chan = -1;
+                iov[n_iov++] = replies[j].data;
+                if (n_iov == SOCKHUB_MAX_IOV) {
+                    ok &= ShubWriteSocketv(chan, iov, n_iov);
+                    n_iov = 0;
+                }
+            }
+        }
+        if (!(ok && ShubWriteSocketv(chan, iov, n_iov))) {
+            shub->params->error_handler("Failed to write to local socket", SHUB_RECOVERABLE_ERROR);
+            close_socket(shub, chan);
+            notify_disconnect(shub, chan);
+        }
+    }
+    shub->n_replies = 0;
+}
+
+static int same_request(ShubMessageHdr* a, ShubMessageHdr* b)
+{
+    return a->code == b->code && a->size == b->size && memcmp(a + 1, b + 1, a->size) == 0;
+}
+
+/*
+ * Merge equal MSG_COMBINE requests of different local sockets, see sockhub.h.
+ * Requests of sockets which sent other requests in this batch are not merged,
+ * so that the server gets requests of each socket in the same order.
+ */
+static void combine_requests(Shub* shub)
+{
+    ShubRequest* reqs = shub->requests;
+    char* src = shub->in_buffer;
+    char* dst = shub->combine_buffer;
+    int used = shub->in_buffer_used;
+    int i, j, n = 0, pos, dst_pos = 0, n_merged = 0;
+
+    if (shub->in_buffer_partial) { /* buffer starts with the tail of a partly sent message */
+        return;
+    }
+    for (pos = 0; pos < used; pos += sizeof(ShubMessageHdr) + ((ShubMessageHdr*)&src[pos])->size) {
+        ShubMessageHdr* hdr = (ShubMessageHdr*)&src[pos];
+        if (hdr->chan >= shub->max_chan) {
+            int max_chan = hdr->chan*2 + 1;
+            shub->chan_requests = realloc(shub->chan_requests, max_chan*sizeof(int));
+            if (shub->chan_requests == NULL) {
+                shub->params->error_handler("Failed to allocate buffer", SHUB_FATAL_ERROR);
+            }
+            memset(shub->chan_requests + shub->max_chan, 0, (max_chan - shub->max_chan)*sizeof(int));
+            shub->max_chan = max_chan;
+        }
+        shub->chan_requests[hdr->chan] += 1;
+        reqs[n].offs = pos;
+        reqs[n].next_merged = -1;
+        reqs[n].last_merged = n;
+        reqs[n].n_merged = 0;
+        n += 1;
+    }
+
+    for (i = 0; i < n; i++) {
+        ShubMessageHdr* hdr = (ShubMessageHdr*)&src[reqs[i].offs];
+        if (hdr->code != MSG_COMBINE || shub->chan_requests[hdr->chan] != 1) {
+            continue;
+        }
+        for (j = 0; j < i; j++) {
+            ShubMessageHdr* first = (ShubMessageHdr*)&src[reqs[j].offs];
+            if (reqs[j].n_merged >= 0 && shub->chan_requests[first->chan] == 1 && same_request(first, hdr)) {
+                reqs[reqs[j].last_merged].next_merged = i;
+                reqs[j].last_merged = i;
+                reqs[j].n_merged += 1;
+                reqs[i].n_merged = -1;
+                n_merged += 1;
+                break;
+            }
+        }
+    }
+
+    if (n_merged != 0) {
+        for (i = 0; i < n; i++) {
+            ShubMessageHdr* hdr = (ShubMessageHdr*)&src[reqs[i].offs];
+            ShubMessageHdr* copy = (ShubMessageHdr*)&dst[dst_pos];
+            if (reqs[i].n_merged < 0) {
+                continue;
+            }
+            memcpy(copy, hdr, sizeof(ShubMessageHdr) + hdr->size);
+            dst_pos += sizeof(ShubMessageHdr) + hdr->size;
+            for (j = reqs[i].next_merged; j >= 0; j = reqs[j].next_merged) {
+                unsigned int chan = ((ShubMessageHdr*)&src[reqs[j].offs])->chan;
+                memcpy(&dst[dst_pos], &chan, sizeof chan);
+                dst_pos += sizeof chan;
+            }
+            copy->size += reqs[i].n_merged*sizeof(unsigned int);
+        }
+        assert(dst_pos <= used);
+        shub->combine_buffer = src;
+        shub->in_buffer = dst;
+        shub->in_buffer_used = dst_pos;
+    }
+
+    for (i = 0; i < n; i++) {
+        shub->chan_requests[((ShubMessageHdr*)&src[reqs[i].offs])->chan] = 0;
     }
 }
 
@@ -343,6 +495,26 @@ void ShubInitialize(Shub* shub, ShubParams* params)
     }
     shub->in_buffer_used = 0;
     shub->out_buffer_used = 0;
+
+    /* each reply has at least a header */
+    shub->replies = malloc(sizeof(ShubReply) * (params->buffer_size / sizeof(ShubMessageHdr) + 1));
+    if (shub->replies == NULL) {
+        shub->params->error_handler("Failed to allocate buffer", SHUB_FATAL_ERROR);
+    }
+    shub->n_replies = 0;
+
+    shub->in_buffer_partial = 0;
+    shub->combine_buffer = NULL;
+    shub->requests = NULL;
+    shub->chan_requests = NULL;
+    shub->max_chan = 0;
+    if (params->combine) {
+        shub->combine_buffer = malloc(params->buffer_size);
+        shub->requests = malloc(sizeof(ShubRequest) * (params->buffer_size / sizeof(ShubMessageHdr) + 1));
+        if (shub->combine_buffer == NULL || shub->requests == NULL) {
+            shub->params->error_handler("Failed to allocate buffer", SHUB_FATAL_ERROR);
+        }
+    }
 }
 
 static int stop = 0;
@@ -431,11 +603,7 @@ void ShubLoop(Shub* shub)
                                 pos += sizeof(ShubMessageHdr) + hdr->size;
                                 if (firstHdr != NULL && (firstHdr->chan != chan || pos > available)) {
                                     assert(hdr > firstHdr);
-                                    if (!ShubWriteSocket(firstHdr->chan, firstHdr, (char*)hdr - (char*)firstHdr)) {
-                                        shub->params->error_handler("Failed to write to local socket", SHUB_RECOVERABLE_ERROR);
-                                        close_socket(shub, firstHdr->chan);
-                                        notify_disconnect(shub, firstHdr->chan);
-                                    }
+                                    queue_reply(shub, firstHdr, (char*)hdr);
                                     firstHdr = NULL;
                                 }
                                 if (pos <= available) {
@@ -449,6 +617,7 @@ void ShubLoop(Shub* shub)
                                     } else {
                                         /* read rest of message if it doesn't fit in the buffer */
                                         int tail = pos - available;
+                                        flush_replies(shub); /* the buffer will be overwritten */
                                         if (!ShubWriteSocket(chan, hdr, available)) {
                                             shub->params->error_handler("Failed to write to local socket", SHUB_RECOVERABLE_ERROR);
                                             close_socket(shub, chan);
@@ -477,12 +646,9 @@ void ShubLoop(Shub* shub)
                             }
                             if (firstHdr != NULL) {
                                assert(&shub->out_buffer[pos] > (char*)firstHdr);
-                                if (!ShubWriteSocket(firstHdr->chan, firstHdr, &shub->out_buffer[pos] - (char*)firstHdr)) {
-                                    shub->params->error_handler("Failed to write to local socket", SHUB_RECOVERABLE_ERROR);
-                                    close_socket(shub, firstHdr->chan);
-                                    notify_disconnect(shub, firstHdr->chan);
-                                }
+                               queue_reply(shub, firstHdr, &shub->out_buffer[pos]);
                             }
+                            flush_replies(shub);
                             /* Move partly fetched message header (if any) to the beginning of buffer */
                             memmove(shub->out_buffer, shub->out_buffer + pos, available - pos);
                             shub->out_buffer_used = available - pos;
@@ -525,6 +691,7 @@ void ShubLoop(Shub* shub)
                                         }
                                         processed = 0;
                                         hdr = NULL;
+                                        shub->in_buffer_partial = 1;
                                     } else {
                                         processed = available;
                                     }
@@ -559,6 +726,7 @@ void ShubLoop(Shub* shub)
                                             }
                                             hdr = NULL; /* message is partly sent to the server: can not skip it any more */
                                             processed = 0;
+                                            shub->in_buffer_partial = 1;
                                         }
                                     } while (size != 0); /* repeat until all message body is received */
 
@@ -577,6 +745,7 @@ void ShubLoop(Shub* shub)
                                     }
                                     memmove(shub->in_buffer, shub->in_buffer + pos, available -= pos);
                                     pos = 0;
+                                    shub->in_buffer_partial = 0;
                                 } else {
                                     available -= pos;
                                 }
@@ -593,6 +762,9 @@ void ShubLoop(Shub* shub)
             }
             if (shub->in_buffer_used != 0) { /* if buffer is not empty... */
                 /* ...then send it */
+                if (shub->params->combine) {
+                    combine_requests(shub);
+                }
 #if SHOW_SENT_STATISTIC
                 static size_t total_sent;
                 static size_t total_count;
@@ -606,6 +778,7 @@ void ShubLoop(Shub* shub)
                     reconnect(shub);
                 }
                 shub->in_buffer_used = 0;
+                shub->in_buffer_partial = 0;
             }
         }
     }
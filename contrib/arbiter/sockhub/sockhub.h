@@ -12,6 +12,7 @@
 #else
 #include <sys/select.h>
 #endif
+#include <sys/uio.h>
 
 
 typedef struct {
@@ -23,7 +24,14 @@ typedef struct {
 enum ShubMessageCodes
 {
     MSG_DISCONNECT,
-    MSG_FIRST_USER_CODE /* all codes >= 1 are user defined */
+    MSG_FIRST_USER_CODE, /* all codes >= 1 are user defined */
+    /*
+     * Requests with this code and equal bodies sent by different clients in
+     * the same batch may be merged if ShubParams.combine is set: the body is
+     * followed by the channels of all but the first of them. The server
+     * should handle it as sent by each of them and reply to each of them.
+     */
+    MSG_COMBINE = 255
 };
 
 typedef enum 
@@ -52,8 +60,23 @@ typedef struct
     char const* file;
     host_t *leader;
     ShubErrorHandler error_handler;
+    int combine; /* merge MSG_COMBINE requests */
 } ShubParams;
    
+typedef struct
+{
+    int    chan;
+    struct iovec data;
+} ShubReply;
+
+typedef struct
+{
+    int    offs;        /* position in in_buffer */
+    int    next_merged; /* next request merged into the same one, -1 if none */
+    int    last_merged; /* last request merged into this one */
+    int    n_merged;    /* this request is merged into other one if -1 */
+} ShubRequest;
+
 typedef struct
 {
     int    output;
@@ -68,6 +91,13 @@ typedef struct
     char*  out_buffer;
     int    in_buffer_used;
     int    out_buffer_used;
+    ShubReply* replies;   /* replies received from server and not yet forwarded to local sockets */
+    int    n_replies;
+    int    in_buffer_partial; /* in_buffer starts in the middle of a message */
+    char*  combine_buffer; /* in_buffer with merged requests */
+    ShubRequest* requests; /* requests in in_buffer */
+    int*   chan_requests;  /* number of requests of each channel in in_buffer */
+    int    max_chan;
     ShubParams* params;
 } Shub;
 
@@ -75,6 +105,7 @@ typedef struct
 int ShubReadSocketEx(int sd, void* buf, int min_size, int max_size);
 int ShubReadSocket(int sd, void* buf, int size);
 int ShubWriteSocket(int sd, void const* buf, int size);
+int ShubWriteSocketv(int sd, struct iovec* iov, int iovcnt);
 
 void ShubInitParams(ShubParams* params);
 int  ShubParamsSetHosts(ShubParams* params, char* hoststring);
@@ -28,6 +28,9 @@ int main(int argc, char* argv[])
               case 'r':
                 params.max_attempts = atoi(argv[++i]);
                 continue;
+              case 'c':
+                params.combine = atoi(argv[++i]);
+                continue;
             }
         }
       Usage:
@@ -39,6 +42,7 @@ int main(int argc, char* argv[])
                 "\t-b SIZE\tbuffer size\n"
                 "\t-q SIZE\tlisten queue size\n"
                 "\t-r N\tmaximun connect attempts\n"
+                "\t-c 0|1\tmerge equal combinable requests of different clients\n"
              );
         
         return 1;
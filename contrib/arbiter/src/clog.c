@@ -9,6 +9,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "clog.h"
 #include "clogfile.h"
@@ -25,6 +26,18 @@ typedef struct clog_data_t {
 	char *datadir;
 
 	clogfile_chain_t *lastfile;
+
+	// The worker thread maps the next file ahead of time and removes the
+	// forgotten files, so that clog_write and clog_forget do not stall.
+	bool has_worker;
+	pthread_t worker;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool stop;
+	int nextid;      // the file to prepare, -1 if none
+	bool nextready;  // 'next' is prepared
+	clogfile_t next;
+	clogfile_chain_t *victims; // the files to remove
 } clog_data_t;
 
 static clogfile_chain_t *new_clogfile_chain(clogfile_t* file) {
@@ -87,6 +100,54 @@ static clogfile_chain_t *load_clogfile_chain(char *datadir) {
 	return head;
 }
 
+static void *clog_worker(void *arg) {
+	clog_t clog = arg;
+
+	pthread_mutex_lock(&clog->lock);
+	while (!clog->stop) {
+		if ((clog->nextid >= 0) && !clog->nextready) {
+			int fileid = clog->nextid;
+			clogfile_t file;
+			bool ok;
+
+			pthread_mutex_unlock(&clog->lock);
+			ok = clogfile_prepare_by_id(&file, clog->datadir, fileid);
+			pthread_mutex_lock(&clog->lock);
+
+			if (ok && (clog->nextid == fileid)) {
+				clog->next = file;
+				clog->nextready = true;
+			} else {
+				if (ok) {
+					clogfile_close(&file);
+				}
+				if (clog->nextid == fileid) {
+					// clog_write will create the file itself
+					clog->nextid = -1;
+				}
+			}
+			pthread_cond_broadcast(&clog->cond);
+		} else if (clog->victims) {
+			clogfile_chain_t *victim = clog->victims;
+			clog->victims = victim->prev;
+
+			pthread_mutex_unlock(&clog->lock);
+			if (!clogfile_remove(&victim->file)) {
+				shout(
+					"couldn't remove clogfile '%s'\n",
+					victim->file.path
+				);
+			}
+			free(victim);
+			pthread_mutex_lock(&clog->lock);
+		} else {
+			pthread_cond_wait(&clog->cond, &clog->lock);
+		}
+	}
+	pthread_mutex_unlock(&clog->lock);
+	return NULL;
+}
+
 // Open the clog at the specified path. Try not to open the same datadir twice
 // or in two different processes. Return a clog object on success, NULL
 // otherwise.
@@ -102,6 +163,18 @@ clog_t clog_open(char *datadir) {
 	clog->datadir = datadir;
 	clog->lastfile = lastfile;
 
+	pthread_mutex_init(&clog->lock, NULL);
+	pthread_cond_init(&clog->cond, NULL);
+	clog->stop = false;
+	clog->nextid = XID_TO_FILEID(lastfile->file.min) + 1;
+	clog->nextready = false;
+	clog->victims = NULL;
+	clog->has_worker = pthread_create(&clog->worker, NULL, clog_worker, clog) == 0;
+	if (!clog->has_worker) {
+		shout("cannot start the clog worker, the files will be created inline\n");
+		clog->nextid = -1;
+	}
+
 	return clog;
 }
 
@@ -133,6 +206,66 @@ int clog_read(clog_t clog, xid_t xid) {
 	}
 }
 
+// Get the statuses of 'n' global commits packed by 2 bits. The xids usually
+// come from a snapshot, so they are close and the file is looked up again
+// only when an xid is out of the previous file's range.
+void clog_read_packed(clog_t clog, xid_t *xids, int n, xid_t *packed) {
+	const int per_word = sizeof(xid_t) * 8 / BITS_PER_COMMIT;
+	clogfile_t *file = NULL;
+	int i;
+
+	memset(packed, 0, (n + per_word - 1) / per_word * sizeof(xid_t));
+	for (i = 0; i < n; i++) {
+		xid_t xid = xids[i];
+		if (!file || !inrange(file->min, xid, file->max)) {
+			file = clog_xid_to_file(clog, xid);
+			if (!file) {
+				shout(
+					"xid %016x status is out of range, "
+					"you might be experiencing a bug in backend\n",
+					xid
+				);
+				continue; // BLANK
+			}
+		}
+		packed[i / per_word] |= (xid_t)clogfile_get_status(file, xid) << (BITS_PER_COMMIT * (i % per_word));
+	}
+}
+
+// Take the file prepared by the worker if it is the one needed, and let the
+// worker prepare the file after it. Return 'true' if 'file' is taken.
+static bool clog_take_prepared(clog_t clog, int fileid, clogfile_t *file) {
+	bool taken = false;
+
+	pthread_mutex_lock(&clog->lock);
+	if (clog->nextid == fileid) {
+		while (!clog->nextready && (clog->nextid == fileid)) {
+			// the worker is late
+			pthread_cond_wait(&clog->cond, &clog->lock);
+		}
+	}
+	if (clog->nextready) {
+		if (clog->nextid == fileid) {
+			*file = clog->next;
+			taken = true;
+		} else {
+			clogfile_close(&clog->next);
+		}
+		clog->nextready = false;
+	}
+	if (clog->has_worker) {
+		clog->nextid = fileid + 1;
+		pthread_cond_broadcast(&clog->cond);
+	}
+	pthread_mutex_unlock(&clog->lock);
+
+	if (taken && !clogfile_install(file)) {
+		clogfile_close(file);
+		taken = false;
+	}
+	return taken;
+}
+
 // Set the status of the specified global commit. Return 'true' on success,
 // 'false' otherwise.
 bool clog_write(clog_t clog, xid_t xid, int status) {
@@ -141,13 +274,17 @@ bool clog_write(clog_t clog, xid_t xid, int status) {
 		clogfile_t newfile;
 		clogfile_chain_t *lastfile;
 
-		debug("xid %u out of range, creating the file\n", xid);
-		if (!clogfile_open_by_id(&newfile, clog->datadir, XID_TO_FILEID(xid), true)) {
-			shout(
-				"failed to create new clogfile "
-				"while saving transaction status\n"
-			);
-			return false;
+		if (clog_take_prepared(clog, XID_TO_FILEID(xid), &newfile)) {
+			debug("xid %u out of range, using the prepared file\n", xid);
+		} else {
+			debug("xid %u out of range, creating the file\n", xid);
+			if (!clogfile_open_by_id(&newfile, clog->datadir, XID_TO_FILEID(xid), true)) {
+				shout(
+					"failed to create new clogfile "
+					"while saving transaction status\n"
+				);
+				return false;
+			}
 		}
 
 		lastfile = new_clogfile_chain(&newfile);
@@ -162,8 +299,21 @@ bool clog_write(clog_t clog, xid_t xid, int status) {
 	return clogfile_set_status(file, xid, status);
 }
 
+// Make the status changes durable: all the changes since the previous call are
+// flushed at once. Return 'true' on success, 'false' otherwise.
+bool clog_sync(clog_t clog) {
+	bool ok = true;
+	clogfile_chain_t *cur;
+	for (cur = clog->lastfile; cur; cur = cur->prev) {
+		ok &= clogfile_sync(&cur->file);
+	}
+	return ok;
+}
+
 // Forget about the commits before the given one ('until'), and free the
-// occupied space if possible. Return 'true' on success, 'false' otherwise.
+// occupied space if possible. The files are removed by the worker, so the
+// failures are only reported to the log. Return 'true' on success, 'false'
+// otherwise.
 bool clog_forget(clog_t clog, xid_t until) {
 	clogfile_chain_t *cur = clog->lastfile;
 	while (cur->prev) {
@@ -171,6 +321,21 @@ bool clog_forget(clog_t clog, xid_t until) {
 			clogfile_chain_t *victim = cur->prev;
 			cur->prev = victim->prev;
 
+			pthread_mutex_lock(&clog->lock);
+			victim->prev = clog->victims;
+			clog->victims = victim;
+			pthread_cond_broadcast(&clog->cond);
+			pthread_mutex_unlock(&clog->lock);
+		} else {
+			cur = cur->prev;
+		}
+	}
+
+	if (!clog->has_worker) {
+		// nobody else will remove them
+		while (clog->victims) {
+			clogfile_chain_t *victim = clog->victims;
+			clog->victims = victim->prev;
 			if (!clogfile_remove(&victim->file)) {
 				shout(
 					"couldn't remove clogfile '%s'\n",
@@ -180,8 +345,6 @@ bool clog_forget(clog_t clog, xid_t until) {
 				return false;
 			}
 			free(victim);
-		} else {
-			cur = cur->prev;
 		}
 	}
 
@@ -191,6 +354,31 @@ bool clog_forget(clog_t clog, xid_t until) {
 // Close the specified clog. Do not use the clog object after closing. Return
 // 'true' on success, 'false' otherwise.
 bool clog_close(clog_t clog) {
+	if (clog->has_worker) {
+		pthread_mutex_lock(&clog->lock);
+		clog->stop = true;
+		pthread_cond_broadcast(&clog->cond);
+		pthread_mutex_unlock(&clog->lock);
+		pthread_join(clog->worker, NULL);
+	}
+	// the prepared file is left under the temporary name to be reused
+	if (clog->nextready) {
+		clogfile_close(&clog->next);
+	}
+	while (clog->victims) {
+		clogfile_chain_t *victim = clog->victims;
+		clog->victims = victim->prev;
+		if (!clogfile_remove(&victim->file)) {
+			shout(
+				"couldn't remove clogfile '%s'\n",
+				victim->file.path
+			);
+		}
+		free(victim);
+	}
+	pthread_mutex_destroy(&clog->lock);
+	pthread_cond_destroy(&clog->cond);
+
 	while (clog->lastfile) {
 		clogfile_chain_t *f = clog->lastfile;
 		clog->lastfile = f->prev;
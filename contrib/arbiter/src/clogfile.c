@@ -19,33 +19,32 @@ static char *clogfile_get_path(char *datadir, int fileid) {
 	return join_path(datadir, fileidstr);
 }
 
-// Open a clog file with the gived id. Create before opening if 'create' is
-// true. Return 'true' on success, 'false' otherwise.
-bool clogfile_open_by_id(clogfile_t *clogfile, char *datadir, int fileid, bool create) {
-	int fd;
+// The name of the file prepared by clogfile_prepare_by_id. It does not look
+// like a clog file, so it is ignored if left by a crash.
+static char *clogfile_get_tmp_path(clogfile_t *clogfile) {
+	char *path = malloc(strlen(clogfile->path) + 5);
+	sprintf(path, "%s.tmp", clogfile->path);
+	return path;
+}
 
+static void clogfile_init(clogfile_t *clogfile, char *datadir, int fileid) {
 	clogfile->path = clogfile_get_path(datadir, fileid);
 	clogfile->min = COMMITS_PER_FILE * fileid;
 	clogfile->max = clogfile->min + COMMITS_PER_FILE - 1;
+	clogfile->dirty_min = BYTES_PER_FILE;
+	clogfile->dirty_max = -1;
+}
 
-	if (create) {
-		fd = open(clogfile->path, O_RDWR | O_CREAT | O_EXCL, 0660);
-		if (fd == -1) {
-			shout("cannot create clog file '%s': %s\n", clogfile->path, strerror(errno));
-			return false;
-		}
-		debug("created clog file '%s'\n", clogfile->path);
-	} else {
-		fd = open(clogfile->path, O_RDWR);
-		if (fd == -1) {
-			shout("cannot open clog file '%s': %s\n", clogfile->path, strerror(errno));
-			return false;
-		}
-		debug("opened clog file '%s'\n", clogfile->path);
+static bool clogfile_map(clogfile_t *clogfile, char *path, int flags) {
+	int fd = open(path, flags, 0660);
+	if (fd == -1) {
+		shout("cannot %s clog file '%s': %s\n", (flags & O_CREAT) ? "create" : "open", path, strerror(errno));
+		return false;
 	}
+	debug("%s clog file '%s'\n", (flags & O_CREAT) ? "created" : "opened", path);
 
 	if (falloc(fd, BYTES_PER_FILE)) {
-		shout("cannot allocate clog file '%s': %s\n", clogfile->path, strerror(errno));
+		shout("cannot allocate clog file '%s': %s\n", path, strerror(errno));
 		close(fd);
 		return false;
 	}
@@ -59,12 +58,48 @@ bool clogfile_open_by_id(clogfile_t *clogfile, char *datadir, int fileid, bool c
 	close(fd);
 
 	if (clogfile->data == MAP_FAILED) {
-		shout("cannot mmap clog file '%s': %s\n", clogfile->path, strerror(errno));
+		shout("cannot mmap clog file '%s': %s\n", path, strerror(errno));
 		return false;
 	}
 	return true;
 }
 
+// Open a clog file with the gived id. Create before opening if 'create' is
+// true. Return 'true' on success, 'false' otherwise.
+bool clogfile_open_by_id(clogfile_t *clogfile, char *datadir, int fileid, bool create) {
+	clogfile_init(clogfile, datadir, fileid);
+	return clogfile_map(clogfile, clogfile->path, create ? O_RDWR | O_CREAT | O_EXCL : O_RDWR);
+}
+
+// Create and map a clog file with the given id under a temporary name, so
+// that it can be installed later without any delay. Return 'true' on
+// success, 'false' otherwise.
+bool clogfile_prepare_by_id(clogfile_t *clogfile, char *datadir, int fileid) {
+	bool ok;
+	char *tmppath;
+
+	clogfile_init(clogfile, datadir, fileid);
+	tmppath = clogfile_get_tmp_path(clogfile);
+	ok = clogfile_map(clogfile, tmppath, O_RDWR | O_CREAT | O_TRUNC);
+	free(tmppath);
+	return ok;
+}
+
+// Give the prepared clog file its permanent name, the mapping stays valid.
+// Fails if the file already exists. Return 'true' on success, 'false'
+// otherwise.
+bool clogfile_install(clogfile_t *clogfile) {
+	bool ok = true;
+	char *tmppath = clogfile_get_tmp_path(clogfile);
+
+	if (link(tmppath, clogfile->path) || unlink(tmppath)) {
+		shout("cannot install clog file '%s': %s\n", clogfile->path, strerror(errno));
+		ok = false;
+	}
+	free(tmppath);
+	return ok;
+}
+
 // Close and remove the given clog file. Return 'true' on success, 'false'
 // otherwise.
 bool clogfile_remove(clogfile_t *clogfile) {
@@ -101,11 +136,26 @@ bool clogfile_set_status(clogfile_t *clogfile, xid_t xid, int status) {
 	char *p = ((char*)clogfile->data + offset);
 	*p &= ~(COMMIT_MASK << (BITS_PER_COMMIT * suboffset));   // AND-out the old status
 	*p |= status << (BITS_PER_COMMIT * suboffset); // OR-in the new status
+	if (offset < clogfile->dirty_min) clogfile->dirty_min = offset;
+	if (offset > clogfile->dirty_max) clogfile->dirty_max = offset;
+	return true;
+}
+
+// Flush the pages changed since the last sync to the disk. Return 'true' on
+// success, 'false' otherwise.
+bool clogfile_sync(clogfile_t *clogfile) {
+	if (clogfile->dirty_min > clogfile->dirty_max) {
+		return true;
+	}
 	#ifdef SYNC
-	if (msync(clogfile->data, BYTES_PER_FILE, MS_SYNC)) {
+	off64_t pagesize = sysconf(_SC_PAGESIZE);
+	off64_t start = clogfile->dirty_min - clogfile->dirty_min % pagesize;
+	if (msync((char*)clogfile->data + start, clogfile->dirty_max + 1 - start, MS_SYNC)) {
 		shout("cannot msync clog file '%s': %s\n", clogfile->path, strerror(errno));
 		return false;
 	}
 	#endif
+	clogfile->dirty_min = BYTES_PER_FILE;
+	clogfile->dirty_max = -1;
 	return true;
 }
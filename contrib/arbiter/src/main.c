@@ -6,6 +6,8 @@
 #include <time.h>
 #include <signal.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/wait.h>
 
 #include "clog.h"
@@ -34,6 +36,39 @@ Transaction* transaction_hash[MAX_TRANSACTIONS];
 xid_t prev_gxid, next_gxid;
 xid_t global_xmin = INVALID_XID;
 
+/*
+ * Xids of the active transactions in ascending order. A new xid is always the
+ * greatest one, so it is appended, and a finished one is found by binary
+ * search. 'active_version' changes with the set of active transactions, so
+ * that the snapshot bounds are recalculated only when needed.
+ */
+static xid_t active_xids[MAX_TRANSACTIONS];
+static int nactive_xids;
+static unsigned active_version;
+
+static void activate_xid(xid_t xid) {
+	assert(nactive_xids < MAX_TRANSACTIONS);
+	assert((nactive_xids == 0) || (active_xids[nactive_xids - 1] < xid));
+	active_xids[nactive_xids++] = xid;
+	active_version++;
+}
+
+static void deactivate_xid(xid_t xid) {
+	int lo = 0, hi = nactive_xids;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (active_xids[mid] < xid) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	assert((lo < nactive_xids) && (active_xids[lo] == xid));
+	memmove(active_xids + lo, active_xids + lo + 1, sizeof(xid_t) * (nactive_xids - lo - 1));
+	nactive_xids--;
+	active_version++;
+}
+
 static Transaction *find_transaction(xid_t xid) {    
 	Transaction *t;    
 	for (t = transaction_hash[xid % MAX_TRANSACTIONS]; t != NULL && t->xid != xid; t = t->collision);
@@ -50,12 +85,31 @@ typedef struct client_userdata_t {
 	 */
 	Transaction *xpart; /* the transaction this client is participating in */
 	Transaction *xwait; /* the transaction this client is waiting for */
+
+	/*
+	 * The last snapshot sent to this client, used for delta encoding.
+	 * 'snapshot_seq' counts the snapshots sent, the client sends its own
+	 * counter to make sure that both sides have the same base snapshot.
+	 */
+	xid_t *last_active;
+	int last_nactive;
+	xid_t snapshot_seq;
 } client_userdata_t;
 
 clog_t clg;
 raft_t raft;
 bool use_raft;
 
+/*
+ * Raft runs in its own thread, so that heartbeats and elections are not
+ * delayed by the client processing. The main thread still applies the acked
+ * updates and notifies the clients, so transactions and clients are never
+ * shared between threads. The raft thread wakes the main thread up through
+ * the 'raft_wakeup' pipe, 'raft_lock' protects the 'raft' structure.
+ */
+static pthread_mutex_t raft_lock = PTHREAD_MUTEX_INITIALIZER;
+static int raft_wakeup[2];
+
 #define CLIENT_USERDATA(CLIENT) ((client_userdata_t*)client_get_userdata(CLIENT))
 #define CLIENT_ID(CLIENT) (CLIENT_USERDATA(CLIENT)->id)
 #define CLIENT_SNAPSENT(CLIENT) (CLIENT_USERDATA(CLIENT)->snapshots_sent)
@@ -68,10 +122,14 @@ static client_userdata_t *create_client_userdata(int id) {
 	cd->snapshots_sent = 0;
 	cd->xpart = NULL;
 	cd->xwait = NULL;
+	cd->last_active = NULL;
+	cd->last_nactive = 0;
+	cd->snapshot_seq = 0;
 	return cd;
 }
 
 static void free_client_userdata(client_userdata_t *cd) {
+	free(cd->last_active);
 	free(cd);
 }
 
@@ -81,6 +139,7 @@ inline static void free_transaction(Transaction* t) {
 	for (tpp = &transaction_hash[t->xid % MAX_TRANSACTIONS]; *tpp != t; tpp = &(*tpp)->collision);
 	*tpp = t->collision;
 	l2_list_unlink(&t->elem);
+	deactivate_xid(t->xid);
 	t->elem.next = free_transactions;
 	free_transactions = &t->elem;
 	if (t->xmin == global_xmin) { 
@@ -157,6 +216,25 @@ static void apply_clog_update(int action, int argument) {
 	}
 }
 
+/* Called by the main thread to replicate a status change. */
+static void emit_clog_update(int status, xid_t xid) {
+	pthread_mutex_lock(&raft_lock);
+	if (raft.role == ROLE_LEADER) {
+		raft_emit(&raft, status, xid);
+	}
+	pthread_mutex_unlock(&raft_lock);
+}
+
+/*
+ * Called before sending the replies: all the status changes made during the
+ * server tick are flushed to the disk at once.
+ */
+static void sync_clog(void) {
+	if (!clog_sync(clg)) {
+		shout("failed to sync the clog\n");
+	}
+}
+
 static int next_client_id = 0;
 static void onconnect(client_t client) {
 	client_userdata_t *cd = create_client_userdata(next_client_id++);
@@ -171,9 +249,7 @@ static void ondisconnect(client_t client) {
 	if ((t = CLIENT_XPART(client))) {
 		transaction_remove_listener(t, 's', client);
 		if (use_raft) {
-			if (raft.role == ROLE_LEADER) {
-				raft_emit(&raft, NEGATIVE, t->xid);
-			}
+			emit_clog_update(NEGATIVE, t->xid);
 		} else {
 			apply_clog_update(NEGATIVE, t->xid);
 		}
@@ -199,6 +275,7 @@ static void debug_cmd(client_t client, int argc, xid_t *argv) {
 		case CMD_AGAINST : cmdname =  "AGAINST"; break;
 		case CMD_SNAPSHOT: cmdname = "SNAPSHOT"; break;
 		case CMD_STATUS  : cmdname =   "STATUS"; break;
+		case CMD_STATUSES: cmdname = "STATUSES"; break;
 		case CMD_DEADLOCK: cmdname = "DEADLOCK"; break;
 		default          : cmdname =  "unknown";
 	}
@@ -225,35 +302,129 @@ static void debug_cmd(client_t client, int argc, xid_t *argv) {
 #define CHECKLEADER(CLIENT) \
 	CHECK(!use_raft || (raft.role == ROLE_LEADER), CLIENT, "not a leader")
 
+/*
+ * Reads are served from the local state without a raft round if this server
+ * holds the lease. Followers may only serve the requests which do not
+ * depend on the transactions state kept by the leader.
+ */
+static bool has_lease(bool follower_ok) {
+	bool ok;
+	if (!use_raft) {
+		return true;
+	}
+	pthread_mutex_lock(&raft_lock);
+	ok = raft_has_lease(&raft) && (follower_ok || (raft.role == ROLE_LEADER));
+	pthread_mutex_unlock(&raft_lock);
+	return ok;
+}
+
+#define CHECKLEASE(CLIENT, FOLLOWER_OK) \
+	CHECK(has_lease(FOLLOWER_OK), CLIENT, "no lease")
+
 static xid_t max_of_xids(xid_t a, xid_t b) {
 	return a > b ? a : b;
 }
 
 static void gen_snapshot(Snapshot *s) {
-	Transaction* t;
-    int n = 0;
+	static Snapshot bounds; /* 'active' is not used */
+	static unsigned bounds_version = ~0;
+
+	if (bounds_version != active_version) {
+		int n = nactive_xids;
+		while (n > 1 && active_xids[n-2]+1 == active_xids[n-1]) { 
+			n -= 1;
+		}
+		if (n > 0) {
+			bounds.xmin = active_xids[0];
+			bounds.xmax = active_xids[--n];
+			assert(bounds.xmin <= bounds.xmax);
+		} else {
+			bounds.xmin = bounds.xmax = 0;
+		} 
+		bounds.nactive = n;
+		bounds_version = active_version;
+	}
+
 	s->times_sent = 0;
-	for (t = (Transaction*)active_transactions.prev; t != (Transaction*)&active_transactions; t = (Transaction*)t->elem.prev) {
-		s->active[n++] = t->xid;
+	s->xmin = bounds.xmin;
+	s->xmax = bounds.xmax;
+	s->nactive = bounds.nactive;
+	memcpy(s->active, active_xids, sizeof(xid_t) * s->nactive);
+}
+
+/*
+ * Appends the snapshot to the message. If 'base_seq' is not zero, the client
+ * supports delta encoding and has the snapshot number 'base_seq' as the last
+ * one received. If it matches the last snapshot we sent to this client, only
+ * the difference is sent:
+ *
+ *   xmin, xmax, nremoved, removed xids..., added xids...
+ *
+ * otherwise (or if the difference is not shorter) the full snapshot is sent
+ * with nremoved == SNAPSHOT_FULL:
+ *
+ *   xmin, xmax, SNAPSHOT_FULL, active xids...
+ *
+ * Clients which do not support delta encoding get xmin, xmax, active xids.
+ * Active xids are always sorted, because they are listed in the order of
+ * transaction begin.
+ */
+static void append_snapshot(client_t client, Snapshot *snap, bool delta, xid_t base_seq) {
+	client_userdata_t *cd = CLIENT_USERDATA(client);
+	static xid_t diff[MAX_TRANSACTIONS * 2];
+	xid_t nremoved = 0;
+	int nadded = 0;
+	int i, j;
+
+	client_message_append(client, sizeof(xid_t), &snap->xmin);
+	client_message_append(client, sizeof(xid_t), &snap->xmax);
+
+	if (!delta) {
+		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		return;
 	}
-	while (n > 1 && s->active[n-2]+1 == s->active[n-1]) { 
-		n -= 1;
+
+	if (base_seq != 0 && base_seq == cd->snapshot_seq) {
+		/* removed xids go to the beginning of 'diff', added ones to the end */
+		for (i = 0, j = 0; i < cd->last_nactive || j < snap->nactive;) {
+			if (j == snap->nactive || (i < cd->last_nactive && cd->last_active[i] < snap->active[j])) {
+				diff[nremoved++] = cd->last_active[i++];
+			} else if (i == cd->last_nactive || snap->active[j] < cd->last_active[i]) {
+				diff[MAX_TRANSACTIONS * 2 - 1 - nadded++] = snap->active[j++];
+			} else {
+				i += 1;
+				j += 1;
+			}
+		}
 	}
-	if (n > 0) {
-        s->xmin = s->active[0];
-        s->xmax = s->active[--n];
-		assert(s->xmin <= s->xmax);
+
+	if (base_seq == 0 || base_seq != cd->snapshot_seq || nremoved + nadded >= snap->nactive) {
+		xid_t full = SNAPSHOT_FULL;
+		client_message_append(client, sizeof(xid_t), &full);
+		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		cd->snapshot_seq = 0; /* the full snapshot is number 1 for both sides */
 	} else {
-		s->xmin = s->xmax = 0;
-	} 
-	s->nactive = n;
+		client_message_append(client, sizeof(xid_t), &nremoved);
+		client_message_append(client, sizeof(xid_t) * nremoved, diff);
+		for (i = 0; i < nadded; i++) {
+			client_message_append(client, sizeof(xid_t), &diff[MAX_TRANSACTIONS * 2 - 1 - i]);
+		}
+	}
+
+	if (cd->last_active == NULL) {
+		cd->last_active = malloc(sizeof(xid_t) * MAX_TRANSACTIONS);
+	}
+	memcpy(cd->last_active, snap->active, sizeof(xid_t) * snap->nactive);
+	cd->last_nactive = snap->nactive;
+	cd->snapshot_seq += 1;
 }
 
 static void onhello(client_t client, int argc, xid_t *argv) {
-	CHECK(argc == 1, client, "HELLO: wrong number of arguments");
+	CHECK((argc == 1) || (argc == 2), client, "HELLO: wrong number of arguments");
+	bool readonly = (argc == 2) && argv[1];
 
-	debug("[%d] HELLO\n", CLIENT_ID(client));
-	if (raft.role == ROLE_LEADER) {
+	debug("[%d] HELLO%s\n", CLIENT_ID(client), readonly ? " READONLY" : "");
+	if ((raft.role == ROLE_LEADER) || (readonly && has_lease(true))) {
 		client_message_shortcut(client, RES_OK);
 	} else {
 		client_message_shortcut(client, RES_FAILED);
@@ -294,7 +465,11 @@ static void set_next_gxid(xid_t value) {
 		assert(xid_is_safe(value));
 		if (xid_is_disturbing(value)) {
 			/* Time to worry has come. */
-			raft_ensure_term(&raft, xid2term(value));
+			pthread_mutex_lock(&raft_lock);
+			if (raft.role == ROLE_LEADER) {
+				raft_ensure_term(&raft, xid2term(value));
+			}
+			pthread_mutex_unlock(&raft_lock);
 		} else {
 			/*
 			 * It is either too early to worry,
@@ -374,21 +549,23 @@ static void onreserve(client_t client, int argc, xid_t *argv) {
 	client_message_finish(client);
 }
 
+/*
+ * The xmin of a transaction is the oldest active xid at its begin, so xmins
+ * grow in the begin order, and the oldest active transaction has the least.
+ */
 static xid_t get_global_xmin() {
-	xid_t xmin = next_gxid;
-	Transaction *t;
-	for (t = (Transaction*)active_transactions.next; t != (Transaction*)&active_transactions; t = (Transaction*)t->elem.next) {
-		if (t->xmin < xmin) { 
-			xmin = t->xmin;
-		}
+	if (nactive_xids == 0) {
+		return next_gxid;
 	}
-	return xmin;
+	Transaction *t = find_transaction(active_xids[0]);
+	assert(t != NULL);
+	return t->xmin;
 }
 
 static void onbegin(client_t client, int argc, xid_t *argv) {
 	Transaction *t;
 	CHECK(
-		(argc == 1) || (argc == 2),
+		(argc == 1) || (argc == 2) || (argc == 4),
 		client,
 		"BEGIN: wrong number of arguments"
 	);
@@ -414,10 +591,11 @@ static void onbegin(client_t client, int argc, xid_t *argv) {
 		client,
 		"not enought xids left in this term"
 	);
+	activate_xid(t->xid);
 	prev_gxid = t->xid;
 	t->snapshots_count = 0;
 
-	if (argc == 2) {
+	if (argc >= 2 && argv[1] != 0) {
 		t->size = argv[1];
 		t->fixed_size = true;
 	} else {
@@ -454,9 +632,7 @@ static void onbegin(client_t client, int argc, xid_t *argv) {
 		client_message_append(client, sizeof(xid_t), &ok);
 		client_message_append(client, sizeof(xid_t), &t->xid);
 		client_message_append(client, sizeof(xid_t), &global_xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmax);
-		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		append_snapshot(client, snap, argc == 4, argc == 4 ? argv[3] : 0);
 	} client_message_finish(client);
 }
 
@@ -530,7 +706,7 @@ static void onvote(client_t client, int argc, xid_t *argv, int vote) {
 					client,
 					"VOTE: couldn't queue for transaction finish"
 				);
-				raft_emit(&raft, s, t->xid);
+				emit_clog_update(s, t->xid);
 			} else {
 				apply_clog_update(s, t->xid);
 				if (s == POSITIVE) {
@@ -557,11 +733,44 @@ static void onvote(client_t client, int argc, xid_t *argv, int vote) {
 	client_message_shortcut(client, RES_FAILED);
 }
 
+/*
+ * The sockhub merges equal votes of its clients into one message followed by
+ * the channels of the other voters. Each of them gets its own reply.
+ */
+static void onvotes(client_t client, int argc, xid_t *argv, int vote) {
+	int i;
+
+	CHECK(
+		argc >= 3,
+		client,
+		"VOTE: wrong number of arguments"
+	);
+
+	for (i = 3; i < argc; i++) {
+		client_t sibling = client_get_sibling(client, argv[i]);
+		if (sibling == NULL) {
+			shout(
+				"[%d] VOTE: merged voter chan=%u not found\n",
+				CLIENT_ID(client), argv[i]
+			);
+			continue;
+		}
+		if (use_raft && (raft.role != ROLE_LEADER)) {
+			client_message_shortcut(sibling, RES_FAILED);
+		} else {
+			onvote(sibling, 3, argv, vote);
+		}
+	}
+
+	CHECKLEADER(client);
+	onvote(client, 3, argv, vote);
+}
+
 static void onsnapshot(client_t client, int argc, xid_t *argv) {
 	Snapshot snapshot_now;
 
 	CHECK(
-		argc == 2,
+		(argc == 2) || (argc == 4),
 		client,
 		"SNAPSHOT: wrong number of arguments"
 	);
@@ -606,9 +815,7 @@ static void onsnapshot(client_t client, int argc, xid_t *argv) {
 	client_message_start(client); {
 		client_message_append(client, sizeof(xid_t), &ok);
 		client_message_append(client, sizeof(xid_t), &global_xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmin);
-		client_message_append(client, sizeof(xid_t), &snap->xmax);
-		client_message_append(client, sizeof(xid_t) * snap->nactive, snap->active);
+		append_snapshot(client, snap, argc == 4, argc == 4 ? argv[3] : 0);
 	} client_message_finish(client);
 }
 
@@ -637,6 +844,8 @@ static void onstatus(client_t client, int argc, xid_t *argv) {
 			return;
 		case DOUBT:
 			if (wait) {
+				/* only the leader knows the transactions to wait for */
+				CHECKLEADER(client);
 				if (!queue_for_transaction_finish(client, xid, 's')) {
 					shout(
 						"[%d] STATUS: couldn't queue for transaction finish\n",
@@ -657,6 +866,31 @@ static void onstatus(client_t client, int argc, xid_t *argv) {
 	}
 }
 
+/*
+ * Reply to the vector of xids with their statuses packed by 2 bits, so that
+ * the client can check all the xids of its snapshot in one round trip.
+ */
+static void onstatuses(client_t client, int argc, xid_t *argv) {
+	static xid_t packed[MAX_STATUSES / STATUSES_PER_WORD];
+	int n = argc - 1;
+	xid_t ok = RES_OK;
+
+	if (n > MAX_STATUSES) {
+		shout(
+			"[%d] STATUSES: too many xids %d, expected <= %d\n",
+			CLIENT_ID(client), n, MAX_STATUSES
+		);
+		client_message_shortcut(client, RES_FAILED);
+		return;
+	}
+
+	clog_read_packed(clg, argv + 1, n, packed);
+	client_message_start(client); {
+		client_message_append(client, sizeof(xid_t), &ok);
+		client_message_append(client, (n + STATUSES_PER_WORD - 1) / STATUSES_PER_WORD * sizeof(xid_t), packed);
+	} client_message_finish(client);
+}
+
 static void onnoise(client_t client, int argc, xid_t *argv) {
 	shout(
 		"[%d] NOISE: unknown command '%c' (%d)\n",
@@ -707,21 +941,23 @@ static void oncmd(client_t client, int argc, xid_t *argv) {
 			onbegin(client, argc, argv);
 			break;
 		case CMD_FOR:
-			CHECKLEADER(client);
-			onvote(client, argc, argv, POSITIVE);
+			onvotes(client, argc, argv, POSITIVE);
 			break;
 		case CMD_AGAINST:
-			CHECKLEADER(client);
-			onvote(client, argc, argv, NEGATIVE);
+			onvotes(client, argc, argv, NEGATIVE);
 			break;
 		case CMD_SNAPSHOT:
-			CHECKLEADER(client);
+			CHECKLEASE(client, false);
 			onsnapshot(client, argc, argv);
 			break;
 		case CMD_STATUS:
-			CHECKLEADER(client);
+			CHECKLEASE(client, true);
 			onstatus(client, argc, argv);
 			break;
+		case CMD_STATUSES:
+			CHECKLEASE(client, true);
+			onstatuses(client, argc, argv);
+			break;
 		case CMD_DEADLOCK:
 			ondeadlock(client, argc, argv);
 			break;
@@ -742,13 +978,14 @@ static void onmessage(client_t client, size_t len, char *data) {
 
 static void usage(char *prog) {
 	printf(
-		"Usage: %s -i ID -r HOST:PORT [-r HOST:PORT ...] [-d DATADIR] [-k] [-l LOGFILE]\n"
+		"Usage: %s -i ID -r HOST:PORT [-r HOST:PORT ...] [-d DATADIR] [-k] [-u] [-l LOGFILE]\n"
 		"   arbiter will try to kill the other one running at\n"
 		"   the same DATADIR.\n"
 		"   -r : Listen on the HOST and PORT. Specify multiple times to enable Raft protocol.\n"
 		"   -i : A number to distinguish this instance among the Raft peers.\n"
 		"   -l : Run as a daemon and write output to LOGFILE.\n"
-		"   -k : Just kill the other arbiter and exit.\n",
+		"   -k : Just kill the other arbiter and exit.\n"
+		"   -u : Wait for all Raft peers to ack an update instead of the majority.\n",
 		prog
 	);
 }
@@ -849,7 +1086,7 @@ bool configure(int argc, char **argv) {
     initGraph(&graph);
 
 	int opt;
-	while ((opt = getopt(argc, argv, "hd:i:r:l:k")) != -1) {
+	while ((opt = getopt(argc, argv, "hd:i:r:l:ku")) != -1) {
 		char *host;
 		char *portstr;
 		int port;
@@ -880,6 +1117,9 @@ bool configure(int argc, char **argv) {
 			case 'k':
 				assassin = true;
 				break;
+			case 'u':
+				raft.unanimous = true;
+				break;
 			default:
 				usage(argv[0]);
 				return false;
@@ -915,6 +1155,49 @@ bool redirect_output() {
 	return true;
 }
 
+static void *raft_main(void *arg) {
+	mstimer_t t;
+	mstimer_reset(&t);
+	while (true) {
+		/* The raft socket has a receive timeout of HEARTBEAT_TIMEOUT_MS. */
+		raft_msg_t *m = raft_recv_message(&raft);
+
+		pthread_mutex_lock(&raft_lock);
+		int acked = raft.log.acked;
+		int role = raft.role;
+		int term = raft.term;
+		raft_tick(&raft, mstimer_reset(&t));
+		if (m) {
+			raft_handle_message(&raft, m);
+		}
+		bool changed = (acked != raft.log.acked) || (role != raft.role) || (term != raft.term);
+		pthread_mutex_unlock(&raft_lock);
+
+		/* The pipe is nonblocking: if it is full, the main thread is awake anyway. */
+		if (changed && (write(raft_wakeup[1], "", 1) == -1) && (errno != EAGAIN)) {
+			shout("failed to wake up the main thread: %s\n", strerror(errno));
+		}
+	}
+	return NULL;
+}
+
+static bool start_raft_thread(server_t server) {
+	pthread_t thread;
+	if (pipe(raft_wakeup) == -1) {
+		shout("cannot create the raft wakeup pipe: %s\n", strerror(errno));
+		return false;
+	}
+	fcntl(raft_wakeup[0], F_SETFL, O_NONBLOCK);
+	fcntl(raft_wakeup[1], F_SETFL, O_NONBLOCK);
+	server_set_raft_socket(server, raft_wakeup[0]);
+
+	if (pthread_create(&thread, NULL, raft_main, NULL) != 0) {
+		shout("cannot start the raft thread\n");
+		return false;
+	}
+	return true;
+}
+
 int main(int argc, char **argv) {
 	if (!configure(argc, argv)) return EXIT_FAILURE;
 
@@ -965,44 +1248,56 @@ int main(int argc, char **argv) {
 		onmessage, onconnect, ondisconnect
 	);
 
-	server_set_raft_socket(server, raftsock);
+	server_set_onflush(server, sync_clog);
 
 	if (!server_start(server)) {
 		return EXIT_FAILURE;
 	}
 
-	mstimer_t t;
-	mstimer_reset(&t);
+	if (use_raft && !start_raft_thread(server)) {
+		die(EXIT_FAILURE);
+	}
+
 	int old_term = 0;
+	int old_role = ROLE_FOLLOWER;
 	while (true) {
-		int ms = mstimer_reset(&t);
-		raft_msg_t *m = NULL;
-
-		if (use_raft) {
-			raft_tick(&raft, ms);
-		}
-
 		/* The client interaction is done in server_tick. */
 		if (server_tick(server, HEARTBEAT_TIMEOUT_MS)) {
-			m = raft_recv_message(&raft);
-			assert(m); /* m should not be NULL, because the message should be ready to recv */
+			char buf[64];
+			while (read(raft_wakeup[0], buf, sizeof(buf)) > 0);
 		}
 
 		if (use_raft) {
+			pthread_mutex_lock(&raft_lock);
+			/* Replicate all the updates emitted during server_tick at once. */
+			if (raft.role == ROLE_LEADER) {
+				raft_flush(&raft);
+			}
+
 			int applied = raft_apply(&raft, apply_clog_update);
+			int role = raft.role;
+			int term = raft.term;
+			pthread_mutex_unlock(&raft_lock);
+
 			if (applied) {
 				debug("applied %d updates\n", applied);
 			}
 
-			if (m) {
-				raft_handle_message(&raft, m);
+			/*
+			 * Disabling the server disconnects the clients, which emits
+			 * updates. It is done on losing the leadership, so that the
+			 * clients go to the new leader. Followers stay enabled to
+			 * serve status requests under the lease.
+			 */
+			if (old_role == ROLE_LEADER && role != ROLE_LEADER) {
+				server_set_enabled(server, false);
 			}
-
-			server_set_enabled(server, raft.role == ROLE_LEADER);
+			server_set_enabled(server, role != ROLE_CANDIDATE);
+			old_role = role;
 
 			/* Update the gxid limits based on current term and leadership. */
-			if (old_term < raft.term) {
-				if (raft.role == ROLE_FOLLOWER) {
+			if (old_term < term) {
+				if (role == ROLE_FOLLOWER) {
 					/*
 					 * If we become a leader, we will use
 					 * the range of xids after the current
@@ -1012,7 +1307,7 @@ int main(int argc, char **argv) {
 					set_next_gxid(prev_gxid + 1);
 					shout("updated range to %u-%u\n", prev_gxid, next_gxid);
 				}
-				old_term = raft.term;
+				old_term = term;
 			}
 		} else {
 			server_set_enabled(server, true);
@@ -2,6 +2,7 @@
 #include <errno.h>
 #include <string.h>
 #include <limits.h>
+#include <stddef.h>
 
 #include "raft.h"
 #include "util.h"
@@ -10,6 +11,7 @@ static void raft_server_init(raft_server_t *s) {
 	s->seqno = 0;
 	s->tosend = 0;
 	s->acked = 0;
+	s->heard = INT_MAX;
 
 	s->host = DEFAULT_LISTENHOST;
 	s->port = DEFAULT_LISTENPORT;
@@ -79,15 +81,20 @@ void raft_init(raft_t *r) {
 	r->log.applied = 0;
 
 	r->servernum = 0;
+	r->heard = INT_MAX;
+
+	r->unanimous = false;
+	r->pending.nupdates = 0;
 }
 
 int raft_apply(raft_t *r, raft_applier_t applier) {
 	int applied_now = 0;
 	while (r->log.acked > r->log.applied) {
-		applier(
-			RAFT_LOG(r, r->log.applied).action,
-			RAFT_LOG(r, r->log.applied).argument
-		);
+		raft_entry_t *e = &RAFT_LOG(r, r->log.applied);
+		int i;
+		for (i = 0; i < e->nupdates; i++) {
+			applier(e->updates[i].action, e->updates[i].argument);
+		}
 		r->log.applied++;
 		applied_now++;
 	}
@@ -152,10 +159,21 @@ int raft_create_udp_socket(raft_t *r) {
 	return r->sock;
 }
 
+// only the used part of the entry is sent
+static int update_msg_size(raft_msg_update_t *m) {
+	int nupdates = (m->empty || m->entry.snapshot) ? 0 : m->entry.nupdates;
+	return offsetof(raft_msg_update_t, entry.updates) + nupdates * sizeof(raft_update_t);
+}
+
 static bool msg_size_is(raft_msg_t *m, int mlen) {
+	raft_msg_update_t *u = (raft_msg_update_t *)m;
 	switch (m->msgtype) {
 		case RAFT_MSG_UPDATE:
-			return mlen == sizeof(raft_msg_update_t);
+			if (mlen < offsetof(raft_msg_update_t, entry.updates)) return false;
+			if (!u->empty && !u->entry.snapshot) {
+				if ((u->entry.nupdates < 0) || (u->entry.nupdates > RAFT_BATCH_SIZE)) return false;
+			}
+			return mlen == update_msg_size(u);
 		case RAFT_MSG_DONE:
 			return mlen == sizeof(raft_msg_done_t);
 		case RAFT_MSG_CLAIM:
@@ -189,20 +207,7 @@ static void raft_send(raft_t *r, int dst, void *m, int mlen) {
 	}
 }
 
-static void raft_beat(raft_t *r, int dst) {
-	if (dst == NOBODY) {
-		// send a beat/update to everybody
-		int i;
-		for (i = 0; i < r->servernum; i++) {
-			if (i == r->me) continue;
-			raft_beat(r, i);
-		}
-		return;
-	}
-
-	assert(r->role == ROLE_LEADER);
-	assert(r->leader == r->me);
-
+static void raft_send_update(raft_t *r, int dst, int index) {
 	raft_server_t *s = r->servers + dst;
 
 	raft_msg_update_t m;
@@ -211,16 +216,16 @@ static void raft_beat(raft_t *r, int dst) {
 	m.msg.term = r->term;
 	m.msg.from = r->me;
 
-	if (s->tosend < r->log.first + r->log.size) {
-		raft_entry_t *e = &RAFT_LOG(r, s->tosend);
+	if (index < r->log.first + r->log.size) {
+		raft_entry_t *e = &RAFT_LOG(r, index);
 		if (e->snapshot) {
 			// TODO: implement snapshot sending
-			shout("tosend = %d, first = %d, size = %d\n", s->tosend, r->log.first, r->log.size);
+			shout("tosend = %d, first = %d, size = %d\n", index, r->log.first, r->log.size);
 			assert(false); // snapshot sending not implemented
 		}
 
 		// the follower is a bit behind: send an update
-		m.previndex = s->tosend - 1;
+		m.previndex = index - 1;
 		if (m.previndex >= 0) {
 			m.prevterm = RAFT_LOG(r, m.previndex).term;
 		} else {
@@ -237,10 +242,49 @@ static void raft_beat(raft_t *r, int dst) {
 	s->seqno++;
 	m.msg.seqno = s->seqno;
 	if (!m.empty) {
-		debug("[to %d] update with seqno = %d, tosend = %d, previndex = %d\n", dst, m.msg.seqno, s->tosend, m.previndex);
+		debug("[to %d] update with seqno = %d, tosend = %d, previndex = %d\n", dst, m.msg.seqno, index, m.previndex);
 	}
 
-	raft_send(r, dst, &m, sizeof(m));
+	raft_send(r, dst, &m, update_msg_size(&m));
+}
+
+/*
+ * Send the entries to the follower without waiting for each ack, keeping at
+ * most RAFT_PIPELINE_DEPTH of them in flight. Since udp messages can be lost,
+ * on 'retransmit' everything not acked yet is sent again, or just a heartbeat
+ * if the follower is up to date.
+ */
+static void raft_beat(raft_t *r, int dst, bool retransmit) {
+	if (dst == NOBODY) {
+		// send a beat/update to everybody
+		int i;
+		for (i = 0; i < r->servernum; i++) {
+			if (i == r->me) continue;
+			raft_beat(r, i, retransmit);
+		}
+		return;
+	}
+
+	assert(r->role == ROLE_LEADER);
+	assert(r->leader == r->me);
+
+	raft_server_t *s = r->servers + dst;
+
+	if (retransmit) {
+		s->tosend = s->acked;
+		if (s->tosend >= r->log.first + r->log.size) {
+			raft_send_update(r, dst, s->tosend);
+			return;
+		}
+	}
+
+	while (
+		(s->tosend < r->log.first + r->log.size) &&
+		(s->tosend < s->acked + RAFT_PIPELINE_DEPTH)
+	) {
+		raft_send_update(r, dst, s->tosend);
+		s->tosend++;
+	}
 }
 
 static void raft_claim(raft_t *r) {
@@ -273,7 +317,21 @@ static void raft_claim(raft_t *r) {
 	}
 }
 
+static void add_to_heard(int *heard, int msec) {
+	if (*heard < INT_MAX - msec) {
+		*heard += msec;
+	} else {
+		*heard = INT_MAX;
+	}
+}
+
 void raft_tick(raft_t *r, int msec) {
+	int i;
+	add_to_heard(&r->heard, msec);
+	for (i = 0; i < r->servernum; i++) {
+		add_to_heard(&r->servers[i].heard, msec);
+	}
+
 	r->timer -= msec;
 	if (r->timer < 0) {
 		switch (r->role) {
@@ -296,7 +354,7 @@ void raft_tick(raft_t *r, int msec) {
 				raft_claim(r);
 				break;
 			case ROLE_LEADER:
-				raft_beat(r, NOBODY);
+				raft_beat(r, NOBODY, true);
 				break;
 		}
 		raft_reset_timer(r);
@@ -318,8 +376,11 @@ static int raft_log_compact(raft_log_t *l, int keep_applied) {
 			snap.minarg = min(snap.minarg, e->minarg);
 			snap.maxarg = max(snap.maxarg, e->maxarg);
 		} else {
-			snap.minarg = min(snap.minarg, e->argument);
-			snap.maxarg = max(snap.maxarg, e->argument);
+			int j;
+			for (j = 0; j < e->nupdates; j++) {
+				snap.minarg = min(snap.minarg, e->updates[j].argument);
+				snap.maxarg = max(snap.maxarg, e->updates[j].argument);
+			}
 		}
 		compacted++;
 	}
@@ -332,10 +393,34 @@ static int raft_log_compact(raft_log_t *l, int keep_applied) {
 	return compacted;
 }
 
+/*
+ * Add the update to the pending entry. The entry is appended to the log and
+ * replicated by raft_flush, so all updates emitted in between share a single
+ * replication round.
+ */
 bool raft_emit(raft_t *r, int action, int argument) {
 	assert(r->leader == r->me);
 	assert(r->role == ROLE_LEADER);
 
+	if ((r->pending.nupdates == RAFT_BATCH_SIZE) && !raft_flush(r)) {
+		return false;
+	}
+
+	raft_update_t *u = r->pending.updates + r->pending.nupdates;
+	u->action = action;
+	u->argument = argument;
+	r->pending.nupdates++;
+	return true;
+}
+
+bool raft_flush(raft_t *r) {
+	assert(r->leader == r->me);
+	assert(r->role == ROLE_LEADER);
+
+	if (r->pending.nupdates == 0) {
+		return true;
+	}
+
 	if (r->log.size == RAFT_LOGLEN) {
 		int compacted = raft_log_compact(&r->log, RAFT_KEEP_APPLIED);
 		if (compacted > 1) {
@@ -350,13 +435,13 @@ bool raft_emit(raft_t *r, int action, int argument) {
 	}
 
 	raft_entry_t *e = &RAFT_LOG(r, r->log.first + r->log.size);
+	*e = r->pending;
 	e->snapshot = false;
 	e->term = r->term;
-	e->action = action;
-	e->argument = argument;
 	r->log.size++;
+	r->pending.nupdates = 0;
 
-	raft_beat(r, NOBODY);
+	raft_beat(r, NOBODY, false);
 	raft_reset_timer(r);
 	return true;
 }
@@ -367,9 +452,9 @@ static bool log_append(raft_log_t *l, int previndex, int prevterm, raft_entry_t
 	}
 	debug(
 		"log_append(%p, previndex=%d, prevterm=%d,"
-		" term=%d, action=%d, argument=%d)\n",
+		" term=%d, nupdates=%d)\n",
 		l, previndex, prevterm,
-		e->term, e->action, e->argument
+		e->term, e->nupdates
 	);
 	if (previndex != -1) {
 		if (previndex < l->first) {
@@ -439,6 +524,7 @@ static void raft_handle_update(raft_t *r, raft_msg_update_t *m) {
 		reply.term = -1;
 	}
 	reply.success = false;
+	reply.beat = false;
 
 	// the message is too old
 	if (m->msg.term < r->term) {
@@ -452,6 +538,7 @@ static void raft_handle_update(raft_t *r, raft_msg_update_t *m) {
 	}
 
 	raft_reset_timer(r);
+	r->heard = 0;
 
 	if (m->acked > r->log.acked) {
 		r->log.acked = min(
@@ -463,15 +550,16 @@ static void raft_handle_update(raft_t *r, raft_msg_update_t *m) {
 	}
 
 	if (m->empty) {
-		// just a hearbeat
-		return;
+		// just a hearbeat, the reply lets the leader keep the lease
+		reply.beat = true;
+		goto finish;
 	}
 
 	if (!log_append(&r->log, m->previndex, m->prevterm, &m->entry)) {
 		debug("log_append failed\n");
 		goto finish;
 	}
-	reply.index = r->log.first + r->log.size - 1;
+	reply.index = m->previndex + 1;
 	reply.term = RAFT_LOG(r, reply.index).term;
 
 	reply.success = true;
@@ -501,9 +589,7 @@ static void raft_refresh_acked(raft_t *r) {
 		assert(replication <= r->servernum);
 
 		if (replication * 2 > r->servernum) {
-			#ifdef MAJORITY_IS_NOT_ENOUGH
-			if (replication < r->servernum) continue;
-			#endif
+			if (r->unanimous && (replication < r->servernum)) continue;
 			r->log.acked = newacked;
 		}
 	}
@@ -519,43 +605,40 @@ static void raft_handle_done(raft_t *r, raft_msg_done_t *m) {
 		return;
 	}
 
+	// updates are pipelined, so replies are not matched by seqno
 	raft_server_t *server = r->servers + sender;
-	if (m->msg.seqno != server->seqno) {
-		debug("[from %d] ============= mseqno(%d) != sseqno(%d)\n", sender, m->msg.seqno, server->seqno);
-		return;
-	}
-	server->seqno++;
 	if (m->msg.term < r->term) {
 		debug("[from %d] ============= msgterm(%d) != term(%d)\n", sender, m->term, r->term);
 		return;
 	}
+	server->heard = 0;
+	if (m->beat) {
+		return;
+	}
 
 	if (m->success) {
 		debug("[from %d] ============= done\n", sender);
-		server->tosend++;
-		server->acked = server->tosend;
+		if (server->acked < m->index + 1) {
+			server->acked = m->index + 1;
+		}
+		if (server->tosend < server->acked) {
+			server->tosend = server->acked;
+		}
 		raft_refresh_acked(r);
 	} else {
 		debug("[from %d] ============= refused\n", sender);
-		if (server->tosend > 0) {
-			// the client should have specified the last index it had gotten
-			if (server->tosend == m->index + 1) {
-				shout(
-					"[from %d] the last index I have is %d, but"
-					" I still refuse, this should not happen\n",
-					sender, m->index
-				);
-				assert(false);
-			}
+		// some entries are lost or reordered: resend after the last index the follower has
+		if (server->tosend > m->index + 1) {
 			server->tosend = m->index + 1;
 		}
-		assert(server->tosend >= server->acked); // FIXME: remove this, because 'tosend' is actually allowed to be less than 'acked' if the follower has restarted
+		if (server->acked > server->tosend) {
+			// the follower has restarted
+			server->acked = server->tosend;
+		}
 	}
 
-	if (server->tosend < r->log.first + r->log.size) {
-		// send the next entry
-		raft_beat(r, sender);
-	}
+	// send the next entries
+	raft_beat(r, sender, false);
 }
 
 static void raft_set_term(raft_t *r, int term) {
@@ -563,6 +646,7 @@ static void raft_set_term(raft_t *r, int term) {
 	r->term = term;
 	r->vote = NOBODY;
 	r->votes = 0;
+	r->heard = INT_MAX;
 }
 
 void raft_ensure_term(raft_t *r, int term) {
@@ -627,13 +711,48 @@ static void raft_handle_vote(raft_t *r, raft_msg_vote_t *m) {
 
 	if (r->votes * 2 > r->servernum) {
 		// got the support of a majority
+		int i;
 		r->role = ROLE_LEADER;
 		r->leader = r->me;
+		r->pending.nupdates = 0;
+		for (i = 0; i < r->servernum; i++) {
+			r->servers[i].tosend = r->servers[i].acked = r->log.acked;
+			r->servers[i].heard = INT_MAX;
+		}
 		raft_reset_timer(r);
 	}
 }
 
+bool raft_has_lease(raft_t *r) {
+	if (r->role == ROLE_FOLLOWER) {
+		return (r->leader != NOBODY) && (r->heard < LEASE_TIMEOUT_MS);
+	}
+	if (r->role == ROLE_LEADER) {
+		int i;
+		int recent = 1; // count self
+		for (i = 0; i < r->servernum; i++) {
+			if (i == r->me) continue;
+			if (r->servers[i].heard < LEASE_TIMEOUT_MS) {
+				recent++;
+			}
+		}
+		return recent * 2 > r->servernum;
+	}
+	return false;
+}
+
 void raft_handle_message(raft_t *r, raft_msg_t *m) {
+	if (
+		(m->msgtype == RAFT_MSG_CLAIM) &&
+		(r->role == ROLE_FOLLOWER) &&
+		(r->leader != NOBODY) &&
+		(r->heard < ELECTION_TIMEOUT_MS_MIN)
+	) {
+		// the leader is alive and may hold a lease, do not let anybody depose it
+		debug("ignore the claim of %d, the leader %d is alive\n", m->from, r->leader);
+		return;
+	}
+
 	if (m->term > r->term) {
 		if (r->role != ROLE_FOLLOWER) {
 			shout("demoting myself\n");
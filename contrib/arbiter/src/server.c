@@ -65,6 +65,7 @@ typedef struct server_data_t {
 	onmessage_callback_t onmessage;
 	onconnect_callback_t onconnect;
 	ondisconnect_callback_t ondisconnect;
+	onflush_callback_t onflush;
 
 	bool enabled;
 
@@ -123,6 +124,7 @@ server_t server_init(
 	server->onmessage = onmessage;
 	server->onconnect = onconnect;
 	server->ondisconnect = ondisconnect;
+	server->onflush = NULL;
 
 #ifdef USE_EPOLL
     server->epollfd = epoll_create(MAX_EVENTS);
@@ -184,6 +186,10 @@ void server_set_raft_socket(server_t server, int sock) {
 	server->raft_stream.good = good;
 }
 
+void server_set_onflush(server_t server, onflush_callback_t onflush) {
+	server->onflush = onflush;
+}
+
 bool server_start(server_t server) {
 	debug("starting the server\n");
 	server->free_chain = NULL;
@@ -593,6 +599,9 @@ bool server_tick(server_t server, int timeout_ms) {
 #endif
 
 	server_close_bad_streams(server);
+	if (server->onflush) {
+		server->onflush();
+	}
 	server_flush(server);
 
 	return raft_ready;
@@ -642,6 +651,13 @@ void *client_get_userdata(client_t client) {
 	return client->userdata;
 }
 
+client_t client_get_sibling(client_t client, unsigned chan) {
+	client_t sibling;
+	if (chan >= MAX_TRANSACTIONS) return NULL;
+	sibling = client->stream->clients + chan;
+	return sibling->stream ? sibling : NULL;
+}
+
 unsigned client_get_ip_addr(client_t client)
 {
     struct sockaddr_in inet_addr;
@@ -27,6 +27,7 @@ static bool auto_explain_log_verbose = false;
 static bool auto_explain_log_buffers = false;
 static bool auto_explain_log_triggers = false;
 static bool auto_explain_log_timing = true;
+static bool auto_explain_log_timing_sampled = false;
 static int	auto_explain_log_format = EXPLAIN_FORMAT_TEXT;
 static bool auto_explain_log_nested_statements = false;
 static double auto_explain_sample_rate = 1;
@@ -163,6 +164,17 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	DefineCustomBoolVariable("auto_explain.log_timing_sampled",
+							 "Time only a sample of plan node executions.",
+							 NULL,
+							 &auto_explain_log_timing_sampled,
+							 false,
+							 PGC_SUSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
 	DefineCustomRealVariable("auto_explain.sample_rate",
 							 "Fraction of queries to process.",
 							 NULL,
@@ -222,7 +234,11 @@ explain_ExecutorStart(QueryDesc *queryDesc, int eflags)
 		if (auto_explain_log_analyze && (eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
 		{
 			if (auto_explain_log_timing)
+			{
 				queryDesc->instrument_options |= INSTRUMENT_TIMER;
+				if (auto_explain_log_timing_sampled)
+					queryDesc->instrument_options |= INSTRUMENT_TIMER_SAMPLED;
+			}
 			else
 				queryDesc->instrument_options |= INSTRUMENT_ROWS;
 			if (auto_explain_log_buffers)
@@ -1,8 +1,8 @@
 /*-------------------------------------------------------------------------
  *
  * decoder_raw.c
- *		Logical decoding output plugin generating SQL queries based
- *		on things decoded.
+ *		Logical decoding output plugin generating binary change records
+ *		which are applied directly to heap and indexes by receiver_raw.
  *
  * Copyright (c) 1996-2015, PostgreSQL Global Development Group
  *
@@ -15,9 +15,12 @@
 #include "postgres.h"
 
 #include "access/genam.h"
+#include "access/htup_details.h"
 #include "access/sysattr.h"
+#include "access/transam.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
+#include "libpq/pqformat.h"
 #include "nodes/parsenodes.h"
 #include "replication/output_plugin.h"
 #include "replication/logical.h"
@@ -85,7 +88,7 @@ decoder_raw_startup(LogicalDecodingContext *ctx, OutputPluginOptions *opt,
     data->isLocal = false;
 	ctx->output_plugin_private = data;
 
-	opt->output_type = OUTPUT_PLUGIN_TEXTUAL_OUTPUT;
+	opt->output_type = OUTPUT_PLUGIN_BINARY_OUTPUT;
 }
 
 /* cleanup this plugin's resources */
@@ -113,7 +116,8 @@ decoder_raw_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
     } else { 
         OutputPluginPrepareWrite(ctx, true);
         XTM_INFO("Send transaction %u to replica\n", txn->xid);
-        appendStringInfoString(ctx->out, "BEGIN;");
+        pq_sendbyte(ctx->out, 'B');
+        pq_sendint(ctx->out, txn->xid, 4);
         OutputPluginWrite(ctx, true);
         data->isLocal = false;
     }
@@ -128,7 +132,7 @@ decoder_raw_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
     if (!data->isLocal) { 
         XTM_INFO("Send commit of transaction %u to replica\n", txn->xid);
         OutputPluginPrepareWrite(ctx, true);
-        appendStringInfoString(ctx->out, "COMMIT;");
+        pq_sendbyte(ctx->out, 'C');
         OutputPluginWrite(ctx, true);
     } else { 
         XTM_INFO("Skip commit of transaction %u\n", txn->xid);
@@ -136,283 +140,135 @@ decoder_raw_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 }
 
 /*
- * Print literal `outputstr' already represented as string of type `typid'
- * into stringbuf `s'.
- *
- * Some builtin types aren't quoted, the rest is quoted. Escaping is done as
- * if standard_conforming_strings were enabled.
+ * Write the qualified name of a relation: schema and relation names are sent
+ * as length-prefixed zero terminated strings.
  */
 static void
-print_literal(StringInfo s, Oid typid, char *outputstr)
+write_relname(StringInfo s, Relation rel)
 {
-	const char *valptr;
-
-	switch (typid)
-	{
-		case BOOLOID:
-			if (outputstr[0] == 't')
-				appendStringInfoString(s, "true");
-			else
-				appendStringInfoString(s, "false");
-			break;
+	char	   *nspname = get_namespace_name(RelationGetNamespace(rel));
+	char	   *relname = NameStr(RelationGetForm(rel)->relname);
+	int			len;
 
-		case INT2OID:
-		case INT4OID:
-		case INT8OID:
-		case OIDOID:
-		case FLOAT4OID:
-		case FLOAT8OID:
-		case NUMERICOID:
-			/* NB: We don't care about Inf, NaN et al. */
-			appendStringInfoString(s, outputstr);
-			break;
-
-		case BITOID:
-		case VARBITOID:
-			appendStringInfo(s, "B'%s'", outputstr);
-			break;
+	len = strlen(nspname) + 1;
+	pq_sendbyte(s, len);
+	pq_sendbytes(s, nspname, len);
 
-		default:
-			appendStringInfoChar(s, '\'');
-			for (valptr = outputstr; *valptr; valptr++)
-			{
-				char		ch = *valptr;
-
-				if (SQL_STR_DOUBLE(ch, false))
-					appendStringInfoChar(s, ch);
-				appendStringInfoChar(s, ch);
-			}
-			appendStringInfoChar(s, '\'');
-			break;
-	}
+	len = strlen(relname) + 1;
+	pq_sendbyte(s, len);
+	pq_sendbytes(s, relname, len);
 }
 
 /*
- * Print a relation name into the StringInfo provided by caller.
+ * Write a tuple: number of attributes followed by the attributes themselves.
+ *
+ * Each attribute starts with its kind:
+ * 'n' - null (dropped columns are always sent as nulls),
+ * 'u' - unchanged toasted value which was not logged,
+ * 'b' - by-value datum copied as is,
+ * 's' - binary send/recv representation of a builtin type,
+ * 't' - text representation, used for all other types.
+ * Non-null kinds are followed by the 4-byte length and the data.
  */
 static void
-print_relname(StringInfo s, Relation rel)
+write_tuple(StringInfo s, Relation rel, HeapTuple tuple)
 {
-	Form_pg_class	class_form = RelationGetForm(rel);
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	Datum		values[MaxTupleAttributeNumber];
+	bool		isnull[MaxTupleAttributeNumber];
+	int			natt;
 
-	appendStringInfoString(s,
-		quote_qualified_identifier(
-				get_namespace_name(
-						   get_rel_namespace(RelationGetRelid(rel))),
-			NameStr(class_form->relname)));
-}
+	heap_deform_tuple(tuple, tupdesc, values, isnull);
 
-/*
- * Print a value into the StringInfo provided by caller.
- */
-static void
-print_value(StringInfo s, Datum origval, Oid typid, bool isnull)
-{
-	Oid					typoutput;
-	bool				typisvarlena;
-
-	/* Query output function */
-	getTypeOutputInfo(typid,
-					  &typoutput, &typisvarlena);
-
-	/* Print value */
-	if (isnull)
-		appendStringInfoString(s, "null");
-	else if (typisvarlena && VARATT_IS_EXTERNAL_ONDISK(origval))
-		appendStringInfoString(s, "unchanged-toast-datum");
-	else if (!typisvarlena)
-		print_literal(s, typid,
-					  OidOutputFunctionCall(typoutput, origval));
-	else
+	pq_sendint(s, tupdesc->natts, 2);
+	for (natt = 0; natt < tupdesc->natts; natt++)
 	{
-		/* Definitely detoasted Datum */
-		Datum		val;
-		val = PointerGetDatum(PG_DETOAST_DATUM(origval));
-		print_literal(s, typid, OidOutputFunctionCall(typoutput, val));
-	}
-}
-
-/*
- * Print a WHERE clause item
- */
-static void
-print_where_clause_item(StringInfo s,
-						Relation relation,
-						HeapTuple tuple,
-						int natt,
-						bool *first_column)
-{
-	Form_pg_attribute	attr;
-	Datum				origval;
-	bool				isnull;
-	TupleDesc			tupdesc = RelationGetDescr(relation);
-
-	attr = tupdesc->attrs[natt - 1];
-
-	/* Skip dropped columns and system columns */
-	if (attr->attisdropped || attr->attnum < 0)
-		return;
-
-	/* Skip comma for first colums */
-	if (!*first_column)
-		appendStringInfoString(s, " AND ");
-	else
-		*first_column = false;
-
-	/* Print attribute name */
-	appendStringInfo(s, "%s = ", quote_identifier(NameStr(attr->attname)));
-
-	/* Get Datum from tuple */
-	origval = heap_getattr(tuple, natt, tupdesc, &isnull);
+		Form_pg_attribute	attr = tupdesc->attrs[natt];
+		Oid					typfunc;
+		bool				typisvarlena;
 
-	/* Get output function */
-	print_value(s, origval, attr->atttypid, isnull);
-}
-
-/*
- * Generate a WHERE clause for UPDATE or DELETE.
- */
-static void
-print_where_clause(StringInfo s,
-				   Relation relation,
-				   HeapTuple oldtuple,
-				   HeapTuple newtuple)
-{
-	TupleDesc		tupdesc = RelationGetDescr(relation);
-	int				natt;
-	bool			first_column = true;
-
-	Assert(relation->rd_rel->relreplident == REPLICA_IDENTITY_DEFAULT ||
-		   relation->rd_rel->relreplident == REPLICA_IDENTITY_FULL ||
-		   relation->rd_rel->relreplident == REPLICA_IDENTITY_INDEX);
-
-	/* Build the WHERE clause */
-	appendStringInfoString(s, " WHERE ");
-
-	RelationGetIndexList(relation);
-	/* Generate WHERE clause using new values of REPLICA IDENTITY */
-	if (OidIsValid(relation->rd_replidindex))
-	{
-		Relation    indexRel;
-		int			key;
+		if (isnull[natt] || attr->attisdropped)
+		{
+			pq_sendbyte(s, 'n');
+			continue;
+		}
+		if (attr->attlen == -1 && VARATT_IS_EXTERNAL_ONDISK(values[natt]))
+		{
+			pq_sendbyte(s, 'u');
+			continue;
+		}
+		if (attr->attbyval)
+		{
+			char		data[sizeof(Datum)];
 
-		/* Use all the values associated with the index */
-		indexRel = index_open(relation->rd_replidindex, AccessShareLock);
-		for (key = 0; key < indexRel->rd_index->indnatts; key++)
+			store_att_byval(data, values[natt], attr->attlen);
+			pq_sendbyte(s, 'b');
+			pq_sendint(s, attr->attlen, 4);
+			pq_sendbytes(s, data, attr->attlen);
+			continue;
+		}
+		if (attr->atttypid < FirstNormalObjectId)
 		{
-			int	relattr = indexRel->rd_index->indkey.values[key];
-
-			/*
-			 * For a relation having REPLICA IDENTITY set at DEFAULT
-			 * or INDEX, if one of the columns used for tuple selectivity
-			 * is changed, the old tuple data is not NULL and need to
-			 * be used for tuple selectivity. If no such columns are
-			 * updated, old tuple data is NULL.
-			 */
-			print_where_clause_item(s, relation,
-									oldtuple ? oldtuple : newtuple,
-									relattr, &first_column);
+			getTypeBinaryOutputInfo(attr->atttypid, &typfunc, &typisvarlena);
+			if (OidIsValid(typfunc))
+			{
+				bytea	   *outputbytes = OidSendFunctionCall(typfunc, values[natt]);
+				int			len = VARSIZE(outputbytes) - VARHDRSZ;
+
+				pq_sendbyte(s, 's');
+				pq_sendint(s, len, 4);
+				pq_sendbytes(s, VARDATA(outputbytes), len);
+				pfree(outputbytes);
+				continue;
+			}
+		}
+		{
+			char	   *outputstr;
+			int			len;
+
+			getTypeOutputInfo(attr->atttypid, &typfunc, &typisvarlena);
+			outputstr = OidOutputFunctionCall(typfunc, values[natt]);
+			len = strlen(outputstr) + 1;
+			pq_sendbyte(s, 't');
+			pq_sendint(s, len, 4);
+			pq_sendbytes(s, outputstr, len);
+			pfree(outputstr);
 		}
-		index_close(indexRel, NoLock);
-		return;
 	}
-
-	/* We need absolutely some values for tuple selectivity now */
-	Assert(oldtuple != NULL &&
-		   relation->rd_rel->relreplident == REPLICA_IDENTITY_FULL);
-
-	/*
-	 * Fallback to default case, use of old values and print WHERE clause
-	 * using all the columns. This is actually the code path for FULL.
-	 */
-	for (natt = 0; natt < tupdesc->natts; natt++)
-		print_where_clause_item(s, relation, oldtuple,
-								natt + 1, &first_column);
 }
 
 /*
- * Decode an INSERT entry
+ * Decode an INSERT entry: 'I', relation name and new tuple.
  */
 static void
 decoder_raw_insert(StringInfo s,
 				   Relation relation,
 				   HeapTuple tuple)
 {
-	TupleDesc		tupdesc = RelationGetDescr(relation);
-	int				natt;
-	bool			first_column = true;
-	StringInfo		values = makeStringInfo();
-
-	/* Initialize string info for values */
-	initStringInfo(values);
-
-	/* Query header */
-	appendStringInfo(s, "INSERT INTO ");
-	print_relname(s, relation);
-	appendStringInfo(s, " (");
-
-	/* Build column names and values */
-	for (natt = 0; natt < tupdesc->natts; natt++)
-	{
-		Form_pg_attribute	attr;
-		Datum				origval;
-		bool				isnull;
-
-		attr = tupdesc->attrs[natt];
-
-		/* Skip dropped columns and system columns */
-		if (attr->attisdropped || attr->attnum < 0)
-			continue;
-
-		/* Skip comma for first colums */
-		if (!first_column)
-		{
-			appendStringInfoString(s, ", ");
-			appendStringInfoString(values, ", ");
-		}
-		else
-			first_column = false;
-
-		/* Print attribute name */
-		appendStringInfo(s, "%s", quote_identifier(NameStr(attr->attname)));
-
-		/* Get Datum from tuple */
-		origval = heap_getattr(tuple, natt + 1, tupdesc, &isnull);
-
-		/* Get output function */
-		print_value(values, origval, attr->atttypid, isnull);
-	}
-
-	/* Append values  */
-	appendStringInfo(s, ") VALUES (%s);", values->data);
-
-	/* Clean up */
-	resetStringInfo(values);
+	pq_sendbyte(s, 'I');
+	write_relname(s, relation);
+	write_tuple(s, relation, tuple);
 }
 
 /*
- * Decode a DELETE entry
+ * Decode a DELETE entry: 'D', relation name and old key (or whole old tuple
+ * for REPLICA IDENTITY FULL).
  */
 static void
 decoder_raw_delete(StringInfo s,
 				   Relation relation,
 				   HeapTuple tuple)
 {
-	appendStringInfo(s, "DELETE FROM ");
-	print_relname(s, relation);
-
-	/*
-	 * Here the same tuple is used as old and new values, selectivity will
-	 * be properly reduced by relation uses DEFAULT or INDEX as REPLICA
-	 * IDENTITY.
-	 */
-	print_where_clause(s, relation, tuple, tuple);
-	appendStringInfoString(s, ";");
+	pq_sendbyte(s, 'D');
+	write_relname(s, relation);
+	write_tuple(s, relation, tuple);
 }
 
 
 /*
- * Decode an UPDATE entry
+ * Decode an UPDATE entry: 'U', relation name, then 'K' with the old key if it
+ * was logged (identifying key changed or REPLICA IDENTITY FULL) and 'N' with
+ * the new tuple.
  */
 static void
 decoder_raw_update(StringInfo s,
@@ -420,53 +276,15 @@ decoder_raw_update(StringInfo s,
 				   HeapTuple oldtuple,
 				   HeapTuple newtuple)
 {
-	TupleDesc		tupdesc = RelationGetDescr(relation);
-	int				natt;
-	bool			first_column = true;
-
-	/* If there are no new values, simply leave as there is nothing to do */
-	if (newtuple == NULL)
-		return;
-
-	appendStringInfo(s, "UPDATE ");
-	print_relname(s, relation);
-
-	/* Build the SET clause with the new values */
-	appendStringInfo(s, " SET ");
-	for (natt = 0; natt < tupdesc->natts; natt++)
+	pq_sendbyte(s, 'U');
+	write_relname(s, relation);
+	if (oldtuple != NULL)
 	{
-		Form_pg_attribute	attr;
-		Datum				origval;
-		bool				isnull;
-
-		attr = tupdesc->attrs[natt];
-
-		/* Skip dropped columns and system columns */
-		if (attr->attisdropped || attr->attnum < 0)
-			continue;
-
-		/* Skip comma for first colums */
-		if (!first_column)
-		{
-			appendStringInfoString(s, ", ");
-		}
-		else
-			first_column = false;
-
-		/* Print attribute name */
-		appendStringInfo(s, "%s = ", quote_identifier(NameStr(attr->attname)));
-
-		/* Get Datum from tuple */
-		origval = heap_getattr(newtuple, natt + 1, tupdesc, &isnull);
-
-		/* Get output function */
-		print_value(s, origval, attr->atttypid, isnull);
+		pq_sendbyte(s, 'K');
+		write_tuple(s, relation, oldtuple);
 	}
-
-	/* Print WHERE clause */
-	print_where_clause(s, relation, oldtuple, newtuple);
-
-	appendStringInfoString(s, ";");
+	pq_sendbyte(s, 'N');
+	write_tuple(s, relation, newtuple);
 }
 
 /*
@@ -516,12 +334,11 @@ decoder_raw_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 			}
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
-			if (!is_rel_non_selective)
+			if (!is_rel_non_selective && change->data.tp.newtuple != NULL)
 			{
 				HeapTuple oldtuple = change->data.tp.oldtuple != NULL ?
 					&change->data.tp.oldtuple->tuple : NULL;
-				HeapTuple newtuple = change->data.tp.newtuple != NULL ?
-					&change->data.tp.newtuple->tuple : NULL;
+				HeapTuple newtuple = &change->data.tp.newtuple->tuple;
 
 				OutputPluginPrepareWrite(ctx, true);
 				decoder_raw_update(ctx->out,
@@ -532,7 +349,7 @@ decoder_raw_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 			}
 			break;
 		case REORDER_BUFFER_CHANGE_DELETE:
-			if (!is_rel_non_selective)
+			if (!is_rel_non_selective && change->data.tp.oldtuple != NULL)
 			{
 				OutputPluginPrepareWrite(ctx, true);
 				decoder_raw_delete(ctx->out,
@@ -5,6 +5,10 @@
  *		creates some basics for a multi-master cluster using vanilla
  *		PostgreSQL without modifying its code.
  *
+ *		Changes are applied directly to the heap and indexes, the same way
+ *		mmts pglogical_apply.c does, without parsing and planning a
+ *		statement for each replicated row.
+ *
  * Copyright (c) 1996-2015, PostgreSQL Global Development Group
  *
  * IDENTIFICATION
@@ -19,17 +23,31 @@
 #include "fmgr.h"
 #include "libpq-fe.h"
 #include "pqexpbuffer.h"
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "access/htup_details.h"
+#include "access/nbtree.h"
 #include "access/xact.h"
 #include "access/transam.h"
+#include "catalog/namespace.h"
+#include "executor/executor.h"
 #include "lib/stringinfo.h"
+#include "libpq/pqformat.h"
+#include "nodes/makefuncs.h"
 #include "pgstat.h"
-#include "executor/spi.h"
 #include "postmaster/bgworker.h"
 #include "storage/ipc.h"
+#include "storage/lmgr.h"
 #include "storage/latch.h"
 #include "storage/proc.h"
+#include "utils/builtins.h"
 #include "utils/guc.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
 #include "utils/snapmgr.h"
+#include "utils/tqual.h"
+#include "utils/typcache.h"
 
 #include "multimaster.h"
 
@@ -60,6 +78,16 @@ static XLogRecPtr output_written_lsn = InvalidXLogRecPtr;
 static XLogRecPtr output_fsync_lsn = InvalidXLogRecPtr;
 static XLogRecPtr output_applied_lsn = InvalidXLogRecPtr;
 
+/* Memory context for decoding and applying a single change */
+static MemoryContext ApplyContext;
+
+typedef struct TupleData
+{
+	Datum		values[MaxTupleAttributeNumber];
+	bool		isnull[MaxTupleAttributeNumber];
+	bool		changed[MaxTupleAttributeNumber];
+} TupleData;
+
 /* Stream functions */
 static void fe_sendint64(int64 i, char *buf);
 static int64 fe_recvint64(char *buf);
@@ -193,6 +221,317 @@ feTimestampDifference(int64 start_time, int64 stop_time,
 	}
 }
 
+/*
+ * Open relation which name is sent by write_relname() of decoder_raw.
+ */
+static Relation
+read_rel(StringInfo s, LOCKMODE mode)
+{
+	char const* nspname;
+	char const* relname;
+	Oid			relid;
+
+	nspname = pq_getmsgbytes(s, pq_getmsgbyte(s));
+	relname = pq_getmsgbytes(s, pq_getmsgbyte(s));
+	relid = RangeVarGetRelid(makeRangeVar((char*)nspname, (char*)relname, -1), mode, false);
+	return heap_open(relid, NoLock);
+}
+
+/*
+ * Read tuple written by write_tuple() of decoder_raw.
+ */
+static void
+read_tuple(StringInfo s, Relation rel, TupleData *tup)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	int			natts = pq_getmsgint(s, 2);
+	int			i;
+
+	if (natts != desc->natts)
+		elog(ERROR, "%s: tuple natts mismatch for relation %s, %d vs %d",
+			 worker_proc, RelationGetRelationName(rel), natts, desc->natts);
+
+	for (i = 0; i < natts; i++)
+	{
+		Form_pg_attribute att = desc->attrs[i];
+		char		kind = pq_getmsgbyte(s);
+		const char *data;
+		int			len;
+
+		tup->isnull[i] = false;
+		tup->changed[i] = true;
+
+		switch (kind)
+		{
+			case 'n':
+				tup->isnull[i] = true;
+				tup->values[i] = (Datum) 0;
+				break;
+			case 'u':
+				tup->isnull[i] = true;
+				tup->changed[i] = false;
+				tup->values[i] = (Datum) 0;
+				break;
+			case 'b':
+				{
+					Datum		buf;
+
+					len = pq_getmsgint(s, 4);
+					if (len != att->attlen)
+						elog(ERROR, "%s: incorrect length %d of column %s",
+							 worker_proc, len, NameStr(att->attname));
+					/* copy to align data */
+					memcpy(&buf, pq_getmsgbytes(s, len), len);
+					tup->values[i] = fetch_att(&buf, true, len);
+					break;
+				}
+			case 's':
+				{
+					Oid			typreceive;
+					Oid			typioparam;
+					StringInfoData buf;
+
+					len = pq_getmsgint(s, 4);
+					getTypeBinaryInputInfo(att->atttypid, &typreceive, &typioparam);
+					initStringInfo(&buf);
+					appendBinaryStringInfo(&buf, pq_getmsgbytes(s, len), len);
+					tup->values[i] = OidReceiveFunctionCall(typreceive, &buf,
+															typioparam, att->atttypmod);
+					if (buf.len != buf.cursor)
+						ereport(ERROR,
+								(errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+								 errmsg("incorrect binary data format")));
+					break;
+				}
+			case 't':
+				{
+					Oid			typinput;
+					Oid			typioparam;
+
+					len = pq_getmsgint(s, 4);
+					data = pq_getmsgbytes(s, len);
+					getTypeInputInfo(att->atttypid, &typinput, &typioparam);
+					tup->values[i] = OidInputFunctionCall(typinput, (char*)data,
+														  typioparam, att->atttypmod);
+					break;
+				}
+			default:
+				elog(ERROR, "%s: unknown column kind '%c'", worker_proc, kind);
+		}
+	}
+}
+
+static EState*
+create_rel_estate(Relation rel)
+{
+	EState	   *estate = CreateExecutorState();
+	ResultRelInfo *resultRelInfo = makeNode(ResultRelInfo);
+
+	resultRelInfo->ri_RangeTableIndex = 1;		/* dummy */
+	resultRelInfo->ri_RelationDesc = rel;
+
+	estate->es_result_relations = resultRelInfo;
+	estate->es_num_result_relations = 1;
+	estate->es_result_relation_info = resultRelInfo;
+	return estate;
+}
+
+/*
+ * Insert index entries for the new version of the tuple.
+ */
+static void
+update_indexes(EState *estate, HeapTuple tuple)
+{
+	ResultRelInfo *relinfo = estate->es_result_relation_info;
+	TupleTableSlot *slot;
+	List	   *recheckIndexes;
+
+	/* HOT update does not require index inserts */
+	if (HeapTupleIsHeapOnly(tuple))
+		return;
+
+	ExecOpenIndices(relinfo, false);
+	if (relinfo->ri_NumIndices > 0)
+	{
+		slot = ExecInitExtraTupleSlot(estate);
+		ExecSetSlotDescriptor(slot, RelationGetDescr(relinfo->ri_RelationDesc));
+		ExecStoreTuple(tuple, slot, InvalidBuffer, false);
+		recheckIndexes = ExecInsertIndexTuples(slot, &tuple->t_self, estate, false, NULL, NIL);
+		if (recheckIndexes != NIL)
+			ereport(ERROR,
+					(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+					 errmsg("%s: deferred constraints are not supported", worker_proc)));
+	}
+	ExecCloseIndices(relinfo);
+}
+
+/*
+ * Locate the tuple identified by 'key': using the replica identity index if
+ * there is one, or comparing all columns for REPLICA IDENTITY FULL.
+ * Tuples of in-progress transactions are waited for, like find_pkey_tuple()
+ * of mmts does.
+ */
+static bool
+find_tuple(Relation rel, TupleData *key, HeapTuple *found)
+{
+	ScanKeyData skey[MaxTupleAttributeNumber];
+	SnapshotData snap;
+	Oid			idxoid = RelationGetReplicaIndex(rel);
+	Relation	idxrel = NULL;
+	IndexScanDesc iscan = NULL;
+	HeapScanDesc hscan = NULL;
+	HeapTuple	tuple;
+	TransactionId xwait;
+	int			nkeys = 0;
+	int			i;
+
+	InitDirtySnapshot(snap);
+
+	if (OidIsValid(idxoid))
+	{
+		idxrel = index_open(idxoid, AccessShareLock);
+		for (i = 0; i < idxrel->rd_index->indnatts; i++)
+		{
+			int			attno = idxrel->rd_index->indkey.values[i];
+			Oid			opcintype = idxrel->rd_opcintype[i];
+			Oid			op = get_opfamily_member(idxrel->rd_opfamily[i], opcintype, opcintype,
+												 BTEqualStrategyNumber);
+
+			if (!OidIsValid(op))
+				elog(ERROR, "%s: missing equality operator for column %d of index %s",
+					 worker_proc, i + 1, RelationGetRelationName(idxrel));
+			if (key->isnull[attno - 1])
+				elog(ERROR, "%s: null value of replica identity column", worker_proc);
+			ScanKeyInit(&skey[nkeys++], i + 1, BTEqualStrategyNumber,
+						get_opcode(op), key->values[attno - 1]);
+		}
+		iscan = index_beginscan(rel, idxrel, &snap, nkeys, 0);
+	}
+	else
+	{
+		TupleDesc	desc = RelationGetDescr(rel);
+
+		for (i = 0; i < desc->natts; i++)
+		{
+			TypeCacheEntry *typentry;
+
+			if (key->isnull[i])
+				continue;
+			typentry = lookup_type_cache(desc->attrs[i]->atttypid, TYPECACHE_EQ_OPR);
+			if (!OidIsValid(typentry->eq_opr))
+				elog(ERROR, "%s: could not identify an equality operator for type %s",
+					 worker_proc, format_type_be(desc->attrs[i]->atttypid));
+			ScanKeyInit(&skey[nkeys++], i + 1, InvalidStrategy,
+						get_opcode(typentry->eq_opr), key->values[i]);
+		}
+		hscan = heap_beginscan(rel, &snap, nkeys, skey);
+	}
+
+  retry:
+	if (iscan != NULL)
+	{
+		index_rescan(iscan, skey, nkeys, NULL, 0);
+		tuple = index_getnext(iscan, ForwardScanDirection);
+	}
+	else
+	{
+		heap_rescan(hscan, skey);
+		tuple = heap_getnext(hscan, ForwardScanDirection);
+	}
+	if (tuple != NULL)
+	{
+		xwait = TransactionIdIsValid(snap.xmin) ? snap.xmin : snap.xmax;
+		if (TransactionIdIsValid(xwait))
+		{
+			XactLockTableWait(xwait, NULL, NULL, XLTW_None);
+			goto retry;
+		}
+		*found = heap_copytuple(tuple);
+	}
+
+	if (iscan != NULL)
+	{
+		index_endscan(iscan);
+		index_close(idxrel, NoLock);
+	}
+	else
+		heap_endscan(hscan);
+
+	return tuple != NULL;
+}
+
+static void
+process_remote_insert(StringInfo s)
+{
+	Relation	rel = read_rel(s, RowExclusiveLock);
+	EState	   *estate = create_rel_estate(rel);
+	TupleData	newtup;
+	HeapTuple	tuple;
+
+	read_tuple(s, rel, &newtup);
+	tuple = heap_form_tuple(RelationGetDescr(rel), newtup.values, newtup.isnull);
+	simple_heap_insert(rel, tuple);
+	update_indexes(estate, tuple);
+
+	ExecResetTupleTable(estate->es_tupleTable, true);
+	FreeExecutorState(estate);
+	heap_close(rel, NoLock);
+}
+
+static void
+process_remote_update(StringInfo s)
+{
+	Relation	rel = read_rel(s, RowExclusiveLock);
+	EState	   *estate = create_rel_estate(rel);
+	TupleData	oldtup;
+	TupleData	newtup;
+	HeapTuple	oldtuple;
+	HeapTuple	newtuple;
+	bool		pkey_sent = false;
+	char		action = pq_getmsgbyte(s);
+
+	if (action == 'K')
+	{
+		pkey_sent = true;
+		read_tuple(s, rel, &oldtup);
+		action = pq_getmsgbyte(s);
+	}
+	if (action != 'N')
+		elog(ERROR, "%s: expected new tuple, got '%c'", worker_proc, action);
+	read_tuple(s, rel, &newtup);
+
+	if (!find_tuple(rel, pkey_sent ? &oldtup : &newtup, &oldtuple))
+		ereport(ERROR,
+				(errcode(ERRCODE_NO_DATA_FOUND),
+				 errmsg("%s: record with specified key can not be located at this node", worker_proc)));
+
+	newtuple = heap_modify_tuple(oldtuple, RelationGetDescr(rel),
+								 newtup.values, newtup.isnull, newtup.changed);
+	simple_heap_update(rel, &oldtuple->t_self, newtuple);
+	update_indexes(estate, newtuple);
+
+	ExecResetTupleTable(estate->es_tupleTable, true);
+	FreeExecutorState(estate);
+	heap_close(rel, NoLock);
+}
+
+static void
+process_remote_delete(StringInfo s)
+{
+	Relation	rel = read_rel(s, RowExclusiveLock);
+	TupleData	oldtup;
+	HeapTuple	oldtuple;
+
+	read_tuple(s, rel, &oldtup);
+	if (!find_tuple(rel, &oldtup, &oldtuple))
+		ereport(ERROR,
+				(errcode(ERRCODE_NO_DATA_FOUND),
+				 errmsg("%s: record with specified key can not be located at this node", worker_proc)));
+
+	simple_heap_delete(rel, &oldtuple->t_self);
+	heap_close(rel, NoLock);
+}
+
 static void
 receiver_raw_main(Datum main_arg)
 {
@@ -217,6 +556,12 @@ receiver_raw_main(Datum main_arg)
 	/* Connect to a database */
 	BackgroundWorkerInitializeConnection(receiver_database, NULL);
 
+	ApplyContext = AllocSetContextCreate(TopMemoryContext,
+										 "ApplyContext",
+										 ALLOCSET_DEFAULT_MINSIZE,
+										 ALLOCSET_DEFAULT_INITSIZE,
+										 ALLOCSET_DEFAULT_MAXSIZE);
+
 	/* Establish connection to remote server */
 	conn = PQconnectdb(args->receiver_conn_string);
 	if (PQstatus(conn) != CONNECTION_OK)
@@ -303,7 +648,8 @@ receiver_raw_main(Datum main_arg)
 		while (true)
 		{
 			XLogRecPtr  walEnd;
-            char* stmt;
+            StringInfoData msg;
+            char action;
 
 			rc = PQgetCopyData(conn, &copybuf, 1);
 			if (rc <= 0) {
@@ -384,26 +730,28 @@ receiver_raw_main(Datum main_arg)
 			}
 
 			/* Apply change to database */
-            stmt = copybuf + hdr_len;
-			pgstat_report_activity(STATE_RUNNING, stmt);
+            msg.data = copybuf + hdr_len;
+            msg.len = rc - hdr_len;
+            msg.maxlen = msg.len;
+            msg.cursor = 0;
+            action = pq_getmsgbyte(&msg);
 			SetCurrentStatementStartTimestamp();
             
-            if (strncmp(stmt, "BEGIN;", 6) == 0) { 
+            if (action == 'B') { 
                 Assert(!insideTrans);
-                SetCurrentStatementStartTimestamp();
+                pgstat_report_activity(STATE_RUNNING, "BEGIN");
 
                 StartTransactionCommand();
                 xid = GetCurrentTransactionId();
                 MMMarkTransAsLocal(xid);
-                SPI_connect();
                 PushActiveSnapshot(GetTransactionSnapshot());
                 insideTrans = true;
                 rollbackTransaction = false;
                 XTM_INFO("%s: Receive transaction %u\n", worker_proc, xid);
-            } else if (strncmp(stmt, "COMMIT;", 7) == 0) { 
+            } else if (action == 'C') { 
                 Assert(insideTrans);
+                pgstat_report_activity(STATE_RUNNING, "COMMIT");
                 insideTrans = false;
-                SPI_finish();
                 PopActiveSnapshot();
                 if (rollbackTransaction) {
                     elog(WARNING, "%s: Rollback transaction %u", worker_proc, xid);
@@ -424,23 +772,40 @@ receiver_raw_main(Datum main_arg)
                     PG_END_TRY();
                 }
             } else if (!rollbackTransaction) {
+                MemoryContext oldcontext;
                 Assert(insideTrans);
-                /* Execute query */
+                pgstat_report_activity(STATE_RUNNING, "apply change");
+
+                /* Apply change */
+                oldcontext = MemoryContextSwitchTo(ApplyContext);
                 PG_TRY();
                 {
-                    rc = SPI_execute(stmt, false, 0);
-                    if (rc != SPI_OK_INSERT && rc != SPI_OK_UPDATE && rc != SPI_OK_DELETE) {
-                        ereport(LOG, (errmsg("%s: Error when applying change: %s",
-                                             worker_proc, stmt)));
+                    switch (action) { 
+                      case 'I':
+                        process_remote_insert(&msg);
+                        break;
+                      case 'U':
+                        process_remote_update(&msg);
+                        break;
+                      case 'D':
+                        process_remote_delete(&msg);
+                        break;
+                      default:
+                        elog(ERROR, "%s: unknown change type '%c'", worker_proc, action);
                     }
+                    CommandCounterIncrement();
                 }
                 PG_CATCH();
                 {
+                    MemoryContextSwitchTo(oldcontext);
+                    EmitErrorReport();
                     FlushErrorState();
-                    elog(WARNING, "%s: %s failed in transaction %u", worker_proc, stmt, xid);
+                    elog(WARNING, "%s: change '%c' failed in transaction %u", worker_proc, action, xid);
                     rollbackTransaction = true;
                 }
                 PG_END_TRY();
+                MemoryContextSwitchTo(oldcontext);
+                MemoryContextReset(ApplyContext);
             }
 			/* Update written position */
 			output_written_lsn = Max(walEnd, output_written_lsn);
@@ -167,6 +167,9 @@ typedef struct BloomTuple
 typedef struct BloomScanOpaqueData
 {
 	BloomSignatureWord *sign;	/* Scan signature */
+	int			nSignWords;		/* number of non-zero words in sign */
+	int		   *signWordNo;		/* ... their positions in sign */
+	BloomSignatureWord *signWords;	/* ... and their values */
 	BloomState	state;
 } BloomScanOpaqueData;
 
@@ -22,6 +22,24 @@
 
 #include "bloom.h"
 
+/*
+ * Release the search signature of a scan.
+ */
+static void
+freeScanSignature(BloomScanOpaque so)
+{
+	if (so->sign)
+		pfree(so->sign);
+	if (so->signWordNo)
+		pfree(so->signWordNo);
+	if (so->signWords)
+		pfree(so->signWords);
+	so->sign = NULL;
+	so->nSignWords = 0;
+	so->signWordNo = NULL;
+	so->signWords = NULL;
+}
+
 /*
  * Begin scan of bloom index.
  */
@@ -36,6 +54,9 @@ blbeginscan(Relation r, int nkeys, int norderbys)
 	so = (BloomScanOpaque) palloc(sizeof(BloomScanOpaqueData));
 	initBloomState(&so->state, scan->indexRelation);
 	so->sign = NULL;
+	so->nSignWords = 0;
+	so->signWordNo = NULL;
+	so->signWords = NULL;
 
 	scan->opaque = so;
 
@@ -51,9 +72,7 @@ blrescan(IndexScanDesc scan, ScanKey scankey, int nscankeys,
 {
 	BloomScanOpaque so = (BloomScanOpaque) scan->opaque;
 
-	if (so->sign)
-		pfree(so->sign);
-	so->sign = NULL;
+	freeScanSignature(so);
 
 	if (scankey && scan->numberOfKeys > 0)
 	{
@@ -70,9 +89,7 @@ blendscan(IndexScanDesc scan)
 {
 	BloomScanOpaque so = (BloomScanOpaque) scan->opaque;
 
-	if (so->sign)
-		pfree(so->sign);
-	so->sign = NULL;
+	freeScanSignature(so);
 }
 
 /*
@@ -103,8 +120,7 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 			 */
 			if (skey->sk_flags & SK_ISNULL)
 			{
-				pfree(so->sign);
-				so->sign = NULL;
+				freeScanSignature(so);
 				return 0;
 			}
 
@@ -114,6 +130,23 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 
 			skey++;
 		}
+
+		/*
+		 * The search signature has only a few bits set per key, so most of
+		 * its words are zero and would match any index tuple.  Collect the
+		 * non-zero ones, so that each tuple is checked against them only.
+		 */
+		so->signWordNo = palloc(sizeof(int) * so->state.opts.bloomLength);
+		so->signWords = palloc(sizeof(BloomSignatureWord) * so->state.opts.bloomLength);
+		for (i = 0; i < so->state.opts.bloomLength; i++)
+		{
+			if (so->sign[i] != 0)
+			{
+				so->signWordNo[so->nSignWords] = i;
+				so->signWords[so->nSignWords] = so->sign[i];
+				so->nSignWords++;
+			}
+		}
 	}
 
 	/*
@@ -146,9 +179,11 @@ blgetbitmap(IndexScanDesc scan, TIDBitmap *tbm)
 				bool		res = true;
 
 				/* Check index signature with scan signature */
-				for (i = 0; i < so->state.opts.bloomLength; i++)
+				for (i = 0; i < so->nSignWords; i++)
 				{
-					if ((itup->sign[i] & so->sign[i]) != so->sign[i])
+					BloomSignatureWord w = so->signWords[i];
+
+					if ((itup->sign[so->signWordNo[i]] & w) != w)
 					{
 						res = false;
 						break;
@@ -9,6 +9,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/un.h>
 #include <sys/utsname.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -17,6 +18,7 @@
 #include <netdb.h>
 #include <time.h>
 #include <fcntl.h>
+#include <ifaddrs.h>
 
 #include "postgres.h"
 #include "fmgr.h"
@@ -28,6 +30,7 @@
 #include "storage/lmgr.h"
 #include "storage/shmem.h"
 #include "storage/ipc.h"
+#include "storage/latch.h"
 #include "access/xlogdefs.h"
 #include "access/xact.h"
 #include "access/xtm.h"
@@ -77,20 +80,95 @@
 #define MAX_ROUTES       16
 #define INIT_BUFFER_SIZE 1024
 #define HANDSHAKE_MAGIC  0xCAFEDEED
+#define MTM_WIRE_PROTO_TAG "mtm-compact-wire-1" /* passed in gid of handshake messages */
 
 static int*        sockets;
 static int         gateway;
+static int         gateway_unix = -1; /* Unix socket for connections from nodes at the same host */
+static int         handoff = -1;      /* datagram socket used to pass accepted connections to other receivers */
+static int         receiverShard;     /* index of this receiver */
+
+/* Receiver serving connection from the node: connections are accepted by receiver 0 and then passed to the owner */
+#define MtmReceiverOf(node) ((node) % MtmArbiterReceivers)
+
+typedef struct
+{
+	int  node;
+	bool compact;
+} MtmHandoffMessage;
 static bool        send_heartbeat;
 static timestamp_t last_sent_heartbeat;
 static TimeoutId   heartbeat_timer;
-static nodemask_t  busy_mask;
 static timestamp_t last_heartbeat_to_node[MAX_NODES];
+static timestamp_t last_message_to_node[MAX_NODES]; /* last time queued arbiter traffic was sent to the node */
+
+typedef enum
+{
+	MTM_PEER_DISCONNECTED,
+	MTM_PEER_WAIT_RETRY,     /* connection attempt failed, wait before next one */
+	MTM_PEER_CONNECTING,     /* non-blocking connect is in progress */
+	MTM_PEER_HANDSHAKE,      /* handshake request is sent, waiting for response */
+	MTM_PEER_CONNECTED
+} MtmPeerState;
+
+/* Base for delta encoding of messages in compact wire format */
+typedef struct
+{
+	csn_t        csn;
+	csn_t        oldestSnapshot;
+	nodemask_t   disabledNodeMask;
+	nodemask_t   connectivityMask;
+} MtmWireState;
+
+/* State of outgoing connection in arbiter sender */
+typedef struct
+{
+	MtmPeerState state;
+	int          sd;
+	char*        buf;           /* output buffer */
+	int          size;          /* size of output buffer */
+	int          used;          /* amount of data in output buffer */
+	int          sent;          /* amount of data from output buffer already written to socket */
+	char*        wire;          /* frame being written to the socket */
+	int          wireUsed;
+	int          wireSent;
+	int          frameRaw;      /* amount of data from output buffer encoded in the frame */
+	bool         compact;       /* peer accepts compact wire format */
+	bool         local;         /* peer is running at the same host: try to connect through Unix socket */
+	bool         isUnix;        /* current connection is through Unix socket */
+	MtmWireState wireState;
+	timestamp_t  deadline;      /* give up connection attempts after this time */
+	timestamp_t  retryTime;     /* time of next connection attempt */
+	MtmHandshakeMessage req;
+	int          reqSent;
+	MtmArbiterMessage resp;
+	int          respReceived;
+	int          eventPos;      /* position in sender_events or -1 */
+	uint32       events;        /* events registered in sender_events */
+} MtmPeer;
+
+static MtmPeer*      peers;
+static WaitEventSet* sender_events;
+static bool          sender_events_changed;
+static nodemask_t    sender_stale_mask;
+
+/* Receiver state */
+static MtmBuffer*    rxBuffer;
+static MtmWireState* rxState;
+static bool*         rxCompact;
+static MtmBuffer     rxMessages;
 
 static void MtmSender(Datum arg);
 static void MtmReceiver(Datum arg);
 static void MtmMonitor(Datum arg);
 static void MtmSendHeartbeat(void);
 static bool MtmSendToNode(int node, void const* buf, int size, time_t reconnectTimeout);
+static void MtmPeerFlush(int node);
+static void MtmPeerClose(int node);
+static void MtmPeerSetState(int node, MtmPeerState state);
+static void MtmFlushNodes(void);
+static void MtmAttachConnection(int node, int fd, bool compact);
+static void MtmHandOverConnection(int node, int fd, bool compact);
 
 char const* const MtmMessageKindMnem[] = 
 {
@@ -103,7 +181,11 @@ char const* const MtmMessageKindMnem[] =
 	"STATUS",
 	"HEARTBEAT",
 	"POLL_REQUEST",
-	"POLL_STATUS"
+	"POLL_STATUS",
+	"SEQ_REQUEST",
+	"SEQ_RESPONSE",
+	"TRACE_REQUEST",
+	"TRACE_EVENT"
 };
 
 static BackgroundWorker MtmSenderWorker = {
@@ -115,7 +197,7 @@ static BackgroundWorker MtmSenderWorker = {
 };
 
 static BackgroundWorker MtmRecevierWorker = {
-	"mtm-receiver",
+	"",
 	BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION, 
 	BgWorkerStart_ConsistentState,
 	MULTIMASTER_BGW_RESTART_TIMEOUT,
@@ -133,9 +215,22 @@ static BackgroundWorker MtmMonitorWorker = {
 
 void MtmArbiterInitialize(void)
 {
+	int i;
 	elog(LOG, "Register background workers");
 	RegisterBackgroundWorker(&MtmSenderWorker);
-	RegisterBackgroundWorker(&MtmRecevierWorker);
+	if (MtmArbiterReceivers > 1 && (Unix_socket_directories == NULL || *Unix_socket_directories == '\0')) { 
+		elog(WARNING, "Multiple arbiter receivers require Unix sockets: use single receiver");
+		MtmArbiterReceivers = 1;
+	}
+	for (i = 0; i < MtmArbiterReceivers; i++) { 
+		if (MtmArbiterReceivers == 1) { 
+			strcpy(MtmRecevierWorker.bgw_name, "mtm-receiver");
+		} else { 
+			snprintf(MtmRecevierWorker.bgw_name, BGW_MAXLEN, "mtm-receiver-%d", i);
+		}
+		MtmRecevierWorker.bgw_main_arg = Int32GetDatum(i);
+		RegisterBackgroundWorker(&MtmRecevierWorker);
+	}
 	RegisterBackgroundWorker(&MtmMonitorWorker);
 }
 
@@ -164,6 +259,63 @@ MtmResolveHostByName(const char *hostname, unsigned* addrs, unsigned* n_addrs)
     return 1;
 }
 
+/*
+ * Path of Unix socket of arbiter listening the port.
+ * Nodes at the same host are expected to use the same socket directory.
+ * Returns false if Unix sockets are not used.
+ */
+static bool MtmGetArbiterSocketPath(int port, char* path, size_t size)
+{
+	char const* dirs = Unix_socket_directories;
+	int len;
+	if (dirs == NULL) { 
+		return false;
+	}
+	while (*dirs == ' ') {
+		dirs += 1;
+	}
+	len = strcspn(dirs, ", ");
+	if (len == 0 || snprintf(path, size, "%.*s/.s.MTM.%d", len, dirs, port) >= size) { 
+		return false;
+	}
+	return true;
+}
+
+/*
+ * Check if host is loopback or one of addresses of this host
+ */
+static bool MtmIsLocalHost(char const* host)
+{
+    unsigned addrs[MAX_ROUTES];
+    unsigned i, n_addrs = sizeof(addrs) / sizeof(addrs[0]);
+	struct ifaddrs *ifaddr, *ifa;
+	bool local = false;
+
+	if (!MtmResolveHostByName(host, addrs, &n_addrs)) {
+		return false;
+	}
+	for (i = 0; i < n_addrs; i++) { 
+		if ((ntohl(addrs[i]) >> 24) == 127) { 
+			return true;
+		}
+	}
+	if (getifaddrs(&ifaddr) < 0) { 
+		return false;
+	}
+	for (ifa = ifaddr; ifa != NULL && !local; ifa = ifa->ifa_next) {
+		if (ifa->ifa_addr != NULL && ifa->ifa_addr->sa_family == AF_INET) { 
+			for (i = 0; i < n_addrs; i++) { 
+				if (((struct sockaddr_in*)ifa->ifa_addr)->sin_addr.s_addr == addrs[i]) { 
+					local = true;
+					break;
+				}
+			}
+		}
+	}
+	freeifaddrs(ifaddr);
+	return local;
+}
+
 static int stop = 0;
 static void SetStop(int sig)
 {
@@ -345,7 +497,7 @@ static void MtmScheduleHeartbeat()
 		enable_timeout_after(heartbeat_timer, MtmHeartbeatSendTimeout);
 		send_heartbeat = true;
 	}
-	PGSemaphoreUnlock(&Mtm->sendSemaphore);
+	SetLatch(MyLatch);
 }
 	
 static void MtmSendHeartbeat()
@@ -367,14 +519,21 @@ static void MtmSendHeartbeat()
 	for (i = 0; i < Mtm->nAllNodes; i++)
 	{
 		if (i+1 != MtmNodeId) { 
-			if (!BIT_CHECK(busy_mask, i)
-				&& (Mtm->status != MTM_ONLINE 
-					|| sockets[i] >= 0 
-					|| !BIT_CHECK(Mtm->disabledNodeMask, i)
-					|| BIT_CHECK(Mtm->reconnectMask, i)))
+			if (Mtm->status != MTM_ONLINE 
+				|| sockets[i] >= 0 
+				|| !BIT_CHECK(Mtm->disabledNodeMask, i)
+				|| BIT_CHECK(Mtm->reconnectMask, i))
 			{ 
-				if (!MtmSendToNode(i, &msg, sizeof(msg), MtmHeartbeatSendTimeout)) { 
+				/* 
+				 * Any arbiter message refreshes lastHeartbeat at the receiver and carries our masks and oldest snapshot,
+				 * so there is no need to send explicit heartbeat through the link which was used since the previous one.
+				 */
+				bool busy = sockets[i] >= 0 && last_message_to_node[i] + MSEC_TO_USEC(MtmHeartbeatSendTimeout) > now;
+
+				if (!busy && !MtmSendToNode(i, &msg, sizeof(msg), MtmHeartbeatSendTimeout)) { 
 					elog(LOG, "Arbiter failed to send heartbeat to node %d", i+1);
+				} else if (sockets[i] < 0) { 
+					MTM_LOG2("Heartbeat to node %d is queued until connection is established", i+1);
 				} else {
 					if (last_heartbeat_to_node[i] + MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2 < now) { 
 						MTM_LOG1("Last heartbeat to node %d was sent %lld microseconds ago", i+1, now - last_heartbeat_to_node[i]);
@@ -383,19 +542,20 @@ static void MtmSendHeartbeat()
 					/* Connectivity mask can be cleared by MtmWatchdog: in this case sockets[i] >= 0 */
 					if (BIT_CHECK(SELF_CONNECTIVITY_MASK, i)) { 
 						MTM_LOG1("Force reconnect to node %d", i+1);    
-						close(sockets[i]);
-						sockets[i] = -1;
+						MtmPeerFlush(i);
+						MtmPeerClose(i);
+						MtmPeerSetState(i, MTM_PEER_DISCONNECTED);
 						MtmReconnectNode(i+1); /* set reconnect mask to force node reconnent */
 						//MtmOnNodeConnect(i+1);
 					}
-					MTM_LOG4("Send heartbeat to node %d with timestamp %lld", i+1, now);    
+					MTM_LOG4("%s heartbeat to node %d with timestamp %lld", busy ? "Piggyback" : "Send", i+1, now);    
 				}
 			} else { 
-				MTM_LOG2("Do not send heartbeat to node %d, busy mask %lld, status %s", i+1, (long long) busy_mask, MtmNodeStatusMnem[Mtm->status]);
+				MTM_LOG2("Do not send heartbeat to node %d, status %s", i+1, MtmNodeStatusMnem[Mtm->status]);
 			}
 		}
 	}
-	
+	MtmFlushNodes();
 }
 
 /* This function shoudl be called from all places where sender can be blocked.
@@ -411,124 +571,683 @@ void MtmCheckHeartbeat()
 }
 
 
-static int MtmConnectSocket(int node, int port, time_t timeout)
+/*
+ * ---
+ * Compact wire format of arbiter messages.
+ * It is negotiated in handshake: if both sides support it, messages sent between two flushes 
+ * are packed in one frame: varint length of frame followed by encoded messages.
+ * Each message is encoded as code, flags and varints, masks, oldest snapshot and CSN are delta-encoded 
+ * against the previous message in this connection. Gid is sent only in poll messages,
+ * votes are identified by xid.
+ * Handshake itself is always sent in fixed-size format.
+ * ---
+ */
+
+#define MTM_WIRE_XIDS      0x01  /* dxid and sxid are present */
+#define MTM_WIRE_STATUS    0x02  /* transaction status is present */
+#define MTM_WIRE_GID       0x04  /* gid is present */
+#define MTM_WIRE_MASKS     0x08  /* nodemasks differ from previous message */
+#define MTM_WIRE_SNAPSHOT  0x10  /* oldest snapshot differs from previous message */
+
+/* code + flags + 2 xids + status + 3 timestamps + 2 masks + gid */
+#define MTM_WIRE_MAX_MSG_SIZE (2 + 2*5 + 1 + 3*10 + 2*10 + 1 + MULTIMASTER_MAX_GID_SIZE)
+#define MTM_WIRE_MAX_BATCH    256
+
+static int MtmWriteVarint(char* dst, uint64 val)
+{
+	int n = 0;
+	while (val >= 0x80) { 
+		dst[n++] = (char)(val | 0x80);
+		val >>= 7;
+	}
+	dst[n++] = (char)val;
+	return n;
+}
+
+static bool MtmReadVarint(char const** src, char const* end, uint64* val)
+{
+	char const* p = *src;
+	uint64 result = 0;
+	int shift = 0;
+	while (p < end && shift < 64) { 
+		uint8 b = (uint8)*p++;
+		result |= (uint64)(b & 0x7F) << shift;
+		if (!(b & 0x80)) { 
+			*val = result;
+			*src = p;
+			return true;
+		}
+		shift += 7;
+	}
+	return false;
+}
+
+#define ZIGZAG_ENCODE(x) (((uint64)(x) << 1) ^ (uint64)((int64)(x) >> 63))
+#define ZIGZAG_DECODE(x) ((int64)((x) >> 1) ^ -(int64)((x) & 1))
+
+static int MtmEncodeMessage(MtmWireState* state, char* dst, MtmArbiterMessage const* msg)
+{
+	int n = 0;
+	uint8 flags = 0;
+
+	if (msg->code != MSG_HEARTBEAT && msg->code != MSG_POLL_REQUEST) { 
+		flags |= MTM_WIRE_XIDS;
+	}
+	if (msg->code == MSG_POLL_STATUS || msg->code == MSG_SEQ_RESPONSE || msg->code == MSG_TRACE_EVENT) { 
+		flags |= MTM_WIRE_STATUS;
+	}
+	if (msg->code == MSG_POLL_REQUEST || msg->code == MSG_POLL_STATUS || msg->code == MSG_TRACE_REQUEST) { 
+		flags |= MTM_WIRE_GID;
+	}
+	if (msg->disabledNodeMask != state->disabledNodeMask || msg->connectivityMask != state->connectivityMask) { 
+		flags |= MTM_WIRE_MASKS;
+	}
+	if (msg->oldestSnapshot != state->oldestSnapshot) { 
+		flags |= MTM_WIRE_SNAPSHOT;
+	}
+	dst[n++] = (char)msg->code;
+	dst[n++] = (char)flags;
+	if (flags & MTM_WIRE_XIDS) { 
+		n += MtmWriteVarint(dst + n, msg->dxid);
+		n += MtmWriteVarint(dst + n, msg->sxid);
+	}
+	if (flags & MTM_WIRE_STATUS) { 
+		dst[n++] = (char)msg->status;
+	}
+	n += MtmWriteVarint(dst + n, ZIGZAG_ENCODE(msg->csn - state->csn));
+	state->csn = msg->csn;
+	if (flags & MTM_WIRE_SNAPSHOT) { 
+		n += MtmWriteVarint(dst + n, ZIGZAG_ENCODE(msg->oldestSnapshot - state->oldestSnapshot));
+		state->oldestSnapshot = msg->oldestSnapshot;
+	}
+	if (flags & MTM_WIRE_MASKS) { 
+		/* xor with previous value contains only changed bits */
+		n += MtmWriteVarint(dst + n, msg->disabledNodeMask ^ state->disabledNodeMask);
+		n += MtmWriteVarint(dst + n, msg->connectivityMask ^ state->connectivityMask);
+		state->disabledNodeMask = msg->disabledNodeMask;
+		state->connectivityMask = msg->connectivityMask;
+	}
+	if (flags & MTM_WIRE_GID) { 
+		int len = strnlen(msg->gid, MULTIMASTER_MAX_GID_SIZE-1);
+		dst[n++] = (char)len;
+		memcpy(dst + n, msg->gid, len);
+		n += len;
+	}
+	Assert(n <= MTM_WIRE_MAX_MSG_SIZE);
+	return n;
+}
+
+static bool MtmDecodeMessage(MtmWireState* state, char const** src, char const* end, MtmArbiterMessage* msg, int node)
+{
+	char const* p = *src;
+	uint8 flags;
+	uint64 val;
+
+	if (end - p < 2) { 
+		return false;
+	}
+	memset(msg, 0, sizeof(*msg));
+	msg->code = (MtmMessageCode)(uint8)*p++;
+	flags = (uint8)*p++;
+	msg->node = node+1;
+	if (flags & MTM_WIRE_XIDS) { 
+		if (!MtmReadVarint(&p, end, &val)) return false;
+		msg->dxid = (TransactionId)val;
+		if (!MtmReadVarint(&p, end, &val)) return false;
+		msg->sxid = (TransactionId)val;
+	}
+	if (flags & MTM_WIRE_STATUS) { 
+		if (p == end) return false;
+		msg->status = (XidStatus)(uint8)*p++;
+	}
+	if (!MtmReadVarint(&p, end, &val)) return false;
+	state->csn += ZIGZAG_DECODE(val);
+	msg->csn = state->csn;
+	if (flags & MTM_WIRE_SNAPSHOT) { 
+		if (!MtmReadVarint(&p, end, &val)) return false;
+		state->oldestSnapshot += ZIGZAG_DECODE(val);
+	}
+	msg->oldestSnapshot = state->oldestSnapshot;
+	if (flags & MTM_WIRE_MASKS) { 
+		if (!MtmReadVarint(&p, end, &val)) return false;
+		state->disabledNodeMask ^= val;
+		if (!MtmReadVarint(&p, end, &val)) return false;
+		state->connectivityMask ^= val;
+	}
+	msg->disabledNodeMask = state->disabledNodeMask;
+	msg->connectivityMask = state->connectivityMask;
+	if (flags & MTM_WIRE_GID) { 
+		int len;
+		if (p == end) return false;
+		len = (uint8)*p++;
+		if (len >= MULTIMASTER_MAX_GID_SIZE || end - p < len) return false;
+		memcpy(msg->gid, p, len);
+		p += len;
+	}
+	*src = p;
+	return true;
+}
+
+/*
+ * ---
+ * Sender side of arbiter connections.
+ * All outgoing connections are non-blocking: each peer has its own output buffer
+ * and connection state machine, so slow or unavailable node doesn't block delivery of messages to other nodes.
+ * ---
+ */
+
+static void MtmPeerSetState(int node, MtmPeerState state)
+{
+	MtmPeer* peer = &peers[node];
+	if ((peer->state == MTM_PEER_DISCONNECTED || peer->state == MTM_PEER_WAIT_RETRY) 
+		!= (state == MTM_PEER_DISCONNECTED || state == MTM_PEER_WAIT_RETRY)) 
+	{
+		/* set of sockets is changed */
+		sender_events_changed = true;
+		BIT_SET(sender_stale_mask, node);
+	}
+	peer->state = state;
+}
+
+static void MtmPeerClose(int node)
+{
+	MtmPeer* peer = &peers[node];
+	if (peer->sd >= 0) { 
+		close(peer->sd);
+		peer->sd = -1;
+	}
+	sockets[node] = -1;
+	/* Frame which was not completely written will be resent after reconnect */
+	peer->wireUsed = peer->wireSent = peer->frameRaw = 0;
+}
+
+/*
+ * Connection attempt failed: retry it later or give up if deadline is expired.
+ */
+static void MtmPeerConnectFailed(int node)
+{
+	MtmPeer* peer = &peers[node];
+	timestamp_t now = MtmGetSystemTime();
+
+	MtmPeerClose(node);
+	if (now >= peer->deadline) { 
+		elog(WARNING, "Arbiter failed to connect to %s:%d", Mtm->nodes[node].con.hostName, Mtm->nodes[node].con.arbiterPort);
+		peer->used = peer->sent = 0; /* messages for unreachable node are lost */
+		MtmPeerSetState(node, MTM_PEER_DISCONNECTED);
+		MtmOnNodeDisconnect(node+1);
+	} else { 
+		peer->retryTime = Min(now + MSEC_TO_USEC(MtmHeartbeatSendTimeout), peer->deadline);
+		MtmPeerSetState(node, MTM_PEER_WAIT_RETRY);
+	}
+}
+
+static void MtmPeerStartHandshake(int node)
 {
+	MtmPeer* peer = &peers[node];
+
+	if (!peer->isUnix) { 
+		MtmSetSocketOptions(peer->sd);
+	}
+	peer->req.hdr.code = MSG_HANDSHAKE;
+	peer->req.hdr.node = MtmNodeId;
+	peer->req.hdr.dxid = HANDSHAKE_MAGIC;
+	peer->req.hdr.sxid = ShmemVariableCache->nextXid;
+	peer->req.hdr.csn  = MtmGetCurrentTime();
+	peer->req.hdr.disabledNodeMask = Mtm->disabledNodeMask;
+	peer->req.hdr.connectivityMask = SELF_CONNECTIVITY_MASK;
+	strcpy(peer->req.hdr.gid, MTM_WIRE_PROTO_TAG);
+	strcpy(peer->req.connStr, Mtm->nodes[MtmNodeId-1].con.connStr);
+	peer->reqSent = 0;
+	peer->respReceived = 0;
+	MtmPeerSetState(node, MTM_PEER_HANDSHAKE);
+}
+
+/*
+ * Try to connect to the node through Unix socket.
+ * Returns false if connection should be established using TCP.
+ */
+static bool MtmPeerConnectUnix(int node)
+{
+	MtmPeer* peer = &peers[node];
+	struct sockaddr_un sock_unix;
+	int rc;
+
+	sock_unix.sun_family = AF_UNIX;
+	if (!MtmGetArbiterSocketPath(Mtm->nodes[node].con.arbiterPort, sock_unix.sun_path, sizeof(sock_unix.sun_path))) { 
+		return false;
+	}
+	peer->sd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (peer->sd < 0) {
+		elog(LOG, "Arbiter failed to create Unix socket: %d", errno);
+		return false;
+	}
+	if (fcntl(peer->sd, F_SETFL, O_NONBLOCK) < 0) {
+		elog(LOG, "Arbiter failed to switch socket to non-blocking mode: %d", errno);
+		MtmPeerClose(node);
+		return false;
+	}
+	do {
+		rc = connect(peer->sd, (struct sockaddr*)&sock_unix, sizeof(sock_unix));
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0 && errno != EINPROGRESS && errno != EAGAIN) { 
+		/* No such socket: node is not really local or uses different socket directory */
+		MTM_LOG1("Arbiter failed to connect to node %d through Unix socket %s: %d, use TCP", node+1, sock_unix.sun_path, errno);
+		MtmPeerClose(node);
+		peer->local = false;
+		return false;
+	}
+	peer->isUnix = true;
+	if (rc == 0) {
+		MtmPeerStartHandshake(node);
+	} else { 
+		MtmPeerSetState(node, MTM_PEER_CONNECTING);
+	}
+	return true;
+}
+
+/*
+ * Initiate non-blocking connect to the node
+ */
+static void MtmPeerConnect(int node)
+{
+	MtmPeer* peer = &peers[node];
+	char const* host = Mtm->nodes[node].con.hostName;
+	int port = Mtm->nodes[node].con.arbiterPort;
     struct sockaddr_in sock_inet;
     unsigned addrs[MAX_ROUTES];
     unsigned i, n_addrs = sizeof(addrs) / sizeof(addrs[0]);
-	MtmHandshakeMessage req;
-	MtmArbiterMessage   resp;
-	int sd;
-	timestamp_t start = MtmGetSystemTime();
-	char const* host = Mtm->nodes[node].con.hostName;
-	nodemask_t save_mask = busy_mask;
-	timestamp_t afterWait;
-	timestamp_t beforeWait;
+	int rc = -1;
 
-    sock_inet.sin_family = AF_INET;
-	sock_inet.sin_port = htons(port);
+	Assert(peer->sd < 0);
+
+	if (peer->local && MtmPeerConnectUnix(node)) { 
+		return;
+	}
+	peer->isUnix = false;
 
 	if (!MtmResolveHostByName(host, addrs, &n_addrs)) {
 		elog(LOG, "Arbiter failed to resolve host '%s' by name", host);
-		return -1;
+		MtmPeerConnectFailed(node);
+		return;
 	}
-	BIT_SET(busy_mask, node);
-	
-  Retry:
-    while (1) {
-		int rc = -1;
-		sd = socket(AF_INET, SOCK_STREAM, 0);
-		if (sd < 0) {
-			elog(LOG, "Arbiter failed to create socket: %d", errno);
-			busy_mask = save_mask;
-			return -1;
+    sock_inet.sin_family = AF_INET;
+	sock_inet.sin_port = htons(port);
+
+	peer->sd = socket(AF_INET, SOCK_STREAM, 0);
+	if (peer->sd < 0) {
+		elog(LOG, "Arbiter failed to create socket: %d", errno);
+		MtmPeerConnectFailed(node);
+		return;
+	}
+	if (fcntl(peer->sd, F_SETFL, O_NONBLOCK) < 0) {
+		elog(LOG, "Arbiter failed to switch socket to non-blocking mode: %d", errno);
+		MtmPeerConnectFailed(node);
+		return;
+	}
+	for (i = 0; i < n_addrs; ++i) {
+		memcpy(&sock_inet.sin_addr, &addrs[i], sizeof sock_inet.sin_addr);
+		do {
+			rc = connect(peer->sd, (struct sockaddr*)&sock_inet, sizeof(sock_inet));
+		} while (rc < 0 && errno == EINTR);
+
+		if (rc >= 0 || errno == EINPROGRESS) {
+			break;
 		}
-		rc = fcntl(sd, F_SETFL, O_NONBLOCK);
-		if (rc < 0) {
-			elog(LOG, "Arbiter failed to switch socket to non-blocking mode: %d", errno);
-			busy_mask = save_mask;
-			return -1;
+	}
+	if (rc == 0) {
+		MtmPeerStartHandshake(node);
+	} else if (errno == EINPROGRESS) { 
+		MtmPeerSetState(node, MTM_PEER_CONNECTING);
+	} else { 
+		elog(WARNING, "Arbiter trying to connect to %s:%d: error=%d", host, port, errno);
+		MtmPeerConnectFailed(node);
+	}
+}
+
+/*
+ * Start new connection to the node, giving up after timeout (msec).
+ */
+static void MtmPeerStartConnect(int node, time_t timeout)
+{
+	MtmPeer* peer = &peers[node];
+	Assert(peer->state == MTM_PEER_DISCONNECTED);
+	peer->deadline = MtmGetSystemTime() + MSEC_TO_USEC(timeout);
+	MtmPeerConnect(node);
+}
+
+/*
+ * Established connection is broken: try to reestablish it and resend messages
+ */
+static void MtmPeerFailed(int node)
+{
+	elog(WARNING, "Arbiter fail to write to node %d: %d", node+1, errno);
+	MtmPeerClose(node);
+	MtmPeerSetState(node, MTM_PEER_DISCONNECTED);
+	MtmPeerStartConnect(node, MtmReconnectTimeout);
+}
+
+/*
+ * Prepare frame with messages from the output buffer.
+ * Peers not supporting compact format receive messages as is.
+ */
+static void MtmPeerEncode(int node)
+{
+	MtmPeer* peer = &peers[node];
+	int nMsgs = Min((peer->used - peer->sent)/sizeof(MtmArbiterMessage), MTM_WIRE_MAX_BATCH);
+	MtmArbiterMessage* msgs = (MtmArbiterMessage*)(peer->buf + peer->sent);
+
+	if (peer->wire == NULL) { 
+		peer->wire = MemoryContextAlloc(TopMemoryContext, 5 + MTM_WIRE_MAX_BATCH*Max(sizeof(MtmArbiterMessage), MTM_WIRE_MAX_MSG_SIZE));
+	}
+	peer->frameRaw = nMsgs*sizeof(MtmArbiterMessage);
+	if (MtmTraceSampleRatio != 0) { 
+		int i;
+		for (i = 0; i < nMsgs; i++) { 
+			if (msgs[i].code == MSG_PREPARED) { 
+				MTM_PROFILE(msgs[i].gid, MTM_EV_VOTE_SENT, node+1, MtmGetSystemTime());
+			}
+		}
+	}
+	if (peer->compact) { 
+		/* Reserve space for frame length and store it just before the messages */
+		int i, len = 5, hdrLen;
+		char hdr[5];
+		for (i = 0; i < nMsgs; i++) { 
+			len += MtmEncodeMessage(&peer->wireState, peer->wire + len, &msgs[i]);
 		}
-		for (i = 0; i < n_addrs; ++i) {
-			memcpy(&sock_inet.sin_addr, &addrs[i], sizeof sock_inet.sin_addr);
-			do {
-				rc = connect(sd, (struct sockaddr*)&sock_inet, sizeof(sock_inet));
-			} while (rc < 0 && errno == EINTR);
+		hdrLen = MtmWriteVarint(hdr, len - 5);
+		memcpy(peer->wire + 5 - hdrLen, hdr, hdrLen);
+		peer->wireSent = 5 - hdrLen;
+		peer->wireUsed = len;
+	} else { 
+		memcpy(peer->wire, msgs, peer->frameRaw);
+		peer->wireSent = 0;
+		peer->wireUsed = peer->frameRaw;
+	}
+}
 
-			if (rc >= 0 || errno == EINPROGRESS) {
+static void MtmPeerFlush(int node)
+{
+	MtmPeer* peer = &peers[node];
+	if (peer->state != MTM_PEER_CONNECTED) {
+		return;
+	}
+	while (true) { 
+		int rc;
+		if (peer->wireSent == peer->wireUsed) { 
+			/* previous frame is completely written */
+			peer->sent += peer->frameRaw;
+			peer->frameRaw = 0;
+			if (peer->sent == peer->used) { 
 				break;
 			}
+			MtmPeerEncode(node);
 		}
-		if (rc == 0) {
-			break;
+		rc = send(peer->sd, peer->wire + peer->wireSent, peer->wireUsed - peer->wireSent, 0);
+		if (rc < 0) { 
+			if (errno == EINTR) { 
+				continue;
+			}
+			if (errno != EAGAIN && errno != EWOULDBLOCK) { 
+				MtmPeerFailed(node);
+			}
+			return;
 		}
-		beforeWait = MtmGetSystemTime();
-		if (errno != EINPROGRESS || start + MSEC_TO_USEC(timeout) < beforeWait ) {
-			elog(WARNING, "Arbiter failed to connect to %s:%d: error=%d", host, port, errno);
-			close(sd);
-			busy_mask = save_mask;
-			return -1;
-		} else {
-			rc = MtmWaitSocket(sd, true, MtmHeartbeatSendTimeout);
-			if (rc == 1) {
-				socklen_t optlen = sizeof(int); 
-				if (getsockopt(sd, SOL_SOCKET, SO_ERROR, (void*)&rc, &optlen) < 0) { 
-					elog(WARNING, "Arbiter failed to getsockopt for %s:%d: error=%d", host, port, errno);
-					close(sd);
-					busy_mask = save_mask;
-					return -1;
-				}
-				if (rc == 0) { 
+		peer->wireSent += rc;
+	}
+	peer->sent = peer->used = 0;
+}
+
+/*
+ * Append message to the output buffer of the node, initiating connection if needed.
+ * Data is written to the socket by MtmPeerFlush.
+ * Returns false if node is not connected and is not going to be connected.
+ */
+static bool MtmSendToNode(int node, void const* buf, int size, time_t reconnectTimeout)
+{	
+	MtmPeer* peer = &peers[node];
+
+	if (BIT_CHECK(Mtm->reconnectMask, node)) {
+		MtmLock(LW_EXCLUSIVE);		
+		BIT_CLEAR(Mtm->reconnectMask, node);
+		MtmUnlock();
+	}
+	if (peer->used + size > peer->size) { 
+		if (peer->sent != 0) { 
+			memmove(peer->buf, peer->buf + peer->sent, peer->used - peer->sent);
+			peer->used -= peer->sent;
+			peer->sent = 0;
+		}
+		if (peer->used + size > peer->size) { 
+			peer->size = Max(peer->size*2, peer->used + size);
+			peer->buf = (peer->buf == NULL) ? MemoryContextAlloc(TopMemoryContext, peer->size) : repalloc(peer->buf, peer->size);
+		}
+	}
+	memcpy(peer->buf + peer->used, buf, size);
+	peer->used += size;
+
+	if (peer->state == MTM_PEER_DISCONNECTED) { 
+		MtmPeerStartConnect(node, reconnectTimeout);
+	}
+	return peer->state != MTM_PEER_DISCONNECTED;
+}
+
+static void MtmFlushNodes(void)
+{
+	int i;
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (peers[i].used != 0) { 
+			MtmPeerFlush(i);
+		}
+	}
+}
+
+/*
+ * Socket of the peer is ready: advance its state
+ */
+static void MtmPeerHandleEvent(int node, uint32 events)
+{
+	MtmPeer* peer = &peers[node];
+	int rc;
+
+	switch (peer->state) { 
+	  case MTM_PEER_CONNECTING:
+	  {
+		  socklen_t optlen = sizeof(int); 
+		  if (getsockopt(peer->sd, SOL_SOCKET, SO_ERROR, (void*)&rc, &optlen) < 0 || rc != 0) { 
+			  elog(WARNING, "Arbiter trying to connect to %s:%d: rc=%d, error=%d", Mtm->nodes[node].con.hostName, Mtm->nodes[node].con.arbiterPort, rc, errno);
+			  MtmPeerConnectFailed(node);
+		  } else { 
+			  MtmPeerStartHandshake(node);
+		  }
+		  break;
+	  }
+	  case MTM_PEER_HANDSHAKE:
+		if (peer->reqSent < sizeof(peer->req)) { 
+			rc = send(peer->sd, (char*)&peer->req + peer->reqSent, sizeof(peer->req) - peer->reqSent, 0);
+			if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) { 
+				break;
+			}
+			if (rc < 0) { 
+				elog(WARNING, "Arbiter failed to send handshake message to %s:%d: %d", Mtm->nodes[node].con.hostName, Mtm->nodes[node].con.arbiterPort, errno);
+				MtmPeerConnectFailed(node);
+				break;
+			}
+			peer->reqSent += rc;
+		} else { 
+			rc = recv(peer->sd, (char*)&peer->resp + peer->respReceived, sizeof(peer->resp) - peer->respReceived, 0);
+			if (rc < 0 && (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)) { 
+				break;
+			}
+			if (rc <= 0) { 
+				elog(WARNING, "Arbiter failed to receive response for handshake message from %s:%d: errno=%d", Mtm->nodes[node].con.hostName, Mtm->nodes[node].con.arbiterPort, errno);
+				MtmPeerConnectFailed(node);
+				break;
+			}
+			peer->respReceived += rc;
+			if (peer->respReceived == sizeof(peer->resp)) { 
+				if (peer->resp.code != MSG_STATUS || peer->resp.dxid != HANDSHAKE_MAGIC) {
+					elog(WARNING, "Arbiter get unexpected response %d for handshake message from %s:%d", peer->resp.code, Mtm->nodes[node].con.hostName, Mtm->nodes[node].con.arbiterPort);
+					MtmPeerConnectFailed(node);
 					break;
-				} else { 
-					elog(WARNING, "Arbiter trying to connect to %s:%d: rc=%d, error=%d", host, port, rc, errno);
 				}
-			} else { 
-				elog(WARNING, "Arbiter waiting socket to %s:%d: rc=%d, error=%d", host, port, rc, errno);
+				MtmLock(LW_EXCLUSIVE);
+				MtmCheckResponse(&peer->resp);
+				MtmUnlock();
+
+				MtmOnNodeConnect(node+1);
+
+				peer->compact = strncmp(peer->resp.gid, MTM_WIRE_PROTO_TAG, MULTIMASTER_MAX_GID_SIZE) == 0;
+				memset(&peer->wireState, 0, sizeof(peer->wireState));
+				sockets[node] = peer->sd;
+				MtmPeerSetState(node, MTM_PEER_CONNECTED);
+				MTM_LOG1("Arbiter established connection with node %d, %s wire format", node+1, peer->compact ? "compact" : "fixed-size");
+				MtmPeerFlush(node);
 			}
-			close(sd);
-			afterWait = MtmGetSystemTime();
-			if (afterWait < beforeWait + MSEC_TO_USEC(MtmHeartbeatSendTimeout)) {
-				MtmSleep(beforeWait + MSEC_TO_USEC(MtmHeartbeatSendTimeout) - afterWait);
+		}
+		break;
+	  case MTM_PEER_CONNECTED:
+		if (events & WL_SOCKET_READABLE) { 
+			/* Nothing is expected from the peer, so it is EOF or error */
+			char c;
+			rc = recv(peer->sd, &c, sizeof c, 0);
+			if (rc == 0 || (rc < 0 && errno != EINTR && errno != EAGAIN && errno != EWOULDBLOCK)) { 
+				MtmPeerFailed(node);
+				break;
 			}
 		}
+		if (events & WL_SOCKET_WRITEABLE) { 
+			MtmPeerFlush(node);
+		}
+		break;
+	  default:
+		break;
 	}
-	MtmSetSocketOptions(sd);
-	req.hdr.code = MSG_HANDSHAKE;
-	req.hdr.node = MtmNodeId;
-	req.hdr.dxid = HANDSHAKE_MAGIC;
-	req.hdr.sxid = ShmemVariableCache->nextXid;
-	req.hdr.csn  = MtmGetCurrentTime();
-	req.hdr.disabledNodeMask = Mtm->disabledNodeMask;
-	req.hdr.connectivityMask = SELF_CONNECTIVITY_MASK;
-	strcpy(req.connStr, Mtm->nodes[MtmNodeId-1].con.connStr);
-	if (!MtmWriteSocket(sd, &req, sizeof req)) { 
-		elog(WARNING, "Arbiter failed to send handshake message to %s:%d: %d", host, port, errno);
-		close(sd);
-		goto Retry;
-	}
-	if (MtmReadSocket(sd, &resp, sizeof resp) != sizeof(resp)) { 
-		elog(WARNING, "Arbiter failed to receive response for handshake message from %s:%d: errno=%d", host, port, errno);
-		close(sd);
-		goto Retry;
-	}
-	if (resp.code != MSG_STATUS || resp.dxid != HANDSHAKE_MAGIC) {
-		elog(WARNING, "Arbiter get unexpected response %d for handshake message from %s:%d", resp.code, host, port);
-		close(sd);
-		goto Retry;
+}
+
+static uint32 MtmPeerEvents(MtmPeer* peer)
+{
+	switch (peer->state) { 
+	  case MTM_PEER_CONNECTING:
+		return WL_SOCKET_WRITEABLE;
+	  case MTM_PEER_HANDSHAKE:
+		return peer->reqSent < sizeof(peer->req) ? WL_SOCKET_WRITEABLE : WL_SOCKET_READABLE;
+	  case MTM_PEER_CONNECTED:
+		return peer->sent < peer->used ? WL_SOCKET_READABLE|WL_SOCKET_WRITEABLE : WL_SOCKET_READABLE;
+	  default:
+		return 0;
 	}
-	
-	MtmLock(LW_EXCLUSIVE);
-	MtmCheckResponse(&resp);
-	MtmUnlock();
+}
 
-	MtmOnNodeConnect(node+1);
+/*
+ * Wait for new messages in the send queue or for readiness of peer sockets.
+ * timeout is in milliseconds, -1 means infinite wait.
+ */
+static void MtmSenderPoll(long timeout)
+{
+	WaitEvent events[MAX_NODES+2];
+	timestamp_t now = MtmGetSystemTime();
+	int i, n;
+
+	/* Retry delayed connections and calculate wait timeout */
+	for (i = 0; i < Mtm->nAllNodes; i++) {
+		MtmPeer* peer = &peers[i];
+		if (peer->state == MTM_PEER_WAIT_RETRY && peer->retryTime <= now) { 
+			MtmPeerConnect(i);
+		}
+		if (peer->state == MTM_PEER_WAIT_RETRY) { 
+			long delay = (long)USEC_TO_MSEC(peer->retryTime - now) + 1;
+			if (timeout < 0 || delay < timeout) { 
+				timeout = delay;
+			}
+		} else if (peer->state == MTM_PEER_CONNECTING || peer->state == MTM_PEER_HANDSHAKE) { 
+			long delay = peer->deadline > now ? (long)USEC_TO_MSEC(peer->deadline - now) + 1 : 0;
+			if (timeout < 0 || delay < timeout) { 
+				timeout = delay;
+			}
+		}
+	}
 
-	busy_mask = save_mask;
+	/* WaitEventSet doesn't allow to remove sockets, so rebuild it when set of connections is changed */
+	if (sender_events_changed) { 
+		if (sender_events != NULL) { 
+			FreeWaitEventSet(sender_events);
+		}
+		sender_events = CreateWaitEventSet(TopMemoryContext, Mtm->nAllNodes + 2);
+		AddWaitEventToSet(sender_events, WL_LATCH_SET, PGINVALID_SOCKET, MyLatch, NULL);
+		AddWaitEventToSet(sender_events, WL_POSTMASTER_DEATH, PGINVALID_SOCKET, NULL, NULL);
+		for (i = 0; i < Mtm->nAllNodes; i++) {
+			MtmPeer* peer = &peers[i];
+			peer->events = MtmPeerEvents(peer);
+			peer->eventPos = peer->events ? AddWaitEventToSet(sender_events, peer->events, peer->sd, NULL, (void*)(size_t)i) : -1;
+		}
+		sender_events_changed = false;
+	} else { 
+		for (i = 0; i < Mtm->nAllNodes; i++) {
+			MtmPeer* peer = &peers[i];
+			uint32 wanted = MtmPeerEvents(peer);
+			if (peer->eventPos >= 0 && wanted != peer->events) { 
+				ModifyWaitEvent(sender_events, peer->eventPos, wanted, NULL);
+				peer->events = wanted;
+			}
+		}
+	}
+
+	n = WaitEventSetWait(sender_events, timeout, events, lengthof(events));
+	sender_stale_mask = 0;
+	for (i = 0; i < n; i++) { 
+		if (events[i].events & WL_POSTMASTER_DEATH) { 
+			proc_exit(1);
+		}
+		if (events[i].events & (WL_SOCKET_READABLE|WL_SOCKET_WRITEABLE)) { 
+			int node = (int)(size_t)events[i].user_data;
+			/* socket may be already closed while handling previous events */
+			if (!BIT_CHECK(sender_stale_mask, node)) { 
+				MtmPeerHandleEvent(node, events[i].events);
+			}
+		}
+	}
+	/* Handle expired connection attempts */
+	now = MtmGetSystemTime();
+	for (i = 0; i < Mtm->nAllNodes; i++) {
+		MtmPeer* peer = &peers[i];
+		if ((peer->state == MTM_PEER_CONNECTING || peer->state == MTM_PEER_HANDSHAKE) && peer->deadline <= now) { 
+			elog(WARNING, "Arbiter waiting socket to %s:%d: timeout", Mtm->nodes[i].con.hostName, Mtm->nodes[i].con.arbiterPort);
+			MtmPeerConnectFailed(i);
+		}
+	}
+}
 
-	return sd;
+/*
+ * Move messages from shared send queue to output buffers of peers
+ */
+static void MtmDrainSendQueue(void)
+{
+	MtmArbiterMessage msg;
+	timestamp_t now = 0;
+	while (MtmDequeueMessage(&msg)) { 
+		int node = msg.node-1;
+		msg.node = MtmNodeId;
+		if (MtmSendToNode(node, &msg, sizeof(msg), MtmReconnectTimeout) && sockets[node] >= 0) { 
+			if (now == 0) { 
+				now = MtmGetSystemTime();
+			}
+			last_message_to_node[node] = now;
+		}
+	}
 }
 
+static bool MtmPeersConnecting(void)
+{
+	int i;
+	for (i = 0; i < Mtm->nAllNodes; i++) {
+		if (peers[i].state != MTM_PEER_DISCONNECTED && peers[i].state != MTM_PEER_CONNECTED) { 
+			return true;
+		}
+	}
+	return false;
+}
 
 static void MtmOpenConnections()
 {
@@ -536,18 +1255,30 @@ static void MtmOpenConnections()
 	int i;
 
 	sockets = (int*)palloc(sizeof(int)*nNodes);
+	peers = (MtmPeer*)palloc0(sizeof(MtmPeer)*nNodes);
 
 	for (i = 0; i < nNodes; i++) {
 		sockets[i] = -1;
+		peers[i].sd = -1;
+		peers[i].eventPos = -1;
 	}
+	sender_events_changed = true;
+
+	/* Connect to all nodes in parallel */
 	for (i = 0; i < nNodes; i++) {
 		if (i+1 != MtmNodeId && i < Mtm->nAllNodes) { 
-			sockets[i] = MtmConnectSocket(i, Mtm->nodes[i].con.arbiterPort, MtmConnectTimeout);
-			if (sockets[i] < 0) { 
-				MtmOnNodeDisconnect(i+1);
-			} 
+			peers[i].local = MtmIsLocalHost(Mtm->nodes[i].con.hostName);
+			MtmPeerStartConnect(i, MtmConnectTimeout);
 		}
 	}
+	while (!stop && MtmPeersConnecting()) { 
+		MtmSenderPoll(-1);
+		ResetLatch(MyLatch);
+		MtmCheckHeartbeat();
+		/* Do not let send queue overflow while connecting */
+		MtmDrainSendQueue();
+		MtmFlushNodes();
+	}
 	if (Mtm->nLiveNodes < Mtm->nAllNodes/2+1) { /* no quorum */
 		elog(WARNING, "Node is out of quorum: only %d nodes of %d are accessible", Mtm->nLiveNodes, Mtm->nAllNodes);
 		MtmSwitchClusterMode(MTM_IN_MINORITY);
@@ -556,50 +1287,6 @@ static void MtmOpenConnections()
 	}
 }
 
-
-static bool MtmSendToNode(int node, void const* buf, int size, time_t reconnectTimeout)
-{	
-	bool result = true;
-	nodemask_t save_mask = busy_mask;
-	BIT_SET(busy_mask, node);
-	while (true) {
-#if 0
-		/* Original intention was to reestablish connectect when reconnet mask is set to avoid hanged-up connection.
-		 * But reconnectMask is set not only when connection is broken, so breaking connection in all this cases cause avalunch of connection failures.
-		 */
-		if (sockets[node] >= 0 && BIT_CHECK(Mtm->reconnectMask, node)) {
-			elog(WARNING, "Arbiter is forced to reconnect to node %d", node+1); 
-			close(sockets[node]);
-			sockets[node] = -1;
-		}
-#endif
-		if (BIT_CHECK(Mtm->reconnectMask, node)) {
-			MtmLock(LW_EXCLUSIVE);		
-			BIT_CLEAR(Mtm->reconnectMask, node);
-			MtmUnlock();
-		}
-		if (sockets[node] < 0 || !MtmWriteSocket(sockets[node], buf, size)) {
-			if (sockets[node] >= 0) { 
-				elog(WARNING, "Arbiter fail to write to node %d: %d", node+1, errno);
-				close(sockets[node]);
-				sockets[node] = -1;
-			}
-			sockets[node] = MtmConnectSocket(node, Mtm->nodes[node].con.arbiterPort, reconnectTimeout);
-			if (sockets[node] < 0) { 
-				MtmOnNodeDisconnect(node+1);
-				result = false;
-				break;
-			}
-			MTM_LOG1("Arbiter reestablish connection with node %d", node+1);
-		} else { 
-			result = true;
-			break;
-		}
-	}
-	busy_mask = save_mask;
-	return result;
-}
-
 static int MtmReadFromNode(int node, void* buf, int buf_size)
 {
 	int rc = MtmReadSocket(sockets[node], buf, buf_size);
@@ -610,11 +1297,13 @@ static int MtmReadFromNode(int node, void* buf, int buf_size)
 	return rc;
 }
 
-static void MtmAcceptOneConnection()
+static void MtmAcceptOneConnection(int listener)
 {
-	int fd = accept(gateway, NULL, NULL);
+	int fd = accept(listener, NULL, NULL);
 	if (fd < 0) {
-		elog(WARNING, "Arbiter failed to accept socket: %d", errno);
+		if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) { 
+			elog(WARNING, "Arbiter failed to accept socket: %d", errno);
+		}
 	} else { 	
 		MtmHandshakeMessage req;
 		MtmArbiterMessage resp;		
@@ -636,6 +1325,7 @@ static void MtmAcceptOneConnection()
 			MtmCheckResponse(&req.hdr);
 			MtmUnlock();
 
+			memset(&resp, 0, sizeof(resp));
 			resp.code = MSG_STATUS;
 			resp.disabledNodeMask = Mtm->disabledNodeMask;
 			resp.connectivityMask = SELF_CONNECTIVITY_MASK;
@@ -643,24 +1333,226 @@ static void MtmAcceptOneConnection()
 			resp.sxid = ShmemVariableCache->nextXid;
 			resp.csn  = MtmGetCurrentTime();
 			resp.node = MtmNodeId;
+			if (strncmp(req.hdr.gid, MTM_WIRE_PROTO_TAG, MULTIMASTER_MAX_GID_SIZE) == 0) { 
+				strcpy(resp.gid, MTM_WIRE_PROTO_TAG); /* accept compact format */
+			}
 			MtmUpdateNodeConnectionInfo(&Mtm->nodes[node].con, req.connStr);
 			if (!MtmWriteSocket(fd, &resp, sizeof resp)) { 
 				elog(WARNING, "Arbiter failed to write response for handshake message to node %d", node+1);
 				close(fd);
+			} else if (MtmReceiverOf(node) != receiverShard) { 
+				MtmHandOverConnection(node, fd, *resp.gid != '\0');
 			} else { 
-				MTM_LOG1("Arbiter established connection with node %d", node+1); 
-				if (sockets[node] >= 0) { 
-					MtmUnregisterSocket(sockets[node]);
-				}
-				sockets[node] = fd;
-				MtmRegisterSocket(fd, node);
-				MtmOnNodeConnect(node+1);
+				MtmAttachConnection(node, fd, *resp.gid != '\0');
 			}
 		}
 	}
 }
+
+static void MtmAttachConnection(int node, int fd, bool compact)
+{
+	MTM_LOG1("Arbiter established connection with node %d", node+1); 
+	if (sockets[node] >= 0) { 
+		MtmUnregisterSocket(sockets[node]);
+		close(sockets[node]);
+	}
+	sockets[node] = fd;
+	rxBuffer[node].used = 0;
+	rxCompact[node] = compact;
+	memset(&rxState[node], 0, sizeof(MtmWireState));
+	MtmRegisterSocket(fd, node);
+	MtmOnNodeConnect(node+1);
+}
+
+/*
+ * ---
+ * Passing connections between receivers
+ * ---
+ */
+
+static bool MtmGetHandoffSocketPath(int shard, char* path, size_t size)
+{
+	size_t len;
+	if (!MtmGetArbiterSocketPath(MtmArbiterPort, path, size)) { 
+		return false;
+	}
+	len = strlen(path);
+	return snprintf(path + len, size - len, ".%d", shard) < size - len;
+}
+
+/*
+ * Receiver 0 accepts all connections and performs handshake.
+ * Connection is then passed to the receiver owning the node using SCM_RIGHTS.
+ * If owner is not ready, connection is closed and peer will reconnect.
+ */
+static void MtmHandOverConnection(int node, int fd, bool compact)
+{
+	struct sockaddr_un addr;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg;
+	union { 
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	MtmHandoffMessage body;
+	int rc;
+
+	if (handoff < 0) { 
+		handoff = socket(AF_UNIX, SOCK_DGRAM, 0);
+		if (handoff < 0) {
+			elog(WARNING, "Arbiter failed to create Unix socket: %d", errno);
+			close(fd);
+			return;
+		}
+	}
+	addr.sun_family = AF_UNIX;
+	MtmGetHandoffSocketPath(MtmReceiverOf(node), addr.sun_path, sizeof(addr.sun_path));
+
+	body.node = node;
+	body.compact = compact;
+	iov.iov_base = &body;
+	iov.iov_len = sizeof(body);
+
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_name = &addr;
+	msg.msg_namelen = sizeof(addr);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof(control.buf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+	do { 
+		rc = sendmsg(handoff, &msg, 0);
+	} while (rc < 0 && errno == EINTR);
+
+	if (rc < 0) { 
+		elog(WARNING, "Arbiter failed to pass connection with node %d to receiver %d: %d", node+1, MtmReceiverOf(node), errno);
+	}
+	close(fd); /* descriptor is duplicated in the target process */
+}
+
+static void MtmReceiveHandedConnections(void)
+{
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr* cmsg;
+	union { 
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof(int))];
+	} control;
+	MtmHandoffMessage body;
+	int fd;
+
+	while (true) { 
+		memset(&msg, 0, sizeof(msg));
+		iov.iov_base = &body;
+		iov.iov_len = sizeof(body);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = control.buf;
+		msg.msg_controllen = sizeof(control.buf);
+
+		if (recvmsg(handoff, &msg, 0) != sizeof(body)) { 
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) { 
+				elog(WARNING, "Arbiter failed to receive passed connection: %d", errno);
+			}
+			return;
+		}
+		cmsg = CMSG_FIRSTHDR(&msg);
+		if (cmsg == NULL || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS) { 
+			elog(WARNING, "Arbiter receive connection message without descriptor");
+			continue;
+		}
+		memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+		if (body.node < 0 || body.node >= MtmMaxNodes || MtmReceiverOf(body.node) != receiverShard) { 
+			elog(WARNING, "Arbiter receive connection with node %d which is not served by receiver %d", body.node+1, receiverShard);
+			close(fd);
+			continue;
+		}
+		MtmAttachConnection(body.node, fd, body.compact);
+	}
+}
+
+static void MtmUnlinkHandoffSocket(int code, Datum arg)
+{
+	char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	if (MtmGetHandoffSocketPath(receiverShard, path, sizeof(path))) { 
+		unlink(path);
+	}
+}
+
+static void MtmListenHandoffSocket(void)
+{
+	struct sockaddr_un addr;
+	
+	addr.sun_family = AF_UNIX;
+	if (!MtmGetHandoffSocketPath(receiverShard, addr.sun_path, sizeof(addr.sun_path))) { 
+		elog(ERROR, "Arbiter receiver %d failed to construct Unix socket path", receiverShard);
+	}
+	handoff = socket(AF_UNIX, SOCK_DGRAM, 0);
+	if (handoff < 0) {
+		elog(ERROR, "Arbiter failed to create Unix socket: %d", errno);
+	}
+	unlink(addr.sun_path);
+	if (bind(handoff, (struct sockaddr*)&addr, sizeof(addr)) < 0) { 
+		elog(ERROR, "Arbiter failed to bind Unix socket %s: %d", addr.sun_path, errno);
+	}
+	if (fcntl(handoff, F_SETFL, O_NONBLOCK) < 0) {
+		elog(ERROR, "Arbiter failed to switch socket to non-blocking mode: %d", errno);
+	}
+	on_proc_exit(MtmUnlinkHandoffSocket, 0);
+	gateway = handoff;
+	sockets[MtmNodeId-1] = handoff;
+	MtmRegisterSocket(handoff, MtmNodeId-1);
+}
 	
 
+static void MtmUnlinkArbiterSocket(int code, Datum arg)
+{
+	char path[sizeof(((struct sockaddr_un*)0)->sun_path)];
+	if (MtmGetArbiterSocketPath(MtmArbiterPort, path, sizeof(path))) { 
+		unlink(path);
+	}
+}
+
+/*
+ * Listen Unix socket for connections from nodes located at the same host:
+ * it is cheaper than TCP loopback. Failure is not fatal: such nodes will use TCP.
+ */
+static void MtmListenUnixSocket(void)
+{
+	struct sockaddr_un sock_unix;
+
+	sock_unix.sun_family = AF_UNIX;
+	if (!MtmGetArbiterSocketPath(MtmArbiterPort, sock_unix.sun_path, sizeof(sock_unix.sun_path))) { 
+		return;
+	}
+	gateway_unix = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (gateway_unix < 0) {
+		elog(WARNING, "Arbiter failed to create Unix socket: %d", errno);
+		return;
+	}
+	unlink(sock_unix.sun_path); /* remove socket left after crash */
+	if (bind(gateway_unix, (struct sockaddr*)&sock_unix, sizeof(sock_unix)) < 0
+		|| listen(gateway_unix, MtmMaxNodes) < 0
+		|| fcntl(gateway_unix, F_SETFL, O_NONBLOCK) < 0) 
+	{
+		elog(WARNING, "Arbiter failed to listen Unix socket %s: %d", sock_unix.sun_path, errno);
+		close(gateway_unix);
+		gateway_unix = -1;
+		return;
+	}
+	on_proc_exit(MtmUnlinkArbiterSocket, 0);
+	MtmRegisterSocket(gateway_unix, MtmNodeId-1);
+}
+
 static void MtmAcceptIncomingConnections()
 {
 	struct sockaddr_in sock_inet;
@@ -672,6 +1564,10 @@ static void MtmAcceptIncomingConnections()
 	for (i = 0; i < nNodes; i++) { 
 		sockets[i] = -1;
 	}
+	if (receiverShard != 0) { 
+		MtmListenHandoffSocket();
+		return;
+	}
 	sock_inet.sin_family = AF_INET;
 	sock_inet.sin_addr.s_addr = htonl(INADDR_ANY);
 	sock_inet.sin_port = htons(MtmArbiterPort);
@@ -689,35 +1585,21 @@ static void MtmAcceptIncomingConnections()
 		elog(ERROR, "Arbiter failed to listen socket: %d", errno);
 	}	
 
+	/* Both listening sockets are non-blocking, because readiness of one of them is not distinguished */
+	if (fcntl(gateway, F_SETFL, O_NONBLOCK) < 0) {
+		elog(ERROR, "Arbiter failed to switch socket to non-blocking mode: %d", errno);
+	}
 	sockets[MtmNodeId-1] = gateway;
 	MtmRegisterSocket(gateway, MtmNodeId-1);
-}
-
 
-static void MtmAppendBuffer(MtmBuffer* txBuffer, MtmArbiterMessage* msg)
-{
-	MtmBuffer* buf = &txBuffer[msg->node-1];
-	if (buf->used == buf->size) {
-		if (buf->size == 0) { 
-			buf->size = INIT_BUFFER_SIZE;
-			buf->data = palloc(buf->size * sizeof(MtmArbiterMessage));
-		} else { 
-			buf->size *= 2;
-			buf->data = repalloc(buf->data, buf->size * sizeof(MtmArbiterMessage));
-		}
-	}
-	msg->node = MtmNodeId;
-	buf->data[buf->used++] = *msg;
+	MtmListenUnixSocket();
 }
 
 
 static void MtmSender(Datum arg)
 {
 	sigset_t sset;
-	int nNodes = MtmMaxNodes;
-	int i;
 
-	MtmBuffer* txBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
 	elog(LOG, "Start arbiter sender %d", MyProcPid);
 	InitializeTimeouts();
 
@@ -737,38 +1619,21 @@ static void MtmSender(Datum arg)
 	heartbeat_timer = RegisterTimeout(USER_TIMEOUT, MtmScheduleHeartbeat);
 	enable_timeout_after(heartbeat_timer, MtmHeartbeatSendTimeout);
 
+	Mtm->senderLatch = MyLatch;
+
 	MtmOpenConnections();
 
 	while (!stop) {
-		MtmMessageQueue *curr, *next;		
-		PGSemaphoreLock(&Mtm->sendSemaphore);
+		ResetLatch(MyLatch);
 		CHECK_FOR_INTERRUPTS();
 
 		MtmCheckHeartbeat();
-		/* 
-		 * Use shared lock to improve locality,
-		 * because all other process modifying this list are using exclusive lock 
-		 */
-		SpinLockAcquire(&Mtm->queueSpinlock);
-
-		for (curr = Mtm->sendQueue; curr != NULL; curr = next) {
-			next = curr->next;
-			MtmAppendBuffer(txBuffer, &curr->msg);
-			curr->next = Mtm->freeQueue;
-			Mtm->freeQueue = curr;
-		}
-		Mtm->sendQueue = NULL;
 
-		SpinLockRelease(&Mtm->queueSpinlock);
+		MtmDrainSendQueue();
+		MtmFlushNodes();
 
-		for (i = 0; i < Mtm->nAllNodes; i++) { 
-			if (txBuffer[i].used != 0) { 
-				MtmSendToNode(i, txBuffer[i].data, txBuffer[i].used*sizeof(MtmArbiterMessage), MtmReconnectTimeout);
-				txBuffer[i].used = 0;
-			}
-		}		
-		CHECK_FOR_INTERRUPTS();
-		MtmCheckHeartbeat();
+		/* Wait for new messages or sockets ready for write */
+		MtmSenderPoll(-1);
 	}
 	elog(LOG, "Stop arbiter sender %d", MyProcPid);
 	proc_exit(1); /* force restart of this bgwroker */
@@ -803,6 +1668,7 @@ static bool MtmRecovery()
 static void MtmMonitor(Datum arg)
 {
 	sigset_t sset;
+	timestamp_t lastStandbyHorizonTime = 0;
 
 	signal(SIGINT, SetStop);
 	signal(SIGQUIT, SetStop);
@@ -816,13 +1682,133 @@ static void MtmMonitor(Datum arg)
 	/* Connect to a database */
 	BackgroundWorkerInitializeConnection(MtmDatabaseName, NULL);
 
+	Mtm->monitorLatch = &MyProc->procLatch;
+
 	while (!stop) {
-		int rc = WaitLatch(&MyProc->procLatch, WL_TIMEOUT | WL_POSTMASTER_DEATH, MtmHeartbeatSendTimeout);
+		timestamp_t now;
+		int timeout = MtmStandbySnapshotPeriod != 0 ? Min(MtmHeartbeatSendTimeout, MtmStandbySnapshotPeriod) : MtmHeartbeatSendTimeout;
+		int rc = WaitLatch(&MyProc->procLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, timeout);
 		if (rc & WL_POSTMASTER_DEATH) { 
 			break;
 		}
+		ResetLatch(&MyProc->procLatch);
+		/* Latch is set by backends to request garbage collection and by arbiter on change of connectivity matrix */
 		MtmRefreshClusterStatus();
+		MtmCheckPrewarmCompleted();
+		MtmCollectGarbage();
+		MtmSampleApplyStats();
+		now = MtmGetSystemTime();
+		if (MtmStandbySnapshotPeriod != 0 && now >= lastStandbyHorizonTime + MSEC_TO_USEC(MtmStandbySnapshotPeriod)) { 
+			lastStandbyHorizonTime = now;
+			MtmLogStandbyHorizon();
+		}
+	}
+}
+
+/*
+ * Extract all complete messages received from the node into rxMessages.
+ * Returns number of messages or -1 if connection was broken because of malformed data.
+ */
+static int MtmDecodeMessages(int node)
+{
+	MtmBuffer* rx = &rxBuffer[node];
+	char* data = (char*)rx->data;
+	char const* p = data;
+	char const* end = data + rx->used;
+
+	rxMessages.used = 0;
+	if (!rxCompact[node]) { 
+		int n = rx->used/sizeof(MtmArbiterMessage);
+		if (n > rxMessages.size) { 
+			rxMessages.size = n;
+			rxMessages.data = repalloc(rxMessages.data, n*sizeof(MtmArbiterMessage));
+		}
+		memcpy(rxMessages.data, data, n*sizeof(MtmArbiterMessage));
+		rxMessages.used = n;
+		p += n*sizeof(MtmArbiterMessage);
+	} else { 
+		while (true) { 
+			char const* frame = p;
+			char const* frameEnd;
+			uint64 len;
+			if (!MtmReadVarint(&frame, end, &len)) {
+				break; /* incomplete frame header */
+			}
+			if (len > rx->size - 5) { 
+				goto Malformed;
+			}
+			if (end - frame < len) {
+				break; /* incomplete frame */
+			}
+			frameEnd = frame + len;
+			while (frame < frameEnd) { 
+				if (rxMessages.used == rxMessages.size) { 
+					rxMessages.size *= 2;
+					rxMessages.data = repalloc(rxMessages.data, rxMessages.size*sizeof(MtmArbiterMessage));
+				}
+				if (!MtmDecodeMessage(&rxState[node], &frame, frameEnd, &rxMessages.data[rxMessages.used], node)) { 
+					goto Malformed;
+				}
+				rxMessages.used += 1;
+			}
+			p = frameEnd;
+		}
+	}
+	rx->used = end - p;
+	if (rx->used != 0 && p != data) { 
+		memmove(data, p, rx->used);
 	}
+	return rxMessages.used;
+
+  Malformed:
+	elog(WARNING, "Arbiter received malformed frame from node %d", node+1);
+	rx->used = 0;
+	MtmDisconnect(node);
+	return -1;
+}
+
+/*
+ * ---
+ * Group precommit
+ * ---
+ * When all replicas have prepared transaction, receiver changes its state to precommitted.
+ * It is done for all transactions prepared in the received batch of messages at once,
+ * so WAL is flushed once per batch.
+ */
+static pgid_t* precommitGids;
+static int     precommitUsed;
+static int     precommitSize;
+
+static void MtmAddPrecommit(char const* gid)
+{
+	if (precommitUsed == precommitSize) { 
+		precommitSize = precommitSize == 0 ? INIT_BUFFER_SIZE : precommitSize*2;
+		precommitGids = precommitGids == NULL 
+			? (pgid_t*)palloc(precommitSize*sizeof(pgid_t))
+			: (pgid_t*)repalloc(precommitGids, precommitSize*sizeof(pgid_t));
+	}
+	strcpy(precommitGids[precommitUsed++], gid);
+}
+
+static void MtmFlushPrecommits(void)
+{
+	char const** gids;
+	int i;
+
+	if (precommitUsed == 0) { 
+		return;
+	}
+	gids = (char const**)palloc(precommitUsed*sizeof(char const*));
+	for (i = 0; i < precommitUsed; i++) { 
+		gids[i] = precommitGids[i];
+	}
+	MTM_LOG2("Precommit %d transactions", precommitUsed);
+	MtmResetTransaction();
+	StartTransactionCommand();
+	SetPreparedTransactionsState(precommitUsed, gids, MULTIMASTER_PRECOMMITTED);
+	CommitTransactionCommand();
+	pfree(gids);
+	precommitUsed = 0;
 }
 
 static void MtmReceiver(Datum arg)
@@ -831,11 +1817,12 @@ static void MtmReceiver(Datum arg)
 	int nNodes = MtmMaxNodes;
 	int nResponses;
 	int i, j, n, rc;
-	MtmBuffer* rxBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
 	timestamp_t lastHeartbeatCheck = MtmGetSystemTime();
 	timestamp_t now;
 	timestamp_t selectTimeout = MtmHeartbeatRecvTimeout;
 
+	receiverShard = DatumGetInt32(arg);
+
 #if USE_EPOLL
 	struct epoll_event* events = (struct epoll_event*)palloc(sizeof(struct epoll_event)*nNodes);
     epollfd = epoll_create(nNodes);
@@ -858,10 +1845,16 @@ static void MtmReceiver(Datum arg)
 
 	MtmAcceptIncomingConnections();
 
+	rxBuffer = (MtmBuffer*)palloc0(sizeof(MtmBuffer)*nNodes);
+	rxState = (MtmWireState*)palloc0(sizeof(MtmWireState)*nNodes);
+	rxCompact = (bool*)palloc0(sizeof(bool)*nNodes);
 	for (i = 0; i < nNodes; i++) { 
-		rxBuffer[i].size = INIT_BUFFER_SIZE;
-		rxBuffer[i].data = palloc(INIT_BUFFER_SIZE*sizeof(MtmArbiterMessage));
+		/* size and used are in bytes */
+		rxBuffer[i].size = INIT_BUFFER_SIZE*sizeof(MtmArbiterMessage);
+		rxBuffer[i].data = palloc(rxBuffer[i].size);
 	}
+	rxMessages.size = INIT_BUFFER_SIZE;
+	rxMessages.data = palloc(rxMessages.size*sizeof(MtmArbiterMessage));
 
 	while (!stop) {
 #if USE_EPOLL
@@ -897,12 +1890,20 @@ static void MtmReceiver(Datum arg)
 			elog(ERROR, "Arbiter failed to select sockets: %d", errno);
 		}
 		for (i = 0; i < nNodes; i++) { 
-			if (sockets[i] >= 0 && FD_ISSET(sockets[i], &events)) 
+			if (sockets[i] >= 0 && (FD_ISSET(sockets[i], &events)
+									|| (sockets[i] == gateway && gateway_unix >= 0 && FD_ISSET(gateway_unix, &events))))
 #endif
 			{
 				if (i+1 == MtmNodeId) { 
 					Assert(sockets[i] == gateway);
-					MtmAcceptOneConnection();
+					if (receiverShard != 0) { 
+						MtmReceiveHandedConnections();
+						continue;
+					}
+					MtmAcceptOneConnection(gateway);
+					if (gateway_unix >= 0) { 
+						MtmAcceptOneConnection(gateway_unix);
+					}
 					continue;
 				}  
 				
@@ -913,13 +1914,16 @@ static void MtmReceiver(Datum arg)
 				}
 
 				rxBuffer[i].used += rc;
-				nResponses = rxBuffer[i].used/sizeof(MtmArbiterMessage);
+				nResponses = MtmDecodeMessages(i);
+				if (nResponses < 0) { 
+					continue;
+				}
 
 				
 				MtmLock(LW_EXCLUSIVE);						
 
 				for (j = 0; j < nResponses; j++) { 
-					MtmArbiterMessage* msg = &rxBuffer[i].data[j];
+					MtmArbiterMessage* msg = &rxMessages.data[j];
 					MtmTransState* ts;
 					MtmTransMap* tm;
 					int node = msg->node;
@@ -928,6 +1932,8 @@ static void MtmReceiver(Datum arg)
 
 					if (Mtm->nodes[node-1].connectivityMask != msg->connectivityMask) { 
 						elog(LOG, "Node %d changes it connectivity mask from %llx to %llx", node, (long long)Mtm->nodes[node-1].connectivityMask, (long long)msg->connectivityMask);
+						Mtm->nodes[node-1].connectivityMask = msg->connectivityMask;
+						MtmConnectivityChanged();
 					}
 
 					Mtm->nodes[node-1].oldestSnapshot = msg->oldestSnapshot;
@@ -960,6 +1966,18 @@ static void MtmReceiver(Datum arg)
 						msg->code = MSG_POLL_STATUS;	
 						MtmSendMessage(msg);
 						continue;
+					  case MSG_SEQ_REQUEST:
+						MtmHandleSequenceRequest(msg);
+						continue;
+					  case MSG_SEQ_RESPONSE:
+						MtmHandleSequenceResponse(msg);
+						continue;
+					  case MSG_TRACE_REQUEST:
+						MtmHandleTraceRequest(msg);
+						continue;
+					  case MSG_TRACE_EVENT:
+						MtmHandleTraceEvent(msg);
+						continue;
 					  case MSG_POLL_STATUS:
 						Assert(*msg->gid);
 						tm = (MtmTransMap*)hash_search(MtmGid2State, msg->gid, HASH_FIND, NULL);
@@ -1020,7 +2038,8 @@ static void MtmReceiver(Datum arg)
 						elog(WARNING, "Ignore response for unexisted transaction %llu from node %d", (long64)msg->dxid, node);
 						continue;
 					}
-					Assert(msg->code == MSG_ABORTED || strcmp(msg->gid, ts->gid) == 0);
+					/* gid is not sent in compact format */
+					Assert(msg->code == MSG_ABORTED || *msg->gid == '\0' || strcmp(msg->gid, ts->gid) == 0);
 					if (BIT_CHECK(ts->votedMask, node-1)) {
 						elog(WARNING, "Receive deteriorated %s response for transaction %s (%llu) from node %d",
 							 MtmMessageKindMnem[msg->code], ts->gid, (long64)ts->xid, node);
@@ -1032,19 +2051,25 @@ static void MtmReceiver(Datum arg)
 						switch (msg->code) { 
 						  case MSG_PREPARED:
 							MTM_TXTRACE(ts, "MtmTransReceiver got MSG_PREPARED");
+							MTM_PROFILE(ts->gid, MTM_EV_VOTE_RECEIVED, node, MtmGetSystemTime());
 							if (ts->status == TRANSACTION_STATUS_COMMITTED) { 
 								elog(WARNING, "Receive PREPARED response for already committed transaction %llu from node %d",
 									 (long64)ts->xid, node);
 								continue;
 							}
+							if (ts->isHomeLocal) { 
+								/* coordinator doesn't wait for votes of home-local transaction */
+								continue;
+							}
 							Mtm->nodes[node-1].transDelay += MtmGetCurrentTime() - ts->csn;
+							MtmAddVoteLatency(node, MtmGetCurrentTime() - ts->csn);
 							ts->xids[node-1] = msg->sxid;
 							
 							if ((~msg->disabledNodeMask & Mtm->disabledNodeMask) != 0) { 
 								/* Coordinator's disabled mask is wider than of this node: so reject such transaction to avoid 
 								   commit on smaller subset of nodes */
 								elog(WARNING, "Coordinator of distributed transaction %s (%llu) see less nodes than node %d: %llx instead of %llx",
-									 ts->gid, (long64)ts->xid, node, Mtm->disabledNodeMask, msg->disabledNodeMask);
+									 ts->gid, (long64)ts->xid, node, (long64)Mtm->disabledNodeMask, (long64)msg->disabledNodeMask);
 								MtmAbortTransaction(ts);
 							}
 							if ((ts->participantsMask & ~Mtm->disabledNodeMask & ~ts->votedMask) == 0) {
@@ -1058,19 +2083,17 @@ static void MtmReceiver(Datum arg)
 									ts->isPrepared = true;
 									if (ts->isTwoPhase) { 
 										MtmWakeUpBackend(ts);										
-									} else if (MtmUseDtm) { 
+									} else if (MtmUseDtm && !ts->isFastCommit) { 
 										ts->votedMask = 0;
 										MTM_TXTRACE(ts, "MtmTransReceiver send MSG_PRECOMMIT");
 										//MtmSend2PCMessage(ts, MSG_PRECOMMIT);	
 										Assert(replorigin_session_origin == InvalidRepOriginId);
 										MTM_LOG2("SetPreparedTransactionState for %s", ts->gid);
-										MtmUnlock();
-										MtmResetTransaction();
-										StartTransactionCommand();
-										SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);	
-										CommitTransactionCommand();
-										MtmLock(LW_EXCLUSIVE);						
+										MtmAddPrecommit(ts->gid);
 									} else { 
+										if (ts->isFastCommit) { 
+											ts->csn = MtmAssignCSN();
+										}
 										ts->status = TRANSACTION_STATUS_UNKNOWN;
 										MtmWakeUpBackend(ts);
 									}
@@ -1083,6 +2106,11 @@ static void MtmReceiver(Datum arg)
 									 ts->gid, (long64)ts->xid, node);
 								continue;
 							}
+							if (ts->isHomeLocal && ts->votingCompleted) { 
+								elog(WARNING, "Node %d failed to apply home-local transaction %s (%llu) which is already committed by this node: it switches to recovery",
+									 node, ts->gid, (long64)ts->xid);
+								continue;
+							}
 							if (ts->status != TRANSACTION_STATUS_ABORTED) { 
 								MTM_LOG1("Arbiter receive abort message for transaction %s (%llu)", ts->gid, (long64)ts->xid);
 								Assert(ts->status == TRANSACTION_STATUS_IN_PROGRESS);
@@ -1142,14 +2170,11 @@ static void MtmReceiver(Datum arg)
 					}
 				}
 				MtmUnlock();
-				
-				rxBuffer[i].used -= nResponses*sizeof(MtmArbiterMessage);
-				if (rxBuffer[i].used != 0) { 
-					memmove(rxBuffer[i].data, (char*)rxBuffer[i].data + nResponses*sizeof(MtmArbiterMessage), rxBuffer[i].used);
-				}
 			}
 		}
-		if (Mtm->status == MTM_ONLINE) { 
+		MtmFlushPrecommits();
+
+		if (Mtm->status == MTM_ONLINE && receiverShard == 0) { /* watchdog checks all nodes */
 			now = MtmGetSystemTime();
 			/* Check for heartbeats only in case of timeout expiration: it means that we do not have unproceeded events.
 			 * It helps to avoid false node failure detection because of blocking receiver.
@@ -5,31 +5,413 @@
 #include "postmaster/bgworker.h"
 #include "storage/s_lock.h"
 #include "storage/spin.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
 #include "storage/proc.h"
 #include "storage/pg_sema.h"
 #include "storage/shmem.h"
 #include "datatype/timestamp.h"
 #include "utils/portal.h"
 #include "tcop/pquery.h"
+#include "portability/instr_time.h"
 
 #include "bgwpool.h"
 
 bool MtmIsLogicalReceiver;
 int  MtmMaxWorkers;
+int  MtmWorkerIdleTimeout;
 
 static BgwPool* MtmPool;
+static BgwPoolWaiter* MtmProducerSlot;
+static BgwPoolQueue* MtmCurrentItemQueue;
+static BgwPoolQueue* MtmCurrentStream;
+static uint64 MtmCurrentItemPos;
+static size_t MtmCurrentItemCells;
 
 static void BgwShutdownWorker(int sig)
 {
-	if (MtmPool) { 
+	if (MtmPool) {
 		BgwPoolStop(MtmPool);
 	}
 }
 
-static void BgwPoolMainLoop(BgwPool* pool)
+/*
+ * -------------------------------------------
+ * Registration and wakeup of waiting processes
+ * -------------------------------------------
+ */
+
+static void BgwPoolReleaseSlot(int code, Datum arg)
+{
+	BgwPoolWaiter* slot = (BgwPoolWaiter*)DatumGetPointer(arg);
+	pg_atomic_write_u32(&slot->waiting, 0);
+	pg_atomic_write_u32(&slot->procno, 0);
+}
+
+/*
+ * Find free slot in the array and assign it to the current process.
+ * Returns NULL if there are no free slots: in this case process will poll the queue with BGW_POOL_WAIT_TIMEOUT interval.
+ */
+static BgwPoolWaiter* BgwPoolAllocateSlot(BgwPoolWaiter* slots, size_t nSlots)
+{
+	size_t i;
+	for (i = 0; i < nSlots; i++) {
+		uint32 free = 0;
+		if (pg_atomic_compare_exchange_u32(&slots[i].procno, &free, MyProc->pgprocno + 1)) {
+			pg_atomic_write_u32(&slots[i].waiting, 0);
+			on_shmem_exit(BgwPoolReleaseSlot, PointerGetDatum(&slots[i]));
+			return &slots[i];
+		}
+	}
+	elog(WARNING, "No free slots in the pool for process %d", MyProcPid);
+	return NULL;
+}
+
+static void BgwPoolSetLatch(BgwPoolWaiter* slot)
+{
+	uint32 procno = pg_atomic_read_u32(&slot->procno);
+	if (procno != 0) {
+		SetLatch(&ProcGlobal->allProcs[procno-1].procLatch);
+	}
+}
+
+/*
+ * Wakeup up to "n" processes waiting for the specified reason. Process is cleaning "waiting" flag itself if it is woken up by timeout,
+ * so whoever succeed to reset this flag is responsible for decrementing the counter of waiters.
+ */
+static void BgwPoolWakeup(BgwPoolWaiter* slots, size_t nSlots, pg_atomic_uint32* nWaiters, size_t n, uint32 reason)
+{
+	size_t i;
+	for (i = 0; i < nSlots && n != 0 && pg_atomic_read_u32(nWaiters) != 0; i++) {
+		uint32 waiting = reason;
+		if (pg_atomic_compare_exchange_u32(&slots[i].waiting, &waiting, BGW_POOL_WAIT_NONE)) {
+			pg_atomic_fetch_sub_u32(nWaiters, 1);
+			BgwPoolSetLatch(&slots[i]);
+			n -= 1;
+		}
+	}
+}
+
+/*
+ * Sleep on the latch until somebody wakes us up or "ready" condition becomes true.
+ * Condition is rechcked after registering process as waiter to avoid lost wakeups.
+ */
+static void BgwPoolSleep(BgwPool* pool, BgwPoolWaiter* slot, pg_atomic_uint32* nWaiters, uint32 reason, bool (*ready)(void* arg, uint64 pos), void* arg, uint64 pos)
+{
+	ResetLatch(MyLatch);
+	if (slot != NULL) {
+		pg_atomic_fetch_add_u32(nWaiters, 1);
+		pg_atomic_write_u32(&slot->waiting, reason);
+	}
+	pg_memory_barrier();
+	if (!pool->shutdown && !ready(arg, pos)) {
+		MtmWaitEvent event = reason >= BGW_POOL_WAIT_CELLS ? MTM_WAIT_POOL_OVERFLOW
+			: reason == BGW_POOL_WAIT_DEPENDENCY ? MTM_WAIT_POOL_DEPENDENCY : MTM_WAIT_POOL_IDLE;
+		timestamp_t start = MtmWaitStart(event);
+		int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, BGW_POOL_WAIT_TIMEOUT);
+		MtmWaitEnd(event, start);
+		if (rc & WL_POSTMASTER_DEATH) {
+			proc_exit(1);
+		}
+	}
+	if (slot != NULL) {
+		uint32 waiting = reason;
+		if (pg_atomic_compare_exchange_u32(&slot->waiting, &waiting, BGW_POOL_WAIT_NONE)) {
+			pg_atomic_fetch_sub_u32(nWaiters, 1);
+		}
+	}
+}
+
+/*
+ * -------------------------------------------
+ * Lock-free queue of work items
+ * -------------------------------------------
+ */
+
+static bool BgwPoolCellIsFree(void* arg, uint64 pos)
+{
+	BgwPoolQueue* queue = (BgwPoolQueue*)arg;
+	return pg_atomic_read_u64(&queue->seq[pos % queue->nCells]) == pos;
+}
+
+static bool BgwPoolQueueHasWork(void* arg, uint64 pos)
+{
+	BgwPoolQueue* queue = (BgwPoolQueue*)arg;
+	pos = pg_atomic_read_u64(&queue->head);
+	return pg_atomic_read_u64(&queue->seq[pos % queue->nCells]) == pos + 1;
+}
+
+/*
+ * Check if there are items in ordinary sub-queues or in stream sub-queues not bound to any worker
+ */
+static bool BgwPoolHasWork(void* arg, uint64 pos)
+{
+	BgwPool* pool = (BgwPool*)arg;
+	size_t i;
+	for (i = 0; i < pool->nQueues*2; i++) {
+		BgwPoolQueue* queue = &pool->queues[i];
+		if ((i < pool->nQueues || pg_atomic_read_u32(&queue->owner) == 0) && BgwPoolQueueHasWork(queue, 0)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/*
+ * Item starting at position "pos" is completed when its first cell is released
+ */
+static bool BgwPoolIsCompleted(void* arg, uint64 pos)
+{
+	BgwPoolQueue* queue = (BgwPoolQueue*)arg;
+	return pg_atomic_read_u64(&queue->seq[pos % queue->nCells]) != pos + 1;
+}
+
+/*
+ * Register item at position "pos" of the sub-queue as the last writer of keys from its footprint.
+ * Returns position+1 of the latest preceding item of the same sub-queue touching any of these keys or 0 if there is no such item.
+ * Dependencies between different sub-queues are not tracked: items of other sub-queues may be not yet taken by workers,
+ * so waiting for them can cause deadlock.
+ * Concurrent producers may miss some dependencies, but it is not a problem because
+ * conflicts are in any case resolved by row locks: it is just a scheduling hint.
+ */
+static uint64 BgwPoolRegisterFootprint(BgwPool* pool, BgwPoolQueue* queue, uint64 pos, uint32 const* footprint, size_t footprintSize)
+{
+	uint64 self = BGW_POOL_WRITER(queue->id, pos);
+	uint64 dependency = 0;
+	size_t i;
+	for (i = 0; i < footprintSize; i++) {
+		pg_atomic_uint64* writer = &pool->lastWriter[footprint[i] % BGW_POOL_KEY_SLOTS];
+		uint64 prev = pg_atomic_read_u64(writer);
+		do {
+			if (prev != 0 && BGW_POOL_WRITER_QUEUE(prev) == queue->id && prev >= self) {
+				break; /* key is already registered by subsequent item */
+			}
+		} while (!pg_atomic_compare_exchange_u64(writer, &prev, self));
+
+		if (prev != 0 && BGW_POOL_WRITER_QUEUE(prev) == queue->id && prev < self && BGW_POOL_WRITER_POS(prev) > dependency) {
+			dependency = BGW_POOL_WRITER_POS(prev);
+		}
+	}
+	return dependency;
+}
+
+/*
+ * Wait until preceding item touching the same keys is completed.
+ * Only items preceding in the same sub-queue are awaited, and them are already taken by other workers, so there can be no deadlock.
+ */
+static void BgwPoolWaitDependency(BgwPool* pool, BgwPoolQueue* queue, BgwPoolWaiter* slot, uint64 pos)
+{
+	while (!pool->shutdown && !BgwPoolIsCompleted(queue, pos)) {
+		BgwPoolSleep(pool, slot, &pool->nDependentWorkers, BGW_POOL_WAIT_DEPENDENCY, BgwPoolIsCompleted, queue, pos);
+	}
+}
+
+/*
+ * Wait until cells [pos, pos+nCells) reserved by producer are released by consumers of previous round
+ */
+static void BgwPoolWaitCells(BgwPool* pool, BgwPoolQueue* queue, uint64 pos, size_t nCells)
+{
+	size_t i;
+	for (i = 0; i < nCells; i++) {
+		while (!BgwPoolCellIsFree(queue, pos + i)) {
+			if (pool->shutdown) {
+				return;
+			}
+			if (pool->lastPeakTime == 0) {
+				pool->lastPeakTime = MtmGetSystemTime();
+			}
+			if (MtmProducerSlot == NULL) {
+				MtmProducerSlot = BgwPoolAllocateSlot(pool->producers, BGW_POOL_MAX_PRODUCERS);
+			}
+			BgwPoolSleep(pool, MtmProducerSlot, &queue->nBlockedProducers, BGW_POOL_WAIT_CELLS + queue->id, BgwPoolCellIsFree, queue, pos + i);
+		}
+	}
+	pg_memory_barrier();
+}
+
+static void BgwPoolPublish(BgwPoolQueue* queue, uint64 pos)
+{
+	pg_write_barrier();
+	pg_atomic_write_u64(&queue->seq[pos % queue->nCells], pos + 1);
+}
+
+/*
+ * Take first published item from the sub-queue. Returns NULL if sub-queue is empty.
+ */
+static BgwPoolItem* BgwPoolQueueDequeue(BgwPoolQueue* queue, uint64* itemPos)
+{
+	uint64 pos = pg_atomic_read_u64(&queue->head);
+	while (true) {
+		size_t cell = pos % queue->nCells;
+		uint64 seq = pg_atomic_read_u64(&queue->seq[cell]);
+		if (seq == pos + 1) {
+			BgwPoolItem* item = (BgwPoolItem*)&queue->cells[cell*BGW_POOL_CELL_SIZE];
+			pg_read_barrier();
+			if (pg_atomic_compare_exchange_u64(&queue->head, &pos, pos + item->nCells)) {
+				*itemPos = pos;
+				return item;
+			}
+			/* item was grabbed by some other worker: "pos" is updated by CAS, retry */
+		} else if (seq == pos) {
+			return NULL;
+		} else {
+			pos = pg_atomic_read_u64(&queue->head);
+		}
+	}
+}
+
+/*
+ * Take item from sub-queues in weighted round-robin order: worker continues to take items from the current sub-queue
+ * until it consumes BGW_POOL_QUANTUM cells (so weight of item is proportional to its size) or becomes empty.
+ * Cursor and credits are updated without locks, so scheduling is fair only approximately.
+ * Returns NULL if all sub-queues are empty.
+ */
+static BgwPoolItem* BgwPoolDequeue(BgwPool* pool, BgwPoolQueue** itemQueue, uint64* itemPos)
+{
+	uint32 cursor = pg_atomic_read_u32(&pool->cursor);
+	size_t i;
+	for (i = 0; i < pool->nQueues; i++) {
+		BgwPoolQueue* queue = &pool->queues[(cursor + i) % pool->nQueues];
+		BgwPoolItem* item = BgwPoolQueueDequeue(queue, itemPos);
+		if (item != NULL) {
+			if (item->size != 0) {
+				int32 credit = (int32)pg_atomic_fetch_sub_u32(&queue->credit, item->nCells);
+				if (credit <= (int32)item->nCells) {
+					/* quantum of this sub-queue is exhausted: pass turn to the next one */
+					pg_atomic_write_u32(&queue->credit, BGW_POOL_QUANTUM);
+					pg_atomic_compare_exchange_u32(&pool->cursor, &cursor, (queue->id + 1) % pool->nQueues);
+				} else if (i != 0) {
+					/* preceding sub-queues are empty */
+					pg_atomic_compare_exchange_u32(&pool->cursor, &cursor, queue->id);
+				}
+			}
+			*itemQueue = queue;
+			return item;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Make cells occupied by item available for the next round of producers
+ */
+static void BgwPoolRelease(BgwPool* pool, BgwPoolQueue* queue, uint64 pos, size_t nCells)
+{
+	size_t i;
+	pg_memory_barrier();
+	for (i = 0; i < nCells; i++) {
+		pg_atomic_write_u64(&queue->seq[(pos + i) % queue->nCells], pos + i + queue->nCells);
+	}
+	pg_memory_barrier();
+	BgwPoolWakeup(pool->producers, BGW_POOL_MAX_PRODUCERS, &queue->nBlockedProducers, BGW_POOL_MAX_PRODUCERS, BGW_POOL_WAIT_CELLS + queue->id);
+	BgwPoolWakeup(pool->workers, pool->nWorkerSlots, &pool->nDependentWorkers, pool->nWorkerSlots, BGW_POOL_WAIT_DEPENDENCY);
+}
+
+/*
+ * Worker executes item in place, so if it is terminated in the middle of execution,
+ * cells of this item should be released to let producers proceed
+ */
+static void BgwPoolReleaseCurrentItem(int code, Datum arg)
+{
+	if (MtmCurrentItemCells != 0) {
+		BgwPoolRelease((BgwPool*)DatumGetPointer(arg), MtmCurrentItemQueue, MtmCurrentItemPos, MtmCurrentItemCells);
+		MtmCurrentItemCells = 0;
+	}
+	if (MtmCurrentStream != NULL) {
+		/* let other worker to skip rest of the stream */
+		pg_atomic_write_u32(&MtmCurrentStream->owner, 0);
+		MtmCurrentStream = NULL;
+	}
+}
+
+/*
+ * -------------------------------------------
+ * Streaming of large transactions
+ * -------------------------------------------
+ */
+
+/*
+ * Bind current worker to the stream sub-queue containing items and not bound to some other worker
+ */
+static BgwPoolQueue* BgwPoolClaimStream(BgwPool* pool)
+{
+	size_t i;
+	for (i = pool->nQueues; i < pool->nQueues*2; i++) {
+		BgwPoolQueue* stream = &pool->queues[i];
+		uint32 owner = 0;
+		if (pg_atomic_read_u32(&stream->owner) == 0
+			&& BgwPoolQueueHasWork(stream, 0)
+			&& pg_atomic_compare_exchange_u32(&stream->owner, &owner, MyProc->pgprocno + 1))
+		{
+			return stream;
+		}
+	}
+	return NULL;
+}
+
+/*
+ * Execute chunks of streamed transaction until the last one. Transaction remains active between chunks.
+ */
+static void BgwPoolStreamLoop(BgwPool* pool, BgwPoolQueue* stream)
+{
+	bool last = false;
+	uint64 pos;
+	BgwPoolItem* item;
+
+	MtmCurrentStream = stream;
+	while (!last && !pool->shutdown) {
+		item = BgwPoolQueueDequeue(stream, &pos);
+		if (item == NULL) {
+			/* producer sets latch of the bound worker directly, so there is no need to register in the pool */
+			BgwPoolSleep(pool, NULL, NULL, BGW_POOL_WAIT_NONE, BgwPoolQueueHasWork, stream, 0);
+			continue;
+		}
+		if (item->size != 0) {
+			last = (item->flags & BGW_POOL_ITEM_LAST_CHUNK) != 0;
+			pg_atomic_fetch_sub_u32(&stream->pending, 1);
+			pg_atomic_fetch_add_u32(&pool->active, 1);
+			MtmCurrentItemQueue = stream;
+			MtmCurrentItemPos = pos;
+			MtmCurrentItemCells = item->nCells;
+
+			pool->executor((char*)item + BGW_POOL_ITEM_HDRSZ, item->size);
+
+			MtmCurrentItemCells = 0;
+			pg_atomic_fetch_sub_u32(&pool->active, 1);
+		}
+		BgwPoolRelease(pool, stream, pos, item->nCells);
+	}
+	MtmCurrentStream = NULL;
+	pg_atomic_write_u32(&stream->owner, 0);
+	pg_memory_barrier();
+}
+
+/*
+ * Stop dynamic worker which was idle for MtmWorkerIdleTimeout, unless pool is already shrunk to its static size
+ */
+static bool BgwPoolRetireWorker(BgwPool* pool)
+{
+	uint32 nWorkers = pg_atomic_read_u32(&pool->nWorkers);
+	while (nWorkers > pool->nStaticWorkers) {
+		if (pg_atomic_compare_exchange_u32(&pool->nWorkers, &nWorkers, nWorkers - 1)) {
+			pg_atomic_fetch_add_u32(&pool->nRetiredWorkers, 1);
+			elog(LOG, "Stop idle dynamic worker %d, %d workers remain", MyProcPid, (int)nWorkers - 1);
+			return true;
+		}
+	}
+	return false;
+}
+
+static void BgwPoolMainLoop(BgwPool* pool, bool isDynamic)
 {
-    int size;
+	timestamp_t idleSince = 0;
+    size_t size;
+	size_t nCells;
     void* work;
+	uint64 pos;
+	BgwPoolItem* item;
+	BgwPoolQueue* queue;
+	BgwPoolWaiter* slot;
 	static PortalData fakePortal;
 	sigset_t sset;
 
@@ -49,70 +431,151 @@ static void BgwPoolMainLoop(BgwPool* pool)
 	ActivePortal->status = PORTAL_ACTIVE;
 	ActivePortal->sourceText = "";
 
-    while (true) { 
-        PGSemaphoreLock(&pool->available);
-        SpinLockAcquire(&pool->lock);
-		if (pool->shutdown) { 
-			break;
+	slot = BgwPoolAllocateSlot(pool->workers, pool->nWorkerSlots);
+	before_shmem_exit(BgwPoolReleaseCurrentItem, PointerGetDatum(pool));
+
+    while (!pool->shutdown) {
+		queue = BgwPoolClaimStream(pool);
+		if (queue != NULL) {
+			idleSince = 0;
+			BgwPoolStreamLoop(pool, queue);
+			continue;
 		}
-        size = *(int*)&pool->queue[pool->head];
-        Assert(size < pool->size);
-        work = malloc(size);
-        pool->pending -= 1;
-        pool->active += 1;
-		if (pool->lastPeakTime == 0 && pool->active == pool->nWorkers && pool->pending != 0) {
+		item = BgwPoolDequeue(pool, &queue, &pos);
+		if (item == NULL) {
+			/* queue is drained: reset back-off of workers start */
+			pool->workerStartDelay = BGW_POOL_MIN_START_DELAY;
+			if (isDynamic && MtmWorkerIdleTimeout != 0) {
+				timestamp_t now = MtmGetSystemTime();
+				if (idleSince == 0) {
+					idleSince = now;
+				} else if (now - idleSince >= (timestamp_t)MtmWorkerIdleTimeout*1000 && BgwPoolRetireWorker(pool)) {
+					break;
+				}
+			}
+			BgwPoolSleep(pool, slot, &pool->nIdleWorkers, BGW_POOL_WAIT_QUEUE, BgwPoolHasWork, pool, 0);
+			continue;
+		}
+		idleSince = 0;
+		nCells = item->nCells;
+		size = item->size;
+		if (size == 0) {
+			/* padding at the end of the sub-queue */
+			BgwPoolRelease(pool, queue, pos, nCells);
+			continue;
+		}
+        Assert(size < queue->nCells*BGW_POOL_CELL_SIZE);
+		/*
+		 * Work is executed in place: cells of the item are owned by this worker until them are released,
+		 * so there is no need to copy it to private memory.
+		 */
+        work = (char*)item + BGW_POOL_ITEM_HDRSZ;
+        pg_atomic_fetch_sub_u32(&pool->pending, 1);
+        pg_atomic_fetch_sub_u32(&queue->pending, 1);
+        pg_atomic_fetch_add_u32(&pool->active, 1);
+		if (pool->lastPeakTime == 0
+			&& pg_atomic_read_u32(&pool->active) == pg_atomic_read_u32(&pool->nWorkers)
+			&& pg_atomic_read_u32(&pool->pending) != 0)
+		{
 			pool->lastPeakTime = MtmGetSystemTime();
 		}
-        if (pool->head + size + 4 > pool->size) { 
-            memcpy(work, pool->queue, size);
-            pool->head = INTALIGN(size);
-        } else { 
-            memcpy(work, &pool->queue[pool->head+4], size);
-            pool->head += 4 + INTALIGN(size);
-        }
-        if (pool->size == pool->head) { 
-            pool->head = 0;
-        }
-        if (pool->producerBlocked) {
-            pool->producerBlocked = false;
-            PGSemaphoreUnlock(&pool->overflow);
-			pool->lastPeakTime = 0;
-        }
-        SpinLockRelease(&pool->lock);
+
+		MtmCurrentItemQueue = queue;
+		MtmCurrentItemPos = pos;
+		MtmCurrentItemCells = nCells;
+
+		if (item->dependency != 0) {
+			BgwPoolWaitDependency(pool, queue, slot, item->dependency - 1);
+		}
+
         pool->executor(work, size);
-        free(work);
-        SpinLockAcquire(&pool->lock);
-        pool->active -= 1;
+
+		MtmCurrentItemCells = 0;
+		BgwPoolRelease(pool, queue, pos, nCells);
+        pg_atomic_fetch_sub_u32(&pool->active, 1);
 		pool->lastPeakTime = 0;
-        SpinLockRelease(&pool->lock);
     }
-	SpinLockRelease(&pool->lock);
 }
 
-void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname,  char const* dbuser, size_t queueSize, size_t nWorkers)
+size_t BgwPoolShmemSize(size_t queueSize, size_t nQueues, size_t nWorkers)
 {
-	MtmPool = pool;
-    pool->queue = (char*)ShmemAlloc(queueSize);
+	size_t nCells = queueSize / nQueues / BGW_POOL_CELL_SIZE;
+	size_t nWorkerSlots = Max(nWorkers, (size_t)MtmMaxWorkers);
+	/* ordinary and stream sub-queue of each origin together occupy nCells */
+	return nQueues*(2*sizeof(BgwPoolQueue) + (nCells + 2)*BGW_POOL_CELL_SIZE + nCells*sizeof(pg_atomic_uint64))
+		+ BGW_POOL_KEY_SLOTS*sizeof(pg_atomic_uint64)
+		+ nWorkerSlots*sizeof(BgwPoolWaiter);
+}
+
+/*
+ * Initialize pool, allocating its sub-queues and tables with "alloc": ShmemAlloc for the real pool, palloc for the private
+ * pool of BgwPoolBenchmark
+ */
+static void BgwPoolSetup(BgwPool* pool, void* (*alloc)(Size size), BgwPoolExecutor executor, char const* dbname,  char const* dbuser, size_t queueSize, size_t nQueues, size_t nWorkers)
+{
+	size_t i, j;
+	size_t nCells = queueSize / nQueues / BGW_POOL_CELL_SIZE;
+	size_t nStreamCells = nCells / BGW_POOL_STREAM_FRACTION;
+
+	pool->nQueues = nQueues;
+	pool->size = nQueues * nCells * BGW_POOL_CELL_SIZE;
+	pool->nWorkerSlots = Max(nWorkers, (size_t)MtmMaxWorkers);
+	pool->queues = (BgwPoolQueue*)alloc(nQueues*2*sizeof(BgwPoolQueue));
+	pool->lastWriter = (pg_atomic_uint64*)alloc(BGW_POOL_KEY_SLOTS*sizeof(pg_atomic_uint64));
+	pool->workers = (BgwPoolWaiter*)alloc(pool->nWorkerSlots*sizeof(BgwPoolWaiter));
     pool->executor = executor;
-    PGSemaphoreCreate(&pool->available);
-    PGSemaphoreCreate(&pool->overflow);
-    PGSemaphoreReset(&pool->available);
-    PGSemaphoreReset(&pool->overflow);
-    SpinLockInit(&pool->lock);
+
+	for (i = 0; i < nQueues*2; i++) {
+		BgwPoolQueue* queue = &pool->queues[i];
+		queue->id = i;
+		queue->nCells = i < nQueues ? nCells - nStreamCells : nStreamCells;
+		queue->cells = (char*)TYPEALIGN(BGW_POOL_CELL_SIZE, alloc((queue->nCells + 1)*BGW_POOL_CELL_SIZE));
+		queue->seq = (pg_atomic_uint64*)alloc(queue->nCells*sizeof(pg_atomic_uint64));
+		for (j = 0; j < queue->nCells; j++) {
+			pg_atomic_init_u64(&queue->seq[j], j);
+		}
+		pg_atomic_init_u64(&queue->head, 0);
+		pg_atomic_init_u64(&queue->tail, 0);
+		pg_atomic_init_u32(&queue->pending, 0);
+		pg_atomic_init_u32(&queue->nBlockedProducers, 0);
+		pg_atomic_init_u32(&queue->credit, BGW_POOL_QUANTUM);
+		pg_atomic_init_u32(&queue->owner, 0);
+		queue->open = false;
+	}
+	for (i = 0; i < BGW_POOL_KEY_SLOTS; i++) {
+		pg_atomic_init_u64(&pool->lastWriter[i], 0);
+	}
+	for (i = 0; i < pool->nWorkerSlots; i++) {
+		pg_atomic_init_u32(&pool->workers[i].procno, 0);
+		pg_atomic_init_u32(&pool->workers[i].waiting, 0);
+	}
+	for (i = 0; i < BGW_POOL_MAX_PRODUCERS; i++) {
+		pg_atomic_init_u32(&pool->producers[i].procno, 0);
+		pg_atomic_init_u32(&pool->producers[i].waiting, 0);
+	}
+	pg_atomic_init_u32(&pool->cursor, 0);
+	pg_atomic_init_u32(&pool->active, 0);
+	pg_atomic_init_u32(&pool->pending, 0);
+	pg_atomic_init_u32(&pool->nWorkers, nWorkers);
+	pg_atomic_init_u32(&pool->nRetiredWorkers, 0);
+	pool->nStaticWorkers = nWorkers;
+	pool->peakWorkers = nWorkers;
+	pool->workerStartDelay = BGW_POOL_MIN_START_DELAY;
+	pg_atomic_init_u32(&pool->nIdleWorkers, 0);
+	pg_atomic_init_u32(&pool->nDependentWorkers, 0);
 	pool->shutdown = false;
-    pool->producerBlocked = false;
-    pool->head = 0;
-    pool->tail = 0;
-    pool->size = queueSize;
-    pool->active = 0;
-    pool->pending = 0;
-	pool->nWorkers = nWorkers;
 	pool->lastPeakTime = 0;
 	pool->lastDynamicWorkerStartTime = 0;
 	strncpy(pool->dbname, dbname, MAX_DBNAME_LEN);
 	strncpy(pool->dbuser, dbuser, MAX_DBUSER_LEN);
 }
- 
+
+void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname,  char const* dbuser, size_t queueSize, size_t nQueues, size_t nWorkers)
+{
+	MtmPool = pool;
+	BgwPoolSetup(pool, ShmemAlloc, executor, dbname, dbuser, queueSize, nQueues, nWorkers);
+}
+
 timestamp_t BgwGetLastPeekTime(BgwPool* pool)
 {
 	return pool->lastPeakTime;
@@ -121,12 +584,12 @@ timestamp_t BgwGetLastPeekTime(BgwPool* pool)
 static void BgwPoolStaticWorkerMainLoop(Datum arg)
 {
 	BgwPoolConstructor constructor = (BgwPoolConstructor)DatumGetPointer(arg);
-    BgwPoolMainLoop(constructor());
+    BgwPoolMainLoop(constructor(), false);
 }
 
 static void BgwPoolDynamicWorkerMainLoop(Datum arg)
 {
-    BgwPoolMainLoop((BgwPool*)DatumGetPointer(arg));
+    BgwPoolMainLoop((BgwPool*)DatumGetPointer(arg), true);
 }
 
 void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor)
@@ -140,29 +603,60 @@ void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor)
 	worker.bgw_main = BgwPoolStaticWorkerMainLoop;
 	worker.bgw_restart_time = MULTIMASTER_BGW_RESTART_TIMEOUT;
 
-    for (i = 0; i < nWorkers; i++) { 
+    for (i = 0; i < nWorkers; i++) {
         snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_worker_%d", i+1);
         worker.bgw_main_arg = PointerGetDatum(constructor);
         RegisterBackgroundWorker(&worker);
     }
 }
 
+static size_t BgwPoolQueueSize(BgwPoolQueue* queue)
+{
+	uint64 head = pg_atomic_read_u64(&queue->head);
+	uint64 tail = pg_atomic_read_u64(&queue->tail);
+	return tail > head ? (size_t)(tail - head)*BGW_POOL_CELL_SIZE : 0;
+}
+
+/*
+ * Size of ordinary and stream sub-queues of the origin node
+ */
+size_t BgwPoolGetSubQueueSize(BgwPool* pool, size_t queueNo)
+{
+	return BgwPoolQueueSize(&pool->queues[queueNo]) + BgwPoolQueueSize(&pool->queues[pool->nQueues + queueNo]);
+}
+
+int BgwPoolGetSubQueuePending(BgwPool* pool, size_t queueNo)
+{
+	return (int)(pg_atomic_read_u32(&pool->queues[queueNo].pending) + pg_atomic_read_u32(&pool->queues[pool->nQueues + queueNo].pending));
+}
+
 size_t BgwPoolGetQueueSize(BgwPool* pool)
 {
-	size_t used;
-    SpinLockAcquire(&pool->lock);
-	used = pool->head <= pool->tail ? pool->tail - pool->head : pool->size - pool->head + pool->tail;
-    SpinLockRelease(&pool->lock);            
-	return used;
+	size_t size = 0;
+	size_t i;
+	for (i = 0; i < pool->nQueues; i++) {
+		size += BgwPoolGetSubQueueSize(pool, i);
+	}
+	return size;
 }
 
 
+/*
+ * Start new dynamic worker if all workers are busy.
+ * Starts are throttled with exponential back-off which is reset when queue becomes empty,
+ * to avoid spawning of large number of workers because of short spike of load.
+ */
 static void BgwStartExtraWorker(BgwPool* pool)
 {
-	if (pool->nWorkers < MtmMaxWorkers) { 
-		timestamp_t now = MtmGetSystemTime();
-		/*if (pool->lastDynamicWorkerStartTime + MULTIMASTER_BGW_RESTART_TIMEOUT*USECS_PER_SEC < now)*/
-		{ 
+	uint32 nWorkers = pg_atomic_read_u32(&pool->nWorkers);
+	timestamp_t now = MtmGetSystemTime();
+	if (now < pool->lastDynamicWorkerStartTime + pool->workerStartDelay) {
+		return;
+	}
+	while (nWorkers < (uint32)MtmMaxWorkers) {
+		/* CAS protects from starting more than MtmMaxWorkers by concurrent producers */
+		if (pg_atomic_compare_exchange_u32(&pool->nWorkers, &nWorkers, nWorkers + 1))
+		{
 			BackgroundWorker worker;
 			BackgroundWorkerHandle* handle;
 			MemSet(&worker, 0, sizeof(BackgroundWorker));
@@ -170,70 +664,218 @@ static void BgwStartExtraWorker(BgwPool* pool)
 			worker.bgw_start_time = BgWorkerStart_ConsistentState;
 			worker.bgw_main = BgwPoolDynamicWorkerMainLoop;
 			worker.bgw_restart_time = MULTIMASTER_BGW_RESTART_TIMEOUT;
-			snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_dynworker_%d", (int)++pool->nWorkers);
+			snprintf(worker.bgw_name, BGW_MAXLEN, "bgw_pool_dynworker_%d", (int)nWorkers + 1);
 			worker.bgw_main_arg = PointerGetDatum(pool);
 			pool->lastDynamicWorkerStartTime = now;
-			if (!RegisterDynamicBackgroundWorker(&worker, &handle)) { 
+			pool->workerStartDelay = Min(pool->workerStartDelay*2, BGW_POOL_MAX_START_DELAY);
+			if (nWorkers + 1 > pool->peakWorkers) {
+				pool->peakWorkers = nWorkers + 1;
+			}
+			if (!RegisterDynamicBackgroundWorker(&worker, &handle)) {
 				elog(WARNING, "Failed to start dynamic background worker");
+				pg_atomic_fetch_sub_u32(&pool->nWorkers, 1);
 			}
+			break;
 		}
 	}
 }
 
-void BgwPoolExecute(BgwPool* pool, void* work, size_t size)
+/*
+ * Reserve cells for the item of the specified size, inserting padding item if there is not enough space at the end of the sub-queue.
+ * Returns NULL if pool is shut down.
+ */
+static BgwPoolItem* BgwPoolReserve(BgwPool* pool, BgwPoolQueue* queue, size_t size, size_t nCells, uint64* itemPos)
 {
-    if (size+4 > pool->size) {
-		/* 
-		 * Size of work is larger than size of shared buffer: 
+	size_t cell;
+	size_t skip;
+	uint64 pos;
+	BgwPoolItem* item;
+
+	pos = pg_atomic_read_u64(&queue->tail);
+	do {
+		cell = pos % queue->nCells;
+		skip = cell + nCells > queue->nCells ? queue->nCells - cell : 0;
+	} while (!pg_atomic_compare_exchange_u64(&queue->tail, &pos, pos + skip + nCells));
+
+	if (skip != 0) {
+		BgwPoolWaitCells(pool, queue, pos, skip);
+		item = (BgwPoolItem*)&queue->cells[cell*BGW_POOL_CELL_SIZE];
+		item->size = 0;
+		item->nCells = skip;
+		item->dependency = 0;
+		item->flags = 0;
+		BgwPoolPublish(queue, pos);
+		pos += skip;
+		cell = 0;
+	}
+	BgwPoolWaitCells(pool, queue, pos, nCells);
+	if (pool->shutdown) {
+		return NULL;
+	}
+	item = (BgwPoolItem*)&queue->cells[cell*BGW_POOL_CELL_SIZE];
+	item->size = size;
+	item->nCells = nCells;
+	item->dependency = 0;
+	item->flags = 0;
+	*itemPos = pos;
+	return item;
+}
+
+void BgwPoolExecute(BgwPool* pool, size_t queueNo, void* work, size_t size, uint32 const* footprint, size_t footprintSize)
+{
+	BgwPoolQueue* queue = &pool->queues[queueNo % pool->nQueues];
+	size_t nCells = (BGW_POOL_ITEM_HDRSZ + size + BGW_POOL_CELL_SIZE - 1) / BGW_POOL_CELL_SIZE;
+	uint64 pos;
+	BgwPoolItem* item;
+
+    if (nCells > queue->nCells/2) {
+		/*
+		 * Size of work is too large for shared buffer:
 		 * run it immediately
 		 */
 		pool->executor(work, size);
 		return;
 	}
- 
-    SpinLockAcquire(&pool->lock);
-    while (!pool->shutdown) { 
-        if ((pool->head <= pool->tail && pool->size - pool->tail < size + 4 && pool->head < size) 
-            || (pool->head > pool->tail && pool->head - pool->tail < size + 4))
-        {
-            if (pool->lastPeakTime == 0) {
-				pool->lastPeakTime = MtmGetSystemTime();
-			}
-			pool->producerBlocked = true;
-            SpinLockRelease(&pool->lock);
-            PGSemaphoreLock(&pool->overflow);
-            SpinLockAcquire(&pool->lock);
-        } else {
-            pool->pending += 1;
-			if (pool->active + pool->pending > pool->nWorkers) { 
-				BgwStartExtraWorker(pool);				
-			}
-			if (pool->lastPeakTime == 0 && pool->active == pool->nWorkers && pool->pending != 0) {
-				pool->lastPeakTime = MtmGetSystemTime();
-			}
-            *(int*)&pool->queue[pool->tail] = size;
-            if (pool->size - pool->tail >= size + 4) { 
-                memcpy(&pool->queue[pool->tail+4], work, size);
-                pool->tail += 4 + INTALIGN(size);
-            } else { 
-                memcpy(pool->queue, work, size);
-                pool->tail = INTALIGN(size);
-            }
-            if (pool->tail == pool->size) {
-                pool->tail = 0;
-            }
-            PGSemaphoreUnlock(&pool->available);
-            break;
-        }
-    }
-    SpinLockRelease(&pool->lock);            
+
+	item = BgwPoolReserve(pool, queue, size, nCells, &pos);
+	if (item == NULL) {
+		return;
+	}
+	item->dependency = BgwPoolRegisterFootprint(pool, queue, pos, footprint, footprintSize);
+	memcpy((char*)item + BGW_POOL_ITEM_HDRSZ, work, size);
+
+	pg_atomic_fetch_add_u32(&queue->pending, 1);
+	pg_atomic_fetch_add_u32(&pool->pending, 1);
+	if (pg_atomic_read_u32(&pool->active) + pg_atomic_read_u32(&pool->pending) > pg_atomic_read_u32(&pool->nWorkers)) {
+		BgwStartExtraWorker(pool);
+	}
+	if (pool->lastPeakTime == 0
+		&& pg_atomic_read_u32(&pool->active) == pg_atomic_read_u32(&pool->nWorkers)
+		&& pg_atomic_read_u32(&pool->pending) != 0)
+	{
+		pool->lastPeakTime = MtmGetSystemTime();
+	}
+	BgwPoolPublish(queue, pos);
+	pg_memory_barrier();
+	BgwPoolWakeup(pool->workers, pool->nWorkerSlots, &pool->nIdleWorkers, 1, BGW_POOL_WAIT_QUEUE);
+}
+
+/*
+ * Check if large transaction can be streamed to the worker: it is possible only if some worker is idle now,
+ * otherwise transaction has to be spilled to the disk.
+ */
+bool BgwPoolStreamStart(BgwPool* pool, size_t queueNo)
+{
+	return !pool->shutdown && pg_atomic_read_u32(&pool->nIdleWorkers) != 0;
+}
+
+/*
+ * Maximal size of chunk which can be passed to BgwPoolStreamExecute
+ */
+size_t BgwPoolStreamChunkSize(BgwPool* pool)
+{
+	return pool->queues[pool->nQueues].nCells/2*BGW_POOL_CELL_SIZE - BGW_POOL_ITEM_HDRSZ;
+}
+
+bool BgwPoolStreamIsOpen(BgwPool* pool, size_t queueNo)
+{
+	return pool->queues[pool->nQueues + queueNo % pool->nQueues].open;
+}
+
+/*
+ * Append chunk of streamed transaction to the stream sub-queue of the origin node.
+ * Chunks are executed by the single worker in the same order, "last" chunk unbinds the worker from the stream.
+ */
+void BgwPoolStreamExecute(BgwPool* pool, size_t queueNo, void* work, size_t size, bool last)
+{
+	BgwPoolQueue* stream = &pool->queues[pool->nQueues + queueNo % pool->nQueues];
+	size_t nCells = (BGW_POOL_ITEM_HDRSZ + size + BGW_POOL_CELL_SIZE - 1) / BGW_POOL_CELL_SIZE;
+	uint64 pos;
+	uint32 owner;
+	BgwPoolItem* item;
+
+	Assert(size <= BgwPoolStreamChunkSize(pool));
+
+	item = BgwPoolReserve(pool, stream, size, nCells, &pos);
+	if (item == NULL) {
+		return;
+	}
+	item->flags = last ? BGW_POOL_ITEM_LAST_CHUNK : 0;
+	stream->open = !last;
+	memcpy((char*)item + BGW_POOL_ITEM_HDRSZ, work, size);
+	pg_atomic_fetch_add_u32(&stream->pending, 1);
+	BgwPoolPublish(stream, pos);
+	pg_memory_barrier();
+
+	owner = pg_atomic_read_u32(&stream->owner);
+	if (owner != 0) {
+		SetLatch(&ProcGlobal->allProcs[owner-1].procLatch);
+	} else {
+		BgwPoolWakeup(pool->workers, pool->nWorkerSlots, &pool->nIdleWorkers, 1, BGW_POOL_WAIT_QUEUE);
+	}
 }
 
 void BgwPoolStop(BgwPool* pool)
 {
-    SpinLockAcquire(&pool->lock);
+	size_t i;
 	pool->shutdown = true;
-    SpinLockRelease(&pool->lock);            
-	PGSemaphoreUnlock(&pool->available);
-	PGSemaphoreUnlock(&pool->overflow);
+	pg_memory_barrier();
+	for (i = 0; i < pool->nWorkerSlots; i++) {
+		BgwPoolSetLatch(&pool->workers[i]);
+	}
+	for (i = 0; i < BGW_POOL_MAX_PRODUCERS; i++) {
+		BgwPoolSetLatch(&pool->producers[i]);
+	}
+}
+
+/*
+ * -------------------------------------------
+ * Micro-benchmark
+ * -------------------------------------------
+ */
+
+static void BgwPoolBenchmarkExecutor(void* work, size_t size)
+{
+}
+
+/*
+ * Measure cost of passing work items through the queue, leaving out workers and their wakeups:
+ * calling backend puts "nItems" items of "size" bytes with footprint of "footprintSize" keys to private pool
+ * with single sub-queue and immediately takes and releases each of them, as worker would do.
+ * Returns total elapsed time in nanoseconds.
+ */
+double BgwPoolBenchmark(size_t size, size_t footprintSize, int nItems)
+{
+	BgwPool* pool = (BgwPool*)palloc0(sizeof(BgwPool));
+	char* work = (char*)palloc0(size);
+	uint32* footprint = (uint32*)palloc((footprintSize + 1)*sizeof(uint32));
+	instr_time start, elapsed;
+	int i;
+	size_t j;
+
+	BgwPoolSetup(pool, palloc, BgwPoolBenchmarkExecutor, "", "", 1024*1024, 1, 1);
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (i = 0; i < nItems; i++) {
+		BgwPoolQueue* queue;
+		BgwPoolItem* item;
+		uint64 pos;
+
+		for (j = 0; j < footprintSize; j++) {
+			footprint[j] = (uint32)(i*footprintSize + j);
+		}
+		BgwPoolExecute(pool, 0, work, size, footprint, footprintSize);
+
+		while ((item = BgwPoolDequeue(pool, &queue, &pos)) != NULL) {
+			if (item->size != 0) {
+				pg_atomic_fetch_sub_u32(&pool->pending, 1);
+				pg_atomic_fetch_sub_u32(&queue->pending, 1);
+			}
+			BgwPoolRelease(pool, queue, pos, item->nCells);
+		}
+	}
+	INSTR_TIME_SET_CURRENT(elapsed);
+	INSTR_TIME_SUBTRACT(elapsed, start);
+
+	return INSTR_TIME_GET_DOUBLE(elapsed)*1e9;
 }
@@ -4,6 +4,7 @@
 #include "storage/s_lock.h"
 #include "storage/spin.h"
 #include "storage/pg_sema.h"
+#include "port/atomics.h"
 #include "bkb.h"
 
 typedef void(*BgwPoolExecutor)(void* work, size_t size);
@@ -15,44 +16,177 @@ typedef ulong64 timestamp_t;
 #define MAX_DBUSER_LEN 30
 #define MULTIMASTER_BGW_RESTART_TIMEOUT 1 /* seconds */
 
+/*
+ * Queue of the pool is split into cells of fixed size. Work item occupies contiguous range of cells and
+ * is described by header placed at the beginning of its first cell.
+ */
+#define BGW_POOL_CELL_SIZE        256
+#define BGW_POOL_CACHE_LINE_SIZE  64
+#define BGW_POOL_MAX_PRODUCERS    MAX_NODES
+#define BGW_POOL_WAIT_TIMEOUT     100 /* milliseconds: protection against lost wakeups */
+#define BGW_POOL_KEY_SLOTS        (64*1024) /* size of table of last writers used to track dependencies between items */
+#define BGW_POOL_STREAM_FRACTION  4    /* part of cells of origin node used for stream sub-queue */
+#define BGW_POOL_QUANTUM          64   /* number of cells which worker can take from one sub-queue before switching to the next one */
+#define BGW_POOL_MIN_START_DELAY  1000 /* microseconds: initial back-off interval between starts of dynamic workers */
+#define BGW_POOL_MAX_START_DELAY  (MULTIMASTER_BGW_RESTART_TIMEOUT*USECS_PER_SEC)
+
+/*
+ * Reason of waiting of process registered in the pool
+ */
+#define BGW_POOL_WAIT_NONE        0
+#define BGW_POOL_WAIT_QUEUE       1 /* worker is idle */
+#define BGW_POOL_WAIT_DEPENDENCY  2 /* worker waits completion of the item on which current item depends */
+#define BGW_POOL_WAIT_CELLS       16 /* producer is blocked because of sub-queue overflow: BGW_POOL_WAIT_CELLS + number of sub-queue */
+
+/*
+ * Entry of the table of last writers: number of sub-queue in the highest bits and position+1 of item in the lowest bits
+ */
+#define BGW_POOL_WRITER_SHIFT     56
+#define BGW_POOL_WRITER(queue, pos) (((uint64)(queue) << BGW_POOL_WRITER_SHIFT) | ((pos) + 1))
+#define BGW_POOL_WRITER_QUEUE(w)  ((w) >> BGW_POOL_WRITER_SHIFT)
+#define BGW_POOL_WRITER_POS(w)    ((w) & (((uint64)1 << BGW_POOL_WRITER_SHIFT) - 1))
+
+/*
+ * Wait events reported in pg_stat_activity and accumulated in shared memory (see mtm.get_wait_stats)
+ */
+typedef enum
+{
+	MTM_WAIT_VOTE,            /* coordinator of 2PC waits for votes of other nodes */
+	MTM_WAIT_IN_DOUBT,        /* visibility check waits for resolution of in-doubt transaction */
+	MTM_WAIT_CLUSTER_LOCK,    /* commit is delayed until recovered node catches up */
+	MTM_WAIT_POOL_OVERFLOW,   /* producer is blocked because sub-queue of the pool is full */
+	MTM_WAIT_POOL_DEPENDENCY, /* worker waits completion of the item on which current item depends */
+	MTM_WAIT_POOL_IDLE,       /* worker waits for work */
+	MTM_WAIT_COMMIT_APPLY,    /* mtm.wait_for_csn waits until transaction of other node is applied */
+	MTM_WAIT_SEQUENCE_BLOCK,  /* nextval waits until other nodes grant block of sequence values */
+	MTM_WAIT_COMMIT_TICKET,   /* apply worker waits for commit of previous transactions of the same origin */
+	MTM_WAIT_COMMIT_PROFILE,  /* mtm.get_commit_profile waits for events of transaction from other nodes */
+	MTM_N_WAIT_EVENTS
+} MtmWaitEvent;
+
+extern timestamp_t MtmWaitStart(MtmWaitEvent event);
+extern void MtmWaitEnd(MtmWaitEvent event, timestamp_t start);
+
 extern timestamp_t MtmGetSystemTime(void);   /* non-adjusted current system time */
 extern timestamp_t MtmGetCurrentTime(void);  /* adjusted current system time */
 
 extern bool MtmIsLogicalReceiver;
 extern int  MtmMaxWorkers;
+extern int  MtmWorkerIdleTimeout;
 
+/*
+ * Header of work item in the queue
+ */
+typedef struct
+{
+	uint32 size;       /* size of work, 0 for padding item inserted at the end of the queue */
+	uint32 nCells;     /* number of cells occupied by this item (including header) */
+	uint64 dependency; /* position+1 of the previous item touching the same keys, 0 if none */
+	uint32 flags;      /* BGW_POOL_ITEM_* */
+} BgwPoolItem;
+
+#define BGW_POOL_ITEM_LAST_CHUNK  1 /* last chunk of streamed transaction: worker is unbound from the stream after executing it */
+
+#define BGW_POOL_ITEM_HDRSZ MAXALIGN(sizeof(BgwPoolItem))
+
+/*
+ * Process waiting for the pool: either idle worker, either producer blocked because of queue overflow
+ */
+typedef struct
+{
+	pg_atomic_uint32 procno;  /* pgprocno+1 of the process owning this slot, 0 if slot is free */
+	pg_atomic_uint32 waiting; /* BGW_POOL_WAIT_*: process is sleeping on its latch and should be woken up */
+} BgwPoolWaiter;
+
+/*
+ * Sub-queue of the pool: lock-free multi-producer/multi-consumer ring of cells with per-cell sequence numbers.
+ * Cell with position "pos" is free if its sequence number is equal to "pos" and contains
+ * published item if it is equal to "pos+1". Positions are monotonically increasing 64-bit counters.
+ */
+typedef struct
+{
+	pg_atomic_uint64 head;     /* position of first item not yet taken by consumers */
+	char   pad0[BGW_POOL_CACHE_LINE_SIZE - sizeof(pg_atomic_uint64)];
+	pg_atomic_uint64 tail;     /* position of first cell not yet reserved by producers */
+	char   pad1[BGW_POOL_CACHE_LINE_SIZE - sizeof(pg_atomic_uint64)];
+	pg_atomic_uint32 pending;  /* number of items in this sub-queue */
+	pg_atomic_uint32 nBlockedProducers;
+	pg_atomic_uint32 credit;   /* cells which still can be taken from this sub-queue before switching to the next one */
+	char   pad2[BGW_POOL_CACHE_LINE_SIZE - 3*sizeof(pg_atomic_uint32)];
+	pg_atomic_uint32 owner;    /* for stream sub-queue: pgprocno+1 of the worker bound to the stream, 0 if none */
+	volatile bool open;        /* for stream sub-queue: last chunk of streamed transaction is not yet sent */
+	uint32 id;                 /* number of sub-queue */
+	size_t nCells;             /* number of cells in the sub-queue */
+	pg_atomic_uint64* seq;     /* [nCells]: sequence numbers of cells */
+	char*  cells;
+} BgwPoolQueue;
+
+/*
+ * Pool of background workers applying transactions.
+ * Each origin node has its own sub-queue, so that producer of one node is not blocked by overflow caused by another node.
+ * Also each origin node has stream sub-queue used to pass chunks of large transaction to the single worker bound to it,
+ * so that transaction is applied while it is still received. Stream sub-queues follow ordinary ones in "queues" array.
+ * Workers take items from sub-queues in round-robin order, dequeuing up to BGW_POOL_QUANTUM cells from one sub-queue at a time.
+ * Producers and consumers are sleeping on their latches and wake up each other when queue state is changed.
+ * Producer can provide footprint of the work: hashes of keys touched by it. Item is not executed
+ * until the last preceding item of the same sub-queue with the same key is completed, instead of conflicting with it on row locks.
+ */
 typedef struct
 {
     BgwPoolExecutor executor;
-    volatile slock_t lock;
-    PGSemaphoreData available;
-    PGSemaphoreData overflow;
-    size_t head;
-    size_t tail;
-    size_t size;
-    size_t active;
-    size_t pending;
-	size_t nWorkers;
-	time_t lastPeakTime;
-	timestamp_t lastDynamicWorkerStartTime;
-    bool   producerBlocked;
-	bool   shutdown;
+	char   pad0[BGW_POOL_CACHE_LINE_SIZE];
+	pg_atomic_uint32 cursor;   /* sub-queue from which workers are currently taking items */
+	pg_atomic_uint32 active;   /* number of items which are currently executed */
+	pg_atomic_uint32 pending;  /* number of items in the queue */
+	pg_atomic_uint32 nWorkers; /* number of started workers */
+	pg_atomic_uint32 nIdleWorkers;
+	pg_atomic_uint32 nDependentWorkers; /* number of workers waiting for completion of preceding items */
+	char   pad1[BGW_POOL_CACHE_LINE_SIZE - 6*sizeof(pg_atomic_uint32)];
+    size_t size;               /* total size of sub-queues in bytes */
+	size_t nQueues;
+	size_t nWorkerSlots;
+	size_t nStaticWorkers;            /* number of workers started at postmaster startup, them are never retired */
+	volatile size_t peakWorkers;      /* maximal number of workers ever running */
+	pg_atomic_uint32 nRetiredWorkers; /* number of dynamic workers stopped because of inactivity */
+	volatile timestamp_t lastPeakTime;
+	volatile timestamp_t lastDynamicWorkerStartTime;
+	volatile timestamp_t workerStartDelay; /* current back-off interval between starts of dynamic workers */
+	volatile bool shutdown;
     char   dbname[MAX_DBNAME_LEN];
 	char   dbuser[MAX_DBUSER_LEN];
-    char*  queue;
+	BgwPoolQueue* queues;      /* [nQueues*2]: ordinary and stream sub-queues */
+	pg_atomic_uint64* lastWriter; /* [BGW_POOL_KEY_SLOTS]: BGW_POOL_WRITER of last item touching key with such hash */
+	BgwPoolWaiter* workers;    /* [nWorkerSlots]: registered workers */
+	BgwPoolWaiter producers[BGW_POOL_MAX_PRODUCERS];
 } BgwPool;
 
 typedef BgwPool*(*BgwPoolConstructor)(void);
 
 extern void BgwPoolStart(int nWorkers, BgwPoolConstructor constructor);
 
-extern void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname, char const* dbuser, size_t queueSize, size_t nWorkers);
+extern size_t BgwPoolShmemSize(size_t queueSize, size_t nQueues, size_t nWorkers);
+
+extern void BgwPoolInit(BgwPool* pool, BgwPoolExecutor executor, char const* dbname, char const* dbuser, size_t queueSize, size_t nQueues, size_t nWorkers);
+
+extern void BgwPoolExecute(BgwPool* pool, size_t queue, void* work, size_t size, uint32 const* footprint, size_t footprintSize);
 
-extern void BgwPoolExecute(BgwPool* pool, void* work, size_t size);
+extern bool BgwPoolStreamStart(BgwPool* pool, size_t queue);
+
+extern void BgwPoolStreamExecute(BgwPool* pool, size_t queue, void* work, size_t size, bool last);
+
+extern size_t BgwPoolStreamChunkSize(BgwPool* pool);
+
+extern bool BgwPoolStreamIsOpen(BgwPool* pool, size_t queue);
 
 extern size_t BgwPoolGetQueueSize(BgwPool* pool);
 
+extern size_t BgwPoolGetSubQueueSize(BgwPool* pool, size_t queue);
+
+extern int BgwPoolGetSubQueuePending(BgwPool* pool, size_t queue);
+
 extern timestamp_t BgwGetLastPeekTime(BgwPool* pool);
 
 extern void BgwPoolStop(BgwPool* pool);
+
+extern double BgwPoolBenchmark(size_t size, size_t footprintSize, int nItems);
 #endif
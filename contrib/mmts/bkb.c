@@ -1,121 +1,102 @@
 #include <stdint.h>
+#include <string.h>
 #include "bkb.h"
 
 /*
- * Bron–Kerbosch algorithm to find maximum clique in graph
+ * Bron–Kerbosch algorithm to find maximum clique in graph.
+ * Matrix passed to MtmFindMaxClique is disconnectivity matrix (bit is set if nodes are not connected),
+ * so clique is searched in its complement. Sets of vertexes are represented by bitmasks and 
+ * Tomita pivoting is used: only vertexes not adjacent to the pivot are branched on.
  */  
 
-typedef struct {
-	int size;
-	int nodes[MAX_NODES];
-} NodeList;
 
-static void list_append(NodeList* list, int n)
-{
-	list->nodes[list->size++] = n;
-}
+typedef struct { 
+	nodemask_t* adj;     /* adjacency (connectivity) matrix */
+	nodemask_t  clique;  /* maximum clique found so far */
+	int         size;    /* size of maximum clique found so far */
+} CliqueSearch;
 
-static void list_copy(NodeList* dst, NodeList const* src)
+/*
+ * Result should not depend on order of search, otherwise nodes can choose different cliques of the same size.
+ * So among cliques of the same size the one containing node with smallest ID is preferred.
+ */
+static int betterClique(nodemask_t clique, int size, CliqueSearch* search)
 {
-	int i;
-	int n = src->size;
-	dst->size = n;
-	for (i = 0; i < n; i++) { 
-		dst->nodes[i] = src->nodes[i];
-	}
+	nodemask_t diff = clique ^ search->clique;
+	return size > search->size || (size == search->size && diff != 0 && (clique & diff & -diff) != 0);
 }
 
-
-static void findMaximumIndependentSet(NodeList* cur, NodeList* result, nodemask_t* graph, int* oldSet, int ne, int ce) 
+static void findMaximumClique(CliqueSearch* search, nodemask_t clique, int size, nodemask_t candidates, nodemask_t excluded)
 {
-    int nod = 0;
-    int minnod = ce;
-    int fixp = -1;
-    int s = -1;
-	int i, j, k;
-	int newce, newne;
-	int sel;
-    int newSet[MAX_NODES];
+	nodemask_t branches, mask;
+	int pivot = -1, maxDegree = -1;
 
-    for (i = 0; i < ce && minnod != 0; i++) {
-		int p = oldSet[i];
-		int cnt = 0;
-		int pos = -1;
-		
-		for (j = ne; j < ce; j++) { 
-			if (BIT_CHECK(graph[p], oldSet[j])) {
-				if (++cnt == minnod) { 
-					break;
-				}
-				pos = j;
-			}
-		}
-		if (minnod > cnt) {
-			minnod = cnt;
-			fixp = p;
-			if (i < ne) {
-				s = pos;
-			} else {
-				s = i;
-				nod = 1;
-			}
-		}
-    }
-	
-
-    for (k = minnod + nod; k >= 1; k--) {
-        sel = oldSet[s];
-		oldSet[s] = oldSet[ne];
-		oldSet[ne] = sel;
-		
-		newne = 0;
-		for (i = 0; i < ne; i++) {
-			if (!BIT_CHECK(graph[sel], oldSet[i])) {
-				newSet[newne++] = oldSet[i];
-			}
-		}
-	    newce = newne;
-		for (i = ne + 1; i < ce; i++) {
-			if (!BIT_CHECK(graph[sel], oldSet[i])) { 
-				newSet[newce++] = oldSet[i];
-			}
+	if (candidates == 0) { 
+		if (excluded == 0 && betterClique(clique, size, search)) { 
+			search->clique = clique;
+			search->size = size;
 		}
-		list_append(cur, sel);
-		if (newce == 0) {
-			if (result->size < cur->size) {
-				list_copy(result, cur);
-			}
-		} else if (newne < newce) {
-			if (cur->size + newce - newne > result->size)  {
-				findMaximumIndependentSet(cur, result, graph, newSet, newne, newce);
-			}
-		}
-		cur->size -= 1;
-		ne += 1;
-		if (k > 1) {
-			for (s = ne; !BIT_CHECK(graph[fixp], oldSet[s]); s++);
+		return;
+	}
+	if (size + nodemask_popcount(candidates) < search->size) { 
+		/* This branch can not produce clique larger than already found */
+		return;
+	}
+	/* Choose pivot maximizing number of its neighbours among candidates */
+	for (mask = candidates | excluded; mask != 0; mask &= mask - 1) { 
+		int u = nodemask_first(mask);
+		int degree = nodemask_popcount(candidates & search->adj[u]);
+		if (degree > maxDegree) { 
+			maxDegree = degree;
+			pivot = u;
 		}
 	}
+	for (branches = candidates & ~search->adj[pivot]; branches != 0; branches &= branches - 1) { 
+		int v = nodemask_first(branches);
+		nodemask_t bit = (nodemask_t)1 << v;
+		findMaximumClique(search, clique | bit, size + 1, candidates & search->adj[v], excluded & search->adj[v]);
+		candidates &= ~bit;
+		excluded |= bit;
+	}
 }
 
 nodemask_t MtmFindMaxClique(nodemask_t* graph, int n_nodes, int* clique_size)
 {
-	NodeList tmp;
-	NodeList result;
-	nodemask_t mask;
-	int all[MAX_NODES];
-	int i;
+	static nodemask_t cachedGraph[MAX_NODES];
+	static int cachedNodes = -1;
+	static nodemask_t cachedClique;
+	static int cachedSize;
+	nodemask_t adj[MAX_NODES];
+	nodemask_t all = NODEMASK_ALL(n_nodes);
+	CliqueSearch search;
+	int i, j;
 
-	tmp.size = 0;
-	result.size = 0;
+	/* Connectivity matrix is not changed most of the time, so reuse result of previous search */
+	if (cachedNodes == n_nodes && memcmp(cachedGraph, graph, n_nodes*sizeof(nodemask_t)) == 0) { 
+		*clique_size = cachedSize;
+		return cachedClique;
+	}
 	for (i = 0; i < n_nodes; i++) { 
-		all[i] = i;
+		adj[i] = ~graph[i] & all & ~((nodemask_t)1 << i);
 	}
-	findMaximumIndependentSet(&tmp, &result, graph, all, 0, n_nodes);
-	mask = 0;
-	for (i = 0; i < result.size; i++) { 
-		BIT_SET(mask, result.nodes[i]);
+	/* Nodes are considered connected only if both of them see each other */
+	for (i = 0; i < n_nodes; i++) { 
+		for (j = 0; j < n_nodes; j++) { 
+			if (!BIT_CHECK(adj[j], i)) { 
+				BIT_CLEAR(adj[i], j);
+			}
+		}
 	}
-	*clique_size = result.size;
-	return mask;
+	search.adj = adj;
+	search.clique = 0;
+	search.size = 0;
+	findMaximumClique(&search, 0, 0, all, 0);
+
+	memcpy(cachedGraph, graph, n_nodes*sizeof(nodemask_t));
+	cachedNodes = n_nodes;
+	cachedClique = search.clique;
+	cachedSize = search.size;
+
+	*clique_size = search.size;
+	return search.clique;
 }
@@ -4,17 +4,75 @@
 #ifndef __BKB_H__
 #define __BKB_H__
 
-#define MAX_NODES 64
+/*
+ * Maximal number of nodes in cluster is chosen at build time (e.g. PG_CPPFLAGS += -DMTM_MAX_NODES=128).
+ * Node masks are plain integers, so the default 64-node configuration pays nothing for this,
+ * and up to 128 nodes are supported using 128-bit integers where compiler provides them.
+ * Notice that masks are still reported to SQL functions and logs as 64-bit integers.
+ */
+#ifndef MTM_MAX_NODES
+#define MTM_MAX_NODES 64
+#endif
+#define MAX_NODES MTM_MAX_NODES
 
 typedef long long long64; /* we are not using int64 here because we want to use %lld format for this type */
 typedef unsigned long long ulong64; /* we are not using uint64 here because we want to use %lld format for this type */
 
+#if MAX_NODES <= 64
 typedef ulong64 nodemask_t;
+#elif MAX_NODES <= 128 && defined(__SIZEOF_INT128__)
+typedef unsigned __int128 nodemask_t;
+#else
+#error "MTM_MAX_NODES should not exceed 64 (128 if compiler supports 128-bit integers)"
+#endif
 
 #define BIT_CHECK(mask, bit) (((mask) & ((nodemask_t)1 << (bit))) != 0)
 #define BIT_CLEAR(mask, bit) (mask &= ~((nodemask_t)1 << (bit)))
 #define BIT_SET(mask, bit)   (mask |= ((nodemask_t)1 << (bit)))
 
+/* Mask of first n nodes (shift by full width of the mask is undefined) */
+#define NODEMASK_ALL(n) ((n) >= (int)sizeof(nodemask_t)*8 ? ~(nodemask_t)0 : ((nodemask_t)1 << (n)) - 1)
+
+/*
+ * Number of nodes in the mask
+ */
+static inline int
+nodemask_popcount(nodemask_t mask)
+{
+#if defined(__GNUC__) && MAX_NODES <= 64
+	return __builtin_popcountll(mask);
+#elif defined(__GNUC__)
+	return __builtin_popcountll((ulong64)mask) + __builtin_popcountll((ulong64)(mask >> 64));
+#else
+	int n = 0;
+	while (mask != 0) { 
+		mask &= mask - 1;
+		n += 1;
+	}
+	return n;
+#endif
+}
+
+/*
+ * Index of the first node in the mask. Mask should not be empty.
+ * Set nodes are enumerated by "for (m = mask; m != 0; m &= m - 1) { i = nodemask_first(m); ... }"
+ */
+static inline int
+nodemask_first(nodemask_t mask)
+{
+#if defined(__GNUC__) && MAX_NODES <= 64
+	return __builtin_ctzll(mask);
+#elif defined(__GNUC__)
+	return (ulong64)mask != 0 ? __builtin_ctzll((ulong64)mask) : 64 + __builtin_ctzll((ulong64)(mask >> 64));
+#else
+	int i = 0;
+	while (!BIT_CHECK(mask, i)) { 
+		i += 1;
+	}
+	return i;
+#endif
+}
+
 extern nodemask_t MtmFindMaxClique(nodemask_t* matrix, int n_modes, int* clique_size);
 
 #endif
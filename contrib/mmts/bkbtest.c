@@ -1,7 +1,60 @@
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <time.h>
 #include "bkb.h"
 
+#define N_ITERATIONS 100
+
+/* Check that all nodes of clique are connected with each other */
+static int isClique(nodemask_t* matrix, int n_nodes, nodemask_t clique)
+{
+	int i, j;
+	for (i = 0; i < n_nodes; i++) { 
+		if (BIT_CHECK(clique, i)) { 
+			for (j = 0; j < n_nodes; j++) { 
+				if (i != j && BIT_CHECK(clique, j) && (BIT_CHECK(matrix[i], j) || BIT_CHECK(matrix[j], i))) { 
+					return 0;
+				}
+			}
+		}
+	}
+	return 1;
+}
+
+/* Benchmark clique search for random disconnectivity matrices where each link is broken with given probability */
+static void benchmark(int n_nodes, double density)
+{
+	nodemask_t matrix[MAX_NODES];
+	long total_size = 0;
+	clock_t start = clock();
+	int i, j, k;
+
+	for (k = 0; k < N_ITERATIONS; k++) { 
+		nodemask_t clique;
+		int clique_size;
+		for (i = 0; i < n_nodes; i++) { 
+			matrix[i] = 0;
+		}
+		for (i = 0; i < n_nodes; i++) { 
+			for (j = 0; j < i; j++) { 
+				if (rand() < density*RAND_MAX) { 
+					BIT_SET(matrix[i], j);
+					BIT_SET(matrix[j], i);
+				}
+			}
+		}
+		clique = MtmFindMaxClique(matrix, n_nodes, &clique_size);
+		if (!isClique(matrix, n_nodes, clique)) { 
+			fprintf(stderr, "Invalid clique %llx\n", clique);
+			exit(1);
+		}
+		total_size += clique_size;
+	}
+	printf("%d nodes, %.2f broken links: average clique size %.2f, %.3f msec per search\n", 
+		   n_nodes, density, (double)total_size/N_ITERATIONS, (double)(clock() - start)*1000/CLOCKS_PER_SEC/N_ITERATIONS);
+}
+
 int main() { 
 	nodemask_t matrix[64] = {0};
 	nodemask_t clique;
@@ -12,6 +65,11 @@ int main() {
 	matrix[4] = 3;
 	clique = MtmFindMaxClique(matrix, 64, &clique_size);
 	printf("Clique=%llx\n", clique);
+
+	srand(2016);
+	benchmark(16, 0.1);
+	benchmark(64, 0.01);
+	benchmark(64, 0.1);
+	benchmark(64, 0.5);
 	return 0;
 }
-	
@@ -5,70 +5,165 @@
 
 #include "ddd.h"
 
-
-void MtmGraphInit(MtmGraph* graph)
+static int compareGtid(GlobalTransactionId const* a, GlobalTransactionId const* b)
 {
-    memset(graph->hashtable, 0, sizeof(graph->hashtable));
+    if (a->node != b->node) {
+        return a->node < b->node ? -1 : 1;
+    }
+    return a->xid < b->xid ? -1 : a->xid == b->xid ? 0 : 1;
 }
 
-static inline MtmVertex* findVertex(MtmGraph* graph, GlobalTransactionId* gtid)
+static int compareEdges(void const* p, void const* q)
 {
-    uint32 h = gtid->xid % MAX_TRANSACTIONS;
-    MtmVertex* v;
-    for (v = graph->hashtable[h]; v != NULL; v = v->collision) { 
-        if (EQUAL_GTID(v->gtid, *gtid)) { 
-            return v;
-        }
-    }
-	v = (MtmVertex*)palloc(sizeof(MtmVertex));
-    v->gtid = *gtid;
-	v->outgoingEdges = NULL;
-    v->collision = graph->hashtable[h];
-    graph->hashtable[h] = v;
-    return v;
+    MtmLockEdge const* a = (MtmLockEdge const*)p;
+    MtmLockEdge const* b = (MtmLockEdge const*)q;
+    int diff = compareGtid(&a->src, &b->src);
+    return diff != 0 ? diff : compareGtid(&a->dst, &b->dst);
 }
 
-void MtmGraphAdd(MtmGraph* graph, GlobalTransactionId* gtid, int size)
+/*
+ * Convert list of locks produced by MtmSerializeLock (waiting transaction followed by list of 
+ * lock owners terminated by zero GTID) to ordered array of unique edges.
+ */
+int MtmLockGraphFromLocks(GlobalTransactionId* gtid, int size, MtmLockEdge** result)
 {
     GlobalTransactionId* last = gtid + size;
+    MtmLockEdge* edges = (MtmLockEdge*)palloc(Max(size, 1)*sizeof(MtmLockEdge));
+    int i, n = 0;
+    
     while (gtid != last) { 
-        MtmVertex* src = findVertex(graph, gtid++);
+        GlobalTransactionId* src = gtid++;
         while (gtid->node != 0) { 
-            MtmVertex* dst = findVertex(graph, gtid++);
-            MtmEdge* e = (MtmEdge*)palloc(sizeof(MtmEdge));
-            e->dst = dst;
-            e->src = src;
-            e->next = src->outgoingEdges;
-            src->outgoingEdges = e;
+            edges[n].src = *src;
+            edges[n].dst = *gtid++;
+            n += 1;
         }
 		gtid += 1;
     }
+    qsort(edges, n, sizeof(MtmLockEdge), compareEdges);
+    for (i = 1, size = n > 0 ? 1 : 0; i < n; i++) { 
+        if (compareEdges(&edges[i], &edges[size-1]) != 0) { 
+            edges[size++] = edges[i];
+        }
+    }
+    *result = edges;
+    return size;
+}
+
+/*
+ * Merge two ordered graphs: edges present only in "to" are added, edges present only in "from" are removed. 
+ * "added" should have space for to->nEdges and "removed" - for from->nEdges edges.
+ */
+void MtmLockGraphDiff(MtmLockGraph* from, MtmLockGraph* to, MtmLockEdge* added, int* nAdded, MtmLockEdge* removed, int* nRemoved)
+{
+    int i = 0, j = 0;
+    *nAdded = *nRemoved = 0;
+    while (i < from->nEdges || j < to->nEdges) { 
+        int diff = i == from->nEdges ? 1 : j == to->nEdges ? -1 : compareEdges(&from->edges[i], &to->edges[j]);
+        if (diff < 0) { 
+            removed[(*nRemoved)++] = from->edges[i++];
+        } else if (diff > 0) { 
+            added[(*nAdded)++] = to->edges[j++];
+        } else { 
+            i += 1;
+            j += 1;
+        }
+    }
+}
+
+/*
+ * Apply delta produced by MtmLockGraphDiff. "result" should have space for graph->nEdges + nAdded edges.
+ * Returns number of edges in resulted graph.
+ */
+int MtmLockGraphApplyDelta(MtmLockGraph* graph, MtmLockEdge* added, int nAdded, MtmLockEdge* removed, int nRemoved, MtmLockEdge* result)
+{
+    int i = 0, j = 0, k = 0, n = 0;
+    while (i < graph->nEdges || j < nAdded) { 
+        int diff = i == graph->nEdges ? 1 : j == nAdded ? -1 : compareEdges(&graph->edges[i], &added[j]);
+        MtmLockEdge* e = diff <= 0 ? &graph->edges[i++] : &added[j++];
+        if (diff == 0) { 
+            j += 1;
+        }
+        while (k < nRemoved && compareEdges(&removed[k], e) < 0) { 
+            k += 1;
+        }
+        if (k < nRemoved && compareEdges(&removed[k], e) == 0) { 
+            continue;
+        }
+        result[n++] = *e;
+    }
+    return n;
 }
 
-static bool recursiveTraverseGraph(MtmVertex* root, MtmVertex* v)
+/* Find position of first edge outgoing from "src" */
+static int findFirstEdge(MtmLockGraph* graph, GlobalTransactionId* src)
 {
-    MtmEdge* e;
-    v->gtid.node = VISITED_NODE_MARK;
-    for (e = v->outgoingEdges; e != NULL; e = e->next) {
-        if (e->dst == root) { 
-            return true;
-        } else if (e->dst->gtid.node != VISITED_NODE_MARK && recursiveTraverseGraph(root, e->dst)) { /* loop */
-            return true;
-        } 
+    int l = 0, r = graph->nEdges;
+    while (l < r) { 
+        int m = (l + r) >> 1;
+        if (compareGtid(&graph->edges[m].src, src) < 0) { 
+            l = m + 1;
+        } else { 
+            r = m;
+        }
     }
-    return false;        
+    return l;
 }
 
-bool MtmGraphFindLoop(MtmGraph* graph, GlobalTransactionId* root)
+/*
+ * Check if there is loop in union of lock graphs of all nodes containing "root" transaction.
+ * Graphs are not merged: outgoing edges of each vertex are located in sorted edge arrays by binary search, 
+ * so only part of the graph reachable from "root" is visited.
+ */
+bool MtmLockGraphFindLoop(MtmLockGraph* graphs, int nGraphs, GlobalTransactionId* root)
 {
-    MtmVertex* v;
-    for (v = graph->hashtable[root->xid % MAX_TRANSACTIONS]; v != NULL; v = v->collision) { 
-        if (EQUAL_GTID(v->gtid, *root)) { 
-            if (recursiveTraverseGraph(v, v)) { 
-                return true;
+    HASHCTL ctl;
+    HTAB* visited;
+    GlobalTransactionId* stack;
+    int sp = 0, stackSize = 64;
+    int nEdges = 0;
+    bool hasLoop = false;
+    int i;
+
+    for (i = 0; i < nGraphs; i++) { 
+        nEdges += graphs[i].nEdges;
+    }
+    if (nEdges == 0) { 
+        return false;
+    }
+    memset(&ctl, 0, sizeof(ctl));
+    ctl.keysize = sizeof(GlobalTransactionId);
+    ctl.entrysize = sizeof(GlobalTransactionId);
+    visited = hash_create("MtmDeadlockVisited", 64, &ctl, HASH_ELEM | HASH_BLOBS);
+    stack = (GlobalTransactionId*)palloc(stackSize*sizeof(GlobalTransactionId));
+
+    stack[sp++] = *root;
+    hash_search(visited, root, HASH_ENTER, NULL);
+
+    while (sp != 0 && !hasLoop) { 
+        GlobalTransactionId src = stack[--sp];
+        for (i = 0; i < nGraphs && !hasLoop; i++) { 
+            MtmLockGraph* graph = &graphs[i];
+            int j;
+            for (j = findFirstEdge(graph, &src); j < graph->nEdges && EQUAL_GTID(graph->edges[j].src, src); j++) { 
+                GlobalTransactionId* dst = &graph->edges[j].dst;
+                bool found;
+                if (EQUAL_GTID(*dst, *root)) { 
+                    hasLoop = true;
+                    break;
+                }
+                hash_search(visited, dst, HASH_ENTER, &found);
+                if (!found) { 
+                    if (sp == stackSize) { 
+                        stackSize *= 2;
+                        stack = (GlobalTransactionId*)repalloc(stack, stackSize*sizeof(GlobalTransactionId));
+                    }
+                    stack[sp++] = *dst;
+                }
             }
-            break;
         }
     }
-    return false;        
+    pfree(stack);
+    hash_destroy(visited);
+    return hasLoop;
 }
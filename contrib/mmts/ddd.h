@@ -3,29 +3,39 @@
 
 #include "multimaster.h"
 
-#define MAX_TRANSACTIONS  1024
-#define VISITED_NODE_MARK 0
+/* Lock graph is sent in full at least every MTM_LOCK_GRAPH_FULL_PERIOD deadlock checks */
+#define MTM_LOCK_GRAPH_FULL_PERIOD 16
 
-typedef struct MtmEdge {
-	struct MtmEdge*   next; /* list of outgoing edges */
-    struct MtmVertex* dst;
-    struct MtmVertex* src;
-} MtmEdge;
+/* Wait-for edge: transaction "src" waits for transaction "dst" */
+typedef struct MtmLockEdge
+{
+	GlobalTransactionId src;
+	GlobalTransactionId dst;
+} MtmLockEdge;
 
-typedef struct MtmVertex
-{    
-    struct MtmEdge* outgoingEdges;
-    struct MtmVertex* collision;
-	GlobalTransactionId gtid;
-} MtmVertex;
+/* Lock graph of one node: array of edges ordered by (src,dst) without duplicates */
+typedef struct MtmLockGraph
+{
+	MtmLockEdge* edges;
+	int          nEdges;
+} MtmLockGraph;
 
-typedef struct MtmGraph
+/* 
+ * Header of 'L' message. It is followed by "nAdded" edges and then "nRemoved" edges.
+ * Full graph is sent as delta with no removed edges and zero base version.
+ */
+typedef struct MtmLockGraphMessage
 {
-    MtmVertex* hashtable[MAX_TRANSACTIONS];
-} MtmGraph;
+	bool        isDelta;
+	int         nAdded;
+	int         nRemoved;
+	timestamp_t version;     /* version of sender's graph after applying this message */
+	timestamp_t baseVersion; /* version of sender's graph this delta was calculated against */
+} MtmLockGraphMessage;
 
-extern void MtmGraphInit(MtmGraph* graph);
-extern void MtmGraphAdd(MtmGraph* graph, GlobalTransactionId* subgraph, int size);
-extern bool MtmGraphFindLoop(MtmGraph* graph, GlobalTransactionId* root);
+extern int  MtmLockGraphFromLocks(GlobalTransactionId* locks, int size, MtmLockEdge** edges);
+extern void MtmLockGraphDiff(MtmLockGraph* from, MtmLockGraph* to, MtmLockEdge* added, int* nAdded, MtmLockEdge* removed, int* nRemoved);
+extern int  MtmLockGraphApplyDelta(MtmLockGraph* graph, MtmLockEdge* added, int nAdded, MtmLockEdge* removed, int nRemoved, MtmLockEdge* result);
+extern bool MtmLockGraphFindLoop(MtmLockGraph* graphs, int nGraphs, GlobalTransactionId* root);
 
 #endif
@@ -35,15 +35,52 @@ CREATE FUNCTION mtm.get_last_csn() RETURNS bigint
 AS 'MODULE_PATHNAME','mtm_get_last_csn'
 LANGUAGE C;
 
+CREATE TYPE mtm.commit_token AS ("node" integer, "csn" bigint, "lsn" bigint);
 
-CREATE TYPE mtm.node_state AS ("id" integer, "disabled" bool, "disconnected" bool, "catchUp" bool, "slotLag" bigint, "avgTransDelay" bigint, "lastStatusChange" timestamp, "oldestSnapshot" bigint, "SenderPid" integer, "SenderStartTime" timestamp, "ReceiverPid" integer, "ReceiverStartTime" timestamp, "connStr" text, "connectivityMask" bigint, "stalled" bool, "stopped" bool);
+CREATE FUNCTION mtm.get_commit_token() RETURNS mtm.commit_token
+AS 'MODULE_PATHNAME','mtm_get_commit_token'
+LANGUAGE C;
+
+CREATE FUNCTION mtm.wait_for_csn(token mtm.commit_token, timeout integer DEFAULT 0) RETURNS boolean
+AS 'MODULE_PATHNAME','mtm_wait_for_csn'
+LANGUAGE C;
+
+
+CREATE TYPE mtm.node_state AS ("id" integer, "disabled" bool, "disconnected" bool, "catchUp" bool, "slotLag" bigint, "avgTransDelay" bigint, "lastStatusChange" timestamp, "oldestSnapshot" bigint, "SenderPid" integer, "SenderStartTime" timestamp, "ReceiverPid" integer, "ReceiverStartTime" timestamp, "connStr" text, "connectivityMask" bigint, "stalled" bool, "stopped" bool, "nWorkers" integer, "peakWorkers" integer, "retiredWorkers" integer, "queueDepth" integer, "queueSize" bigint, "voteLatencyP50" bigint, "voteLatencyP99" bigint);
 
 CREATE FUNCTION mtm.get_nodes_state() RETURNS SETOF mtm.node_state
 AS 'MODULE_PATHNAME','mtm_get_nodes_state'
 LANGUAGE C;
 
+CREATE TYPE mtm.apply_stats AS ("id" integer, "rowsApplied" bigint, "bytesApplied" bigint, "rowsPerSec" bigint, "bytesPerSec" bigint, "queueDepthHistory" integer[], "spillBytes" bigint, "conflicts" bigint, "deadlocks" bigint, "coordinatedTransactions" bigint, "avgPrepareTime" bigint, "avgVoteTime" bigint, "avgPrecommitTime" bigint, "avgCommitTime" bigint);
+
+CREATE FUNCTION mtm.get_apply_stats() RETURNS SETOF mtm.apply_stats
+AS 'MODULE_PATHNAME','mtm_get_apply_stats'
+LANGUAGE C;
+
+CREATE TYPE mtm.trace_event AS ("gid" text, "event" text, "time" timestamp with time zone, "pid" integer);
+
+-- Events of sampled distributed transactions (see multimaster.trace_sample_ratio)
+CREATE FUNCTION mtm.get_trace() RETURNS SETOF mtm.trace_event
+AS 'MODULE_PATHNAME','mtm_get_trace'
+LANGUAGE C;
+
+CREATE TYPE mtm.commit_profile AS ("node" integer, "replica" integer, "stage" text, "start" timestamp with time zone, "duration" bigint);
+
+-- Breakdown of commit latency (microseconds) of sampled distributed transaction into stages at coordinator and replicas
+CREATE FUNCTION mtm.get_commit_profile(gid text) RETURNS SETOF mtm.commit_profile
+AS 'MODULE_PATHNAME','mtm_get_commit_profile'
+LANGUAGE C;
+
+CREATE TYPE mtm.wait_stats AS ("event" text, "waits" bigint, "waitTime" bigint);
+
+-- Number and total time (microseconds) of sleeps in multimaster wait events since server start
+CREATE FUNCTION mtm.get_wait_stats() RETURNS SETOF mtm.wait_stats
+AS 'MODULE_PATHNAME','mtm_get_wait_stats'
+LANGUAGE C;
+
 CREATE TYPE mtm.cluster_state AS ("status" text, "disabledNodeMask" bigint, "disconnectedNodeMask" bigint, "catchUpNodeMask" bigint, "liveNodes" integer, "allNodes" integer, "nActiveQueries" integer, "nPendingQueries" integer, "queueSize" bigint, "transCount" bigint, "timeShift" bigint, "recoverySlot" integer,
-"xidHashSize" bigint, "gidHashSize" bigint, "oldestXid" bigint, "configChanges" integer, "stalledNodeMask" bigint, "stoppedNodeMask" bigint);
+"xidHashSize" bigint, "gidHashSize" bigint, "oldestXid" bigint, "configChanges" integer, "stalledNodeMask" bigint, "stoppedNodeMask" bigint, "sendQueueFull" bigint);
 
 CREATE TYPE mtm.trans_state AS ("status" text, "gid" text, "xid" bigint, "coordinator" integer, "gxid" bigint, "csn" timestamp, "snapshot" timestamp, "local" boolean, "prepared" boolean, "active" boolean, "twophase" boolean, "votingCompleted" boolean, "participants" bigint, "voted" bigint, "configChanges" integer);
 
@@ -67,6 +104,15 @@ CREATE FUNCTION mtm.make_table_local(relation regclass) RETURNS void
 AS 'MODULE_PATHNAME','mtm_make_table_local'
 LANGUAGE C;
 
+CREATE FUNCTION mtm.make_table_fast_commit(relation regclass) RETURNS void
+AS 'MODULE_PATHNAME','mtm_make_table_fast_commit'
+LANGUAGE C;
+
+-- Usage: CREATE TRIGGER ... AFTER INSERT OR UPDATE OR DELETE ON tbl FOR EACH ROW EXECUTE PROCEDURE mtm.home_check('home_node_column')
+CREATE FUNCTION mtm.home_check() RETURNS trigger
+AS 'MODULE_PATHNAME','mtm_home_check'
+LANGUAGE C;
+
 CREATE FUNCTION mtm.dump_lock_graph() RETURNS text
 AS 'MODULE_PATHNAME','mtm_dump_lock_graph'
 LANGUAGE C;
@@ -83,5 +129,11 @@ CREATE FUNCTION mtm.check_deadlock(xid bigint) RETURNS boolean
 AS 'MODULE_PATHNAME','mtm_check_deadlock'
 LANGUAGE C;
 
+CREATE FUNCTION mtm.microbench(component text, iterations integer default 100000, size integer default 64) RETURNS float8
+AS 'MODULE_PATHNAME','mtm_microbench'
+LANGUAGE C;
+
 CREATE TABLE IF NOT EXISTS mtm.local_tables(rel_schema text, rel_name text, primary key(rel_schema, rel_name));
 
+CREATE TABLE IF NOT EXISTS mtm.fast_commit_tables(rel_schema text, rel_name text, primary key(rel_schema, rel_name));
+
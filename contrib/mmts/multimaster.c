@@ -8,6 +8,7 @@
 #include <unistd.h>
 #include <sys/time.h>
 #include <time.h>
+#include <poll.h>
 
 #include "postgres.h"
 #include "funcapi.h"
@@ -29,7 +30,9 @@
 #include "storage/ipc.h"
 #include "storage/procarray.h"
 #include "access/xlogdefs.h"
+#include "access/hash.h"
 #include "access/xact.h"
+#include "access/parallel.h"
 #include "access/xtm.h"
 #include "access/transam.h"
 #include "access/subtrans.h"
@@ -40,6 +43,7 @@
 #include "access/twophase.h"
 #include "utils/guc.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/timeout.h"
 #include "utils/tqual.h"
 #include "utils/array.h"
@@ -56,6 +60,7 @@
 #include "replication/slot.h"
 #include "replication/message.h"
 #include "port/atomics.h"
+#include "access/hlc.h"
 #include "tcop/utility.h"
 #include "nodes/makefuncs.h"
 #include "access/htup_details.h"
@@ -65,12 +70,18 @@
 #include "parser/analyze.h"
 #include "parser/parse_relation.h"
 #include "parser/parse_type.h"
+#include "parser/parse_func.h"
+#include "commands/trigger.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_type.h"
 #include "tcop/pquery.h"
+#include "tcop/sessionpool.h"
 #include "lib/ilist.h"
+#include "pgstat.h"
+#include "portability/instr_time.h"
 
 #include "multimaster.h"
+#include "spill.h"
 #include "ddd.h"
 
 typedef struct { 
@@ -83,12 +94,29 @@ typedef struct {
 	bool  isSuspended;    /* prepared transaction is suspended because coordinator node is switch to offline */
     bool  isTransactionBlock; /* is transaction block */
 	bool  containsDML;    /* transaction contains DML statements */
+	bool  isFastCommit;   /* transaction DML statements are only inserts in fast commit tables */
+	bool  isHomeLocal;    /* transaction DML statements only change rows of home tables owned by this node */
 	XidStatus status;     /* transaction status */
     csn_t snapshot;       /* transaction snaphsot */
 	csn_t csn;            /* CSN */
+	timestamp_t startTime; /* system time of transaction start */
 	pgid_t gid;           /* global transaction identifier (used by 2pc) */
 } MtmCurrentTrans;
 
+/* Block of sequence values reserved by this node, see MtmAdjustSequenceValue */
+typedef struct
+{
+	uint32      key;          /* hash of qualified name of sequence */
+	int64       reserved;     /* highest value reserved by any node known to this node, except pending proposal */
+	int64       blockStart;   /* first value of the block owned by this node */
+	int64       blockEnd;     /* last value of the block owned by this node, 0 if none */
+	int64       proposal;     /* first value of the block this node is trying to reserve, 0 if none */
+	int64       proposalEnd;  /* last value of the proposed block */
+	timestamp_t proposalTime; /* time of broadcasting of the proposal, it is repeated after MtmHeartbeatRecvTimeout */
+	nodemask_t  votedMask;    /* mask of nodes which granted the proposal */
+	bool        rejected;     /* proposal is rejected by some node or conflicts with proposal of node with smaller ID */
+} MtmSeqBlock;
+
 typedef enum 
 {
 	MTM_STATE_LOCK_ID
@@ -97,6 +125,14 @@ typedef enum
 #define MTM_SHMEM_SIZE (128*1024*1024)
 #define MTM_HASH_SIZE  100003
 #define MTM_MAP_SIZE   MTM_HASH_SIZE
+#define MTM_XID_MAP_PARTITIONS 16 /* should be power of two */
+#define MTM_XID_MAP_LOCK_ID(hashcode) (1 + MtmMaxNodes*2 + (hashcode) % MTM_XID_MAP_PARTITIONS)
+#define MTM_CSN_CACHE_SIZE (64*1024) /* should be power of two */
+#define MTM_GC_BATCH_SIZE  1024 /* maximal number of transactions removed by GC while holding lock */
+#define MTM_LATENCY_WINDOW 1024 /* histogram of vote latencies is halved when it accumulates this number of samples */
+#define MTM_LATENCY_MIN_SAMPLES 64 /* minimal number of samples to use vote latency histogram for 2PC timeout */
+#define MTM_LATENCY_TIMEOUT_RATIO 4 /* 2PC timeout as ratio of 99 percentile of vote latency */
+#define MTM_MIN_ADAPTIVE_2PC_TIMEOUT MSEC_TO_USEC(10) /* lower bound for adaptive 2PC timeout */
 #define MIN_WAIT_TIMEOUT 1000
 #define MAX_WAIT_TIMEOUT 100000
 #define MAX_WAIT_LOOPS   10000 // 1000000 
@@ -118,13 +154,22 @@ PG_FUNCTION_INFO_V1(mtm_get_csn);
 PG_FUNCTION_INFO_V1(mtm_get_trans_by_gid);
 PG_FUNCTION_INFO_V1(mtm_get_trans_by_xid);
 PG_FUNCTION_INFO_V1(mtm_get_last_csn);
+PG_FUNCTION_INFO_V1(mtm_get_commit_token);
+PG_FUNCTION_INFO_V1(mtm_wait_for_csn);
 PG_FUNCTION_INFO_V1(mtm_get_nodes_state);
 PG_FUNCTION_INFO_V1(mtm_get_cluster_state);
 PG_FUNCTION_INFO_V1(mtm_get_cluster_info);
+PG_FUNCTION_INFO_V1(mtm_get_apply_stats);
+PG_FUNCTION_INFO_V1(mtm_get_trace);
+PG_FUNCTION_INFO_V1(mtm_get_commit_profile);
 PG_FUNCTION_INFO_V1(mtm_make_table_local);
+PG_FUNCTION_INFO_V1(mtm_home_check);
+PG_FUNCTION_INFO_V1(mtm_make_table_fast_commit);
 PG_FUNCTION_INFO_V1(mtm_dump_lock_graph);
 PG_FUNCTION_INFO_V1(mtm_inject_2pc_error);
 PG_FUNCTION_INFO_V1(mtm_check_deadlock);
+PG_FUNCTION_INFO_V1(mtm_microbench);
+PG_FUNCTION_INFO_V1(mtm_get_wait_stats);
 
 static Snapshot MtmGetSnapshot(Snapshot snapshot);
 static void MtmInitialize(void);
@@ -138,7 +183,10 @@ static void MtmEndTransaction(MtmCurrentTrans* x, bool commit);
 static bool MtmTwoPhaseCommit(MtmCurrentTrans* x);
 static TransactionId MtmGetOldestXmin(Relation rel, bool ignoreVacuum);
 static bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot);
-static TransactionId MtmAdjustOldestXid(TransactionId xid);
+static void MtmXidInMVCCSnapshotBatch(TransactionId* xids, int n, Snapshot snapshot, bool* result);
+static bool MtmAdjustOldestXid(TransactionId xid, csn_t oldestSnapshot);
+static csn_t MtmGetOldestSnapshot(void);
+static bool MtmIsDeadForAllSnapshots(TransactionId xmax);
 static bool MtmDetectGlobalDeadLock(PGPROC* proc);
 static void MtmAddSubtransactions(MtmTransState* ts, TransactionId* subxids, int nSubxids);
 static char const* MtmGetName(void);
@@ -146,17 +194,23 @@ static size_t MtmGetTransactionStateSize(void);
 static void MtmSerializeTransactionState(void* ctx);
 static void MtmDeserializeTransactionState(void* ctx);
 static void MtmInitializeSequence(int64* start, int64* step);
+static int64 MtmAdjustSequenceValue(Relation seqrel, int64 next, int64 incby, int64 maxv);
+static void MtmReplayLogicalMessage(char const* prefix, char const* message, Size size);
+static void MtmLogCommitCSN(MtmCurrentTrans* x);
+static void MtmTransactionListAppend(MtmTransState* ts);
+static void MtmDisableNode(int nodeId);
 
 static void MtmCheckClusterLock(void);
 static void MtmCheckSlots(void);
 static void MtmAddSubtransactions(MtmTransState* ts, TransactionId *subxids, int nSubxids);
 
 static void MtmShmemStartup(void);
+static void MtmLookupPrewarm(void);
 
 static BgwPool* MtmPoolConstructor(void);
-static bool MtmRunUtilityStmt(PGconn* conn, char const* sql, char **errmsg);
 static void MtmBroadcastUtilityStmt(char const* sql, bool ignoreError);
 static void MtmProcessDDLCommand(char const* queryString, bool transactional);
+static void MtmGucTransactionEnd(bool sent);
 
 MtmState* Mtm;
 
@@ -168,11 +222,21 @@ MemoryContext MtmApplyContext;
 HTAB* MtmXid2State;
 HTAB* MtmGid2State;
 static HTAB* MtmLocalTables;
+static HTAB* MtmFastCommitTables;
+static HTAB* MtmSeqBlocks;
+static HTAB* MtmLocalTablesCache;         /* Backend-local copy of MtmLocalTables used by walsender row filter */
+static uint64 MtmLocalTablesCacheVersion; /* Value of Mtm->localTablesVersion at the moment of cache construction */
+static Oid    MtmLastFilteredRelid;       /* Relation of the last row filtered by walsender, InvalidOid if unknown */
+static bool   MtmLastFilteredIsDistributed;
 
 static bool MtmIsRecoverySession;
+static bool (*MtmPrewarmLoadingInProgress)(void); /* AutoPrewarmLoadingInProgress() of pg_prewarm, if it is preloaded */
 static MtmConnectionInfo* MtmConnections;
 
 static MtmCurrentTrans MtmTx;
+static MtmCommitToken MtmLastCommitToken; /* position of the last distributed transaction committed by this backend */
+static TransactionId MtmLocalXmin; /* last oldest xmin of local backends */
+static timestamp_t MtmPhaseStartTime; /* start of current 2PC phase of transaction coordinated by this backend */
 static dlist_head MtmLsnMapping = DLIST_STATIC_INIT(MtmLsnMapping);
 
 static TransactionManager MtmTM = 
@@ -190,7 +254,12 @@ static TransactionManager MtmTM =
 	MtmGetTransactionStateSize,
 	MtmSerializeTransactionState,
 	MtmDeserializeTransactionState,
-	MtmInitializeSequence
+	MtmInitializeSequence,
+	MtmIsDeadForAllSnapshots,
+	MtmXidInMVCCSnapshotBatch,
+	MtmIsDeadForAllSnapshots, /* IsVisibleForAllSnapshots */
+	MtmAdjustSequenceValue,
+	MtmReplayLogicalMessage
 };
 
 char const* const MtmNodeStatusMnem[] = 
@@ -219,11 +288,13 @@ char* MtmDatabaseUser;
 int   MtmNodes;
 int   MtmNodeId;
 int   MtmReplicationNodeId;
+lsn_t MtmSenderRestartLSN[MAX_NODES]; /* per-origin positions already applied by the receiver of this WAL sender */
 int   MtmArbiterPort;
 int   MtmConnectTimeout;
 int   MtmReconnectTimeout;
 int   MtmNodeDisableDelay;
 int   MtmTransSpillThreshold;
+int   MtmTransSpillBudget;
 int   MtmMaxNodes;
 int   MtmHeartbeatSendTimeout;
 int   MtmHeartbeatRecvTimeout;
@@ -231,6 +302,15 @@ int   MtmMin2PCTimeout;
 int   MtmMax2PCRatio;
 bool  MtmUseDtm;
 bool  MtmPreserveCommitOrder;
+bool  MtmCompressReplication;
+bool  MtmTrustedCluster;
+int   MtmArbiterReceivers;
+int   MtmTraceSampleRatio;
+int   MtmApplyPrefetchDepth;
+int   MtmApplyMaintenanceWorkers;
+int   MtmStandbySnapshotPeriod;
+int   MtmQuorumCommitDelay;
+bool  MtmIsStandby; /* node is hot standby replica of multimaster node */
 bool  MtmVolksWagenMode;
 
 TransactionId  MtmUtilityProcessedInXid;
@@ -238,24 +318,29 @@ TransactionId  MtmUtilityProcessedInXid;
 static char* MtmConnStrs;
 static char* MtmClusterName;
 static int   MtmQueueSize;
+static int   MtmSendQueueSize;
 static int   MtmWorkers;
 static int   MtmVacuumDelay;
 static int   MtmMinRecoveryLag;
+static bool  MtmLockClusterOnRecovery;
 static int   MtmMaxRecoveryLag;
 static int   MtmGcPeriod;
 static bool  MtmIgnoreTablesWithoutPk;
 static int   MtmLockCount;
 static bool  MtmMajorNode;
+static int   MtmSequenceBlockSize;
 
 static ExecutorStart_hook_type PreviousExecutorStartHook;
 static ExecutorFinish_hook_type PreviousExecutorFinishHook;
 static ProcessUtility_hook_type PreviousProcessUtilityHook;
 static shmem_startup_hook_type PreviousShmemStartupHook;
+static session_pool_hook_type PreviousSessionPoolHook;
 
 static nodemask_t lastKnownMatrix[MAX_NODES];
 
 static void MtmExecutorStart(QueryDesc *queryDesc, int eflags);
 static void MtmExecutorFinish(QueryDesc *queryDesc);
+static void MtmSessionPoolHook(SessionPoolEvent event, int32 sessionId);
 static void MtmProcessUtility(Node *parsetree, const char *queryString,
 							 ProcessUtilityContext context, ParamListInfo params,
 							 DestReceiver *dest, char *completionTag);
@@ -264,10 +349,11 @@ static void MtmProcessUtility(Node *parsetree, const char *queryString,
  * -------------------------------------------
  * Synchronize access to MTM structures.
  * Using LWLock seems to be more efficient (at our benchmarks)
- * Multimaster uses trash of 2N+1 lwlocks, where N is number of nodes.
+ * Multimaster uses trash of 2N+1+P lwlocks, where N is number of nodes and P is MTM_XID_MAP_PARTITIONS.
  * locks[0] is used to synchronize access to multimaster state, 
  * locks[1..N] are used to provide exclusive access to replication session for each node
  * locks[N+1..2*N] are used to synchronize access to distributed lock graph at each node
+ * locks[2*N+1..2*N+P] are partition locks of MtmXid2State hash
  * -------------------------------------------
  */
 void MtmLock(LWLockMode mode)
@@ -308,6 +394,98 @@ void MtmUnlockNode(int nodeId)
 	LWLockRelease((LWLockId)&Mtm->locks[nodeId]);	
 }
 
+/*
+ * MtmXid2State is partitioned hash. All modifications of it are done under exclusive MtmLock, 
+ * but visibility checks are done without MtmLock, holding only shared lock of the partition.
+ * So insertion and removal of elements should also hold exclusive partition lock. 
+ * New elements are initialized as in-progress transactions before partition lock is released.
+ * Readers not holding MtmLock rely on the following order: CSN is assigned before status is changed.
+ */
+static LWLock* MtmXidMapPartitionLock(TransactionId xid, uint32* hashcode)
+{
+	*hashcode = get_hash_value(MtmXid2State, &xid);
+	return &Mtm->locks[MTM_XID_MAP_LOCK_ID(*hashcode)].lock;
+}
+
+/*
+ * Direct mapped cache of final statuses of transactions.
+ * It allows to check visibility of tuples of completed transactions without any locks.
+ * Entries are updated only under exclusive MtmLock, so there is single writer;
+ * readers use seqlock protocol and treat concurrent update as cache miss.
+ */
+static void MtmCsnCacheSet(MtmCsnCacheEntry* entry, TransactionId xid, XidStatus status, csn_t csn)
+{
+	uint32 seq = pg_atomic_read_u32(&entry->seq);
+	Assert(MtmLockCount != 0);
+	pg_atomic_write_u32(&entry->seq, seq + 1);
+	pg_write_barrier();
+	entry->xid = xid;
+	entry->status = status;
+	entry->csn = csn;
+	pg_write_barrier();
+	pg_atomic_write_u32(&entry->seq, seq + 2);
+}
+
+static void MtmCsnCacheUpdate(TransactionId xid, XidStatus status, csn_t csn)
+{
+	MtmCsnCacheSet(&Mtm->csnCache[xid & (MTM_CSN_CACHE_SIZE-1)], xid, status, csn);
+}
+
+static void MtmCsnCacheRemove(TransactionId xid)
+{
+	MtmCsnCacheEntry* entry = &Mtm->csnCache[xid & (MTM_CSN_CACHE_SIZE-1)];
+	if (entry->xid == xid) { 
+		MtmCsnCacheSet(entry, InvalidTransactionId, TRANSACTION_STATUS_IN_PROGRESS, INVALID_CSN);
+	}
+}
+
+static bool MtmCsnCacheLookup(TransactionId xid, XidStatus* status, csn_t* csn)
+{
+	MtmCsnCacheEntry* entry = &Mtm->csnCache[xid & (MTM_CSN_CACHE_SIZE-1)];
+	uint32 seq = pg_atomic_read_u32(&entry->seq);
+	bool found;
+	if (seq & 1) { 
+		return false;
+	}
+	pg_read_barrier();
+	found = entry->xid == xid;
+	*status = entry->status;
+	*csn = entry->csn;
+	pg_read_barrier();
+	return found && pg_atomic_read_u32(&entry->seq) == seq;
+}
+
+static MtmTransState* MtmXidMapEnter(TransactionId xid, bool* found)
+{
+	uint32 hashcode;
+	LWLock* lock = MtmXidMapPartitionLock(xid, &hashcode);
+	MtmTransState* ts;
+	Assert(MtmLockCount != 0);
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	ts = (MtmTransState*)hash_search_with_hash_value(MtmXid2State, &xid, hashcode, HASH_ENTER, found);
+	if (!*found) { 
+		ts->status = TRANSACTION_STATUS_IN_PROGRESS;
+		ts->csn = INVALID_CSN;
+		ts->nSubxids = 0;
+		ts->isFastCommit = false;
+		ts->isHomeLocal = false;
+	}
+	LWLockRelease(lock);
+	MtmCsnCacheRemove(xid);
+	return ts;
+}
+
+static void MtmXidMapRemove(TransactionId xid)
+{
+	uint32 hashcode;
+	LWLock* lock = MtmXidMapPartitionLock(xid, &hashcode);
+	Assert(MtmLockCount != 0);
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	hash_search_with_hash_value(MtmXid2State, &xid, hashcode, HASH_REMOVE, NULL);
+	LWLockRelease(lock);
+	MtmCsnCacheRemove(xid);
+}
+
 /*
  * -------------------------------------------
  * System time manipulation functions
@@ -323,11 +501,50 @@ timestamp_t MtmGetSystemTime(void)
 }
 
 /*
- * Get adjusted system time: taking in account time shift
+ * Get adjusted system time: it is never less than last assigned or received CSN
  */
 timestamp_t MtmGetCurrentTime(void)
 {
-    return MtmGetSystemTime() + Mtm->timeShift;
+	return HlcRead(&Mtm->csn, MtmGetSystemTime());
+}
+
+/*
+ * Names of wait events shown in pg_stat_activity.wait_event, indexed by MtmWaitEvent
+ */
+static char const* const MtmWaitEventNames[] =
+{
+	"MtmVote",
+	"MtmInDoubt",
+	"MtmClusterLock",
+	"MtmPoolOverflow",
+	"MtmPoolDependency",
+	"MtmPoolIdle",
+	"MtmCommitApply",
+	"MtmSequenceBlock",
+	"MtmCommitTicket",
+	"MtmCommitProfile"
+};
+
+/* Ids of wait events assigned by pgstat_register_wait_event in _PG_init */
+static uint16 MtmWaitEventIds[MTM_N_WAIT_EVENTS];
+
+/*
+ * Report start of the wait in pg_stat_activity and return start time to be passed to MtmWaitEnd.
+ * Waits should be short and contain no LWLock acquisitions, which override the reported event.
+ */
+timestamp_t MtmWaitStart(MtmWaitEvent event)
+{
+	pgstat_report_wait_start(WAIT_EXTENSION, MtmWaitEventIds[event]);
+	return MtmGetSystemTime();
+}
+
+void MtmWaitEnd(MtmWaitEvent event, timestamp_t start)
+{
+	pgstat_report_wait_end();
+	if (Mtm != NULL) {
+		pg_atomic_fetch_add_u64(&Mtm->waitCount[event], 1);
+		pg_atomic_fetch_add_u64(&Mtm->waitTime[event], MtmGetSystemTime() - start);
+	}
 }
 
 void MtmSleep(timestamp_t interval)
@@ -344,29 +561,24 @@ void MtmSleep(timestamp_t interval)
 }
     
 /** 
- * Return ascending unique timestamp which is used as CSN
+ * Return ascending unique timestamp which is used as CSN.
+ * CSN is hybrid logical clock: physical time in microseconds, incremented as logical counter 
+ * when it is not greater than last assigned or received CSN.
+ * Clock is advanced using atomic compare-and-swap, so it can be called without holding MtmLock.
  */
 csn_t MtmAssignCSN()
 {
-    csn_t csn = MtmGetCurrentTime();
-    if (csn <= Mtm->csn) { 
-        csn = ++Mtm->csn;
-    } else { 
-        Mtm->csn = csn;
-    }
-    return csn;
+	return HlcNext(&Mtm->csn, MtmGetSystemTime());
 }
 
 /**
- * "Adjust" system clock if we receive message from future 
+ * Advance logical clock if we receive message from future.
+ * Unlike adjusting of system time it doesn't require to wait in case of clock skew.
  */
 csn_t MtmSyncClock(csn_t global_csn)
 {
-    csn_t local_csn;
-    while ((local_csn = MtmAssignCSN()) < global_csn) { 
-        Mtm->timeShift += global_csn - local_csn;
-    }
-    return local_csn;
+	HlcSync(&Mtm->csn, global_csn);
+    return MtmAssignCSN();
 }
 
 /*
@@ -389,6 +601,10 @@ MtmSerializeTransactionState(void* ctx)
 	memcpy(ctx, &MtmTx, sizeof(MtmTx));
 }
 
+/*
+ * Called in parallel worker: visibility checks in worker use CSN snapshot of the leader and
+ * the leader's backend slot keeps this snapshot registered for GC while worker is running.
+ */
 static void
 MtmDeserializeTransactionState(void* ctx)
 {
@@ -399,7 +615,8 @@ MtmDeserializeTransactionState(void* ctx)
 static void
 MtmInitializeSequence(int64* start, int64* step)
 {
-	if (MtmVolksWagenMode)
+	/* In block mode uniqueness is provided by MtmAdjustSequenceValue */
+	if (MtmVolksWagenMode || MtmSequenceBlockSize != 0)
 	{
 		*start = 1;
 		*step  = 1;
@@ -411,6 +628,207 @@ MtmInitializeSequence(int64* start, int64* step)
 	}
 }
 
+/*
+ * Sequence blocks.
+ * With multimaster.sequence_block_size > 0 each node hands out values of sequences with increment 1
+ * from contiguous blocks reserved by agreement of all online nodes, so that inserts of generated keys
+ * preserves right-edge locality of indexes and nextval doesn't need communication between refills.
+ * To reserve a block, node broadcasts MSG_SEQ_REQUEST with start of the block following
+ * the highest reserved value it knows. Node grants the block if its start exceeds all values reserved
+ * at this node, so two overlapping blocks can not be granted by the same node. If the block
+ * overlaps with pending proposal of the node itself, node with smaller ID wins.
+ * Sequences are identified by hash of qualified name, because OIDs are different at different nodes:
+ * sequences with the same hash just share range of values.
+ * Reservations are kept only in shared memory: after restart node abandons the rest of its block
+ * and refills starting from the persistent last value of the sequence.
+ */
+static MtmSeqBlock* MtmGetSequenceBlock(uint32 key)
+{
+	bool found;
+	MtmSeqBlock* seq = (MtmSeqBlock*)hash_search(MtmSeqBlocks, &key, HASH_ENTER_NULL, &found);
+	if (seq != NULL && !found) {
+		seq->reserved = 0;
+		seq->blockStart = 0;
+		seq->blockEnd = 0;
+		seq->proposal = 0;
+		seq->proposalEnd = 0;
+		seq->proposalTime = 0;
+		seq->votedMask = 0;
+		seq->rejected = false;
+	}
+	return seq;
+}
+
+static void MtmBroadcastSequenceRequest(MtmSeqBlock* seq)
+{
+	int i;
+	MtmArbiterMessage msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.code = MSG_SEQ_REQUEST;
+	msg.disabledNodeMask = Mtm->disabledNodeMask;
+	msg.connectivityMask = SELF_CONNECTIVITY_MASK;
+	msg.oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+	msg.sxid = seq->key;
+	msg.dxid = (TransactionId)(seq->proposalEnd - seq->proposal + 1);
+	msg.csn = (csn_t)seq->proposal;
+
+	for (i = 0; i < Mtm->nAllNodes; i++)
+	{
+		if (i+1 != MtmNodeId && !BIT_CHECK(Mtm->disabledNodeMask, i))
+		{
+			msg.node = i+1;
+			MtmSendMessage(&msg);
+		}
+	}
+}
+
+/*
+ * Vote for block of sequence values requested by other node. Called by arbiter with MtmLock held.
+ */
+void MtmHandleSequenceRequest(MtmArbiterMessage* msg)
+{
+	MtmSeqBlock* seq = MtmGetSequenceBlock(msg->sxid);
+	int64 start = (int64)msg->csn;
+	int64 end = start + msg->dxid - 1;
+	bool overlapsProposal;
+
+	if (seq == NULL) { 
+		elog(WARNING, "Reject request for sequence block from node %d: too many sequences", msg->node);
+		msg->status = TRANSACTION_STATUS_ABORTED;
+		msg->csn = (csn_t)end;
+	} else {
+		overlapsProposal = seq->proposal != 0 && start <= seq->proposalEnd && end >= seq->proposal;
+		if (start <= seq->reserved || (overlapsProposal && msg->node > MtmNodeId)) {
+			msg->status = TRANSACTION_STATUS_ABORTED;
+			msg->csn = (csn_t)Max(seq->reserved, overlapsProposal ? seq->proposalEnd : 0);
+		} else {
+			if (overlapsProposal) { 
+				/* our own proposal can not be granted any more */
+				seq->rejected = true;
+			}
+			seq->reserved = end;
+			msg->status = TRANSACTION_STATUS_COMMITTED;
+		}
+	}
+	msg->code = MSG_SEQ_RESPONSE;
+	msg->disabledNodeMask = Mtm->disabledNodeMask;
+	msg->connectivityMask = SELF_CONNECTIVITY_MASK;
+	msg->oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+	MtmSendMessage(msg);
+}
+
+/*
+ * Handle vote for block of sequence values proposed by this node. Called by arbiter with MtmLock held.
+ */
+void MtmHandleSequenceResponse(MtmArbiterMessage* msg)
+{
+	MtmSeqBlock* seq = (MtmSeqBlock*)hash_search(MtmSeqBlocks, &msg->sxid, HASH_FIND, NULL);
+	if (seq == NULL) { 
+		return;
+	}
+	if (msg->status == TRANSACTION_STATUS_COMMITTED) {
+		if (seq->proposal != 0 && (int64)msg->csn == seq->proposal) { 
+			BIT_SET(seq->votedMask, msg->node-1);
+		}
+	} else { 
+		seq->reserved = Max(seq->reserved, (int64)msg->csn);
+		/* ignore rejects of previous proposals */
+		if (seq->proposal != 0 && (int64)msg->csn >= seq->proposal) { 
+			seq->rejected = true;
+		}
+	}
+}
+
+/*
+ * Move value fetched by nextval to the block of values reserved by this node, reserving new block if needed.
+ */
+static int64
+MtmAdjustSequenceValue(Relation seqrel, int64 next, int64 incby, int64 maxv)
+{
+	/* Block of the last used sequence cached by backend: blocks of node are only growing, so it can not become stale */
+	static Oid   cachedRelid;
+	static int64 cachedStart;
+	static int64 cachedEnd;
+	MtmSeqBlock* seq;
+	char* name;
+	uint32 key;
+	nodemask_t liveMask;
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	timestamp_t start;
+
+	if (MtmSequenceBlockSize == 0 || MtmVolksWagenMode || incby != 1 || MtmIsLogicalReceiver
+		|| seqrel->rd_rel->relpersistence != RELPERSISTENCE_PERMANENT)
+	{
+		return next;
+	}
+	if (RelationGetRelid(seqrel) == cachedRelid && next >= cachedStart && next <= cachedEnd) { 
+		return next;
+	}
+	name = psprintf("%s.%s", get_namespace_name(RelationGetNamespace(seqrel)), RelationGetRelationName(seqrel));
+	key = DatumGetUInt32(hash_any((unsigned char const*)name, strlen(name)));
+	pfree(name);
+
+	MtmLock(LW_EXCLUSIVE);
+	seq = MtmGetSequenceBlock(key);
+	if (seq == NULL) { 
+		MtmUnlock();
+		elog(ERROR, "Too many sequences: maximal number of sequences with reserved blocks is %d", MULTIMASTER_MAX_SEQUENCES);
+	}
+	while (next < seq->blockStart || next > seq->blockEnd) { 
+		if (Mtm->status != MTM_ONLINE) { 
+			seq->proposal = 0;
+			MtmUnlock();
+			elog(ERROR, "Multimaster node is not online: current status %s", MtmNodeStatusMnem[Mtm->status]);
+		}
+		if (seq->proposal == 0) { 
+			seq->proposal = Max(next, seq->reserved + 1);
+			if (seq->proposal > maxv) { 
+				seq->proposal = 0;
+				MtmUnlock();
+				ereport(ERROR,
+						(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						 errmsg("nextval: no more values can be reserved for sequence \"%s\"",
+								RelationGetRelationName(seqrel))));
+			}
+			seq->proposalEnd = maxv - seq->proposal < MtmSequenceBlockSize ? maxv : seq->proposal + MtmSequenceBlockSize - 1;
+			seq->proposalTime = MtmGetSystemTime();
+			seq->votedMask = 0;
+			seq->rejected = false;
+			MtmBroadcastSequenceRequest(seq);
+		}
+		liveMask = NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
+		if (!seq->rejected && (liveMask & ~seq->votedMask) == 0) { 
+			seq->blockStart = seq->proposal;
+			seq->blockEnd = seq->proposalEnd;
+			seq->reserved = Max(seq->reserved, seq->proposalEnd);
+			seq->proposal = 0;
+			MTM_LOG1("Reserve block [%lld, %lld] of sequence %s", (long long)seq->blockStart, (long long)seq->blockEnd, RelationGetRelationName(seqrel));
+			if (next < seq->blockStart) { 
+				next = seq->blockStart;
+			}
+			continue;
+		}
+		if (seq->rejected || seq->proposalTime + MSEC_TO_USEC(MtmHeartbeatRecvTimeout) < MtmGetSystemTime()) { 
+			/* retry with new proposal: reserved is already advanced by rejecting nodes */
+			seq->proposal = 0;
+			continue;
+		}
+		MtmUnlock();
+		start = MtmWaitStart(MTM_WAIT_SEQUENCE_BLOCK);
+		MtmSleep(delay);
+		MtmWaitEnd(MTM_WAIT_SEQUENCE_BLOCK, start);
+		if (delay*2 <= MAX_WAIT_TIMEOUT) { 
+			delay *= 2;
+		}
+		MtmLock(LW_EXCLUSIVE);
+	}
+	cachedRelid = RelationGetRelid(seqrel);
+	cachedStart = seq->blockStart;
+	cachedEnd = seq->blockEnd;
+	MtmUnlock();
+	return next;
+}
+
 
 /*
  * -------------------------------------------
@@ -422,15 +840,18 @@ csn_t MtmTransactionSnapshot(TransactionId xid)
 {
 	csn_t snapshot = INVALID_CSN;
 	
-	MtmLock(LW_SHARED);
 	if (Mtm->status == MTM_ONLINE) {
-		MtmTransState* ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
+		uint32 hashcode;
+		LWLock* lock = MtmXidMapPartitionLock(xid, &hashcode);
+		MtmTransState* ts;
+		LWLockAcquire(lock, LW_SHARED);
+		ts = (MtmTransState*)hash_search_with_hash_value(MtmXid2State, &xid, hashcode, HASH_FIND, NULL);
 		if (ts != NULL && !ts->isLocal) { 
 			snapshot = ts->snapshot;
 			Assert(ts->gtid.node == MtmNodeId || MtmIsRecoverySession); 		
 		}
+		LWLockRelease(lock);
 	}
-	MtmUnlock();
     return snapshot;
 }
 
@@ -438,20 +859,231 @@ csn_t MtmTransactionSnapshot(TransactionId xid)
 Snapshot MtmGetSnapshot(Snapshot snapshot)
 {
     snapshot = PgGetSnapshotData(snapshot);
-	RecentGlobalDataXmin = RecentGlobalXmin = Mtm->oldestXid;
+	MtmLocalXmin = RecentGlobalXmin;
+	if (!MtmIsStandby) { 
+		RecentGlobalDataXmin = RecentGlobalXmin = Mtm->oldestXid;
+	}
     return snapshot;
 }
 
 
+/*
+ * Garbage collection is performed by MtmCollectGarbage in monitor worker, 
+ * here we just take in account horizon published by it.
+ * Mtm->oldestXid is changed only by GC, reading 32-bit value is atomic.
+ */
 TransactionId MtmGetOldestXmin(Relation rel, bool ignoreVacuum)
 {
     TransactionId xmin = PgGetOldestXmin(NULL, false); /* consider all backends */
+	MtmLocalXmin = xmin;
+	if (TransactionIdIsValid(xmin) && MtmUseDtm && !MtmVolksWagenMode) { 
+		TransactionId oldestXid = *(volatile TransactionId*)&Mtm->oldestXid;
+		if (TransactionIdPrecedes(oldestXid, xmin)) { 
+			xmin = oldestXid;
+		}
+	}
+	return xmin;
+}
+
+/*
+ * Mtm->oldestXid can be held back by transactions committed recently at other nodes.
+ * But transaction committed before Mtm->oldestCsn is visible for all snapshots at all nodes,
+ * so tuple deleted by it can be pruned if it is also not visible for any local snapshot.
+ */
+static bool MtmIsDeadForAllSnapshots(TransactionId xmax)
+{
+	XidStatus status = TRANSACTION_STATUS_IN_PROGRESS;
+	csn_t csn = INVALID_CSN;
+	csn_t oldestCsn = *(volatile csn_t*)&Mtm->oldestCsn;
+
+	if (!MtmUseDtm || MtmVolksWagenMode || oldestCsn == INVALID_CSN
+		|| !TransactionIdIsNormal(MtmLocalXmin) || !TransactionIdPrecedes(xmax, MtmLocalXmin)) 
+	{ 
+		return false;
+	}
+	if (!MtmCsnCacheLookup(xmax, &status, &csn)) { 
+		uint32 hashcode;
+		LWLock* lock = MtmXidMapPartitionLock(xmax, &hashcode);
+		MtmTransState* ts;
+		LWLockAcquire(lock, LW_SHARED);
+		ts = (MtmTransState*)hash_search_with_hash_value(MtmXid2State, &xmax, hashcode, HASH_FIND, NULL);
+		if (ts != NULL) { 
+			status = ts->status;
+			pg_read_barrier(); /* CSN is assigned before status is changed */
+			csn = ts->csn;
+		}
+		LWLockRelease(lock);
+	}
+	return status == TRANSACTION_STATUS_COMMITTED && csn < oldestCsn;
+}
+
+/*
+ * Remove from MtmXid2State and MtmGid2State transactions which are not used in any snapshot at any node.
+ * It is done in batches to avoid long holding of exclusive lock.
+ */
+void MtmCollectGarbage(void)
+{
+    TransactionId xmin = PgGetOldestXmin(NULL, false);
+	csn_t oldestSnapshot;
 	if (TransactionIdIsValid(xmin)) { 
 		MtmLock(LW_EXCLUSIVE);
-		xmin = MtmAdjustOldestXid(xmin);
+		oldestSnapshot = MtmGetOldestSnapshot();
+		while (MtmAdjustOldestXid(xmin, oldestSnapshot)) { 
+			/* Give other backends a chance to grab the lock between batches */
+			MtmUnlock();
+			MtmLock(LW_EXCLUSIVE);
+		}
 		MtmUnlock();
 	}
-	return xmin;
+}
+
+/*
+ * -------------------------------------------
+ * Hot standby support.
+ * Physical replica of the node gets CSNs of distributed transactions from 'S' logical messages replayed from WAL
+ * and inserts them in MtmXid2State, so visibility is checked in the same way as at primary.
+ * Snapshot of standby is the last replayed horizon: all transactions with smaller CSNs are finished before
+ * the horizon is written, so their commit records are already replayed and all snapshots of standby are consistent
+ * with snapshots of primary. Transactions which are not prepared yet will get CSN larger than current CSN of the node.
+ * -------------------------------------------
+ */
+
+/*
+ * Write CSN of distributed transaction before its commit record.
+ */
+static void MtmLogCommitCSN(MtmCurrentTrans* x)
+{
+	MtmTransMap* tm;
+	MtmCsnLogicalMessage* msg;
+	Size size;
+
+	if (x->gid[0] == '\0') { 
+		return;
+	}
+	MtmLock(LW_SHARED);
+	tm = (MtmTransMap*)hash_search(MtmGid2State, x->gid, HASH_FIND, NULL);
+	if (tm == NULL || tm->state == NULL) { 
+		MtmUnlock();
+		return;
+	}
+	{
+		MtmTransState* ts = tm->state;
+		MtmTransState* sts = ts->next;
+		int i;
+		size = offsetof(MtmCsnLogicalMessage, subxids) + ts->nSubxids*sizeof(TransactionId);
+		msg = (MtmCsnLogicalMessage*)palloc(size);
+		msg->horizon = INVALID_CSN;
+		/* see MtmEndTransaction: CSN received with commit is final */
+		msg->csn = (x->csn > ts->csn || Mtm->status == MTM_RECOVERY) && x->csn != INVALID_CSN ? x->csn : ts->csn;
+		msg->xid = ts->xid;
+		msg->nSubxids = ts->nSubxids;
+		for (i = 0; i < ts->nSubxids; i++, sts = sts->next) { 
+			msg->subxids[i] = sts->xid;
+		}
+	}
+	MtmUnlock();
+	LogLogicalMessage("S", (char*)msg, size, false);
+	pfree(msg);
+}
+
+/*
+ * Called periodically by monitor to advance snapshots of hot standby replicas.
+ * Prepared transactions have CSN not larger than final one, so horizon is less than CSN of any unfinished transaction.
+ */
+void MtmLogStandbyHorizon(void)
+{
+	static csn_t lastHorizon;
+	MtmCsnLogicalMessage msg;
+	MtmTransState* ts;
+	csn_t horizon;
+
+	MtmLock(LW_SHARED);
+	horizon = pg_atomic_read_u64(&Mtm->csn);
+	for (ts = Mtm->transListHead; ts != NULL; ts = ts->next) { 
+		if (ts->status != TRANSACTION_STATUS_COMMITTED 
+			&& ts->status != TRANSACTION_STATUS_ABORTED
+			&& ts->csn != INVALID_CSN
+			&& ts->csn <= horizon)
+		{ 
+			horizon = ts->csn - 1;
+		}
+	}
+	MtmUnlock();
+
+	if (horizon > lastHorizon) { 
+		lastHorizon = horizon;
+		msg.horizon = horizon;
+		msg.csn = INVALID_CSN;
+		msg.xid = InvalidTransactionId;
+		msg.nSubxids = 0;
+		LogLogicalMessage("S", (char*)&msg, offsetof(MtmCsnLogicalMessage, subxids), false);
+	}
+}
+
+/*
+ * Redo of 'S' message at hot standby: remember CSN of committed transaction or advance snapshot horizon.
+ * It is done by startup process.
+ */
+static void MtmReplayLogicalMessage(char const* prefix, char const* message, Size size)
+{
+	MtmCsnLogicalMessage hdr;
+
+	if (!MtmIsStandby || strcmp(prefix, "S") != 0) { 
+		return;
+	}
+	Assert(size >= offsetof(MtmCsnLogicalMessage, subxids));
+	memcpy(&hdr, message, offsetof(MtmCsnLogicalMessage, subxids)); /* WAL data is not aligned */
+
+	MtmLock(LW_EXCLUSIVE);
+	if (TransactionIdIsValid(hdr.xid)) { 
+		bool found;
+		MtmTransState* ts = MtmXidMapEnter(hdr.xid, &found);
+		if (!found) { 
+			TransactionId* subxids = (TransactionId*)palloc(hdr.nSubxids*sizeof(TransactionId));
+			memcpy(subxids, message + offsetof(MtmCsnLogicalMessage, subxids), hdr.nSubxids*sizeof(TransactionId));
+			ts->isEnqueued = false;
+			ts->isActive = false;
+			ts->isLocal = true;
+			ts->isPrepared = false;
+			ts->isPinned = false;
+			ts->isTwoPhase = false;
+			ts->votingCompleted = true;
+			ts->snapshot = INVALID_CSN;
+			ts->gid[0] = '\0';
+			ts->csn = hdr.csn;
+			/* Transaction is not visible until horizon passes its CSN, and then its commit is replayed */
+			ts->status = TRANSACTION_STATUS_COMMITTED;
+			MtmTransactionListAppend(ts);
+			MtmAddSubtransactions(ts, subxids, hdr.nSubxids);
+			pfree(subxids);
+		} else { 
+			/* commit was retried */
+			ts->csn = hdr.csn;
+			MtmAdjustSubtransactions(ts);
+		}
+	}
+	if (hdr.horizon > pg_atomic_read_u64(&Mtm->csn)) { 
+		TransactionId xmin = PgGetOldestXmin(NULL, false);
+		csn_t oldestSnapshot = hdr.horizon;
+		int i;
+
+		pg_atomic_write_u64(&Mtm->csn, hdr.horizon);
+
+		/* Unlike MtmGetOldestSnapshot, there are no other nodes to consider */
+		for (i = 0; i < ProcGlobal->allProcCount; i++) { 
+			csn_t snapshot = MtmBackend(i)->activeSnapshot;
+			if (snapshot != INVALID_CSN && snapshot < oldestSnapshot) { 
+				oldestSnapshot = snapshot;
+			}
+		}
+		if (TransactionIdIsValid(xmin)) { 
+			while (MtmAdjustOldestXid(xmin, oldestSnapshot)) { 
+				MtmUnlock();
+				MtmLock(LW_EXCLUSIVE);
+			}
+		}
+	}
+	MtmUnlock();
 }
 
 bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
@@ -464,13 +1096,23 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 #endif
 	timestamp_t start = MtmGetSystemTime();
     timestamp_t delay = MIN_WAIT_TIMEOUT;
+	uint32 hashcode;
+	LWLock* lock;
 	int i;
     Assert(xid != InvalidTransactionId);
 	
 	if (!MtmUseDtm) { 
 		return PgXidInMVCCSnapshot(xid, snapshot);
 	}
-	MtmLock(LW_SHARED);
+	{
+		XidStatus status;
+		csn_t csn;
+		if (MtmCsnCacheLookup(xid, &status, &csn)) { 
+			return csn > MtmTx.snapshot || status != TRANSACTION_STATUS_COMMITTED;
+		}
+	}
+	lock = MtmXidMapPartitionLock(xid, &hashcode);
+	LWLockAcquire(lock, LW_SHARED);
 
 #if TRACE_SLEEP_TIME
     if (firstReportTime == 0) {
@@ -480,27 +1122,50 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
     
 	for (i = 0; i < MAX_WAIT_LOOPS; i++)
     {
-        MtmTransState* ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
+        MtmTransState* ts = (MtmTransState*)hash_search_with_hash_value(MtmXid2State, &xid, hashcode, HASH_FIND, NULL);
         if (ts != NULL /*&& ts->status != TRANSACTION_STATUS_IN_PROGRESS*/)
         {
+			XidStatus status = ts->status;
+			pg_read_barrier(); /* CSN is assigned before status is changed */
             if (ts->csn > MtmTx.snapshot) { 
                 MTM_LOG4("%d: tuple with xid=%d(csn=%lld) is invisibile in snapshot %lld",
 						 MyProcPid, xid, ts->csn, MtmTx.snapshot);
 				if (MtmGetSystemTime() - start > USECS_PER_SEC) { 
 					elog(WARNING, "Backend %d waits for transaction %s (%llu) status %lld usecs", MyProcPid, ts->gid, (long64)xid, MtmGetSystemTime() - start);
 				}
-				MtmUnlock();
+				LWLockRelease(lock);
                 return true;
             }
-            if (ts->status == TRANSACTION_STATUS_UNKNOWN)
+            if (status == TRANSACTION_STATUS_UNKNOWN)
             {
                 MTM_LOG3("%d: wait for in-doubt transaction %u in snapshot %llu", MyProcPid, xid, MtmTx.snapshot);
-                MtmUnlock();
+				/* 
+				 * Status is changed without partition lock, so recheck it after registration:
+				 * atomic increment is full barrier, and MtmWakeUpReaders checks number of waiters after status change.
+				 * The latch is reset before the recheck, so a wakeup coming after it makes WaitLatch return at once.
+				 * Timeout is still used to check for changes of CSN and in case of lost notifications.
+				 */
+				ResetLatch(MyLatch);
+				MtmBackend(MyProc->pgprocno)->snapshotWaitXid = xid;
+				pg_atomic_fetch_add_u32(&Mtm->nSnapshotWaiters, 1);
+				if (ts->status != TRANSACTION_STATUS_UNKNOWN) { 
+					MtmBackend(MyProc->pgprocno)->snapshotWaitXid = InvalidTransactionId;
+					pg_atomic_fetch_sub_u32(&Mtm->nSnapshotWaiters, 1);
+					continue;
+				}
+                LWLockRelease(lock);
 #if TRACE_SLEEP_TIME
                 {
                 timestamp_t delta, now = MtmGetCurrentTime();
 #endif
-                MtmSleep(delay);
+				{
+					timestamp_t waitStart = MtmWaitStart(MTM_WAIT_IN_DOUBT);
+					int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, Max(USEC_TO_MSEC(delay), 1));
+					MtmWaitEnd(MTM_WAIT_IN_DOUBT, waitStart);
+					if (rc & WL_POSTMASTER_DEATH) { 
+						proc_exit(1);
+					}
+				}
 #if TRACE_SLEEP_TIME
                 delta = MtmGetCurrentTime() - now;
                 totalSleepTime += delta;
@@ -520,105 +1185,219 @@ bool MtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
                 if (delay*2 <= MAX_WAIT_TIMEOUT) {
                     delay *= 2;
                 }
-				MtmLock(LW_SHARED);
+				MtmBackend(MyProc->pgprocno)->snapshotWaitXid = InvalidTransactionId;
+				pg_atomic_fetch_sub_u32(&Mtm->nSnapshotWaiters, 1);
+				LWLockAcquire(lock, LW_SHARED);
             }
             else
             {
-                bool invisible = ts->status != TRANSACTION_STATUS_COMMITTED;
+                bool invisible = status != TRANSACTION_STATUS_COMMITTED;
                 MTM_LOG4("%d: tuple with xid=%d(csn= %lld) is %s in snapshot %lld",
 						 MyProcPid, xid, ts->csn, invisible ? "rollbacked" : "committed", MtmTx.snapshot);
-                MtmUnlock();
 				if (MtmGetSystemTime() - start > USECS_PER_SEC) { 
 					elog(WARNING, "Backend %d waits for %s transaction %s (%llu) %lld usecs", MyProcPid, invisible ? "rollbacked" : "committed", 
 						 ts->gid, (long64)xid, MtmGetSystemTime() - start);
 				}
+                LWLockRelease(lock);
                 return invisible;
             }
         }
         else
         {
             MTM_LOG4("%d: visibility check is skept for transaction %u in snapshot %llu", MyProcPid, xid, MtmTx.snapshot);
-			MtmUnlock();
+			LWLockRelease(lock);
 			return PgXidInMVCCSnapshot(xid, snapshot);
         }
     }
-	MtmUnlock();
+	LWLockRelease(lock);
 	elog(ERROR, "Failed to get status of XID %llu in %lld usec", (long64)xid, MtmGetSystemTime() - start);
 	return true;
 }    
 
+/*
+ * Non-blocking part of MtmXidInMVCCSnapshot: returns false if transaction is in-doubt and visibility can not be decided now.
+ */
+static bool MtmXidInMVCCSnapshotNoWait(TransactionId xid, Snapshot snapshot, bool* inSnapshot)
+{
+	XidStatus status;
+	csn_t csn;
+	uint32 hashcode;
+	LWLock* lock;
+	MtmTransState* ts;
 
+	if (MtmCsnCacheLookup(xid, &status, &csn)) { 
+		*inSnapshot = csn > MtmTx.snapshot || status != TRANSACTION_STATUS_COMMITTED;
+		return true;
+	}
+	lock = MtmXidMapPartitionLock(xid, &hashcode);
+	LWLockAcquire(lock, LW_SHARED);
+	ts = (MtmTransState*)hash_search_with_hash_value(MtmXid2State, &xid, hashcode, HASH_FIND, NULL);
+	if (ts == NULL) { 
+		LWLockRelease(lock);
+		*inSnapshot = PgXidInMVCCSnapshot(xid, snapshot);
+		return true;
+	}
+	status = ts->status;
+	pg_read_barrier(); /* CSN is assigned before status is changed */
+	csn = ts->csn;
+	LWLockRelease(lock);
+
+	if (csn > MtmTx.snapshot) { 
+		*inSnapshot = true;
+	} else if (status == TRANSACTION_STATUS_UNKNOWN) { 
+		return false;
+	} else { 
+		*inSnapshot = status != TRANSACTION_STATUS_COMMITTED;
+	}
+	return true;
+}
 
 /*
- * There can be different oldest XIDs at different cluster node.
- * We collest oldest CSNs from all nodes and choose minimum from them.
- * If no such XID can be located, then return previously observed oldest XID
+ * Batched version of MtmXidInMVCCSnapshot called for all xids of the heap page by page-at-a-time scans.
+ * Instead of blocking at the first in-doubt transaction, all xids are checked first and then all in-doubt 
+ * ones are awaited together: pages with many rows of 2PC transactions in flight are usually waited for once.
+ * Backend registers itself as waiter for one of them (only one xid fits in its slot), others are rechecked
+ * at wakeup or timeout.
  */
-static TransactionId 
-MtmAdjustOldestXid(TransactionId xid)
+static void MtmXidInMVCCSnapshotBatch(TransactionId* xids, int n, Snapshot snapshot, bool* result)
 {
-	int i;   
-	csn_t oldestSnapshot = INVALID_CSN;
-	MtmTransState *prev = NULL;
-	MtmTransState *ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_FIND, NULL);
-	MTM_LOG2("%d: MtmAdjustOldestXid(%d): snapshot=%lld, csn=%lld, status=%d", MyProcPid, xid, ts != NULL ? ts->snapshot : 0, ts != NULL ? ts->csn : 0, ts != NULL ? ts->status : -1);
-	Mtm->gcCount = 0;
+	int pending[2*MaxHeapTuplesPerPage];
+	int nPending = 0;
+	timestamp_t start = MtmGetSystemTime();
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	int i, j, loops;
 
-	if (ts != NULL) { 
-		oldestSnapshot = ts->snapshot;
-		Assert(oldestSnapshot != INVALID_CSN);
-		if (Mtm->nodes[MtmNodeId-1].oldestSnapshot < oldestSnapshot) { 
-			Mtm->nodes[MtmNodeId-1].oldestSnapshot = oldestSnapshot;
-		} else {
-			oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+	Assert(n <= 2*MaxHeapTuplesPerPage);
+
+	if (!MtmUseDtm) { 
+		for (i = 0; i < n; i++) { 
+			result[i] = PgXidInMVCCSnapshot(xids[i], snapshot);
 		}
-		for (i = 0; i < Mtm->nAllNodes; i++) { 
-			if (!BIT_CHECK(Mtm->disabledNodeMask, i)
-				&& Mtm->nodes[i].oldestSnapshot < oldestSnapshot) 
-			{ 
-				oldestSnapshot = Mtm->nodes[i].oldestSnapshot;
+		return;
+	}
+	for (i = 0; i < n; i++) { 
+		if (!MtmXidInMVCCSnapshotNoWait(xids[i], snapshot, &result[i])) { 
+			pending[nPending++] = i;
+		}
+	}
+	for (loops = 0; nPending != 0; loops++) { 
+		TransactionId xid = xids[pending[0]];
+		if (loops == MAX_WAIT_LOOPS) { 
+			elog(ERROR, "Failed to get status of XID %llu in %lld usec", (long64)xid, MtmGetSystemTime() - start);
+		}
+		MTM_LOG3("%d: wait for %d in-doubt transactions in snapshot %llu", MyProcPid, nPending, MtmTx.snapshot);
+		/* see MtmXidInMVCCSnapshot: latch is reset and status rechecked after registration to avoid lost wakeup */
+		ResetLatch(MyLatch);
+		MtmBackend(MyProc->pgprocno)->snapshotWaitXid = xid;
+		pg_atomic_fetch_add_u32(&Mtm->nSnapshotWaiters, 1);
+		if (!MtmXidInMVCCSnapshotNoWait(xid, snapshot, &result[pending[0]])) { 
+			timestamp_t waitStart = MtmWaitStart(MTM_WAIT_IN_DOUBT);
+			int rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, Max(USEC_TO_MSEC(delay), 1));
+			MtmWaitEnd(MTM_WAIT_IN_DOUBT, waitStart);
+			if (rc & WL_POSTMASTER_DEATH) { 
+				proc_exit(1);
+			}
+			if (delay*2 <= MAX_WAIT_TIMEOUT) {
+				delay *= 2;
 			}
 		}
-		if (oldestSnapshot > MtmVacuumDelay*USECS_PER_SEC) { 
-			oldestSnapshot -= MtmVacuumDelay*USECS_PER_SEC;
-		} else { 
-			oldestSnapshot = 0;
+		MtmBackend(MyProc->pgprocno)->snapshotWaitXid = InvalidTransactionId;
+		pg_atomic_fetch_sub_u32(&Mtm->nSnapshotWaiters, 1);
+
+		for (i = j = 0; i < nPending; i++) { 
+			if (!MtmXidInMVCCSnapshotNoWait(xids[pending[i]], snapshot, &result[pending[i]])) { 
+				pending[j++] = pending[i];
+			}
 		}
-		
-		for (ts = Mtm->transListHead; 
-			 ts != NULL 
-				 && (ts->status == TRANSACTION_STATUS_ABORTED || ts->status == TRANSACTION_STATUS_COMMITTED) 
-				 && ts->csn < oldestSnapshot
-				 && !ts->isPinned
-				 && TransactionIdPrecedes(ts->xid, xid);
-			 prev = ts, ts = ts->next) 
+		nPending = j;
+	}
+}
+
+
+
+/*
+ * There can be different oldest snapshots at different cluster node.
+ * Every backend publishes snapshot of its current transaction in its MtmBackendState slot,
+ * so local oldest snapshot is found by scanning these slots rather than looking up transaction state of the oldest XID.
+ * We combine it with oldest CSNs reported by other nodes and choose minimum from them.
+ * Should be called with MtmLock held, because slots are updated under this lock.
+ */
+static csn_t
+MtmGetOldestSnapshot(void)
+{
+	int i;
+	csn_t oldestSnapshot = pg_atomic_read_u64(&Mtm->csn);
+
+	for (i = 0; i < ProcGlobal->allProcCount; i++) { 
+		csn_t snapshot = MtmBackend(i)->activeSnapshot;
+		if (snapshot != INVALID_CSN && snapshot < oldestSnapshot) { 
+			oldestSnapshot = snapshot;
+		}
+	}
+	if (Mtm->nodes[MtmNodeId-1].oldestSnapshot < oldestSnapshot) { 
+		Mtm->nodes[MtmNodeId-1].oldestSnapshot = oldestSnapshot;
+	} else {
+		oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+	}
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (!BIT_CHECK(Mtm->disabledNodeMask, i)
+			&& Mtm->nodes[i].oldestSnapshot < oldestSnapshot) 
 		{ 
-			if (prev != NULL) { 
-				/* Remove information about too old transactions */
-				hash_search(MtmXid2State, &prev->xid, HASH_REMOVE, NULL);
-				hash_search(MtmGid2State, &prev->gid, HASH_REMOVE, NULL);
-			}
+			oldestSnapshot = Mtm->nodes[i].oldestSnapshot;
 		}
-	} 
+	}
+	if (oldestSnapshot > MtmVacuumDelay*USECS_PER_SEC) { 
+		oldestSnapshot -= MtmVacuumDelay*USECS_PER_SEC;
+	} else { 
+		oldestSnapshot = 0;
+	}
+	if (oldestSnapshot > Mtm->oldestCsn) { 
+		Mtm->oldestCsn = oldestSnapshot;
+	}
+	return oldestSnapshot;
+}
 
-	if (MtmUseDtm && !MtmVolksWagenMode) 
+/*
+ * Remove from the head of transaction list transactions which are not used in any snapshot at any node.
+ * Horizon is computed once by MtmGetOldestSnapshot: new transactions can only get larger snapshots, so it remains valid
+ * while the list is drained in several batches.
+ * At most MTM_GC_BATCH_SIZE transactions are removed: returns true if there are more transactions to collect.
+ */
+static bool
+MtmAdjustOldestXid(TransactionId xid, csn_t oldestSnapshot)
+{
+	int nRemoved = 0;
+	MtmTransState *prev = NULL;
+	MtmTransState *ts;
+	MTM_LOG2("%d: MtmAdjustOldestXid(%d): oldestSnapshot=%lld", MyProcPid, xid, oldestSnapshot);
+	Mtm->gcCount = 0;
+
+	for (ts = Mtm->transListHead; 
+		 ts != NULL 
+			 && (ts->status == TRANSACTION_STATUS_ABORTED || ts->status == TRANSACTION_STATUS_COMMITTED) 
+			 && ts->csn < oldestSnapshot
+			 && !ts->isPinned
+			 && TransactionIdPrecedes(ts->xid, xid)
+			 && nRemoved < MTM_GC_BATCH_SIZE;
+		 prev = ts, ts = ts->next) 
 	{ 
 		if (prev != NULL) { 
-			MTM_LOG2("%d: MtmAdjustOldestXid: oldestXid=%d, prev->xid=%d, prev->status=%s, prev->snapshot=%lld, ts->xid=%d, ts->status=%d, ts->snapshot=%lld, oldestSnapshot=%lld", 
-					 MyProcPid, xid, prev->xid, MtmTxnStatusMnem[prev->status], prev->snapshot, (ts ? ts->xid : 0), (ts ? ts->status : -1), (ts ? ts->snapshot : -1), oldestSnapshot);
-			Mtm->transListHead = prev;
-			Mtm->oldestXid = xid = prev->xid;            
-		} else if (TransactionIdPrecedes(Mtm->oldestXid, xid)) {  
-			xid = Mtm->oldestXid;
+			/* Remove information about too old transactions */
+			MtmXidMapRemove(prev->xid);
+			hash_search(MtmGid2State, &prev->gid, HASH_REMOVE, NULL);
+			nRemoved += 1;
 		}
-	} else { 
-		if (prev != NULL) { 
-			MTM_LOG2("%d: MtmAdjustOldestXid: oldestXid=%d, prev->xid=%d, prev->status=%s, prev->snapshot=%lld, ts->xid=%d, ts->status=%d, ts->snapshot=%lld, oldestSnapshot=%lld", 
-					 MyProcPid, xid, prev->xid, MtmTxnStatusMnem[prev->status], prev->snapshot, (ts ? ts->xid : 0), (ts ? ts->status : -1), (ts ? ts->snapshot : -1), oldestSnapshot);
-			Mtm->transListHead = prev;
+	}
+
+	if (prev != NULL) { 
+		MTM_LOG2("%d: MtmAdjustOldestXid: oldestXid=%d, prev->xid=%d, prev->status=%s, prev->snapshot=%lld, ts->xid=%d, ts->status=%d, ts->snapshot=%lld, oldestSnapshot=%lld", 
+				 MyProcPid, xid, prev->xid, MtmTxnStatusMnem[prev->status], prev->snapshot, (ts ? ts->xid : 0), (ts ? ts->status : -1), (ts ? ts->snapshot : -1), oldestSnapshot);
+		Mtm->transListHead = prev;
+		if (MtmUseDtm && !MtmVolksWagenMode) { 
+			Mtm->oldestXid = prev->xid;            
 		}
 	}
-    return xid;
+    return nRemoved == MTM_GC_BATCH_SIZE;
 }
 
 /*
@@ -659,7 +1438,7 @@ static void MtmAddSubtransactions(MtmTransState* ts, TransactionId* subxids, int
         bool found;
 		MtmTransState* sts;
 		Assert(TransactionIdIsValid(subxids[i]));
-        sts = (MtmTransState*)hash_search(MtmXid2State, &subxids[i], HASH_ENTER, &found);
+        sts = MtmXidMapEnter(subxids[i], &found);
         Assert(!found);
 		sts->isActive = false;
 		sts->isPinned = false;
@@ -670,6 +1449,33 @@ static void MtmAddSubtransactions(MtmTransState* ts, TransactionId* subxids, int
     }
 }
 
+/*
+ * Wakeup backends waiting in MtmXidInMVCCSnapshot for transaction or its subtransactions.
+ * Should be called after change of transaction status.
+ */
+static void MtmWakeUpReaders(MtmTransState* ts)
+{
+	int i, j;
+	int nProcs = ProcGlobal->allProcCount;
+
+	pg_memory_barrier(); /* pairs with registration of waiter in MtmXidInMVCCSnapshot, done after its ResetLatch */
+	if (pg_atomic_read_u32(&Mtm->nSnapshotWaiters) == 0) { 
+		return;
+	}
+	for (i = 0; i < nProcs; i++) { 
+		TransactionId xid = MtmBackend(i)->snapshotWaitXid;
+		if (TransactionIdIsValid(xid)) { 
+			MtmTransState* sts = ts;
+			for (j = 0; j <= ts->nSubxids; j++, sts = sts->next) { 
+				if (sts->xid == xid) { 
+					SetLatch(&ProcGlobal->allProcs[i].procLatch);
+					break;
+				}
+			}
+		}
+	}
+}
+
 void MtmAdjustSubtransactions(MtmTransState* ts)
 {
 	int i;
@@ -678,9 +1484,16 @@ void MtmAdjustSubtransactions(MtmTransState* ts)
 
     for (i = 0; i < nSubxids; i++) {
 		sts = sts->next;
-		sts->status = ts->status;
 		sts->csn = ts->csn;
+		pg_write_barrier();
+		sts->status = ts->status;
+	}
+	if (ts->status == TRANSACTION_STATUS_COMMITTED || ts->status == TRANSACTION_STATUS_ABORTED) { 
+		for (i = 0, sts = ts; i <= nSubxids; i++, sts = sts->next) {
+			MtmCsnCacheUpdate(sts->xid, ts->status, ts->csn);
+		}
 	}
+	MtmWakeUpReaders(ts);
 }
 
 /*
@@ -693,6 +1506,13 @@ void MtmAdjustSubtransactions(MtmTransState* ts)
 static void
 MtmXactCallback(XactEvent event, void *arg)
 {
+	/*
+	 * Parallel worker executes part of the leader's query: its MtmTx is copied from the leader by MtmDeserializeTransactionState,
+	 * so it should neither assign its own CSN at start nor take part in commit (leader's state would start 2PC at COMMIT_COMMAND).
+	 */
+	if (IsParallelWorker()) { 
+		return;
+	}
     switch (event) 
     {
 	  case XACT_EVENT_START:
@@ -709,6 +1529,9 @@ MtmXactCallback(XactEvent event, void *arg)
 		break;
 	  case XACT_EVENT_PRE_COMMIT_PREPARED:
 		MtmPreCommitPreparedTransaction(&MtmTx);
+		if (MtmStandbySnapshotPeriod != 0) { 
+			MtmLogCommitCSN(&MtmTx);
+		}
 		break;
 	  case XACT_EVENT_COMMIT:
 		MtmEndTransaction(&MtmTx, true);
@@ -765,17 +1588,34 @@ static const char* const isoLevelStr[] =
 	"serializable"
 };
 
+/*
+ * Start read-only transaction. Such transaction takes part neither in 2PC nor in cluster lock,
+ * so it is enough to take last assigned CSN as snapshot without advancing the clock.
+ * MtmLock is obtained in shared mode only to exclude concurrent assignment of CSN which is not yet
+ * published in transaction state, so read-only transactions do not block each other.
+ * Snapshot is registered in per-backend slot to be taken in account by garbage collector.
+ */
+static void 
+MtmBeginReadOnlyTransaction(MtmCurrentTrans* x)
+{
+	MtmLock(LW_SHARED);
+	/* Hot standby doesn't take part in cluster: its snapshot is horizon replayed from WAL of primary */
+	if (x->isDistributed && !MtmIsStandby && Mtm->status != MTM_ONLINE && strcmp(application_name, MULTIMASTER_ADMIN) != 0) { 
+		MtmUnlock();			
+		elog(ERROR, "Multimaster node is not online: current status %s", MtmNodeStatusMnem[Mtm->status]);
+	}
+	x->snapshot = pg_atomic_read_u64(&Mtm->csn);
+	MtmBackend(MyProc->pgprocno)->activeSnapshot = x->snapshot;
+	MtmUnlock();
+}
+
 static void 
 MtmBeginTransaction(MtmCurrentTrans* x)
 {
     if (x->snapshot == INVALID_CSN) { 
-		TransactionId xmin = (Mtm->gcCount >= MtmGcPeriod) ? PgGetOldestXmin(NULL, false) : InvalidTransactionId; /* Get oldest xmin outside critical section */
-
-		MtmLock(LW_EXCLUSIVE);	
-		if (TransactionIdIsValid(xmin) && Mtm->gcCount >= MtmGcPeriod) {
-			MtmAdjustOldestXid(xmin);
+		if (Mtm->gcCount >= MtmGcPeriod && Mtm->monitorLatch != NULL) { 
+			SetLatch(Mtm->monitorLatch); /* ask monitor to collect garbage */
 		}
-
 		x->xid = GetCurrentTransactionIdIfAny();
         x->isReplicated = MtmIsLogicalReceiver;
         x->isDistributed = MtmIsUserTransaction();
@@ -783,6 +1623,22 @@ MtmBeginTransaction(MtmCurrentTrans* x)
 		x->isSuspended = false;
 		x->isTwoPhase = false;
 		x->isTransactionBlock = IsTransactionBlock();
+		x->containsDML = false;
+		x->isFastCommit = true;
+		x->isHomeLocal = true;
+		x->gtid.xid = InvalidTransactionId;
+		x->gid[0] = '\0';
+		x->status = TRANSACTION_STATUS_IN_PROGRESS;
+		x->startTime = MtmGetSystemTime();
+
+		/* Transaction declared as read-only, i.e. using default_transaction_read_only */
+		if (XactReadOnly && !x->isReplicated) { 
+			MtmBeginReadOnlyTransaction(x);
+			MTM_LOG3("%d: MtmLocalTransaction: read-only transaction uses snapshot %llu", MyProcPid, x->snapshot);
+			return;
+		}
+		MtmLock(LW_EXCLUSIVE);	
+
 		/* Application name can be changed usnig PGAPPNAME environment variable */
 		if (x->isDistributed && Mtm->status != MTM_ONLINE && strcmp(application_name, MULTIMASTER_ADMIN) != 0) { 
 			/* Reject all user's transactions at offline cluster. 
@@ -791,11 +1647,8 @@ MtmBeginTransaction(MtmCurrentTrans* x)
 			MtmUnlock();			
 			elog(ERROR, "Multimaster node is not online: current status %s", MtmNodeStatusMnem[Mtm->status]);
 		}
-		x->containsDML = false;
         x->snapshot = MtmAssignCSN();	
-		x->gtid.xid = InvalidTransactionId;
-		x->gid[0] = '\0';
-		x->status = TRANSACTION_STATUS_IN_PROGRESS;
+		MtmBackend(MyProc->pgprocno)->activeSnapshot = x->snapshot;
 
 		/*
 		 * Check if there is global multimaster lock preventing new transaction from commit to make a chance to wal-senders to caught-up.
@@ -818,13 +1671,15 @@ static MtmTransState*
 MtmCreateTransState(MtmCurrentTrans* x)
 {
 	bool found;
-	MtmTransState* ts = (MtmTransState*)hash_search(MtmXid2State, &x->xid, HASH_ENTER, &found);
+	MtmTransState* ts = MtmXidMapEnter(x->xid, &found);
 	ts->status = TRANSACTION_STATUS_IN_PROGRESS;
 	ts->snapshot = x->snapshot;
 	ts->isLocal = true;
 	ts->isPrepared = false;
 	ts->isTwoPhase = x->isTwoPhase;
 	ts->isPinned = false;
+	ts->isFastCommit = false;
+	ts->isHomeLocal = false;
 	ts->votingCompleted = false;
 	if (!found) {
 		ts->isEnqueued = false;
@@ -859,6 +1714,10 @@ MtmPrePrepareTransaction(MtmCurrentTrans* x)
 	if (!x->isDistributed) {
 		return;
 	}
+	if (!x->isReplicated) { 
+		MTM_PROFILE(x->gid, MTM_EV_BEGIN, 0, x->startTime);
+		MTM_PROFILE(x->gid, MTM_EV_EXECUTED, 0, MtmGetSystemTime());
+	}
 
 	if (Mtm->inject2PCError == 1) { 
 		Mtm->inject2PCError = 0;
@@ -869,11 +1728,15 @@ MtmPrePrepareTransaction(MtmCurrentTrans* x)
 
 	if (!IsBackgroundWorker && Mtm->status != MTM_ONLINE) { 
 		/* Do not take in account bg-workers which are performing recovery */
-		elog(ERROR, "Abort current transaction because this cluster node is in %s status", MtmNodeStatusMnem[Mtm->status]);			
+		ereport(ERROR,
+				(errcode(ERRCODE_TRANSACTION_ROLLBACK),
+				 errmsg("Abort current transaction because this cluster node is in %s status", MtmNodeStatusMnem[Mtm->status])));
 	}
 	if (TransactionIdIsValid(x->gtid.xid) && BIT_CHECK(Mtm->disabledNodeMask, x->gtid.node-1)) {
 		/* Coordinator of transaction is disabled: just abort transaction without any further steps */
-		elog(ERROR, "Abort transaction %s (%llu) because it's coordinator %d was disabled", x->gid, (long64)x->xid, x->gtid.node);
+		ereport(ERROR,
+				(errcode(ERRCODE_TRANSACTION_ROLLBACK),
+				 errmsg("Abort transaction %s (%llu) because it's coordinator %d was disabled", x->gid, (long64)x->xid, x->gtid.node)));
 	}
 
 	MtmLock(LW_EXCLUSIVE);
@@ -883,13 +1746,16 @@ MtmPrePrepareTransaction(MtmCurrentTrans* x)
 	 * Invalid CSN prevent replication of transaction by logical replication 
 	 */	   
 	ts->isLocal = x->isReplicated || !x->containsDML;
+	ts->isFastCommit = x->containsDML && x->isFastCommit && !x->isTwoPhase;
+	ts->isHomeLocal = x->containsDML && x->isHomeLocal && !x->isTwoPhase && MtmIsHomeLocalGid(x->gid);
 	ts->snapshot = x->snapshot;
 	ts->csn = MtmAssignCSN();	
 	ts->procno = MyProc->pgprocno;
 	ts->votingCompleted = false;
-	ts->participantsMask = (((nodemask_t)1 << Mtm->nAllNodes) - 1) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
+	ts->participantsMask = NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
 	ts->nConfigChanges = Mtm->nConfigChanges;
 	ts->votedMask = 0;
+	ts->quorumTime = 0;
 	ts->nSubxids = xactGetCommittedChildren(&subxids);
 	if (!ts->isActive) {
 		ts->isActive = true;
@@ -912,6 +1778,7 @@ MtmPrePrepareTransaction(MtmCurrentTrans* x)
 	MTM_LOG3("%d: MtmPrePrepareTransaction prepare commit of %d (gtid.xid=%d, gtid.node=%d, CSN=%lld)", 
 			 MyProcPid, x->xid, ts->gtid.xid, ts->gtid.node, ts->csn);
 	MtmUnlock();
+	MtmPhaseStartTime = MtmGetSystemTime();
 	MTM_TXTRACE(x, "PrePrepareTransaction Finish");
 }
 
@@ -938,16 +1805,20 @@ bool MtmWatchdog(timestamp_t now)
 }
 
 /* 
- * Mark transaction as precommitted
+ * Mark batch of transactions as precommitted.
+ * New state of all of them is written to WAL by one record.
  */
-void MtmPrecommitTransaction(char const* gid)
+void MtmPrecommitTransactions(int n, char const* const* gids)
 {
+	char const** precommitted = (char const**)palloc(n*sizeof(char const*));
+	int nPrecommitted = 0;
+	int i;
+
 	MtmLock(LW_EXCLUSIVE);
-	{
-		MtmTransMap* tm = (MtmTransMap*)hash_search(MtmGid2State, gid, HASH_FIND, NULL);
+	for (i = 0; i < n; i++) {
+		MtmTransMap* tm = (MtmTransMap*)hash_search(MtmGid2State, gids[i], HASH_FIND, NULL);
 		if (tm == NULL) {
-			MtmUnlock();
-			elog(WARNING, "MtmPrecommitTransaction: transaction '%s' is not found", gid);
+			elog(WARNING, "MtmPrecommitTransaction: transaction '%s' is not found", gids[i]);
 		} else { 
 			MtmTransState* ts = tm->state;
 			Assert(ts != NULL);
@@ -958,38 +1829,112 @@ void MtmPrecommitTransaction(char const* gid)
 				if (Mtm->status != MTM_RECOVERY) {
 					MtmSend2PCMessage(ts, MSG_PRECOMMITTED);
 				}
-				MtmUnlock();
-				Assert(replorigin_session_origin != InvalidRepOriginId);
-				if (!IsTransactionState()) {
-					MtmResetTransaction();
-					StartTransactionCommand();
-					SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);
-					CommitTransactionCommand();
-				} else { 
-					SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);
-				}
+				precommitted[nPrecommitted++] = gids[i];
 			} else {
-				elog(WARNING, "MtmPrecommitTransaction: transaction '%s' is already in %s state", gid, MtmTxnStatusMnem[ts->status]);
-				MtmUnlock();
+				elog(WARNING, "MtmPrecommitTransaction: transaction '%s' is already in %s state", gids[i], MtmTxnStatusMnem[ts->status]);
+			}
+		}
+	}
+	MtmUnlock();
+
+	if (nPrecommitted != 0) { 
+		Assert(replorigin_session_origin != InvalidRepOriginId);
+		if (!IsTransactionState()) {
+			MtmResetTransaction();
+			StartTransactionCommand();
+			SetPreparedTransactionsState(nPrecommitted, precommitted, MULTIMASTER_PRECOMMITTED);
+			CommitTransactionCommand();
+		} else { 
+			SetPreparedTransactionsState(nPrecommitted, precommitted, MULTIMASTER_PRECOMMITTED);
+		}
+	}
+	pfree(precommitted);
+}
+
+/*
+ * Quorum commit: once majority of nodes has voted in current phase, wait at most multimaster.quorum_commit_delay
+ * for the remaining ones and then disable them. Disabled nodes go to recovery, which resolves transactions prepared
+ * by them but not voted. Other nodes learn about the fence from logical message written before commit record,
+ * so a lagging node can not get quorum for a transaction conflicting with this one before it is recovered.
+ * Should be called with MtmLock held.
+ */
+static void
+MtmFenceLaggards(MtmTransState* ts)
+{
+	nodemask_t laggards = ts->participantsMask & ~Mtm->disabledNodeMask & ~ts->votedMask;
+	timestamp_t now;
+	MtmFenceLogicalMessage msg;
+	nodemask_t mask;
+
+	if (laggards == 0
+		|| nodemask_popcount(ts->participantsMask & ~Mtm->disabledNodeMask & ts->votedMask) + 1 < Mtm->nAllNodes/2+1)
+	{
+		return;
+	}
+	now = MtmGetSystemTime();
+	if (ts->quorumTime == 0) { 
+		ts->quorumTime = now;
+	}
+	if (now < ts->quorumTime + MSEC_TO_USEC(MtmQuorumCommitDelay)) { 
+		return;
+	}
+	elog(WARNING, "Commit transaction %s (%llu) without votes of nodes %llx: they are disabled", 
+		 ts->gid, (long64)ts->xid, (long64)laggards);
+	msg.fencedMask = laggards;
+	msg.time = now;
+	LogLogicalMessage("F", (char*)&msg, sizeof(msg), false);
+	for (mask = laggards; mask != 0; mask &= mask - 1) {
+		MtmDisableNode(nodemask_first(mask) + 1);
+	}
+	/* Configuration is changed by this transaction, so it should not be aborted because of it */
+	ts->participantsMask &= ~laggards;
+	ts->nConfigChanges = Mtm->nConfigChanges;
+	MtmCheckQuorum();
+}
+
+/*
+ * Apply fence written by coordinator of transaction committed without votes of some nodes, see MtmFenceLaggards.
+ * It is called by receiver before commit of this transaction is applied.
+ */
+void MtmFenceNodes(int originNode, MtmFenceLogicalMessage const* msg)
+{
+	nodemask_t mask;
+
+	if (Mtm->status == MTM_RECOVERY) { 
+		/* fences of the past are not interesting for recovered node */
+		return;
+	}
+	MtmLock(LW_EXCLUSIVE);
+	for (mask = msg->fencedMask; mask != 0; mask &= mask - 1) {
+		int nodeId = nodemask_first(mask) + 1;
+		if (Mtm->nodes[nodeId-1].lastStatusChangeTime > msg->time) { 
+			continue; /* node was enabled after the fence */
+		}
+		if (nodeId == MtmNodeId) { 
+			if (Mtm->status == MTM_ONLINE) { 
+				elog(WARNING, "Node %d has committed transaction without my vote", originNode);
+				BIT_SET(Mtm->disabledNodeMask, MtmNodeId-1);
+				MtmSwitchClusterMode(MTM_RECOVERY);
 			}
+		} else if (!BIT_CHECK(Mtm->disabledNodeMask, nodeId-1)) { 
+			elog(WARNING, "Node %d is fenced by node %d", nodeId, originNode);
+			MtmDisableNode(nodeId);
+			MtmCheckQuorum();
 		}
 	}
+	MtmUnlock();
 }
-				
-				
-	
-
 
 static bool 
 MtmVotingCompleted(MtmTransState* ts)
 {
-	nodemask_t liveNodesMask = (((nodemask_t)1 << Mtm->nAllNodes) - 1) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
+	nodemask_t liveNodesMask = NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
 
 	if (!ts->isPrepared) { /* We can not just abort precommitted transactions */
 		if (ts->nConfigChanges != Mtm->nConfigChanges)
 		{ 
 			elog(WARNING, "Abort transaction %s (%llu) because cluster configuration is changed from %llx to %llx since transaction start", 
-				 ts->gid, (long64)ts->xid, ts->participantsMask, liveNodesMask);
+				 ts->gid, (long64)ts->xid, (long64)ts->participantsMask, (long64)liveNodesMask);
 			MtmAbortTransaction(ts);
 			return true;
 		}
@@ -1000,6 +1945,20 @@ MtmVotingCompleted(MtmTransState* ts)
 	if (ts->votingCompleted) { 
 		return true;
 	}
+	if (ts->isHomeLocal && ts->status == TRANSACTION_STATUS_IN_PROGRESS) { 
+		/* 
+		 * Rows changed by home-local transaction are owned by this node, so it can not conflict with transactions 
+		 * of other nodes: commit it without waiting for votes and let replicas apply it asynchronously.
+		 */
+		ts->isPrepared = true;
+		ts->csn = MtmAssignCSN();
+		ts->status = TRANSACTION_STATUS_UNKNOWN;
+		ts->votingCompleted = true;
+		return true;
+	}
+	if (ts->status == TRANSACTION_STATUS_IN_PROGRESS && MtmQuorumCommitDelay >= 0) { 
+		MtmFenceLaggards(ts);
+	}
 	if (ts->status == TRANSACTION_STATUS_IN_PROGRESS
 		&& (ts->participantsMask & ~Mtm->disabledNodeMask & ~ts->votedMask) == 0) /* all live participants voted */
 	{
@@ -1010,13 +1969,15 @@ MtmVotingCompleted(MtmTransState* ts)
 			return true;
 		} else {
 			MTM_LOG1("Transaction %s is considered as prepared (status=%s participants=%llx disabled=%llx, voted=%llx)", 
-					 ts->gid, MtmTxnStatusMnem[ts->status], ts->participantsMask, Mtm->disabledNodeMask, ts->votedMask);
+					 ts->gid, MtmTxnStatusMnem[ts->status], (long64)ts->participantsMask, (long64)Mtm->disabledNodeMask, (long64)ts->votedMask);
 			ts->isPrepared = true;
 			if (ts->isTwoPhase) {
 				ts->votingCompleted = true;
 				return true;
-			} else if (MtmUseDtm) {
+			} else if (MtmUseDtm && !ts->isFastCommit) {
 				ts->votedMask = 0;
+				ts->quorumTime = 0;
+				MTM_TXTRACE(ts, "MtmVotingCompleted send MSG_PRECOMMIT");
 				Assert(replorigin_session_origin == InvalidRepOriginId);
 				MtmUnlock();
 				SetPreparedTransactionState(ts->gid, MULTIMASTER_PRECOMMITTED);	
@@ -1024,6 +1985,9 @@ MtmVotingCompleted(MtmTransState* ts)
 				//MtmSend2PCMessage(ts, MSG_PRECOMMIT);
 				return false;
 			} else {
+				if (ts->isFastCommit) { 
+					ts->csn = MtmAssignCSN();
+				}
 				ts->status = TRANSACTION_STATUS_UNKNOWN;
 				ts->votingCompleted = true;
 				return true;
@@ -1034,24 +1998,327 @@ MtmVotingCompleted(MtmTransState* ts)
 		|| ts->status == TRANSACTION_STATUS_ABORTED; /* or transaction was aborted */
 }
 
+/*
+ * ---
+ * Vote latency statistic
+ * ---
+ */
+
+/*
+ * Account round-trip of PREPARED vote from the node. Histogram is halved periodically,
+ * so that it reflects recent state of the link. Should be called under MtmLock.
+ */
+void MtmAddVoteLatency(int nodeId, timestamp_t latency)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	int bucket = 0;
+	int i;
+
+	while (bucket < MTM_LATENCY_BUCKETS-1 && latency >= ((timestamp_t)2 << bucket)) { 
+		bucket += 1;
+	}
+	node->voteLatency[bucket] += 1;
+	if (++node->nVoteLatencySamples >= MTM_LATENCY_WINDOW) { 
+		node->nVoteLatencySamples = 0;
+		for (i = 0; i < MTM_LATENCY_BUCKETS; i++) { 
+			node->voteLatency[i] >>= 1;
+			node->nVoteLatencySamples += node->voteLatency[i];
+		}
+	}
+}
+
+/*
+ * Estimate percentile of vote round-trip for the node: upper bound of the histogram bucket is returned.
+ * Returns 0 if there are not enough samples.
+ */
+timestamp_t MtmGetVoteLatency(int nodeId, int percentile)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	uint32 threshold = (uint32)(((uint64)node->nVoteLatencySamples*percentile + 99)/100);
+	uint32 sum = 0;
+	int i;
+
+	if (node->nVoteLatencySamples < MTM_LATENCY_MIN_SAMPLES) { 
+		return 0;
+	}
+	for (i = 0; i < MTM_LATENCY_BUCKETS-1; i++) { 
+		sum += node->voteLatency[i];
+		if (sum >= threshold) { 
+			break;
+		}
+	}
+	return (timestamp_t)2 << i;
+}
+
+/*
+ * ---
+ * Apply statistic
+ * ---
+ */
+
+static void MtmInitApplyStats(MtmApplyStats* stats)
+{
+	int i;
+	pg_atomic_init_u64(&stats->rowsApplied, 0);
+	pg_atomic_init_u64(&stats->bytesApplied, 0);
+	pg_atomic_init_u64(&stats->spillBytes, 0);
+	pg_atomic_init_u64(&stats->conflicts, 0);
+	pg_atomic_init_u64(&stats->deadlocks, 0);
+	for (i = 0; i < MTM_N_PHASES; i++) { 
+		pg_atomic_init_u64(&stats->phaseTime[i], 0);
+		pg_atomic_init_u64(&stats->phaseCount[i], 0);
+	}
+	stats->lastSampleTime = 0;
+	stats->lastRowsApplied = 0;
+	stats->lastBytesApplied = 0;
+	stats->rowsPerSec = 0;
+	stats->bytesPerSec = 0;
+	memset(stats->queueDepth, 0, sizeof(stats->queueDepth));
+	stats->queueDepthPos = 0;
+}
+
+/*
+ * Calculate apply rates and remember depth of apply queues. 
+ * This function is called by monitor worker, samples are taken not more frequently than once per second.
+ */
+void MtmSampleApplyStats(void)
+{
+	timestamp_t now = MtmGetSystemTime();
+	int i;
+
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		MtmApplyStats* stats = &Mtm->nodes[i].stats;
+		uint64 rows, bytes;
+
+		if (now < stats->lastSampleTime + USECS_PER_SEC) { 
+			continue;
+		}
+		rows = pg_atomic_read_u64(&stats->rowsApplied);
+		bytes = pg_atomic_read_u64(&stats->bytesApplied);
+		if (stats->lastSampleTime != 0) { 
+			timestamp_t interval = now - stats->lastSampleTime;
+			stats->rowsPerSec = (rows - stats->lastRowsApplied)*USECS_PER_SEC/interval;
+			stats->bytesPerSec = (bytes - stats->lastBytesApplied)*USECS_PER_SEC/interval;
+		}
+		stats->lastRowsApplied = rows;
+		stats->lastBytesApplied = bytes;
+		stats->lastSampleTime = now;
+		stats->queueDepth[stats->queueDepthPos % MTM_STATS_HISTORY] = BgwPoolGetSubQueuePending(&Mtm->pool, i);
+		stats->queueDepthPos += 1;
+	}
+}
+
+/*
+ * ---
+ * Transaction trace
+ * ---
+ */
+
+/*
+ * Names of commit path events shown by mtm.get_trace(), indexed by MtmCommitEvent
+ */
+static char const* const MtmCommitEventNames[] =
+{
+	"Commit: begin",
+	"Commit: executed",
+	"Commit: prepared",
+	"Commit: decoded",
+	"Commit: sent",
+	"Commit: receive begin",
+	"Commit: received",
+	"Commit: apply begin",
+	"Commit: applied",
+	"Commit: replica prepared",
+	"Commit: vote sent",
+	"Commit: vote received",
+	"Commit: voted"
+};
+
+/*
+ * Record event of distributed transaction in shared memory ring buffer if transaction is sampled.
+ * Writers do not wait each other: concurrently written or overwritten events are just skipped by readers.
+ */
+static void MtmTraceEventAppend(char const* gid, char const* event, int code, int node, timestamp_t time)
+{
+	MtmTraceEvent* ev;
+	uint64 pos;
+
+	if (*gid == '\0' || Mtm == NULL || Mtm->traceBuffer == NULL) { 
+		return;
+	}
+	if (MtmTraceSampleRatio > 1 
+		&& DatumGetUInt32(hash_any((unsigned char const*)gid, strlen(gid))) % MtmTraceSampleRatio != 0)
+	{
+		return;
+	}
+	pos = pg_atomic_fetch_add_u64(&Mtm->traceHead, 1);
+	ev = &Mtm->traceBuffer[pos % MTM_TRACE_BUFFER_SIZE];
+	pg_atomic_write_u64(&ev->pos, 0);
+	pg_write_barrier();
+	ev->time = time;
+	ev->pid = MyProcPid;
+	ev->code = code;
+	ev->node = node;
+	strlcpy(ev->gid, gid, sizeof(ev->gid));
+	strlcpy(ev->event, event, sizeof(ev->event));
+	pg_write_barrier();
+	pg_atomic_write_u64(&ev->pos, pos + 1);
+}
+
+void MtmTraceTransaction(char const* gid, char const* event)
+{
+	MtmTraceEventAppend(gid, event, -1, 0, MtmGetSystemTime());
+}
+
+/*
+ * Record commit path event, time may be earlier than now if gid was not yet known when it happened
+ */
+void MtmTraceCommitEvent(char const* gid, MtmCommitEvent event, int node, timestamp_t time)
+{
+	MtmTraceEventAppend(gid, MtmCommitEventNames[event], event, node, time);
+}
+
+/*
+ * Copy event at the given position of trace buffer, returns false if it is concurrently written or overwritten
+ */
+static bool MtmReadTraceEvent(uint64 pos, MtmTraceEvent* dst)
+{
+	MtmTraceEvent* src = &Mtm->traceBuffer[pos % MTM_TRACE_BUFFER_SIZE];
+	if (pg_atomic_read_u64(&src->pos) != pos + 1) { 
+		return false;
+	}
+	pg_read_barrier();
+	memcpy(dst, src, sizeof(MtmTraceEvent));
+	pg_read_barrier();
+	return pg_atomic_read_u64(&src->pos) == pos + 1;
+}
+
+/*
+ * Commit profile.
+ * All nodes sample the same transactions, because sampling is done by hash of GID, so to get profile of a transaction
+ * backend broadcasts MSG_TRACE_REQUEST with its GID and collects commit path events sent by other nodes in MSG_TRACE_EVENT
+ * messages. Intervals are computed only between events recorded at the same node, so clock skew doesn't matter,
+ * except for the network stage which is derived from difference of round trips measured by coordinator and replica.
+ */
+
+/*
+ * Send commit path events of requested transaction. Called by arbiter with MtmLock held.
+ */
+void MtmHandleTraceRequest(MtmArbiterMessage* msg)
+{
+	MtmArbiterMessage reply;
+	MtmTraceEvent ev;
+	uint64 head, pos;
+	int nEvents = 0;
+
+	memset(&reply, 0, sizeof(reply));
+	reply.code = MSG_TRACE_EVENT;
+	reply.node = msg->node;
+	reply.sxid = msg->sxid;
+	reply.disabledNodeMask = Mtm->disabledNodeMask;
+	reply.connectivityMask = SELF_CONNECTIVITY_MASK;
+	reply.oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+
+	if (Mtm->traceBuffer != NULL) { 
+		head = pg_atomic_read_u64(&Mtm->traceHead);
+		for (pos = head > MTM_TRACE_BUFFER_SIZE ? head - MTM_TRACE_BUFFER_SIZE : 0; pos < head; pos++) { 
+			if (MtmReadTraceEvent(pos, &ev) && ev.code >= 0 && strcmp(ev.gid, msg->gid) == 0) { 
+				reply.status = TRANSACTION_STATUS_IN_PROGRESS;
+				reply.dxid = (TransactionId)(ev.code | (ev.node << 8));
+				reply.csn = ev.time;
+				MtmSendMessage(&reply);
+				nEvents += 1;
+			}
+		}
+	}
+	reply.status = TRANSACTION_STATUS_COMMITTED;
+	reply.dxid = nEvents;
+	reply.csn = MtmGetSystemTime();
+	MtmSendMessage(&reply);
+}
+
+/*
+ * Collect commit path event sent by other node in response to our request. Called by arbiter with MtmLock held.
+ */
+void MtmHandleTraceEvent(MtmArbiterMessage* msg)
+{
+	if (Mtm->profileOwner == 0 || msg->sxid != Mtm->profileRequest) { 
+		/* response to abandoned request */
+		return;
+	}
+	if (msg->status == TRANSACTION_STATUS_COMMITTED) { 
+		BIT_SET(Mtm->profileRespondedMask, msg->node-1);
+	} else if (Mtm->nProfileEvents < MTM_PROFILE_MAX_EVENTS && (msg->dxid & 0xFF) < MTM_N_COMMIT_EVENTS) { 
+		MtmProfileEvent* ev = &Mtm->profileEvents[Mtm->nProfileEvents++];
+		ev->origin = msg->node;
+		ev->code = msg->dxid & 0xFF;
+		ev->node = msg->dxid >> 8;
+		ev->time = msg->csn;
+	}
+}
+
+/*
+ * Timeout for receiving votes from participants of transaction. If latency statistic is collected for all participants, 
+ * then it is derived from the slowest 99 percentile, otherwise multimaster.min_2pc_timeout is used.
+ */
+static timestamp_t MtmGet2PCTimeout(MtmTransState* ts)
+{
+	timestamp_t timeout = 0;
+	int i;
+
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (BIT_CHECK(ts->participantsMask, i)) { 
+			timestamp_t latency = MtmGetVoteLatency(i+1, 99);
+			if (latency == 0) { 
+				return MSEC_TO_USEC(MtmMin2PCTimeout);
+			}
+			timeout = Max(timeout, latency*MTM_LATENCY_TIMEOUT_RATIO);
+		}
+	}
+	return timeout == 0 ? MSEC_TO_USEC(MtmMin2PCTimeout) : Max(timeout, MTM_MIN_ADAPTIVE_2PC_TIMEOUT);
+}
+
+/*
+ * Account duration of 2PC phase of transaction coordinated by this node
+ */
+static void MtmAddPhaseTime(Mtm2PCPhase phase, timestamp_t delay)
+{
+	MtmStatAdd(MtmNodeId, phaseTime[phase], delay);
+	MtmStatAdd(MtmNodeId, phaseCount[phase], 1);
+}
+
 static void
 Mtm2PCVoting(MtmCurrentTrans* x, MtmTransState* ts)
 {
 	int result = 0;
 	timestamp_t prepareTime = ts->csn - ts->snapshot;
-	timestamp_t timeout = Max(prepareTime + MSEC_TO_USEC(MtmMin2PCTimeout), prepareTime*MtmMax2PCRatio/100);
+	timestamp_t timeout = Max(prepareTime + MtmGet2PCTimeout(ts), prepareTime*MtmMax2PCRatio/100);
 	timestamp_t start = MtmGetSystemTime();
 	timestamp_t deadline = start + timeout;
 	timestamp_t now;
+	timestamp_t waitStart;
+	bool prepared = ts->isPrepared;
 
 	Assert(ts->csn > ts->snapshot);
 
+	MtmPhaseStartTime = start;
 	/* Wait votes from all nodes until: */
 	while (!MtmVotingCompleted(ts))
 	{ 
+		if (ts->isPrepared && !prepared) { 
+			/* all PREPARED votes are received, now wait for PRECOMMITTED */
+			now = MtmGetSystemTime();
+			MTM_PROFILE(x->gid, MTM_EV_VOTED, 0, now);
+			MtmAddPhaseTime(MTM_PHASE_VOTE, now - MtmPhaseStartTime);
+			MtmPhaseStartTime = now;
+			prepared = true;
+		}
 		MtmUnlock();
 		MTM_TXTRACE(x, "PostPrepareTransaction WaitLatch Start");
-		result = WaitLatch(&MyProc->procLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, MtmHeartbeatRecvTimeout);
+		waitStart = MtmWaitStart(MTM_WAIT_VOTE);
+		result = WaitLatch(&MyProc->procLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 
+						   ts->quorumTime != 0 ? Min(MtmHeartbeatRecvTimeout, MtmQuorumCommitDelay + 1) : MtmHeartbeatRecvTimeout);
+		MtmWaitEnd(MTM_WAIT_VOTE, waitStart);
 		MTM_TXTRACE(x, "PostPrepareTransaction WaitLatch Finish");
 		/* Emergency bailout if postmaster has died */
 		if (result & WL_POSTMASTER_DEATH) { 
@@ -1090,6 +2357,12 @@ Mtm2PCVoting(MtmCurrentTrans* x, MtmTransState* ts)
 			MtmAbortTransaction(ts);
 		}
 	}
+	now = MtmGetSystemTime();
+	if (!prepared && ts->isPrepared) { 
+		MTM_PROFILE(x->gid, MTM_EV_VOTED, 0, now);
+	}
+	MtmAddPhaseTime(prepared ? MTM_PHASE_PRECOMMIT : MTM_PHASE_VOTE, now - MtmPhaseStartTime);
+	MtmPhaseStartTime = ts->status == TRANSACTION_STATUS_ABORTED ? 0 : now;
 	x->status = ts->status;
 	MTM_LOG3("%d: Result of vote: %d", MyProcPid, MtmTxnStatusMnem[ts->status]);
 }
@@ -1098,12 +2371,21 @@ static void
 MtmPostPrepareTransaction(MtmCurrentTrans* x)
 { 
 	MtmTransState* ts;
+	timestamp_t prepareStartTime = MtmPhaseStartTime;
 	MTM_TXTRACE(x, "PostPrepareTransaction Start");
 
+	MtmPhaseStartTime = 0; /* statistic of 2PC phases is collected only by coordinator */
+	MtmGucTransactionEnd(true); /* receivers get GUCs with prepared transaction even if it is aborted later */
+
 	if (!x->isDistributed) {
 		MTM_TXTRACE(x, "not distributed?");
 		return;
 	}
+	if (x->isReplicated) { 
+		MTM_PROFILE(x->gid, MTM_EV_REPLICA_PREPARED, x->gtid.node, MtmGetSystemTime());
+	} else { 
+		MTM_PROFILE(x->gid, MTM_EV_PREPARED, 0, MtmGetSystemTime());
+	}
 
 	if (Mtm->inject2PCError == 2) { 
 		Mtm->inject2PCError = 0;
@@ -1135,9 +2417,12 @@ MtmPostPrepareTransaction(MtmCurrentTrans* x)
 		MTM_TXTRACE(x, "recovery? 6");
 	} else if (!ts->isLocal)  { 
 		MTM_TXTRACE(x, "not recovery?");
+		MtmAddPhaseTime(MTM_PHASE_PREPARE, MtmGetSystemTime() - prepareStartTime);
 		Mtm2PCVoting(x, ts);
 		MtmUnlock();
 		if (x->isTwoPhase) { 
+			/* transaction will be committed later by COMMIT PREPARED */
+			MtmPhaseStartTime = 0;
 			MtmResetTransaction();
 		}
 	}
@@ -1173,6 +2458,7 @@ MtmPreCommitPreparedTransaction(MtmCurrentTrans* x)
 		if (!ts->isLocal) { 
 			ts->votingCompleted = false;
 			ts->votedMask = 0;
+			ts->quorumTime = 0;
 			ts->procno = MyProc->pgprocno;
 			MTM_LOG2("Coordinator of transaction %s sends MSG_PRECOMMIT", ts->gid);
 			Assert(replorigin_session_origin == InvalidRepOriginId);
@@ -1236,6 +2522,16 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 {
 	MTM_LOG2("%d: End transaction %d, prepared=%d, replicated=%d, distributed=%d, 2pc=%d, gid=%s -> %s", 
 			 MyProcPid, x->xid, x->isPrepared, x->isReplicated, x->isDistributed, x->isTwoPhase, x->gid, commit ? "commit" : "abort");
+	if (MyProc != NULL) { 
+		MtmBackend(MyProc->pgprocno)->activeSnapshot = INVALID_CSN;
+	}
+	MtmGucTransactionEnd(commit);
+	if (MtmPhaseStartTime != 0) { 
+		if (commit && x->isPrepared) { 
+			MtmAddPhaseTime(MTM_PHASE_COMMIT, MtmGetSystemTime() - MtmPhaseStartTime);
+		}
+		MtmPhaseStartTime = 0;
+	}
 	if (x->status != TRANSACTION_STATUS_ABORTED && x->isDistributed && (x->isPrepared || x->isReplicated) && !x->isTwoPhase) {
 		MtmTransState* ts = NULL;
 		MtmLock(LW_EXCLUSIVE);
@@ -1256,18 +2552,24 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 				MTM_LOG2("TRANSLOG: %s transaction gid=%s xid=%d node=%d dxid=%d status %s", 
 						 (commit ? "commit" : "rollback"), ts->gid, ts->xid, ts->gtid.node, ts->gtid.xid, MtmTxnStatusMnem[ts->status]);
 			if (commit) {
-				if (!(ts->status == TRANSACTION_STATUS_UNKNOWN 
-					  || (ts->status == TRANSACTION_STATUS_IN_PROGRESS && Mtm->status == MTM_RECOVERY)))  
+				/* 
+				 * Coordinator commits fast commit and home-local transactions without precommit, 
+				 * so replica receives COMMIT PREPARED for them while they are still in progress
+				 */
+				bool isPrecommitted = ts->status == TRANSACTION_STATUS_UNKNOWN;
+				if (!(isPrecommitted
+					  || (ts->status == TRANSACTION_STATUS_IN_PROGRESS && (Mtm->status == MTM_RECOVERY || x->isReplicated))))  
 				{
 					elog(ERROR, "Attempt to commit %s transaction %s (%llu)", 
 						 MtmTxnStatusMnem[ts->status], ts->gid, (long64)ts->xid);
 				}
-				if (x->csn > ts->csn || Mtm->status == MTM_RECOVERY) {
+				if (x->csn > ts->csn || Mtm->status == MTM_RECOVERY || !isPrecommitted) {
 					Assert(x->csn != INVALID_CSN);
 					ts->csn = x->csn;
 					MtmSyncClock(ts->csn);
 				}
 				Mtm->lastCsn = ts->csn;
+				pg_write_barrier(); /* readers not holding MtmLock expect CSN to be assigned before status */
 				ts->status = TRANSACTION_STATUS_COMMITTED;
 				Assert(ts->isActive);
 				ts->isActive = false;
@@ -1290,7 +2592,7 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 			if (ts == NULL) { 
 				bool found;
 				Assert(TransactionIdIsValid(x->xid));
-				ts = (MtmTransState*)hash_search(MtmXid2State, &x->xid, HASH_ENTER, &found);
+				ts = MtmXidMapEnter(x->xid, &found);
 				if (!found) { 
 					ts->isEnqueued = false;
 					ts->isActive = false;
@@ -1320,7 +2622,7 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 			}
 			MtmSend2PCMessage(ts, MSG_ABORTED); /* send notification to coordinator */
 		} else if (x->status == TRANSACTION_STATUS_ABORTED && x->isReplicated && !x->isPrepared) {
-			hash_search(MtmXid2State, &x->xid, HASH_REMOVE, NULL);
+			MtmXidMapRemove(x->xid);
 		}
 		MtmUnlock();
 	}
@@ -1330,29 +2632,87 @@ MtmEndTransaction(MtmCurrentTrans* x, bool commit)
 	}
 }
 
+static uint32 MtmSendQueueCells(void)
+{
+	uint32 n = 1;
+	while (n < MtmSendQueueSize) { 
+		n <<= 1;
+	}
+	return n;
+}
+
 /* 
- * Send arbiter's message
+ * Send arbiter's message.
+ * Message is placed in bounded lock-free queue consumed by mtm-sender.
+ * If queue is full, wait until sender frees some space. In this case caller may hold MtmLock,
+ * which is also needed to sender, so wait is limited by MtmHeartbeatRecvTimeout and after it
+ * message is dropped: transaction will be then resolved by 2PC timeout.
  */
 void MtmSendMessage(MtmArbiterMessage* msg) 
 {
-	SpinLockAcquire(&Mtm->queueSpinlock);
-	{
-		MtmMessageQueue* mq = Mtm->freeQueue;
-		MtmMessageQueue* sendQueue = Mtm->sendQueue;
-		if (mq == NULL) {
-			mq = (MtmMessageQueue*)ShmemAlloc(sizeof(MtmMessageQueue));
+	uint32 pos = pg_atomic_read_u32(&Mtm->sendQueueTail);
+	MtmSendQueueCell* cell;
+	timestamp_t start = 0;
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+
+	while (true) {
+		int32 diff;
+		cell = &Mtm->sendQueue[pos & Mtm->sendQueueMask];
+		diff = (int32)(pg_atomic_read_u32(&cell->seq) - pos);
+		if (diff == 0) { 
+			if (pg_atomic_compare_exchange_u32(&Mtm->sendQueueTail, &pos, pos + 1)) { 
+				break;
+			}
+			/* pos is updated by failed CAS */
+		} else if (diff < 0) { 
+			/* queue is full */
+			timestamp_t now = MtmGetSystemTime();
+			if (start == 0) { 
+				start = now;
+				pg_atomic_fetch_add_u64(&Mtm->sendQueueFull, 1);
+			} else if (now > start + MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) { 
+				elog(WARNING, "Arbiter send queue is full: drop message %s to node %d", MtmMessageKindMnem[msg->code], msg->node);
+				return;
+			}
+			if (Mtm->senderLatch != NULL) { 
+				SetLatch(Mtm->senderLatch);
+			}
+			MtmSleep(delay);
+			if (delay*2 <= MAX_WAIT_TIMEOUT) { 
+				delay *= 2;
+			}
+			pos = pg_atomic_read_u32(&Mtm->sendQueueTail);
 		} else { 
-			Mtm->freeQueue = mq->next;
-		}
-		mq->msg = *msg;
-		mq->next = sendQueue;
-		Mtm->sendQueue = mq;
-		if (sendQueue == NULL) { 
-			/* singal semaphore only once for the whole list */
-			PGSemaphoreUnlock(&Mtm->sendSemaphore);
+			/* other producer has already taken this cell */
+			pos = pg_atomic_read_u32(&Mtm->sendQueueTail);
 		}
 	}
-	SpinLockRelease(&Mtm->queueSpinlock);
+	cell->msg = *msg;
+	pg_write_barrier();
+	pg_atomic_write_u32(&cell->seq, pos + 1);
+
+	if (Mtm->senderLatch != NULL) { 
+		SetLatch(Mtm->senderLatch);
+	}
+}
+
+/*
+ * Get next message from send queue. Should be called only by mtm-sender.
+ */
+bool MtmDequeueMessage(MtmArbiterMessage* msg)
+{
+	uint32 pos = pg_atomic_read_u32(&Mtm->sendQueueHead);
+	MtmSendQueueCell* cell = &Mtm->sendQueue[pos & Mtm->sendQueueMask];
+
+	if ((int32)(pg_atomic_read_u32(&cell->seq) - (pos + 1)) < 0) { 
+		return false; /* queue is empty or message is not yet written */
+	}
+	pg_read_barrier();
+	*msg = cell->msg;
+	pg_memory_barrier();
+	pg_atomic_write_u32(&cell->seq, pos + Mtm->sendQueueMask + 1);
+	pg_atomic_write_u32(&Mtm->sendQueueHead, pos + 1);
+	return true;
 }
 
 /*
@@ -1419,6 +2779,46 @@ static void MtmBroadcastPollMessage(MtmTransState* ts)
 	}
 }
 
+/*
+ * Poll state of many in-doubt transactions, given by their gids.
+ * After a restart there can be thousands of them, each taking a send queue cell per node,
+ * while the arbiter sender may need MtmLock (held by the caller) to establish connections
+ * and drain the queue. MtmSendMessage would then wait and drop every poll which doesn't fit.
+ * So polls are sent in portions fitting in the free part of the queue, and MtmLock is released
+ * while the sender makes room. Transactions resolved meanwhile are not polled any more.
+ */
+static void MtmBroadcastPollMessages(pgid_t* gids, int n)
+{
+	int i = 0;
+	timestamp_t start = MtmGetSystemTime();
+
+	while (i < n) {
+		uint32 used = pg_atomic_read_u32(&Mtm->sendQueueTail) - pg_atomic_read_u32(&Mtm->sendQueueHead);
+		int room = (int)(Mtm->sendQueueMask + 1 - used) / Mtm->nAllNodes;
+
+		if (room <= 0 && MtmGetSystemTime() < start + MSEC_TO_USEC(MtmHeartbeatRecvTimeout)) {
+			MtmUnlock();
+			if (Mtm->senderLatch != NULL) { 
+				SetLatch(Mtm->senderLatch);
+			}
+			MtmSleep(MIN_WAIT_TIMEOUT);
+			MtmLock(LW_EXCLUSIVE);
+			continue;
+		}
+		/* If sender makes no progress, let MtmSendMessage deal with the overflow */
+		room = Max(room, 1);
+		for (; i < n && room > 0; i++, room--) {
+			MtmTransMap* tm = (MtmTransMap*)hash_search(MtmGid2State, gids[i], HASH_FIND, NULL);
+			if (tm != NULL && tm->state != NULL
+				&& (tm->state->status == TRANSACTION_STATUS_UNKNOWN || tm->state->status == TRANSACTION_STATUS_IN_PROGRESS))
+			{
+				MtmBroadcastPollMessage(tm->state);
+			}
+		}
+		start = MtmGetSystemTime();
+	}
+}
+
 /*
  * Restore state of recovered prepared transaction in memory.
  * This function is called at system startup to make it possible to 
@@ -1429,6 +2829,8 @@ static void	MtmLoadPreparedTransactions(void)
 	PreparedTransaction pxacts;
 	int n = GetPreparedTransactions(&pxacts);
 	int i;
+	int nPolls = 0;
+	pgid_t* polls = (n != 0) ? (pgid_t*)palloc(n*sizeof(pgid_t)) : NULL;
 
 	for (i = 0; i < n; i++) { 
 		bool found;
@@ -1436,7 +2838,7 @@ static void	MtmLoadPreparedTransactions(void)
 		MtmTransMap* tm = (MtmTransMap*)hash_search(MtmGid2State, gid, HASH_ENTER, &found);
 		if (!found || tm->state == NULL) {
 			TransactionId xid = GetNewTransactionId(false);
-			MtmTransState* ts = (MtmTransState*)hash_search(MtmXid2State, &xid, HASH_ENTER, &found);
+			MtmTransState* ts = MtmXidMapEnter(xid, &found);
 			MTM_LOG1("Recover prepared transaction %s (%llu) state=%s", gid, (long64)xid, pxacts[i].state_3pc);
 			MyPgXact->xid = InvalidTransactionId; /* dirty hack:((( */
 			Assert(!found);
@@ -1454,20 +2856,24 @@ static void	MtmLoadPreparedTransactions(void)
 			ts->gtid.xid = xid;
 			ts->nSubxids = 0;
 			ts->votingCompleted = true;
-			ts->participantsMask = (((nodemask_t)1 << Mtm->nAllNodes) - 1) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
+			ts->participantsMask = NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
 			ts->nConfigChanges = Mtm->nConfigChanges;
 			ts->votedMask = 0;
 			strcpy(ts->gid, gid);
 			MtmTransactionListAppend(ts);			
 			tm->status = ts->status;
 			tm->state = ts;
-			MtmBroadcastPollMessage(ts);
+			strcpy(polls[nPolls++], gid);
 		}
 	}
 	MTM_LOG1("Recover %d prepared transactions", n);
+	MtmBroadcastPollMessages(polls, nPolls);
 	if (pxacts) { 
 		pfree(pxacts);
 	}
+	if (polls) { 
+		pfree(polls);
+	}
 }
 
 static void MtmStartRecovery()
@@ -1504,6 +2910,7 @@ void MtmJoinTransaction(GlobalTransactionId* gtid, csn_t globalSnapshot)
 		MtmLock(LW_EXCLUSIVE);
 		MtmSyncClock(globalSnapshot);	
 		MtmTx.snapshot = globalSnapshot;	
+		MtmBackend(MyProc->pgprocno)->activeSnapshot = globalSnapshot;
 		if (Mtm->status != MTM_RECOVERY) { 
 			MtmTransState* ts = MtmCreateTransState(&MtmTx); /* we need local->remote xid mapping for deadlock detection */
 			if (!ts->isActive) { 
@@ -1699,7 +3106,7 @@ static void MtmPollStatusOfPreparedTransactionsForDisabledNode(int disabledNodeI
 			}
 		} else {
 			MTM_LOG1("Skip transaction %s (%llu) with status %s gtid.node=%d gtid.xid=%llu votedMask=%llx", 
-					 ts->gid, (long64)ts->xid, MtmTxnStatusMnem[ts->status], ts->gtid.node, (long64)ts->gtid.xid, ts->votedMask);
+					 ts->gid, (long64)ts->xid, MtmTxnStatusMnem[ts->status], ts->gtid.node, (long64)ts->gtid.xid, (long64)ts->votedMask);
 		}
 	}
 }
@@ -1712,6 +3119,10 @@ static void MtmPollStatusOfPreparedTransactionsForDisabledNode(int disabledNodeI
 static void MtmPollStatusOfPreparedTransactions()
 {
 	MtmTransState *ts;
+	int nPolls = 0;
+	int maxPolls = 0;
+	pgid_t* polls = NULL;
+
 	for (ts = Mtm->transListHead; ts != NULL; ts = ts->next) { 
 		if (TransactionIdIsValid(ts->gtid.xid) 
 			&& ts->votingCompleted /* If voting is not yet completed, then there is some backend coordinating this transaction */
@@ -1719,12 +3130,22 @@ static void MtmPollStatusOfPreparedTransactions()
 		{
 			Assert(ts->gid[0]);
 			MTM_LOG1("Poll state of transaction %s (%llu) from node %d", ts->gid, (long64)ts->xid, ts->gtid.node);				
-			MtmBroadcastPollMessage(ts);
+			if (nPolls == maxPolls) { 
+				maxPolls = (maxPolls == 0) ? 64 : maxPolls*2;
+				polls = (polls == NULL)
+					? (pgid_t*)palloc(maxPolls*sizeof(pgid_t))
+					: (pgid_t*)repalloc(polls, maxPolls*sizeof(pgid_t));
+			}
+			strcpy(polls[nPolls++], ts->gid);
 		} else {
 			MTM_LOG2("Skip prepared transaction %s (%d) with status %s gtid.node=%d gtid.xid=%llu votedMask=%llx", 
-					 ts->gid, (long64)ts->xid, MtmTxnStatusMnem[ts->status], ts->gtid.node, (long64)ts->gtid.xid, ts->votedMask);
+					 ts->gid, (long64)ts->xid, MtmTxnStatusMnem[ts->status], ts->gtid.node, (long64)ts->gtid.xid, (long64)ts->votedMask);
 		}
 	}
+	if (polls != NULL) { 
+		MtmBroadcastPollMessages(polls, nPolls);
+		pfree(polls);
+	}
 }
 
 /*
@@ -1757,7 +3178,7 @@ static void MtmDisableNode(int nodeId)
  */
 static void MtmEnableNode(int nodeId)
 { 
-	if (BIT_SET(Mtm->disabledNodeMask, nodeId-1)) {
+	if (BIT_CHECK(Mtm->disabledNodeMask, nodeId-1)) {
 		BIT_CLEAR(Mtm->disabledNodeMask, nodeId-1);
 		BIT_CLEAR(Mtm->reconnectMask, nodeId-1);
 		Mtm->nConfigChanges += 1;
@@ -1777,8 +3198,8 @@ void MtmRecoveryCompleted(void)
 {
 	int i;
 	MTM_LOG1("Recovery of node %d is completed, disabled mask=%llx, connectivity mask=%llx, endLSN=%llx, live nodes=%d",
-			 MtmNodeId, Mtm->disabledNodeMask, 
-			 SELF_CONNECTIVITY_MASK, (long64)GetXLogInsertRecPtr(), Mtm->nLiveNodes);
+			 MtmNodeId, (long64)Mtm->disabledNodeMask, 
+			 (long64)SELF_CONNECTIVITY_MASK, (long64)GetXLogInsertRecPtr(), Mtm->nLiveNodes);
 	if (Mtm->nAllNodes >= 3) { 
 		elog(WARNING, "restartLSNs at the end of recovery: {%llx, %llx, %llx}", 
 			 Mtm->nodes[0].restartLSN, Mtm->nodes[1].restartLSN, Mtm->nodes[2].restartLSN);
@@ -1871,8 +3292,9 @@ bool MtmIsRecoveredNode(int nodeId)
  * Check if wal sender replayed all transactions from WAL log.
  * It can never happen if there are many active transactions.
  * In this case we wait until gap between sent and current position in the 
- * WAL becomes smaller than threshold value MtmMinRecoveryLag and 
- * after it prohibit start of new transactions until WAL is completely replayed.
+ * WAL becomes smaller than threshold value MtmMinRecoveryLag.
+ * After it either fence is set for this node: recovery is completed when WAL-sender reaches current WAL position,
+ * either (if multimaster.lock_cluster_on_recovery is set) start of new transactions is prohibited until WAL is completely replayed.
  */
 void MtmCheckRecoveryCaughtUp(int nodeId, lsn_t slotLSN)
 {
@@ -1882,18 +3304,31 @@ void MtmCheckRecoveryCaughtUp(int nodeId, lsn_t slotLSN)
 		if (!BIT_CHECK(Mtm->nodeLockerMask, nodeId-1)
 			&& slotLSN + MtmMinRecoveryLag > walLSN) 
 		{ 
-			/*
-			 * Wal sender almost caught up.
-			 * Lock cluster preventing new transaction to start until wal is completely replayed.
-			 * We have to maintain two bitmasks: one is marking wal sender, another - correspondent nodes. 
-			 * Is there some better way to establish mapping between nodes ad WAL-seconder?
-			 */
-			MTM_LOG1("Node %d is almost caught-up: slot position %llx, WAL position %llx, active transactions %d", 
-				 nodeId, slotLSN, walLSN, Mtm->nActiveTransactions);
-			Assert(MyWalSnd != NULL); /* This function is called by WAL-sender, so it should not be NULL */
+			if (MtmLockClusterOnRecovery) { 
+				/*
+				 * Wal sender almost caught up.
+				 * Lock cluster preventing new transaction to start until wal is completely replayed.
+				 * We have to maintain two bitmasks: one is marking wal sender, another - correspondent nodes. 
+				 * Is there some better way to establish mapping between nodes ad WAL-seconder?
+				 */
+				MTM_LOG1("Node %d is almost caught-up: slot position %llx, WAL position %llx, active transactions %d", 
+						 nodeId, slotLSN, walLSN, Mtm->nActiveTransactions);
+				Assert(MyWalSnd != NULL); /* This function is called by WAL-sender, so it should not be NULL */
+				BIT_SET(Mtm->walSenderLockerMask, MyWalSnd - WalSndCtl->walsnds);
+				Mtm->nLockers += 1;
+			} else { 
+				/*
+				 * Wal sender almost caught up: remember current WAL position as a fence.
+				 * Transactions committed before the fence are delivered by this WAL-sender, 
+				 * and changes of other nodes committed after it are received by recovered node directly from their origins,
+				 * because its replication origins are advanced only by applied transactions.
+				 * So there is no need to block new transactions.
+				 */
+				MTM_LOG1("Node %d is almost caught-up: slot position %llx, set recovery fence at WAL position %llx, active transactions %d", 
+						 nodeId, slotLSN, walLSN, Mtm->nActiveTransactions);
+				Mtm->nodes[nodeId-1].recoveryFence = walLSN;
+			}
 			BIT_SET(Mtm->nodeLockerMask, nodeId-1);
-			BIT_SET(Mtm->walSenderLockerMask, MyWalSnd - WalSndCtl->walsnds);
-			Mtm->nLockers += 1;
 		} else { 
 			MTM_LOG2("Continue recovery of node %d, slot position %llx, WAL position %llx,"
 			" WAL sender position %llx, lockers %d, active transactions %d", nodeId, slotLSN,
@@ -1905,24 +3340,39 @@ void MtmCheckRecoveryCaughtUp(int nodeId, lsn_t slotLSN)
 
 /* 
  * Notification about node recovery completion.
- * If recovery is in progess and WAL sender replays all records in WAL, then enable recovered node and send notificatoin to it about end of recovery. 
+ * If recovery is in progess and WAL sender replays all records in WAL (or passed recovery fence), 
+ * then enable recovered node and send notificatoin to it about end of recovery. 
  */
 bool MtmRecoveryCaughtUp(int nodeId, lsn_t walEndPtr)
 {
 	bool caughtUp = false;
 	MtmLock(LW_EXCLUSIVE);
-	if (MtmIsRecoveredNode(nodeId) && Mtm->nActiveTransactions == 0) { 
-		if (BIT_CHECK(Mtm->nodeLockerMask, nodeId-1)) { 
-			MTM_LOG1("Node %d is caught-up at WAL position %llx", nodeId, walEndPtr);	
-			BIT_CLEAR(Mtm->walSenderLockerMask, MyWalSnd - WalSndCtl->walsnds);
+	if (MtmIsRecoveredNode(nodeId)) { 
+		lsn_t fence = Mtm->nodes[nodeId-1].recoveryFence;
+		if (fence != INVALID_LSN && walEndPtr >= fence) { 
+			MTM_LOG1("Node %d is caught-up at WAL position %llx passing recovery fence %llx", nodeId, walEndPtr, fence);	
+			Assert(BIT_CHECK(Mtm->nodeLockerMask, nodeId-1));
 			BIT_CLEAR(Mtm->nodeLockerMask, nodeId-1);
-			Mtm->nLockers -= 1;
-		} else { 
-			MTM_LOG1("Node %d is caught-up at WAL position %llx without locking cluster", nodeId, walEndPtr);	
-			/* We are lucky: caught-up without locking cluster! */
+			Mtm->nodes[nodeId-1].recoveryFence = INVALID_LSN;
+			MtmEnableNode(nodeId);
+			caughtUp = true;
+		} else if (Mtm->nActiveTransactions == 0) { 
+			if (fence != INVALID_LSN) { 
+				MTM_LOG1("Node %d is caught-up at WAL position %llx before reaching recovery fence %llx", nodeId, walEndPtr, fence);	
+				BIT_CLEAR(Mtm->nodeLockerMask, nodeId-1);
+				Mtm->nodes[nodeId-1].recoveryFence = INVALID_LSN;
+			} else if (BIT_CHECK(Mtm->nodeLockerMask, nodeId-1)) { 
+				MTM_LOG1("Node %d is caught-up at WAL position %llx", nodeId, walEndPtr);	
+				BIT_CLEAR(Mtm->walSenderLockerMask, MyWalSnd - WalSndCtl->walsnds);
+				BIT_CLEAR(Mtm->nodeLockerMask, nodeId-1);
+				Mtm->nLockers -= 1;
+			} else { 
+				MTM_LOG1("Node %d is caught-up at WAL position %llx without locking cluster", nodeId, walEndPtr);	
+				/* We are lucky: caught-up without locking cluster! */
+			}
+			MtmEnableNode(nodeId);
+			caughtUp = true;
 		}
-		MtmEnableNode(nodeId);
-		caughtUp = true;
 	}
 	MtmUnlock();
 	return caughtUp;
@@ -1933,6 +3383,11 @@ bool MtmRecoveryCaughtUp(int nodeId, lsn_t walEndPtr)
  */
 void MtmSwitchClusterMode(MtmNodeStatus mode)
 {
+	if (mode == MTM_ONLINE && MtmPrewarmLoadingInProgress != NULL && MtmPrewarmLoadingInProgress()) { 
+		/* MtmCheckPrewarmCompleted will switch to online mode once buffer cache is loaded */
+		MTM_LOG1("Postpone switch to online mode until buffer cache is prewarmed");
+		mode = MTM_CONNECTED;
+	}
 	Mtm->status = mode;
 	Mtm->nodes[MtmNodeId-1].lastStatusChangeTime = MtmGetSystemTime();
 	MTM_LOG1("Switch to %s mode", MtmNodeStatusMnem[mode]);
@@ -1956,24 +3411,26 @@ MtmCheckClusterLock()
 			if (Mtm->nActiveTransactions == 0) { 
 				lsn_t currLogPos = GetXLogInsertRecPtr();
 				int i;
-				for (i = 0; mask != 0; i++, mask >>= 1) { 
-					if (mask & 1) { 
-						if (WalSndCtl->walsnds[i].sentPtr != currLogPos) {
-							/* recovery is in progress */
-							break;
-						} else { 
-							/* recovered replica caught up with master */
-							MTM_LOG1("WAL-sender %d complete recovery", i);
-							BIT_CLEAR(Mtm->walSenderLockerMask, i);
-						}
+				for (; mask != 0; mask &= mask - 1) { 
+					i = nodemask_first(mask);
+					if (WalSndCtl->walsnds[i].sentPtr != currLogPos) {
+						/* recovery is in progress */
+						break;
+					} else { 
+						/* recovered replica caught up with master */
+						MTM_LOG1("WAL-sender %d complete recovery", i);
+						BIT_CLEAR(Mtm->walSenderLockerMask, i);
 					}
 				}
 			}
 			if (mask != 0) { 
 				/* some "almost cautch-up" wal-senders are still working. */
 				/* Do not start new transactions until them are completed. */
+				timestamp_t waitStart;
 				MtmUnlock();
+				waitStart = MtmWaitStart(MTM_WAIT_CLUSTER_LOCK);
 				MtmSleep(delay);
+				MtmWaitEnd(MTM_WAIT_CLUSTER_LOCK, waitStart);
 				if (delay*2 <= MAX_WAIT_TIMEOUT) { 
 					delay *= 2;
 				}
@@ -1982,7 +3439,7 @@ MtmCheckClusterLock()
 			} else {  
 				/* All lockers have synchronized their logs */
 				/* Remove lock and mark them as recovered */
-				MTM_LOG1("Complete recovery of %d nodes (node mask %llx)", Mtm->nLockers, Mtm->nodeLockerMask);
+				MTM_LOG1("Complete recovery of %d nodes (node mask %llx)", Mtm->nLockers, (long64)Mtm->nodeLockerMask);
 				Assert(Mtm->walSenderLockerMask == 0);
 				Assert((Mtm->nodeLockerMask & Mtm->disabledNodeMask) == Mtm->nodeLockerMask);
 				Mtm->disabledNodeMask &= ~Mtm->nodeLockerMask;
@@ -2039,36 +3496,70 @@ MtmBuildConnectivityMatrix(nodemask_t* matrix)
 }
 
 
+/*
+ * Clique found by monitor after the last change of connectivity matrix. It is applied when all its members
+ * have sent heartbeats after it was found, so their connectivity masks reflect the same change.
+ */
+static nodemask_t  pendingClique;
+static int         pendingCliqueSize;
+static timestamp_t pendingCliqueTime;
+static uint64      lastConnectivityEpoch = PG_UINT64_MAX;
+
+/*
+ * Notify monitor about change of connectivity matrix. Should be called under MtmLock.
+ */
+void MtmConnectivityChanged(void)
+{
+	Mtm->connectivityEpoch += 1;
+	if (Mtm->monitorLatch != NULL) { 
+		SetLatch(Mtm->monitorLatch);
+	}
+}
+
 /**
  * Build connectivity graph, find clique in it and extend disabledNodeMask by nodes not included in clique.
- * This fnuctions is called by arbiter monitor process with period MtmHeartbeatSendTimeout
+ * This fnuctions is called by arbiter monitor process with period MtmHeartbeatSendTimeout and 
+ * each time connectivity matrix is changed. Clique is recalculated only when connectivity epoch is changed.
  */
 void MtmRefreshClusterStatus()
 {
 	nodemask_t mask, newClique, disabled;
 	nodemask_t matrix[MAX_NODES];
 	int cliqueSize;
-	nodemask_t oldClique = ~Mtm->disabledNodeMask & (((nodemask_t)1 << Mtm->nAllNodes)-1);
+	nodemask_t oldClique = ~Mtm->disabledNodeMask & NODEMASK_ALL(Mtm->nAllNodes);
+	uint64 epoch = Mtm->connectivityEpoch;
+	timestamp_t now = MtmGetSystemTime();
 	int i;
 
-	MtmBuildConnectivityMatrix(matrix);
-	newClique = MtmFindMaxClique(matrix, Mtm->nAllNodes, &cliqueSize);
-
-	if (newClique == oldClique) {
+	if (epoch != lastConnectivityEpoch) { 
+		lastConnectivityEpoch = epoch;
+		MtmBuildConnectivityMatrix(matrix);
+		newClique = MtmFindMaxClique(matrix, Mtm->nAllNodes, &cliqueSize);
+		if (newClique != pendingClique) { 
+			pendingClique = newClique;
+			pendingCliqueSize = cliqueSize;
+			pendingCliqueTime = now;
+		}
+	}
+	if (pendingClique == oldClique) {
 		/* Nothing is changed */
 		return;
 	}
-
-	do {
-		/* Otherwise make sure that all nodes have a chance to replicate their connectivity mask and we have the "consistent" picture.
-		 * Obviously we can not get true consistent snapshot, but at least try to wait heartbeat send timeout is expired and
-		 * connectivity graph is stabilized.
-		 */
-		oldClique = newClique;		
-		MtmSleep(MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2); /* double timeout to condider worst case when heartbeat send interval is added with refresh cluster status interval */
-		MtmBuildConnectivityMatrix(matrix);
-		newClique = MtmFindMaxClique(matrix, Mtm->nAllNodes, &cliqueSize);
-	} while (newClique != oldClique);
+	/* 
+	 * Make sure that all nodes of the new clique had a chance to replicate their connectivity mask and we have the "consistent" picture.
+	 * Obviously we can not get true consistent snapshot, but wait until each clique member sends heartbeat after the clique was found.
+	 * Double heartbeat send timeout still limits the wait if some of them are silent.
+	 */
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (i+1 != MtmNodeId && BIT_CHECK(pendingClique, i) && Mtm->nodes[i].lastHeartbeat <= pendingCliqueTime) { 
+			break;
+		}
+	}
+	if (i < Mtm->nAllNodes && now < pendingCliqueTime + MSEC_TO_USEC(MtmHeartbeatSendTimeout)*2) { 
+		return;
+	}
+	newClique = pendingClique;
+	cliqueSize = pendingCliqueSize;
 
 	if (cliqueSize >= Mtm->nAllNodes/2+1 || (cliqueSize == (Mtm->nAllNodes+1)/2 && MtmMajorNode)) { /* have quorum */
 		fprintf(stderr, "Old mask: ");
@@ -2082,17 +3573,16 @@ void MtmRefreshClusterStatus()
 		}
 		putc('\n', stderr);
 
-		MTM_LOG1("Find clique %llx, disabledNodeMask %llx", newClique, Mtm->disabledNodeMask);
+		MTM_LOG1("Find clique %llx, disabledNodeMask %llx", (long64)newClique, (long64)Mtm->disabledNodeMask);
 		MtmLock(LW_EXCLUSIVE);
-		disabled = ~newClique & (((nodemask_t)1 << Mtm->nAllNodes)-1) & ~Mtm->disabledNodeMask; /* new disabled nodes mask */
+		disabled = ~newClique & NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask; /* new disabled nodes mask */
 		
 		if (disabled) { 
 			timestamp_t now = MtmGetSystemTime();
-			for (i = 0, mask = disabled; mask != 0; i++, mask >>= 1) {
-				if (mask & 1) { 
-					if (Mtm->nodes[i].lastStatusChangeTime + MSEC_TO_USEC(MtmNodeDisableDelay) < now) {
-						MtmDisableNode(i+1);
-					}
+			for (mask = disabled; mask != 0; mask &= mask - 1) {
+				i = nodemask_first(mask);
+				if (Mtm->nodes[i].lastStatusChangeTime + MSEC_TO_USEC(MtmNodeDisableDelay) < now) {
+					MtmDisableNode(i+1);
 				}
 			}
 			MtmCheckQuorum();
@@ -2122,11 +3612,27 @@ void MtmRefreshClusterStatus()
 			MtmStartRecovery();
 		}
 	} else { 
-		MTM_LOG1("Clique %llx has no quorum", newClique);
+		MTM_LOG1("Clique %llx has no quorum", (long64)newClique);
 		MtmSwitchClusterMode(MTM_IN_MINORITY);
 	}
 }
 
+/*
+ * Switch to online mode postponed by MtmSwitchClusterMode because autoprewarm was loading buffer cache.
+ * Called periodically by monitor.
+ */
+void MtmCheckPrewarmCompleted(void)
+{
+	if (MtmPrewarmLoadingInProgress != NULL && Mtm->status == MTM_CONNECTED && !MtmPrewarmLoadingInProgress()) { 
+		MtmLock(LW_EXCLUSIVE);
+		if (Mtm->status == MTM_CONNECTED && Mtm->nReceivers == Mtm->nLiveNodes-1 && Mtm->nSenders == Mtm->nLiveNodes-1) { 
+			MTM_LOG1("Buffer cache is prewarmed");
+			MtmSwitchClusterMode(MTM_ONLINE);
+		}
+		MtmUnlock();
+	}
+}
+
 /*
  * Check if there is quorum: current node see more than half of all nodes
  */
@@ -2134,12 +3640,12 @@ void MtmCheckQuorum(void)
 {
 	if (Mtm->nLiveNodes >= Mtm->nAllNodes/2+1 || (Mtm->nLiveNodes == (Mtm->nAllNodes+1)/2 && MtmMajorNode)) { /* have quorum */
 		if (Mtm->status == MTM_IN_MINORITY) { 
-			MTM_LOG1("Node is in majority: disabled mask %llx", Mtm->disabledNodeMask);
+			MTM_LOG1("Node is in majority: disabled mask %llx", (long64)Mtm->disabledNodeMask);
 			MtmSwitchClusterMode(MTM_ONLINE);
 		}
 	} else {
 		if (Mtm->status == MTM_ONLINE) { /* out of quorum */
-			elog(WARNING, "Node is in minority: disabled mask %llx", Mtm->disabledNodeMask);
+			elog(WARNING, "Node is in minority: disabled mask %llx", (long64)Mtm->disabledNodeMask);
 			MtmSwitchClusterMode(MTM_IN_MINORITY);
 		}
 	}
@@ -2168,6 +3674,7 @@ void MtmOnNodeDisconnect(int nodeId)
 	MtmLock(LW_EXCLUSIVE);
 	BIT_SET(SELF_CONNECTIVITY_MASK, nodeId-1);
 	BIT_SET(Mtm->reconnectMask, nodeId-1);
+	MtmConnectivityChanged();
 	elog(LOG, "Disconnect node %d connectivity mask %llx", 
 		 nodeId, (long long)SELF_CONNECTIVITY_MASK);
 	MtmUnlock();
@@ -2180,7 +3687,10 @@ void MtmOnNodeConnect(int nodeId)
 {
 	MtmLock(LW_EXCLUSIVE);	
 	elog(LOG, "Connect node %d connectivity mask %llx", nodeId, (long long)SELF_CONNECTIVITY_MASK);
-	BIT_CLEAR(SELF_CONNECTIVITY_MASK, nodeId-1);
+	if (BIT_CHECK(SELF_CONNECTIVITY_MASK, nodeId-1)) { 
+		BIT_CLEAR(SELF_CONNECTIVITY_MASK, nodeId-1);
+		MtmConnectivityChanged();
+	}
 	BIT_SET(Mtm->reconnectMask, nodeId-1); /* force sender to reestablish connection and send heartbeat */
 	MtmUnlock();
 }
@@ -2217,11 +3727,12 @@ MtmCreateXidMap(void)
 	memset(&info, 0, sizeof(info));
 	info.keysize = sizeof(TransactionId);
 	info.entrysize = sizeof(MtmTransState) + (MtmMaxNodes-1)*sizeof(TransactionId);
+	info.num_partitions = MTM_XID_MAP_PARTITIONS;
 	htab = ShmemInitHash(
 		"MtmXid2State",
 		MTM_HASH_SIZE, MTM_HASH_SIZE,
 		&info,
-		HASH_ELEM | HASH_BLOBS
+		HASH_ELEM | HASH_BLOBS | HASH_PARTITION
 	);
 	return htab;
 }
@@ -2249,22 +3760,111 @@ MtmCreateGidMap(void)
 }
 
 /* 
- * Initialize hash table used to mark local (not distributed) tables
+ * Initialize hash table used to mark local (not distributed) tables
+ */
+static HTAB* 
+MtmCreateLocalTableMap(void)
+{
+	HASHCTL info;
+	HTAB* htab;
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(Oid);
+	htab = ShmemInitHash(
+		"MtmLocalTables",
+		MULTIMASTER_MAX_LOCAL_TABLES, MULTIMASTER_MAX_LOCAL_TABLES,
+		&info,
+		0 
+	);
+	return htab;
+}
+
+/* 
+ * Initialize hash table used to mark tables with fast commit
  */
 static HTAB* 
-MtmCreateLocalTableMap(void)
+MtmCreateFastCommitTableMap(void)
 {
 	HASHCTL info;
-	HTAB* htab;
 	memset(&info, 0, sizeof(info));
 	info.keysize = sizeof(Oid);
-	htab = ShmemInitHash(
-		"MtmLocalTables",
+	return ShmemInitHash(
+		"MtmFastCommitTables",
 		MULTIMASTER_MAX_LOCAL_TABLES, MULTIMASTER_MAX_LOCAL_TABLES,
 		&info,
 		0 
 	);
-	return htab;
+}
+
+/* 
+ * Initialize hash table of blocks of sequence values reserved by this node
+ */
+static HTAB* 
+MtmCreateSequenceBlockMap(void)
+{
+	HASHCTL info;
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(uint32);
+	info.entrysize = sizeof(MtmSeqBlock);
+	return ShmemInitHash(
+		"MtmSeqBlocks",
+		MULTIMASTER_MAX_SEQUENCES, MULTIMASTER_MAX_SEQUENCES,
+		&info,
+		HASH_ELEM | HASH_BLOBS
+	);
+}
+
+static void MtmMakeRelationFastCommit(Oid relid)
+{
+	if (OidIsValid(relid)) { 
+		MtmLock(LW_EXCLUSIVE);		
+		hash_search(MtmFastCommitTables, &relid, HASH_ENTER, NULL);
+		MtmUnlock();		
+	}
+}	
+
+static void MtmLoadFastCommitTables(void)
+{
+	RangeVar	   *rv;
+	Relation		rel;
+	SysScanDesc		scan;
+	HeapTuple		tuple;
+
+	Assert(IsTransactionState());
+
+	rv = makeRangeVar(MULTIMASTER_SCHEMA_NAME, MULTIMASTER_FAST_COMMIT_TABLES_TABLE, -1);
+	rel = heap_openrv_extended(rv, AccessShareLock, true);
+	if (rel != NULL) { 
+		scan = systable_beginscan(rel, 0, true, NULL, 0, NULL);
+		while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+		{
+			bool isnull;
+			Datum schema = heap_getattr(tuple, Anum_mtm_local_tables_rel_schema, RelationGetDescr(rel), &isnull);
+			Datum name = heap_getattr(tuple, Anum_mtm_local_tables_rel_name, RelationGetDescr(rel), &isnull);
+			Oid relid = RangeVarGetRelid(makeRangeVar(TextDatumGetCString(schema), TextDatumGetCString(name), -1), NoLock, true);
+			if (OidIsValid(relid)) { 
+				hash_search(MtmFastCommitTables, &relid, HASH_ENTER, NULL);
+			}
+		}
+		systable_endscan(scan);
+		heap_close(rel, AccessShareLock);
+	}
+}
+
+static bool MtmIsFastCommitRelation(Relation rel)
+{
+	bool isFastCommit;
+	MtmLock(LW_SHARED);
+	if (!Mtm->fastCommitTablesHashLoaded) { 
+		MtmUnlock();
+		MtmLock(LW_EXCLUSIVE);
+		if (!Mtm->fastCommitTablesHashLoaded) { 
+			MtmLoadFastCommitTables();
+			Mtm->fastCommitTablesHashLoaded = true;
+		}
+	}
+	isFastCommit = hash_search(MtmFastCommitTables, &RelationGetRelid(rel), HASH_FIND, NULL) != NULL;
+	MtmUnlock();
+	return isFastCommit;
 }
 
 static void MtmMakeRelationLocal(Oid relid)
@@ -2272,6 +3872,7 @@ static void MtmMakeRelationLocal(Oid relid)
 	if (OidIsValid(relid)) { 
 		MtmLock(LW_EXCLUSIVE);		
 		hash_search(MtmLocalTables, &relid, HASH_ENTER, NULL);
+		pg_atomic_fetch_add_u64(&Mtm->localTablesVersion, 1);
 		MtmUnlock();		
 	}
 }	
@@ -2372,9 +3973,11 @@ static void MtmInitialize()
 		Mtm->status = MTM_INITIALIZATION;
 		Mtm->recoverySlot = 0;
 		Mtm->locks = GetNamedLWLockTranche(MULTIMASTER_NAME);
-		Mtm->csn = MtmGetCurrentTime();
+		/* CSN of hot standby is advanced only by horizons replayed from WAL, see MtmReplayLogicalMessage */
+		pg_atomic_init_u64(&Mtm->csn, MtmIsStandby ? INVALID_CSN : MtmGetSystemTime());
 		Mtm->lastCsn = INVALID_CSN;
 		Mtm->oldestXid = FirstNormalTransactionId;
+		Mtm->oldestCsn = INVALID_CSN;
         Mtm->nLiveNodes = MtmNodes;
         Mtm->nAllNodes = MtmNodes;
 		Mtm->disabledNodeMask = 0;
@@ -2393,16 +3996,47 @@ static void MtmInitialize()
         Mtm->transListTail = &Mtm->transListHead;		
         Mtm->nReceivers = 0;
         Mtm->nSenders = 0;
-		Mtm->timeShift = 0;		
 		Mtm->transCount = 0;
 		Mtm->gcCount = 0;
 		Mtm->nConfigChanges = 0;
 		Mtm->recoveryCount = 0;
 		Mtm->localTablesHashLoaded = false;
+		pg_atomic_init_u64(&Mtm->localTablesVersion, 0);
+		Mtm->fastCommitTablesHashLoaded = false;
 		Mtm->preparedTransactionsLoaded = false;
 		Mtm->inject2PCError = 0;
-		Mtm->sendQueue = NULL;
-		Mtm->freeQueue = NULL;
+		Mtm->sendQueueMask = MtmSendQueueCells()-1;
+		Mtm->sendQueue = (MtmSendQueueCell*)ShmemAlloc(sizeof(MtmSendQueueCell)*MtmSendQueueCells());
+		for (i = 0; i <= Mtm->sendQueueMask; i++) { 
+			pg_atomic_init_u32(&Mtm->sendQueue[i].seq, i);
+		}
+		pg_atomic_init_u32(&Mtm->sendQueueHead, 0);
+		pg_atomic_init_u32(&Mtm->sendQueueTail, 0);
+		pg_atomic_init_u64(&Mtm->sendQueueFull, 0);
+		Mtm->backends = (MtmBackendSlot*)CACHELINEALIGN(ShmemAlloc(sizeof(MtmBackendSlot)*ProcGlobal->allProcCount + PG_CACHE_LINE_SIZE));
+		for (i = 0; i < ProcGlobal->allProcCount; i++) { 
+			MtmBackend(i)->snapshotWaitXid = InvalidTransactionId;
+			MtmBackend(i)->activeSnapshot = INVALID_CSN;
+		}
+		pg_atomic_init_u32(&Mtm->nSnapshotWaiters, 0);
+		Mtm->csnCache = (MtmCsnCacheEntry*)ShmemAlloc(sizeof(MtmCsnCacheEntry)*MTM_CSN_CACHE_SIZE);
+		for (i = 0; i < MTM_CSN_CACHE_SIZE; i++) { 
+			pg_atomic_init_u32(&Mtm->csnCache[i].seq, 0);
+			Mtm->csnCache[i].xid = InvalidTransactionId;
+		}
+		pg_atomic_init_u64(&Mtm->transMemoryUsed, 0);
+		pg_atomic_init_u64(&Mtm->traceHead, 0);
+		Mtm->profileRequest = 0;
+		Mtm->profileOwner = 0;
+		Mtm->nProfileEvents = 0;
+		for (i = 0; i < MTM_N_WAIT_EVENTS; i++) { 
+			pg_atomic_init_u64(&Mtm->waitCount[i], 0);
+			pg_atomic_init_u64(&Mtm->waitTime[i], 0);
+		}
+		Mtm->traceBuffer = (MtmTraceEvent*)ShmemAlloc(sizeof(MtmTraceEvent)*MTM_TRACE_BUFFER_SIZE);
+		for (i = 0; i < MTM_TRACE_BUFFER_SIZE; i++) { 
+			pg_atomic_init_u64(&Mtm->traceBuffer[i].pos, 0);
+		}
 		for (i = 0; i < MtmNodes; i++) {
 			Mtm->nodes[i].oldestSnapshot = 0;
 			Mtm->nodes[i].disabledNodeMask = 0;
@@ -2410,22 +4044,33 @@ static void MtmInitialize()
 			Mtm->nodes[i].lockGraphUsed = 0;
 			Mtm->nodes[i].lockGraphAllocated = 0;
 			Mtm->nodes[i].lockGraphData = NULL;
+			Mtm->nodes[i].lockGraphVersion = 0;
+			Mtm->nodes[i].lockGraphUpdates = 0;
 			Mtm->nodes[i].transDelay = 0;
+			memset(Mtm->nodes[i].voteLatency, 0, sizeof(Mtm->nodes[i].voteLatency));
+			Mtm->nodes[i].nVoteLatencySamples = 0;
 			Mtm->nodes[i].lastStatusChangeTime = MtmGetSystemTime();
 			Mtm->nodes[i].con = MtmConnections[i];
 			Mtm->nodes[i].flushPos = 0;
 			Mtm->nodes[i].lastHeartbeat = 0;
 			Mtm->nodes[i].restartLSN = INVALID_LSN;
+			Mtm->nodes[i].recoveryFence = INVALID_LSN;
 			Mtm->nodes[i].originId = InvalidRepOriginId;
 			Mtm->nodes[i].timeline = 0;
 		}
+		for (i = 0; i < MtmMaxNodes; i++) {
+			MtmInitApplyStats(&Mtm->nodes[i].stats);
+			Mtm->nodes[i].commitTicketIssued = 0;
+			pg_atomic_init_u64(&Mtm->nodes[i].commitTicketDone, 0);
+			memset(Mtm->nodes[i].commitTicketWaiters, 0, sizeof(Mtm->nodes[i].commitTicketWaiters));
+		}
 		Mtm->nodes[MtmNodeId-1].originId = DoNotReplicateId;
 		/* All transaction originated from the current node should be ignored during recovery */
 		Mtm->nodes[MtmNodeId-1].restartLSN = (lsn_t)PG_UINT64_MAX;
-		PGSemaphoreCreate(&Mtm->sendSemaphore);
-		PGSemaphoreReset(&Mtm->sendSemaphore);
-		SpinLockInit(&Mtm->queueSpinlock);
-		BgwPoolInit(&Mtm->pool, MtmExecutor, MtmDatabaseName, MtmDatabaseUser, MtmQueueSize, MtmWorkers);
+		Mtm->senderLatch = NULL;
+		Mtm->monitorLatch = NULL;
+		Mtm->connectivityEpoch = 0;
+		BgwPoolInit(&Mtm->pool, MtmExecutor, MtmDatabaseName, MtmDatabaseUser, MtmQueueSize, MtmMaxNodes, MtmWorkers);
 		RegisterXactCallback(MtmXactCallback, NULL);
 		MtmTx.snapshot = INVALID_CSN;
 		MtmTx.xid = InvalidTransactionId;		
@@ -2433,6 +4078,8 @@ static void MtmInitialize()
 	MtmXid2State = MtmCreateXidMap();
 	MtmGid2State = MtmCreateGidMap();
 	MtmLocalTables = MtmCreateLocalTableMap();
+	MtmFastCommitTables = MtmCreateFastCommitTableMap();
+	MtmSeqBlocks = MtmCreateSequenceBlockMap();
     MtmDoReplication = true;
 	TM = &MtmTM;
 	LWLockRelease(AddinShmemInitLock);
@@ -2447,6 +4094,31 @@ MtmShmemStartup(void)
 		PreviousShmemStartupHook();
 	}
 	MtmInitialize();
+	MtmLookupPrewarm();
+}
+
+/*
+ * If pg_prewarm is preloaded, node should not become online until autoprewarm has reloaded buffer cache
+ * after restart. Otherwise the first client requests redirected to the node will hit cold cache.
+ * Libraries are already loaded at this moment, so lookup of function doesn't load anything.
+ */
+static void
+MtmLookupPrewarm(void)
+{
+	char* libs = pstrdup(shared_preload_libraries_string);
+	List* elems;
+	ListCell* cell;
+
+	if (SplitIdentifierString(libs, ',', &elems)) {
+		foreach (cell, elems) {
+			if (strcmp((char*)lfirst(cell), "pg_prewarm") == 0) {
+				MtmPrewarmLoadingInProgress = (bool (*)(void))load_external_function("pg_prewarm", "AutoPrewarmLoadingInProgress", false, NULL);
+				break;
+			}
+		}
+		list_free(elems);
+	}
+	pfree(libs);
 }
 
 /*
@@ -2701,6 +4373,8 @@ static bool ConfigIsSane(void)
 void
 _PG_init(void)
 {
+	int i;
+
 	/*
 	 * In order to create our shared memory area, we have to be loaded via
 	 * shared_preload_libraries.  If not, fall out without hooking into any of
@@ -2712,6 +4386,12 @@ _PG_init(void)
 	if (!process_shared_preload_libraries_in_progress)
 		return;
 
+	StaticAssertStmt(lengthof(MtmWaitEventNames) == MTM_N_WAIT_EVENTS, "MtmWaitEventNames does not match MtmWaitEvent");
+	StaticAssertStmt(lengthof(MtmCommitEventNames) == MTM_N_COMMIT_EVENTS, "MtmCommitEventNames does not match MtmCommitEvent");
+	for (i = 0; i < MTM_N_WAIT_EVENTS; i++) { 
+		MtmWaitEventIds[i] = pgstat_register_wait_event(MtmWaitEventNames[i]);
+	}
+
 	DefineCustomIntVariable(
 		"multimaster.heartbeat_send_timeout", 
 		"Timeout in milliseconds of sending heartbeat messages",
@@ -2785,6 +4465,21 @@ _PG_init(void)
 		NULL,
 		NULL
 	);
+	DefineCustomIntVariable(
+		"multimaster.trans_spill_budget",
+		"Total size (Mb) of memory which can be used by all receivers for buffering transactions larger than multimaster.trans_spill_threshold",
+		"Transaction exceeding multimaster.trans_spill_threshold is kept in memory while this node-wide budget is not exhausted, "
+		"so that only the largest transactions are written to the disk. Zero value disables this.",
+		&MtmTransSpillBudget,
+		1000, /* 1Gb */
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
 
 	DefineCustomIntVariable(
 		"multimaster.node_disable_delay",
@@ -2801,9 +4496,22 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomBoolVariable(
+		"multimaster.lock_cluster_on_recovery",
+		"Prohibit start of new transactions when WAL-sender performing recovery almost caught up",
+		"By default recovery is completed when WAL-sender reaches WAL position saved when lag becomes smaller than multimaster.min_recovery_lag",
+		&MtmLockClusterOnRecovery,
+		false,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.min_recovery_lag",
-		"Minimal lag of WAL-sender performing recovery after which cluster is locked until recovery is completed",
+		"Minimal lag of WAL-sender performing recovery after which recovery fence is set (or cluster is locked) until recovery is completed",
 		"When wal-sender almost catch-up WAL current position we need to stop 'Achilles tortile competition' and "
 		"temporary stop commit of new transactions until node will be completely repared",
 		&MtmMinRecoveryLag,
@@ -2833,6 +4541,19 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomBoolVariable(
+		"multimaster.spill_compression",
+		"Compress transactions spilled to the disk",
+		"Reduces disk traffic caused by large transactions at the cost of CPU",
+		&MtmSpillCompression,
+		false,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomBoolVariable(
 		"multimaster.major_node",
 		"Node which forms a majority in case of partitioning in cliques with equal number of nodes",
@@ -2872,6 +4593,36 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.apply_prefetch_depth",
+		"Maximal number of updated or deleted rows of replicated transaction whose pages are prefetched before apply",
+		"Zero disables prefetch",
+		&MtmApplyPrefetchDepth,
+		1024,
+		0,
+		INT_MAX,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"multimaster.apply_maintenance_workers",
+		"Number of parallel workers used to build indexes created by replicated DDL statements",
+		"Replaces max_parallel_maintenance_workers for DDL received from other nodes, -1 keeps its value",
+		&MtmApplyMaintenanceWorkers,
+		-1,
+		-1,
+		1024,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomBoolVariable(
 		"multimaster.preserve_commit_order",
 		"Transactions from one node will be committed in same order al all nodes",
@@ -2885,6 +4636,32 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomBoolVariable(
+		"multimaster.compress_replication",
+		"Ask other nodes to compress logical replication stream sent to this node",
+		"Messages are compressed with pglz. It reduces network traffic at the price of CPU usage at sender and receiver.",
+		&MtmCompressReplication,
+		false,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomBoolVariable(
+		"multimaster.trusted_cluster",
+		"Use internal binary representation for all types which allow it when receiving changes from other nodes",
+		"All nodes should run the same binaries. Types which internal representation depends on node specific OIDs (like enums) are still passed in text form.",
+		&MtmTrustedCluster,
+		true,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomBoolVariable(
 		"multimaster.volkswagen_mode",
 		"Pretend to be normal postgres. This means skip some NOTICE's and use local sequences. Default false.",
@@ -2898,6 +4675,22 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.sequence_block_size",
+		"Number of values of sequence reserved by node at once",
+		"If zero, sequences are made unique by assigning start = node ID and increment = max_nodes. "
+		"Otherwise nodes hand out values of sequences with increment 1 from contiguous blocks reserved by agreement of all online nodes",
+		&MtmSequenceBlockSize,
+		0,
+		0,
+		INT_MAX,
+		PGC_BACKEND,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.workers",
 		"Number of multimaster executor workers",
@@ -2928,6 +4721,21 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.worker_idle_timeout",
+		"Time (msec) of inactivity after which dynamic executor worker is stopped",
+		"Zero value disables stopping of dynamic workers",
+		&MtmWorkerIdleTimeout,
+		60000,
+		0,
+		INT_MAX,
+		PGC_BACKEND,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.vacuum_delay",
 		"Minimal age of records which can be vacuumed (seconds)",
@@ -2943,10 +4751,27 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.trace_sample_ratio",
+		"Record events of each N-th distributed transaction in shared memory trace buffer",
+		"Transactions are sampled by hash of GID, so all events of sampled transaction are recorded at all nodes. "
+		"Trace can be inspected using mtm.get_trace() function, commit latency of sampled transaction is broken down "
+		"by mtm.get_commit_profile(). Zero value disables tracing.",
+		&MtmTraceSampleRatio,
+		100,
+		0,
+		INT_MAX,
+		PGC_SUSET,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.min_2pc_timeout",
 		"Minimal timeout between receiving PREPARED message from nodes participated in transaction to coordinator (milliseconds)",
-		NULL,
+		"Used until enough vote round-trips are observed to derive the timeout from per-node latency histogram",
 		&MtmMin2PCTimeout,
 		2000, /* 2 seconds */
 		1,
@@ -2974,6 +4799,36 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.send_queue_size",
+		"Maximal number of messages in arbiter send queue",
+		"Rounded up to power of two. When queue is full, senders of messages wait for arbiter",
+		&MtmSendQueueSize,
+		4096,
+		64,
+		1024*1024,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"multimaster.arbiter_receivers",
+		"Number of arbiter receiver workers",
+		"Connections from nodes are distributed between receivers",
+		&MtmArbiterReceivers,
+		1,
+		1,
+		MAX_NODES,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomIntVariable(
 		"multimaster.queue_size",
 		"Multimaster queue size",
@@ -3075,6 +4930,36 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"multimaster.quorum_commit_delay",
+		"Time in milliseconds to wait for votes of remaining nodes after majority has voted for transaction",
+		"Nodes which do not vote in this time are disabled and recovered. -1 means waiting for all live nodes",
+		&MtmQuorumCommitDelay,
+		-1,
+		-1,
+		INT_MAX,
+		PGC_BACKEND,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
+	DefineCustomIntVariable(
+		"multimaster.standby_snapshot_period",
+		"Period in milliseconds of advancing snapshots of hot standby replicas of the node",
+		"CSNs of distributed transactions are written to WAL only if it is not zero",
+		&MtmStandbySnapshotPeriod,
+		0,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		GUC_UNIT_MS,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	if (!ConfigIsSane()) {
 		elog(ERROR, "Multimaster config is insane, refusing to work");
 	}
@@ -3082,19 +4967,26 @@ _PG_init(void)
 	/* This will also perform some checks on connection strings */
 	MtmSplitConnStrs();
 
-    MtmStartReceivers();
+	/*
+	 * Physical replica started from base backup of multimaster node gets the same configuration,
+	 * but it should not take part in the cluster: only visibility of its read-only transactions is maintained.
+	 * Postmaster is already in data directory at this moment.
+	 */
+	MtmIsStandby = access("recovery.conf", F_OK) == 0;
+
+	if (!MtmIsStandby) { 
+		MtmStartReceivers();
+	}
 
 	/*
 	 * Request additional shared resources.  (These are no-ops if we're not in
 	 * the postmaster process.)  We'll allocate or attach to the shared
 	 * resources in mtm_shmem_startup().
 	 */
-	RequestAddinShmemSpace(MTM_SHMEM_SIZE + MtmQueueSize);
-	RequestNamedLWLockTranche(MULTIMASTER_NAME, 1 + MtmMaxNodes*2);
-
-    BgwPoolStart(MtmWorkers, MtmPoolConstructor);
-
-	MtmArbiterInitialize();
+	RequestAddinShmemSpace(MTM_SHMEM_SIZE + BgwPoolShmemSize(MtmQueueSize, MtmMaxNodes, MtmWorkers)
+						   + sizeof(MtmSendQueueCell)*MtmSendQueueCells()
+						   + sizeof(MtmTraceEvent)*MTM_TRACE_BUFFER_SIZE);
+	RequestNamedLWLockTranche(MULTIMASTER_NAME, 1 + MtmMaxNodes*2 + MTM_XID_MAP_PARTITIONS);
 
 	/*
 	 * Install hooks.
@@ -3102,6 +4994,14 @@ _PG_init(void)
 	PreviousShmemStartupHook = shmem_startup_hook;
 	shmem_startup_hook = MtmShmemStartup;
 
+	if (MtmIsStandby) { 
+		return;
+	}
+
+    BgwPoolStart(MtmWorkers, MtmPoolConstructor);
+
+	MtmArbiterInitialize();
+
 	PreviousExecutorStartHook = ExecutorStart_hook;
 	ExecutorStart_hook = MtmExecutorStart;
 
@@ -3110,6 +5010,9 @@ _PG_init(void)
 
 	PreviousProcessUtilityHook = ProcessUtility_hook;
 	ProcessUtility_hook = MtmProcessUtility;
+
+	PreviousSessionPoolHook = session_pool_hook;
+	session_pool_hook = MtmSessionPoolHook;
 }
 
 /*
@@ -3121,6 +5024,7 @@ _PG_fini(void)
 	shmem_startup_hook = PreviousShmemStartupHook;
 	ExecutorFinish_hook = PreviousExecutorFinishHook;
 	ProcessUtility_hook = PreviousProcessUtilityHook;	
+	session_pool_hook = PreviousSessionPoolHook;
 }
 
 
@@ -3231,9 +5135,12 @@ MtmReplicationMode MtmGetReplicationMode(int nodeId, sig_atomic_t volatile* shut
 	
 	if (!Mtm->preparedTransactionsLoaded)
 	{
-		/* We must restore state of prepared (but no committed or aborted) transaction before start of recovery. */
-		MtmLoadPreparedTransactions();
+		/* 
+		 * We must restore state of prepared (but no committed or aborted) transaction before start of recovery.
+		 * MtmLock may be released while their status is polled, so mark them loaded first.
+		 */
 		Mtm->preparedTransactionsLoaded = true;
+		MtmLoadPreparedTransactions();
 	}
 
 	while ((Mtm->status != MTM_CONNECTED && Mtm->status != MTM_ONLINE) || BIT_CHECK(Mtm->disabledNodeMask, nodeId-1)) 
@@ -3369,6 +5276,7 @@ MtmReplicationStartupHook(struct PGLogicalStartupHookArgs* args)
 	ulong64 recoveryStartPos = INVALID_LSN;
 
 	MtmIsRecoverySession = false;
+	memset(MtmSenderRestartLSN, 0, sizeof(MtmSenderRestartLSN));
 	Mtm->nodes[MtmReplicationNodeId-1].senderPid = MyProcPid;
 	Mtm->nodes[MtmReplicationNodeId-1].senderStartTime = MtmGetSystemTime();
 	foreach(param, args->in_params)
@@ -3407,6 +5315,25 @@ MtmReplicationStartupHook(struct PGLogicalStartupHookArgs* args)
 			} else { 
 				elog(ERROR, "Recovered position is not specified");
 			}
+		} else if (strcmp("mtm_origin_restart_pos", elem->defname) == 0) { 
+			/* 
+			 * Comma separated list of restart positions of the receiver for each origin node.
+			 * Transactions below these positions are already applied by the receiver and need not be sent.
+			 */
+			if (elem->arg != NULL && strVal(elem->arg) != NULL) {
+				char* pos = strVal(elem->arg);
+				int i;
+				for (i = 0; i < MAX_NODES && *pos != '\0'; i++) { 
+					char* end;
+					MtmSenderRestartLSN[i] = strtoull(pos, &end, 16);
+					if (end == pos || (*end != ',' && *end != '\0')) { 
+						elog(WARNING, "Invalid origin restart position list '%s'", strVal(elem->arg));
+						memset(MtmSenderRestartLSN, 0, sizeof(MtmSenderRestartLSN));
+						break;
+					}
+					pos = *end == ',' ? end + 1 : end;
+				}
+			}
 		}
 	}
 	MtmLock(LW_EXCLUSIVE);
@@ -3424,6 +5351,11 @@ MtmReplicationStartupHook(struct PGLogicalStartupHookArgs* args)
 		if (recoveryStartPos < MyReplicationSlot->data.restart_lsn) { 
 			elog(WARNING, "Specified recovery start position %llx is beyond restart lsn %llx", recoveryStartPos, (long64)MyReplicationSlot->data.restart_lsn);
 		}
+		if (Mtm->nodes[MtmReplicationNodeId-1].recoveryFence != INVALID_LSN) { 
+			/* fence was set by previous recovery session */
+			Mtm->nodes[MtmReplicationNodeId-1].recoveryFence = INVALID_LSN;
+			BIT_CLEAR(Mtm->nodeLockerMask, MtmReplicationNodeId-1);
+		}
 		if (!BIT_CHECK(Mtm->disabledNodeMask,  MtmReplicationNodeId-1)) {
 			MtmDisableNode(MtmReplicationNodeId);
 			MtmCheckQuorum();
@@ -3543,11 +5475,14 @@ MtmReplicationTxnFilterHook(struct PGLogicalTxnFilterArgs* args)
 	return res;
 }
 
-/**
- * Filter record corresponding to local (non-distributed) tables
- */
-static bool 
-MtmReplicationRowFilterHook(struct PGLogicalRowFilterArgs* args)
+typedef struct
+{
+	Oid  relid;
+	bool isDistributed;
+} MtmLocalTablesCacheEntry;
+
+static bool
+MtmIsDistributedRelation(Oid relid)
 {
 	bool isDistributed;
 	MtmLock(LW_SHARED);
@@ -3559,9 +5494,67 @@ MtmReplicationRowFilterHook(struct PGLogicalRowFilterArgs* args)
 			Mtm->localTablesHashLoaded = true;
 		}
 	}
-	isDistributed = hash_search(MtmLocalTables, &RelationGetRelid(args->changed_rel), HASH_FIND, NULL) == NULL;
-	MtmUnlock();
-	return isDistributed;
+	isDistributed = hash_search(MtmLocalTables, &relid, HASH_FIND, NULL) == NULL;
+	MtmUnlock();
+	return isDistributed;
+}
+
+/*
+ * Forget cached state of relations which are dropped or altered: their OIDs may be reused.
+ */
+static void
+MtmLocalTablesCacheInvalidate(Datum arg, Oid relid)
+{
+	MtmLastFilteredRelid = InvalidOid;
+	if (MtmLocalTablesCache != NULL) {
+		if (OidIsValid(relid)) {
+			hash_search(MtmLocalTablesCache, &relid, HASH_REMOVE, NULL);
+		} else {
+			/* reset of whole relcache: rebuild cache on next access */
+			MtmLocalTablesCacheVersion = (uint64)-1;
+		}
+	}
+}
+
+/**
+ * Filter record corresponding to local (non-distributed) tables.
+ * This hook is called for each decoded row by each walsender, so to avoid contention on MtmLock 
+ * result is cached in backend-local hash which is reset when set of local tables is changed
+ * (Mtm->localTablesVersion is incremented) or the relation is invalidated.
+ * Rows usually come in runs of the same relation, so the last answer is remembered too
+ * and in the common case the check costs an atomic read and a comparison.
+ */
+static bool 
+MtmReplicationRowFilterHook(struct PGLogicalRowFilterArgs* args)
+{
+	Oid relid = RelationGetRelid(args->changed_rel);
+	uint64 version = pg_atomic_read_u64(&Mtm->localTablesVersion);
+	MtmLocalTablesCacheEntry* entry;
+	bool found;
+
+	if (relid == MtmLastFilteredRelid && version == MtmLocalTablesCacheVersion) {
+		return MtmLastFilteredIsDistributed;
+	}
+	if (MtmLocalTablesCache == NULL || MtmLocalTablesCacheVersion != version) { 
+		HASHCTL info;
+		if (MtmLocalTablesCache != NULL) { 
+			hash_destroy(MtmLocalTablesCache);
+		} else { 
+			CacheRegisterRelcacheCallback(MtmLocalTablesCacheInvalidate, (Datum)0);
+		}
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(Oid);
+		info.entrysize = sizeof(MtmLocalTablesCacheEntry);
+		MtmLocalTablesCache = hash_create("MtmLocalTablesCache", 64, &info, HASH_ELEM | HASH_BLOBS);
+		MtmLocalTablesCacheVersion = version;
+	}
+	entry = (MtmLocalTablesCacheEntry*)hash_search(MtmLocalTablesCache, &relid, HASH_ENTER, &found);
+	if (!found) { 
+		entry->isDistributed = MtmIsDistributedRelation(relid);
+	}
+	MtmLastFilteredRelid = relid;
+	MtmLastFilteredIsDistributed = entry->isDistributed;
+	return entry->isDistributed;
 }
 
 /*
@@ -3571,8 +5564,9 @@ MtmReplicationRowFilterHook(struct PGLogicalRowFilterArgs* args)
  * It is more efficient to filter records at senders size (done by MtmReplicationTxnFilterHook) to avoid sending useless data through network. 
  * But asynchronous nature of logical replications makes it not possible to guarantee (at least I failed to do it)
  * that replica do not receive deteriorated data.
+ * GID of prepared transaction is returned in *gidp (empty string for plain commits).
  */
-bool MtmFilterTransaction(char* record, int size)
+bool MtmFilterTransaction(char* record, int size, char const** gidp)
 {
 	StringInfoData s;
 	uint8       event;
@@ -3613,8 +5607,11 @@ bool MtmFilterTransaction(char* record, int size)
 
     switch (event)
     {
-	  case PGLOGICAL_PREPARE:
 	  case PGLOGICAL_PRECOMMIT_PREPARED:
+		pq_getmsgint(&s, 4); /* number of transactions, the first one is logged */
+		gid = pq_getmsgstring(&s);
+		break;
+	  case PGLOGICAL_PREPARE:
 	  case PGLOGICAL_ABORT_PREPARED:
 		gid = pq_getmsgstring(&s);
 		break;
@@ -3643,6 +5640,7 @@ bool MtmFilterTransaction(char* record, int size)
 				 gid, replication_node, end_lsn, event, origin_node, origin_lsn, restart_lsn);
 	}
 
+	*gidp = gid;
 	return duplicate;
 }
 
@@ -3748,9 +5746,12 @@ mtm_add_node(PG_FUNCTION_ARGS)
 		}
 
 		Mtm->nodes[nodeId].transDelay = 0;
+		memset(Mtm->nodes[nodeId].voteLatency, 0, sizeof(Mtm->nodes[nodeId].voteLatency));
+		Mtm->nodes[nodeId].nVoteLatencySamples = 0;
 		Mtm->nodes[nodeId].lastStatusChangeTime = MtmGetSystemTime();
 		Mtm->nodes[nodeId].flushPos = 0;
 		Mtm->nodes[nodeId].oldestSnapshot = 0;
+		Mtm->nodes[nodeId].recoveryFence = INVALID_LSN;
 
 		BIT_SET(Mtm->disabledNodeMask, nodeId);
 		Mtm->nConfigChanges += 1;
@@ -3806,6 +5807,71 @@ mtm_get_last_csn(PG_FUNCTION_ARGS)
 	PG_RETURN_INT64(Mtm->lastCsn);
 }
 
+/*
+ * Return token of the last distributed transaction committed by this session.
+ * Passing it to mtm.wait_for_csn at other node makes this node to see results of the transaction.
+ */
+Datum
+mtm_get_commit_token(PG_FUNCTION_ARGS)
+{
+	TupleDesc desc;
+	Datum values[Natts_mtm_commit_token];
+	bool  nulls[Natts_mtm_commit_token] = {false};
+
+	if (MtmLastCommitToken.node == 0) {
+		PG_RETURN_NULL();
+	}
+	get_call_result_type(fcinfo, NULL, &desc);
+	values[0] = Int32GetDatum(MtmLastCommitToken.node);
+	values[1] = Int64GetDatum(MtmLastCommitToken.csn);
+	values[2] = Int64GetDatum(MtmLastCommitToken.lsn);
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(BlessTupleDesc(desc), values, nulls)));
+}
+
+/*
+ * Wait until transaction identified by commit token is applied at this node.
+ * CSN is not enough to locate the transaction in the stream received from its origin, so token also contains
+ * LSN of commit record at origin, which is compared with flushPos of the origin: it is advanced only after
+ * commit is applied and flushed here, unlike restartLSN which tracks received records.
+ * Returns false if timeout (msec, 0 - infinite) is expired.
+ */
+Datum
+mtm_wait_for_csn(PG_FUNCTION_ARGS)
+{
+	HeapTupleHeader token = PG_GETARG_HEAPTUPLEHEADER(0);
+	int timeout = PG_GETARG_INT32(1);
+	bool isnull[Natts_mtm_commit_token];
+	int node = DatumGetInt32(GetAttributeByNum(token, 1, &isnull[0]));
+	csn_t csn = DatumGetInt64(GetAttributeByNum(token, 2, &isnull[1]));
+	lsn_t lsn = DatumGetInt64(GetAttributeByNum(token, 3, &isnull[2]));
+	timestamp_t deadline = MtmGetSystemTime() + MSEC_TO_USEC(timeout);
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	timestamp_t start;
+
+	if (isnull[0] || isnull[1] || isnull[2] || node < 1 || node > Mtm->nAllNodes) {
+		elog(ERROR, "Invalid commit token");
+	}
+	/* Snapshots assigned after this point will include the transaction */
+	MtmSyncClock(csn);
+
+	if (node != MtmNodeId) {
+		start = MtmWaitStart(MTM_WAIT_COMMIT_APPLY);
+		while (Mtm->nodes[node-1].flushPos < lsn) {
+			if (timeout != 0 && MtmGetSystemTime() >= deadline) {
+				MtmWaitEnd(MTM_WAIT_COMMIT_APPLY, start);
+				PG_RETURN_BOOL(false);
+			}
+			MtmSleep(delay);
+			if (delay*2 <= MAX_WAIT_TIMEOUT) {
+				delay *= 2;
+			}
+			CHECK_FOR_INTERRUPTS();
+		}
+		MtmWaitEnd(MTM_WAIT_COMMIT_APPLY, start);
+	}
+	PG_RETURN_BOOL(true);
+}
+
 Datum
 mtm_get_csn(PG_FUNCTION_ARGS)
 {
@@ -3873,11 +5939,399 @@ mtm_get_nodes_state(PG_FUNCTION_ARGS)
 	usrfctx->values[13] = Int64GetDatum(Mtm->nodes[usrfctx->nodeId-1].connectivityMask);
 	usrfctx->values[14] = BoolGetDatum(BIT_CHECK(Mtm->stalledNodeMask, usrfctx->nodeId-1));
 	usrfctx->values[15] = BoolGetDatum(BIT_CHECK(Mtm->stoppedNodeMask, usrfctx->nodeId-1));
+	/* apply pool statistic is available only for local node */
+	if (usrfctx->nodeId == MtmNodeId) {
+		usrfctx->values[16] = Int32GetDatum(pg_atomic_read_u32(&Mtm->pool.nWorkers));
+		usrfctx->values[17] = Int32GetDatum(Mtm->pool.peakWorkers);
+		usrfctx->values[18] = Int32GetDatum(pg_atomic_read_u32(&Mtm->pool.nRetiredWorkers));
+		usrfctx->nulls[16] = usrfctx->nulls[17] = usrfctx->nulls[18] = false;
+	} else {
+		usrfctx->nulls[16] = usrfctx->nulls[17] = usrfctx->nulls[18] = true;
+	}
+	/* depth of sub-queue of changes received from this node */
+	usrfctx->values[19] = Int32GetDatum(BgwPoolGetSubQueuePending(&Mtm->pool, usrfctx->nodeId-1));
+	usrfctx->values[20] = Int64GetDatum(BgwPoolGetSubQueueSize(&Mtm->pool, usrfctx->nodeId-1));
+	/* percentiles of PREPARED vote round-trip (microseconds), NULL until enough samples are collected */
+	MtmLock(LW_SHARED);
+	usrfctx->values[21] = Int64GetDatum(MtmGetVoteLatency(usrfctx->nodeId, 50));
+	usrfctx->values[22] = Int64GetDatum(MtmGetVoteLatency(usrfctx->nodeId, 99));
+	MtmUnlock();
+	usrfctx->nulls[21] = usrfctx->nulls[22] = DatumGetInt64(usrfctx->values[21]) == 0;
+	usrfctx->nodeId += 1;
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, usrfctx->values, usrfctx->nulls)));
+}
+
+Datum
+mtm_get_apply_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext* funcctx;
+	MtmGetNodeStateCtx* usrfctx;
+	MemoryContext oldcontext;
+	MtmApplyStats* stats;
+	Datum history[MTM_STATS_HISTORY];
+	int i, n, phase;
+
+    if (SRF_IS_FIRSTCALL()) { 
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);       
+		usrfctx = (MtmGetNodeStateCtx*)palloc(sizeof(MtmGetNodeStateCtx));
+		get_call_result_type(fcinfo, NULL, &usrfctx->desc);
+		usrfctx->nodeId = 1;
+		memset(usrfctx->nulls, false, sizeof(usrfctx->nulls));
+		funcctx->user_fctx = usrfctx;
+		MemoryContextSwitchTo(oldcontext);      
+    }
+    funcctx = SRF_PERCALL_SETUP();	
+	usrfctx = (MtmGetNodeStateCtx*)funcctx->user_fctx;
+	if (usrfctx->nodeId > Mtm->nAllNodes) {
+		SRF_RETURN_DONE(funcctx);      
+	}
+	stats = &Mtm->nodes[usrfctx->nodeId-1].stats;
+	usrfctx->values[0] = Int32GetDatum(usrfctx->nodeId);
+	usrfctx->values[1] = Int64GetDatum(pg_atomic_read_u64(&stats->rowsApplied));
+	usrfctx->values[2] = Int64GetDatum(pg_atomic_read_u64(&stats->bytesApplied));
+	usrfctx->values[3] = Int64GetDatum(stats->rowsPerSec);
+	usrfctx->values[4] = Int64GetDatum(stats->bytesPerSec);
+	/* queue depth samples from the oldest to the most recent one */
+	n = Min(stats->queueDepthPos, MTM_STATS_HISTORY);
+	for (i = 0; i < n; i++) { 
+		history[i] = Int32GetDatum(stats->queueDepth[(stats->queueDepthPos - n + i) % MTM_STATS_HISTORY]);
+	}
+	usrfctx->values[5] = PointerGetDatum(construct_array(history, n, INT4OID, sizeof(int32), true, 'i'));
+	usrfctx->values[6] = Int64GetDatum(pg_atomic_read_u64(&stats->spillBytes));
+	usrfctx->values[7] = Int64GetDatum(pg_atomic_read_u64(&stats->conflicts));
+	usrfctx->values[8] = Int64GetDatum(pg_atomic_read_u64(&stats->deadlocks));
+	usrfctx->values[9] = Int64GetDatum(pg_atomic_read_u64(&stats->phaseCount[MTM_PHASE_PREPARE]));
+	/* average duration of 2PC phases in microseconds, NULL if there were no such transactions */
+	for (phase = 0; phase < MTM_N_PHASES; phase++) { 
+		uint64 count = pg_atomic_read_u64(&stats->phaseCount[phase]);
+		usrfctx->values[10 + phase] = Int64GetDatum(count ? pg_atomic_read_u64(&stats->phaseTime[phase])/count : 0);
+		usrfctx->nulls[10 + phase] = count == 0;
+	}
 	usrfctx->nodeId += 1;
 
 	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, usrfctx->values, usrfctx->nulls)));
 }
 
+Datum
+mtm_get_wait_stats(PG_FUNCTION_ARGS)
+{
+    FuncCallContext* funcctx;
+	Datum values[Natts_mtm_wait_stats];
+	bool  nulls[Natts_mtm_wait_stats] = {false};
+	int   event;
+
+    if (SRF_IS_FIRSTCALL()) { 
+		MemoryContext oldcontext;
+		TupleDesc desc;
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);       
+		get_call_result_type(fcinfo, NULL, &desc);
+		funcctx->tuple_desc = desc;
+		MemoryContextSwitchTo(oldcontext);      
+    }
+    funcctx = SRF_PERCALL_SETUP();	
+	event = (int)funcctx->call_cntr;
+	if (event >= MTM_N_WAIT_EVENTS) {
+		SRF_RETURN_DONE(funcctx);      
+	}
+	values[0] = CStringGetTextDatum(MtmWaitEventNames[event]);
+	values[1] = Int64GetDatum(pg_atomic_read_u64(&Mtm->waitCount[event]));
+	values[2] = Int64GetDatum(pg_atomic_read_u64(&Mtm->waitTime[event]));
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(funcctx->tuple_desc, values, nulls)));
+}
+
+/*
+ * Convert system time (microseconds since Unix epoch) to timestamp with time zone
+ */
+static TimestampTz MtmSystemTimeToTimestampTz(timestamp_t t)
+{
+	TimestampTz time = time_t_to_timestamptz(t/USECS_PER_SEC);
+#ifdef HAVE_INT64_TIMESTAMP
+	time += t % USECS_PER_SEC;
+#else
+	time += (double)(t % USECS_PER_SEC)/USECS_PER_SEC;
+#endif
+	return time;
+}
+
+typedef struct
+{
+	int            nEvents;
+	int            curr;
+	MtmTraceEvent* events;
+	TupleDesc      desc;
+} MtmGetTraceCtx;
+
+Datum
+mtm_get_trace(PG_FUNCTION_ARGS)
+{
+    FuncCallContext* funcctx;
+	MtmGetTraceCtx* usrfctx;
+	MtmTraceEvent* ev;
+    Datum     values[Natts_mtm_trace];
+    bool      nulls[Natts_mtm_trace] = {false};
+
+    if (SRF_IS_FIRSTCALL()) { 
+		MemoryContext oldcontext;
+		uint64 head, pos;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);       
+		usrfctx = (MtmGetTraceCtx*)palloc(sizeof(MtmGetTraceCtx));
+		get_call_result_type(fcinfo, NULL, &usrfctx->desc);
+		usrfctx->events = (MtmTraceEvent*)palloc(sizeof(MtmTraceEvent)*MTM_TRACE_BUFFER_SIZE);
+		usrfctx->nEvents = 0;
+		usrfctx->curr = 0;
+		/* copy snapshot of trace buffer from the oldest event to the most recent one */
+		head = pg_atomic_read_u64(&Mtm->traceHead);
+		for (pos = head > MTM_TRACE_BUFFER_SIZE ? head - MTM_TRACE_BUFFER_SIZE : 0; pos < head; pos++) { 
+			if (MtmReadTraceEvent(pos, &usrfctx->events[usrfctx->nEvents])) { 
+				usrfctx->nEvents += 1;
+			}
+		}
+		funcctx->user_fctx = usrfctx;
+		MemoryContextSwitchTo(oldcontext);      
+    }
+    funcctx = SRF_PERCALL_SETUP();	
+	usrfctx = (MtmGetTraceCtx*)funcctx->user_fctx;
+	if (usrfctx->curr == usrfctx->nEvents) {
+		SRF_RETURN_DONE(funcctx);      
+	}
+	ev = &usrfctx->events[usrfctx->curr++];
+	values[0] = CStringGetTextDatum(ev->gid);
+	values[1] = CStringGetTextDatum(ev->event);
+	values[2] = TimestampTzGetDatum(MtmSystemTimeToTimestampTz(ev->time));
+	values[3] = Int32GetDatum(ev->pid);
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, values, nulls)));
+}
+
+/* Stage of commit profile: interval between two events */
+typedef struct
+{
+	int         node;     /* node at which stage is performed */
+	int         replica;  /* replica to which this stage belongs, 0 for common stages of coordinator */
+	char const* stage;
+	timestamp_t start;    /* system time of the node */
+	timestamp_t duration;
+} MtmProfileStage;
+
+typedef struct
+{
+	int              nStages;
+	int              curr;
+	MtmProfileStage* stages;
+	TupleDesc        desc;
+} MtmGetCommitProfileCtx;
+
+/*
+ * Collect commit path events of transaction from this and all other live nodes.
+ * Returns number of events placed in events[MTM_PROFILE_MAX_EVENTS].
+ */
+static int MtmCollectCommitEvents(char const* gid, MtmProfileEvent* events)
+{
+	MtmArbiterMessage msg;
+	MtmTraceEvent ev;
+	uint64 head, pos;
+	uint32 request;
+	nodemask_t liveMask;
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	timestamp_t start;
+	int nEvents = 0;
+	int i;
+
+	head = pg_atomic_read_u64(&Mtm->traceHead);
+	for (pos = head > MTM_TRACE_BUFFER_SIZE ? head - MTM_TRACE_BUFFER_SIZE : 0; pos < head && nEvents < MTM_PROFILE_MAX_EVENTS; pos++) { 
+		if (MtmReadTraceEvent(pos, &ev) && ev.code >= 0 && strcmp(ev.gid, gid) == 0) { 
+			events[nEvents].origin = MtmNodeId;
+			events[nEvents].code = ev.code;
+			events[nEvents].node = ev.node;
+			events[nEvents].time = ev.time;
+			nEvents += 1;
+		}
+	}
+
+	MtmLock(LW_EXCLUSIVE);
+	/* Only one request is collected at a time; owner which didn't finish it in time is ousted */
+	while (Mtm->profileOwner != 0 && MtmGetSystemTime() < Mtm->profileDeadline) { 
+		MtmUnlock();
+		start = MtmWaitStart(MTM_WAIT_COMMIT_PROFILE);
+		MtmSleep(delay);
+		MtmWaitEnd(MTM_WAIT_COMMIT_PROFILE, start);
+		if (delay*2 <= MAX_WAIT_TIMEOUT) { 
+			delay *= 2;
+		}
+		MtmLock(LW_EXCLUSIVE);
+	}
+	request = ++Mtm->profileRequest;
+	Mtm->profileOwner = MyProcPid;
+	Mtm->profileDeadline = MtmGetSystemTime() + MSEC_TO_USEC(MtmHeartbeatRecvTimeout);
+	Mtm->profileRespondedMask = 0;
+	Mtm->nProfileEvents = 0;
+	liveMask = NODEMASK_ALL(Mtm->nAllNodes) & ~Mtm->disabledNodeMask & ~((nodemask_t)1 << (MtmNodeId-1));
+
+	memset(&msg, 0, sizeof(msg));
+	msg.code = MSG_TRACE_REQUEST;
+	msg.sxid = request;
+	msg.disabledNodeMask = Mtm->disabledNodeMask;
+	msg.connectivityMask = SELF_CONNECTIVITY_MASK;
+	msg.oldestSnapshot = Mtm->nodes[MtmNodeId-1].oldestSnapshot;
+	strlcpy(msg.gid, gid, sizeof(msg.gid));
+	for (i = 0; i < Mtm->nAllNodes; i++) { 
+		if (BIT_CHECK(liveMask, i)) { 
+			msg.node = i+1;
+			MtmSendMessage(&msg);
+		}
+	}
+
+	delay = MIN_WAIT_TIMEOUT;
+	while ((liveMask & ~Mtm->profileRespondedMask) != 0 && Mtm->profileRequest == request
+		   && MtmGetSystemTime() < Mtm->profileDeadline) 
+	{ 
+		MtmUnlock();
+		start = MtmWaitStart(MTM_WAIT_COMMIT_PROFILE);
+		MtmSleep(delay);
+		MtmWaitEnd(MTM_WAIT_COMMIT_PROFILE, start);
+		if (delay*2 <= MAX_WAIT_TIMEOUT) { 
+			delay *= 2;
+		}
+		MtmLock(LW_EXCLUSIVE);
+	}
+	if (Mtm->profileRequest == request) { 
+		for (i = 0; i < Mtm->nProfileEvents && nEvents < MTM_PROFILE_MAX_EVENTS; i++) { 
+			events[nEvents++] = Mtm->profileEvents[i];
+		}
+		if ((liveMask & ~Mtm->profileRespondedMask) != 0) { 
+			elog(WARNING, "Commit profile of transaction %s is incomplete: nodes %llx have not responded", 
+				 gid, (long long)(liveMask & ~Mtm->profileRespondedMask));
+		}
+		Mtm->profileOwner = 0;
+	} else { 
+		elog(WARNING, "Commit profile of transaction %s is incomplete: request is taken over by other backend", gid);
+	}
+	MtmUnlock();
+	return nEvents;
+}
+
+/*
+ * Build stages of commit profile from events of transaction.
+ * Returns number of stages placed in stages, which should have room for 3 + 8*(nAllNodes-1) elements.
+ */
+static int MtmBuildCommitProfile(MtmProfileEvent const* events, int nEvents, MtmProfileStage* stages)
+{
+	int nNodes = Mtm->nAllNodes;
+	/* times[(origin-1)*MTM_N_COMMIT_EVENTS*(nNodes+1) + code*(nNodes+1) + node]: time of the first event, 0 if none */
+	timestamp_t* times = (timestamp_t*)palloc0(sizeof(timestamp_t)*nNodes*MTM_N_COMMIT_EVENTS*(nNodes+1));
+	timestamp_t lastVote = 0;
+	int coordinator = 0;
+	int nStages = 0;
+	int i, r;
+
+#define EVENT_TIME(origin, code, node) times[((origin)-1)*MTM_N_COMMIT_EVENTS*(nNodes+1) + (code)*(nNodes+1) + (node)]
+#define ADD_STAGE(_node, _replica, _stage, _start, _end) \
+	do { \
+		if ((_start) != 0 && (_end) != 0) { \
+			stages[nStages].node = _node; \
+			stages[nStages].replica = _replica; \
+			stages[nStages].stage = _stage; \
+			stages[nStages].start = _start; \
+			stages[nStages].duration = (_end) - (_start); \
+			nStages += 1; \
+		} \
+	} while (0)
+
+	for (i = 0; i < nEvents; i++) { 
+		MtmProfileEvent const* ev = &events[i];
+		if (ev->origin < 1 || ev->origin > nNodes || ev->node < 0 || ev->node > nNodes) { 
+			continue;
+		}
+		if (EVENT_TIME(ev->origin, ev->code, ev->node) == 0) { 
+			EVENT_TIME(ev->origin, ev->code, ev->node) = ev->time;
+		}
+		if (ev->code == MTM_EV_BEGIN) { 
+			coordinator = ev->origin;
+		}
+	}
+	if (coordinator != 0) { 
+		int c = coordinator;
+		ADD_STAGE(c, 0, "execute", EVENT_TIME(c, MTM_EV_BEGIN, 0), EVENT_TIME(c, MTM_EV_EXECUTED, 0));
+		ADD_STAGE(c, 0, "prepare", EVENT_TIME(c, MTM_EV_EXECUTED, 0), EVENT_TIME(c, MTM_EV_PREPARED, 0));
+		for (r = 1; r <= nNodes; r++) { 
+			timestamp_t decoded = EVENT_TIME(c, MTM_EV_DECODED, r);
+			timestamp_t voteReceived = EVENT_TIME(c, MTM_EV_VOTE_RECEIVED, r);
+			timestamp_t receiveBegin = EVENT_TIME(r, MTM_EV_RECEIVE_BEGIN, c);
+			timestamp_t voteSent = EVENT_TIME(r, MTM_EV_VOTE_SENT, c);
+			if (r == c) { 
+				continue;
+			}
+			ADD_STAGE(c, r, "decode", EVENT_TIME(c, MTM_EV_PREPARED, 0), decoded);
+			ADD_STAGE(c, r, "send", decoded, EVENT_TIME(c, MTM_EV_SENT, r));
+			ADD_STAGE(r, r, "receive", receiveBegin, EVENT_TIME(r, MTM_EV_RECEIVED, c));
+			ADD_STAGE(r, r, "pool wait", EVENT_TIME(r, MTM_EV_RECEIVED, c), EVENT_TIME(r, MTM_EV_APPLY_BEGIN, c));
+			ADD_STAGE(r, r, "apply", EVENT_TIME(r, MTM_EV_APPLY_BEGIN, c), EVENT_TIME(r, MTM_EV_APPLIED, c));
+			ADD_STAGE(r, r, "prepare", EVENT_TIME(r, MTM_EV_APPLIED, c), EVENT_TIME(r, MTM_EV_REPLICA_PREPARED, c));
+			ADD_STAGE(r, r, "vote send", EVENT_TIME(r, MTM_EV_REPLICA_PREPARED, c), voteSent);
+			if (decoded != 0 && voteReceived != 0 && receiveBegin != 0 && voteSent != 0) { 
+				/* delivery of BEGIN to replica plus delivery of its vote: round trip at coordinator minus time spent at replica */
+				ADD_STAGE(c, r, "network", decoded, voteReceived - (voteSent - receiveBegin));
+			}
+			lastVote = Max(lastVote, voteReceived);
+		}
+		ADD_STAGE(c, 0, "vote receive", lastVote, EVENT_TIME(c, MTM_EV_VOTED, 0));
+	}
+#undef EVENT_TIME
+#undef ADD_STAGE
+	pfree(times);
+	return nStages;
+}
+
+Datum
+mtm_get_commit_profile(PG_FUNCTION_ARGS)
+{
+    FuncCallContext* funcctx;
+	MtmGetCommitProfileCtx* usrfctx;
+	MtmProfileStage* st;
+    Datum     values[Natts_mtm_commit_profile];
+    bool      nulls[Natts_mtm_commit_profile] = {false};
+
+    if (SRF_IS_FIRSTCALL()) { 
+		MemoryContext oldcontext;
+		char* gid = text_to_cstring(PG_GETARG_TEXT_PP(0));
+		MtmProfileEvent* events;
+		int nEvents;
+
+		funcctx = SRF_FIRSTCALL_INIT();
+		oldcontext = MemoryContextSwitchTo(funcctx->multi_call_memory_ctx);       
+		usrfctx = (MtmGetCommitProfileCtx*)palloc(sizeof(MtmGetCommitProfileCtx));
+		get_call_result_type(fcinfo, NULL, &usrfctx->desc);
+		events = (MtmProfileEvent*)palloc(sizeof(MtmProfileEvent)*MTM_PROFILE_MAX_EVENTS);
+		nEvents = MtmCollectCommitEvents(gid, events);
+		usrfctx->stages = (MtmProfileStage*)palloc(sizeof(MtmProfileStage)*(3 + 8*Mtm->nAllNodes));
+		usrfctx->nStages = MtmBuildCommitProfile(events, nEvents, usrfctx->stages);
+		usrfctx->curr = 0;
+		pfree(events);
+		funcctx->user_fctx = usrfctx;
+		MemoryContextSwitchTo(oldcontext);      
+    }
+    funcctx = SRF_PERCALL_SETUP();	
+	usrfctx = (MtmGetCommitProfileCtx*)funcctx->user_fctx;
+	if (usrfctx->curr == usrfctx->nStages) {
+		SRF_RETURN_DONE(funcctx);      
+	}
+	st = &usrfctx->stages[usrfctx->curr++];
+	values[0] = Int32GetDatum(st->node);
+	values[1] = Int32GetDatum(st->replica);
+	nulls[1] = st->replica == 0;
+	values[2] = CStringGetTextDatum(st->stage);
+	values[3] = TimestampTzGetDatum(MtmSystemTimeToTimestampTz(st->start));
+	values[4] = Int64GetDatum(st->duration);
+
+	SRF_RETURN_NEXT(funcctx, HeapTupleGetDatum(heap_form_tuple(usrfctx->desc, values, nulls)));
+}
+
 Datum
 mtm_get_trans_by_gid(PG_FUNCTION_ARGS)
 {
@@ -3976,11 +6430,11 @@ mtm_get_cluster_state(PG_FUNCTION_ARGS)
 	values[3] = Int64GetDatum(Mtm->nodeLockerMask);
 	values[4] = Int32GetDatum(Mtm->nLiveNodes);
 	values[5] = Int32GetDatum(Mtm->nAllNodes);
-	values[6] = Int32GetDatum((int)Mtm->pool.active);
-	values[7] = Int32GetDatum((int)Mtm->pool.pending);
+	values[6] = Int32GetDatum((int)pg_atomic_read_u32(&Mtm->pool.active));
+	values[7] = Int32GetDatum((int)pg_atomic_read_u32(&Mtm->pool.pending));
 	values[8] = Int64GetDatum(BgwPoolGetQueueSize(&Mtm->pool));
 	values[9] = Int64GetDatum(Mtm->transCount);
-	values[10] = Int64GetDatum(Mtm->timeShift);
+	values[10] = Int64GetDatum(Max((int64)(pg_atomic_read_u64(&Mtm->csn) - MtmGetSystemTime()), 0)); /* lead of logical clock */
 	values[11] = Int32GetDatum(Mtm->recoverySlot);
 	values[12] = Int64GetDatum(hash_get_num_entries(MtmXid2State));
 	values[13] = Int64GetDatum(hash_get_num_entries(MtmGid2State));
@@ -3988,6 +6442,7 @@ mtm_get_cluster_state(PG_FUNCTION_ARGS)
 	values[15] = Int32GetDatum(Mtm->nConfigChanges);
 	values[16] = Int64GetDatum(Mtm->stalledNodeMask);
 	values[17] = Int64GetDatum(Mtm->stoppedNodeMask);
+	values[18] = Int64GetDatum(pg_atomic_read_u64(&Mtm->sendQueueFull));
 
 	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(desc, values, nulls)));
 }
@@ -4115,80 +6570,170 @@ Datum mtm_make_table_local(PG_FUNCTION_ARGS)
 		heap_close(rel, RowExclusiveLock);
 
 		MtmTx.containsDML = true;
+		MtmTx.isFastCommit = false;
+		MtmTx.isHomeLocal = false;
 	}
 	return false;
 }
 
-Datum mtm_dump_lock_graph(PG_FUNCTION_ARGS)
+/*
+ * Home tables are tables with AFTER INSERT OR UPDATE OR DELETE FOR EACH ROW trigger "mtm.home_check(column)",
+ * where integer column contains ID of the node owning the row. Rows can be changed only at their home node,
+ * so transaction which changes only rows of home tables is home-local: it is committed without waiting for
+ * votes of other nodes.
+ * Returns number of home column or InvalidAttrNumber if relation is not a home table.
+ */
+AttrNumber MtmGetHomeColumn(Relation rel)
 {
-	StringInfo s = makeStringInfo();
+	static Oid homeCheckFunc = InvalidOid;
+	Oid noArgs[1];
+	TriggerDesc* trigdesc = rel->trigdesc;
 	int i;
-	for (i = 0; i < Mtm->nAllNodes; i++)
-	{
-		size_t lockGraphSize;
-		char  *lockGraphData;
-		MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
-		lockGraphSize = Mtm->nodes[i].lockGraphUsed;
-		lockGraphData = palloc(lockGraphSize);
-		memcpy(lockGraphData, Mtm->nodes[i].lockGraphData, lockGraphSize);
-		MtmUnlockNode(i + 1 + MtmMaxNodes);
 
-		if (lockGraphData) {
-			GlobalTransactionId *gtid = (GlobalTransactionId *) lockGraphData;
-			GlobalTransactionId *last = (GlobalTransactionId *) (lockGraphData + lockGraphSize);
-			appendStringInfo(s, "node-%d lock graph: ", i+1);
-			while (gtid != last) { 
-				GlobalTransactionId *src = gtid++;
-				appendStringInfo(s, "%d:%llu -> ", src->node, (long64)src->xid);
-				while (gtid->node != 0) {
-					GlobalTransactionId *dst = gtid++;
-					appendStringInfo(s, "%d:%llu, ", dst->node, (long64)dst->xid);
-				}
-				gtid += 1;
+	if (trigdesc == NULL) { 
+		return InvalidAttrNumber;
+	}
+	if (!OidIsValid(homeCheckFunc)) { 
+		homeCheckFunc = LookupFuncName(list_make2(makeString(MULTIMASTER_SCHEMA_NAME), makeString(MULTIMASTER_HOME_CHECK_FUNCTION)), 0, noArgs, true);
+		if (!OidIsValid(homeCheckFunc)) { 
+			return InvalidAttrNumber;
+		}
+	}
+	for (i = 0; i < trigdesc->numtriggers; i++) { 
+		Trigger* trigger = &trigdesc->triggers[i];
+		if (trigger->tgfoid == homeCheckFunc 
+			&& trigger->tgenabled != TRIGGER_DISABLED && trigger->tgenabled != TRIGGER_FIRES_ON_REPLICA 
+			&& trigger->tgnargs == 1) 
+		{
+			AttrNumber attnum = get_attnum(RelationGetRelid(rel), trigger->tgargs[0]);
+			if (attnum > 0 && RelationGetDescr(rel)->attrs[attnum-1]->atttypid == INT4OID) { 
+				return attnum;
 			}
-			appendStringInfo(s, "\n");
 		}
 	}
-	return CStringGetTextDatum(s->data);
+	return InvalidAttrNumber;
 }
 
-Datum mtm_inject_2pc_error(PG_FUNCTION_ARGS)
+bool MtmIsHomeTuple(Relation rel, AttrNumber attnum, HeapTuple tuple, int nodeId)
 {
-	Mtm->inject2PCError = PG_GETARG_INT32(0);
-    PG_RETURN_VOID();
+	bool isnull;
+	Datum value = heap_getattr(tuple, attnum, RelationGetDescr(rel), &isnull);
+	return !isnull && DatumGetInt32(value) == nodeId;
 }
 
 /*
- * -------------------------------------------
- * Broadcast utulity statements
- * -------------------------------------------
+ * Trigger function of home tables: rows may be changed only by transactions coordinated by the node owning them,
+ * and the owner of a row can not be changed. Otherwise home-local transaction of the owner could conflict with
+ * transaction of other node without any of them waiting for the other one, and replicas would diverge.
  */
+Datum mtm_home_check(PG_FUNCTION_ARGS)
+{
+	TriggerData* trigdata = (TriggerData*)fcinfo->context;
+	Relation rel;
+	AttrNumber attnum;
+
+	if (!CALLED_AS_TRIGGER(fcinfo) 
+		|| !TRIGGER_FIRED_AFTER(trigdata->tg_event) 
+		|| !TRIGGER_FIRED_FOR_ROW(trigdata->tg_event)
+		|| trigdata->tg_trigger->tgdeferrable)
+	{
+		elog(ERROR, "mtm.home_check should be used as not deferrable AFTER ... FOR EACH ROW trigger");
+	}
+	rel = trigdata->tg_relation;
+	if (trigdata->tg_trigger->tgnargs != 1
+		|| (attnum = get_attnum(RelationGetRelid(rel), trigdata->tg_trigger->tgargs[0])) <= 0
+		|| RelationGetDescr(rel)->attrs[attnum-1]->atttypid != INT4OID)
+	{
+		elog(ERROR, "mtm.home_check expects name of integer column containing home node ID as argument");
+	}
+	if (!MtmTx.isReplicated) { 
+		if (!MtmIsHomeTuple(rel, attnum, trigdata->tg_trigtuple, MtmNodeId)
+			|| (TRIGGER_FIRED_BY_UPDATE(trigdata->tg_event) && !MtmIsHomeTuple(rel, attnum, trigdata->tg_newtuple, MtmNodeId)))
+		{
+			elog(ERROR, "Row of home table %s is not owned by node %d: it can be changed only at its home node",
+				 RelationGetRelationName(rel), MtmNodeId);
+		}
+	}
+	return PointerGetDatum(NULL);
+}
 
 /*
- * Execute statement with specified parameters and check its result
+ * Inserts in fast commit tables are considered as not conflicting with other transactions,
+ * so transaction performing only such inserts is committed without precommit phase.
+ * Price is that these inserts can become visible at replicas in already taken snapshot.
  */
-static bool MtmRunUtilityStmt(PGconn* conn, char const* sql, char **errmsg)
+Datum mtm_make_table_fast_commit(PG_FUNCTION_ARGS)
 {
-	PGresult *result = PQexec(conn, sql);
-	int status = PQresultStatus(result);
+	Oid	reloid = PG_GETARG_OID(0);
+	RangeVar   *rv;
+	Relation	rel;
+	HeapTuple	tup;
+	Datum		values[Natts_mtm_local_tables];
+	bool		nulls[Natts_mtm_local_tables];
+
+	MtmMakeRelationFastCommit(reloid);
+	
+	rv = makeRangeVar(MULTIMASTER_SCHEMA_NAME, MULTIMASTER_FAST_COMMIT_TABLES_TABLE, -1);
+	rel = heap_openrv(rv, RowExclusiveLock);
+	if (rel != NULL) {
+		memset(nulls, false, sizeof(nulls));
+		values[Anum_mtm_local_tables_rel_schema - 1] = CStringGetTextDatum(get_namespace_name(get_rel_namespace(reloid)));
+		values[Anum_mtm_local_tables_rel_name - 1] = CStringGetTextDatum(get_rel_name(reloid));
+
+		tup = heap_form_tuple(RelationGetDescr(rel), values, nulls);
+		simple_heap_insert(rel, tup);
+		CatalogUpdateIndexes(rel, tup);
+		heap_freetuple(tup);
+		heap_close(rel, RowExclusiveLock);
 
-	bool ret = status == PGRES_COMMAND_OK || status == PGRES_TUPLES_OK;
+		MtmTx.containsDML = true;
+		MtmTx.isFastCommit = false;
+		MtmTx.isHomeLocal = false;
+	}
+	PG_RETURN_VOID();
+}
 
-	if (!ret) {
-		char *errstr = PQresultErrorMessage(result);
-		int errlen = strlen(errstr);
-		if (errlen > 9) { 
-			*errmsg = palloc0(errlen);
+Datum mtm_dump_lock_graph(PG_FUNCTION_ARGS)
+{
+	StringInfo s = makeStringInfo();
+	int i, j;
+	for (i = 0; i < Mtm->nAllNodes; i++)
+	{
+		MtmLockEdge* edges;
+		int nEdges;
+		timestamp_t version;
+		MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
+		nEdges = Mtm->nodes[i].lockGraphUsed/sizeof(MtmLockEdge);
+		version = Mtm->nodes[i].lockGraphVersion;
+		edges = (MtmLockEdge*)palloc(Max(nEdges, 1)*sizeof(MtmLockEdge));
+		memcpy(edges, Mtm->nodes[i].lockGraphData, nEdges*sizeof(MtmLockEdge));
+		MtmUnlockNode(i + 1 + MtmMaxNodes);
 
-			/* Strip "ERROR:  " from beginning and "\n" from end of error string */
-			strncpy(*errmsg, errstr + 8, errlen - 1 - 8);
+		if (version != 0) {
+			appendStringInfo(s, "node-%d lock graph (version %lld): ", i+1, version);
+			for (j = 0; j < nEdges; j++) { 
+				appendStringInfo(s, "%d:%llu -> %d:%llu, ", 
+								 edges[j].src.node, (long64)edges[j].src.xid, edges[j].dst.node, (long64)edges[j].dst.xid);
+			}
+			appendStringInfo(s, "\n");
 		}
+		pfree(edges);
 	}
+	return CStringGetTextDatum(s->data);
+}
 
-	PQclear(result);
-	return ret;
+Datum mtm_inject_2pc_error(PG_FUNCTION_ARGS)
+{
+	Mtm->inject2PCError = PG_GETARG_INT32(0);
+    PG_RETURN_VOID();
 }
 
+/*
+ * -------------------------------------------
+ * Broadcast utulity statements
+ * -------------------------------------------
+ */
+
 static void 
 MtmNoticeReceiver(void *i, const PGresult *res)
 {
@@ -4224,106 +6769,212 @@ MtmNoticeReceiver(void *i, const PGresult *res)
 	pfree(stripped_notice);
 }
 
-static void MtmBroadcastUtilityStmt(char const* sql, bool ignoreError)
-{
-	int i = 0;
-	nodemask_t disabledNodeMask = Mtm->disabledNodeMask;
-	int failedNode = -1;
-	char const* errorMsg = NULL;
-	PGconn **conns = palloc0(sizeof(PGconn*)*Mtm->nAllNodes);
-	char* utility_errmsg;
-	int nNodes = Mtm->nAllNodes;
+/*
+ * Persistent connections to cluster nodes used by this backend to broadcast utility statements.
+ * Connection is established on first use and reestablished if it is broken or node was disabled.
+ */
+static PGconn* MtmBroadcastConns[MAX_NODES];
+static int     MtmBroadcastNodes[MAX_NODES]; /* node index passed to MtmNoticeReceiver */
 
-	for (i = 0; i < nNodes; i++) 
+static PGconn* MtmGetBroadcastConnection(int node, bool ignoreError)
+{
+	PGconn* conn = MtmBroadcastConns[node];
+	/* connection might be left in the middle of transaction if broadcast was interrupted by error */
+	if (conn != NULL && (PQstatus(conn) != CONNECTION_OK || PQtransactionStatus(conn) != PQTRANS_IDLE)) 
 	{ 
-		if (!BIT_CHECK(disabledNodeMask, i)) 
+		PQfinish(conn);
+		conn = NULL;
+	}
+	if (conn == NULL) 
+	{ 
+		conn = PQconnectdb_safe(psprintf("%s application_name=%s", Mtm->nodes[node].con.connStr, MULTIMASTER_BROADCAST_SERVICE));
+		if (PQstatus(conn) != CONNECTION_OK)
 		{
-			conns[i] = PQconnectdb_safe(psprintf("%s application_name=%s", Mtm->nodes[i].con.connStr, MULTIMASTER_BROADCAST_SERVICE));
-			if (PQstatus(conns[i]) != CONNECTION_OK)
-			{
-				if (ignoreError) 
-				{ 
-					PQfinish(conns[i]);
-					conns[i] = NULL;
-				} else { 
-					failedNode = i;
-					do { 
-						PQfinish(conns[i]);
-					} while (--i >= 0);                             
-					elog(ERROR, "Failed to establish connection '%s' to node %d, error = %s", Mtm->nodes[failedNode].con.connStr, failedNode+1, PQerrorMessage(conns[i]));
-				}
+			char* errmsg = pstrdup(PQerrorMessage(conn));
+			PQfinish(conn);
+			MtmBroadcastConns[node] = NULL;
+			if (ignoreError) 
+			{ 
+				return NULL;
 			}
-			PQsetNoticeReceiver(conns[i], MtmNoticeReceiver, &i);
+			elog(ERROR, "Failed to establish connection '%s' to node %d, error = %s", Mtm->nodes[node].con.connStr, node+1, errmsg);
 		}
+		MtmBroadcastNodes[node] = node;
+		PQsetNoticeReceiver(conn, MtmNoticeReceiver, &MtmBroadcastNodes[node]);
+		MtmBroadcastConns[node] = conn;
 	}
-	Assert(i == nNodes);
-    
+	return conn;
+}
+
+/*
+ * Send statement to all specified connections at once and wait for completion of all of them in one poll loop.
+ * Error message of the first failed statement at each node is saved in errmsgs.
+ * Returns number of nodes at which statement has failed.
+ */
+static int MtmBroadcastAndWait(PGconn** conns, int nNodes, char const* sql, char** errmsgs)
+{
+	struct pollfd fds[MAX_NODES];
+	bool busy[MAX_NODES];
+	int i, nBusy = 0, nFailed = 0;
+
 	for (i = 0; i < nNodes; i++) 
 	{ 
+		busy[i] = false;
+		errmsgs[i] = NULL;
 		if (conns[i]) 
-		{
-			if (!MtmRunUtilityStmt(conns[i], "BEGIN TRANSACTION", &utility_errmsg) && !ignoreError)
-			{
-				errorMsg = "Failed to start transaction at node %d";
-				failedNode = i;
-				break;
-			}
-			if (!MtmRunUtilityStmt(conns[i], sql, &utility_errmsg) && !ignoreError)
-			{
-				if (i + 1 == MtmNodeId)
-					errorMsg = utility_errmsg;
-				else
-				{
-					elog(ERROR, "%s", utility_errmsg);
-					errorMsg = "Failed to run command at node %d";
-				}
-
-				failedNode = i;
-				break;
+		{ 
+			if (PQsendQuery(conns[i], sql)) { 
+				busy[i] = true;
+				nBusy += 1;
+			} else { 
+				errmsgs[i] = pstrdup(PQerrorMessage(conns[i]));
+				nFailed += 1;
 			}
 		}
 	}
-	if (failedNode >= 0 && !ignoreError)  
-	{
+	while (nBusy != 0) 
+	{ 
+		int n = 0;
 		for (i = 0; i < nNodes; i++) 
 		{ 
-			if (conns[i])
+			if (busy[i]) 
 			{
-				MtmRunUtilityStmt(conns[i], "ROLLBACK TRANSACTION", &utility_errmsg);
+				PGresult* result;
+				if (!PQconsumeInput(conns[i])) { 
+					if (errmsgs[i] == NULL) { 
+						errmsgs[i] = pstrdup(PQerrorMessage(conns[i]));
+						nFailed += 1;
+					}
+					busy[i] = false;
+					nBusy -= 1;
+					continue;
+				}
+				while (!PQisBusy(conns[i])) 
+				{ 
+					result = PQgetResult(conns[i]);
+					if (result == NULL) { 
+						busy[i] = false;
+						nBusy -= 1;
+						break;
+					}
+					if (PQresultStatus(result) != PGRES_COMMAND_OK && PQresultStatus(result) != PGRES_TUPLES_OK && errmsgs[i] == NULL) { 
+						char *errstr = PQresultErrorMessage(result);
+						int errlen = strlen(errstr);
+						/* Strip "ERROR:  " from beginning and "\n" from end of error string */
+						errmsgs[i] = errlen > 9 ? pnstrdup(errstr + 8, errlen - 1 - 8) : pstrdup(errstr);
+						nFailed += 1;
+					}
+					PQclear(result);
+				}
+				if (busy[i]) { 
+					fds[n].fd = PQsocket(conns[i]);
+					fds[n].events = POLLIN;
+					n += 1;
+				}
 			}
 		}
-	} else { 
-		for (i = 0; i < nNodes; i++) 
-		{ 
-			if (conns[i] && !MtmRunUtilityStmt(conns[i], "COMMIT TRANSACTION", &utility_errmsg) && !ignoreError) 
-			{ 
-				errorMsg = "Commit failed at node %d";
-				failedNode = i;
+		if (n != 0) { 
+			if (poll(fds, n, MtmHeartbeatRecvTimeout) < 0 && errno != EINTR) { 
+				elog(ERROR, "Failed to wait for results of utility statement broadcast: %m");
 			}
+			CHECK_FOR_INTERRUPTS();
 		}
-	}                       
+	}
+	return nFailed;
+}
+
+/*
+ * Execute utility statement at all enabled nodes in one distributed transaction.
+ * Persistent per-backend connections are used and statement is sent to all nodes in parallel.
+ */
+static void MtmBroadcastUtilityStmt(char const* sql, bool ignoreError)
+{
+	int i = 0;
+	nodemask_t disabledNodeMask = Mtm->disabledNodeMask;
+	int failedNode = -1;
+	PGconn *conns[MAX_NODES];
+	char* errmsgs[MAX_NODES];
+	int nNodes = Mtm->nAllNodes;
+
 	for (i = 0; i < nNodes; i++) 
 	{ 
-		if (conns[i])
+		if (!BIT_CHECK(disabledNodeMask, i)) 
 		{
-			PQfinish(conns[i]);
+			conns[i] = MtmGetBroadcastConnection(i, ignoreError);
+		} 
+		else 
+		{ 
+			conns[i] = NULL;
+			if (MtmBroadcastConns[i] != NULL) 
+			{ 
+				PQfinish(MtmBroadcastConns[i]);
+				MtmBroadcastConns[i] = NULL;
+			}
+		}
+	}
+
+	if (MtmBroadcastAndWait(conns, nNodes, psprintf("BEGIN TRANSACTION; %s", sql), errmsgs) != 0 && !ignoreError) 
+	{
+		/* prefer error reported by this node */
+		failedNode = errmsgs[MtmNodeId-1] != NULL ? MtmNodeId-1 : -1;
+		for (i = 0; failedNode < 0; i++) { 
+			if (errmsgs[i] != NULL) { 
+				failedNode = i;
+			}
 		}
+		MtmBroadcastAndWait(conns, nNodes, "ROLLBACK TRANSACTION", errmsgs);
+		elog(ERROR, "Failed to run command at node %d: %s", failedNode+1, errmsgs[failedNode]);
 	}
-	if (!ignoreError && failedNode >= 0) 
+	if (MtmBroadcastAndWait(conns, nNodes, "COMMIT TRANSACTION", errmsgs) != 0 && !ignoreError) 
 	{ 
-		elog(ERROR, errorMsg, failedNode+1);
+		for (i = 0; errmsgs[i] == NULL; i++);
+		elog(ERROR, "Commit failed at node %d: %s", i+1, errmsgs[i]);
 	}
 }
 
 /*
  * Genenerate global transaction identifier for two-pahse commit.
- * It should be unique for all nodes
+ * It should be unique for all nodes.
+ * GID of home-local transaction is marked with suffix, so that replicas can check ownership of its rows.
  */
 static void
-MtmGenerateGid(char* gid)
+MtmGenerateGid(char* gid, bool homeLocal)
 {
 	static int localCount;
-	sprintf(gid, "MTM-%d-%d-%d", MtmNodeId, MyProcPid, ++localCount);
+	sprintf(gid, "MTM-%d-%d-%d%s", MtmNodeId, MyProcPid, ++localCount, homeLocal ? MULTIMASTER_HOME_LOCAL_GID_SUFFIX : "");
+}
+
+bool MtmIsHomeLocalGid(char const* gid)
+{
+	size_t len = strlen(gid);
+	size_t suffixLen = strlen(MULTIMASTER_HOME_LOCAL_GID_SUFFIX);
+	return strncmp(gid, "MTM-", 4) == 0 && len > suffixLen && strcmp(gid + len - suffixLen, MULTIMASTER_HOME_LOCAL_GID_SUFFIX) == 0;
+}
+
+/*
+ * Coordinator commits home-local transaction without waiting for votes, so replica can receive its COMMIT PREPARED
+ * while PREPARE is still applied by other worker. Wait until the transaction is prepared here or the node leaves
+ * online mode because PREPARE has failed.
+ */
+void MtmWaitForPreparedTransaction(char const* gid)
+{
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	while (true) {
+		MtmTransMap* tm;
+		bool done;
+		MtmLock(LW_SHARED);
+		tm = (MtmTransMap*)hash_search(MtmGid2State, gid, HASH_FIND, NULL);
+		done = (tm != NULL && tm->state != NULL && (tm->state->votingCompleted || tm->state->status == TRANSACTION_STATUS_ABORTED))
+			|| Mtm->status != MTM_ONLINE;
+		MtmUnlock();
+		if (done) { 
+			break;
+		}
+		MtmSleep(delay);
+		if (delay*2 <= MAX_WAIT_TIMEOUT) { 
+			delay *= 2;
+		}
+	}
 }
 
 /*
@@ -4346,7 +6997,7 @@ static bool MtmTwoPhaseCommit(MtmCurrentTrans* x)
 	// }
 
 	if (!x->isReplicated && x->isDistributed && x->containsDML) {
-		MtmGenerateGid(x->gid);
+		MtmGenerateGid(x->gid, x->isHomeLocal);
 		if (!x->isTransactionBlock) { 
 			BeginTransactionBlock();
 			x->isTransactionBlock = true;
@@ -4366,9 +7017,14 @@ static bool MtmTwoPhaseCommit(MtmCurrentTrans* x)
 				StartTransactionCommand();
 				if (x->status == TRANSACTION_STATUS_ABORTED) { 
 					FinishPreparedTransaction(x->gid, false);
-					elog(ERROR, "Transaction %s (%llu) is aborted by DTM", x->gid, (long64)x->xid);
+					ereport(ERROR,
+							(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+							 errmsg("Transaction %s (%llu) is aborted by DTM", x->gid, (long64)x->xid)));
 				} else {
 					FinishPreparedTransaction(x->gid, true);
+					MtmLastCommitToken.node = MtmNodeId;
+					MtmLastCommitToken.csn = x->csn;
+					MtmLastCommitToken.lsn = XactLastRecEnd;
 				}
 			}
 		}
@@ -4397,6 +7053,13 @@ typedef struct MtmGucEntry
 
 static HTAB *MtmGucHash = NULL;
 static dlist_head MtmGucList = DLIST_STATIC_INIT(MtmGucList);
+static StringInfo  MtmGucBlob;           /* serialized GUCs of the session */
+static timestamp_t MtmGucBlobVersion;    /* version of GUCs in MtmGucBlob */
+static timestamp_t MtmGucVersion;        /* time of the last change of GUCs of the session */
+static timestamp_t MtmGucSentVersion;    /* version of GUCs sent to other nodes by committed or prepared transaction */
+static timestamp_t MtmGucSentTime;       /* when they were sent */
+static timestamp_t MtmGucPendingVersion; /* version of GUCs sent by current transaction, 0 if none */
+static timestamp_t MtmGucPendingTime;
 
 static void MtmGucInit(void)
 {
@@ -4428,6 +7091,7 @@ static void MtmGucDiscard()
 
 	hash_destroy(MtmGucHash);
 	MtmGucInit();
+	MtmGucVersion = MtmGetSystemTime();
 }
 
 static inline void MtmGucUpdate(const char *key, char *value)
@@ -4491,44 +7155,172 @@ static void MtmGucSet(VariableSetStmt *stmt, const char *queryStr)
 
 		case VAR_SET_CURRENT:
 		case VAR_SET_MULTI:
-			break;
+			MemoryContextSwitchTo(oldcontext);
+			return;
 	}
+	MtmGucVersion = MtmGetSystemTime();
 
 	MemoryContextSwitchTo(oldcontext);
 }
 
-char* MtmGucSerialize(void)
+/*
+ * Serialize GUCs set by the session as pairs of null-terminated name and value.
+ * Result is cached until GUCs are changed.
+ */
+static StringInfo MtmGucSerialize(void)
 {
-	StringInfo serialized_gucs;
 	dlist_iter iter;
-	int nvars = 0;
-
-	serialized_gucs = makeStringInfo();
 
+	if (MtmGucBlob == NULL) {
+		MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+		MtmGucBlob = makeStringInfo();
+		MemoryContextSwitchTo(oldcontext);
+	} else if (MtmGucBlobVersion == MtmGucVersion) {
+		return MtmGucBlob;
+	}
+	resetStringInfo(MtmGucBlob);
 	dlist_foreach(iter, &MtmGucList)
 	{
 		MtmGucEntry *cur_entry = dlist_container(MtmGucEntry, list_node, iter.cur);
+		appendBinaryStringInfo(MtmGucBlob, cur_entry->key, strlen(cur_entry->key) + 1);
+		appendBinaryStringInfo(MtmGucBlob, cur_entry->value, strlen(cur_entry->value) + 1);
+	}
+	MtmGucBlobVersion = MtmGucVersion;
+	return MtmGucBlob;
+}
 
-		appendStringInfoString(serialized_gucs, "SET ");
-		appendStringInfoString(serialized_gucs, cur_entry->key);
-		appendStringInfoString(serialized_gucs, " TO ");
+/*
+ * Check if current GUCs of the session are already known to receivers at all nodes.
+ * Receivers keep them in memory, so they are sent again if some WAL sender is restarted after they were sent.
+ */
+static bool MtmGucIsSent(void)
+{
+	int i;
+	if (MtmGucSentVersion != MtmGucVersion) {
+		return false;
+	}
+	for (i = 0; i < Mtm->nAllNodes; i++) {
+		if (Mtm->nodes[i].senderStartTime >= MtmGucSentTime) {
+			return false;
+		}
+	}
+	return true;
+}
 
-		/* quite a crutch */
-		if (strstr(cur_entry->key, "_mem") != NULL)
-		{
-			appendStringInfoString(serialized_gucs, "'");
-			appendStringInfoString(serialized_gucs, cur_entry->value);
-			appendStringInfoString(serialized_gucs, "'");
+/*
+ * Remember GUCs sent by the current transaction once it is committed or prepared (so decoded by WAL senders).
+ */
+static void MtmGucTransactionEnd(bool sent)
+{
+	if (MtmGucPendingVersion != 0) {
+		if (sent) {
+			MtmGucSentVersion = MtmGucPendingVersion;
+			MtmGucSentTime = MtmGucPendingTime;
 		}
-		else
+		MtmGucPendingVersion = 0;
+	}
+}
+
+/*
+ * GUCs of pooled sessions that are not current in this backend, so that
+ * each session goes on sending its own GUCs with its DDL.
+ */
+typedef struct
+{
+	int32       session;  /* SessionPoolSessionId(): hash key */
+	HTAB*       gucHash;
+	dlist_head  gucList;
+	StringInfo  gucBlob;
+	timestamp_t gucBlobVersion;
+	timestamp_t gucVersion;
+	timestamp_t gucSentVersion;
+	timestamp_t gucSentTime;
+} MtmPooledSessionGucs;
+
+static HTAB *MtmPooledSessionGucsHash;
+
+static void MtmGucForget(void)
+{
+	MtmGucHash = NULL;
+	dlist_init(&MtmGucList);
+	MtmGucBlob = NULL;
+	MtmGucBlobVersion = 0;
+	MtmGucVersion = 0;
+	MtmGucSentVersion = 0;
+	MtmGucSentTime = 0;
+}
+
+static void MtmSessionPoolHook(SessionPoolEvent event, int32 sessionId)
+{
+	MtmPooledSessionGucs* entry;
+	bool found;
+
+	if (MtmPooledSessionGucsHash == NULL) {
+		HASHCTL hash_ctl;
+		MemSet(&hash_ctl, 0, sizeof(hash_ctl));
+		hash_ctl.keysize = sizeof(int32);
+		hash_ctl.entrysize = sizeof(MtmPooledSessionGucs);
+		hash_ctl.hcxt = TopMemoryContext;
+		MtmPooledSessionGucsHash = hash_create("MtmPooledSessionGucs", MTM_GUC_HASHSIZE, &hash_ctl,
+											   HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	switch (event) {
+	  case SESSION_POOL_SWITCH_OUT:
+		entry = (MtmPooledSessionGucs*)hash_search(MtmPooledSessionGucsHash, &sessionId, HASH_ENTER, &found);
+		entry->gucHash = MtmGucHash;
+		dlist_init(&entry->gucList);
+		while (!dlist_is_empty(&MtmGucList)) {
+			dlist_push_tail(&entry->gucList, dlist_pop_head_node(&MtmGucList));
+		}
+		entry->gucBlob = MtmGucBlob;
+		entry->gucBlobVersion = MtmGucBlobVersion;
+		entry->gucVersion = MtmGucVersion;
+		entry->gucSentVersion = MtmGucSentVersion;
+		entry->gucSentTime = MtmGucSentTime;
+		MtmGucForget();
+		break;
+
+	  case SESSION_POOL_SWITCH_IN:
+		entry = (MtmPooledSessionGucs*)hash_search(MtmPooledSessionGucsHash, &sessionId, HASH_FIND, NULL);
+		if (entry != NULL) {
+			Assert(MtmGucHash == NULL && dlist_is_empty(&MtmGucList));
+			MtmGucHash = entry->gucHash;
+			while (!dlist_is_empty(&entry->gucList)) {
+				dlist_push_tail(&MtmGucList, dlist_pop_head_node(&entry->gucList));
+			}
+			MtmGucBlob = entry->gucBlob;
+			MtmGucBlobVersion = entry->gucBlobVersion;
+			MtmGucVersion = entry->gucVersion;
+			MtmGucSentVersion = entry->gucSentVersion;
+			MtmGucSentTime = entry->gucSentTime;
+			hash_search(MtmPooledSessionGucsHash, &sessionId, HASH_REMOVE, NULL);
+		}
+		break;
+
+	  case SESSION_POOL_CLOSE:
+	  {
+		dlist_iter iter;
+		dlist_foreach(iter, &MtmGucList)
 		{
-			appendStringInfoString(serialized_gucs, cur_entry->value);
+			MtmGucEntry *cur_entry = dlist_container(MtmGucEntry, list_node, iter.cur);
+			pfree(cur_entry->value);
 		}
-		appendStringInfoString(serialized_gucs, "; ");
-		nvars++;
+		if (MtmGucHash != NULL) {
+			hash_destroy(MtmGucHash);
+		}
+		if (MtmGucBlob != NULL) {
+			pfree(MtmGucBlob->data);
+			pfree(MtmGucBlob);
+		}
+		MtmGucForget();
+		break;
+	  }
 	}
 
-	return serialized_gucs->data;
+	if (PreviousSessionPoolHook != NULL) {
+		PreviousSessionPoolHook(event, sessionId);
+	}
 }
 
 /*
@@ -4539,22 +7331,42 @@ char* MtmGucSerialize(void)
 
 static void MtmProcessDDLCommand(char const* queryString, bool transactional)
 {
-	char* gucCtx = MtmGucSerialize();
-	if (*gucCtx) {
-		queryString = psprintf("RESET SESSION AUTHORIZATION; reset all; %s; %s", gucCtx, queryString);
-	} else { 
-		queryString = psprintf("RESET SESSION AUTHORIZATION; reset all; %s", queryString);
+	StringInfo gucs = MtmGucSerialize();
+	timestamp_t now = MtmGetSystemTime(); /* taken before writing of message, see MtmGucIsSent */
+	MtmDDLMessageHeader hdr;
+	StringInfoData msg;
+
+	hdr.session = SessionPoolSessionId();
+	hdr.gucVersion = MtmGucVersion;
+	hdr.gucSize = gucs->len != 0 && MtmGucIsSent() ? -1 : gucs->len;
+	initStringInfo(&msg);
+	appendBinaryStringInfo(&msg, (char*)&hdr, sizeof(hdr));
+	if (hdr.gucSize > 0) {
+		appendBinaryStringInfo(&msg, gucs->data, gucs->len);
 	}
+	appendBinaryStringInfo(&msg, queryString, strlen(queryString) + 1);
+
 	MTM_LOG3("Sending utility: %s", queryString);
 	if (transactional) {
 		/* Transactional DDL */
-		LogLogicalMessage("D", queryString, strlen(queryString) + 1, true);
+		LogLogicalMessage("D", msg.data, msg.len, true);
 		MtmTx.containsDML = true;
+		MtmTx.isFastCommit = false;
+		MtmTx.isHomeLocal = false;
+		if (hdr.gucSize > 0) { 
+			MtmGucPendingVersion = hdr.gucVersion;
+			MtmGucPendingTime = now;
+		}
 	} else {	
 		MTM_LOG1("Execute concurrent DDL: %s", queryString);
 		/* Concurrent DDL */
-		XLogFlush(LogLogicalMessage("C", queryString, strlen(queryString) + 1, false));
+		XLogFlush(LogLogicalMessage("C", msg.data, msg.len, false));
+		if (hdr.gucSize > 0) { 
+			MtmGucSentVersion = hdr.gucVersion;
+			MtmGucSentTime = now;
+		}
 	}
+	pfree(msg.data);
 }
 
 static void MtmFinishDDLCommand()
@@ -4562,20 +7374,59 @@ static void MtmFinishDDLCommand()
 	LogLogicalMessage("E", "", 1, true);
 }
 
+static void MtmStoreLockGraph(MtmNodeInfo* node, MtmLockEdge* edges, int nEdges, timestamp_t version)
+{
+	int size = nEdges*sizeof(MtmLockEdge);
+	int allocated = node->lockGraphAllocated;
+	if (size > allocated) { 
+		allocated = Max(Max(MULTIMASTER_LOCK_BUF_INIT_SIZE, allocated*2), size);
+		node->lockGraphData = ShmemAlloc(allocated);
+		node->lockGraphAllocated = allocated;
+	}
+	memcpy(node->lockGraphData, edges, size);
+	node->lockGraphUsed = size;
+	node->lockGraphVersion = version;
+}
+
+/*
+ * Process 'L' message: either replace lock graph of the node or apply delta to it.
+ * Delta is applied only to the graph it was calculated against, otherwise graph of the node 
+ * is considered unknown until next full graph is received.
+ */
 void MtmUpdateLockGraph(int nodeId, void const* messageBody, int messageSize)
 {
-	int allocated;
+	MtmLockGraphMessage msg;
+	MtmLockEdge* edges;
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+
+	memcpy(&msg, messageBody, sizeof(msg));
+	Assert(messageSize == sizeof(msg) + (msg.nAdded + msg.nRemoved)*sizeof(MtmLockEdge));
+	edges = (MtmLockEdge*)palloc(Max(msg.nAdded + msg.nRemoved, 1)*sizeof(MtmLockEdge));
+	memcpy(edges, (char const*)messageBody + sizeof(msg), (msg.nAdded + msg.nRemoved)*sizeof(MtmLockEdge));
+
 	MtmLockNode(nodeId + MtmMaxNodes, LW_EXCLUSIVE);
-	allocated = Mtm->nodes[nodeId-1].lockGraphAllocated;
-	if (messageSize > allocated) { 
-		allocated = Max(Max(MULTIMASTER_LOCK_BUF_INIT_SIZE, allocated*2), messageSize);
-		Mtm->nodes[nodeId-1].lockGraphData = ShmemAlloc(allocated);
-		Mtm->nodes[nodeId-1].lockGraphAllocated = allocated;
-	}
-	memcpy(Mtm->nodes[nodeId-1].lockGraphData, messageBody, messageSize);
-	Mtm->nodes[nodeId-1].lockGraphUsed = messageSize;
+	if (!msg.isDelta) { 
+		MtmStoreLockGraph(node, edges, msg.nAdded, msg.version);
+	} else if (node->lockGraphVersion != 0 && node->lockGraphVersion == msg.baseVersion) { 
+		MtmLockGraph graph;
+		MtmLockEdge* result;
+		int nEdges;
+		graph.edges = (MtmLockEdge*)node->lockGraphData;
+		graph.nEdges = node->lockGraphUsed/sizeof(MtmLockEdge);
+		result = (MtmLockEdge*)palloc((graph.nEdges + msg.nAdded + 1)*sizeof(MtmLockEdge));
+		nEdges = MtmLockGraphApplyDelta(&graph, edges, msg.nAdded, edges + msg.nAdded, msg.nRemoved, result);
+		MtmStoreLockGraph(node, result, nEdges, msg.version);
+		pfree(result);
+	} else { 
+		MTM_LOG1("Ignore deadlock graph delta from node %d: base version %lld doesn't match current version %lld", 
+				 nodeId, msg.baseVersion, node->lockGraphVersion);
+		node->lockGraphUsed = 0;
+		node->lockGraphVersion = 0;
+	}
 	MtmUnlockNode(nodeId + MtmMaxNodes);
-	MTM_LOG1("Update deadlock graph for node %d size %d", nodeId, messageSize);
+	pfree(edges);
+	MTM_LOG1("Update deadlock graph for node %d: %s with %d added and %d removed edges", 
+			 nodeId, msg.isDelta ? "delta" : "full graph", msg.nAdded, msg.nRemoved);
 }
 
 static void MtmProcessUtility(Node *parsetree, const char *queryString,
@@ -4803,6 +7654,11 @@ static void MtmProcessUtility(Node *parsetree, const char *queryString,
 						Relation rel = heap_open(relid, ShareLock);
 						if (RelationNeedsWAL(rel)) {
 							MtmTx.containsDML = true;
+							MtmTx.isFastCommit = false;
+							if (MtmGetHomeColumn(rel) == InvalidAttrNumber) { 
+								/* rows copied to home table are checked by its trigger */
+								MtmTx.isHomeLocal = false;
+							}
 						}	
 						heap_close(rel, ShareLock);
 					}
@@ -4890,6 +7746,16 @@ MtmExecutorStart(QueryDesc *queryDesc, int eflags)
 		standard_ExecutorStart(queryDesc, eflags);
 }
 
+/*
+ * INSERT ... ON CONFLICT DO UPDATE can conflict with other transactions like any update
+ */
+static bool
+MtmIsUpsert(QueryDesc *queryDesc)
+{
+	Plan* plan = queryDesc->plannedstmt->planTree;
+	return IsA(plan, ModifyTable) && ((ModifyTable*)plan)->onConflictAction == ONCONFLICT_UPDATE;
+}
+
 static void
 MtmExecutorFinish(QueryDesc *queryDesc)
 {
@@ -4915,7 +7781,15 @@ MtmExecutorFinish(QueryDesc *queryDesc)
 					}
 					MTM_LOG3("MtmTx.containsDML = true // WAL");
 					MtmTx.containsDML = true;
-					break;
+					if (MtmTx.isFastCommit && !(operation == CMD_INSERT && !MtmIsUpsert(queryDesc) && MtmIsFastCommitRelation(rel))) { 
+						MtmTx.isFastCommit = false;
+					}
+					if (MtmTx.isHomeLocal && MtmGetHomeColumn(rel) == InvalidAttrNumber) { 
+						MtmTx.isHomeLocal = false;
+					}
+					if (!MtmTx.isFastCommit && !MtmTx.isHomeLocal) { 
+						break;
+					}
 				}
 			}
         }
@@ -4937,13 +7811,103 @@ MtmExecutorFinish(QueryDesc *queryDesc)
  * -------------------------------------------
  */
 
-void MtmExecute(void* work, int size)
+void MtmExecute(void* work, int size, uint32 const* footprint, int footprintSize)
 {
 	if (Mtm->status == MTM_RECOVERY) { 
 		/* During recovery apply changes sequentially to preserve commit order */
 		MtmExecutor(work, size);
 	} else { 
-		BgwPoolExecute(&Mtm->pool, work, size);
+		/* each origin node has its own sub-queue in the pool */
+		BgwPoolExecute(&Mtm->pool, MtmReplicationNodeId - 1, work, size, footprint, footprintSize);
+	}
+}
+
+/*
+ * Commit tickets.
+ * With multimaster.preserve_commit_order receiver assigns sequential tickets to commit-prepared and
+ * rollback-prepared of each origin node and passes them to the pool, so these transactions are applied
+ * by workers concurrently with each other and with prepares, and only the final commit step waits
+ * for the turn of its ticket. Worker waiting for ticket T registers its latch in slot T % MTM_COMMIT_TICKET_WAITERS,
+ * which is set by the worker releasing ticket T-1. Slot can be overwritten by other waiter of the same slot,
+ * so wait is also limited by timeout.
+ */
+#define MTM_COMMIT_TICKET_POLL_TIMEOUT 10 /* msec */
+
+uint64 MtmIssueCommitTicket(int nodeId)
+{
+	/* Only receiver of the node assigns tickets */
+	return ++Mtm->nodes[nodeId-1].commitTicketIssued;
+}
+
+void MtmWaitCommitTicket(int nodeId, uint64 ticket)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	Latch* volatile* slot = &node->commitTicketWaiters[ticket % MTM_COMMIT_TICKET_WAITERS];
+	timestamp_t start;
+
+	if (pg_atomic_read_u64(&node->commitTicketDone) + 1 >= ticket) { 
+		return;
+	}
+	start = MtmWaitStart(MTM_WAIT_COMMIT_TICKET);
+	*slot = &MyProc->procLatch;
+	pg_memory_barrier();
+	while (pg_atomic_read_u64(&node->commitTicketDone) + 1 < ticket) { 
+		int rc = WaitLatch(&MyProc->procLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, MTM_COMMIT_TICKET_POLL_TIMEOUT);
+		if (rc & WL_POSTMASTER_DEATH) { 
+			proc_exit(1);
+		}
+		ResetLatch(&MyProc->procLatch);
+	}
+	if (*slot == &MyProc->procLatch) { 
+		*slot = NULL;
+	}
+	MtmWaitEnd(MTM_WAIT_COMMIT_TICKET, start);
+}
+
+void MtmReleaseCommitTicket(int nodeId, uint64 ticket)
+{
+	MtmNodeInfo* node = &Mtm->nodes[nodeId-1];
+	Latch* next;
+
+	/* Transaction which failed before reaching its commit still has to wait for its turn */
+	MtmWaitCommitTicket(nodeId, ticket);
+	if (pg_atomic_read_u64(&node->commitTicketDone) < ticket) { 
+		pg_atomic_write_u64(&node->commitTicketDone, ticket);
+	}
+	pg_memory_barrier();
+	next = node->commitTicketWaiters[(ticket + 1) % MTM_COMMIT_TICKET_WAITERS];
+	if (next != NULL) { 
+		SetLatch(next);
+	}
+}
+
+/*
+ * Check if large transaction received from the node can be applied by worker while it is received.
+ * It is not possible in recovery mode and when there are no idle workers.
+ */
+bool MtmStartStream(int nodeId)
+{
+	return Mtm->status != MTM_RECOVERY && BgwPoolStreamStart(&Mtm->pool, nodeId - 1);
+}
+
+void MtmExecuteStream(int nodeId, void* work, int size, bool last)
+{
+	BgwPoolStreamExecute(&Mtm->pool, nodeId - 1, work, size, last);
+}
+
+int MtmStreamChunkSize(void)
+{
+	return (int)BgwPoolStreamChunkSize(&Mtm->pool);
+}
+
+/*
+ * Rollback transaction streamed from the node, if any
+ */
+void MtmAbortStream(int nodeId)
+{
+	if (BgwPoolStreamIsOpen(&Mtm->pool, nodeId - 1)) {
+		char abort = 'X';
+		BgwPoolStreamExecute(&Mtm->pool, nodeId - 1, &abort, 1, true);
 	}
 }
     
@@ -5027,44 +7991,103 @@ MtmSerializeLock(PROCLOCK* proclock, void* arg)
     }
 }
 
+/*
+ * Broadcast local lock graph to other nodes. Only changes since the previously sent graph are sent, 
+ * unless delta is larger than the graph itself. Full graph is also sent periodically to let nodes 
+ * which have missed some deltas resynchronize.
+ * Node lock is held while WAL record is inserted, so order of messages in WAL matches order of versions.
+ */
+static void
+MtmSendLockGraph(MtmLockGraph* graph)
+{
+	MtmNodeInfo* node = &Mtm->nodes[MtmNodeId-1];
+	MtmLockGraph sent;
+	MtmLockGraphMessage* msg;
+	MtmLockEdge* edges;
+	XLogRecPtr lsn;
+	timestamp_t version = MtmGetSystemTime();
+
+	MtmLockNode(MtmNodeId + MtmMaxNodes, LW_EXCLUSIVE);
+	sent.edges = (MtmLockEdge*)node->lockGraphData;
+	sent.nEdges = node->lockGraphUsed/sizeof(MtmLockEdge);
+	msg = (MtmLockGraphMessage*)palloc(sizeof(MtmLockGraphMessage) + (graph->nEdges + sent.nEdges)*sizeof(MtmLockEdge));
+	edges = (MtmLockEdge*)(msg + 1);
+	msg->isDelta = false;
+	if (node->lockGraphVersion != 0 && ++node->lockGraphUpdates % MTM_LOCK_GRAPH_FULL_PERIOD != 0) { 
+		MtmLockGraphDiff(&sent, graph, edges, &msg->nAdded, edges + graph->nEdges, &msg->nRemoved);
+		if (msg->nAdded + msg->nRemoved == 0) { 
+			/* Graph was not changed */
+			MtmUnlockNode(MtmNodeId + MtmMaxNodes);
+			pfree(msg);
+			return;
+		}
+		if (msg->nAdded + msg->nRemoved < graph->nEdges) { 
+			memmove(edges + msg->nAdded, edges + graph->nEdges, msg->nRemoved*sizeof(MtmLockEdge));
+			msg->isDelta = true;
+		}
+	}
+	if (!msg->isDelta) { 
+		memcpy(edges, graph->edges, graph->nEdges*sizeof(MtmLockEdge));
+		msg->nAdded = graph->nEdges;
+		msg->nRemoved = 0;
+	}
+	if (version <= node->lockGraphVersion) { 
+		version = node->lockGraphVersion + 1;
+	}
+	msg->version = version;
+	msg->baseVersion = msg->isDelta ? node->lockGraphVersion : 0;
+
+	Assert(replorigin_session_origin == InvalidRepOriginId);
+	lsn = LogLogicalMessage("L", (char*)msg, sizeof(MtmLockGraphMessage) + (msg->nAdded + msg->nRemoved)*sizeof(MtmLockEdge), false);
+	MtmStoreLockGraph(node, graph->edges, graph->nEdges, version);
+	MtmUnlockNode(MtmNodeId + MtmMaxNodes);
+
+	XLogFlush(lsn);
+	pfree(msg);
+}
+
 static bool 
 MtmDetectGlobalDeadLockForXid(TransactionId xid)
 {
 	bool hasDeadlock = false;
     if (TransactionIdIsValid(xid)) { 
 		ByteBuffer buf;
-		MtmGraph graph;
+		MtmLockGraph* graphs;
+		int nGraphs;
 		GlobalTransactionId gtid; 
 		int i;
 		
         ByteBufferAlloc(&buf);
         EnumerateLocks(MtmSerializeLock, &buf);
 
-		Assert(replorigin_session_origin == InvalidRepOriginId);
-		XLogFlush(LogLogicalMessage("L", buf.data, buf.used, false));
-
-		MtmGraphInit(&graph);
-		MtmGraphAdd(&graph, (GlobalTransactionId*)buf.data, buf.used/sizeof(GlobalTransactionId));
+		graphs = (MtmLockGraph*)palloc(Mtm->nAllNodes*sizeof(MtmLockGraph));
+		graphs[0].nEdges = MtmLockGraphFromLocks((GlobalTransactionId*)buf.data, buf.used/sizeof(GlobalTransactionId), &graphs[0].edges);
         ByteBufferFree(&buf);
+		nGraphs = 1;
+
+		MtmSendLockGraph(&graphs[0]);
+
 		for (i = 0; i < Mtm->nAllNodes; i++) { 
 			if (i+1 != MtmNodeId && !BIT_CHECK(Mtm->disabledNodeMask, i)) { 
-				size_t lockGraphSize;
-				void* lockGraphData;
+				MtmLockGraph* graph = &graphs[nGraphs];
 				MtmLockNode(i + 1 + MtmMaxNodes, LW_SHARED);
-				lockGraphSize = Mtm->nodes[i].lockGraphUsed;
-				lockGraphData = palloc(lockGraphSize);
-				memcpy(lockGraphData, Mtm->nodes[i].lockGraphData, lockGraphSize);
-				MtmUnlockNode(i + 1 + MtmMaxNodes);
-
-				if (lockGraphData == NULL) {
-					return true;
+				if (Mtm->nodes[i].lockGraphVersion != 0) { 
+					graph->nEdges = Mtm->nodes[i].lockGraphUsed/sizeof(MtmLockEdge);
+					graph->edges = (MtmLockEdge*)palloc(Max(graph->nEdges, 1)*sizeof(MtmLockEdge));
+					memcpy(graph->edges, Mtm->nodes[i].lockGraphData, graph->nEdges*sizeof(MtmLockEdge));
+					nGraphs += 1;
 				} else { 
-					MtmGraphAdd(&graph, (GlobalTransactionId*)lockGraphData, lockGraphSize/sizeof(GlobalTransactionId));
+					MTM_LOG1("Lock graph of node %d is not known", i+1);
 				}
+				MtmUnlockNode(i + 1 + MtmMaxNodes);
 			}
 		}
 		MtmGetGtid(xid, &gtid);
-		hasDeadlock = MtmGraphFindLoop(&graph, &gtid);
+		hasDeadlock = MtmLockGraphFindLoop(graphs, nGraphs, &gtid);
+		for (i = 0; i < nGraphs; i++) { 
+			pfree(graphs[i].edges);
+		}
+		pfree(graphs);
 		elog(LOG, "Distributed deadlock check by backend %d for %u:%llu = %d", MyProcPid, gtid.node, (long64)gtid.xid, hasDeadlock);
 		if (!hasDeadlock) { 
 			/* There is no deadlock loop in graph, but deadlock can be caused by lack of apply workers: if all of them are busy, then some transactions
@@ -5092,7 +8115,11 @@ MtmDetectGlobalDeadLock(PGPROC* proc)
 
 	MTM_LOG1("Detect global deadlock for %llu by backend %d", (long64)pgxact->xid, MyProcPid);
 
-    return MtmDetectGlobalDeadLockForXid(pgxact->xid);
+	if (MtmDetectGlobalDeadLockForXid(pgxact->xid)) { 
+		MtmStatAdd(MtmNodeId, deadlocks, 1);
+		return true;
+	}
+	return false;
 }
 
 Datum mtm_check_deadlock(PG_FUNCTION_ARGS)
@@ -5100,3 +8127,103 @@ Datum mtm_check_deadlock(PG_FUNCTION_ARGS)
 	TransactionId xid = PG_GETARG_INT64(0);
     PG_RETURN_BOOL(MtmDetectGlobalDeadLockForXid(xid));
 }
+
+/*
+ * -------------------------------------------
+ * Micro-benchmarks of hot paths
+ * -------------------------------------------
+ */
+
+#define MTM_MICROBENCH_CLIQUE_MATRICES 16
+
+/*
+ * Run "iterations" iterations of the specified component and return average time of one operation in nanoseconds.
+ * Meaning of "size" depends on component:
+ *   clique   - number of nodes in random disconnectivity matrix (up to 64)
+ *   deadlock - length of lock graph chain traversed from its root
+ *   snapshot - number of recent transaction IDs checked against current snapshot
+ *   bgwpool  - size of work item passed through the queue
+ * Warm-up and setup are done before the timer is started; scaling with concurrency is measured
+ * by running this function from several backends at the same time (see tests/microbench.sh).
+ */
+Datum mtm_microbench(PG_FUNCTION_ARGS)
+{
+	char* component = text_to_cstring(PG_GETARG_TEXT_PP(0));
+	int iterations = PG_GETARG_INT32(1);
+	int size = PG_GETARG_INT32(2);
+	instr_time start, elapsed;
+	double ns;
+	int i, j, k;
+
+	if (iterations <= 0 || size <= 0) {
+		elog(ERROR, "Number of iterations and size should be positive");
+	}
+	if (strcmp(component, "clique") == 0) {
+		nodemask_t matrices[MTM_MICROBENCH_CLIQUE_MATRICES][MAX_NODES];
+		int cliqueSize;
+		if (size > MAX_NODES) {
+			elog(ERROR, "Size of matrix should not exceed %d", MAX_NODES);
+		}
+		memset(matrices, 0, sizeof matrices);
+		for (k = 0; k < MTM_MICROBENCH_CLIQUE_MATRICES; k++) {
+			for (i = 0; i < size; i++) {
+				for (j = 0; j < i; j++) {
+					if (random() < MAX_RANDOM_VALUE/10) { /* 10% of broken links */
+						BIT_SET(matrices[k][i], j);
+						BIT_SET(matrices[k][j], i);
+					}
+				}
+			}
+		}
+		INSTR_TIME_SET_CURRENT(start);
+		for (i = 0; i < iterations; i++) {
+			MtmFindMaxClique(matrices[i % MTM_MICROBENCH_CLIQUE_MATRICES], size, &cliqueSize);
+		}
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		ns = INSTR_TIME_GET_DOUBLE(elapsed)*1e9;
+	} else if (strcmp(component, "deadlock") == 0) {
+		MtmLockGraph graph;
+		GlobalTransactionId root;
+		/* chain without loop: whole graph is traversed */
+		graph.nEdges = size;
+		graph.edges = (MtmLockEdge*)palloc(size*sizeof(MtmLockEdge));
+		for (i = 0; i < size; i++) {
+			graph.edges[i].src.node = graph.edges[i].dst.node = 0;
+			graph.edges[i].src.xid = FirstNormalTransactionId + i;
+			graph.edges[i].dst.xid = FirstNormalTransactionId + i + 1;
+		}
+		root = graph.edges[0].src;
+		INSTR_TIME_SET_CURRENT(start);
+		for (i = 0; i < iterations; i++) {
+			MtmLockGraphFindLoop(&graph, 1, &root);
+		}
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		ns = INSTR_TIME_GET_DOUBLE(elapsed)*1e9;
+		pfree(graph.edges);
+	} else if (strcmp(component, "snapshot") == 0) {
+		Snapshot snapshot = GetTransactionSnapshot();
+		TransactionId xmin = snapshot->xmin;
+		int nXids = 0;
+		INSTR_TIME_SET_CURRENT(start);
+		for (i = 0; i < iterations; i++) {
+			TransactionId xid = xmin - 1 - (i % size);
+			if (TransactionIdIsNormal(xid) && TransactionIdPrecedes(xid, xmin)) {
+				MtmXidInMVCCSnapshot(xid, snapshot);
+				nXids += 1;
+			}
+		}
+		INSTR_TIME_SET_CURRENT(elapsed);
+		INSTR_TIME_SUBTRACT(elapsed, start);
+		if (nXids == 0) {
+			elog(ERROR, "There are no transactions preceding snapshot");
+		}
+		ns = INSTR_TIME_GET_DOUBLE(elapsed)*1e9*iterations/nXids;
+	} else if (strcmp(component, "bgwpool") == 0) {
+		ns = BgwPoolBenchmark(size, 1, iterations);
+	} else {
+		elog(ERROR, "Unknown component '%s': should be one of clique, deadlock, snapshot, bgwpool", component);
+	}
+	PG_RETURN_FLOAT8(ns/iterations);
+}
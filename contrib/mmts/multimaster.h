@@ -6,6 +6,7 @@
 #include "bkb.h"
 
 #include "access/clog.h"
+#include "storage/latch.h"
 #include "pglogical_output/hooks.h"
 #include "commands/vacuum.h"
 #include "libpq-fe.h"
@@ -40,17 +41,35 @@
 #define MTM_LOG4(fmt, ...) fprintf(stderr, fmt "\n", ## __VA_ARGS__) 
 #endif
 
+/*
+ * Events of sampled transactions are always recorded in shared memory ring buffer (see mtm.get_trace()),
+ * MTM_TRACE additionally dumps all of them to stderr
+ */
 #if MTM_TRACE == 0
-#define MTM_TXTRACE(tx, event)
+#define MTM_TXTRACE(tx, event) \
+		do { if (MtmTraceSampleRatio != 0) MtmTraceTransaction(tx->gid, event); } while (0)
 #else
 #define MTM_TXTRACE(tx, event) \
-		fprintf(stderr, "[MTM_TXTRACE], %s, %lld, %s, %d\n", tx->gid, (long long)MtmGetSystemTime(), event, MyProcPid)
+		do { \
+			fprintf(stderr, "[MTM_TXTRACE], %s, %lld, %s, %d\n", tx->gid, (long long)MtmGetSystemTime(), event, MyProcPid); \
+			if (MtmTraceSampleRatio != 0) MtmTraceTransaction(tx->gid, event); \
+		} while (0)
 #endif
 
+/*
+ * Record event of commit path of sampled transaction used to build its commit profile (see mtm.get_commit_profile()).
+ * Node is the peer of the event: replica for per-replica events of coordinator, coordinator for events of replica.
+ */
+#define MTM_PROFILE(gid, event, node, time) \
+		do { if (MtmTraceSampleRatio != 0) MtmTraceCommitEvent(gid, event, node, time); } while (0)
+
 #define MULTIMASTER_NAME                "multimaster"
 #define MULTIMASTER_SCHEMA_NAME         "mtm"
 #define MULTIMASTER_DDL_TABLE           "ddl_log"
 #define MULTIMASTER_LOCAL_TABLES_TABLE  "local_tables"
+#define MULTIMASTER_FAST_COMMIT_TABLES_TABLE "fast_commit_tables"
+#define MULTIMASTER_HOME_CHECK_FUNCTION "home_check"
+#define MULTIMASTER_HOME_LOCAL_GID_SUFFIX "-H"
 #define MULTIMASTER_SLOT_PATTERN        "mtm_slot_%d"
 #define MULTIMASTER_MIN_PROTO_VERSION   1
 #define MULTIMASTER_MAX_PROTO_VERSION   1
@@ -59,11 +78,19 @@
 #define MULTIMASTER_MAX_CONN_STR_SIZE   128
 #define MULTIMASTER_MAX_HOST_NAME_SIZE  64
 #define MULTIMASTER_MAX_LOCAL_TABLES    256
+#define MULTIMASTER_MAX_SEQUENCES       1024  /* number of sequences for which blocks of values are reserved */
+#define MTM_LATENCY_BUCKETS             32    /* bucket i of vote latency histogram contains round-trips in [2^i,2^(i+1)) microseconds */
+#define MTM_TRACE_BUFFER_SIZE           4096  /* number of events in ring buffer of transaction trace */
+#define MTM_TRACE_EVENT_SIZE            48    /* maximal length of trace event name */
+#define MTM_PROFILE_MAX_EVENTS          1024  /* maximal number of events of one transaction collected from other nodes for commit profile */
+#define MTM_COMMIT_TICKET_WAITERS       64    /* size of ring of latches of workers waiting for their commit ticket */
+#define MTM_STATS_HISTORY               16    /* number of samples of apply queue depth kept in apply statistic */
 #define MULTIMASTER_MAX_CTL_STR_SIZE    256
 #define MULTIMASTER_LOCK_BUF_INIT_SIZE  4096
 #define MULTIMASTER_BROADCAST_SERVICE   "mtm_broadcast"
 #define MULTIMASTER_ADMIN               "mtm_admin"
 #define MULTIMASTER_PRECOMMITTED        "precommitted"
+#define MULTIMASTER_MAX_FOOTPRINT_SIZE  1024 /* maximal number of keys tracked for scheduling of replicated transaction */
 
 #define MULTIMASTER_DEFAULT_ARBITER_PORT 5433
 
@@ -81,8 +108,13 @@
 #define Anum_mtm_local_tables_rel_name	 2
 
 #define Natts_mtm_trans_state   15
-#define Natts_mtm_nodes_state   16
-#define Natts_mtm_cluster_state 18
+#define Natts_mtm_nodes_state   23
+#define Natts_mtm_cluster_state 19
+#define Natts_mtm_apply_stats   14
+#define Natts_mtm_trace         4
+#define Natts_mtm_commit_profile 5
+#define Natts_mtm_wait_stats    3
+#define Natts_mtm_commit_token  3
 
 typedef ulong64 csn_t; /* commit serial number */
 #define INVALID_CSN  ((csn_t)-1)
@@ -103,6 +135,14 @@ typedef enum
 	PGLOGICAL_PRECOMMIT_PREPARED
 } PGLOGICAL_EVENT;
 
+/* Position of committed transaction returned by mtm.get_commit_token */
+typedef struct
+{
+	int   node;   /* ID of coordinator node (1-based), 0 if there is no committed transaction */
+	csn_t csn;    /* commit serial number of the transaction */
+	lsn_t lsn;    /* end of COMMIT PREPARED record in WAL of coordinator */
+} MtmCommitToken;
+
 /* Identifier of global transaction */
 typedef struct 
 {
@@ -123,7 +163,11 @@ typedef enum
 	MSG_STATUS,
 	MSG_HEARTBEAT,
 	MSG_POLL_REQUEST,
-	MSG_POLL_STATUS
+	MSG_POLL_STATUS,
+	MSG_SEQ_REQUEST,  /* request to reserve block of sequence values: sxid - sequence key, dxid - block size, csn - block start */
+	MSG_SEQ_RESPONSE, /* status COMMITTED if block is granted (csn - block start), ABORTED if rejected (csn - highest reserved value) */
+	MSG_TRACE_REQUEST, /* request for commit profile events of transaction: gid, sxid - request ID */
+	MSG_TRACE_EVENT   /* status IN_PROGRESS for event (dxid - event code | peer node << 8, csn - time), COMMITTED after the last one */
 } MtmMessageCode;
 
 typedef enum
@@ -173,11 +217,50 @@ typedef struct MtmAbortLogicalMessage
 	lsn_t     origin_lsn;
 } MtmAbortLogicalMessage;
 
-typedef struct MtmMessageQueue
+/*
+ * Coordinator committing transaction without votes of some nodes (see multimaster.quorum_commit_delay) disables them
+ * and writes logical message 'F' before commit record. Nodes applying the message disable them too before
+ * transaction is committed, so they will not prepare conflicting transactions coordinated by lagging nodes.
+ */
+typedef struct MtmFenceLogicalMessage
+{
+	nodemask_t  fencedMask;
+	timestamp_t time;       /* fence is ignored for nodes which status has been changed since this time */
+} MtmFenceLogicalMessage;
+
+/*
+ * Header of DDL logical message ('D' or 'C'), followed by serialized GUCs of the session (pairs of null-terminated
+ * name and value) and null-terminated query string. GUCs are included only in the first message after they are
+ * changed, subsequent messages refer to them by version and receiver inserts them from its cache.
+ */
+typedef struct
+{
+	int32       session;    /* origin session, see SessionPoolSessionId() */
+	int32       gucSize;    /* size of serialized GUCs following the header, -1 if they are sent by previous message */
+	timestamp_t gucVersion; /* time of the last change of GUCs of the session */
+} MtmDDLMessageHeader;
+
+/*
+ * Logical message 'S' used by hot standby replicas of the node to provide CSN based snapshots.
+ * It is written before commit record of distributed transaction with CSN of the transaction,
+ * and periodically by monitor with horizon: all transactions with CSN <= horizon are
+ * already finished at the moment of writing the message. Messages are not sent to other nodes.
+ */
+typedef struct
 {
+	csn_t         horizon;   /* INVALID_CSN if not known */
+	csn_t         csn;
+	TransactionId xid;       /* InvalidTransactionId in horizon message */
+	int32         nSubxids;
+	TransactionId subxids[FLEXIBLE_ARRAY_MEMBER];
+} MtmCsnLogicalMessage;
+
+/* Cell of bounded MPSC queue of messages to be sent by arbiter sender */
+typedef struct
+{
+	pg_atomic_uint32  seq;    /* position this cell expects next: pos for producer, pos+1 for consumer */
 	MtmArbiterMessage msg;
-	struct MtmMessageQueue* next;
-} MtmMessageQueue;
+} MtmSendQueueCell;
 
 typedef struct 
 {
@@ -201,10 +284,97 @@ typedef struct
 } MtmConnectionInfo;
 
 
+/*
+ * Event of transaction trace. Position is assigned by atomic increment of Mtm->traceHead,
+ * "pos" field is set to position plus one when event is completely written, so that readers
+ * can detect overwritten entries.
+ */
+typedef struct
+{
+	pg_atomic_uint64 pos;
+	timestamp_t time;
+	int         pid;
+	int         code;        /* MtmCommitEvent of commit path events, -1 for other events */
+	int         node;        /* peer node of commit path event */
+	pgid_t      gid;
+	char        event[MTM_TRACE_EVENT_SIZE];
+} MtmTraceEvent;
+
+/*
+ * Events of commit path of distributed transaction, recorded at coordinator and replicas.
+ * Commit profile is built from intervals between them, see mtm.get_commit_profile().
+ */
+typedef enum
+{
+	MTM_EV_BEGIN,            /* coordinator: transaction is started */
+	MTM_EV_EXECUTED,         /* coordinator: local execution is finished, PREPARE starts */
+	MTM_EV_PREPARED,         /* coordinator: PREPARE record is flushed */
+	MTM_EV_DECODED,          /* coordinator: walsender to the replica starts to send decoded transaction */
+	MTM_EV_SENT,             /* coordinator: walsender has written PREPARE message to the replica */
+	MTM_EV_RECEIVE_BEGIN,    /* replica: receiver got BEGIN of transaction */
+	MTM_EV_RECEIVED,         /* replica: receiver passes the whole transaction to the pool */
+	MTM_EV_APPLY_BEGIN,      /* replica: pool worker starts to apply transaction */
+	MTM_EV_APPLIED,          /* replica: changes are applied, PREPARE starts */
+	MTM_EV_REPLICA_PREPARED, /* replica: PREPARE record is flushed, vote is passed to arbiter */
+	MTM_EV_VOTE_SENT,        /* replica: arbiter writes PREPARED vote to the socket */
+	MTM_EV_VOTE_RECEIVED,    /* coordinator: arbiter got PREPARED vote of the replica */
+	MTM_EV_VOTED,            /* coordinator: backend sees that all PREPARED votes are received */
+	MTM_N_COMMIT_EVENTS
+} MtmCommitEvent;
+
+/* Commit path event collected from some node for commit profile */
+typedef struct
+{
+	int         origin;      /* node which recorded the event */
+	int         code;        /* MtmCommitEvent */
+	int         node;        /* peer node of the event */
+	timestamp_t time;        /* system time of origin node */
+} MtmProfileEvent;
+
+/*
+ * Phases of commit of distributed transaction at coordinator
+ */
+typedef enum
+{
+	MTM_PHASE_PREPARE,   /* local PREPARE of transaction */
+	MTM_PHASE_VOTE,      /* waiting for PREPARED votes */
+	MTM_PHASE_PRECOMMIT, /* waiting for PRECOMMITTED votes */
+	MTM_PHASE_COMMIT,    /* local COMMIT PREPARED */
+	MTM_N_PHASES
+} Mtm2PCPhase;
+
+/*
+ * Apply statistic of the node. Counters are updated using atomic operations without locks,
+ * rates and queue depth history are maintained by monitor worker.
+ * For local node there are statistic of 2PC phases and detected global deadlocks.
+ */
+typedef struct
+{
+	pg_atomic_uint64 rowsApplied;      /* Number of rows inserted, updated or deleted by transactions received from this node */
+	pg_atomic_uint64 bytesApplied;     /* Size of transactions received from this node */
+	pg_atomic_uint64 spillBytes;       /* Size of data received from this node which was spilled to the disk */
+	pg_atomic_uint64 conflicts;        /* Number of transactions from this node which failed to be applied */
+	pg_atomic_uint64 deadlocks;        /* Number of detected global deadlocks */
+	pg_atomic_uint64 phaseTime[MTM_N_PHASES];  /* Total time (microseconds) of 2PC phases */
+	pg_atomic_uint64 phaseCount[MTM_N_PHASES];
+	timestamp_t lastSampleTime;
+	uint64      lastRowsApplied;
+	uint64      lastBytesApplied;
+	uint64      rowsPerSec;
+	uint64      bytesPerSec;
+	int         queueDepth[MTM_STATS_HISTORY]; /* Ring buffer of sampled apply queue depth */
+	int         queueDepthPos;                 /* Total number of collected samples */
+} MtmApplyStats;
+
+#define MtmStatAdd(nodeId, counter, n) pg_atomic_fetch_add_u64(&Mtm->nodes[(nodeId)-1].stats.counter, (n))
+
 typedef struct
 {
 	MtmConnectionInfo con;
+	MtmApplyStats stats;
 	timestamp_t transDelay;
+	uint32      voteLatency[MTM_LATENCY_BUCKETS]; /* Decaying histogram of PREPARED vote round-trips */
+	uint32      nVoteLatencySamples;   /* Number of samples in voteLatency histogram */
 	timestamp_t lastStatusChangeTime;
 	timestamp_t receiverStartTime;
 	timestamp_t senderStartTime;
@@ -216,13 +386,38 @@ typedef struct
 	lsn_t       flushPos;
 	csn_t       oldestSnapshot;        /* Oldest snapshot used by active transactions at this node */	
 	lsn_t       restartLSN;
+	lsn_t       recoveryFence;         /* WAL position which WAL-sender should reach to complete recovery of this node without locking cluster */
 	RepOriginId originId;
 	int         timeline;
-	void*       lockGraphData;
+	void*       lockGraphData;         /* Ordered array of lock graph edges (MtmLockEdge) */
 	int         lockGraphAllocated;
 	int         lockGraphUsed;
+	timestamp_t lockGraphVersion;      /* Version of lock graph received from this node, 0 if graph is not known */
+	int         lockGraphUpdates;      /* Number of lock graph updates sent by this node */
+	uint64      commitTicketIssued;    /* Number of commit tickets assigned by receiver to transactions of this node */
+	pg_atomic_uint64 commitTicketDone; /* Number of transactions of this node committed in ticket order */
+	Latch*      commitTicketWaiters[MTM_COMMIT_TICKET_WAITERS]; /* Latches of apply workers waiting for the turn of their ticket */
 } MtmNodeInfo;
 
+/*
+ * Part of backend state which is accessed by other processes.
+ * Slots are indexed by pgprocno and padded to cache line size, so that
+ * backends updating their own slots do not invalidate each other's caches.
+ */
+typedef struct
+{
+	TransactionId snapshotWaitXid;     /* XID of in-doubt transaction backend is waiting for */
+	csn_t activeSnapshot;              /* snapshot of transaction executed by backend, INVALID_CSN if none */
+} MtmBackendState;
+
+typedef union
+{
+	MtmBackendState state;
+	char pad[PG_CACHE_LINE_SIZE];
+} MtmBackendSlot;
+
+#define MtmBackend(procno) (&Mtm->backends[procno].state)
+
 typedef struct MtmTransState
 {
     TransactionId  xid;
@@ -242,12 +437,24 @@ typedef struct MtmTransState
 	bool           isActive;           /* Transaction is active */
 	bool           isTwoPhase;         /* User level 2PC */
 	bool           isPinned;           /* Transaction oid potected from GC */
+	bool           isFastCommit;       /* Transaction only inserts in fast commit tables: precommit phase is skipped */
+	bool           isHomeLocal;        /* Transaction only changes rows owned by this node: it is committed without waiting for votes */
 	int            nConfigChanges;     /* Number of cluster configuration changes at moment of transaction start */
+	timestamp_t    quorumTime;         /* When majority of nodes has voted in current phase, 0 if not yet */
 	nodemask_t     participantsMask;   /* Mask of nodes involved in transaction */
 	nodemask_t     votedMask;          /* Mask of voted nodes */
 	TransactionId  xids[1];            /* [Mtm->nAllNodes]: transaction ID at replicas */
 } MtmTransState;
 
+/* Element of cache of final statuses of transactions, see MtmCsnCacheLookup */
+typedef struct
+{
+	pg_atomic_uint32 seq;              /* seqlock: odd while entry is updated */
+	TransactionId    xid;
+	XidStatus        status;
+	csn_t            csn;
+} MtmCsnCacheEntry;
+
 typedef struct {
 	pgid_t gid;
 	bool   abort;
@@ -259,10 +466,11 @@ typedef struct
 {
 	MtmNodeStatus status;              /* Status of this node */
 	int recoverySlot;                  /* NodeId of recovery slot or 0 if none */
-	volatile slock_t queueSpinlock;    /* spinlock used to protect sender queue */
-	PGSemaphoreData sendSemaphore;     /* semaphore used to notify mtm-sender about new responses to coordinator */
+	Latch* volatile senderLatch;       /* latch used to notify mtm-sender about new responses to coordinator */
+	Latch* volatile monitorLatch;      /* latch used to start garbage collection by mtm-monitor */
 	LWLockPadded *locks;               /* multimaster lock tranche */
 	TransactionId oldestXid;           /* XID of oldest transaction visible by any active transaction (local or global) */
+	csn_t oldestCsn;                   /* transactions committed with smaller CSN are visible for all active snapshots at all nodes */
 	nodemask_t disabledNodeMask;       /* bitmask of disabled nodes */
 	nodemask_t stalledNodeMask;        /* bitmask of stalled nodes (node with dropped relication slot which makes it not possible automatic recovery of such node) */
 	nodemask_t stoppedNodeMask;        /* Bitmask of stopped (permanently disabled nodes) */
@@ -271,8 +479,11 @@ typedef struct
 	nodemask_t walSenderLockerMask;    /* Mask of WAL-senders IDs locking the cluster */
 	nodemask_t nodeLockerMask;         /* Mask of node IDs which WAL-senders are locking the cluster */
 	nodemask_t reconnectMask; 	       /* Mask of nodes connection to which has to be reestablished by sender */
+	uint64     connectivityEpoch;      /* Incremented on each change of connectivity matrix */
 	int        lastLockHolder;         /* PID of process last obtaning the node lock */
 	bool   localTablesHashLoaded;      /* Whether data from local_tables table is loaded in shared memory hash table */
+	pg_atomic_uint64 localTablesVersion; /* Incremented on each change of local tables hash, used to invalidate walsender caches */
+	bool   fastCommitTablesHashLoaded; /* Whether data from fast_commit_tables table is loaded in shared memory hash table */
 	bool   preparedTransactionsLoaded; /* GIDs of prepared transactions are loaded at startup */
 	int    inject2PCError;             /* Simulate error during 2PC commit at this node */
     int    nLiveNodes;                 /* Number of active nodes */
@@ -284,8 +495,7 @@ typedef struct
 	int    nConfigChanges;             /* Number of cluster configuration changes */
 	int    recoveryCount;              /* Number of completed recoveries */
 	int    donorNodeId;               /* Cluster node from which this node was populated */
-	int64  timeShift;                  /* Local time correction */
-	csn_t  csn;                        /* Last obtained timestamp: used to provide unique acending CSNs based on system time */
+	pg_atomic_uint64 csn;              /* Last obtained timestamp: used to provide unique acending CSNs based on system time */
 	csn_t  lastCsn;                    /* CSN of last committed transaction */
 	MtmTransState* votingTransactions; /* L1-list of replicated transactions sendings notifications to coordinator.
 									 	 This list is used to pass information to mtm-sender BGW */
@@ -295,8 +505,25 @@ typedef struct
 								  		  This list is expected to be in CSN ascending order, by strict order may be violated */
 	ulong64 transCount;                /* Counter of transactions perfromed by this node */	
 	ulong64 gcCount;                   /* Number of global transactions performed since last GC */
-	MtmMessageQueue* sendQueue;        /* Messages to be sent by arbiter sender */
-	MtmMessageQueue* freeQueue;        /* Free messages */
+	pg_atomic_uint32 sendQueueHead;    /* Position of next message to be taken by arbiter sender */
+	pg_atomic_uint32 sendQueueTail;    /* Position of next free cell */
+	pg_atomic_uint64 sendQueueFull;    /* Number of times MtmSendMessage found send queue full */
+	uint32 sendQueueMask;              /* Size of send queue minus one (size is power of two) */
+	MtmSendQueueCell* sendQueue;       /* Messages to be sent by arbiter sender */
+	pg_atomic_uint32 nSnapshotWaiters; /* Number of backends waiting in MtmXidInMVCCSnapshot for resolution of in-doubt transaction */
+	MtmBackendSlot* backends;          /* [ProcGlobal->allProcCount]: per-backend state indexed by pgprocno */
+	MtmCsnCacheEntry* csnCache;        /* [MTM_CSN_CACHE_SIZE]: direct mapped cache of committed/aborted transactions */
+	pg_atomic_uint64 transMemoryUsed;  /* Memory used by receivers for buffering transactions above multimaster.trans_spill_threshold */
+	pg_atomic_uint64 traceHead;        /* Position of next event in trace buffer */
+	MtmTraceEvent* traceBuffer;        /* [MTM_TRACE_BUFFER_SIZE]: ring buffer of events of sampled transactions */
+	uint32 profileRequest;             /* ID of the last request for commit profile events sent by this node */
+	int    profileOwner;               /* PID of backend collecting commit profile, 0 if none */
+	timestamp_t profileDeadline;       /* Time when owner stops waiting for responses, after it other backend can take over */
+	nodemask_t profileRespondedMask;   /* Nodes which have sent all their events for the current request */
+	int    nProfileEvents;             /* Number of events received for the current request */
+	MtmProfileEvent profileEvents[MTM_PROFILE_MAX_EVENTS]; /* Events received from other nodes for the current request */
+	pg_atomic_uint64 waitCount[MTM_N_WAIT_EVENTS]; /* Number of sleeps of all backends and workers in each wait event */
+	pg_atomic_uint64 waitTime[MTM_N_WAIT_EVENTS];  /* Total time (microseconds) of these sleeps */
 	lsn_t recoveredLSN;           /* LSN at the moment of recovery completion */
 	BgwPool pool;                      /* Pool of background workers for applying logical replication patches */
 	MtmNodeInfo nodes[1];              /* [Mtm->nAllNodes]: per-node data */ 
@@ -330,10 +557,19 @@ extern int   MtmConnectTimeout;
 extern int   MtmReconnectTimeout;
 extern int   MtmNodeDisableDelay;
 extern int   MtmTransSpillThreshold;
+extern int   MtmTransSpillBudget;
 extern int   MtmHeartbeatSendTimeout;
 extern int   MtmHeartbeatRecvTimeout;
 extern bool  MtmUseDtm;
 extern bool  MtmPreserveCommitOrder;
+extern bool  MtmCompressReplication;
+extern bool  MtmTrustedCluster;
+extern int   MtmArbiterReceivers;
+extern int   MtmTraceSampleRatio;
+extern int   MtmApplyPrefetchDepth;
+extern int   MtmApplyMaintenanceWorkers;
+extern int   MtmStandbySnapshotPeriod;
+extern bool  MtmIsStandby;
 extern HTAB* MtmXid2State;
 extern HTAB* MtmGid2State;
 extern VacuumStmt* MtmVacuumStmt;
@@ -341,6 +577,7 @@ extern IndexStmt*  MtmIndexStmt;
 extern DropStmt*   MtmDropStmt;
 extern MemoryContext MtmApplyContext;
 extern lsn_t MtmSenderWalEnd;
+extern lsn_t MtmSenderRestartLSN[MAX_NODES];
 extern timestamp_t MtmRefreshClusterStatusSchedule;
 
 
@@ -348,15 +585,24 @@ extern void  MtmArbiterInitialize(void);
 extern void  MtmStartReceivers(void);
 extern void  MtmStartReceiver(int nodeId, bool dynamic);
 extern csn_t MtmTransactionSnapshot(TransactionId xid);
+extern AttrNumber MtmGetHomeColumn(Relation rel);
+extern bool  MtmIsHomeTuple(Relation rel, AttrNumber attnum, HeapTuple tuple, int nodeId);
+extern bool  MtmIsHomeLocalGid(char const* gid);
+extern void  MtmWaitForPreparedTransaction(char const* gid);
 extern csn_t MtmAssignCSN(void);
 extern csn_t MtmSyncClock(csn_t csn);
 extern void  MtmJoinTransaction(GlobalTransactionId* gtid, csn_t snapshot);
 extern void  MtmReceiverStarted(int nodeId);
 extern MtmReplicationMode MtmGetReplicationMode(int nodeId, sig_atomic_t volatile* shutdown);
-extern void  MtmExecute(void* work, int size);
+extern void  MtmExecute(void* work, int size, uint32 const* footprint, int footprintSize);
+extern bool  MtmStartStream(int nodeId);
+extern void  MtmExecuteStream(int nodeId, void* work, int size, bool last);
+extern int   MtmStreamChunkSize(void);
+extern void  MtmAbortStream(int nodeId);
 extern void  MtmExecutor(void* work, size_t size);
 extern void  MtmSend2PCMessage(MtmTransState* ts, MtmMessageCode cmd);
 extern void  MtmSendMessage(MtmArbiterMessage* msg);
+extern bool  MtmDequeueMessage(MtmArbiterMessage* msg);
 extern void  MtmAdjustSubtransactions(MtmTransState* ts);
 extern void  MtmLock(LWLockMode mode);
 extern void  MtmUnlock(void);
@@ -368,6 +614,13 @@ extern void  MtmRecoverNode(int nodeId);
 extern void  MtmOnNodeDisconnect(int nodeId);
 extern void  MtmOnNodeConnect(int nodeId);
 extern void  MtmWakeUpBackend(MtmTransState* ts);
+extern void  MtmAddVoteLatency(int nodeId, timestamp_t latency);
+extern timestamp_t MtmGetVoteLatency(int nodeId, int percentile);
+extern void  MtmSampleApplyStats(void);
+extern void  MtmTraceTransaction(char const* gid, char const* event);
+extern void  MtmTraceCommitEvent(char const* gid, MtmCommitEvent event, int node, timestamp_t time);
+extern void  MtmHandleTraceRequest(MtmArbiterMessage* msg);
+extern void  MtmHandleTraceEvent(MtmArbiterMessage* msg);
 extern void  MtmSleep(timestamp_t interval); 
 extern void  MtmAbortTransaction(MtmTransState* ts);
 extern void  MtmSetCurrentTransactionGID(char const* gid);
@@ -377,11 +630,21 @@ extern TransactionId MtmGetCurrentTransactionId(void);
 extern XidStatus MtmGetCurrentTransactionStatus(void);
 extern XidStatus MtmExchangeGlobalTransactionStatus(char const* gid, XidStatus status);
 extern bool  MtmIsRecoveredNode(int nodeId);
+extern void  MtmHandleSequenceRequest(MtmArbiterMessage* msg);
+extern uint64 MtmIssueCommitTicket(int nodeId);
+extern void  MtmWaitCommitTicket(int nodeId, uint64 ticket);
+extern void  MtmReleaseCommitTicket(int nodeId, uint64 ticket);
+extern void  MtmHandleSequenceResponse(MtmArbiterMessage* msg);
 extern void  MtmRefreshClusterStatus(void);
+extern void  MtmConnectivityChanged(void);
+extern void  MtmCollectGarbage(void);
+extern void  MtmLogStandbyHorizon(void);
+extern void  MtmFenceNodes(int originNode, MtmFenceLogicalMessage const* msg);
 extern void  MtmSwitchClusterMode(MtmNodeStatus mode);
 extern void  MtmUpdateNodeConnectionInfo(MtmConnectionInfo* conn, char const* connStr);
 extern void  MtmSetupReplicationHooks(struct PGLogicalHooks* hooks);
 extern void  MtmCheckQuorum(void);
+extern void  MtmCheckPrewarmCompleted(void);
 extern bool  MtmRecoveryCaughtUp(int nodeId, lsn_t walEndPtr);
 extern void  MtmCheckRecoveryCaughtUp(int nodeId, lsn_t slotLSN);
 extern void  MtmRecoveryCompleted(void);
@@ -399,7 +662,6 @@ extern void MtmBeginSession(int nodeId);
 extern void MtmEndSession(int nodeId, bool unlock);
 extern void MtmFinishPreparedTransaction(MtmTransState* ts, bool commit);
 extern void MtmRollbackPreparedTransaction(int nodeId, char const* gid);
-extern bool MtmFilterTransaction(char* record, int size);
-extern void MtmPrecommitTransaction(char const* gid);
-extern char* MtmGucSerialize(void);
+extern bool MtmFilterTransaction(char* record, int size, char const** gid);
+extern void MtmPrecommitTransactions(int n, char const* const* gids);
 #endif
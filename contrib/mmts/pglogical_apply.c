@@ -15,6 +15,7 @@
 #include "catalog/dependency.h"
 #include "catalog/index.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
 
 #include "executor/spi.h"
@@ -45,6 +46,7 @@
 #include "utils/tqual.h"
 #include "utils/builtins.h"
 #include "utils/datetime.h"
+#include "utils/guc.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
@@ -64,16 +66,17 @@ typedef struct TupleData
 
 static Relation read_rel(StringInfo s, LOCKMODE mode);
 static void read_tuple_parts(StringInfo s, Relation rel, TupleData *tup);
+static void skip_tuple_parts(StringInfo s, Relation rel);
 static EState* create_rel_estate(Relation rel);
 static bool find_pkey_tuple(ScanKey skey, Relation rel, Relation idxrel,
                             TupleTableSlot *slot, bool lock, LockTupleMode mode);
 static void build_index_scan_keys(EState *estate, ScanKey *scan_keys, TupleData *tup);
 static bool build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup);
 static void UserTableUpdateOpenIndexes(EState *estate, TupleTableSlot *slot);
-static void UserTableUpdateIndexes(EState *estate, TupleTableSlot *slot);
 
 static bool process_remote_begin(StringInfo s);
 static bool process_remote_message(StringInfo s);
+static void MtmResetGucs(void);
 static void process_remote_commit(StringInfo s);
 static void process_remote_insert(StringInfo s, Relation rel);
 static void process_remote_update(StringInfo s, Relation rel);
@@ -81,6 +84,14 @@ static void process_remote_delete(StringInfo s, Relation rel);
 
 static MemoryContext TopContext;
 static bool          GucAltered; /* transaction is setting some GUC variables */
+static int           GucSessionNode;    /* origin session which GUCs are applied by worker */
+static int32         GucSession;
+static timestamp_t   GucSessionVersion;
+static int           HomeNode;   /* coordinator of applied transaction */
+static bool          ForeignHomeRows; /* applied transaction changes rows of home tables not owned by its coordinator */
+static int           CommitTicketNode; /* origin node of the commit ticket */
+static uint64        CommitTicket;     /* ticket of applied commit-prepared or rollback-prepared, 0 if none */
+static timestamp_t   ApplyStartTime;   /* when worker started to apply current transaction, recorded in its profile at PREPARE */
 
 /*
  * Search the index 'idxrel' for a tuple identified by 'skey' in 'rel'.
@@ -218,53 +229,24 @@ static bool
 build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup)
 {
 	int			attoff;
-	Datum		indclassDatum;
-	Datum		indkeyDatum;
-	bool		isnull;
-	oidvector  *opclass;
-	int2vector  *indkey;
 	bool		hasnulls = false;
+	/* catalog lookups are done only once: template of scan key is cached across transactions */
+	PGLIndexKeyMapEntry* keys = pglogical_index_key_map_get(rel, idxrel);
 
-	indclassDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
-									Anum_pg_index_indclass, &isnull);
-	Assert(!isnull);
-	opclass = (oidvector *) DatumGetPointer(indclassDatum);
-
-	indkeyDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
-									Anum_pg_index_indkey, &isnull);
-	Assert(!isnull);
-	indkey = (int2vector *) DatumGetPointer(indkeyDatum);
-
-
-	for (attoff = 0; attoff < IndexRelationGetNumberOfKeyAttributes(idxrel); attoff++)
+	for (attoff = 0; attoff < keys->nkeys; attoff++)
 	{
-		Oid			operator;
-		Oid			opfamily;
-		RegProcedure regop;
 		int			pkattno = attoff + 1;
-		int			mainattno = indkey->values[attoff];
-		Oid			atttype = attnumTypeId(rel, mainattno);
-		Oid			optype = get_opclass_input_type(opclass->values[attoff]);
-
-		opfamily = get_opclass_family(opclass->values[attoff]);
-
-		operator = get_opfamily_member(opfamily, optype,
-									   optype,
-									   BTEqualStrategyNumber);
-
-		if (!OidIsValid(operator))
-			elog(ERROR,
-				 "could not lookup equality operator for type %u, optype %u in opfamily %u",
-				 atttype, optype, opfamily);
-
-		regop = get_opcode(operator);
+		int			mainattno = keys->attnums[attoff];
 
 		/* FIXME: convert type? */
-		ScanKeyInit(&skey[attoff],
-					pkattno,
-					BTEqualStrategyNumber,
-					regop,
-					tup->values[mainattno - 1]);
+		ScanKeyEntryInitializeWithInfo(&skey[attoff],
+									   0,
+									   pkattno,
+									   BTEqualStrategyNumber,
+									   InvalidOid,
+									   C_COLLATION_OID,
+									   &keys->eqfuncs[attoff],
+									   tup->values[mainattno - 1]);
 
 		if (tup->isnull[mainattno - 1])
 		{
@@ -275,18 +257,6 @@ build_index_scan_key(ScanKey skey, Relation rel, Relation idxrel, TupleData *tup
 	return hasnulls;
 }
 
-static void
-UserTableUpdateIndexes(EState *estate, TupleTableSlot *slot)
-{
-	/* HOT update does not require index inserts */
-	if (HeapTupleIsHeapOnly(slot->tts_tuple))
-		return;
-
-	ExecOpenIndices(estate->es_result_relation_info, false);
-	UserTableUpdateOpenIndexes(estate, slot);
-	ExecCloseIndices(estate->es_result_relation_info);
-}
-
 static void
 UserTableUpdateOpenIndexes(EState *estate, TupleTableSlot *slot)
 {
@@ -337,7 +307,6 @@ process_remote_begin(StringInfo s)
 {
 	GlobalTransactionId gtid;
 	csn_t snapshot;
-	int rc;
 
 	gtid.node = pq_getmsgint(s, 4); 
 	gtid.xid = pq_getmsgint(s, 4); 
@@ -346,6 +315,7 @@ process_remote_begin(StringInfo s)
 	Assert(gtid.node > 0);
 
 	MTM_LOG2("REMOTE begin node=%d xid=%d snapshot=%lld", gtid.node, gtid.xid, snapshot);
+	ApplyStartTime = MtmGetSystemTime();
 	MtmResetTransaction();		
 #if 1
 	if (BIT_CHECK(Mtm->disabledNodeMask, gtid.node-1)) { 
@@ -356,20 +326,77 @@ process_remote_begin(StringInfo s)
     SetCurrentStatementStartTimestamp();     
 	StartTransactionCommand();
     MtmJoinTransaction(&gtid, snapshot);
+	HomeNode = gtid.node;
+	ForeignHomeRows = false;
 
-	if (GucAltered) {
-		SPI_connect();
-		GucAltered = false;
-		rc = SPI_execute("RESET SESSION AUTHORIZATION; reset all;", false, 0);
-		SPI_finish();
-		if (rc < 0) { 
-			elog(ERROR, "Failed to set reset context: %d", rc);
-		}
+	/* GUCs are kept if transaction starts with DDL: it will check whether they are the same */
+	if (GucAltered && !(s->cursor + 1 < s->len && s->data[s->cursor] == 'M' && s->data[s->cursor+1] == 'D')) {
+		MtmResetGucs();
 	}
 
 	return true;
 }
 
+static void
+MtmResetGucs(void)
+{
+	int rc;
+	SPI_connect();
+	GucAltered = false;
+	GucSessionNode = 0;
+	rc = SPI_execute("RESET SESSION AUTHORIZATION; reset all;", false, 0);
+	SPI_finish();
+	if (rc < 0) { 
+		elog(ERROR, "Failed to set reset context: %d", rc);
+	}
+}
+
+/*
+ * Set GUCs of origin session before execution of its DDL statement.
+ * GUCs are pairs of null-terminated name and value. Nothing is done if worker has already applied the same
+ * version of GUCs of this session.
+ */
+static void
+MtmApplyGucs(MtmDDLMessageHeader const* hdr, char const* gucs)
+{
+	char const* end = gucs + hdr->gucSize;
+
+	if (GucAltered && GucSessionNode == MtmReplicationNodeId && GucSession == hdr->session && GucSessionVersion == hdr->gucVersion) { 
+		return;
+	}
+	if (GucAltered) { 
+		MtmResetGucs();
+	}
+	while (gucs < end) { 
+		char const* name = gucs;
+		char const* value = name + strlen(name) + 1;
+		gucs = value + strlen(value) + 1;
+		(void) set_config_option(name, value,
+								 superuser() ? PGC_SUSET : PGC_USERSET, PGC_S_SESSION,
+								 GUC_ACTION_SET, true, 0, false);
+	}
+	GucAltered = true;
+	GucSessionNode = MtmReplicationNodeId;
+	GucSession = hdr->session;
+	GucSessionVersion = hdr->gucVersion;
+}
+
+/*
+ * Rows of home tables may be changed only by transactions coordinated by their home node (see mtm_home_check).
+ * Violation is detected at PREPARE, when GID tells us how the transaction was committed. Recovery does not
+ * preserve coordinator of transaction, so the check is skipped.
+ */
+static void
+check_home_tuple(Relation rel, HeapTuple tuple)
+{
+	if (!ForeignHomeRows && Mtm->status != MTM_RECOVERY) { 
+		AttrNumber attnum = MtmGetHomeColumn(rel);
+		if (attnum != InvalidAttrNumber && !MtmIsHomeTuple(rel, attnum, tuple, HomeNode)) { 
+			ForeignHomeRows = true;
+		}
+	}
+}
+
 static bool
 process_remote_message(StringInfo s)
 {
@@ -377,12 +404,21 @@ process_remote_message(StringInfo s)
 	int messageSize = pq_getmsgint(s, 4);
 	char const* messageBody = pq_getmsgbytes(s, messageSize);
 	bool standalone = false;
+	MtmDDLMessageHeader hdr;
+	char const* query = NULL;
+
+	if (action == 'C' || action == 'D') { 
+		Assert(messageSize >= sizeof(hdr));
+		memcpy(&hdr, messageBody, sizeof(hdr));
+		Assert(hdr.gucSize >= 0); /* references to GUCs are resolved by receiver */
+		query = messageBody + sizeof(hdr) + hdr.gucSize;
+	}
 
 	switch (action)
 	{
 		case 'C':
 		{
-			MTM_LOG1("%d: Executing non-tx utility statement %s", MyProcPid, messageBody);
+			MTM_LOG1("%d: Executing non-tx utility statement %s", MyProcPid, query);
 			SetCurrentStatementStartTimestamp();
 			MtmResetTransaction();
 			StartTransactionCommand();
@@ -392,17 +428,29 @@ process_remote_message(StringInfo s)
 		case 'D':
 		{
 			int rc;
-			GucAltered = true;
-			MTM_LOG1("%d: Executing utility statement %s", MyProcPid, messageBody);
+			MTM_LOG1("%d: Executing utility statement %s", MyProcPid, query);
+			MtmApplyGucs(&hdr, messageBody + sizeof(hdr));
 			SPI_connect();
-			ActivePortal->sourceText = messageBody;
+			ActivePortal->sourceText = query;
 			MtmVacuumStmt = NULL;
 			MtmIndexStmt = NULL;
 			MtmDropStmt = NULL;
-			rc = SPI_execute(messageBody, false, 0);
+			if (MtmApplyMaintenanceWorkers >= 0) {
+				/*
+				 * Every node builds replicated indexes itself: heap TIDs differ between nodes, so pages of
+				 * an index built elsewhere can't be reused. Let the build use workers of this node instead.
+				 * The setting is local to the transaction applying the statement.
+				 */
+				char workers[16];
+				sprintf(workers, "%d", MtmApplyMaintenanceWorkers);
+				(void) set_config_option("max_parallel_maintenance_workers", workers,
+										 PGC_USERSET, PGC_S_SESSION,
+										 GUC_ACTION_LOCAL, true, 0, false);
+			}
+			rc = SPI_execute(query, false, 0);
 			SPI_finish();
 			if (rc < 0) { 
-				elog(ERROR, "Failed to execute utility statement %s", messageBody);
+				elog(ERROR, "Failed to execute utility statement %s", query);
 			} else { 
 				PushActiveSnapshot(GetTransactionSnapshot());
 
@@ -415,7 +463,7 @@ process_remote_message(StringInfo s)
 														 NULL,
 														 NULL);
 					/* Run parse analysis ... */
-					MtmIndexStmt = transformIndexStmt(relid, MtmIndexStmt, messageBody);
+					MtmIndexStmt = transformIndexStmt(relid, MtmIndexStmt, query);
 
 					MemoryContextSwitchTo(oldContext);
 
@@ -464,6 +512,13 @@ process_remote_message(StringInfo s)
 			standalone = true;
 			break;
 		}
+		case 'F':
+		{
+			Assert(messageSize == sizeof(MtmFenceLogicalMessage));
+			MtmFenceNodes(MtmReplicationNodeId, (MtmFenceLogicalMessage const*)messageBody);
+			standalone = true;
+			break;
+		}
 		case 'L':
 		{
 			MTM_LOG3("%lld: Process deadlock message with size %d from %d", MtmGetSystemTime(), messageSize, MtmReplicationNodeId);
@@ -536,6 +591,32 @@ read_tuple_parts(StringInfo s, Relation rel, TupleData *tup)
 				else
 					tup->values[i] = PointerGetDatum(data);
 				break;
+			case 'o': /* internal format with embedded type oid */
+				{
+					Oid typid = getBaseType(att->atttypid);
+					struct varlena *datum;
+
+					tup->isnull[i] = false;
+					len = pq_getmsgint(s, 4); /* read length */
+					data = pq_getmsgbytes(s, len);
+
+					/* copy is needed anyway to patch OID and align data */
+					datum = (struct varlena *) palloc(len);
+					memcpy(datum, data, len);
+					if (len < VARHDRSZ || VARSIZE(datum) != len)
+						elog(ERROR, "incorrect length %d of column %s", len, NameStr(att->attname));
+
+					if (type_is_rowtype(typid) && typid != RECORDOID) {
+						HeapTupleHeaderSetTypeId((HeapTupleHeader) datum, typid);
+						HeapTupleHeaderSetTypMod((HeapTupleHeader) datum, -1);
+					} else if (type_is_array(typid)) {
+						ARR_ELEMTYPE((ArrayType *) datum) = get_element_type(typid);
+					} else {
+						elog(ERROR, "type %s of column %s has no embedded type OID", format_type_be(att->atttypid), NameStr(att->attname));
+					}
+					tup->values[i] = PointerGetDatum(datum);
+					break;
+				}
 			case 's': /* send/recv format */
 				{
 					Oid typreceive;
@@ -586,6 +667,50 @@ read_tuple_parts(StringInfo s, Relation rel, TupleData *tup)
 	}
 }
 
+/*
+ * Move cursor past the tuple without decoding its columns.
+ */
+static void
+skip_tuple_parts(StringInfo s, Relation rel)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	int			i;
+	char		action;
+
+	action = pq_getmsgbyte(s);
+
+	if (action != 'T')
+		elog(ERROR, "expected TUPLE, got %c", action);
+
+	(void) pq_getmsgint(s, 2);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		char		kind;
+
+		if (desc->attrs[i]->atttypid == InvalidOid) {
+			continue;
+		}
+
+		kind = pq_getmsgbyte(s);
+
+		switch (kind)
+		{
+			case 'n':
+			case 'u':
+				break;
+			case 'b':
+			case 'o':
+			case 's':
+			case 't':
+				(void) pq_getmsgbytes(s, pq_getmsgint(s, 4));
+				break;
+			default:
+				elog(ERROR, "unknown column type '%c'", kind);
+		}
+	}
+}
+
 static Relation 
 read_rel(StringInfo s, LOCKMODE mode)
 {
@@ -595,23 +720,35 @@ read_rel(StringInfo s, LOCKMODE mode)
 	Oid			remote_relid = pq_getmsgint(s, 4);
 	Oid         local_relid;
 
+	/* 
+	 * Sender includes names of the relation only in the first 'R' message of the transaction,
+	 * zero length of schema name means that we should use names remembered before.
+	 */
+	nspnamelen = pq_getmsgbyte(s);
+	if (nspnamelen != 0) { 
+		char const* nspname = pq_getmsgbytes(s, nspnamelen);
+		char const* relname;
+		relnamelen = pq_getmsgbyte(s);
+		relname = pq_getmsgbytes(s, relnamelen);
+		pglogical_relid_map_set_name(remote_relid, nspname, relname);
+	}
+
 	local_relid = pglogical_relid_map_get(remote_relid);
+	if (local_relid != InvalidOid) { 
+		/* relation can be dropped or renamed while we are waiting for the lock: then mapping is invalidated */
+		LockRelationOid(local_relid, mode);
+		if (pglogical_relid_map_get(remote_relid) != local_relid) { 
+			UnlockRelationOid(local_relid, mode);
+			local_relid = InvalidOid;
+		}
+	}
 	if (local_relid == InvalidOid) { 
-		rv = makeNode(RangeVar);
-
-		nspnamelen = pq_getmsgbyte(s);
-		rv->schemaname = (char *) pq_getmsgbytes(s, nspnamelen);
-		
-		relnamelen = pq_getmsgbyte(s);
-		rv->relname = (char *) pq_getmsgbytes(s, relnamelen);
-		
+		rv = pglogical_relid_map_get_name(remote_relid);
+		if (rv == NULL) { 
+			elog(ERROR, "Name of remote relation %u is not known", remote_relid);
+		}
 		local_relid = RangeVarGetRelidExtended(rv, mode, false, false, NULL, NULL);
 		pglogical_relid_map_put(remote_relid, local_relid);
-	} else { 
-		nspnamelen = pq_getmsgbyte(s);
-		s->cursor += nspnamelen;
-		relnamelen = pq_getmsgbyte(s);
-		s->cursor += relnamelen;
 	}
 	return heap_open(local_relid, NoLock);
 }
@@ -640,16 +777,28 @@ process_remote_commit(StringInfo in)
 	replorigin_session_origin_lsn = origin_node == MtmReplicationNodeId ? end_lsn : origin_lsn;
 	Assert(replorigin_session_origin == InvalidRepOriginId);
 
+	if (CommitTicket != 0) { 
+		/* preserve commit order: wait until previous transactions of the node are committed */
+		MtmWaitCommitTicket(CommitTicketNode, CommitTicket);
+	}
+
 	switch (event)
 	{
 	    case PGLOGICAL_PRECOMMIT_PREPARED:
 		{
+			/* precommits of a whole batch come in one message */
+			int n = pq_getmsgint(in, 4);
+			char const** gids = (char const**)palloc(n*sizeof(char const*));
+			int i;
 			Assert(!TransactionIdIsValid(MtmGetCurrentTransactionId()));
-			gid = pq_getmsgstring(in);
-			MTM_LOG2("%d: PGLOGICAL_PRECOMMIT_PREPARED %s", MyProcPid, gid);
+			for (i = 0; i < n; i++) { 
+				gids[i] = pq_getmsgstring(in);
+				MTM_LOG2("%d: PGLOGICAL_PRECOMMIT_PREPARED %s", MyProcPid, gids[i]);
+			}
 			MtmBeginSession(origin_node);
-			MtmPrecommitTransaction(gid);
+			MtmPrecommitTransactions(n, gids);
 			MtmEndSession(origin_node, true);
+			pfree(gids);
 			return;
 		}
 		case PGLOGICAL_COMMIT:
@@ -667,6 +816,28 @@ process_remote_commit(StringInfo in)
 		{
 			Assert(IsTransactionState() && TransactionIdIsValid(MtmGetCurrentTransactionId()));
 			gid = pq_getmsgstring(in);
+			MTM_PROFILE(gid, MTM_EV_APPLY_BEGIN, origin_node, ApplyStartTime);
+			MTM_PROFILE(gid, MTM_EV_APPLIED, origin_node, MtmGetSystemTime());
+			if (ForeignHomeRows) { 
+				if (MtmIsHomeLocalGid(gid)) { 
+					/* 
+					 * Coordinator has already committed home-local transaction, so rejecting it makes this node
+					 * diverge from the others: recover it from them, as the check is not done in recovery.
+					 */
+					MtmLock(LW_EXCLUSIVE);
+					if (Mtm->status == MTM_ONLINE) { 
+						elog(WARNING, "Can not apply home-local transaction %s committed by node %d: switch to recovery", gid, origin_node);
+						BIT_SET(Mtm->disabledNodeMask, MtmNodeId-1);
+						MtmSwitchClusterMode(MTM_RECOVERY);
+					}
+					MtmUnlock();
+				}
+				elog(ERROR, "Transaction %s of node %d changes rows of home tables owned by other nodes", gid, origin_node);
+			}
+			if (Mtm->status != MTM_RECOVERY && BIT_CHECK(Mtm->disabledNodeMask, origin_node-1)) { 
+				/* transaction was started before coordinator was fenced, see MtmFenceNodes */
+				elog(ERROR, "Transaction %s of fenced node %d is rejected", gid, origin_node);
+			}
 			if (MtmExchangeGlobalTransactionStatus(gid, TRANSACTION_STATUS_IN_PROGRESS) == TRANSACTION_STATUS_ABORTED) { 
 				MTM_LOG1("Avoid prepare of previously aborted global transaction %s", gid);	
 				AbortCurrentTransaction();
@@ -700,6 +871,9 @@ process_remote_commit(StringInfo in)
 			csn = pq_getmsgint64(in); 
 			gid = pq_getmsgstring(in);
 			MTM_LOG2("PGLOGICAL_COMMIT_PREPARED commit: csn=%lld, gid=%s, lsn=%llx", csn, gid, end_lsn);
+			if (MtmIsHomeLocalGid(gid)) { 
+				MtmWaitForPreparedTransaction(gid);
+			}
 			MtmResetTransaction();
 			StartTransactionCommand();
 			MtmBeginSession(origin_node);
@@ -728,32 +902,217 @@ process_remote_commit(StringInfo in)
 	MtmUpdateLsnMapping(MtmReplicationNodeId, end_lsn);
 }
 
+/*
+ * Consecutive inserts into the same relation are collected in batch and written using heap_multi_insert.
+ * Conflicts with existed tuples are checked when tuple is added to the batch,
+ * conflicts between tuples of the same batch are detected by unique indexes.
+ */
+#define MTM_MAX_INSERT_BATCH_TUPLES 1000
+#define MTM_MAX_INSERT_BATCH_SIZE   65535
+
+typedef struct
+{
+	Relation        rel;
+	EState*         estate;
+	TupleTableSlot* slot;
+	TupleTableSlot* oldslot;
+	BulkInsertState bistate;     /* ring shared by the batches of a transaction */
+	LocalTransactionId bistateLxid; /* transaction bistate was allocated in */
+	int             nTuples;
+	Size            size;
+	HeapTuple       tuples[MTM_MAX_INSERT_BATCH_TUPLES];
+} MtmInsertBatch;
+
+static MtmInsertBatch MtmBatch;
+
+static void
+MtmFlushInsertBatch(void)
+{
+	EState* estate = MtmBatch.estate;
+	MemoryContext oldcontext;
+	int i;
+
+	if (MtmBatch.nTuples == 0) {
+		return;
+	}
+	oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+	heap_multi_insert(MtmBatch.rel, MtmBatch.tuples, MtmBatch.nTuples, GetCurrentCommandId(true), 0, MtmBatch.bistate);
+	MemoryContextSwitchTo(oldcontext);
+
+	for (i = 0; i < MtmBatch.nTuples; i++)
+	{
+		ExecStoreTuple(MtmBatch.tuples[i], MtmBatch.slot, InvalidBuffer, false);
+		UserTableUpdateOpenIndexes(estate, MtmBatch.slot);
+	}
+	ExecCloseIndices(estate->es_result_relation_info);
+	ReleaseBulkInsertStatePin(MtmBatch.bistate);
+
+	if (ActiveSnapshotSet())
+		PopActiveSnapshot();
+
+    heap_close(MtmBatch.rel, NoLock);
+    ExecResetTupleTable(estate->es_tupleTable, true);
+    FreeExecutorState(estate);
+
+	MtmBatch.nTuples = 0;
+	MtmBatch.estate = NULL;
+	MtmBatch.rel = NULL;
+
+	CommandCounterIncrement();
+}
+
+/*
+ * Forget about batch of aborted transaction: its resources are released by abort
+ */
+static void
+MtmResetInsertBatch(void)
+{
+	MtmBatch.nTuples = 0;
+	MtmBatch.estate = NULL;
+	MtmBatch.rel = NULL;
+	MtmBatch.bistate = NULL;
+}
+
+/*
+ * Executor state reused by consecutive updates and deletes of the same relation, so that
+ * applying huge replicated transaction doesn't create executor state and open replica identity
+ * and all other indexes of the relation for each row.
+ */
+typedef struct
+{
+	Relation        rel;
+	Relation        idxrel;
+	EState*         estate;
+	TupleTableSlot* oldslot;
+	TupleTableSlot* newslot;
+	bool            indicesOpened;
+} MtmModifyState;
+
+static MtmModifyState MtmModify;
+
+static void
+MtmCloseModifyState(void)
+{
+	if (MtmModify.rel == NULL) { 
+		return;
+	}
+	if (MtmModify.indicesOpened) { 
+		ExecCloseIndices(MtmModify.estate->es_result_relation_info);
+	}
+	/* release locks upon commit */
+	index_close(MtmModify.idxrel, NoLock);
+	heap_close(MtmModify.rel, NoLock);
+
+	ExecResetTupleTable(MtmModify.estate->es_tupleTable, true);
+	FreeExecutorState(MtmModify.estate);
+
+	MtmModify.rel = NULL;
+	MtmModify.idxrel = NULL;
+	MtmModify.estate = NULL;
+}
+
+/*
+ * Forget about modify state of aborted transaction: its resources are released by abort
+ */
+static void
+MtmResetModifyState(void)
+{
+	MtmModify.rel = NULL;
+	MtmModify.idxrel = NULL;
+	MtmModify.estate = NULL;
+}
+
+/*
+ * Get modify state for the relation, reusing state of previous update or delete if possible.
+ * Reference to the relation is owned by modify state.
+ */
+static MtmModifyState*
+MtmOpenModifyState(Relation rel)
+{
+	Oid idxoid;
+
+	if (MtmModify.rel != NULL) { 
+		if (RelationGetRelid(MtmModify.rel) == RelationGetRelid(rel)) { 
+			heap_close(rel, NoLock);
+			ResetPerTupleExprContext(MtmModify.estate);
+			return &MtmModify;
+		}
+		MtmCloseModifyState();
+	}
+	if (rel->rd_rel->relkind != RELKIND_RELATION)
+		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
+			 rel->rd_rel->relkind, RelationGetRelationName(rel));
+
+	/* lookup index to build scankey */
+	if (rel->rd_indexvalid == 0)
+		RelationGetIndexList(rel);
+	idxoid = rel->rd_replidindex;
+	if (!OidIsValid(idxoid))
+	{
+		elog(ERROR, "could not find primary key for table with oid %u",
+			 RelationGetRelid(rel));
+	}
+	MtmModify.estate = create_rel_estate(rel);
+	MtmModify.oldslot = ExecInitExtraTupleSlot(MtmModify.estate);
+	ExecSetSlotDescriptor(MtmModify.oldslot, RelationGetDescr(rel));
+	MtmModify.newslot = ExecInitExtraTupleSlot(MtmModify.estate);
+	ExecSetSlotDescriptor(MtmModify.newslot, RelationGetDescr(rel));
+	MtmModify.indicesOpened = false;
+	/* open index, so we can build scan key for row */
+	MtmModify.idxrel = index_open(idxoid, RowExclusiveLock);
+	Assert(MtmModify.idxrel->rd_index->indisunique);
+	MtmModify.rel = rel;
+	return &MtmModify;
+}
+
 static void
 process_remote_insert(StringInfo s, Relation rel)
 {
 	EState *estate;
 	TupleData new_tuple;
-	TupleTableSlot *newslot;
-	TupleTableSlot *oldslot;
+	HeapTuple tup;
 	ResultRelInfo *relinfo;
 	ScanKey	*index_keys;
+	MemoryContext oldcontext;
 	int	i;
 
-	PushActiveSnapshot(GetTransactionSnapshot());
-
-	estate = create_rel_estate(rel);
-	newslot = ExecInitExtraTupleSlot(estate);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel));
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
+	if (MtmBatch.nTuples != 0 && RelationGetRelid(MtmBatch.rel) != RelationGetRelid(rel)) {
+		MtmFlushInsertBatch();
+	}
+	if (MtmBatch.nTuples == 0) { 
+		PushActiveSnapshot(GetTransactionSnapshot());
+
+		estate = create_rel_estate(rel);
+		MtmBatch.rel = rel;
+		MtmBatch.estate = estate;
+		MtmBatch.slot = ExecInitExtraTupleSlot(estate);
+		MtmBatch.oldslot = ExecInitExtraTupleSlot(estate);
+		ExecSetSlotDescriptor(MtmBatch.slot, RelationGetDescr(rel));
+		ExecSetSlotDescriptor(MtmBatch.oldslot, RelationGetDescr(rel));
+		ExecOpenIndices(estate->es_result_relation_info, false);
+		/*
+		 * All batches of a transaction write through the same ring of buffers, as COPY does,
+		 * so that a huge replicated transaction doesn't evict the rest of shared buffers.
+		 */
+		if (MtmBatch.bistate == NULL || MtmBatch.bistateLxid != MyProc->lxid) {
+			oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+			MtmBatch.bistate = GetBulkInsertState();
+			MtmBatch.bistateLxid = MyProc->lxid;
+			MemoryContextSwitchTo(oldcontext);
+		}
+		MtmBatch.size = 0;
+	} else { 
+		/* batch holds its own reference to the relation */
+		heap_close(rel, NoLock);
+		rel = MtmBatch.rel;
+		estate = MtmBatch.estate;
+	}
+	oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
 
 	read_tuple_parts(s, rel, &new_tuple);
-	{
-		HeapTuple tup;
-		tup = heap_form_tuple(RelationGetDescr(rel),
-							  new_tuple.values, new_tuple.isnull);
-		ExecStoreTuple(tup, newslot, InvalidBuffer, true);
-	}
+	tup = heap_form_tuple(RelationGetDescr(rel),
+						  new_tuple.values, new_tuple.isnull);
+	check_home_tuple(rel, tup);
 
 	// if (rel->rd_rel->relkind != RELKIND_RELATION) // RELKIND_MATVIEW
 	// 	elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
@@ -761,13 +1120,12 @@ process_remote_insert(StringInfo s, Relation rel)
 
 	/* debug output */
 #ifdef VERBOSE_INSERT
-	log_tuple("INSERT:%s", RelationGetDescr(rel), newslot->tts_tuple);
+	log_tuple("INSERT:%s", RelationGetDescr(rel), tup);
 #endif
 
 	/*
 	 * Search for conflicting tuples.
 	 */
-	ExecOpenIndices(estate->es_result_relation_info, false);
 	relinfo = estate->es_result_relation_info;
 	index_keys = palloc0(relinfo->ri_NumIndices * sizeof(ScanKeyData*));
 
@@ -797,7 +1155,7 @@ process_remote_insert(StringInfo s, Relation rel)
 		/* if conflict: wait */
 		found = find_pkey_tuple(index_keys[i],
 								rel, relinfo->ri_IndexRelationDescs[i],
-								oldslot, true, LockTupleExclusive);
+								MtmBatch.oldslot, true, LockTupleExclusive);
 
 		/* alert if there's more than one conflicting unique key */
 		if (found)
@@ -810,35 +1168,24 @@ process_remote_insert(StringInfo s, Relation rel)
 		}
 		CHECK_FOR_INTERRUPTS();
 	}
+	MemoryContextSwitchTo(oldcontext);
 
-	simple_heap_insert(rel, newslot->tts_tuple);
-    UserTableUpdateOpenIndexes(estate, newslot);
-
-	ExecCloseIndices(estate->es_result_relation_info);
-
-	if (ActiveSnapshotSet())
-		PopActiveSnapshot();
-
-    heap_close(rel, NoLock);
-    ExecResetTupleTable(estate->es_tupleTable, true);
-    FreeExecutorState(estate);
-
-	CommandCounterIncrement();
+	MtmBatch.tuples[MtmBatch.nTuples++] = tup;
+	MtmBatch.size += tup->t_len;
+	if (MtmBatch.nTuples == MTM_MAX_INSERT_BATCH_TUPLES || MtmBatch.size >= MTM_MAX_INSERT_BATCH_SIZE) { 
+		MtmFlushInsertBatch();
+	}
 }
 
 static void
 process_remote_update(StringInfo s, Relation rel)
 {
 	char		action;
-	EState	   *estate;
-	TupleTableSlot *newslot;
-	TupleTableSlot *oldslot;
+	MtmModifyState* ms;
 	bool		pkey_sent;
 	bool		found_tuple;
 	TupleData   old_tuple;
 	TupleData   new_tuple;
-	Oid			idxoid;
-	Relation	idxrel;
 	ScanKeyData skey[INDEX_MAX_KEYS];
 	HeapTuple	remote_tuple = NULL;
 
@@ -849,11 +1196,8 @@ process_remote_update(StringInfo s, Relation rel)
 		elog(ERROR, "expected action 'N' or 'K', got %c",
 			 action);
 
-	estate = create_rel_estate(rel);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
-	newslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(newslot, RelationGetDescr(rel));
+	ms = MtmOpenModifyState(rel);
+	rel = ms->rel;
 
 	if (action == 'K')
 	{
@@ -869,54 +1213,36 @@ process_remote_update(StringInfo s, Relation rel)
 		elog(ERROR, "expected action 'N', got %c",
 			 action);
 
-	if (rel->rd_rel->relkind != RELKIND_RELATION)
-		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
-			 rel->rd_rel->relkind, RelationGetRelationName(rel));
-
 	/* read new tuple */
 	read_tuple_parts(s, rel, &new_tuple);
 
-	/* lookup index to build scankey */
-	if (rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel);
-	idxoid = rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
-	{
-		elog(ERROR, "could not find primary key for table with oid %u",
-			 RelationGetRelid(rel));
-		return;
-	}
-
-	/* open index, so we can build scan key for row */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
-	Assert(idxrel->rd_index->indisunique);
-
 	/* Use columns from the new tuple if the key didn't change. */
-	build_index_scan_key(skey, rel, idxrel,
+	build_index_scan_key(skey, rel, ms->idxrel,
 						 pkey_sent ? &old_tuple : &new_tuple);
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
 	/* look for tuple identified by the (old) primary key */
-	found_tuple = find_pkey_tuple(skey, rel, idxrel, oldslot, true,
+	found_tuple = find_pkey_tuple(skey, rel, ms->idxrel, ms->oldslot, true,
 						pkey_sent ? LockTupleExclusive : LockTupleNoKeyExclusive);
 
 	if (found_tuple)
 	{
-		remote_tuple = heap_modify_tuple(oldslot->tts_tuple,
+		remote_tuple = heap_modify_tuple(ms->oldslot->tts_tuple,
 										 RelationGetDescr(rel),
 										 new_tuple.values,
 										 new_tuple.isnull,
 										 new_tuple.changed);
 
-		ExecStoreTuple(remote_tuple, newslot, InvalidBuffer, true);
+		ExecStoreTuple(remote_tuple, ms->newslot, InvalidBuffer, true);
+		check_home_tuple(rel, ms->oldslot->tts_tuple);
+		check_home_tuple(rel, remote_tuple);
 
 #ifdef VERBOSE_UPDATE
 		{
 			StringInfoData o;
 			initStringInfo(&o);
-			tuple_to_stringinfo(&o, RelationGetDescr(rel), oldslot->tts_tuple);
+			tuple_to_stringinfo(&o, RelationGetDescr(rel), ms->oldslot->tts_tuple);
 			appendStringInfo(&o, " to");
 			tuple_to_stringinfo(&o, RelationGetDescr(rel), remote_tuple);
 			MTM_LOG1(DEBUG1, "UPDATE:%s", o.data);
@@ -924,8 +1250,15 @@ process_remote_update(StringInfo s, Relation rel)
 		}
 #endif
 
-        simple_heap_update(rel, &oldslot->tts_tuple->t_self, newslot->tts_tuple);
-        UserTableUpdateIndexes(estate, newslot);
+        simple_heap_update(rel, &ms->oldslot->tts_tuple->t_self, ms->newslot->tts_tuple);
+		/* HOT update does not require index inserts */
+		if (!HeapTupleIsHeapOnly(ms->newslot->tts_tuple)) { 
+			if (!ms->indicesOpened) { 
+				ExecOpenIndices(ms->estate->es_result_relation_info, false);
+				ms->indicesOpened = true;
+			}
+			UserTableUpdateOpenIndexes(ms->estate, ms->newslot);
+		}
 	}
 	else
 	{
@@ -937,13 +1270,6 @@ process_remote_update(StringInfo s, Relation rel)
 	}
     
 	PopActiveSnapshot();
-    
-	/* release locks upon commit */
-	index_close(idxrel, NoLock);
-	heap_close(rel, NoLock);
-    
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
 
 	CommandCounterIncrement();
 }
@@ -951,58 +1277,37 @@ process_remote_update(StringInfo s, Relation rel)
 static void
 process_remote_delete(StringInfo s, Relation rel)
 {
-	EState	   *estate;
+	MtmModifyState* ms;
 	TupleData   oldtup;
-	TupleTableSlot *oldslot;
-	Oid			idxoid;
-	Relation	idxrel;
 	ScanKeyData skey[INDEX_MAX_KEYS];
 	bool		found_old;
 
-	estate = create_rel_estate(rel);
-	oldslot = ExecInitExtraTupleSlot(estate);
-	ExecSetSlotDescriptor(oldslot, RelationGetDescr(rel));
+	ms = MtmOpenModifyState(rel);
+	rel = ms->rel;
 
 	read_tuple_parts(s, rel, &oldtup);
 
-	/* lookup index to build scankey */
-	if (rel->rd_indexvalid == 0)
-		RelationGetIndexList(rel);
-	idxoid = rel->rd_replidindex;
-	if (!OidIsValid(idxoid))
-	{
-		elog(ERROR, "could not find primary key for table with oid %u",
-			 RelationGetRelid(rel));
-		return;
-	}
-
-	/* Now open the primary key index */
-	idxrel = index_open(idxoid, RowExclusiveLock);
-
-	if (rel->rd_rel->relkind != RELKIND_RELATION)
-		elog(ERROR, "unexpected relkind '%c' rel \"%s\"",
-			 rel->rd_rel->relkind, RelationGetRelationName(rel));
-
 #ifdef VERBOSE_DELETE
 	{
 		HeapTuple tup;
 		tup = heap_form_tuple(RelationGetDescr(rel),
 							  oldtup.values, oldtup.isnull);
-		ExecStoreTuple(tup, oldslot, InvalidBuffer, true);
+		ExecStoreTuple(tup, ms->oldslot, InvalidBuffer, true);
 	}
-	log_tuple("DELETE old-key:%s", RelationGetDescr(rel), oldslot->tts_tuple);
+	log_tuple("DELETE old-key:%s", RelationGetDescr(rel), ms->oldslot->tts_tuple);
 #endif
 
 	PushActiveSnapshot(GetTransactionSnapshot());
 
-	build_index_scan_key(skey, rel, idxrel, &oldtup);
+	build_index_scan_key(skey, rel, ms->idxrel, &oldtup);
 
 	/* try to find tuple via a (candidate|primary) key */
-	found_old = find_pkey_tuple(skey, rel, idxrel, oldslot, true, LockTupleExclusive);
+	found_old = find_pkey_tuple(skey, rel, ms->idxrel, ms->oldslot, true, LockTupleExclusive);
 
 	if (found_old)
 	{
-		simple_heap_delete(rel, &oldslot->tts_tuple->t_self);
+		check_home_tuple(rel, ms->oldslot->tts_tuple);
+		simple_heap_delete(rel, &ms->oldslot->tts_tuple->t_self);
 	}
 	else
 	{
@@ -1014,13 +1319,141 @@ process_remote_delete(StringInfo s, Relation rel)
 
 	PopActiveSnapshot();
 
-	index_close(idxrel, NoLock);
-	heap_close(rel, NoLock);
+	CommandCounterIncrement();
+}
 
-	ExecResetTupleTable(estate->es_tupleTable, true);
-	FreeExecutorState(estate);
+/*
+ * Prefetch heap pages of the tuples which are going to be updated or deleted by the transaction.
+ *
+ * Applying of UPDATE and DELETE records has to locate the old tuple using replica identity index,
+ * and each such lookup synchronously reads index and heap pages from the disk, one row at a time.
+ * When the whole transaction is available in the message buffer, we can walk through it in advance,
+ * descend the index for each key and issue asynchronous read requests for the heap pages,
+ * so that the subsequent apply finds them in the OS cache. Index pages are loaded into shared buffers
+ * by the descent itself.
+ *
+ * The pass works on its own copy of the buffer and stops at the first record it can not interpret
+ * without applying preceding ones (DDL messages, spilled chunks, end of transaction).
+ */
+static void
+MtmPrefetchTransaction(StringInfo in)
+{
+	StringInfoData s = *in;
+	MemoryContext oldcontext = CurrentMemoryContext;
+	MemoryContext rowContext;
+	Relation	rel = NULL;
+	Relation	idxrel = NULL;
+	IndexScanDesc scan = NULL;
+	SnapshotData snap;
+	TupleData	old_tuple;
+	TupleData	new_tuple;
+	ScanKeyData skey[INDEX_MAX_KEYS];
+	ItemPointer tid;
+	int			nRows = 0;
+	bool		done = false;
+
+	/* scan descriptors live in the caller's context, decoded rows are released after each record */
+	rowContext = AllocSetContextCreate(CurrentMemoryContext,
+									   "ApplyPrefetchContext",
+									   ALLOCSET_DEFAULT_MINSIZE,
+									   ALLOCSET_DEFAULT_INITSIZE,
+									   ALLOCSET_DEFAULT_MAXSIZE);
+	InitDirtySnapshot(snap);
 
-	CommandCounterIncrement();
+	while (!done && s.cursor < s.len && nRows < MtmApplyPrefetchDepth)
+	{
+		char action = pq_getmsgbyte(&s);
+		TupleData* key = NULL;
+
+		MemoryContextSwitchTo(rowContext);
+		switch (action) {
+		  case 'R':
+			if (scan != NULL) {
+				index_endscan(scan);
+				scan = NULL;
+			}
+			if (idxrel != NULL) {
+				index_close(idxrel, NoLock);
+				idxrel = NULL;
+			}
+			if (rel != NULL) {
+				heap_close(rel, NoLock);
+			}
+			MemoryContextSwitchTo(oldcontext);
+			rel = read_rel(&s, RowExclusiveLock);
+			if (rel->rd_rel->relkind == RELKIND_RELATION) {
+				if (rel->rd_indexvalid == 0)
+					RelationGetIndexList(rel);
+				if (OidIsValid(rel->rd_replidindex)) {
+					idxrel = index_open(rel->rd_replidindex, RowExclusiveLock);
+					scan = index_beginscan(rel, idxrel, &snap,
+										   IndexRelationGetNumberOfKeyAttributes(idxrel), 0);
+				}
+			}
+			continue;
+		  case 'I':
+			if (rel == NULL) {
+				done = true;
+				break;
+			}
+			skip_tuple_parts(&s, rel);
+			continue;
+		  case 'U':
+			if (rel == NULL) {
+				done = true;
+				break;
+			}
+			action = pq_getmsgbyte(&s);
+			if (action == 'K') {
+				read_tuple_parts(&s, rel, &old_tuple);
+				action = pq_getmsgbyte(&s);
+				key = &old_tuple;
+			}
+			if (action != 'N') {
+				done = true;
+				break;
+			}
+			if (key == NULL) {
+				read_tuple_parts(&s, rel, &new_tuple);
+				key = &new_tuple;
+			} else {
+				skip_tuple_parts(&s, rel);
+			}
+			break;
+		  case 'D':
+			if (rel == NULL) {
+				done = true;
+				break;
+			}
+			read_tuple_parts(&s, rel, &old_tuple);
+			key = &old_tuple;
+			break;
+		  default:
+			done = true;
+			break;
+		}
+		if (key != NULL && scan != NULL
+			&& !build_index_scan_key(skey, rel, idxrel, key))
+		{
+			index_rescan(scan, skey, IndexRelationGetNumberOfKeyAttributes(idxrel), NULL, 0);
+			while ((tid = index_getnext_tid(scan, ForwardScanDirection)) != NULL) {
+				PrefetchBuffer(rel, MAIN_FORKNUM, ItemPointerGetBlockNumber(tid));
+			}
+			nRows += 1;
+		}
+		MemoryContextReset(rowContext);
+	}
+	MemoryContextSwitchTo(oldcontext);
+	if (scan != NULL) {
+		index_endscan(scan);
+	}
+	if (idxrel != NULL) {
+		index_close(idxrel, NoLock);
+	}
+	if (rel != NULL) {
+		heap_close(rel, NoLock);
+	}
+	MemoryContextDelete(rowContext);
 }
 
 void MtmExecutor(void* work, size_t size)
@@ -1030,6 +1463,8 @@ void MtmExecutor(void* work, size_t size)
 	int spill_file = -1;
 	int save_cursor = 0;
 	int save_len = 0;
+	volatile uint64 nRows = 0;
+	volatile uint64 nBytes = size;
     s.data = work;
     s.len = size;
     s.maxlen = -1;
@@ -1049,6 +1484,14 @@ void MtmExecutor(void* work, size_t size)
         while (true) { 
             char action = pq_getmsgbyte(&s);
             MTM_LOG2("%d: REMOTE process action %c", MyProcPid, action);
+			if (action != 'I' && action != 'R' && action != '(' && action != ')') { 
+				/* batch of inserts is terminated by any other change */
+				MtmFlushInsertBatch();
+			}
+			if (action != 'U' && action != 'D' && action != 'R' && action != '(' && action != ')') { 
+				/* the same for state of updates and deletes */
+				MtmCloseModifyState();
+			}
 #if 0
 			if (Mtm->status == MTM_RECOVERY) { 
 				MTM_LOG1("Replay action %c[%x]",   action, s.data[s.cursor]);
@@ -1059,6 +1502,9 @@ void MtmExecutor(void* work, size_t size)
                 /* BEGIN */
             case 'B':
 			    if (process_remote_begin(&s)) { 				   
+					if (MtmApplyPrefetchDepth > 0) {
+						MtmPrefetchTransaction(&s);
+					}
 					continue;
 				} else { 
 					break;
@@ -1070,18 +1516,28 @@ void MtmExecutor(void* work, size_t size)
                 /* INSERT */
             case 'I':
                 process_remote_insert(&s, rel);
+				nRows += 1;
                 continue;
                 /* UPDATE */
             case 'U':
                 process_remote_update(&s, rel);
+				nRows += 1;
                 continue;
                 /* DELETE */
             case 'D':
                 process_remote_delete(&s, rel);
+				nRows += 1;
                 continue;
             case 'R':
                 rel = read_rel(&s, RowExclusiveLock);
                 continue;
+			case 'T':
+			{
+				/* commit ticket precedes commit-prepared or rollback-prepared message */
+				CommitTicketNode = pq_getmsgint(&s, 4);
+				CommitTicket = pq_getmsgint64(&s);
+				continue;
+			}
 			case 'F':
 			{
 				int node_id = pq_getmsgint(&s, 4);
@@ -1093,6 +1549,7 @@ void MtmExecutor(void* work, size_t size)
  		    case '(':
 			{
 			    int64 size = pq_getmsgint(&s, 4);    
+				nBytes += size;
 				s.data = palloc(size);
 				save_cursor = s.cursor;
 				save_len = s.len;
@@ -1109,6 +1566,28 @@ void MtmExecutor(void* work, size_t size)
 				s.len = save_len;
 				continue;
 			}
+			case '<':
+			{
+				/* end of chunk of streamed transaction: transaction remains active until next chunk */
+				break;
+			}
+			case '>':
+			{
+				/* next chunk of streamed transaction: skip it if applying of previous chunks has failed */
+				if (!IsTransactionState()) {
+					break;
+				}
+				continue;
+			}
+			case 'X':
+			{
+				/* streamed transaction is not committed at origin node */
+				if (IsTransactionState()) {
+					MtmEndSession(MtmReplicationNodeId, false);
+					AbortCurrentTransaction();
+				}
+				break;
+			}
 			case 'M':
 			{
 				if (process_remote_message(&s)) { 
@@ -1130,16 +1609,33 @@ void MtmExecutor(void* work, size_t size)
     PG_CATCH();
     {
 		MemoryContext oldcontext = MemoryContextSwitchTo(MtmApplyContext);
+		MtmResetInsertBatch();
+		MtmResetModifyState();
 		MtmHandleApplyError();
 		MemoryContextSwitchTo(oldcontext);
+		GucSessionNode = 0; /* GUCs set by aborted transaction are rolled back */
 		EmitErrorReport();
         FlushErrorState();
+		if (MtmReplicationNodeId > 0 && MtmReplicationNodeId <= Mtm->nAllNodes) { 
+			MtmStatAdd(MtmReplicationNodeId, conflicts, 1);
+		}
+		nRows = 0;
 		MTM_LOG1("%d: REMOTE begin abort transaction %llu", MyProcPid, (long64)MtmGetCurrentTransactionId());
 		MtmEndSession(MtmReplicationNodeId, false);
         AbortCurrentTransaction();
 		MTM_LOG2("%d: REMOTE end abort transaction %llu", MyProcPid, (long64)MtmGetCurrentTransactionId());
     }
     PG_END_TRY();
+	if (CommitTicket != 0) { 
+		/* ticket is released even if commit has failed, otherwise subsequent commits will wait forever */
+		MtmReleaseCommitTicket(CommitTicketNode, CommitTicket);
+		CommitTicket = 0;
+	}
+	if (nRows != 0 && MtmReplicationNodeId > 0 && MtmReplicationNodeId <= Mtm->nAllNodes) { 
+		/* counters are updated once per transaction to reduce contention */
+		MtmStatAdd(MtmReplicationNodeId, rowsApplied, nRows);
+		MtmStatAdd(MtmReplicationNodeId, bytesApplied, nBytes);
+	}
 	if (spill_file >= 0) { 
 		MtmCloseSpillFile(spill_file);
 	}
@@ -69,10 +69,14 @@ enum {
 	PARAM_BINARY_WANT_INTERNAL_BASETYPES,
 	PARAM_BINARY_WANT_BINARY_BASETYPES,
 	PARAM_BINARY_BASETYPES_MAJOR_VERSION,
+	PARAM_BINARY_TRUSTED_CLUSTER,
+	PARAM_BINARY_CATALOG_VERSION,
+	PARAM_BINARY_LZ4_DATUMS,
 	PARAM_PG_VERSION,
 	PARAM_FORWARD_CHANGESETS,
 	PARAM_HOOKS_SETUP_FUNCTION,
-	PARAM_NO_TXINFO
+	PARAM_NO_TXINFO,
+	PARAM_COMPRESSION
 } OutputPluginParamKey;
 
 typedef struct {
@@ -96,10 +100,14 @@ static OutputPluginParam param_lookup[] = {
 	{"binary.want_internal_basetypes", PARAM_BINARY_WANT_INTERNAL_BASETYPES},
 	{"binary.want_binary_basetypes", PARAM_BINARY_WANT_BINARY_BASETYPES},
 	{"binary.basetypes_major_version", PARAM_BINARY_BASETYPES_MAJOR_VERSION},
+	{"binary.trusted_cluster", PARAM_BINARY_TRUSTED_CLUSTER},
+	{"binary.catalog_version", PARAM_BINARY_CATALOG_VERSION},
+	{"binary.lz4_datums", PARAM_BINARY_LZ4_DATUMS},
 	{"pg_version", PARAM_PG_VERSION},
 	{"forward_changesets", PARAM_FORWARD_CHANGESETS},
 	{"hooks.setup_function", PARAM_HOOKS_SETUP_FUNCTION},
 	{"no_txinfo", PARAM_NO_TXINFO},
+	{"compression", PARAM_COMPRESSION},
 	{NULL, PARAM_UNRECOGNISED}
 };
 
@@ -185,8 +193,8 @@ process_parameters_v1(List *options, PGLogicalOutputData *data)
 
 			case PARAM_BINARY_FLOAT8BYVAL:
 				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
-				data->client_binary_float4byval_set = true;
-				data->client_binary_float4byval = DatumGetBool(val);
+				data->client_binary_float8byval_set = true;
+				data->client_binary_float8byval = DatumGetBool(val);
 				break;
 
 			case PARAM_BINARY_INTEGER_DATETIMES:
@@ -241,6 +249,23 @@ process_parameters_v1(List *options, PGLogicalOutputData *data)
 				data->client_binary_basetypes_major_version = DatumGetUInt32(val);
 				break;
 
+			case PARAM_BINARY_TRUSTED_CLUSTER:
+				/* client claims to share our catalog, see decide_datum_transfer */
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
+				data->client_binary_trusted_cluster = DatumGetBool(val);
+				break;
+
+			case PARAM_BINARY_CATALOG_VERSION:
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_UINT32);
+				data->client_binary_catalog_version = DatumGetUInt32(val);
+				break;
+
+			case PARAM_BINARY_LZ4_DATUMS:
+				/* client can decompress datums compressed with lz4 */
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
+				data->client_binary_lz4_datums = DatumGetBool(val);
+				break;
+
 			case PARAM_HOOKS_SETUP_FUNCTION:
 				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_QUALIFIED_NAME);
 				data->hooks_setup_funcname = (List*) PointerGetDatum(val);
@@ -251,6 +276,12 @@ process_parameters_v1(List *options, PGLogicalOutputData *data)
 				data->client_no_txinfo = DatumGetBool(val);
 				break;
 
+			case PARAM_COMPRESSION:
+				/* compress messages with pglz, see pglogical_compress_message */
+				val = get_param_value(elem, false, OUTPUT_PARAM_TYPE_BOOL);
+				data->client_compression = DatumGetBool(val);
+				break;
+
 			case PARAM_UNRECOGNISED:
 				ereport(DEBUG1,
 						(errmsg("Unrecognised pglogical parameter %s ignored", elem->defname)));
@@ -448,12 +479,18 @@ prepare_startup_message(PGLogicalOutputData *data)
 			data->forward_changesets);
 	l = add_startup_msg_b(l, "forward_changeset_origins",
 			data->forward_changeset_origins);
+	l = add_startup_msg_b(l, "compression",
+			data->client_compression);
 
 	/* binary options enabled */
 	l = add_startup_msg_b(l, "binary.internal_basetypes",
 			data->allow_internal_basetypes);
 	l = add_startup_msg_b(l, "binary.binary_basetypes",
 			data->allow_binary_basetypes);
+	l = add_startup_msg_b(l, "binary.trusted_cluster",
+			data->allow_trusted_types);
+	l = add_startup_msg_b(l, "binary.lz4_datums",
+			data->allow_lz4_datums);
 
 	/* Binary format characteristics of server */
 	l = add_startup_msg_i(l, "binary.basetypes_major_version", PG_VERSION_NUM/100);
@@ -481,6 +518,8 @@ prepare_startup_message(PGLogicalOutputData *data)
 			data->hooks.shutdown_hook != NULL);
 	l = add_startup_msg_b(l, "hooks.row_filter_enabled",
 			data->hooks.row_filter_hook != NULL);
+	l = add_startup_msg_b(l, "hooks.column_filter_enabled",
+			data->hooks.column_filter_hook != NULL);
 	l = add_startup_msg_b(l, "hooks.transaction_filter_enabled",
 			data->hooks.txn_filter_hook != NULL);
 
@@ -98,12 +98,14 @@ load_hooks(PGLogicalOutputData *data)
 				"\tstartup_hook: %p\n"
 				"\tshutdown_hook: %p\n"
 				"\trow_filter_hook: %p\n"
+				"\tcolumn_filter_hook: %p\n"
 				"\ttxn_filter_hook: %p\n"
 				"\thooks_private_data: %p\n",
 				hooks_func,
 				data->hooks.startup_hook,
 				data->hooks.shutdown_hook,
 				data->hooks.row_filter_hook,
+				data->hooks.column_filter_hook,
 				data->hooks.txn_filter_hook,
 				data->hooks.hooks_private_data);
 	} 
@@ -210,6 +212,33 @@ call_row_filter_hook(PGLogicalOutputData *data, ReorderBufferTXN *txn,
 	return ret;
 }
 
+/*
+ * Get the set of columns of the relation to replicate from a client-provided
+ * hook, NULL meaning all of them.
+ */
+Bitmapset *
+call_column_filter_hook(PGLogicalOutputData *data, Relation rel)
+{
+	struct PGLogicalColumnFilterArgs hook_args;
+	MemoryContext old_ctxt;
+	Bitmapset  *ret = NULL;
+
+	if (data->hooks.column_filter_hook != NULL)
+	{
+		hook_args.private_data = data->hooks.hooks_private_data;
+		hook_args.changed_rel = rel;
+
+		old_ctxt = MemoryContextSwitchTo(data->hooks_mctxt);
+		ret = (*data->hooks.column_filter_hook)(&hook_args);
+		MemoryContextSwitchTo(old_ctxt);
+
+		/* Filter hooks shouldn't change the private data ptr */
+		Assert(data->hooks.hooks_private_data == hook_args.private_data);
+	}
+
+	return ret;
+}
+
 bool
 call_txn_filter_hook(PGLogicalOutputData *data, RepOriginId txn_origin)
 {
@@ -21,10 +21,15 @@
 #include "access/sysattr.h"
 #include "access/xact.h"
 
+#include "catalog/catversion.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 
+#include "common/pg_lzcompress.h"
+
+#include "libpq/pqformat.h"
+
 #include "mb/pg_wchar.h"
 
 #include "nodes/parsenodes.h"
@@ -167,7 +172,8 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 										  ALLOCSET_DEFAULT_MAXSIZE);
 	data->allow_internal_basetypes = false;
 	data->allow_binary_basetypes = false;
-
+	data->allow_trusted_types = false;
+	data->allow_lz4_datums = false;
 
 	ctx->output_plugin_private = data;
 
@@ -319,6 +325,31 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 			data->allow_binary_basetypes = true;
 		}
 
+		/*
+		 * In trusted cluster mode the receiver promises that it has the same
+		 * catalog as we do (multimaster replicates all DDL), so internal
+		 * representation can be used also for arrays, composites and
+		 * extension types. Catalog version is checked to be sure that
+		 * on-disk formats are the same.
+		 */
+		if (data->allow_internal_basetypes &&
+			data->client_binary_trusted_cluster)
+		{
+			if (data->client_binary_catalog_version == CATALOG_VERSION_NO)
+				data->allow_trusted_types = true;
+			else
+				elog(LOG, "Trusted cluster mode rejected: catalog version %u doesn't match %u",
+					 data->client_binary_catalog_version, CATALOG_VERSION_NO);
+		}
+
+		/*
+		 * Datums in internal representation may be compressed, and are sent
+		 * so unless the receiver doesn't know the compression method.
+		 */
+		if (data->allow_internal_basetypes &&
+			data->client_binary_lz4_datums)
+			data->allow_lz4_datums = true;
+
 		/*
 		 * Will we forward changesets? We have to if we're on 9.4;
 		 * otherwise honour the client's request.
@@ -370,6 +401,55 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 	}
 }
 
+/*
+ * Wrappers of OutputPluginPrepareWrite/OutputPluginWrite which compress
+ * the message if the client asked for it.
+ */
+static void
+pglogical_prepare_write(LogicalDecodingContext *ctx, bool last_write)
+{
+	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
+
+	OutputPluginPrepareWrite(ctx, last_write);
+	data->write_offset = ctx->out->len;
+}
+
+/*
+ * Replace message with compressed frame: 'z', uncompressed size and
+ * pglz compressed data. Small or incompressible messages are sent as is.
+ */
+static void
+pglogical_compress_message(StringInfo out, int offset)
+{
+	int32	rawsize = out->len - offset;
+	int32	size;
+	char   *compressed;
+
+	if (rawsize < PGLOGICAL_COMPRESSION_MIN_SIZE)
+		return;
+
+	compressed = palloc(PGLZ_MAX_OUTPUT(rawsize));
+	size = pglz_compress(out->data + offset, rawsize, compressed, PGLZ_strategy_default);
+	if (size >= 0 && size + 5 < rawsize)
+	{
+		out->len = offset;
+		pq_sendbyte(out, 'z');
+		pq_sendint(out, rawsize, 4);
+		appendBinaryStringInfo(out, compressed, size);
+	}
+	pfree(compressed);
+}
+
+static void
+pglogical_write(LogicalDecodingContext *ctx, bool last_write)
+{
+	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
+
+	if (data->client_compression)
+		pglogical_compress_message(ctx->out, data->write_offset);
+	OutputPluginWrite(ctx, last_write);
+}
+
 /*
  * BEGIN callback
  */
@@ -386,7 +466,7 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 	send_replication_origin &= txn->origin_id != InvalidRepOriginId;
 
 	if (data->api) { 
-		OutputPluginPrepareWrite(ctx, !send_replication_origin);
+		pglogical_prepare_write(ctx, !send_replication_origin);
 		data->api->write_begin(ctx->out, data, txn);
 
 		if (send_replication_origin)
@@ -394,8 +474,8 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 			char *origin;
 			
 			/* Message boundary */
-			OutputPluginWrite(ctx, false);
-			OutputPluginPrepareWrite(ctx, true);
+			pglogical_write(ctx, false);
+			pglogical_prepare_write(ctx, true);
 			
 			/*
 			 * XXX: which behaviour we want here?
@@ -410,7 +490,7 @@ pg_decode_begin_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn)
 				replorigin_by_oid(txn->origin_id, true, &origin))
 			data->api->write_origin(ctx->out, origin, txn->origin_lsn);
 		}
-		OutputPluginWrite(ctx, true);
+		pglogical_write(ctx, true);
 	}
 }
 
@@ -420,9 +500,9 @@ pg_decode_caughtup(LogicalDecodingContext *ctx)
 	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
 
 	if (data->api) { 
-		OutputPluginPrepareWrite(ctx, true);
+		pglogical_prepare_write(ctx, true);
 		data->api->write_caughtup(ctx->out, data, ctx->reader->EndRecPtr);
-		OutputPluginWrite(ctx, true);
+		pglogical_write(ctx, true);
 	}
 }
 
@@ -437,9 +517,9 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
 
 	if (data->api) { 
-		OutputPluginPrepareWrite(ctx, true);
+		pglogical_prepare_write(ctx, true);
 		data->api->write_commit(ctx->out, data, txn, commit_lsn);
-		OutputPluginWrite(ctx, true);
+		pglogical_write(ctx, true);
 	}
 }
 
@@ -457,41 +537,43 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	/* Avoid leaking memory by using and resetting our own context */
 	old = MemoryContextSwitchTo(data->context);
 
+	data->att_list = call_column_filter_hook(data, relation);
+
 	/* TODO: add caching (send only if changed) */
 	if (data->api->write_rel)
 	{
-		OutputPluginPrepareWrite(ctx, false);
+		pglogical_prepare_write(ctx, false);
 		data->api->write_rel(ctx->out, data, relation);
-		OutputPluginWrite(ctx, false);
+		pglogical_write(ctx, false);
 	}
 
 	/* Send the data */
 	switch (change->action)
 	{
 		case REORDER_BUFFER_CHANGE_INSERT:
-			OutputPluginPrepareWrite(ctx, true);
+			pglogical_prepare_write(ctx, true);
 			data->api->write_insert(ctx->out, data, relation,
 									&change->data.tp.newtuple->tuple);
-			OutputPluginWrite(ctx, true);
+			pglogical_write(ctx, true);
 			break;
 		case REORDER_BUFFER_CHANGE_UPDATE:
 			{
 				HeapTuple oldtuple = change->data.tp.oldtuple ?
 					&change->data.tp.oldtuple->tuple : NULL;
 
-				OutputPluginPrepareWrite(ctx, true);
+				pglogical_prepare_write(ctx, true);
 				data->api->write_update(ctx->out, data, relation, oldtuple,
 										&change->data.tp.newtuple->tuple);
-				OutputPluginWrite(ctx, true);
+				pglogical_write(ctx, true);
 				break;
 			}
 		case REORDER_BUFFER_CHANGE_DELETE:
 			if (change->data.tp.oldtuple)
 			{
-				OutputPluginPrepareWrite(ctx, true);
+				pglogical_prepare_write(ctx, true);
 				data->api->write_delete(ctx->out, data, relation,
 										&change->data.tp.oldtuple->tuple);
-				OutputPluginWrite(ctx, true);
+				pglogical_write(ctx, true);
 			}
 			else
 				elog(DEBUG1, "didn't send DELETE change because of missing oldtuple");
@@ -534,9 +616,9 @@ pg_decode_message(LogicalDecodingContext *ctx,
 {
 	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
 
-	OutputPluginPrepareWrite(ctx, true);
+	pglogical_prepare_write(ctx, true);
 	data->api->write_message(ctx->out, prefix, sz, message);
-	OutputPluginWrite(ctx, true);
+	pglogical_write(ctx, true);
 }
 
 static void
@@ -557,9 +639,9 @@ send_startup_message(LogicalDecodingContext *ctx,
 	 */
 
 	if (data->api) {
-		OutputPluginPrepareWrite(ctx, last_message);
+		pglogical_prepare_write(ctx, last_message);
 		data->api->write_startup_message(ctx->out, msg);
-		OutputPluginWrite(ctx, last_message);
+		pglogical_write(ctx, last_message);
 	}
 
 	pfree(msg);
@@ -27,6 +27,9 @@
 #define PG_LOGICAL_PROTO_VERSION_NUM 1
 #define PG_LOGICAL_PROTO_MIN_VERSION_NUM 1
 
+/* Messages shorter than this are not compressed even if client asked for compression */
+#define PGLOGICAL_COMPRESSION_MIN_SIZE 128
+
 /*
  * The name of a hook function. This is used instead of the usual List*
  * because can serve as a hash key.
@@ -50,9 +53,13 @@ typedef struct PGLogicalOutputData
 	/* protocol */
 	bool	allow_internal_basetypes;
 	bool	allow_binary_basetypes;
+	bool	allow_trusted_types;	/* same catalog on both sides, see decide_datum_transfer */
+	bool	allow_lz4_datums;	/* receiver reads lz4 compressed datums */
 	bool	forward_changesets;
 	bool	forward_changeset_origins;
 	int		field_datum_encoding;
+	int		write_offset;	/* start of message in ctx->out, walsender puts its header before it */
+	Bitmapset *att_list;	/* columns of the relation being written chosen by the column filter hook, NULL for all */
 
 	/*
 	 * client info
@@ -82,9 +89,13 @@ typedef struct PGLogicalOutputData
 	bool	client_binary_float8byval;
 	bool	client_binary_intdatetimes_set;
 	bool	client_binary_intdatetimes;
+	bool	client_binary_trusted_cluster;
+	uint32	client_binary_catalog_version;
+	bool	client_binary_lz4_datums;
 	bool	client_forward_changesets_set;
 	bool	client_forward_changesets;
 	bool	client_no_txinfo;
+	bool	client_compression;
 
 	/* hooks */
 	List *hooks_setup_funcname;
@@ -2,6 +2,7 @@
 #define PGLOGICAL_OUTPUT_HOOKS_H
 
 #include "access/xlogdefs.h"
+#include "nodes/bitmapset.h"
 #include "nodes/pg_list.h"
 #include "utils/rel.h"
 #include "utils/palloc.h"
@@ -49,6 +50,19 @@ struct PGLogicalRowFilterArgs
 typedef bool (*pglogical_row_filter_hook_fn)(struct PGLogicalRowFilterArgs *args);
 
 
+struct PGLogicalColumnFilterArgs
+{
+	void 	   *private_data;
+	Relation	changed_rel;
+};
+
+/*
+ * Returns the set of attribute numbers of changed_rel to replicate, or NULL
+ * to replicate all columns. The set stays owned by the hook.
+ */
+typedef Bitmapset *(*pglogical_column_filter_hook_fn)(struct PGLogicalColumnFilterArgs *args);
+
+
 struct PGLogicalShutdownHookArgs
 {
 	void	   *private_data;
@@ -66,6 +80,7 @@ struct PGLogicalHooks
 	pglogical_shutdown_hook_fn shutdown_hook;
 	pglogical_txn_filter_hook_fn txn_filter_hook;
 	pglogical_row_filter_hook_fn row_filter_hook;
+	pglogical_column_filter_hook_fn column_filter_hook;
 	void *hooks_private_data;
 };
 
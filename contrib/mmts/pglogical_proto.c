@@ -63,7 +63,11 @@ static void pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 static char decide_datum_transfer(Form_pg_attribute att,
 								  Form_pg_type typclass,
 								  bool allow_internal_basetypes,
-								  bool allow_binary_basetypes);
+								  bool allow_binary_basetypes,
+								  bool allow_trusted_types);
+static PGLRelMetaEntry* pglogical_attr_transfer_get(PGLogicalOutputData *data, Relation rel);
+static bool type_is_portable(Oid typid);
+static bool type_is_patchable(Oid typid);
 
 static void pglogical_write_caughtup(StringInfo out, PGLogicalOutputData *data,
 									 XLogRecPtr wal_end_ptr);
@@ -75,10 +79,7 @@ static void pglogical_write_caughtup(StringInfo out, PGLogicalOutputData *data,
 static void
 pglogical_write_rel(StringInfo out, PGLogicalOutputData *data, Relation rel)
 {
-	const char *nspname;
-	uint8		nspnamelen;
-	const char *relname;
-	uint8		relnamelen;
+	PGLRelMetaEntry* meta;
 	Oid         relid;
 
 	if (MtmIsFilteredTxn) {
@@ -92,23 +93,56 @@ pglogical_write_rel(StringInfo out, PGLogicalOutputData *data, Relation rel)
 	}
 
 	relid = RelationGetRelid(rel);
+	meta = pglogical_relmeta_get(rel);
 	pq_sendbyte(out, 'R');		/* sending RELATION */	
 	pq_sendint(out, relid, sizeof relid); /* use Oid as relation identifier */
+
+	if (meta->sentXid == MtmCurrentXid) { 
+		/* names were already sent in this transaction: receiver remembers them */
+		pq_sendbyte(out, 0);
+		return;
+	}
+	meta->sentXid = MtmCurrentXid;
 	
-	nspname = get_namespace_name(rel->rd_rel->relnamespace);
-	if (nspname == NULL)
-		elog(ERROR, "cache lookup failed for namespace %u",
-				 rel->rd_rel->relnamespace);
-	nspnamelen = strlen(nspname) + 1;
-	
-	relname = NameStr(rel->rd_rel->relname);
-	relnamelen = strlen(relname) + 1;
-	
-	pq_sendbyte(out, nspnamelen);		/* schema name length */
-	pq_sendbytes(out, nspname, nspnamelen);
+	pq_sendbyte(out, meta->nspnamelen);		/* schema name length */
+	pq_sendbytes(out, meta->nspname, meta->nspnamelen);
 	
-	pq_sendbyte(out, relnamelen);		/* table name length */
-	pq_sendbytes(out, relname, relnamelen);
+	pq_sendbyte(out, meta->relnamelen);		/* table name length */
+	pq_sendbytes(out, meta->relname, meta->relnamelen);
+}
+
+/*
+ * Map replication origin of the transaction to the multimaster node id.
+ */
+static int
+MtmGetOriginNode(ReorderBufferTXN *txn)
+{
+	if (txn->origin_id != InvalidRepOriginId) { 
+		int i;
+		for (i = 0; i < Mtm->nAllNodes && Mtm->nodes[i].originId != txn->origin_id; i++);
+		if (i == Mtm->nAllNodes) { 
+			elog(WARNING, "Failed to map origin %d", txn->origin_id);
+			i = MtmNodeId-1;
+		} else { 
+			Assert(i == MtmNodeId-1 || txn->origin_lsn != InvalidXLogRecPtr);
+		}
+		return i+1;
+	}
+	return MtmNodeId;
+}
+
+/*
+ * Check if transaction was already applied by the receiver: receiver reports its
+ * per-origin restart positions at startup, so there is no need to send transactions
+ * which are in any case filtered out by MtmFilterTransaction at the receiver side.
+ * These positions can only increase, so using ones obtained at session start is safe.
+ */
+static bool
+MtmIsAppliedByReceiver(ReorderBufferTXN *txn)
+{
+	int origin_node = MtmGetOriginNode(txn);
+	lsn_t restart_lsn = origin_node == MtmNodeId ? txn->end_lsn : txn->origin_lsn;
+	return restart_lsn != INVALID_LSN && restart_lsn <= MtmSenderRestartLSN[origin_node-1];
 }
 
 /*
@@ -124,6 +158,10 @@ pglogical_write_begin(StringInfo out, PGLogicalOutputData *data,
 	if (!isRecovery && csn == INVALID_CSN) { 
 		MtmIsFilteredTxn = true;
 		MTM_LOG3("%d: pglogical_write_begin XID=%d filtered", MyProcPid, txn->xid);
+	} else if (MtmIsAppliedByReceiver(txn)) { 
+		MtmIsFilteredTxn = true;
+		MTM_LOG2("%d: pglogical_write_begin XID=%d end_lsn=%llx origin_lsn=%llx is already applied by node %d", 
+				 MyProcPid, txn->xid, (long64)txn->end_lsn, (long64)txn->origin_lsn, MtmReplicationNodeId);
 	} else {
 		MtmCurrentXid = txn->xid;
 		MtmIsFilteredTxn = false;
@@ -132,6 +170,7 @@ pglogical_write_begin(StringInfo out, PGLogicalOutputData *data,
 				 (long64)txn->restart_decoding_lsn, (long64)txn->first_lsn, (long64)txn->end_lsn, (long64)MyReplicationSlot->data.confirmed_flush);
 		
 		MTM_LOG3("%d: pglogical_write_begin XID=%d sent", MyProcPid, txn->xid);
+		MTM_PROFILE(txn->gid, MTM_EV_DECODED, MtmReplicationNodeId, MtmGetSystemTime());
 		pq_sendbyte(out, 'B');		/* BEGIN */
 		pq_sendint(out, MtmNodeId, 4);
 		pq_sendint(out, isRecovery ? InvalidTransactionId : txn->xid, 4);
@@ -160,6 +199,9 @@ pglogical_write_message(StringInfo out,
 		}
 		DDLInProgress = true;
 		break;
+	  case 'S':
+		/* CSNs are needed only by hot standby replicas of this node */
+		return;
 	  case 'E':
 		DDLInProgress = false;
 		/*
@@ -174,6 +216,62 @@ pglogical_write_message(StringInfo out,
 	pq_sendbytes(out, message, sz);
 }
 
+/*
+ * Write PRECOMMIT_PREPARED of a batch of prepared transactions, as one
+ * XLOG_XACT_3PC_STATE record has it, to the output stream.  A precommitted
+ * PREPARE is sent as a batch of one.  Transactions the receiver doesn't know
+ * about are left out, the batch isn't sent at all if none remain.
+ */
+static void
+pglogical_write_precommits(StringInfo out, ReorderBufferTXN *txn, XLogRecPtr commit_lsn)
+{
+	bool isRecovery = MtmIsRecoveredNode(MtmReplicationNodeId);
+	bool batch = txn->xact_action == XLOG_XACT_3PC_STATE;
+	int nxacts = batch ? txn->nxacts_3pc : 1;
+	char const** gids = (char const**)palloc(nxacts*sizeof(char const*));
+	int nsent = 0;
+	int i;
+
+	Assert(MtmTransactionRecords == 0);
+	for (i = 0; i < nxacts; i++) { 
+		TransactionId xid = batch ? txn->xids_3pc[i] : txn->xid;
+		char const* gid = batch ? txn->gids_3pc[i] : txn->gid;
+
+		if (isRecovery || MtmTransactionSnapshot(xid) != INVALID_CSN) { 
+			MTM_LOG2("Send PGLOGICAL_PRECOMMIT_PREPARED for transaction %s (%llu) end_lsn=%llx to node %d, isRecovery=%d, txn->origin_id=%d", 
+					 gid, (long64)xid, (long64)txn->end_lsn, MtmReplicationNodeId, isRecovery, txn->origin_id);
+			gids[nsent++] = gid;
+		}
+	}
+	if (nsent != 0) { 
+		MtmCheckRecoveryCaughtUp(MtmReplicationNodeId, txn->end_lsn);
+		if (MtmIsAppliedByReceiver(txn)) { 
+			MTM_LOG2("Skip precommit of %d transactions end_lsn=%llx already applied by node %d", 
+					 nsent, (long64)txn->end_lsn, MtmReplicationNodeId);
+			nsent = 0;
+		}
+	}
+	if (nsent != 0) { 
+		pq_sendbyte(out, 'C');		/* sending COMMIT */
+		pq_sendbyte(out, PGLOGICAL_PRECOMMIT_PREPARED);
+		pq_sendbyte(out, MtmNodeId);
+
+		/* send fixed fields */
+		pq_sendint64(out, commit_lsn);
+		pq_sendint64(out, txn->end_lsn);
+		pq_sendint64(out, txn->commit_time);
+
+		pq_sendbyte(out, MtmGetOriginNode(txn));
+		pq_sendint64(out, txn->origin_lsn);
+
+		pq_sendint(out, nsent, 4);
+		for (i = 0; i < nsent; i++) { 
+			pq_sendstring(out, gids[i]);
+		}
+	}
+	pfree(gids);
+}
+
 /*
  * Write COMMIT to the output stream.
  */
@@ -191,6 +289,8 @@ pglogical_write_commit(StringInfo out, PGLogicalOutputData *data,
     	event = PGLOGICAL_COMMIT;
 	else if (txn->xact_action == XLOG_XACT_PREPARE)
     	event = *txn->state_3pc ? PGLOGICAL_PRECOMMIT_PREPARED : PGLOGICAL_PREPARE;
+	else if (txn->xact_action == XLOG_XACT_3PC_STATE)
+		event = PGLOGICAL_PRECOMMIT_PREPARED;
 	else if (txn->xact_action == XLOG_XACT_COMMIT_PREPARED)
     	event = PGLOGICAL_COMMIT_PREPARED;
 	else if (txn->xact_action == XLOG_XACT_ABORT_PREPARED)
@@ -204,6 +304,9 @@ pglogical_write_commit(StringInfo out, PGLogicalOutputData *data,
 			Assert(MtmTransactionRecords == 0);
 			return;
 		}
+	} else if (event == PGLOGICAL_PRECOMMIT_PREPARED) {
+		pglogical_write_precommits(out, txn, commit_lsn);
+		return;
 	} else { 
 		csn_t csn = MtmTransactionSnapshot(txn->xid);
 		bool isRecovery = MtmIsRecoveredNode(MtmReplicationNodeId);
@@ -224,11 +327,13 @@ pglogical_write_commit(StringInfo out, PGLogicalOutputData *data,
 			MTM_LOG1("Send ABORT_PREPARED for transaction %s (%llu) end_lsn=%llx to node %d, isRecovery=%d, txn->origin_id=%d, csn=%lld", 
 					 txn->gid, (long64)txn->xid, (long64)txn->end_lsn, MtmReplicationNodeId, isRecovery, txn->origin_id, csn);
 		}
-		if (event == PGLOGICAL_PRECOMMIT_PREPARED) { 
-			MTM_LOG2("Send PGLOGICAL_PRECOMMIT_PREPARED for transaction %s (%llu) end_lsn=%llx to node %d, isRecovery=%d, txn->origin_id=%d, csn=%lld", 
-					 txn->gid, (long64)txn->xid, (long64)txn->end_lsn, MtmReplicationNodeId, isRecovery, txn->origin_id, csn);
-		}
 		MtmCheckRecoveryCaughtUp(MtmReplicationNodeId, txn->end_lsn);
+		if (MtmIsAppliedByReceiver(txn)) { 
+			MTM_LOG2("Skip event %d for transaction %s end_lsn=%llx already applied by node %d", 
+					 event, txn->gid, (long64)txn->end_lsn, MtmReplicationNodeId);
+			Assert(MtmTransactionRecords == 0);
+			return;
+		}
 	}
 
     pq_sendbyte(out, 'C');		/* sending COMMIT */
@@ -245,19 +350,7 @@ pglogical_write_commit(StringInfo out, PGLogicalOutputData *data,
     pq_sendint64(out, txn->end_lsn);
     pq_sendint64(out, txn->commit_time);
 
-	if (txn->origin_id != InvalidRepOriginId) { 
-		int i;
-		for (i = 0; i < Mtm->nAllNodes && Mtm->nodes[i].originId != txn->origin_id; i++);
-		if (i == Mtm->nAllNodes) { 
-			elog(WARNING, "Failed to map origin %d", txn->origin_id);
-			i = MtmNodeId-1;
-		} else { 
-			Assert(i == MtmNodeId-1 || txn->origin_lsn != InvalidXLogRecPtr);
-		}
-		pq_sendbyte(out, i+1);
-	} else { 
-		pq_sendbyte(out, MtmNodeId);
-	}
+	pq_sendbyte(out, MtmGetOriginNode(txn));
 	pq_sendint64(out, txn->origin_lsn);
 
 	if (txn->xact_action == XLOG_XACT_COMMIT_PREPARED) { 
@@ -270,6 +363,9 @@ pglogical_write_commit(StringInfo out, PGLogicalOutputData *data,
 
 	MtmTransactionRecords = 0;
 	MTM_TXTRACE(txn, "pglogical_write_commit Finish");
+	if (event == PGLOGICAL_PREPARE) { 
+		MTM_PROFILE(txn->gid, MTM_EV_SENT, MtmReplicationNodeId, MtmGetSystemTime());
+	}
 }
 
 /* 
@@ -370,6 +466,75 @@ write_startup_message(StringInfo out, List *msg)
 {
 }
 
+/*
+ * Get relation metadata with attribute transfer info, choosing the transfer type
+ * and looking up the send/output function of each attribute only once per relation
+ * instead of for each column of each row sent.
+ */
+static PGLRelMetaEntry*
+pglogical_attr_transfer_get(PGLogicalOutputData *data, Relation rel)
+{
+	PGLRelMetaEntry* meta = pglogical_relmeta_get(rel);
+	TupleDesc	desc = RelationGetDescr(rel);
+	uint8		flags = (data->allow_internal_basetypes ? 1 : 0)
+		| (data->allow_binary_basetypes ? 2 : 0)
+		| (data->allow_trusted_types ? 4 : 0);
+	MemoryContext attrcxt;
+	PGLAttrTransfer* attrs;
+	uint16		nliveatts = 0;
+	int			i;
+
+	if (meta->attrcxt != NULL && meta->attrflags == flags) { 
+		return meta;
+	}
+	if (meta->attrcxt != NULL) { 
+		MemoryContextDelete(meta->attrcxt);
+		meta->attrcxt = NULL;
+		meta->attrs = NULL;
+	}
+
+	/* the lookups below may fail, so only attach the info to the entry once it is complete */
+	attrcxt = AllocSetContextCreate(CacheMemoryContext,
+									"pglogical attribute transfer",
+									ALLOCSET_SMALL_SIZES);
+	attrs = (PGLAttrTransfer*)MemoryContextAllocZero(attrcxt, sizeof(PGLAttrTransfer) * desc->natts);
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		HeapTuple	typtup;
+		Form_pg_type typclass;
+		Form_pg_attribute att = desc->attrs[i];
+		PGLAttrTransfer* attr = &attrs[i];
+
+		/* dropped columns are not sent */
+		if (att->attisdropped)
+			continue;
+		nliveatts++;
+
+		typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
+		if (!HeapTupleIsValid(typtup))
+			elog(ERROR, "cache lookup failed for type %u", att->atttypid);
+		typclass = (Form_pg_type) GETSTRUCT(typtup);
+
+		attr->transfer_type = decide_datum_transfer(att, typclass,
+													data->allow_internal_basetypes,
+													data->allow_binary_basetypes,
+													data->allow_trusted_types);
+		if (attr->transfer_type == 's') { 
+			fmgr_info_cxt(typclass->typsend, &attr->func, attrcxt);
+		} else if (attr->transfer_type == 't') { 
+			fmgr_info_cxt(typclass->typoutput, &attr->func, attrcxt);
+		}
+		ReleaseSysCache(typtup);
+	}
+
+	meta->attrcxt = attrcxt;
+	meta->attrs = attrs;
+	meta->nliveatts = nliveatts;
+	meta->attrflags = flags;
+	return meta;
+}
+
 /*
  * Write a tuple to the outputstream, in the most efficient format possible.
  */
@@ -381,7 +546,9 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 	Datum		values[MaxTupleAttributeNumber];
 	bool		isnull[MaxTupleAttributeNumber];
 	int			i;
-	uint16		nliveatts = 0;
+	PGLRelMetaEntry* meta;
+	uint16		nliveatts;
+	bool		send_lz4 = data->allow_lz4_datums; /* shadowed by column data below */
 
 	if (MtmIsFilteredTxn) {
 		MTM_LOG2("%d: pglogical_write_tuple filtered", MyProcPid);
@@ -394,15 +561,10 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 	}
 
 	desc = RelationGetDescr(rel);
+	meta = pglogical_attr_transfer_get(data, rel);
+	nliveatts = meta->nliveatts;
 
 	pq_sendbyte(out, 'T');			/* sending TUPLE */
-
-	for (i = 0; i < desc->natts; i++)
-	{
-		if (desc->attrs[i]->attisdropped)
-			continue;
-		nliveatts++;
-	}
 	pq_sendint(out, nliveatts, 2);
 
 	/* try to allocate enough memory from the get go */
@@ -418,15 +580,24 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 
 	for (i = 0; i < desc->natts; i++)
 	{
-		HeapTuple	typtup;
-		Form_pg_type typclass;
 		Form_pg_attribute att = desc->attrs[i];
-		char		transfer_type;
+		PGLAttrTransfer* attr = &meta->attrs[i];
+		char		transfer_type = attr->transfer_type;
 
 		/* skip dropped columns */
 		if (att->attisdropped)
 			continue;
 
+		/*
+		 * Columns filtered out by the column filter hook are sent as unchanged:
+		 * the receiver decodes tuples positionally, so they can't be omitted.
+		 */
+		if (data->att_list != NULL && !bms_is_member(att->attnum, data->att_list))
+		{
+			pq_sendbyte(out, 'u');
+			continue;
+		}
+
 		if (isnull[i])
 		{
 			pq_sendbyte(out, 'n');	/* null column */
@@ -438,14 +609,6 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 			continue;
 		}
 
-		typtup = SearchSysCache1(TYPEOID, ObjectIdGetDatum(att->atttypid));
-		if (!HeapTupleIsValid(typtup))
-			elog(ERROR, "cache lookup failed for type %u", att->atttypid);
-		typclass = (Form_pg_type) GETSTRUCT(typtup);
-
-		transfer_type = decide_datum_transfer(att, typclass,
-											  data->allow_internal_basetypes,
-											  data->allow_binary_basetypes);
         pq_sendbyte(out, transfer_type);
 		switch (transfer_type)
 		{
@@ -485,6 +648,23 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 
 					Assert(!VARATT_IS_EXTERNAL(data));
 
+					/*
+					 * Compressed datums are sent as they are, so the receiver
+					 * stores them without compressing them again, unless it
+					 * can't decompress them.
+					 */
+					if (VARATT_IS_COMPRESSED(data) &&
+						VARCOMPRESSMETHOD_4B_C(data) == TOAST_LZ4_COMPRESSION_ID &&
+						!send_lz4)
+					{
+						struct varlena *plain = heap_tuple_untoast_attr((struct varlena *) data);
+
+						pq_sendint(out, VARSIZE(plain), 4); /* length */
+						appendBinaryStringInfo(out, (char *) plain, VARSIZE(plain));
+						pfree(plain);
+						break;
+					}
+
 					pq_sendint(out, VARSIZE_ANY(data), 4); /* length */
 
 					appendBinaryStringInfo(out, data, VARSIZE_ANY(data));
@@ -494,13 +674,23 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 
 				break;
 
+			case 'o': /* internal varlena with embedded type oid follows */
+				{
+					struct varlena *data = PG_DETOAST_DATUM(values[i]);
+
+					pq_sendint(out, VARSIZE(data), 4); /* length */
+					appendBinaryStringInfo(out, (char *) data, VARSIZE(data));
+					if ((Pointer) data != DatumGetPointer(values[i]))
+						pfree(data);
+				}
+				break;
+
 			case 's': /* binary send/recv data follows */
 				{
 					bytea	   *outputbytes;
 					int			len;
 
-					outputbytes = OidSendFunctionCall(typclass->typsend,
-													  values[i]);
+					outputbytes = SendFunctionCall(&attr->func, values[i]);
 
 					len = VARSIZE(outputbytes) - VARHDRSZ;
 					pq_sendint(out, len, 4); /* length */
@@ -514,16 +704,13 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 					char   	   *outputstr;
 					int			len;
 
-					outputstr =	OidOutputFunctionCall(typclass->typoutput,
-													  values[i]);
+					outputstr =	OutputFunctionCall(&attr->func, values[i]);
 					len = strlen(outputstr) + 1;
 					pq_sendint(out, len, 4); /* length */
 					appendBinaryStringInfo(out, outputstr, len); /* data */
 					pfree(outputstr);
 				}
 		}
-
-		ReleaseSysCache(typtup);
 	}
 }
 
@@ -533,7 +720,8 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 static char
 decide_datum_transfer(Form_pg_attribute att, Form_pg_type typclass,
 					  bool allow_internal_basetypes,
-					  bool allow_binary_basetypes)
+					  bool allow_binary_basetypes,
+					  bool allow_trusted_types)
 {
 	/*
 	 * Use the binary protocol, if allowed, for builtin & plain datatypes.
@@ -545,16 +733,34 @@ decide_datum_transfer(Form_pg_attribute att, Form_pg_type typclass,
 	{
 		return 'b';
 	}
+	/*
+	 * All nodes of multimaster cluster have the same binaries and catalog, so
+	 * internal representation can be used for any type not referencing
+	 * objects by OID. OIDs of user types are different at different nodes
+	 * (DDL is replicated as statements), so arrays of user types and
+	 * composites are sent with 'o' tag and receiver patches embedded type
+	 * OID with the one of its own column type.
+	 */
+	else if (allow_trusted_types)
+	{
+		Oid typid = getBaseType(att->atttypid);
+		if (type_is_portable(typid)) {
+			return 'b';
+		}
+		if (type_is_patchable(typid)) {
+			return 'o';
+		}
+	}
 	/*
 	 * Use send/recv, if allowed, if the type is plain or builtin.
 	 *
 	 * XXX: we can't use send/recv for array or composite types for now due to
 	 * the embedded oids.
 	 */
-	else if (allow_binary_basetypes &&
-			 OidIsValid(typclass->typreceive) &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typtype != 'c') &&
-			 (att->atttypid < FirstNormalObjectId || typclass->typelem == InvalidOid))
+	if (allow_binary_basetypes &&
+		OidIsValid(typclass->typreceive) &&
+		(att->atttypid < FirstNormalObjectId || typclass->typtype != 'c') &&
+		(att->atttypid < FirstNormalObjectId || typclass->typelem == InvalidOid))
 	{
 		return 's';
 	}
@@ -562,6 +768,72 @@ decide_datum_transfer(Form_pg_attribute att, Form_pg_type typclass,
 	return 't';
 }
 
+/*
+ * Check if internal representation of the type doesn't contain OIDs which can be different at different nodes.
+ * Enums are stored as pg_enum OIDs and so are never portable.
+ */
+static bool
+type_is_portable(Oid typid)
+{
+	HeapTuple	tp;
+	Form_pg_type typtup;
+	bool		portable = false;
+
+	tp = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typid));
+	if (!HeapTupleIsValid(tp))
+		elog(ERROR, "cache lookup failed for type %u", typid);
+	typtup = (Form_pg_type) GETSTRUCT(tp);
+
+	switch (typtup->typtype)
+	{
+		case TYPTYPE_BASE:
+			if (typtup->typlen == -1 && OidIsValid(typtup->typelem)) {
+				/* array: element type OID is stored in array header */
+				portable = typid < FirstNormalObjectId && type_is_portable(getBaseType(typtup->typelem));
+			} else {
+				portable = true;
+			}
+			break;
+		case TYPTYPE_RANGE:
+			/* range type OID is stored in range header */
+			portable = typid < FirstNormalObjectId;
+			break;
+		default:
+			break;
+	}
+	ReleaseSysCache(tp);
+	return portable;
+}
+
+/*
+ * Check if the type has exactly one embedded type OID which receiver can replace with the local one:
+ * array of portable user type or composite with all portable attributes.
+ */
+static bool
+type_is_patchable(Oid typid)
+{
+	bool patchable = false;
+
+	if (type_is_rowtype(typid)) {
+		if (typid != RECORDOID) {
+			TupleDesc desc = lookup_rowtype_tupdesc(typid, -1);
+			int i;
+			patchable = true;
+			for (i = 0; i < desc->natts && patchable; i++) {
+				if (!desc->attrs[i]->attisdropped) {
+					patchable = type_is_portable(getBaseType(desc->attrs[i]->atttypid));
+				}
+			}
+			ReleaseTupleDesc(desc);
+		}
+	} else {
+		Oid elemtype = get_element_type(typid);
+		if (OidIsValid(elemtype)) {
+			patchable = type_is_portable(getBaseType(elemtype));
+		}
+	}
+	return patchable;
+}
 
 PGLogicalProtoAPI *
 pglogical_init_api(PGLogicalProtoType typ)
@@ -23,6 +23,12 @@
 #include "access/xact.h"
 #include "access/clog.h"
 #include "access/transam.h"
+#include "access/hash.h"
+#include "access/genam.h"
+#include "access/heapam.h"
+#include "catalog/catversion.h"
+#include "catalog/namespace.h"
+#include "nodes/makefuncs.h"
 #include "lib/stringinfo.h"
 #include "libpq/pqformat.h"
 #include "pgstat.h"
@@ -33,16 +39,23 @@
 #include "utils/guc.h"
 #include "utils/snapmgr.h"
 #include "utils/memutils.h"
+#include "utils/inval.h"
+#include "utils/rel.h"
+#include "utils/relcache.h"
 #include "executor/spi.h"
 #include "replication/origin.h"
 #include "utils/portal.h"
 #include "tcop/pquery.h"
+#include "common/pg_lzcompress.h"
 
 #include "multimaster.h"
 #include "spill.h"
+#include "pglogical_config.h"
 
 #define ERRCODE_DUPLICATE_OBJECT_STR  "42710"
 #define RECEIVER_SUSPEND_TIMEOUT (1*USECS_PER_SEC)
+#define RECEIVER_FEEDBACK_INTERVAL 10   /* msec: minimal interval between feedbacks not requested by sender */
+#define RECEIVER_IDLE_TIMEOUT      1000 /* msec: feedback is sent if no data was received during this time */
 
 /* Signal handling */
 static volatile sig_atomic_t got_sigterm = false;
@@ -57,8 +70,27 @@ static char worker_proc[BGW_MAXLEN];
 
 /* Lastly written positions */
 static lsn_t output_written_lsn = INVALID_LSN;
+static int64 last_feedback_time;                 /* Time of last sent feedback */
+static lsn_t pending_feedback_lsn = INVALID_LSN; /* WAL end reported by keepalive for which feedback was postponed */
 lsn_t MtmSenderWalEnd;
 
+/*
+ * Footprint of the transaction: hashes of (relation, replica identity key) pairs touched by it.
+ * It is passed to the pool to hold back transactions depending on not yet applied predecessors.
+ */
+typedef struct
+{
+	Oid  remote_relid;
+	Oid  local_relid;
+	int  nKeys;                 /* number of key columns, 0 if key can not be determined */
+	int  keys[INDEX_MAX_KEYS];  /* positions of key columns in transferred tuple */
+} MtmFootprintRelation;
+
+static HTAB* MtmFootprintRelations;
+static MtmFootprintRelation* MtmFootprintCurrRel;
+static uint32 MtmFootprint[MULTIMASTER_MAX_FOOTPRINT_SIZE];
+static int MtmFootprintSize;
+
 /* Stream functions */
 static void fe_sendint64(int64 i, char *buf);
 static int64 fe_recvint64(char *buf);
@@ -115,6 +147,8 @@ sendFeedback(PGconn *conn, int64 now, int node_id)
 							 worker_proc, PQerrorMessage(conn))));
 		return false;
 	}
+	last_feedback_time = now;
+	pending_feedback_lsn = INVALID_LSN;
 
 	return true;
 }
@@ -176,24 +210,293 @@ feGetCurrentTimestamp(void)
 	return result;
 }
 
+/*
+ * -------------------------------------------
+ * Transaction footprint
+ * -------------------------------------------
+ */
+
 static void
-feTimestampDifference(int64 start_time, int64 stop_time,
-					  long *secs, int *microsecs)
+MtmFootprintInvalidate(Datum arg, Oid relid)
 {
-	int64	   diff = stop_time - start_time;
+	HASH_SEQ_STATUS status;
+	MtmFootprintRelation* entry;
 
-	if (diff <= 0)
+	hash_seq_init(&status, MtmFootprintRelations);
+	while ((entry = (MtmFootprintRelation*)hash_seq_search(&status)) != NULL)
 	{
-		*secs = 0;
-		*microsecs = 0;
+		if (relid == InvalidOid || entry->local_relid == relid) {
+			hash_search(MtmFootprintRelations, &entry->remote_relid, HASH_REMOVE, NULL);
+		}
 	}
-	else
-	{
-		*secs = (long) (diff / USECS_PER_SEC);
-		*microsecs = (int) (diff % USECS_PER_SEC);
+	MtmFootprintCurrRel = NULL;
+}
+
+/*
+ * Locate positions of replica identity key columns of the relation in the transferred tuple.
+ * Dropped columns are not sent, so position is the number of preceding live columns.
+ */
+static MtmFootprintRelation*
+MtmFootprintGetRelation(Oid remote_relid, char* nspname, char* relname)
+{
+	MtmFootprintRelation* entry;
+	bool found;
+
+	if (MtmFootprintRelations == NULL) {
+		HASHCTL ctl;
+		MemSet(&ctl, 0, sizeof(ctl));
+		ctl.keysize = sizeof(Oid);
+		ctl.entrysize = sizeof(MtmFootprintRelation);
+		MtmFootprintRelations = hash_create("mtm_footprint_relations", 256, &ctl, HASH_ELEM | HASH_BLOBS);
+		CacheRegisterRelcacheCallback(MtmFootprintInvalidate, (Datum)0);
+	}
+	entry = (MtmFootprintRelation*)hash_search(MtmFootprintRelations, &remote_relid, HASH_ENTER, &found);
+	if (!found) {
+		MemoryContext oldContext = CurrentMemoryContext;
+		bool inTransaction = IsTransactionState();
+
+		entry->nKeys = 0;
+		entry->local_relid = InvalidOid;
+
+		if (!inTransaction) {
+			StartTransactionCommand();
+		}
+		entry->local_relid = RangeVarGetRelid(makeRangeVar(nspname, relname, -1), NoLock, true);
+		if (OidIsValid(entry->local_relid)) {
+			Relation rel = heap_open(entry->local_relid, AccessShareLock);
+			Oid idxoid = RelationGetReplicaIndex(rel);
+			if (OidIsValid(idxoid)) {
+				Relation idxrel = index_open(idxoid, AccessShareLock);
+				TupleDesc desc = RelationGetDescr(rel);
+				int nKeys = RelationGetNumberOfAttributes(idxrel);
+				int i, j;
+				for (i = 0; i < nKeys; i++) {
+					AttrNumber attno = idxrel->rd_index->indkey.values[i];
+					int pos = 0;
+					if (attno <= 0) { /* expression index */
+						break;
+					}
+					for (j = 0; j < attno - 1; j++) {
+						if (!desc->attrs[j]->attisdropped) {
+							pos += 1;
+						}
+					}
+					entry->keys[i] = pos;
+				}
+				entry->nKeys = i == nKeys ? nKeys : 0;
+				index_close(idxrel, AccessShareLock);
+			}
+			heap_close(rel, AccessShareLock);
+		}
+		if (!inTransaction) {
+			CommitTransactionCommand();
+		}
+		MemoryContextSwitchTo(oldContext);
+	}
+	return entry;
+}
+
+/*
+ * Calculate hash of key columns of the tuple and add it to the footprint
+ */
+static void
+MtmFootprintAddTuple(StringInfo s)
+{
+	int i, natts;
+	int key = 0;
+	uint32 hash;
+
+	if (pq_getmsgbyte(s) != 'T') {
+		MtmFootprintCurrRel = NULL;
+		return;
+	}
+	natts = pq_getmsgint(s, 2);
+	hash = DatumGetUInt32(hash_uint32(MtmFootprintCurrRel->local_relid));
+
+	for (i = 0; i < natts; i++) {
+		char kind = pq_getmsgbyte(s);
+		int len = 0;
+		char const* data = NULL;
+		if (kind != 'n' && kind != 'u') {
+			len = pq_getmsgint(s, 4);
+			data = pq_getmsgbytes(s, len);
+		}
+		if (key < MtmFootprintCurrRel->nKeys && MtmFootprintCurrRel->keys[key] == i) {
+			if (data == NULL) {
+				/* NULL or unchanged key: it can not be used to identify the row */
+				return;
+			}
+			hash = ((hash << 1) | (hash >> 31)) ^ DatumGetUInt32(hash_any((unsigned char const*)data, len));
+			key += 1;
+		}
+	}
+	if (key == MtmFootprintCurrRel->nKeys && MtmFootprintSize < MULTIMASTER_MAX_FOOTPRINT_SIZE) {
+		MtmFootprint[MtmFootprintSize++] = hash;
+	}
+}
+
+/*
+ * Inspect message of replicated transaction and update its footprint
+ */
+static void
+MtmFootprintCollect(char* stmt, int len)
+{
+	StringInfoData s;
+	s.data = stmt;
+	s.len = len;
+	s.maxlen = -1;
+	s.cursor = 1;
+
+	switch (stmt[0]) {
+	  case 'B':
+		MtmFootprintSize = 0;
+		MtmFootprintCurrRel = NULL;
+		break;
+	  case 'R':
+	  {
+		  Oid remote_relid = pq_getmsgint(&s, 4);
+		  int nspnamelen = pq_getmsgbyte(&s);
+		  char* nspname = (char*)pq_getmsgbytes(&s, nspnamelen);
+		  int relnamelen = pq_getmsgbyte(&s);
+		  char* relname = (char*)pq_getmsgbytes(&s, relnamelen);
+		  MtmFootprintCurrRel = MtmFootprintGetRelation(remote_relid, nspname, relname);
+		  if (MtmFootprintCurrRel->nKeys == 0) {
+			  MtmFootprintCurrRel = NULL;
+		  }
+		  break;
+	  }
+	  case 'I':
+	  case 'D':
+		if (MtmFootprintCurrRel != NULL) {
+			MtmFootprintAddTuple(&s);
+		}
+		break;
+	  case 'U':
+		if (MtmFootprintCurrRel != NULL) {
+			char action = pq_getmsgbyte(&s);
+			if (action == 'K') {
+				MtmFootprintAddTuple(&s);
+				if (MtmFootprintCurrRel == NULL) {
+					break;
+				}
+				action = pq_getmsgbyte(&s);
+			}
+			if (action == 'N') {
+				MtmFootprintAddTuple(&s);
+			}
+		}
+		break;
 	}
 }
 
+/*
+ * Decompress message sent by walsender as 'z' frame (see pglogical_compress_message).
+ * Returns pointer to data in static buffer which is valid until next call, or NULL if message is corrupted.
+ */
+static char*
+MtmDecompressMessage(char* stmt, int* len)
+{
+	static char* buf;
+	static int   bufSize;
+	uint32 rawsize;
+
+	if (*len < 5) { 
+		return NULL;
+	}
+	memcpy(&rawsize, stmt + 1, sizeof(rawsize));
+	rawsize = ntohl(rawsize);
+	if (rawsize > bufSize) { 
+		bufSize = Max(rawsize, bufSize*2);
+		buf = buf == NULL ? MemoryContextAlloc(TopMemoryContext, bufSize) : repalloc(buf, bufSize);
+	}
+	if (pglz_decompress(stmt + 5, *len - 5, buf, rawsize) != rawsize) { 
+		return NULL;
+	}
+	*len = rawsize;
+	return buf;
+}
+
+/*
+ * GUCs of origin sessions. Session includes its GUCs only in the first DDL message after they are changed,
+ * subsequent messages refer to them by version, so receiver keeps the last GUCs of each session
+ * and inserts them in DDL messages passed to workers.
+ */
+typedef struct
+{
+	int32       session;  /* origin session: hash key */
+	timestamp_t version;
+	int32       size;
+	char*       gucs;
+} MtmSessionGucs;
+
+static HTAB* MtmSessionGucsHash;
+
+/*
+ * Returns either original message or pointer to static buffer valid until next call.
+ */
+static char*
+MtmResolveDDLMessage(int nodeId, char* stmt, int* len)
+{
+	static StringInfoData buf;
+	MtmDDLMessageHeader hdr;
+	MtmSessionGucs* entry;
+	int hdrOffs = 6; /* 'M', action and message size */
+	bool found;
+
+	if (*len < hdrOffs + (int)sizeof(hdr)) { 
+		return stmt;
+	}
+	memcpy(&hdr, stmt + hdrOffs, sizeof(hdr));
+	if (MtmSessionGucsHash == NULL) { 
+		HASHCTL info;
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(int32);
+		info.entrysize = sizeof(MtmSessionGucs);
+		info.hcxt = TopMemoryContext;
+		MtmSessionGucsHash = hash_create("MtmSessionGucs", MaxConnections, &info, HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+	entry = (MtmSessionGucs*)hash_search(MtmSessionGucsHash, &hdr.session, HASH_ENTER, &found);
+	if (!found) { 
+		entry->version = 0;
+		entry->size = 0;
+		entry->gucs = NULL;
+	}
+	if (hdr.gucSize >= 0) { 
+		if (entry->gucs != NULL) { 
+			pfree(entry->gucs);
+			entry->gucs = NULL;
+		}
+		entry->version = hdr.gucVersion;
+		entry->size = hdr.gucSize;
+		if (hdr.gucSize > 0) { 
+			entry->gucs = MemoryContextAlloc(TopMemoryContext, hdr.gucSize);
+			memcpy(entry->gucs, stmt + hdrOffs + sizeof(hdr), hdr.gucSize);
+		}
+		return stmt;
+	}
+	if (entry->version != hdr.gucVersion) { 
+		elog(WARNING, "GUCs of session %d of node %d are unknown: DDL will be executed with default settings", hdr.session, nodeId);
+		entry->size = 0;
+	}
+	if (buf.data == NULL) { 
+		MemoryContext oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+		initStringInfo(&buf);
+		MemoryContextSwitchTo(oldcontext);
+	}
+	resetStringInfo(&buf);
+	pq_sendbyte(&buf, 'M');
+	pq_sendbyte(&buf, stmt[1]);
+	pq_sendint(&buf, *len - hdrOffs + entry->size, 4);
+	hdr.gucSize = entry->size;
+	appendBinaryStringInfo(&buf, (char*)&hdr, sizeof(hdr));
+	if (entry->size > 0) { 
+		appendBinaryStringInfo(&buf, entry->gucs, entry->size);
+	}
+	appendBinaryStringInfo(&buf, stmt + hdrOffs + sizeof(hdr), *len - hdrOffs - sizeof(hdr));
+	*len = buf.len;
+	return buf.data;
+}
+
 static char const* const MtmReplicationModeName[] = 
 {
 	"exit",
@@ -203,12 +506,93 @@ static char const* const MtmReplicationModeName[] =
 	"open_existed" /* normal mode: use existed slot or create new one and start receiving data from it from the rememered position */
 };
 
+/*
+ * Memory reserved by this receiver from node-wide budget (multimaster.trans_spill_budget)
+ * for buffering transaction exceeding multimaster.trans_spill_threshold.
+ */
+static uint64 trans_memory_reserved;
+
+#define TRANS_MEMORY_QUANTUM MB /* granularity of reservation, to avoid access to shared counter for each message */
+
+/*
+ * Check if transaction of the specified size can be kept in memory.
+ * Returns false if it should be spilled to the disk.
+ */
+static bool
+MtmReserveTransMemory(size_t size)
+{
+	uint64 threshold = (uint64)MtmTransSpillThreshold*MB;
+	uint64 budget = (uint64)MtmTransSpillBudget*MB;
+	uint64 required, used;
+
+	if (size < threshold) { 
+		return true;
+	}
+	required = (size - threshold + TRANS_MEMORY_QUANTUM) / TRANS_MEMORY_QUANTUM * TRANS_MEMORY_QUANTUM;
+	if (required <= trans_memory_reserved) { 
+		return true;
+	}
+	used = pg_atomic_read_u64(&Mtm->transMemoryUsed);
+	do { 
+		if (used + required - trans_memory_reserved > budget) { 
+			return false;
+		}
+	} while (!pg_atomic_compare_exchange_u64(&Mtm->transMemoryUsed, &used, used + required - trans_memory_reserved));
+	trans_memory_reserved = required;
+	return true;
+}
+
+static void
+MtmReleaseTransMemory(void)
+{
+	if (trans_memory_reserved != 0) { 
+		pg_atomic_fetch_sub_u64(&Mtm->transMemoryUsed, trans_memory_reserved);
+		trans_memory_reserved = 0;
+	}
+}
+
+static void
+MtmReleaseTransMemoryOnExit(int code, Datum arg)
+{
+	MtmReleaseTransMemory();
+}
+
+/*
+ * Pass chunk of streamed transaction to the worker bound to the stream.
+ * Chunk which doesn't fit in the stream sub-queue (because of single huge message) is passed through spill file.
+ */
+static void
+MtmStreamChunk(int nodeId, ByteBuffer* buf, bool last)
+{
+	if (buf->used > MtmStreamChunkSize()) {
+		StringInfoData spill_info;
+		int file_id;
+		int spill_file = MtmCreateSpillFile(nodeId, &file_id);
+		ByteBufferAppend(buf, ")", 1);
+		MtmSpillToFile(spill_file, buf->data, buf->used);
+		MtmStatAdd(nodeId, spillBytes, buf->used);
+		MtmCloseSpillFile(spill_file);
+		initStringInfo(&spill_info);
+		pq_sendbyte(&spill_info, 'F');
+		pq_sendint(&spill_info, nodeId, 4);
+		pq_sendint(&spill_info, file_id, 4);
+		pq_sendbyte(&spill_info, '(');
+		pq_sendint(&spill_info, buf->used, 4);
+		MtmExecuteStream(nodeId, spill_info.data, spill_info.len, last);
+		pfree(spill_info.data);
+	} else {
+		MtmExecuteStream(nodeId, buf->data, buf->used, last);
+	}
+	ByteBufferReset(buf);
+}
+
 static void
 pglogical_receiver_main(Datum main_arg)
 {
 	int nodeId = DatumGetInt32(main_arg);
 	/* Variables for replication connection */
 	PQExpBuffer query;
+	PQExpBuffer originRestartPos;
 	PGconn *conn;
 	PGresult *res;
 	MtmReplicationMode mode;
@@ -219,18 +603,25 @@ pglogical_receiver_main(Datum main_arg)
 	/* Buffer for COPY data */
 	char	*copybuf = NULL;
 	int spill_file = -1;
+	bool streaming = false;
+	timestamp_t receive_start = 0; /* when BEGIN of current transaction was received */
+	char const* gid;
 	StringInfoData spill_info;
+	StringInfoData commit_info;
 	char *slotName;
 	char* connString = psprintf("replication=database %s", Mtm->nodes[nodeId-1].con.connStr);
 	static PortalData fakePortal;
+	int i;
 
 	ByteBufferAlloc(&buf);
+	before_shmem_exit(MtmReleaseTransMemoryOnExit, 0);
 
 	slotName = psprintf(MULTIMASTER_SLOT_PATTERN, MtmNodeId);
 
 	MtmIsLogicalReceiver = true;
 
 	initStringInfo(&spill_info);
+	initStringInfo(&commit_info);
 
 	/* Register functions for SIGTERM/SIGHUP management */
 	pqsignal(SIGHUP, receiver_raw_sighup);
@@ -242,6 +633,9 @@ pglogical_receiver_main(Datum main_arg)
 	Mtm->nodes[nodeId-1].receiverStartTime = MtmGetSystemTime();
 	MtmReplicationNodeId = nodeId;
 
+	/* worker may be still bound to the transaction streamed by previous instance of receiver */
+	MtmAbortStream(nodeId);
+
     sprintf(worker_proc, "mtm_pglogical_receiver_%d_%d", MtmNodeId, nodeId);
 
 	/* We're now ready to receive signals */
@@ -356,7 +750,21 @@ pglogical_receiver_main(Datum main_arg)
 		MTM_LOG1("Start replication on slot %s from node %d at position %llx, mode %s, recovered lsn %llx", 
 				 slotName, nodeId, originStartPos, MtmReplicationModeName[mode], Mtm->recoveredLSN);
 
-		appendPQExpBuffer(query, "START_REPLICATION SLOT \"%s\" LOGICAL %x/%x (\"startup_params_format\" '1', \"max_proto_version\" '%d',  \"min_proto_version\" '%d', \"forward_changesets\" '1', \"mtm_replication_mode\" '%s', \"mtm_restart_pos\" '%llx', \"mtm_recovered_pos\" '%llx')",
+		/* 
+		 * Pass restart positions for all origins to let sender skip transactions which are already applied by this node:
+		 * them will be in any case filtered out by MtmFilterTransaction and sending them is just a waste of network bandwidth.
+		 */
+		originRestartPos = createPQExpBuffer();
+		for (i = 0; i < Mtm->nAllNodes; i++) { 
+			appendPQExpBuffer(originRestartPos, i == 0 ? "%llx" : ",%llx", Mtm->nodes[i].restartLSN);
+		}
+
+		appendPQExpBuffer(query, "START_REPLICATION SLOT \"%s\" LOGICAL %x/%x (\"startup_params_format\" '1', \"max_proto_version\" '%d',  \"min_proto_version\" '%d', \"forward_changesets\" '1', \"mtm_replication_mode\" '%s', \"mtm_restart_pos\" '%llx', \"mtm_recovered_pos\" '%llx', \"mtm_origin_restart_pos\" '%s', "
+						  /* ask for internal representation of datums: sender checks that binary layout is compatible */
+						  "\"binary.want_internal_basetypes\" '1', \"binary.want_binary_basetypes\" '1', \"binary.basetypes_major_version\" '%u', "
+						  "\"binary.sizeof_datum\" '%u', \"binary.sizeof_int\" '%u', \"binary.sizeof_long\" '%u', \"binary.bigendian\" '%d', "
+						  "\"binary.float4_byval\" '%d', \"binary.float8_byval\" '%d', \"binary.integer_datetimes\" '%d', "
+						  "\"binary.trusted_cluster\" '%d', \"binary.catalog_version\" '%u', \"binary.lz4_datums\" '1', \"compression\" '%d')",
 						  slotName,
 						  (uint32) (originStartPos >> 32),
 						  (uint32) originStartPos,
@@ -364,8 +772,16 @@ pglogical_receiver_main(Datum main_arg)
 						  MULTIMASTER_MIN_PROTO_VERSION,
 						  MtmReplicationModeName[mode],
 						  originStartPos,
-						  Mtm->recoveredLSN
+						  Mtm->recoveredLSN,
+						  originRestartPos->data,
+						  PG_VERSION_NUM/100,
+						  (uint32) sizeof(Datum), (uint32) sizeof(int), (uint32) sizeof(long),
+						  server_bigendian(),
+						  server_float4_byval(), server_float8_byval(), server_integer_datetimes(),
+						  MtmTrustedCluster, CATALOG_VERSION_NO,
+						  MtmCompressReplication
 			);
+		destroyPQExpBuffer(originRestartPos);
 		res = PQexec(conn, query->data);
 		if (PQresultStatus(res) != PGRES_COPY_BOTH)
 		{
@@ -429,6 +845,7 @@ pglogical_receiver_main(Datum main_arg)
 			{
 				lsn_t walEnd;
 				char* stmt;
+				int stmt_len;
 				
 				/* Some cleanup */
 				if (copybuf != NULL)
@@ -480,7 +897,8 @@ pglogical_receiver_main(Datum main_arg)
 					/*
 					 * If the server requested an immediate reply, send one.
 					 * If sync mode is sent reply in all cases to ensure that
-					 * server knows how far replay has been done.
+					 * server knows how far replay has been done, but not more often than
+					 * RECEIVER_FEEDBACK_INTERVAL: postponed feedback is sent when receiver becomes idle.
 					 * In recovery mode also always send reply to provide master with more precise information
 					 * about recovery progress
 					 */
@@ -488,10 +906,18 @@ pglogical_receiver_main(Datum main_arg)
 					{
 						int64 now = feGetCurrentTimestamp();
 
-						/* Leave is feedback is not sent properly */
-						MtmUpdateLsnMapping(nodeId, walEnd);
-						if (!sendFeedback(conn, now, nodeId)) {
-							goto OnError;
+						if (!replyRequested && Mtm->status != MTM_RECOVERY 
+							&& now < last_feedback_time + RECEIVER_FEEDBACK_INTERVAL*1000)
+						{
+							pending_feedback_lsn = walEnd;
+						}
+						else
+						{
+							/* Leave is feedback is not sent properly */
+							MtmUpdateLsnMapping(nodeId, walEnd);
+							if (!sendFeedback(conn, now, nodeId)) {
+								goto OnError;
+							}
 						}
 					}
 					continue;
@@ -521,6 +947,14 @@ pglogical_receiver_main(Datum main_arg)
 				if (rc > hdr_len)
 				{
 					stmt = copybuf + hdr_len;
+					stmt_len = rc - hdr_len;
+					if (stmt[0] == 'z') { 
+						stmt = MtmDecompressMessage(stmt, &stmt_len);
+						if (stmt == NULL) { 
+							ereport(LOG, (errmsg("%s: Failed to decompress message", worker_proc)));
+							goto OnError;
+						}
+					}
 					if (mode == REPLMODE_RECOVERED) {
 						if (stmt[0] != 'B') {
 							output_written_lsn = Max(walEnd, output_written_lsn);
@@ -529,7 +963,23 @@ pglogical_receiver_main(Datum main_arg)
 						mode = REPLMODE_OPEN_EXISTED;
 					}
 					MTM_LOG3("Receive message %c from node %d", stmt[0], nodeId);
-					if (buf.used >= MtmTransSpillThreshold*MB) { 
+					if (stmt[0] == 'M' && (stmt[1] == 'D' || stmt[1] == 'C')) { 
+						stmt = MtmResolveDDLMessage(nodeId, stmt, &stmt_len);
+					}
+					if (streaming) {
+						if (buf.used >= MtmStreamChunkSize()) {
+							/* transaction remains active at worker until next chunk */
+							ByteBufferAppend(&buf, "<", 1);
+							MtmStreamChunk(nodeId, &buf, false);
+							ByteBufferAppend(&buf, ">", 1);
+						}
+					} else if (spill_file < 0 && buf.used >= Min(MtmTransSpillThreshold*MB, MtmStreamChunkSize()) && MtmStartStream(nodeId)) {
+						/* apply large transaction while it is received instead of spilling it to the disk */
+						streaming = true;
+						ByteBufferAppend(&buf, "<", 1);
+						MtmStreamChunk(nodeId, &buf, false);
+						ByteBufferAppend(&buf, ">", 1);
+					} else if (!MtmReserveTransMemory(buf.used)) { 
 						if (spill_file < 0) {
 							int file_id;
 							spill_file = MtmCreateSpillFile(nodeId, &file_id);
@@ -541,49 +991,71 @@ pglogical_receiver_main(Datum main_arg)
 						pq_sendbyte(&spill_info, '(');
 						pq_sendint(&spill_info, buf.used, 4);
 						MtmSpillToFile(spill_file, buf.data, buf.used);
+						MtmStatAdd(nodeId, spillBytes, buf.used);
 						ByteBufferReset(&buf);
+						MtmReleaseTransMemory();
 					}
-					if (stmt[0] == 'Z' || (stmt[0] == 'M' && (stmt[1] == 'L' || stmt[1] == 'A' || stmt[1] == 'C'))) {
+					if (stmt[0] == 'Z' || (stmt[0] == 'M' && (stmt[1] == 'L' || stmt[1] == 'A' || stmt[1] == 'F' || stmt[1] == 'C'))) {
 						MTM_LOG3("Process '%c' message from %d", stmt[1], nodeId);
 						if (stmt[0] == 'M' && stmt[1] == 'C') { /* concurrent DDL should be executed by parallel workers */
-							MtmExecute(stmt, rc - hdr_len);
+							MtmExecute(stmt, stmt_len, NULL, 0);
 						} else {
-							MtmExecutor(stmt, rc - hdr_len); /* all other messages can be processed by receiver itself */
+							MtmExecutor(stmt, stmt_len); /* all other messages can be processed by receiver itself */
 						}
 					} else { 
-						ByteBufferAppend(&buf, stmt, rc - hdr_len);
+						if (stmt[0] == 'B') { 
+							receive_start = MtmGetSystemTime();
+						}
+						MtmFootprintCollect(stmt, stmt_len);
+						ByteBufferAppend(&buf, stmt, stmt_len);
 						if (stmt[0] == 'C') /* commit */
 						{
-							if (!MtmFilterTransaction(stmt, rc - hdr_len)) 
+							if (!MtmFilterTransaction(stmt, stmt_len, &gid)) 
 							{ 
-								if (spill_file >= 0) { 
+								if (stmt[1] == PGLOGICAL_PREPARE) { 
+									MTM_PROFILE(gid, MTM_EV_RECEIVE_BEGIN, nodeId, receive_start);
+									MTM_PROFILE(gid, MTM_EV_RECEIVED, nodeId, MtmGetSystemTime());
+								}
+								if (streaming) {
+									MtmStreamChunk(nodeId, &buf, true);
+									streaming = false;
+								} else if (spill_file >= 0) { 
 									ByteBufferAppend(&buf, ")", 1);
 									pq_sendbyte(&spill_info, '(');
 									pq_sendint(&spill_info, buf.used, 4);
 									MtmSpillToFile(spill_file, buf.data, buf.used);
+									MtmStatAdd(nodeId, spillBytes, buf.used);
 									MtmCloseSpillFile(spill_file);
-									MtmExecute(spill_info.data, spill_info.len);
+									MtmExecute(spill_info.data, spill_info.len, MtmFootprint, MtmFootprintSize);
 									spill_file = -1;
 									resetStringInfo(&spill_info);
 								} else { 
-									if (MtmPreserveCommitOrder && buf.used == rc - hdr_len) {
-										/* Perform commit-prepared and rollback-prepared requested directly in receiver */
-										timestamp_t stop, start = MtmGetSystemTime();
-										MtmExecutor(buf.data, buf.used);
-										stop = MtmGetSystemTime();
-										if (stop - start > USECS_PER_SEC) { 
-											elog(WARNING, "Commit of prepared transaction takes %lld usec, flags=%x", stop - start, stmt[1]);
-										}
+									if (MtmPreserveCommitOrder && buf.used == stmt_len) {
+										/* 
+										 * Commit-prepared and rollback-prepared are applied by workers concurrently,
+										 * but each of them waits for commit of previously received ones using commit ticket
+										 */
+										resetStringInfo(&commit_info);
+										pq_sendbyte(&commit_info, 'T');
+										pq_sendint(&commit_info, nodeId, 4);
+										pq_sendint64(&commit_info, MtmIssueCommitTicket(nodeId));
+										appendBinaryStringInfo(&commit_info, buf.data, buf.used);
+										MtmExecute(commit_info.data, commit_info.len, MtmFootprint, MtmFootprintSize);
 									} else {
 										Assert(stmt[1] == PGLOGICAL_PREPARE || stmt[1] == PGLOGICAL_COMMIT); /* all other commits should be applied in place */
-										MtmExecute(buf.data, buf.used);
+										MtmExecute(buf.data, buf.used, MtmFootprint, MtmFootprintSize);
 									}
 								}
+							} else if (streaming) {
+								MtmAbortStream(nodeId);
+								streaming = false;
 							} else if (spill_file >= 0) { 
 								MtmCloseSpillFile(spill_file);
 								spill_file = -1;
 							}
 							ByteBufferReset(&buf);
+							MtmReleaseTransMemory();
+							MtmFootprintSize = 0;
 						}
 					}
 				}
@@ -595,74 +1067,55 @@ pglogical_receiver_main(Datum main_arg)
 			if (rc == 0)
 			{
 				/*
-				 * In async mode, and no data available. We block on reading but
-				 * not more than the specified timeout, so that we can send a
+				 * No data available. Send postponed feedback and wait for data on the socket
+				 * or for the latch, but not more than the specified timeout, so that we can send a
 				 * response back to the client.
 				 */
-				int			r;
-				fd_set	  input_mask;
-				int64	   message_target = 0;
-				int64	   fsync_target = 0;
-				struct timeval timeout;
-				struct timeval *timeoutptr = NULL;
-				int64	   targettime;
-				long		secs;
-				int		 usecs;
-				int64		now;
-
-				FD_ZERO(&input_mask);
-				FD_SET(PQsocket(conn), &input_mask);
-
-				/* Now compute when to wakeup. */
-				targettime = message_target;
-
-				if (fsync_target > 0 && fsync_target < targettime)
-					targettime = fsync_target;
-				now = feGetCurrentTimestamp();
-				feTimestampDifference(now,
-									  targettime,
-									  &secs,
-									  &usecs);
-				if (secs <= 0)
-					timeout.tv_sec = 1; /* Always sleep at least 1 sec */
-				else
-					timeout.tv_sec = secs;
-				timeout.tv_usec = usecs;
-				timeoutptr = &timeout;
-
-				r = select(PQsocket(conn) + 1, &input_mask, NULL, NULL, timeoutptr);
-				if (r == 0)
+				int64 now = feGetCurrentTimestamp();
+				long  timeout = RECEIVER_IDLE_TIMEOUT;
+				int   r;
+
+				if (pending_feedback_lsn != INVALID_LSN)
 				{
-					int64 now = feGetCurrentTimestamp();
-					
-					/* Leave is feedback is not sent properly */
-					MtmUpdateLsnMapping(nodeId, INVALID_LSN);
-					sendFeedback(conn, now, nodeId);
+					if (now >= last_feedback_time + RECEIVER_FEEDBACK_INTERVAL*1000)
+					{
+						/* Leave is feedback is not sent properly */
+						MtmUpdateLsnMapping(nodeId, pending_feedback_lsn);
+						if (!sendFeedback(conn, now, nodeId)) {
+							goto OnError;
+						}
+					}
+					else
+					{
+						timeout = Max((last_feedback_time + RECEIVER_FEEDBACK_INTERVAL*1000 - now)/1000, 1);
+					}
 				}
-				else if (r < 0 && errno == EINTR)
+
+				r = WaitLatchOrSocket(&MyProc->procLatch,
+									  WL_LATCH_SET | WL_SOCKET_READABLE | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+									  PQsocket(conn), timeout);
+				if (r & WL_POSTMASTER_DEATH)
+					proc_exit(1);
+
+				if (r & WL_SOCKET_READABLE)
 				{
-					/*
-					 * Got a timeout or signal. Continue the loop and either
-					 * deliver a status packet to the server or just go back into
-					 * blocking.
-					 */
-					continue;
+					/* There is actually data on the socket */
+					if (PQconsumeInput(conn) == 0)
+					{
+						ereport(LOG, (errmsg("%s: Data remaining on the socket.",
+											 worker_proc)));
+						goto OnError;
+					}
 				}
-				else if (r < 0)
+				else if ((r & WL_TIMEOUT) && pending_feedback_lsn == INVALID_LSN)
 				{
-					ereport(LOG, (errmsg("%s: Incorrect status received.",
-										 worker_proc)));
+					now = feGetCurrentTimestamp();
 					
-					goto OnError;
-				}
-
-				/* Else there is actually data on the socket */
-				if (PQconsumeInput(conn) == 0)
-				{
-					ereport(LOG, (errmsg("%s: Data remaining on the socket.",
-										 worker_proc)));
-					goto OnError;
+					/* Leave is feedback is not sent properly */
+					MtmUpdateLsnMapping(nodeId, INVALID_LSN);
+					sendFeedback(conn, now, nodeId);
 				}
+				/* Latch is reset and signals are processed at the beginning of the loop */
 				continue;
 			}
 
@@ -686,6 +1139,13 @@ pglogical_receiver_main(Datum main_arg)
 		continue;
 
 	  OnError:
+		if (streaming) {
+			/* transaction will be resent after reconnect */
+			MtmAbortStream(nodeId);
+			ByteBufferReset(&buf);
+			MtmReleaseTransMemory();
+			streaming = false;
+		}
 		PQfinish(conn);
 		MtmReleaseRecoverySlot(nodeId);
 		MtmSleep(RECEIVER_SUSPEND_TIMEOUT);		
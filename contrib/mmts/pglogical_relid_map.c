@@ -11,10 +11,148 @@
  *-------------------------------------------------------------------------
  */
 #include "postgres.h"
+#include "access/nbtree.h"
+#include "access/transam.h"
+#include "catalog/pg_index.h"
+#include "nodes/makefuncs.h"
+#include "parser/parse_relation.h"
 #include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/lsyscache.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/syscache.h"
 #include "pglogical_relid_map.h"
 
-static HTAB *relid_map;
+static PGLOidMap relid_map;
+static PGLOidMap relmeta_map;
+static HTAB *index_key_map;
+
+#define PGL_OID_MAP_ENTRY(map, i) ((Oid*)((map)->entries + (Size)(i)*(map)->entrysize))
+
+static inline uint32
+pgl_oid_hash(Oid oid)
+{
+	/* murmur3 finalizer: Oids are sequential, so spread them across the table */
+	uint32 h = (uint32)oid;
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+static void
+pgl_oid_map_init(PGLOidMap* map, Size entrysize, uint32 size)
+{
+	Assert((size & (size-1)) == 0);
+	map->entrysize = entrysize;
+	map->mask = size - 1;
+	map->used = 0;
+	map->entries = MemoryContextAllocZero(CacheMemoryContext, entrysize*size);
+}
+
+/*
+ * Locate entry with the specified key. If "insert" is true, then new entry is added if not found
+ * (it is zeroed except the key). Returns NULL if entry is not found and not inserted.
+ */
+static void*
+pgl_oid_map_lookup(PGLOidMap* map, Oid key, bool insert, bool* found)
+{
+	uint32 i;
+	Oid* entry;
+
+	Assert(key != InvalidOid);
+	for (i = pgl_oid_hash(key) & map->mask; *(entry = PGL_OID_MAP_ENTRY(map, i)) != InvalidOid; i = (i + 1) & map->mask) { 
+		if (*entry == key) { 
+			if (found) { 
+				*found = true;
+			}
+			return entry;
+		}
+	}
+	if (found) { 
+		*found = false;
+	}
+	if (!insert) { 
+		return NULL;
+	}
+	if ((map->used + 1)*4 > (map->mask + 1)*3) { 
+		/* load factor exceeds 75%: double size of the table */
+		PGLOidMap old = *map;
+		uint32 j;
+		pgl_oid_map_init(map, old.entrysize, (old.mask + 1)*2);
+		for (j = 0; j <= old.mask; j++) { 
+			Oid* src = PGL_OID_MAP_ENTRY(&old, j);
+			if (*src != InvalidOid) { 
+				for (i = pgl_oid_hash(*src) & map->mask; *PGL_OID_MAP_ENTRY(map, i) != InvalidOid; i = (i + 1) & map->mask);
+				memcpy(PGL_OID_MAP_ENTRY(map, i), src, map->entrysize);
+			}
+		}
+		map->used = old.used;
+		pfree(old.entries);
+		for (i = pgl_oid_hash(key) & map->mask; *PGL_OID_MAP_ENTRY(map, i) != InvalidOid; i = (i + 1) & map->mask);
+		entry = PGL_OID_MAP_ENTRY(map, i);
+	}
+	map->used += 1;
+	*entry = key;
+	return entry;
+}
+
+/*
+ * Forget about invalidated relations: them will be resolved again by name on next access.
+ * InvalidOid means that all relations are invalidated.
+ */
+static void
+pglogical_relid_map_invalidate(Datum arg, Oid relid)
+{
+	HASH_SEQ_STATUS status;
+	uint32 i;
+
+	/* relid map is indexed by remote relid, so we have to scan it to find local one */
+	for (i = 0; i <= relid_map.mask; i++) { 
+		PGLRelidMapEntry* entry = (PGLRelidMapEntry*)PGL_OID_MAP_ENTRY(&relid_map, i);
+		if (relid == InvalidOid || entry->local_relid == relid) { 
+			entry->local_relid = InvalidOid;
+		}
+	}
+	if (relid == InvalidOid) { 
+		for (i = 0; i <= relmeta_map.mask; i++) { 
+			((PGLRelMetaEntry*)PGL_OID_MAP_ENTRY(&relmeta_map, i))->valid = false;
+		}
+	} else { 
+		PGLRelMetaEntry* entry = (PGLRelMetaEntry*)pgl_oid_map_lookup(&relmeta_map, relid, false, NULL);
+		if (entry != NULL) { 
+			entry->valid = false;
+		}
+	}
+	if (relid == InvalidOid) { 
+		PGLIndexKeyMapEntry* entry;
+		hash_seq_init(&status, index_key_map);
+		while ((entry = (PGLIndexKeyMapEntry*)hash_seq_search(&status)) != NULL) { 
+			entry->valid = false;
+		}
+	} else { 
+		PGLIndexKeyMapEntry* entry = (PGLIndexKeyMapEntry*)hash_search(index_key_map, &relid, HASH_FIND, NULL);
+		if (entry != NULL) { 
+			entry->valid = false;
+		}
+	}
+}
+
+/*
+ * Renaming of schema doesn't invalidate relations belonging to it, so drop all cached names.
+ * Changes of types used by relations don't either, so this also serves type invalidations.
+ */
+static void
+pglogical_relmeta_invalidate(Datum arg, int cacheid, uint32 hashvalue)
+{
+	uint32 i;
+	for (i = 0; i <= relmeta_map.mask; i++) { 
+		((PGLRelMetaEntry*)PGL_OID_MAP_ENTRY(&relmeta_map, i))->valid = false;
+	}
+}
 
 static void
 pglogical_relid_map_init(void)
@@ -22,11 +160,14 @@ pglogical_relid_map_init(void)
 	HASHCTL	ctl;
 	int hash_flags = HASH_ELEM;
 
-	Assert(relid_map == NULL);
+	Assert(index_key_map == NULL);
+
+	pgl_oid_map_init(&relid_map, sizeof(PGLRelidMapEntry), PGL_INIT_RELID_MAP_SIZE);
+	pgl_oid_map_init(&relmeta_map, sizeof(PGLRelMetaEntry), PGL_INIT_RELID_MAP_SIZE);
 
 	MemSet(&ctl, 0, sizeof(ctl));
 	ctl.keysize = sizeof(Oid);
-	ctl.entrysize = sizeof(PGLRelidMapEntry);
+	ctl.entrysize = sizeof(PGLIndexKeyMapEntry);
 
 #if PG_VERSION_NUM >= 90500
 	hash_flags |= HASH_BLOBS;
@@ -35,32 +176,161 @@ pglogical_relid_map_init(void)
 	hash_flags |= HASH_FUNCTION;
 #endif
 
-	relid_map = hash_create("pglogical_relid_map", PGL_INIT_RELID_MAP_SIZE, &ctl, hash_flags);
+	index_key_map = hash_create("pglogical_index_key_map", PGL_INIT_RELID_MAP_SIZE, &ctl, hash_flags);
 
-	Assert(relid_map != NULL);
+	CacheRegisterRelcacheCallback(pglogical_relid_map_invalidate, (Datum)0);
+	CacheRegisterSyscacheCallback(NAMESPACEOID, pglogical_relmeta_invalidate, (Datum)0);
+	CacheRegisterSyscacheCallback(TYPEOID, pglogical_relmeta_invalidate, (Datum)0);
 }
 
 Oid pglogical_relid_map_get(Oid relid)
 {
-	if (relid_map != NULL) { 
-		PGLRelidMapEntry* entry = (PGLRelidMapEntry*)hash_search(relid_map, &relid, HASH_FIND, NULL);
+	if (index_key_map != NULL) { 
+		PGLRelidMapEntry* entry = (PGLRelidMapEntry*)pgl_oid_map_lookup(&relid_map, relid, false, NULL);
 		return entry ? entry->local_relid : InvalidOid;
 	}
 	return InvalidOid;
 }
 
+/*
+ * Get schema and name of the relation sent in 'R' message, using cached values if possible
+ */
+PGLRelMetaEntry* pglogical_relmeta_get(Relation rel)
+{
+	PGLRelMetaEntry* entry;
+	char* nspname;
+
+    if (index_key_map == NULL) { 
+        pglogical_relid_map_init();
+    }
+	entry = (PGLRelMetaEntry*)pgl_oid_map_lookup(&relmeta_map, RelationGetRelid(rel), true, NULL);
+	if (entry->valid) { 
+		return entry;
+	}
+	nspname = get_namespace_name(rel->rd_rel->relnamespace);
+	if (nspname == NULL)
+		elog(ERROR, "cache lookup failed for namespace %u",
+				 rel->rd_rel->relnamespace);
+	strlcpy(entry->nspname, nspname, NAMEDATALEN);
+	strlcpy(entry->relname, NameStr(rel->rd_rel->relname), NAMEDATALEN);
+	entry->nspnamelen = strlen(entry->nspname) + 1;
+	entry->relnamelen = strlen(entry->relname) + 1;
+	entry->sentXid = InvalidTransactionId;
+	if (entry->attrcxt != NULL) { 
+		/* can't be done in the invalidation callback: a row may be being sent right now */
+		MemoryContextDelete(entry->attrcxt);
+		entry->attrcxt = NULL;
+		entry->attrs = NULL;
+	}
+	entry->valid = true;
+	pfree(nspname);
+	return entry;
+}
+
+/*
+ * Get scan key template for the index "idxrel" of relation "rel", building it if needed
+ */
+PGLIndexKeyMapEntry* pglogical_index_key_map_get(Relation rel, Relation idxrel)
+{
+	Oid indexoid = RelationGetRelid(idxrel);
+	PGLIndexKeyMapEntry* entry;
+	Datum		indclassDatum;
+	Datum		indkeyDatum;
+	bool		isnull;
+	bool		found;
+	oidvector  *opclass;
+	int2vector  *indkey;
+	int			attoff;
+
+    if (index_key_map == NULL) { 
+        pglogical_relid_map_init();
+    }
+	entry = (PGLIndexKeyMapEntry*)hash_search(index_key_map, &indexoid, HASH_ENTER, &found);
+	if (found && entry->valid) { 
+		return entry;
+	}
+	entry->valid = false;
+
+	indclassDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
+									Anum_pg_index_indclass, &isnull);
+	Assert(!isnull);
+	opclass = (oidvector *) DatumGetPointer(indclassDatum);
+
+	indkeyDatum = SysCacheGetAttr(INDEXRELID, idxrel->rd_indextuple,
+									Anum_pg_index_indkey, &isnull);
+	Assert(!isnull);
+	indkey = (int2vector *) DatumGetPointer(indkeyDatum);
+
+	entry->nkeys = RelationGetNumberOfAttributes(idxrel);
+	for (attoff = 0; attoff < entry->nkeys; attoff++)
+	{
+		Oid			operator;
+		Oid			opfamily;
+		int			mainattno = indkey->values[attoff];
+		Oid			atttype = attnumTypeId(rel, mainattno);
+		Oid			optype = get_opclass_input_type(opclass->values[attoff]);
+
+		opfamily = get_opclass_family(opclass->values[attoff]);
+
+		operator = get_opfamily_member(opfamily, optype,
+									   optype,
+									   BTEqualStrategyNumber);
+
+		if (!OidIsValid(operator))
+			elog(ERROR,
+				 "could not lookup equality operator for type %u, optype %u in opfamily %u",
+				 atttype, optype, opfamily);
+
+		entry->attnums[attoff] = mainattno;
+		fmgr_info_cxt(get_opcode(operator), &entry->eqfuncs[attoff], CacheMemoryContext);
+	}
+	entry->valid = true;
+	return entry;
+}
+
 bool pglogical_relid_map_put(Oid remote_relid, Oid local_relid)
 {
 	bool found;	
     PGLRelidMapEntry* entry;
-    if (relid_map == NULL) { 
+    if (index_key_map == NULL) { 
         pglogical_relid_map_init();
     }
-    entry = hash_search(relid_map, &remote_relid, HASH_ENTER, &found);
-  	if (found) {
+    entry = (PGLRelidMapEntry*)pgl_oid_map_lookup(&relid_map, remote_relid, true, &found);
+  	if (found && entry->local_relid != InvalidOid) {
 	    Assert(entry->local_relid == local_relid);
 		return false;	    
     }
     entry->local_relid = local_relid;
 	return true;
 }
+
+/*
+ * Remember remote names of the relation. Sender doesn't resend them for each change of the transaction,
+ * so we need them to resolve relation if mapping is invalidated in the middle of transaction.
+ */
+void pglogical_relid_map_set_name(Oid remote_relid, char const* nspname, char const* relname)
+{
+    PGLRelidMapEntry* entry;
+    if (index_key_map == NULL) { 
+        pglogical_relid_map_init();
+    }
+    entry = (PGLRelidMapEntry*)pgl_oid_map_lookup(&relid_map, remote_relid, true, NULL);
+	if (strcmp(entry->nspname, nspname) != 0 || strcmp(entry->relname, relname) != 0) { 
+		strlcpy(entry->nspname, nspname, NAMEDATALEN);
+		strlcpy(entry->relname, relname, NAMEDATALEN);
+	}
+}
+
+/*
+ * Construct range var from the remembered remote names of relation, returns NULL if them are not known
+ */
+RangeVar* pglogical_relid_map_get_name(Oid remote_relid)
+{
+	if (index_key_map != NULL) { 
+		PGLRelidMapEntry* entry = (PGLRelidMapEntry*)pgl_oid_map_lookup(&relid_map, remote_relid, false, NULL);
+		if (entry != NULL && *entry->relname != '\0') { 
+			return makeRangeVar(pstrdup(entry->nspname), pstrdup(entry->relname), -1);
+		}
+	}
+	return NULL;
+}
@@ -1,14 +1,74 @@
 #ifndef PGLOGICAL_RELID_MAP
 #define PGLOGICAL_RELID_MAP
 
-#define PGL_INIT_RELID_MAP_SIZE 256
+#define PGL_INIT_RELID_MAP_SIZE 256 /* should be power of two */
+
+/*
+ * Open addressing hash table with linear probing for entries identified by Oid.
+ * Key should be the first field of the entry, InvalidOid marks free slot.
+ * Entries are never removed (number of relations is limited), instead of it they are
+ * marked as invalid by relcache callback. Entries can be moved when table is extended,
+ * so pointers to them should not be kept.
+ */
+typedef struct PGLOidMap {
+	char*  entries;
+	Size   entrysize;
+	uint32 mask;      /* number of slots - 1 */
+	uint32 used;      /* number of occupied slots */
+} PGLOidMap;
 
 typedef struct PGLRelidMapEntry { 
 	Oid remote_relid;
-	Oid local_relid;
+	Oid local_relid; /* InvalidOid if mapping was invalidated */
+	char nspname[NAMEDATALEN]; /* remote names of relation, used to resolve it after invalidation */
+	char relname[NAMEDATALEN];
 } PGLRelidMapEntry; 
 
+/*
+ * How WAL sender sends an attribute: transfer type chosen by decide_datum_transfer
+ * ('\0' for dropped columns) and the send or output function for 's' and 't' types.
+ */
+typedef struct PGLAttrTransfer {
+	char     transfer_type;
+	FmgrInfo func;
+} PGLAttrTransfer;
+
+/*
+ * Relation metadata cached by WAL sender to avoid catalog lookups when sending each row.
+ * Attribute transfer info is built by the protocol code on first use and lives in attrcxt,
+ * which is dropped when the entry is revalidated.
+ */
+typedef struct PGLRelMetaEntry { 
+	Oid      relid;
+	bool     valid;
+	uint8    nspnamelen; /* including terminating zero */
+	uint8    relnamelen; /* including terminating zero */
+	TransactionId sentXid; /* transaction in which the names were already sent */
+	char     nspname[NAMEDATALEN];
+	char     relname[NAMEDATALEN];
+	MemoryContext attrcxt;  /* NULL if attribute transfer info is not built yet */
+	PGLAttrTransfer* attrs; /* one entry per attribute of the relation */
+	uint16   nliveatts;     /* number of not dropped attributes */
+	uint8    attrflags;     /* output options attrs were built for */
+} PGLRelMetaEntry; 
+
+/*
+ * Template of scan key for the index: heap attributes of index keys and equality operators for them.
+ * Templates are cached across transactions and invalidated by relcache callback.
+ */
+typedef struct PGLIndexKeyMapEntry {
+	Oid      indexoid;
+	bool     valid;
+	int      nkeys;
+	AttrNumber attnums[INDEX_MAX_KEYS];
+	FmgrInfo eqfuncs[INDEX_MAX_KEYS];
+} PGLIndexKeyMapEntry;
+
 extern Oid  pglogical_relid_map_get(Oid relid);
 extern bool pglogical_relid_map_put(Oid remote_relid, Oid local_relid);
+extern void pglogical_relid_map_set_name(Oid remote_relid, char const* nspname, char const* relname);
+extern RangeVar* pglogical_relid_map_get_name(Oid remote_relid);
+extern PGLIndexKeyMapEntry* pglogical_index_key_map_get(Relation rel, Relation idxrel);
+extern PGLRelMetaEntry* pglogical_relmeta_get(Relation rel);
 
 #endif
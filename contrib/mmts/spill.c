@@ -3,12 +3,24 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include "storage/fd.h"
+#include "common/pg_lzcompress.h"
+#include "utils/memutils.h"
 #include "spill.h"
 #include "pgstat.h"
 
-void MtmSpillToFile(int fd, char const* data, size_t size)
+bool MtmSpillCompression;
+
+/*
+ * Each chunk of spilled transaction is prepended with header. If chunk is compressed, then storedSize < rawSize.
+ */
+typedef struct
+{
+	uint32 rawSize;
+	uint32 storedSize;
+} MtmSpillChunkHeader;
+
+static void MtmWriteSpillData(int fd, char const* data, size_t size)
 {
-	Assert(fd >= 0);
 	while (size != 0) { 
 		int written = write(fd, data, size);
 		if (written <= 0) { 
@@ -22,6 +34,44 @@ void MtmSpillToFile(int fd, char const* data, size_t size)
 	}
 }
 
+static void MtmReadSpillData(int fd, char* data, size_t size)
+{
+	while (size != 0) { 
+		int rc = read(fd, data, size);
+		if (rc <= 0) { 
+			CloseTransientFile(fd);
+			ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("pglogical_apply failed to read spill file: %m")));
+		}
+		data += rc;
+		size -= rc;
+	}
+}
+
+void MtmSpillToFile(int fd, char const* data, size_t size)
+{
+	MtmSpillChunkHeader hdr;
+	char* compressed = NULL;
+
+	Assert(fd >= 0);
+	hdr.rawSize = hdr.storedSize = size;
+	if (MtmSpillCompression) {
+		int32 len;
+		compressed = MemoryContextAllocHuge(CurrentMemoryContext, PGLZ_MAX_OUTPUT(size));
+		len = pglz_compress(data, size, compressed, PGLZ_strategy_default);
+		if (len >= 0) { 
+			hdr.storedSize = len;
+			data = compressed;
+		}
+	}
+	MtmWriteSpillData(fd, (char*)&hdr, sizeof hdr);
+	MtmWriteSpillData(fd, data, hdr.storedSize);
+	if (compressed != NULL) { 
+		pfree(compressed);
+	}
+}
+
 void MtmCreateSpillDirectory(int node_id)
 {
 	char path[MAXPGPATH];
@@ -89,23 +139,45 @@ int MtmOpenSpillFile(int node_id, int file_id)
 						path)));
 	}
 	unlink(path); /* Should remove file on close */
+#ifdef USE_POSIX_FADVISE
+	(void) posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
 	return fd;
 }
 
 void MtmReadSpillFile(int fd, char* data, size_t size)
 {
+	MtmSpillChunkHeader hdr;
+
 	Assert(fd >= 0);
-	while (size != 0) { 
-		int rc = read(fd, data, size);
-		if (rc <= 0) { 
+	MtmReadSpillData(fd, (char*)&hdr, sizeof hdr);
+	if (hdr.rawSize != size || hdr.storedSize > hdr.rawSize) { 
+		CloseTransientFile(fd);
+		elog(ERROR, "pglogical_apply: corrupted chunk of spill file: size %u instead of %u", hdr.rawSize, (uint32)size);
+	}
+	if (hdr.storedSize < hdr.rawSize) { 
+		char* compressed = MemoryContextAllocHuge(CurrentMemoryContext, hdr.storedSize);
+		MtmReadSpillData(fd, compressed, hdr.storedSize);
+		if (pglz_decompress(compressed, hdr.storedSize, data, hdr.rawSize) != hdr.rawSize) { 
 			CloseTransientFile(fd);
-			ereport(ERROR,
-				(errcode_for_file_access(),
-				 errmsg("pglogical_apply failed to read spill file: %m")));
+			elog(ERROR, "pglogical_apply: failed to decompress chunk of spill file");
+		}
+		pfree(compressed);
+	} else { 
+		MtmReadSpillData(fd, data, size);
+	}
+#ifdef USE_POSIX_FADVISE
+	{
+		/* 
+		 * Chunks are produced using the same threshold, so initiate read-ahead of the next chunk 
+		 * assuming that it has the same size, while this one is applied
+		 */
+		off_t pos = lseek(fd, 0, SEEK_CUR);
+		if (pos >= 0) { 
+			(void) posix_fadvise(fd, pos, sizeof(hdr) + hdr.storedSize, POSIX_FADV_WILLNEED);
 		}
-		data += rc;
-		size -= rc;
 	}
+#endif
 }
 
 void MtmCloseSpillFile(int fd)
@@ -1,6 +1,8 @@
 #ifndef __SPILL_H__
 #define __SPILL_H__
 
+extern bool MtmSpillCompression;
+
 void MtmSpillToFile(int fd, char const* data, size_t size);
 void MtmCreateSpillDirectory(int node_id);
 int  MtmCreateSpillFile(int node_id, int* file_id);
@@ -0,0 +1,69 @@
+use strict;
+use warnings;
+use Cluster;
+use TestLib;
+use Test::More tests => 6;
+
+my $cluster = new Cluster(3);
+$cluster->init();
+$cluster->configure();
+foreach my $node (@{$cluster->{nodes}})
+{
+	$node->append_conf("postgresql.conf", qq(
+			multimaster.trace_sample_ratio = 1
+		));
+}
+$cluster->start();
+
+my $psql_out;
+my $node = $cluster->{nodes}->[0];
+
+# Wait until nodes are connected to each other and become online
+my $created = 0;
+for (my $i = 0; $i < 60 && !$created; $i++) {
+	sleep(1);
+	$created = $cluster->psql(0, 'postgres', "create extension multimaster;") == 0;
+}
+BAIL_OUT("failed to create multimaster extension") unless $created;
+foreach my $i (1..2) {
+	BAIL_OUT("node $i is not online") unless $cluster->poll(0, 'postgres', $i, 30, 1);
+}
+
+$node->safe_psql('postgres', "
+	create table log(k int primary key, v int);
+	create table t(k int primary key, v int);
+	insert into t values(1, 0);
+	select mtm.make_table_fast_commit('log');");
+
+# Number of transactions coordinated by node 0 which have passed precommit phase
+sub precommits
+{
+	return $node->safe_psql('postgres',
+		"select count(*) from mtm.get_trace() where event like '% send MSG_PRECOMMIT';");
+}
+
+my $n = precommits();
+$node->safe_psql('postgres', "insert into log values(1, 1);");
+is(precommits(), $n, "Insert into fast commit table skips precommit.");
+sleep(2);
+$cluster->psql(2, 'postgres', "select v from log where k = 1;", stdout => \$psql_out);
+is($psql_out, '1', "Insert into fast commit table is replicated.");
+
+$n = precommits();
+$node->safe_psql('postgres', "
+	begin;
+	insert into log values(2, 1);
+	update t set v = v + 1 where k = 1;
+	commit;");
+is(precommits(), $n + 1, "Transaction also updating other table passes precommit.");
+
+$n = precommits();
+$node->safe_psql('postgres', "
+	insert into log values(1, 2) on conflict (k) do update set v = excluded.v;");
+is(precommits(), $n + 1, "Upsert into fast commit table passes precommit.");
+
+sleep(2);
+$cluster->psql(1, 'postgres', "select string_agg(k || ':' || v, ',' order by k) from log;", stdout => \$psql_out);
+is($psql_out, '1:2,2:1', "Changes of fast commit table are replicated.");
+$cluster->psql(2, 'postgres', "select v from t where k = 1;", stdout => \$psql_out);
+is($psql_out, '1', "Mixed transaction is replicated.");
@@ -0,0 +1,117 @@
+use strict;
+use warnings;
+use Cluster;
+use TestLib;
+use Test::More tests => 9;
+
+my $cluster = new Cluster(3);
+$cluster->init();
+$cluster->configure();
+foreach my $node (@{$cluster->{nodes}})
+{
+	$node->append_conf("postgresql.conf", qq(
+			multimaster.trace_sample_ratio = 1
+		));
+}
+$cluster->start();
+
+my ($rc, $psql_out, $psql_err);
+
+# Wait until nodes are connected to each other and become online
+my $created = 0;
+for (my $i = 0; $i < 60 && !$created; $i++) {
+	sleep(1);
+	$created = $cluster->psql(0, 'postgres', "create extension multimaster;") == 0;
+}
+BAIL_OUT("failed to create multimaster extension") unless $created;
+foreach my $i (1..2) {
+	BAIL_OUT("node $i is not online") unless $cluster->poll(0, 'postgres', $i, 30, 1);
+}
+
+###############################################################################
+# Rows of home table are owned by nodes with ID stored in home column
+###############################################################################
+
+$cluster->{nodes}->[0]->safe_psql('postgres', "
+	create table acc(k int primary key, home int, v int);
+	create trigger acc_home after insert or update or delete on acc
+		for each row execute procedure mtm.home_check('home');
+	insert into acc values(1, 1, 0);");
+$cluster->{nodes}->[1]->safe_psql('postgres', "insert into acc values(2, 2, 0);");
+
+# Home-local transactions are replicated asynchronously: wait until all nodes
+# have the given contents of home table
+sub wait_for_contents
+{
+	my $expected = shift;
+	foreach my $node (@{$cluster->{nodes}})
+	{
+		my $contents;
+		for (my $i = 0; $i < 30; $i++) {
+			$contents = $node->safe_psql('postgres',
+				"select string_agg(k || ':' || home || ':' || v, ',' order by k) from acc;");
+			last if $contents eq $expected;
+			sleep(1);
+		}
+		return 0 if $contents ne $expected;
+	}
+	return 1;
+}
+
+BAIL_OUT("rows are not replicated") unless wait_for_contents('1:1:0,2:2:0');
+
+# Number of home-local transactions coordinated by the node
+sub home_local
+{
+	my $i = shift;
+	return $cluster->{nodes}->[$i]->safe_psql('postgres',
+		"select count(distinct gid) from mtm.get_trace() where gid like '%-H';");
+}
+
+my $n = home_local(0);
+$rc = $cluster->psql(0, 'postgres', "update acc set v = v + 1 where k = 1;");
+is($rc, 0, "Home node changes its row.");
+cmp_ok(home_local(0), '>', $n, "Transaction changing only home rows is home-local.");
+BAIL_OUT("update is not replicated") unless wait_for_contents('1:1:1,2:2:0');
+
+###############################################################################
+# Writes of rows owned by other nodes are rejected
+###############################################################################
+
+$rc = $cluster->psql(1, 'postgres', "update acc set v = v + 10 where k = 1;",
+	stdout => \$psql_out, stderr => \$psql_err);
+like($psql_err, qr/not owned by node 2/, "Other node can not update row.");
+
+$rc = $cluster->psql(2, 'postgres', "delete from acc where k = 2;",
+	stdout => \$psql_out, stderr => \$psql_err);
+like($psql_err, qr/not owned by node 3/, "Other node can not delete row.");
+
+$rc = $cluster->psql(2, 'postgres', "insert into acc values(3, 1, 0);",
+	stdout => \$psql_out, stderr => \$psql_err);
+like($psql_err, qr/not owned by node 3/, "Node can not insert row owned by other node.");
+
+$rc = $cluster->psql(0, 'postgres', "update acc set home = 2 where k = 1;",
+	stdout => \$psql_out, stderr => \$psql_err);
+like($psql_err, qr/not owned by node 1/, "Owner of the row can not be changed.");
+
+###############################################################################
+# Cross-home transactions conflicting with home-local ones
+###############################################################################
+
+$rc = $cluster->psql(1, 'postgres', "
+	begin;
+	update acc set v = v + 1 where k = 2;
+	update acc set v = v + 100 where k = 1;
+	commit;",
+	stdout => \$psql_out, stderr => \$psql_err);
+like($psql_err, qr/not owned by node 2/, "Cross-home transaction is rejected.");
+
+$rc = $cluster->psql(0, 'postgres', "update acc set v = v + 1 where k = 1;");
+$rc += $cluster->psql(1, 'postgres', "update acc set v = v + 1 where k = 2;");
+is($rc, 0, "Home-local transactions are committed after rejected cross-home one.");
+
+###############################################################################
+# All nodes have the same contents
+###############################################################################
+
+ok(wait_for_contents('1:1:2,2:2:1'), "Nodes have the same contents of home table.");
@@ -1,4 +1,5 @@
 #include <time.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -6,6 +7,7 @@
 #include <sys/time.h>
 #include <pthread.h>
 
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -37,6 +39,105 @@ class my_unique_ptr
 typedef void* (*thread_proc_t)(void*);
 typedef uint32_t xid_t;
 
+/*
+ * Log-linear latency histogram in the spirit of HdrHistogram: values below
+ * SUB_BUCKETS usec are recorded exactly, larger ones with a relative error
+ * of at most 2/SUB_BUCKETS.
+ */
+struct histogram
+{
+    enum {
+        SUB_BUCKET_BITS = 7,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        HALF_BUCKETS = SUB_BUCKETS / 2,
+        MAX_VALUE_BITS = 40,
+        N_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * HALF_BUCKETS
+    };
+    size_t counts[N_BUCKETS];
+    size_t count;
+    time_t sum;
+    time_t maxValue;
+
+    void reset() {
+        memset(counts, 0, sizeof counts);
+        count = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    static int bucket(time_t value) {
+        int shift = 0;
+        while ((value >> shift) >= SUB_BUCKETS) {
+            shift += 1;
+        }
+        int i = shift == 0 ? (int)value : shift*HALF_BUCKETS + (int)(value >> shift);
+        return i < N_BUCKETS ? i : N_BUCKETS - 1;
+    }
+
+    static time_t upperBound(int i) {
+        if (i < SUB_BUCKETS) {
+            return i;
+        }
+        int shift = i/HALF_BUCKETS - 1;
+        return ((time_t)(i - shift*HALF_BUCKETS + 1) << shift) - 1;
+    }
+
+    void add(time_t value) {
+        if (value < 0) {
+            value = 0;
+        }
+        counts[bucket(value)] += 1;
+        count += 1;
+        sum += value;
+        if (value > maxValue) {
+            maxValue = value;
+        }
+    }
+
+    void merge(histogram const& other) {
+        for (int i = 0; i < N_BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        if (other.maxValue > maxValue) {
+            maxValue = other.maxValue;
+        }
+    }
+
+    time_t percentile(double p) const {
+        size_t rank = (size_t)ceil(p*count/100);
+        size_t seen = 0;
+        if (rank == 0) {
+            rank = 1;
+        }
+        for (int i = 0; i < N_BUCKETS && count != 0; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return upperBound(i) < maxValue ? upperBound(i) : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+    void print(char const* name) const {
+        printf("\"%s\":{\"count\":%ld, \"mean\":%ld, \"p50\":%ld, \"p99\":%ld, \"p999\":%ld, \"max\":%ld}",
+               name, count, count != 0 ? sum/count : 0,
+               percentile(50), percentile(99), percentile(99.9), maxValue);
+    }
+};
+
+/* transaction types we keep latency histograms for */
+enum txn_type
+{
+    TXN_TRANSFER,   /* writer moving money between two accounts */
+    TXN_BALANCE,    /* writer reading two accounts */
+    TXN_TOTAL,      /* reader summing all accounts */
+    N_TXN_TYPES
+};
+
+static char const* const txnTypeNames[N_TXN_TYPES] = { "transfer", "balance", "total" };
+
 struct thread
 {
     pthread_t t;
@@ -44,6 +145,7 @@ struct thread
     size_t updates;
     size_t selects;
     size_t aborts;
+    histogram latency[N_TXN_TYPES];
     int id;
 
     void start(int tid, thread_proc_t proc) { 
@@ -52,6 +154,9 @@ struct thread
         selects = 0;
         aborts = 0;
         transactions = 0;
+        for (int i = 0; i < N_TXN_TYPES; i++) {
+            latency[i].reset();
+        }
         pthread_create(&t, NULL, proc, this);
     }
 
@@ -67,6 +172,7 @@ struct config
     int nIterations;
     int nAccounts;
     int updatePercent;
+    int rate;
     vector<string> connections;
 	bool scatter;
 
@@ -76,12 +182,14 @@ struct config
         nIterations = 1000;
         nAccounts = 100000;
         updatePercent = 100;
+        rate = 0;
 		scatter = false;
     }
 };
 
 config cfg;
 bool running;
+time_t benchStart;
 
 #define USEC 1000000
 
@@ -92,6 +200,17 @@ static time_t getCurrentTime()
     return (time_t)tv.tv_sec*USEC + tv.tv_usec;
 }
 
+static void waitUntil(time_t when)
+{
+    time_t now = getCurrentTime();
+    if (when > now) {
+        struct timespec ts;
+        ts.tv_sec = (when - now) / USEC;
+        ts.tv_nsec = (when - now) % USEC * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
 
 void exec(transaction_base& txn, char const* sql, ...)
 {
@@ -125,6 +244,7 @@ void* reader(void* arg)
     int64_t prevSum = 0;
 
     while (running) {
+        time_t start = getCurrentTime();
         work txn(*conns[random() % conns.size()]);
         result r = txn.exec("select sum(v) from t");
         int64_t sum = r[0][0].as(int64_t());
@@ -136,6 +256,7 @@ void* reader(void* arg)
         t.transactions += 1;
         t.selects += 1;
         txn.commit();
+        t.latency[TXN_TOTAL].add(getCurrentTime() - start);
     }
     return NULL;
 }
@@ -147,8 +268,23 @@ void* writer(void* arg)
     for (size_t i = 0; i < conns.size(); i++) {
         conns[i] = new connection(cfg.connections[i]);
     }
+    /*
+     * In open-loop mode every writer issues transactions on a fixed schedule
+     * and latency is measured from the scheduled start, so that a stalled
+     * commit is charged for the transactions queued up behind it instead of
+     * silently lowering the arrival rate.
+     */
+    time_t interval = cfg.rate != 0 ? (time_t)cfg.nWriters*USEC/cfg.rate : 0;
+
     for (int i = 0; i < cfg.nIterations; i++)
     { 
+        time_t start;
+        if (interval != 0) {
+            start = benchStart + (time_t)i*interval;
+            waitUntil(start);
+        } else {
+            start = getCurrentTime();
+        }
         //work 
         //transaction<repeatable_read> txn(*conns[random() % conns.size()]);
         transaction<read_committed> txn(*conns[random() % conns.size()]);
@@ -162,16 +298,19 @@ void* writer(void* arg)
             if (random() % 100 < cfg.updatePercent) { 
                 exec(txn, "update t set v = v - 1 where u=%d", srcAcc);
                 exec(txn, "update t set v = v + 1 where u=%d", dstAcc);
+                txn.commit();
                 t.updates += 2;
+                t.latency[TXN_TRANSFER].add(getCurrentTime() - start);
             } else { 
                 int64_t sum = execQuery<int64_t>(txn, "select v from t where u=%d", srcAcc)
                     + execQuery<int64_t>(txn, "select v from t where u=%d", dstAcc);
                 if (sum > cfg.nIterations*cfg.nWriters || sum < -cfg.nIterations*cfg.nWriters) { 
                     printf("Wrong sum=%ld\n", sum);
                 }
+                txn.commit();
                 t.selects += 2;
+                t.latency[TXN_BALANCE].add(getCurrentTime() - start);
             }
-            txn.commit();            
             t.transactions += 1;
         } catch (pqxx_exception const& x) { 
             txn.abort();
@@ -231,6 +370,9 @@ int main (int argc, char* argv[])
             case 'p':
                 cfg.updatePercent = atoi(argv[++i]);
                 continue;
+            case 'R':
+                cfg.rate = atoi(argv[++i]);
+                continue;
             case 's':
   			    cfg.scatter = true;
                 continue;
@@ -248,6 +390,7 @@ int main (int argc, char* argv[])
                "\t-a N\tnumber of accounts (100000)\n"
                "\t-n N\tnumber of iterations (1000)\n"
                "\t-p N\tupdate percent (100)\n"
+               "\t-R N\topen-loop mode: writer transactions per second (0 = closed loop)\n"
                "\t-c STR\tdatabase connection string\n"
                "\t-i\tinitialize database\n");
         return 1;
@@ -260,6 +403,7 @@ int main (int argc, char* argv[])
     }
 
     time_t start = getCurrentTime();
+    benchStart = start;
     running = true;
 
     vector<thread> readers(cfg.nReaders);
@@ -268,6 +412,11 @@ int main (int argc, char* argv[])
     size_t nUpdates = 0;
     size_t nSelects = 0;
     size_t nTransactions = 0;
+    histogram* latency = new histogram[N_TXN_TYPES];
+
+    for (int i = 0; i < N_TXN_TYPES; i++) {
+        latency[i].reset();
+    }
 
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].start(i, reader);
@@ -282,6 +431,9 @@ int main (int argc, char* argv[])
         nSelects += writers[i].selects;
         nAborts += writers[i].aborts;
         nTransactions += writers[i].transactions;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(writers[i].latency[j]);
+        }
     }
     
     running = false;
@@ -289,7 +441,10 @@ int main (int argc, char* argv[])
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].wait();
         nSelects += readers[i].selects;
-        nTransactions += writers[i].transactions;
+        nTransactions += readers[i].transactions;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(readers[i].latency[j]);
+        }
     }
  
     time_t elapsed = getCurrentTime() - start;
@@ -297,7 +452,8 @@ int main (int argc, char* argv[])
     printf(
         "{\"tps\":%f, \"transactions\":%ld,"
         " \"selects\":%ld, \"updates\":%ld, \"aborts\":%ld, \"abort_percent\": %d,"
-        " \"readers\":%d, \"writers\":%d, \"update_percent\":%d, \"accounts\":%d, \"iterations\":%d, \"hosts\":%ld}\n",
+        " \"readers\":%d, \"writers\":%d, \"update_percent\":%d, \"rate\":%d, \"accounts\":%d, \"iterations\":%d, \"hosts\":%ld,"
+        " \"latency\":{",
         (double)(nTransactions*USEC)/elapsed,
         nTransactions,
         nSelects, 
@@ -307,10 +463,19 @@ int main (int argc, char* argv[])
         cfg.nReaders,
         cfg.nWriters,
         cfg.updatePercent,
+        cfg.rate,
         cfg.nAccounts,
         cfg.nIterations,
         cfg.connections.size()
         );
+    for (int i = 0; i < N_TXN_TYPES; i++) {
+        if (i != 0) {
+            printf(", ");
+        }
+        latency[i].print(txnTypeNames[i]);
+    }
+    printf("}}\n");
+    delete[] latency;
 
     return 0;
 }
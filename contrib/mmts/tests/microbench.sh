@@ -0,0 +1,34 @@
+#!/bin/sh
+# Run micro-benchmarks of multimaster hot paths (see mtm.microbench) in 1, 2, 4 and 8 concurrent backends.
+# Usage: microbench.sh [connection string] [iterations]
+
+CONNINFO=${1:-"dbname=regression host=localhost port=5432 sslmode=disable"}
+ITERATIONS=${2:-100000}
+
+run()
+{
+	component=$1
+	size=$2
+	for clients in 1 2 4 8
+	do
+		rm -f microbench.$$.*
+		i=0
+		while [ $i -lt $clients ]
+		do
+			psql "$CONNINFO" -A -t -c "select mtm.microbench('$component', $ITERATIONS, $size)" > microbench.$$.$i &
+			i=`expr $i + 1`
+		done
+		wait
+		cat microbench.$$.* | awk -v c=$component -v s=$size -v n=$clients \
+			'{ sum += $1; if ($1 > max) max = $1 } END { printf "%-8s size=%-5d clients=%d: avg %.1f ns/op, max %.1f ns/op\n", c, s, n, sum/NR, max }'
+	done
+	rm -f microbench.$$.*
+}
+
+run clique 8
+run clique 64
+run deadlock 16
+run deadlock 1024
+run snapshot 1024
+run bgwpool 64
+run bgwpool 1024
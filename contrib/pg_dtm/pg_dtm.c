@@ -19,6 +19,8 @@
 #include "storage/lmgr.h"
 #include "storage/shmem.h"
 #include "storage/ipc.h"
+#include "storage/barrier.h"
+#include "port/atomics.h"
 #include "access/xlogdefs.h"
 #include "access/xact.h"
 #include "access/xtm.h"
@@ -45,6 +47,25 @@
 #include "sockhub.h"
 #include "arbiter.h"
 
+#define DTM_RESOLVED_CACHE_SIZE (64*1024) /* should be power of two */
+
+/*
+ * An entry of the resolvedXids cache packs the XID, its epoch and its status
+ * into one 64-bit word, so that it is written and read atomically.  With the
+ * epoch in the key, an XID reused after wraparound never matches the entry
+ * of its previous incarnation.  A zero word is an empty entry.
+ */
+#define DTM_RESOLVED_EPOCH_BITS  30
+#define DTM_RESOLVED_EPOCH_MASK  ((1U << DTM_RESOLVED_EPOCH_BITS) - 1)
+#define DTM_RESOLVED_STATUS_SHIFT (32 + DTM_RESOLVED_EPOCH_BITS)
+
+#define DTM_RESOLVED_NONE      0 /* empty entry */
+#define DTM_RESOLVED_COMPLETED 1 /* completed per global snapshot, no local state */
+
+#define DtmResolvedEntry(epoch, xid, status) \
+	(((uint64) (status) << DTM_RESOLVED_STATUS_SHIFT) | \
+	 ((uint64) ((epoch) & DTM_RESOLVED_EPOCH_MASK) << 32) | (uint64) (xid))
+
 typedef struct
 {
 	LWLockId hashLock;
@@ -52,6 +73,8 @@ typedef struct
 	TransactionId minXid;  /* XID of oldest transaction visible by any active transaction (local or global) */
 	TransactionId nextXid; /* next XID for local transaction */
 	size_t nReservedXids;  /* number of XIDs reserved for local transactions */
+	pg_atomic_uint32 resolvedEpoch; /* XID epoch the resolvedXids entries were made in */
+	pg_atomic_uint64 resolvedXids[DTM_RESOLVED_CACHE_SIZE]; /* direct mapped cache of XIDs completed according to global snapshot but having no local state */
 } DtmState;
 
 typedef struct
@@ -65,6 +88,39 @@ typedef struct
 #define DTM_SHMEM_SIZE (1024*1024)
 #define DTM_HASH_SIZE  1003
 
+#define DTM_RING_REPLY_SIZE (1024*sizeof(TransactionId)) /* the largest reply accepted by arbiter API */
+#define DTM_RING_READ_BUFFER_SIZE (64*1024)
+
+/*
+ * Reply slot of the backend sending requests through the ring
+ */
+typedef struct
+{
+	Latch* latch;          /* latch of the backend waiting for the reply */
+	bool pending;          /* request is sent but reply is not received yet */
+	volatile bool ready;   /* reply is received */
+	int size;              /* size of the reply body, -1 if connection to arbiter was lost */
+	char data[DTM_RING_REPLY_SIZE];
+} DtmRingSlot;
+
+/*
+ * Shared memory ring through which backends pass requests to the worker
+ * owning connection to arbiter. Messages are copied to the ring as is, with
+ * channel set to the backend ID, so arbiter sees the same protocol as with
+ * sockhub. Replies are copied by the worker to the slot of the backend.
+ */
+typedef struct
+{
+	slock_t lock;
+	Latch* worker;         /* latch of the worker */
+	bool connected;        /* worker is connected to arbiter */
+	uint64 head;           /* position of the next request, advanced by backends */
+	uint64 tail;           /* position of the first unsent request, advanced by the worker */
+	char* buffer;          /* DtmRingSize bytes of requests */
+	int nSlots;
+	DtmRingSlot slots[FLEXIBLE_ARRAY_MEMBER]; /* indexed by backend ID - 1 */
+} DtmRing;
+
 void _PG_init(void);
 void _PG_fini(void);
 
@@ -86,10 +142,16 @@ static void DtmSerializeLock(PROCLOCK* lock, void* arg);
 static char const* DtmGetName(void);
 
 static bool TransactionIdIsInSnapshot(TransactionId xid, Snapshot snapshot);
-static bool TransactionIdIsInDoubt(TransactionId xid);
+static bool TransactionIdIsInDoubt(TransactionId xid, uint32 epoch);
+static uint32 DtmXidEpoch(TransactionId xid, TransactionId nextXid, uint32 nextEpoch);
+static void DtmResetResolvedXids(uint32 epoch);
 
 static void DtmShmemStartup(void);
 static void DtmBackgroundWorker(Datum arg);
+static void DtmRingBackgroundWorker(Datum arg);
+static Size DtmRingShmemSize(int nSlots);
+static bool DtmRingSend(void* msg, int size);
+static int  DtmRingRecv(void* body, int maxsize);
 
 static void ByteBufferAlloc(ByteBuffer* buf);
 static void ByteBufferAppend(ByteBuffer* buf, void* data, int len);
@@ -100,6 +162,7 @@ static void ByteBufferFree(ByteBuffer* buf);
 static shmem_startup_hook_type prev_shmem_startup_hook;
 static HTAB* xid_in_doubt;
 static DtmState* dtm;
+static DtmRing* dtmRing;
 static Snapshot CurrentTransactionSnapshot;
 
 static TransactionId DtmNextXid;
@@ -123,12 +186,16 @@ static TransactionManager DtmTM = {
 	PgGetTransactionStateSize,
 	PgSerializeTransactionState,
 	PgDeserializeTransactionState,
-	PgInitializeSequence
+	PgInitializeSequence,
+	PgIsDeadForAllSnapshots
 };
 
 static char *Arbiters;
 static char *ArbitersCopy;
 static int DtmBufferSize;
+static int DtmRingSize;
+static bool DtmRingExitRegistered;
+static volatile sig_atomic_t DtmRingTerminate;
 
 static BackgroundWorker DtmWorker = {
 	"DtmWorker",
@@ -138,6 +205,14 @@ static BackgroundWorker DtmWorker = {
 	DtmBackgroundWorker
 };
 
+static BackgroundWorker DtmRingWorker = {
+	"DtmRingWorker",
+	BGWORKER_SHMEM_ACCESS,
+	BgWorkerStart_PostmasterStart,
+	1,
+	DtmRingBackgroundWorker
+};
+
 #define XTM_TRACE(fmt, ...)
 //#define XTM_INFO(fmt, ...) fprintf(stderr, fmt, ## __VA_ARGS__)
 #define XTM_INFO(fmt, ...)
@@ -191,13 +266,23 @@ static bool TransactionIdIsInSnapshot(TransactionId xid, Snapshot snapshot)
  * We use xid_in_doubt hash table to mark transactions which are "precommitted". Entry is inserted in hash table
  * before seding status to DTMD and removed after receving response from DTMD and setting transaction status in local CLOG.
  * So information about transaction should always present either in xid_in_doubt either in CLOG.
+ *
+ * Transaction completed according to the global snapshot and having no local state will never become in-doubt,
+ * so such XIDs are remembered in resolvedXids cache to avoid lock and CLOG access for them at next snapshots.
+ * Cache is accessed without locks: entries, keyed by XID and epoch, are written and read atomically.
  */
-static bool TransactionIdIsInDoubt(TransactionId xid)
+static bool TransactionIdIsInDoubt(TransactionId xid, uint32 epoch)
 {
 	bool inDoubt;
 
 	if (!TransactionIdIsInSnapshot(xid, &DtmSnapshot))
 	{ /* transaction is completed according to the snaphot */
+		pg_atomic_uint64* resolved = &dtm->resolvedXids[xid & (DTM_RESOLVED_CACHE_SIZE-1)];
+		uint64 entry = DtmResolvedEntry(epoch, xid, DTM_RESOLVED_COMPLETED);
+		if (pg_atomic_read_u64(resolved) == entry)
+		{
+			return false;
+		}
 		LWLockAcquire(dtm->hashLock, LW_SHARED);
 		inDoubt = hash_search(xid_in_doubt, &xid, HASH_FIND, NULL) != NULL;
 		LWLockRelease(dtm->hashLock);
@@ -212,10 +297,39 @@ static bool TransactionIdIsInDoubt(TransactionId xid)
 			XactLockTableWait(xid, NULL, NULL, XLTW_None);
 			return true;
 		}
+		pg_atomic_write_u64(resolved, entry);
 	}
 	return false;
 }
 
+/*
+ * Epoch of an XID close to nextXid, on either side of it: XIDs of the global snapshot may be ahead
+ * of the local nextXid, and those of the local snapshot may be from before the last wraparound.
+ */
+static uint32 DtmXidEpoch(TransactionId xid, TransactionId nextXid, uint32 nextEpoch)
+{
+	uint64 next = ((uint64) nextEpoch << 32) | nextXid;
+
+	return (uint32) ((next + (int32) (xid - nextXid)) >> 32);
+}
+
+/*
+ * Forget all resolved XIDs once the XID counter has wrapped around.  Keys carry the epoch so stale
+ * entries could not match anyway, but this keeps them from occupying the cache.  Whoever first sees
+ * the new epoch clears the cache; concurrent writers of old entries are harmless.
+ */
+static void DtmResetResolvedXids(uint32 epoch)
+{
+	uint32 oldEpoch = pg_atomic_read_u32(&dtm->resolvedEpoch);
+
+	if (oldEpoch != epoch && pg_atomic_compare_exchange_u32(&dtm->resolvedEpoch, &oldEpoch, epoch))
+	{
+		int i;
+		for (i = 0; i < DTM_RESOLVED_CACHE_SIZE; i++)
+			pg_atomic_write_u64(&dtm->resolvedXids[i], 0);
+	}
+}
+
 /* Merge local and global snapshots.
  * Produce most restricted (conservative) snapshot which treate transaction as in-progress if is is marked as in-progress
  * either in local, either in global snapshots
@@ -224,6 +338,8 @@ static void DtmMergeWithGlobalSnapshot(Snapshot dst)
 {
 	int i, j, n;
 	TransactionId xid;
+	TransactionId nextXid;
+	uint32 nextEpoch;
 	Snapshot src = &DtmSnapshot;
 
 	Assert(TransactionIdIsValid(src->xmin) && TransactionIdIsValid(src->xmax));
@@ -239,11 +355,14 @@ GetLocalSnapshot:
 		return;
 	}
 
+	GetNextXidAndEpoch(&nextXid, &nextEpoch);
+	DtmResetResolvedXids(nextEpoch);
+
 	for (i = 0; i < dst->xcnt; i++)
-		if (TransactionIdIsInDoubt(dst->xip[i]))
+		if (TransactionIdIsInDoubt(dst->xip[i], DtmXidEpoch(dst->xip[i], nextXid, nextEpoch)))
 			goto GetLocalSnapshot;
 	for (xid = dst->xmax; xid < src->xmax; xid++)
-		if (TransactionIdIsInDoubt(xid))
+		if (TransactionIdIsInDoubt(xid, DtmXidEpoch(xid, nextXid, nextEpoch)))
 			goto GetLocalSnapshot;
 	DumpSnapshot(dst, "local");
 	DumpSnapshot(src, "DTM");
@@ -726,6 +845,7 @@ static int dtm_xid_match_fn(const void *key1, const void *key2, Size keysize)
 static void DtmInitialize()
 {
 	bool found;
+	int i;
 	static HASHCTL info;
 
 	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
@@ -736,6 +856,9 @@ static void DtmInitialize()
 		dtm->xidLock = LWLockAssign();
 		dtm->nReservedXids = 0;
 		dtm->minXid = InvalidTransactionId;
+		pg_atomic_init_u32(&dtm->resolvedEpoch, 0);
+		for (i = 0; i < DTM_RESOLVED_CACHE_SIZE; i++)
+			pg_atomic_init_u64(&dtm->resolvedXids[i], 0);
 		RegisterXactCallback(DtmXactCallback, NULL);
 		RegisterSubXactCallback(DtmSubXactCallback, NULL);
 	}
@@ -752,6 +875,19 @@ static void DtmInitialize()
 		HASH_ELEM | HASH_FUNCTION | HASH_COMPARE
 	);
 
+	if (DtmRingSize != 0)
+	{
+		LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+		dtmRing = ShmemInitStruct("dtm_ring", DtmRingShmemSize(MaxBackends), &found);
+		if (!found)
+		{
+			memset(dtmRing, 0, DtmRingShmemSize(MaxBackends));
+			SpinLockInit(&dtmRing->lock);
+			dtmRing->nSlots = MaxBackends;
+			dtmRing->buffer = (char*)&dtmRing->slots[MaxBackends];
+		}
+		LWLockRelease(AddinShmemInitLock);
+	}
 
 	TM = &DtmTM;
 }
@@ -831,7 +967,6 @@ _PG_init(void)
 	 * the postmaster process.)  We'll allocate or attach to the shared
 	 * resources in imcs_shmem_startup().
 	 */
-	RequestAddinShmemSpace(DTM_SHMEM_SIZE);
 	RequestAddinLWLocks(2);
 
 	DefineCustomIntVariable(
@@ -864,6 +999,21 @@ _PG_init(void)
 		NULL
 	);
 
+	DefineCustomIntVariable(
+		"dtm.ring_size",
+		"Size of shared memory ring through which backends pass requests to the worker connected to arbiter, if 0, then sockhub or direct connection will be used",
+		NULL,
+		&DtmRingSize,
+		0,
+		0,
+		INT_MAX,
+		PGC_POSTMASTER,
+		0,
+		NULL,
+		NULL,
+		NULL
+	);
+
 	DefineCustomStringVariable(
 		"dtm.arbiters",
 		"The comma separated host:port pairs where arbiters reside",
@@ -877,8 +1027,23 @@ _PG_init(void)
 		NULL // GucShowHook show_hook
 	);
 
+	/*
+	 * MaxBackends is not computed yet, so use the same expression as
+	 * InitializeMaxBackends to size the reply slots.
+	 */
+	RequestAddinShmemSpace(DTM_SHMEM_SIZE
+						   + (DtmRingSize != 0
+							  ? DtmRingShmemSize(MaxConnections + autovacuum_max_workers + 1 + max_worker_processes)
+							  : 0));
+
 	ArbitersCopy = strdup(Arbiters);
-	if (DtmBufferSize != 0)
+	if (DtmRingSize != 0)
+	{
+		ArbiterConfig(Arbiters, NULL);
+		ArbiterSetTransport(DtmRingSend, DtmRingRecv);
+		RegisterBackgroundWorker(&DtmRingWorker);
+	}
+	else if (DtmBufferSize != 0)
 	{
 		ArbiterConfig(Arbiters, Unix_socket_directories);
 		RegisterBackgroundWorker(&DtmWorker);
@@ -990,11 +1155,315 @@ void DtmBackgroundWorker(Datum arg)
 	ShubParamsSetHosts(&params, ArbitersCopy);
 	params.file = unix_sock_path;
 	params.buffer_size = DtmBufferSize;
+	params.combine = 1;	/* merge votes of backends for the same transaction */
 
 	ShubInitialize(&shub, &params);
 	ShubLoop(&shub);
 }
 
+/*
+ *  Shared memory ring
+ *  ***************************************************************************
+ */
+
+static Size DtmRingShmemSize(int nSlots)
+{
+	return add_size(add_size(offsetof(DtmRing, slots), mul_size(nSlots, sizeof(DtmRingSlot))), DtmRingSize);
+}
+
+/*
+ * Copy the message to the ring, wait for free space if the ring is full.
+ * Returns false if the worker is not connected to arbiter.
+ */
+static bool DtmRingPut(void* msg, int size, bool reply)
+{
+	DtmRing* ring = dtmRing;
+	Latch* worker;
+	int offs, n;
+
+	for (;;)
+	{
+		SpinLockAcquire(&ring->lock);
+		if (!ring->connected)
+		{
+			SpinLockRelease(&ring->lock);
+			return false;
+		}
+		if (ring->head + size - ring->tail <= DtmRingSize)
+			break;
+		worker = ring->worker;
+		SpinLockRelease(&ring->lock);
+		SetLatch(worker);
+		if (WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 1) & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+		ResetLatch(MyLatch);
+	}
+	offs = ring->head % DtmRingSize;
+	n = Min(size, DtmRingSize - offs);
+	memcpy(ring->buffer + offs, msg, n);
+	memcpy(ring->buffer, (char*)msg + n, size - n);
+	ring->head += size;
+	if (reply)
+	{
+		DtmRingSlot* slot = &ring->slots[MyBackendId-1];
+		slot->latch = MyLatch;
+		slot->ready = false;
+		slot->pending = true;
+	}
+	worker = ring->worker;
+	SpinLockRelease(&ring->lock);
+	SetLatch(worker);
+	return true;
+}
+
+/*
+ * Tell arbiter that this backend will not send requests any more,
+ * so it aborts the transaction this backend participates in
+ */
+static void DtmRingDetach(int code, Datum arg)
+{
+	ShubMessageHdr hdr;
+	hdr.size = 0;
+	hdr.code = MSG_DISCONNECT;
+	hdr.chan = MyBackendId;
+	DtmRingPut(&hdr, sizeof hdr, false);
+}
+
+static bool DtmRingSend(void* msg, int size)
+{
+	if (MyBackendId == InvalidBackendId || MyBackendId > dtmRing->nSlots || size > DtmRingSize)
+		return false;
+
+	((ShubMessageHdr*)msg)->chan = MyBackendId;
+	if (!DtmRingExitRegistered)
+	{
+		before_shmem_exit(DtmRingDetach, 0);
+		DtmRingExitRegistered = true;
+	}
+	return DtmRingPut(msg, size, true);
+}
+
+static int DtmRingRecv(void* body, int maxsize)
+{
+	DtmRingSlot* slot = &dtmRing->slots[MyBackendId-1];
+	int size;
+
+	for (;;)
+	{
+		ResetLatch(MyLatch);
+		if (slot->ready)
+			break;
+		if (WaitLatch(MyLatch, WL_LATCH_SET | WL_POSTMASTER_DEATH, 0) & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+	pg_read_barrier();
+	size = slot->size;
+	if (size > maxsize)
+		size = -1;
+	else if (size > 0)
+		memcpy(body, slot->data, size);
+	slot->ready = false;
+	return size;
+}
+
+/*
+ * Pass the reply received from arbiter to the backend. NULL data means that
+ * reply can not be delivered.
+ */
+static void DtmRingReply(int chan, void* data, int size)
+{
+	DtmRingSlot* slot;
+
+	if (chan < 1 || chan > dtmRing->nSlots)
+	{
+		elog(WARNING, "Arbiter replied to unknown channel %d", chan);
+		return;
+	}
+	slot = &dtmRing->slots[chan-1];
+	if (!slot->pending)
+		return; /* backend has exited, so nobody waits for the reply */
+
+	if (data != NULL)
+		memcpy(slot->data, data, size);
+	slot->size = data != NULL ? size : -1;
+	slot->pending = false;
+	pg_write_barrier();
+	slot->ready = true;
+	SetLatch(slot->latch);
+}
+
+/*
+ * Drop the unsent requests and fail all the requests waiting for reply
+ */
+static void DtmRingDisconnect(void)
+{
+	DtmRing* ring = dtmRing;
+	int i;
+
+	SpinLockAcquire(&ring->lock);
+	ring->connected = false;
+	ring->tail = ring->head;
+	for (i = 0; i < ring->nSlots; i++)
+	{
+		DtmRingSlot* slot = &ring->slots[i];
+		if (slot->pending)
+		{
+			slot->size = -1;
+			slot->pending = false;
+			pg_write_barrier();
+			slot->ready = true;
+			SetLatch(slot->latch);
+		}
+	}
+	SpinLockRelease(&ring->lock);
+}
+
+/*
+ * Send all the requests placed in the ring to arbiter
+ */
+static bool DtmRingFlush(int sd)
+{
+	DtmRing* ring = dtmRing;
+	uint64 head, tail;
+
+	SpinLockAcquire(&ring->lock);
+	head = ring->head;
+	tail = ring->tail;
+	SpinLockRelease(&ring->lock);
+
+	while (tail != head)
+	{
+		int offs = tail % DtmRingSize;
+		int n = Min(head - tail, DtmRingSize - offs);
+		if (!ShubWriteSocket(sd, ring->buffer + offs, n))
+			return false;
+		tail += n;
+	}
+
+	SpinLockAcquire(&ring->lock);
+	ring->tail = tail;
+	SpinLockRelease(&ring->lock);
+	return true;
+}
+
+/*
+ * Deliver all the complete replies in the buffer, returns number of consumed bytes.
+ * Replies too large for the slot are skipped: 'discard' is the number of
+ * bytes of such reply still to be skipped.
+ */
+static int DtmRingDispatch(char* buf, int used, int* discard)
+{
+	int pos = 0;
+
+	for (;;)
+	{
+		ShubMessageHdr* hdr;
+
+		if (*discard != 0)
+		{
+			int n = Min(*discard, used - pos);
+			pos += n;
+			*discard -= n;
+			if (*discard != 0)
+				break;
+		}
+		if (pos + sizeof(ShubMessageHdr) > used)
+			break;
+		hdr = (ShubMessageHdr*)&buf[pos];
+		if (hdr->size > DTM_RING_REPLY_SIZE)
+		{
+			DtmRingReply(hdr->chan, NULL, 0);
+			*discard = hdr->size;
+			pos += sizeof(ShubMessageHdr);
+			continue;
+		}
+		if (pos + sizeof(ShubMessageHdr) + hdr->size > used)
+			break;
+		DtmRingReply(hdr->chan, hdr + 1, hdr->size);
+		pos += sizeof(ShubMessageHdr) + hdr->size;
+	}
+	return pos;
+}
+
+static void DtmRingSigterm(SIGNAL_ARGS)
+{
+	int save_errno = errno;
+	DtmRingTerminate = true;
+	SetLatch(MyLatch);
+	errno = save_errno;
+}
+
+void DtmRingBackgroundWorker(Datum arg)
+{
+	static char buf[DTM_RING_READ_BUFFER_SIZE];
+	int used = 0;
+	int discard = 0;
+	int sd = -1;
+
+	pqsignal(SIGTERM, DtmRingSigterm);
+	BackgroundWorkerUnblockSignals();
+
+	/* transport was set in postmaster for backends, this process uses socket */
+	ArbiterSetTransport(NULL, NULL);
+
+	SpinLockAcquire(&dtmRing->lock);
+	dtmRing->worker = MyLatch;
+	SpinLockRelease(&dtmRing->lock);
+	DtmRingDisconnect(); /* requests of the previous worker will never be replied */
+
+	while (!DtmRingTerminate)
+	{
+		int rc;
+		bool ok;
+
+		if (sd < 0)
+		{
+			sd = ArbiterOpenSocket();
+			if (sd < 0)
+			{
+				rc = WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH, 1000);
+				ResetLatch(MyLatch);
+				if (rc & WL_POSTMASTER_DEATH)
+					proc_exit(1);
+				continue;
+			}
+			used = discard = 0;
+			SpinLockAcquire(&dtmRing->lock);
+			dtmRing->connected = true;
+			SpinLockRelease(&dtmRing->lock);
+		}
+
+		rc = WaitLatchOrSocket(MyLatch, WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH, sd, 0);
+		ResetLatch(MyLatch);
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+
+		ok = DtmRingFlush(sd);
+		if (ok && (rc & WL_SOCKET_READABLE))
+		{
+			int n = read(sd, buf + used, sizeof(buf) - used);
+			if (n > 0)
+			{
+				int pos;
+				used += n;
+				pos = DtmRingDispatch(buf, used, &discard);
+				memmove(buf, buf + pos, used - pos);
+				used -= pos;
+			}
+			else
+				ok = false;
+		}
+		if (!ok)
+		{
+			elog(WARNING, "Connection to arbiter is lost");
+			ArbiterCloseSocket();
+			sd = -1;
+			DtmRingDisconnect();
+		}
+	}
+	proc_exit(0);
+}
+
 static void ByteBufferAlloc(ByteBuffer* buf)
 {
     buf->size = 1024;
@@ -1,4 +1,5 @@
 #include <time.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -6,6 +7,7 @@
 #include <sys/time.h>
 #include <pthread.h>
 
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -37,17 +39,119 @@ class unique_ptr
 typedef void* (*thread_proc_t)(void*);
 typedef uint32_t xid_t;
 
+/*
+ * Log-linear latency histogram in the spirit of HdrHistogram: values below
+ * SUB_BUCKETS usec are recorded exactly, larger ones with a relative error
+ * of at most 2/SUB_BUCKETS.
+ */
+struct histogram
+{
+    enum {
+        SUB_BUCKET_BITS = 7,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        HALF_BUCKETS = SUB_BUCKETS / 2,
+        MAX_VALUE_BITS = 40,
+        N_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * HALF_BUCKETS
+    };
+    size_t counts[N_BUCKETS];
+    size_t count;
+    time_t sum;
+    time_t maxValue;
+
+    void reset() {
+        memset(counts, 0, sizeof counts);
+        count = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    static int bucket(time_t value) {
+        int shift = 0;
+        while ((value >> shift) >= SUB_BUCKETS) {
+            shift += 1;
+        }
+        int i = shift == 0 ? (int)value : shift*HALF_BUCKETS + (int)(value >> shift);
+        return i < N_BUCKETS ? i : N_BUCKETS - 1;
+    }
+
+    static time_t upperBound(int i) {
+        if (i < SUB_BUCKETS) {
+            return i;
+        }
+        int shift = i/HALF_BUCKETS - 1;
+        return ((time_t)(i - shift*HALF_BUCKETS + 1) << shift) - 1;
+    }
+
+    void add(time_t value) {
+        if (value < 0) {
+            value = 0;
+        }
+        counts[bucket(value)] += 1;
+        count += 1;
+        sum += value;
+        if (value > maxValue) {
+            maxValue = value;
+        }
+    }
+
+    void merge(histogram const& other) {
+        for (int i = 0; i < N_BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        if (other.maxValue > maxValue) {
+            maxValue = other.maxValue;
+        }
+    }
+
+    time_t percentile(double p) const {
+        size_t rank = (size_t)ceil(p*count/100);
+        size_t seen = 0;
+        if (rank == 0) {
+            rank = 1;
+        }
+        for (int i = 0; i < N_BUCKETS && count != 0; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return upperBound(i) < maxValue ? upperBound(i) : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+    void print(char const* name) const {
+        printf("\"%s\":{\"count\":%ld, \"mean\":%ld, \"p50\":%ld, \"p99\":%ld, \"p999\":%ld, \"max\":%ld}",
+               name, count, count != 0 ? sum/count : 0,
+               percentile(50), percentile(99), percentile(99.9), maxValue);
+    }
+};
+
+/* transaction types we keep latency histograms for */
+enum txn_type
+{
+    TXN_TRANSFER,   /* writer moving money between two nodes */
+    TXN_TOTAL,      /* reader summing all accounts on all nodes */
+    N_TXN_TYPES
+};
+
+static char const* const txnTypeNames[N_TXN_TYPES] = { "transfer", "total" };
+
 struct thread
 {
     pthread_t t;
     size_t proceeded;
     size_t aborts;
+    histogram latency[N_TXN_TYPES];
     int id;
 
     void start(int tid, thread_proc_t proc) { 
         id = tid;
         proceeded = 0;
         aborts = 0;
+        for (int i = 0; i < N_TXN_TYPES; i++) {
+            latency[i].reset();
+        }
         pthread_create(&t, NULL, proc, this);
     }
 
@@ -63,12 +167,14 @@ struct config
     int nIterations;
     int nAccounts;
     char const* isolationLevel;
+    int rate;
     vector<string> connections;
 
     config() {
         nReaders = 1;
         nWriters = 10;
         nIterations = 1000;
+        rate = 0;
         nAccounts = 1000;      
         isolationLevel = "repeatable read";//"read committed";
     }
@@ -76,6 +182,7 @@ struct config
 
 config cfg;
 bool running;
+time_t benchStart;
 
 #define USEC 1000000
 
@@ -86,6 +193,17 @@ static time_t getCurrentTime()
     return (time_t)tv.tv_sec*USEC + tv.tv_usec;
 }
 
+static void waitUntil(time_t when)
+{
+    time_t now = getCurrentTime();
+    if (when > now) {
+        struct timespec ts;
+        ts.tv_sec = (when - now) / USEC;
+        ts.tv_nsec = (when - now) % USEC * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
 
 void exec(transaction_base& txn, char const* sql, ...)
 {
@@ -118,6 +236,7 @@ void* reader(void* arg)
     int64_t prevSum = 0;
 
     while (running && (cfg.nWriters != 0 || t.proceeded < (size_t)cfg.nIterations)) {
+        time_t start = getCurrentTime();
         try {
             xid_t xid = 0;
             for (size_t i = 0; i < conns.size(); i++) {        
@@ -148,6 +267,7 @@ void* reader(void* arg)
                 prevSum = sum;
             }
             t.proceeded += 1;
+            t.latency[TXN_TOTAL].add(getCurrentTime() - start);
         } catch (pqxx_exception const& x) { 
             printf("reader exception\n");
             continue;
@@ -163,8 +283,23 @@ void* writer(void* arg)
     for (size_t i = 0; i < conns.size(); i++) {
         conns[i] = new connection(cfg.connections[i]);
     }
+    /*
+     * In open-loop mode every writer issues transactions on a fixed schedule
+     * and latency is measured from the scheduled start, so that a stalled
+     * commit is charged for the transactions queued up behind it instead of
+     * silently lowering the arrival rate.
+     */
+    time_t interval = cfg.rate != 0 ? (time_t)cfg.nWriters*USEC/cfg.rate : 0;
+
     for (int i = 0; i < cfg.nIterations; i++)
     { 
+        time_t start;
+        if (interval != 0) {
+            start = benchStart + (time_t)i*interval;
+            waitUntil(start);
+        } else {
+            start = getCurrentTime();
+        }
         int srcCon, dstCon;
         //int srcAcc = (random() % ((cfg.nAccounts-cfg.nWriters)/cfg.nWriters))*cfg.nWriters + t.id;
         //int dstAcc = (random() % ((cfg.nAccounts-cfg.nWriters)/cfg.nWriters))*cfg.nWriters + t.id;
@@ -216,6 +351,7 @@ void* writer(void* arg)
         }
        
         t.proceeded += 1;
+        t.latency[TXN_TRANSFER].add(getCurrentTime() - start);
     }
     return NULL;
 }
@@ -257,6 +393,9 @@ int main (int argc, char* argv[])
             case 'n':
                 cfg.nIterations = atoi(argv[++i]);
                 continue;
+            case 'R':
+                cfg.rate = atoi(argv[++i]);
+                continue;
             case 'c':
                 cfg.connections.push_back(string(argv[++i]));
                 continue;
@@ -274,6 +413,7 @@ int main (int argc, char* argv[])
                "\t-a N\tnumber of accounts (1000)\n"
                "\t-n N\tnumber of iterations (1000)\n"
                "\t-l STR\tisolation level (read committed)\n"
+               "\t-R N\topen-loop mode: writer transactions per second (0 = closed loop)\n"
                "\t-c STR\tdatabase connection string\n"
                "\t-i\tinitialize datanase\n");
         return 1;
@@ -287,6 +427,7 @@ int main (int argc, char* argv[])
     }
 
     time_t start = getCurrentTime();
+    benchStart = start;
     running = true;
 
     vector<thread> readers(cfg.nReaders);
@@ -294,6 +435,11 @@ int main (int argc, char* argv[])
     size_t nReads = 0;
     size_t nWrites = 0;
     size_t nAborts = 0;
+    histogram* latency = new histogram[N_TXN_TYPES];
+
+    for (int i = 0; i < N_TXN_TYPES; i++) {
+        latency[i].reset();
+    }
     
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].start(i, reader);
@@ -306,6 +452,9 @@ int main (int argc, char* argv[])
         writers[i].wait();
         nWrites += writers[i].proceeded;
         nAborts += writers[i].aborts;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(writers[i].latency[j]);
+        }
     }
 
     if (cfg.nWriters != 0) {
@@ -315,14 +464,39 @@ int main (int argc, char* argv[])
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].wait();
         nReads += readers[i].proceeded;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(readers[i].latency[j]);
+        }
     }
  
     time_t elapsed = getCurrentTime() - start;
     if (elapsed == 0) { 
         printf("Test is completed too fast\n");
     } else { 
-        printf("TPS(updates)=%f, TPS(selects)=%f, aborts=%ld\n", (double)(nWrites*USEC)/elapsed, (double)(nReads*USEC)/elapsed, nAborts);
+        printf(
+            "{\"update_tps\":%f, \"read_tps\":%f,"
+            " \"readers\":%d, \"writers\":%d, \"aborts\":%ld, \"rate\":%d,"
+            " \"accounts\":%d, \"iterations\":%d, \"hosts\":%ld,"
+            " \"latency\":{",
+            (double)(nWrites*USEC)/elapsed,
+            (double)(nReads*USEC)/elapsed,
+            cfg.nReaders,
+            cfg.nWriters,
+            nAborts,
+            cfg.rate,
+            cfg.nAccounts,
+            cfg.nIterations,
+            cfg.connections.size()
+            );
+        for (int i = 0; i < N_TXN_TYPES; i++) {
+            if (i != 0) {
+                printf(", ");
+            }
+            latency[i].print(txnTypeNames[i]);
+        }
+        printf("}}\n");
     }
+    delete[] latency;
     return 0;
 }
 // vim: sts=4 ts=4 sw=4 expandtab
@@ -0,0 +1,1028 @@
+/*-------------------------------------------------------------------------
+ *
+ * autoprewarm.c
+ *		Periodically dump information about the blocks present in
+ *		shared_buffers, and reload them on server restart.
+ *
+ *		When the library is preloaded, a master background worker is
+ *		started at server start.  It first reloads the blocks listed in the
+ *		dump file left by the previous run, launching for each database a
+ *		few loader workers which read the blocks in block order, taking
+ *		chunks of the list from shared memory.  Afterwards it dumps the list
+ *		of blocks in shared_buffers to the file every
+ *		pg_prewarm.autoprewarm_interval seconds, and once more at shutdown.
+ *
+ *		While the initial load is running AutoPrewarmLoadingInProgress()
+ *		returns true, which lets other modules, such as multimaster, hold
+ *		off declaring the node ready until the cache is warm.
+ *
+ * Copyright (c) 2016, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		  contrib/pg_prewarm/autoprewarm.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/heapam.h"
+#include "access/xact.h"
+#include "catalog/pg_class.h"
+#include "catalog/pg_type.h"
+#include "fmgr.h"
+#include "miscadmin.h"
+#include "pgstat.h"
+#include "postmaster/bgworker.h"
+#include "storage/buf_internals.h"
+#include "storage/dsm.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/proc.h"
+#include "storage/procsignal.h"
+#include "storage/shmem.h"
+#include "storage/smgr.h"
+#include "storage/spin.h"
+#include "tcop/tcopprot.h"
+#include "utils/guc.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+#include "utils/relfilenodemap.h"
+#include "utils/resowner.h"
+
+#define AUTOPREWARM_FILE "autoprewarm.blocks"
+
+/* Number of blocks a loader takes from the list at a time */
+#define AUTOPREWARM_CHUNK_SIZE 1024
+
+/* Upper limit for pg_prewarm.autoprewarm_workers */
+#define MAX_AUTOPREWARM_WORKERS 32
+
+/* Metadata for each block we dump. */
+typedef struct BlockInfoRecord
+{
+	Oid			database;
+	Oid			tablespace;
+	Oid			filenode;
+	ForkNumber	forknum;
+	BlockNumber blocknum;
+} BlockInfoRecord;
+
+/* Shared state information for autoprewarm bgworker. */
+typedef struct AutoPrewarmSharedState
+{
+	slock_t		mutex;			/* protects the fields below */
+	pid_t		bgworker_pid;	/* for main bgworker */
+	pid_t		pid_using_dumpfile;		/* for autoprewarm or block dump */
+	bool		loading;		/* is the initial load still to be done? */
+
+	/* Following items are for communication with the loader workers. */
+	dsm_handle	block_info_handle;
+	Oid			database;
+	int			next_idx;		/* next block of the list to take */
+	int			stop_idx;		/* end of this database's blocks */
+	int			prewarmed_blocks;
+} AutoPrewarmSharedState;
+
+void		_PG_init(void);
+void		autoprewarm_main(Datum main_arg);
+void		autoprewarm_database_main(Datum main_arg);
+bool		AutoPrewarmLoadingInProgress(void);
+
+PG_FUNCTION_INFO_V1(autoprewarm_start_worker);
+PG_FUNCTION_INFO_V1(autoprewarm_dump_now);
+
+static void apw_load_buffers(void);
+static int	apw_dump_now(bool is_bgworker, bool dump_unlogged);
+static void apw_start_master_worker(void);
+static int	apw_run_loaders(void);
+static bool apw_init_shmem(void);
+static void apw_shmem_startup(void);
+static void apw_detach_shmem(int code, Datum arg);
+static int	apw_compare_blockinfo(const void *p, const void *q);
+static void apw_sigterm_handler(SIGNAL_ARGS);
+static void apw_sighup_handler(SIGNAL_ARGS);
+
+/* Flags set by signal handlers */
+static volatile sig_atomic_t got_sigterm = false;
+static volatile sig_atomic_t got_sighup = false;
+
+/* Pointer to shared-memory state. */
+static AutoPrewarmSharedState *apw_state = NULL;
+
+static shmem_startup_hook_type prev_shmem_startup_hook = NULL;
+
+/* GUC variables. */
+static bool autoprewarm = true; /* start worker? */
+static int	autoprewarm_interval;		/* dump interval */
+static int	autoprewarm_workers;		/* loaders per database */
+
+/*
+ * Module load callback.
+ */
+void
+_PG_init(void)
+{
+	DefineCustomIntVariable("pg_prewarm.autoprewarm_interval",
+							"Sets the interval between dumps of shared buffers",
+							"If set to zero, time-based dumping is disabled.",
+							&autoprewarm_interval,
+							300,
+							0, INT_MAX / 1000,
+							PGC_SIGHUP,
+							GUC_UNIT_S,
+							NULL,
+							NULL,
+							NULL);
+
+	DefineCustomIntVariable("pg_prewarm.autoprewarm_workers",
+							"Sets the number of workers loading each database in parallel",
+							NULL,
+							&autoprewarm_workers,
+							4,
+							1, MAX_AUTOPREWARM_WORKERS,
+							PGC_SIGHUP,
+							0,
+							NULL,
+							NULL,
+							NULL);
+
+	if (!process_shared_preload_libraries_in_progress)
+		return;
+
+	/* can't define PGC_POSTMASTER variable after startup */
+	DefineCustomBoolVariable("pg_prewarm.autoprewarm",
+							 "Starts the autoprewarm worker.",
+							 NULL,
+							 &autoprewarm,
+							 true,
+							 PGC_POSTMASTER,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	EmitWarningsOnPlaceholders("pg_prewarm");
+
+	RequestAddinShmemSpace(MAXALIGN(sizeof(AutoPrewarmSharedState)));
+
+	prev_shmem_startup_hook = shmem_startup_hook;
+	shmem_startup_hook = apw_shmem_startup;
+
+	/* Register autoprewarm worker, if enabled. */
+	if (autoprewarm)
+	{
+		BackgroundWorker worker;
+
+		MemSet(&worker, 0, sizeof(BackgroundWorker));
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_ConsistentState;
+
+		/*
+		 * Restart after a crash, both to keep dumping and because the
+		 * initial load has to be redone with the buffers lost.
+		 */
+		worker.bgw_restart_time = 10;
+		strcpy(worker.bgw_library_name, "pg_prewarm");
+		strcpy(worker.bgw_function_name, "autoprewarm_main");
+		strcpy(worker.bgw_name, "autoprewarm master");
+		worker.bgw_main_arg = BoolGetDatum(true);
+		RegisterBackgroundWorker(&worker);
+	}
+}
+
+/*
+ * Allocate the shared state at server start.  The initial load counts as
+ * pending from the start if there is something to load, so that nobody
+ * sees a cold cache as warm before the worker gets going.
+ */
+static void
+apw_shmem_startup(void)
+{
+	if (prev_shmem_startup_hook)
+		prev_shmem_startup_hook();
+
+	if (!apw_init_shmem())
+	{
+		struct stat st;
+
+		apw_state->loading = autoprewarm &&
+			stat(AUTOPREWARM_FILE, &st) == 0;
+	}
+}
+
+/*
+ * Main entry point for the master autoprewarm process.  Per-database workers
+ * have a separate entry point.
+ */
+void
+autoprewarm_main(Datum main_arg)
+{
+	bool		first_time = DatumGetBool(main_arg);
+	TimestampTz last_dump_time = 0;
+
+	/* Establish signal handlers; once that's done, unblock signals. */
+	pqsignal(SIGTERM, apw_sigterm_handler);
+	pqsignal(SIGHUP, apw_sighup_handler);
+	pqsignal(SIGUSR1, procsignal_sigusr1_handler);
+	BackgroundWorkerUnblockSignals();
+
+	/* Create (if necessary) and attach to our shared memory area. */
+	apw_init_shmem();
+
+	/* Set on-detach hook so that our PID will be cleared on exit. */
+	on_shmem_exit(apw_detach_shmem, 0);
+
+	/*
+	 * Store our PID in the shared memory area --- unless there's already
+	 * another worker running, in which case just exit.
+	 */
+	SpinLockAcquire(&apw_state->mutex);
+	if (apw_state->bgworker_pid != InvalidPid)
+	{
+		SpinLockRelease(&apw_state->mutex);
+		ereport(LOG,
+				(errmsg("autoprewarm worker is already running under PID %d",
+						(int) apw_state->bgworker_pid)));
+		return;
+	}
+	apw_state->bgworker_pid = MyProcPid;
+	SpinLockRelease(&apw_state->mutex);
+
+	/* We need a resource owner for the dsm segment and file access */
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "autoprewarm");
+
+	/*
+	 * Preload buffers from the dump file only if we just started; when the
+	 * worker is launched by autoprewarm_start_worker() the cache is not
+	 * cold.
+	 */
+	if (first_time)
+		apw_load_buffers();
+
+	SpinLockAcquire(&apw_state->mutex);
+	apw_state->loading = false;
+	SpinLockRelease(&apw_state->mutex);
+
+	/* Periodically dump buffers until terminated. */
+	while (!got_sigterm)
+	{
+		int			rc;
+
+		/* In case of a SIGHUP, just reload the configuration. */
+		if (got_sighup)
+		{
+			got_sighup = false;
+			ProcessConfigFile(PGC_SIGHUP);
+		}
+
+		if (autoprewarm_interval <= 0)
+		{
+			/* We're only dumping at shutdown, so just wait forever. */
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_POSTMASTER_DEATH,
+						   -1L);
+		}
+		else
+		{
+			long		delay_in_ms = 0;
+			TimestampTz next_dump_time = 0;
+			long		secs = 0;
+			int			usecs = 0;
+
+			/* Compute the next dump time. */
+			next_dump_time =
+				TimestampTzPlusMilliseconds(last_dump_time,
+											autoprewarm_interval * 1000);
+			TimestampDifference(GetCurrentTimestamp(), next_dump_time,
+								&secs, &usecs);
+			delay_in_ms = secs + (usecs / 1000);
+
+			/* Perform a dump if it's time. */
+			if (delay_in_ms <= 0)
+			{
+				last_dump_time = GetCurrentTimestamp();
+				apw_dump_now(true, false);
+				continue;
+			}
+
+			/* Sleep until the next dump time. */
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   delay_in_ms);
+		}
+
+		/* Reset the latch, bail out if postmaster died, otherwise loop. */
+		ResetLatch(&MyProc->procLatch);
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+
+	/*
+	 * Dump one last time.  We assume this is probably the result of a system
+	 * shutdown, although it's possible that we've merely been terminated.
+	 */
+	apw_dump_now(true, true);
+}
+
+/*
+ * Read the dump file and launch per-database workers one at a time to
+ * prewarm the buffers found there.
+ */
+static void
+apw_load_buffers(void)
+{
+	FILE	   *file = NULL;
+	int			num_elements,
+				i;
+	BlockInfoRecord *blkinfo;
+	dsm_segment *seg;
+	int			prewarmed_blocks = 0;
+
+	/*
+	 * Skip the prewarm if the dump file is in use; otherwise, prevent any
+	 * other process from writing it while we're using it.
+	 */
+	SpinLockAcquire(&apw_state->mutex);
+	if (apw_state->pid_using_dumpfile == InvalidPid)
+		apw_state->pid_using_dumpfile = MyProcPid;
+	else
+	{
+		SpinLockRelease(&apw_state->mutex);
+		ereport(LOG,
+				(errmsg("skipping prewarm because block dump file is being written by PID %d",
+						(int) apw_state->pid_using_dumpfile)));
+		return;
+	}
+	SpinLockRelease(&apw_state->mutex);
+
+	/*
+	 * Open the block dump file.  Exit quietly if it doesn't exist, but
+	 * report any other error.
+	 */
+	file = AllocateFile(AUTOPREWARM_FILE, "r");
+	if (!file)
+	{
+		if (errno == ENOENT)
+		{
+			SpinLockAcquire(&apw_state->mutex);
+			apw_state->pid_using_dumpfile = InvalidPid;
+			SpinLockRelease(&apw_state->mutex);
+			return;				/* No file to load. */
+		}
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m",
+						AUTOPREWARM_FILE)));
+	}
+
+	/* First line of the file is a record count. */
+	if (fscanf(file, "<<%d>>\n", &num_elements) != 1)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not read from file \"%s\": %m",
+						AUTOPREWARM_FILE)));
+
+	/* Allocate a dynamic shared memory segment to store the record data. */
+	seg = dsm_create(sizeof(BlockInfoRecord) * Max(num_elements, 1), 0);
+	blkinfo = (BlockInfoRecord *) dsm_segment_address(seg);
+
+	/* Read records, one per line. */
+	for (i = 0; i < num_elements; i++)
+	{
+		unsigned	forknum;
+
+		if (fscanf(file, "%u,%u,%u,%u,%u\n", &blkinfo[i].database,
+				   &blkinfo[i].tablespace, &blkinfo[i].filenode,
+				   &forknum, &blkinfo[i].blocknum) != 5)
+			ereport(ERROR,
+					(errmsg("autoprewarm block dump file is corrupted at line %d",
+							i + 1)));
+		blkinfo[i].forknum = forknum;
+	}
+
+	FreeFile(file);
+
+	/* The dump is sorted already, but don't count on it being ours. */
+	qsort(blkinfo, num_elements, sizeof(BlockInfoRecord),
+		  apw_compare_blockinfo);
+
+	/* There is no point in loading more blocks than fit in the cache. */
+	if (num_elements > NBuffers)
+		num_elements = NBuffers;
+
+	/* Process each database in turn. */
+	apw_state->block_info_handle = dsm_segment_handle(seg);
+
+	i = 0;
+	while (i < num_elements && !got_sigterm)
+	{
+		Oid			current_db = blkinfo[i].database;
+		int			j = i + 1;
+
+		/*
+		 * Advance to the end of this database's blocks.  Blocks of shared
+		 * relations (database 0) sort first; they are loaded along with the
+		 * first real database, from which they can be opened just as well.
+		 */
+		while (j < num_elements)
+		{
+			if (current_db == InvalidOid)
+				current_db = blkinfo[j].database;
+			else if (blkinfo[j].database != current_db)
+				break;
+			j++;
+		}
+
+		/* Only shared relations, can't connect to database 0: give up. */
+		if (current_db == InvalidOid)
+			break;
+
+		SpinLockAcquire(&apw_state->mutex);
+		apw_state->database = current_db;
+		apw_state->next_idx = i;
+		apw_state->stop_idx = j;
+		apw_state->prewarmed_blocks = 0;
+		SpinLockRelease(&apw_state->mutex);
+
+		prewarmed_blocks += apw_run_loaders();
+
+		i = j;
+	}
+
+	/* Clean up. */
+	dsm_detach(seg);
+	SpinLockAcquire(&apw_state->mutex);
+	apw_state->block_info_handle = 0;
+	apw_state->pid_using_dumpfile = InvalidPid;
+	SpinLockRelease(&apw_state->mutex);
+
+	/* Report our success. */
+	ereport(LOG,
+			(errmsg("autoprewarm successfully prewarmed %d of %d previously-loaded blocks",
+					prewarmed_blocks, num_elements)));
+}
+
+/*
+ * Launch the loader workers for the database set up in shared memory, and
+ * wait for all of them to finish.  Each loader takes chunks of the block
+ * list, so running fewer loaders than asked for only makes it slower.
+ * Returns the number of blocks prewarmed.
+ */
+static int
+apw_run_loaders(void)
+{
+	BackgroundWorkerHandle *handles[MAX_AUTOPREWARM_WORKERS];
+	BackgroundWorker worker;
+	int			nblocks = apw_state->stop_idx - apw_state->next_idx;
+	int			nworkers;
+	int			nlaunched = 0;
+	int			i;
+
+	/* Don't bother with several loaders for a handful of blocks */
+	nworkers = Min(autoprewarm_workers,
+				   (nblocks + AUTOPREWARM_CHUNK_SIZE - 1) / AUTOPREWARM_CHUNK_SIZE);
+	nworkers = Max(nworkers, 1);
+
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags =
+		BGWORKER_SHMEM_ACCESS | BGWORKER_BACKEND_DATABASE_CONNECTION;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	strcpy(worker.bgw_library_name, "pg_prewarm");
+	strcpy(worker.bgw_function_name, "autoprewarm_database_main");
+	strcpy(worker.bgw_name, "autoprewarm loader");
+
+	/* must set notify PID to wait for shutdown */
+	worker.bgw_notify_pid = MyProcPid;
+
+	for (i = 0; i < nworkers; i++)
+	{
+		if (!RegisterDynamicBackgroundWorker(&worker, &handles[nlaunched]))
+		{
+			if (nlaunched == 0)
+				ereport(LOG,
+						(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+						 errmsg("registering dynamic bgworker autoprewarm failed"),
+						 errhint("Consider increasing configuration parameter \"max_worker_processes\".")));
+			break;
+		}
+		nlaunched++;
+	}
+
+	for (i = 0; i < nlaunched; i++)
+	{
+		/*
+		 * Ignore return value; if it fails, postmaster has died, but we have
+		 * checks for that elsewhere.
+		 */
+		WaitForBackgroundWorkerShutdown(handles[i]);
+		pfree(handles[i]);
+	}
+
+	return apw_state->prewarmed_blocks;
+}
+
+/*
+ * Loader worker: prewarm chunks of the block list belonging to one database
+ * until there are none left.
+ */
+void
+autoprewarm_database_main(Datum main_arg)
+{
+	BlockInfoRecord *block_info;
+	dsm_segment *seg;
+	Relation	rel = NULL;
+	Oid			filenode = InvalidOid;
+	Oid			tablespace = InvalidOid;
+	ForkNumber	forknum = InvalidForkNumber;
+	BlockNumber nblocks = 0;
+	bool		skip_relation = false;
+	bool		skip_fork = false;
+	int			prewarmed_blocks = 0;
+
+	/* Establish signal handlers; once that's done, unblock signals. */
+	pqsignal(SIGTERM, die);
+	BackgroundWorkerUnblockSignals();
+
+	/* Connect to correct database and get block information. */
+	apw_init_shmem();
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "autoprewarm");
+	seg = dsm_attach(apw_state->block_info_handle);
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	BackgroundWorkerInitializeConnectionByOid(apw_state->database, InvalidOid);
+	block_info = (BlockInfoRecord *) dsm_segment_address(seg);
+
+	for (;;)
+	{
+		int			pos;
+		int			stop;
+
+		/* Take the next chunk of blocks. */
+		SpinLockAcquire(&apw_state->mutex);
+		pos = apw_state->next_idx;
+		stop = Min(pos + AUTOPREWARM_CHUNK_SIZE, apw_state->stop_idx);
+		apw_state->next_idx = stop;
+		SpinLockRelease(&apw_state->mutex);
+
+		if (pos >= stop)
+			break;
+
+		/* Loop until we run out of blocks in the chunk. */
+		for (; pos < stop; pos++)
+		{
+			BlockInfoRecord *blk = &block_info[pos];
+			Buffer		buf;
+
+			CHECK_FOR_INTERRUPTS();
+
+			/* Open the relation when we move on to a new one. */
+			if (rel == NULL || blk->filenode != filenode ||
+				blk->tablespace != tablespace)
+			{
+				Oid			reloid;
+
+				if (rel)
+				{
+					relation_close(rel, AccessShareLock);
+					rel = NULL;
+					CommitTransactionCommand();
+				}
+				else if (skip_relation &&
+						 blk->filenode == filenode &&
+						 blk->tablespace == tablespace)
+					continue;
+
+				filenode = blk->filenode;
+				tablespace = blk->tablespace;
+				forknum = InvalidForkNumber;
+				skip_relation = true;
+
+				/*
+				 * The relation might have been dropped or rewritten since
+				 * the dump; then its blocks are simply skipped.
+				 */
+				StartTransactionCommand();
+				reloid = RelidByRelfilenode(tablespace, filenode);
+				if (OidIsValid(reloid))
+					rel = try_relation_open(reloid, AccessShareLock);
+				if (!rel)
+				{
+					CommitTransactionCommand();
+					continue;
+				}
+				skip_relation = false;
+			}
+
+			/* Check the fork when we move on to a new one. */
+			if (blk->forknum != forknum)
+			{
+				forknum = blk->forknum;
+				skip_fork = true;
+
+				if (forknum > InvalidForkNumber && forknum <= MAX_FORKNUM)
+				{
+					RelationOpenSmgr(rel);
+					if (smgrexists(rel->rd_smgr, forknum))
+					{
+						nblocks = RelationGetNumberOfBlocksInFork(rel, forknum);
+						skip_fork = false;
+					}
+				}
+			}
+
+			if (skip_fork || blk->blocknum >= nblocks)
+				continue;
+
+			/* Prewarm buffer. */
+			buf = ReadBufferExtended(rel, forknum, blk->blocknum, RBM_NORMAL,
+									 NULL);
+			if (BufferIsValid(buf))
+			{
+				prewarmed_blocks++;
+				ReleaseBuffer(buf);
+			}
+		}
+	}
+
+	/* Release lock on previous relation. */
+	if (rel)
+	{
+		relation_close(rel, AccessShareLock);
+		CommitTransactionCommand();
+	}
+
+	SpinLockAcquire(&apw_state->mutex);
+	apw_state->prewarmed_blocks += prewarmed_blocks;
+	SpinLockRelease(&apw_state->mutex);
+
+	dsm_detach(seg);
+}
+
+/*
+ * Dump information on blocks in shared buffers.  We use a text format here
+ * so that it's easy to understand and even change the file contents if
+ * necessary.
+ * Returns the number of blocks dumped.
+ */
+static int
+apw_dump_now(bool is_bgworker, bool dump_unlogged)
+{
+	int			num_blocks;
+	int			i;
+	int			ret;
+	BlockInfoRecord *block_info_array;
+	BufferDesc *bufHdr;
+	FILE	   *file;
+	char		transient_dump_file_path[MAXPGPATH];
+	pid_t		pid;
+
+	SpinLockAcquire(&apw_state->mutex);
+	pid = apw_state->pid_using_dumpfile;
+	if (apw_state->pid_using_dumpfile == InvalidPid)
+		apw_state->pid_using_dumpfile = MyProcPid;
+	SpinLockRelease(&apw_state->mutex);
+
+	if (pid != InvalidPid)
+	{
+		if (!is_bgworker)
+			ereport(ERROR,
+					(errmsg("could not perform block dump because dump file is being used by PID %d",
+							(int) apw_state->pid_using_dumpfile)));
+
+		ereport(LOG,
+				(errmsg("skipping block dump because it is already being performed by PID %d",
+						(int) apw_state->pid_using_dumpfile)));
+		return 0;
+	}
+
+	block_info_array = (BlockInfoRecord *)
+		palloc_extended(sizeof(BlockInfoRecord) * NBuffers, MCXT_ALLOC_HUGE);
+
+	for (num_blocks = 0, i = 0; i < NBuffers; i++)
+	{
+		uint32		buf_state;
+
+		CHECK_FOR_INTERRUPTS();
+
+		bufHdr = GetBufferDescriptor(i);
+
+		/* Lock each buffer header before inspecting. */
+		buf_state = LockBufHdr(bufHdr);
+
+		/*
+		 * Unlogged tables will be automatically truncated after a crash or
+		 * unclean shutdown. In such cases we need not prewarm them. Dump them
+		 * only if requested by caller.
+		 */
+		if (buf_state & BM_TAG_VALID &&
+			((buf_state & BM_PERMANENT) || dump_unlogged))
+		{
+			block_info_array[num_blocks].database = bufHdr->tag.rnode.dbNode;
+			block_info_array[num_blocks].tablespace = bufHdr->tag.rnode.spcNode;
+			block_info_array[num_blocks].filenode = bufHdr->tag.rnode.relNode;
+			block_info_array[num_blocks].forknum = bufHdr->tag.forkNum;
+			block_info_array[num_blocks].blocknum = bufHdr->tag.blockNum;
+			++num_blocks;
+		}
+
+		UnlockBufHdr(bufHdr, buf_state);
+	}
+
+	/* Store the blocks in the order they are to be loaded back in. */
+	qsort(block_info_array, num_blocks, sizeof(BlockInfoRecord),
+		  apw_compare_blockinfo);
+
+	snprintf(transient_dump_file_path, MAXPGPATH, "%s.tmp", AUTOPREWARM_FILE);
+	file = AllocateFile(transient_dump_file_path, "w");
+	if (!file)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m",
+						transient_dump_file_path)));
+
+	ret = fprintf(file, "<<%d>>\n", num_blocks);
+	if (ret < 0)
+	{
+		int			save_errno = errno;
+
+		FreeFile(file);
+		unlink(transient_dump_file_path);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to file \"%s\": %m",
+						transient_dump_file_path)));
+	}
+
+	for (i = 0; i < num_blocks; i++)
+	{
+		CHECK_FOR_INTERRUPTS();
+
+		ret = fprintf(file, "%u,%u,%u,%u,%u\n",
+					  block_info_array[i].database,
+					  block_info_array[i].tablespace,
+					  block_info_array[i].filenode,
+					  (uint32) block_info_array[i].forknum,
+					  block_info_array[i].blocknum);
+		if (ret < 0)
+		{
+			int			save_errno = errno;
+
+			FreeFile(file);
+			unlink(transient_dump_file_path);
+			errno = save_errno;
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write to file \"%s\": %m",
+							transient_dump_file_path)));
+		}
+	}
+
+	pfree(block_info_array);
+
+	/*
+	 * Rename transient_dump_file_path to AUTOPREWARM_FILE to make things
+	 * permanent.
+	 */
+	ret = FreeFile(file);
+	if (ret != 0)
+	{
+		int			save_errno = errno;
+
+		unlink(transient_dump_file_path);
+		errno = save_errno;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not close file \"%s\": %m",
+						transient_dump_file_path)));
+	}
+
+	(void) durable_rename(transient_dump_file_path, AUTOPREWARM_FILE, ERROR);
+	apw_state->pid_using_dumpfile = InvalidPid;
+
+	ereport(DEBUG1,
+			(errmsg("wrote block details for %d blocks", num_blocks)));
+	return num_blocks;
+}
+
+/*
+ * SQL-callable function to launch autoprewarm.
+ */
+Datum
+autoprewarm_start_worker(PG_FUNCTION_ARGS)
+{
+	pid_t		pid;
+
+	if (!autoprewarm)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("autoprewarm is disabled")));
+
+	apw_init_shmem();
+	SpinLockAcquire(&apw_state->mutex);
+	pid = apw_state->bgworker_pid;
+	SpinLockRelease(&apw_state->mutex);
+
+	if (pid != InvalidPid)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("autoprewarm worker is already running under PID %d",
+						(int) pid)));
+
+	apw_start_master_worker();
+
+	PG_RETURN_VOID();
+}
+
+/*
+ * SQL-callable function to perform an immediate block dump.
+ *
+ * Note: this is declared to return int8, as insurance against some
+ * very distant day when we might make NBuffers wider than int.
+ */
+Datum
+autoprewarm_dump_now(PG_FUNCTION_ARGS)
+{
+	int			num_blocks;
+
+	apw_init_shmem();
+
+	PG_ENSURE_ERROR_CLEANUP(apw_detach_shmem, 0);
+	{
+		num_blocks = apw_dump_now(false, true);
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(apw_detach_shmem, 0);
+
+	PG_RETURN_INT64((int64) num_blocks);
+}
+
+/*
+ * Is the initial load of the buffer cache still under way?  Meant to be
+ * looked up by other modules with load_external_function(); false unless
+ * the library was preloaded.
+ */
+bool
+AutoPrewarmLoadingInProgress(void)
+{
+	bool		loading;
+
+	if (apw_state == NULL)
+		return false;
+
+	SpinLockAcquire(&apw_state->mutex);
+	loading = apw_state->loading;
+	SpinLockRelease(&apw_state->mutex);
+
+	return loading;
+}
+
+/*
+ * Allocate and initialize autoprewarm related shared memory, if not already
+ * done, and set up backend-local pointer to that state.  Returns true if an
+ * existing shared memory segment was found.
+ */
+static bool
+apw_init_shmem(void)
+{
+	bool		found;
+
+	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	apw_state = ShmemInitStruct("autoprewarm",
+								sizeof(AutoPrewarmSharedState),
+								&found);
+	if (!found)
+	{
+		/* First time through ... */
+		SpinLockInit(&apw_state->mutex);
+		apw_state->bgworker_pid = InvalidPid;
+		apw_state->pid_using_dumpfile = InvalidPid;
+		apw_state->loading = false;
+		apw_state->block_info_handle = 0;
+	}
+	LWLockRelease(AddinShmemInitLock);
+
+	return found;
+}
+
+/*
+ * Clear our PID from autoprewarm shared state.
+ */
+static void
+apw_detach_shmem(int code, Datum arg)
+{
+	SpinLockAcquire(&apw_state->mutex);
+	if (apw_state->pid_using_dumpfile == MyProcPid)
+		apw_state->pid_using_dumpfile = InvalidPid;
+	if (apw_state->bgworker_pid == MyProcPid)
+	{
+		apw_state->bgworker_pid = InvalidPid;
+		apw_state->loading = false;
+	}
+	SpinLockRelease(&apw_state->mutex);
+}
+
+/*
+ * Start autoprewarm master worker process.
+ */
+static void
+apw_start_master_worker(void)
+{
+	BackgroundWorker worker;
+	BackgroundWorkerHandle *handle;
+	BgwHandleStatus status;
+	pid_t		pid;
+
+	MemSet(&worker, 0, sizeof(BackgroundWorker));
+	worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+	worker.bgw_start_time = BgWorkerStart_ConsistentState;
+	worker.bgw_restart_time = BGW_NEVER_RESTART;
+	strcpy(worker.bgw_library_name, "pg_prewarm");
+	strcpy(worker.bgw_function_name, "autoprewarm_main");
+	strcpy(worker.bgw_name, "autoprewarm master");
+	worker.bgw_main_arg = BoolGetDatum(false);
+
+	/* must set notify PID to wait for startup */
+	worker.bgw_notify_pid = MyProcPid;
+
+	if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not register background process"),
+			   errhint("You may need to increase max_worker_processes.")));
+
+	status = WaitForBackgroundWorkerStartup(handle, &pid);
+	if (status != BGWH_STARTED)
+		ereport(ERROR,
+				(errcode(ERRCODE_INSUFFICIENT_RESOURCES),
+				 errmsg("could not start background process"),
+			   errhint("More details may be available in the server log.")));
+}
+
+/*
+ * qsort comparator for BlockInfoRecord: database, tablespace, relation,
+ * fork, block.
+ */
+static int
+apw_compare_blockinfo(const void *p, const void *q)
+{
+	const BlockInfoRecord *a = (const BlockInfoRecord *) p;
+	const BlockInfoRecord *b = (const BlockInfoRecord *) q;
+
+#define cmp_member(fld) \
+	do { \
+		if (a->fld < b->fld) \
+			return -1; \
+		else if (a->fld > b->fld) \
+			return 1; \
+	} while (0)
+
+	cmp_member(database);
+	cmp_member(tablespace);
+	cmp_member(filenode);
+	cmp_member(forknum);
+	cmp_member(blocknum);
+
+#undef cmp_member
+
+	return 0;
+}
+
+/*
+ * Signal handler for SIGTERM
+ */
+static void
+apw_sigterm_handler(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sigterm = true;
+
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
+
+/*
+ * Signal handler for SIGHUP
+ */
+static void
+apw_sighup_handler(SIGNAL_ARGS)
+{
+	int			save_errno = errno;
+
+	got_sighup = true;
+
+	if (MyProc)
+		SetLatch(&MyProc->procLatch);
+
+	errno = save_errno;
+}
@@ -16,9 +16,14 @@
 #include "c.h"
 #include "libpq-fe.h"
 
+#include "nodes/pg_list.h"
+
 
 /* maximum duration to wait for connection */
-#define CLIENT_CONNECT_TIMEOUT_SECONDS "5"
+#define CLIENT_CONNECT_TIMEOUT_SECONDS 5
+
+/* interval at which pending connections are checked for interrupts */
+#define CONNECT_POLL_TIMEOUT_MSEC 1000
 
 /* maximum (textual) lengths of hostname and port */
 #define MAX_NODE_LENGTH 255
@@ -27,6 +32,9 @@
 /* times to attempt connection (or reconnection) */
 #define MAX_CONNECT_ATTEMPTS 2
 
+/* maximum number of remote prepared statements kept by a backend */
+#define MAX_PREPARED_STATEMENTS 1024
+
 /* SQL statement for testing */
 #define TEST_SQL "DO $$ BEGIN RAISE EXCEPTION 'Raised remotely!'; END $$"
 
@@ -47,12 +55,39 @@ typedef struct NodeConnectionEntry
 {
 	NodeConnectionKey cacheKey; /* hash entry key */
 	PGconn *connection;         /* connection to remote server, if any */
+	uint64 lastUsed;            /* use counter value when last handed out */
 } NodeConnectionEntry;
 
 
+/*
+ * PreparedStatementKey identifies a statement prepared on a remote connection
+ * by the connection and the statement's query text.
+ */
+typedef struct PreparedStatementKey
+{
+	PGconn *connection;      /* connection the statement is prepared on */
+	char *queryString;       /* query text of the statement */
+} PreparedStatementKey;
+
+
+/* PreparedStatementEntry keeps track of the name of a prepared statement. */
+typedef struct PreparedStatementEntry
+{
+	PreparedStatementKey cacheKey;      /* hash entry key */
+	char statementName[NAMEDATALEN];    /* name the statement is prepared as */
+} PreparedStatementEntry;
+
+
+/* limit on the number of cached connections of a backend, or -1 */
+extern int MaxCachedConnections;
+
+
 /* function declarations for obtaining and using a connection */
 extern PGconn * GetConnection(char *nodeName, int32 nodePort, bool openNew);
+extern void OpenConnections(List *shardPlacementList);
 extern void PurgeConnection(PGconn *connection);
+extern char * PreparedStatementName(PGconn *connection, char *queryString,
+									int parameterCount, Oid *parameterTypes);
 extern void ReportRemoteError(PGconn *connection, PGresult *result);
 
 
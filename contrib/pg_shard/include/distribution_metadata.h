@@ -111,6 +111,10 @@ typedef struct ShardIntervalListCacheEntry
 {
 	Oid distributedTableId; /* cache key */
 	List *shardIntervalList;
+	char partitionMethod;
+	Var *partitionColumn;
+	ShardInterval **sortedShardIntervalArray; /* hash partitioned tables only */
+	bool uniformHashDistribution; /* intervals split the hash space evenly */
 } ShardIntervalListCacheEntry;
 
 
@@ -128,6 +132,9 @@ typedef enum
 
 /* function declarations to access and manipulate the metadata */
 extern List * LookupShardIntervalList(Oid distributedTableId);
+extern ShardInterval ** LookupSortedShardIntervalArray(Oid distributedTableId,
+													   int *shardCount,
+													   bool *uniformHashDistribution);
 extern List * LoadShardIntervalList(Oid distributedTableId);
 extern ShardInterval * LoadShardInterval(int64 shardId);
 extern List * LoadFinalizedShardPlacementList(int64 shardId);
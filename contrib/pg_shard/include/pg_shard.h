@@ -73,6 +73,7 @@ typedef struct DistributedPlan
 	List *targetList;   /* copy of the target list for remote SELECT queries only */
 
 	bool selectFromMultipleShards; /* does the select run across multiple shards? */
+	bool multiRowInsert;           /* do tasks insert disjoint rows of one INSERT? */
 	CreateStmt *createTemporaryTableStmt; /* valid for multiple shard selects */
 } DistributedPlan;
 
@@ -89,6 +90,12 @@ typedef struct Task
 	StringInfo queryString;     /* SQL string suitable for immediate remote execution */
 	List *taskPlacementList;    /* ShardPlacements on which the task can be executed */
 	int64 shardId;              /* Denormalized shardId of tasks for convenience */
+
+	/* query with its constants replaced by parameters, for single shard tasks */
+	StringInfo parameterizedQueryString;
+	int parameterCount;
+	Oid *parameterTypes;
+	char **parameterValues;     /* parameter values in text format */
 } Task;
 
 
@@ -20,7 +20,8 @@
 /* templates for SQL commands used during shard placement repair */
 #define DROP_REGULAR_TABLE_COMMAND "DROP TABLE IF EXISTS %s"
 #define DROP_FOREIGN_TABLE_COMMAND "DROP FOREIGN TABLE IF EXISTS %s"
-#define COPY_SHARD_PLACEMENT_COMMAND "SELECT worker_copy_shard_placement(%s, %s, %d)"
+#define COPY_OUT_COMMAND "COPY %s TO STDOUT (FORMAT binary)"
+#define COPY_IN_COMMAND "COPY %s FROM STDIN (FORMAT binary)"
 #define SELECT_ALL_QUERY "SELECT * FROM %s"
 
 
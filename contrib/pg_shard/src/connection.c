@@ -15,10 +15,14 @@
 #include "miscadmin.h"
 
 #include "connection.h"
+#include "distribution_metadata.h"
 
+#include <errno.h>
+#include <poll.h>
 #include <stddef.h>
 #include <string.h>
 
+#include "access/hash.h"
 #include "commands/dbcommands.h"
 #include "lib/stringinfo.h"
 #include "mb/pg_wchar.h"
@@ -28,6 +32,7 @@
 #include "utils/hsearch.h"
 #include "utils/memutils.h"
 #include "utils/palloc.h"
+#include "utils/timestamp.h"
 
 
 /*
@@ -36,10 +41,32 @@
  */
 static HTAB *NodeConnectionHash = NULL;
 
+/* counter used to find the least recently used cached connection */
+static uint64 ConnectionUseCounter = 0;
+
+/* configuration for the number of cached connections, -1 means no limit */
+int MaxCachedConnections = -1;
+
+/*
+ * PreparedStatementHash keeps the statements prepared on the connections of
+ * the connection hash. It is created when the first statement is prepared.
+ */
+static HTAB *PreparedStatementHash = NULL;
+static uint32 PreparedStatementCount = 0;
+
 
 /* local function forward declarations */
 static HTAB * CreateNodeConnectionHash(void);
-static PGconn * ConnectToNode(char *nodeName, char *nodePort);
+static HTAB * CreatePreparedStatementHash(void);
+static uint32 PreparedStatementKeyHash(const void *key, Size keySize);
+static int PreparedStatementKeyCompare(const void *leftKey, const void *rightKey,
+									   Size keySize);
+static void ForgetPreparedStatements(PGconn *connection);
+static PGconn * ConnectToNode(NodeConnectionKey *nodeConnectionKey);
+static PGconn * StartNodeConnection(NodeConnectionKey *nodeConnectionKey);
+static void FinishNodeConnections(PGconn **connectionArray, int connectionCount,
+								  bool reportErrors);
+static void ReleaseIdleConnections(void);
 static char * ConnectionGetOptionValue(PGconn *connection, char *optionKeyword);
 
 
@@ -49,9 +76,14 @@ static char * ConnectionGetOptionValue(PGconn *connection, char *optionKeyword);
  * the specified port yet exists, and openNew is true, the function establishes
  * a new connection and returns that.
  *
+ * Before opening a new connection, the function closes idle connections which
+ * exceed the configured limit on cached connections.
+ *
  * Returned connections are guaranteed to be in the CONNECTION_OK state. If the
  * requested connection cannot be established, or if it was previously created
- * but is now in an unrecoverable bad state, this function returns NULL.
+ * but is now in an unrecoverable bad state, this function returns NULL. Cached
+ * connections still running a query, which was abandoned when an error cut its
+ * execution short, are considered to be in a bad state.
  *
  * This function throws an error if a hostname over 255 characters is provided.
  */
@@ -87,8 +119,10 @@ GetConnection(char *nodeName, int32 nodePort, bool openNew)
 	if (entryFound)
 	{
 		connection = nodeConnectionEntry->connection;
-		if (PQstatus(connection) == CONNECTION_OK)
+		if (PQstatus(connection) == CONNECTION_OK &&
+			PQtransactionStatus(connection) != PQTRANS_ACTIVE)
 		{
+			nodeConnectionEntry->lastUsed = ++ConnectionUseCounter;
 			needNewConnection = false;
 		}
 		else
@@ -99,19 +133,74 @@ GetConnection(char *nodeName, int32 nodePort, bool openNew)
 
 	if (needNewConnection && openNew)
 	{
-		StringInfo nodePortString = makeStringInfo();
-		appendStringInfo(nodePortString, "%d", nodePort);
+		ReleaseIdleConnections();
 
-		connection = ConnectToNode(nodeName, nodePortString->data);
-		if (connection != NULL)
+		connection = ConnectToNode(&nodeConnectionKey);
+	}
+	else if (needNewConnection)
+	{
+		connection = NULL;
+	}
+
+	return connection;
+}
+
+
+/*
+ * OpenConnections establishes connections to the nodes of the given placements
+ * which have no cached connection yet. All connections are started at once and
+ * completed in parallel, so that a statement which fans out to many nodes pays
+ * for a single round of connection setup. Connections which fail are closed
+ * without an error; GetConnection retries and reports them when the node is
+ * actually needed.
+ */
+void
+OpenConnections(List *shardPlacementList)
+{
+	PGconn **connectionArray = NULL;
+	int connectionCount = 0;
+	ListCell *shardPlacementCell = NULL;
+
+	if (NodeConnectionHash == NULL)
+	{
+		NodeConnectionHash = CreateNodeConnectionHash();
+	}
+
+	connectionArray = palloc0(list_length(shardPlacementList) * sizeof(PGconn *));
+
+	foreach(shardPlacementCell, shardPlacementList)
+	{
+		ShardPlacement *shardPlacement = (ShardPlacement *) lfirst(shardPlacementCell);
+		NodeConnectionKey nodeConnectionKey;
+		NodeConnectionEntry *nodeConnectionEntry = NULL;
+		bool entryFound = false;
+
+		if (strnlen(shardPlacement->nodeName, MAX_NODE_LENGTH + 1) > MAX_NODE_LENGTH)
 		{
-			nodeConnectionEntry = hash_search(NodeConnectionHash, &nodeConnectionKey,
-											  HASH_ENTER, &entryFound);
-			nodeConnectionEntry->connection = connection;
+			continue;
 		}
+
+		memset(&nodeConnectionKey, 0, sizeof(nodeConnectionKey));
+		strncpy(nodeConnectionKey.nodeName, shardPlacement->nodeName, MAX_NODE_LENGTH);
+		nodeConnectionKey.nodePort = shardPlacement->nodePort;
+
+		/* connections started earlier in this loop are found here as well */
+		nodeConnectionEntry = hash_search(NodeConnectionHash, &nodeConnectionKey,
+										  HASH_FIND, &entryFound);
+		if (entryFound)
+		{
+			nodeConnectionEntry->lastUsed = ++ConnectionUseCounter;
+			continue;
+		}
+
+		ReleaseIdleConnections();
+
+		connectionArray[connectionCount++] = StartNodeConnection(&nodeConnectionKey);
 	}
 
-	return connection;
+	FinishNodeConnections(connectionArray, connectionCount, false);
+
+	pfree(connectionArray);
 }
 
 
@@ -166,6 +255,7 @@ PurgeConnection(PGconn *connection)
 									 "connection than that provided by caller",
 									 nodeConnectionKey.nodeName,
 									 nodeConnectionKey.nodePort)));
+			ForgetPreparedStatements(nodeConnectionEntry->connection);
 			PQfinish(nodeConnectionEntry->connection);
 		}
 	}
@@ -177,10 +267,107 @@ PurgeConnection(PGconn *connection)
 								 nodeConnectionKey.nodePort)));
 	}
 
+	ForgetPreparedStatements(connection);
 	PQfinish(connection);
 }
 
 
+/*
+ * PreparedStatementName returns the name of a statement prepared on the given
+ * connection for the given parameterized query, preparing the statement if
+ * the connection does not have it yet. The function returns NULL if the query
+ * cannot be prepared, or if the backend already keeps as many prepared
+ * statements as it may; the query should then be sent as it is.
+ */
+char *
+PreparedStatementName(PGconn *connection, char *queryString, int parameterCount,
+					  Oid *parameterTypes)
+{
+	PreparedStatementKey preparedStatementKey;
+	PreparedStatementEntry *preparedStatementEntry = NULL;
+	static uint32 statementNameCounter = 0;
+	char statementName[NAMEDATALEN];
+	PGresult *result = NULL;
+	bool entryFound = false;
+	bool preparedOK = false;
+
+	if (PreparedStatementHash == NULL)
+	{
+		PreparedStatementHash = CreatePreparedStatementHash();
+	}
+
+	preparedStatementKey.connection = connection;
+	preparedStatementKey.queryString = queryString;
+
+	preparedStatementEntry = hash_search(PreparedStatementHash, &preparedStatementKey,
+										 HASH_FIND, &entryFound);
+	if (entryFound)
+	{
+		return preparedStatementEntry->statementName;
+	}
+
+	if (PreparedStatementCount >= MAX_PREPARED_STATEMENTS)
+	{
+		return NULL;
+	}
+
+	snprintf(statementName, NAMEDATALEN, "pg_shard_%u", ++statementNameCounter);
+
+	result = PQprepare(connection, statementName, queryString, parameterCount,
+					   parameterTypes);
+	preparedOK = (PQresultStatus(result) == PGRES_COMMAND_OK);
+	PQclear(result);
+
+	if (!preparedOK)
+	{
+		return NULL;
+	}
+
+	preparedStatementEntry = hash_search(PreparedStatementHash, &preparedStatementKey,
+										 HASH_ENTER, &entryFound);
+	preparedStatementEntry->cacheKey.queryString =
+		MemoryContextStrdup(CacheMemoryContext, queryString);
+	strlcpy(preparedStatementEntry->statementName, statementName, NAMEDATALEN);
+	PreparedStatementCount++;
+
+	return preparedStatementEntry->statementName;
+}
+
+
+/*
+ * ForgetPreparedStatements removes the statements prepared on the given
+ * connection from the prepared statement hash, as the connection is about to
+ * be closed.
+ */
+static void
+ForgetPreparedStatements(PGconn *connection)
+{
+	HASH_SEQ_STATUS status;
+	PreparedStatementEntry *preparedStatementEntry = NULL;
+
+	if (PreparedStatementHash == NULL)
+	{
+		return;
+	}
+
+	hash_seq_init(&status, PreparedStatementHash);
+	while ((preparedStatementEntry = hash_seq_search(&status)) != NULL)
+	{
+		char *queryString = preparedStatementEntry->cacheKey.queryString;
+
+		if (preparedStatementEntry->cacheKey.connection != connection)
+		{
+			continue;
+		}
+
+		hash_search(PreparedStatementHash, &preparedStatementEntry->cacheKey,
+					HASH_REMOVE, NULL);
+		pfree(queryString);
+		PreparedStatementCount--;
+	}
+}
+
+
 /*
  * ReportRemoteError retrieves various error fields from the a remote result and
  * produces an error report at the WARNING level.
@@ -256,53 +443,324 @@ CreateNodeConnectionHash(void)
 
 
 /*
- * ConnectToNode opens a connection to a remote PostgreSQL server. The function
- * configures the connection's fallback application name to 'pg_shard' and sets
- * the remote encoding to match the local one. This function requires that the
- * port be specified as a string for easier use with libpq functions.
+ * CreatePreparedStatementHash returns a newly created hash table for keeping
+ * the statements prepared on remote connections, indexed by connection and
+ * query text.
+ */
+static HTAB *
+CreatePreparedStatementHash(void)
+{
+	HTAB *preparedStatementHash = NULL;
+	HASHCTL info;
+	int hashFlags = 0;
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(PreparedStatementKey);
+	info.entrysize = sizeof(PreparedStatementEntry);
+	info.hash = PreparedStatementKeyHash;
+	info.match = PreparedStatementKeyCompare;
+	info.hcxt = CacheMemoryContext;
+	hashFlags = (HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_CONTEXT);
+
+	preparedStatementHash = hash_create("pg_shard prepared statements", 64, &info,
+										hashFlags);
+
+	return preparedStatementHash;
+}
+
+
+/* PreparedStatementKeyHash hashes the connection and query text of a key. */
+static uint32
+PreparedStatementKeyHash(const void *key, Size keySize)
+{
+	const PreparedStatementKey *preparedStatementKey = key;
+	const char *queryString = preparedStatementKey->queryString;
+	uint32 queryHash = DatumGetUInt32(hash_any((const unsigned char *) queryString,
+											   strlen(queryString)));
+
+	return queryHash ^ (uint32) ((uintptr_t) preparedStatementKey->connection);
+}
+
+
+/*
+ * PreparedStatementKeyCompare returns zero if the given keys have the same
+ * connection and query text, and non-zero otherwise.
+ */
+static int
+PreparedStatementKeyCompare(const void *leftKey, const void *rightKey, Size keySize)
+{
+	const PreparedStatementKey *leftStatementKey = leftKey;
+	const PreparedStatementKey *rightStatementKey = rightKey;
+
+	if (leftStatementKey->connection != rightStatementKey->connection)
+	{
+		return 1;
+	}
+
+	return strcmp(leftStatementKey->queryString, rightStatementKey->queryString);
+}
+
+
+/*
+ * ConnectToNode opens a connection to the remote PostgreSQL server identified
+ * by the given key, and adds the connection to the connection hash.
  *
  * We attempt to connect up to MAX_CONNECT_ATTEMPT times. After that we give up
  * and return NULL.
  */
 static PGconn *
-ConnectToNode(char *nodeName, char *nodePort)
+ConnectToNode(NodeConnectionKey *nodeConnectionKey)
+{
+	PGconn *connection = NULL;
+
+	for (int attemptIndex = 0; attemptIndex < MAX_CONNECT_ATTEMPTS; attemptIndex++)
+	{
+		/* warn if still erroring on final attempt */
+		bool reportErrors = (attemptIndex == MAX_CONNECT_ATTEMPTS - 1);
+
+		connection = StartNodeConnection(nodeConnectionKey);
+		FinishNodeConnections(&connection, 1, reportErrors);
+		if (connection != NULL)
+		{
+			break;
+		}
+	}
+
+	return connection;
+}
+
+
+/*
+ * StartNodeConnection starts connecting to a remote PostgreSQL server without
+ * waiting for the connection to complete. The function configures the
+ * connection's fallback application name to 'pg_shard' and sets the remote
+ * encoding to match the local one.
+ *
+ * The pending connection is added to the connection hash right away, so that
+ * it is closed by GetConnection if an error interrupts the connection attempt.
+ */
+static PGconn *
+StartNodeConnection(NodeConnectionKey *nodeConnectionKey)
 {
 	PGconn *connection = NULL;
+	NodeConnectionEntry *nodeConnectionEntry = NULL;
+	StringInfo nodePortString = makeStringInfo();
 	const char *clientEncoding = GetDatabaseEncodingName();
 	const char *dbname = get_database_name(MyDatabaseId);
+	bool entryFound = false;
 
 	const char *keywordArray[] = {
 		"host", "port", "fallback_application_name",
-		"client_encoding", "connect_timeout", "dbname", NULL
+		"client_encoding", "dbname", NULL
 	};
 	const char *valueArray[] = {
-		nodeName, nodePort, "pg_shard", clientEncoding,
-		CLIENT_CONNECT_TIMEOUT_SECONDS, dbname, NULL
+		nodeConnectionKey->nodeName, nodePortString->data, "pg_shard",
+		clientEncoding, dbname, NULL
 	};
 
 	Assert(sizeof(keywordArray) == sizeof(valueArray));
 
-	for (int attemptIndex = 0; attemptIndex < MAX_CONNECT_ATTEMPTS; attemptIndex++)
+	appendStringInfo(nodePortString, "%d", nodeConnectionKey->nodePort);
+
+	connection = PQconnectStartParams(keywordArray, valueArray, false);
+	if (connection == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_OUT_OF_MEMORY),
+						errmsg("could not allocate connection to \"%s:%d\"",
+							   nodeConnectionKey->nodeName,
+							   nodeConnectionKey->nodePort)));
+	}
+
+	nodeConnectionEntry = hash_search(NodeConnectionHash, nodeConnectionKey,
+									  HASH_ENTER, &entryFound);
+	nodeConnectionEntry->connection = connection;
+	nodeConnectionEntry->lastUsed = ++ConnectionUseCounter;
+
+	return connection;
+}
+
+
+/*
+ * FinishNodeConnections waits for the given started connections to complete,
+ * driving all of them at once. Connections which fail, or which are not
+ * established within CLIENT_CONNECT_TIMEOUT_SECONDS, are purged and set to NULL
+ * in the given array; their errors are reported if reportErrors is set.
+ */
+static void
+FinishNodeConnections(PGconn **connectionArray, int connectionCount, bool reportErrors)
+{
+	PostgresPollingStatusType *pollingStatusArray = NULL;
+	struct pollfd *pollFDArray = NULL;
+	int *pollConnectionIndexArray = NULL;
+	int pendingCount = 0;
+	int connectionIndex = 0;
+	TimestampTz connectDeadline = 0;
+
+	if (connectionCount == 0)
+	{
+		return;
+	}
+
+	pollingStatusArray = palloc0(connectionCount * sizeof(PostgresPollingStatusType));
+	pollFDArray = palloc0(connectionCount * sizeof(struct pollfd));
+	pollConnectionIndexArray = palloc0(connectionCount * sizeof(int));
+	connectDeadline = TimestampTzPlusMilliseconds(GetCurrentTimestamp(),
+												  CLIENT_CONNECT_TIMEOUT_SECONDS * 1000);
+
+	for (connectionIndex = 0; connectionIndex < connectionCount; connectionIndex++)
 	{
-		connection = PQconnectdbParams(keywordArray, valueArray, false);
-		if (PQstatus(connection) == CONNECTION_OK)
+		PGconn *connection = connectionArray[connectionIndex];
+
+		if (PQstatus(connection) == CONNECTION_BAD)
 		{
-			break;
+			pollingStatusArray[connectionIndex] = PGRES_POLLING_FAILED;
 		}
 		else
 		{
-			/* warn if still erroring on final attempt */
-			if (attemptIndex == MAX_CONNECT_ATTEMPTS - 1)
+			/* libpq wants the socket to be writable before it is polled */
+			pollingStatusArray[connectionIndex] = PGRES_POLLING_WRITING;
+			pendingCount++;
+		}
+	}
+
+	while (pendingCount > 0)
+	{
+		int pollCount = 0;
+		int pollIndex = 0;
+		int pollResult = 0;
+
+		if (GetCurrentTimestamp() >= connectDeadline)
+		{
+			break;
+		}
+
+		for (connectionIndex = 0; connectionIndex < connectionCount; connectionIndex++)
+		{
+			PostgresPollingStatusType pollingStatus = pollingStatusArray[connectionIndex];
+
+			if (pollingStatus == PGRES_POLLING_READING ||
+				pollingStatus == PGRES_POLLING_WRITING)
 			{
-				ReportRemoteError(connection, NULL);
+				pollFDArray[pollCount].fd = PQsocket(connectionArray[connectionIndex]);
+				pollFDArray[pollCount].events =
+					(pollingStatus == PGRES_POLLING_READING) ? POLLIN : POLLOUT;
+				pollFDArray[pollCount].revents = 0;
+				pollConnectionIndexArray[pollCount] = connectionIndex;
+				pollCount++;
 			}
+		}
 
-			PQfinish(connection);
-			connection = NULL;
+		pollResult = poll(pollFDArray, pollCount, CONNECT_POLL_TIMEOUT_MSEC);
+		if (pollResult < 0 && errno != EINTR)
+		{
+			ereport(ERROR, (errcode_for_socket_access(),
+							errmsg("could not wait for connections: %m")));
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (pollIndex = 0; pollResult > 0 && pollIndex < pollCount; pollIndex++)
+		{
+			PostgresPollingStatusType pollingStatus = PGRES_POLLING_FAILED;
+
+			if (pollFDArray[pollIndex].revents == 0)
+			{
+				continue;
+			}
+
+			connectionIndex = pollConnectionIndexArray[pollIndex];
+			pollingStatus = PQconnectPoll(connectionArray[connectionIndex]);
+			pollingStatusArray[connectionIndex] = pollingStatus;
+
+			if (pollingStatus == PGRES_POLLING_OK ||
+				pollingStatus == PGRES_POLLING_FAILED)
+			{
+				pendingCount--;
+			}
 		}
 	}
 
-	return connection;
+	for (connectionIndex = 0; connectionIndex < connectionCount; connectionIndex++)
+	{
+		PGconn *connection = connectionArray[connectionIndex];
+		PostgresPollingStatusType pollingStatus = pollingStatusArray[connectionIndex];
+
+		if (pollingStatus == PGRES_POLLING_OK)
+		{
+			continue;
+		}
+
+		if (reportErrors && pollingStatus == PGRES_POLLING_FAILED)
+		{
+			ReportRemoteError(connection, NULL);
+		}
+		else if (reportErrors)
+		{
+			ereport(WARNING, (errcode(ERRCODE_CONNECTION_FAILURE),
+							  errmsg("Connection failed to %s:%s", PQhost(connection),
+									 PQport(connection)),
+							  errdetail("Timed out after %d seconds.",
+										CLIENT_CONNECT_TIMEOUT_SECONDS)));
+		}
+
+		PurgeConnection(connection);
+		connectionArray[connectionIndex] = NULL;
+	}
+
+	pfree(pollingStatusArray);
+	pfree(pollFDArray);
+	pfree(pollConnectionIndexArray);
+}
+
+
+/*
+ * ReleaseIdleConnections makes room for a new connection in the connection
+ * hash by closing the least recently used idle connections, if the hash has
+ * reached the limit set by pg_shard.max_cached_connections. Connections which
+ * are running a query or are inside a remote transaction are never closed, so
+ * the limit may be exceeded while they are in use.
+ */
+static void
+ReleaseIdleConnections(void)
+{
+	if (MaxCachedConnections < 0)
+	{
+		return;
+	}
+
+	while (hash_get_num_entries(NodeConnectionHash) >= MaxCachedConnections)
+	{
+		HASH_SEQ_STATUS status;
+		NodeConnectionEntry *nodeConnectionEntry = NULL;
+		PGconn *idleConnection = NULL;
+		uint64 idleConnectionLastUsed = 0;
+
+		hash_seq_init(&status, NodeConnectionHash);
+		while ((nodeConnectionEntry = hash_seq_search(&status)) != NULL)
+		{
+			PGconn *connection = nodeConnectionEntry->connection;
+
+			if (PQstatus(connection) != CONNECTION_OK ||
+				PQtransactionStatus(connection) != PQTRANS_IDLE)
+			{
+				continue;
+			}
+
+			if (idleConnection == NULL ||
+				nodeConnectionEntry->lastUsed < idleConnectionLastUsed)
+			{
+				idleConnection = connection;
+				idleConnectionLastUsed = nodeConnectionEntry->lastUsed;
+			}
+		}
+
+		if (idleConnection == NULL)
+		{
+			break;
+		}
+
+		PurgeConnection(idleConnection);
+	}
 }
 
 
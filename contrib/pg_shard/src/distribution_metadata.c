@@ -16,6 +16,7 @@
 #include "miscadmin.h"
 
 #include "distribution_metadata.h"
+#include "create_shards.h"
 
 #include <stddef.h>
 #include <string.h>
@@ -36,19 +37,34 @@
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/errcodes.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/palloc.h"
 
 
+/* initial size of the shard interval list cache */
+#define SHARD_INTERVAL_CACHE_SIZE 64
+
+
 /*
- * ShardIntervalListCache is used for caching shard interval lists. It begins
- * initialized to empty list as there are no items in the cache.
+ * ShardIntervalListCache is used for caching shard interval lists, keyed by
+ * distributed table. It is created on first use.
  */
-static List *ShardIntervalListCache = NIL;
+static HTAB *ShardIntervalListCache = NULL;
 
 
 /* local function forward declarations */
+static ShardIntervalListCacheEntry * LookupShardIntervalListCacheEntry(
+	Oid distributedTableId);
+static ShardIntervalListCacheEntry * CachedShardIntervalList(Oid distributedTableId);
+static void InvalidateShardIntervalListCache(Datum argument, Oid relationId);
+static ShardInterval ** SortHashedShardIntervals(List *shardIntervalList);
+static int CompareShardIntervalsByMinValue(const void *leftElement,
+										   const void *rightElement);
+static bool HasUniformHashDistribution(ShardInterval **sortedIntervalArray,
+									   int shardCount);
 static ShardInterval * TupleToShardInterval(HeapTuple heapTuple,
 											TupleDesc tupleDescriptor);
 static ShardPlacement * TupleToShardPlacement(HeapTuple heapTuple,
@@ -65,48 +81,261 @@ static void AcquireShardLock(int64 shardId, ShardLockType shardLockType,
 List *
 LookupShardIntervalList(Oid distributedTableId)
 {
-	ShardIntervalListCacheEntry *matchingCacheEntry = NULL;
-	ListCell *cacheEntryCell = NULL;
+	ShardIntervalListCacheEntry *cacheEntry =
+		LookupShardIntervalListCacheEntry(distributedTableId);
 
-	/* search the cache */
-	foreach(cacheEntryCell, ShardIntervalListCache)
+	if (cacheEntry == NULL)
 	{
-		ShardIntervalListCacheEntry *cacheEntry = lfirst(cacheEntryCell);
-		if (cacheEntry->distributedTableId == distributedTableId)
-		{
-			matchingCacheEntry = cacheEntry;
-			break;
-		}
+		return NIL;
 	}
 
-	/* if not found in the cache, load the shard interval and put it in cache */
-	if (matchingCacheEntry == NULL)
+	return cacheEntry->shardIntervalList;
+}
+
+
+/*
+ * LookupSortedShardIntervalArray returns the cached shard intervals of a hash
+ * partitioned table sorted by their min values, and sets shardCount to their
+ * number. The function also reports whether the intervals split the hash space
+ * evenly, as master_create_worker_shards does, in which case the shard of a
+ * hash value can be computed directly. The function returns NULL if the table
+ * is not hash partitioned, has no shards or its shard intervals overlap, as no
+ * binary search is possible in that case.
+ */
+ShardInterval **
+LookupSortedShardIntervalArray(Oid distributedTableId, int *shardCount,
+							   bool *uniformHashDistribution)
+{
+	ShardIntervalListCacheEntry *cacheEntry =
+		LookupShardIntervalListCacheEntry(distributedTableId);
+
+	if (cacheEntry == NULL || cacheEntry->sortedShardIntervalArray == NULL)
 	{
-		MemoryContext oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+		*shardCount = 0;
+		*uniformHashDistribution = false;
+		return NULL;
+	}
 
-		List *loadedIntervalList = LoadShardIntervalList(distributedTableId);
-		if (loadedIntervalList != NIL)
-		{
-			matchingCacheEntry = palloc0(sizeof(ShardIntervalListCacheEntry));
-			matchingCacheEntry->distributedTableId = distributedTableId;
-			matchingCacheEntry->shardIntervalList = loadedIntervalList;
+	*shardCount = list_length(cacheEntry->shardIntervalList);
+	*uniformHashDistribution = cacheEntry->uniformHashDistribution;
+	return cacheEntry->sortedShardIntervalArray;
+}
 
-			ShardIntervalListCache = lappend(ShardIntervalListCache, matchingCacheEntry);
-		}
 
-		MemoryContextSwitchTo(oldContext);
+/*
+ * LookupShardIntervalListCacheEntry returns the cache entry for the given
+ * table, loading its shard intervals if they are not cached yet. The cache is
+ * kept until a relcache invalidation is received for the table: this happens
+ * when the table is altered or dropped, and when its shards or partitioning
+ * are created, see CreateShardRow and InsertPartitionRow. The function returns
+ * NULL if the table has no shards.
+ */
+static ShardIntervalListCacheEntry *
+LookupShardIntervalListCacheEntry(Oid distributedTableId)
+{
+	ShardIntervalListCacheEntry *cacheEntry = NULL;
+	MemoryContext oldContext = NULL;
+	List *loadedIntervalList = NIL;
+	bool foundInCache = false;
+
+	if (ShardIntervalListCache == NULL)
+	{
+		HASHCTL info;
+		int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(Oid);
+		info.entrysize = sizeof(ShardIntervalListCacheEntry);
+		info.hcxt = CacheMemoryContext;
+
+		ShardIntervalListCache = hash_create("pg_shard shard interval cache",
+											 SHARD_INTERVAL_CACHE_SIZE, &info,
+											 hashFlags);
+		CacheRegisterRelcacheCallback(InvalidateShardIntervalListCache,
+									  (Datum) 0);
 	}
 
+	cacheEntry = hash_search(ShardIntervalListCache, &distributedTableId, HASH_FIND,
+							 NULL);
+	if (cacheEntry != NULL)
+	{
+		return cacheEntry;
+	}
+
+	/* if not found in the cache, load the shard interval and put it in cache */
+	oldContext = MemoryContextSwitchTo(CacheMemoryContext);
+
+	loadedIntervalList = LoadShardIntervalList(distributedTableId);
+
 	/*
 	 * The only case we don't cache the shard list is when the distributed table
 	 * doesn't have any shards. This is to force reloading shard list on next call.
 	 */
-	if (matchingCacheEntry == NULL)
+	if (loadedIntervalList != NIL)
 	{
-		return NIL;
+		ShardInterval **sortedIntervalArray = NULL;
+		char partitionMethod = PartitionType(distributedTableId);
+		Var *partitionColumn = PartitionColumn(distributedTableId);
+
+		if (partitionMethod == HASH_PARTITION_TYPE)
+		{
+			sortedIntervalArray = SortHashedShardIntervals(loadedIntervalList);
+		}
+
+		cacheEntry = hash_search(ShardIntervalListCache, &distributedTableId,
+								 HASH_ENTER, &foundInCache);
+		cacheEntry->shardIntervalList = loadedIntervalList;
+		cacheEntry->partitionMethod = partitionMethod;
+		cacheEntry->partitionColumn = partitionColumn;
+		cacheEntry->sortedShardIntervalArray = sortedIntervalArray;
+		cacheEntry->uniformHashDistribution =
+			(sortedIntervalArray != NULL &&
+			 HasUniformHashDistribution(sortedIntervalArray,
+										list_length(loadedIntervalList)));
+	}
+
+	MemoryContextSwitchTo(oldContext);
+
+	return cacheEntry;
+}
+
+
+/*
+ * CachedShardIntervalList returns the cache entry for the given table if its
+ * shard intervals are cached, and NULL otherwise.
+ */
+static ShardIntervalListCacheEntry *
+CachedShardIntervalList(Oid distributedTableId)
+{
+	if (ShardIntervalListCache == NULL)
+	{
+		return NULL;
+	}
+
+	return hash_search(ShardIntervalListCache, &distributedTableId, HASH_FIND, NULL);
+}
+
+
+/*
+ * InvalidateShardIntervalListCache removes the shard intervals of the given
+ * table, or of all tables if relationId is invalid, from the cache. Removed
+ * intervals are not freed, as plans built earlier may still point to them;
+ * shard metadata changes are rare enough for this not to matter.
+ */
+static void
+InvalidateShardIntervalListCache(Datum argument, Oid relationId)
+{
+	HASH_SEQ_STATUS status;
+	ShardIntervalListCacheEntry *cacheEntry = NULL;
+
+	if (OidIsValid(relationId))
+	{
+		hash_search(ShardIntervalListCache, &relationId, HASH_REMOVE, NULL);
+		return;
 	}
 
-	return matchingCacheEntry->shardIntervalList;
+	hash_seq_init(&status, ShardIntervalListCache);
+	while ((cacheEntry = hash_seq_search(&status)) != NULL)
+	{
+		hash_search(ShardIntervalListCache, &cacheEntry->distributedTableId,
+					HASH_REMOVE, NULL);
+	}
+}
+
+
+/*
+ * SortHashedShardIntervals returns an array of the given hash partitioned
+ * shard intervals sorted by their min values. If any two intervals overlap,
+ * the function returns NULL.
+ */
+static ShardInterval **
+SortHashedShardIntervals(List *shardIntervalList)
+{
+	int shardCount = list_length(shardIntervalList);
+	ShardInterval **sortedIntervalArray = palloc(shardCount * sizeof(ShardInterval *));
+	ListCell *shardIntervalCell = NULL;
+	int shardIndex = 0;
+
+	foreach(shardIntervalCell, shardIntervalList)
+	{
+		sortedIntervalArray[shardIndex++] = (ShardInterval *) lfirst(shardIntervalCell);
+	}
+
+	qsort(sortedIntervalArray, shardCount, sizeof(ShardInterval *),
+		  CompareShardIntervalsByMinValue);
+
+	for (shardIndex = 1; shardIndex < shardCount; shardIndex++)
+	{
+		int32 previousMaxValue =
+			DatumGetInt32(sortedIntervalArray[shardIndex - 1]->maxValue);
+		int32 minValue = DatumGetInt32(sortedIntervalArray[shardIndex]->minValue);
+
+		if (minValue <= previousMaxValue)
+		{
+			pfree(sortedIntervalArray);
+			return NULL;
+		}
+	}
+
+	return sortedIntervalArray;
+}
+
+
+/*
+ * HasUniformHashDistribution returns whether the given sorted hash partitioned
+ * shard intervals split the hash space into equal parts, with the remainder
+ * going to the last shard, as master_create_worker_shards creates them.
+ */
+static bool
+HasUniformHashDistribution(ShardInterval **sortedIntervalArray, int shardCount)
+{
+	uint64 hashTokenIncrement = HASH_TOKEN_COUNT / shardCount;
+	int shardIndex = 0;
+
+	for (shardIndex = 0; shardIndex < shardCount; shardIndex++)
+	{
+		ShardInterval *shardInterval = sortedIntervalArray[shardIndex];
+		int32 shardMinHashToken = INT32_MIN + (shardIndex * hashTokenIncrement);
+		int32 shardMaxHashToken = shardMinHashToken + (hashTokenIncrement - 1);
+
+		if (shardIndex == (shardCount - 1))
+		{
+			shardMaxHashToken = INT32_MAX;
+		}
+
+		if (DatumGetInt32(shardInterval->minValue) != shardMinHashToken ||
+			DatumGetInt32(shardInterval->maxValue) != shardMaxHashToken)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * CompareShardIntervalsByMinValue is a qsort comparator ordering hash
+ * partitioned shard intervals by their min values.
+ */
+static int
+CompareShardIntervalsByMinValue(const void *leftElement, const void *rightElement)
+{
+	ShardInterval *leftInterval = *((ShardInterval **) leftElement);
+	ShardInterval *rightInterval = *((ShardInterval **) rightElement);
+	int32 leftMinValue = DatumGetInt32(leftInterval->minValue);
+	int32 rightMinValue = DatumGetInt32(rightInterval->minValue);
+
+	if (leftMinValue < rightMinValue)
+	{
+		return -1;
+	}
+	else if (leftMinValue > rightMinValue)
+	{
+		return 1;
+	}
+
+	return 0;
 }
 
 
@@ -310,6 +539,7 @@ LoadShardPlacementList(int64 shardId)
 Var *
 PartitionColumn(Oid distributedTableId)
 {
+	ShardIntervalListCacheEntry *cacheEntry = CachedShardIntervalList(distributedTableId);
 	Var *partitionColumn = NULL;
 	Oid argTypes[] = { OIDOID };
 	Datum argValues[] = { ObjectIdGetDatum(distributedTableId) };
@@ -325,6 +555,13 @@ PartitionColumn(Oid distributedTableId)
 	 * in LoadShardIntervalList for a more extensive explanation.
 	 */
 	MemoryContext upperContext = CurrentMemoryContext, oldContext = NULL;
+
+	/* tables with cached shards have their partition column cached as well */
+	if (cacheEntry != NULL)
+	{
+		return copyObject(cacheEntry->partitionColumn);
+	}
+
 	SPI_connect();
 
 	if (spiPlan == NULL)
@@ -370,6 +607,7 @@ PartitionColumn(Oid distributedTableId)
 char
 PartitionType(Oid distributedTableId)
 {
+	ShardIntervalListCacheEntry *cacheEntry = CachedShardIntervalList(distributedTableId);
 	char partitionType = 0;
 	Oid argTypes[] = { OIDOID };
 	Datum argValues[] = { ObjectIdGetDatum(distributedTableId) };
@@ -379,6 +617,12 @@ PartitionType(Oid distributedTableId)
 	Datum partitionTypeDatum = 0;
 	static SPIPlanPtr spiPlan = NULL;
 
+	/* tables with cached shards have their partition method cached as well */
+	if (cacheEntry != NULL)
+	{
+		return cacheEntry->partitionMethod;
+	}
+
 	SPI_connect();
 
 	if (spiPlan == NULL)
@@ -709,6 +953,9 @@ InsertPartitionRow(Oid distributedTableId, char partitionType, text *partitionKe
 	Assert(spiStatus == SPI_OK_INSERT);
 
 	SPI_finish();
+
+	/* make all sessions reload the table's cached shard intervals */
+	CacheInvalidateRelcacheByRelid(distributedTableId);
 }
 
 
@@ -756,6 +1003,9 @@ CreateShardRow(Oid distributedTableId, char shardStorage, text *shardMinValue,
 
 	SPI_finish();
 
+	/* make all sessions reload the table's cached shard intervals */
+	CacheInvalidateRelcacheByRelid(distributedTableId);
+
 	return newShardId;
 }
 
@@ -73,26 +73,57 @@ static char * pg_shard_get_indexclusterdef_string(Oid indexRelationId);
 List *
 TableDDLCommandList(Oid relationId)
 {
-	List *tableDDLCommandList = NIL;
+	List *tableCreationCommandList = TableCreationCommandList(relationId);
+	List *indexCreationCommandList = IndexCreationCommandList(relationId);
+
+	return list_concat(tableCreationCommandList, indexCreationCommandList);
+}
+
+
+/*
+ * TableCreationCommandList takes in a relationId, and returns the list of DDL
+ * commands needed to create the relation without its indexes: the table's
+ * schema definition and optional column storage and statistics definitions.
+ */
+List *
+TableCreationCommandList(Oid relationId)
+{
+	List *tableCreationCommandList = NIL;
 	char *tableSchemaDef = NULL;
 	char *tableColumnOptionsDef = NULL;
 
-	Relation pgIndex = NULL;
-	SysScanDesc scanDescriptor = NULL;
-	ScanKeyData scanKey[1];
-	int scanKeyCount = 1;
-	HeapTuple heapTuple = NULL;
-
 	/* fetch table schema and column option definitions */
 	tableSchemaDef = pg_shard_get_tableschemadef_string(relationId);
 	tableColumnOptionsDef = pg_shard_get_tablecolumnoptionsdef_string(relationId);
 
-	tableDDLCommandList = lappend(tableDDLCommandList, tableSchemaDef);
+	tableCreationCommandList = lappend(tableCreationCommandList, tableSchemaDef);
 	if (tableColumnOptionsDef != NULL)
 	{
-		tableDDLCommandList = lappend(tableDDLCommandList, tableColumnOptionsDef);
+		tableCreationCommandList = lappend(tableCreationCommandList,
+										   tableColumnOptionsDef);
 	}
 
+	return tableCreationCommandList;
+}
+
+
+/*
+ * IndexCreationCommandList takes in a relationId, and returns the list of DDL
+ * commands needed to create the relation's indexes and index-backed
+ * constraints, along with the definition of the index the table is clustered
+ * on, if any.
+ */
+List *
+IndexCreationCommandList(Oid relationId)
+{
+	List *indexCreationCommandList = NIL;
+
+	Relation pgIndex = NULL;
+	SysScanDesc scanDescriptor = NULL;
+	ScanKeyData scanKey[1];
+	int scanKeyCount = 1;
+	HeapTuple heapTuple = NULL;
+
 	/* open system catalog and scan all indexes that belong to this table */
 	pgIndex = heap_open(IndexRelationId, AccessShareLock);
 
@@ -145,7 +176,7 @@ TableDDLCommandList(Oid relationId)
 		}
 
 		/* append found constraint or index definition to the list */
-		tableDDLCommandList = lappend(tableDDLCommandList, statementDef);
+		indexCreationCommandList = lappend(indexCreationCommandList, statementDef);
 
 		/* if table is clustered on this index, append definition to the list */
 		if (indexForm->indisclustered)
@@ -153,7 +184,7 @@ TableDDLCommandList(Oid relationId)
 			char *clusteredDef = pg_shard_get_indexclusterdef_string(indexId);
 			Assert(clusteredDef != NULL);
 
-			tableDDLCommandList = lappend(tableDDLCommandList, clusteredDef);
+			indexCreationCommandList = lappend(indexCreationCommandList, clusteredDef);
 		}
 
 		heapTuple = systable_getnext(scanDescriptor);
@@ -163,7 +194,7 @@ TableDDLCommandList(Oid relationId)
 	systable_endscan(scanDescriptor);
 	heap_close(pgIndex, AccessShareLock);
 
-	return tableDDLCommandList;
+	return indexCreationCommandList;
 }
 
 
@@ -25,6 +25,7 @@
 #include "prune_shard_list.h"
 #include "ruleutils.h"
 
+#include <poll.h>
 #include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
@@ -32,6 +33,7 @@
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/htup.h"
+#include "access/transam.h"
 #include "access/sdir.h"
 #if (PG_VERSION_NUM >= 90500 && PG_VERSION_NUM < 90600)
 #include "access/stratnum.h"
@@ -41,7 +43,9 @@
 #include "access/tupdesc.h"
 #include "access/xact.h"
 #include "catalog/namespace.h"
+#include "catalog/pg_aggregate.h"
 #include "catalog/pg_class.h"
+#include "catalog/pg_namespace.h"
 #include "catalog/pg_type.h"
 #include "commands/extension.h"
 #include "executor/execdesc.h"
@@ -50,6 +54,9 @@
 #include "executor/tuptable.h"
 #include "lib/stringinfo.h"
 #include "nodes/execnodes.h"
+#if PG_VERSION_NUM >= 90600
+#include "nodes/extensible.h"
+#endif
 #include "nodes/makefuncs.h"
 #include "nodes/memnodes.h" /* IWYU pragma: keep */
 #include "nodes/nodeFuncs.h"
@@ -62,8 +69,12 @@
 #include "optimizer/clauses.h"
 #include "optimizer/cost.h"
 #include "optimizer/planner.h"
+#include "optimizer/tlist.h"
 #include "optimizer/var.h"
 #include "parser/analyze.h"
+#include "parser/parse_coerce.h"
+#include "parser/parse_collate.h"
+#include "parser/parse_func.h"
 #include "parser/parse_node.h"
 #include "parser/parsetree.h"
 #include "parser/parse_type.h"
@@ -80,11 +91,93 @@
 #include "utils/rel.h"
 #include "utils/relcache.h"
 #include "utils/snapmgr.h"
+#include "utils/syscache.h"
 #include "utils/tuplestore.h"
 #include "utils/memutils.h"
 
 typedef long long csn_t;
 
+/* wake up to check for interrupts while waiting for shard query results */
+#define RESULT_POLL_TIMEOUT_MSEC 1000
+
+/*
+ * TaskExecution keeps the state of a task of a multiple shard SELECT, which
+ * is executed concurrently with the other tasks of the query.
+ */
+typedef struct TaskExecution
+{
+	Task *task;                  /* task being executed */
+	ListCell *placementCell;     /* placement the task is currently tried on */
+	PGconn *connection;          /* connection the query is running on, if any */
+	Tuplestorestate *tupleStore; /* results received so far */
+	bool completed;              /* all results have been received */
+} TaskExecution;
+
+/*
+ * MultiShardExecution keeps the state of all tasks of a multiple shard SELECT.
+ * Completed tasks are handed out one at a time by NextCompletedTask.
+ */
+typedef struct MultiShardExecution
+{
+	TaskExecution *executionArray;
+	int taskCount;
+	int returnedTaskCount;      /* completed tasks handed out to the caller */
+	struct pollfd *pollFDArray;
+	int *pollTaskIndexArray;
+	AttInMetadata *attributeInputMetadata;
+	char **columnArray;
+	bool binaryResults;         /* results are fetched in binary format */
+	FmgrInfo *receiveFunctionArray;
+	Oid *typeIOParamArray;
+	Datum *columnValueArray;
+	bool *columnNullArray;
+	MemoryContext ioContext;    /* reset after building each tuple */
+} MultiShardExecution;
+
+/*
+ * ShardInsertRows collects the rows of a multi-row INSERT which go to the same
+ * shard.
+ */
+typedef struct ShardInsertRows
+{
+	int64 shardId;     /* hash key */
+	List *valuesLists; /* rows as lists of expressions */
+} ShardInsertRows;
+
+/* state of ConstToParamMutator */
+typedef struct ShardQueryParameters
+{
+	List *parameterTypeList;  /* types of the parameters, in order */
+	List *parameterValueList; /* parameter values in text format */
+} ShardQueryParameters;
+
+#if PG_VERSION_NUM >= 90500
+
+/*
+ * ShardResultScanState is the executor state of the custom scan node which
+ * replaces the sequential scan of the local plan of a multiple shard SELECT.
+ * Rows are returned straight from the remote results as the tasks complete.
+ */
+typedef struct ShardResultScanState
+{
+	CustomScanState customScanState;          /* must be first */
+	DistributedPlan *distributedPlan;         /* tasks and remote target list */
+	MultiShardExecution *multiShardExecution; /* NULL for EXPLAIN only */
+	TaskExecution *currentExecution;          /* task whose rows are returned */
+	TupleTableSlot *remoteSlot;               /* row in remote target list form */
+	bool returnRemoteRows;                    /* scan partial aggregate results */
+} ShardResultScanState;
+
+/* state of CombineAggregateMutator */
+typedef struct CombineAggregateContext
+{
+	List *groupColumnList; /* grouping columns of the original query */
+	List *aggregateList;   /* aggregates of the original query */
+	ParseState *parseState;
+} CombineAggregateContext;
+
+#endif
+
 /* controls use of locks to enforce safe commutativity */
 bool AllModificationsCommutative = false;
 
@@ -100,6 +193,12 @@ bool DtmTwoPhaseCommit = false;
 /* logs each statement used in a distributed plan */
 bool LogDistributedStatements = false;
 
+/* fetches multiple shard SELECT results in binary format where possible */
+bool UseBinaryResults = true;
+
+/* runs single shard queries as prepared statements on the worker nodes */
+bool UsePreparedStatements = true;
+
 
 /* planner functions forward declarations */
 static PlannedStmt * PgShardPlanner(Query *parse, int cursorOptions,
@@ -114,16 +213,47 @@ static void ClassifyRestrictions(List *queryRestrictList, List **remoteRestrictL
 								 List **localRestrictList);
 static Query * RowAndColumnFilterQuery(Query *query, List *remoteRestrictList,
 									   List *localRestrictList);
+static void PushDownSortAndLimit(Query *filterQuery, Query *query,
+								 List *localRestrictList);
+#if PG_VERSION_NUM >= 90500
+static bool AggregatesSafeToPushDown(Query *query, List *localRestrictList);
+static bool PartialAggregateSupported(Aggref *aggregate);
+static Query * PartialAggregateQuery(Query *query, List *remoteRestrictList);
+static Query * CombineAggregateQuery(Query *query, Query *partialQuery);
+static Node * CombineAggregateMutator(Node *node, CombineAggregateContext *context);
+static int ListMemberIndex(List *list, Node *node);
+#endif
 static Query * BuildLocalQuery(Query *query, List *localRestrictList);
 static PlannedStmt * PlanSequentialScan(Query *query, int cursorOptions,
 										ParamListInfo boundParams);
 static List * QueryRestrictList(Query *query);
 static Const * ExtractPartitionValue(Query *query, Var *partitionColumn);
+static OpExpr * PartitionValueRestriction(Var *partitionColumn, Const *partitionValue);
+static RangeTblEntry * MultiRowInsertValues(Query *query, Index *valuesRangeTableIndex);
+static DistributedPlan * BuildMultiRowInsertPlan(Query *query,
+												 RangeTblEntry *valuesRangeTableEntry,
+												 Index valuesRangeTableIndex);
 static bool ExtractFromExpressionWalker(Node *node, List **qualifierList);
 static List * QueryFromList(List *rangeTableList);
 static List * TargetEntryList(List *expressionList);
+#if PG_VERSION_NUM >= 90500
+static Plan * ReplaceSequentialScan(Plan *plan);
+static Plan * ReplaceFunctionScan(Plan *plan);
+static Node * ScanColumnMutator(Node *node, Index *scanRangeTableIndex);
+static Node * CreateShardResultScanState(CustomScan *customScan);
+static void BeginShardResultScan(CustomScanState *node, EState *estate, int eflags);
+static TupleTableSlot * ExecShardResultScan(CustomScanState *node);
+static TupleTableSlot * ShardResultScanNext(ScanState *node);
+static bool ShardResultScanRecheck(ScanState *node, TupleTableSlot *slot);
+static void EndShardResultScan(CustomScanState *node);
+static void ReScanShardResultScan(CustomScanState *node);
+#else
 static CreateStmt * CreateTemporaryTableLikeStmt(Oid sourceRelationId);
+#endif
 static DistributedPlan * BuildDistributedPlan(Query *query, List *shardIntervalList);
+static Task * BuildShardTask(Query *query, int64 shardId);
+static void ParameterizeShardTask(Task *task, Query *query);
+static Node * ConstToParamMutator(Node *node, ShardQueryParameters *parameters);
 
 /* executor functions forward declarations */
 static void PgShardExecutorStart(QueryDesc *queryDesc, int eflags);
@@ -132,15 +262,39 @@ static void NextExecutorStartHook(QueryDesc *queryDesc, int eflags);
 static LOCKMODE CommutativityRuleToLockMode(CmdType commandType);
 static void AcquireExecutorShardLocks(List *taskList, LOCKMODE lockMode);
 static int CompareTasksByShardId(const void *leftElement, const void *rightElement);
+static MultiShardExecution * BeginMultiShardExecution(List *taskList,
+													  TupleDesc tupleDescriptor);
+static TaskExecution * NextCompletedTask(MultiShardExecution *multiShardExecution);
+static void EndMultiShardExecution(MultiShardExecution *multiShardExecution);
+static bool NodeBusy(MultiShardExecution *multiShardExecution,
+					 ShardPlacement *taskPlacement);
+#if PG_VERSION_NUM < 90500
 static void ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
 									   RangeVar *intermediateTable);
-static bool SendQueryInSingleRowMode(PGconn *connection, StringInfo query);
-static bool StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
-							 Tuplestorestate *tupleStore);
 static void TupleStoreToTable(RangeVar *tableRangeVar, List *remoteTargetList,
 							  TupleDesc storeTupleDescriptor, Tuplestorestate *store);
+#endif
+static void StartTaskExecution(MultiShardExecution *multiShardExecution,
+							   TaskExecution *execution);
+static bool ReceiveTaskResults(MultiShardExecution *multiShardExecution,
+							   TaskExecution *execution);
+static void AbandonTaskExecution(TaskExecution *execution);
+static bool SendQueryInSingleRowMode(PGconn *connection, Task *task,
+									 bool binaryResults);
+static int SendTaskQuery(PGconn *connection, Task *task, bool binaryResults);
+static bool BinaryResultsSupported(TupleDesc tupleDescriptor);
+static void StoreBinaryResultTuples(PGresult *result,
+									MultiShardExecution *multiShardExecution,
+									Tuplestorestate *tupleStore);
+static void StoreResultTuples(PGresult *result, AttInMetadata *attributeInputMetadata,
+							  char **columnArray, MemoryContext ioContext,
+							  Tuplestorestate *tupleStore);
+static bool StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
+							 Tuplestorestate *tupleStore);
 static void PgShardExecutorRun(QueryDesc *queryDesc, ScanDirection direction, long count);
 static int32 ExecuteDistributedModify(DistributedPlan *distributedPlan);
+static int32 ExecuteModifyTask(Task *task);
+static void ClearRemainingResults(PGconn *connection);
 static void PrepareDtmTransaction(Task *task);
 static csn_t SendDtmBeginTransaction(PGconn *connection);
 static bool SendDtmJoinTransaction(PGconn *connection, csn_t TransactionId);
@@ -178,6 +332,30 @@ static ExecutorFinish_hook_type PreviousExecutorFinishHook = NULL;
 static ExecutorEnd_hook_type PreviousExecutorEndHook = NULL;
 static ProcessUtility_hook_type PreviousProcessUtilityHook = NULL;
 
+#if PG_VERSION_NUM >= 90500
+
+/* custom scan returning the rows fetched by a multiple shard SELECT */
+static CustomScanMethods ShardResultScanMethods = {
+	.CustomName = "ShardResultScan",
+	.CreateCustomScanState = CreateShardResultScanState
+};
+
+static CustomExecMethods ShardResultScanExecMethods = {
+	.CustomName = "ShardResultScan",
+	.BeginCustomScan = BeginShardResultScan,
+	.ExecCustomScan = ExecShardResultScan,
+	.EndCustomScan = EndShardResultScan,
+	.ReScanCustomScan = ReScanShardResultScan
+};
+
+/*
+ * Distributed plan of the multiple shard SELECT whose local plan is being
+ * initialized; the plan tree of the statement no longer points to it then.
+ */
+static DistributedPlan *StartingDistributedPlan = NULL;
+
+#endif
+
 /* XTM stuff */
 static List *connectionsWithDtmTransactions = NIL;
 static csn_t currentGlobalTransactionId = 0;
@@ -237,6 +415,24 @@ _PG_init(void)
 							 &LogDistributedStatements, false, PGC_USERSET, 0, NULL,
 							 NULL, NULL);
 
+	DefineCustomBoolVariable("pg_shard.use_binary_results",
+							 "Fetches multiple shard SELECT results in binary format",
+							 NULL, &UseBinaryResults, true, PGC_USERSET, 0, NULL,
+							 NULL, NULL);
+
+	DefineCustomBoolVariable("pg_shard.use_prepared_statements",
+							 "Runs single shard queries as prepared statements on "
+							 "the worker nodes", NULL, &UsePreparedStatements, true,
+							 PGC_USERSET, 0, NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pg_shard.max_cached_connections",
+							"Sets the maximum number of worker connections kept "
+							"open by a session",
+							"Idle connections beyond this number are closed before "
+							"new ones are opened; -1 means no limit.",
+							&MaxCachedConnections, -1, -1, INT_MAX, PGC_USERSET, 0,
+							NULL, NULL, NULL);
+
 	EmitWarningsOnPlaceholders("pg_shard");
 
 	/* install error transformation handler for PL/pgSQL invocations */
@@ -350,6 +546,8 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 		List *queryShardList = NIL;
 		bool selectFromMultipleShards = false;
 		CreateStmt *createTemporaryTableStmt = NULL;
+		RangeTblEntry *valuesRangeTableEntry = NULL;
+		Index valuesRangeTableIndex = 0;
 
 		/* call standard planner first to have Query transformations performed */
 		plannedStatement = standard_planner(distributedQuery, cursorOptions,
@@ -357,6 +555,20 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 
 		ErrorIfQueryNotSupported(distributedQuery);
 
+		/* rows of a multi-row INSERT are sent to their shards in one INSERT each */
+		valuesRangeTableEntry = MultiRowInsertValues(distributedQuery,
+													 &valuesRangeTableIndex);
+		if (valuesRangeTableEntry != NULL)
+		{
+			distributedPlan = BuildMultiRowInsertPlan(distributedQuery,
+													  valuesRangeTableEntry,
+													  valuesRangeTableIndex);
+			distributedPlan->originalPlan = plannedStatement->planTree;
+
+			plannedStatement->planTree = (Plan *) distributedPlan;
+			return plannedStatement;
+		}
+
 		/*
 		 * Compute the list of shards this query needs to access.
 		 * Error out if there are no existing shards for the table.
@@ -366,17 +578,18 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 		/*
 		 * If a select query touches multiple shards, we don't push down the
 		 * query as-is, and instead only push down the filter clauses and select
-		 * needed columns. We then copy those results to a local temporary table
-		 * and then modify the original PostgreSQL plan to perform a sequential
-		 * scan on that temporary table.
-		 * XXX: This approach is limited as we cannot handle index or foreign
-		 * scans. We will revisit this by potentially using another type of scan
-		 * node instead of a sequential scan.
+		 * needed columns. We then plan the query locally with a sequential scan
+		 * and replace that scan with a custom scan which returns the rows of
+		 * the remote results as they arrive. Before custom scans were available
+		 * the results are copied to a local temporary table, which is scanned
+		 * by the original sequential scan instead.
 		 */
 		selectFromMultipleShards = SelectFromMultipleShards(query, queryShardList);
 		if (selectFromMultipleShards)
 		{
+#if PG_VERSION_NUM < 90500
 			Oid distributedTableId = InvalidOid;
+#endif
 			Query *localQuery = NULL;
 			List *queryRestrictList = QueryRestrictList(distributedQuery);
 			List *remoteRestrictList = NIL;
@@ -386,22 +599,49 @@ PgShardPlanner(Query *query, int cursorOptions, ParamListInfo boundParams)
 			ClassifyRestrictions(queryRestrictList, &remoteRestrictList,
 								 &localRestrictList);
 
-			/* build local and distributed query */
-			distributedQuery = RowAndColumnFilterQuery(distributedQuery,
-													   remoteRestrictList,
-													   localRestrictList);
-			localQuery = BuildLocalQuery(query, localRestrictList);
-
-			/*
-			 * Force a sequential scan as we change the underlying table to
-			 * point to our intermediate temporary table which contains the
-			 * fetched data.
-			 */
-			plannedStatement = PlanSequentialScan(localQuery, cursorOptions, boundParams);
-
-			/* construct a CreateStmt to clone the existing table */
-			distributedTableId = ExtractFirstDistributedTableId(distributedQuery);
-			createTemporaryTableStmt = CreateTemporaryTableLikeStmt(distributedTableId);
+#if PG_VERSION_NUM >= 90500
+			if (AggregatesSafeToPushDown(distributedQuery, localRestrictList))
+			{
+				/* shards compute partial aggregates which we combine locally */
+				Query *partialQuery = PartialAggregateQuery(distributedQuery,
+															remoteRestrictList);
+				localQuery = CombineAggregateQuery(distributedQuery, partialQuery);
+				distributedQuery = partialQuery;
+
+				plannedStatement = standard_planner(localQuery, cursorOptions,
+													boundParams);
+				plannedStatement->planTree =
+					ReplaceFunctionScan(plannedStatement->planTree);
+			}
+			else
+#endif
+			{
+				Query *filterQuery = NULL;
+
+				/* build local and distributed query */
+				filterQuery = RowAndColumnFilterQuery(distributedQuery, remoteRestrictList,
+													  localRestrictList);
+				PushDownSortAndLimit(filterQuery, distributedQuery, localRestrictList);
+				distributedQuery = filterQuery;
+				localQuery = BuildLocalQuery(query, localRestrictList);
+
+				/*
+				 * Force a sequential scan as we change the underlying table to
+				 * point to our intermediate temporary table which contains the
+				 * fetched data.
+				 */
+				plannedStatement = PlanSequentialScan(localQuery, cursorOptions,
+													  boundParams);
+
+#if PG_VERSION_NUM >= 90500
+				plannedStatement->planTree =
+					ReplaceSequentialScan(plannedStatement->planTree);
+#else
+				/* construct a CreateStmt to clone the existing table */
+				distributedTableId = ExtractFirstDistributedTableId(distributedQuery);
+				createTemporaryTableStmt = CreateTemporaryTableLikeStmt(distributedTableId);
+#endif
+			}
 		}
 
 		distributedPlan = BuildDistributedPlan(distributedQuery, queryShardList);
@@ -609,14 +849,14 @@ ErrorIfQueryNotSupported(Query *queryTree)
 						errdetail("Joins are not supported in distributed queries.")));
 	}
 
-	/* reject queries which involve multi-row inserts */
-	if (hasValuesScan)
+	/* reject VALUES lists other than the rows of multi-row inserts */
+	if (hasValuesScan && commandType != CMD_INSERT)
 	{
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 						errmsg("cannot perform distributed planning for the given"
 							   " query"),
-						errdetail("Multi-row INSERTs to distributed tables are not "
-								  "supported.")));
+						errdetail("VALUES lists must not appear in the FROM clause of "
+								  "a distributed query.")));
 	}
 
 	/* reject queries with a returning list */
@@ -924,216 +1164,959 @@ RowAndColumnFilterQuery(Query *query, List *remoteRestrictList, List *localRestr
 
 
 /*
- * BuildLocalQuery returns a copy of query with its quals replaced by those
- * in localRestrictList. Expects queries with a single entry in their FROM
- * list.
+ * PushDownSortAndLimit adds the ORDER BY and LIMIT clauses of the query to the
+ * given filter query, so that each shard returns no more rows than the query
+ * may need. The local plan still sorts and limits the rows of all shards. The
+ * clauses are only pushed down if all filters are evaluated remotely, the
+ * query returns rows as they are stored and the sort keys are plain columns.
+ * LIMIT and OFFSET are expected to be constants, as they are after planning.
  */
-static Query *
-BuildLocalQuery(Query *query, List *localRestrictList)
+static void
+PushDownSortAndLimit(Query *filterQuery, Query *query, List *localRestrictList)
 {
-	Query *localQuery = copyObject(query);
-	FromExpr *joinTree = localQuery->jointree;
+	List *sortClauseList = NIL;
+	ListCell *sortClauseCell = NULL;
+	Const *limitCount = (Const *) query->limitCount;
+	Const *limitOffset = (Const *) query->limitOffset;
+	int64 remoteLimit = 0;
+	Index sortGroupRef = 0;
+
+	if (query->hasAggs || query->groupClause != NIL || query->havingQual != NULL ||
+		query->hasWindowFuncs || query->distinctClause != NIL ||
+		localRestrictList != NIL)
+	{
+		return;
+	}
 
-	Assert(joinTree != NULL);
-	Assert(list_length(joinTree->fromlist) == 1);
-	joinTree->quals = (Node *) make_ands_explicit((List *) localRestrictList);
+	if (limitCount == NULL || !IsA(limitCount, Const) || limitCount->constisnull)
+	{
+		return;
+	}
 
-	return localQuery;
-}
+	remoteLimit = DatumGetInt64(limitCount->constvalue);
+	if (limitOffset != NULL)
+	{
+		int64 offset = 0;
 
+		if (!IsA(limitOffset, Const) || limitOffset->constisnull)
+		{
+			return;
+		}
 
-/*
- * PlanSequentialScan attempts to plan the given query using only a sequential
- * scan of the underlying table. The function disables index scan types and
- * plans the query. If the plan still contains a non-sequential scan plan node,
- * the function errors out. Note this function modifies the query parameter, so
- * make a copy before calling PlanSequentialScan if that is unacceptable.
- */
-static PlannedStmt *
-PlanSequentialScan(Query *query, int cursorOptions, ParamListInfo boundParams)
-{
-	PlannedStmt *sequentialScanPlan = NULL;
-	bool indexScanEnabledOldValue = false;
-	bool bitmapScanEnabledOldValue = false;
-	List *rangeTableList = NIL;
-	ListCell *rangeTableCell = NULL;
+		offset = DatumGetInt64(limitOffset->constvalue);
+		if (offset > 0 && remoteLimit > INT64_MAX - offset)
+		{
+			return;
+		}
 
-	/* error out if the table is a foreign table */
-	ExtractRangeTableEntryWalker((Node *) query, &rangeTableList);
+		remoteLimit += Max(offset, 0);
+	}
 
-	foreach(rangeTableCell, rangeTableList)
+	foreach(sortClauseCell, query->sortClause)
 	{
-		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
-		if (rangeTableEntry->rtekind == RTE_RELATION)
+		SortGroupClause *sortClause = (SortGroupClause *) lfirst(sortClauseCell);
+		TargetEntry *sortEntry = get_sortgroupclause_tle(sortClause, query->targetList);
+		TargetEntry *filterEntry = NULL;
+		ListCell *filterEntryCell = NULL;
+		SortGroupClause *filterSortClause = NULL;
+
+		if (!IsA(sortEntry->expr, Var))
 		{
-			if (rangeTableEntry->relkind == RELKIND_FOREIGN_TABLE)
+			return;
+		}
+
+		foreach(filterEntryCell, filterQuery->targetList)
+		{
+			TargetEntry *targetEntry = (TargetEntry *) lfirst(filterEntryCell);
+			if (equal(targetEntry->expr, sortEntry->expr))
 			{
-				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-								errmsg("multi-shard SELECTs from foreign tables are "
-									   "unsupported")));
+				filterEntry = targetEntry;
+				break;
 			}
 		}
-	}
-
-	/* disable index scan types */
-	indexScanEnabledOldValue = enable_indexscan;
-	bitmapScanEnabledOldValue = enable_bitmapscan;
-
-	enable_indexscan = false;
-	enable_bitmapscan = false;
 
-	sequentialScanPlan = standard_planner(query, cursorOptions, boundParams);
+		Assert(filterEntry != NULL);
+		if (filterEntry->ressortgroupref == 0)
+		{
+			filterEntry->ressortgroupref = ++sortGroupRef;
+		}
 
-	enable_indexscan = indexScanEnabledOldValue;
-	enable_bitmapscan = bitmapScanEnabledOldValue;
+		filterSortClause = copyObject(sortClause);
+		filterSortClause->tleSortGroupRef = filterEntry->ressortgroupref;
+		sortClauseList = lappend(sortClauseList, filterSortClause);
+	}
 
-	return sequentialScanPlan;
+	filterQuery->sortClause = sortClauseList;
+	filterQuery->limitCount = (Node *) makeConst(INT8OID, -1, InvalidOid, sizeof(int64),
+												 Int64GetDatum(remoteLimit), false,
+												 FLOAT8PASSBYVAL);
 }
 
 
+#if PG_VERSION_NUM >= 90500
+
 /*
- * QueryRestrictList returns the restriction clauses for the query. For a SELECT
- * statement these are the where-clause expressions. For INSERT statements we
- * build an equality clause based on the partition-column and its supplied
- * insert value.
+ * AggregatesSafeToPushDown returns whether the aggregates of the query can be
+ * split into partial aggregates computed on the shards and combined locally.
+ * This is the case for count, sum, min and max grouped by plain columns when
+ * all filters are evaluated remotely.
  */
-static List *
-QueryRestrictList(Query *query)
+static bool
+AggregatesSafeToPushDown(Query *query, List *localRestrictList)
 {
-	List *queryRestrictList = NIL;
-	CmdType commandType = query->commandType;
+	List *groupColumnList = NIL;
+	List *expressionList = NIL;
+	ListCell *groupClauseCell = NULL;
+	ListCell *expressionCell = NULL;
 
-	if (commandType == CMD_INSERT)
+	if (!query->hasAggs || query->hasWindowFuncs || query->groupingSets != NIL ||
+		localRestrictList != NIL)
 	{
-		/* build equality expression based on partition column value for row */
-		Oid distributedTableId = ExtractFirstDistributedTableId(query);
-		Var *partitionColumn = PartitionColumn(distributedTableId);
-		Const *partitionValue = ExtractPartitionValue(query, partitionColumn);
-
-		OpExpr *equalityExpr = MakeOpExpression(partitionColumn, BTEqualStrategyNumber);
+		return false;
+	}
 
-		Node *rightOp = get_rightop((Expr *) equalityExpr);
-		Const *rightConst = (Const *) rightOp;
-		Assert(IsA(rightOp, Const));
+	foreach(groupClauseCell, query->groupClause)
+	{
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+		TargetEntry *groupEntry = get_sortgroupclause_tle(groupClause, query->targetList);
 
-		rightConst->constvalue = partitionValue->constvalue;
-		rightConst->constisnull = partitionValue->constisnull;
-		rightConst->constbyval = partitionValue->constbyval;
+		if (!IsA(groupEntry->expr, Var))
+		{
+			return false;
+		}
 
-		queryRestrictList = list_make1(equalityExpr);
-	}
-	else if (commandType == CMD_SELECT || commandType == CMD_UPDATE ||
-			 commandType == CMD_DELETE)
-	{
-		query_tree_walker(query, ExtractFromExpressionWalker, &queryRestrictList, 0);
+		groupColumnList = lappend(groupColumnList, groupEntry->expr);
 	}
 
-	return queryRestrictList;
-}
-
+	/* other columns may only be used within aggregates */
+	expressionList = pull_var_clause((Node *) query->targetList, PVC_INCLUDE_AGGREGATES,
+									 PVC_REJECT_PLACEHOLDERS);
+	expressionList = list_concat(expressionList,
+								 pull_var_clause(query->havingQual, PVC_INCLUDE_AGGREGATES,
+												 PVC_REJECT_PLACEHOLDERS));
 
-/*
- * ExtractPartitionValue extracts the partition column value from a the target
- * of a modification command. If a partition value is missing altogether or is
- * NULL, this function throws an error.
- */
-static Const *
-ExtractPartitionValue(Query *query, Var *partitionColumn)
-{
-	Const *partitionValue = NULL;
-	TargetEntry *targetEntry = get_tle_by_resno(query->targetList,
-												partitionColumn->varattno);
-	if (targetEntry != NULL)
+	foreach(expressionCell, expressionList)
 	{
-		Assert(IsA(targetEntry->expr, Const));
-
-		partitionValue = (Const *) targetEntry->expr;
-	}
+		Node *expression = (Node *) lfirst(expressionCell);
 
-	if (partitionValue == NULL || partitionValue->constisnull)
-	{
-		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
-						errmsg("cannot plan INSERT using row with NULL value "
-							   "in partition column")));
+		if (IsA(expression, Var) && !list_member(groupColumnList, expression))
+		{
+			return false;
+		}
+		else if (IsA(expression, Aggref) &&
+				 !PartialAggregateSupported((Aggref *) expression))
+		{
+			return false;
+		}
 	}
 
-	return partitionValue;
+	return true;
 }
 
 
 /*
- * ExtractFromExpressionWalker walks over a FROM expression, and finds all
- * explicit qualifiers in the expression.
+ * PartialAggregateSupported returns whether the aggregate can be computed by
+ * combining its results over subsets of rows.
  */
 static bool
-ExtractFromExpressionWalker(Node *node, List **qualifierList)
+PartialAggregateSupported(Aggref *aggregate)
 {
-	bool walkIsComplete = false;
-	if (node == NULL)
+	char *aggregateName = NULL;
+
+	if (aggregate->aggdistinct != NIL || aggregate->aggorder != NIL ||
+		aggregate->aggfilter != NULL || aggregate->aggdirectargs != NIL ||
+		aggregate->aggkind != AGGKIND_NORMAL || aggregate->agglevelsup != 0 ||
+		aggregate->aggvariadic || list_length(aggregate->args) > 1)
 	{
 		return false;
 	}
 
-	if (IsA(node, FromExpr))
+	if (get_func_namespace(aggregate->aggfnoid) != PG_CATALOG_NAMESPACE)
 	{
-		FromExpr *fromExpression = (FromExpr *) node;
-		List *fromQualifierList = (List *) fromExpression->quals;
-		(*qualifierList) = list_concat(*qualifierList, fromQualifierList);
+		return false;
 	}
 
-	walkIsComplete = expression_tree_walker(node, ExtractFromExpressionWalker,
-											(void *) qualifierList);
+	aggregateName = get_func_name(aggregate->aggfnoid);
 
-	return walkIsComplete;
+	return (strcmp(aggregateName, "count") == 0 || strcmp(aggregateName, "sum") == 0 ||
+			strcmp(aggregateName, "min") == 0 || strcmp(aggregateName, "max") == 0);
 }
 
 
 /*
- * QueryFromList creates the from list construct that is used for building the
- * query's join tree. The function creates the from list by making a range table
- * reference for each entry in the given range table list.
+ * PartialAggregateQuery builds the query computing the partial aggregates of
+ * the given query on a shard. Its target list holds the grouping columns
+ * followed by the distinct aggregates of the query, which appear in the same
+ * order as the columns of the local query's result relation.
  */
-static List *
-QueryFromList(List *rangeTableList)
+static Query *
+PartialAggregateQuery(Query *query, List *remoteRestrictList)
 {
-	List *fromList = NIL;
-	Index rangeTableIndex = 1;
-	uint32 rangeTableCount = (uint32) list_length(rangeTableList);
+	Query *partialQuery = makeNode(Query);
+	List *rangeTableList = NIL;
+	List *targetList = NIL;
+	List *groupClauseList = NIL;
+	List *aggregateList = NIL;
+	List *expressionList = NIL;
+	ListCell *groupClauseCell = NULL;
+	ListCell *expressionCell = NULL;
+	FromExpr *fromExpr = NULL;
+	AttrNumber resultNumber = 1;
 
-	for (rangeTableIndex = 1; rangeTableIndex <= rangeTableCount; rangeTableIndex++)
+	ExtractRangeTableEntryWalker((Node *) query, &rangeTableList);
+	Assert(list_length(rangeTableList) == 1);
+
+	fromExpr = makeNode(FromExpr);
+	fromExpr->quals = (Node *) make_ands_explicit((List *) remoteRestrictList);
+	fromExpr->fromlist = QueryFromList(rangeTableList);
+
+	foreach(groupClauseCell, query->groupClause)
 	{
-		RangeTblRef *rangeTableReference = makeNode(RangeTblRef);
-		rangeTableReference->rtindex = rangeTableIndex;
+		SortGroupClause *groupClause = (SortGroupClause *) lfirst(groupClauseCell);
+		TargetEntry *groupEntry = get_sortgroupclause_tle(groupClause, query->targetList);
+		TargetEntry *targetEntry = NULL;
+		SortGroupClause *partialGroupClause = NULL;
 
-		fromList = lappend(fromList, rangeTableReference);
-	}
+		if (tlist_member((Node *) groupEntry->expr, targetList) != NULL)
+		{
+			continue;
+		}
 
-	return fromList;
-}
+		targetEntry = makeTargetEntry(copyObject(groupEntry->expr), resultNumber, NULL,
+									  false);
+		targetEntry->ressortgroupref = resultNumber;
+		targetList = lappend(targetList, targetEntry);
 
+		partialGroupClause = copyObject(groupClause);
+		partialGroupClause->tleSortGroupRef = resultNumber;
+		groupClauseList = lappend(groupClauseList, partialGroupClause);
 
-/*
- * TargetEntryList creates a target entry for each expression in the given list,
- * and returns the newly created target entries in a list.
- */
-static List *
-TargetEntryList(List *expressionList)
-{
-	List *targetEntryList = NIL;
-	ListCell *expressionCell = NULL;
+		resultNumber++;
+	}
+
+	expressionList = pull_var_clause((Node *) query->targetList, PVC_INCLUDE_AGGREGATES,
+									 PVC_REJECT_PLACEHOLDERS);
+	expressionList = list_concat(expressionList,
+								 pull_var_clause(query->havingQual, PVC_INCLUDE_AGGREGATES,
+												 PVC_REJECT_PLACEHOLDERS));
 
 	foreach(expressionCell, expressionList)
 	{
-		Expr *expression = (Expr *) lfirst(expressionCell);
+		Node *expression = (Node *) lfirst(expressionCell);
 
-		TargetEntry *targetEntry = makeTargetEntry(expression, -1, NULL, false);
-		targetEntryList = lappend(targetEntryList, targetEntry);
+		if (IsA(expression, Aggref))
+		{
+			aggregateList = list_append_unique(aggregateList, expression);
+		}
 	}
 
-	return targetEntryList;
+	foreach(expressionCell, aggregateList)
+	{
+		Expr *aggregate = (Expr *) lfirst(expressionCell);
+
+		targetList = lappend(targetList, makeTargetEntry(copyObject(aggregate),
+														 resultNumber++, NULL, false));
+	}
+
+	partialQuery->commandType = CMD_SELECT;
+	partialQuery->rtable = rangeTableList;
+	partialQuery->jointree = fromExpr;
+	partialQuery->targetList = targetList;
+	partialQuery->groupClause = groupClauseList;
+	partialQuery->hasAggs = true;
+
+	return partialQuery;
+}
+
+
+/*
+ * CombineAggregateQuery builds the local query which combines the results of
+ * the given partial aggregate query over all shards into the results of the
+ * original query. The local query reads the partial results from a function
+ * range table entry, whose scan is later replaced by a shard result scan. The
+ * distributed table is kept in the range table for permission checks only.
+ */
+static Query *
+CombineAggregateQuery(Query *query, Query *partialQuery)
+{
+	Query *combineQuery = copyObject(query);
+	RangeTblEntry *tableRangeTableEntry = NULL;
+	RangeTblEntry *resultRangeTableEntry = makeNode(RangeTblEntry);
+	RangeTblFunction *resultFunction = makeNode(RangeTblFunction);
+	RangeTblRef *resultReference = makeNode(RangeTblRef);
+	CombineAggregateContext context;
+	List *columnNameList = NIL;
+	ListCell *targetEntryCell = NULL;
+
+	memset(&context, 0, sizeof(context));
+	context.parseState = make_parsestate(NULL);
+	context.parseState->p_expr_kind = EXPR_KIND_SELECT_TARGET;
+
+	foreach(targetEntryCell, partialQuery->targetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Node *expression = (Node *) targetEntry->expr;
+		StringInfo columnName = makeStringInfo();
+
+		appendStringInfo(columnName, "column%d", targetEntry->resno);
+		columnNameList = lappend(columnNameList, makeString(columnName->data));
+
+		resultFunction->funccoltypes = lappend_oid(resultFunction->funccoltypes,
+												   exprType(expression));
+		resultFunction->funccoltypmods = lappend_int(resultFunction->funccoltypmods,
+													 exprTypmod(expression));
+		resultFunction->funccolcollations =
+			lappend_oid(resultFunction->funccolcollations, exprCollation(expression));
+
+		if (IsA(expression, Aggref))
+		{
+			context.aggregateList = lappend(context.aggregateList, expression);
+		}
+		else
+		{
+			context.groupColumnList = lappend(context.groupColumnList, expression);
+		}
+	}
+
+	/* the rows are never produced by this expression, see ReplaceFunctionScan */
+	resultFunction->funcexpr = (Node *) makeNullConst(RECORDOID, -1, InvalidOid);
+	resultFunction->funccolcount = list_length(partialQuery->targetList);
+
+	resultRangeTableEntry->rtekind = RTE_FUNCTION;
+	resultRangeTableEntry->functions = list_make1(resultFunction);
+	resultRangeTableEntry->eref = makeAlias("shard_result", columnNameList);
+	resultRangeTableEntry->inFromCl = true;
+
+	Assert(list_length(combineQuery->rtable) == 1);
+	tableRangeTableEntry = (RangeTblEntry *) linitial(combineQuery->rtable);
+	tableRangeTableEntry->inFromCl = false;
+	tableRangeTableEntry->inh = false;
+
+	/* the planner leaves the HAVING clause in implicit-AND format */
+	if (combineQuery->havingQual != NULL && IsA(combineQuery->havingQual, List))
+	{
+		combineQuery->havingQual = (Node *) make_ands_explicit(
+			(List *) combineQuery->havingQual);
+	}
+
+	resultReference->rtindex = 1;
+
+	combineQuery->rtable = list_make2(resultRangeTableEntry, tableRangeTableEntry);
+	combineQuery->jointree = makeFromExpr(list_make1(resultReference), NULL);
+	combineQuery->targetList = (List *) CombineAggregateMutator(
+		(Node *) combineQuery->targetList, &context);
+	combineQuery->havingQual = CombineAggregateMutator(combineQuery->havingQual,
+													   &context);
+
+	free_parsestate(context.parseState);
+
+	return combineQuery;
+}
+
+
+/*
+ * CombineAggregateMutator replaces the grouping columns of the original query
+ * with the corresponding columns of the partial results, and the aggregates
+ * with aggregates combining the partial ones. Counts are combined by summing
+ * them up; the result of the combining aggregate is cast back to the type of
+ * the original aggregate.
+ */
+static Node *
+CombineAggregateMutator(Node *node, CombineAggregateContext *context)
+{
+	int groupColumnCount = list_length(context->groupColumnList);
+
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Var) && ((Var *) node)->varlevelsup == 0)
+	{
+		Var *column = (Var *) node;
+		int columnIndex = ListMemberIndex(context->groupColumnList, node);
+
+		Assert(columnIndex >= 0);
+		return (Node *) makeVar(1, columnIndex + 1, column->vartype, column->vartypmod,
+								column->varcollid, 0);
+	}
+	else if (IsA(node, Aggref))
+	{
+		Aggref *aggregate = (Aggref *) node;
+		int aggregateIndex = ListMemberIndex(context->aggregateList, node);
+		char *aggregateName = get_func_name(aggregate->aggfnoid);
+		char *combineName = (strcmp(aggregateName, "count") == 0) ? "sum" : aggregateName;
+		Var *partialColumn = NULL;
+		Node *combineAggregate = NULL;
+		Node *combineExpression = NULL;
+
+		Assert(aggregateIndex >= 0);
+		partialColumn = makeVar(1, groupColumnCount + aggregateIndex + 1,
+								aggregate->aggtype, -1, aggregate->aggcollid, 0);
+
+		combineAggregate = ParseFuncOrColumn(context->parseState,
+											 list_make2(makeString("pg_catalog"),
+														makeString(combineName)),
+											 list_make1(partialColumn),
+											 makeFuncCall(NIL, NIL, -1), -1);
+		combineExpression = coerce_to_target_type(context->parseState, combineAggregate,
+												  exprType(combineAggregate),
+												  aggregate->aggtype, -1,
+												  COERCION_EXPLICIT,
+												  COERCE_IMPLICIT_CAST, -1);
+		if (combineExpression == NULL)
+		{
+			ereport(ERROR, (errmsg("could not combine partial results of %s",
+								   aggregateName)));
+		}
+
+		assign_expr_collations(context->parseState, combineExpression);
+
+		return combineExpression;
+	}
+
+	return expression_tree_mutator(node, CombineAggregateMutator, (void *) context);
+}
+
+
+/*
+ * ListMemberIndex returns the position of the first member of the list equal
+ * to the given node, or -1 if there is none.
+ */
+static int
+ListMemberIndex(List *list, Node *node)
+{
+	ListCell *cell = NULL;
+	int index = 0;
+
+	foreach(cell, list)
+	{
+		if (equal(lfirst(cell), node))
+		{
+			return index;
+		}
+
+		index++;
+	}
+
+	return -1;
+}
+
+#endif
+
+
+/*
+ * BuildLocalQuery returns a copy of query with its quals replaced by those
+ * in localRestrictList. Expects queries with a single entry in their FROM
+ * list.
+ */
+static Query *
+BuildLocalQuery(Query *query, List *localRestrictList)
+{
+	Query *localQuery = copyObject(query);
+	FromExpr *joinTree = localQuery->jointree;
+
+	Assert(joinTree != NULL);
+	Assert(list_length(joinTree->fromlist) == 1);
+	joinTree->quals = (Node *) make_ands_explicit((List *) localRestrictList);
+
+	return localQuery;
+}
+
+
+/*
+ * PlanSequentialScan attempts to plan the given query using only a sequential
+ * scan of the underlying table. The function disables index scan types and
+ * plans the query. If the plan still contains a non-sequential scan plan node,
+ * the function errors out. Note this function modifies the query parameter, so
+ * make a copy before calling PlanSequentialScan if that is unacceptable.
+ */
+static PlannedStmt *
+PlanSequentialScan(Query *query, int cursorOptions, ParamListInfo boundParams)
+{
+	PlannedStmt *sequentialScanPlan = NULL;
+	bool indexScanEnabledOldValue = false;
+	bool bitmapScanEnabledOldValue = false;
+	List *rangeTableList = NIL;
+	ListCell *rangeTableCell = NULL;
+
+	/* error out if the table is a foreign table */
+	ExtractRangeTableEntryWalker((Node *) query, &rangeTableList);
+
+	foreach(rangeTableCell, rangeTableList)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+		if (rangeTableEntry->rtekind == RTE_RELATION)
+		{
+			if (rangeTableEntry->relkind == RELKIND_FOREIGN_TABLE)
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("multi-shard SELECTs from foreign tables are "
+									   "unsupported")));
+			}
+		}
+	}
+
+	/* disable index scan types */
+	indexScanEnabledOldValue = enable_indexscan;
+	bitmapScanEnabledOldValue = enable_bitmapscan;
+
+	enable_indexscan = false;
+	enable_bitmapscan = false;
+
+	sequentialScanPlan = standard_planner(query, cursorOptions, boundParams);
+
+	enable_indexscan = indexScanEnabledOldValue;
+	enable_bitmapscan = bitmapScanEnabledOldValue;
+
+	return sequentialScanPlan;
+}
+
+
+#if PG_VERSION_NUM >= 90500
+
+/*
+ * ReplaceSequentialScan replaces the sequential scan in the given local plan of
+ * a multiple shard SELECT with a shard result scan of the same relation. The
+ * scan keeps the quals and target list of the sequential scan, so the local
+ * filters and the plan nodes above are evaluated on the rows as they arrive.
+ */
+static Plan *
+ReplaceSequentialScan(Plan *plan)
+{
+	if (plan == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(plan, SeqScan))
+	{
+		CustomScan *customScan = makeNode(CustomScan);
+
+		customScan->scan.plan = *plan;
+		customScan->scan.plan.type = T_CustomScan;
+		customScan->scan.scanrelid = ((Scan *) plan)->scanrelid;
+		customScan->methods = &ShardResultScanMethods;
+		customScan->custom_relids = bms_make_singleton(customScan->scan.scanrelid);
+
+		return (Plan *) customScan;
+	}
+
+	plan->lefttree = ReplaceSequentialScan(plan->lefttree);
+	plan->righttree = ReplaceSequentialScan(plan->righttree);
+
+	return plan;
+}
+
+
+/*
+ * ReplaceFunctionScan replaces the scan of the partial aggregate results in the
+ * given local plan of a multiple shard SELECT with a shard result scan. The
+ * partial results are returned as they are received, so the scan describes its
+ * tuples with a custom scan target list and references them as INDEX_VAR.
+ */
+static Plan *
+ReplaceFunctionScan(Plan *plan)
+{
+	if (plan == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(plan, FunctionScan))
+	{
+		FunctionScan *functionScan = (FunctionScan *) plan;
+		Index scanRangeTableIndex = functionScan->scan.scanrelid;
+		RangeTblFunction *resultFunction = linitial(functionScan->functions);
+		CustomScan *customScan = makeNode(CustomScan);
+		ListCell *typeCell = NULL;
+		ListCell *typeModifierCell = NULL;
+		ListCell *collationCell = NULL;
+		AttrNumber columnNumber = 1;
+
+		forthree(typeCell, resultFunction->funccoltypes,
+				 typeModifierCell, resultFunction->funccoltypmods,
+				 collationCell, resultFunction->funccolcollations)
+		{
+			Var *column = makeVar(scanRangeTableIndex, columnNumber, lfirst_oid(typeCell),
+								  lfirst_int(typeModifierCell),
+								  lfirst_oid(collationCell), 0);
+
+			customScan->custom_scan_tlist = lappend(customScan->custom_scan_tlist,
+													makeTargetEntry((Expr *) column,
+																	columnNumber,
+																	NULL, false));
+			columnNumber++;
+		}
+
+		customScan->scan.plan = *plan;
+		customScan->scan.plan.type = T_CustomScan;
+		customScan->scan.plan.targetlist = (List *) ScanColumnMutator(
+			(Node *) plan->targetlist, &scanRangeTableIndex);
+		customScan->scan.plan.qual = (List *) ScanColumnMutator((Node *) plan->qual,
+																&scanRangeTableIndex);
+		customScan->scan.scanrelid = 0;
+		customScan->methods = &ShardResultScanMethods;
+		customScan->custom_relids = bms_make_singleton(scanRangeTableIndex);
+
+		return (Plan *) customScan;
+	}
+
+	plan->lefttree = ReplaceFunctionScan(plan->lefttree);
+	plan->righttree = ReplaceFunctionScan(plan->righttree);
+
+	return plan;
 }
 
 
+/*
+ * ScanColumnMutator makes columns of the given scanned range table entry refer
+ * to the custom scan target list instead.
+ */
+static Node *
+ScanColumnMutator(Node *node, Index *scanRangeTableIndex)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Var) && ((Var *) node)->varno == *scanRangeTableIndex)
+	{
+		Var *column = (Var *) copyObject(node);
+		column->varno = INDEX_VAR;
+
+		return (Node *) column;
+	}
+
+	return expression_tree_mutator(node, ScanColumnMutator, (void *) scanRangeTableIndex);
+}
+
+#endif
+
+
+/*
+ * QueryRestrictList returns the restriction clauses for the query. For a SELECT
+ * statement these are the where-clause expressions. For INSERT statements we
+ * build an equality clause based on the partition-column and its supplied
+ * insert value.
+ */
+static List *
+QueryRestrictList(Query *query)
+{
+	List *queryRestrictList = NIL;
+	CmdType commandType = query->commandType;
+
+	if (commandType == CMD_INSERT)
+	{
+		/* build equality expression based on partition column value for row */
+		Oid distributedTableId = ExtractFirstDistributedTableId(query);
+		Var *partitionColumn = PartitionColumn(distributedTableId);
+		Const *partitionValue = ExtractPartitionValue(query, partitionColumn);
+
+		OpExpr *equalityExpr = PartitionValueRestriction(partitionColumn,
+														 partitionValue);
+
+		queryRestrictList = list_make1(equalityExpr);
+	}
+	else if (commandType == CMD_SELECT || commandType == CMD_UPDATE ||
+			 commandType == CMD_DELETE)
+	{
+		query_tree_walker(query, ExtractFromExpressionWalker, &queryRestrictList, 0);
+	}
+
+	return queryRestrictList;
+}
+
+
+/*
+ * ExtractPartitionValue extracts the partition column value from a the target
+ * of a modification command. If a partition value is missing altogether or is
+ * NULL, this function throws an error.
+ */
+static Const *
+ExtractPartitionValue(Query *query, Var *partitionColumn)
+{
+	Const *partitionValue = NULL;
+	TargetEntry *targetEntry = get_tle_by_resno(query->targetList,
+												partitionColumn->varattno);
+	if (targetEntry != NULL)
+	{
+		Assert(IsA(targetEntry->expr, Const));
+
+		partitionValue = (Const *) targetEntry->expr;
+	}
+
+	if (partitionValue == NULL || partitionValue->constisnull)
+	{
+		ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+						errmsg("cannot plan INSERT using row with NULL value "
+							   "in partition column")));
+	}
+
+	return partitionValue;
+}
+
+
+/*
+ * PartitionValueRestriction builds an equality clause restricting the partition
+ * column to the given value.
+ */
+static OpExpr *
+PartitionValueRestriction(Var *partitionColumn, Const *partitionValue)
+{
+	OpExpr *equalityExpr = MakeOpExpression(partitionColumn, BTEqualStrategyNumber);
+
+	Node *rightOp = get_rightop((Expr *) equalityExpr);
+	Const *rightConst = (Const *) rightOp;
+	Assert(IsA(rightOp, Const));
+
+	rightConst->constvalue = partitionValue->constvalue;
+	rightConst->constisnull = partitionValue->constisnull;
+	rightConst->constbyval = partitionValue->constbyval;
+
+	return equalityExpr;
+}
+
+
+/*
+ * MultiRowInsertValues returns the VALUES range table entry holding the rows
+ * of a multi-row INSERT and sets valuesRangeTableIndex to its position in the
+ * range table. For other queries, the function returns NULL.
+ */
+static RangeTblEntry *
+MultiRowInsertValues(Query *query, Index *valuesRangeTableIndex)
+{
+	ListCell *rangeTableCell = NULL;
+	Index rangeTableIndex = 1;
+
+	if (query->commandType != CMD_INSERT)
+	{
+		return NULL;
+	}
+
+	foreach(rangeTableCell, query->rtable)
+	{
+		RangeTblEntry *rangeTableEntry = (RangeTblEntry *) lfirst(rangeTableCell);
+
+		if (rangeTableEntry->rtekind == RTE_VALUES)
+		{
+			*valuesRangeTableIndex = rangeTableIndex;
+			return rangeTableEntry;
+		}
+
+		rangeTableIndex++;
+	}
+
+	return NULL;
+}
+
+
+/*
+ * BuildMultiRowInsertPlan routes each row of the given multi-row INSERT to its
+ * shard and creates a task for each shard which inserts all of its rows with
+ * a single statement. Every row must have a constant partition value and must
+ * go to exactly one shard.
+ */
+static DistributedPlan *
+BuildMultiRowInsertPlan(Query *query, RangeTblEntry *valuesRangeTableEntry,
+						Index valuesRangeTableIndex)
+{
+	DistributedPlan *distributedPlan = palloc0(sizeof(DistributedPlan));
+	Oid distributedTableId = ExtractFirstDistributedTableId(query);
+	Var *partitionColumn = PartitionColumn(distributedTableId);
+	TargetEntry *partitionEntry = get_tle_by_resno(query->targetList,
+												   partitionColumn->varattno);
+	List *shardIntervalList = LookupShardIntervalList(distributedTableId);
+	List *originalValuesLists = valuesRangeTableEntry->values_lists;
+	List *shardRowsList = NIL;
+	List *taskList = NIL;
+	ListCell *valuesListCell = NULL;
+	ListCell *shardRowsCell = NULL;
+	HTAB *shardRowsHash = NULL;
+	HASHCTL info;
+
+	if (shardIntervalList == NIL)
+	{
+		char *relationName = get_rel_name(distributedTableId);
+
+		ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+						errmsg("could not find any shards for query"),
+						errdetail("No shards exist for distributed table \"%s\".",
+								  relationName),
+						errhint("Run master_create_worker_shards to create shards "
+								"and try again.")));
+	}
+
+	memset(&info, 0, sizeof(info));
+	info.keysize = sizeof(int64);
+	info.entrysize = sizeof(ShardInsertRows);
+	info.hcxt = CurrentMemoryContext;
+
+	shardRowsHash = hash_create("pg_shard multi-row insert", 32, &info,
+								HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+
+	foreach(valuesListCell, originalValuesLists)
+	{
+		List *valuesList = (List *) lfirst(valuesListCell);
+		Node *partitionValue = NULL;
+		List *restrictClauseList = NIL;
+		List *prunedShardList = NIL;
+		ShardInterval *shardInterval = NULL;
+		ShardInsertRows *shardRows = NULL;
+		bool shardRowsFound = false;
+
+		if (partitionEntry != NULL)
+		{
+			Var *valuesColumn = (Var *) partitionEntry->expr;
+
+			partitionValue = (Node *) partitionEntry->expr;
+			if (IsA(valuesColumn, Var) && valuesColumn->varno == valuesRangeTableIndex)
+			{
+				partitionValue = list_nth(valuesList, valuesColumn->varattno - 1);
+			}
+
+			if (!IsA(partitionValue, Const))
+			{
+				ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+								errmsg("cannot plan sharded modification containing "
+									   "values which are not constants or constant "
+									   "expressions")));
+			}
+		}
+
+		if (partitionValue == NULL || ((Const *) partitionValue)->constisnull)
+		{
+			ereport(ERROR, (errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+							errmsg("cannot plan INSERT using row with NULL value "
+								   "in partition column")));
+		}
+
+		restrictClauseList = list_make1(PartitionValueRestriction(partitionColumn,
+																  (Const *) partitionValue));
+		prunedShardList = PruneShardList(distributedTableId, restrictClauseList,
+										 shardIntervalList);
+		if (prunedShardList == NIL)
+		{
+			ereport(ERROR, (errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+							errmsg("could not find destination shard for new row"),
+							errdetail("Target relation does not contain any shards "
+									  "capable of storing the new row.")));
+		}
+		else if (list_length(prunedShardList) > 1)
+		{
+			ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+							errmsg("cannot modify multiple shards during a single query")));
+		}
+
+		shardInterval = (ShardInterval *) linitial(prunedShardList);
+		shardRows = hash_search(shardRowsHash, &shardInterval->id, HASH_ENTER,
+								&shardRowsFound);
+		if (!shardRowsFound)
+		{
+			shardRows->valuesLists = NIL;
+			shardRowsList = lappend(shardRowsList, shardRows);
+		}
+
+		shardRows->valuesLists = lappend(shardRows->valuesLists, valuesList);
+	}
+
+	/* deparse the query with the rows of each shard in turn */
+	foreach(shardRowsCell, shardRowsList)
+	{
+		ShardInsertRows *shardRows = (ShardInsertRows *) lfirst(shardRowsCell);
+
+		valuesRangeTableEntry->values_lists = shardRows->valuesLists;
+		taskList = lappend(taskList, BuildShardTask(query, shardRows->shardId));
+	}
+
+	valuesRangeTableEntry->values_lists = originalValuesLists;
+	hash_destroy(shardRowsHash);
+
+	distributedPlan->plan.type = (NodeTag) T_DistributedPlan;
+	distributedPlan->targetList = query->targetList;
+	distributedPlan->taskList = taskList;
+	distributedPlan->multiRowInsert = true;
+
+	return distributedPlan;
+}
+
+
+/*
+ * ExtractFromExpressionWalker walks over a FROM expression, and finds all
+ * explicit qualifiers in the expression.
+ */
+static bool
+ExtractFromExpressionWalker(Node *node, List **qualifierList)
+{
+	bool walkIsComplete = false;
+	if (node == NULL)
+	{
+		return false;
+	}
+
+	if (IsA(node, FromExpr))
+	{
+		FromExpr *fromExpression = (FromExpr *) node;
+		List *fromQualifierList = (List *) fromExpression->quals;
+		(*qualifierList) = list_concat(*qualifierList, fromQualifierList);
+	}
+
+	walkIsComplete = expression_tree_walker(node, ExtractFromExpressionWalker,
+											(void *) qualifierList);
+
+	return walkIsComplete;
+}
+
+
+/*
+ * QueryFromList creates the from list construct that is used for building the
+ * query's join tree. The function creates the from list by making a range table
+ * reference for each entry in the given range table list.
+ */
+static List *
+QueryFromList(List *rangeTableList)
+{
+	List *fromList = NIL;
+	Index rangeTableIndex = 1;
+	uint32 rangeTableCount = (uint32) list_length(rangeTableList);
+
+	for (rangeTableIndex = 1; rangeTableIndex <= rangeTableCount; rangeTableIndex++)
+	{
+		RangeTblRef *rangeTableReference = makeNode(RangeTblRef);
+		rangeTableReference->rtindex = rangeTableIndex;
+
+		fromList = lappend(fromList, rangeTableReference);
+	}
+
+	return fromList;
+}
+
+
+/*
+ * TargetEntryList creates a target entry for each expression in the given list,
+ * and returns the newly created target entries in a list.
+ */
+static List *
+TargetEntryList(List *expressionList)
+{
+	List *targetEntryList = NIL;
+	ListCell *expressionCell = NULL;
+
+	foreach(expressionCell, expressionList)
+	{
+		Expr *expression = (Expr *) lfirst(expressionCell);
+
+		TargetEntry *targetEntry = makeTargetEntry(expression, -1, NULL, false);
+		targetEntryList = lappend(targetEntryList, targetEntry);
+	}
+
+	return targetEntryList;
+}
+
+
+#if PG_VERSION_NUM < 90500
+
 /*
  * CreateTemporaryTableLikeStmt returns a CreateStmt node which will create a
  * clone of the given relation using the CREATE TEMPORARY TABLE LIKE option.
@@ -1174,10 +2157,13 @@ CreateTemporaryTableLikeStmt(Oid sourceRelationId)
 	return createStmt;
 }
 
+#endif
+
 
 /*
  * BuildDistributedPlan simply creates the DistributedPlan instance from the
- * provided query and shard interval list.
+ * provided query and shard interval list. A query which runs on a single shard
+ * also gets a parameterized form, so that it can run as a prepared statement.
  */
 static DistributedPlan *
 BuildDistributedPlan(Query *query, List *shardIntervalList)
@@ -1191,51 +2177,169 @@ BuildDistributedPlan(Query *query, List *shardIntervalList)
 	foreach(shardIntervalCell, shardIntervalList)
 	{
 		ShardInterval *shardInterval = (ShardInterval *) lfirst(shardIntervalCell);
-		int64 shardId = shardInterval->id;
-		List *finalizedPlacementList = NIL;
-		FromExpr *joinTree = NULL;
-		Task *task = NULL;
-		StringInfo queryString = makeStringInfo();
+		Task *task = BuildShardTask(query, shardInterval->id);
+
+		if (UsePreparedStatements && list_length(shardIntervalList) == 1)
+		{
+			ParameterizeShardTask(task, query);
+		}
+
+		taskList = lappend(taskList, task);
+	}
+
+	distributedPlan->taskList = taskList;
 
-		/* grab shared metadata lock to stop concurrent placement additions */
-		LockShardDistributionMetadata(shardId, ShareLock);
+	return distributedPlan;
+}
 
-		/* now safe to populate placement list */
-		finalizedPlacementList = LoadFinalizedShardPlacementList(shardId);
 
-		/*
-		 * Convert the qualifiers to an explicitly and'd clause, which is needed
-		 * before we deparse the query. This applies to SELECT, UPDATE and
-		 * DELETE statements.
-		 */
-		joinTree = query->jointree;
-		if ((joinTree != NULL) && (joinTree->quals != NULL))
+/*
+ * BuildShardTask creates the task which runs the given query on the placements
+ * of the given shard.
+ */
+static Task *
+BuildShardTask(Query *query, int64 shardId)
+{
+	List *finalizedPlacementList = NIL;
+	FromExpr *joinTree = NULL;
+	Task *task = NULL;
+	StringInfo queryString = makeStringInfo();
+
+	/* grab shared metadata lock to stop concurrent placement additions */
+	LockShardDistributionMetadata(shardId, ShareLock);
+
+	/* now safe to populate placement list */
+	finalizedPlacementList = LoadFinalizedShardPlacementList(shardId);
+
+	/*
+	 * Convert the qualifiers to an explicitly and'd clause, which is needed
+	 * before we deparse the query. This applies to SELECT, UPDATE and
+	 * DELETE statements.
+	 */
+	joinTree = query->jointree;
+	if ((joinTree != NULL) && (joinTree->quals != NULL))
+	{
+		Node *whereClause = joinTree->quals;
+		if (IsA(whereClause, List))
 		{
-			Node *whereClause = joinTree->quals;
-			if (IsA(whereClause, List))
-			{
-				joinTree->quals = (Node *) make_ands_explicit((List *) whereClause);
-			}
+			joinTree->quals = (Node *) make_ands_explicit((List *) whereClause);
 		}
+	}
 
-		deparse_shard_query(query, shardId, queryString);
+	deparse_shard_query(query, shardId, queryString);
 
-		if (LogDistributedStatements)
+	if (LogDistributedStatements)
+	{
+		ereport(LOG, (errmsg("distributed statement: %s", queryString->data)));
+	}
+
+	task = (Task *) palloc0(sizeof(Task));
+	task->queryString = queryString;
+	task->taskPlacementList = finalizedPlacementList;
+	task->shardId = shardId;
+
+	return task;
+}
+
+
+/*
+ * ParameterizeShardTask replaces the constants of the given task's query with
+ * parameters, and stores the resulting query string along with the types and
+ * text values of the parameters in the task. The worker node can then prepare
+ * the query once and reuse its plan for other constant values. Tasks whose
+ * query has no constants to replace are left unchanged.
+ */
+static void
+ParameterizeShardTask(Task *task, Query *query)
+{
+	ShardQueryParameters parameters = { NIL, NIL };
+	Query *parameterizedQuery = NULL;
+	StringInfo parameterizedQueryString = NULL;
+	int parameterCount = 0;
+	int parameterIndex = 0;
+	ListCell *parameterTypeCell = NULL;
+	ListCell *parameterValueCell = NULL;
+
+	parameterizedQuery = query_tree_mutator(query, ConstToParamMutator, &parameters, 0);
+
+	parameterCount = list_length(parameters.parameterTypeList);
+	if (parameterCount == 0)
+	{
+		return;
+	}
+
+	parameterizedQueryString = makeStringInfo();
+	deparse_shard_query(parameterizedQuery, task->shardId, parameterizedQueryString);
+
+	task->parameterizedQueryString = parameterizedQueryString;
+	task->parameterCount = parameterCount;
+	task->parameterTypes = palloc0(parameterCount * sizeof(Oid));
+	task->parameterValues = palloc0(parameterCount * sizeof(char *));
+
+	forboth(parameterTypeCell, parameters.parameterTypeList,
+			parameterValueCell, parameters.parameterValueList)
+	{
+		task->parameterTypes[parameterIndex] = lfirst_oid(parameterTypeCell);
+		task->parameterValues[parameterIndex] = (char *) lfirst(parameterValueCell);
+		parameterIndex++;
+	}
+}
+
+
+/*
+ * ConstToParamMutator replaces each non-null constant of a built-in type with
+ * an external parameter, and records the parameter's type and value in text
+ * format. Constants of other types are kept, as the worker may assign their
+ * types different oids.
+ */
+static Node *
+ConstToParamMutator(Node *node, ShardQueryParameters *parameters)
+{
+	if (node == NULL)
+	{
+		return NULL;
+	}
+
+	if (IsA(node, Const))
+	{
+		Const *constant = (Const *) node;
+		Oid constantType = constant->consttype;
+		Param *parameter = NULL;
+		Oid outputFunctionId = InvalidOid;
+		bool typeVarLength = false;
+		char *parameterValue = NULL;
+
+		if (constant->constisnull || constantType >= FirstNormalObjectId ||
+			constantType == UNKNOWNOID || get_typtype(constantType) == TYPTYPE_PSEUDO)
 		{
-			ereport(LOG, (errmsg("distributed statement: %s", queryString->data)));
+			return (Node *) copyObject(constant);
 		}
 
-		task = (Task *) palloc0(sizeof(Task));
-		task->queryString = queryString;
-		task->taskPlacementList = finalizedPlacementList;
-		task->shardId = shardId;
+		getTypeOutputInfo(constantType, &outputFunctionId, &typeVarLength);
+		parameterValue = OidOutputFunctionCall(outputFunctionId, constant->constvalue);
 
-		taskList = lappend(taskList, task);
-	}
+		parameters->parameterTypeList = lappend_oid(parameters->parameterTypeList,
+													constantType);
+		parameters->parameterValueList = lappend(parameters->parameterValueList,
+												 parameterValue);
 
-	distributedPlan->taskList = taskList;
+		parameter = makeNode(Param);
+		parameter->paramkind = PARAM_EXTERN;
+		parameter->paramid = list_length(parameters->parameterTypeList);
+		parameter->paramtype = constantType;
+		parameter->paramtypmod = constant->consttypmod;
+		parameter->paramcollid = constant->constcollid;
+		parameter->location = constant->location;
+
+		return (Node *) parameter;
+	}
+	else if (IsA(node, Query))
+	{
+		return (Node *) query_tree_mutator((Query *) node, ConstToParamMutator,
+										   parameters, 0);
+	}
 
-	return distributedPlan;
+	return expression_tree_mutator(node, ConstToParamMutator, parameters);
 }
 
 
@@ -1307,6 +2411,20 @@ PgShardExecutorStart(QueryDesc *queryDesc, int eflags)
 		}
 		else
 		{
+#if PG_VERSION_NUM >= 90500
+
+			/*
+			 * If its a SELECT query over multiple shards, the custom scan in the
+			 * local plan executes the remote queries and returns their rows.
+			 * It finds the distributed plan when it is initialized.
+			 */
+			plannedStatement->planTree = distributedPlan->originalPlan;
+
+			StartingDistributedPlan = distributedPlan;
+			NextExecutorStartHook(queryDesc, eflags);
+			StartingDistributedPlan = NULL;
+#else
+
 			/*
 			 * If its a SELECT query over multiple shards, we fetch the relevant
 			 * data from the remote nodes and insert it into a temp table. We then
@@ -1348,6 +2466,7 @@ PgShardExecutorStart(QueryDesc *queryDesc, int eflags)
 			plannedStatement->planTree = originalPlan;
 
 			NextExecutorStartHook(queryDesc, eflags);
+#endif
 		}
 	}
 	else
@@ -1482,52 +2601,621 @@ CompareTasksByShardId(const void *leftElement, const void *rightElement)
 }
 
 
+#if PG_VERSION_NUM < 90500
+
+/*
+ * ExecuteMultipleShardSelect executes the SELECT queries in the distributed
+ * plan and inserts the returned rows into the given tableId as each of the
+ * concurrently executed tasks completes.
+ */
+static void
+ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
+						   RangeVar *intermediateTable)
+{
+	List *targetList = distributedPlan->targetList;
+
+	/* ExecType instead of ExecCleanType so we don't ignore junk columns */
+	TupleDesc tupleStoreDescriptor = ExecTypeFromTL(targetList, false);
+
+	MultiShardExecution *multiShardExecution =
+		BeginMultiShardExecution(distributedPlan->taskList, tupleStoreDescriptor);
+	TaskExecution *execution = NULL;
+
+	while ((execution = NextCompletedTask(multiShardExecution)) != NULL)
+	{
+		/*
+		 * We successfully fetched data into local tuplestore. Now move results
+		 * from the tupleStore into the table.
+		 */
+		TupleStoreToTable(intermediateTable, targetList, tupleStoreDescriptor,
+						  execution->tupleStore);
+
+		tuplestore_end(execution->tupleStore);
+		execution->tupleStore = NULL;
+	}
+
+	EndMultiShardExecution(multiShardExecution);
+}
+
+#endif
+
+
+#if PG_VERSION_NUM >= 90500
+
+/*
+ * CreateShardResultScanState creates the executor state of a shard result scan
+ * for the distributed plan being started.
+ */
+static Node *
+CreateShardResultScanState(CustomScan *customScan)
+{
+	ShardResultScanState *scanState = palloc0(sizeof(ShardResultScanState));
+
+	if (StartingDistributedPlan == NULL)
+	{
+		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						errmsg("could not find distributed plan of shard result scan"),
+						errdetail("Multiple shard SELECT plans cannot be reused.")));
+	}
+
+	NodeSetTag(scanState, T_CustomScanState);
+	scanState->customScanState.methods = &ShardResultScanExecMethods;
+	scanState->distributedPlan = StartingDistributedPlan;
+
+	return (Node *) scanState;
+}
+
+
+/*
+ * BeginShardResultScan sends the remote queries of the scan's distributed plan
+ * unless the plan is only explained.
+ */
+static void
+BeginShardResultScan(CustomScanState *node, EState *estate, int eflags)
+{
+	ShardResultScanState *scanState = (ShardResultScanState *) node;
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	CustomScan *customScan = (CustomScan *) node->ss.ps.plan;
+
+	/* ExecType instead of ExecCleanType so we don't ignore junk columns */
+	TupleDesc remoteTupleDescriptor = ExecTypeFromTL(distributedPlan->targetList, false);
+
+	scanState->remoteSlot = ExecInitExtraTupleSlot(estate);
+	ExecSetSlotDescriptor(scanState->remoteSlot, remoteTupleDescriptor);
+
+	/* partial aggregate results are scanned in the form they are received */
+	scanState->returnRemoteRows = (customScan->custom_scan_tlist != NIL);
+
+	if ((eflags & EXEC_FLAG_EXPLAIN_ONLY) == 0)
+	{
+		scanState->multiShardExecution =
+			BeginMultiShardExecution(distributedPlan->taskList, remoteTupleDescriptor);
+	}
+}
+
+
+/*
+ * ExecShardResultScan returns the next row of the scan which passes its quals,
+ * projected as needed.
+ */
+static TupleTableSlot *
+ExecShardResultScan(CustomScanState *node)
+{
+	return ExecScan(&node->ss, ShardResultScanNext, ShardResultScanRecheck);
+}
+
+
+/*
+ * ShardResultScanNext returns the next row received from the remote nodes. The
+ * rows of a task are returned once the task completes, so that a task retried
+ * on another placement never returns a row twice. The row is stored in the
+ * scan slot at the attribute locations given by the remote query's target
+ * list, with the columns not fetched set to null. Partial aggregate results
+ * are returned as received.
+ */
+static TupleTableSlot *
+ShardResultScanNext(ScanState *node)
+{
+	ShardResultScanState *scanState = (ShardResultScanState *) node;
+	TupleTableSlot *scanSlot = node->ss_ScanTupleSlot;
+	TupleTableSlot *remoteSlot = scanState->remoteSlot;
+	List *remoteTargetList = scanState->distributedPlan->targetList;
+	int scanColumnCount = scanSlot->tts_tupleDescriptor->natts;
+	ListCell *targetEntryCell = NULL;
+	int remoteColumnIndex = 0;
+
+	ExecClearTuple(scanSlot);
+
+	for (;;)
+	{
+		TaskExecution *execution = scanState->currentExecution;
+
+		if (execution != NULL &&
+			tuplestore_gettupleslot(execution->tupleStore, true, false, remoteSlot))
+		{
+			break;
+		}
+
+		if (execution != NULL)
+		{
+			tuplestore_end(execution->tupleStore);
+			execution->tupleStore = NULL;
+		}
+
+		if (scanState->multiShardExecution == NULL)
+		{
+			return scanSlot;
+		}
+
+		execution = NextCompletedTask(scanState->multiShardExecution);
+		scanState->currentExecution = execution;
+		if (execution == NULL)
+		{
+			return scanSlot;
+		}
+	}
+
+	if (scanState->returnRemoteRows)
+	{
+		return remoteSlot;
+	}
+
+	slot_getallattrs(remoteSlot);
+
+	/* set all values to null for the scan tuple */
+	memset(scanSlot->tts_isnull, true, scanColumnCount * sizeof(bool));
+
+	foreach(targetEntryCell, remoteTargetList)
+	{
+		TargetEntry *targetEntry = (TargetEntry *) lfirst(targetEntryCell);
+		Expr *expression = targetEntry->expr;
+		int scanColumnId = 0;
+
+		/* special case for count(*) as we expect a NULL const */
+		if (IsA(expression, Const))
+		{
+			Const *constValue PG_USED_FOR_ASSERTS_ONLY = (Const *) expression;
+			Assert(constValue->consttype == UNKNOWNOID);
+		}
+		else
+		{
+			Assert(IsA(expression, Var));
+			scanColumnId = ((Var *) expression)->varattno;
+
+			scanSlot->tts_values[scanColumnId - 1] =
+				remoteSlot->tts_values[remoteColumnIndex];
+			scanSlot->tts_isnull[scanColumnId - 1] =
+				remoteSlot->tts_isnull[remoteColumnIndex];
+		}
+
+		remoteColumnIndex++;
+	}
+
+	return ExecStoreVirtualTuple(scanSlot);
+}
+
+
+/*
+ * ShardResultScanRecheck is never asked to recheck anything, as the scan is not
+ * used below locking or EvalPlanQual.
+ */
+static bool
+ShardResultScanRecheck(ScanState *node, TupleTableSlot *slot)
+{
+	return true;
+}
+
+
+/*
+ * EndShardResultScan ends the execution of the remote queries.
+ */
+static void
+EndShardResultScan(CustomScanState *node)
+{
+	ShardResultScanState *scanState = (ShardResultScanState *) node;
+
+	if (scanState->currentExecution != NULL &&
+		scanState->currentExecution->tupleStore != NULL)
+	{
+		tuplestore_end(scanState->currentExecution->tupleStore);
+		scanState->currentExecution->tupleStore = NULL;
+	}
+	scanState->currentExecution = NULL;
+
+	if (scanState->multiShardExecution != NULL)
+	{
+		EndMultiShardExecution(scanState->multiShardExecution);
+		scanState->multiShardExecution = NULL;
+	}
+}
+
+
+/*
+ * ReScanShardResultScan starts the remote queries over again, since the rows
+ * of completed tasks are not kept.
+ */
+static void
+ReScanShardResultScan(CustomScanState *node)
+{
+	ShardResultScanState *scanState = (ShardResultScanState *) node;
+	DistributedPlan *distributedPlan = scanState->distributedPlan;
+	bool executing = (scanState->multiShardExecution != NULL);
+
+	EndShardResultScan(node);
+	ExecScanReScan(&node->ss);
+
+	if (executing)
+	{
+		scanState->multiShardExecution =
+			BeginMultiShardExecution(distributedPlan->taskList,
+									 scanState->remoteSlot->tts_tupleDescriptor);
+	}
+}
+
+#endif
+
+
+/*
+ * BeginMultiShardExecution prepares the concurrent execution of the given
+ * SELECT tasks. The queries are sent to all nodes up front and results are
+ * collected from whichever node answers first, so the query takes about as
+ * long as the slowest shard rather than the sum of all of them. Tasks placed
+ * on the same node share its cached connection and run one after another.
+ */
+static MultiShardExecution *
+BeginMultiShardExecution(List *taskList, TupleDesc tupleDescriptor)
+{
+	MultiShardExecution *multiShardExecution = palloc0(sizeof(MultiShardExecution));
+	int taskCount = list_length(taskList);
+	int taskIndex = 0;
+	ListCell *taskCell = NULL;
+	List *placementList = NIL;
+
+	multiShardExecution->executionArray = palloc0(taskCount * sizeof(TaskExecution));
+	multiShardExecution->taskCount = taskCount;
+	multiShardExecution->pollFDArray = palloc0(taskCount * sizeof(struct pollfd));
+	multiShardExecution->pollTaskIndexArray = palloc0(taskCount * sizeof(int));
+	multiShardExecution->attributeInputMetadata = TupleDescGetAttInMetadata(tupleDescriptor);
+	multiShardExecution->columnArray = palloc0(tupleDescriptor->natts * sizeof(char *));
+	multiShardExecution->binaryResults = UseBinaryResults &&
+										 BinaryResultsSupported(tupleDescriptor);
+	if (multiShardExecution->binaryResults)
+	{
+		int columnCount = tupleDescriptor->natts;
+		int columnIndex = 0;
+
+		multiShardExecution->receiveFunctionArray = palloc0(columnCount *
+															sizeof(FmgrInfo));
+		multiShardExecution->typeIOParamArray = palloc0(columnCount * sizeof(Oid));
+		multiShardExecution->columnValueArray = palloc0(columnCount * sizeof(Datum));
+		multiShardExecution->columnNullArray = palloc0(columnCount * sizeof(bool));
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			Oid receiveFunctionId = InvalidOid;
+
+			getTypeBinaryInputInfo(tupleDescriptor->attrs[columnIndex]->atttypid,
+								   &receiveFunctionId,
+								   &multiShardExecution->typeIOParamArray[columnIndex]);
+			fmgr_info(receiveFunctionId,
+					  &multiShardExecution->receiveFunctionArray[columnIndex]);
+		}
+	}
+	multiShardExecution->ioContext = AllocSetContextCreate(CurrentMemoryContext,
+														   "MultiShardExecution",
+														   ALLOCSET_DEFAULT_MINSIZE,
+														   ALLOCSET_DEFAULT_INITSIZE,
+														   ALLOCSET_DEFAULT_MAXSIZE);
+
+	DtmTwoPhaseCommit = IsTransactionBlock();
+
+	/*
+	 * Connect to the nodes the tasks start on in parallel. Distributed
+	 * transactions need connections to all placements.
+	 */
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		if (UseDtmTransactions)
+		{
+			placementList = list_concat(placementList,
+										list_copy(task->taskPlacementList));
+		}
+		else if (task->taskPlacementList != NIL)
+		{
+			placementList = lappend(placementList,
+									linitial(task->taskPlacementList));
+		}
+	}
+
+	OpenConnections(placementList);
+
+	foreach(taskCell, taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+		TaskExecution *execution = &multiShardExecution->executionArray[taskIndex++];
+
+		if (UseDtmTransactions)
+		{
+			PrepareDtmTransaction(task);
+		}
+
+		execution->task = task;
+		execution->placementCell = list_head(task->taskPlacementList);
+		execution->tupleStore = tuplestore_begin_heap(false, false, work_mem);
+	}
+
+	return multiShardExecution;
+}
+
+
+/*
+ * NextCompletedTask waits until one more task of the execution receives all of
+ * its results and returns it. The caller takes over the task's tuple-store and
+ * should end it. If all tasks have been returned, the function returns NULL.
+ * If a task fails on all of its placements, the function errors out; queries
+ * left running on the other connections are dealt with by GetConnection.
+ */
+static TaskExecution *
+NextCompletedTask(MultiShardExecution *multiShardExecution)
+{
+	TaskExecution *executionArray = multiShardExecution->executionArray;
+	int taskCount = multiShardExecution->taskCount;
+	struct pollfd *pollFDArray = multiShardExecution->pollFDArray;
+	int *pollTaskIndexArray = multiShardExecution->pollTaskIndexArray;
+
+	while (multiShardExecution->returnedTaskCount < taskCount)
+	{
+		int taskIndex = 0;
+		int pollCount = 0;
+		int pollIndex = 0;
+		int pollResult = 0;
+
+		/* send queries of the tasks which are not running yet */
+		for (taskIndex = 0; taskIndex < taskCount; taskIndex++)
+		{
+			TaskExecution *execution = &executionArray[taskIndex];
+
+			if (!execution->completed && execution->connection == NULL)
+			{
+				StartTaskExecution(multiShardExecution, execution);
+			}
+
+			if (execution->connection != NULL)
+			{
+				pollFDArray[pollCount].fd = PQsocket(execution->connection);
+				pollFDArray[pollCount].events = POLLIN;
+				pollFDArray[pollCount].revents = 0;
+				pollTaskIndexArray[pollCount] = taskIndex;
+				pollCount++;
+			}
+		}
+
+		Assert(pollCount > 0);
+		pollResult = poll(pollFDArray, pollCount, RESULT_POLL_TIMEOUT_MSEC);
+		if (pollResult < 0 && errno != EINTR)
+		{
+			ereport(ERROR, (errcode_for_socket_access(),
+							errmsg("could not wait for query results: %m")));
+		}
+
+		CHECK_FOR_INTERRUPTS();
+
+		for (pollIndex = 0; pollResult > 0 && pollIndex < pollCount; pollIndex++)
+		{
+			TaskExecution *execution = NULL;
+
+			if (pollFDArray[pollIndex].revents == 0)
+			{
+				continue;
+			}
+
+			execution = &executionArray[pollTaskIndexArray[pollIndex]];
+			if (!ReceiveTaskResults(multiShardExecution, execution))
+			{
+				/* retry the task on the next placement */
+				tuplestore_clear(execution->tupleStore);
+				PurgeConnection(execution->connection);
+				execution->connection = NULL;
+				execution->placementCell = lnext(execution->placementCell);
+			}
+			else if (execution->completed)
+			{
+				/* other ready sockets are still readable on the next call */
+				execution->connection = NULL;
+				multiShardExecution->returnedTaskCount++;
+
+				return execution;
+			}
+		}
+	}
+
+	return NULL;
+}
+
+
+/*
+ * EndMultiShardExecution releases the resources of the execution. Queries
+ * which are still running, as happens when a LIMIT stops the scan early, are
+ * allowed to finish so that the cached connections remain usable.
+ */
+static void
+EndMultiShardExecution(MultiShardExecution *multiShardExecution)
+{
+	int taskIndex = 0;
+
+	for (taskIndex = 0; taskIndex < multiShardExecution->taskCount; taskIndex++)
+	{
+		TaskExecution *execution = &multiShardExecution->executionArray[taskIndex];
+
+		if (execution->connection != NULL)
+		{
+			AbandonTaskExecution(execution);
+		}
+
+		if (execution->tupleStore != NULL)
+		{
+			tuplestore_end(execution->tupleStore);
+			execution->tupleStore = NULL;
+		}
+	}
+
+	MemoryContextDelete(multiShardExecution->ioContext);
+}
+
+
+/*
+ * NodeBusy returns whether a query of another task of the execution is running
+ * on the node of the given placement.
+ */
+static bool
+NodeBusy(MultiShardExecution *multiShardExecution, ShardPlacement *taskPlacement)
+{
+	int taskIndex = 0;
+
+	for (taskIndex = 0; taskIndex < multiShardExecution->taskCount; taskIndex++)
+	{
+		TaskExecution *execution = &multiShardExecution->executionArray[taskIndex];
+		ShardPlacement *runningPlacement = NULL;
+
+		if (execution->connection == NULL)
+		{
+			continue;
+		}
+
+		runningPlacement = (ShardPlacement *) lfirst(execution->placementCell);
+		if (runningPlacement->nodePort == taskPlacement->nodePort &&
+			strncmp(runningPlacement->nodeName, taskPlacement->nodeName,
+					MAX_NODE_LENGTH) == 0)
+		{
+			return true;
+		}
+	}
+
+	return false;
+}
+
+
 /*
- * ExecuteMultipleShardSelect executes the SELECT queries in the distributed
- * plan and inserts the returned rows into the given tableId.
+ * StartTaskExecution sends the query of the given task to its current
+ * placement, moving on to the next placements if it fails. If the node is busy
+ * with another task of the same query, the task is left to wait for it. The
+ * function errors out if no placements are left.
  */
 static void
-ExecuteMultipleShardSelect(DistributedPlan *distributedPlan,
-						   RangeVar *intermediateTable)
+StartTaskExecution(MultiShardExecution *multiShardExecution, TaskExecution *execution)
 {
-	List *taskList = distributedPlan->taskList;
-	List *targetList = distributedPlan->targetList;
+	Task *task = execution->task;
 
-	/* ExecType instead of ExecCleanType so we don't ignore junk columns */
-	TupleDesc tupleStoreDescriptor = ExecTypeFromTL(targetList, false);
+	while (execution->placementCell != NULL)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(execution->placementCell);
+		char *nodeName = taskPlacement->nodeName;
+		int32 nodePort = taskPlacement->nodePort;
+		PGconn *connection = NULL;
+		bool queryOK = false;
 
-	ListCell *taskCell = NULL;
+		if (NodeBusy(multiShardExecution, taskPlacement))
+		{
+			/* wait until the node completes the other task */
+			return;
+		}
 
-	DtmTwoPhaseCommit = IsTransactionBlock();
+		connection = GetConnection(nodeName, nodePort, !UseDtmTransactions);
+		if (connection == NULL)
+		{
+			execution->placementCell = lnext(execution->placementCell);
+			continue;
+		}
 
-	foreach(taskCell, taskList)
+		queryOK = SendQueryInSingleRowMode(connection, task,
+										   multiShardExecution->binaryResults);
+		if (queryOK)
+		{
+			execution->connection = connection;
+			return;
+		}
+
+		PurgeConnection(connection);
+		execution->placementCell = lnext(execution->placementCell);
+	}
+
+	ereport(ERROR, (errmsg("could not receive query results")));
+}
+
+
+/*
+ * ReceiveTaskResults reads the results which are available on the connection
+ * of the given task without blocking and stores them in the task's
+ * tuple-store. The task is marked completed once all results are received.
+ * If the task fails, the function returns false.
+ */
+static bool
+ReceiveTaskResults(MultiShardExecution *multiShardExecution, TaskExecution *execution)
+{
+	PGconn *connection = execution->connection;
+
+	if (PQconsumeInput(connection) == 0)
 	{
-		Task *task = (Task *) lfirst(taskCell);
-		Tuplestorestate *tupleStore = tuplestore_begin_heap(false, false, work_mem);
-		bool resultsOK = false;
+		ReportRemoteError(connection, NULL);
+		return false;
+	}
 
-		if (UseDtmTransactions)
+	while (PQisBusy(connection) == 0)
+	{
+		ExecStatusType resultStatus = 0;
+
+		PGresult *result = PQgetResult(connection);
+		if (result == NULL)
 		{
-			PrepareDtmTransaction(task);
+			execution->completed = true;
+			break;
 		}
 
-		resultsOK = ExecuteTaskAndStoreResults(task, tupleStoreDescriptor, tupleStore);
-		if (!resultsOK)
+		resultStatus = PQresultStatus(result);
+		if ((resultStatus != PGRES_SINGLE_TUPLE) && (resultStatus != PGRES_TUPLES_OK))
 		{
-			ereport(ERROR, (errmsg("could not receive query results")));
+			ReportRemoteError(connection, result);
+			PQclear(result);
+
+			return false;
 		}
 
-		/*
-		 * We successfully fetched data into local tuplestore. Now move results from
-		 * the tupleStore into the table.
-		 */
-		Assert(tupleStore != NULL);
-		TupleStoreToTable(intermediateTable, targetList, tupleStoreDescriptor,
-						  tupleStore);
+		if (multiShardExecution->binaryResults)
+		{
+			StoreBinaryResultTuples(result, multiShardExecution, execution->tupleStore);
+		}
+		else
+		{
+			StoreResultTuples(result, multiShardExecution->attributeInputMetadata,
+							  multiShardExecution->columnArray,
+							  multiShardExecution->ioContext, execution->tupleStore);
+		}
+		PQclear(result);
+	}
 
-		tuplestore_end(tupleStore);
+	return true;
+}
+
+
+/*
+ * AbandonTaskExecution discards the remaining results of the task's query. The
+ * query is not cancelled, as a late cancel request could hit the next query on
+ * the connection and would abort a distributed transaction.
+ */
+static void
+AbandonTaskExecution(TaskExecution *execution)
+{
+	PGconn *connection = execution->connection;
+	PGresult *result = NULL;
+
+	while ((result = PQgetResult(connection)) != NULL)
+	{
+		PQclear(result);
 	}
-	
+
+	execution->connection = NULL;
 }
 
 
@@ -1562,7 +3250,7 @@ ExecuteTaskAndStoreResults(Task *task, TupleDesc tupleDescriptor,
 			continue;
 		}
 
-		queryOK = SendQueryInSingleRowMode(connection, task->queryString);
+		queryOK = SendQueryInSingleRowMode(connection, task, false);
 		if (!queryOK)
 		{
 			PurgeConnection(connection);
@@ -1587,17 +3275,18 @@ ExecuteTaskAndStoreResults(Task *task, TupleDesc tupleDescriptor,
 
 
 /*
- * SendQueryInSingleRowMode sends the given query on the connection in an
- * asynchronous way. The function also sets the single-row mode on the
- * connection so that we receive results a row at a time.
+ * SendQueryInSingleRowMode sends the given task's query on the connection in
+ * an asynchronous way. The function also sets the single-row mode on the
+ * connection so that we receive results a row at a time. If binaryResults is
+ * set, the results are requested in binary format.
  */
 static bool
-SendQueryInSingleRowMode(PGconn *connection, StringInfo query)
+SendQueryInSingleRowMode(PGconn *connection, Task *task, bool binaryResults)
 {
 	int querySent = 0;
 	int singleRowMode = 0;
 
-	querySent = PQsendQuery(connection, query->data);
+	querySent = SendTaskQuery(connection, task, binaryResults);
 	if (querySent == 0)
 	{
 		ReportRemoteError(connection, NULL);
@@ -1615,6 +3304,215 @@ SendQueryInSingleRowMode(PGconn *connection, StringInfo query)
 }
 
 
+/*
+ * SendTaskQuery sends the given task's query on the connection without waiting
+ * for its results, and returns the result of the libpq send call. If the task
+ * has a parameterized query, the query runs as a statement prepared on the
+ * connection; the statement is prepared when the connection first sees the
+ * query. Otherwise, or if the statement cannot be prepared, the query string
+ * is sent as it is.
+ */
+static int
+SendTaskQuery(PGconn *connection, Task *task, bool binaryResults)
+{
+	int resultFormat = binaryResults ? 1 : 0;
+	char *statementName = NULL;
+
+	if (UsePreparedStatements && task->parameterizedQueryString != NULL)
+	{
+		statementName = PreparedStatementName(connection,
+											  task->parameterizedQueryString->data,
+											  task->parameterCount,
+											  task->parameterTypes);
+	}
+
+	if (statementName != NULL)
+	{
+		return PQsendQueryPrepared(connection, statementName, task->parameterCount,
+								   (const char *const *) task->parameterValues,
+								   NULL, NULL, resultFormat);
+	}
+	else if (binaryResults)
+	{
+		return PQsendQueryParams(connection, task->queryString->data, 0, NULL, NULL,
+								 NULL, NULL, resultFormat);
+	}
+
+	return PQsendQuery(connection, task->queryString->data);
+}
+
+
+/*
+ * StoreResultTuples builds tuples from the rows of the given result and stores
+ * them in the given tuple-store. The columnArray should have space for all
+ * columns of the tuple descriptor.
+ */
+static void
+StoreResultTuples(PGresult *result, AttInMetadata *attributeInputMetadata,
+				  char **columnArray, MemoryContext ioContext,
+				  Tuplestorestate *tupleStore)
+{
+	uint32 expectedColumnCount PG_USED_FOR_ASSERTS_ONLY =
+		attributeInputMetadata->tupdesc->natts;
+	uint32 rowIndex = 0;
+	uint32 columnIndex = 0;
+	uint32 rowCount = PQntuples(result);
+	uint32 columnCount = PQnfields(result);
+
+	Assert(columnCount == expectedColumnCount);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		HeapTuple heapTuple = NULL;
+		MemoryContext oldContext = NULL;
+		memset(columnArray, 0, columnCount * sizeof(char *));
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			if (PQgetisnull(result, rowIndex, columnIndex))
+			{
+				columnArray[columnIndex] = NULL;
+			}
+			else
+			{
+				columnArray[columnIndex] = PQgetvalue(result, rowIndex, columnIndex);
+			}
+		}
+
+		/*
+		 * Switch to a temporary memory context that we reset after each tuple. This
+		 * protects us from any memory leaks that might be present in I/O functions
+		 * called by BuildTupleFromCStrings.
+		 */
+		oldContext = MemoryContextSwitchTo(ioContext);
+
+		heapTuple = BuildTupleFromCStrings(attributeInputMetadata, columnArray);
+
+		MemoryContextSwitchTo(oldContext);
+
+		tuplestore_puttuple(tupleStore, heapTuple);
+		MemoryContextReset(ioContext);
+	}
+}
+
+
+/*
+ * BinaryResultsSupported returns whether rows of the given descriptor can be
+ * transferred in binary format. As the binary format of arrays and composite
+ * types embeds type OIDs, which may differ between nodes, this is only the
+ * case for built-in base types with a receive function and arrays of them.
+ */
+static bool
+BinaryResultsSupported(TupleDesc tupleDescriptor)
+{
+	int columnIndex = 0;
+
+	for (columnIndex = 0; columnIndex < tupleDescriptor->natts; columnIndex++)
+	{
+		Oid typeId = tupleDescriptor->attrs[columnIndex]->atttypid;
+		Oid elementTypeId = get_element_type(typeId);
+		HeapTuple typeTuple = NULL;
+		Form_pg_type typeForm = NULL;
+		bool typeSupported = false;
+
+		if (OidIsValid(elementTypeId))
+		{
+			typeId = elementTypeId;
+		}
+
+		if (typeId >= FirstNormalObjectId)
+		{
+			return false;
+		}
+
+		typeTuple = SearchSysCache1(TYPEOID, ObjectIdGetDatum(typeId));
+		if (!HeapTupleIsValid(typeTuple))
+		{
+			return false;
+		}
+
+		typeForm = (Form_pg_type) GETSTRUCT(typeTuple);
+		typeSupported = (typeForm->typtype == TYPTYPE_BASE &&
+						 OidIsValid(typeForm->typreceive));
+		ReleaseSysCache(typeTuple);
+
+		if (!typeSupported)
+		{
+			return false;
+		}
+	}
+
+	return true;
+}
+
+
+/*
+ * StoreBinaryResultTuples builds tuples from the binary format rows of the
+ * given result using the receive functions of the column types, and stores
+ * them in the given tuple-store.
+ */
+static void
+StoreBinaryResultTuples(PGresult *result, MultiShardExecution *multiShardExecution,
+						Tuplestorestate *tupleStore)
+{
+	TupleDesc tupleDescriptor = multiShardExecution->attributeInputMetadata->tupdesc;
+	Datum *columnValueArray = multiShardExecution->columnValueArray;
+	bool *columnNullArray = multiShardExecution->columnNullArray;
+	MemoryContext ioContext = multiShardExecution->ioContext;
+	uint32 rowIndex = 0;
+	uint32 columnIndex = 0;
+	uint32 rowCount = PQntuples(result);
+	uint32 columnCount = PQnfields(result);
+
+	Assert(columnCount == tupleDescriptor->natts);
+
+	for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
+	{
+		HeapTuple heapTuple = NULL;
+		MemoryContext oldContext = MemoryContextSwitchTo(ioContext);
+
+		for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
+		{
+			StringInfoData columnBuffer;
+
+			if (PQgetisnull(result, rowIndex, columnIndex))
+			{
+				columnValueArray[columnIndex] = (Datum) 0;
+				columnNullArray[columnIndex] = true;
+				continue;
+			}
+
+			/* libpq keeps the value null-terminated, as receive functions expect */
+			columnBuffer.data = PQgetvalue(result, rowIndex, columnIndex);
+			columnBuffer.len = PQgetlength(result, rowIndex, columnIndex);
+			columnBuffer.maxlen = columnBuffer.len + 1;
+			columnBuffer.cursor = 0;
+
+			columnValueArray[columnIndex] =
+				ReceiveFunctionCall(&multiShardExecution->receiveFunctionArray[columnIndex],
+									&columnBuffer,
+									multiShardExecution->typeIOParamArray[columnIndex],
+									tupleDescriptor->attrs[columnIndex]->atttypmod);
+			columnNullArray[columnIndex] = false;
+
+			if (columnBuffer.cursor != columnBuffer.len)
+			{
+				ereport(ERROR, (errcode(ERRCODE_INVALID_BINARY_REPRESENTATION),
+								errmsg("incorrect binary data format in column %u of "
+									   "remote result", columnIndex + 1)));
+			}
+		}
+
+		heapTuple = heap_form_tuple(tupleDescriptor, columnValueArray, columnNullArray);
+
+		MemoryContextSwitchTo(oldContext);
+
+		tuplestore_puttuple(tupleStore, heapTuple);
+		MemoryContextReset(ioContext);
+	}
+}
+
+
 /*
  * StoreQueryResult gets the query results from the given connection, builds
  * tuples from the results and stores them in the given tuple-store. If the
@@ -1639,10 +3537,6 @@ StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
 
 	for (;;)
 	{
-		uint32 rowIndex = 0;
-		uint32 columnIndex = 0;
-		uint32 rowCount = 0;
-		uint32 columnCount = 0;
 		ExecStatusType resultStatus = 0;
 
 		PGresult *result = PQgetResult(connection);
@@ -1660,43 +3554,8 @@ StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
 			return false;
 		}
 
-		rowCount = PQntuples(result);
-		columnCount = PQnfields(result);
-		Assert(columnCount == expectedColumnCount);
-
-		for (rowIndex = 0; rowIndex < rowCount; rowIndex++)
-		{
-			HeapTuple heapTuple = NULL;
-			MemoryContext oldContext = NULL;
-			memset(columnArray, 0, columnCount * sizeof(char *));
-
-			for (columnIndex = 0; columnIndex < columnCount; columnIndex++)
-			{
-				if (PQgetisnull(result, rowIndex, columnIndex))
-				{
-					columnArray[columnIndex] = NULL;
-				}
-				else
-				{
-					columnArray[columnIndex] = PQgetvalue(result, rowIndex, columnIndex);
-				}
-			}
-
-			/*
-			 * Switch to a temporary memory context that we reset after each tuple. This
-			 * protects us from any memory leaks that might be present in I/O functions
-			 * called by BuildTupleFromCStrings.
-			 */
-			oldContext = MemoryContextSwitchTo(ioContext);
-
-			heapTuple = BuildTupleFromCStrings(attributeInputMetadata, columnArray);
-
-			MemoryContextSwitchTo(oldContext);
-
-			tuplestore_puttuple(tupleStore, heapTuple);
-			MemoryContextReset(ioContext);
-		}
-
+		StoreResultTuples(result, attributeInputMetadata, columnArray, ioContext,
+						  tupleStore);
 		PQclear(result);
 	}
 
@@ -1706,6 +3565,8 @@ StoreQueryResult(PGconn *connection, TupleDesc tupleDescriptor,
 }
 
 
+#if PG_VERSION_NUM < 90500
+
 /*
  * TupleStoreToTable inserts the tuples from the given tupleStore into the given
  * table. Before doing so, the function extracts the values from the tuple and
@@ -1794,6 +3655,8 @@ TupleStoreToTable(RangeVar *tableRangeVar, List *storeToTableColumnList,
 	heap_close(table, RowExclusiveLock);
 }
 
+#endif
+
 
 /*
  * PgShardExecutorRun actually runs a distributed plan, if any.
@@ -1882,24 +3745,62 @@ PgShardExecutorRun(QueryDesc *queryDesc, ScanDirection direction, long count)
  * tables. A distributed modification is successful if any placement of the
  * distributed table is successful. ExecuteDistributedModify returns the number
  * of modified rows in that case and errors in all others. This function will
- * also generate warnings for individual placement failures.
+ * also generate warnings for individual placement failures. The rows of a
+ * multi-row INSERT may go to several shards, whose tasks are run in turn.
  */
 static int32
 ExecuteDistributedModify(DistributedPlan *plan)
 {
-	int32 affectedTupleCount = -1;
-	Task *task = (Task *) linitial(plan->taskList);
-	ListCell *taskPlacementCell = NULL;
-	List *failedPlacementList = NIL;
-	ListCell *failedPlacementCell = NULL;
+	int32 affectedTupleCount = 0;
+	ListCell *taskCell = NULL;
+	List *placementList = NIL;
 
 	/* we only support a single modification to a single shard */
-	if (list_length(plan->taskList) != 1)
+	if (list_length(plan->taskList) != 1 && !plan->multiRowInsert)
 	{
 		ereport(ERROR, (errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 						errmsg("cannot modify multiple shards during a single query")));
 	}
 
+	/* connect to all placements of the modified shards in parallel */
+	foreach(taskCell, plan->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		placementList = list_concat(placementList, list_copy(task->taskPlacementList));
+	}
+
+	OpenConnections(placementList);
+
+	foreach(taskCell, plan->taskList)
+	{
+		Task *task = (Task *) lfirst(taskCell);
+
+		affectedTupleCount += ExecuteModifyTask(task);
+	}
+
+	return affectedTupleCount;
+}
+
+
+/*
+ * ExecuteModifyTask runs the modification of the given task on all of its
+ * placements and returns the number of modified rows. The statement is sent
+ * to all placements before waiting for any of them, so that they run it
+ * concurrently. Placements which fail are marked inactive; if all of them
+ * fail, the function errors out.
+ */
+static int32
+ExecuteModifyTask(Task *task)
+{
+	int32 affectedTupleCount = -1;
+	int placementCount = list_length(task->taskPlacementList);
+	PGconn **connectionArray = palloc0(placementCount * sizeof(PGconn *));
+	int placementIndex = 0;
+	ListCell *taskPlacementCell = NULL;
+	List *failedPlacementList = NIL;
+	ListCell *failedPlacementCell = NULL;
+
 	if (UseDtmTransactions)
 	{
 		DtmTwoPhaseCommit = true;
@@ -1911,26 +3812,43 @@ ExecuteDistributedModify(DistributedPlan *plan)
 		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
 		char *nodeName = taskPlacement->nodeName;
 		int32 nodePort = taskPlacement->nodePort;
-
 		PGconn *connection = NULL;
-		PGresult *result = NULL;
-		char *currentAffectedTupleString = NULL;
-		int32 currentAffectedTupleCount = -1;
 
 		Assert(taskPlacement->shardState == STATE_FINALIZED);
 
 		connection = GetConnection(nodeName, nodePort, !UseDtmTransactions);
+		if (connection != NULL && SendTaskQuery(connection, task, false) == 0)
+		{
+			ReportRemoteError(connection, NULL);
+			connection = NULL;
+		}
+
+		connectionArray[placementIndex++] = connection;
+	}
+
+	placementIndex = 0;
+	foreach(taskPlacementCell, task->taskPlacementList)
+	{
+		ShardPlacement *taskPlacement = (ShardPlacement *) lfirst(taskPlacementCell);
+		char *nodeName = taskPlacement->nodeName;
+		int32 nodePort = taskPlacement->nodePort;
+		PGconn *connection = connectionArray[placementIndex++];
+		PGresult *result = NULL;
+		char *currentAffectedTupleString = NULL;
+		int32 currentAffectedTupleCount = -1;
+
 		if (connection == NULL)
 		{
 			failedPlacementList = lappend(failedPlacementList, taskPlacement);
 			continue;
 		}
 
-		result = PQexec(connection, task->queryString->data);
+		result = PQgetResult(connection);
 		if (PQresultStatus(result) != PGRES_COMMAND_OK)
 		{
 			ReportRemoteError(connection, result);
 			PQclear(result);
+			ClearRemainingResults(connection);
 
 			failedPlacementList = lappend(failedPlacementList, taskPlacement);
 			continue;
@@ -1955,10 +3873,13 @@ ExecuteDistributedModify(DistributedPlan *plan)
 		}
 
 		PQclear(result);
+		ClearRemainingResults(connection);
 	}
 
+	pfree(connectionArray);
+
 	/* if all placements failed, error out */
-	if (list_length(failedPlacementList) == list_length(task->taskPlacementList))
+	if (list_length(failedPlacementList) == placementCount)
 	{
 		ereport(ERROR, (errmsg("could not modify any active placements")));
 	}
@@ -1975,6 +3896,22 @@ ExecuteDistributedModify(DistributedPlan *plan)
 }
 
 
+/*
+ * ClearRemainingResults reads and discards the results left on the connection,
+ * so that the next command can be sent on it.
+ */
+static void
+ClearRemainingResults(PGconn *connection)
+{
+	PGresult *result = NULL;
+
+	while ((result = PQgetResult(connection)) != NULL)
+	{
+		PQclear(result);
+	}
+}
+
+
 /*
  * PrepareDtmTransaction sends the necessary commands to the nodes to perform
  * a global transaction.
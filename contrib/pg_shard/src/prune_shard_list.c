@@ -69,51 +69,13 @@ static OpExpr * MakeOpExpressionWithZeroConst(void);
 static List * BuildRestrictInfoList(List *qualList);
 static Node * BuildBaseConstraint(Var *column);
 static void UpdateConstraint(Node *baseConstraint, ShardInterval *shardInterval);
+static bool HashedPartitionValue(Expr *predicate, Var *partitionColumn,
+								 int32 *hashedValue);
+static ShardInterval * FindHashedShardInterval(Oid relationId, int32 hashedValue,
+											   bool *shardIntervalsSorted);
+static ShardInterval * SearchHashedShardInterval(ShardInterval **sortedIntervalArray,
+												 int shardCount, int32 hashedValue);
 
-static HTAB* shardPlacementCache;
-
-typedef struct ShardPlacementEntryCacheEntry
-{
-	Oid tableId;
-	List** placements;
-} ShardPlacementCacheEntry;
-
-#define MAX_DISTRIBUTED_TABLES 101
-
-static List* 
-LookupShardPlacementCache(Oid relationId, int shardHashCode)
-{
-	ShardPlacementCacheEntry* entry = NULL;
-
-	if (shardPlacementCache == NULL)
-	{
-		HASHCTL info;
-		int hashFlags = (HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
-
-		memset(&info, 0, sizeof(info));
-		info.keysize = sizeof(Oid);
-		info.entrysize = sizeof(ShardPlacementCacheEntry);
-		info.hcxt = CacheMemoryContext;
-
-		shardPlacementCache = hash_create("pg_shard placement cache", MAX_DISTRIBUTED_TABLES, &info, hashFlags);
-	}
-	entry = hash_search(shardPlacementCache, &relationId, HASH_FIND, NULL);
-	return (entry != NULL) ? entry->placements[shardHashCode] : NULL;
-}
-
-static void 
-AddToShardPlacementCache(Oid relationId, int shardHashCode, int shardCount, List* shardPlacements)
-{
-	MemoryContext oldContext = MemoryContextSwitchTo(CacheMemoryContext);
-	bool found = false;
-	ShardPlacementCacheEntry* entry = (ShardPlacementCacheEntry*)hash_search(shardPlacementCache, &relationId, HASH_ENTER, &found);
-	if (!found)
-	{
-		entry->placements = palloc0(shardCount*sizeof(List*));
-	}
-	entry->placements[shardHashCode] = list_copy(shardPlacements);
-	MemoryContextSwitchTo(oldContext);
-}
 
 /*
  * PruneShardList prunes shards from given list based on the selection criteria,
@@ -126,9 +88,6 @@ PruneShardList(Oid relationId, List *whereClauseList, List *shardIntervalList)
 	ListCell *shardIntervalCell = NULL;
 	List *restrictInfoList = NIL;
 	Node *baseConstraint = NULL;
-	int shardHashCode = -1;
-	int shardCount = shardIntervalList->length;
-	uint32 hashTokenIncrement = (uint32)(HASH_TOKEN_COUNT / shardCount);
 	Var *partitionColumn = PartitionColumn(relationId);
 	char partitionMethod = PartitionType(relationId);
 
@@ -146,49 +105,41 @@ PruneShardList(Oid relationId, List *whereClauseList, List *shardIntervalList)
 		{
 			Node *hashedNode = NULL;
 			List *hashedClauseList = NULL;
-			if (whereClauseList && whereClauseList->length == 1)
+			ListCell *whereClauseCell = NULL;
+
+			/*
+			 * An equality restriction on the partition column selects at most
+			 * one shard, which we find from the sorted shard intervals rather
+			 * than by refuting the constraints of all shards. Any other
+			 * restrictions could prune only this shard, which is not needed.
+			 */
+			foreach(whereClauseCell, whereClauseList)
 			{
-				Expr* predicate = (Expr *)lfirst(list_head(whereClauseList));
+				Expr *whereClause = (Expr *) lfirst(whereClauseCell);
+				int32 hashedValue = 0;
+				ShardInterval *shardInterval = NULL;
+				bool shardIntervalsSorted = false;
 
-				if (IsA(predicate, OpExpr))
+				if (!HashedPartitionValue(whereClause, partitionColumn, &hashedValue))
 				{
-					OpExpr *operatorExpression = (OpExpr *) predicate;
-					Oid leftHashFunction = InvalidOid;
-					Oid rightHashFunction = InvalidOid;
-					if (get_op_hash_functions(operatorExpression->opno,
-											  &leftHashFunction,
-											  &rightHashFunction)				
-						&& SimpleOpExpression(predicate)
-						&& OpExpressionContainsColumn(operatorExpression,
-													  partitionColumn))
-					{
-						Node *leftOperand = get_leftop(predicate);
-						Node *rightOperand = get_rightop(predicate);
-						Const *constant = (Const*)(IsA(rightOperand, Const) ? rightOperand : leftOperand);
-						TypeCacheEntry *typeEntry = lookup_type_cache(constant->consttype, TYPECACHE_HASH_PROC_FINFO);
-						FmgrInfo *hashFunction = &(typeEntry->hash_proc_finfo);
-						if (OidIsValid(hashFunction->fn_oid))
-						{
-							int hashedValue = DatumGetInt32(FunctionCall1(hashFunction, constant->constvalue));
-							shardHashCode = (int)((uint32)(hashedValue - INT32_MIN) / hashTokenIncrement);
-							remainingShardList = LookupShardPlacementCache(relationId, shardHashCode);
-							if (remainingShardList != NULL)
-							{
-								return remainingShardList;
-							}
-						}
-					}
+					continue;
 				}
+
+				shardInterval = FindHashedShardInterval(relationId, hashedValue,
+														&shardIntervalsSorted);
+				if (shardIntervalsSorted)
+				{
+					return (shardInterval != NULL) ? list_make1(shardInterval) : NIL;
+				}
+
+				break;
 			}
+
 			hashedNode = HashableClauseMutator((Node *) whereClauseList,
 											   partitionColumn);
 			hashedClauseList = (List *) hashedNode;
 			restrictInfoList = BuildRestrictInfoList(hashedClauseList);
 
-			/* override the partition column for hash partitioning */
-			partitionColumn = MakeInt4Column();
-			restrictInfoList = BuildRestrictInfoList(hashedClauseList);
-
 			/* override the partition column for hash partitioning */
 			partitionColumn = MakeInt4Column();
 			break;
@@ -224,26 +175,141 @@ PruneShardList(Oid relationId, List *whereClauseList, List *shardIntervalList)
 		}
 		else
 		{
-			remainingShardList = lappend(remainingShardList, &(shardInterval->id));
+			remainingShardList = lappend(remainingShardList, shardInterval);
+		}
+	}
+
+	return remainingShardList;
+}
+
+
+/*
+ * HashedPartitionValue checks whether the given predicate is an equality
+ * restriction of the partition column to a constant, and if so sets hashedValue
+ * to the hash of that constant.
+ */
+static bool
+HashedPartitionValue(Expr *predicate, Var *partitionColumn, int32 *hashedValue)
+{
+	OpExpr *operatorExpression = NULL;
+	Oid leftHashFunction = InvalidOid;
+	Oid rightHashFunction = InvalidOid;
+	Node *leftOperand = NULL;
+	Node *rightOperand = NULL;
+	Const *constant = NULL;
+	TypeCacheEntry *typeEntry = NULL;
+
+	if (!IsA(predicate, OpExpr) || !SimpleOpExpression(predicate))
+	{
+		return false;
+	}
+
+	operatorExpression = (OpExpr *) predicate;
+	if (!get_op_hash_functions(operatorExpression->opno, &leftHashFunction,
+							   &rightHashFunction) ||
+		!OpExpressionContainsColumn(operatorExpression, partitionColumn))
+	{
+		return false;
+	}
+
+	leftOperand = get_leftop(predicate);
+	rightOperand = get_rightop(predicate);
+	constant = (Const *) (IsA(rightOperand, Const) ? rightOperand : leftOperand);
+	if (constant->constisnull)
+	{
+		return false;
+	}
+
+	typeEntry = lookup_type_cache(constant->consttype, TYPECACHE_HASH_PROC_FINFO);
+	if (!OidIsValid(typeEntry->hash_proc_finfo.fn_oid))
+	{
+		return false;
+	}
+
+	*hashedValue = DatumGetInt32(FunctionCall1(&typeEntry->hash_proc_finfo,
+											   constant->constvalue));
+
+	return true;
+}
+
+
+/*
+ * FindHashedShardInterval returns the shard interval of the given table which
+ * contains the given hashed value, or NULL if there is none. If the intervals
+ * split the hash space evenly, the shard's position is computed directly;
+ * otherwise the function searches the sorted intervals. If the intervals can't
+ * be sorted, shardIntervalsSorted is set to false and NULL is returned.
+ */
+static ShardInterval *
+FindHashedShardInterval(Oid relationId, int32 hashedValue, bool *shardIntervalsSorted)
+{
+	int shardCount = 0;
+	bool uniformHashDistribution = false;
+	ShardInterval **sortedIntervalArray =
+		LookupSortedShardIntervalArray(relationId, &shardCount, &uniformHashDistribution);
+
+	if (sortedIntervalArray == NULL)
+	{
+		*shardIntervalsSorted = false;
+		return NULL;
+	}
+
+	*shardIntervalsSorted = true;
+
+	if (uniformHashDistribution)
+	{
+		uint64 hashTokenIncrement = HASH_TOKEN_COUNT / shardCount;
+		uint64 shardIndex =
+			((uint32) hashedValue - (uint32) INT32_MIN) / hashTokenIncrement;
+
+		/* the last shard also covers the remainder of the hash space */
+		if (shardIndex >= shardCount)
+		{
+			shardIndex = shardCount - 1;
 		}
+
+		return sortedIntervalArray[shardIndex];
 	}
-	if (shardHashCode >= 0)
+
+	return SearchHashedShardInterval(sortedIntervalArray, shardCount, hashedValue);
+}
+
+
+/*
+ * SearchHashedShardInterval returns the shard interval which contains the given
+ * hashed value, or NULL if there is none. The intervals must be sorted by their
+ * min values and must not overlap.
+ */
+static ShardInterval *
+SearchHashedShardInterval(ShardInterval **sortedIntervalArray, int shardCount,
+						  int32 hashedValue)
+{
+	int lowerIndex = 0;
+	int upperIndex = shardCount;
+
+	/* find the first interval whose max value is not less than the hashed value */
+	while (lowerIndex < upperIndex)
 	{
-		ShardInterval* shardInterval = (ShardInterval *) linitial(remainingShardList);
-		int64 shardId = shardInterval->id;
-		int32 shardMinHashToken = INT32_MIN + (shardId * hashTokenIncrement);
-		int32 shardMaxHashToken = shardMinHashToken + (hashTokenIncrement - 1);
-		if (shardId == (shardCount - 1))
+		int middleIndex = lowerIndex + (upperIndex - lowerIndex) / 2;
+		int32 maxValue = DatumGetInt32(sortedIntervalArray[middleIndex]->maxValue);
+
+		if (maxValue < hashedValue)
 		{
-			shardMaxHashToken = INT32_MAX;
+			lowerIndex = middleIndex + 1;
 		}
-		if (DatumGetInt32(shardInterval->minValue) == shardMinHashToken &&
-			DatumGetInt32(shardInterval->maxValue) == shardMaxHashToken)
-		{		
-			AddToShardPlacementCache(relationId, shardHashCode, shardIntervalList->length, remainingShardList);
+		else
+		{
+			upperIndex = middleIndex;
 		}
 	}
-	return remainingShardList;
+
+	if (lowerIndex < shardCount &&
+		DatumGetInt32(sortedIntervalArray[lowerIndex]->minValue) <= hashedValue)
+	{
+		return sortedIntervalArray[lowerIndex];
+	}
+
+	return NULL;
 }
 
 
@@ -50,6 +50,10 @@ static List * RecreateTableDDLCommandList(Oid relationId, int64 shardId);
 static bool CopyDataFromFinalizedPlacement(Oid distributedTableId, int64 shardId,
 										   ShardPlacement *healthyPlacement,
 										   ShardPlacement *placementToRepair);
+static bool StartRemoteCopy(PGconn *connection, StringInfo copyCommand,
+							ExecStatusType expectedStatus);
+static bool StreamCopyData(PGconn *sourceConnection, PGconn *targetConnection);
+static bool FinishRemoteCopy(PGconn *connection);
 static void CopyDataFromTupleStoreToRelation(Tuplestorestate *tupleStore,
 											 Relation relation);
 
@@ -62,8 +66,9 @@ PG_FUNCTION_INFO_V1(worker_copy_shard_placement);
 /*
  * master_copy_shard_placement implements a user-facing UDF to copy data from
  * a healthy (source) node to an inactive (target) node. To accomplish this it
- * entirely recreates the table structure before copying all data. During this
- * time all modifications are paused to the shard. After successful repair, the
+ * entirely recreates the table structure before copying all data, and builds
+ * the table's indexes once the data is in place. During this time all
+ * modifications are paused to the shard. After successful repair, the
  * inactive placement is marked healthy and modifications may continue. If the
  * repair fails at any point, this function throws an error, leaving the node
  * in an unhealthy state.
@@ -83,8 +88,10 @@ master_copy_shard_placement(PG_FUNCTION_ARGS)
 	ShardPlacement *sourcePlacement = NULL;
 	ShardPlacement *targetPlacement = NULL;
 	List *ddlCommandList = NIL;
+	List *indexCommandList = NIL;
 	bool recreated = false;
 	bool dataCopied = false;
+	bool indexesCreated = false;
 
 	/*
 	 * By taking an exclusive lock on the shard, we both stop all modifications
@@ -141,6 +148,21 @@ master_copy_shard_placement(PG_FUNCTION_ARGS)
 								"details.")));
 	}
 
+	/* building the indexes at once is cheaper than maintaining them per row */
+	indexCommandList = IndexCreationCommandList(distributedTableId);
+	indexCommandList = ExtendedDDLCommandList(distributedTableId, shardId,
+											  indexCommandList);
+
+	indexesCreated = ExecuteRemoteCommandList(targetPlacement->nodeName,
+											  targetPlacement->nodePort,
+											  indexCommandList);
+	if (!indexesCreated)
+	{
+		ereport(ERROR, (errmsg("could not create shard indexes"),
+						errhint("Consult recent messages in the server logs for "
+								"details.")));
+	}
+
 	/* the placement is repaired, so return to finalized state */
 	UpdateShardPlacementRowState(targetPlacement->id, STATE_FINALIZED);
 
@@ -244,7 +266,8 @@ SearchShardPlacementInList(List *shardPlacementList, text *nodeNameText, int32 n
  * RecreateTableDDLCommandList returns a list of DDL statements similar to that
  * returned by ExtendedDDLCommandList except that the list begins with a "DROP
  * TABLE" or "DROP FOREIGN TABLE" statement to facilitate total recreation of a
- * placement.
+ * placement. The list does not create the table's indexes, which are built
+ * after the data is copied.
  */
 static List *
 RecreateTableDDLCommandList(Oid relationId, int64 shardId)
@@ -278,7 +301,7 @@ RecreateTableDDLCommandList(Oid relationId, int64 shardId)
 
 	extendedDropCommandList = list_make1(extendedDropCommand->data);
 
-	createCommandList = TableDDLCommandList(relationId);
+	createCommandList = TableCreationCommandList(relationId);
 	extendedCreateCommandList = ExtendedDDLCommandList(relationId, shardId,
 													   createCommandList);
 
@@ -293,8 +316,10 @@ RecreateTableDDLCommandList(Oid relationId, int64 shardId)
  * CopyDataFromFinalizedPlacement copies a the data for a shard (identified by
  * a relation and shard identifier) from a healthy placement to one needing
  * repair. The unhealthy placement must already have an empty relation in place
- * to receive rows from the healthy placement. This function returns a boolean
- * indicating success or failure.
+ * to receive rows from the healthy placement. The data is streamed from a COPY
+ * TO STDOUT on the healthy placement into a COPY FROM STDIN on the other one,
+ * so no rows are kept on this node. This function returns a boolean indicating
+ * success or failure.
  */
 static bool
 CopyDataFromFinalizedPlacement(Oid distributedTableId, int64 shardId,
@@ -303,7 +328,12 @@ CopyDataFromFinalizedPlacement(Oid distributedTableId, int64 shardId,
 {
 	char *relationName = get_rel_name(distributedTableId);
 	const char *shardName = NULL;
-	StringInfo copyRelationQuery = makeStringInfo();
+	StringInfo copyOutCommand = makeStringInfo();
+	StringInfo copyInCommand = makeStringInfo();
+	PGconn *sourceConnection = NULL;
+	PGconn *targetConnection = NULL;
+	bool copyOutStarted = false;
+	bool copyInStarted = false;
 	bool copySuccessful = false;
 
 	char relationKind = get_rel_relkind(distributedTableId);
@@ -318,19 +348,166 @@ CopyDataFromFinalizedPlacement(Oid distributedTableId, int64 shardId,
 	AppendShardIdToName(&relationName, shardId);
 	shardName = quote_identifier(relationName);
 
-	appendStringInfo(copyRelationQuery, COPY_SHARD_PLACEMENT_COMMAND,
-					 quote_literal_cstr(shardName),
-					 quote_literal_cstr(healthyPlacement->nodeName),
-					 healthyPlacement->nodePort);
+	appendStringInfo(copyOutCommand, COPY_OUT_COMMAND, shardName);
+	appendStringInfo(copyInCommand, COPY_IN_COMMAND, shardName);
 
-	copySuccessful = ExecuteRemoteCommandList(placementToRepair->nodeName,
-											  placementToRepair->nodePort,
-											  list_make1(copyRelationQuery->data));
+	/* start copying out first, so connecting to the target cannot close it as idle */
+	sourceConnection = GetConnection(healthyPlacement->nodeName,
+									 healthyPlacement->nodePort, true);
+	if (sourceConnection == NULL)
+	{
+		return false;
+	}
+
+	copyOutStarted = StartRemoteCopy(sourceConnection, copyOutCommand, PGRES_COPY_OUT);
+	if (copyOutStarted)
+	{
+		targetConnection = GetConnection(placementToRepair->nodeName,
+										 placementToRepair->nodePort, true);
+	}
+
+	if (targetConnection != NULL)
+	{
+		copyInStarted = StartRemoteCopy(targetConnection, copyInCommand,
+										PGRES_COPY_IN);
+	}
+
+	if (copyOutStarted && copyInStarted)
+	{
+		copySuccessful = StreamCopyData(sourceConnection, targetConnection);
+	}
+
+	/*
+	 * A connection left in the middle of a copy cannot be reused, so we close
+	 * both connections after a failure.
+	 */
+	if (!copySuccessful)
+	{
+		PurgeConnection(sourceConnection);
+		if (targetConnection != NULL)
+		{
+			PurgeConnection(targetConnection);
+		}
+	}
 
 	return copySuccessful;
 }
 
 
+/*
+ * StartRemoteCopy sends the given COPY command on the connection and checks
+ * that the remote node has switched to the expected copy state. The function
+ * returns false, after reporting the error, if the copy could not be started.
+ */
+static bool
+StartRemoteCopy(PGconn *connection, StringInfo copyCommand,
+				ExecStatusType expectedStatus)
+{
+	PGresult *result = PQexec(connection, copyCommand->data);
+	bool copyStarted = (PQresultStatus(result) == expectedStatus);
+
+	if (!copyStarted)
+	{
+		ReportRemoteError(connection, result);
+	}
+
+	PQclear(result);
+
+	return copyStarted;
+}
+
+
+/*
+ * StreamCopyData forwards the data of a COPY TO STDOUT running on the source
+ * connection into the COPY FROM STDIN running on the target connection, one
+ * chunk at a time, and ends both copies. The function returns true only if
+ * both copies completed successfully.
+ */
+static bool
+StreamCopyData(PGconn *sourceConnection, PGconn *targetConnection)
+{
+	bool copyOutDone = false;
+	bool copyOutFailed = false;
+	bool copyInFailed = false;
+	bool copyOutOK = false;
+	bool copyInOK = false;
+
+	while (!copyOutDone && !copyInFailed)
+	{
+		char *copyData = NULL;
+		int copyDataLength = PQgetCopyData(sourceConnection, &copyData, false);
+
+		if (copyDataLength == -1)
+		{
+			copyOutDone = true;
+		}
+		else if (copyDataLength == -2)
+		{
+			ReportRemoteError(sourceConnection, NULL);
+			copyOutDone = true;
+			copyOutFailed = true;
+		}
+		else
+		{
+			int copyDataSent = PQputCopyData(targetConnection, copyData,
+											 copyDataLength);
+			if (copyDataSent != 1)
+			{
+				ReportRemoteError(targetConnection, NULL);
+				copyInFailed = true;
+			}
+
+			PQfreemem(copyData);
+		}
+	}
+
+	if (copyInFailed)
+	{
+		return false;
+	}
+
+	/* abort the incoming copy if we could not read all of the data */
+	if (PQputCopyEnd(targetConnection,
+					 copyOutFailed ? "could not read data of source placement"
+					 : NULL) != 1)
+	{
+		ReportRemoteError(targetConnection, NULL);
+		return false;
+	}
+
+	copyOutOK = !copyOutFailed && FinishRemoteCopy(sourceConnection);
+	copyInOK = FinishRemoteCopy(targetConnection);
+
+	return copyOutOK && copyInOK;
+}
+
+
+/*
+ * FinishRemoteCopy collects the results of a copy which has ended on the given
+ * connection. The function reports any error and returns whether the copy
+ * command completed successfully.
+ */
+static bool
+FinishRemoteCopy(PGconn *connection)
+{
+	bool copyCompleted = true;
+	PGresult *result = NULL;
+
+	while ((result = PQgetResult(connection)) != NULL)
+	{
+		if (PQresultStatus(result) != PGRES_COMMAND_OK)
+		{
+			ReportRemoteError(connection, result);
+			copyCompleted = false;
+		}
+
+		PQclear(result);
+	}
+
+	return copyCompleted;
+}
+
+
 /*
  * CopyDataFromTupleStoreToRelation loads a specified relation with all tuples
  * stored in the provided tuplestore. This function assumes the relation's
@@ -77,7 +77,7 @@ DELETE FROM limit_orders WHERE id = 246 AND bidder_id = (random() * 1000);
 -- commands with mutable but non-volatilte functions(ie: stable func.) in their quals
 DELETE FROM limit_orders WHERE id = 246 AND placed_at = current_timestamp;
 
--- commands with multiple rows are unsupported
+-- rows of multi-row commands must have partition values
 INSERT INTO limit_orders VALUES (DEFAULT), (DEFAULT);
 
 -- INSERT ... SELECT ... FROM commands are unsupported
@@ -47,6 +47,13 @@
  * requires holding pgss->lock exclusively; this allows individual entries
  * in the file to be read or written while holding only shared lock.
  *
+ * To keep all that off the path of statements executed over and over, each
+ * backend adds up the counters of the statements it has entered into the
+ * hashtable before in a local hashtable of pending counters, and merges
+ * them into the shared entries every pg_stat_statements.flush_interval.
+ * The merge takes the shared lock only if it can do so without waiting;
+ * otherwise the counters stay pending till next time.
+ *
  *
  * Copyright (c) 2008-2016, PostgreSQL Global Development Group
  *
@@ -62,6 +69,7 @@
 #include <unistd.h>
 
 #include "access/hash.h"
+#include "access/xact.h"
 #include "executor/instrument.h"
 #include "funcapi.h"
 #include "mb/pg_wchar.h"
@@ -175,6 +183,15 @@ typedef struct pgssEntry
 	slock_t		mutex;			/* protects the counters only */
 } pgssEntry;
 
+/*
+ * Counters of a statement not merged into the shared entry yet
+ */
+typedef struct pgssPendingEntry
+{
+	pgssHashKey key;			/* hash key of entry - MUST BE FIRST */
+	Counters	counters;		/* the statistics to add */
+} pgssPendingEntry;
+
 /*
  * Global shared state
  */
@@ -238,6 +255,10 @@ static ProcessUtility_hook_type prev_ProcessUtility = NULL;
 static pgssSharedState *pgss = NULL;
 static HTAB *pgss_hash = NULL;
 
+/* Counters of this backend not merged yet, and when they last were */
+static HTAB *pgss_pending = NULL;
+static TimestampTz pgss_last_flush = 0;
+
 /*---- GUC variables ----*/
 
 typedef enum
@@ -259,6 +280,7 @@ static int	pgss_max;			/* max # statements to track */
 static int	pgss_track;			/* tracking level */
 static bool pgss_track_utility; /* whether to track utility commands */
 static bool pgss_save;			/* whether to save stats across shutdown */
+static int	pgss_flush_interval;	/* msec between merges of counters */
 
 
 #define pgss_enabled() \
@@ -305,6 +327,12 @@ static void pgss_store(const char *query, uint32 queryId,
 static void pg_stat_statements_internal(FunctionCallInfo fcinfo,
 							pgssVersion api_version,
 							bool showtext);
+static void counters_add_call(Counters *c, double total_time, uint64 rows,
+				  const BufferUsage *bufusage);
+static void counters_merge(Counters *dst, const Counters *src);
+static void pgss_pending_add(pgssHashKey *key);
+static void pgss_flush_pending(bool force);
+static void pgss_backend_exit(int code, Datum arg);
 static Size pgss_memsize(void);
 static pgssEntry *entry_alloc(pgssHashKey *key, Size query_offset, int query_len,
 			int encoding, bool sticky);
@@ -396,6 +424,19 @@ _PG_init(void)
 							 NULL,
 							 NULL);
 
+	DefineCustomIntVariable("pg_stat_statements.flush_interval",
+	 "Sets the time between merges of a backend's counters into the shared ones.",
+							"Zero updates the shared counters with every statement.",
+							&pgss_flush_interval,
+							1000,
+							0,
+							INT_MAX,
+							PGC_SUSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL);
+
 	EmitWarningsOnPlaceholders("pg_stat_statements");
 
 	/*
@@ -1113,6 +1154,7 @@ pgss_store(const char *query, uint32 queryId,
 	char	   *norm_query = NULL;
 	int			encoding = GetDatabaseEncoding();
 	int			query_len;
+	bool		count_locally = false;
 
 	Assert(query != NULL);
 
@@ -1127,6 +1169,24 @@ pgss_store(const char *query, uint32 queryId,
 	key.dbid = MyDatabaseId;
 	key.queryid = queryId;
 
+	/*
+	 * If we have stored the statement before, just count it locally.  The
+	 * shared entry may be gone meanwhile; the merge will find out.
+	 */
+	if (!jstate && pgss_pending != NULL && pgss_flush_interval > 0)
+	{
+		pgssPendingEntry *pending;
+
+		pending = (pgssPendingEntry *) hash_search(pgss_pending, &key,
+												   HASH_FIND, NULL);
+		if (pending)
+		{
+			counters_add_call(&pending->counters, total_time, rows, bufusage);
+			pgss_flush_pending(false);
+			return;
+		}
+	}
+
 	/* Lookup the hash table entry with shared lock. */
 	LWLockAcquire(pgss->lock, LW_SHARED);
 
@@ -1210,59 +1270,228 @@ pgss_store(const char *query, uint32 queryId,
 		if (e->counters.calls == 0)
 			e->counters.usage = USAGE_INIT;
 
-		e->counters.calls += 1;
-		e->counters.total_time += total_time;
-		if (e->counters.calls == 1)
-		{
-			e->counters.min_time = total_time;
-			e->counters.max_time = total_time;
-			e->counters.mean_time = total_time;
-		}
-		else
-		{
-			/*
-			 * Welford's method for accurately computing variance. See
-			 * <http://www.johndcook.com/blog/standard_deviation/>
-			 */
-			double		old_mean = e->counters.mean_time;
-
-			e->counters.mean_time +=
-				(total_time - old_mean) / e->counters.calls;
-			e->counters.sum_var_time +=
-				(total_time - old_mean) * (total_time - e->counters.mean_time);
-
-			/* calculate min and max time */
-			if (e->counters.min_time > total_time)
-				e->counters.min_time = total_time;
-			if (e->counters.max_time < total_time)
-				e->counters.max_time = total_time;
-		}
-		e->counters.rows += rows;
-		e->counters.shared_blks_hit += bufusage->shared_blks_hit;
-		e->counters.shared_blks_read += bufusage->shared_blks_read;
-		e->counters.shared_blks_dirtied += bufusage->shared_blks_dirtied;
-		e->counters.shared_blks_written += bufusage->shared_blks_written;
-		e->counters.local_blks_hit += bufusage->local_blks_hit;
-		e->counters.local_blks_read += bufusage->local_blks_read;
-		e->counters.local_blks_dirtied += bufusage->local_blks_dirtied;
-		e->counters.local_blks_written += bufusage->local_blks_written;
-		e->counters.temp_blks_read += bufusage->temp_blks_read;
-		e->counters.temp_blks_written += bufusage->temp_blks_written;
-		e->counters.blk_read_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_read_time);
-		e->counters.blk_write_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_write_time);
-		e->counters.usage += USAGE_EXEC(total_time);
+		counters_add_call((Counters *) &e->counters, total_time, rows,
+						  bufusage);
 
 		SpinLockRelease(&e->mutex);
+
+		/* Count further executions locally, if so configured */
+		count_locally = pgss_flush_interval > 0;
 	}
 
 done:
 	LWLockRelease(pgss->lock);
 
+	if (count_locally)
+		pgss_pending_add(&key);
+
 	/* We postpone this clean-up until we're out of the lock */
 	if (norm_query)
 		pfree(norm_query);
 }
 
+/*
+ * Add one execution of a statement to a set of counters.
+ */
+static void
+counters_add_call(Counters *c, double total_time, uint64 rows,
+				  const BufferUsage *bufusage)
+{
+	c->calls += 1;
+	c->total_time += total_time;
+	if (c->calls == 1)
+	{
+		c->min_time = total_time;
+		c->max_time = total_time;
+		c->mean_time = total_time;
+	}
+	else
+	{
+		/*
+		 * Welford's method for accurately computing variance. See
+		 * <http://www.johndcook.com/blog/standard_deviation/>
+		 */
+		double		old_mean = c->mean_time;
+
+		c->mean_time += (total_time - old_mean) / c->calls;
+		c->sum_var_time +=
+			(total_time - old_mean) * (total_time - c->mean_time);
+
+		/* calculate min and max time */
+		if (c->min_time > total_time)
+			c->min_time = total_time;
+		if (c->max_time < total_time)
+			c->max_time = total_time;
+	}
+	c->rows += rows;
+	c->shared_blks_hit += bufusage->shared_blks_hit;
+	c->shared_blks_read += bufusage->shared_blks_read;
+	c->shared_blks_dirtied += bufusage->shared_blks_dirtied;
+	c->shared_blks_written += bufusage->shared_blks_written;
+	c->local_blks_hit += bufusage->local_blks_hit;
+	c->local_blks_read += bufusage->local_blks_read;
+	c->local_blks_dirtied += bufusage->local_blks_dirtied;
+	c->local_blks_written += bufusage->local_blks_written;
+	c->temp_blks_read += bufusage->temp_blks_read;
+	c->temp_blks_written += bufusage->temp_blks_written;
+	c->blk_read_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_read_time);
+	c->blk_write_time += INSTR_TIME_GET_MILLISEC(bufusage->blk_write_time);
+	c->usage += USAGE_EXEC(total_time);
+}
+
+/*
+ * Add the executions counted in one set of counters to another.
+ */
+static void
+counters_merge(Counters *dst, const Counters *src)
+{
+	if (src->calls == 0)
+		return;
+
+	if (dst->calls == 0)
+	{
+		dst->min_time = src->min_time;
+		dst->max_time = src->max_time;
+		dst->mean_time = src->mean_time;
+		dst->sum_var_time = src->sum_var_time;
+	}
+	else
+	{
+		/* Chan et al.'s method for combining Welford's partial sums */
+		double		n1 = dst->calls;
+		double		n2 = src->calls;
+		double		delta = src->mean_time - dst->mean_time;
+
+		dst->mean_time += delta * n2 / (n1 + n2);
+		dst->sum_var_time += src->sum_var_time +
+			delta * delta * n1 * n2 / (n1 + n2);
+
+		if (dst->min_time > src->min_time)
+			dst->min_time = src->min_time;
+		if (dst->max_time < src->max_time)
+			dst->max_time = src->max_time;
+	}
+	dst->calls += src->calls;
+	dst->total_time += src->total_time;
+	dst->rows += src->rows;
+	dst->shared_blks_hit += src->shared_blks_hit;
+	dst->shared_blks_read += src->shared_blks_read;
+	dst->shared_blks_dirtied += src->shared_blks_dirtied;
+	dst->shared_blks_written += src->shared_blks_written;
+	dst->local_blks_hit += src->local_blks_hit;
+	dst->local_blks_read += src->local_blks_read;
+	dst->local_blks_dirtied += src->local_blks_dirtied;
+	dst->local_blks_written += src->local_blks_written;
+	dst->temp_blks_read += src->temp_blks_read;
+	dst->temp_blks_written += src->temp_blks_written;
+	dst->blk_read_time += src->blk_read_time;
+	dst->blk_write_time += src->blk_write_time;
+	dst->usage += src->usage;
+}
+
+/*
+ * Start counting executions of a statement locally.
+ */
+static void
+pgss_pending_add(pgssHashKey *key)
+{
+	pgssPendingEntry *pending;
+	bool		found;
+
+	if (pgss_pending == NULL)
+	{
+		HASHCTL		info;
+
+		memset(&info, 0, sizeof(info));
+		info.keysize = sizeof(pgssHashKey);
+		info.entrysize = sizeof(pgssPendingEntry);
+		info.hash = pgss_hash_fn;
+		info.match = pgss_match_fn;
+		info.hcxt = TopMemoryContext;
+		pgss_pending = hash_create("pg_stat_statements pending counters",
+								   256, &info,
+								   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE |
+								   HASH_CONTEXT);
+
+		before_shmem_exit(pgss_backend_exit, (Datum) 0);
+		pgss_last_flush = GetCurrentStatementStartTimestamp();
+	}
+
+	pending = (pgssPendingEntry *) hash_search(pgss_pending, key,
+											   HASH_ENTER, &found);
+	if (!found)
+		memset(&pending->counters, 0, sizeof(Counters));
+}
+
+/*
+ * Merge this backend's pending counters into the shared entries.
+ *
+ * Unless forced, does nothing before pg_stat_statements.flush_interval has
+ * passed since the last merge, or if that would mean waiting for the lock.
+ * Statements whose shared entries have been deallocated are forgotten,
+ * pending counters and all, as are those not executed since the last
+ * merge; they get stored the long way when they are executed again.
+ */
+static void
+pgss_flush_pending(bool force)
+{
+	HASH_SEQ_STATUS hash_seq;
+	pgssPendingEntry *pending;
+	TimestampTz now;
+
+	if (pgss_pending == NULL || !pgss || !pgss_hash)
+		return;
+
+	now = GetCurrentStatementStartTimestamp();
+	if (force)
+		LWLockAcquire(pgss->lock, LW_SHARED);
+	else if (!TimestampDifferenceExceeds(pgss_last_flush, now,
+										 pgss_flush_interval) ||
+			 !LWLockConditionalAcquire(pgss->lock, LW_SHARED))
+		return;
+
+	hash_seq_init(&hash_seq, pgss_pending);
+	while ((pending = hash_seq_search(&hash_seq)) != NULL)
+	{
+		pgssEntry  *entry = NULL;
+
+		if (pending->counters.calls > 0)
+			entry = (pgssEntry *) hash_search(pgss_hash, &pending->key,
+											  HASH_FIND, NULL);
+		if (entry)
+		{
+			volatile pgssEntry *e = (volatile pgssEntry *) entry;
+
+			SpinLockAcquire(&e->mutex);
+
+			/* "Unstick" entry if it was previously sticky */
+			if (e->counters.calls == 0)
+				e->counters.usage = USAGE_INIT;
+
+			counters_merge((Counters *) &e->counters, &pending->counters);
+
+			SpinLockRelease(&e->mutex);
+
+			memset(&pending->counters, 0, sizeof(Counters));
+		}
+		else
+			hash_search(pgss_pending, &pending->key, HASH_REMOVE, NULL);
+	}
+
+	LWLockRelease(pgss->lock);
+
+	pgss_last_flush = now;
+}
+
+/*
+ * Merge what's pending at backend exit.
+ */
+static void
+pgss_backend_exit(int code, Datum arg)
+{
+	pgss_flush_pending(true);
+}
+
 /*
  * Reset all statement statistics.
  */
@@ -1353,6 +1582,9 @@ pg_stat_statements_internal(FunctionCallInfo fcinfo,
 				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
 				 errmsg("pg_stat_statements must be loaded via shared_preload_libraries")));
 
+	/* let the session see its own statements up to date, at least */
+	pgss_flush_pending(true);
+
 	/* check to see if caller supports us returning a tuplestore */
 	if (rsinfo == NULL || !IsA(rsinfo, ReturnSetInfo))
 		ereport(ERROR,
@@ -2208,6 +2440,16 @@ entry_reset(void)
 	pgssEntry  *entry;
 	FILE	   *qfile;
 
+	/* what's pending here would be forgotten at the next merge anyway */
+	if (pgss_pending != NULL)
+	{
+		pgssPendingEntry *pending;
+
+		hash_seq_init(&hash_seq, pgss_pending);
+		while ((pending = hash_seq_search(&hash_seq)) != NULL)
+			hash_search(pgss_pending, &pending->key, HASH_REMOVE, NULL);
+	}
+
 	LWLockAcquire(pgss->lock, LW_EXCLUSIVE);
 
 	hash_seq_init(&hash_seq, pgss_hash);
@@ -7,11 +7,13 @@
 
 #include "trgm.h"
 
+#include "catalog/pg_collation.h"
 #include "catalog/pg_type.h"
 #include "tsearch/ts_locale.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/pg_crc.h"
+#include "utils/pg_locale.h"
 
 PG_MODULE_MAGIC;
 
@@ -131,6 +133,133 @@ unique_array(trgm *a, int len)
 	return curend + 1 - a;
 }
 
+/*
+ * Sort key of a trigram byte.  CMPTRGM compares plain chars, so the order
+ * depends on whether char is signed.
+ */
+#define TRGMBYTEKEY(c)	((unsigned char) (c) ^ (CHAR_MIN < 0 ? 0x80 : 0))
+
+/* Below this many trigrams qsort beats the radix sort */
+#define TRGM_RADIX_THRESHOLD	64
+
+/*
+ * Sort an array of trigrams and remove duplicates, returning the new length.
+ *
+ * Larger arrays, such as those of long documents being indexed, are sorted
+ * by a radix sort of the three bytes, which removes duplicates as it copies
+ * the result back.
+ */
+static int
+sort_unique_array(trgm *a, int len)
+{
+	trgm	   *tmp;
+	trgm	   *src,
+			   *dst;
+	int			count[256];
+	int			pass,
+				i;
+
+	if (len <= 1)
+		return len;
+
+	if (len < TRGM_RADIX_THRESHOLD)
+	{
+		qsort((void *) a, len, sizeof(trgm), comp_trgm);
+		return unique_array(a, len);
+	}
+
+	tmp = (trgm *) palloc(sizeof(trgm) * len);
+
+	/* Least significant byte first; each pass is a stable counting sort */
+	src = a;
+	dst = tmp;
+	for (pass = 2; pass >= 0; pass--)
+	{
+		int			sum = 0;
+		trgm	   *swap;
+
+		memset(count, 0, sizeof(count));
+		for (i = 0; i < len; i++)
+			count[TRGMBYTEKEY(src[i][pass])]++;
+		for (i = 0; i < 256; i++)
+		{
+			int			c = count[i];
+
+			count[i] = sum;
+			sum += c;
+		}
+		for (i = 0; i < len; i++)
+		{
+			trgm	   *d = &dst[count[TRGMBYTEKEY(src[i][pass])]++];
+
+			CPTRGM(d, &src[i]);
+		}
+
+		swap = src;
+		src = dst;
+		dst = swap;
+	}
+
+	/* After an odd number of passes the result is in tmp */
+	Assert(src == tmp);
+	CPTRGM(&a[0], &src[0]);
+	dst = a;
+	for (i = 1; i < len; i++)
+	{
+		if (CMPTRGM(&src[i], dst))
+		{
+			dst++;
+			CPTRGM(dst, &src[i]);
+		}
+	}
+
+	pfree(tmp);
+
+	return dst + 1 - a;
+}
+
+#ifdef IGNORECASE
+/*
+ * Fold a word to lower case like lowerstr_with_len() does, but without
+ * allocating anything, if that can be done byte by byte: the encoding
+ * has only single-byte characters, or the word only ASCII ones that lower
+ * to ASCII.  dst may be the same as src.
+ *
+ * Returns false, leaving dst alone, if the word needs the general code.
+ */
+static bool
+fold_word_fast(char *dst, const char *src, int bytelen)
+{
+	int			i;
+
+#ifdef USE_WIDE_UPPER_LOWER
+	if (pg_database_encoding_max_length() > 1 &&
+		!lc_ctype_is_c(DEFAULT_COLLATION_OID))
+	{
+		for (i = 0; i < bytelen; i++)
+		{
+			if (!IS_HIGHBIT_SET(src[i]) &&
+				towlower((wint_t) (unsigned char) src[i]) < 0x80)
+				continue;
+			return false;
+		}
+		for (i = 0; i < bytelen; i++)
+			dst[i] = (char) towlower((wint_t) (unsigned char) src[i]);
+		return true;
+	}
+#endif
+
+	for (i = 0; i < bytelen; i++)
+	{
+		/* lowerstr_with_len() stops at a zero byte */
+		if (src[i] == '\0')
+			return false;
+		dst[i] = tolower((unsigned char) src[i]);
+	}
+	return true;
+}
+#endif   /* IGNORECASE */
+
 /*
  * Finds first word in string, returns pointer to the word,
  * endword points to the character after word
@@ -266,17 +395,17 @@ generate_trgm_only(trgm *trg, char *str, int slen)
 	eword = str;
 	while ((bword = find_word(eword, slen - (eword - str), &eword, &charlen)) != NULL)
 	{
+		bytelen = eword - bword;
 #ifdef IGNORECASE
-		bword = lowerstr_with_len(bword, eword - bword);
-		bytelen = strlen(bword);
+		if (!fold_word_fast(buf + LPADDING, bword, bytelen))
+		{
+			bword = lowerstr_with_len(bword, bytelen);
+			bytelen = strlen(bword);
+			memcpy(buf + LPADDING, bword, bytelen);
+			pfree(bword);
+		}
 #else
-		bytelen = eword - bword;
-#endif
-
 		memcpy(buf + LPADDING, bword, bytelen);
-
-#ifdef IGNORECASE
-		pfree(bword);
 #endif
 
 		buf[LPADDING + bytelen] = ' ';
@@ -337,11 +466,7 @@ generate_trgm(char *str, int slen)
 	/*
 	 * Make trigrams unique.
 	 */
-	if (len > 1)
-	{
-		qsort((void *) GETARR(trg), len, sizeof(trgm), comp_trgm);
-		len = unique_array(GETARR(trg), len);
-	}
+	len = sort_unique_array(GETARR(trg), len);
 
 	SET_VARSIZE(trg, CALCGTSIZE(ARRKEY, len));
 
@@ -826,8 +951,13 @@ generate_wildcard_trgm(const char *str, int slen)
 									  buf, &bytelen, &charlen)) != NULL)
 	{
 #ifdef IGNORECASE
-		buf2 = lowerstr_with_len(buf, bytelen);
-		bytelen = strlen(buf2);
+		if (fold_word_fast(buf, buf, bytelen))
+			buf2 = buf;
+		else
+		{
+			buf2 = lowerstr_with_len(buf, bytelen);
+			bytelen = strlen(buf2);
+		}
 #else
 		buf2 = buf;
 #endif
@@ -838,7 +968,8 @@ generate_wildcard_trgm(const char *str, int slen)
 		tptr = make_trigrams(tptr, buf2, bytelen, charlen);
 
 #ifdef IGNORECASE
-		pfree(buf2);
+		if (buf2 != buf)
+			pfree(buf2);
 #endif
 	}
 
@@ -850,11 +981,7 @@ generate_wildcard_trgm(const char *str, int slen)
 	/*
 	 * Make trigrams unique.
 	 */
-	if (len > 1)
-	{
-		qsort((void *) GETARR(trg), len, sizeof(trgm), comp_trgm);
-		len = unique_array(GETARR(trg), len);
-	}
+	len = sort_unique_array(GETARR(trg), len);
 
 	SET_VARSIZE(trg, CALCGTSIZE(ARRKEY, len));
 
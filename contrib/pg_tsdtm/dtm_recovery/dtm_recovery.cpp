@@ -1,7 +1,11 @@
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
 #include <string>
 #include <vector>
 #include <set>
+#include <thread>
+#include <mutex>
 
 #include <pqxx/connection>
 #include <pqxx/transaction>
@@ -10,23 +14,153 @@
 using namespace std;
 using namespace pqxx;
 
+/* Number of gids checked by one query against pg_committed_xacts */
+#define CHECK_BATCH_SIZE 1000
+
+static bool verbose = false;
+static mutex output_mutex;
+
+struct Shard
+{
+    string         conn_str;
+    vector<string> prepared_xacts;  /* gids prepared at this shard */
+    set<string>    committed_xacts; /* gids committed at this shard */
+    string         error;
+};
+
+static void trace(string const& msg)
+{
+    if (verbose) {
+        lock_guard<mutex> guard(output_mutex);
+        cout << msg;
+    }
+}
+
+/*
+ * Collect gids of prepared transactions of the shard.
+ */
+static void collect_prepared(Shard* shard)
+{
+    try {
+        trace("Connecting to " + shard->conn_str + "...\n");
+        connection con(shard->conn_str);
+        nontransaction txn(con);
+        result r = txn.exec("select gid from pg_prepared_xacts");
+        for (result::const_iterator it = r.begin(); it != r.end(); ++it)
+        {
+            shard->prepared_xacts.push_back(it.at("gid").as(string()));
+        }
+    } catch (exception const& e) {
+        shard->error = e.what();
+    }
+}
+
+/*
+ * Find which of the given prepared transactions are committed at the shard.
+ * Gids are checked in batches rather than with a query per gid.
+ */
+static void collect_committed(Shard* shard, vector<string> const* gids)
+{
+    try {
+        connection con(shard->conn_str);
+        nontransaction txn(con);
+        for (size_t i = 0; i < gids->size(); i += CHECK_BATCH_SIZE)
+        {
+            string sql = "select gid from pg_committed_xacts where gid in (";
+            for (size_t j = i; j < gids->size() && j < i + CHECK_BATCH_SIZE; j++) {
+                if (j != i) {
+                    sql += ",";
+                }
+                sql += txn.quote((*gids)[j]);
+            }
+            sql += ")";
+            result r = txn.exec(sql);
+            for (result::const_iterator it = r.begin(); it != r.end(); ++it)
+            {
+                shard->committed_xacts.insert(it.at("gid").as(string()));
+            }
+        }
+    } catch (exception const& e) {
+        shard->error = e.what();
+    }
+}
+
+/*
+ * Commit or roll back a part of the prepared transactions of a shard.
+ * COMMIT/ROLLBACK PREPARED can't run inside a transaction block, so each
+ * one is executed on its own.
+ */
+static void resolve(Shard* shard, set<string> const* committed_xacts, size_t job, size_t n_jobs, string* error)
+{
+    try {
+        connection con(shard->conn_str);
+        nontransaction txn(con);
+        for (size_t i = job; i < shard->prepared_xacts.size(); i += n_jobs)
+        {
+            string const& gid = shard->prepared_xacts[i];
+            if (shard->committed_xacts.find(gid) != shard->committed_xacts.end()) {
+                /* already committed here */
+                continue;
+            }
+            if (committed_xacts->find(gid) != committed_xacts->end()) {
+                trace("Commit transaction " + gid + "\n");
+                txn.exec("commit prepared " + txn.quote(gid));
+            } else {
+                trace("Rollback transaction " + gid + "\n");
+                txn.exec("rollback prepared " + txn.quote(gid));
+            }
+        }
+    } catch (exception const& e) {
+        *error = e.what();
+    }
+}
+
+/*
+ * Report errors of a stage, returns false if there were any.
+ */
+static bool check_errors(vector<Shard> const& shards)
+{
+    bool ok = true;
+    for (vector<Shard>::const_iterator is = shards.begin(); is != shards.end(); ++is)
+    {
+        if (!is->error.empty()) {
+            cerr << "Error at " << is->conn_str << ": " << is->error << "\n";
+            ok = false;
+        }
+    }
+    return ok;
+}
+
 int main (int argc, char* argv[])
 {
     if (argc == 1){
         printf("Use -h to show usage options\n");
         return 1;
     }
-    vector<string> connections;
+    vector<Shard> shards;
     set<string> prepared_xacts;
     set<string> committed_xacts;
-    bool verbose = false;
-    for (int i = 1; i < argc; i++) { 
-        if (argv[i][0] == '-') { 
-            switch (argv[i][1]) { 
+    size_t n_jobs = 1;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] == '-') {
+            switch (argv[i][1]) {
               case 'C':
               case 'c':
-                connections.push_back(string(argv[++i]));
+                if (i + 1 == argc) {
+                    break; /* missing value */
+                }
+                shards.push_back(Shard());
+                shards.back().conn_str = argv[++i];
                 continue;
+              case 'j':
+              {
+                if (i + 1 == argc) {
+                    break;
+                }
+                int n = atoi(argv[++i]);
+                n_jobs = n < 1 ? 1 : (size_t)n;
+                continue;
+              }
               case 'v':
                 verbose = true;
                 continue;
@@ -36,94 +170,82 @@ int main (int argc, char* argv[])
                "Usage: dtm_recovery {options}\n"
                "Options:\n"
                "\t-c STR\tdatabase connection string\n"
+               "\t-j N\tnumber of connections resolving transactions at each shard (default 1)\n"
                "\t-v\tverbose mode: print extra information while processing\n");
         return 1;
     }
-    if (verbose) { 
-        cout << "Collecting information about prepared transactions...\n";
+    vector<thread> threads;
+
+    trace("Collecting information about prepared transactions...\n");
+    for (vector<Shard>::iterator is = shards.begin(); is != shards.end(); ++is)
+    {
+        threads.push_back(thread(collect_prepared, &*is));
+    }
+    for (vector<thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+    threads.clear();
+    if (!check_errors(shards)) {
+        return 1;
     }
-    for (vector<string>::iterator ic = connections.begin(); ic != connections.end(); ++ic)
+    for (vector<Shard>::iterator is = shards.begin(); is != shards.end(); ++is)
     {
-        if (verbose) { 
-            cout << "Connecting to " << *ic << "...\n";
-        }
-        connection con(*ic);
-        work txn(con);
-        result r = txn.exec("select gid from pg_prepared_xacts");
-        for (result::const_iterator it = r.begin(); it != r.end(); ++it)
-        {
-            string gid = it.at("gid").as(string());
-            prepared_xacts.insert(gid);
-        }
-        txn.commit();
+        prepared_xacts.insert(is->prepared_xacts.begin(), is->prepared_xacts.end());
     }
-    if (verbose) { 
+    if (verbose) {
         cout << "Prepared transactions: ";
         for (set<string>::iterator it = prepared_xacts.begin(); it != prepared_xacts.end(); ++it)
         {
             cout << *it << ", ";
         }
         cout << "\nChecking which of them are committed...\n";
-    }        
-    for (vector<string>::iterator ic = connections.begin(); ic != connections.end(); ++ic)
+    }
+    vector<string> gids(prepared_xacts.begin(), prepared_xacts.end());
+    for (vector<Shard>::iterator is = shards.begin(); is != shards.end(); ++is)
     {
-        if (verbose) { 
-            cout << "Connecting to " << *ic << "...\n";
-        }
-        connection con(*ic);
-        work txn(con);
-        con.prepare("commit-check", "select * from pg_committed_xacts where gid=$1");
-        for (set<string>::iterator it = prepared_xacts.begin(); it != prepared_xacts.end(); ++it)
-        {
-            string gid = *it;
-            result r = txn.prepared("commit-check")(gid).exec();
-            if (!r.empty()) {
-                committed_xacts.insert(gid);
-            }
-        }
-        txn.commit();
+        threads.push_back(thread(collect_committed, &*is, &gids));
     }
-    if (verbose) { 
+    for (vector<thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+    threads.clear();
+    if (!check_errors(shards)) {
+        return 1;
+    }
+    for (vector<Shard>::iterator is = shards.begin(); is != shards.end(); ++is)
+    {
+        committed_xacts.insert(is->committed_xacts.begin(), is->committed_xacts.end());
+    }
+    if (verbose) {
         cout << "Committed transactions: ";
         for (set<string>::iterator it = committed_xacts.begin(); it != committed_xacts.end(); ++it)
         {
             cout << *it << ", ";
         }
         cout << "\nCommitting them at all nodes...\n";
-    }      
-    for (vector<string>::iterator ic = connections.begin(); ic != connections.end(); ++ic)
+    }
+    /* Resolve the transactions at all shards at once, n_jobs connections per shard */
+    vector<string> errors(shards.size() * n_jobs);
+    for (size_t i = 0; i < shards.size(); i++)
     {
-        if (verbose) { 
-            cout << "Connecting to " << *ic << "...\n";
+        for (size_t job = 0; job < n_jobs; job++) {
+            threads.push_back(thread(resolve, &shards[i], &committed_xacts, job, n_jobs, &errors[i*n_jobs + job]));
         }
-        connection con(*ic);
-        work txn(con);
-        con.prepare("commit-check", "select * from pg_committed_xacts where gid=$1");
-        con.prepare("commit-prepared", "commit prepared $1");
-        con.prepare("rollback-prepared", "rollback prepared $1");
-        result r = txn.exec("select gid from pg_prepared_xacts");
-        for (result::const_iterator it = r.begin(); it != r.end(); ++it)
-        {
-            string gid = it.at("gid").as(string());
-            result rc = txn.prepared("commit-check")(gid).exec();
-            if (rc.empty()) {
-                if (committed_xacts.find(gid) != committed_xacts.end()) {
-                    if (verbose) { 
-                        cout << "Commit transaction " << gid << "\n";
-                    }
-                    txn.prepared("commit-prepared")(gid);
-                } else { 
-                    if (verbose) { 
-                        cout << "Rollback transaction " << gid << "\n";
-                    }
-                    txn.prepared("rollback-prepared")(gid);
-                }
+    }
+    for (vector<thread>::iterator it = threads.begin(); it != threads.end(); ++it) {
+        it->join();
+    }
+    for (size_t i = 0; i < shards.size(); i++)
+    {
+        for (size_t job = 0; job < n_jobs; job++) {
+            if (!errors[i*n_jobs + job].empty()) {
+                shards[i].error = errors[i*n_jobs + job];
             }
         }
-        txn.commit();
     }
-    if (verbose) { 
-        cout << "Recovery completed\n";
+    if (!check_errors(shards)) {
+        return 1;
     }
+    trace("Recovery completed\n");
     return 0;
-}               
+}
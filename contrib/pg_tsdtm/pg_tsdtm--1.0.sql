@@ -24,3 +24,16 @@ LANGUAGE C;
 CREATE FUNCTION dtm_get_csn(xid integer) RETURNS bigint
 AS 'MODULE_PATHNAME','dtm_get_csn'
 LANGUAGE C;
+
+CREATE FUNCTION dtm_prepare_all(gtid cstring, csn bigint) RETURNS bigint
+AS 'MODULE_PATHNAME','dtm_prepare_all'
+LANGUAGE C;
+
+CREATE FUNCTION dtm_commit(gtid cstring, csn bigint) RETURNS void
+AS 'MODULE_PATHNAME','dtm_commit'
+LANGUAGE C;
+
+-- Number and total time (microseconds) of waits for in-doubt transactions since server start
+CREATE FUNCTION dtm_get_wait_stats(OUT waits bigint, OUT wait_time bigint) RETURNS record
+AS 'MODULE_PATHNAME','dtm_get_wait_stats'
+LANGUAGE C;
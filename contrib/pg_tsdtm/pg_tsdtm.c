@@ -11,14 +11,20 @@
 
 #include "postgres.h"
 #include "fmgr.h"
+#include "funcapi.h"
 #include "miscadmin.h"
+#include "pgstat.h"
 #include "storage/s_lock.h"
-#include "storage/spin.h"
 #include "storage/lmgr.h"
 #include "storage/shmem.h"
 #include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "port/atomics.h"
+#include "access/hlc.h"
+#include "lib/ilist.h"
 #include "access/xlogdefs.h"
 #include "access/xact.h"
+#include "access/parallel.h"
 #include "access/xtm.h"
 #include "access/transam.h"
 #include "access/subtrans.h"
@@ -26,6 +32,7 @@
 #include "access/clog.h"
 #include "access/twophase.h"
 #include "executor/spi.h"
+#include "access/htup_details.h"
 #include "utils/hsearch.h"
 #include "utils/tqual.h"
 #include <utils/guc.h>
@@ -43,33 +50,52 @@
 
 #define TRACE_SLEEP_TIME 1
 
+#define DTM_XID_PARTITIONS  16		/* number of partitions of xid2status hash, should be power of two */
+#define DTM_GTID_PARTITIONS 16		/* number of partitions of gtid2xid hash, should be power of two */
+#define DTM_LOCKS (1 + DTM_XID_PARTITIONS + DTM_GTID_PARTITIONS)
+
+#define DTM_LIST_LOCK			(&dtm_locks[0].lock)
+#define DTM_XID_LOCK(xid)		(&dtm_locks[1 + ((xid) & (DTM_XID_PARTITIONS-1))].lock)
+#define DTM_GTID_LOCK(hash)		(&dtm_locks[1 + DTM_XID_PARTITIONS + ((hash) & (DTM_GTID_PARTITIONS-1))].lock)
+
 typedef uint64 timestamp_t;
 
-/* Distributed transaction state kept in shared memory */
+/*
+ * Distributed transaction state kept in shared memory.
+ * Entries are inserted and removed under exclusive lock of xid2status partition,
+ * but status and CSN are updated and read using atomics, so that status of
+ * subtransactions can be changed without locking their partitions.
+ * CSN is always assigned before status is changed from in-progress.
+ */
 typedef struct DtmTransStatus
 {
 	TransactionId xid;
-	XidStatus	status;
+	pg_atomic_uint32 status;	/* XidStatus */
 	int			nSubxids;
-	cid_t		cid;			/* CSN */
+	pg_atomic_uint64 cid;		/* CSN */
 	struct DtmTransStatus *next;/* pointer to next element in finished
-								 * transaction list */
+								 * transaction list, protected by DTM_LIST_LOCK */
 }	DtmTransStatus;
 
 /* State of DTM node */
 typedef struct
 {
-	cid_t		cid;			/* last assigned CSN; used to provide unique
+	pg_atomic_uint64 cid;		/* last assigned CSN; used to provide unique
 								 * ascending CSNs */
-	TransactionId oldest_xid;	/* XID of oldest transaction visible by any
-								 * active transaction (local or global) */
-	long		time_shift;		/* correction to system time */
-	volatile slock_t lock;		/* spinlock to protect access to hash table  */
+	pg_atomic_uint32 oldest_xid;	/* XID of oldest transaction visible by any
+									 * active transaction (local or global) */
 	DtmTransStatus *trans_list_head;	/* L1 list of finished transactions
 										 * present in xid2status hash table.
 										 * This list is used to perform
 										 * cleanup of too old transactions */
 	DtmTransStatus **trans_list_tail;
+	dlist_head	in_doubt_list;	/* list of in-doubt global transactions
+								 * ordered by prepare CSN, protected by
+								 * DTM_LIST_LOCK */
+	pg_atomic_uint64 in_doubt_waits;	/* number of sleeps of visibility
+										 * checks on in-doubt transactions */
+	pg_atomic_uint64 in_doubt_wait_time;	/* total time of these sleeps
+											 * (microseconds) */
 }	DtmNodeState;
 
 /* Structure used to map global transaction identifier to XID */
@@ -79,6 +105,9 @@ typedef struct
 	TransactionId xid;
 	TransactionId *subxids;
 	int			nSubxids;
+	cid_t		prepare_cid;	/* CSN assigned at begin of prepare or
+								 * INVALID_CID if not prepared */
+	dlist_node	in_doubt;		/* element of in_doubt_list */
 }	DtmTransId;
 
 
@@ -89,10 +118,14 @@ static shmem_startup_hook_type prev_shmem_startup_hook;
 static HTAB *xid2status;
 static HTAB *gtid2xid;
 static DtmNodeState *local;
+static LWLockPadded *dtm_locks;
 static DtmCurrentTrans dtm_tx;
 static uint64 totalSleepInterrupts;
+static uint16 DtmInDoubtWaitEvent;	/* id of "DtmInDoubt" wait event */
 static int	DtmVacuumDelay;
 static bool DtmRecordCommits;
+static int	DtmReadStaleness;
+static TransactionId DtmLocalXmin;	/* last oldest xmin of local backends */
 
 static Snapshot DtmGetSnapshot(Snapshot snapshot);
 static TransactionId DtmGetOldestXmin(Relation rel, bool ignoreVacuum);
@@ -105,6 +138,8 @@ static char const *DtmGetName(void);
 static size_t DtmGetTransactionStateSize(void);
 static void DtmSerializeTransactionState(void* ctx);
 static void DtmDeserializeTransactionState(void* ctx);
+static bool DtmIsDeadForAllSnapshots(TransactionId xmax);
+static void DtmXidInMVCCSnapshotBatch(TransactionId *xids, int n, Snapshot snapshot, bool *result);
 
 
 static TransactionManager DtmTM = {
@@ -121,7 +156,10 @@ static TransactionManager DtmTM = {
 	DtmGetTransactionStateSize,
 	DtmSerializeTransactionState,
 	DtmDeserializeTransactionState,
-	PgInitializeSequence
+	PgInitializeSequence,
+	DtmIsDeadForAllSnapshots,
+	DtmXidInMVCCSnapshotBatch,
+	DtmIsDeadForAllSnapshots	/* IsVisibleForAllSnapshots */
 };
 
 void		_PG_init(void);
@@ -135,6 +173,8 @@ static timestamp_t dtm_get_current_time();
 static void dtm_sleep(timestamp_t interval);
 static cid_t dtm_get_cid();
 static cid_t dtm_sync(cid_t cid);
+static cid_t DtmGetStaleSnapshot(void);
+static uint32 dtm_gtid_hash_fn(const void *key, Size keysize);
 
 /*
  *	Time manipulation functions
@@ -147,7 +187,7 @@ dtm_get_current_time()
 	struct timeval tv;
 
 	gettimeofday(&tv, NULL);
-	return (timestamp_t) tv.tv_sec * USEC + tv.tv_usec + local->time_shift;
+	return (timestamp_t) tv.tv_sec * USEC + tv.tv_usec;
 }
 
 /* Sleep for specified amount of time */
@@ -169,37 +209,25 @@ dtm_sleep(timestamp_t interval)
 }
 
 /* Get unique ascending CSN.
- * This function is called inside critical section
+ * CSN is hybrid logical clock: physical time in microseconds, which is
+ * incremented as logical counter if it is not greater than last assigned or
+ * received CSN. So clock skew between nodes never causes waiting.
+ * Clock is advanced using atomic compare-and-swap, so no lock is needed.
  */
 static cid_t
 dtm_get_cid()
 {
-	cid_t		cid = dtm_get_current_time();
-
-	if (cid <= local->cid)
-	{
-		cid = ++local->cid;
-	}
-	else
-	{
-		local->cid = cid;
-	}
-	return cid;
+	return HlcNext(&local->cid, dtm_get_current_time());
 }
 
 /*
- * Adjust system time
+ * Advance logical clock to the received CSN
  */
 static cid_t
 dtm_sync(cid_t global_cid)
 {
-	cid_t		local_cid;
-
-	while ((local_cid = dtm_get_cid()) < global_cid)
-	{
-		local->time_shift += global_cid - local_cid;
-	}
-	return local_cid;
+	HlcSync(&local->cid, global_cid);
+	return dtm_get_cid();
 }
 
 void
@@ -219,6 +247,8 @@ _PG_init(void)
 		return;
 
 	RequestAddinShmemSpace(dtm_memsize());
+	RequestNamedLWLockTranche("pg_tsdtm", DTM_LOCKS);
+	DtmInDoubtWaitEvent = pgstat_register_wait_event("DtmInDoubt");
 
 	DefineCustomIntVariable(
 							"dtm.vacuum_delay",
@@ -235,6 +265,22 @@ _PG_init(void)
 							NULL
 		);
 
+	DefineCustomIntVariable(
+							"dtm.read_staleness",
+							"Maximal lag of snapshots allowing reads without waiting for in-doubt transactions",
+							"Snapshot is taken before all in-doubt transactions, but not older than this lag. "
+							"0 disables the mode.",
+							&DtmReadStaleness,
+							0,
+							0,
+							INT_MAX,
+							PGC_USERSET,
+							GUC_UNIT_MS,
+							NULL,
+							NULL,
+							NULL
+		);
+
 	DefineCustomBoolVariable(
 							 "dtm.record_commits",
 							 "Store information about committed global transactions in pg_committed_xacts table",
@@ -307,6 +353,15 @@ static void
 dtm_xact_callback(XactEvent event, void *arg)
 {
 	DTM_TRACE((stderr, "Backend %d dtm_xact_callback %d\n", getpid(), event));
+
+	/*
+	 * Parallel worker gets transaction state of the leader from
+	 * DtmDeserializeTransactionState: it must not assign xid and snapshot of
+	 * its own, and only the leader finishes the transaction.
+	 */
+	if (IsParallelWorker())
+		return;
+
 	switch (event)
 	{
 		case XACT_EVENT_START:
@@ -353,6 +408,9 @@ PG_FUNCTION_INFO_V1(dtm_begin_prepare);
 PG_FUNCTION_INFO_V1(dtm_prepare);
 PG_FUNCTION_INFO_V1(dtm_end_prepare);
 PG_FUNCTION_INFO_V1(dtm_get_csn);
+PG_FUNCTION_INFO_V1(dtm_prepare_all);
+PG_FUNCTION_INFO_V1(dtm_commit);
+PG_FUNCTION_INFO_V1(dtm_get_wait_stats);
 
 Datum
 dtm_extend(PG_FUNCTION_ARGS)
@@ -407,6 +465,44 @@ dtm_end_prepare(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Combination of dtm_begin_prepare and dtm_prepare: should be sent by coordinator
+ * together with PREPARE TRANSACTION in one query, so that prepare of distributed
+ * transaction requires only one round-trip.
+ */
+Datum
+dtm_prepare_all(PG_FUNCTION_ARGS)
+{
+	GlobalTransactionId gtid = PG_GETARG_CSTRING(0);
+	cid_t		cid = PG_GETARG_INT64(1);
+
+	DtmLocalBeginPrepare(gtid);
+	cid = DtmLocalPrepare(gtid, cid);
+	DTM_TRACE((stderr, "Backend %d prepares transaction %s with cid=%lu\n", getpid(), gtid, cid));
+	PG_RETURN_INT64(cid);
+}
+
+/*
+ * Combination of dtm_end_prepare and COMMIT PREPARED: assign CSN chosen by coordinator
+ * and commit prepared transaction.
+ */
+Datum
+dtm_commit(PG_FUNCTION_ARGS)
+{
+	GlobalTransactionId gtid = PG_GETARG_CSTRING(0);
+	cid_t		cid = PG_GETARG_INT64(1);
+
+	if (IsTransactionBlock())
+		ereport(ERROR,
+				(errcode(ERRCODE_ACTIVE_SQL_TRANSACTION),
+				 errmsg("dtm_commit cannot run inside a transaction block")));
+
+	DTM_TRACE((stderr, "Backend %d commits transaction %s with cid=%lu\n", getpid(), gtid, cid));
+	DtmLocalEndPrepare(gtid, cid);
+	FinishPreparedTransaction(gtid, true);
+	PG_RETURN_VOID();
+}
+
 Datum
 dtm_get_csn(PG_FUNCTION_ARGS)
 {
@@ -416,6 +512,22 @@ dtm_get_csn(PG_FUNCTION_ARGS)
 	PG_RETURN_INT64(csn);
 }
 
+Datum
+dtm_get_wait_stats(PG_FUNCTION_ARGS)
+{
+	TupleDesc	desc;
+	Datum		values[2];
+	bool		nulls[2] = {false, false};
+
+	if (get_call_result_type(fcinfo, NULL, &desc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	values[0] = Int64GetDatum(pg_atomic_read_u64(&local->in_doubt_waits));
+	values[1] = Int64GetDatum(pg_atomic_read_u64(&local->in_doubt_wait_time));
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(desc, values, nulls)));
+}
+
 /*
  *	***************************************************************************
  */
@@ -463,6 +575,46 @@ DtmGetName(void)
 	return "pg_tsdtm";
 }
 
+/*
+ * Insert new entry in xid2status hash. Caller should not hold lock of any partition.
+ */
+static DtmTransStatus *
+DtmInsertTransStatus(TransactionId xid, XidStatus status, cid_t cid, int nSubxids)
+{
+	LWLock	   *lock = DTM_XID_LOCK(xid);
+	DtmTransStatus *ts;
+	bool		found;
+
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_ENTER, &found);
+	Assert(!found);
+	pg_atomic_init_u32(&ts->status, status);
+	pg_atomic_init_u64(&ts->cid, cid);
+	ts->nSubxids = nSubxids;
+	ts->next = NULL;
+	LWLockRelease(lock);
+
+	return ts;
+}
+
+/*
+ * Locate entry in xid2status hash.
+ * Entry can be accessed after partition lock is released only by holder of DTM_LIST_LOCK,
+ * because entries are removed only under exclusive list lock.
+ */
+static DtmTransStatus *
+DtmFindTransStatus(TransactionId xid)
+{
+	LWLock	   *lock = DTM_XID_LOCK(xid);
+	DtmTransStatus *ts;
+
+	LWLockAcquire(lock, LW_SHARED);
+	ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_FIND, NULL);
+	LWLockRelease(lock);
+
+	return ts;
+}
+
 static void
 DtmTransactionListAppend(DtmTransStatus * ts)
 {
@@ -496,31 +648,38 @@ DtmAdjustOldestXid(TransactionId xid)
 	{
 		DtmTransStatus *ts,
 				   *prev = NULL;
-		timestamp_t now = dtm_get_current_time();
-		timestamp_t cutoff_time = now - DtmVacuumDelay * USEC;
+		timestamp_t cutoff_time;
+		LWLock	   *lock = DTM_XID_LOCK(xid);
 
-		SpinLockAcquire(&local->lock);
+		LWLockAcquire(lock, LW_SHARED);
 		ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_FIND, NULL);
-		if (ts != NULL)
+		cutoff_time = ts != NULL ? pg_atomic_read_u64(&ts->cid) - DtmVacuumDelay * USEC : 0;
+		LWLockRelease(lock);
+
+		/*
+		 * If somebody else is already performing cleanup, do not wait for
+		 * it: previously observed oldest XID is always safe to return.
+		 */
+		if (ts != NULL && LWLockConditionalAcquire(DTM_LIST_LOCK, LW_EXCLUSIVE))
 		{
-			cutoff_time = ts->cid - DtmVacuumDelay * USEC;
-
-			for (ts = local->trans_list_head; ts != NULL && ts->cid < cutoff_time; prev = ts, ts = ts->next)
+			for (ts = local->trans_list_head; ts != NULL && pg_atomic_read_u64(&ts->cid) < cutoff_time; prev = ts, ts = ts->next)
 			{
 				if (prev != NULL)
+				{
+					lock = DTM_XID_LOCK(prev->xid);
+					LWLockAcquire(lock, LW_EXCLUSIVE);
 					hash_search(xid2status, &prev->xid, HASH_REMOVE, NULL);
+					LWLockRelease(lock);
+				}
 			}
+			if (prev != NULL)
+			{
+				local->trans_list_head = prev;
+				pg_atomic_write_u32(&local->oldest_xid, prev->xid);
+			}
+			LWLockRelease(DTM_LIST_LOCK);
 		}
-		if (prev != NULL)
-		{
-			local->trans_list_head = prev;
-			local->oldest_xid = xid = prev->xid;
-		}
-		else
-		{
-			xid = local->oldest_xid;
-		}
-		SpinLockRelease(&local->lock);
+		xid = pg_atomic_read_u32(&local->oldest_xid);
 	}
 	return xid;
 }
@@ -529,6 +688,7 @@ Snapshot
 DtmGetSnapshot(Snapshot snapshot)
 {
 	snapshot = PgGetSnapshotData(snapshot);
+	DtmLocalXmin = RecentGlobalDataXmin;
 	RecentGlobalDataXmin = RecentGlobalXmin = DtmAdjustOldestXid(RecentGlobalDataXmin);
 	return snapshot;
 }
@@ -538,10 +698,41 @@ DtmGetOldestXmin(Relation rel, bool ignoreVacuum)
 {
 	TransactionId xmin = PgGetOldestXmin(rel, ignoreVacuum);
 
+	DtmLocalXmin = xmin;
 	xmin = DtmAdjustOldestXid(xmin);
 	return xmin;
 }
 
+/*
+ * Oldest xmin is held back by DtmAdjustOldestXid until all transactions
+ * committed in last dtm.vacuum_delay seconds are forgotten. But a global
+ * transaction committed before that interval is visible for all snapshots:
+ * remote ones can not be older than dtm.vacuum_delay (see DtmLocalAccess)
+ * and local ones are checked using local oldest xmin.
+ */
+static bool
+DtmIsDeadForAllSnapshots(TransactionId xmax)
+{
+	cid_t		cutoff = dtm_get_current_time() - (cid_t) DtmVacuumDelay * USEC;
+	LWLock	   *lock = DTM_XID_LOCK(xmax);
+	DtmTransStatus *ts;
+	bool		dead = false;
+
+	if (!TransactionIdIsNormal(DtmLocalXmin) || !TransactionIdPrecedes(xmax, DtmLocalXmin))
+		return false;
+
+	LWLockAcquire(lock, LW_SHARED);
+	ts = (DtmTransStatus *) hash_search(xid2status, &xmax, HASH_FIND, NULL);
+	if (ts != NULL)
+	{
+		dead = pg_atomic_read_u32(&ts->status) == TRANSACTION_STATUS_COMMITTED;
+		pg_read_barrier();
+		dead &= pg_atomic_read_u64(&ts->cid) < cutoff;
+	}
+	LWLockRelease(lock);
+	return dead;
+}
+
 /*
  * Check tuple bisibility based on CSN of current transaction.
  * If there is no niformation about transaction with this XID, then use standard PostgreSQL visibility rules.
@@ -550,55 +741,159 @@ bool
 DtmXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 {
 	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	LWLock	   *lock = DTM_XID_LOCK(xid);
 
 	Assert(xid != InvalidTransactionId);
 
-	SpinLockAcquire(&local->lock);
-
 	while (true)
 	{
-		DtmTransStatus *ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_FIND, NULL);
+		DtmTransStatus *ts;
+		XidStatus	status;
+		cid_t		cid;
 
-		if (ts != NULL)
+		LWLockAcquire(lock, LW_SHARED);
+		ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_FIND, NULL);
+		if (ts == NULL)
 		{
-			if (ts->cid > dtm_tx.snapshot)
-			{
-				DTM_TRACE((stderr, "%d: tuple with xid=%d(csn=%lld) is invisibile in snapshot %lld\n",
-						   getpid(), xid, ts->cid, dtm_tx.snapshot));
-				SpinLockRelease(&local->lock);
-				return true;
-			}
-			if (ts->status == TRANSACTION_STATUS_IN_PROGRESS)
-			{
-				DTM_TRACE((stderr, "%d: wait for in-doubt transaction %u in snapshot %lu\n", getpid(), xid, dtm_tx.snapshot));
-				SpinLockRelease(&local->lock);
+			LWLockRelease(lock);
+			DTM_TRACE((stderr, "%d: visibility check is skept for transaction %u in snapshot %lu\n", getpid(), xid, dtm_tx.snapshot));
+			break;
+		}
 
-				dtm_sleep(delay);
+		/*
+		 * Status should be read before CSN: CSN of in-doubt transaction can
+		 * only increase, and final CSN is assigned before status is changed.
+		 */
+		status = pg_atomic_read_u32(&ts->status);
+		pg_read_barrier();
+		cid = pg_atomic_read_u64(&ts->cid);
+		LWLockRelease(lock);
 
-				if (delay * 2 <= MAX_WAIT_TIMEOUT)
-					delay *= 2;
-				SpinLockAcquire(&local->lock);
-			}
-			else
-			{
-				bool		invisible = ts->status == TRANSACTION_STATUS_ABORTED;
+		if (cid > dtm_tx.snapshot)
+		{
+			DTM_TRACE((stderr, "%d: tuple with xid=%d(csn=%lld) is invisibile in snapshot %lld\n",
+					   getpid(), xid, cid, dtm_tx.snapshot));
+			return true;
+		}
+		if (status == TRANSACTION_STATUS_IN_PROGRESS)
+		{
+			timestamp_t start = dtm_get_current_time();
 
-				DTM_TRACE((stderr, "%d: tuple with xid=%d(csn= %lld) is %s in snapshot %lld\n",
-						   getpid(), xid, ts->cid, invisible ? "rollbacked" : "committed", dtm_tx.snapshot));
-				SpinLockRelease(&local->lock);
-				return invisible;
-			}
+			DTM_TRACE((stderr, "%d: wait for in-doubt transaction %u in snapshot %lu\n", getpid(), xid, dtm_tx.snapshot));
+
+			pgstat_report_wait_start(WAIT_EXTENSION, DtmInDoubtWaitEvent);
+			dtm_sleep(delay);
+			pgstat_report_wait_end();
+			pg_atomic_fetch_add_u64(&local->in_doubt_waits, 1);
+			pg_atomic_fetch_add_u64(&local->in_doubt_wait_time, dtm_get_current_time() - start);
+
+			if (delay * 2 <= MAX_WAIT_TIMEOUT)
+				delay *= 2;
 		}
 		else
 		{
-			DTM_TRACE((stderr, "%d: visibility check is skept for transaction %u in snapshot %lu\n", getpid(), xid, dtm_tx.snapshot));
-			break;
+			bool		invisible = status == TRANSACTION_STATUS_ABORTED;
+
+			DTM_TRACE((stderr, "%d: tuple with xid=%d(csn= %lld) is %s in snapshot %lld\n",
+					   getpid(), xid, cid, invisible ? "rollbacked" : "committed", dtm_tx.snapshot));
+			return invisible;
 		}
 	}
-	SpinLockRelease(&local->lock);
 	return PgXidInMVCCSnapshot(xid, snapshot);
 }
 
+/*
+ * Batched version of DtmXidInMVCCSnapshot used for page-at-a-time scans:
+ * lock of each xid2status partition is taken once for all xids of the page.
+ * Xids which are not global are resolved after releasing the lock by
+ * PgXidInMVCCSnapshot.  In-doubt xids are not awaited one by one: backend
+ * sleeps once for all of them and rechecks them together, so a page full of
+ * rows of 2PC transactions in flight is usually waited for once.
+ */
+static void
+DtmXidInMVCCSnapshotBatch(TransactionId *xids, int n, Snapshot snapshot, bool *result)
+{
+	enum
+	{
+		XID_RESOLVED, XID_LOCAL, XID_IN_DOUBT
+	}			state[2 * MaxHeapTuplesPerPage];
+	timestamp_t delay = MIN_WAIT_TIMEOUT;
+	int			nInDoubt = n;
+	int			part;
+	int			i;
+
+	Assert(n <= 2 * MaxHeapTuplesPerPage);
+
+	for (i = 0; i < n; i++)
+		state[i] = XID_IN_DOUBT;
+
+	while (true)
+	{
+		for (part = 0; part < DTM_XID_PARTITIONS; part++)
+		{
+			bool		locked = false;
+
+			for (i = 0; i < n; i++)
+			{
+				DtmTransStatus *ts;
+				XidStatus	status;
+
+				if (state[i] != XID_IN_DOUBT ||
+					(xids[i] & (DTM_XID_PARTITIONS - 1)) != part)
+					continue;
+				if (!locked)
+				{
+					LWLockAcquire(DTM_XID_LOCK(xids[i]), LW_SHARED);
+					locked = true;
+				}
+				ts = (DtmTransStatus *) hash_search(xid2status, &xids[i], HASH_FIND, NULL);
+				if (ts == NULL)
+				{
+					state[i] = XID_LOCAL;
+					nInDoubt -= 1;
+					continue;
+				}
+				status = pg_atomic_read_u32(&ts->status);
+				pg_read_barrier();
+				if (pg_atomic_read_u64(&ts->cid) > dtm_tx.snapshot)
+				{
+					state[i] = XID_RESOLVED;
+					result[i] = true;
+					nInDoubt -= 1;
+				}
+				else if (status != TRANSACTION_STATUS_IN_PROGRESS)
+				{
+					state[i] = XID_RESOLVED;
+					result[i] = status == TRANSACTION_STATUS_ABORTED;
+					nInDoubt -= 1;
+				}
+			}
+			if (locked)
+				LWLockRelease(DTM_XID_LOCK(part));
+		}
+		if (nInDoubt == 0)
+			break;
+
+		DTM_TRACE((stderr, "%d: wait for %d in-doubt transactions in snapshot %lu\n", getpid(), nInDoubt, dtm_tx.snapshot));
+		{
+			timestamp_t start = dtm_get_current_time();
+
+			pgstat_report_wait_start(WAIT_EXTENSION, DtmInDoubtWaitEvent);
+			dtm_sleep(delay);
+			pgstat_report_wait_end();
+			pg_atomic_fetch_add_u64(&local->in_doubt_waits, 1);
+			pg_atomic_fetch_add_u64(&local->in_doubt_wait_time, dtm_get_current_time() - start);
+		}
+		if (delay * 2 <= MAX_WAIT_TIMEOUT)
+			delay *= 2;
+	}
+	for (i = 0; i < n; i++)
+	{
+		if (state[i] == XID_LOCAL)
+			result[i] = PgXidInMVCCSnapshot(xids[i], snapshot);
+	}
+}
+
 void
 DtmInitialize()
 {
@@ -609,38 +904,68 @@ DtmInitialize()
 	info.entrysize = sizeof(DtmTransStatus);
 	info.hash = dtm_xid_hash_fn;
 	info.match = dtm_xid_match_fn;
+	info.num_partitions = DTM_XID_PARTITIONS;
 	xid2status = ShmemInitHash("xid2status",
 							   DTM_HASH_INIT_SIZE, DTM_HASH_INIT_SIZE,
 							   &info,
-							   HASH_ELEM | HASH_FUNCTION | HASH_COMPARE);
+					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_PARTITION);
 
 	info.keysize = MAX_GTID_SIZE;
 	info.entrysize = sizeof(DtmTransId);
 	info.hash = dtm_gtid_hash_fn;
 	info.match = dtm_gtid_match_fn;
 	info.keycopy = dtm_gtid_keycopy_fn;
+	info.num_partitions = DTM_GTID_PARTITIONS;
 	gtid2xid = ShmemInitHash("gtid2xid",
 							 DTM_HASH_INIT_SIZE, DTM_HASH_INIT_SIZE,
 							 &info,
-					HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_KEYCOPY);
+	 HASH_ELEM | HASH_FUNCTION | HASH_COMPARE | HASH_KEYCOPY | HASH_PARTITION);
 
 	TM = &DtmTM;
 
 	LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+	dtm_locks = GetNamedLWLockTranche("pg_tsdtm");
 	local = (DtmNodeState *) ShmemInitStruct("dtm", sizeof(DtmNodeState), &found);
 	if (!found)
 	{
-		local->time_shift = 0;
-		local->oldest_xid = FirstNormalTransactionId;
-		local->cid = dtm_get_current_time();
+		pg_atomic_init_u32(&local->oldest_xid, FirstNormalTransactionId);
+		pg_atomic_init_u64(&local->cid, dtm_get_current_time());
 		local->trans_list_head = NULL;
 		local->trans_list_tail = &local->trans_list_head;
-		SpinLockInit(&local->lock);
+		dlist_init(&local->in_doubt_list);
+		pg_atomic_init_u64(&local->in_doubt_waits, 0);
+		pg_atomic_init_u64(&local->in_doubt_wait_time, 0);
 		RegisterXactCallback(dtm_xact_callback, NULL);
 	}
 	LWLockRelease(AddinShmemInitLock);
 }
 
+/*
+ * Choose snapshot preceding all in-doubt transactions, so that visibility
+ * checks never have to wait for them. Snapshot lag is limited by
+ * dtm.read_staleness and by dtm.vacuum_delay: if some transaction stays
+ * in-doubt longer, then reader can still wait for it.
+ */
+static cid_t
+DtmGetStaleSnapshot(void)
+{
+	cid_t		now = dtm_get_cid();
+	cid_t		snapshot = now - (cid_t) DtmReadStaleness * 1000;
+	cid_t		oldest = now - (cid_t) DtmVacuumDelay * USEC;
+
+	LWLockAcquire(DTM_LIST_LOCK, LW_SHARED);
+	if (!dlist_is_empty(&local->in_doubt_list))
+	{
+		DtmTransId *id = dlist_head_element(DtmTransId, in_doubt, &local->in_doubt_list);
+
+		if (id->prepare_cid <= snapshot)
+			snapshot = id->prepare_cid - 1;
+	}
+	LWLockRelease(DTM_LIST_LOCK);
+
+	return snapshot < oldest ? oldest : snapshot;
+}
+
 /*
  * Start transaction at local node.
  * Associate local snapshot (current time) with this transaction.
@@ -650,18 +975,67 @@ DtmLocalBegin(DtmCurrentTrans * x)
 {
 	if (!TransactionIdIsValid(x->xid))
 	{
-		SpinLockAcquire(&local->lock);
 		x->xid = GetCurrentTransactionId();
 		Assert(TransactionIdIsValid(x->xid));
 		x->cid = INVALID_CID;
 		x->is_global = false;
 		x->is_prepared = false;
-		x->snapshot = dtm_get_cid();
-		SpinLockRelease(&local->lock);
+		x->snapshot = DtmReadStaleness != 0 ? DtmGetStaleSnapshot() : dtm_get_cid();
 		DTM_TRACE((stderr, "DtmLocalBegin: transaction %u uses local snapshot %lu\n", x->xid, x->snapshot));
 	}
 }
 
+/*
+ * Register global transaction identifier of current transaction
+ */
+static void
+DtmRegisterGtid(DtmCurrentTrans * x, GlobalTransactionId gtid)
+{
+	LWLock	   *lock = DTM_GTID_LOCK(dtm_gtid_hash_fn(gtid, 0));
+	DtmTransId *id;
+
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_ENTER, NULL);
+	id->xid = x->xid;
+	id->nSubxids = 0;
+	id->subxids = 0;
+	id->prepare_cid = INVALID_CID;
+	LWLockRelease(lock);
+}
+
+/*
+ * Get copy of global transaction descriptor.
+ * Removed transaction is also excluded from the list of in-doubt transactions.
+ */
+static void
+DtmLookupGtid(GlobalTransactionId gtid, DtmTransId * copy, bool remove)
+{
+	LWLock	   *lock = DTM_GTID_LOCK(dtm_gtid_hash_fn(gtid, 0));
+	DtmTransId *id;
+
+	if (remove)
+	{
+		LWLockAcquire(DTM_LIST_LOCK, LW_EXCLUSIVE);
+		LWLockAcquire(lock, LW_EXCLUSIVE);
+		id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
+		Assert(id != NULL);
+		if (id->prepare_cid != INVALID_CID)
+			dlist_delete(&id->in_doubt);
+		*copy = *id;
+		hash_search(gtid2xid, gtid, HASH_REMOVE, NULL);
+		LWLockRelease(lock);
+		LWLockRelease(DTM_LIST_LOCK);
+	}
+	else
+	{
+		LWLockAcquire(lock, LW_SHARED);
+		id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
+		Assert(id != NULL);
+		*copy = *id;
+		LWLockRelease(lock);
+	}
+}
+
 /*
  * Transaction is going to be distributed.
  * Returns snapshot of current transaction.
@@ -671,15 +1045,7 @@ DtmLocalExtend(DtmCurrentTrans * x, GlobalTransactionId gtid)
 {
 	if (gtid != NULL)
 	{
-		SpinLockAcquire(&local->lock);
-		{
-			DtmTransId *id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_ENTER, NULL);
-
-			id->xid = x->xid;
-			id->nSubxids = 0;
-			id->subxids = 0;
-		}
-		SpinLockRelease(&local->lock);
+		DtmRegisterGtid(x, gtid);
 	}
 	x->is_global = true;
 	return x->snapshot;
@@ -694,21 +1060,13 @@ DtmLocalAccess(DtmCurrentTrans * x, GlobalTransactionId gtid, cid_t global_cid)
 {
 	cid_t		local_cid;
 
-	SpinLockAcquire(&local->lock);
+	if (gtid != NULL)
 	{
-		if (gtid != NULL)
-		{
-			DtmTransId *id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_ENTER, NULL);
-
-			id->xid = x->xid;
-			id->nSubxids = 0;
-			id->subxids = 0;
-		}
-		local_cid = dtm_sync(global_cid);
-		x->snapshot = global_cid;
-		x->is_global = true;
+		DtmRegisterGtid(x, gtid);
 	}
-	SpinLockRelease(&local->lock);
+	local_cid = dtm_sync(global_cid);
+	x->snapshot = global_cid;
+	x->is_global = true;
 	if (global_cid < local_cid - DtmVacuumDelay * USEC)
 	{
 		elog(ERROR, "Too old snapshot: requested %ld, current %ld", global_cid, local_cid);
@@ -723,22 +1081,37 @@ DtmLocalAccess(DtmCurrentTrans * x, GlobalTransactionId gtid, cid_t global_cid)
 void
 DtmLocalBeginPrepare(GlobalTransactionId gtid)
 {
-	SpinLockAcquire(&local->lock);
-	{
-		DtmTransStatus *ts;
-		DtmTransId *id;
+	DtmTransStatus *ts;
+	DtmTransId *id;
+	TransactionId xid;
+	TransactionId *subxids;
+	int			nSubxids;
+	cid_t		cid;
+	LWLock	   *lock = DTM_GTID_LOCK(dtm_gtid_hash_fn(gtid, 0));
 
-		id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
-		Assert(id != NULL);
-		Assert(TransactionIdIsValid(id->xid));
-		ts = (DtmTransStatus *) hash_search(xid2status, &id->xid, HASH_ENTER, NULL);
-		ts->status = TRANSACTION_STATUS_IN_PROGRESS;
-		ts->cid = dtm_get_cid();
-		ts->nSubxids = id->nSubxids;
-		DtmTransactionListAppend(ts);
-		DtmAddSubtransactions(ts, id->subxids, id->nSubxids);
-	}
-	SpinLockRelease(&local->lock);
+	LWLockAcquire(DTM_LIST_LOCK, LW_EXCLUSIVE);
+
+	/*
+	 * Prepare CSNs are assigned under exclusive list lock, so in_doubt_list
+	 * is ordered by them.
+	 */
+	cid = dtm_get_cid();
+	LWLockAcquire(lock, LW_EXCLUSIVE);
+	id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
+	Assert(id != NULL);
+	Assert(TransactionIdIsValid(id->xid));
+	Assert(id->prepare_cid == INVALID_CID);
+	id->prepare_cid = cid;
+	dlist_push_tail(&local->in_doubt_list, &id->in_doubt);
+	xid = id->xid;
+	subxids = id->subxids;
+	nSubxids = id->nSubxids;
+	LWLockRelease(lock);
+
+	ts = DtmInsertTransStatus(xid, TRANSACTION_STATUS_IN_PROGRESS, cid, nSubxids);
+	DtmTransactionListAppend(ts);
+	DtmAddSubtransactions(ts, subxids, nSubxids);
+	LWLockRelease(DTM_LIST_LOCK);
 }
 
 /*
@@ -750,13 +1123,11 @@ DtmLocalPrepare(GlobalTransactionId gtid, cid_t global_cid)
 {
 	cid_t		local_cid;
 
-	SpinLockAcquire(&local->lock);
 	local_cid = dtm_get_cid();
 	if (local_cid > global_cid)
 	{
 		global_cid = local_cid;
 	}
-	SpinLockRelease(&local->lock);
 	return global_cid;
 }
 
@@ -766,28 +1137,27 @@ DtmLocalPrepare(GlobalTransactionId gtid, cid_t global_cid)
 void
 DtmLocalEndPrepare(GlobalTransactionId gtid, cid_t cid)
 {
-	SpinLockAcquire(&local->lock);
 	{
 		DtmTransStatus *ts;
-		DtmTransId *id;
+		DtmTransId	id;
 		int			i;
 
-		id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
-		Assert(id != NULL);
+		DtmLookupGtid(gtid, &id, false);
 
-		ts = (DtmTransStatus *) hash_search(xid2status, &id->xid, HASH_FIND, NULL);
+		LWLockAcquire(DTM_LIST_LOCK, LW_SHARED);
+		ts = DtmFindTransStatus(id.xid);
 		Assert(ts != NULL);
-		ts->cid = cid;
+		pg_atomic_write_u64(&ts->cid, cid);
 		for (i = 0; i < ts->nSubxids; i++)
 		{
 			ts = ts->next;
-			ts->cid = cid;
+			pg_atomic_write_u64(&ts->cid, cid);
 		}
+		LWLockRelease(DTM_LIST_LOCK);
 		dtm_sync(cid);
 
-		DTM_TRACE((stderr, "Prepare transaction %u(%s) with CSN %lu\n", id->xid, gtid, cid));
+		DTM_TRACE((stderr, "Prepare transaction %u(%s) with CSN %lu\n", id.xid, gtid, cid));
 	}
-	SpinLockRelease(&local->lock);
 
 	/*
 	 * Record commit in pg_committed_xact table to be make it possible to
@@ -817,20 +1187,18 @@ DtmLocalCommitPrepared(DtmCurrentTrans * x, GlobalTransactionId gtid)
 {
 	Assert(gtid != NULL);
 
-	SpinLockAcquire(&local->lock);
 	{
-		DtmTransId *id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_REMOVE, NULL);
+		DtmTransId	id;
 
-		Assert(id != NULL);
+		DtmLookupGtid(gtid, &id, true);
 
 		x->is_global = true;
 		x->is_prepared = true;
-		x->xid = id->xid;
-		free(id->subxids);
+		x->xid = id.xid;
+		free(id.subxids);
 
 		DTM_TRACE((stderr, "Global transaction %u(%s) is precommitted\n", x->xid, gtid));
 	}
-	SpinLockRelease(&local->lock);
 }
 
 /*
@@ -839,42 +1207,43 @@ DtmLocalCommitPrepared(DtmCurrentTrans * x, GlobalTransactionId gtid)
 void
 DtmLocalCommit(DtmCurrentTrans * x)
 {
-	SpinLockAcquire(&local->lock);
 	if (TransactionIdIsValid(x->xid))
 	{
-		bool		found;
 		DtmTransStatus *ts;
 
-		ts = (DtmTransStatus *) hash_search(xid2status, &x->xid, HASH_ENTER, &found);
-		ts->status = TRANSACTION_STATUS_COMMITTED;
 		if (x->is_prepared)
 		{
 			int			i;
-			DtmTransStatus *sts = ts;
+			DtmTransStatus *sts;
 
-			Assert(found);
 			Assert(x->is_global);
-			for (i = 0; i < ts->nSubxids; i++)
+			LWLockAcquire(DTM_LIST_LOCK, LW_SHARED);
+			ts = DtmFindTransStatus(x->xid);
+			Assert(ts != NULL);
+			pg_atomic_write_u32(&ts->status, TRANSACTION_STATUS_COMMITTED);
+			for (i = 0, sts = ts; i < ts->nSubxids; i++)
 			{
 				sts = sts->next;
-				Assert(sts->cid == ts->cid);
-				sts->status = TRANSACTION_STATUS_COMMITTED;
+				Assert(pg_atomic_read_u64(&sts->cid) == pg_atomic_read_u64(&ts->cid));
+				pg_atomic_write_u32(&sts->status, TRANSACTION_STATUS_COMMITTED);
 			}
+			x->cid = pg_atomic_read_u64(&ts->cid);
+			LWLockRelease(DTM_LIST_LOCK);
 		}
 		else
 		{
 			TransactionId *subxids;
+			int			nSubxids = xactGetCommittedChildren(&subxids);
 
-			Assert(!found);
-			ts->cid = dtm_get_cid();
+			x->cid = dtm_get_cid();
+			LWLockAcquire(DTM_LIST_LOCK, LW_EXCLUSIVE);
+			ts = DtmInsertTransStatus(x->xid, TRANSACTION_STATUS_COMMITTED, x->cid, nSubxids);
 			DtmTransactionListAppend(ts);
-			ts->nSubxids = xactGetCommittedChildren(&subxids);
-			DtmAddSubtransactions(ts, subxids, ts->nSubxids);
+			DtmAddSubtransactions(ts, subxids, nSubxids);
+			LWLockRelease(DTM_LIST_LOCK);
 		}
-		x->cid = ts->cid;
 		DTM_TRACE((stderr, "Local transaction %u is committed at %lu\n", x->xid, x->cid));
 	}
-	SpinLockRelease(&local->lock);
 }
 
 /*
@@ -885,20 +1254,18 @@ DtmLocalAbortPrepared(DtmCurrentTrans * x, GlobalTransactionId gtid)
 {
 	Assert(gtid != NULL);
 
-	SpinLockAcquire(&local->lock);
 	{
-		DtmTransId *id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_REMOVE, NULL);
+		DtmTransId	id;
 
-		Assert(id != NULL);
+		DtmLookupGtid(gtid, &id, true);
 
 		x->is_global = true;
 		x->is_prepared = true;
-		x->xid = id->xid;
-		free(id->subxids);
+		x->xid = id.xid;
+		free(id.subxids);
 
 		DTM_TRACE((stderr, "Global transaction %u(%s) is preaborted\n", x->xid, gtid));
 	}
-	SpinLockRelease(&local->lock);
 }
 
 /*
@@ -907,30 +1274,30 @@ DtmLocalAbortPrepared(DtmCurrentTrans * x, GlobalTransactionId gtid)
 void
 DtmLocalAbort(DtmCurrentTrans * x)
 {
-	SpinLockAcquire(&local->lock);
 	{
-		bool		found;
 		DtmTransStatus *ts;
 
 		Assert(TransactionIdIsValid(x->xid));
-		ts = (DtmTransStatus *) hash_search(xid2status, &x->xid, HASH_ENTER, &found);
 		if (x->is_prepared)
 		{
-			Assert(found);
 			Assert(x->is_global);
+			LWLockAcquire(DTM_LIST_LOCK, LW_SHARED);
+			ts = DtmFindTransStatus(x->xid);
+			Assert(ts != NULL);
+			x->cid = pg_atomic_read_u64(&ts->cid);
+			pg_atomic_write_u32(&ts->status, TRANSACTION_STATUS_ABORTED);
+			LWLockRelease(DTM_LIST_LOCK);
 		}
 		else
 		{
-			Assert(!found);
-			ts->cid = dtm_get_cid();
-			ts->nSubxids = 0;
+			x->cid = dtm_get_cid();
+			LWLockAcquire(DTM_LIST_LOCK, LW_EXCLUSIVE);
+			ts = DtmInsertTransStatus(x->xid, TRANSACTION_STATUS_ABORTED, x->cid, 0);
 			DtmTransactionListAppend(ts);
+			LWLockRelease(DTM_LIST_LOCK);
 		}
-		x->cid = ts->cid;
-		ts->status = TRANSACTION_STATUS_ABORTED;
 		DTM_TRACE((stderr, "Local transaction %u is aborted at %lu\n", x->xid, x->cid));
 	}
-	SpinLockRelease(&local->lock);
 }
 
 /*
@@ -980,17 +1347,18 @@ static cid_t
 DtmGetCsn(TransactionId xid)
 {
 	cid_t		csn = 0;
+	LWLock	   *lock = DTM_XID_LOCK(xid);
 
-	SpinLockAcquire(&local->lock);
+	LWLockAcquire(lock, LW_SHARED);
 	{
 		DtmTransStatus *ts = (DtmTransStatus *) hash_search(xid2status, &xid, HASH_FIND, NULL);
 
 		if (ts != NULL)
 		{
-			csn = ts->cid;
+			csn = pg_atomic_read_u64(&ts->cid);
 		}
 	}
-	SpinLockRelease(&local->lock);
+	LWLockRelease(lock);
 	return csn;
 }
 
@@ -1002,7 +1370,9 @@ DtmLocalSavePreparedState(GlobalTransactionId gtid)
 {
 	if (gtid != NULL)
 	{
-		SpinLockAcquire(&local->lock);
+		LWLock	   *lock = DTM_GTID_LOCK(dtm_gtid_hash_fn(gtid, 0));
+
+		LWLockAcquire(lock, LW_EXCLUSIVE);
 		{
 			DtmTransId *id = (DtmTransId *) hash_search(gtid2xid, gtid, HASH_FIND, NULL);
 
@@ -1019,13 +1389,14 @@ DtmLocalSavePreparedState(GlobalTransactionId gtid)
 				}
 			}
 		}
-		SpinLockRelease(&local->lock);
+		LWLockRelease(lock);
 	}
 }
 
 /*
  * Add subtransactions to finished transactions list.
  * Copy CSN and status of parent transaction.
+ * Caller should hold DTM_LIST_LOCK in exclusive mode.
  */
 static void
 DtmAddSubtransactions(DtmTransStatus * ts, TransactionId *subxids, int nSubxids)
@@ -1034,15 +1405,12 @@ DtmAddSubtransactions(DtmTransStatus * ts, TransactionId *subxids, int nSubxids)
 
 	for (i = 0; i < nSubxids; i++)
 	{
-		bool		found;
 		DtmTransStatus *sts;
 
 		Assert(TransactionIdIsValid(subxids[i]));
-		sts = (DtmTransStatus *) hash_search(xid2status, &subxids[i], HASH_ENTER, &found);
-		Assert(!found);
-		sts->status = ts->status;
-		sts->cid = ts->cid;
-		sts->nSubxids = 0;
+		sts = DtmInsertTransStatus(subxids[i],
+								   pg_atomic_read_u32(&ts->status),
+								   pg_atomic_read_u64(&ts->cid), 0);
 		DtmTransactionListInsertAfter(ts, sts);
 	}
 }
@@ -1,4 +1,5 @@
 #include <time.h>
+#include <math.h>
 #include <stdio.h>
 #include <stdarg.h>
 #include <stdlib.h>
@@ -6,6 +7,7 @@
 #include <sys/time.h>
 #include <pthread.h>
 
+#include <string.h>
 #include <string>
 #include <vector>
 
@@ -36,11 +38,110 @@ class my_unique_ptr
 typedef void* (*thread_proc_t)(void*);
 typedef int64_t csn_t;
 
+/*
+ * Log-linear latency histogram in the spirit of HdrHistogram: values below
+ * SUB_BUCKETS usec are recorded exactly, larger ones with a relative error
+ * of at most 2/SUB_BUCKETS.
+ */
+struct histogram
+{
+    enum {
+        SUB_BUCKET_BITS = 7,
+        SUB_BUCKETS = 1 << SUB_BUCKET_BITS,
+        HALF_BUCKETS = SUB_BUCKETS / 2,
+        MAX_VALUE_BITS = 40,
+        N_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * HALF_BUCKETS
+    };
+    size_t counts[N_BUCKETS];
+    size_t count;
+    time_t sum;
+    time_t maxValue;
+
+    void reset() {
+        memset(counts, 0, sizeof counts);
+        count = 0;
+        sum = 0;
+        maxValue = 0;
+    }
+
+    static int bucket(time_t value) {
+        int shift = 0;
+        while ((value >> shift) >= SUB_BUCKETS) {
+            shift += 1;
+        }
+        int i = shift == 0 ? (int)value : shift*HALF_BUCKETS + (int)(value >> shift);
+        return i < N_BUCKETS ? i : N_BUCKETS - 1;
+    }
+
+    static time_t upperBound(int i) {
+        if (i < SUB_BUCKETS) {
+            return i;
+        }
+        int shift = i/HALF_BUCKETS - 1;
+        return ((time_t)(i - shift*HALF_BUCKETS + 1) << shift) - 1;
+    }
+
+    void add(time_t value) {
+        if (value < 0) {
+            value = 0;
+        }
+        counts[bucket(value)] += 1;
+        count += 1;
+        sum += value;
+        if (value > maxValue) {
+            maxValue = value;
+        }
+    }
+
+    void merge(histogram const& other) {
+        for (int i = 0; i < N_BUCKETS; i++) {
+            counts[i] += other.counts[i];
+        }
+        count += other.count;
+        sum += other.sum;
+        if (other.maxValue > maxValue) {
+            maxValue = other.maxValue;
+        }
+    }
+
+    time_t percentile(double p) const {
+        size_t rank = (size_t)ceil(p*count/100);
+        size_t seen = 0;
+        if (rank == 0) {
+            rank = 1;
+        }
+        for (int i = 0; i < N_BUCKETS && count != 0; i++) {
+            seen += counts[i];
+            if (seen >= rank) {
+                return upperBound(i) < maxValue ? upperBound(i) : maxValue;
+            }
+        }
+        return maxValue;
+    }
+
+    void print(char const* name) const {
+        printf("\"%s\":{\"count\":%ld, \"mean\":%ld, \"p50\":%ld, \"p99\":%ld, \"p999\":%ld, \"max\":%ld}",
+               name, count, count != 0 ? sum/count : 0,
+               percentile(50), percentile(99), percentile(99.9), maxValue);
+    }
+};
+
+/* transaction types we keep latency histograms for */
+enum txn_type
+{
+    TXN_TRANSFER,   /* writer moving money between two nodes */
+    TXN_TOTAL,      /* reader summing all accounts on all nodes */
+    N_TXN_TYPES
+};
+
+static char const* const txnTypeNames[N_TXN_TYPES] = { "transfer", "total" };
+
 struct thread
 {
     pthread_t t;
     size_t proceeded;
     size_t aborts;
+    histogram latency[N_TXN_TYPES];
     time_t max_trans_duration;
     int id;
 
@@ -48,6 +149,9 @@ struct thread
         id = tid;
         proceeded = 0;
         aborts = 0;
+        for (int i = 0; i < N_TXN_TYPES; i++) {
+            latency[i].reset();
+        }
         max_trans_duration = 0;
         pthread_create(&t, NULL, proc, this);
     }
@@ -68,12 +172,14 @@ struct config
     bool deadlockFree;
     bool maxSnapshot;
     bool makeSavepoints;
+    int rate;
     vector<string> connections;
 
     config() {
         nReaders = 1;
         nWriters = 10;
         nIterations = 1000;
+        rate = 0;
         nAccounts = 100000;  
         startId = 0;
         diapason = 100000;
@@ -85,6 +191,7 @@ struct config
 
 config cfg;
 bool running;
+time_t benchStart;
 
 #define USEC 1000000
 
@@ -95,6 +202,17 @@ static time_t getCurrentTime()
     return (time_t)tv.tv_sec*USEC + tv.tv_usec;
 }
 
+static void waitUntil(time_t when)
+{
+    time_t now = getCurrentTime();
+    if (when > now) {
+        struct timespec ts;
+        ts.tv_sec = (when - now) / USEC;
+        ts.tv_nsec = (when - now) % USEC * 1000;
+        nanosleep(&ts, NULL);
+    }
+}
+
 inline csn_t max(csn_t t1, csn_t t2) { 
     return t1 < t2 ? t2 : t1;
 }
@@ -165,6 +283,7 @@ void* reader(void* arg)
         if (elapsed > t.max_trans_duration) { 
             t.max_trans_duration = elapsed;
         }
+        t.latency[TXN_TOTAL].add(elapsed);
     }
     return NULL;
 }
@@ -177,8 +296,23 @@ void* writer(void* arg)
     srcCon = new connection(cfg.connections[t.id % cfg.connections.size()]);
     dstCon = new connection(cfg.connections[(t.id + 1) % cfg.connections.size()]);
 
+    /*
+     * In open-loop mode every writer issues transactions on a fixed schedule
+     * and latency is measured from the scheduled start, so that a stalled
+     * commit is charged for the transactions queued up behind it instead of
+     * silently lowering the arrival rate.
+     */
+    time_t interval = cfg.rate != 0 ? (time_t)cfg.nWriters*USEC/cfg.rate : 0;
+
     for (int i = 0; i < cfg.nIterations; i++)
     { 
+        time_t start;
+        if (interval != 0) {
+            start = benchStart + (time_t)i*interval;
+            waitUntil(start);
+        } else {
+            start = getCurrentTime();
+        }
         char gtid[32];
 
         int srcAcc = cfg.startId + random() % cfg.diapason;
@@ -193,8 +327,6 @@ void* writer(void* arg)
 
         nontransaction srcTx(*srcCon);
         nontransaction dstTx(*dstCon);
-        
-        time_t start = getCurrentTime();
 
         exec(srcTx, "begin transaction");
         exec(dstTx, "begin transaction");
@@ -238,6 +370,7 @@ void* writer(void* arg)
         if (elapsed > t.max_trans_duration) { 
             t.max_trans_duration = elapsed;
         }
+        t.latency[TXN_TRANSFER].add(elapsed);
  
         t.proceeded += 1;
     }
@@ -288,6 +421,9 @@ int main (int argc, char* argv[])
             case 'd':
                 cfg.diapason = atoi(argv[++i]);
                 continue;
+            case 'R':
+                cfg.rate = atoi(argv[++i]);
+                continue;
             case 'C':
             case 'c':
                 cfg.connections.push_back(string(argv[++i]));
@@ -313,6 +449,7 @@ int main (int argc, char* argv[])
                "\t-s N\tperform updates starting from this id (0)\n"
                "\t-d N\tperform updates in this diapason (#accounts)\n"
                "\t-n N\tnumber of iterations (1000)\n"
+               "\t-R N\topen-loop mode: writer transactions per second (0 = closed loop)\n"
                "\t-c STR\tdatabase connection string\n"
                "\t-f\tavoid deadlocks by ordering accounts\n"
                "\t-m\tchoose maximal snapshot\n"
@@ -333,6 +470,7 @@ int main (int argc, char* argv[])
     }
 
     time_t start = getCurrentTime();
+    benchStart = start;
     running = true;
 
     vector<thread> readers(cfg.nReaders);
@@ -342,6 +480,11 @@ int main (int argc, char* argv[])
     size_t nAborts = 0;
     time_t maxReadDuration = 0;
     time_t maxWriteDuration = 0;
+    histogram* latency = new histogram[N_TXN_TYPES];
+
+    for (int i = 0; i < N_TXN_TYPES; i++) {
+        latency[i].reset();
+    }
 
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].start(i, reader);
@@ -354,6 +497,9 @@ int main (int argc, char* argv[])
         writers[i].wait();
         nWrites += writers[i].proceeded;
         nAborts += writers[i].aborts;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(writers[i].latency[j]);
+        }
         if (writers[i].max_trans_duration > maxWriteDuration) { 
             maxWriteDuration = writers[i].max_trans_duration;
         }
@@ -364,6 +510,9 @@ int main (int argc, char* argv[])
     for (int i = 0; i < cfg.nReaders; i++) { 
         readers[i].wait();
         nReads += readers[i].proceeded;
+        for (int j = 0; j < N_TXN_TYPES; j++) {
+            latency[j].merge(readers[i].latency[j]);
+        }
         if (readers[i].max_trans_duration > maxReadDuration) { 
             maxReadDuration = readers[i].max_trans_duration;
         }
@@ -377,7 +526,8 @@ int main (int argc, char* argv[])
         "{\"update_tps\":%f, \"read_tps\":%f,"
         " \"readers\":%d, \"writers\":%d, \"aborts\":%ld, \"abort_percent\": %d,"
         " \"max_read_duration\":%ld, \"max_write_duration\":%ld,"
-        " \"accounts\":%d, \"iterations\":%d, \"hosts\":%ld}\n",
+        " \"rate\":%d, \"accounts\":%d, \"iterations\":%d, \"hosts\":%ld,"
+        " \"latency\":{",
         (double)(nWrites*USEC)/elapsed,
         (double)(nReads*USEC)/elapsed,
         cfg.nReaders,
@@ -385,10 +535,19 @@ int main (int argc, char* argv[])
         nAborts,
         (int)(nAborts*100/(nWrites + 0.0001)),
         maxReadDuration, maxWriteDuration,
+        cfg.rate,
         cfg.nAccounts,
         cfg.nIterations,
         cfg.connections.size()
         );
+    for (int i = 0; i < N_TXN_TYPES; i++) {
+        if (i != 0) {
+            printf(", ");
+        }
+        latency[i].print(txnTypeNames[i]);
+    }
+    printf("}}\n");
+    delete[] latency;
 
     return 0;
 }
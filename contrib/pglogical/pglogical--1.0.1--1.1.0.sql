@@ -0,0 +1,7 @@
+\echo Use "ALTER EXTENSION pglogical UPDATE TO '1.1.0'" to load this file. \quit
+
+ALTER TABLE pglogical.replication_set_table ADD COLUMN set_att_list text[];
+
+DROP FUNCTION pglogical.replication_set_add_table(set_name name, relation regclass, synchronize boolean);
+CREATE FUNCTION pglogical.replication_set_add_table(set_name name, relation regclass, synchronize boolean DEFAULT false, columns text[] DEFAULT NULL)
+RETURNS boolean CALLED ON NULL INPUT VOLATILE LANGUAGE c AS 'MODULE_PATHNAME', 'pglogical_replication_set_add_table';
@@ -31,6 +31,7 @@
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
 
+#include "pglogical_apply_pool.h"
 #include "pglogical_node.h"
 #include "pglogical_conflict.h"
 #include "pglogical_worker.h"
@@ -49,6 +50,8 @@ static const struct config_enum_entry PGLogicalConflictResolvers[] = {
 
 bool	pglogical_synchronous_commit = false;
 char   *pglogical_temp_directory;
+int		pglogical_synchronize_parallelism = 4;
+int		pglogical_apply_workers = 0;
 
 void _PG_init(void);
 void pglogical_supervisor_main(Datum main_arg);
@@ -442,6 +445,24 @@ _PG_init(void)
 							   "/tmp", PGC_SIGHUP,
 							   0,
 							   NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.synchronize_parallelism",
+							"Number of tables copied and indexes built at the same time during initial synchronization",
+							NULL,
+							&pglogical_synchronize_parallelism,
+							4, 1, 64,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
+
+	DefineCustomIntVariable("pglogical.apply_workers",
+							"Number of workers applying the transactions of a subscription in parallel, 0 to apply them in the apply worker",
+							NULL,
+							&pglogical_apply_workers,
+							0, 0, APPLY_POOL_MAX_WORKERS,
+							PGC_SIGHUP,
+							0,
+							NULL, NULL, NULL);
 	if (IsBinaryUpgrade)
 		return;
 
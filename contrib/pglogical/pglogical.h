@@ -22,8 +22,8 @@
 #include "pglogical_fe.h"
 #include "pglogical_node.h"
 
-#define PGLOGICAL_VERSION "1.0.1"
-#define PGLOGICAL_VERSION_NUM 10001
+#define PGLOGICAL_VERSION "1.1.0"
+#define PGLOGICAL_VERSION_NUM 10100
 
 #define PGLOGICAL_MIN_PROTO_VERSION_NUM 1
 #define PGLOGICAL_MAX_PROTO_VERSION_NUM 1
@@ -38,6 +38,8 @@
 
 extern bool pglogical_synchronous_commit;
 extern char *pglogical_temp_directory;
+extern int	pglogical_synchronize_parallelism;
+extern int	pglogical_apply_workers;
 
 extern char *shorten_hash(const char *str, int maxlen);
 
@@ -16,6 +16,7 @@
 #include "libpq-fe.h"
 #include "pgstat.h"
 
+#include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/xact.h"
 
@@ -51,6 +52,7 @@
 #include "utils/memutils.h"
 #include "utils/snapmgr.h"
 
+#include "pglogical_apply_pool.h"
 #include "pglogical_conflict.h"
 #include "pglogical_node.h"
 #include "pglogical_proto.h"
@@ -78,6 +80,35 @@ PGLogicalSubscription	   *MySubscription = NULL;
 
 static PGconn	   *applyconn = NULL;
 
+/*
+ * Consecutive inserts into a relation where they can't conflict with local
+ * rows are collected here and written with heap_multi_insert.  The limits
+ * are the same as COPY uses.
+ */
+#define MAX_BUFFERED_TUPLES		1000
+#define MAX_BUFFERED_BYTES		65535
+
+typedef struct ApplyInsertBuffer
+{
+	PGLogicalRelation  *rel;		/* relation, NULL if nothing buffered */
+	EState			   *estate;		/* holds the tuples and open indexes */
+	TupleTableSlot	   *slot;
+	HeapTuple			tuples[MAX_BUFFERED_TUPLES];
+	int					ntuples;
+	Size				nbytes;
+
+	/*
+	 * Ring of buffers the inserts of the current transaction go through,
+	 * like COPY, so that a large replicated transaction doesn't evict the
+	 * rest of shared buffers.  It lives in TopTransactionContext, and lxid
+	 * tells which transaction it belongs to.
+	 */
+	BulkInsertState		bistate;
+	LocalTransactionId	bistate_lxid;
+} ApplyInsertBuffer;
+
+static ApplyInsertBuffer insert_buffer;
+
 typedef struct PGLFlushPosition
 {
 	dlist_node node;
@@ -92,6 +123,10 @@ static void handle_startup_param(const char *key, const char *value);
 static bool parse_bool_param(const char *key, const char *value);
 static void process_syncing_tables(XLogRecPtr end_lsn);
 static void start_sync_worker(RangeVar *rv);
+static bool insert_conflict_possible(EState *estate);
+static void buffer_insert(PGLogicalTupleData *newtup);
+static void flush_insert_buffer(void);
+static void track_commit_position(XLogRecPtr local_end, XLogRecPtr remote_end);
 
 /*
  * Check if given relation is in process of being synchronized.
@@ -149,7 +184,6 @@ handle_commit(StringInfo s)
 	uint8 			flags;
 	const char	   *gid;
 	char 		   *local_gid;
-	PGLFlushPosition *flushpos;
 	bool 			flush = true;
 	PGLogicalLocalNode *mynode;
 
@@ -159,7 +193,13 @@ handle_commit(StringInfo s)
 	{
 		case PGLOGICAL_COMMIT:
 		{
-			if (IsTransactionState())
+			if (MyApplyPoolWorker != NULL)
+			{
+				/* The apply worker tracks the flush position of the pool. */
+				apply_pool_commit(end_lsn);
+				flush = false;
+			}
+			else if (IsTransactionState())
 				CommitTransactionCommand();
 			else
 				flush = false;
@@ -227,14 +267,8 @@ handle_commit(StringInfo s)
 
 	if (flush)
 	{
-		MemoryContextSwitchTo(TopMemoryContext);
-
 		/* Track commit lsn  */
-		flushpos = (PGLFlushPosition *) palloc(sizeof(PGLFlushPosition));
-		flushpos->local_end = XactLastCommitEnd;
-		flushpos->remote_end = end_lsn;
-
-		dlist_push_tail(&lsn_mapping, &flushpos->node);
+		track_commit_position(XactLastCommitEnd, end_lsn);
 		MemoryContextSwitchTo(MessageContext);
 	}
 
@@ -255,6 +289,13 @@ handle_commit(StringInfo s)
 
 	in_remote_transaction = false;
 
+	/* The rest is up to the apply worker. */
+	if (MyApplyPoolWorker != NULL)
+	{
+		pgstat_report_activity(STATE_IDLE, NULL);
+		return;
+	}
+
 	/*
 	 * Stop replay if we're doing limited replay and we've replayed up to the
 	 * last record we're supposed to process.
@@ -379,72 +420,26 @@ UserTableUpdateOpenIndexes(EState *estate, TupleTableSlot *slot)
 	}
 }
 
-static bool
-physatt_in_attmap(PGLogicalRelation *rel, int attid)
-{
-	AttrNumber	i;
-
-	for (i = 0; i < rel->natts; i++)
-		if (rel->attmap[i] == attid)
-			return true;
-
-	return false;
-}
-
 /*
  * Executes default values for columns for which we didn't get any data.
  *
- * TODO: this needs caching, it's not exactly fast.
+ * The default expressions are prepared by the relation cache, only the
+ * execution state is built here as it can't outlive the executor state.
  */
 static void
 fill_tuple_defaults(PGLogicalRelation *rel, ExprContext *econtext,
 							  PGLogicalTupleData *tuple)
 {
-	TupleDesc	desc = RelationGetDescr(rel->rel);
-	AttrNumber	num_phys_attrs = desc->natts;
 	int			i;
-	AttrNumber	attnum,
-				num_defaults = 0;
-	int		   *defmap;
-	ExprState **defexprs;
-
-	/* We got all the data via replication, no need to evaluate anything. */
-	if (num_phys_attrs == rel->natts)
-		return;
 
-	defmap = (int *) palloc(num_phys_attrs * sizeof(int));
-	defexprs = (ExprState **) palloc(num_phys_attrs * sizeof(ExprState *));
-
-	for (attnum = 0; attnum < num_phys_attrs; attnum++)
+	for (i = 0; i < rel->ndefaults; i++)
 	{
-		Expr	   *defexpr;
-
-		if (desc->attrs[attnum]->attisdropped)
-			continue;
-
-		if (physatt_in_attmap(rel, attnum))
-			continue;
-
-		defexpr = (Expr *) build_column_default(rel->rel, attnum + 1);
-
-		if (defexpr != NULL)
-		{
-			/* Run the expression through planner */
-			defexpr = expression_planner(defexpr);
-
-			/* Initialize executable expression in copycontext */
-			defexprs[num_defaults] = ExecInitExpr(defexpr, NULL);
-			defmap[num_defaults] = attnum;
-			num_defaults++;
-		}
+		ExprState  *defexpr = ExecInitExpr(rel->defexprs[i], NULL);
+		int			attnum = rel->defmap[i];
 
+		tuple->values[attnum] = ExecEvalExpr(defexpr, econtext,
+											 &tuple->nulls[attnum], NULL);
 	}
-
-	for (i = 0; i < num_defaults; i++)
-		tuple->values[defmap[i]] = ExecEvalExpr(defexprs[i],
-												econtext,
-												&tuple->nulls[defmap[i]],
-												NULL);
 }
 
 static void
@@ -472,15 +467,23 @@ handle_insert(StringInfo s)
 		return;
 	}
 
+	/* Add to the buffered inserts if they are into the same relation. */
+	if (insert_buffer.rel != NULL)
+	{
+		if (RelationGetRelid(insert_buffer.rel->rel) ==
+			RelationGetRelid(rel->rel))
+		{
+			pglogical_relation_close(rel, NoLock);
+			buffer_insert(&newtup);
+			return;
+		}
+		flush_insert_buffer();
+	}
+
 	/* Initialize the executor state. */
 	estate = create_estate_for_relation(rel->rel);
 	econtext = GetPerTupleExprContext(estate);
 
-	PushActiveSnapshot(GetTransactionSnapshot());
-
-	MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
-	fill_tuple_defaults(rel, econtext, &newtup);
-
 	localslot = ExecInitExtraTupleSlot(estate);
 	applyslot = ExecInitExtraTupleSlot(estate);
 	ExecSetSlotDescriptor(localslot, RelationGetDescr(rel->rel));
@@ -488,6 +491,26 @@ handle_insert(StringInfo s)
 
 	ExecOpenIndices(estate->es_result_relation_info, false);
 
+	/*
+	 * If the row can't conflict with a local one, start buffering inserts
+	 * into the relation instead of applying them one by one.  The queue
+	 * table is excluded, since its rows must be processed right away.
+	 */
+	if (RelationGetRelid(rel->rel) != QueueRelid &&
+		!insert_conflict_possible(estate))
+	{
+		insert_buffer.rel = rel;
+		insert_buffer.estate = estate;
+		insert_buffer.slot = applyslot;
+		buffer_insert(&newtup);
+		return;
+	}
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+	fill_tuple_defaults(rel, econtext, &newtup);
+
 	conflicts = pglogical_tuple_find_conflict(estate, &newtup, localslot);
 
 	remotetuple = heap_form_tuple(RelationGetDescr(rel->rel),
@@ -578,6 +601,128 @@ handle_insert(StringInfo s)
 	CommandCounterIncrement();
 }
 
+/*
+ * Can an insert into the relation conflict with an existing local row?
+ *
+ * Only unique indexes can detect conflicts.  With conflict_resolution=error
+ * a conflict is an error anyway, which the unique index insert raises too.
+ */
+static bool
+insert_conflict_possible(EState *estate)
+{
+	ResultRelInfo  *relinfo = estate->es_result_relation_info;
+	int				i;
+
+	if (pglogical_conflict_resolver == PGLOGICAL_RESOLVE_ERROR)
+		return false;
+
+	for (i = 0; i < relinfo->ri_NumIndices; i++)
+	{
+		if (relinfo->ri_IndexRelationInfo[i]->ii_Unique)
+			return true;
+	}
+
+	return false;
+}
+
+/*
+ * Add an insert into insert_buffer.rel to the buffer, flushing it if full.
+ */
+static void
+buffer_insert(PGLogicalTupleData *newtup)
+{
+	EState		   *estate = insert_buffer.estate;
+	Relation		rel = insert_buffer.rel->rel;
+	MemoryContext	oldcontext;
+	HeapTuple		tuple;
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+	fill_tuple_defaults(insert_buffer.rel, GetPerTupleExprContext(estate),
+						newtup);
+
+	/* The tuple has to live until the flush. */
+	MemoryContextSwitchTo(estate->es_query_cxt);
+	tuple = heap_form_tuple(RelationGetDescr(rel), newtup->values,
+							newtup->nulls);
+	MemoryContextSwitchTo(oldcontext);
+
+	/* Check the constraints of the tuple */
+	ExecStoreTuple(tuple, insert_buffer.slot, InvalidBuffer, false);
+	if (rel->rd_att->constr)
+		ExecConstraints(estate->es_result_relation_info, insert_buffer.slot,
+						estate);
+
+	ResetPerTupleExprContext(estate);
+	PopActiveSnapshot();
+
+	insert_buffer.tuples[insert_buffer.ntuples++] = tuple;
+	insert_buffer.nbytes += tuple->t_len;
+
+	if (insert_buffer.ntuples == MAX_BUFFERED_TUPLES ||
+		insert_buffer.nbytes >= MAX_BUFFERED_BYTES)
+		flush_insert_buffer();
+}
+
+/*
+ * Write the buffered inserts, if any, and release the relation.
+ *
+ * This has to be called before applying anything else, so that the
+ * changes are applied in order.
+ */
+static void
+flush_insert_buffer(void)
+{
+	EState		   *estate = insert_buffer.estate;
+	int				i;
+
+	if (insert_buffer.rel == NULL)
+		return;
+
+	PushActiveSnapshot(GetTransactionSnapshot());
+
+	if (insert_buffer.bistate == NULL ||
+		insert_buffer.bistate_lxid != MyProc->lxid)
+	{
+		MemoryContext	oldcontext;
+
+		oldcontext = MemoryContextSwitchTo(TopTransactionContext);
+		insert_buffer.bistate = GetBulkInsertState();
+		insert_buffer.bistate_lxid = MyProc->lxid;
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	heap_multi_insert(insert_buffer.rel->rel, insert_buffer.tuples,
+					  insert_buffer.ntuples, GetCurrentCommandId(true), 0,
+					  insert_buffer.bistate);
+	/* keep the ring, but not the pin, for the next batch */
+	ReleaseBulkInsertStatePin(insert_buffer.bistate);
+
+	for (i = 0; i < insert_buffer.ntuples; i++)
+	{
+		ExecStoreTuple(insert_buffer.tuples[i], insert_buffer.slot,
+					   InvalidBuffer, false);
+		UserTableUpdateOpenIndexes(estate, insert_buffer.slot);
+		ResetPerTupleExprContext(estate);
+	}
+
+	PopActiveSnapshot();
+
+	ExecCloseIndices(estate->es_result_relation_info);
+	pglogical_relation_close(insert_buffer.rel, NoLock);
+	ExecResetTupleTable(estate->es_tupleTable, true);
+	FreeExecutorState(estate);
+
+	insert_buffer.rel = NULL;
+	insert_buffer.estate = NULL;
+	insert_buffer.slot = NULL;
+	insert_buffer.ntuples = 0;
+	insert_buffer.nbytes = 0;
+
+	CommandCounterIncrement();
+}
+
 static void
 handle_update(StringInfo s)
 {
@@ -1081,9 +1226,26 @@ handle_queued_message(HeapTuple msgtup, bool tx_just_started)
 
 static void
 replication_handler(StringInfo s)
+{
+	/* Transactions applied by the pool workers are handed over there. */
+	if (apply_pool_handle_message(s))
+		return;
+
+	pglogical_apply_message(s);
+}
+
+/*
+ * Apply a message of the replication stream.
+ */
+void
+pglogical_apply_message(StringInfo s)
 {
 	char action = pq_getmsgbyte(s);
 
+	/* Apply buffered inserts before anything but another insert. */
+	if (action != 'I')
+		flush_insert_buffer();
+
 	switch (action)
 	{
 		/* BEGIN */
@@ -1123,6 +1285,56 @@ replication_handler(StringInfo s)
 	}
 }
 
+/*
+ * Can the transactions be handed to the apply pool now?
+ *
+ * Table synchronization needs the position of every applied transaction,
+ * so transactions are applied serially until it finishes.
+ */
+bool
+pglogical_apply_serial_required(void)
+{
+	return MyApplyWorker->sync_pending || list_length(SyncingTables) > 0;
+}
+
+/*
+ * Forget the state of the remote transaction after its local transaction
+ * was aborted, so that it can be applied again.
+ */
+void
+pglogical_apply_reset(void)
+{
+	insert_buffer.rel = NULL;
+	insert_buffer.estate = NULL;
+	insert_buffer.slot = NULL;
+	insert_buffer.ntuples = 0;
+	insert_buffer.nbytes = 0;
+	insert_buffer.bistate = NULL;
+
+	in_remote_transaction = false;
+}
+
+/*
+ * Remember the local end of a commit of the remote transaction ending at
+ * remote_end, see get_flush_position().
+ */
+static void
+track_commit_position(XLogRecPtr local_end, XLogRecPtr remote_end)
+{
+	PGLFlushPosition   *flushpos;
+	MemoryContext		oldcontext;
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	flushpos = (PGLFlushPosition *) palloc(sizeof(PGLFlushPosition));
+	flushpos->local_end = local_end;
+	flushpos->remote_end = remote_end;
+
+	dlist_push_tail(&lsn_mapping, &flushpos->node);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
 /*
  * Figure out which write/flush positions to report to the walsender process.
  *
@@ -1140,7 +1352,15 @@ static bool
 get_flush_position(XLogRecPtr *write, XLogRecPtr *flush)
 {
 	dlist_mutable_iter iter;
-	XLogRecPtr	local_flush = GetFlushRecPtr();
+	XLogRecPtr	local_flush;
+	XLogRecPtr	local_end;
+	XLogRecPtr	remote_end;
+
+	/* Add the commits done by the apply pool workers. */
+	if (apply_pool_get_progress(&local_end, &remote_end))
+		track_commit_position(local_end, remote_end);
+
+	local_flush = GetFlushRecPtr();
 
 	*write = InvalidXLogRecPtr;
 	*flush = InvalidXLogRecPtr;
@@ -1197,7 +1417,7 @@ send_feedback(PGconn *conn, XLogRecPtr recvpos, int64 now, bool force)
 	if (recvpos < last_recvpos)
 		recvpos = last_recvpos;
 
-	if (get_flush_position(&writepos, &flushpos))
+	if (get_flush_position(&writepos, &flushpos) && !apply_pool_busy())
 	{
 		/*
 		 * No outstanding transactions to flush, we can report the latest
@@ -1396,8 +1616,13 @@ apply_work(PGconn *streamConn)
 		/* confirm all writes at once */
 		send_feedback(applyconn, last_received, GetCurrentTimestamp(), false);
 
-		if (!in_remote_transaction)
+		if (!in_remote_transaction && !apply_pool_in_transaction())
+		{
+			/* Synchronization needs the pool to be done, see above. */
+			if (pglogical_apply_serial_required())
+				apply_pool_drain();
 			process_syncing_tables(last_received);
+		}
 
 		/* Cleanup the memory. */
 		MemoryContextResetAndDeleteChildren(MessageContext);
@@ -1756,6 +1981,10 @@ pglogical_apply_main(Datum main_arg)
 
 	CommitTransactionCommand();
 
+	/* Start the workers which apply the transactions in parallel. */
+	if (pglogical_apply_workers > 0)
+		apply_pool_start(pglogical_apply_workers, originid, QueueRelid);
+
 	apply_work(streamConn);
 
 	/*
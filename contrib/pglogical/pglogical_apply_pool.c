@@ -0,0 +1,1283 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_apply_pool.c
+ *		pglogical parallel apply
+ *
+ * When pglogical.apply_workers is set, the apply worker of a subscription
+ * doesn't apply the transactions itself.  It collects every remote
+ * transaction from BEGIN to COMMIT and hands it over to one of the pool
+ * workers it started, through a shm_mq in a dsm segment shared with them.
+ *
+ * Each transaction gets a sequence number.  The pool workers apply the
+ * transactions concurrently, but commit them strictly in sequence, so the
+ * replication origin advances the same way as with a single apply process.
+ * The origin session is only held by a pool worker for the duration of its
+ * commit.
+ *
+ * The apply worker also computes the footprint of every transaction: the
+ * hashes of the replica identity keys it touches.  A transaction isn't
+ * started until the last preceding transaction touching any of the same
+ * keys has committed, in the same spirit as the BgwPool of multimaster.
+ * Relations with other unique indexes than the replica identity one are
+ * treated as a single key as these can conflict on any of them.
+ *
+ * Rows can still be locked by a later transaction which waits for its turn
+ * to commit while an earlier one waits for the lock.  The later transaction
+ * notices that the earlier one is blocked, rolls back and applies again once
+ * it's its turn.
+ *
+ * Transactions which write to the queue table, two phase commit messages,
+ * very large transactions and everything while tables are being
+ * synchronized are applied by the apply worker itself, after waiting for
+ * the pool to finish everything dispatched before.
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_apply_pool.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "miscadmin.h"
+
+#include "access/genam.h"
+#include "access/hash.h"
+#include "access/htup_details.h"
+#include "access/xact.h"
+#include "access/xlog.h"
+
+#include "libpq/pqformat.h"
+
+#include "pgstat.h"
+
+#include "postmaster/bgworker.h"
+
+#include "storage/dsm.h"
+#include "storage/ipc.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/spin.h"
+
+#include "utils/hsearch.h"
+#include "utils/guc.h"
+#include "utils/inval.h"
+#include "utils/memutils.h"
+#include "utils/rel.h"
+
+#include "pglogical_apply_pool.h"
+#include "pglogical_proto.h"
+#include "pglogical_relcache.h"
+#include "pglogical_worker.h"
+#include "pglogical.h"
+
+#define APPLY_POOL_QUEUE_SIZE		(64 * 1024)
+#define APPLY_POOL_KEY_SLOTS		(64 * 1024)
+#define APPLY_POOL_MAX_XACT_SIZE	(8 * 1024 * 1024)
+
+typedef struct ApplyPoolWorker
+{
+	PGPROC	   *proc;			/* NULL until the worker has started */
+	uint64		seq;			/* transaction being applied, 0 if none */
+	uint64		done_seq;		/* last transaction finished */
+} ApplyPoolWorker;
+
+typedef struct ApplyPoolShared
+{
+	slock_t		mutex;
+	Oid			dboid;
+	RepOriginId	originid;
+	PGPROC	   *leader;
+	bool		stopped;		/* the leader or a worker exited */
+	uint64		committed_seq;	/* last transaction committed */
+	XLogRecPtr	local_end;		/* local end of the last commit */
+	XLogRecPtr	remote_end;		/* remote end of the last commit */
+	int			nworkers;
+	ApplyPoolWorker	workers[FLEXIBLE_ARRAY_MEMBER];
+} ApplyPoolShared;
+
+/* Header of a transaction sent to a worker, followed by its messages. */
+typedef struct ApplyPoolItem
+{
+	uint64		seq;			/* sequence number of the transaction */
+	uint64		dep;			/* transaction to wait for before start */
+} ApplyPoolItem;
+
+/* Relation info the leader keeps for dispatching. */
+typedef struct ApplyPoolRel
+{
+	uint32		remoteid;		/* hash key */
+	StringInfoData relmsg;		/* last RELATION message */
+	uint32		version;		/* number of RELATION messages seen */
+	uint32		sent[APPLY_POOL_MAX_WORKERS];	/* version sent to worker */
+	uint64		xact_seq;		/* last transaction referencing the rel */
+	bool		xact_relmsg;	/* RELATION message came in xact_seq */
+	bool		xact_changed;	/* rows were changed in xact_seq */
+	bool		keys_valid;		/* is the key info below up to date? */
+	bool		serial;			/* apply changes in the leader */
+	bool		whole;			/* footprint is the whole relation */
+	int			natts;
+	bool	   *iskey;			/* [natts] remote attribute is a key column */
+} ApplyPoolRel;
+
+typedef enum
+{
+	APPLY_POOL_IDLE,			/* outside of a transaction */
+	APPLY_POOL_COLLECTING		/* collecting transaction for a worker */
+} ApplyPoolState;
+
+struct ApplyPoolWorker *MyApplyPoolWorker = NULL;
+
+static ApplyPoolShared *pool = NULL;
+
+/* Leader state. */
+static shm_mq_handle *pool_mqh[APPLY_POOL_MAX_WORKERS];
+static uint64	pool_assigned[APPLY_POOL_MAX_WORKERS];
+static int		pool_next_worker = 0;
+static HTAB	   *pool_rels = NULL;
+static uint64  *pool_writers = NULL;
+static Oid		pool_queue_relid = InvalidOid;
+static bool		pool_has_session = true;
+static uint64	pool_last_seq = 0;
+static uint64	pool_dispatched = 0;
+static XLogRecPtr	pool_commit_lsn = InvalidXLogRecPtr;
+static TimestampTz	pool_commit_time = 0;
+static XLogRecPtr	pool_reported_end = InvalidXLogRecPtr;
+
+static ApplyPoolState xact_state = APPLY_POOL_IDLE;
+static StringInfoData xact_buf;
+static StringInfoData item_buf;
+static List	   *xact_rels = NIL;
+static uint64	xact_seq = 0;
+static uint64	xact_dep = 0;
+static bool		xact_serial = false;
+static XLogRecPtr	xact_commit_lsn = InvalidXLogRecPtr;
+static TimestampTz	xact_commit_time = 0;
+
+/* Worker state. */
+static uint64	my_seq = 0;
+
+static void apply_pool_wait(void);
+static void apply_pool_check(void);
+static void apply_pool_collect(StringInfo s);
+static void apply_pool_note_change(StringInfo s, char action);
+static ApplyPoolRel *apply_pool_get_rel(uint32 remoteid, bool create);
+static ApplyPoolRel *apply_pool_note_relation(StringInfo s);
+static void apply_pool_rel_keys(ApplyPoolRel *entry);
+static bool apply_pool_add_tuple(StringInfo s, ApplyPoolRel *entry);
+static void apply_pool_add_key(uint32 hash);
+static void apply_pool_run_serial(void);
+static void apply_pool_dispatch(void);
+static void apply_pool_replay(char *data, Size len);
+static void apply_pool_wait_for(uint64 seq, bool yield);
+
+static Size
+apply_pool_shared_size(int nworkers)
+{
+	return BUFFERALIGN(offsetof(ApplyPoolShared, workers) +
+					   sizeof(ApplyPoolWorker) * nworkers);
+}
+
+static shm_mq *
+apply_pool_queue(ApplyPoolShared *shared, int worker)
+{
+	return (shm_mq *) ((char *) shared +
+					   apply_pool_shared_size(shared->nworkers) +
+					   (Size) worker * APPLY_POOL_QUEUE_SIZE);
+}
+
+/*
+ * Wake up all the processes attached to the pool.
+ */
+static void
+apply_pool_wakeup(void)
+{
+	int		i;
+
+	for (i = 0; i < pool->nworkers; i++)
+	{
+		PGPROC *proc = pool->workers[i].proc;
+
+		if (proc != NULL && proc != MyProc)
+			SetLatch(&proc->procLatch);
+	}
+
+	if (pool->leader != MyProc)
+		SetLatch(&pool->leader->procLatch);
+}
+
+static uint64
+apply_pool_committed(void)
+{
+	uint64	committed;
+
+	SpinLockAcquire(&pool->mutex);
+	committed = pool->committed_seq;
+	SpinLockRelease(&pool->mutex);
+
+	return committed;
+}
+
+/*
+ * Mark the pool as stopped when the leader exits.
+ */
+static void
+apply_pool_leader_detach(dsm_segment *seg, Datum arg)
+{
+	SpinLockAcquire(&pool->mutex);
+	pool->stopped = true;
+	SpinLockRelease(&pool->mutex);
+
+	apply_pool_wakeup();
+}
+
+/*
+ * Mark the pool as stopped when a worker exits because of an error, so that
+ * the leader doesn't wait for it forever.
+ */
+static void
+apply_pool_worker_exit(int code, Datum arg)
+{
+	if (code == 0 || pool == NULL)
+		return;
+
+	SpinLockAcquire(&pool->mutex);
+	pool->stopped = true;
+	SpinLockRelease(&pool->mutex);
+
+	apply_pool_wakeup();
+}
+
+static void
+apply_pool_relcache_cb(Datum arg, Oid reloid)
+{
+	HASH_SEQ_STATUS	status;
+	ApplyPoolRel   *entry;
+
+	/* Index changes affect the footprint, just recompute everything. */
+	hash_seq_init(&status, pool_rels);
+	while ((entry = (ApplyPoolRel *) hash_seq_search(&status)) != NULL)
+		entry->keys_valid = false;
+}
+
+/*
+ * Start the pool workers.
+ *
+ * Called by the apply worker while it holds the replication origin session.
+ */
+void
+apply_pool_start(int nworkers, RepOriginId originid, Oid queue_relid)
+{
+	MemoryContext	oldcontext;
+	dsm_segment	   *seg;
+	Size			size;
+	HASHCTL			ctl;
+	int				i;
+
+	Assert(nworkers > 0 && nworkers <= APPLY_POOL_MAX_WORKERS);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+
+	size = apply_pool_shared_size(nworkers) +
+		(Size) nworkers * APPLY_POOL_QUEUE_SIZE;
+	seg = dsm_create(size, 0);
+	dsm_pin_mapping(seg);
+
+	pool = (ApplyPoolShared *) dsm_segment_address(seg);
+	memset(pool, 0, apply_pool_shared_size(nworkers));
+	SpinLockInit(&pool->mutex);
+	pool->dboid = MyDatabaseId;
+	pool->originid = originid;
+	pool->leader = MyProc;
+	pool->nworkers = nworkers;
+
+	on_dsm_detach(seg, apply_pool_leader_detach, (Datum) 0);
+
+	for (i = 0; i < nworkers; i++)
+	{
+		BackgroundWorker		bgw;
+		BackgroundWorkerHandle *bgw_handle;
+		pid_t					pid;
+		shm_mq				   *mq;
+
+		mq = shm_mq_create(apply_pool_queue(pool, i), APPLY_POOL_QUEUE_SIZE);
+		shm_mq_set_sender(mq, MyProc);
+
+		memset(&bgw, 0, sizeof(bgw));
+		bgw.bgw_flags =	BGWORKER_SHMEM_ACCESS |
+			BGWORKER_BACKEND_DATABASE_CONNECTION;
+		bgw.bgw_start_time = BgWorkerStart_RecoveryFinished;
+		bgw.bgw_main = NULL;
+		snprintf(bgw.bgw_library_name, BGW_MAXLEN,
+				 EXTENSION_NAME);
+		snprintf(bgw.bgw_function_name, BGW_MAXLEN,
+				 "pglogical_apply_pool_main");
+		snprintf(bgw.bgw_name, BGW_MAXLEN,
+				 "pglogical apply %u:%u pool %d", MyDatabaseId,
+				 MyApplyWorker->subid, i + 1);
+		bgw.bgw_restart_time = BGW_NEVER_RESTART;
+		bgw.bgw_notify_pid = MyProcPid;
+		bgw.bgw_main_arg = UInt32GetDatum(dsm_segment_handle(seg));
+		memcpy(bgw.bgw_extra, &i, sizeof(i));
+
+		if (!RegisterDynamicBackgroundWorker(&bgw, &bgw_handle))
+		{
+			ereport(ERROR,
+					(errcode(ERRCODE_CONFIGURATION_LIMIT_EXCEEDED),
+					 errmsg("apply pool worker registration failed, you might want to increase max_worker_processes setting")));
+		}
+
+		pool_mqh[i] = shm_mq_attach(mq, seg, bgw_handle);
+		pool_assigned[i] = 0;
+
+		WaitForBackgroundWorkerStartup(bgw_handle, &pid);
+	}
+
+	MemSet(&ctl, 0, sizeof(ctl));
+	ctl.keysize = sizeof(uint32);
+	ctl.entrysize = sizeof(ApplyPoolRel);
+	ctl.hcxt = TopMemoryContext;
+	pool_rels = hash_create("pglogical apply pool relations", 128, &ctl,
+							HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	CacheRegisterRelcacheCallback(apply_pool_relcache_cb, (Datum) 0);
+
+	pool_writers = palloc0(APPLY_POOL_KEY_SLOTS * sizeof(uint64));
+	pool_queue_relid = queue_relid;
+	pool_has_session = true;
+
+	initStringInfo(&xact_buf);
+	initStringInfo(&item_buf);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	elog(LOG, "started %d apply pool workers for subscription %s",
+		 nworkers, MySubscription->name);
+}
+
+/*
+ * Wait for the pool workers to make progress.
+ */
+static void
+apply_pool_wait(void)
+{
+	int		rc;
+
+	rc = WaitLatch(&MyProc->procLatch,
+				   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+				   1000L);
+
+	ResetLatch(&MyProc->procLatch);
+
+	/* emergency bailout if postmaster has died */
+	if (rc & WL_POSTMASTER_DEATH)
+		proc_exit(1);
+
+	if (got_SIGTERM)
+		proc_exit(1);
+
+	apply_pool_check();
+}
+
+static void
+apply_pool_check(void)
+{
+	bool	stopped;
+
+	SpinLockAcquire(&pool->mutex);
+	stopped = pool->stopped;
+	SpinLockRelease(&pool->mutex);
+
+	if (stopped)
+		ereport(ERROR,
+				(errmsg("pglogical apply pool worker exited unexpectedly")));
+}
+
+/*
+ * Are there transactions handed to the pool which are not committed yet?
+ */
+bool
+apply_pool_busy(void)
+{
+	return pool != NULL && apply_pool_committed() < pool_dispatched;
+}
+
+/*
+ * Is the leader in the middle of collecting a transaction for the pool?
+ */
+bool
+apply_pool_in_transaction(void)
+{
+	return xact_state == APPLY_POOL_COLLECTING;
+}
+
+/*
+ * Get the position of the last commit done by the pool workers.
+ *
+ * Returns false if there wasn't any new commit since the last call.
+ */
+bool
+apply_pool_get_progress(XLogRecPtr *local_end, XLogRecPtr *remote_end)
+{
+	if (pool == NULL)
+		return false;
+
+	SpinLockAcquire(&pool->mutex);
+	*local_end = pool->local_end;
+	*remote_end = pool->remote_end;
+	SpinLockRelease(&pool->mutex);
+
+	if (*remote_end == pool_reported_end)
+		return false;
+
+	pool_reported_end = *remote_end;
+	return true;
+}
+
+/*
+ * Wait until the pool workers commit everything handed to them and take
+ * the replication origin session back, so that the leader can apply
+ * changes itself.
+ */
+void
+apply_pool_drain(void)
+{
+	if (pool == NULL)
+		return;
+
+	while (apply_pool_committed() < pool_dispatched)
+		apply_pool_wait();
+
+	if (!pool_has_session)
+	{
+		replorigin_session_setup(pool->originid);
+		replorigin_session_origin = pool->originid;
+		replorigin_session_origin_lsn = pool_commit_lsn;
+		replorigin_session_origin_timestamp = pool_commit_time;
+		pool_has_session = true;
+	}
+}
+
+/*
+ * Handle message received by the apply worker.
+ *
+ * Returns true if the message was taken by the pool, false if it should be
+ * applied by the caller.
+ */
+bool
+apply_pool_handle_message(StringInfo s)
+{
+	char	action = s->data[s->cursor];
+
+	if (pool == NULL)
+		return false;
+
+	if (xact_state == APPLY_POOL_IDLE)
+	{
+		if (action != 'B' || pglogical_apply_serial_required())
+		{
+			/*
+			 * Everything else than a transaction we can hand to the pool is
+			 * applied by the leader.  The startup message is independent of
+			 * the transactions.
+			 */
+			if (action != 'S')
+				apply_pool_drain();
+
+			/* The workers will need the relation info too. */
+			if (action == 'R')
+				(void) apply_pool_note_relation(s);
+
+			return false;
+		}
+
+		xact_state = APPLY_POOL_COLLECTING;
+		xact_seq = ++pool_last_seq;
+		xact_dep = 0;
+		xact_serial = false;
+		xact_rels = NIL;
+		resetStringInfo(&xact_buf);
+	}
+
+	apply_pool_collect(s);
+
+	return true;
+}
+
+/*
+ * Add message to the transaction which is being collected.
+ */
+static void
+apply_pool_collect(StringInfo s)
+{
+	StringInfoData	msg;
+	uint32			len = s->len - s->cursor;
+	char			action;
+
+	appendBinaryStringInfo(&xact_buf, (char *) &len, sizeof(len));
+	appendBinaryStringInfo(&xact_buf, s->data + s->cursor, len);
+
+	/* Look into the message without consuming it. */
+	msg = *s;
+	action = pq_getmsgbyte(&msg);
+
+	switch (action)
+	{
+		case 'B':
+			{
+				TransactionId	remote_xid;
+
+				pglogical_read_begin(&msg, &xact_commit_lsn, &xact_commit_time,
+									 &remote_xid);
+				break;
+			}
+		case 'C':
+			{
+				XLogRecPtr		commit_lsn;
+				XLogRecPtr		end_lsn;
+				TimestampTz		commit_time;
+				uint8			flags;
+				const char	   *gid;
+
+				pglogical_read_commit(&msg, &commit_lsn, &end_lsn,
+									  &commit_time, &flags, &gid);
+
+				if (PGLOGICAL_XACT_EVENT(flags) != PGLOGICAL_COMMIT)
+					xact_serial = true;
+
+				if (xact_serial)
+					apply_pool_run_serial();
+				else
+					apply_pool_dispatch();
+
+				xact_state = APPLY_POOL_IDLE;
+				return;
+			}
+		case 'O':
+			break;
+		case 'R':
+			{
+				ApplyPoolRel   *entry;
+
+				/* Keep our own relation cache up to date. */
+				(void) pglogical_read_rel(&msg);
+				entry = apply_pool_note_relation(s);
+
+				/*
+				 * Changes of the relation which came before can't be applied
+				 * by a worker which gets the new message first.
+				 */
+				if (entry->xact_seq == xact_seq && entry->xact_changed)
+					xact_serial = true;
+
+				if (entry->xact_seq != xact_seq)
+				{
+					entry->xact_seq = xact_seq;
+					entry->xact_changed = false;
+					xact_rels = lappend(xact_rels, entry);
+				}
+				entry->xact_relmsg = true;
+				break;
+			}
+		case 'I':
+		case 'U':
+		case 'D':
+			if (!xact_serial)
+				apply_pool_note_change(&msg, action);
+			break;
+		default:
+			xact_serial = true;
+			break;
+	}
+
+	/* Large transactions won't be copied around, apply them right away. */
+	if (xact_buf.len > APPLY_POOL_MAX_XACT_SIZE)
+	{
+		apply_pool_run_serial();
+		xact_state = APPLY_POOL_IDLE;
+	}
+}
+
+static ApplyPoolRel *
+apply_pool_get_rel(uint32 remoteid, bool create)
+{
+	ApplyPoolRel   *entry;
+	bool			found;
+
+	entry = hash_search(pool_rels, (void *) &remoteid,
+						create ? HASH_ENTER : HASH_FIND, &found);
+
+	if (create && !found)
+	{
+		entry->relmsg.data = NULL;
+		entry->version = 0;
+		memset(entry->sent, 0, sizeof(entry->sent));
+		entry->xact_seq = 0;
+		entry->xact_relmsg = false;
+		entry->xact_changed = false;
+		entry->keys_valid = false;
+		entry->natts = 0;
+		entry->iskey = NULL;
+	}
+
+	return entry;
+}
+
+/*
+ * Remember RELATION message, to be sent to the workers which didn't get it
+ * yet.
+ */
+static ApplyPoolRel *
+apply_pool_note_relation(StringInfo s)
+{
+	StringInfoData	msg = *s;
+	MemoryContext	oldcontext;
+	ApplyPoolRel   *entry;
+	uint32			remoteid;
+
+	(void) pq_getmsgbyte(&msg);	/* action */
+	(void) pq_getmsgbyte(&msg);	/* flags */
+	remoteid = pq_getmsgint(&msg, 4);
+
+	entry = apply_pool_get_rel(remoteid, true);
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+	if (entry->relmsg.data == NULL)
+		initStringInfo(&entry->relmsg);
+	resetStringInfo(&entry->relmsg);
+	appendBinaryStringInfo(&entry->relmsg, s->data + s->cursor,
+						   s->len - s->cursor);
+	MemoryContextSwitchTo(oldcontext);
+
+	entry->version++;
+	entry->keys_valid = false;
+
+	return entry;
+}
+
+/*
+ * Add the keys changed by an INSERT, UPDATE or DELETE to the footprint of
+ * the transaction.
+ */
+static void
+apply_pool_note_change(StringInfo s, char action)
+{
+	uint32			remoteid;
+	ApplyPoolRel   *entry;
+	bool			keyed;
+	char			tupaction;
+
+	(void) pq_getmsgbyte(s);	/* flags */
+	remoteid = pq_getmsgint(s, 4);
+
+	/* Let the leader raise the error for unknown relations. */
+	entry = apply_pool_get_rel(remoteid, false);
+	if (entry == NULL)
+	{
+		xact_serial = true;
+		return;
+	}
+
+	if (entry->xact_seq != xact_seq)
+	{
+		entry->xact_seq = xact_seq;
+		entry->xact_relmsg = false;
+		xact_rels = lappend(xact_rels, entry);
+	}
+	entry->xact_changed = true;
+
+	if (!entry->keys_valid)
+		apply_pool_rel_keys(entry);
+
+	if (entry->serial)
+	{
+		xact_serial = true;
+		return;
+	}
+
+	keyed = !entry->whole;
+
+	/* INSERTs into tables without any unique index can't conflict. */
+	if (action == 'I' && entry->natts == 0)
+		return;
+
+	tupaction = pq_getmsgbyte(s);
+	if (keyed && (tupaction == 'K' || tupaction == 'O'))
+	{
+		keyed = apply_pool_add_tuple(s, entry);
+		if (keyed && action == 'U')
+			tupaction = pq_getmsgbyte(s);
+	}
+	if (keyed && tupaction == 'N')
+		keyed = apply_pool_add_tuple(s, entry);
+
+	if (!keyed)
+		apply_pool_add_key(DatumGetUInt32(hash_uint32(remoteid)));
+}
+
+/*
+ * Find out which remote attributes identify the rows of a relation.
+ */
+static void
+apply_pool_rel_keys(ApplyPoolRel *entry)
+{
+	PGLogicalRelation  *rel;
+	MemoryContext		oldcontext = CurrentMemoryContext;
+	bool				started = false;
+	List			   *indexes;
+	ListCell		   *lc;
+	int					nunique = 0;
+	Oid					uniqueoid = InvalidOid;
+
+	if (!IsTransactionState())
+	{
+		StartTransactionCommand();
+		started = true;
+	}
+
+	rel = pglogical_relation_open(entry->remoteid, AccessShareLock);
+
+	entry->serial = (RelationGetRelid(rel->rel) == pool_queue_relid);
+	entry->whole = false;
+
+	if (entry->iskey != NULL)
+		pfree(entry->iskey);
+	entry->iskey = MemoryContextAllocZero(TopMemoryContext,
+										  Max(rel->natts, 1) * sizeof(bool));
+
+	indexes = RelationGetIndexList(rel->rel);
+	foreach (lc, indexes)
+	{
+		Relation	idxrel = index_open(lfirst_oid(lc), AccessShareLock);
+
+		if (idxrel->rd_index->indisunique)
+		{
+			nunique++;
+			uniqueoid = lfirst_oid(lc);
+		}
+		index_close(idxrel, AccessShareLock);
+	}
+
+	if (nunique == 1 && uniqueoid == rel->rel->rd_replidindex)
+	{
+		Relation	idxrel = index_open(uniqueoid, AccessShareLock);
+		int			i;
+
+		for (i = 0; i < idxrel->rd_index->indnatts; i++)
+		{
+			AttrNumber	attnum = idxrel->rd_index->indkey.values[i];
+			int			j;
+			bool		found = false;
+
+			for (j = 0; j < rel->natts; j++)
+			{
+				if (rel->attmap[j] == attnum - 1)
+				{
+					entry->iskey[j] = true;
+					found = true;
+				}
+			}
+
+			/* Expression or column not sent by the provider. */
+			if (!found)
+				entry->whole = true;
+		}
+		index_close(idxrel, AccessShareLock);
+
+		entry->natts = rel->natts;
+	}
+	else if (nunique > 0)
+	{
+		entry->whole = true;
+		entry->natts = rel->natts;
+	}
+	else
+		entry->natts = 0;
+
+	pglogical_relation_close(rel, AccessShareLock);
+
+	if (started)
+		CommitTransactionCommand();
+	MemoryContextSwitchTo(oldcontext);
+
+	entry->keys_valid = true;
+}
+
+/*
+ * Add the key of a tuple in the protocol format to the footprint.
+ *
+ * Returns false if the key can't be determined from the tuple.
+ */
+static bool
+apply_pool_add_tuple(StringInfo s, ApplyPoolRel *entry)
+{
+	uint32		hash = entry->remoteid;
+	int			natts;
+	int			i;
+
+	if (pq_getmsgbyte(s) != 'T')
+		return false;
+
+	natts = pq_getmsgint(s, 2);
+	if (natts != entry->natts)
+		return false;
+
+	for (i = 0; i < natts; i++)
+	{
+		char		kind = pq_getmsgbyte(s);
+		int			len;
+		const char *data;
+
+		switch (kind)
+		{
+			case 'n':
+				if (entry->iskey[i])
+					hash = (hash << 1 | hash >> 31) ^ 'n';
+				break;
+			case 'u':
+				/* unchanged toasted key, we don't know the value */
+				if (entry->iskey[i])
+					return false;
+				break;
+			case 'i':
+			case 'b':
+			case 't':
+				len = pq_getmsgint(s, 4);
+				data = pq_getmsgbytes(s, len);
+				if (entry->iskey[i])
+					hash = (hash << 1 | hash >> 31) ^
+						DatumGetUInt32(hash_any((const unsigned char *) data,
+												len));
+				break;
+			default:
+				return false;
+		}
+	}
+
+	apply_pool_add_key(hash);
+
+	return true;
+}
+
+/*
+ * Register the key as written by the current transaction and remember the
+ * preceding transaction which wrote it.
+ */
+static void
+apply_pool_add_key(uint32 hash)
+{
+	uint64	   *writer = &pool_writers[hash % APPLY_POOL_KEY_SLOTS];
+
+	if (*writer != xact_seq)
+	{
+		if (*writer > xact_dep)
+			xact_dep = *writer;
+		*writer = xact_seq;
+	}
+}
+
+/*
+ * Apply the collected transaction in the leader.
+ *
+ * The pool has to commit everything before, the rest of the transaction if
+ * it wasn't complete yet is then applied by the leader as it comes.
+ */
+static void
+apply_pool_run_serial(void)
+{
+	apply_pool_drain();
+
+	/* Nothing else is running, later transactions can't depend on this. */
+	SpinLockAcquire(&pool->mutex);
+	pool->committed_seq = xact_seq;
+	SpinLockRelease(&pool->mutex);
+	pool_dispatched = xact_seq;
+
+	apply_pool_replay(xact_buf.data, xact_buf.len);
+	resetStringInfo(&xact_buf);
+}
+
+/*
+ * Hand the collected transaction to an idle pool worker.
+ */
+static void
+apply_pool_dispatch(void)
+{
+	ApplyPoolItem	item;
+	ListCell	   *lc;
+	int				worker = -1;
+	shm_mq_result	res;
+
+	/* The workers need the replication origin session to commit. */
+	if (pool_has_session)
+	{
+		replorigin_session_reset();
+		replorigin_session_origin = InvalidRepOriginId;
+		pool_has_session = false;
+	}
+
+	/* Find idle worker. */
+	while (worker < 0)
+	{
+		int		i;
+
+		for (i = 0; i < pool->nworkers; i++)
+		{
+			int		w = (pool_next_worker + i) % pool->nworkers;
+			uint64	done_seq;
+
+			SpinLockAcquire(&pool->mutex);
+			done_seq = pool->workers[w].done_seq;
+			SpinLockRelease(&pool->mutex);
+
+			if (done_seq == pool_assigned[w])
+			{
+				worker = w;
+				break;
+			}
+		}
+
+		if (worker < 0)
+			apply_pool_wait();
+	}
+	pool_next_worker = (worker + 1) % pool->nworkers;
+
+	item.seq = xact_seq;
+	item.dep = xact_dep;
+
+	resetStringInfo(&item_buf);
+	appendBinaryStringInfo(&item_buf, (char *) &item, sizeof(item));
+
+	/* Send the RELATION messages the worker hasn't seen yet. */
+	foreach (lc, xact_rels)
+	{
+		ApplyPoolRel   *entry = (ApplyPoolRel *) lfirst(lc);
+
+		if (!entry->xact_relmsg && entry->sent[worker] != entry->version)
+		{
+			uint32	len = entry->relmsg.len;
+
+			appendBinaryStringInfo(&item_buf, (char *) &len, sizeof(len));
+			appendBinaryStringInfo(&item_buf, entry->relmsg.data, len);
+		}
+		entry->sent[worker] = entry->version;
+	}
+	appendBinaryStringInfo(&item_buf, xact_buf.data, xact_buf.len);
+
+	pool_assigned[worker] = xact_seq;
+	res = shm_mq_send(pool_mqh[worker], item_buf.len, item_buf.data, false);
+	if (res != SHM_MQ_SUCCESS)
+		ereport(ERROR,
+				(errmsg("could not send transaction to pglogical apply pool worker")));
+
+	pool_dispatched = xact_seq;
+	pool_commit_lsn = xact_commit_lsn;
+	pool_commit_time = xact_commit_time;
+
+	list_free(xact_rels);
+	xact_rels = NIL;
+}
+
+/*
+ * Apply messages of a transaction.
+ */
+static void
+apply_pool_replay(char *data, Size len)
+{
+	Size	pos = 0;
+
+	while (pos < len)
+	{
+		StringInfoData	s;
+		uint32			msglen;
+
+		memcpy(&msglen, data + pos, sizeof(msglen));
+		pos += sizeof(msglen);
+
+		s.data = data + pos;
+		s.len = msglen;
+		s.maxlen = -1;
+		s.cursor = 0;
+
+		pglogical_apply_message(&s);
+
+		pos += msglen;
+	}
+}
+
+/*
+ * Is any preceding transaction waiting for a lock?
+ *
+ * It might be waiting for us, we can't tell cheaply.
+ */
+static bool
+apply_pool_preceding_blocked(void)
+{
+	bool	blocked = false;
+	int		i;
+
+	SpinLockAcquire(&pool->mutex);
+	for (i = 0; i < pool->nworkers; i++)
+	{
+		ApplyPoolWorker	   *w = &pool->workers[i];
+
+		if (w->seq != 0 && w->seq < my_seq && w->proc != NULL &&
+			w->proc->waitLock != NULL)
+		{
+			blocked = true;
+			break;
+		}
+	}
+	SpinLockRelease(&pool->mutex);
+
+	return blocked;
+}
+
+/*
+ * Wait until the transaction seq is committed.
+ *
+ * If yield is set, give up with an error when a preceding transaction seems
+ * to be waiting for our locks for longer than deadlock_timeout.
+ */
+static void
+apply_pool_wait_for(uint64 seq, bool yield)
+{
+	TimestampTz		start = GetCurrentTimestamp();
+	bool			stopped;
+	uint64			committed;
+
+	for (;;)
+	{
+		int		rc;
+
+		SpinLockAcquire(&pool->mutex);
+		committed = pool->committed_seq;
+		stopped = pool->stopped;
+		SpinLockRelease(&pool->mutex);
+
+		if (committed >= seq)
+			break;
+
+		if (stopped || got_SIGTERM)
+			ereport(ERROR,
+					(errmsg("pglogical apply pool is shutting down")));
+
+		if (yield &&
+			TimestampDifferenceExceeds(start, GetCurrentTimestamp(),
+									   DeadlockTimeout) &&
+			apply_pool_preceding_blocked())
+			ereport(ERROR,
+					(errcode(ERRCODE_T_R_SERIALIZATION_FAILURE),
+					 errmsg("canceling apply of remote transaction to let a preceding one proceed")));
+
+		rc = WaitLatch(&MyProc->procLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   DeadlockTimeout);
+
+		ResetLatch(&MyProc->procLatch);
+
+		/* emergency bailout if postmaster has died */
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+	}
+}
+
+/*
+ * Commit the applied transaction.
+ *
+ * Called by handle_commit() in the pool workers.
+ */
+void
+apply_pool_commit(XLogRecPtr end_lsn)
+{
+	XLogRecPtr	local_end = InvalidXLogRecPtr;
+
+	/* Commit in the same order as the provider did. */
+	apply_pool_wait_for(my_seq - 1, true);
+
+	if (IsTransactionState())
+	{
+		replorigin_session_setup(pool->originid);
+		replorigin_session_origin = pool->originid;
+
+		CommitTransactionCommand();
+
+		replorigin_session_reset();
+		replorigin_session_origin = InvalidRepOriginId;
+
+		local_end = XactLastCommitEnd;
+	}
+
+	SpinLockAcquire(&pool->mutex);
+	pool->committed_seq = my_seq;
+	if (local_end != InvalidXLogRecPtr)
+		pool->local_end = local_end;
+	pool->remote_end = end_lsn;
+	SpinLockRelease(&pool->mutex);
+
+	apply_pool_wakeup();
+}
+
+/*
+ * Apply one transaction received from the leader.
+ */
+static void
+apply_pool_execute(char *data, Size len)
+{
+	ApplyPoolItem	item;
+	volatile bool	retry;
+
+	memcpy(&item, data, sizeof(item));
+	my_seq = item.seq;
+
+	SpinLockAcquire(&pool->mutex);
+	MyApplyPoolWorker->seq = item.seq;
+	SpinLockRelease(&pool->mutex);
+
+	apply_pool_wait_for(item.dep, false);
+
+	do
+	{
+		MemoryContext	oldcontext = CurrentMemoryContext;
+
+		retry = false;
+
+		PG_TRY();
+		{
+			apply_pool_replay(data + sizeof(item), len - sizeof(item));
+		}
+		PG_CATCH();
+		{
+			ErrorData  *edata;
+
+			MemoryContextSwitchTo(oldcontext);
+			edata = CopyErrorData();
+
+			if (edata->sqlerrcode != ERRCODE_T_R_DEADLOCK_DETECTED &&
+				edata->sqlerrcode != ERRCODE_T_R_SERIALIZATION_FAILURE)
+				PG_RE_THROW();
+
+			FlushErrorState();
+			AbortOutOfAnyTransaction();
+			pglogical_apply_reset();
+			MemoryContextSwitchTo(oldcontext);
+
+			elog(DEBUG1, "retrying apply of remote transaction: %s",
+				 edata->message);
+			FreeErrorData(edata);
+
+			retry = true;
+		}
+		PG_END_TRY();
+
+		/*
+		 * Apply again once everything before is committed, then there is
+		 * nobody left to conflict with.
+		 */
+		if (retry)
+			apply_pool_wait_for(item.seq - 1, false);
+	} while (retry);
+
+	SpinLockAcquire(&pool->mutex);
+	MyApplyPoolWorker->seq = 0;
+	MyApplyPoolWorker->done_seq = item.seq;
+	SpinLockRelease(&pool->mutex);
+
+	SetLatch(&pool->leader->procLatch);
+}
+
+/*
+ * Entry point of the apply pool worker.
+ */
+void
+pglogical_apply_pool_main(Datum main_arg)
+{
+	dsm_segment	   *seg;
+	shm_mq		   *mq;
+	shm_mq_handle  *mqh;
+	int				worker;
+
+	/* Establish signal handlers. */
+	pqsignal(SIGTERM, handle_sigterm);
+	BackgroundWorkerUnblockSignals();
+
+	Assert(CurrentResourceOwner == NULL);
+	CurrentResourceOwner = ResourceOwnerCreate(NULL, "pglogical apply pool");
+
+	/* Attach to dsm segment. */
+	seg = dsm_attach(DatumGetUInt32(main_arg));
+	if (seg == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("could not map dynamic shared memory segment")));
+	dsm_pin_mapping(seg);
+
+	pool = (ApplyPoolShared *) dsm_segment_address(seg);
+	memcpy(&worker, MyBgworkerEntry->bgw_extra, sizeof(worker));
+	MyApplyPoolWorker = &pool->workers[worker];
+
+	before_shmem_exit(apply_pool_worker_exit, (Datum) 0);
+
+	mq = apply_pool_queue(pool, worker);
+	shm_mq_set_receiver(mq, MyProc);
+	mqh = shm_mq_attach(mq, seg, NULL);
+
+	/* Connect to our database. */
+	BackgroundWorkerInitializeConnectionByOid(pool->dboid, InvalidOid);
+
+	/* Same settings as the apply worker. */
+	SetConfigOption("synchronous_commit",
+					pglogical_synchronous_commit ? "local" : "off",
+					PGC_BACKEND, PGC_S_OVERRIDE);
+	SetConfigOption("check_function_bodies", "off",
+					PGC_INTERNAL, PGC_S_OVERRIDE);
+
+	MessageContext = AllocSetContextCreate(TopMemoryContext,
+										   "MessageContext",
+										   ALLOCSET_DEFAULT_MINSIZE,
+										   ALLOCSET_DEFAULT_INITSIZE,
+										   ALLOCSET_DEFAULT_MAXSIZE);
+
+	SpinLockAcquire(&pool->mutex);
+	MyApplyPoolWorker->proc = MyProc;
+	SpinLockRelease(&pool->mutex);
+
+	pgstat_report_activity(STATE_IDLE, NULL);
+
+	while (!got_SIGTERM)
+	{
+		shm_mq_result	res;
+		Size			len;
+		void		   *data;
+
+		MemoryContextSwitchTo(MessageContext);
+
+		res = shm_mq_receive(mqh, &len, &data, true);
+
+		if (res == SHM_MQ_DETACHED)
+			break;
+		else if (res == SHM_MQ_WOULD_BLOCK)
+		{
+			int		rc;
+
+			rc = WaitLatch(&MyProc->procLatch,
+						   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+						   1000L);
+
+			ResetLatch(&MyProc->procLatch);
+
+			/* emergency bailout if postmaster has died */
+			if (rc & WL_POSTMASTER_DEATH)
+				proc_exit(1);
+
+			continue;
+		}
+
+		apply_pool_execute((char *) data, len);
+
+		/* Cleanup the memory. */
+		MemoryContextResetAndDeleteChildren(MessageContext);
+	}
+
+	proc_exit(0);
+}
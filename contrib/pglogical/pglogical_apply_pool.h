@@ -0,0 +1,45 @@
+/*-------------------------------------------------------------------------
+ *
+ * pglogical_apply_pool.h
+ *		pglogical parallel apply
+ *
+ * Copyright (c) 2015, PostgreSQL Global Development Group
+ *
+ * IDENTIFICATION
+ *		pglogical_apply_pool.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef PGLOGICAL_APPLY_POOL_H
+#define PGLOGICAL_APPLY_POOL_H
+
+#include "lib/stringinfo.h"
+#include "replication/origin.h"
+
+#define APPLY_POOL_MAX_WORKERS		64
+
+struct ApplyPoolWorker;
+
+/* Set in the apply pool workers, NULL in all other processes. */
+extern struct ApplyPoolWorker *MyApplyPoolWorker;
+
+/* Apply worker side. */
+extern void apply_pool_start(int nworkers, RepOriginId originid,
+							 Oid queue_relid);
+extern bool apply_pool_handle_message(StringInfo s);
+extern bool apply_pool_in_transaction(void);
+extern bool apply_pool_busy(void);
+extern bool apply_pool_get_progress(XLogRecPtr *local_end,
+									XLogRecPtr *remote_end);
+extern void apply_pool_drain(void);
+
+/* Pool worker side. */
+extern void apply_pool_commit(XLogRecPtr end_lsn);
+extern void pglogical_apply_pool_main(Datum main_arg);
+
+/* Provided by pglogical_apply.c. */
+extern void pglogical_apply_message(StringInfo s);
+extern bool pglogical_apply_serial_required(void);
+extern void pglogical_apply_reset(void);
+
+#endif /* PGLOGICAL_APPLY_POOL_H */
@@ -1004,9 +1004,10 @@ pglogical_drop_replication_set(PG_FUNCTION_ARGS)
 Datum
 pglogical_replication_set_add_table(PG_FUNCTION_ARGS)
 {
-	Name		repset_name = PG_GETARG_NAME(0);
-	Oid			reloid = PG_GETARG_OID(1);
-	bool		synchronize = PG_GETARG_BOOL(2);
+	Name		repset_name;
+	Oid			reloid;
+	bool		synchronize;
+	List	   *att_names = NIL;
 	PGLogicalRepSet    *repset;
 	Relation			rel;
 	PGLogicalLocalNode *node;
@@ -1014,6 +1015,18 @@ pglogical_replication_set_add_table(PG_FUNCTION_ARGS)
 	char			   *relname;
 	StringInfoData		json;
 
+	/* The column list may be NULL, other arguments may not. */
+	if (PG_ARGISNULL(0) || PG_ARGISNULL(1) || PG_ARGISNULL(2))
+		ereport(ERROR,
+				(errcode(ERRCODE_NULL_VALUE_NOT_ALLOWED),
+				 errmsg("set_name, relation and synchronize may not be NULL")));
+
+	repset_name = PG_GETARG_NAME(0);
+	reloid = PG_GETARG_OID(1);
+	synchronize = PG_GETARG_BOOL(2);
+	if (!PG_ARGISNULL(3))
+		att_names = textarray_to_list(PG_GETARG_ARRAYTYPE_P(3));
+
 	node = get_local_node(true);
 	if (!node)
 		ereport(ERROR,
@@ -1028,7 +1041,7 @@ pglogical_replication_set_add_table(PG_FUNCTION_ARGS)
 	/* Make sure the relation exists. */
 	rel = heap_open(reloid, AccessShareLock);
 
-	replication_set_add_table(repset->id, reloid);
+	replication_set_add_table(repset->id, reloid, att_names);
 
 	if (synchronize)
 	{
@@ -1113,7 +1126,7 @@ pglogical_replication_set_add_all_tables(PG_FUNCTION_ARGS)
 				continue;
 
 			if (!replication_set_has_table(repset->id, reloid))
-				replication_set_add_table(repset->id, reloid);
+				replication_set_add_table(repset->id, reloid, NIL);
 
 			if (synchronize)
 			{
@@ -50,6 +50,7 @@ void pglogical_startup_hook(struct PGLogicalStartupHookArgs *startup_args);
 void pglogical_shutdown_hook(struct PGLogicalShutdownHookArgs *shutdown_args);
 bool pglogical_row_filter_hook(struct PGLogicalRowFilterArgs *rowfilter_args);
 bool pglogical_txn_filter_hook(struct PGLogicalTxnFilterArgs *txnfilter_args);
+Bitmapset *pglogical_column_filter_hook(struct PGLogicalColumnFilterArgs *colfilter_args);
 
 typedef struct PGLogicalHooksPrivate
 {
@@ -243,6 +244,9 @@ pglogical_row_filter_hook(struct PGLogicalRowFilterArgs *rowfilter_args)
 				rs->replicate_delete = replicated_set->replicate_delete;
 				rs->replicate_truncate = replicated_set->replicate_truncate;
 
+				/* The compiled per relation actions are stale now. */
+				repset_relcache_reset();
+
 				return false;
 			}
 		}
@@ -259,6 +263,26 @@ pglogical_row_filter_hook(struct PGLogicalRowFilterArgs *rowfilter_args)
 	return ret;
 }
 
+Bitmapset *
+pglogical_column_filter_hook(struct PGLogicalColumnFilterArgs *colfilter_args)
+{
+	PGLogicalHooksPrivate *private = (PGLogicalHooksPrivate*)colfilter_args->private_data;
+	Oid			relid = RelationGetRelid(colfilter_args->changed_rel);
+
+	/*
+	 * Catching up a single table follows its initial copy, which has all
+	 * the columns; the internal tables are always sent whole.
+	 */
+	if (private->replicate_only_table ||
+		relid == get_queue_table_oid() ||
+		relid == get_replication_set_table_oid())
+		return NULL;
+
+	return relation_replicated_columns(colfilter_args->changed_rel,
+									   private->local_node_id,
+									   private->replication_sets);
+}
+
 bool
 pglogical_txn_filter_hook(struct PGLogicalTxnFilterArgs *txnfilter_args)
 {
@@ -295,6 +319,7 @@ pglogical_hooks_setup(PG_FUNCTION_ARGS)
 	hooks->startup_hook = pglogical_startup_hook;
 	hooks->shutdown_hook = NULL;
 	hooks->row_filter_hook = pglogical_row_filter_hook;
+	hooks->column_filter_hook = pglogical_column_filter_hook;
 	hooks->txn_filter_hook = pglogical_txn_filter_hook;
 
 	PG_RETURN_VOID();
@@ -14,11 +14,16 @@
 
 #include "access/heapam.h"
 
+#include "optimizer/planner.h"
+
+#include "rewrite/rewriteHandler.h"
+
 #include "utils/builtins.h"
 #include "utils/catcache.h"
 #include "utils/hsearch.h"
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 
 #include "pglogical_relcache.h"
@@ -29,6 +34,73 @@ static HTAB *PGLogicalRelationHash = NULL;
 static void pglogical_relcache_init(void);
 static int tupdesc_get_att_by_name(TupleDesc desc, const char *attname);
 
+static void
+relcache_free_defaults(PGLogicalRelation *entry)
+{
+	if (entry->defcxt != NULL)
+		MemoryContextDelete(entry->defcxt);
+
+	entry->defcxt = NULL;
+	entry->ndefaults = 0;
+	entry->defmap = NULL;
+	entry->defexprs = NULL;
+}
+
+/*
+ * Prepare the default expressions of the local columns which are not sent
+ * by the remote, so that they don't have to be looked up for every row.
+ */
+static void
+relcache_build_defaults(PGLogicalRelation *entry)
+{
+	TupleDesc		desc = RelationGetDescr(entry->rel);
+	MemoryContext	oldcontext;
+	bool		   *mapped;
+	int				i;
+
+	relcache_free_defaults(entry);
+
+	/* We get all the data via replication, no need to evaluate anything. */
+	if (desc->natts == entry->natts)
+		return;
+
+	entry->defcxt = AllocSetContextCreate(CacheMemoryContext,
+										  "pglogical relation defaults",
+										  ALLOCSET_SMALL_MINSIZE,
+										  ALLOCSET_SMALL_INITSIZE,
+										  ALLOCSET_SMALL_MAXSIZE);
+	oldcontext = MemoryContextSwitchTo(entry->defcxt);
+
+	mapped = (bool *) palloc0(desc->natts * sizeof(bool));
+	for (i = 0; i < entry->natts; i++)
+		mapped[entry->attmap[i]] = true;
+
+	entry->defmap = (int *) palloc(desc->natts * sizeof(int));
+	entry->defexprs = (Expr **) palloc(desc->natts * sizeof(Expr *));
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Expr	   *defexpr;
+
+		if (desc->attrs[i]->attisdropped || mapped[i])
+			continue;
+
+		defexpr = (Expr *) build_column_default(entry->rel, i + 1);
+
+		if (defexpr != NULL)
+		{
+			/* Run the expression through planner */
+			entry->defexprs[entry->ndefaults] = expression_planner(defexpr);
+			entry->defmap[entry->ndefaults] = i;
+			entry->ndefaults++;
+		}
+	}
+
+	pfree(mapped);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
 static void
 relcache_free_entry(PGLogicalRelation *entry)
 {
@@ -48,6 +120,8 @@ relcache_free_entry(PGLogicalRelation *entry)
 	if (entry->attmap)
 		pfree(entry->attmap);
 
+	relcache_free_defaults(entry);
+
 	entry->natts = 0;
 	entry->reloid = InvalidOid;
 }
@@ -85,6 +159,8 @@ pglogical_relation_open(uint32 remoteid, LOCKMODE lockmode)
 		for (i = 0; i < entry->natts; i++)
 			entry->attmap[i] = tupdesc_get_att_by_name(desc, entry->attnames[i]);
 
+		relcache_build_defaults(entry);
+
 		entry->reloid = RelationGetRelid(entry->rel);
 	}
 	else
@@ -113,6 +189,8 @@ pglogical_relation_cache_update(uint32 remoteid, char *schemaname,
 
 	if (found)
 		relcache_free_entry(entry);
+	else
+		entry->defcxt = NULL;
 
 	/* Make cached copy of the data */
 	oldcontext = MemoryContextSwitchTo(CacheMemoryContext);
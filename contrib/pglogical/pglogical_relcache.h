@@ -13,6 +13,8 @@
 #ifndef PGLOGICAL_RELCACHE_H
 #define PGLOGICAL_RELCACHE_H
 
+#include "nodes/primnodes.h"
+
 typedef struct PGLogicalRelation
 {
 	/* Info coming from the remote side. */
@@ -26,6 +28,12 @@ typedef struct PGLogicalRelation
 	Oid			reloid;
 	Relation	rel;
 	int		   *attmap;
+
+	/* Defaults of local columns not sent by the remote, filled with attmap. */
+	MemoryContext defcxt;
+	int			ndefaults;
+	int		   *defmap;			/* local attribute index of each default */
+	Expr	  **defexprs;		/* planned default expressions */
 } PGLogicalRelation;
 
 extern void pglogical_relation_cache_update(uint32 remoteid,
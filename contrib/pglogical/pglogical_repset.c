@@ -20,10 +20,12 @@
 #include "access/hash.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/sysattr.h"
 #include "access/xact.h"
 
 #include "catalog/indexing.h"
 #include "catalog/namespace.h"
+#include "catalog/objectaddress.h"
 #include "catalog/pg_type.h"
 
 #include "executor/spi.h"
@@ -38,7 +40,9 @@
 #include "utils/fmgroids.h"
 #include "utils/inval.h"
 #include "utils/lsyscache.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/syscache.h"
 
 #include "pglogical_node.h"
 #include "pglogical_repset.h"
@@ -73,12 +77,23 @@ typedef struct RepSetTableTuple
 	Oid			reloid;
 } RepSetTableTuple;
 
-#define Natts_repset_table			2
+#define Natts_repset_table			3
 #define Anum_repset_table_setid		1
 #define Anum_repset_table_reloid	2
+#define Anum_repset_table_att_list	3
 
 static HTAB *RepSetRelationHash = NULL;
 
+/*
+ * Is RepSetRelationHash a complete map of the replicated relations? When it
+ * is, relations missing from it are known not to be replicated and don't
+ * have to be looked up in the catalogs.
+ */
+static bool RepSetRelationHashComplete = false;
+
+/* Cached oid of the pglogical schema, reset on pg_namespace changes. */
+static Oid	RepSetExtensionNamespace = InvalidOid;
+
 /*
  * Read the replication set.
  */
@@ -168,10 +183,14 @@ get_replication_set_by_name(Oid nodeid, const char *setname, bool missing_ok)
 	return repset;
 }
 
+static void repset_relation_init_entry(PGLogicalRepSetRelation *entry,
+									   Oid reloid);
+
 static void
 repset_relcache_invalidate_callback(Datum arg, Oid reloid)
 {
 	PGLogicalRepSetRelation *entry;
+	bool		found;
 
 	/* Just to be sure. */
 	if (RepSetRelationHash == NULL)
@@ -186,6 +205,19 @@ repset_relcache_invalidate_callback(Datum arg, Oid reloid)
 		{
 			entry->isvalid = false;
 		}
+
+		RepSetRelationHashComplete = false;
+	}
+	else if (RepSetRelationHashComplete)
+	{
+		/*
+		 * The relation may have just been added to a replication set, so
+		 * remember it needs a catalog lookup even if we had no entry yet.
+		 */
+		entry = hash_search(RepSetRelationHash, &reloid, HASH_ENTER, &found);
+		if (!found)
+			repset_relation_init_entry(entry, reloid);
+		entry->isvalid = false;
 	}
 	else if ((entry = hash_search(RepSetRelationHash, &reloid,
 								  HASH_FIND, NULL)) != NULL)
@@ -194,6 +226,12 @@ repset_relcache_invalidate_callback(Datum arg, Oid reloid)
 	}
 }
 
+static void
+repset_namespace_invalidate_callback(Datum arg, int cacheid, uint32 hashvalue)
+{
+	RepSetExtensionNamespace = InvalidOid;
+}
+
 static void
 repset_relcache_init(void)
 {
@@ -222,6 +260,22 @@ repset_relcache_init(void)
 	 */
 	CacheRegisterRelcacheCallback(repset_relcache_invalidate_callback,
 								  (Datum) 0);
+	CacheRegisterSyscacheCallback(NAMESPACEOID,
+								  repset_namespace_invalidate_callback,
+								  (Datum) 0);
+}
+
+/*
+ * Forget everything cached about the replicated relations, used when the
+ * flags of one of the subscribed replication sets change.
+ */
+void
+repset_relcache_reset(void)
+{
+	if (RepSetRelationHash == NULL)
+		return;
+
+	repset_relcache_invalidate_callback((Datum) 0, InvalidOid);
 }
 
 List *
@@ -359,40 +413,198 @@ get_relation_replication_sets(Oid nodeid, Oid reloid)
 	return replication_sets;
 }
 
+/*
+ * Get the column list of a replication_set_table tuple as a set of attribute
+ * numbers of the relation, NULL meaning all columns. Columns which don't
+ * exist anymore are ignored.
+ */
+static Bitmapset *
+repset_table_att_list(HeapTuple tuple, TupleDesc desc, Oid reloid)
+{
+	Datum		d;
+	bool		isnull;
+	Bitmapset  *att_list = NULL;
+	ListCell   *lc;
+
+	d = heap_getattr(tuple, Anum_repset_table_att_list, desc, &isnull);
+	if (isnull)
+		return NULL;
+
+	foreach (lc, textarray_to_list(DatumGetArrayTypeP(d)))
+	{
+		AttrNumber	attnum = get_attnum(reloid, (char *) lfirst(lc));
+
+		if (attnum > 0)
+			att_list = bms_add_member(att_list, attnum);
+	}
+
+	/* An empty list can't be satisfied, keep it distinct from "all". */
+	if (att_list == NULL)
+		att_list = bms_make_singleton(0);
+
+	return att_list;
+}
+
+/*
+ * Merge the actions and columns of the subscribed replication set setid (if
+ * it is one) into the relation entry.
+ */
+static void
+repset_relation_add_set(PGLogicalRepSetRelation *entry, Oid setid,
+						List *subs_replication_sets, Bitmapset *att_list)
+{
+	ListCell   *slc;
+
+	foreach (slc, subs_replication_sets)
+	{
+		PGLogicalRepSet	   *srepset = lfirst(slc);
+
+		if (setid == srepset->id)
+		{
+			MemoryContext	oldcxt;
+
+			if (srepset->replicate_insert)
+				entry->replicate_insert = true;
+			if (srepset->replicate_update)
+				entry->replicate_update = true;
+			if (srepset->replicate_delete)
+				entry->replicate_delete = true;
+			if (srepset->replicate_truncate)
+				entry->replicate_truncate = true;
+
+			if (att_list == NULL)
+				entry->all_columns = true;
+			else
+			{
+				oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+				entry->att_list = bms_add_members(entry->att_list, att_list);
+				MemoryContextSwitchTo(oldcxt);
+			}
+		}
+	}
+}
+
+static void
+repset_relation_init_entry(PGLogicalRepSetRelation *entry, Oid reloid)
+{
+	entry->reloid = reloid;
+	entry->isvalid = true;
+	entry->replicate_insert = false;
+	entry->replicate_update = false;
+	entry->replicate_delete = false;
+	entry->replicate_truncate = false;
+	entry->all_columns = false;
+	entry->identity_added = false;
+	entry->att_list = NULL;
+}
+
+/*
+ * Compile the map of all relations that are members of the subscribed
+ * replication sets with a single pass over the replication_set_table
+ * catalog. Relations not found in the map afterwards are not replicated.
+ */
+static void
+repset_relcache_build(List *subs_replication_sets)
+{
+	PGLogicalRepSetRelation *entry;
+	HASH_SEQ_STATUS	status;
+	RangeVar	   *rv;
+	Relation		rel;
+	SysScanDesc		scan;
+	HeapTuple		tuple;
+
+	/* Throw away the old contents, everything is going to be reloaded. */
+	hash_seq_init(&status, RepSetRelationHash);
+	while ((entry = hash_seq_search(&status)) != NULL)
+	{
+		bms_free(entry->att_list);
+		if (hash_search(RepSetRelationHash, &entry->reloid,
+						HASH_REMOVE, NULL) == NULL)
+			elog(ERROR, "hash table corrupted");
+	}
+
+	rv = makeRangeVar(EXTENSION_NAME, CATALOG_REPSET_TABLE, -1);
+	rel = heap_openrv(rv, RowExclusiveLock);
+
+	scan = systable_beginscan(rel, 0, true, NULL, 0, NULL);
+
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		RepSetTableTuple   *t = (RepSetTableTuple *) GETSTRUCT(tuple);
+		bool				found;
+
+		entry = hash_search(RepSetRelationHash, &t->reloid, HASH_ENTER,
+							&found);
+		if (!found)
+			repset_relation_init_entry(entry, t->reloid);
+
+		repset_relation_add_set(entry, t->id, subs_replication_sets,
+								repset_table_att_list(tuple,
+													  RelationGetDescr(rel),
+													  t->reloid));
+	}
+
+	systable_endscan(scan);
+	heap_close(rel, RowExclusiveLock);
+
+	RepSetRelationHashComplete = true;
+}
+
 static PGLogicalRepSetRelation *
 get_repset_relation(Oid nodeid, Oid reloid, List *subs_replication_sets)
 {
 	PGLogicalRepSetRelation *entry;
 	bool			found;
-	ListCell	   *tlc;
-	List		   *table_replication_sets;
+	RangeVar	   *rv;
+	Relation		rel;
+	ScanKeyData		key[1];
+	SysScanDesc		scan;
+	HeapTuple		tuple;
 
 	if (RepSetRelationHash == NULL)
 		repset_relcache_init();
 
 	/*
-	 * HASH_ENTER returns the existing entry if present or creates a new one.
-	 *
 	 * It might seem that it's weird to use just reloid here for the cache key
 	 * when we are searching for nodeid + relation. But this function is only
 	 * used by the output plugin which means the nodeid is always the same as
-	 * only one node is connected to current process.
+	 * only one node is connected to current process. For the same reason the
+	 * subscribed replication sets are always the same, so we can compile the
+	 * whole map of replicated relations upfront.
+	 */
+	if (!RepSetRelationHashComplete)
+		repset_relcache_build(subs_replication_sets);
+
+	/*
+	 * HASH_ENTER returns the existing entry if present or creates a new one.
 	 */
 	entry = hash_search(RepSetRelationHash, (void *) &reloid,
 						HASH_ENTER, &found);
 
-	if (found && entry->isvalid)
+	/*
+	 * Relations missing from a complete map are not members of any
+	 * subscribed replication set, no need to look at the catalogs.
+	 */
+	if (!found)
+	{
+		repset_relation_init_entry(entry, reloid);
 		return entry;
+	}
 
-	/* Fill the entry */
-	entry->reloid = reloid;
-	entry->replicate_insert = false;
-	entry->replicate_update = false;
-	entry->replicate_delete = false;
-	entry->replicate_truncate = false;
+	if (entry->isvalid)
+		return entry;
 
-	/* Get replication sets for a table. */
-	table_replication_sets = get_relation_replication_sets(nodeid, reloid);
+	/* Refill the entry of a relation whose membership may have changed. */
+	bms_free(entry->att_list);
+	repset_relation_init_entry(entry, reloid);
+
+	rv = makeRangeVar(EXTENSION_NAME, CATALOG_REPSET_TABLE, -1);
+	rel = heap_openrv(rv, RowExclusiveLock);
+
+	ScanKeyInit(&key[0],
+				Anum_repset_table_reloid,
+				BTEqualStrategyNumber, F_OIDEQ,
+				ObjectIdGetDatum(reloid));
 
 	/*
 	 * Check for match between table's replication sets and the subscription
@@ -402,39 +614,24 @@ get_repset_relation(Oid nodeid, Oid reloid, List *subs_replication_sets)
 	 * noop. This will be commonly true for example for internal tables which
 	 * are created during table rewrites, so if we'll want to support
 	 * replicating those, we'll have to have special handling for them.
+	 *
+	 * The only index of the catalog leads with set_id, so this is a heap
+	 * scan; it only runs when an invalidated entry is refilled.
 	 */
-	foreach(tlc, table_replication_sets)
-	{
-		PGLogicalRepSet	   *trepset = lfirst(tlc);
-		ListCell		   *slc;
-
-		foreach (slc, subs_replication_sets)
-		{
-			PGLogicalRepSet	   *srepset = lfirst(slc);
+	scan = systable_beginscan(rel, 0, true, NULL, 1, key);
 
-			if (trepset->id == srepset->id)
-			{
-				if (srepset->replicate_insert)
-					entry->replicate_insert = true;
-				if (srepset->replicate_update)
-					entry->replicate_update = true;
-				if (srepset->replicate_delete)
-					entry->replicate_delete = true;
-				if (srepset->replicate_truncate)
-					entry->replicate_truncate = true;
-			}
-		}
+	while (HeapTupleIsValid(tuple = systable_getnext(scan)))
+	{
+		RepSetTableTuple   *t = (RepSetTableTuple *) GETSTRUCT(tuple);
 
-		/*
-		 * Now we now everything is replicated, no point in trying to check
-		 * more replication sets.
-		 */
-		if (entry->replicate_insert && entry->replicate_update &&
-			entry->replicate_delete && entry->replicate_truncate)
-			break;
+		repset_relation_add_set(entry, t->id, subs_replication_sets,
+								repset_table_att_list(tuple,
+													  RelationGetDescr(rel),
+													  reloid));
 	}
 
-	entry->isvalid = true;
+	systable_endscan(scan);
+	heap_close(rel, RowExclusiveLock);
 
 	return entry;
 }
@@ -466,8 +663,13 @@ relation_is_replicated(Relation rel, Oid nodeid, List *replication_sets,
 {
 	PGLogicalRepSetRelation *r;
 
-	/* TODO: cache */
-	if (RelationGetNamespace(rel) == get_namespace_oid(EXTENSION_NAME, false))
+	if (RepSetRelationHash == NULL)
+		repset_relcache_init();
+
+	if (RepSetExtensionNamespace == InvalidOid)
+		RepSetExtensionNamespace = get_namespace_oid(EXTENSION_NAME, false);
+
+	if (RelationGetNamespace(rel) == RepSetExtensionNamespace)
 		return false;
 
 	r = get_repset_relation(nodeid, RelationGetRelid(rel), replication_sets);
@@ -490,6 +692,45 @@ relation_is_replicated(Relation rel, Oid nodeid, List *replication_sets,
 	return false;
 }
 
+/*
+ * Get the set of attribute numbers of the relation replicated by the
+ * subscribed replication sets, NULL meaning all columns.
+ *
+ * Replica identity columns are always part of a column list, as the
+ * downstream can't apply UPDATEs and DELETEs without them.
+ */
+Bitmapset *
+relation_replicated_columns(Relation rel, Oid nodeid, List *replication_sets)
+{
+	PGLogicalRepSetRelation *r;
+
+	if (RepSetRelationHash == NULL)
+		repset_relcache_init();
+
+	r = get_repset_relation(nodeid, RelationGetRelid(rel), replication_sets);
+
+	if (r->all_columns || r->att_list == NULL)
+		return NULL;
+
+	if (!r->identity_added)
+	{
+		Bitmapset	   *idattrs;
+		MemoryContext	oldcxt;
+		int				x = -1;
+
+		idattrs = RelationGetIndexAttrBitmap(rel, INDEX_ATTR_BITMAP_IDENTITY_KEY);
+		oldcxt = MemoryContextSwitchTo(CacheMemoryContext);
+		while ((x = bms_next_member(idattrs, x)) >= 0)
+			r->att_list = bms_add_member(r->att_list,
+										 x + FirstLowInvalidHeapAttributeNumber);
+		MemoryContextSwitchTo(oldcxt);
+		bms_free(idattrs);
+		r->identity_added = true;
+	}
+
+	return r->att_list;
+}
+
 /*
  * Add new tuple to the replication_sets catalog.
  */
@@ -783,10 +1024,12 @@ drop_node_replication_sets(Oid nodeid)
 /*
  * Insert new replication set / relation mapping.
  *
+ * att_names is the list of the columns to replicate, NIL for all of them.
+ *
  * The caller is responsible for ensuring the relation exists.
  */
 void
-replication_set_add_table(Oid setid, Oid reloid)
+replication_set_add_table(Oid setid, Oid reloid, List *att_names)
 {
 	RangeVar   *rv;
 	Relation	rel;
@@ -820,6 +1063,42 @@ replication_set_add_table(Oid setid, Oid reloid)
 						   "UPDATEs and/or DELETEs"),
 				 errhint("Add a PRIMARY KEY to the table")));
 
+	/* Check the column list, it has to include the replica identity. */
+	if (att_names != NIL)
+	{
+		Bitmapset  *idattrs;
+		Bitmapset  *att_list = NULL;
+		ListCell   *lc;
+		int			x = -1;
+
+		foreach (lc, att_names)
+		{
+			char	   *attname = (char *) lfirst(lc);
+			AttrNumber	attnum = get_attnum(reloid, attname);
+
+			if (attnum <= 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_UNDEFINED_COLUMN),
+						 errmsg("column \"%s\" of table %s does not exist",
+								attname, RelationGetRelationName(targetrel))));
+			att_list = bms_add_member(att_list, attnum);
+		}
+
+		idattrs = RelationGetIndexAttrBitmap(targetrel,
+											 INDEX_ATTR_BITMAP_IDENTITY_KEY);
+		while ((x = bms_next_member(idattrs, x)) >= 0)
+		{
+			AttrNumber	attnum = x + FirstLowInvalidHeapAttributeNumber;
+
+			if (!bms_is_member(attnum, att_list))
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("column list of table %s must include replica identity column \"%s\"",
+								RelationGetRelationName(targetrel),
+								get_attname(reloid, attnum))));
+		}
+	}
+
 	heap_close(targetrel, NoLock);
 
 	/* Open the catalog. */
@@ -832,6 +1111,11 @@ replication_set_add_table(Oid setid, Oid reloid)
 
 	values[Anum_repset_table_setid - 1] = ObjectIdGetDatum(repset->id);
 	values[Anum_repset_table_reloid - 1] = reloid;
+	if (att_names != NIL)
+		values[Anum_repset_table_att_list - 1] =
+			PointerGetDatum(strlist_to_textarray(att_names));
+	else
+		nulls[Anum_repset_table_att_list - 1] = true;
 
 	tup = heap_form_tuple(tupDesc, values, nulls);
 
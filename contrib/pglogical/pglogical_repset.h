@@ -41,6 +41,10 @@ typedef struct PGLogicalRepSetRelation
 	bool			replicate_update;	/* should update be replicated? */
 	bool			replicate_delete;	/* should delete be replicated? */
 	bool			replicate_truncate; /* should truncate be replicated? */
+
+	bool			all_columns;		/* is any set replicating all columns? */
+	bool			identity_added;		/* are replica identity columns in att_list? */
+	Bitmapset	   *att_list;			/* union of the column lists of the sets */
 } PGLogicalRepSetRelation;
 
 /* Change types, can't use ReorderBufferChangeType as it's missing TRUNCATE. */
@@ -65,13 +69,16 @@ extern List *get_relation_replication_sets(Oid nodeid, Oid reloid);
 extern bool relation_is_replicated(Relation rel, Oid nodeid,
 								   List *replication_set_names,
 								   PGLogicalChangeType change_type);
+extern Bitmapset *relation_replicated_columns(Relation rel, Oid nodeid,
+											  List *replication_sets);
+extern void repset_relcache_reset(void);
 
 extern void create_replication_set(PGLogicalRepSet *repset);
 extern void alter_replication_set(PGLogicalRepSet *repset);
 extern void drop_replication_set(Oid setid);
 extern void drop_node_replication_sets(Oid nodeid);
 
-extern void replication_set_add_table(Oid setid, Oid reloid);
+extern void replication_set_add_table(Oid setid, Oid reloid, List *att_names);
 extern bool replication_set_has_table(Oid setid, Oid reloid);
 extern void replication_set_remove_table(Oid setid, Oid reloid,
 										 bool from_table_drop);
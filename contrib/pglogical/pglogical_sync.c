@@ -13,6 +13,7 @@
 
 #include "postgres.h"
 
+#include <poll.h>
 #include <unistd.h>
 
 #include "libpq-fe.h"
@@ -126,9 +127,21 @@ restore_structure(PGLogicalSubscription *sub, const char *srcfile,
 			 PG_VERSION_NUM / 100 / 100, PG_VERSION_NUM / 100 % 100);
 
 	initStringInfo(&command);
-	appendStringInfo(&command,
-					 "%s --section=\"%s\" --exit-on-error -1 -d \"%s\" \"%s\"",
-					 pg_restore, section, sub->target_if->dsn, srcfile);
+
+	/*
+	 * Post-data items are mostly index builds, which we run in parallel if
+	 * allowed to.  pg_restore can't do that in a single transaction.
+	 */
+	if (strcmp(section, "post-data") == 0 &&
+		pglogical_synchronize_parallelism > 1)
+		appendStringInfo(&command,
+						 "%s --section=\"%s\" --exit-on-error -j %d -d \"%s\" \"%s\"",
+						 pg_restore, section, pglogical_synchronize_parallelism,
+						 sub->target_if->dsn, srcfile);
+	else
+		appendStringInfo(&command,
+						 "%s --section=\"%s\" --exit-on-error -1 -d \"%s\" \"%s\"",
+						 pg_restore, section, sub->target_if->dsn, srcfile);
 
 	res = system(command.data);
 	if (res != 0)
@@ -268,24 +281,36 @@ finish_copy_target_tx(PGconn *conn)
 
 
 /*
- * COPY single table over wire.
+ * State of one origin/target connection pair used for copying tables.
+ */
+typedef struct CopyStream
+{
+	PGconn	   *origin_conn;
+	PGconn	   *target_conn;
+	RangeVar   *table;			/* table being copied, NULL if idle */
+	bool		flushing;		/* target has unsent data buffered */
+} CopyStream;
+
+/*
+ * Start COPY of a single table over the stream's connections.
+ *
+ * The data is then relayed by copy_stream_relay.
  */
 static void
-copy_table_data(PGconn *origin_conn, PGconn *target_conn,
-				const char *nspname, const char *relname)
+copy_stream_start(CopyStream *stream, RangeVar *table)
 {
+	PGconn	   *origin_conn = stream->origin_conn;
+	PGconn	   *target_conn = stream->target_conn;
 	PGresult   *res;
-	int			bytes;
-	char	   *copybuf;
 	StringInfoData	query;
 
 	/* Build COPY TO query. */
 	initStringInfo(&query);
 	appendStringInfo(&query, "COPY %s.%s TO stdout",
-					 PQescapeIdentifier(origin_conn, nspname,
-										strlen(nspname)),
-					 PQescapeIdentifier(origin_conn, relname,
-										strlen(relname)));
+					 PQescapeIdentifier(origin_conn, table->schemaname,
+										strlen(table->schemaname)),
+					 PQescapeIdentifier(origin_conn, table->relname,
+										strlen(table->relname)));
 
 	/* Execute COPY TO. */
 	res = PQexec(origin_conn, query.data);
@@ -296,14 +321,15 @@ copy_table_data(PGconn *origin_conn, PGconn *target_conn,
 				 errdetail("Query '%s': %s", query.data,
 					 PQerrorMessage(origin_conn))));
 	}
+	PQclear(res);
 
 	/* Build COPY FROM query. */
 	resetStringInfo(&query);
 	appendStringInfo(&query, "COPY %s.%s FROM stdin",
-					 PQescapeIdentifier(origin_conn, nspname,
-										strlen(nspname)),
-					 PQescapeIdentifier(origin_conn, relname,
-										strlen(relname)));
+					 PQescapeIdentifier(origin_conn, table->schemaname,
+										strlen(table->schemaname)),
+					 PQescapeIdentifier(origin_conn, table->relname,
+										strlen(table->relname)));
 
 	/* Execute COPY FROM. */
 	res = PQexec(target_conn, query.data);
@@ -312,11 +338,105 @@ copy_table_data(PGconn *origin_conn, PGconn *target_conn,
 		ereport(ERROR,
 				(errmsg("table copy failed"),
 				 errdetail("Query '%s': %s", query.data,
+					 PQerrorMessage(target_conn))));
+	}
+	PQclear(res);
+
+	/* Data is relayed without blocking on either side. */
+	if (PQsetnonblocking(target_conn, 1) != 0)
+		elog(ERROR, "could not set target connection to nonblocking mode");
+
+	stream->table = table;
+	stream->flushing = false;
+	pfree(query.data);
+}
+
+/*
+ * Finish COPY of the stream's table, after the origin sent all of it.
+ */
+static void
+copy_stream_finish(CopyStream *stream)
+{
+	PGconn	   *origin_conn = stream->origin_conn;
+	PGconn	   *target_conn = stream->target_conn;
+	PGresult   *res;
+
+	res = PQgetResult(origin_conn);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		ereport(ERROR,
+				(errmsg("reading from origin table failed"),
+				 errdetail("source connection reported: %s",
 					 PQerrorMessage(origin_conn))));
 	}
+	PQclear(res);
+
+	/* Send local finish and wait for the target to absorb the rest. */
+	if (PQsetnonblocking(target_conn, 0) != 0 ||
+		PQputCopyEnd(target_conn, NULL) != 1)
+	{
+		ereport(ERROR,
+				(errmsg("sending copy-completion to destination connection failed"),
+				 errdetail("destination connection reported: %s",
+					 PQerrorMessage(target_conn))));
+	}
+
+	res = PQgetResult(target_conn);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		ereport(ERROR,
+				(errmsg("writing to target table failed"),
+				 errdetail("destination connection reported: %s",
+					 PQerrorMessage(target_conn))));
+	}
+	PQclear(res);
+
+	stream->table = NULL;
+}
+
+/*
+ * Relay the COPY data available on the stream's origin connection to its
+ * target connection, without blocking.
+ *
+ * Returns the socket and events to wait for before calling again, or
+ * finishes the table's COPY and returns -1 once all data arrived.
+ */
+static pgsocket
+copy_stream_relay(CopyStream *stream, short *events)
+{
+	PGconn	   *origin_conn = stream->origin_conn;
+	PGconn	   *target_conn = stream->target_conn;
+	int			bytes;
+	char	   *copybuf;
 
-	while ((bytes = PQgetCopyData(origin_conn, &copybuf, false)) > 0)
+	/* Don't read more until the target took what we gave it. */
+	if (stream->flushing)
 	{
+		int			flushed = PQflush(target_conn);
+
+		if (flushed < 0)
+			ereport(ERROR,
+					(errmsg("writing to target table failed"),
+					 errdetail("destination connection reported: %s",
+						 PQerrorMessage(target_conn))));
+		if (flushed > 0)
+		{
+			*events = POLLOUT;
+			return PQsocket(target_conn);
+		}
+		stream->flushing = false;
+	}
+
+	if (PQconsumeInput(origin_conn) != 1)
+		ereport(ERROR,
+				(errmsg("reading from origin table failed"),
+				 errdetail("source connection reported: %s",
+					 PQerrorMessage(origin_conn))));
+
+	while ((bytes = PQgetCopyData(origin_conn, &copybuf, true)) > 0)
+	{
+		int			flushed;
+
 		if (PQputCopyData(target_conn, copybuf, bytes) != 1)
 		{
 			ereport(ERROR,
@@ -326,7 +446,24 @@ copy_table_data(PGconn *origin_conn, PGconn *target_conn,
 		}
 		PQfreemem(copybuf);
 
-		CHECK_FOR_INTERRUPTS();
+		flushed = PQflush(target_conn);
+		if (flushed < 0)
+			ereport(ERROR,
+					(errmsg("writing to target table failed"),
+					 errdetail("destination connection reported: %s",
+						 PQerrorMessage(target_conn))));
+		if (flushed > 0)
+		{
+			stream->flushing = true;
+			*events = POLLOUT;
+			return PQsocket(target_conn);
+		}
+	}
+
+	if (bytes == 0)
+	{
+		*events = POLLIN;
+		return PQsocket(origin_conn);
 	}
 
 	if (bytes != -1)
@@ -337,53 +474,100 @@ copy_table_data(PGconn *origin_conn, PGconn *target_conn,
 					bytes, PQerrorMessage(origin_conn))));
 	}
 
-	/* Send local finish */
-	if (PQputCopyEnd(target_conn, NULL) != 1)
-	{
-		ereport(ERROR,
-				(errmsg("sending copy-completion to destination connection failed"),
-				 errdetail("destination connection reported: %s",
-					 PQerrorMessage(target_conn))));
-	}
-
-	PQclear(res);
+	copy_stream_finish(stream);
+	return PGINVALID_SOCKET;
 }
 
 /*
  * Copy data from origin node to target node.
  *
- * Creates new connection to origin and target.
+ * Creates new connections to origin and target.  Up to
+ * pglogical.synchronize_parallelism tables are copied at the same time,
+ * each over its own pair of connections: the origin connections all use
+ * the same exported snapshot, and each takes the next table from the list
+ * when it is done with the previous one.  With the COPY work done by the
+ * backends serving those connections, this process only relays the data.
  */
 static void
 copy_tables_data(const char *origin_dsn, const char *target_dsn,
 				 const char *origin_snapshot, List *tables)
 {
-	PGconn	   *origin_conn;
-	PGconn	   *target_conn;
-	ListCell   *lc;
-
-	/* Connect to origin node. */
-	origin_conn = pglogical_connect(origin_dsn, EXTENSION_NAME "_copy");
-	start_copy_origin_tx(origin_conn, origin_snapshot);
-
-	/* Connect to target node. */
-	target_conn = pglogical_connect(target_dsn, EXTENSION_NAME "_copy");
-	start_copy_target_tx(target_conn);
+	CopyStream *streams;
+	struct pollfd *pollfds;
+	int			nstreams;
+	int			i;
+	ListCell   *next_table = list_head(tables);
+
+	nstreams = Max(Min(pglogical_synchronize_parallelism,
+					   list_length(tables)), 1);
+	streams = palloc0(nstreams * sizeof(CopyStream));
+	pollfds = palloc0(nstreams * sizeof(struct pollfd));
+
+	for (i = 0; i < nstreams; i++)
+	{
+		/* Connect to origin node. */
+		streams[i].origin_conn = pglogical_connect(origin_dsn,
+												   EXTENSION_NAME "_copy");
+		start_copy_origin_tx(streams[i].origin_conn, origin_snapshot);
+
+		/* Connect to target node. */
+		streams[i].target_conn = pglogical_connect(target_dsn,
+												   EXTENSION_NAME "_copy");
+		start_copy_target_tx(streams[i].target_conn);
+	}
 
 	/* Copy every table. */
-	foreach (lc, tables)
+	for (;;)
 	{
-		RangeVar	*rv = lfirst(lc);
+		int			npollfds = 0;
+
+		for (i = 0; i < nstreams; i++)
+		{
+			CopyStream *stream = &streams[i];
+			pgsocket	sock = PGINVALID_SOCKET;
+			short		events = 0;
+
+			while (sock == PGINVALID_SOCKET)
+			{
+				if (stream->table == NULL)
+				{
+					if (next_table == NULL)
+						break;
+					copy_stream_start(stream, lfirst(next_table));
+					next_table = lnext(next_table);
+				}
+				sock = copy_stream_relay(stream, &events);
+			}
+
+			if (sock != PGINVALID_SOCKET)
+			{
+				pollfds[npollfds].fd = sock;
+				pollfds[npollfds].events = events;
+				pollfds[npollfds].revents = 0;
+				npollfds++;
+			}
+		}
 
-		copy_table_data(origin_conn, target_conn,
-						rv->schemaname, rv->relname);
+		if (npollfds == 0)
+			break;
+
+		if (poll(pollfds, npollfds, 1000) < 0 && errno != EINTR)
+			ereport(ERROR,
+					(errcode_for_socket_access(),
+					 errmsg("could not wait for table copy: %m")));
 
 		CHECK_FOR_INTERRUPTS();
 	}
 
 	/* Finish the transactions and disconnect. */
-	finish_copy_origin_tx(origin_conn);
-	finish_copy_target_tx(target_conn);
+	for (i = 0; i < nstreams; i++)
+	{
+		finish_copy_origin_tx(streams[i].origin_conn);
+		finish_copy_target_tx(streams[i].target_conn);
+	}
+
+	pfree(streams);
+	pfree(pollfds);
 }
 
 /*
@@ -391,18 +575,15 @@ copy_tables_data(const char *origin_dsn, const char *target_dsn,
  *
  * Creates new connection to origin and target.
  *
- * This is basically same as the copy_tables_data, but it can't be easily
- * merged to single function because we need to get list of tables here after
- * the transaction is bound to a snapshot.
+ * This gets the list of tables in a transaction bound to the snapshot, so
+ * that it matches the data, and then copies them by copy_tables_data.
  */
 static List *
 copy_replication_sets_data(const char *origin_dsn, const char *target_dsn,
 						   const char *origin_snapshot, List *replication_sets)
 {
 	PGconn	   *origin_conn;
-	PGconn	   *target_conn;
 	List	   *tables;
-	ListCell   *lc;
 
 	/* Connect to origin node. */
 	origin_conn = pglogical_connect(origin_dsn, EXTENSION_NAME "_copy");
@@ -412,24 +593,10 @@ copy_replication_sets_data(const char *origin_dsn, const char *target_dsn,
 	tables = pg_logical_get_remote_repset_tables(origin_conn,
 												 replication_sets);
 
-	/* Connect to target node. */
-	target_conn = pglogical_connect(target_dsn, EXTENSION_NAME "_copy");
-	start_copy_target_tx(target_conn);
+	finish_copy_origin_tx(origin_conn);
 
 	/* Copy every table. */
-	foreach (lc, tables)
-	{
-		RangeVar	*rv = lfirst(lc);
-
-		copy_table_data(origin_conn, target_conn,
-						rv->schemaname, rv->relname);
-
-		CHECK_FOR_INTERRUPTS();
-	}
-
-	/* Finish the transactions and disconnect. */
-	finish_copy_origin_tx(origin_conn);
-	finish_copy_target_tx(target_conn);
+	copy_tables_data(origin_dsn, target_dsn, origin_snapshot, tables);
 
 	return tables;
 }
@@ -506,6 +506,8 @@ prepare_startup_message(PGLogicalOutputData *data)
 			data->hooks.shutdown_hook != NULL);
 	l = add_startup_msg_b(l, "hooks.row_filter_enabled",
 			data->hooks.row_filter_hook != NULL);
+	l = add_startup_msg_b(l, "hooks.column_filter_enabled",
+			data->hooks.column_filter_hook != NULL);
 	l = add_startup_msg_b(l, "hooks.transaction_filter_enabled",
 			data->hooks.txn_filter_hook != NULL);
 
@@ -16,6 +16,9 @@ extern void call_shutdown_hook(PGLogicalOutputData *data);
 extern bool call_row_filter_hook(PGLogicalOutputData *data,
 		ReorderBufferTXN *txn, Relation rel, ReorderBufferChange *change);
 
+extern Bitmapset *call_column_filter_hook(PGLogicalOutputData *data,
+		Relation rel);
+
 extern bool call_txn_filter_hook(PGLogicalOutputData *data,
 		RepOriginId txn_origin);
 
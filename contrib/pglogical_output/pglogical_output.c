@@ -374,9 +374,11 @@ pg_decode_startup(LogicalDecodingContext * ctx, OutputPluginOptions *opt,
 			data->relmeta_cache_size = data->client_relmeta_cache_size;
 		}
 
-		/* if cache enabled, init it */
-		if (data->relmeta_cache_size != 0)
-			pglogical_init_relmetacache(ctx->context);
+		/*
+		 * The cache is always initialized: even if the client doesn't cache
+		 * relation metadata, protocols keep per-relation output state in it.
+		 */
+		pglogical_init_relmetacache(ctx->context);
 	}
 }
 
@@ -436,6 +438,10 @@ pg_decode_commit_txn(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 {
 	PGLogicalOutputData* data = (PGLogicalOutputData*)ctx->output_plugin_private;
 
+	/* 3PC states of prepared transactions are of no use to the protocol */
+	if (txn->xact_action == XLOG_XACT_3PC_STATE)
+		return;
+
 	OutputPluginPrepareWrite(ctx, true);
 	data->api->write_commit(ctx->out, data, txn, commit_lsn);
 	OutputPluginWrite(ctx, true);
@@ -457,16 +463,30 @@ pg_decode_change(LogicalDecodingContext *ctx, ReorderBufferTXN *txn,
 	/* Avoid leaking memory by using and resetting our own context */
 	old = MemoryContextSwitchTo(data->context);
 
+	/* Columns to send, applied by the protocol to metadata and tuples */
+	data->att_list = call_column_filter_hook(data, relation);
+
 	/*
 	 * If the protocol wants to write relation information and the client
-	 * isn't known to have metadata cached for this relation already,
-	 * send relation metadata.
+	 * isn't known to have metadata cached for this relation already (or has
+	 * it cached for another set of columns), send relation metadata.
 	 *
 	 * TODO: track hit/miss stats
 	 */
 	if (data->api->write_rel != NULL &&
-			!pglogical_cache_relmeta(data, relation, &cached_relmeta))
+			(!pglogical_cache_relmeta(data, relation, &cached_relmeta) ||
+			 !bms_equal(cached_relmeta->att_list, data->att_list)))
 	{
+		if (cached_relmeta != NULL)
+		{
+			MemoryContext oldcxt = MemoryContextSwitchTo(pglogical_relmeta_context());
+
+			cached_relmeta->is_cached = false;
+			bms_free(cached_relmeta->att_list);
+			cached_relmeta->att_list = bms_copy(data->att_list);
+			MemoryContextSwitchTo(oldcxt);
+		}
+
 		OutputPluginPrepareWrite(ctx, false);
 		data->api->write_rel(ctx->out, data, relation, cached_relmeta);
 		OutputPluginWrite(ctx, false);
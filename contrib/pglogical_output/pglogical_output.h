@@ -65,6 +65,9 @@ typedef struct PGLogicalOutputData
 	int		field_datum_encoding;
 	int		relmeta_cache_size;
 
+	/* columns of the relation being written, as chosen by the column filter hook; NULL means all */
+	Bitmapset *att_list;
+
 	/*
 	 * client info
 	 *
@@ -105,4 +108,9 @@ typedef struct PGLogicalOutputData
 	List *extra_startup_params;
 } PGLogicalOutputData;
 
+/* Is the attribute sent for the relation being written? */
+#define PGL_ATT_IS_SENT(data, att) \
+	(!(att)->attisdropped && \
+	 ((data)->att_list == NULL || bms_is_member((att)->attnum, (data)->att_list)))
+
 #endif /* PG_LOGICAL_OUTPUT_H */
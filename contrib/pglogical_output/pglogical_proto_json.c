@@ -16,6 +16,7 @@
 
 #include "pglogical_output.h"
 #include "pglogical_proto_json.h"
+#include "pglogical_relmetacache.h"
 
 #include "access/sysattr.h"
 #include "access/tuptoaster.h"
@@ -38,12 +39,16 @@
 
 #include "mb/pg_wchar.h"
 
+#include "nodes/makefuncs.h"
+
 #ifdef HAVE_REPLICATION_ORIGINS
 #include "replication/origin.h"
 #endif
 
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/json.h"
+#include "utils/jsonapi.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
@@ -51,6 +56,8 @@
 #include "utils/timestamp.h"
 #include "utils/typcache.h"
 
+/* Buffer size for pg_lltoa, as in int8.c */
+#define MAXINT8LEN		25
 
 /*
  * Write BEGIN to the output stream.
@@ -126,20 +133,247 @@ pglogical_json_write_commit(StringInfo out, PGLogicalOutputData *data, ReorderBu
 }
 
 /*
- * Write a tuple to the outputstream, in the most efficient format possible.
+ * How an attribute value is converted to json.
+ *
+ * Integers, floats, numerics and booleans are written without fmgr output
+ * function lookups, text-like values are escaped directly and json is copied
+ * as is. Everything else goes through to_json, so the result is the same as
+ * row_to_json would produce.
+ */
+typedef enum JsonAttKind
+{
+	JSON_ATT_DROPPED,
+	JSON_ATT_INT2,
+	JSON_ATT_INT4,
+	JSON_ATT_INT8,
+	JSON_ATT_FLOAT4,
+	JSON_ATT_FLOAT8,
+	JSON_ATT_NUMERIC,
+	JSON_ATT_BOOL,
+	JSON_ATT_TEXT,
+	JSON_ATT_JSON,
+	JSON_ATT_GENERIC
+} JsonAttKind;
+
+typedef struct JsonAttMeta
+{
+	JsonAttKind	kind;
+	char	   *key;		/* escaped attribute name followed by ':' */
+	int			keylen;
+	FmgrInfo	to_json;	/* for JSON_ATT_GENERIC only */
+} JsonAttMeta;
+
+/*
+ * Per-relation json output state, kept in the relation metadata cache and
+ * rebuilt after relcache invalidation.
+ */
+typedef struct JsonRelMeta
+{
+	char	   *relation;	/* ,"relation":["nspname","relname"] */
+	int			relationlen;
+	int			natts;
+	JsonAttMeta	atts[FLEXIBLE_ARRAY_MEMBER];
+} JsonRelMeta;
+
+static JsonRelMeta *
+json_get_relmeta(Relation rel)
+{
+	struct PGLRelMetaCacheEntry *entry = pglogical_get_relmeta(rel);
+	TupleDesc	desc = RelationGetDescr(rel);
+	JsonRelMeta *meta = (JsonRelMeta *) entry->api_private;
+	MemoryContext oldcxt;
+	StringInfoData buf;
+	int			i;
+
+	if (meta != NULL && meta->natts == desc->natts)
+		return meta;
+
+	oldcxt = MemoryContextSwitchTo(pglogical_relmeta_context());
+
+	meta = palloc(offsetof(JsonRelMeta, atts) + desc->natts * sizeof(JsonAttMeta));
+	meta->natts = desc->natts;
+
+	initStringInfo(&buf);
+	appendStringInfoString(&buf, ",\"relation\":[");
+	escape_json(&buf, get_namespace_name(RelationGetNamespace(rel)));
+	appendStringInfoChar(&buf, ',');
+	escape_json(&buf, RelationGetRelationName(rel));
+	appendStringInfoChar(&buf, ']');
+	meta->relation = buf.data;
+	meta->relationlen = buf.len;
+
+	for (i = 0; i < desc->natts; i++)
+	{
+		Form_pg_attribute att = desc->attrs[i];
+		JsonAttMeta *am = &meta->atts[i];
+
+		if (att->attisdropped)
+		{
+			am->kind = JSON_ATT_DROPPED;
+			continue;
+		}
+
+		initStringInfo(&buf);
+		escape_json(&buf, NameStr(att->attname));
+		appendStringInfoChar(&buf, ':');
+		am->key = buf.data;
+		am->keylen = buf.len;
+
+		/* domains are written as their base type, as json_categorize_type does */
+		switch (getBaseType(att->atttypid))
+		{
+			case INT2OID:
+				am->kind = JSON_ATT_INT2;
+				break;
+			case INT4OID:
+				am->kind = JSON_ATT_INT4;
+				break;
+			case INT8OID:
+				am->kind = JSON_ATT_INT8;
+				break;
+			case FLOAT4OID:
+				am->kind = JSON_ATT_FLOAT4;
+				break;
+			case FLOAT8OID:
+				am->kind = JSON_ATT_FLOAT8;
+				break;
+			case NUMERICOID:
+				am->kind = JSON_ATT_NUMERIC;
+				break;
+			case BOOLOID:
+				am->kind = JSON_ATT_BOOL;
+				break;
+			case TEXTOID:
+			case VARCHAROID:
+			case BPCHAROID:
+				am->kind = JSON_ATT_TEXT;
+				break;
+			case JSONOID:
+				am->kind = JSON_ATT_JSON;
+				break;
+			default:
+				am->kind = JSON_ATT_GENERIC;
+				/* to_json looks up type of its argument in the call expression */
+				fmgr_info(F_TO_JSON, &am->to_json);
+				am->to_json.fn_expr = (Node *)
+					makeFuncExpr(F_TO_JSON, JSONOID,
+								 list_make1(makeNullConst(att->atttypid,
+														  att->atttypmod,
+														  att->attcollation)),
+								 InvalidOid, InvalidOid, COERCE_EXPLICIT_CALL);
+				break;
+		}
+	}
+
+	MemoryContextSwitchTo(oldcxt);
+
+	entry->api_private = meta;
+	return meta;
+}
+
+/*
+ * Write output of a numeric type output function: as a json number if it
+ * is one, otherwise (NaN, Infinity) as a string.
  */
 static void
-json_write_tuple(StringInfo out, Relation rel, HeapTuple tuple)
+json_write_number(StringInfo out, char *outputstr)
 {
-	TupleDesc	desc;
-	Datum		tupdatum,
-				json;
+	int			len = strlen(outputstr);
+
+	if (IsValidJsonNumber(outputstr, len))
+		appendBinaryStringInfo(out, outputstr, len);
+	else
+		escape_json(out, outputstr);
+}
+
+/*
+ * Write a tuple to the outputstream as a json object, using attribute keys
+ * and conversion methods cached for the relation.
+ */
+static void
+json_write_tuple(StringInfo out, PGLogicalOutputData *data, JsonRelMeta *meta,
+				 Relation rel, HeapTuple tuple)
+{
+	TupleDesc	desc = RelationGetDescr(rel);
+	Datum		values[MaxTupleAttributeNumber];
+	bool		isnull[MaxTupleAttributeNumber];
+	char		numbuf[MAXINT8LEN + 1];
+	bool		first = true;
+	int			i;
+
+	heap_deform_tuple(tuple, desc, values, isnull);
+
+	appendStringInfoChar(out, '{');
+	for (i = 0; i < meta->natts; i++)
+	{
+		JsonAttMeta *am = &meta->atts[i];
+		Datum		val = values[i];
 
-	desc = RelationGetDescr(rel);
-	tupdatum = heap_copy_tuple_as_datum(tuple, desc);
-	json = DirectFunctionCall1(row_to_json, tupdatum);
+		if (am->kind == JSON_ATT_DROPPED ||
+			(data->att_list != NULL && !bms_is_member(i + 1, data->att_list)))
+			continue;
 
-	appendStringInfoString(out, TextDatumGetCString(json));
+		if (first)
+			first = false;
+		else
+			appendStringInfoChar(out, ',');
+		appendBinaryStringInfo(out, am->key, am->keylen);
+
+		if (isnull[i])
+		{
+			appendStringInfoString(out, "null");
+			continue;
+		}
+
+		switch (am->kind)
+		{
+			case JSON_ATT_INT2:
+				pg_ltoa(DatumGetInt16(val), numbuf);
+				appendStringInfoString(out, numbuf);
+				break;
+			case JSON_ATT_INT4:
+				pg_ltoa(DatumGetInt32(val), numbuf);
+				appendStringInfoString(out, numbuf);
+				break;
+			case JSON_ATT_INT8:
+				pg_lltoa(DatumGetInt64(val), numbuf);
+				appendStringInfoString(out, numbuf);
+				break;
+			case JSON_ATT_FLOAT4:
+				json_write_number(out, DatumGetCString(DirectFunctionCall1(float4out, val)));
+				break;
+			case JSON_ATT_FLOAT8:
+				json_write_number(out, DatumGetCString(DirectFunctionCall1(float8out, val)));
+				break;
+			case JSON_ATT_NUMERIC:
+				json_write_number(out, DatumGetCString(DirectFunctionCall1(numeric_out, val)));
+				break;
+			case JSON_ATT_BOOL:
+				appendStringInfoString(out, DatumGetBool(val) ? "true" : "false");
+				break;
+			case JSON_ATT_TEXT:
+				escape_json(out, TextDatumGetCString(val));
+				break;
+			case JSON_ATT_JSON:
+				{
+					text	   *json = DatumGetTextPP(val);
+
+					appendBinaryStringInfo(out, VARDATA_ANY(json), VARSIZE_ANY_EXHDR(json));
+					break;
+				}
+			case JSON_ATT_GENERIC:
+				{
+					text	   *json = DatumGetTextPP(FunctionCall1(&am->to_json, val));
+
+					appendBinaryStringInfo(out, VARDATA_ANY(json), VARSIZE_ANY_EXHDR(json));
+					break;
+				}
+			case JSON_ATT_DROPPED:
+				Assert(false);
+				break;
+		}
+	}
+	appendStringInfoChar(out, '}');
 }
 
 /*
@@ -148,24 +382,24 @@ json_write_tuple(StringInfo out, Relation rel, HeapTuple tuple)
  * Generic function handling DML changes.
  */
 static void
-pglogical_json_write_change(StringInfo out, const char *change, Relation rel,
+pglogical_json_write_change(StringInfo out, PGLogicalOutputData *data,
+							const char *change, Relation rel,
 							HeapTuple oldtuple, HeapTuple newtuple)
 {
-	appendStringInfoChar(out, '{');
-	appendStringInfo(out, "\"action\":\"%s\",\"relation\":[\"%s\",\"%s\"]",
-					 change,
-					 get_namespace_name(RelationGetNamespace(rel)),
-					 RelationGetRelationName(rel));
+	JsonRelMeta *meta = json_get_relmeta(rel);
+
+	appendStringInfo(out, "{\"action\":\"%s\"", change);
+	appendBinaryStringInfo(out, meta->relation, meta->relationlen);
 
 	if (oldtuple)
 	{
 		appendStringInfoString(out, ",\"oldtuple\":");
-		json_write_tuple(out, rel, oldtuple);
+		json_write_tuple(out, data, meta, rel, oldtuple);
 	}
 	if (newtuple)
 	{
 		appendStringInfoString(out, ",\"newtuple\":");
-		json_write_tuple(out, rel, newtuple);
+		json_write_tuple(out, data, meta, rel, newtuple);
 	}
 	appendStringInfoChar(out, '}');
 }
@@ -177,7 +411,7 @@ void
 pglogical_json_write_insert(StringInfo out, PGLogicalOutputData *data,
 							Relation rel, HeapTuple newtuple)
 {
-	pglogical_json_write_change(out, "I", rel, NULL, newtuple);
+	pglogical_json_write_change(out, data, "I", rel, NULL, newtuple);
 }
 
 /*
@@ -188,7 +422,7 @@ pglogical_json_write_update(StringInfo out, PGLogicalOutputData *data,
 							Relation rel, HeapTuple oldtuple,
 							HeapTuple newtuple)
 {
-	pglogical_json_write_change(out, "U", rel, oldtuple, newtuple);
+	pglogical_json_write_change(out, data, "U", rel, oldtuple, newtuple);
 }
 
 /*
@@ -198,7 +432,7 @@ void
 pglogical_json_write_delete(StringInfo out, PGLogicalOutputData *data,
 							Relation rel, HeapTuple oldtuple)
 {
-	pglogical_json_write_change(out, "D", rel, oldtuple, NULL);
+	pglogical_json_write_change(out, data, "D", rel, oldtuple, NULL);
 }
 
 /*
@@ -50,7 +50,8 @@
 
 #define IS_REPLICA_IDENTITY 1
 
-static void pglogical_write_attrs(StringInfo out, Relation rel);
+static void pglogical_write_attrs(StringInfo out, PGLogicalOutputData *data,
+								  Relation rel);
 static void pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 								   Relation rel, HeapTuple tuple);
 static char decide_datum_transfer(Form_pg_attribute att,
@@ -100,7 +101,7 @@ pglogical_write_rel(StringInfo out, PGLogicalOutputData *data, Relation rel,
 	pq_sendbytes(out, relname, relnamelen);
 
 	/* send the attribute info */
-	pglogical_write_attrs(out, rel);
+	pglogical_write_attrs(out, data, rel);
 
 	/*
 	 * Since we've sent the whole relation metadata not just the columns for
@@ -119,7 +120,7 @@ pglogical_write_rel(StringInfo out, PGLogicalOutputData *data, Relation rel,
  * Write relation attributes to the outputstream.
  */
 static void
-pglogical_write_attrs(StringInfo out, Relation rel)
+pglogical_write_attrs(StringInfo out, PGLogicalOutputData *data, Relation rel)
 {
 	TupleDesc	desc;
 	int			i;
@@ -133,7 +134,7 @@ pglogical_write_attrs(StringInfo out, Relation rel)
 	/* send number of live attributes */
 	for (i = 0; i < desc->natts; i++)
 	{
-		if (desc->attrs[i]->attisdropped)
+		if (!PGL_ATT_IS_SENT(data, desc->attrs[i]))
 			continue;
 		nliveatts++;
 	}
@@ -150,7 +151,7 @@ pglogical_write_attrs(StringInfo out, Relation rel)
 		uint16			len;
 		const char	   *attname;
 
-		if (att->attisdropped)
+		if (!PGL_ATT_IS_SENT(data, att))
 			continue;
 
 		if (bms_is_member(att->attnum - FirstLowInvalidHeapAttributeNumber,
@@ -374,7 +375,7 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 
 	for (i = 0; i < desc->natts; i++)
 	{
-		if (desc->attrs[i]->attisdropped)
+		if (!PGL_ATT_IS_SENT(data, desc->attrs[i]))
 			continue;
 		nliveatts++;
 	}
@@ -398,8 +399,8 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 		Form_pg_attribute att = desc->attrs[i];
 		char		transfer_type;
 
-		/* skip dropped columns */
-		if (att->attisdropped)
+		/* skip dropped and filtered out columns */
+		if (!PGL_ATT_IS_SENT(data, att))
 			continue;
 
 		if (isnull[i])
@@ -461,6 +462,21 @@ pglogical_write_tuple(StringInfo out, PGLogicalOutputData *data,
 
 					Assert(!VARATT_IS_EXTERNAL(data));
 
+					/*
+					 * Receivers of this protocol only know pglz compressed
+					 * datums, decompress the ones compressed with lz4.
+					 */
+					if (VARATT_IS_COMPRESSED(data) &&
+						VARCOMPRESSMETHOD_4B_C(data) != TOAST_PGLZ_COMPRESSION_ID)
+					{
+						struct varlena *plain = heap_tuple_untoast_attr((struct varlena *) data);
+
+						pq_sendint(out, VARSIZE(plain), 4); /* length */
+						appendBinaryStringInfo(out, (char *) plain, VARSIZE(plain));
+						pfree(plain);
+						break;
+					}
+
 					pq_sendint(out, VARSIZE_ANY(data), 4); /* length */
 
 					appendBinaryStringInfo(out, data, VARSIZE_ANY(data));
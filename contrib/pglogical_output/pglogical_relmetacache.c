@@ -21,6 +21,9 @@
 #include "utils/rel.h"
 
 static void relmeta_cache_callback(Datum arg, Oid relid);
+#if PG_VERSION_NUM >= 90500
+static void relmeta_cache_reset_callback(void *arg);
+#endif
 
 /*
  * We need a global that invalidation callbacks can access because they
@@ -32,6 +35,9 @@ static void relmeta_cache_callback(Datum arg, Oid relid);
  */
 static HTAB *RelMetaCache = NULL;
 
+/* Decoding context the api_private data of the entries is allocated in */
+static MemoryContext RelMetaCacheContext = NULL;
+
 /*
  * The callback persists across decoding sessions so we should only
  * register it once.
@@ -73,6 +79,26 @@ pglogical_init_relmetacache(MemoryContext decoding_context)
 
 	Assert(RelMetaCache != NULL);
 
+	RelMetaCacheContext = decoding_context;
+
+#if PG_VERSION_NUM >= 90500
+	/*
+	 * The shutdown callback isn't called if decoding errors out, but the
+	 * decoding context still goes away then, taking the hash table with
+	 * it. Forget about it when that happens, so neither the invalidation
+	 * callback nor the next decoding session in this backend will see a
+	 * dangling pointer.
+	 */
+	{
+		MemoryContextCallback *cb;
+
+		cb = MemoryContextAlloc(decoding_context, sizeof(MemoryContextCallback));
+		cb->func = relmeta_cache_reset_callback;
+		cb->arg = NULL;
+		MemoryContextRegisterResetCallback(decoding_context, cb);
+	}
+#endif
+
 	/*
 	 * Watch for invalidation events.
 	 *
@@ -106,6 +132,21 @@ relmeta_cache_callback(Datum arg, Oid relid)
 	if (RelMetaCache == NULL)
 		return;
 
+	/*
+	 * InvalidOid means that the whole relcache was reset, so we can't tell
+	 * which relations changed and have to forget all of them.
+	 */
+	if (relid == InvalidOid)
+	{
+		HASH_SEQ_STATUS status;
+		struct PGLRelMetaCacheEntry *hentry;
+
+		hash_seq_init(&status, RelMetaCache);
+		while ((hentry = (struct PGLRelMetaCacheEntry *) hash_seq_search(&status)) != NULL)
+			(void) hash_search(RelMetaCache, &hentry->relid, HASH_REMOVE, NULL);
+		return;
+	}
+
 	/*
 	 * Nobody keeps pointers to entries in this hash table around so
 	 * it's safe to directly HASH_REMOVE the entries as soon as they are
@@ -121,6 +162,18 @@ relmeta_cache_callback(Datum arg, Oid relid)
 	(void) hash_search(RelMetaCache, &relid, HASH_REMOVE, NULL);
  }
 
+#if PG_VERSION_NUM >= 90500
+/*
+ * The decoding context the cache lives in is being reset or deleted.
+ */
+static void
+relmeta_cache_reset_callback(void *arg)
+{
+	RelMetaCache = NULL;
+	RelMetaCacheContext = NULL;
+}
+#endif
+
 /*
  * Look up an entry, creating it not found.
  *
@@ -156,6 +209,7 @@ pglogical_cache_relmeta(struct PGLogicalOutputData *data,
 	{
 		Assert(hentry->relid = RelationGetRelid(rel));
 		hentry->is_cached = false;
+		hentry->att_list = NULL;
 		hentry->api_private = NULL;
 	}
 
@@ -165,6 +219,41 @@ pglogical_cache_relmeta(struct PGLogicalOutputData *data,
 	return hentry->is_cached;
 }
 
+/*
+ * Look up an entry for the output plugin's own use, creating it if not
+ * found, no matter whether the client caches relation metadata or not.
+ *
+ * Newly created entries have api_private=NULL. Data attached to api_private
+ * must be allocated in the context returned by pglogical_relmeta_context().
+ */
+struct PGLRelMetaCacheEntry *
+pglogical_get_relmeta(Relation rel)
+{
+	struct PGLRelMetaCacheEntry *hentry;
+	bool found;
+
+	Assert(RelMetaCache != NULL);
+
+	hentry = (struct PGLRelMetaCacheEntry*) hash_search(RelMetaCache,
+										 (void *)(&RelationGetRelid(rel)),
+										 HASH_ENTER, &found);
+
+	if (!found)
+	{
+		hentry->is_cached = false;
+		hentry->att_list = NULL;
+		hentry->api_private = NULL;
+	}
+
+	return hentry;
+}
+
+MemoryContext
+pglogical_relmeta_context(void)
+{
+	Assert(RelMetaCacheContext != NULL);
+	return RelMetaCacheContext;
+}
 
 /*
  * Tear down the relation metadata cache at the end of a decoding
@@ -182,5 +271,6 @@ pglogical_destroy_relmetacache(void)
 	{
 		hash_destroy(RelMetaCache);
 		RelMetaCache = NULL;
+		RelMetaCacheContext = NULL;
 	}
 }
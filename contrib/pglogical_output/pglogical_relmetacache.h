@@ -8,6 +8,8 @@ struct PGLRelMetaCacheEntry
 	Oid relid;
 	/* Does the client have this relation cached? */
 	bool is_cached;
+	/* Columns the cached metadata was sent for, NULL for all */
+	Bitmapset *att_list;
 	/* Field for API plugin use, must be alloc'd in decoding context */
 	void *api_private;
 };
@@ -16,6 +18,8 @@ struct PGLogicalOutputData;
 
 extern void pglogical_init_relmetacache(MemoryContext decoding_context);
 extern bool pglogical_cache_relmeta(struct PGLogicalOutputData *data, Relation rel, struct PGLRelMetaCacheEntry **entry);
+extern struct PGLRelMetaCacheEntry *pglogical_get_relmeta(Relation rel);
+extern MemoryContext pglogical_relmeta_context(void);
 extern void pglogical_destroy_relmetacache(void);
 
 #endif /* PGLOGICAL_RELMETA_CACHE_H */
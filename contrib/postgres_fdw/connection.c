@@ -12,6 +12,8 @@
  */
 #include "postgres.h"
 
+#include <poll.h>
+
 #include "postgres_fdw.h"
 
 #include "access/xact.h"
@@ -50,6 +52,13 @@ typedef struct ConnCacheEntry
 								 * one level of subxact open, etc */
 	bool		have_prep_stmt; /* have we prepared any stmts in this xact? */
 	bool		have_error;		/* have any subxacts aborted in this xact? */
+	bool		commit_pending; /* result of asynchronous dtm_commit is not
+								 * received yet */
+	ForeignScanState *pending_scan;	/* scan whose FETCH is in flight, or
+									 * NULL */
+	bool		modified;		/* has the remote xact modified anything? */
+	bool		commit_sent;	/* one-phase COMMIT of a read-only remote
+								 * xact is sent, result not received yet */
 } ConnCacheEntry;
 
 /*
@@ -76,6 +85,10 @@ static void do_sql_command(PGconn *conn, const char *sql);
 static void do_sql_send_command(PGconn *conn, const char *sql);
 static void do_sql_wait_command(PGconn *conn, const char *sql);
 static void begin_remote_xact(ConnCacheEntry *entry);
+static void finish_pending_commit(ConnCacheEntry *entry);
+static ConnCacheEntry *find_conn_entry(PGconn *conn);
+static void finish_pending_scan(ConnCacheEntry *entry);
+static void send_read_only_commits(void);
 static void pgfdw_xact_callback(XactEvent event, void *arg);
 static void pgfdw_subxact_callback(SubXactEvent event,
 					   SubTransactionId mySubid,
@@ -146,6 +159,10 @@ GetConnection(UserMapping *user, bool will_prep_stmt)
 		entry->xact_depth = 0;
 		entry->have_prep_stmt = false;
 		entry->have_error = false;
+		entry->commit_pending = false;
+		entry->pending_scan = NULL;
+		entry->modified = false;
+		entry->commit_sent = false;
 	}
 
 	/*
@@ -166,12 +183,23 @@ GetConnection(UserMapping *user, bool will_prep_stmt)
 		entry->xact_depth = 0;	/* just to be sure */
 		entry->have_prep_stmt = false;
 		entry->have_error = false;
+		entry->commit_pending = false;
+		entry->pending_scan = NULL;
+		entry->modified = false;
+		entry->commit_sent = false;
 		entry->conn = connect_pg_server(server, user);
 
 		elog(DEBUG3, "new postgres_fdw connection %p for server \"%s\" (user mapping oid %u, userid %u)",
 			 entry->conn, server->servername, user->umid, user->userid);
 	}
 
+	/*
+	 * Collect result of previous asynchronous commit before sending new
+	 * commands.
+	 */
+	if (entry->commit_pending)
+		finish_pending_commit(entry);
+
 	/*
 	 * Start a new transaction or subtransaction if needed.
 	 */
@@ -392,6 +420,115 @@ do_sql_wait_command(PGconn *conn, const char *sql)
 	}
 }
 
+/*
+ * Receive result of dtm_commit sent asynchronously at the end of previous
+ * transaction. Transaction is already committed locally and its outcome was
+ * decided, so failures can be only reported.
+ */
+static void
+finish_pending_commit(ConnCacheEntry *entry)
+{
+	PGresult   *res;
+
+	entry->commit_pending = false;
+	while ((res = PQgetResult(entry->conn)) != NULL)
+	{
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			pgfdw_report_error(WARNING, res, entry->conn, true, "SELECT public.dtm_commit");
+		else
+			PQclear(res);
+	}
+}
+
+/*
+ * Find the connection cache entry of the given connection.
+ */
+static ConnCacheEntry *
+find_conn_entry(PGconn *conn)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	if (ConnectionHash == NULL)
+		return NULL;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->conn == conn)
+		{
+			hash_seq_term(&scan);
+			return entry;
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Receive the results of a FETCH sent asynchronously on the entry's
+ * connection, if any, so that the connection can be used for other commands.
+ * The rows are kept by the scan which sent the FETCH.
+ */
+static void
+finish_pending_scan(ConnCacheEntry *entry)
+{
+	if (entry->pending_scan != NULL)
+		complete_pending_fetch(entry->pending_scan);
+	Assert(entry->pending_scan == NULL);
+}
+
+/*
+ * Remember that the given scan has sent a FETCH on the connection and not
+ * yet received its results, or forget about it if node is NULL.
+ */
+void
+SetPendingScan(PGconn *conn, ForeignScanState *node)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	Assert(entry != NULL);
+	Assert(node == NULL || entry->pending_scan == NULL);
+	entry->pending_scan = node;
+}
+
+/*
+ * Return the scan with a FETCH in flight on the connection, or NULL.
+ */
+ForeignScanState *
+GetPendingScan(PGconn *conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	return entry ? entry->pending_scan : NULL;
+}
+
+/*
+ * Note that the remote transaction on the connection has modified data, so
+ * that it takes part in two-phase commit of a distributed transaction.
+ */
+void
+MarkConnectionModified(PGconn *conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	Assert(entry != NULL);
+	entry->modified = true;
+}
+
+/*
+ * Make the connection ready for a new command by receiving the results of a
+ * FETCH still in flight on it, if any.
+ */
+void
+pgfdw_finish_pending_scan(PGconn *conn)
+{
+	ConnCacheEntry *entry = find_conn_entry(conn);
+
+	if (entry != NULL)
+		finish_pending_scan(entry);
+}
+
 /*
  * Start remote transaction or subtransaction, if needed.
  *
@@ -413,6 +550,8 @@ begin_remote_xact(ConnCacheEntry *entry)
 		TransactionId gxid = GetTransactionManager()->GetGlobalTransactionId();
 		const char *sql;
 
+		finish_pending_scan(entry);
+
 		elog(DEBUG3, "starting remote transaction on connection %p",
 			 entry->conn);
 
@@ -430,16 +569,29 @@ begin_remote_xact(ConnCacheEntry *entry)
 			sql = "START TRANSACTION ISOLATION LEVEL SERIALIZABLE";
 		else
 			sql = "START TRANSACTION ISOLATION LEVEL REPEATABLE READ";
-		do_sql_command(entry->conn, sql);
-		entry->xact_depth = 1;
-		if (UseTsDtmTransactions)
+
+		if (!UseTsDtmTransactions)
+		{
+			do_sql_command(entry->conn, sql);
+			entry->xact_depth = 1;
+		}
+		else
 		{
+			/*
+			 * Pack dtm_extend/dtm_access together with START TRANSACTION, so
+			 * that joining global transaction costs only one round-trip.
+			 * PQexec returns result of the last command, or the first error.
+			 */
+			entry->xact_depth = 1;
 			if (!currentGlobalTransactionId)
 			{
-				PGresult   *res = PQexec(entry->conn, psprintf("SELECT public.dtm_extend('%d.%d')",
-									MyProcPid, ++currentLocalTransactionId));
+				PGresult   *res;
 				char	   *resp;
 
+				sql = psprintf("%s; SELECT public.dtm_extend('%d.%d')",
+							   sql, MyProcPid, ++currentLocalTransactionId);
+				res = PQexec(entry->conn, sql);
+
 				if (PQresultStatus(res) != PGRES_TUPLES_OK)
 				{
 					pgfdw_report_error(ERROR, res, entry->conn, true, sql);
@@ -453,8 +605,11 @@ begin_remote_xact(ConnCacheEntry *entry)
 			}
 			else
 			{
-				PGresult   *res = PQexec(entry->conn, psprintf("SELECT public.dtm_access(%llu, '%d.%d')", currentGlobalTransactionId, MyProcPid, currentLocalTransactionId));
+				PGresult   *res;
 
+				sql = psprintf("%s; SELECT public.dtm_access(%llu, '%d.%d')",
+							   sql, currentGlobalTransactionId, MyProcPid, currentLocalTransactionId);
+				res = PQexec(entry->conn, sql);
 				if (PQresultStatus(res) != PGRES_TUPLES_OK)
 				{
 					pgfdw_report_error(ERROR, res, entry->conn, true, sql);
@@ -473,6 +628,7 @@ begin_remote_xact(ConnCacheEntry *entry)
 	{
 		char		sql[64];
 
+		finish_pending_scan(entry);
 		snprintf(sql, sizeof(sql), "SAVEPOINT s%d", entry->xact_depth + 1);
 		do_sql_command(entry->conn, sql);
 		entry->xact_depth++;
@@ -533,6 +689,9 @@ GetPrepStmtNumber(PGconn *conn)
 PGresult *
 pgfdw_exec_query(PGconn *conn, const char *query)
 {
+	/* Collect the results of a FETCH sent asynchronously, if any */
+	pgfdw_finish_pending_scan(conn);
+
 	/*
 	 * Submit a query.  Since we don't use non-blocking mode, this also can
 	 * block.  But its risk is relatively small, so we ignore that for now.
@@ -661,42 +820,183 @@ pgfdw_report_error(int elevel, PGresult *res, PGconn *conn,
 
 typedef bool (*DtmCommandResultHandler) (PGresult *result, void *arg);
 
+/* State of one connection in RunDtmStatement */
+typedef struct DtmParticipant
+{
+	ConnCacheEntry *entry;
+	const char *sql;			/* command whose results we wait for */
+	unsigned	expectedStatus; /* expected status of its last result */
+	PGresult   *last;			/* latest result received, or NULL */
+	bool		done;			/* have we received all results? */
+} DtmParticipant;
+
+/*
+ * Check a result received by RunDtmStatement.  Results other than the last
+ * one should be PGRES_COMMAND_OK; the last one is checked by the caller.
+ */
+static bool
+check_dtm_result(DtmParticipant *part, PGresult *result, unsigned expectedStatus)
+{
+	if (PQresultStatus(result) == expectedStatus)
+		return true;
+
+	elog(WARNING, "Failed command %s: status=%d, expected status=%d",
+		 part->sql, PQresultStatus(result), expectedStatus);
+	pgfdw_report_error(WARNING, result, part->entry->conn, false, part->sql);
+	return false;
+}
+
+/*
+ * Send statement to all participants of distributed transaction which
+ * modified anything and wait for responses.  Statement can contain several
+ * commands: all results except the last one should be PGRES_COMMAND_OK,
+ * status of last one should be equal to expectedStatus and it is passed to
+ * handler.
+ *
+ * The statement is sent to all participants before waiting for any of them,
+ * and results are gathered from whichever connection has them ready, so
+ * that the wait takes as long as the slowest participant rather than the
+ * sum of all of them.  Results of one-phase commits sent by
+ * send_read_only_commits are gathered in the same loop.  Failures are
+ * reported as warnings, so that the caller can clean up other participants.
+ */
 static bool
 RunDtmStatement(char const * sql, unsigned expectedStatus, DtmCommandResultHandler handler, void *arg)
 {
 	HASH_SEQ_STATUS scan;
 	ConnCacheEntry *entry;
+	DtmParticipant *parts;
+	struct pollfd *fds;
+	int			nparts = 0;
+	int			i;
 	bool		allOk = true;
 
+	parts = (DtmParticipant *)
+		palloc0(hash_get_num_entries(ConnectionHash) * sizeof(DtmParticipant));
+	fds = (struct pollfd *)
+		palloc0(hash_get_num_entries(ConnectionHash) * sizeof(struct pollfd));
+
 	hash_seq_init(&scan, ConnectionHash);
 	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
 	{
-		if (entry->xact_depth > 0)
+		if (entry->commit_sent)
+		{
+			parts[nparts].sql = "COMMIT TRANSACTION";
+			parts[nparts].expectedStatus = PGRES_COMMAND_OK;
+		}
+		else if (entry->xact_depth > 0 && entry->modified)
 		{
+			finish_pending_scan(entry);
 			do_sql_send_command(entry->conn, sql);
+			parts[nparts].sql = sql;
+			parts[nparts].expectedStatus = expectedStatus;
 		}
+		else
+			continue;
+		parts[nparts].entry = entry;
+		nparts++;
 	}
 
-	hash_seq_init(&scan, ConnectionHash);
-	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	for (;;)
 	{
-		if (entry->xact_depth > 0)
+		int			nfds = 0;
+
+		for (i = 0; i < nparts; i++)
 		{
-			PGresult   *result = PQgetResult(entry->conn);
+			DtmParticipant *part = &parts[i];
+			PGconn	   *conn = part->entry->conn;
 
-			if (PQresultStatus(result) != expectedStatus || (handler && !handler(result, arg)))
+			if (part->done)
+				continue;
+
+			/* Consume every result that is complete */
+			while (!PQisBusy(conn))
+			{
+				PGresult   *result = PQgetResult(conn);
+
+				if (result == NULL)
+				{
+					part->done = true;
+					break;
+				}
+				if (part->last != NULL)
+				{
+					if (!check_dtm_result(part, part->last, PGRES_COMMAND_OK))
+						allOk = false;
+					PQclear(part->last);
+				}
+				part->last = result;
+			}
+
+			if (part->done)
 			{
-				elog(WARNING, "Failed command %s: status=%d, expected status=%d", sql, PQresultStatus(result), expectedStatus);
-				pgfdw_report_error(ERROR, result, entry->conn, true, sql);
-				allOk = false;
+				PGresult   *last = part->last;
+
+				part->entry->commit_sent = false;
+				if (last == NULL)
+					continue;
+				if (!check_dtm_result(part, last, part->expectedStatus))
+					allOk = false;
+				else if (part->sql == sql && handler && !handler(last, arg))
+				{
+					elog(WARNING, "Failed command %s: unexpected result", sql);
+					allOk = false;
+				}
+				PQclear(last);
+				part->last = NULL;
+				continue;
 			}
-			PQclear(result);
-			PQgetResult(entry->conn);	/* consume NULL result */
+
+			fds[nfds].fd = PQsocket(conn);
+			fds[nfds].events = POLLIN;
+			fds[nfds].revents = 0;
+			nfds++;
+		}
+
+		if (nfds == 0)
+			break;
+
+		if (poll(fds, nfds, -1) < 0 && errno != EINTR)
+			ereport(ERROR,
+					(errcode_for_socket_access(),
+					 errmsg("could not wait for remote servers: %m")));
+
+		/* Read whatever arrived; a broken connection yields an error result */
+		for (i = 0; i < nparts; i++)
+		{
+			if (!parts[i].done)
+				(void) PQconsumeInput(parts[i].entry->conn);
 		}
 	}
+
+	pfree(parts);
+	pfree(fds);
 	return allOk;
 }
 
+/*
+ * Send one-phase COMMIT to participants of distributed transaction which did
+ * not modify anything: they need neither PREPARE nor a commit timestamp.  The
+ * results are gathered by the next RunDtmStatement.
+ */
+static void
+send_read_only_commits(void)
+{
+	HASH_SEQ_STATUS scan;
+	ConnCacheEntry *entry;
+
+	hash_seq_init(&scan, ConnectionHash);
+	while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+	{
+		if (entry->xact_depth > 0 && !entry->modified)
+		{
+			finish_pending_scan(entry);
+			do_sql_send_command(entry->conn, "COMMIT TRANSACTION");
+			entry->commit_sent = true;
+		}
+	}
+}
+
 static bool
 RunDtmCommand(char const * sql)
 {
@@ -766,17 +1066,70 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 			case XACT_EVENT_PRE_COMMIT:
 				{
 					csn_t		maxCSN = 0;
+					bool		modified = false;
+
+					/*
+					 * Shards which were only read from just commit, along
+					 * with the first round below.  If no shard was modified,
+					 * that is all there is to do.
+					 */
+					send_read_only_commits();
 
-					if (!RunDtmCommand(psprintf("PREPARE TRANSACTION '%d.%d'",
-									MyProcPid, currentLocalTransactionId)) ||
-						!RunDtmFunction(psprintf("SELECT public.dtm_begin_prepare('%d.%d')",
-									MyProcPid, currentLocalTransactionId)) ||
-						!RunDtmStatement(psprintf("SELECT public.dtm_prepare('%d.%d',0)",
-												  MyProcPid, currentLocalTransactionId), PGRES_TUPLES_OK, DtmMaxCSN, &maxCSN) ||
-						!RunDtmFunction(psprintf("SELECT public.dtm_end_prepare('%d.%d',%lld)",
-							MyProcPid, currentLocalTransactionId, maxCSN)) ||
-						!RunDtmCommand(psprintf("COMMIT PREPARED '%d.%d'",
-									  MyProcPid, currentLocalTransactionId)))
+					hash_seq_init(&scan, ConnectionHash);
+					while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+						modified |= (entry->xact_depth > 0 && entry->modified);
+
+					if (!modified)
+					{
+						if (!RunDtmCommand("COMMIT TRANSACTION"))
+							ereport(ERROR,
+									(errcode(ERRCODE_TRANSACTION_ROLLBACK),
+									 errmsg("transaction was aborted at one of the shards")));
+						return;
+					}
+
+					/*
+					 * Prepare and commit are pipelined to the modified shards
+					 * in two rounds: first one prepares transaction and
+					 * collects local CSNs, second one assigns maximal CSN and
+					 * commits.
+					 */
+					if (!RunDtmStatement(psprintf("PREPARE TRANSACTION '%d.%d'; SELECT public.dtm_prepare_all('%d.%d',0)",
+												  MyProcPid, currentLocalTransactionId,
+												  MyProcPid, currentLocalTransactionId), PGRES_TUPLES_OK, DtmMaxCSN, &maxCSN))
+					{
+						RunDtmCommand(psprintf("ROLLBACK PREPARED '%d.%d'",
+									  MyProcPid, currentLocalTransactionId));
+						ereport(ERROR,
+								(errcode(ERRCODE_TRANSACTION_ROLLBACK),
+								 errmsg("transaction was aborted at one of the shards")));
+						break;
+					}
+					if (AsyncTsDtmCommit)
+					{
+						/*
+						 * All shards are prepared, so outcome of transaction
+						 * is decided.  Do not wait for completion of commit:
+						 * results are collected at next use of connection.
+						 * Until commit is completed, shard readers wait for
+						 * in-doubt transaction.
+						 */
+						char	   *sql = psprintf("SELECT public.dtm_commit('%d.%d',%lld)",
+										   MyProcPid, currentLocalTransactionId, maxCSN);
+
+						hash_seq_init(&scan, ConnectionHash);
+						while ((entry = (ConnCacheEntry *) hash_seq_search(&scan)))
+						{
+							if (entry->xact_depth > 0 && entry->modified)
+							{
+								do_sql_send_command(entry->conn, sql);
+								entry->commit_pending = true;
+							}
+						}
+						return;
+					}
+					if (!RunDtmFunction(psprintf("SELECT public.dtm_commit('%d.%d',%lld)",
+							MyProcPid, currentLocalTransactionId, maxCSN)))
 					{
 						RunDtmCommand(psprintf("ROLLBACK PREPARED '%d.%d'",
 									  MyProcPid, currentLocalTransactionId));
@@ -816,6 +1169,7 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 				case XACT_EVENT_PARALLEL_PRE_COMMIT:
 				case XACT_EVENT_PRE_COMMIT:
 					/* Commit all remote transactions during pre-commit */
+					finish_pending_scan(entry);
 					do_sql_send_command(entry->conn, "COMMIT TRANSACTION");
 					continue;
 
@@ -872,6 +1226,9 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 					/* Assume we might have lost track of prepared statements */
 					entry->have_error = true;
 
+					/* The scan state is gone; its results are discarded */
+					entry->pending_scan = NULL;
+
 					/*
 					 * If a command has been submitted to the remote server by
 					 * using an asynchronous execution function, the command
@@ -927,13 +1284,15 @@ pgfdw_xact_callback(XactEvent event, void *arg)
 
 		/* Reset state to show we're out of a transaction */
 		entry->xact_depth = 0;
+		entry->modified = false;
+		entry->commit_sent = false;
 
 		/*
 		 * If the connection isn't in a good idle state, discard it to
 		 * recover. Next GetConnection will open a new connection.
 		 */
 		if (PQstatus(entry->conn) != CONNECTION_OK ||
-			PQtransactionStatus(entry->conn) != PQTRANS_IDLE)
+			(PQtransactionStatus(entry->conn) != PQTRANS_IDLE && !entry->commit_pending))
 		{
 			elog(WARNING, "discarding connection %p, conn status=%d, trans status=%d", entry->conn, PQstatus(entry->conn), PQtransactionStatus(entry->conn));
 			PQfinish(entry->conn);
@@ -1002,6 +1361,7 @@ pgfdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
 		if (event == SUBXACT_EVENT_PRE_COMMIT_SUB)
 		{
 			/* Commit all remote subtransactions during pre-commit */
+			finish_pending_scan(entry);
 			snprintf(sql, sizeof(sql), "RELEASE SAVEPOINT s%d", curlevel);
 			do_sql_command(entry->conn, sql);
 		}
@@ -1010,6 +1370,9 @@ pgfdw_subxact_callback(SubXactEvent event, SubTransactionId mySubid,
 			/* Assume we might have lost track of prepared statements */
 			entry->have_error = true;
 
+			/* A FETCH in flight is cancelled and its results discarded */
+			entry->pending_scan = NULL;
+
 			/*
 			 * If a command has been submitted to the remote server by using
 			 * an asynchronous execution function, the command might not have
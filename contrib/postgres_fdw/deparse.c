@@ -1275,6 +1275,49 @@ deparseInsertSql(StringInfo buf, PlannerInfo *root,
 						 returningList, retrieved_attrs);
 }
 
+/*
+ * deparse remote INSERT statement inserting several rows at once
+ *
+ * insertSql is a statement built by deparseInsertSql with a non-empty
+ * column list and neither ON CONFLICT nor RETURNING clause, so that its
+ * VALUES list comes last.  We append to buf the same statement with
+ * numRows parameter lists, each of numCols parameters.
+ */
+void
+deparseBatchInsertSql(StringInfo buf, const char *insertSql,
+					  int numCols, int numRows)
+{
+	const char *values = NULL;
+	const char *p;
+	int			pindex = 1;
+	int			row;
+	int			col;
+
+	/* The last " VALUES (" is ours; quoted column names precede it. */
+	for (p = strstr(insertSql, " VALUES ("); p; p = strstr(p + 1, " VALUES ("))
+		values = p;
+	if (values == NULL)
+		elog(ERROR, "could not find VALUES clause in \"%s\"", insertSql);
+
+	appendBinaryStringInfo(buf, insertSql, values - insertSql);
+	appendStringInfoString(buf, " VALUES ");
+
+	for (row = 0; row < numRows; row++)
+	{
+		if (row > 0)
+			appendStringInfoString(buf, ", ");
+		appendStringInfoChar(buf, '(');
+		for (col = 0; col < numCols; col++)
+		{
+			if (col > 0)
+				appendStringInfoString(buf, ", ");
+			appendStringInfo(buf, "$%d", pindex);
+			pindex++;
+		}
+		appendStringInfoChar(buf, ')');
+	}
+}
+
 /*
  * deparse remote UPDATE statement
  *
@@ -28,6 +28,7 @@
 #include "optimizer/pathnode.h"
 #include "optimizer/paths.h"
 #include "optimizer/planmain.h"
+#include "optimizer/prep.h"
 #include "optimizer/restrictinfo.h"
 #include "optimizer/var.h"
 #include "optimizer/tlist.h"
@@ -50,6 +51,9 @@ PG_MODULE_MAGIC;
 /* If no remote estimates, assume a sort costs 20% extra */
 #define DEFAULT_FDW_SORT_MULTIPLIER 1.2
 
+/* The protocol allows at most 65535 parameters in a batched INSERT */
+#define MAX_BATCH_PARAMS			65535
+
 /*
  * Indexes of FDW-private information stored in fdw_private lists.
  *
@@ -150,11 +154,24 @@ typedef struct PgFdwScanState
 	int			fetch_ct_2;		/* Min(# of fetches done, 2) */
 	bool		eof_reached;	/* true if last fetch reached EOF */
 
+	/* for fetching the next batch asynchronously */
+	bool		fetch_in_flight;	/* FETCH sent, results not received yet */
+	bool		prefetched;		/* next batch is in prefetch_tuples */
+	HeapTuple  *prefetch_tuples;	/* array of tuples of the next batch */
+	int			num_prefetched; /* # of tuples in array */
+	bool		prefetch_eof;	/* true if the next batch reached EOF */
+
 	/* working memory contexts */
 	MemoryContext batch_cxt;	/* context holding current batch of tuples */
+	MemoryContext prefetch_cxt; /* context holding the next batch */
 	MemoryContext temp_cxt;		/* context for per-tuple temporary data */
 
 	int			fetch_size;		/* number of tuples per fetch */
+
+	/* for receiving the rows in binary format; see check_binary_fetch */
+	bool		binary_fetch;	/* is the cursor declared BINARY? */
+	FmgrInfo   *recv_flinfo;	/* receive functions of the columns */
+	Oid		   *recv_ioparams;	/* their typioparams */
 } PgFdwScanState;
 
 /*
@@ -180,6 +197,13 @@ typedef struct PgFdwModifyState
 	int			p_nums;			/* number of parameters to transmit */
 	FmgrInfo   *p_flinfo;		/* output conversion functions for them */
 
+	/* for batched INSERT; batch_size is 1 if rows are sent one at a time */
+	int			batch_size;		/* max number of rows per remote INSERT */
+	int			num_batched;	/* number of rows currently buffered */
+	const char **batch_values;	/* parameter values of buffered rows */
+	char	   *batch_p_name;	/* name of full-batch prepared statement */
+	MemoryContext batch_cxt;	/* context holding buffered values */
+
 	/* working memory context */
 	MemoryContext temp_cxt;		/* context for per-tuple temporary data */
 } PgFdwModifyState;
@@ -263,6 +287,12 @@ typedef struct
 } ec_member_foreign_arg;
 
 bool		UseTsDtmTransactions;
+bool		AsyncTsDtmCommit;
+bool		AsyncFetch = true;
+int			FetchMemory = 1024;
+bool		ColocatedJoins = false;
+
+static set_join_pathlist_hook_type prev_set_join_pathlist_hook = NULL;
 void		_PG_init(void);
 
 /*
@@ -347,6 +377,21 @@ static void postgresGetForeignJoinPaths(PlannerInfo *root,
 							JoinPathExtraData *extra);
 static bool postgresRecheckForeignScan(ForeignScanState *node,
 						   TupleTableSlot *slot);
+static void colocated_join_pathlist(PlannerInfo *root,
+						RelOptInfo *joinrel,
+						RelOptInfo *outerrel,
+						RelOptInfo *innerrel,
+						JoinType jointype,
+						JoinPathExtraData *extra);
+static bool get_foreign_children(PlannerInfo *root, RelOptInfo *rel,
+					 List **children);
+static Path *colocated_child_join_path(PlannerInfo *root,
+						  RelOptInfo *joinrel,
+						  RelOptInfo *outer_child,
+						  RelOptInfo *inner_child,
+						  AppendRelInfo *outer_appinfo,
+						  AppendRelInfo *inner_appinfo,
+						  JoinPathExtraData *extra);
 
 /*
  * Helper functions
@@ -368,8 +413,14 @@ static bool ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
 						  void *arg);
 static void create_cursor(ForeignScanState *node);
 static void fetch_more_data(ForeignScanState *node);
+static void check_binary_fetch(ForeignScanState *node, ForeignTable *table);
+static void adapt_fetch_size(PgFdwScanState *fsstate, PGresult *res,
+				 bool waited);
+static void send_fetch_request(ForeignScanState *node, bool declare);
 static void close_cursor(PGconn *conn, unsigned int cursor_number);
 static void prepare_foreign_modify(PgFdwModifyState *fmstate);
+static char *prepare_remote_statement(PGconn *conn, const char *query);
+static void flush_batched_inserts(PgFdwModifyState *fmstate);
 static const char **convert_prep_stmt_params(PgFdwModifyState *fmstate,
 						 ItemPointer tupleid,
 						 TupleTableSlot *slot);
@@ -1320,6 +1371,9 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 	fsstate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
 											   "postgres_fdw tuple data",
 											   ALLOCSET_DEFAULT_SIZES);
+	fsstate->prefetch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+												  "postgres_fdw prefetched data",
+												  ALLOCSET_DEFAULT_SIZES);
 	fsstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
 											  "postgres_fdw temporary data",
 											  ALLOCSET_SMALL_SIZES);
@@ -1341,6 +1395,9 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 
 	fsstate->attinmeta = TupleDescGetAttInMetadata(fsstate->tupdesc);
 
+	/* Decide whether to receive the rows in binary format. */
+	check_binary_fetch(node, table);
+
 	/*
 	 * Prepare for processing of parameters used in remote query, if any.
 	 */
@@ -1353,6 +1410,15 @@ postgresBeginForeignScan(ForeignScanState *node, int eflags)
 							 &fsstate->param_flinfo,
 							 &fsstate->param_exprs,
 							 &fsstate->param_values);
+
+	/*
+	 * If the query needs no parameter values, declare the cursor and send the
+	 * first FETCH right away, without waiting for the results.  This way the
+	 * children of an Append over foreign tables on different servers run
+	 * their queries concurrently rather than one after another.
+	 */
+	if (AsyncFetch && numParams == 0 && GetPendingScan(fsstate->conn) == NULL)
+		send_fetch_request(node, true);
 }
 
 /*
@@ -1445,12 +1511,16 @@ postgresReScanForeignScan(ForeignScanState *node)
 		pgfdw_report_error(ERROR, res, fsstate->conn, true, sql);
 	PQclear(res);
 
-	/* Now force a fresh FETCH. */
+	/* Now force a fresh FETCH, discarding any batch fetched ahead. */
 	fsstate->tuples = NULL;
 	fsstate->num_tuples = 0;
 	fsstate->next_tuple = 0;
 	fsstate->fetch_ct_2 = 0;
 	fsstate->eof_reached = false;
+	fsstate->prefetch_tuples = NULL;
+	fsstate->num_prefetched = 0;
+	fsstate->prefetched = false;
+	MemoryContextReset(fsstate->prefetch_cxt);
 }
 
 /*
@@ -1681,6 +1751,7 @@ postgresBeginForeignModify(ModifyTableState *mtstate,
 	/* Open connection; report that we'll create a prepared statement. */
 	fmstate->conn = GetConnection(user, true);
 	fmstate->p_name = NULL;		/* prepared statement not made yet */
+	MarkConnectionModified(fmstate->conn);
 
 	/* Deconstruct fdw_private data. */
 	fmstate->query = strVal(list_nth(fdw_private,
@@ -1740,6 +1811,59 @@ postgresBeginForeignModify(ModifyTableState *mtstate,
 
 	Assert(fmstate->p_nums <= n_params);
 
+	/*
+	 * Decide whether INSERTs can be buffered and sent several rows at a time.
+	 * That is only possible when the executor needs nothing back from the
+	 * remote server per row: no RETURNING (which also covers local AFTER ROW
+	 * triggers), no ON CONFLICT, and no local triggers that might look at
+	 * the remote table before we flush.  The table option overrides the
+	 * server option.
+	 */
+	fmstate->batch_size = 1;
+	if (operation == CMD_INSERT &&
+		!fmstate->has_returning &&
+		fmstate->target_attrs != NIL &&
+		rel->trigdesc == NULL &&
+		((ModifyTable *) mtstate->ps.plan)->onConflictAction == ONCONFLICT_NONE)
+	{
+		ForeignServer *server = GetForeignServer(table->serverid);
+
+		foreach(lc, server->options)
+		{
+			DefElem    *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, "batch_size") == 0)
+			{
+				fmstate->batch_size = strtol(defGetString(def), NULL, 10);
+				break;
+			}
+		}
+		foreach(lc, table->options)
+		{
+			DefElem    *def = (DefElem *) lfirst(lc);
+
+			if (strcmp(def->defname, "batch_size") == 0)
+			{
+				fmstate->batch_size = strtol(defGetString(def), NULL, 10);
+				break;
+			}
+		}
+
+		fmstate->batch_size = Min(fmstate->batch_size,
+								  MAX_BATCH_PARAMS / fmstate->p_nums);
+	}
+
+	if (fmstate->batch_size > 1)
+	{
+		fmstate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+												"postgres_fdw batched rows",
+												   ALLOCSET_DEFAULT_SIZES);
+		fmstate->batch_values = (const char **)
+			MemoryContextAllocZero(estate->es_query_cxt,
+								   sizeof(char *) * fmstate->p_nums *
+								   fmstate->batch_size);
+	}
+
 	resultRelInfo->ri_FdwState = fmstate;
 }
 
@@ -1758,6 +1882,34 @@ postgresExecForeignInsert(EState *estate,
 	PGresult   *res;
 	int			n_rows;
 
+	/*
+	 * In batch mode, just remember the row's parameters and report it as
+	 * inserted; the remote INSERT happens once the batch fills up or the
+	 * modify ends.
+	 */
+	if (fmstate->batch_size > 1)
+	{
+		const char **batch_values;
+		MemoryContext oldcontext;
+		int			i;
+
+		p_values = convert_prep_stmt_params(fmstate, NULL, slot);
+
+		batch_values = fmstate->batch_values +
+			fmstate->num_batched * fmstate->p_nums;
+		oldcontext = MemoryContextSwitchTo(fmstate->batch_cxt);
+		for (i = 0; i < fmstate->p_nums; i++)
+			batch_values[i] = p_values[i] ? pstrdup(p_values[i]) : NULL;
+		MemoryContextSwitchTo(oldcontext);
+
+		MemoryContextReset(fmstate->temp_cxt);
+
+		if (++fmstate->num_batched == fmstate->batch_size)
+			flush_batched_inserts(fmstate);
+
+		return slot;
+	}
+
 	/* Set up the prepared statement on the remote server, if we didn't yet */
 	if (!fmstate->p_name)
 		prepare_foreign_modify(fmstate);
@@ -1768,6 +1920,7 @@ postgresExecForeignInsert(EState *estate,
 	/*
 	 * Execute the prepared statement.
 	 */
+	pgfdw_finish_pending_scan(fmstate->conn);
 	if (!PQsendQueryPrepared(fmstate->conn,
 							 fmstate->p_name,
 							 fmstate->p_nums,
@@ -1844,6 +1997,7 @@ postgresExecForeignUpdate(EState *estate,
 	/*
 	 * Execute the prepared statement.
 	 */
+	pgfdw_finish_pending_scan(fmstate->conn);
 	if (!PQsendQueryPrepared(fmstate->conn,
 							 fmstate->p_name,
 							 fmstate->p_nums,
@@ -1920,6 +2074,7 @@ postgresExecForeignDelete(EState *estate,
 	/*
 	 * Execute the prepared statement.
 	 */
+	pgfdw_finish_pending_scan(fmstate->conn);
 	if (!PQsendQueryPrepared(fmstate->conn,
 							 fmstate->p_name,
 							 fmstate->p_nums,
@@ -1973,7 +2128,11 @@ postgresEndForeignModify(EState *estate,
 	if (fmstate == NULL)
 		return;
 
-	/* If we created a prepared statement, destroy it */
+	/* Send any rows still buffered for a batched INSERT */
+	if (fmstate->num_batched > 0)
+		flush_batched_inserts(fmstate);
+
+	/* If we created prepared statements, destroy them */
 	if (fmstate->p_name)
 	{
 		char		sql[64];
@@ -1991,6 +2150,19 @@ postgresEndForeignModify(EState *estate,
 		PQclear(res);
 		fmstate->p_name = NULL;
 	}
+	if (fmstate->batch_p_name)
+	{
+		char		sql[64];
+		PGresult   *res;
+
+		snprintf(sql, sizeof(sql), "DEALLOCATE %s", fmstate->batch_p_name);
+
+		res = pgfdw_exec_query(fmstate->conn, sql);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			pgfdw_report_error(ERROR, res, fmstate->conn, true, sql);
+		PQclear(res);
+		fmstate->batch_p_name = NULL;
+	}
 
 	/* Release remote connection */
 	ReleaseConnection(fmstate->conn);
@@ -2275,6 +2447,7 @@ postgresBeginDirectModify(ForeignScanState *node, int eflags)
 	 * establish new connection if necessary.
 	 */
 	dmstate->conn = GetConnection(user, false);
+	MarkConnectionModified(dmstate->conn);
 
 	/* Initialize state variable */
 	dmstate->num_tuples = -1;	/* -1 means not set yet */
@@ -2841,8 +3014,10 @@ create_cursor(ForeignScanState *node)
 
 	/* Construct the DECLARE CURSOR command */
 	initStringInfo(&buf);
-	appendStringInfo(&buf, "DECLARE c%u CURSOR FOR\n%s",
-					 fsstate->cursor_number, fsstate->query);
+	appendStringInfo(&buf, "DECLARE c%u %sCURSOR FOR\n%s",
+					 fsstate->cursor_number,
+					 fsstate->binary_fetch ? "BINARY " : "",
+					 fsstate->query);
 
 	/*
 	 * Notice that we pass NULL for paramTypes, thus forcing the remote server
@@ -2851,6 +3026,7 @@ create_cursor(ForeignScanState *node)
 	 * the desired result.  This allows us to avoid assuming that the remote
 	 * server has the same OIDs we do for the parameters' types.
 	 */
+	pgfdw_finish_pending_scan(conn);
 	if (!PQsendQueryParams(conn, buf.data, numParams,
 						   NULL, values, NULL, NULL, 0))
 		pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
@@ -2880,49 +3056,160 @@ create_cursor(ForeignScanState *node)
 
 /*
  * Fetch some more rows from the node's cursor.
+ *
+ * The rows may already have been requested by an earlier call, in which case
+ * we only wait for them.  Once they are in, the next batch is requested ahead
+ * of time if no other scan is waiting for results on the connection, so that
+ * the remote server works on it while we consume this one.
  */
 static void
 fetch_more_data(ForeignScanState *node)
 {
 	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	MemoryContext batch_cxt;
+
+	/* Send a FETCH now, unless one was sent ahead of time. */
+	if (!fsstate->fetch_in_flight && !fsstate->prefetched)
+	{
+		pgfdw_finish_pending_scan(fsstate->conn);
+		send_fetch_request(node, false);
+	}
+
+	if (fsstate->fetch_in_flight)
+	{
+		/* An aborted subtransaction may have discarded our results. */
+		if (GetPendingScan(fsstate->conn) != node)
+			elog(ERROR, "results of FETCH from cursor c%u were discarded",
+				 fsstate->cursor_number);
+
+		complete_pending_fetch(node);
+	}
+
+	/* Make the fetched batch current, and flush the previous batch. */
+	batch_cxt = fsstate->batch_cxt;
+	fsstate->batch_cxt = fsstate->prefetch_cxt;
+	fsstate->prefetch_cxt = batch_cxt;
+	MemoryContextReset(fsstate->prefetch_cxt);
+
+	fsstate->tuples = fsstate->prefetch_tuples;
+	fsstate->num_tuples = fsstate->num_prefetched;
+	fsstate->next_tuple = 0;
+	fsstate->eof_reached = fsstate->prefetch_eof;
+
+	fsstate->prefetch_tuples = NULL;
+	fsstate->num_prefetched = 0;
+	fsstate->prefetched = false;
+
+	if (AsyncFetch && !fsstate->eof_reached &&
+		GetPendingScan(fsstate->conn) == NULL)
+		send_fetch_request(node, false);
+}
+
+/*
+ * Send a FETCH for the next batch of the node's cursor without waiting for
+ * the results, which complete_pending_fetch collects later.
+ *
+ * If declare is true, the cursor is declared by the same request.  This is
+ * only possible for queries without parameters, since the two commands are
+ * sent together as a simple query.
+ */
+static void
+send_fetch_request(ForeignScanState *node, bool declare)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	PGconn	   *conn = fsstate->conn;
+	char	   *sql;
+
+	Assert(!fsstate->fetch_in_flight && !fsstate->prefetched);
+	Assert(!declare || fsstate->numParams == 0);
+
+	if (declare)
+		sql = psprintf("DECLARE c%u %sCURSOR FOR\n%s;\nFETCH %d FROM c%u",
+					   fsstate->cursor_number,
+					   fsstate->binary_fetch ? "BINARY " : "",
+					   fsstate->query,
+					   fsstate->fetch_size, fsstate->cursor_number);
+	else
+		sql = psprintf("FETCH %d FROM c%u",
+					   fsstate->fetch_size, fsstate->cursor_number);
+
+	/* On error, report the original query, not the FETCH. */
+	if (!PQsendQuery(conn, sql))
+		pgfdw_report_error(ERROR, NULL, conn, false, fsstate->query);
+
+	SetPendingScan(conn, node);
+	fsstate->fetch_in_flight = true;
+
+	if (declare)
+	{
+		/* Mark the cursor as created, and show no tuples have been retrieved */
+		fsstate->cursor_exists = true;
+		fsstate->tuples = NULL;
+		fsstate->num_tuples = 0;
+		fsstate->next_tuple = 0;
+		fsstate->fetch_ct_2 = 0;
+		fsstate->eof_reached = false;
+	}
+
+	/* Update fetch_ct_2 */
+	if (fsstate->fetch_ct_2 < 2)
+		fsstate->fetch_ct_2++;
+
+	pfree(sql);
+}
+
+/*
+ * Receive the results of the FETCH the node has in flight, and store the
+ * rows as the node's next batch.
+ *
+ * This is called by fetch_more_data, and by the connection manager when
+ * another command must be sent on the connection.
+ */
+void
+complete_pending_fetch(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	PGconn	   *conn = fsstate->conn;
 	PGresult   *volatile res = NULL;
 	MemoryContext oldcontext;
+	bool		waited;
 
-	/*
-	 * We'll store the tuples in the batch_cxt.  First, flush the previous
-	 * batch.
-	 */
-	fsstate->tuples = NULL;
-	MemoryContextReset(fsstate->batch_cxt);
-	oldcontext = MemoryContextSwitchTo(fsstate->batch_cxt);
+	Assert(fsstate->fetch_in_flight);
+
+	/* Forget about the request first, so that an error leaves no trace. */
+	fsstate->fetch_in_flight = false;
+	SetPendingScan(conn, NULL);
+
+	fsstate->prefetch_tuples = NULL;
+	MemoryContextReset(fsstate->prefetch_cxt);
+	oldcontext = MemoryContextSwitchTo(fsstate->prefetch_cxt);
 
 	/* PGresult must be released before leaving this function. */
 	PG_TRY();
 	{
-		PGconn	   *conn = fsstate->conn;
-		char		sql[64];
 		int			numrows;
 		int			i;
 
-		snprintf(sql, sizeof(sql), "FETCH %d FROM c%u",
-				 fsstate->fetch_size, fsstate->cursor_number);
+		/* Note whether the results are not all here yet, for sizing. */
+		if (!PQconsumeInput(conn))
+			pgfdw_report_error(ERROR, NULL, conn, false, fsstate->query);
+		waited = PQisBusy(conn);
 
-		res = pgfdw_exec_query(conn, sql);
+		res = pgfdw_get_result(conn, fsstate->query);
 		/* On error, report the original query, not the FETCH. */
 		if (PQresultStatus(res) != PGRES_TUPLES_OK)
 			pgfdw_report_error(ERROR, res, conn, false, fsstate->query);
 
 		/* Convert the data into HeapTuples */
 		numrows = PQntuples(res);
-		fsstate->tuples = (HeapTuple *) palloc0(numrows * sizeof(HeapTuple));
-		fsstate->num_tuples = numrows;
-		fsstate->next_tuple = 0;
+		fsstate->prefetch_tuples = (HeapTuple *) palloc0(numrows * sizeof(HeapTuple));
+		fsstate->num_prefetched = numrows;
 
 		for (i = 0; i < numrows; i++)
 		{
 			Assert(IsA(node->ss.ps.plan, ForeignScan));
 
-			fsstate->tuples[i] =
+			fsstate->prefetch_tuples[i] =
 				make_tuple_from_result_row(res, i,
 										   fsstate->rel,
 										   fsstate->attinmeta,
@@ -2931,12 +3218,12 @@ fetch_more_data(ForeignScanState *node)
 										   fsstate->temp_cxt);
 		}
 
-		/* Update fetch_ct_2 */
-		if (fsstate->fetch_ct_2 < 2)
-			fsstate->fetch_ct_2++;
-
 		/* Must be EOF if we didn't get as many tuples as we asked for. */
-		fsstate->eof_reached = (numrows < fsstate->fetch_size);
+		fsstate->prefetch_eof = (numrows < fsstate->fetch_size);
+		fsstate->prefetched = true;
+
+		if (!fsstate->prefetch_eof)
+			adapt_fetch_size(fsstate, res, waited);
 
 		PQclear(res);
 		res = NULL;
@@ -2952,6 +3239,116 @@ fetch_more_data(ForeignScanState *node)
 	MemoryContextSwitchTo(oldcontext);
 }
 
+/*
+ * Decide whether the node's cursor should return its rows in binary format,
+ * and if so look up the receive functions to convert them.
+ *
+ * This is requested with the binary_fetch option of the table or server (the
+ * table's setting wins).  Binary formats are only assumed to agree with the
+ * remote server's for built-in base types, so we fall back to text if any
+ * retrieved column has another type.
+ */
+static void
+check_binary_fetch(ForeignScanState *node, ForeignTable *table)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	ForeignServer *server = GetForeignServer(table->serverid);
+	TupleDesc	tupdesc = fsstate->tupdesc;
+	bool		binary_fetch = false;
+	ListCell   *lc;
+
+	fsstate->binary_fetch = false;
+
+	foreach(lc, server->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "binary_fetch") == 0)
+			binary_fetch = defGetBoolean(def);
+	}
+	foreach(lc, table->options)
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "binary_fetch") == 0)
+			binary_fetch = defGetBoolean(def);
+	}
+
+	if (!binary_fetch)
+		return;
+
+	fsstate->recv_flinfo = (FmgrInfo *)
+		palloc0(tupdesc->natts * sizeof(FmgrInfo));
+	fsstate->recv_ioparams = (Oid *) palloc0(tupdesc->natts * sizeof(Oid));
+
+	foreach(lc, fsstate->retrieved_attrs)
+	{
+		int			attnum = lfirst_int(lc);
+		Oid			typid;
+		int16		typlen;
+		bool		typbyval;
+		char		typalign;
+		char		typdelim;
+		Oid			recvfn;
+
+		/* ctid is the only system column we care about; tid is built in */
+		if (attnum <= 0)
+			continue;
+
+		typid = tupdesc->attrs[attnum - 1]->atttypid;
+		if (!is_builtin(typid) || get_typtype(typid) != TYPTYPE_BASE)
+			return;
+
+		get_type_io_data(typid, IOFunc_receive, &typlen, &typbyval,
+						 &typalign, &typdelim,
+						 &fsstate->recv_ioparams[attnum - 1], &recvfn);
+		if (!OidIsValid(recvfn))
+			return;
+		fmgr_info(recvfn, &fsstate->recv_flinfo[attnum - 1]);
+	}
+
+	fsstate->binary_fetch = true;
+}
+
+/*
+ * Grow the node's fetch size after a full batch, if the remote server and
+ * the network rather than we are the bottleneck.
+ *
+ * waited tells whether the batch's results were still arriving when we came
+ * to collect them, which means the round trip was not hidden behind local
+ * processing of the previous batch.  Then we double the fetch size, as long
+ * as a batch of rows as wide as these stays within postgres_fdw.fetch_memory.
+ */
+static void
+adapt_fetch_size(PgFdwScanState *fsstate, PGresult *res, bool waited)
+{
+	int			numrows = PQntuples(res);
+	int			numfields = PQnfields(res);
+	double		batch_bytes = 0;
+	double		max_rows;
+	int			row;
+	int			col;
+
+	if (!waited || FetchMemory <= 0 || numrows == 0)
+		return;
+
+	for (row = 0; row < numrows; row++)
+	{
+		/* count the per-tuple overhead too */
+		batch_bytes += MAXALIGN(HEAPTUPLESIZE + SizeofHeapTupleHeader);
+		for (col = 0; col < numfields; col++)
+			batch_bytes += PQgetlength(res, row, col);
+	}
+
+	max_rows = (double) FetchMemory * 1024.0 / (batch_bytes / numrows);
+	max_rows = Min(max_rows, MaxAllocSize / sizeof(HeapTuple));
+
+	if (fsstate->fetch_size * 2.0 <= max_rows)
+		fsstate->fetch_size *= 2;
+	else if (fsstate->fetch_size < max_rows)
+		fsstate->fetch_size = (int) max_rows;
+}
+
 /*
  * Force assorted GUC parameters to settings that ensure that we'll output
  * data values in a form that is unambiguous to the remote server.
@@ -3029,6 +3426,18 @@ close_cursor(PGconn *conn, unsigned int cursor_number)
  */
 static void
 prepare_foreign_modify(PgFdwModifyState *fmstate)
+{
+	/* This action shows that the prepare has been done. */
+	fmstate->p_name = prepare_remote_statement(fmstate->conn, fmstate->query);
+}
+
+/*
+ * prepare_remote_statement
+ *		Create a prepared statement for query on the remote server, and
+ *		return its name (palloc'd in the current memory context)
+ */
+static char *
+prepare_remote_statement(PGconn *conn, const char *query)
 {
 	char		prep_name[NAMEDATALEN];
 	char	   *p_name;
@@ -3036,7 +3445,7 @@ prepare_foreign_modify(PgFdwModifyState *fmstate)
 
 	/* Construct name we'll use for the prepared statement. */
 	snprintf(prep_name, sizeof(prep_name), "pgsql_fdw_prep_%u",
-			 GetPrepStmtNumber(fmstate->conn));
+			 GetPrepStmtNumber(conn));
 	p_name = pstrdup(prep_name);
 
 	/*
@@ -3046,12 +3455,13 @@ prepare_foreign_modify(PgFdwModifyState *fmstate)
 	 * the prepared statements we use in this module are simple enough that
 	 * the remote server will make the right choices.
 	 */
-	if (!PQsendPrepare(fmstate->conn,
+	pgfdw_finish_pending_scan(conn);
+	if (!PQsendPrepare(conn,
 					   p_name,
-					   fmstate->query,
+					   query,
 					   0,
 					   NULL))
-		pgfdw_report_error(ERROR, NULL, fmstate->conn, false, fmstate->query);
+		pgfdw_report_error(ERROR, NULL, conn, false, query);
 
 	/*
 	 * Get the result, and check for success.
@@ -3059,13 +3469,67 @@ prepare_foreign_modify(PgFdwModifyState *fmstate)
 	 * We don't use a PG_TRY block here, so be careful not to throw error
 	 * without releasing the PGresult.
 	 */
-	res = pgfdw_get_result(fmstate->conn, fmstate->query);
+	res = pgfdw_get_result(conn, query);
 	if (PQresultStatus(res) != PGRES_COMMAND_OK)
-		pgfdw_report_error(ERROR, res, fmstate->conn, true, fmstate->query);
+		pgfdw_report_error(ERROR, res, conn, true, query);
 	PQclear(res);
 
-	/* This action shows that the prepare has been done. */
-	fmstate->p_name = p_name;
+	return p_name;
+}
+
+/*
+ * flush_batched_inserts
+ *		Send the rows buffered by postgresExecForeignInsert as one INSERT
+ *
+ * A full batch goes through a prepared statement made on first use, since
+ * that is the common case; the final partial batch is sent unprepared.
+ */
+static void
+flush_batched_inserts(PgFdwModifyState *fmstate)
+{
+	StringInfoData sql;
+	PGresult   *res;
+	int			num_cols = list_length(fmstate->target_attrs);
+	int			num_params = fmstate->num_batched * fmstate->p_nums;
+	bool		full = (fmstate->num_batched == fmstate->batch_size);
+	int			ok;
+
+	Assert(fmstate->num_batched > 0);
+
+	initStringInfo(&sql);
+	deparseBatchInsertSql(&sql, fmstate->query, num_cols,
+						  fmstate->num_batched);
+
+	if (full && !fmstate->batch_p_name)
+		fmstate->batch_p_name = prepare_remote_statement(fmstate->conn,
+														 sql.data);
+
+	pgfdw_finish_pending_scan(fmstate->conn);
+	if (full)
+		ok = PQsendQueryPrepared(fmstate->conn, fmstate->batch_p_name,
+								 num_params, fmstate->batch_values,
+								 NULL, NULL, 0);
+	else
+		ok = PQsendQueryParams(fmstate->conn, sql.data, num_params,
+							   NULL, fmstate->batch_values,
+							   NULL, NULL, 0);
+	if (!ok)
+		pgfdw_report_error(ERROR, NULL, fmstate->conn, false, sql.data);
+
+	/*
+	 * Get the result, and check for success.
+	 *
+	 * We don't use a PG_TRY block here, so be careful not to throw error
+	 * without releasing the PGresult.
+	 */
+	res = pgfdw_get_result(fmstate->conn, sql.data);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pgfdw_report_error(ERROR, res, fmstate->conn, true, sql.data);
+	PQclear(res);
+
+	pfree(sql.data);
+	fmstate->num_batched = 0;
+	MemoryContextReset(fmstate->batch_cxt);
 }
 
 /*
@@ -3192,6 +3656,7 @@ execute_dml_stmt(ForeignScanState *node)
 	 * the desired result.  This allows us to avoid assuming that the remote
 	 * server has the same OIDs we do for the parameters' types.
 	 */
+	pgfdw_finish_pending_scan(dmstate->conn);
 	if (!PQsendQueryParams(dmstate->conn, dmstate->query, numParams,
 						   NULL, values, NULL, NULL, 0))
 		pgfdw_report_error(ERROR, NULL, dmstate->conn, false, dmstate->query);
@@ -4344,6 +4809,203 @@ postgresGetForeignJoinPaths(PlannerInfo *root,
 	/* XXX Consider parameterized paths for the join relation */
 }
 
+/*
+ * colocated_join_pathlist
+ *		Consider joining two inheritance parents child by child on the
+ *		foreign servers holding the children.
+ *
+ * This is installed as set_join_pathlist_hook.  If both sides of an inner
+ * join are inheritance parents whose children (those not excluded by
+ * constraints) are postgres_fdw foreign tables on distinct servers, we join
+ * each pair of children on the same server remotely and offer an Append of
+ * those joins for the parents' join.  That is only correct if matching rows
+ * are always stored on the same server, as when both parents are sharded on
+ * the join key; the planner can't check that, so the user has to promise it
+ * by setting postgres_fdw.colocated_joins.
+ */
+static void
+colocated_join_pathlist(PlannerInfo *root,
+						RelOptInfo *joinrel,
+						RelOptInfo *outerrel,
+						RelOptInfo *innerrel,
+						JoinType jointype,
+						JoinPathExtraData *extra)
+{
+	List	   *outer_children;
+	List	   *inner_children;
+	List	   *subpaths = NIL;
+	ListCell   *lco;
+
+	if (prev_set_join_pathlist_hook)
+		prev_set_join_pathlist_hook(root, joinrel, outerrel, innerrel,
+									jointype, extra);
+
+	if (!ColocatedJoins || jointype != JOIN_INNER)
+		return;
+
+	/* There would be no local join path to recheck rows with in EPQ. */
+	if (root->parse->commandType != CMD_SELECT || root->rowMarks)
+		return;
+
+	if (!get_foreign_children(root, outerrel, &outer_children) ||
+		!get_foreign_children(root, innerrel, &inner_children))
+		return;
+
+	foreach(lco, outer_children)
+	{
+		AppendRelInfo *outer_appinfo = (AppendRelInfo *) lfirst(lco);
+		RelOptInfo *outer_child = find_base_rel(root,
+												outer_appinfo->child_relid);
+		AppendRelInfo *inner_appinfo = NULL;
+		RelOptInfo *inner_child = NULL;
+		ListCell   *lci;
+		Path	   *path;
+
+		foreach(lci, inner_children)
+		{
+			AppendRelInfo *appinfo = (AppendRelInfo *) lfirst(lci);
+			RelOptInfo *child = find_base_rel(root, appinfo->child_relid);
+
+			if (child->serverid == outer_child->serverid &&
+				child->userid == outer_child->userid)
+			{
+				inner_appinfo = appinfo;
+				inner_child = child;
+				break;
+			}
+		}
+
+		/* Without a partner on its server, the child joins no rows. */
+		if (inner_child == NULL)
+			continue;
+
+		path = colocated_child_join_path(root, joinrel,
+										 outer_child, inner_child,
+										 outer_appinfo, inner_appinfo,
+										 extra);
+		if (path == NULL)
+			return;
+		subpaths = lappend(subpaths, path);
+	}
+
+	if (subpaths == NIL)
+		return;
+
+	add_path(joinrel, (Path *) create_append_path(joinrel, subpaths, NULL, 0));
+}
+
+/*
+ * Collect the AppendRelInfos of the children of an inheritance parent, if
+ * all those not excluded by constraints are postgres_fdw foreign tables on
+ * distinct servers.  Returns false if the rel doesn't qualify.
+ *
+ * Rows stored in the parent table itself count as a child too, so the
+ * parent must be excluded, e.g. by a CHECK (false) NO INHERIT constraint.
+ */
+static bool
+get_foreign_children(PlannerInfo *root, RelOptInfo *rel, List **children)
+{
+	ListCell   *lc;
+
+	*children = NIL;
+
+	if (rel->reloptkind != RELOPT_BASEREL || rel->rtekind != RTE_RELATION ||
+		!planner_rt_fetch(rel->relid, root)->inh)
+		return false;
+
+	foreach(lc, root->append_rel_list)
+	{
+		AppendRelInfo *appinfo = (AppendRelInfo *) lfirst(lc);
+		RelOptInfo *child;
+		ListCell   *lc2;
+
+		if (appinfo->parent_relid != rel->relid)
+			continue;
+
+		child = find_base_rel(root, appinfo->child_relid);
+		if (IS_DUMMY_REL(child))
+			continue;
+
+		if (child->fdwroutine == NULL ||
+			child->fdwroutine->GetForeignJoinPaths != postgresGetForeignJoinPaths)
+			return false;
+
+		foreach(lc2, *children)
+		{
+			AppendRelInfo *other = (AppendRelInfo *) lfirst(lc2);
+
+			if (find_base_rel(root, other->child_relid)->serverid ==
+				child->serverid)
+				return false;
+		}
+
+		*children = lappend(*children, appinfo);
+	}
+
+	return *children != NIL;
+}
+
+/*
+ * Build a join rel for a pair of children of the parents joined by joinrel,
+ * translating the parents' target list and join clauses, and return the
+ * cheapest path of pushing the join down, or NULL if it can't be pushed down.
+ */
+static Path *
+colocated_child_join_path(PlannerInfo *root,
+						  RelOptInfo *joinrel,
+						  RelOptInfo *outer_child,
+						  RelOptInfo *inner_child,
+						  AppendRelInfo *outer_appinfo,
+						  AppendRelInfo *inner_appinfo,
+						  JoinPathExtraData *extra)
+{
+	RelOptInfo *child_joinrel;
+	JoinPathExtraData child_extra;
+	SpecialJoinInfo *child_sjinfo;
+	Node	   *node;
+
+	child_joinrel = makeNode(RelOptInfo);
+	child_joinrel->reloptkind = RELOPT_JOINREL;
+	child_joinrel->relids = bms_union(outer_child->relids,
+									  inner_child->relids);
+	child_joinrel->consider_startup = joinrel->consider_startup;
+	child_joinrel->serverid = outer_child->serverid;
+	child_joinrel->userid = outer_child->userid;
+	child_joinrel->useridiscurrent = (outer_child->useridiscurrent ||
+									  inner_child->useridiscurrent);
+	child_joinrel->fdwroutine = outer_child->fdwroutine;
+
+	/* The children's columns stand in for the parents' ones */
+	child_joinrel->reltarget = copy_pathtarget(joinrel->reltarget);
+	node = adjust_appendrel_attrs(root, (Node *) joinrel->reltarget->exprs,
+								  outer_appinfo);
+	node = adjust_appendrel_attrs(root, node, inner_appinfo);
+	child_joinrel->reltarget->exprs = (List *) node;
+
+	child_extra = *extra;
+	node = adjust_appendrel_attrs(root, (Node *) extra->restrictlist,
+								  outer_appinfo);
+	node = adjust_appendrel_attrs(root, node, inner_appinfo);
+	child_extra.restrictlist = (List *) node;
+
+	/* For an inner join, sjinfo only tells the sides apart for estimates */
+	child_sjinfo = (SpecialJoinInfo *) palloc(sizeof(SpecialJoinInfo));
+	memcpy(child_sjinfo, extra->sjinfo, sizeof(SpecialJoinInfo));
+	child_sjinfo->min_lefthand = outer_child->relids;
+	child_sjinfo->min_righthand = inner_child->relids;
+	child_sjinfo->syn_lefthand = outer_child->relids;
+	child_sjinfo->syn_righthand = inner_child->relids;
+	child_extra.sjinfo = child_sjinfo;
+
+	postgresGetForeignJoinPaths(root, child_joinrel, outer_child, inner_child,
+								JOIN_INNER, &child_extra);
+	if (child_joinrel->pathlist == NIL)
+		return NULL;
+
+	set_cheapest(child_joinrel);
+	return child_joinrel->cheapest_total_path;
+}
+
 /*
  * Create a tuple from the specified row of the PGresult.
  *
@@ -4416,6 +5078,7 @@ make_tuple_from_result_row(PGresult *res,
 	{
 		int			i = lfirst_int(lc);
 		char	   *valstr;
+		StringInfoData valbuf;
 
 		/* fetch next column's textual value */
 		if (PQgetisnull(res, row, j))
@@ -4425,7 +5088,45 @@ make_tuple_from_result_row(PGresult *res,
 
 		/* convert value to internal representation */
 		errpos.cur_attno = i;
-		if (i > 0)
+		if (PQfformat(res, j) == 1)
+		{
+			/* binary value from a BINARY cursor; see check_binary_fetch */
+			PgFdwScanState *fdw_sstate;
+
+			Assert(fsstate);
+			fdw_sstate = (PgFdwScanState *) fsstate->fdw_state;
+			Assert(fdw_sstate->binary_fetch);
+
+			if (valstr != NULL)
+			{
+				/* receive functions expect a writable, terminated buffer */
+				valbuf.len = PQgetlength(res, row, j);
+				valbuf.maxlen = valbuf.len + 1;
+				valbuf.data = palloc(valbuf.maxlen);
+				memcpy(valbuf.data, valstr, valbuf.len);
+				valbuf.data[valbuf.len] = '\0';
+				valbuf.cursor = 0;
+			}
+
+			if (i > 0)
+			{
+				Assert(i <= tupdesc->natts);
+				nulls[i - 1] = (valstr == NULL);
+				values[i - 1] =
+					ReceiveFunctionCall(&fdw_sstate->recv_flinfo[i - 1],
+										valstr ? &valbuf : NULL,
+										fdw_sstate->recv_ioparams[i - 1],
+										attinmeta->atttypmods[i - 1]);
+			}
+			else if (i == SelfItemPointerAttributeNumber && valstr != NULL)
+			{
+				Datum		datum;
+
+				datum = DirectFunctionCall1(tidrecv, PointerGetDatum(&valbuf));
+				ctid = (ItemPointer) DatumGetPointer(datum);
+			}
+		}
+		else if (i > 0)
 		{
 			/* ordinary column */
 			Assert(i <= tupdesc->natts);
@@ -4594,8 +5295,12 @@ postgres_fdw_exec(PG_FUNCTION_ARGS)
 	ForeignServer *server = GetForeignServer(table->serverid);
 	UserMapping *user = GetUserMapping(userid, server->serverid);
 	PGconn	   *conn = GetConnection(user, false);
-	PGresult   *res = PQexec(conn, sql);
+	PGresult   *res;
 
+	/* We can't tell what the command does, so assume it writes. */
+	MarkConnectionModified(conn);
+	pgfdw_finish_pending_scan(conn);
+	res = PQexec(conn, sql);
 	PQclear(res);
 	ReleaseConnection(conn);
 	PG_RETURN_VOID();
@@ -4608,4 +5313,25 @@ _PG_init(void)
 							 "Use timestamp base distributed transaction manager for FDW connections", NULL,
 						  &UseTsDtmTransactions, false, PGC_USERSET, 0, NULL,
 							 NULL, NULL);
+	DefineCustomBoolVariable("postgres_fdw.async_tsdtm_commit",
+							 "Do not wait for completion of distributed commit at shards", NULL,
+							 &AsyncTsDtmCommit, false, PGC_USERSET, 0, NULL,
+							 NULL, NULL);
+	DefineCustomBoolVariable("postgres_fdw.async_fetch",
+							 "Send FETCH requests of foreign scans ahead of time", NULL,
+							 &AsyncFetch, true, PGC_USERSET, 0, NULL,
+							 NULL, NULL);
+	DefineCustomBoolVariable("postgres_fdw.colocated_joins",
+							 "Join children of inheritance parents pairwise on their foreign servers",
+							 "Only correct if matching rows of the joined tables are always on the same server.",
+							 &ColocatedJoins, false, PGC_USERSET, 0, NULL,
+							 NULL, NULL);
+	DefineCustomIntVariable("postgres_fdw.fetch_memory",
+							"Memory a batch of fetched rows may grow to as the fetch size adapts",
+							"Zero keeps the fetch size as configured.",
+							&FetchMemory, 1024, 0, MAX_KILOBYTES,
+							PGC_USERSET, GUC_UNIT_KB, NULL, NULL, NULL);
+
+	prev_set_join_pathlist_hook = set_join_pathlist_hook;
+	set_join_pathlist_hook = colocated_join_pathlist;
 }
@@ -15,6 +15,7 @@
 
 #include "foreign/foreign.h"
 #include "lib/stringinfo.h"
+#include "nodes/execnodes.h"
 #include "nodes/relation.h"
 #include "utils/relcache.h"
 
@@ -97,12 +98,17 @@ typedef struct PgFdwRelationInfo
 /* in postgres_fdw.c */
 extern int	set_transmission_modes(void);
 extern void reset_transmission_modes(int nestlevel);
+extern void complete_pending_fetch(ForeignScanState *node);
 
 /* in connection.c */
 extern PGconn *GetConnection(UserMapping *user, bool will_prep_stmt);
 extern void ReleaseConnection(PGconn *conn);
 extern unsigned int GetCursorNumber(PGconn *conn);
 extern unsigned int GetPrepStmtNumber(PGconn *conn);
+extern void SetPendingScan(PGconn *conn, ForeignScanState *node);
+extern ForeignScanState *GetPendingScan(PGconn *conn);
+extern void pgfdw_finish_pending_scan(PGconn *conn);
+extern void MarkConnectionModified(PGconn *conn);
 extern PGresult *pgfdw_get_result(PGconn *conn, const char *query);
 extern PGresult *pgfdw_exec_query(PGconn *conn, const char *query);
 extern void pgfdw_report_error(int elevel, PGresult *res, PGconn *conn,
@@ -128,6 +134,8 @@ extern void deparseInsertSql(StringInfo buf, PlannerInfo *root,
 				 Index rtindex, Relation rel,
 				 List *targetAttrs, bool doNothing, List *returningList,
 				 List **retrieved_attrs);
+extern void deparseBatchInsertSql(StringInfo buf, const char *insertSql,
+					  int numCols, int numRows);
 extern void deparseUpdateSql(StringInfo buf, PlannerInfo *root,
 				 Index rtindex, Relation rel,
 				 List *targetAttrs, List *returningList,
@@ -167,5 +175,9 @@ extern bool is_shippable(Oid objectId, Oid classId, PgFdwRelationInfo *fpinfo);
 extern const char *get_jointype_name(JoinType jointype);
 
 extern bool UseTsDtmTransactions;
+extern bool AsyncTsDtmCommit;
+extern bool AsyncFetch;
+extern int	FetchMemory;
+extern bool ColocatedJoins;
 
 #endif   /* POSTGRES_FDW_H */
@@ -0,0 +1,73 @@
+-- predictability
+SET synchronous_commit = on;
+
+SELECT 'init' FROM pg_create_logical_replication_slot('regression_slot', 'test_decoding');
+
+CREATE TABLE mem_test(id int, data text);
+ALTER TABLE mem_test ALTER COLUMN data SET STORAGE PLAIN;
+
+-- consume DDL
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+/*
+ * Changes and transactions come from slab contexts, tuples from a
+ * generation context.  Exercise their allocation and freeing patterns:
+ * many subtransactions, some of them aborted while the toplevel
+ * transaction is still going, and tuples of very different sizes.
+ */
+
+-- many subtransactions, every third one aborted
+DO $$
+BEGIN
+    FOR i IN 1..3000 LOOP
+        BEGIN
+            INSERT INTO mem_test VALUES (i, repeat('x', i % 100));
+            IF i % 3 = 0 THEN
+                RAISE EXCEPTION 'abort';
+            END IF;
+        EXCEPTION WHEN raise_exception THEN
+            NULL;
+        END;
+    END LOOP;
+END $$;
+SELECT count(*), count(DISTINCT data), min(length(data)), max(length(data))
+FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1')
+WHERE data ~ 'INSERT';
+
+-- small and almost page-sized tuples mixed, filling several generation blocks
+BEGIN;
+INSERT INTO mem_test SELECT g.i, repeat('y', CASE WHEN g.i % 2 = 0 THEN 8000 ELSE 10 END)
+FROM generate_series(1, 3000) g(i);
+DELETE FROM mem_test WHERE id % 4 = 0;
+INSERT INTO mem_test SELECT g.i, repeat('z', 8000 - g.i) FROM generate_series(1, 1000) g(i);
+COMMIT;
+-- decoding twice reuses the memory freed by the first pass
+SELECT count(*), sum(length(data))
+FROM pg_logical_slot_peek_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+SELECT substring(data, 1, 29), count(*), sum(length(data))
+FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1')
+GROUP BY 1 ORDER BY 1;
+
+-- the same while being spilled to disk and restored
+SET logical_decoding_work_mem = '64kB';
+DO $$
+BEGIN
+    FOR i IN 1..1000 LOOP
+        BEGIN
+            INSERT INTO mem_test VALUES (i, repeat('w', (i * 37) % 8000));
+            IF i % 5 = 0 THEN
+                RAISE EXCEPTION 'abort';
+            END IF;
+        EXCEPTION WHEN raise_exception THEN
+            NULL;
+        END;
+    END LOOP;
+END $$;
+SELECT count(*), sum(length(data))
+FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1')
+WHERE data ~ 'INSERT';
+RESET logical_decoding_work_mem;
+
+DROP TABLE mem_test;
+
+SELECT pg_drop_replication_slot('regression_slot');
@@ -0,0 +1,62 @@
+-- predictability
+SET synchronous_commit = on;
+
+SELECT 'init' FROM pg_create_logical_replication_slot('regression_slot', 'test_decoding');
+SELECT 'init' FROM pg_create_physical_replication_slot('regression_slot_p', true);
+SELECT 'init' FROM pg_create_physical_replication_slot('regression_slot_p_noreserve');
+
+CREATE TABLE adv_test(id int);
+
+-- consume DDL
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+-- changes up to the target are skipped, later ones decoded
+INSERT INTO adv_test VALUES (1);
+INSERT INTO adv_test VALUES (2);
+SELECT pg_current_xlog_location() AS adv_lsn \gset
+INSERT INTO adv_test VALUES (3);
+SELECT slot_name, end_lsn = :'adv_lsn' FROM pg_replication_slot_advance('regression_slot', :'adv_lsn');
+SELECT confirmed_flush_lsn = :'adv_lsn' FROM pg_replication_slots WHERE slot_name = 'regression_slot';
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+-- a slot isn't moved backwards
+SELECT confirmed_flush_lsn AS cur_lsn FROM pg_replication_slots WHERE slot_name = 'regression_slot' \gset
+SELECT end_lsn = :'cur_lsn' FROM pg_replication_slot_advance('regression_slot', :'adv_lsn');
+
+-- nor beyond the end of WAL
+INSERT INTO adv_test VALUES (4);
+SELECT end_lsn <= pg_current_xlog_location() FROM pg_replication_slot_advance('regression_slot', 'FFFFFFFF/FFFFFFFF');
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+-- the slot keeps decoding correctly after being advanced
+BEGIN;
+INSERT INTO adv_test VALUES (5);
+ALTER TABLE adv_test ADD COLUMN data text;
+INSERT INTO adv_test VALUES (6, 'after ddl');
+COMMIT;
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+-- skipped DDL is still known to decoding
+ALTER TABLE adv_test ADD COLUMN more int;
+SELECT pg_current_xlog_location() AS ddl_lsn \gset
+INSERT INTO adv_test VALUES (7, 'skipped ddl', 7);
+SELECT end_lsn = :'ddl_lsn' FROM pg_replication_slot_advance('regression_slot', :'ddl_lsn');
+SELECT data FROM pg_logical_slot_get_changes('regression_slot', NULL, NULL, 'include-xids', '0', 'skip-empty-xacts', '1');
+
+-- physical slots
+SELECT restart_lsn AS phys_lsn FROM pg_replication_slots WHERE slot_name = 'regression_slot_p' \gset
+SELECT end_lsn AS phys_end FROM pg_replication_slot_advance('regression_slot_p', pg_current_xlog_location()) \gset
+SELECT :'phys_end'::pg_lsn > :'phys_lsn';
+SELECT restart_lsn = :'phys_end' FROM pg_replication_slots WHERE slot_name = 'regression_slot_p';
+SELECT end_lsn = :'phys_end' FROM pg_replication_slot_advance('regression_slot_p', :'phys_lsn');
+
+-- errors
+SELECT pg_replication_slot_advance('regression_slot_p_noreserve', pg_current_xlog_location());
+SELECT pg_replication_slot_advance('regression_slot', '0/0');
+SELECT pg_replication_slot_advance('nonexistent_slot', pg_current_xlog_location());
+
+DROP TABLE adv_test;
+
+SELECT pg_drop_replication_slot('regression_slot');
+SELECT pg_drop_replication_slot('regression_slot_p');
+SELECT pg_drop_replication_slot('regression_slot_p_noreserve');
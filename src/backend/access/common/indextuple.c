@@ -92,7 +92,8 @@ index_form_tuple(TupleDesc tupleDescriptor,
 		VARSIZE(DatumGetPointer(untoasted_values[i])) > TOAST_INDEX_TARGET &&
 			(att->attstorage == 'x' || att->attstorage == 'm'))
 		{
-			Datum		cvalue = toast_compress_datum(untoasted_values[i]);
+			Datum		cvalue = toast_compress_datum(untoasted_values[i],
+												  TOAST_PGLZ_COMPRESSION_ID);
 
 			if (DatumGetPointer(cvalue) != NULL)
 			{
@@ -21,6 +21,7 @@
 #include "access/nbtree.h"
 #include "access/reloptions.h"
 #include "access/spgist.h"
+#include "access/tuptoaster.h"
 #include "catalog/pg_type.h"
 #include "commands/defrem.h"
 #include "commands/tablespace.h"
@@ -361,6 +362,19 @@ static relopt_string stringRelOpts[] =
 		gistValidateBufferingOption,
 		"auto"
 	},
+	{
+		{
+			"compression",
+			"Chooses the method compressing new values of a column (\"pglz\" or \"lz4\").",
+			RELOPT_KIND_ATTRIBUTE,
+			ShareUpdateExclusiveLock	/* since it applies only to later
+										 * inserts */
+		},
+		4,
+		false,
+		toast_validate_compression_option,
+		"pglz"
+	},
 	{
 		{
 			"check_option",
@@ -1419,7 +1433,8 @@ attribute_reloptions(Datum reloptions, bool validate)
 	int			numoptions;
 	static const relopt_parse_elt tab[] = {
 		{"n_distinct", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct)},
-		{"n_distinct_inherited", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct_inherited)}
+		{"n_distinct_inherited", RELOPT_TYPE_REAL, offsetof(AttributeOpts, n_distinct_inherited)},
+		{"compression", RELOPT_TYPE_STRING, offsetof(AttributeOpts, compression)}
 	};
 
 	options = parseRelOptions(reloptions, validate, RELOPT_KIND_ATTRIBUTE,
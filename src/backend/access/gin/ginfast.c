@@ -19,6 +19,7 @@
 #include "postgres.h"
 
 #include "access/gin_private.h"
+#include "access/heapam.h"
 #include "access/xloginsert.h"
 #include "access/xlog.h"
 #include "commands/vacuum.h"
@@ -37,6 +38,12 @@ int			gin_pending_list_limit = 0;
 #define GIN_PAGE_FREESIZE \
 	( BLCKSZ - MAXALIGN(SizeOfPageHeaderData) - MAXALIGN(sizeof(GinPageOpaqueData)) )
 
+/*
+ * An inserting backend leaves the cleanup of an overgrown pending list to
+ * autovacuum, until the list exceeds this many times its limit.
+ */
+#define GIN_PENDING_BACKSTOP	4
+
 typedef struct KeyArray
 {
 	Datum	   *keys;			/* expansible array */
@@ -228,6 +235,7 @@ ginHeapTupleFastInsert(GinState *ginstate, GinTupleCollector *collector)
 	ginxlogUpdateMeta data;
 	bool		separateList = false;
 	bool		needCleanup = false;
+	bool		needForegroundCleanup = false;
 	int			cleanupSize;
 	bool		needWal;
 
@@ -433,13 +441,23 @@ ginHeapTupleFastInsert(GinState *ginstate, GinTupleCollector *collector)
 	cleanupSize = GinGetPendingListCleanupSize(index);
 	if (metadata->nPendingPages * GIN_PAGE_FREESIZE > cleanupSize * 1024L)
 		needCleanup = true;
+	if (metadata->nPendingPages * GIN_PAGE_FREESIZE >
+		GIN_PENDING_BACKSTOP * cleanupSize * 1024L)
+		needForegroundCleanup = true;
 
 	UnlockReleaseBuffer(metabuffer);
 
 	END_CRIT_SECTION();
 
-	if (needCleanup)
-		ginInsertCleanup(ginstate, false, true, NULL);
+	/*
+	 * Rather than stall this insert, hand the cleanup over to autovacuum.
+	 * Only if it can't take it, or falls far behind, do we do it ourselves.
+	 */
+	if (needCleanup &&
+		(needForegroundCleanup ||
+		 !AutoVacuumRequestWork(AVW_GINCleanupPendingList,
+								RelationGetRelid(index))))
+		ginInsertCleanup(ginstate, false, true, false, NULL);
 }
 
 /*
@@ -721,11 +739,16 @@ processPendingPage(BuildAccumulator *accum, KeyArray *ka,
  * to FSM otherwise caller is responsible to put deleted pages into
  * FSM.
  *
+ * forceCleanup is set by [auto]vacuum/analyze, gin_clean_pending_list() and
+ * the background cleanup, which wait for a concurrent cleanup to finish and
+ * use maintenance memory.  A regular insert doesn't.
+ *
  * If stats isn't null, we count deleted pending pages into the counts.
  */
 void
 ginInsertCleanup(GinState *ginstate, bool full_clean,
-				 bool fill_fsm, IndexBulkDeleteResult *stats)
+				 bool fill_fsm, bool forceCleanup,
+				 IndexBulkDeleteResult *stats)
 {
 	Relation	index = ginstate->index;
 	Buffer		metabuffer,
@@ -742,7 +765,6 @@ ginInsertCleanup(GinState *ginstate, bool full_clean,
 	bool		cleanupFinish = false;
 	bool		fsm_vac = false;
 	Size		workMemory;
-	bool		inVacuum = (stats == NULL);
 
 	/*
 	 * We would like to prevent concurrent cleanup process. For that we will
@@ -751,7 +773,7 @@ ginInsertCleanup(GinState *ginstate, bool full_clean,
 	 * insertion into pending list
 	 */
 
-	if (inVacuum)
+	if (forceCleanup)
 	{
 		/*
 		 * We are called from [auto]vacuum/analyze or gin_clean_pending_list()
@@ -1014,9 +1036,35 @@ gin_clean_pending_list(PG_FUNCTION_ARGS)
 
 	memset(&stats, 0, sizeof(stats));
 	initGinState(&ginstate, indexRel);
-	ginInsertCleanup(&ginstate, true, true, &stats);
+	ginInsertCleanup(&ginstate, true, true, true, &stats);
 
 	index_close(indexRel, AccessShareLock);
 
 	PG_RETURN_INT64((int64) stats.pages_deleted);
 }
+
+/*
+ * Clean the pending list of a GIN index on behalf of the backends that
+ * asked autovacuum to (see ginHeapTupleFastInsert).  The index may have
+ * been dropped, or its OID reused, since the request was made; that is
+ * silently ignored.
+ */
+void
+ginCleanupPendingListInBackground(Oid indexoid)
+{
+	Relation	indexRel;
+	GinState	ginstate;
+
+	indexRel = try_relation_open(indexoid, RowExclusiveLock);
+	if (indexRel == NULL)
+		return;
+
+	if (indexRel->rd_rel->relkind == RELKIND_INDEX &&
+		indexRel->rd_rel->relam == GIN_AM_OID)
+	{
+		initGinState(&ginstate, indexRel);
+		ginInsertCleanup(&ginstate, false, true, true, NULL);
+	}
+
+	relation_close(indexRel, RowExclusiveLock);
+}
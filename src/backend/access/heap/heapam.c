@@ -354,6 +354,7 @@ heapgetpage(HeapScanDesc scan, BlockNumber page)
 	OffsetNumber lineoff;
 	ItemId		lpp;
 	bool		all_visible;
+	bool		prefetched;
 
 	Assert(page < scan->rs_nblocks);
 
@@ -421,6 +422,12 @@ heapgetpage(HeapScanDesc scan, BlockNumber page)
 	 */
 	all_visible = PageIsAllVisible(dp) && !snapshot->takenDuringRecovery;
 
+	/*
+	 * Let transaction manager resolve visibility of all xids of the page at
+	 * once, if it supports that.
+	 */
+	prefetched = !all_visible && PrefetchXidsInMVCCSnapshot(buffer, snapshot);
+
 	for (lineoff = FirstOffsetNumber, lpp = PageGetItemId(dp, lineoff);
 		 lineoff <= lines;
 		 lineoff++, lpp++)
@@ -448,6 +455,9 @@ heapgetpage(HeapScanDesc scan, BlockNumber page)
 		}
 	}
 
+	if (prefetched)
+		ResetXidsInMVCCSnapshot();
+
 	LockBuffer(buffer, BUFFER_LOCK_UNLOCK);
 
 	Assert(ntup <= MaxHeapTuplesPerPage);
@@ -1614,6 +1624,10 @@ heap_endscan(HeapScanDesc scan)
 Size
 heap_parallelscan_estimate(Snapshot snapshot)
 {
+	/* SnapshotAny is not serialized, see heap_parallelscan_initialize */
+	if (snapshot == SnapshotAny)
+		return offsetof(ParallelHeapScanDescData, phs_snapshot_data);
+
 	return add_size(offsetof(ParallelHeapScanDescData, phs_snapshot_data),
 					EstimateSnapshotSpace(snapshot));
 }
@@ -1639,7 +1653,14 @@ heap_parallelscan_initialize(ParallelHeapScanDesc target, Relation relation,
 	SpinLockInit(&target->phs_mutex);
 	target->phs_cblock = InvalidBlockNumber;
 	target->phs_startblock = InvalidBlockNumber;
-	SerializeSnapshot(snapshot, target->phs_snapshot_data);
+
+	/*
+	 * SnapshotAny, used by index builds, is a static snapshot that every
+	 * participant can reference directly.
+	 */
+	target->phs_snapshot_any = (snapshot == SnapshotAny);
+	if (!target->phs_snapshot_any)
+		SerializeSnapshot(snapshot, target->phs_snapshot_data);
 }
 
 /* ----------------
@@ -1654,6 +1675,12 @@ heap_beginscan_parallel(Relation relation, ParallelHeapScanDesc parallel_scan)
 	Snapshot	snapshot;
 
 	Assert(RelationGetRelid(relation) == parallel_scan->phs_relid);
+
+	if (parallel_scan->phs_snapshot_any)
+		return heap_beginscan_internal(relation, SnapshotAny, 0, NULL,
+									   parallel_scan, true, true, true,
+									   false, false, false);
+
 	snapshot = RestoreSnapshot(parallel_scan->phs_snapshot_data);
 	RegisterSnapshot(snapshot);
 
@@ -2324,6 +2351,21 @@ FreeBulkInsertState(BulkInsertState bistate)
 	pfree(bistate);
 }
 
+/*
+ * ReleaseBulkInsertStatePin - release the buffer currently held in bistate
+ *
+ * This lets a caller keep using the same ring of buffers for a series of
+ * bulk inserts, possibly into different relations, without holding on to
+ * a pin in between.
+ */
+void
+ReleaseBulkInsertStatePin(BulkInsertState bistate)
+{
+	if (bistate->current_buf != InvalidBuffer)
+		ReleaseBuffer(bistate->current_buf);
+	bistate->current_buf = InvalidBuffer;
+}
+
 
 /*
  *	heap_insert		- insert tuple into a heap
@@ -2353,6 +2395,11 @@ FreeBulkInsertState(BulkInsertState bistate)
  * Speculatively inserted tuples behave as "value locks" of short duration,
  * used to implement INSERT .. ON CONFLICT.
  *
+ * HEAP_INSERT_PARALLEL allows the insertion in parallel mode.  The caller
+ * must have assigned the transaction ID and used the command ID before
+ * entering it, so that the workers insert with the leader's, as parallel
+ * COPY does.
+ *
  * Note that most of these options will be applied when inserting into the
  * heap's TOAST table, too, if the tuple requires any out-of-line data.  Only
  * HEAP_INSERT_IS_SPECULATIVE is explicitly ignored, as the toast data does
@@ -2556,12 +2603,12 @@ heap_prepare_insert(Relation relation, HeapTuple tup, TransactionId xid,
 					CommandId cid, int options)
 {
 	/*
-	 * For now, parallel operations are required to be strictly read-only.
-	 * Unlike heap_update() and heap_delete(), an insert should never create a
-	 * combo CID, so it might be possible to relax this restriction, but not
-	 * without more thought and testing.
+	 * Parallel operations are required to be strictly read-only, unless the
+	 * caller has arranged for the insertions with HEAP_INSERT_PARALLEL.
+	 * Unlike heap_update() and heap_delete(), an insert never creates a combo
+	 * CID, so all it takes is an XID and a command ID fixed in advance.
 	 */
-	if (IsInParallelMode())
+	if (IsInParallelMode() && !(options & HEAP_INSERT_PARALLEL))
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_TRANSACTION_STATE),
 				 errmsg("cannot insert tuples during a parallel operation")));
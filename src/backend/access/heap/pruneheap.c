@@ -19,6 +19,7 @@
 #include "access/transam.h"
 #include "access/htup_details.h"
 #include "access/xlog.h"
+#include "access/xtm.h"
 #include "catalog/catalog.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -114,9 +115,13 @@ heap_page_prune_opt(Relation relation, Buffer buffer)
 	 * Let's see if we really need pruning.
 	 *
 	 * Forget it if page is not hinted to contain something prunable that's
-	 * older than OldestXmin.
+	 * older than OldestXmin.  Transaction manager can know that the hinted
+	 * deleter is committed before all active snapshots even if OldestXmin
+	 * is held back by it.
 	 */
-	if (!PageIsPrunable(page, OldestXmin))
+	if (!PageIsPrunable(page, OldestXmin) &&
+		!(TransactionIdIsNormal(((PageHeader) page)->pd_prune_xid) &&
+		  TM->IsDeadForAllSnapshots(((PageHeader) page)->pd_prune_xid)))
 		return;
 
 	/*
@@ -494,6 +499,17 @@ heap_prune_chain(Relation relation, Buffer buffer, OffsetNumber rootoffnum,
 				break;
 
 			case HEAPTUPLE_RECENTLY_DEAD:
+
+				/*
+				 * Transaction manager may know that deleting transaction is
+				 * committed before all active snapshots, although it doesn't
+				 * precede OldestXmin.
+				 */
+				if (TM->IsDeadForAllSnapshots(HeapTupleHeaderGetUpdateXid(htup)))
+				{
+					tupdead = true;
+					break;
+				}
 				recent_dead = true;
 
 				/*
@@ -35,8 +35,10 @@
 #include "access/tuptoaster.h"
 #include "access/xact.h"
 #include "catalog/catalog.h"
+#include "common/pg_lz4.h"
 #include "common/pg_lzcompress.h"
 #include "miscadmin.h"
+#include "utils/attoptcache.h"
 #include "utils/expandeddatum.h"
 #include "utils/fmgroids.h"
 #include "utils/rel.h"
@@ -53,7 +55,7 @@
 typedef struct toast_compress_header
 {
 	int32		vl_len_;		/* varlena header (do not touch directly!) */
-	int32		rawsize;
+	uint32		rawsize;		/* and compression method in the top bits */
 } toast_compress_header;
 
 /*
@@ -61,11 +63,15 @@ typedef struct toast_compress_header
  * toast entries.
  */
 #define TOAST_COMPRESS_HDRSZ		((int32) sizeof(toast_compress_header))
-#define TOAST_COMPRESS_RAWSIZE(ptr) (((toast_compress_header *) (ptr))->rawsize)
+#define TOAST_COMPRESS_RAWSIZE(ptr) \
+	((int32) (((toast_compress_header *) (ptr))->rawsize & VARLENA_RAWSIZE_MASK))
+#define TOAST_COMPRESS_METHOD(ptr) \
+	((int) (((toast_compress_header *) (ptr))->rawsize >> VARLENA_RAWSIZE_BITS))
 #define TOAST_COMPRESS_RAWDATA(ptr) \
 	(((char *) (ptr)) + TOAST_COMPRESS_HDRSZ)
-#define TOAST_COMPRESS_SET_RAWSIZE(ptr, len) \
-	(((toast_compress_header *) (ptr))->rawsize = (len))
+#define TOAST_COMPRESS_SET_RAWSIZE_METHOD(ptr, len, cmethod) \
+	(((toast_compress_header *) (ptr))->rawsize = \
+	 (len) | ((uint32) (cmethod) << VARLENA_RAWSIZE_BITS))
 
 static void toast_delete_datum(Relation rel, Datum value, bool is_speculative);
 static Datum toast_save_datum(Relation rel, Datum value,
@@ -774,7 +780,8 @@ toast_insert_or_update(Relation rel, HeapTuple newtup, HeapTuple oldtup,
 		if (att[i]->attstorage == 'x')
 		{
 			old_value = toast_values[i];
-			new_value = toast_compress_datum(old_value);
+			new_value = toast_compress_datum(old_value,
+										toast_compression_method(rel, i + 1));
 
 			if (DatumGetPointer(new_value) != NULL)
 			{
@@ -913,7 +920,8 @@ toast_insert_or_update(Relation rel, HeapTuple newtup, HeapTuple oldtup,
 		 */
 		i = biggest_attno;
 		old_value = toast_values[i];
-		new_value = toast_compress_datum(old_value);
+		new_value = toast_compress_datum(old_value,
+									toast_compression_method(rel, i + 1));
 
 		if (DatumGetPointer(new_value) != NULL)
 		{
@@ -1291,7 +1299,8 @@ toast_flatten_tuple_to_datum(HeapTupleHeader tup,
 /* ----------
  * toast_compress_datum -
  *
- *	Create a compressed version of a varlena datum
+ *	Create a compressed version of a varlena datum, using compression
+ *	method cmethod
  *
  *	If we fail (ie, compressed result is actually bigger than original)
  *	then return NULL.  We must not use compressed data if it'd expand
@@ -1302,7 +1311,7 @@ toast_flatten_tuple_to_datum(HeapTupleHeader tup,
  * ----------
  */
 Datum
-toast_compress_datum(Datum value)
+toast_compress_datum(Datum value, int cmethod)
 {
 	struct varlena *tmp;
 	int32		valsize = VARSIZE_ANY_EXHDR(DatumGetPointer(value));
@@ -1313,17 +1322,14 @@ toast_compress_datum(Datum value)
 
 	/*
 	 * No point in wasting a palloc cycle if value size is out of the allowed
-	 * range for compression
+	 * range for compression.  pglz's limits are used for all methods.
 	 */
 	if (valsize < PGLZ_strategy_default->min_input_size ||
 		valsize > PGLZ_strategy_default->max_input_size)
 		return PointerGetDatum(NULL);
 
-	tmp = (struct varlena *) palloc(PGLZ_MAX_OUTPUT(valsize) +
-									TOAST_COMPRESS_HDRSZ);
-
 	/*
-	 * We recheck the actual size even if pglz_compress() reports success,
+	 * We recheck the actual size even if the compressor reports success,
 	 * because it might be satisfied with having saved as little as one byte
 	 * in the compressed data --- which could turn into a net loss once you
 	 * consider header and alignment padding.  Worst case, the compressed
@@ -1332,14 +1338,37 @@ toast_compress_datum(Datum value)
 	 * only one header byte and no padding if the value is short enough.  So
 	 * we insist on a savings of more than 2 bytes to ensure we have a gain.
 	 */
-	len = pglz_compress(VARDATA_ANY(DatumGetPointer(value)),
-						valsize,
-						TOAST_COMPRESS_RAWDATA(tmp),
-						PGLZ_strategy_default);
+	switch (cmethod)
+	{
+		case TOAST_PGLZ_COMPRESSION_ID:
+			tmp = (struct varlena *) palloc(PGLZ_MAX_OUTPUT(valsize) +
+											TOAST_COMPRESS_HDRSZ);
+			len = pglz_compress(VARDATA_ANY(DatumGetPointer(value)),
+								valsize,
+								TOAST_COMPRESS_RAWDATA(tmp),
+								PGLZ_strategy_default);
+			break;
+		case TOAST_LZ4_COMPRESSION_ID:
+
+			/*
+			 * Don't let the compressor write more than the result could
+			 * have to be worth it.
+			 */
+			tmp = (struct varlena *) palloc(valsize);
+			len = pglz4_compress(VARDATA_ANY(DatumGetPointer(value)),
+								 valsize,
+								 TOAST_COMPRESS_RAWDATA(tmp),
+								 valsize - TOAST_COMPRESS_HDRSZ);
+			break;
+		default:
+			elog(ERROR, "invalid compression method %d", cmethod);
+			return PointerGetDatum(NULL);		/* keep compiler quiet */
+	}
+
 	if (len >= 0 &&
 		len + TOAST_COMPRESS_HDRSZ < valsize - 2)
 	{
-		TOAST_COMPRESS_SET_RAWSIZE(tmp, valsize);
+		TOAST_COMPRESS_SET_RAWSIZE_METHOD(tmp, valsize, cmethod);
 		SET_VARSIZE_COMPRESSED(tmp, len + TOAST_COMPRESS_HDRSZ);
 		/* successful compression */
 		return PointerGetDatum(tmp);
@@ -1353,6 +1382,53 @@ toast_compress_datum(Datum value)
 }
 
 
+/* ----------
+ * toast_compression_method -
+ *
+ *	Return the compression method to compress new values of attribute
+ *	attnum of rel with, as chosen by its "compression" option.
+ * ----------
+ */
+int
+toast_compression_method(Relation rel, int attnum)
+{
+	AttributeOpts *aopts;
+	int			cmethod = TOAST_PGLZ_COMPRESSION_ID;
+
+	aopts = get_attribute_options(RelationGetRelid(rel), attnum);
+	if (aopts != NULL)
+	{
+		if (aopts->compression != 0 &&
+			strcmp((char *) aopts + aopts->compression, "lz4") == 0)
+			cmethod = TOAST_LZ4_COMPRESSION_ID;
+		pfree(aopts);
+	}
+
+	return cmethod;
+}
+
+
+/* ----------
+ * toast_validate_compression_option -
+ *
+ *	Validator for the "compression" attribute option.
+ * ----------
+ */
+void
+toast_validate_compression_option(char *value)
+{
+	if (value == NULL ||
+		(strcmp(value, "pglz") != 0 &&
+		 strcmp(value, "lz4") != 0))
+	{
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid value for \"compression\" option"),
+				 errdetail("Valid values are \"pglz\" and \"lz4\".")));
+	}
+}
+
+
 /* ----------
  * toast_get_valid_index
  *
@@ -2208,6 +2284,7 @@ static struct varlena *
 toast_decompress_datum(struct varlena * attr)
 {
 	struct varlena *result;
+	int32		rawsize;
 
 	Assert(VARATT_IS_COMPRESSED(attr));
 
@@ -2215,10 +2292,25 @@ toast_decompress_datum(struct varlena * attr)
 		palloc(TOAST_COMPRESS_RAWSIZE(attr) + VARHDRSZ);
 	SET_VARSIZE(result, TOAST_COMPRESS_RAWSIZE(attr) + VARHDRSZ);
 
-	if (pglz_decompress(TOAST_COMPRESS_RAWDATA(attr),
-						VARSIZE(attr) - TOAST_COMPRESS_HDRSZ,
-						VARDATA(result),
-						TOAST_COMPRESS_RAWSIZE(attr)) < 0)
+	switch (TOAST_COMPRESS_METHOD(attr))
+	{
+		case TOAST_PGLZ_COMPRESSION_ID:
+			rawsize = pglz_decompress(TOAST_COMPRESS_RAWDATA(attr),
+									  VARSIZE(attr) - TOAST_COMPRESS_HDRSZ,
+									  VARDATA(result),
+									  TOAST_COMPRESS_RAWSIZE(attr));
+			break;
+		case TOAST_LZ4_COMPRESSION_ID:
+			rawsize = pglz4_decompress(TOAST_COMPRESS_RAWDATA(attr),
+									   VARSIZE(attr) - TOAST_COMPRESS_HDRSZ,
+									   VARDATA(result),
+									   TOAST_COMPRESS_RAWSIZE(attr));
+			break;
+		default:
+			rawsize = -1;
+			break;
+	}
+	if (rawsize < 0)
 		elog(ERROR, "compressed data is corrupted");
 
 	return result;
@@ -30,6 +30,8 @@ static bool _bt_readpage(IndexScanDesc scan, ScanDirection dir,
 static void _bt_saveitem(BTScanOpaque so, int itemIndex,
 			 OffsetNumber offnum, IndexTuple itup);
 static bool _bt_steppage(IndexScanDesc scan, ScanDirection dir);
+static bool _bt_readnextpage(IndexScanDesc scan, BlockNumber blkno);
+static bool _bt_parallel_readpage(IndexScanDesc scan, BlockNumber blkno);
 static Buffer _bt_walk_left(Relation rel, Buffer buf, Snapshot snapshot);
 static bool _bt_endpoint(IndexScanDesc scan, ScanDirection dir);
 static void _bt_drop_lock_and_maybe_pin(IndexScanDesc scan, BTScanPos sp);
@@ -527,6 +529,10 @@ _bt_compare(Relation rel,
  * are both search-type scankeys (see nbtree/README for more about this).
  * Within this routine, we build a temporary insertion-type scankey to use
  * in locating the scan start position.
+ *
+ * In a parallel scan, only the first participant to get here positions the
+ * scan; the others wait for it and then pick up the page it handed on.
+ * Parallel scans only run forward.
  */
 bool
 _bt_first(IndexScanDesc scan, ScanDirection dir)
@@ -546,6 +552,7 @@ _bt_first(IndexScanDesc scan, ScanDirection dir)
 	int			i;
 	StrategyNumber strat_total;
 	BTScanPosItem *currItem;
+	BlockNumber blkno;
 
 	Assert(!BTScanPosIsValid(so->currPos));
 
@@ -562,7 +569,37 @@ _bt_first(IndexScanDesc scan, ScanDirection dir)
 	 * never be satisfied (eg, x == 1 AND x > 2).
 	 */
 	if (!so->qual_ok)
+	{
+		/* Notify any other workers that we're done with this scan key. */
+		_bt_parallel_done(scan);
 		return false;
+	}
+
+	/*
+	 * For parallel scans, get the starting page from shared state. If the
+	 * scan has not started, proceed to find out first leaf page in the usual
+	 * way while keeping other participating processes waiting.  If the scan
+	 * has already begun, use the page number from the shared structure.
+	 */
+	if (scan->parallel_scan != NULL)
+	{
+		if (!ScanDirectionIsForward(dir))
+			elog(ERROR, "parallel btree scans can only run forward");
+
+		if (!_bt_parallel_seize(scan, &blkno))
+			return false;
+		else if (blkno == P_NONE)
+		{
+			_bt_parallel_done(scan);
+			return false;
+		}
+		else if (blkno != InvalidBlockNumber)
+		{
+			if (!_bt_parallel_readpage(scan, blkno))
+				return false;
+			goto readcomplete;
+		}
+	}
 
 	/*----------
 	 * Examine the scan keys to discover where we need to start the scan.
@@ -773,7 +810,10 @@ _bt_first(IndexScanDesc scan, ScanDirection dir)
 
 			Assert(subkey->sk_flags & SK_ROW_MEMBER);
 			if (subkey->sk_flags & SK_ISNULL)
+			{
+				_bt_parallel_done(scan);
 				return false;
+			}
 			memcpy(scankeys + i, subkey, sizeof(ScanKeyData));
 
 			/*
@@ -993,6 +1033,12 @@ _bt_first(IndexScanDesc scan, ScanDirection dir)
 		 * because nothing finer to lock exists.
 		 */
 		PredicateLockRelation(rel, scan->xs_snapshot);
+
+		/*
+		 * mark parallel scan as done, so that all the workers can finish
+		 * their scan
+		 */
+		_bt_parallel_done(scan);
 		return false;
 	}
 	else
@@ -1060,6 +1106,7 @@ _bt_first(IndexScanDesc scan, ScanDirection dir)
 		_bt_drop_lock_and_maybe_pin(scan, &so->currPos);
 	}
 
+readcomplete:
 	/* OK, itemIndex says what to return */
 	currItem = &so->currPos.items[so->currPos.itemIndex];
 	scan->xs_ctup.t_self = currItem->heapTid;
@@ -1127,6 +1174,9 @@ _bt_next(IndexScanDesc scan, ScanDirection dir)
  * they are updated as appropriate.  All other fields of so->currPos are
  * initialized from scratch here.
  *
+ * In a parallel scan, the caller must have seized the scan; we hand the
+ * next page on to the other participants before reading this one.
+ *
  * We scan the current page starting at offnum and moving in the indicated
  * direction.  All items matching the scan keys are loaded into currPos.items.
  * moreLeft or moreRight (as appropriate) is cleared if _bt_checkkeys reports
@@ -1154,6 +1204,14 @@ _bt_readpage(IndexScanDesc scan, ScanDirection dir, OffsetNumber offnum)
 
 	page = BufferGetPage(so->currPos.buf);
 	opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+
+	/* allow next page be processed by parallel worker */
+	if (scan->parallel_scan)
+	{
+		Assert(ScanDirectionIsForward(dir));
+		_bt_parallel_release(scan, opaque->btpo_next);
+	}
+
 	minoff = P_FIRSTDATAKEY(opaque);
 	maxoff = PageGetMaxOffsetNumber(page);
 
@@ -1323,45 +1381,37 @@ _bt_steppage(IndexScanDesc scan, ScanDirection dir)
 
 	if (ScanDirectionIsForward(dir))
 	{
-		/* Walk right to the next page with data */
-		/* We must rely on the previously saved nextPage link! */
-		BlockNumber blkno = so->currPos.nextPage;
-
-		/* Remember we left a page with data */
-		so->currPos.moreLeft = true;
-
-		/* release the previous buffer, if pinned */
-		BTScanPosUnpinIfPinned(so->currPos);
+		BlockNumber blkno;
 
-		for (;;)
+		if (scan->parallel_scan != NULL)
 		{
-			/* if we're at end of scan, give up */
-			if (blkno == P_NONE || !so->currPos.moreRight)
+			/*
+			 * Seize the scan to get the next block number; if the scan has
+			 * ended already, bail out.
+			 */
+			if (!_bt_parallel_seize(scan, &blkno))
 			{
+				/* release the previous buffer, if pinned */
+				BTScanPosUnpinIfPinned(so->currPos);
 				BTScanPosInvalidate(so->currPos);
 				return false;
 			}
-			/* check for interrupts while we're not holding any buffer lock */
-			CHECK_FOR_INTERRUPTS();
-			/* step right one page */
-			so->currPos.buf = _bt_getbuf(rel, blkno, BT_READ);
-			/* check for deleted page */
-			page = BufferGetPage(so->currPos.buf);
-			TestForOldSnapshot(scan->xs_snapshot, rel, page);
-			opaque = (BTPageOpaque) PageGetSpecialPointer(page);
-			if (!P_IGNORE(opaque))
-			{
-				PredicateLockPage(rel, blkno, scan->xs_snapshot);
-				/* see if there are any matches on this page */
-				/* note that this will clear moreRight if we can stop */
-				if (_bt_readpage(scan, dir, P_FIRSTDATAKEY(opaque)))
-					break;
-			}
-
-			/* nope, keep going */
-			blkno = opaque->btpo_next;
-			_bt_relbuf(rel, so->currPos.buf);
 		}
+		else
+		{
+			/* Walk right to the next page with data */
+			/* We must rely on the previously saved nextPage link! */
+			blkno = so->currPos.nextPage;
+		}
+
+		/* Remember we left a page with data */
+		so->currPos.moreLeft = true;
+
+		/* release the previous buffer, if pinned */
+		BTScanPosUnpinIfPinned(so->currPos);
+
+		if (!_bt_readnextpage(scan, blkno))
+			return false;
 	}
 	else
 	{
@@ -1441,6 +1491,108 @@ _bt_steppage(IndexScanDesc scan, ScanDirection dir)
 	return true;
 }
 
+/*
+ *	_bt_readnextpage() -- Read the first page with data right of a page
+ *
+ * On entry, no buffer of the scan is pinned.  blkno is the page to start
+ * from: the saved right-link of the current page, or in a parallel scan
+ * the page we seized.
+ *
+ * On success exit, so->currPos is updated to contain data from that page,
+ * which is pinned and read-locked.  We return TRUE to indicate success.
+ * If there are no more matching records, we set so->currPos.buf to
+ * InvalidBuffer and return FALSE; a parallel scan is then marked done.
+ */
+static bool
+_bt_readnextpage(IndexScanDesc scan, BlockNumber blkno)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+	Relation	rel = scan->indexRelation;
+	Page		page;
+	BTPageOpaque opaque;
+
+	for (;;)
+	{
+		/*
+		 * if we're at end of scan, give up and mark parallel scan as done, so
+		 * that all the workers can finish their scan
+		 */
+		if (blkno == P_NONE || !so->currPos.moreRight)
+		{
+			_bt_parallel_done(scan);
+			BTScanPosInvalidate(so->currPos);
+			return false;
+		}
+		/* check for interrupts while we're not holding any buffer lock */
+		CHECK_FOR_INTERRUPTS();
+		/* step right one page */
+		so->currPos.buf = _bt_getbuf(rel, blkno, BT_READ);
+		/* check for deleted page */
+		page = BufferGetPage(so->currPos.buf);
+		TestForOldSnapshot(scan->xs_snapshot, rel, page);
+		opaque = (BTPageOpaque) PageGetSpecialPointer(page);
+		if (!P_IGNORE(opaque))
+		{
+			PredicateLockPage(rel, blkno, scan->xs_snapshot);
+			/* see if there are any matches on this page */
+			/* note that this will clear moreRight if we can stop */
+			if (_bt_readpage(scan, ForwardScanDirection,
+							 P_FIRSTDATAKEY(opaque)))
+				break;
+		}
+		else if (scan->parallel_scan != NULL)
+		{
+			/* allow next page be processed by parallel worker */
+			_bt_parallel_release(scan, opaque->btpo_next);
+		}
+
+		/* nope, keep going */
+		if (scan->parallel_scan != NULL)
+		{
+			_bt_relbuf(rel, so->currPos.buf);
+			if (!_bt_parallel_seize(scan, &blkno))
+			{
+				BTScanPosInvalidate(so->currPos);
+				return false;
+			}
+		}
+		else
+		{
+			blkno = opaque->btpo_next;
+			_bt_relbuf(rel, so->currPos.buf);
+		}
+	}
+
+	return true;
+}
+
+/*
+ *	_bt_parallel_readpage() -- Read the page a parallel scan has handed us,
+ *		or the first page with data right of it
+ *
+ * On success, release lock and maybe pin on buffer.  We return TRUE to
+ * indicate success.
+ */
+static bool
+_bt_parallel_readpage(IndexScanDesc scan, BlockNumber blkno)
+{
+	BTScanOpaque so = (BTScanOpaque) scan->opaque;
+
+	/* initialize moreLeft/moreRight for a forward scan */
+	so->currPos.moreLeft = false;
+	so->currPos.moreRight = true;
+	so->numKilled = 0;			/* just paranoia */
+	so->markItemIndex = -1;		/* ditto */
+
+	if (!_bt_readnextpage(scan, blkno))
+		return false;
+
+	/* Drop the lock, and maybe the pin, on the current page */
+	_bt_drop_lock_and_maybe_pin(scan, &so->currPos);
+
+	return true;
+}
+
 /*
  * _bt_walk_left() -- step left one page, if possible
  *
@@ -1681,6 +1833,7 @@ _bt_endpoint(IndexScanDesc scan, ScanDirection dir)
 		 * exists.
 		 */
 		PredicateLockRelation(rel, scan->xs_snapshot);
+		_bt_parallel_done(scan);
 		BTScanPosInvalidate(so->currPos);
 		return false;
 	}
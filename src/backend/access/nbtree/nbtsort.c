@@ -55,6 +55,15 @@
  * This code isn't concerned about the FSM at all. The caller is responsible
  * for initializing that.
  *
+ * A non-unique index on a large table can be built in parallel, if
+ * max_parallel_maintenance_workers allows.  Each worker then scans a
+ * disjoint set of heap pages, sorts its index tuples in its own tuplesort,
+ * and streams the sorted run to the leader through a shm_mq.  The leader
+ * doesn't sort anything itself; it merges the runs as it loads the leaf
+ * pages, exactly as it would read them from a single tuplesort.  Unique
+ * indexes are always built serially, since uniqueness violations between
+ * tuples sorted by different workers would only show up during the merge.
+ *
  * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -67,16 +76,54 @@
 #include "postgres.h"
 
 #include "access/nbtree.h"
+#include "access/parallel.h"
+#include "access/relscan.h"
+#include "access/xact.h"
 #include "access/xlog.h"
 #include "access/xloginsert.h"
+#include "catalog/catalog.h"
+#include "catalog/index.h"
+#include "lib/binaryheap.h"
 #include "miscadmin.h"
+#include "optimizer/paths.h"
+#include "storage/dsm_impl.h"
 #include "storage/smgr.h"
+#include "storage/spin.h"
 #include "tcop/tcopprot.h"
 #include "utils/rel.h"
 #include "utils/sortsupport.h"
 #include "utils/tuplesort.h"
 
 
+/* Magic numbers for parallel index build shared memory */
+#define PARALLEL_KEY_BTREE_SHARED		UINT64CONST(0xB000000000000001)
+#define PARALLEL_KEY_BTREE_HEAPSCAN		UINT64CONST(0xB000000000000002)
+#define PARALLEL_KEY_BTREE_QUEUES		UINT64CONST(0xB000000000000003)
+
+/* Size of the queue through which each worker sends its sorted run */
+#define PARALLEL_BTREE_QUEUE_SIZE		65536
+
+/*
+ * Status shared by the leader and the workers of a parallel index build.
+ * The scan of the heap is coordinated by a ParallelHeapScanDesc stored
+ * separately in the same segment.
+ */
+typedef struct BTShared
+{
+	/* immutable state, set up by the leader */
+	Oid			heaprelid;
+	Oid			indexrelid;
+	int			sortmem;		/* sort memory of each worker, in kB */
+
+	/* mutable state, updated by each worker once it has sent its run */
+	slock_t		mutex;
+	int			nparticipantsdone;
+	double		reltuples;
+	double		indtuples;
+	bool		brokenhotchain;
+} BTShared;
+
+
 /*
  * Status record for spooling/sorting phase.  (Note we may have two of
  * these due to the special requirements for uniqueness-checking with
@@ -88,8 +135,26 @@ struct BTSpool
 	Relation	heap;
 	Relation	index;
 	bool		isunique;
+
+	/* only in the leader of a parallel build, sortstate is NULL then */
+	ParallelContext *pcxt;
+	BTShared   *btshared;
+	int			nqueues;		/* # of launched workers */
+	shm_mq_handle **queues;		/* their sorted runs */
+	double		nreceived;		/* # of index tuples merged */
 };
 
+/*
+ * Working state of the leader merging the sorted runs of the workers.
+ */
+typedef struct BTMergeState
+{
+	TupleDesc	tupdes;
+	int			keysz;
+	SortSupport sortKeys;
+	IndexTuple *tuples;			/* current tuple of each run, or NULL */
+} BTMergeState;
+
 /*
  * Status record for a btree page being built.  We have one of these
  * for each active tree level.
@@ -138,6 +203,14 @@ static void _bt_buildadd(BTWriteState *wstate, BTPageState *state,
 static void _bt_uppershutdown(BTWriteState *wstate, BTPageState *state);
 static void _bt_load(BTWriteState *wstate,
 		 BTSpool *btspool, BTSpool *btspool2);
+static SortSupport _bt_sortsupport(Relation index);
+static int32 _bt_sortcompare(IndexTuple itup, IndexTuple itup2,
+				int keysz, TupleDesc tupdes, SortSupport sortKeys);
+static IndexTuple _bt_parallel_receive(BTSpool *btspool, int i);
+static int	_bt_merge_compare(Datum a, Datum b, void *arg);
+static void _bt_parallel_callback(Relation index, HeapTuple htup,
+					  Datum *values, bool *isnull,
+					  bool tupleIsAlive, void *state);
 
 
 /*
@@ -179,7 +252,14 @@ _bt_spoolinit(Relation heap, Relation index, bool isunique, bool isdead)
 void
 _bt_spooldestroy(BTSpool *btspool)
 {
-	tuplesort_end(btspool->sortstate);
+	if (btspool->pcxt != NULL)
+	{
+		DestroyParallelContext(btspool->pcxt);
+		ExitParallelMode();
+		pfree(btspool->queues);
+	}
+	else
+		tuplesort_end(btspool->sortstate);
 	pfree(btspool);
 }
 
@@ -210,7 +290,9 @@ _bt_leafbuild(BTSpool *btspool, BTSpool *btspool2)
 	}
 #endif   /* BTREE_BUILD_STATS */
 
-	tuplesort_performsort(btspool->sortstate);
+	/* the runs of a parallel build are already sorted by the workers */
+	if (btspool->pcxt == NULL)
+		tuplesort_performsort(btspool->sortstate);
 	if (btspool2)
 		tuplesort_performsort(btspool2->sortstate);
 
@@ -236,6 +318,93 @@ _bt_leafbuild(BTSpool *btspool, BTSpool *btspool2)
  * Internal routines.
  */
 
+/*
+ * Prepare SortSupport data for each column of the index, for comparing
+ * index tuples the way tuplesort.c sorted them.
+ */
+static SortSupport
+_bt_sortsupport(Relation index)
+{
+	int			keysz = RelationGetNumberOfAttributes(index);
+	ScanKey		indexScanKey = _bt_mkscankey_nodata(index);
+	SortSupport sortKeys;
+	int			i;
+
+	sortKeys = (SortSupport) palloc0(keysz * sizeof(SortSupportData));
+
+	for (i = 0; i < keysz; i++)
+	{
+		SortSupport sortKey = sortKeys + i;
+		ScanKey		scanKey = indexScanKey + i;
+		int16		strategy;
+
+		sortKey->ssup_cxt = CurrentMemoryContext;
+		sortKey->ssup_collation = scanKey->sk_collation;
+		sortKey->ssup_nulls_first =
+			(scanKey->sk_flags & SK_BT_NULLS_FIRST) != 0;
+		sortKey->ssup_attno = scanKey->sk_attno;
+		/* Abbreviation is not supported here */
+		sortKey->abbreviate = false;
+
+		AssertState(sortKey->ssup_attno != 0);
+
+		strategy = (scanKey->sk_flags & SK_BT_DESC) != 0 ?
+			BTGreaterStrategyNumber : BTLessStrategyNumber;
+
+		PrepareSortSupportFromIndexRel(index, strategy, sortKey);
+	}
+
+	_bt_freeskey(indexScanKey);
+
+	return sortKeys;
+}
+
+/*
+ * Compare two index tuples column by column.
+ */
+static int32
+_bt_sortcompare(IndexTuple itup, IndexTuple itup2,
+				int keysz, TupleDesc tupdes, SortSupport sortKeys)
+{
+	int			i;
+
+	for (i = 1; i <= keysz; i++)
+	{
+		SortSupport entry;
+		Datum		attrDatum1,
+					attrDatum2;
+		bool		isNull1,
+					isNull2;
+		int32		compare;
+
+		entry = sortKeys + i - 1;
+		attrDatum1 = index_getattr(itup, i, tupdes, &isNull1);
+		attrDatum2 = index_getattr(itup2, i, tupdes, &isNull2);
+
+		compare = ApplySortComparator(attrDatum1, isNull1,
+									  attrDatum2, isNull2,
+									  entry);
+		if (compare != 0)
+			return compare;
+	}
+	return 0;
+}
+
+/*
+ * binaryheap comparator for the runs of a parallel build.  binaryheap keeps
+ * the largest element first, so the order is inverted.
+ */
+static int
+_bt_merge_compare(Datum a, Datum b, void *arg)
+{
+	BTMergeState *mstate = (BTMergeState *) arg;
+
+	return -_bt_sortcompare(mstate->tuples[DatumGetInt32(a)],
+							mstate->tuples[DatumGetInt32(b)],
+							mstate->keysz, mstate->tupdes, mstate->sortKeys);
+}
+
+
 
 /*
  * allocate workspace for a new, clean btree page, not linked to any siblings.
@@ -686,7 +855,6 @@ _bt_load(BTWriteState *wstate, BTSpool *btspool, BTSpool *btspool2)
 	TupleDesc	tupdes = RelationGetDescr(wstate->index);
 	int			i,
 				keysz = RelationGetNumberOfAttributes(wstate->index);
-	ScanKey		indexScanKey = NULL;
 	SortSupport sortKeys;
 
 	if (merge)
@@ -701,34 +869,7 @@ _bt_load(BTWriteState *wstate, BTSpool *btspool, BTSpool *btspool2)
 									   true, &should_free);
 		itup2 = tuplesort_getindextuple(btspool2->sortstate,
 										true, &should_free2);
-		indexScanKey = _bt_mkscankey_nodata(wstate->index);
-
-		/* Prepare SortSupport data for each column */
-		sortKeys = (SortSupport) palloc0(keysz * sizeof(SortSupportData));
-
-		for (i = 0; i < keysz; i++)
-		{
-			SortSupport sortKey = sortKeys + i;
-			ScanKey		scanKey = indexScanKey + i;
-			int16		strategy;
-
-			sortKey->ssup_cxt = CurrentMemoryContext;
-			sortKey->ssup_collation = scanKey->sk_collation;
-			sortKey->ssup_nulls_first =
-				(scanKey->sk_flags & SK_BT_NULLS_FIRST) != 0;
-			sortKey->ssup_attno = scanKey->sk_attno;
-			/* Abbreviation is not supported here */
-			sortKey->abbreviate = false;
-
-			AssertState(sortKey->ssup_attno != 0);
-
-			strategy = (scanKey->sk_flags & SK_BT_DESC) != 0 ?
-				BTGreaterStrategyNumber : BTLessStrategyNumber;
-
-			PrepareSortSupportFromIndexRel(wstate->index, strategy, sortKey);
-		}
-
-		_bt_freeskey(indexScanKey);
+		sortKeys = _bt_sortsupport(wstate->index);
 
 		for (;;)
 		{
@@ -740,30 +881,8 @@ _bt_load(BTWriteState *wstate, BTSpool *btspool, BTSpool *btspool2)
 			}
 			else if (itup != NULL)
 			{
-				for (i = 1; i <= keysz; i++)
-				{
-					SortSupport entry;
-					Datum		attrDatum1,
-								attrDatum2;
-					bool		isNull1,
-								isNull2;
-					int32		compare;
-
-					entry = sortKeys + i - 1;
-					attrDatum1 = index_getattr(itup, i, tupdes, &isNull1);
-					attrDatum2 = index_getattr(itup2, i, tupdes, &isNull2);
-
-					compare = ApplySortComparator(attrDatum1, isNull1,
-												  attrDatum2, isNull2,
-												  entry);
-					if (compare > 0)
-					{
-						load1 = false;
-						break;
-					}
-					else if (compare < 0)
-						break;
-				}
+				if (_bt_sortcompare(itup, itup2, keysz, tupdes, sortKeys) > 0)
+					load1 = false;
 			}
 			else
 				load1 = false;
@@ -791,6 +910,52 @@ _bt_load(BTWriteState *wstate, BTSpool *btspool, BTSpool *btspool2)
 		}
 		pfree(sortKeys);
 	}
+	else if (btspool->pcxt != NULL)
+	{
+		/*
+		 * Parallel build: merge the sorted runs of the workers, using a heap
+		 * of the runs ordered by their current tuple.
+		 */
+		BTMergeState mstate;
+		binaryheap *runs;
+
+		mstate.tupdes = tupdes;
+		mstate.keysz = keysz;
+		mstate.sortKeys = _bt_sortsupport(wstate->index);
+		mstate.tuples = (IndexTuple *) palloc(btspool->nqueues *
+											  sizeof(IndexTuple));
+		runs = binaryheap_allocate(btspool->nqueues, _bt_merge_compare,
+								   &mstate);
+
+		for (i = 0; i < btspool->nqueues; i++)
+		{
+			mstate.tuples[i] = _bt_parallel_receive(btspool, i);
+			if (mstate.tuples[i] != NULL)
+				binaryheap_add_unordered(runs, Int32GetDatum(i));
+		}
+		binaryheap_build(runs);
+
+		while (!binaryheap_empty(runs))
+		{
+			i = DatumGetInt32(binaryheap_first(runs));
+
+			/* When we see first tuple, create first index page */
+			if (state == NULL)
+				state = _bt_pagestate(wstate, 0);
+
+			/* _bt_buildadd copies the tuple, so the queue can reuse it */
+			_bt_buildadd(wstate, state, mstate.tuples[i]);
+
+			mstate.tuples[i] = _bt_parallel_receive(btspool, i);
+			if (mstate.tuples[i] != NULL)
+				binaryheap_replace_first(runs, Int32GetDatum(i));
+			else
+				(void) binaryheap_remove_first(runs);
+		}
+		binaryheap_free(runs);
+		pfree(mstate.tuples);
+		pfree(mstate.sortKeys);
+	}
 	else
 	{
 		/* merge is unnecessary */
@@ -831,3 +996,286 @@ _bt_load(BTWriteState *wstate, BTSpool *btspool, BTSpool *btspool2)
 		smgrimmedsync(wstate->index->rd_smgr, MAIN_FORKNUM);
 	}
 }
+
+
+/*
+ * Parallel index build support.
+ */
+
+/*
+ * Per-worker state of the heap scan feeding a worker's tuplesort.
+ */
+typedef struct BTWorkerState
+{
+	Tuplesortstate *sortstate;
+	Relation	index;
+	double		indtuples;
+} BTWorkerState;
+
+/*
+ * Try to start a parallel build of the index.
+ *
+ * If the build qualifies and at least one worker could be launched, returns
+ * a spool through which _bt_leafbuild merges the sorted runs of the workers;
+ * the workers are scanning the heap by then.  Otherwise returns NULL and the
+ * caller builds the index serially.
+ */
+BTSpool *
+_bt_parallel_spoolinit(Relation heap, Relation index,
+					   struct IndexInfo *indexInfo)
+{
+	int			nworkers = max_parallel_maintenance_workers;
+	ParallelContext *pcxt;
+	BTShared   *btshared;
+	ParallelHeapScanDesc pscan;
+	char	   *queuespace;
+	shm_mq_handle **queues;
+	BTSpool    *btspool;
+	int			i;
+
+	/*
+	 * Workers compute index tuples themselves, so expressions and predicates
+	 * (which might not be parallel safe) are left to the serial build, as
+	 * are the cases where the heap scan needs anything else than SnapshotAny
+	 * or the table isn't visible to other backends.  Small tables aren't
+	 * worth the startup cost.
+	 */
+	if (nworkers <= 0 ||
+		dynamic_shared_memory_type == DSM_IMPL_NONE ||
+		!IsUnderPostmaster ||
+		IsBootstrapProcessingMode() ||
+		IsInParallelMode() ||
+		indexInfo->ii_Unique ||
+		indexInfo->ii_Concurrent ||
+		indexInfo->ii_ExclusionOps != NULL ||
+		indexInfo->ii_Expressions != NIL ||
+		indexInfo->ii_Predicate != NIL ||
+		RelationUsesLocalBuffers(heap) ||
+		IsSystemRelation(heap) ||
+		RelationGetNumberOfBlocks(heap) < (BlockNumber) min_parallel_relation_size)
+		return NULL;
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext(_bt_parallel_build_main, nworkers);
+
+	shm_toc_estimate_chunk(&pcxt->estimator, sizeof(BTShared));
+	shm_toc_estimate_chunk(&pcxt->estimator,
+						   heap_parallelscan_estimate(SnapshotAny));
+	shm_toc_estimate_chunk(&pcxt->estimator,
+						   mul_size(PARALLEL_BTREE_QUEUE_SIZE, nworkers));
+	shm_toc_estimate_keys(&pcxt->estimator, 3);
+
+	InitializeParallelDSM(pcxt);
+
+	btshared = (BTShared *) shm_toc_allocate(pcxt->toc, sizeof(BTShared));
+	btshared->heaprelid = RelationGetRelid(heap);
+	btshared->indexrelid = RelationGetRelid(index);
+	btshared->sortmem = Max(maintenance_work_mem / nworkers, 64);
+	SpinLockInit(&btshared->mutex);
+	btshared->nparticipantsdone = 0;
+	btshared->reltuples = 0;
+	btshared->indtuples = 0;
+	btshared->brokenhotchain = false;
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_BTREE_SHARED, btshared);
+
+	pscan = (ParallelHeapScanDesc)
+		shm_toc_allocate(pcxt->toc, heap_parallelscan_estimate(SnapshotAny));
+	heap_parallelscan_initialize(pscan, heap, SnapshotAny);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_BTREE_HEAPSCAN, pscan);
+
+	queuespace = shm_toc_allocate(pcxt->toc,
+							mul_size(PARALLEL_BTREE_QUEUE_SIZE, nworkers));
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_BTREE_QUEUES, queuespace);
+
+	/* pcxt->nworkers is zero if there was no room for a DSM segment */
+	queues = (shm_mq_handle **) palloc(Max(pcxt->nworkers, 1) *
+									   sizeof(shm_mq_handle *));
+	for (i = 0; i < pcxt->nworkers; i++)
+	{
+		shm_mq	   *mq;
+
+		mq = shm_mq_create(queuespace + (Size) i * PARALLEL_BTREE_QUEUE_SIZE,
+						   (Size) PARALLEL_BTREE_QUEUE_SIZE);
+		shm_mq_set_receiver(mq, MyProc);
+		queues[i] = shm_mq_attach(mq, pcxt->seg, NULL);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	if (pcxt->nworkers_launched == 0)
+	{
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		pfree(queues);
+		return NULL;
+	}
+
+	/* let the queues notice workers that die without attaching */
+	for (i = 0; i < pcxt->nworkers_launched; i++)
+		shm_mq_set_handle(queues[i], pcxt->worker[i].bgwhandle);
+
+	btspool = (BTSpool *) palloc0(sizeof(BTSpool));
+	btspool->heap = heap;
+	btspool->index = index;
+	btspool->isunique = false;
+	btspool->pcxt = pcxt;
+	btspool->btshared = btshared;
+	btspool->nqueues = pcxt->nworkers_launched;
+	btspool->queues = queues;
+	btspool->nreceived = 0;
+
+	return btspool;
+}
+
+/*
+ * Wait for the workers of a parallel build merged by _bt_leafbuild, and
+ * collect their statistics.  Returns the number of heap tuples scanned and
+ * sets *indtuples to the number of index tuples.
+ *
+ * A worker detaching from its queue looks just like the end of its run to
+ * the merge, so this also verifies that every worker has actually sent all
+ * of its tuples; errors raised by the workers are rethrown here.
+ */
+double
+_bt_parallel_spoolfinish(BTSpool *btspool, struct IndexInfo *indexInfo,
+						 double *indtuples)
+{
+	BTShared   *btshared = btspool->btshared;
+
+	Assert(btspool->pcxt != NULL);
+
+	WaitForParallelWorkersToFinish(btspool->pcxt);
+
+	if (btshared->nparticipantsdone != btspool->nqueues ||
+		btshared->indtuples != btspool->nreceived)
+		elog(ERROR, "parallel workers did not complete build of index \"%s\"",
+			 RelationGetRelationName(btspool->index));
+
+	if (btshared->brokenhotchain)
+		indexInfo->ii_BrokenHotChain = true;
+
+	*indtuples = btshared->indtuples;
+	return btshared->reltuples;
+}
+
+/*
+ * Fetch the next tuple of the i'th worker's sorted run, or NULL at its end.
+ *
+ * The tuple stays valid until the next call for the same run.
+ */
+static IndexTuple
+_bt_parallel_receive(BTSpool *btspool, int i)
+{
+	shm_mq_result res;
+	Size		nbytes;
+	void	   *data;
+
+	res = shm_mq_receive(btspool->queues[i], &nbytes, &data, false);
+	if (res != SHM_MQ_SUCCESS)
+		return NULL;
+
+	Assert(nbytes == IndexTupleSize((IndexTuple) data));
+	btspool->nreceived += 1;
+	return (IndexTuple) data;
+}
+
+/*
+ * Main entrypoint of a parallel index build worker.
+ *
+ * Scans its share of the heap, sorts the index tuples and sends them, in
+ * order, to the leader.
+ */
+void
+_bt_parallel_build_main(dsm_segment *seg, shm_toc *toc)
+{
+	BTShared   *btshared;
+	ParallelHeapScanDesc pscan;
+	char	   *queuespace;
+	shm_mq	   *mq;
+	shm_mq_handle *mqh;
+	Relation	heap;
+	Relation	index;
+	IndexInfo  *indexInfo;
+	BTWorkerState wstate;
+	IndexTuple	itup;
+	bool		should_free;
+	bool		complete = true;
+	double		reltuples;
+
+	btshared = shm_toc_lookup(toc, PARALLEL_KEY_BTREE_SHARED);
+	pscan = shm_toc_lookup(toc, PARALLEL_KEY_BTREE_HEAPSCAN);
+	queuespace = shm_toc_lookup(toc, PARALLEL_KEY_BTREE_QUEUES);
+
+	mq = (shm_mq *) (queuespace +
+					 (Size) ParallelWorkerNumber * PARALLEL_BTREE_QUEUE_SIZE);
+	shm_mq_set_sender(mq, MyProc);
+	mqh = shm_mq_attach(mq, seg, NULL);
+
+	/* the leader holds the same locks, they don't conflict within the group */
+	heap = heap_open(btshared->heaprelid, ShareLock);
+	index = index_open(btshared->indexrelid, RowExclusiveLock);
+	indexInfo = BuildIndexInfo(index);
+
+	wstate.sortstate = tuplesort_begin_index_btree(heap, index, false,
+												   btshared->sortmem, false);
+	wstate.index = index;
+	wstate.indtuples = 0;
+
+	reltuples = IndexBuildHeapParallelScan(heap, index, indexInfo, pscan,
+										   _bt_parallel_callback,
+										   (void *) &wstate);
+
+	tuplesort_performsort(wstate.sortstate);
+
+	while ((itup = tuplesort_getindextuple(wstate.sortstate,
+										   true, &should_free)) != NULL)
+	{
+		shm_mq_result res;
+
+		res = shm_mq_send(mqh, IndexTupleSize(itup), itup, false);
+		if (should_free)
+			pfree(itup);
+		if (res != SHM_MQ_SUCCESS)
+		{
+			/* the leader has gone away, nobody is interested in the rest */
+			complete = false;
+			break;
+		}
+	}
+
+	if (complete)
+	{
+		SpinLockAcquire(&btshared->mutex);
+		btshared->nparticipantsdone++;
+		btshared->reltuples += reltuples;
+		btshared->indtuples += wstate.indtuples;
+		if (indexInfo->ii_BrokenHotChain)
+			btshared->brokenhotchain = true;
+		SpinLockRelease(&btshared->mutex);
+	}
+
+	/* end of our run */
+	shm_mq_detach(mq);
+
+	tuplesort_end(wstate.sortstate);
+	index_close(index, RowExclusiveLock);
+	heap_close(heap, ShareLock);
+}
+
+/*
+ * Per-tuple callback of a worker's heap scan.
+ */
+static void
+_bt_parallel_callback(Relation index,
+					  HeapTuple htup,
+					  Datum *values,
+					  bool *isnull,
+					  bool tupleIsAlive,
+					  void *state)
+{
+	BTWorkerState *wstate = (BTWorkerState *) state;
+
+	tuplesort_putindextuplevalues(wstate->sortstate, wstate->index,
+								  &htup->t_self, values, isnull);
+	wstate->indtuples += 1;
+}
@@ -303,6 +303,23 @@ xact_desc_assignment(StringInfo buf, xl_xact_assignment *xlrec)
 		appendStringInfo(buf, " %u", xlrec->xsub[i]);
 }
 
+static void
+xact_desc_3pc_state(StringInfo buf, xl_xact_3pc_state *xlrec)
+{
+	char	   *ptr = (char *) xlrec + MinSizeOfXact3PCState;
+	int			i;
+
+	appendStringInfo(buf, "state %s; xacts:", xlrec->state_3pc);
+
+	for (i = 0; i < xlrec->nxacts; i++)
+	{
+		xl_xact_3pc_state_xact *xact = (xl_xact_3pc_state_xact *) ptr;
+
+		appendStringInfo(buf, " %u '%s'", xact->xid, xact->gid);
+		ptr += SizeOfXact3PCStateXact(strlen(xact->gid));
+	}
+}
+
 void
 xact_desc(StringInfo buf, XLogReaderState *record)
 {
@@ -335,6 +352,10 @@ xact_desc(StringInfo buf, XLogReaderState *record)
 		appendStringInfo(buf, "xtop %u: ", xlrec->xtop);
 		xact_desc_assignment(buf, xlrec);
 	}
+	else if (info == XLOG_XACT_3PC_STATE)
+	{
+		xact_desc_3pc_state(buf, (xl_xact_3pc_state *) rec);
+	}
 }
 
 const char *
@@ -362,6 +383,9 @@ xact_identify(uint8 info)
 		case XLOG_XACT_ASSIGNMENT:
 			id = "ASSIGNMENT";
 			break;
+		case XLOG_XACT_3PC_STATE:
+			id = "3PC_STATE";
+			break;
 	}
 
 	return id;
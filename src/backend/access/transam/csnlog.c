@@ -0,0 +1,487 @@
+/*-------------------------------------------------------------------------
+ *
+ * csnlog.c
+ *		PostgreSQL commit-sequence-number log manager
+ *
+ * When csn_snapshots is enabled, every transaction commit is assigned a
+ * commit sequence number (CSN) from a shared 64-bit counter, and the
+ * pg_csnlog manager remembers the CSN of each committed XID.  An MVCC
+ * snapshot then needs nothing but the value of the counter at the time
+ * it was taken: an XID is visible to the snapshot if and only if it
+ * committed with a smaller CSN.  Taking a snapshot therefore does not
+ * need to scan the proc array for running XIDs.
+ *
+ * Like pg_subtrans, pg_csnlog is only needed for XIDs that may still be
+ * interesting to some running snapshot, so there are no XLOG interactions
+ * and nothing is preserved across a restart.  At startup we zero the
+ * currently-active pages and remember where the log begins; XIDs older
+ * than that are answered from pg_clog and the proc array instead.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/transam/csnlog.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/csnlog.h"
+#include "access/slru.h"
+#include "access/transam.h"
+#include "access/xlog.h"
+#include "access/xtm.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "storage/procarray.h"
+#include "storage/shmem.h"
+#include "utils/snapmgr.h"
+
+
+/*
+ * Defines for CSNLog page sizes.  A page is the same BLCKSZ as is used
+ * everywhere else in Postgres.
+ *
+ * Note: because TransactionIds are 32 bits and wrap around at 0xFFFFFFFF,
+ * CSNLog page numbering also wraps around at
+ * 0xFFFFFFFF/CSNLOG_XACTS_PER_PAGE, and segment numbering at
+ * 0xFFFFFFFF/CSNLOG_XACTS_PER_PAGE/SLRU_PAGES_PER_SEGMENT.  We need take no
+ * explicit notice of that fact in this module, except when comparing segment
+ * and page numbers in TruncateCSNLog (see CSNLogPagePrecedes) and zeroing
+ * them in StartupCSNLog.
+ */
+
+/* We need eight bytes per xact */
+#define CSNLOG_XACTS_PER_PAGE (BLCKSZ / sizeof(CommitSeqNo))
+
+#define TransactionIdToPage(xid) ((xid) / (TransactionId) CSNLOG_XACTS_PER_PAGE)
+#define TransactionIdToEntry(xid) ((xid) % (TransactionId) CSNLOG_XACTS_PER_PAGE)
+
+
+/*
+ * Link to shared-memory data structures for CSNLog control
+ */
+static SlruCtlData CSNLogCtlData;
+
+#define CSNLogCtl  (&CSNLogCtlData)
+
+/*
+ * Shared state, besides the SLRU buffers.
+ *
+ * nextCSN is only advanced while holding CSNLogControlLock exclusively, so
+ * that nobody can observe a CSN that has been handed out but not yet stored.
+ * It is read without any lock when taking a snapshot.
+ *
+ * oldestXid and startupXid are set once by StartupCSNLog: XIDs before
+ * oldestXid finished before startup, and XIDs in [oldestXid, startupXid) are
+ * either prepared transactions or finished before startup.
+ */
+typedef struct CSNLogSharedData
+{
+	pg_atomic_uint64 nextCSN;
+	TransactionId oldestXid;
+	TransactionId startupXid;
+	bool		started;
+} CSNLogSharedData;
+
+static CSNLogSharedData *CSNLogShared = NULL;
+
+/* GUC variable */
+bool		csn_snapshots = false;
+
+static void CSNLogSetCommitSeqNo(TransactionId xid, CommitSeqNo csn);
+static int	ZeroCSNLogPage(int pageno);
+static bool CSNLogPagePrecedes(int page1, int page2);
+
+
+/*
+ * Is the CSN log being maintained?  It is not during recovery, nor when
+ * csn_snapshots is off.
+ */
+bool
+CSNLogActive(void)
+{
+	return csn_snapshots && CSNLogShared->started;
+}
+
+/*
+ * Record the final state of a transaction tree.
+ *
+ * This is installed as SetTransactionStatus method of the CSN transaction
+ * manager.  Commits are made visible in pg_clog and get their CSN under
+ * CSNLogControlLock, so concurrent snapshots see both or neither.  Any
+ * other status change is passed straight to pg_clog.
+ */
+void
+CsnTransactionIdSetTreeStatus(TransactionId xid, int nsubxids,
+				   TransactionId *subxids, XidStatus status, XLogRecPtr lsn)
+{
+	CommitSeqNo csn;
+	int			i;
+
+	if (status != TRANSACTION_STATUS_COMMITTED || !CSNLogActive())
+	{
+		PgTransactionIdSetTreeStatus(xid, nsubxids, subxids, status, lsn);
+		return;
+	}
+
+	LWLockAcquire(CSNLogControlLock, LW_EXCLUSIVE);
+
+	PgTransactionIdSetTreeStatus(xid, nsubxids, subxids, status, lsn);
+
+	csn = pg_atomic_fetch_add_u64(&CSNLogShared->nextCSN, 1);
+
+	CSNLogSetCommitSeqNo(xid, csn);
+	for (i = 0; i < nsubxids; i++)
+		CSNLogSetCommitSeqNo(subxids[i], csn);
+
+	LWLockRelease(CSNLogControlLock);
+}
+
+/*
+ * Store the CSN of a single transaction.
+ *
+ * CSNLogControlLock must be held exclusively by the caller.
+ */
+static void
+CSNLogSetCommitSeqNo(TransactionId xid, CommitSeqNo csn)
+{
+	int			pageno = TransactionIdToPage(xid);
+	int			entryno = TransactionIdToEntry(xid);
+	int			slotno;
+	CommitSeqNo *ptr;
+
+	slotno = SimpleLruReadPage(CSNLogCtl, pageno, true, xid);
+	ptr = (CommitSeqNo *) CSNLogCtl->shared->page_buffer[slotno];
+	ptr += entryno;
+
+	/* Current state should be 0 */
+	Assert(*ptr == InvalidCommitSeqNo);
+
+	*ptr = csn;
+
+	CSNLogCtl->shared->page_dirty[slotno] = true;
+}
+
+/*
+ * Interrogate the CSN of a transaction in the CSN log.
+ *
+ * Returns InvalidCommitSeqNo unless the transaction committed after the log
+ * was started.
+ */
+CommitSeqNo
+CSNLogGetCommitSeqNo(TransactionId xid)
+{
+	int			pageno = TransactionIdToPage(xid);
+	int			entryno = TransactionIdToEntry(xid);
+	int			slotno;
+	CommitSeqNo csn;
+
+	if (!TransactionIdIsNormal(xid) ||
+		TransactionIdPrecedes(xid, CSNLogShared->oldestXid))
+		return InvalidCommitSeqNo;
+
+	/* lock is acquired by SimpleLruReadPage_ReadOnly */
+
+	slotno = SimpleLruReadPage_ReadOnly(CSNLogCtl, pageno, xid);
+	csn = ((CommitSeqNo *) CSNLogCtl->shared->page_buffer[slotno])[entryno];
+
+	LWLockRelease(CSNLogControlLock);
+
+	return csn;
+}
+
+/*
+ * The CSN the next committing transaction will get.  A snapshot taken now
+ * sees exactly the transactions whose CSN precedes this value.
+ */
+CommitSeqNo
+GetCurrentCommitSeqNo(void)
+{
+	return pg_atomic_read_u64(&CSNLogShared->nextCSN);
+}
+
+/*
+ * Is xid still in progress according to a CSN snapshot?
+ *
+ * The caller has already checked xid against the snapshot's xmin and xmax.
+ */
+bool
+CSNLogXidInSnapshot(TransactionId xid, CommitSeqNo snapshot_csn)
+{
+	CommitSeqNo csn;
+
+	if (TransactionIdPrecedes(xid, CSNLogShared->oldestXid))
+		return false;
+
+	csn = CSNLogGetCommitSeqNo(xid);
+
+	/*
+	 * XIDs assigned before startup that have no CSN either finished before
+	 * startup or are prepared transactions.  Once such a prepared transaction
+	 * is no longer running it must have stored its CSN, so look again.
+	 */
+	if (!CommitSeqNoIsValid(csn) &&
+		TransactionIdPrecedes(xid, CSNLogShared->startupXid))
+	{
+		if (TransactionIdIsInProgress(xid))
+			return true;
+		csn = CSNLogGetCommitSeqNo(xid);
+		if (!CommitSeqNoIsValid(csn))
+			return false;
+	}
+
+	return !CommitSeqNoIsValid(csn) || csn >= snapshot_csn;
+}
+
+
+/*
+ * Initialization of shared memory for CSNLog
+ */
+Size
+CSNLogShmemSize(void)
+{
+	if (!csn_snapshots)
+		return 0;
+	return add_size(SimpleLruShmemSize(NUM_CSNLOG_BUFFERS, 0),
+					sizeof(CSNLogSharedData));
+}
+
+void
+CSNLogShmemInit(void)
+{
+	bool		found;
+
+	if (!csn_snapshots)
+		return;
+
+	CSNLogCtl->PagePrecedes = CSNLogPagePrecedes;
+	SimpleLruInit(CSNLogCtl, "csnlog", NUM_CSNLOG_BUFFERS, 0,
+				  CSNLogControlLock, "pg_csnlog",
+				  LWTRANCHE_CSNLOG_BUFFERS);
+	/* Override default assumption that writes should be fsync'd */
+	CSNLogCtl->do_fsync = false;
+
+	CSNLogShared = ShmemInitStruct("CSNLog shared",
+								   sizeof(CSNLogSharedData),
+								   &found);
+	if (!IsUnderPostmaster)
+	{
+		Assert(!found);
+		pg_atomic_init_u64(&CSNLogShared->nextCSN, FirstNormalCommitSeqNo);
+		CSNLogShared->oldestXid = InvalidTransactionId;
+		CSNLogShared->startupXid = InvalidTransactionId;
+		CSNLogShared->started = false;
+	}
+	else
+		Assert(found);
+}
+
+/*
+ * Initialize (or reinitialize) a page of CSNLog to zeroes.
+ *
+ * The page is not actually written, just set up in shared memory.
+ * The slot number of the new page is returned.
+ *
+ * Control lock must be held at entry, and will be held at exit.
+ */
+static int
+ZeroCSNLogPage(int pageno)
+{
+	return SimpleLruZeroPage(CSNLogCtl, pageno);
+}
+
+/*
+ * This must be called ONCE at the end of recovery, after StartupXLOG has
+ * initialized ShmemVariableCache->nextXid and the prepared transactions
+ * have been recovered.
+ *
+ * oldestActiveXID is the oldest XID of any prepared transaction, or nextXid
+ * if there are none.
+ */
+void
+StartupCSNLog(TransactionId oldestActiveXID)
+{
+	int			startPage;
+	int			endPage;
+
+	if (!csn_snapshots)
+		return;
+
+	/*
+	 * The directory is not there in clusters initialized before pg_csnlog
+	 * existed; since nothing in it survives a restart, just create it.
+	 */
+	if (mkdir("pg_csnlog", S_IRWXU) < 0 && errno != EEXIST)
+		ereport(FATAL,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						"pg_csnlog")));
+
+	/*
+	 * Since we don't expect pg_csnlog to be valid across crashes, we
+	 * initialize the currently-active page(s) to zeroes during startup.
+	 * Whenever we advance into a new page, ExtendCSNLog will likewise zero
+	 * the new page without regard to whatever was previously on disk.
+	 */
+	LWLockAcquire(CSNLogControlLock, LW_EXCLUSIVE);
+
+	startPage = TransactionIdToPage(oldestActiveXID);
+	endPage = TransactionIdToPage(ShmemVariableCache->nextXid);
+
+	while (startPage != endPage)
+	{
+		(void) ZeroCSNLogPage(startPage);
+		startPage++;
+		/* must account for wraparound */
+		if (startPage > TransactionIdToPage(MaxTransactionId))
+			startPage = 0;
+	}
+	(void) ZeroCSNLogPage(startPage);
+
+	CSNLogShared->oldestXid = oldestActiveXID;
+	CSNLogShared->startupXid = ShmemVariableCache->nextXid;
+	CSNLogShared->started = true;
+
+	LWLockRelease(CSNLogControlLock);
+}
+
+/*
+ * This must be called ONCE during postmaster or standalone-backend shutdown
+ */
+void
+ShutdownCSNLog(void)
+{
+	/*
+	 * Flush dirty CSNLog pages to disk
+	 *
+	 * This is not actually necessary from a correctness point of view. We do
+	 * it merely as a debugging aid.
+	 */
+	if (csn_snapshots)
+		SimpleLruFlush(CSNLogCtl, false);
+}
+
+/*
+ * Perform a checkpoint --- either during shutdown, or on-the-fly
+ */
+void
+CheckPointCSNLog(void)
+{
+	/*
+	 * Flush dirty CSNLog pages to disk
+	 *
+	 * This is not actually necessary from a correctness point of view. We do
+	 * it merely to improve the odds that writing of dirty pages is done by
+	 * the checkpoint process and not by backends.
+	 */
+	if (csn_snapshots)
+		SimpleLruFlush(CSNLogCtl, true);
+}
+
+
+/*
+ * Make sure that CSNLog has room for a newly-allocated XID.
+ *
+ * NB: this is called while holding XidGenLock.  We want it to be very fast
+ * most of the time; even when it's not so fast, no actual I/O need happen
+ * unless we're forced to write out a dirty CSNLog page to make room
+ * in shared memory.
+ */
+void
+ExtendCSNLog(TransactionId newestXact)
+{
+	int			pageno;
+
+	if (!CSNLogActive())
+		return;
+
+	/*
+	 * No work except at first XID of a page.  But beware: just after
+	 * wraparound, the first XID of page zero is FirstNormalTransactionId.
+	 */
+	if (TransactionIdToEntry(newestXact) != 0 &&
+		!TransactionIdEquals(newestXact, FirstNormalTransactionId))
+		return;
+
+	pageno = TransactionIdToPage(newestXact);
+
+	LWLockAcquire(CSNLogControlLock, LW_EXCLUSIVE);
+
+	/* Zero the page */
+	ZeroCSNLogPage(pageno);
+
+	LWLockRelease(CSNLogControlLock);
+}
+
+
+/*
+ * Remove all CSNLog segments that no snapshot can ask about any more.
+ *
+ * This is called during checkpoint.  Snapshots only look up XIDs following
+ * their xmin, which is taken from a shared horizon that may be older than
+ * what is advertised in the proc array yet; see CsnGetSnapshotData.
+ */
+void
+TruncateCSNLog(void)
+{
+	TransactionId oldestXact;
+	int			cutoffPage;
+
+	if (!CSNLogActive())
+		return;
+
+	oldestXact = GetOldestCsnSnapshotXmin();
+
+	/*
+	 * The cutoff point is the start of the segment containing oldestXact. We
+	 * pass the *page* containing oldestXact to SimpleLruTruncate.  We step
+	 * back one transaction to avoid passing a cutoff page that hasn't been
+	 * created yet in the rare case that oldestXact would be the first item on
+	 * a page and oldestXact == next XID.  In that case, if we didn't subtract
+	 * one, we'd trigger SimpleLruTruncate's wraparound detection.
+	 */
+	TransactionIdRetreat(oldestXact);
+	cutoffPage = TransactionIdToPage(oldestXact);
+
+	SimpleLruTruncate(CSNLogCtl, cutoffPage);
+}
+
+
+/*
+ * Decide which of two CSNLog page numbers is "older" for truncation purposes.
+ *
+ * We need to use comparison of TransactionIds here in order to do the right
+ * thing with wraparound XID arithmetic.  However, if we are asked about
+ * page number zero, we don't want to hand InvalidTransactionId to
+ * TransactionIdPrecedes: it'll get weird about permanent xact IDs.  So,
+ * offset both xids by FirstNormalTransactionId to avoid that.
+ */
+static bool
+CSNLogPagePrecedes(int page1, int page2)
+{
+	TransactionId xid1;
+	TransactionId xid2;
+
+	xid1 = ((TransactionId) page1) * CSNLOG_XACTS_PER_PAGE;
+	xid1 += FirstNormalTransactionId;
+	xid2 = ((TransactionId) page2) * CSNLOG_XACTS_PER_PAGE;
+	xid2 += FirstNormalTransactionId;
+
+	return TransactionIdPrecedes(xid1, xid2);
+}
+
+
+/*
+ * GUC assign hook for csn_snapshots: switch between the standard and the
+ * CSN transaction manager, unless an extension has installed its own.
+ */
+void
+assign_csn_snapshots(bool newval, void *extra)
+{
+	if (TM == &PgTM || TM == &CsnTM)
+		TM = newval ? &CsnTM : &PgTM;
+}
@@ -253,6 +253,24 @@ static struct xllist
 
 static TwoPhaseStateData *TwoPhaseState;
 
+/*
+ * Copy of the state data of the PREPARE record this backend wrote last.
+ *
+ * Distributed transactions are usually prepared, moved to their 3PC
+ * precommit state and committed by the same backend within moments, and
+ * each of those steps needs the state data again. Keeping a copy saves
+ * reading the record back from WAL every time. Records are identified by
+ * their start LSN, which can't be reused by a different record.
+ */
+#define TWOPHASE_DATA_CACHE_MAX_SIZE	BLCKSZ
+
+static struct
+{
+	XLogRecPtr	lsn;			/* start of the cached record, or invalid */
+	uint32		len;			/* length of the state data */
+	char		data[TWOPHASE_DATA_CACHE_MAX_SIZE];
+}	lastPrepareData;
+
 /*
  * Global transaction entry currently locked by us, if any.
  */
@@ -285,7 +303,7 @@ static void ProcessRecords(char *bufptr, TransactionId xid,
 			   const TwoPhaseCallback callbacks[]);
 static void RemoveGXact(GlobalTransaction gxact);
 
-static void XlogReadTwoPhaseData(XLogRecPtr lsn, char **buf, int *len);
+static void RememberTwoPhaseData(XLogRecPtr lsn, StateFileChunk *chunks);
 
 /*
  * Initialization of shared memory
@@ -635,7 +653,8 @@ LockGXact(const char *gid, Oid user)
 	MyLockedGxact = NULL;
 	i = string_hash(gid, 0) % max_prepared_xacts;
   Retry:
-	LWLockAcquire(TwoPhaseStateLock, LW_EXCLUSIVE);
+	/* the collision chains only change under an exclusive lock */
+	LWLockAcquire(TwoPhaseStateLock, LW_SHARED);
 	for (gxact = TwoPhaseState->hashTable[i]; gxact != NULL; gxact = gxact->next)
 	{
 		if (strcmp(gxact->gid, gid) == 0)
@@ -821,60 +840,130 @@ bool GetPreparedTransactionState(char const* gid, char* state)
  * Alter 3PC state of prepared transaction
  */
 void SetPreparedTransactionState(char const* gid, char const* state)
-{	
-	GlobalTransaction gxact;
-	PGXACT	   *pgxact;
-	TwoPhaseFileHeader *hdr;
+{
+	SetPreparedTransactionsState(1, &gid, state);
+}
+
+/*
+ * SetPreparedTransactionsState
+ * Alter 3PC state of several prepared transactions with single WAL record and flush
+ *
+ * The XLOG_XACT_3PC_STATE record only identifies the transactions, their 2PC state
+ * data stays in the original PREPARE record (or state file) and gets the new state
+ * patched in when it is written to disk.  Like a commit record, the state record
+ * is flushed before the new state becomes visible, in shared memory or in a state
+ * file.  Each gxact is unlocked between the steps, as we can't hold the locks of a
+ * whole batch at once; this is fine because nobody finishes a transaction before
+ * its precommit is known.
+ */
+void SetPreparedTransactionsState(int n, char const* const* gids, char const* state)
+{
+	xl_xact_3pc_state xlrec;
+	xl_xact_3pc_state_xact *xact;
 	char* buf;
-    bool replorigin;
-	
+	Size size = 0;
+	Size offs = 0;
+	bool replorigin;
+	XLogRecPtr end_lsn;
+	int i;
 
 	if (strlen(state) >= MAX_3PC_STATE_SIZE)
 		ereport(ERROR,
 				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
 				 errmsg("transaction state \"%s\" is too long",
 						state)));
+	if (n == 0)
+		return;
 
-    replorigin = (replorigin_session_origin != InvalidRepOriginId &&
-				  replorigin_session_origin != DoNotReplicateId);
+	for (i = 0; i < n; i++)
+		size += SizeOfXact3PCStateXact(strlen(gids[i]));
+	buf = palloc0(size);
 
-	gxact = LockGXact(gid, GetUserId());	
-	pgxact = &ProcGlobal->allPgXact[gxact->pgprocno];
-	strcpy(gxact->state_3pc, state);
+	for (i = 0; i < n; i++)
+	{
+		GlobalTransaction gxact = LockGXact(gids[i], GetUserId());
+		PGXACT	   *pgxact = &ProcGlobal->allPgXact[gxact->pgprocno];
+		PGPROC	   *proc = &ProcGlobal->allProcs[gxact->pgprocno];
 
-	if (gxact->ondisk)
-		buf = ReadTwoPhaseFile(pgxact->xid, true);
-	else
-		XlogReadTwoPhaseData(gxact->prepare_start_lsn, &buf, NULL);
-	hdr = (TwoPhaseFileHeader *)buf;
-	strcpy(hdr->state_3pc, state);
+		xact = (xl_xact_3pc_state_xact *) (buf + offs);
+		xact->xid = pgxact->xid;
+		xact->dbId = proc->databaseId;
+		strcpy(xact->gid, gids[i]);
+		offs += SizeOfXact3PCStateXact(strlen(gids[i]));
+
+		PostPrepare_Twophase();
+	}
+
+	replorigin = (replorigin_session_origin != InvalidRepOriginId &&
+				  replorigin_session_origin != DoNotReplicateId);
+
+	memset(&xlrec, 0, sizeof(xlrec));
+	xlrec.nxacts = n;
+	strcpy(xlrec.state_3pc, state);
+	if (replorigin)
+	{
+		xlrec.origin_lsn = replorigin_session_origin_lsn;
+		xlrec.origin_timestamp = replorigin_session_origin_timestamp;
+	}
 
 	START_CRIT_SECTION();
-	MyPgXact->delayChkpt = true;
 
-	hdr->xl_origin.origin_lsn = replorigin_session_origin_lsn;
-	hdr->xl_origin.origin_timestamp = replorigin_session_origin_timestamp;
+	/*
+	 * Keep a checkpoint from starting after the record but storing the old
+	 * state: CheckPointTwoPhase() writes the gxacts' current state, and
+	 * replay begins after the record then.  See RecordTransactionCommit().
+	 */
+	MyPgXact->delayChkpt = true;
 
 	XLogBeginInsert();
-	XLogRegisterData(buf, hdr->total_len - sizeof(pg_crc32c));
+	XLogRegisterData((char *) &xlrec, MinSizeOfXact3PCState);
+	XLogRegisterData(buf, size);
 	XLogIncludeOrigin();
 
-	gxact->prepare_end_lsn = XLogInsert(RM_XACT_ID, XLOG_XACT_PREPARE);
+	end_lsn = XLogInsert(RM_XACT_ID, XLOG_XACT_3PC_STATE);
 
 	if (replorigin)
 		/* Move LSNs forward for this replication origin */
-		replorigin_session_advance(replorigin_session_origin_lsn,
-								   gxact->prepare_end_lsn);
+		replorigin_session_advance(replorigin_session_origin_lsn, end_lsn);
 
-	XLogFlush(gxact->prepare_end_lsn);
-	gxact->prepare_start_lsn = ProcLastRecPtr;
-	MyPgXact->delayChkpt = false;
+	XLogFlush(end_lsn);
 
 	END_CRIT_SECTION();
 
-	PostPrepare_Twophase();
+	pfree(buf);
+
+	for (i = 0; i < n; i++)
+	{
+		GlobalTransaction gxact = LockGXact(gids[i], GetUserId());
+		PGXACT	   *pgxact = &ProcGlobal->allPgXact[gxact->pgprocno];
+
+		strcpy(gxact->state_3pc, state);
+
+		/* the state file isn't rewritten from WAL anymore, so update it here */
+		if (gxact->ondisk)
+			SetTwoPhaseFileState(pgxact->xid, state);
 
-	//elog(LOG, "SetPreparedTransactionState(%s,%s)->%lx", gid, state, gxact->prepare_end_lsn);
+		PostPrepare_Twophase();
+	}
+
+	MyPgXact->delayChkpt = false;
+}
+
+/*
+ * SetTwoPhaseFileState
+ * Store new 3PC state in the state file of a prepared transaction, if it has one
+ */
+void SetTwoPhaseFileState(TransactionId xid, char const* state)
+{
+	char* buf = ReadTwoPhaseFile(xid, false);
+	TwoPhaseFileHeader *hdr;
+
+	if (buf == NULL)
+		return;
+	hdr = (TwoPhaseFileHeader *) buf;
+	strcpy(hdr->state_3pc, state);
+	RecreateTwoPhaseFile(xid, buf, hdr->total_len - sizeof(pg_crc32c));
+	pfree(buf);
 }
 
 /* Working status for pg_prepared_xact */
@@ -1288,6 +1377,8 @@ EndPrepare(GlobalTransaction gxact)
 
 	END_CRIT_SECTION();
 
+	RememberTwoPhaseData(gxact->prepare_start_lsn, records.head);
+
 	/*
 	 * Wait for synchronous replication, if required.
 	 *
@@ -1300,6 +1391,31 @@ EndPrepare(GlobalTransaction gxact)
 	records.num_chunks = 0;
 }
 
+/*
+ * Remember the state data of the PREPARE record just written at lsn, for
+ * XlogReadTwoPhaseData.
+ */
+static void
+RememberTwoPhaseData(XLogRecPtr lsn, StateFileChunk *chunks)
+{
+	StateFileChunk *chunk;
+	uint32		len = 0;
+
+	lastPrepareData.lsn = InvalidXLogRecPtr;
+
+	for (chunk = chunks; chunk != NULL; chunk = chunk->next)
+	{
+		/* don't bother with unusually large transactions */
+		if (len + chunk->len > TWOPHASE_DATA_CACHE_MAX_SIZE)
+			return;
+		memcpy(lastPrepareData.data + len, chunk->data, chunk->len);
+		len += chunk->len;
+	}
+
+	lastPrepareData.len = len;
+	lastPrepareData.lsn = lsn;
+}
+
 /*
  * Register a 2PC record to be written to state file.
  */
@@ -1482,6 +1598,16 @@ XlogReadTwoPhaseData(XLogRecPtr lsn, char **buf, int *len)
 
 	Assert(!RecoveryInProgress());
 
+	/* Maybe we wrote it ourselves just now */
+	if (lsn == lastPrepareData.lsn)
+	{
+		if (len != NULL)
+			*len = lastPrepareData.len;
+		*buf = palloc(lastPrepareData.len);
+		memcpy(*buf, lastPrepareData.data, lastPrepareData.len);
+		return;
+	}
+
 	xlogreader = XLogReaderAllocate(&read_local_xlog_page, NULL);
 	if (!xlogreader)
 		ereport(ERROR,
@@ -1879,6 +2005,8 @@ CheckPointTwoPhase(XLogRecPtr redo_horizon)
 			int			len;
 
 			XlogReadTwoPhaseData(gxact->prepare_start_lsn, &buf, &len);
+			/* 3PC state changes after PREPARE are kept in compact records */
+			strcpy(((TwoPhaseFileHeader *) buf)->state_3pc, gxact->state_3pc);
 			RecreateTwoPhaseFile(pgxact->xid, buf, len);
 			gxact->ondisk = true;
 			pfree(buf);
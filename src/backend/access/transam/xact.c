@@ -63,6 +63,7 @@
 #include "utils/snapmgr.h"
 #include "utils/timeout.h"
 #include "utils/timestamp.h"
+#include "utils/tqual.h"
 #include "pg_trace.h"
 
 
@@ -611,9 +612,13 @@ AssignTransactionId(TransactionState s)
 		/*
 		 * ensure this test matches similar one in
 		 * RecoverPreparedTransactions()
+		 *
+		 * Logical decoding wants to know about subtransactions before their
+		 * first change so it can stream in-progress transactions, so report
+		 * them right away with wal_level = logical.
 		 */
 		if (nUnreportedXids >= PGPROC_MAX_CACHED_SUBXIDS ||
-			log_unknown_top)
+			log_unknown_top || XLogLogicalInfoActive())
 		{
 			xl_xact_assignment xlrec;
 
@@ -688,11 +693,12 @@ GetCurrentCommandId(bool used)
 	{
 		/*
 		 * Forbid setting currentCommandIdUsed in parallel mode, because we
-		 * have no provision for communicating this back to the master.  We
-		 * could relax this restriction when currentCommandIdUsed was already
-		 * true at the start of the parallel operation.
+		 * have no provision for communicating this back to the master.  It
+		 * is fine if currentCommandIdUsed was already true at the start of
+		 * the parallel operation, as for the workers of a parallel COPY.
 		 */
-		Assert(CurrentTransactionState->parallelModeLevel == 0);
+		Assert(CurrentTransactionState->parallelModeLevel == 0 ||
+			   currentCommandIdUsed);
 		currentCommandIdUsed = true;
 	}
 	return currentCommandId;
@@ -2473,6 +2479,9 @@ AbortTransaction(void)
 	AbortBufferIO();
 	UnlockBuffers();
 
+	/* Forget visibility results prefetched for the interrupted page scan */
+	ResetXidsInMVCCSnapshot();
+
 	/* Reset WAL record construction state */
 	XLogResetInsertion();
 
@@ -4566,6 +4575,7 @@ AbortSubTransaction(void)
 	pgstat_progress_end_command();
 	AbortBufferIO();
 	UnlockBuffers();
+	ResetXidsInMVCCSnapshot();
 
 	/* Reset WAL record construction state */
 	XLogResetInsertion();
@@ -4814,8 +4824,8 @@ Size
 EstimateTransactionStateSpace(void)
 {
 	TransactionState s;
-	Size		nxids = 6;		/* iso level, deferrable, top & current XID,
-								 * command counter, XID count */
+	Size		nxids = 7;		/* iso level, deferrable, top & current XID,
+								 * command counter and its use, XID count */
 
 	for (s = CurrentTransactionState; s != NULL; s = s->parent)
 	{
@@ -4836,10 +4846,11 @@ EstimateTransactionStateSpace(void)
  *
  * We need to save and restore XactDeferrable, XactIsoLevel, and the XIDs
  * associated with this transaction.  The first eight bytes of the result
- * contain XactDeferrable and XactIsoLevel; the next twelve bytes contain the
+ * contain XactDeferrable and XactIsoLevel; the next sixteen bytes contain the
  * XID of the top-level transaction, the XID of the current transaction
- * (or, in each case, InvalidTransactionId if none), and the current command
- * counter.  After that, the next 4 bytes contain a count of how many
+ * (or, in each case, InvalidTransactionId if none), the current command
+ * counter and whether it has been used.  After that, the next 4 bytes
+ * contain a count of how many
  * additional XIDs follow; this is followed by all of those XIDs one after
  * another.  We emit the XIDs in sorted order for the convenience of the
  * receiving process.
@@ -4859,6 +4870,7 @@ SerializeTransactionState(Size maxsize, char *start_address)
 	result[c++] = XactTopTransactionId;
 	result[c++] = CurrentTransactionState->transactionId;
 	result[c++] = (TransactionId) currentCommandId;
+	result[c++] = (TransactionId) currentCommandIdUsed;
 	Assert(maxsize >= c * sizeof(TransactionId));
 
 	/*
@@ -4927,9 +4939,10 @@ StartParallelWorkerTransaction(char *tstatespace)
 	XactTopTransactionId = tstate[2];
 	CurrentTransactionState->transactionId = tstate[3];
 	currentCommandId = tstate[4];
-	nParallelCurrentXids = (int) tstate[5];
-	ParallelCurrentXids = &tstate[6];
-	TM->DeserializeTransactionState(&tstate[nParallelCurrentXids + 6]);
+	currentCommandIdUsed = (bool) tstate[5];
+	nParallelCurrentXids = (int) tstate[6];
+	ParallelCurrentXids = &tstate[7];
+	TM->DeserializeTransactionState(&tstate[nParallelCurrentXids + 7]);
 
 	CurrentTransactionState->blockState = TBLOCK_PARALLEL_INPROGRESS;
 }
@@ -5697,6 +5710,33 @@ xact_redo(XLogReaderState *record)
 							   record->EndRecPtr, false /* backward */ , false /* WAL */ );
 		}
 	}
+	else if (info == XLOG_XACT_3PC_STATE)
+	{
+		xl_xact_3pc_state *xlrec = (xl_xact_3pc_state *) XLogRecGetData(record);
+		RepOriginId originId = XLogRecGetOrigin(record);
+		char	   *ptr = (char *) xlrec + MinSizeOfXact3PCState;
+		int			i;
+
+		/*
+		 * The state files were recreated by replay of PREPARE; transactions
+		 * already finished have none anymore.
+		 */
+		for (i = 0; i < xlrec->nxacts; i++)
+		{
+			xl_xact_3pc_state_xact *xact = (xl_xact_3pc_state_xact *) ptr;
+
+			SetTwoPhaseFileState(xact->xid, xlrec->state_3pc);
+			ptr += SizeOfXact3PCStateXact(strlen(xact->gid));
+		}
+
+		if (originId != InvalidRepOriginId && originId != DoNotReplicateId)
+		{
+			Assert(xlrec->origin_lsn != InvalidXLogRecPtr);
+			/* recover apply progress */
+			replorigin_advance(originId, xlrec->origin_lsn,
+							   record->EndRecPtr, false /* backward */ , false /* WAL */ );
+		}
+	}
 	else if (info == XLOG_XACT_ASSIGNMENT)
 	{
 		xl_xact_assignment *xlrec = (xl_xact_assignment *) XLogRecGetData(record);
@@ -17,12 +17,16 @@
 #include <ctype.h>
 #include <time.h>
 #include <fcntl.h>
+#ifdef HAVE_SCHED_GETCPU
+#include <sched.h>
+#endif
 #include <sys/stat.h>
 #include <sys/time.h>
 #include <unistd.h>
 
 #include "access/clog.h"
 #include "access/commit_ts.h"
+#include "access/csnlog.h"
 #include "access/multixact.h"
 #include "access/rewriteheap.h"
 #include "access/subtrans.h"
@@ -33,6 +37,8 @@
 #include "access/xact.h"
 #include "access/xlog_internal.h"
 #include "access/xloginsert.h"
+#include "access/xlogparallel.h"
+#include "access/xlogprefetch.h"
 #include "access/xlogreader.h"
 #include "access/xlogutils.h"
 #include "catalog/catversion.h"
@@ -53,6 +59,7 @@
 #include "replication/walsender.h"
 #include "storage/barrier.h"
 #include "storage/bufmgr.h"
+#include "storage/doublewrite.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
 #include "storage/large_object.h"
@@ -87,6 +94,7 @@ int			max_wal_size = 64;	/* 1 GB */
 int			min_wal_size = 5;	/* 80 MB */
 int			wal_keep_segments = 0;
 int			XLOGbuffers = -1;
+int			XLOGInsertLocks = -1;
 int			XLogArchiveTimeout = 0;
 int			XLogArchiveMode = ARCHIVE_MODE_OFF;
 char	   *XLogArchiveCommand = NULL;
@@ -106,11 +114,13 @@ bool		XLOG_DEBUG = false;
 #endif
 
 /*
- * Number of WAL insertion locks to use. A higher value allows more insertions
- * to happen concurrently, but adds some CPU overhead to flushing the WAL,
- * which needs to iterate all the locks.
+ * Number of WAL insertion locks to use, set by wal_insert_locks. A higher
+ * value allows more insertions to happen concurrently, but adds some CPU
+ * overhead to flushing the WAL, which needs to iterate all the locks. The
+ * auto-tuned value scales with the number of CPUs, between these limits.
  */
-#define NUM_XLOGINSERT_LOCKS  8
+#define MIN_AUTO_XLOGINSERT_LOCKS	8
+#define MAX_AUTO_XLOGINSERT_LOCKS	128
 
 /*
  * Max distance from last checkpoint, before triggering a new xlog-based
@@ -961,8 +971,8 @@ XLogInsertRecord(XLogRecData *rdata, XLogRecPtr fpw_lsn)
 	 * To keep track of which insertions are still in-progress, each concurrent
 	 * inserter acquires an insertion lock. In addition to just indicating that
 	 * an insertion is in progress, the lock tells others how far the inserter
-	 * has progressed. There is a small fixed number of insertion locks,
-	 * determined by NUM_XLOGINSERT_LOCKS. When an inserter crosses a page
+	 * has progressed. There is a limited number of insertion locks, set by
+	 * wal_insert_locks at server start. When an inserter crosses a page
 	 * boundary, it updates the value stored in the lock to the how far it has
 	 * inserted, to allow the previous buffer to be flushed.
 	 *
@@ -1432,12 +1442,28 @@ WALInsertLockAcquire(void)
 	 * If this is the first time through in this backend, pick a lock
 	 * (semi-)randomly.  This allows the locks to be used evenly if you have a
 	 * lot of very short connections.
+	 *
+	 * Where we can tell which CPU we are running on, use that instead, with
+	 * lockToTry as an offset: processes on the same CPU can't insert at the
+	 * same time, so as long as there are as many locks as CPUs inserters
+	 * only collide when they get preempted, and each lock's cache line stays
+	 * with the CPU (and NUMA node) using it.
 	 */
 	static int	lockToTry = -1;
+#ifdef HAVE_SCHED_GETCPU
+	int			cpu = sched_getcpu();
 
 	if (lockToTry == -1)
-		lockToTry = MyProc->pgprocno % NUM_XLOGINSERT_LOCKS;
+		lockToTry = 0;
+	if (cpu >= 0)
+		MyLockNo = (cpu + lockToTry) % XLOGInsertLocks;
+	else
+		MyLockNo = lockToTry;
+#else
+	if (lockToTry == -1)
+		lockToTry = MyProc->pgprocno % XLOGInsertLocks;
 	MyLockNo = lockToTry;
+#endif
 
 	/*
 	 * The insertingAt value is initially set to 0, as we don't know our
@@ -1454,7 +1480,7 @@ WALInsertLockAcquire(void)
 		 * than locks, it still helps to distribute the inserters evenly
 		 * across the locks.
 		 */
-		lockToTry = (lockToTry + 1) % NUM_XLOGINSERT_LOCKS;
+		lockToTry = (lockToTry + 1) % XLOGInsertLocks;
 	}
 }
 
@@ -1472,7 +1498,7 @@ WALInsertLockAcquireExclusive(void)
 	 * indicator is set to 0xFFFFFFFFFFFFFFFF, which is higher than any real
 	 * XLogRecPtr value, to make sure that no-one blocks waiting on those.
 	 */
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS - 1; i++)
+	for (i = 0; i < XLOGInsertLocks - 1; i++)
 	{
 		LWLockAcquire(&WALInsertLocks[i].l.lock, LW_EXCLUSIVE);
 		LWLockUpdateVar(&WALInsertLocks[i].l.lock,
@@ -1498,7 +1524,7 @@ WALInsertLockRelease(void)
 	{
 		int			i;
 
-		for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+		for (i = 0; i < XLOGInsertLocks; i++)
 			LWLockReleaseClearVar(&WALInsertLocks[i].l.lock,
 								  &WALInsertLocks[i].l.insertingAt,
 								  0);
@@ -1526,8 +1552,8 @@ WALInsertLockUpdateInsertingAt(XLogRecPtr insertingAt)
 		 * We use the last lock to mark our actual position, see comments in
 		 * WALInsertLockAcquireExclusive.
 		 */
-		LWLockUpdateVar(&WALInsertLocks[NUM_XLOGINSERT_LOCKS - 1].l.lock,
-					 &WALInsertLocks[NUM_XLOGINSERT_LOCKS - 1].l.insertingAt,
+		LWLockUpdateVar(&WALInsertLocks[XLOGInsertLocks - 1].l.lock,
+					 &WALInsertLocks[XLOGInsertLocks - 1].l.insertingAt,
 						insertingAt);
 	}
 	else
@@ -1594,7 +1620,7 @@ WaitXLogInsertionsToFinish(XLogRecPtr upto)
 	 * out for any insertion that's still in progress.
 	 */
 	finishedUpto = reservedUpto;
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+	for (i = 0; i < XLOGInsertLocks; i++)
 	{
 		XLogRecPtr	insertingat = InvalidXLogRecPtr;
 
@@ -4554,6 +4580,18 @@ DataChecksumsEnabled(void)
 	return (ControlFile->data_checksum_version > 0);
 }
 
+/*
+ * Returns the wal_level of the primary, as last replayed from its
+ * XLOG_PARAMETER_CHANGE records.  Outside of recovery this is our own
+ * wal_level.
+ */
+int
+GetActiveWalLevelOnStandby(void)
+{
+	Assert(ControlFile != NULL);
+	return ControlFile->wal_level;
+}
+
 /*
  * Returns a fake LSN for unlogged relations.
  *
@@ -4635,6 +4673,60 @@ check_wal_buffers(int *newval, void **extra, GucSource source)
 	return true;
 }
 
+/*
+ * Auto-tune the number of WAL insertion locks.
+ *
+ * One lock per CPU lets every CPU insert at once without waiting on a shared
+ * lock; the number is rounded up to a power of two and kept between
+ * MIN_AUTO_XLOGINSERT_LOCKS (the fixed number used before this was
+ * configurable) and MAX_AUTO_XLOGINSERT_LOCKS, above which the cost of
+ * scanning all the locks on every WAL flush starts to dominate.
+ */
+static int
+XLOGChooseNumInsertLocks(void)
+{
+	int			nlocks = MIN_AUTO_XLOGINSERT_LOCKS;
+
+#ifdef _SC_NPROCESSORS_ONLN
+	long		ncpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	while (nlocks < ncpus && nlocks < MAX_AUTO_XLOGINSERT_LOCKS)
+		nlocks *= 2;
+#endif
+
+	return nlocks;
+}
+
+/*
+ * GUC check_hook for wal_insert_locks
+ */
+bool
+check_wal_insert_locks(int *newval, void **extra, GucSource source)
+{
+	/*
+	 * -1 indicates a request for auto-tune.
+	 */
+	if (*newval == -1)
+	{
+		/*
+		 * If we haven't yet changed the boot_val default of -1, just let it
+		 * be.  We'll fix it when XLOGShmemSize is called.
+		 */
+		if (XLOGInsertLocks == -1)
+			return true;
+
+		/* Otherwise, substitute the auto-tune value */
+		*newval = XLOGChooseNumInsertLocks();
+	}
+	else if (*newval == 0)
+	{
+		GUC_check_errdetail("At least one WAL insertion lock is required.");
+		return false;
+	}
+
+	return true;
+}
+
 /*
  * Initialization of shared memory for XLOG
  */
@@ -4658,11 +4750,22 @@ XLOGShmemSize(void)
 	}
 	Assert(XLOGbuffers > 0);
 
+	/* Likewise for wal_insert_locks. */
+	if (XLOGInsertLocks == -1)
+	{
+		char		buf[32];
+
+		snprintf(buf, sizeof(buf), "%d", XLOGChooseNumInsertLocks());
+		SetConfigOption("wal_insert_locks", buf, PGC_POSTMASTER,
+						PGC_S_OVERRIDE);
+	}
+	Assert(XLOGInsertLocks > 0);
+
 	/* XLogCtl */
 	size = sizeof(XLogCtlData);
 
 	/* WAL insertion locks, plus alignment */
-	size = add_size(size, mul_size(sizeof(WALInsertLockPadded), NUM_XLOGINSERT_LOCKS + 1));
+	size = add_size(size, mul_size(sizeof(WALInsertLockPadded), XLOGInsertLocks + 1));
 	/* xlblocks array */
 	size = add_size(size, mul_size(sizeof(XLogRecPtr), XLOGbuffers));
 	/* extra alignment padding for XLOG I/O buffers */
@@ -4737,14 +4840,14 @@ XLOGShmemInit(void)
 		((uintptr_t) allocptr) %sizeof(WALInsertLockPadded);
 	WALInsertLocks = XLogCtl->Insert.WALInsertLocks =
 		(WALInsertLockPadded *) allocptr;
-	allocptr += sizeof(WALInsertLockPadded) * NUM_XLOGINSERT_LOCKS;
+	allocptr += sizeof(WALInsertLockPadded) * XLOGInsertLocks;
 
 	XLogCtl->Insert.WALInsertLockTranche.name = "wal_insert";
 	XLogCtl->Insert.WALInsertLockTranche.array_base = WALInsertLocks;
 	XLogCtl->Insert.WALInsertLockTranche.array_stride = sizeof(WALInsertLockPadded);
 
 	LWLockRegisterTranche(LWTRANCHE_WAL_INSERT, &XLogCtl->Insert.WALInsertLockTranche);
-	for (i = 0; i < NUM_XLOGINSERT_LOCKS; i++)
+	for (i = 0; i < XLOGInsertLocks; i++)
 	{
 		LWLockInitialize(&WALInsertLocks[i].l.lock, LWTRANCHE_WAL_INSERT);
 		WALInsertLocks[i].l.insertingAt = InvalidXLogRecPtr;
@@ -6037,6 +6140,14 @@ StartupXLOG(void)
 	 */
 	ValidateXLOGDirectoryStructure();
 
+	/*
+	 * Repair torn data pages from the double-write buffer before anything
+	 * reads them, and set it up.  This must happen before the data directory
+	 * is fsync'd below, which makes the repairs durable.
+	 */
+	DoubleWriteStartup(ControlFile->state != DB_SHUTDOWNED &&
+					   ControlFile->state != DB_SHUTDOWNED_IN_RECOVERY);
+
 	/*
 	 * If we previously crashed, there might be data which we had written,
 	 * intending to fsync it, but which we had not actually fsync'd yet.
@@ -6752,6 +6863,7 @@ StartupXLOG(void)
 		{
 			ErrorContextCallback errcallback;
 			TimestampTz xtime;
+			XLogPrefetcher *prefetcher;
 
 			InRedo = true;
 
@@ -6759,6 +6871,12 @@ StartupXLOG(void)
 					(errmsg("redo starts at %X/%X",
 						 (uint32) (ReadRecPtr >> 32), (uint32) ReadRecPtr)));
 
+			/* Set up prefetching of the blocks upcoming records refer to */
+			prefetcher = XLogPrefetcherAllocate();
+
+			/* Hand block-level records to worker processes, if configured */
+			XLogParallelRedoStart(ArchiveRecoveryRequested && EnableHotStandby);
+
 			/*
 			 * main redo apply loop
 			 */
@@ -6830,6 +6948,16 @@ StartupXLOG(void)
 						recoveryPausesHere();
 				}
 
+				/*
+				 * Read ahead of this record and start fetching the data
+				 * blocks that are going to be needed.  When streaming, don't
+				 * look beyond what the walreceiver has flushed.
+				 */
+				XLogPrefetcherReadAhead(prefetcher, ReadRecPtr, EndRecPtr,
+										xlogreader->readPageTLI,
+										currentSource == XLOG_FROM_STREAM ?
+										receivedUpto : InvalidXLogRecPtr);
+
 				/* Setup error traceback support for ereport() */
 				errcallback.callback = rm_redo_error_callback;
 				errcallback.arg = (void *) xlogreader;
@@ -6912,8 +7040,12 @@ StartupXLOG(void)
 					TransactionIdIsValid(record->xl_xid))
 					RecordKnownAssignedTransactionIds(record->xl_xid);
 
-				/* Now apply the WAL record itself */
-				RmgrTable[record->xl_rmid].rm_redo(xlogreader);
+				/*
+				 * Now apply the WAL record itself, unless a parallel redo
+				 * worker is going to.
+				 */
+				if (!XLogParallelRedoDispatch(xlogreader))
+					RmgrTable[record->xl_rmid].rm_redo(xlogreader);
 
 				/* Pop the error context stack */
 				error_context_stack = errcallback.previous;
@@ -6938,6 +7070,16 @@ StartupXLOG(void)
 					WalRcvForceReply();
 				}
 
+				/*
+				 * Logical walsenders decoding on this standby can only
+				 * proceed up to what has been replayed; let them know when
+				 * a record they care about most has been.
+				 */
+				if ((record->xl_rmid == RM_XACT_ID ||
+					 record->xl_rmid == RM_STANDBY_ID) &&
+					AllowCascadeReplication())
+					WalSndWakeup();
+
 				/* Remember this record as the last-applied one */
 				LastRec = ReadRecPtr;
 
@@ -6977,6 +7119,9 @@ StartupXLOG(void)
 			 * end of main redo apply loop
 			 */
 
+			XLogParallelRedoStop();
+			XLogPrefetcherFree(prefetcher);
+
 			if (reachedStopPoint)
 			{
 				if (!reachedConsistency)
@@ -7421,6 +7566,9 @@ StartupXLOG(void)
 		StartupSUBTRANS(oldestActiveXID);
 	}
 
+	/* The CSN log is not maintained during recovery, start it now. */
+	StartupCSNLog(oldestActiveXID);
+
 	/*
 	 * Perform end of recovery actions for any SLRUs that need it.
 	 */
@@ -7548,8 +7696,10 @@ CheckRecoveryConsistency(void)
 	{
 		/*
 		 * Check to see if the XLOG sequence contained any unresolved
-		 * references to uninitialized pages.
+		 * references to uninitialized pages.  Parallel redo workers must
+		 * catch up and are checked first.
 		 */
+		XLogParallelRedoReachedConsistency();
 		XLogCheckInvalidPages();
 
 		reachedConsistency = true;
@@ -7896,6 +8046,19 @@ GetRedoRecPtr(void)
 	return RedoRecPtr;
 }
 
+/*
+ * Are full-page images being forced by an online backup in progress?
+ *
+ * The flag is read without a lock.  It's set before the checkpoint a backup
+ * starts with, so a caller that has fetched the redo pointer of that
+ * checkpoint with GetRedoRecPtr() sees it set.
+ */
+bool
+XLogIsForcingPageWrites(void)
+{
+	return XLogCtl->Insert.forcePageWrites;
+}
+
 /*
  * Return information needed to decide whether a modified block needs a
  * full-page image to be included in the WAL record.
@@ -8024,6 +8187,7 @@ ShutdownXLOG(int code, Datum arg)
 	ShutdownCLOG();
 	ShutdownCommitTs();
 	ShutdownSUBTRANS();
+	ShutdownCSNLog();
 	ShutdownMultiXact();
 }
 
@@ -8600,7 +8764,10 @@ CreateCheckPoint(int flags)
 	 * StartupSUBTRANS hasn't been called yet.
 	 */
 	if (!RecoveryInProgress())
+	{
 		TruncateSUBTRANS(GetOldestXmin(NULL, false));
+		TruncateCSNLog();
+	}
 
 	/* Real work is done, but log and update stats before releasing lock. */
 	LogCheckpointEnd(false);
@@ -8678,6 +8845,7 @@ CheckPointGuts(XLogRecPtr checkPointRedo, int flags)
 	CheckPointCLOG();
 	CheckPointCommitTs();
 	CheckPointSUBTRANS();
+	CheckPointCSNLog();
 	CheckPointMultiXact();
 	CheckPointPredicate();
 	CheckPointRelationMap();
@@ -9173,6 +9341,13 @@ void
 UpdateFullPageWrites(void)
 {
 	XLogCtlInsert *Insert = &XLogCtl->Insert;
+	bool		fpw;
+
+	/*
+	 * Torn pages are repaired from the double-write buffer when it's in use,
+	 * so full page images aren't needed then.
+	 */
+	fpw = fullPageWrites && !DoubleWriteEnabled();
 
 	/*
 	 * Do nothing if full_page_writes has not been changed.
@@ -9181,7 +9356,7 @@ UpdateFullPageWrites(void)
 	 * because we assume that there is no concurrently running process which
 	 * can update it.
 	 */
-	if (fullPageWrites == Insert->fullPageWrites)
+	if (fpw == Insert->fullPageWrites)
 		return;
 
 	START_CRIT_SECTION();
@@ -9193,7 +9368,7 @@ UpdateFullPageWrites(void)
 	 * setting it to false, first write the WAL record and then set the global
 	 * flag.
 	 */
-	if (fullPageWrites)
+	if (fpw)
 	{
 		WALInsertLockAcquireExclusive();
 		Insert->fullPageWrites = true;
@@ -9207,12 +9382,12 @@ UpdateFullPageWrites(void)
 	if (XLogStandbyInfoActive() && !RecoveryInProgress())
 	{
 		XLogBeginInsert();
-		XLogRegisterData((char *) (&fullPageWrites), sizeof(bool));
+		XLogRegisterData((char *) (&fpw), sizeof(bool));
 
 		XLogInsert(RM_XLOG_ID, XLOG_FPW_CHANGE);
 	}
 
-	if (!fullPageWrites)
+	if (!fpw)
 	{
 		WALInsertLockAcquireExclusive();
 		Insert->fullPageWrites = false;
@@ -9560,6 +9735,14 @@ xlog_redo(XLogReaderState *record)
 		UpdateControlFile();
 		LWLockRelease(ControlFileLock);
 
+		/*
+		 * Logical slots on a standby can't be used anymore once the primary
+		 * stops logging the information decoding needs.
+		 */
+		if (InRecovery && xlrec.wal_level < WAL_LEVEL_LOGICAL)
+			ReplicationSlotsInvalidateLogical(InvalidOid,
+											  InvalidTransactionId);
+
 		/* Check to see if any changes to max_connections give problems */
 		CheckRequiredParameterValues();
 	}
@@ -28,6 +28,7 @@
 #include "miscadmin.h"
 #include "replication/origin.h"
 #include "storage/bufmgr.h"
+#include "storage/doublewrite.h"
 #include "storage/proc.h"
 #include "utils/memutils.h"
 #include "pg_trace.h"
@@ -846,7 +847,7 @@ XLogCheckBufferNeedsBackup(Buffer buffer)
  * record data.
  *
  * We only need to do something if page has not yet been full page written in
- * this checkpoint round. The LSN of the inserted wal record is returned if we
+ * this checkpoint round, and isn't protected by the double-write buffer. The LSN of the inserted wal record is returned if we
  * had to write, InvalidXLogRecPtr otherwise.
  *
  * It is possible that multiple concurrent backends could attempt to write WAL
@@ -879,6 +880,15 @@ XLogSaveBufferForHint(Buffer buffer, bool buffer_std)
 	 */
 	lsn = BufferGetLSNAtomic(buffer);
 
+	/*
+	 * A torn write of the page is repaired from the double-write buffer when
+	 * it's in use, so no image is needed then, unless an online backup
+	 * forces them or hint bit changes are to be WAL-logged for their own
+	 * sake (wal_log_hints, as for pg_rewind).
+	 */
+	if (DoubleWriteEnabled() && !wal_log_hints && !XLogIsForcingPageWrites())
+		return InvalidXLogRecPtr;
+
 	if (lsn <= RedoRecPtr)
 	{
 		int			flags;
@@ -0,0 +1,507 @@
+/*-------------------------------------------------------------------------
+ *
+ * xlogparallel.c
+ *		Replaying WAL with several worker processes.
+ *
+ * Normally the startup process applies every WAL record itself, so redo is
+ * bound to a single CPU.  When recovery_parallel_workers is set, the startup
+ * process still reads and decodes the WAL, but hands records that touch a
+ * single existing data block to background workers, chosen by hashing the
+ * block's RelFileNode, fork and block number.  Records for the same block
+ * therefore always go to the same worker and are applied in WAL order, while
+ * records for different blocks are applied concurrently.
+ *
+ * Everything else acts as a barrier: before the startup process applies a
+ * record that is not dispatched, it waits until the workers have applied all
+ * the records handed to them.  Only the heap and btree resource managers are
+ * dispatched, and only their single-block records; those touch nothing but
+ * their own page, apart from clearing visibility map bits and updating the
+ * free space map, both of which lock the buffers involved.  Records for
+ * blocks past the current end of their fork are applied by the startup
+ * process too, so that workers never extend a relation.  Commit and
+ * checkpoint records, multi-block records, smgr and database operations all
+ * fall outside these rules and are barriers.
+ *
+ * Parallel redo is not used with hot standby: conflict resolution, the
+ * known-assigned-xids machinery and the visibility of replayed changes to
+ * queries all assume that records are applied by the startup process in
+ * order.
+ *
+ * The startup process still advances lastReplayedEndRecPtr as it dispatches
+ * records, so that value may be slightly ahead of what has actually been
+ * applied; this is harmless without hot standby.  Before the consistency
+ * point is declared the startup process waits for the workers as well.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/transam/xlogparallel.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/hash.h"
+#include "access/rmgr.h"
+#include "access/xlog.h"
+#include "access/xlog_internal.h"
+#include "access/xlogparallel.h"
+#include "access/xlogutils.h"
+#include "lib/stringinfo.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "postmaster/bgworker.h"
+#include "postmaster/startup.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/proc.h"
+#include "storage/shm_mq.h"
+#include "storage/shmem.h"
+#include "storage/smgr.h"
+#include "utils/memutils.h"
+
+/* Number of worker processes to replay WAL with, 0 means none */
+int			recovery_parallel_workers = 0;
+
+/* Size of the queue of records from the startup process to each worker */
+#define PARALLEL_REDO_QUEUE_SIZE	(256 * 1024)
+
+typedef struct XLogParallelRedoWorkerSlot
+{
+	pg_atomic_uint64 applied;	/* number of records applied so far */
+	bool		invalidPages;	/* did the worker see invalid pages? */
+} XLogParallelRedoWorkerSlot;
+
+typedef struct XLogParallelRedoCtlData
+{
+	PGPROC	   *startupProc;	/* to wake up the startup process */
+	bool		startupWaiting; /* is it waiting for the workers? */
+	bool		reachedConsistency;		/* copy of the startup's flag */
+	XLogParallelRedoWorkerSlot workers[MAX_PARALLEL_REDO_WORKERS];
+	/* the worker queues follow */
+} XLogParallelRedoCtlData;
+
+/* Header of the message carrying a record to a worker */
+typedef struct XLogParallelRedoMsg
+{
+	XLogRecPtr	ReadRecPtr;
+	XLogRecPtr	EndRecPtr;
+} XLogParallelRedoMsg;
+
+/* The block a record is dispatched by */
+typedef struct XLogParallelRedoTag
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber blkno;
+} XLogParallelRedoTag;
+
+static XLogParallelRedoCtlData *XLogParallelRedoCtl = NULL;
+
+/* State of the startup process */
+static int	nRedoWorkers = 0;
+static BackgroundWorkerHandle *redoWorkerHandles[MAX_PARALLEL_REDO_WORKERS];
+static shm_mq_handle *redoWorkerQueues[MAX_PARALLEL_REDO_WORKERS];
+static uint64 redoWorkerDispatched[MAX_PARALLEL_REDO_WORKERS];
+
+static shm_mq *XLogParallelRedoQueue(int worker);
+static bool XLogParallelRedoIsDispatchable(XLogReaderState *record);
+static void XLogParallelRedoErrorCallback(void *arg);
+static void XLogParallelRedoDetach(int code, Datum arg);
+
+Size
+XLogParallelRedoShmemSize(void)
+{
+	Size		size;
+
+	size = MAXALIGN(sizeof(XLogParallelRedoCtlData));
+	size = add_size(size, mul_size(recovery_parallel_workers,
+								   PARALLEL_REDO_QUEUE_SIZE));
+	return size;
+}
+
+void
+XLogParallelRedoShmemInit(void)
+{
+	bool		found;
+
+	XLogParallelRedoCtl = (XLogParallelRedoCtlData *)
+		ShmemInitStruct("Parallel Redo Ctl", XLogParallelRedoShmemSize(),
+						&found);
+	if (!found)
+	{
+		int			i;
+
+		memset(XLogParallelRedoCtl, 0, sizeof(XLogParallelRedoCtlData));
+		for (i = 0; i < MAX_PARALLEL_REDO_WORKERS; i++)
+			pg_atomic_init_u64(&XLogParallelRedoCtl->workers[i].applied, 0);
+	}
+}
+
+static shm_mq *
+XLogParallelRedoQueue(int worker)
+{
+	return (shm_mq *) ((char *) XLogParallelRedoCtl +
+					   MAXALIGN(sizeof(XLogParallelRedoCtlData)) +
+					   (Size) worker * PARALLEL_REDO_QUEUE_SIZE);
+}
+
+/*
+ * Launch the redo workers, called by the startup process when redo starts.
+ * If no worker can be started redo simply stays serial.
+ */
+void
+XLogParallelRedoStart(bool hotStandby)
+{
+	int			i;
+
+	if (recovery_parallel_workers == 0 || !IsUnderPostmaster)
+		return;
+
+	if (hotStandby)
+	{
+		ereport(LOG,
+				(errmsg("parallel redo is not used with hot standby")));
+		return;
+	}
+
+	XLogParallelRedoCtl->startupProc = MyProc;
+	XLogParallelRedoCtl->startupWaiting = false;
+	XLogParallelRedoCtl->reachedConsistency = reachedConsistency;
+
+	for (i = 0; i < recovery_parallel_workers; i++)
+	{
+		BackgroundWorker worker;
+		BackgroundWorkerHandle *handle;
+		shm_mq	   *mq;
+		pid_t		pid;
+
+		mq = shm_mq_create(XLogParallelRedoQueue(i), PARALLEL_REDO_QUEUE_SIZE);
+		shm_mq_set_sender(mq, MyProc);
+		pg_atomic_write_u64(&XLogParallelRedoCtl->workers[i].applied, 0);
+		XLogParallelRedoCtl->workers[i].invalidPages = false;
+
+		memset(&worker, 0, sizeof(worker));
+		snprintf(worker.bgw_name, BGW_MAXLEN, "parallel redo worker %d", i);
+		worker.bgw_flags = BGWORKER_SHMEM_ACCESS;
+		worker.bgw_start_time = BgWorkerStart_PostmasterStart;
+		worker.bgw_restart_time = BGW_NEVER_RESTART;
+		worker.bgw_main = NULL;
+		sprintf(worker.bgw_library_name, "postgres");
+		sprintf(worker.bgw_function_name, "XLogParallelRedoWorkerMain");
+		worker.bgw_main_arg = Int32GetDatum(i);
+		worker.bgw_notify_pid = MyProcPid;
+
+		if (!RegisterDynamicBackgroundWorker(&worker, &handle))
+			break;
+		if (WaitForBackgroundWorkerStartup(handle, &pid) != BGWH_STARTED)
+		{
+			pfree(handle);
+			break;
+		}
+
+		redoWorkerHandles[i] = handle;
+		redoWorkerQueues[i] = shm_mq_attach(mq, NULL, handle);
+		redoWorkerDispatched[i] = 0;
+	}
+	nRedoWorkers = i;
+
+	/* Make sure the workers go away should the startup process fail */
+	if (nRedoWorkers > 0)
+		on_shmem_exit(XLogParallelRedoDetach, (Datum) 0);
+
+	if (nRedoWorkers < recovery_parallel_workers)
+		ereport(LOG,
+				(errmsg("could only start %d of %d parallel redo workers",
+						nRedoWorkers, recovery_parallel_workers),
+				 errhint("You might need to increase max_worker_processes.")));
+	if (nRedoWorkers > 0)
+		ereport(LOG,
+				(errmsg("replaying WAL with %d parallel redo workers",
+						nRedoWorkers)));
+}
+
+/*
+ * Can the record just decoded be applied by a worker?
+ */
+static bool
+XLogParallelRedoIsDispatchable(XLogReaderState *record)
+{
+	RmgrId		rmid = XLogRecGetRmid(record);
+	DecodedBkpBlock *blk;
+	SMgrRelation smgr;
+
+	if (rmid != RM_HEAP_ID && rmid != RM_HEAP2_ID && rmid != RM_BTREE_ID)
+		return false;
+
+	if (record->max_block_id != 0 || !record->blocks[0].in_use)
+		return false;
+
+	/* The block must exist, or replaying it would extend the relation */
+	blk = &record->blocks[0];
+	smgr = smgropen(blk->rnode, InvalidBackendId);
+	if (smgr->md_fd[blk->forknum] == NULL && !smgrexists(smgr, blk->forknum))
+		return false;
+	if (blk->blkno >= smgrnblocks(smgr, blk->forknum))
+		return false;
+
+	return true;
+}
+
+/*
+ * Hand the record just decoded to a redo worker, if possible.
+ *
+ * Returns true if a worker is going to apply the record.  Otherwise waits
+ * for all the records dispatched so far to be applied and returns false;
+ * the caller must then apply the record itself.
+ */
+bool
+XLogParallelRedoDispatch(XLogReaderState *record)
+{
+	XLogParallelRedoTag tag;
+	XLogParallelRedoMsg msg;
+	shm_mq_iovec iov[2];
+	shm_mq_result res;
+	int			worker;
+
+	if (nRedoWorkers == 0)
+		return false;
+
+	if (!XLogParallelRedoIsDispatchable(record))
+	{
+		XLogParallelRedoWaitAll();
+		return false;
+	}
+
+	/* Zero the whole tag, padding included, as it is hashed as bytes */
+	memset(&tag, 0, sizeof(tag));
+	tag.rnode = record->blocks[0].rnode;
+	tag.forknum = record->blocks[0].forknum;
+	tag.blkno = record->blocks[0].blkno;
+	worker = DatumGetUInt32(hash_any((unsigned char *) &tag, sizeof(tag))) %
+		nRedoWorkers;
+
+	msg.ReadRecPtr = record->ReadRecPtr;
+	msg.EndRecPtr = record->EndRecPtr;
+	iov[0].data = (char *) &msg;
+	iov[0].len = sizeof(msg);
+	iov[1].data = (char *) record->decoded_record;
+	iov[1].len = XLogRecGetTotalLen(record);
+
+	res = shm_mq_sendv(redoWorkerQueues[worker], iov, 2, false);
+	if (res != SHM_MQ_SUCCESS)
+		ereport(ERROR,
+				(errcode(ERRCODE_INTERNAL_ERROR),
+				 errmsg("parallel redo worker %d exited unexpectedly", worker)));
+	redoWorkerDispatched[worker]++;
+
+	return true;
+}
+
+/*
+ * Wait until the workers have applied every record dispatched to them.
+ */
+void
+XLogParallelRedoWaitAll(void)
+{
+	int			i;
+
+	for (i = 0; i < nRedoWorkers; i++)
+	{
+		XLogParallelRedoWorkerSlot *slot = &XLogParallelRedoCtl->workers[i];
+
+		for (;;)
+		{
+			pid_t		pid;
+
+			if (pg_atomic_read_u64(&slot->applied) >= redoWorkerDispatched[i])
+				break;
+
+			/* Ask to be woken up, and recheck to avoid missing it */
+			XLogParallelRedoCtl->startupWaiting = true;
+			pg_memory_barrier();
+			if (pg_atomic_read_u64(&slot->applied) >= redoWorkerDispatched[i])
+				break;
+
+			if (GetBackgroundWorkerPid(redoWorkerHandles[i], &pid) == BGWH_STOPPED)
+				ereport(ERROR,
+						(errcode(ERRCODE_INTERNAL_ERROR),
+						 errmsg("parallel redo worker %d exited unexpectedly", i)));
+
+			WaitLatch(MyLatch, WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					  100L);
+			ResetLatch(MyLatch);
+			HandleStartupProcInterrupts();
+		}
+	}
+	XLogParallelRedoCtl->startupWaiting = false;
+}
+
+/*
+ * Called by the startup process when it is about to declare recovery
+ * consistent: the workers must have caught up, and must not have run into
+ * references to invalid pages, which only the startup process can check.
+ * From then on the workers treat invalid pages as errors themselves.
+ */
+void
+XLogParallelRedoReachedConsistency(void)
+{
+	int			i;
+
+	if (nRedoWorkers == 0)
+		return;
+
+	XLogParallelRedoWaitAll();
+
+	for (i = 0; i < nRedoWorkers; i++)
+	{
+		if (XLogParallelRedoCtl->workers[i].invalidPages)
+			ereport(PANIC,
+					(errmsg("WAL contains references to invalid pages"),
+					 errdetail("The invalid page references were found by parallel redo worker %d.", i),
+					 errhint("Setting recovery_parallel_workers to 0 may allow recovery to complete.")));
+	}
+
+	XLogParallelRedoCtl->reachedConsistency = true;
+	pg_write_barrier();
+}
+
+/*
+ * Wait for the workers to apply every record and let them exit, at the end
+ * of redo.
+ */
+void
+XLogParallelRedoStop(void)
+{
+	if (nRedoWorkers == 0)
+		return;
+
+	XLogParallelRedoWaitAll();
+	XLogParallelRedoDetach(0, (Datum) 0);
+}
+
+/*
+ * Detach from the worker queues, which tells the workers to exit.  Also
+ * used as an exit callback of the startup process.
+ */
+static void
+XLogParallelRedoDetach(int code, Datum arg)
+{
+	int			i;
+
+	for (i = 0; i < nRedoWorkers; i++)
+		shm_mq_detach(shm_mq_get_queue(redoWorkerQueues[i]));
+	nRedoWorkers = 0;
+}
+
+/*
+ * Error context callback for errors occurring in a redo worker.
+ */
+static void
+XLogParallelRedoErrorCallback(void *arg)
+{
+	XLogReaderState *record = (XLogReaderState *) arg;
+	const RmgrData *rmgr = &RmgrTable[XLogRecGetRmid(record)];
+	StringInfoData buf;
+
+	initStringInfo(&buf);
+	rmgr->rm_desc(&buf, record);
+
+	errcontext("parallel redo at %X/%X for %s: %s",
+			   (uint32) (record->ReadRecPtr >> 32),
+			   (uint32) record->ReadRecPtr,
+			   rmgr->rm_name, buf.data);
+
+	pfree(buf.data);
+}
+
+/*
+ * Entry point of a redo worker: apply the records the startup process
+ * sends, until it detaches from the queue.
+ */
+void
+XLogParallelRedoWorkerMain(Datum main_arg)
+{
+	int			workerno = DatumGetInt32(main_arg);
+	XLogParallelRedoWorkerSlot *slot = &XLogParallelRedoCtl->workers[workerno];
+	XLogReaderState *reader;
+	shm_mq	   *mq;
+	shm_mq_handle *mqh;
+	MemoryContext redoContext;
+	ErrorContextCallback errcallback;
+
+	BackgroundWorkerUnblockSignals();
+
+	/* Redo routines expect to be running in the startup process */
+	InRecovery = true;
+
+	mq = XLogParallelRedoQueue(workerno);
+	shm_mq_set_receiver(mq, MyProc);
+	mqh = shm_mq_attach(mq, NULL, NULL);
+
+	reader = XLogReaderAllocate(NULL, NULL);
+	if (reader == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+
+	redoContext = AllocSetContextCreate(TopMemoryContext,
+										"parallel redo",
+										ALLOCSET_DEFAULT_SIZES);
+
+	for (;;)
+	{
+		XLogParallelRedoMsg msg;
+		XLogRecord *record;
+		shm_mq_result res;
+		Size		nbytes;
+		void	   *data;
+		char	   *errormsg;
+		MemoryContext oldcxt;
+
+		res = shm_mq_receive(mqh, &nbytes, &data, false);
+		if (res != SHM_MQ_SUCCESS)
+			break;
+
+		CHECK_FOR_INTERRUPTS();
+
+		if (nbytes < sizeof(msg) + SizeOfXLogRecord)
+			elog(ERROR, "invalid parallel redo message size %zu", nbytes);
+		memcpy(&msg, data, sizeof(msg));
+		record = (XLogRecord *) ((char *) data + sizeof(msg));
+
+		reader->ReadRecPtr = msg.ReadRecPtr;
+		reader->EndRecPtr = msg.EndRecPtr;
+		if (!DecodeXLogRecord(reader, record, &errormsg))
+			elog(ERROR, "could not decode WAL record at %X/%X: %s",
+				 (uint32) (msg.ReadRecPtr >> 32), (uint32) msg.ReadRecPtr,
+				 errormsg);
+
+		pg_read_barrier();
+		reachedConsistency = XLogParallelRedoCtl->reachedConsistency;
+
+		errcallback.callback = XLogParallelRedoErrorCallback;
+		errcallback.arg = (void *) reader;
+		errcallback.previous = error_context_stack;
+		error_context_stack = &errcallback;
+
+		oldcxt = MemoryContextSwitchTo(redoContext);
+		RmgrTable[record->xl_rmid].rm_redo(reader);
+		MemoryContextSwitchTo(oldcxt);
+		MemoryContextReset(redoContext);
+
+		error_context_stack = errcallback.previous;
+
+		if (!slot->invalidPages && XLogHaveInvalidPages())
+			slot->invalidPages = true;
+
+		/* Report progress, and wake up the startup process if it waits */
+		pg_atomic_fetch_add_u64(&slot->applied, 1);
+		pg_memory_barrier();
+		if (XLogParallelRedoCtl->startupWaiting)
+			SetLatch(&XLogParallelRedoCtl->startupProc->procLatch);
+	}
+
+	XLogReaderFree(reader);
+	proc_exit(0);
+}
@@ -0,0 +1,329 @@
+/*-------------------------------------------------------------------------
+ *
+ * xlogprefetch.c
+ *		Prefetching of data blocks referenced by WAL during replay.
+ *
+ * Replaying a record that modifies a block which is not in shared buffers
+ * means a synchronous random read in the startup process, so recovery speed
+ * is bounded by storage latency.  To take advantage of storage that can
+ * serve many reads concurrently, the prefetcher decodes the WAL a little
+ * ahead of the replay position with its own XLogReader and issues
+ * PrefetchSharedBuffer() (which is posix_fadvise() underneath) for the
+ * blocks those records will touch.
+ *
+ * The prefetcher is purely advisory: it reads only WAL segment files already
+ * present in pg_xlog (and, when streaming, only up to what has been flushed
+ * by the walreceiver), and any failure to read or decode the WAL ahead just
+ * stops it until replay has made some progress.  Blocks that replay restores
+ * from a full-page image or initializes from scratch are not prefetched, nor
+ * are blocks beyond the current end of their relation fork.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/backend/access/transam/xlogprefetch.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "access/xlog_internal.h"
+#include "access/xlogprefetch.h"
+#include "access/xlogreader.h"
+#include "access/xlogrecord.h"
+#include "storage/bufmgr.h"
+#include "storage/fd.h"
+#include "storage/smgr.h"
+
+/*
+ * How far ahead of the replay position to decode WAL, in kilobytes.
+ * Zero disables prefetching.
+ */
+int			recovery_prefetch_distance = 256;
+
+/* Number of recently prefetched blocks remembered to skip repeats */
+#define XLOGPREFETCHER_RECENT_BLOCKS 16
+
+typedef struct XLogPrefetcherBlock
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+	BlockNumber blkno;
+} XLogPrefetcherBlock;
+
+struct XLogPrefetcher
+{
+	XLogReaderState *reader;
+
+	/* WAL segment currently open for reading, if any */
+	int			readFile;
+	XLogSegNo	readSegNo;
+	TimeLineID	readTLI;
+
+	/* timeline and flushed WAL limit given by the latest call */
+	TimeLineID	tli;
+	XLogRecPtr	readUpto;		/* InvalidXLogRecPtr means no limit */
+
+	/* have we successfully decoded a record since the last (re)start? */
+	bool		started;
+
+	/*
+	 * When reading ahead fails we don't retry until either replay has moved
+	 * on by a page or more WAL has been received.
+	 */
+	bool		stalled;
+	XLogRecPtr	stalledAt;
+	XLogRecPtr	stalledUpto;
+
+	/* ring of recently prefetched blocks */
+	XLogPrefetcherBlock recent[XLOGPREFETCHER_RECENT_BLOCKS];
+	int			nextRecent;
+
+	/* statistics reported at the end of recovery */
+	uint64		prefetched;
+	uint64		hits;
+	uint64		skipped;
+};
+
+static int XLogPrefetcherPageRead(XLogReaderState *reader,
+					   XLogRecPtr targetPagePtr, int reqLen,
+					   XLogRecPtr targetRecPtr, char *readBuf,
+					   TimeLineID *pageTLI);
+static void XLogPrefetcherScanBlocks(XLogPrefetcher *prefetcher);
+static void XLogPrefetcherCloseFile(XLogPrefetcher *prefetcher);
+
+/*
+ * Create a prefetcher.  It does nothing until XLogPrefetcherReadAhead() is
+ * called.
+ */
+XLogPrefetcher *
+XLogPrefetcherAllocate(void)
+{
+	XLogPrefetcher *prefetcher;
+
+	prefetcher = palloc0(sizeof(XLogPrefetcher));
+	prefetcher->reader = XLogReaderAllocate(&XLogPrefetcherPageRead,
+											prefetcher);
+	if (prefetcher->reader == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed while allocating an XLog reading processor.")));
+	prefetcher->readFile = -1;
+
+	return prefetcher;
+}
+
+void
+XLogPrefetcherFree(XLogPrefetcher *prefetcher)
+{
+	elog(DEBUG1, "recovery prefetched " UINT64_FORMAT " blocks, "
+		 UINT64_FORMAT " were already in shared buffers, "
+		 UINT64_FORMAT " were skipped",
+		 prefetcher->prefetched, prefetcher->hits, prefetcher->skipped);
+
+	XLogPrefetcherCloseFile(prefetcher);
+	XLogReaderFree(prefetcher->reader);
+	pfree(prefetcher);
+}
+
+/*
+ * Decode WAL ahead of the record being replayed and prefetch the blocks it
+ * references, until we are recovery_prefetch_distance in front of it.
+ *
+ * replayRecPtr and replayEndRecPtr delimit the record about to be replayed,
+ * tli is the timeline it was read from, and readUpto is the end of WAL known
+ * to be complete on disk, or InvalidXLogRecPtr if whatever is in pg_xlog may
+ * be read.
+ */
+void
+XLogPrefetcherReadAhead(XLogPrefetcher *prefetcher,
+						XLogRecPtr replayRecPtr, XLogRecPtr replayEndRecPtr,
+						TimeLineID tli, XLogRecPtr readUpto)
+{
+	XLogReaderState *reader = prefetcher->reader;
+	XLogRecPtr	distance = (XLogRecPtr) recovery_prefetch_distance * 1024;
+	XLogRecPtr	startPtr = InvalidXLogRecPtr;
+
+	if (distance == 0)
+		return;
+
+	/* Anything read ahead on another timeline is of no use */
+	if (tli != prefetcher->tli)
+	{
+		prefetcher->tli = tli;
+		prefetcher->started = false;
+		prefetcher->stalled = false;
+	}
+	prefetcher->readUpto = readUpto;
+
+	if (prefetcher->stalled)
+	{
+		if (replayEndRecPtr < prefetcher->stalledAt + XLOG_BLCKSZ &&
+			readUpto == prefetcher->stalledUpto)
+			return;
+		prefetcher->stalled = false;
+	}
+
+	/* (Re)start at the replay position if we're not ahead of it */
+	if (!prefetcher->started || reader->EndRecPtr < replayEndRecPtr)
+	{
+		prefetcher->started = false;
+		startPtr = replayRecPtr;
+	}
+
+	while (!prefetcher->started ||
+		   reader->EndRecPtr < replayEndRecPtr + distance)
+	{
+		XLogRecord *record;
+		char	   *errormsg;
+
+		record = XLogReadRecord(reader, startPtr, &errormsg);
+		if (record == NULL)
+		{
+			prefetcher->stalled = true;
+			prefetcher->stalledAt = replayEndRecPtr;
+			prefetcher->stalledUpto = readUpto;
+			return;
+		}
+
+		prefetcher->started = true;
+		startPtr = InvalidXLogRecPtr;
+
+		XLogPrefetcherScanBlocks(prefetcher);
+	}
+}
+
+/*
+ * Issue prefetches for the blocks referenced by the record just decoded.
+ */
+static void
+XLogPrefetcherScanBlocks(XLogPrefetcher *prefetcher)
+{
+	XLogReaderState *reader = prefetcher->reader;
+	int			block_id;
+
+	for (block_id = 0; block_id <= reader->max_block_id; block_id++)
+	{
+		DecodedBkpBlock *blk = &reader->blocks[block_id];
+		XLogPrefetcherBlock *recent;
+		SMgrRelation smgr;
+		int			i;
+
+		if (!blk->in_use)
+			continue;
+
+		/* Replay won't read blocks it restores or initializes */
+		if (blk->has_image || (blk->flags & BKPBLOCK_WILL_INIT) != 0)
+		{
+			prefetcher->skipped++;
+			continue;
+		}
+
+		for (i = 0; i < XLOGPREFETCHER_RECENT_BLOCKS; i++)
+		{
+			recent = &prefetcher->recent[i];
+			if (recent->blkno == blk->blkno &&
+				recent->forknum == blk->forknum &&
+				RelFileNodeEquals(recent->rnode, blk->rnode))
+				break;
+		}
+		if (i < XLOGPREFETCHER_RECENT_BLOCKS)
+		{
+			prefetcher->skipped++;
+			continue;
+		}
+
+		/*
+		 * The relation may not exist yet, or be shorter than the block
+		 * number, if earlier records still to be replayed create or extend
+		 * it.  smgrexists() closes and reopens the fork, so only use it when
+		 * the fork isn't open already.
+		 */
+		smgr = smgropen(blk->rnode, InvalidBackendId);
+		if ((smgr->md_fd[blk->forknum] == NULL &&
+			 !smgrexists(smgr, blk->forknum)) ||
+			blk->blkno >= smgrnblocks(smgr, blk->forknum))
+		{
+			prefetcher->skipped++;
+			continue;
+		}
+
+		if (PrefetchSharedBuffer(smgr, blk->forknum, blk->blkno))
+			prefetcher->prefetched++;
+		else
+			prefetcher->hits++;
+
+		recent = &prefetcher->recent[prefetcher->nextRecent];
+		recent->rnode = blk->rnode;
+		recent->forknum = blk->forknum;
+		recent->blkno = blk->blkno;
+		prefetcher->nextRecent = (prefetcher->nextRecent + 1) %
+			XLOGPREFETCHER_RECENT_BLOCKS;
+	}
+}
+
+/*
+ * XLogReader page read callback: read straight from the segment files in
+ * pg_xlog, failing instead of waiting when the WAL isn't there yet.
+ */
+static int
+XLogPrefetcherPageRead(XLogReaderState *reader, XLogRecPtr targetPagePtr,
+					   int reqLen, XLogRecPtr targetRecPtr, char *readBuf,
+					   TimeLineID *pageTLI)
+{
+	XLogPrefetcher *prefetcher = (XLogPrefetcher *) reader->private_data;
+	XLogSegNo	segno;
+	uint32		offset;
+	int			readLen = XLOG_BLCKSZ;
+
+	if (!XLogRecPtrIsInvalid(prefetcher->readUpto))
+	{
+		if (targetPagePtr + reqLen > prefetcher->readUpto)
+			return -1;
+		if (targetPagePtr + XLOG_BLCKSZ > prefetcher->readUpto)
+			readLen = prefetcher->readUpto - targetPagePtr;
+	}
+
+	XLByteToSeg(targetPagePtr, segno);
+	offset = targetPagePtr % XLogSegSize;
+
+	if (prefetcher->readFile >= 0 &&
+		(segno != prefetcher->readSegNo || prefetcher->tli != prefetcher->readTLI))
+		XLogPrefetcherCloseFile(prefetcher);
+
+	if (prefetcher->readFile < 0)
+	{
+		char		path[MAXPGPATH];
+
+		XLogFilePath(path, prefetcher->tli, segno);
+		prefetcher->readFile = BasicOpenFile(path, O_RDONLY | PG_BINARY, 0);
+		if (prefetcher->readFile < 0)
+			return -1;
+		prefetcher->readSegNo = segno;
+		prefetcher->readTLI = prefetcher->tli;
+	}
+
+	if (lseek(prefetcher->readFile, (off_t) offset, SEEK_SET) < 0 ||
+		read(prefetcher->readFile, readBuf, XLOG_BLCKSZ) != XLOG_BLCKSZ)
+	{
+		XLogPrefetcherCloseFile(prefetcher);
+		return -1;
+	}
+
+	*pageTLI = prefetcher->readTLI;
+	return readLen;
+}
+
+static void
+XLogPrefetcherCloseFile(XLogPrefetcher *prefetcher)
+{
+	if (prefetcher->readFile >= 0)
+	{
+		close(prefetcher->readFile);
+		prefetcher->readFile = -1;
+	}
+}
@@ -19,6 +19,7 @@
 
 #include <unistd.h>
 
+#include "access/timeline.h"
 #include "access/xlog.h"
 #include "access/xlog_internal.h"
 #include "access/xlogutils.h"
@@ -27,6 +28,7 @@
 #include "storage/smgr.h"
 #include "utils/guc.h"
 #include "utils/hsearch.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 
 
@@ -749,6 +751,49 @@ XLogRead(char *buf, TimeLineID tli, XLogRecPtr startptr, Size count)
 	}
 }
 
+/*
+ * Determine the timeline of the WAL file to read the page at targetPagePtr
+ * from, when replay has reached timeline replayTLI.
+ *
+ * The segment in which a timeline switch happened is read from the file of
+ * the new timeline, which has the old timeline's WAL up to the switch point
+ * as well.  The history of replayTLI is cached, as this is called for
+ * every page read.
+ */
+static TimeLineID
+XLogPageTimeLine(XLogRecPtr targetPagePtr, TimeLineID replayTLI)
+{
+	static TimeLineID historyTLI = 0;
+	static List *history = NIL;
+	TimeLineID	tli;
+	TimeLineID	nextTLI;
+	XLogRecPtr	switchpoint;
+	XLogSegNo	segno;
+	XLogSegNo	switchsegno;
+
+	if (historyTLI != replayTLI)
+	{
+		MemoryContext oldcxt = MemoryContextSwitchTo(TopMemoryContext);
+
+		list_free_deep(history);
+		history = readTimeLineHistory(replayTLI);
+		historyTLI = replayTLI;
+		MemoryContextSwitchTo(oldcxt);
+	}
+
+	tli = tliOfPointInHistory(targetPagePtr, history);
+	if (tli == replayTLI)
+		return tli;
+
+	switchpoint = tliSwitchPoint(tli, history, &nextTLI);
+	XLByteToSeg(targetPagePtr, segno);
+	XLByteToSeg(switchpoint, switchsegno);
+	if (segno == switchsegno)
+		tli = nextTLI;
+
+	return tli;
+}
+
 /*
  * read_page callback for reading local xlog files
  *
@@ -773,11 +818,8 @@ read_local_xlog_page(XLogReaderState *state, XLogRecPtr targetPagePtr,
 	while (1)
 	{
 		/*
-		 * TODO: we're going to have to do something more intelligent about
-		 * timelines on standbys. Use readTimeLineHistory() and
-		 * tliOfPointInHistory() to get the proper LSN? For now we'll catch
-		 * that case earlier, but the code and TODO is left in here for when
-		 * that changes.
+		 * On a standby, read_upto is on the timeline being replayed; the
+		 * page itself may be on an older one, see below.
 		 */
 		if (!RecoveryInProgress())
 		{
@@ -794,6 +836,9 @@ read_local_xlog_page(XLogReaderState *state, XLogRecPtr targetPagePtr,
 		pg_usleep(1000L);
 	}
 
+	if (RecoveryInProgress())
+		*pageTLI = XLogPageTimeLine(targetPagePtr, *pageTLI);
+
 	if (targetPagePtr + XLOG_BLCKSZ <= read_upto)
 	{
 		/*
@@ -15,6 +15,7 @@
 
 #include "postgres.h"
 
+#include "access/csnlog.h"
 #include "access/transam.h"
 #include "access/xtm.h"
 
@@ -36,6 +37,12 @@ PgGetTransactionManagerName(void)
 	return "postgres";
 }
 
+char const *
+CsnGetTransactionManagerName(void)
+{
+	return "csn";
+}
+
 size_t 
 PgGetTransactionStateSize(void)
 {
@@ -58,6 +65,12 @@ void PgInitializeSequence(int64* init, int64* step)
 	*step = 1;
 }
 
+bool
+PgIsDeadForAllSnapshots(TransactionId xmax)
+{
+	return false;
+}
+
 
 TransactionManager PgTM = {
 	PgTransactionIdGetStatus,
@@ -73,7 +86,26 @@ TransactionManager PgTM = {
 	PgGetTransactionStateSize,
 	PgSerializeTransactionState,
 	PgDeserializeTransactionState,
-	PgInitializeSequence
+	PgInitializeSequence,
+	PgIsDeadForAllSnapshots
+};
+
+TransactionManager CsnTM = {
+	PgTransactionIdGetStatus,
+	CsnTransactionIdSetTreeStatus,
+	CsnGetSnapshotData,
+	PgGetNewTransactionId,
+	PgGetOldestXmin,
+	PgTransactionIdIsInProgress,
+	PgGetGlobalTransactionId,
+	CsnXidInMVCCSnapshot,
+	PgDetectGlobalDeadLock,
+	CsnGetTransactionManagerName,
+	PgGetTransactionStateSize,
+	PgSerializeTransactionState,
+	PgDeserializeTransactionState,
+	PgInitializeSequence,
+	PgIsDeadForAllSnapshots
 };
 
 TransactionManager *TM = &PgTM;
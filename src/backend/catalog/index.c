@@ -109,6 +109,16 @@ static void UpdateIndexRelation(Oid indexoid, Oid heapoid,
 static void index_update_stats(Relation rel,
 				   bool hasindex, bool isprimary,
 				   double reltuples);
+static double IndexBuildHeapScanInternal(Relation heapRelation,
+						   Relation indexRelation,
+						   IndexInfo *indexInfo,
+						   bool allow_sync,
+						   bool anyvisible,
+						   BlockNumber start_blockno,
+						   BlockNumber numblocks,
+						   ParallelHeapScanDesc parallel_scan,
+						   IndexBuildCallback callback,
+						   void *callback_state);
 static void IndexCheckExclusion(Relation heapRelation,
 					Relation indexRelation,
 					IndexInfo *indexInfo);
@@ -2185,6 +2195,45 @@ IndexBuildHeapRangeScan(Relation heapRelation,
 						BlockNumber numblocks,
 						IndexBuildCallback callback,
 						void *callback_state)
+{
+	return IndexBuildHeapScanInternal(heapRelation, indexRelation,
+									  indexInfo, allow_sync, anyvisible,
+									  start_blockno, numblocks, NULL,
+									  callback, callback_state);
+}
+
+/*
+ * As IndexBuildHeapScan, except that the heap is scanned as one participant
+ * of the given parallel heap scan, which must have been set up with
+ * SnapshotAny by the leader.  Each participant sees a disjoint subset of the
+ * heap's pages, so together they index the whole relation.  Not usable for
+ * concurrent builds or during bootstrap.
+ */
+double
+IndexBuildHeapParallelScan(Relation heapRelation,
+						   Relation indexRelation,
+						   IndexInfo *indexInfo,
+						   ParallelHeapScanDesc parallel_scan,
+						   IndexBuildCallback callback,
+						   void *callback_state)
+{
+	return IndexBuildHeapScanInternal(heapRelation, indexRelation,
+									  indexInfo, true, false,
+									  0, InvalidBlockNumber, parallel_scan,
+									  callback, callback_state);
+}
+
+static double
+IndexBuildHeapScanInternal(Relation heapRelation,
+						   Relation indexRelation,
+						   IndexInfo *indexInfo,
+						   bool allow_sync,
+						   bool anyvisible,
+						   BlockNumber start_blockno,
+						   BlockNumber numblocks,
+						   ParallelHeapScanDesc parallel_scan,
+						   IndexBuildCallback callback,
+						   void *callback_state)
 {
 	bool		is_system_catalog;
 	bool		checking_uniqueness;
@@ -2258,21 +2307,29 @@ IndexBuildHeapRangeScan(Relation heapRelation,
 		OldestXmin = GetOldestXmin(heapRelation, true);
 	}
 
-	scan = heap_beginscan_strat(heapRelation,	/* relation */
-								snapshot,		/* snapshot */
-								0,		/* number of keys */
-								NULL,	/* scan key */
-								true,	/* buffer access strategy OK */
-								allow_sync);	/* syncscan OK? */
-
-	/* set our scan endpoints */
-	if (!allow_sync)
-		heap_setscanlimits(scan, start_blockno, numblocks);
+	if (parallel_scan != NULL)
+	{
+		Assert(snapshot == SnapshotAny && parallel_scan->phs_snapshot_any);
+		scan = heap_beginscan_parallel(heapRelation, parallel_scan);
+	}
 	else
 	{
-		/* syncscan can only be requested on whole relation */
-		Assert(start_blockno == 0);
-		Assert(numblocks == InvalidBlockNumber);
+		scan = heap_beginscan_strat(heapRelation,	/* relation */
+									snapshot,	/* snapshot */
+									0,	/* number of keys */
+									NULL,	/* scan key */
+									true,	/* buffer access strategy OK */
+									allow_sync);	/* syncscan OK? */
+
+		/* set our scan endpoints */
+		if (!allow_sync)
+			heap_setscanlimits(scan, start_blockno, numblocks);
+		else
+		{
+			/* syncscan can only be requested on whole relation */
+			Assert(start_blockno == 0);
+			Assert(numblocks == InvalidBlockNumber);
+		}
 	}
 
 	reltuples = 0;
@@ -22,9 +22,12 @@
 
 #include "access/heapam.h"
 #include "access/htup_details.h"
+#include "access/parallel.h"
 #include "access/sysattr.h"
 #include "access/xact.h"
 #include "access/xlog.h"
+#include "catalog/catalog.h"
+#include "catalog/pg_proc.h"
 #include "catalog/pg_type.h"
 #include "commands/copy.h"
 #include "commands/defrem.h"
@@ -38,7 +41,10 @@
 #include "optimizer/planner.h"
 #include "nodes/makefuncs.h"
 #include "rewrite/rewriteHandler.h"
+#include "storage/dsm_impl.h"
 #include "storage/fd.h"
+#include "storage/shm_mq.h"
+#include "storage/spin.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/lsyscache.h"
@@ -47,6 +53,7 @@
 #include "utils/rel.h"
 #include "utils/rls.h"
 #include "utils/snapmgr.h"
+#include "utils/typcache.h"
 
 
 #define ISOCTAL(c) (((c) >= '0') && ((c) <= '7'))
@@ -130,6 +137,7 @@ typedef struct CopyStateData
 	bool		convert_selectively;	/* do selective binary conversion? */
 	List	   *convert_select; /* list of column names (can be NIL) */
 	bool	   *convert_select_flags;	/* per-column CSV/TEXT CS flags */
+	int			nworkers;		/* parallel workers to load the data with */
 
 	/* these are just for error messages, see CopyFromErrorCallback */
 	const char *cur_relname;	/* table name for error messages */
@@ -199,6 +207,19 @@ typedef struct CopyStateData
 	char	   *raw_buf;
 	int			raw_buf_index;	/* next byte to process */
 	int			raw_buf_len;	/* total # of bytes stored */
+
+	/*
+	 * Parallel COPY FROM, see ParallelCopyFrom().  The leader reads the lines
+	 * and hands them to its workers in chunks, together with the arguments
+	 * of BeginCopyFrom to set up the same COPY.
+	 */
+	List	   *attnamelist;	/* columns given to BeginCopyFrom */
+	List	   *options;		/* options given to BeginCopyFrom */
+	ParallelContext *pcxt;		/* leader: workers loading the data */
+	shm_mq_handle *pcqueue;		/* worker: chunks received from the leader */
+	int			pchi_options;	/* worker: heap_insert options to use */
+	char	   *pcchunk;		/* worker: unread lines of the current chunk */
+	Size		pcchunk_len;	/* worker: length of the same */
 } CopyStateData;
 
 /* DestReceiver for COPY (query) TO */
@@ -209,6 +230,39 @@ typedef struct
 	uint64		processed;		/* # of tuples processed */
 } DR_copy;
 
+/* Magic numbers for parallel COPY FROM shared memory */
+#define PARALLEL_KEY_COPY_SHARED		UINT64CONST(0xC000000000000001)
+#define PARALLEL_KEY_COPY_NODES			UINT64CONST(0xC000000000000002)
+#define PARALLEL_KEY_COPY_QUEUES		UINT64CONST(0xC000000000000003)
+
+/* The leader sends lines to a worker in chunks of about this size */
+#define PARALLEL_COPY_CHUNK_SIZE		65536
+
+/* Size of the queue through which each worker receives its chunks */
+#define PARALLEL_COPY_QUEUE_SIZE		(4 * PARALLEL_COPY_CHUNK_SIZE)
+
+/* Upper limit of the PARALLEL option, as of max_parallel_workers_per_gather */
+#define PARALLEL_COPY_MAX_WORKERS		1024
+
+/*
+ * Status shared by the leader and the workers of a parallel COPY FROM.  The
+ * column list, options and range table of the COPY are stored separately in
+ * the same segment, as a node string.
+ *
+ * A chunk holds the line number of its first line, followed by consecutive
+ * lines, each as an int32 length and the line in the server encoding.
+ */
+typedef struct ParallelCopyShared
+{
+	/* immutable state, set up by the leader */
+	Oid			relid;
+	int			hi_options;		/* heap_insert options of the workers */
+
+	/* mutable state, updated by each worker once it has loaded its lines */
+	slock_t		mutex;
+	uint64		processed;		/* # of rows inserted */
+} ParallelCopyShared;
+
 
 /*
  * These macros centralize code used to process line_buf and raw_buf buffers.
@@ -299,6 +353,16 @@ static void CopyFromInsertBatch(CopyState cstate, EState *estate,
 					BulkInsertState bistate,
 					int nBufferedTuples, HeapTuple *bufferedTuples,
 					int firstBufferedLineNo);
+static int ParallelCopyWorkers(CopyState cstate,
+					ResultRelInfo *resultRelInfo);
+static bool ParallelCopyFrom(CopyState cstate, ResultRelInfo *resultRelInfo,
+				 int hi_options, uint64 *processed);
+static void ParallelCopySendChunk(ParallelContext *pcxt,
+					  shm_mq_handle **queues, int worker,
+					  StringInfo chunk);
+static void ParallelCopyMain(dsm_segment *seg, shm_toc *toc);
+static bool ParallelCopyReadLine(CopyState cstate);
+static void InitCopyFromState(CopyState cstate);
 static bool CopyReadLine(CopyState cstate);
 static bool CopyReadLineText(CopyState cstate);
 static int	CopyReadAttributesText(CopyState cstate);
@@ -1025,6 +1089,7 @@ ProcessCopyOptions(CopyState cstate,
 				   List *options)
 {
 	bool		format_specified = false;
+	bool		parallel_specified = false;
 	ListCell   *option;
 
 	/* Support external use for option sanity checking */
@@ -1191,6 +1256,21 @@ ProcessCopyOptions(CopyState cstate,
 						 errmsg("argument to option \"%s\" must be a valid encoding name",
 								defel->defname)));
 		}
+		else if (strcmp(defel->defname, "parallel") == 0)
+		{
+			if (parallel_specified)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("conflicting or redundant options")));
+			parallel_specified = true;
+			cstate->nworkers = defGetInt32(defel);
+			if (cstate->nworkers < 0 ||
+				cstate->nworkers > PARALLEL_COPY_MAX_WORKERS)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("argument to option \"%s\" must be between 0 and %d",
+								defel->defname, PARALLEL_COPY_MAX_WORKERS)));
+		}
 		else
 			ereport(ERROR,
 					(errcode(ERRCODE_SYNTAX_ERROR),
@@ -1328,6 +1408,16 @@ ProcessCopyOptions(CopyState cstate,
 				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
 				 errmsg("COPY force null only available using COPY FROM")));
 
+	/* Check parallel */
+	if (cstate->nworkers > 0 && !is_from)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("COPY parallel only available using COPY FROM")));
+	if (cstate->nworkers > 0 && cstate->binary)
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot specify PARALLEL in BINARY mode")));
+
 	/* Don't allow the delimiter to appear in the null string. */
 	if (strchr(cstate->null_print, cstate->delim[0]) != NULL)
 		ereport(ERROR,
@@ -2138,6 +2228,13 @@ CopyFromErrorCallback(void *arg)
 {
 	CopyState	cstate = (CopyState) arg;
 
+	/*
+	 * The leader of a parallel COPY only reads lines.  Errors raised between
+	 * them come from the workers, whose own context tells the line.
+	 */
+	if (cstate->pcxt != NULL && !cstate->line_buf_valid)
+		return;
+
 	if (cstate->binary)
 	{
 		/* can't usefully display the data */
@@ -2256,6 +2353,7 @@ CopyFrom(CopyState cstate)
 	int			hi_options = 0; /* start with default heap_insert options */
 	BulkInsertState bistate;
 	uint64		processed = 0;
+	bool		parallel;
 	bool		useHeapMultiInsert;
 	int			nBufferedTuples = 0;
 
@@ -2365,6 +2463,10 @@ CopyFrom(CopyState cstate)
 		hi_options |= HEAP_INSERT_FROZEN;
 	}
 
+	/* A parallel worker inserts just like its leader, see ParallelCopyMain */
+	if (cstate->pcqueue != NULL)
+		hi_options = cstate->pchi_options;
+
 	/*
 	 * We need a ResultRelInfo so we can use the regular executor's
 	 * index-entry-making machinery.  (There used to be a huge amount of code
@@ -2434,7 +2536,10 @@ CopyFrom(CopyState cstate)
 	errcallback.previous = error_context_stack;
 	error_context_stack = &errcallback;
 
-	for (;;)
+	/* Have parallel workers load the data if possible, else do it here */
+	parallel = ParallelCopyFrom(cstate, resultRelInfo, hi_options, &processed);
+
+	while (!parallel)
 	{
 		TupleTableSlot *slot;
 		bool		skip_tuple;
@@ -2499,6 +2604,22 @@ CopyFrom(CopyState cstate)
 
 			if (useHeapMultiInsert)
 			{
+				/*
+				 * CopyFromInsertBatch expects the lines of a batch to be
+				 * consecutive, which those a parallel worker receives are
+				 * only within a chunk.
+				 */
+				if (nBufferedTuples > 0 &&
+					cstate->cur_lineno != firstBufferedLineNo + nBufferedTuples)
+				{
+					CopyFromInsertBatch(cstate, estate, mycid, hi_options,
+										resultRelInfo, myslot, bistate,
+										nBufferedTuples, bufferedTuples,
+										firstBufferedLineNo);
+					nBufferedTuples = 0;
+					bufferedTuplesSize = 0;
+				}
+
 				/* Add this tuple to the tuple buffer */
 				if (nBufferedTuples == 0)
 					firstBufferedLineNo = cstate->cur_lineno;
@@ -2588,9 +2709,10 @@ CopyFrom(CopyState cstate)
 
 	/*
 	 * If we skipped writing WAL, then we need to sync the heap (but not
-	 * indexes since those use WAL anyway)
+	 * indexes since those use WAL anyway).  The leader of a parallel COPY
+	 * does that for its workers once they are done.
 	 */
-	if (hi_options & HEAP_INSERT_SKIP_WAL)
+	if ((hi_options & HEAP_INSERT_SKIP_WAL) && cstate->pcqueue == NULL)
 		heap_sync(cstate->rel);
 
 	return processed;
@@ -2674,6 +2796,383 @@ CopyFromInsertBatch(CopyState cstate, EState *estate, CommandId mycid,
 	cstate->cur_lineno = save_cur_lineno;
 }
 
+/*
+ * Parallel COPY FROM.
+ *
+ * Finding where a line ends takes a sequential scan of the input, if only
+ * because of quoted newlines in CSV, but that is cheap next to parsing the
+ * fields and inserting the rows.  So the leader reads the lines, converted
+ * to the server encoding by CopyReadLine, and sends them to its workers
+ * round robin in chunks of consecutive lines.  Each worker sets up the same
+ * COPY and runs CopyFrom on its lines, inserting with the leader's XID and
+ * command ID.  The result is the same as of a serial COPY, except for the
+ * physical order of the rows.
+ */
+
+/*
+ * How many parallel workers can load the data of this COPY FROM?  Zero if
+ * the leader must load it itself.
+ *
+ * The workers run the input functions, defaults, constraints and index
+ * expressions, so all of these must be parallel safe.  Triggers are left to
+ * serial COPY, as they might look at the rows of other workers, and so are
+ * the constraints that wait for other rows to be checked: deferred unique
+ * constraints and exclusion constraints.  Parallel mode doesn't support
+ * serializable transactions.
+ */
+static int
+ParallelCopyWorkers(CopyState cstate, ResultRelInfo *resultRelInfo)
+{
+	Relation	rel = cstate->rel;
+	TupleDesc	tupDesc = RelationGetDescr(rel);
+	ListCell   *cur;
+	int			i;
+
+	/* Workers can't see the local buffers of temporary relations */
+	if (cstate->nworkers <= 0 ||
+		dynamic_shared_memory_type == DSM_IMPL_NONE ||
+		!IsUnderPostmaster ||
+		IsInParallelMode() ||
+		IsolationIsSerializable() ||
+		RelationUsesLocalBuffers(rel) ||
+		IsSystemRelation(rel) ||
+		rel->trigdesc != NULL ||
+		cstate->volatile_defexprs)
+		return 0;
+
+	foreach(cur, cstate->attnumlist)
+	{
+		int			m = lfirst_int(cur) - 1;
+		Oid			typid = tupDesc->attrs[m]->atttypid;
+
+		if (func_parallel(cstate->in_functions[m].fn_oid) != PROPARALLEL_SAFE)
+			return 0;
+
+		/* the input function of a domain checks its constraints */
+		if (get_typtype(typid) == TYPTYPE_DOMAIN && DomainHasConstraints(typid))
+			return 0;
+	}
+
+	for (i = 0; i < cstate->num_defaults; i++)
+	{
+		if (has_parallel_hazard((Node *) cstate->defexprs[i]->expr, false))
+			return 0;
+	}
+
+	if (tupDesc->constr != NULL)
+	{
+		for (i = 0; i < tupDesc->constr->num_check; i++)
+		{
+			Node	   *check = stringToNode(tupDesc->constr->check[i].ccbin);
+
+			if (has_parallel_hazard(check, false))
+				return 0;
+		}
+	}
+
+	for (i = 0; i < resultRelInfo->ri_NumIndices; i++)
+	{
+		Relation	indexRel = resultRelInfo->ri_IndexRelationDescs[i];
+		IndexInfo  *indexInfo = resultRelInfo->ri_IndexRelationInfo[i];
+
+		if (indexInfo->ii_ExclusionOps != NULL ||
+			(indexInfo->ii_Unique && !indexRel->rd_index->indimmediate) ||
+			has_parallel_hazard((Node *) indexInfo->ii_Expressions, false) ||
+			has_parallel_hazard((Node *) indexInfo->ii_Predicate, false))
+			return 0;
+	}
+
+	return cstate->nworkers;
+}
+
+/*
+ * Load the data of a COPY FROM with parallel workers, if it qualifies and at
+ * least one worker could be launched.  Returns false, having read nothing,
+ * if the caller must load the data itself; otherwise sets *processed to the
+ * number of rows loaded.
+ */
+static bool
+ParallelCopyFrom(CopyState cstate, ResultRelInfo *resultRelInfo,
+				 int hi_options, uint64 *processed)
+{
+	int			nworkers = ParallelCopyWorkers(cstate, resultRelInfo);
+	ParallelContext *pcxt;
+	ParallelCopyShared *pcshared;
+	char	   *nodes;
+	char	   *nodespace;
+	char	   *queuespace;
+	shm_mq_handle **queues;
+	StringInfoData chunk;
+	uint64		nlines = 0;
+	int			worker = 0;
+	bool		done = false;
+	int			i;
+
+	if (nworkers == 0)
+		return false;
+
+	/*
+	 * Workers can't assign an XID; they use ours, and our command ID, which
+	 * CopyFrom has already marked as used.
+	 */
+	(void) GetCurrentTransactionId();
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext(ParallelCopyMain, nworkers);
+
+	nodes = nodeToString(list_make3(cstate->attnamelist, cstate->options,
+									cstate->range_table));
+
+	shm_toc_estimate_chunk(&pcxt->estimator, sizeof(ParallelCopyShared));
+	shm_toc_estimate_chunk(&pcxt->estimator, strlen(nodes) + 1);
+	shm_toc_estimate_chunk(&pcxt->estimator,
+						   mul_size(PARALLEL_COPY_QUEUE_SIZE, nworkers));
+	shm_toc_estimate_keys(&pcxt->estimator, 3);
+
+	InitializeParallelDSM(pcxt);
+
+	pcshared = (ParallelCopyShared *)
+		shm_toc_allocate(pcxt->toc, sizeof(ParallelCopyShared));
+	pcshared->relid = RelationGetRelid(cstate->rel);
+	pcshared->hi_options = hi_options | HEAP_INSERT_PARALLEL;
+	SpinLockInit(&pcshared->mutex);
+	pcshared->processed = 0;
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_COPY_SHARED, pcshared);
+
+	nodespace = shm_toc_allocate(pcxt->toc, strlen(nodes) + 1);
+	strcpy(nodespace, nodes);
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_COPY_NODES, nodespace);
+
+	queuespace = shm_toc_allocate(pcxt->toc,
+							 mul_size(PARALLEL_COPY_QUEUE_SIZE, nworkers));
+	shm_toc_insert(pcxt->toc, PARALLEL_KEY_COPY_QUEUES, queuespace);
+
+	/* pcxt->nworkers is zero if there was no room for a DSM segment */
+	queues = (shm_mq_handle **) palloc(Max(pcxt->nworkers, 1) *
+									   sizeof(shm_mq_handle *));
+	for (i = 0; i < pcxt->nworkers; i++)
+	{
+		shm_mq	   *mq;
+
+		mq = shm_mq_create(queuespace + (Size) i * PARALLEL_COPY_QUEUE_SIZE,
+						   (Size) PARALLEL_COPY_QUEUE_SIZE);
+		shm_mq_set_sender(mq, MyProc);
+		queues[i] = shm_mq_attach(mq, pcxt->seg, NULL);
+	}
+
+	LaunchParallelWorkers(pcxt);
+
+	if (pcxt->nworkers_launched == 0)
+	{
+		DestroyParallelContext(pcxt);
+		ExitParallelMode();
+		pfree(queues);
+		return false;
+	}
+
+	/* let the queues notice workers that die without attaching */
+	for (i = 0; i < pcxt->nworkers_launched; i++)
+		shm_mq_set_handle(queues[i], pcxt->worker[i].bgwhandle);
+
+	cstate->pcxt = pcxt;
+	initStringInfo(&chunk);
+
+	/* on input just throw the header line away */
+	if (cstate->header_line)
+	{
+		cstate->cur_lineno++;
+		done = CopyReadLine(cstate);
+	}
+
+	while (!done)
+	{
+		int32		len;
+
+		CHECK_FOR_INTERRUPTS();
+
+		cstate->cur_lineno++;
+		done = CopyReadLine(cstate);
+
+		/* the line is the workers' business now, see CopyFromErrorCallback */
+		cstate->line_buf_valid = false;
+
+		/* EOF at start of line means we're done, as in NextCopyFromRawFields */
+		if (done && cstate->line_buf.len == 0)
+			break;
+
+		if (chunk.len == 0)
+			appendBinaryStringInfo(&chunk, (char *) &cstate->cur_lineno,
+								   sizeof(int));
+		len = cstate->line_buf.len;
+		appendBinaryStringInfo(&chunk, (char *) &len, sizeof(int32));
+		appendBinaryStringInfo(&chunk, cstate->line_buf.data, len);
+		nlines++;
+
+		if (chunk.len >= PARALLEL_COPY_CHUNK_SIZE)
+		{
+			ParallelCopySendChunk(pcxt, queues, worker, &chunk);
+			worker = (worker + 1) % pcxt->nworkers_launched;
+		}
+	}
+
+	if (chunk.len > 0)
+		ParallelCopySendChunk(pcxt, queues, worker, &chunk);
+
+	/* that's the end of the input for every worker */
+	for (i = 0; i < pcxt->nworkers_launched; i++)
+		shm_mq_detach(shm_mq_get_queue(queues[i]));
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* A worker detaching early looks just like the end of its input */
+	if (pcshared->processed != nlines)
+		elog(ERROR, "parallel workers did not complete COPY into \"%s\"",
+			 RelationGetRelationName(cstate->rel));
+	*processed = pcshared->processed;
+
+	cstate->pcxt = NULL;
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+
+	pfree(chunk.data);
+	pfree(queues);
+
+	return true;
+}
+
+/*
+ * Send a chunk of lines to a worker of a parallel COPY, and reset it.
+ */
+static void
+ParallelCopySendChunk(ParallelContext *pcxt, shm_mq_handle **queues,
+					  int worker, StringInfo chunk)
+{
+	int			i;
+
+	if (shm_mq_send(queues[worker], chunk->len, chunk->data,
+					false) != SHM_MQ_SUCCESS)
+	{
+		/*
+		 * The worker is gone.  Let the others finish, so that the error of
+		 * this one, if it left one, is rethrown here.
+		 */
+		for (i = 0; i < pcxt->nworkers_launched; i++)
+			shm_mq_detach(shm_mq_get_queue(queues[i]));
+		WaitForParallelWorkersToFinish(pcxt);
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("lost connection to parallel worker")));
+	}
+
+	resetStringInfo(chunk);
+}
+
+/*
+ * Main entrypoint of a parallel COPY worker.
+ *
+ * Sets up the COPY of the leader, only reading the lines from its queue
+ * instead of the input of the COPY, and loads them with CopyFrom.
+ */
+static void
+ParallelCopyMain(dsm_segment *seg, shm_toc *toc)
+{
+	ParallelCopyShared *pcshared;
+	List	   *nodes;
+	char	   *queuespace;
+	shm_mq	   *mq;
+	Relation	rel;
+	CopyState	cstate;
+	MemoryContext oldcontext;
+	AttrNumber	attr_count;
+	uint64		processed;
+
+	pcshared = shm_toc_lookup(toc, PARALLEL_KEY_COPY_SHARED);
+	nodes = (List *) stringToNode(shm_toc_lookup(toc, PARALLEL_KEY_COPY_NODES));
+	queuespace = shm_toc_lookup(toc, PARALLEL_KEY_COPY_QUEUES);
+
+	mq = (shm_mq *) (queuespace +
+					 (Size) ParallelWorkerNumber * PARALLEL_COPY_QUEUE_SIZE);
+	shm_mq_set_receiver(mq, MyProc);
+
+	/* the leader holds the same lock, it doesn't conflict within the group */
+	rel = heap_open(pcshared->relid, RowExclusiveLock);
+
+	cstate = BeginCopy(true, rel, NULL, NULL, InvalidOid,
+					   (List *) linitial(nodes), (List *) lsecond(nodes));
+	oldcontext = MemoryContextSwitchTo(cstate->copycontext);
+
+	InitCopyFromState(cstate);
+	cstate->range_table = (List *) lthird(nodes);
+
+	/* the leader has skipped the header, and decided on FREEZE */
+	cstate->header_line = false;
+	cstate->freeze = false;
+	cstate->pchi_options = pcshared->hi_options;
+
+	cstate->file_has_oids = cstate->oids;
+	attr_count = list_length(cstate->attnumlist);
+	cstate->max_fields = cstate->file_has_oids ? (attr_count + 1) : attr_count;
+	cstate->raw_fields = (char **) palloc(cstate->max_fields * sizeof(char *));
+
+	cstate->pcqueue = shm_mq_attach(mq, seg, NULL);
+
+	MemoryContextSwitchTo(oldcontext);
+
+	processed = CopyFrom(cstate);
+
+	SpinLockAcquire(&pcshared->mutex);
+	pcshared->processed += processed;
+	SpinLockRelease(&pcshared->mutex);
+
+	shm_mq_detach(mq);
+	EndCopyFrom(cstate);
+	heap_close(rel, RowExclusiveLock);
+}
+
+/*
+ * Read the next line of a parallel COPY worker, sent by the leader, into
+ * line_buf.  Returns false once the leader has sent all lines.
+ */
+static bool
+ParallelCopyReadLine(CopyState cstate)
+{
+	int32		len;
+
+	if (cstate->pcchunk_len == 0)
+	{
+		shm_mq_result res;
+		Size		nbytes;
+		void	   *data;
+		int			first_lineno;
+
+		/* the leader detaches from the queue at the end of the input */
+		res = shm_mq_receive(cstate->pcqueue, &nbytes, &data, false);
+		if (res != SHM_MQ_SUCCESS)
+			return false;
+
+		Assert(nbytes > sizeof(int));
+		memcpy(&first_lineno, data, sizeof(int));
+		cstate->cur_lineno = first_lineno - 1;
+		cstate->pcchunk = (char *) data + sizeof(int);
+		cstate->pcchunk_len = nbytes - sizeof(int);
+	}
+
+	memcpy(&len, cstate->pcchunk, sizeof(int32));
+	Assert(cstate->pcchunk_len >= sizeof(int32) + len);
+
+	resetStringInfo(&cstate->line_buf);
+	appendBinaryStringInfo(&cstate->line_buf,
+						   cstate->pcchunk + sizeof(int32), len);
+	cstate->line_buf_converted = true;
+	cstate->line_buf_valid = true;
+	cstate->cur_lineno++;
+
+	cstate->pcchunk += sizeof(int32) + len;
+	cstate->pcchunk_len -= sizeof(int32) + len;
+
+	return true;
+}
+
 /*
  * Setup to read tuples from a file for COPY FROM.
  *
@@ -2693,114 +3192,16 @@ BeginCopyFrom(Relation rel,
 {
 	CopyState	cstate;
 	bool		pipe = (filename == NULL);
-	TupleDesc	tupDesc;
-	Form_pg_attribute *attr;
-	AttrNumber	num_phys_attrs,
-				num_defaults;
-	FmgrInfo   *in_functions;
-	Oid		   *typioparams;
-	int			attnum;
 	Oid			in_func_oid;
-	int		   *defmap;
-	ExprState **defexprs;
 	MemoryContext oldcontext;
-	bool		volatile_defexprs;
 
 	cstate = BeginCopy(true, rel, NULL, NULL, InvalidOid, attnamelist, options);
 	oldcontext = MemoryContextSwitchTo(cstate->copycontext);
 
-	/* Initialize state variables */
-	cstate->fe_eof = false;
-	cstate->eol_type = EOL_UNKNOWN;
-	cstate->cur_relname = RelationGetRelationName(cstate->rel);
-	cstate->cur_lineno = 0;
-	cstate->cur_attname = NULL;
-	cstate->cur_attval = NULL;
-
-	/* Set up variables to avoid per-attribute overhead. */
-	initStringInfo(&cstate->attribute_buf);
-	initStringInfo(&cstate->line_buf);
-	cstate->line_buf_converted = false;
-	cstate->raw_buf = (char *) palloc(RAW_BUF_SIZE + 1);
-	cstate->raw_buf_index = cstate->raw_buf_len = 0;
-
-	tupDesc = RelationGetDescr(cstate->rel);
-	attr = tupDesc->attrs;
-	num_phys_attrs = tupDesc->natts;
-	num_defaults = 0;
-	volatile_defexprs = false;
-
-	/*
-	 * Pick up the required catalog information for each attribute in the
-	 * relation, including the input function, the element type (to pass to
-	 * the input function), and info about defaults and constraints. (Which
-	 * input function we use depends on text/binary format choice.)
-	 */
-	in_functions = (FmgrInfo *) palloc(num_phys_attrs * sizeof(FmgrInfo));
-	typioparams = (Oid *) palloc(num_phys_attrs * sizeof(Oid));
-	defmap = (int *) palloc(num_phys_attrs * sizeof(int));
-	defexprs = (ExprState **) palloc(num_phys_attrs * sizeof(ExprState *));
-
-	for (attnum = 1; attnum <= num_phys_attrs; attnum++)
-	{
-		/* We don't need info for dropped attributes */
-		if (attr[attnum - 1]->attisdropped)
-			continue;
-
-		/* Fetch the input function and typioparam info */
-		if (cstate->binary)
-			getTypeBinaryInputInfo(attr[attnum - 1]->atttypid,
-								   &in_func_oid, &typioparams[attnum - 1]);
-		else
-			getTypeInputInfo(attr[attnum - 1]->atttypid,
-							 &in_func_oid, &typioparams[attnum - 1]);
-		fmgr_info(in_func_oid, &in_functions[attnum - 1]);
-
-		/* Get default info if needed */
-		if (!list_member_int(cstate->attnumlist, attnum))
-		{
-			/* attribute is NOT to be copied from input */
-			/* use default value if one exists */
-			Expr	   *defexpr = (Expr *) build_column_default(cstate->rel,
-																attnum);
-
-			if (defexpr != NULL)
-			{
-				/* Run the expression through planner */
-				defexpr = expression_planner(defexpr);
-
-				/* Initialize executable expression in copycontext */
-				defexprs[num_defaults] = ExecInitExpr(defexpr, NULL);
-				defmap[num_defaults] = attnum - 1;
-				num_defaults++;
-
-				/*
-				 * If a default expression looks at the table being loaded,
-				 * then it could give the wrong answer when using
-				 * multi-insert. Since database access can be dynamic this is
-				 * hard to test for exactly, so we use the much wider test of
-				 * whether the default expression is volatile. We allow for
-				 * the special case of when the default expression is the
-				 * nextval() of a sequence which in this specific case is
-				 * known to be safe for use with the multi-insert
-				 * optimisation. Hence we use this special case function
-				 * checker rather than the standard check for
-				 * contain_volatile_functions().
-				 */
-				if (!volatile_defexprs)
-					volatile_defexprs = contain_volatile_functions_not_nextval((Node *) defexpr);
-			}
-		}
-	}
-
-	/* We keep those variables in cstate. */
-	cstate->in_functions = in_functions;
-	cstate->typioparams = typioparams;
-	cstate->defmap = defmap;
-	cstate->defexprs = defexprs;
-	cstate->volatile_defexprs = volatile_defexprs;
-	cstate->num_defaults = num_defaults;
+	InitCopyFromState(cstate);
 	cstate->is_program = is_program;
+	cstate->attnamelist = attnamelist;
+	cstate->options = options;
 
 	if (pipe)
 	{
@@ -2913,6 +3314,120 @@ BeginCopyFrom(Relation rel,
 	return cstate;
 }
 
+/*
+ * Set up the state of a COPY FROM that doesn't depend on where the data
+ * comes from: the line and attribute buffers, and the input functions and
+ * defaults of the attributes.  Used by BeginCopyFrom and by the workers of a
+ * parallel COPY.
+ */
+static void
+InitCopyFromState(CopyState cstate)
+{
+	TupleDesc	tupDesc;
+	Form_pg_attribute *attr;
+	AttrNumber	num_phys_attrs,
+				num_defaults;
+	FmgrInfo   *in_functions;
+	Oid		   *typioparams;
+	int			attnum;
+	Oid			in_func_oid;
+	int		   *defmap;
+	ExprState **defexprs;
+	bool		volatile_defexprs;
+
+	/* Initialize state variables */
+	cstate->fe_eof = false;
+	cstate->eol_type = EOL_UNKNOWN;
+	cstate->cur_relname = RelationGetRelationName(cstate->rel);
+	cstate->cur_lineno = 0;
+	cstate->cur_attname = NULL;
+	cstate->cur_attval = NULL;
+
+	/* Set up variables to avoid per-attribute overhead. */
+	initStringInfo(&cstate->attribute_buf);
+	initStringInfo(&cstate->line_buf);
+	cstate->line_buf_converted = false;
+	cstate->raw_buf = (char *) palloc(RAW_BUF_SIZE + 1);
+	cstate->raw_buf_index = cstate->raw_buf_len = 0;
+
+	tupDesc = RelationGetDescr(cstate->rel);
+	attr = tupDesc->attrs;
+	num_phys_attrs = tupDesc->natts;
+	num_defaults = 0;
+	volatile_defexprs = false;
+
+	/*
+	 * Pick up the required catalog information for each attribute in the
+	 * relation, including the input function, the element type (to pass to
+	 * the input function), and info about defaults and constraints. (Which
+	 * input function we use depends on text/binary format choice.)
+	 */
+	in_functions = (FmgrInfo *) palloc(num_phys_attrs * sizeof(FmgrInfo));
+	typioparams = (Oid *) palloc(num_phys_attrs * sizeof(Oid));
+	defmap = (int *) palloc(num_phys_attrs * sizeof(int));
+	defexprs = (ExprState **) palloc(num_phys_attrs * sizeof(ExprState *));
+
+	for (attnum = 1; attnum <= num_phys_attrs; attnum++)
+	{
+		/* We don't need info for dropped attributes */
+		if (attr[attnum - 1]->attisdropped)
+			continue;
+
+		/* Fetch the input function and typioparam info */
+		if (cstate->binary)
+			getTypeBinaryInputInfo(attr[attnum - 1]->atttypid,
+								   &in_func_oid, &typioparams[attnum - 1]);
+		else
+			getTypeInputInfo(attr[attnum - 1]->atttypid,
+							 &in_func_oid, &typioparams[attnum - 1]);
+		fmgr_info(in_func_oid, &in_functions[attnum - 1]);
+
+		/* Get default info if needed */
+		if (!list_member_int(cstate->attnumlist, attnum))
+		{
+			/* attribute is NOT to be copied from input */
+			/* use default value if one exists */
+			Expr	   *defexpr = (Expr *) build_column_default(cstate->rel,
+																attnum);
+
+			if (defexpr != NULL)
+			{
+				/* Run the expression through planner */
+				defexpr = expression_planner(defexpr);
+
+				/* Initialize executable expression in copycontext */
+				defexprs[num_defaults] = ExecInitExpr(defexpr, NULL);
+				defmap[num_defaults] = attnum - 1;
+				num_defaults++;
+
+				/*
+				 * If a default expression looks at the table being loaded,
+				 * then it could give the wrong answer when using
+				 * multi-insert. Since database access can be dynamic this is
+				 * hard to test for exactly, so we use the much wider test of
+				 * whether the default expression is volatile. We allow for
+				 * the special case of when the default expression is the
+				 * nextval() of a sequence which in this specific case is
+				 * known to be safe for use with the multi-insert
+				 * optimisation. Hence we use this special case function
+				 * checker rather than the standard check for
+				 * contain_volatile_functions().
+				 */
+				if (!volatile_defexprs)
+					volatile_defexprs = contain_volatile_functions_not_nextval((Node *) defexpr);
+			}
+		}
+	}
+
+	/* We keep those variables in cstate. */
+	cstate->in_functions = in_functions;
+	cstate->typioparams = typioparams;
+	cstate->defmap = defmap;
+	cstate->defexprs = defexprs;
+	cstate->volatile_defexprs = volatile_defexprs;
+	cstate->num_defaults = num_defaults;
+}
+
 /*
  * Read raw fields in the next line for COPY FROM in text or csv mode.
  * Return false if no more lines.
@@ -2933,26 +3448,35 @@ NextCopyFromRawFields(CopyState cstate, char ***fields, int *nfields)
 	/* only available for text or csv input */
 	Assert(!cstate->binary);
 
-	/* on input just throw the header line away */
-	if (cstate->cur_lineno == 0 && cstate->header_line)
+	if (cstate->pcqueue != NULL)
 	{
-		cstate->cur_lineno++;
-		if (CopyReadLine(cstate))
-			return false;		/* done */
+		/* a parallel worker gets the lines read by its leader */
+		if (!ParallelCopyReadLine(cstate))
+			return false;
 	}
+	else
+	{
+		/* on input just throw the header line away */
+		if (cstate->cur_lineno == 0 && cstate->header_line)
+		{
+			cstate->cur_lineno++;
+			if (CopyReadLine(cstate))
+				return false;	/* done */
+		}
 
-	cstate->cur_lineno++;
+		cstate->cur_lineno++;
 
-	/* Actually read the line into memory here */
-	done = CopyReadLine(cstate);
+		/* Actually read the line into memory here */
+		done = CopyReadLine(cstate);
 
-	/*
-	 * EOF at start of line means we're done.  If we see EOF after some
-	 * characters, we act as though it was newline followed by EOF, ie,
-	 * process the line and then exit loop on next iteration.
-	 */
-	if (done && cstate->line_buf.len == 0)
-		return false;
+		/*
+		 * EOF at start of line means we're done.  If we see EOF after some
+		 * characters, we act as though it was newline followed by EOF, ie,
+		 * process the line and then exit loop on next iteration.
+		 */
+		if (done && cstate->line_buf.len == 0)
+			return false;
+	}
 
 	/* Parse the line into de-escaped field values */
 	if (cstate->csv_mode)
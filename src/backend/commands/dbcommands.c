@@ -59,6 +59,7 @@
 #include "utils/builtins.h"
 #include "utils/fmgroids.h"
 #include "utils/pg_locale.h"
+#include "utils/sharedcatcache.h"
 #include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/tqual.h"
@@ -895,6 +896,12 @@ dropdb(const char *dbname, bool missing_ok)
 	 */
 	DropDatabaseBuffers(db_id);
 
+	/*
+	 * Likewise its shared catcache entries, lest a future database with the
+	 * same OID find them.
+	 */
+	SharedCatCacheInvalidateDatabase(db_id);
+
 	/*
 	 * Tell the stats collector to forget it immediately, too.
 	 */
@@ -2103,6 +2110,9 @@ dbase_redo(XLogReaderState *record)
 			 */
 			LockSharedObjectForSession(DatabaseRelationId, xlrec->db_id, 0, AccessExclusiveLock);
 			ResolveRecoveryConflictWithDatabase(xlrec->db_id);
+
+			/* Logical slots created on the standby go with the database */
+			ReplicationSlotsDropDBSlots(xlrec->db_id);
 		}
 
 		/* Drop pages for this database that are in the shared buffer cache */
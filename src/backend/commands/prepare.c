@@ -609,6 +609,22 @@ DropAllPreparedStatements(void)
 	}
 }
 
+/*
+ * Install another set of prepared statements, returning the current one.
+ *
+ * A backend serving several pooled sessions keeps a set per session; NULL
+ * stands for an empty set.  A set that is no longer needed is released by
+ * installing it, dropping its statements and destroying the hash table.
+ */
+HTAB *
+SwitchPreparedStatements(HTAB *statements)
+{
+	HTAB	   *old = prepared_queries;
+
+	prepared_queries = statements;
+	return old;
+}
+
 /*
  * Implements the 'EXPLAIN EXECUTE' utility statement.
  *
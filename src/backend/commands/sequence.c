@@ -598,6 +598,8 @@ nextval_internal(Oid relid)
 	{
 		rescnt++;				/* return last_value if not is_called */
 		fetch--;
+		if (TM->AdjustSequenceValue != NULL && !seq->is_cycled)
+			last = next = result = TM->AdjustSequenceValue(seqrel, next, incby, maxv);
 	}
 
 	/*
@@ -680,6 +682,8 @@ nextval_internal(Oid relid)
 			else
 				next += incby;
 		}
+		if (TM->AdjustSequenceValue != NULL && !seq->is_cycled)
+			next = TM->AdjustSequenceValue(seqrel, next, incby, maxv);
 		fetch--;
 		if (rescnt < cache)
 		{
@@ -23,6 +23,13 @@
  * of index scans performed.  So we don't use maintenance_work_mem memory for
  * the TID array, just enough to hold as many heap tuples as fit on one page.
  *
+ * A pass of index cleanup over several indexes may be done in parallel: the
+ * TID array is copied into a dynamic shared memory segment, and parallel
+ * workers and the leader take indexes one at a time until all are done.
+ * Only indexes of the built-in access methods, whose bulk-delete statistics
+ * are a plain IndexBulkDeleteResult that can be passed between processes,
+ * are given to workers; the leader vacuums any others itself.
+ *
  *
  * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -42,10 +49,13 @@
 #include "access/heapam_xlog.h"
 #include "access/htup_details.h"
 #include "access/multixact.h"
+#include "access/parallel.h"
 #include "access/transam.h"
 #include "access/visibilitymap.h"
+#include "access/xact.h"
 #include "access/xlog.h"
 #include "catalog/catalog.h"
+#include "catalog/pg_am.h"
 #include "catalog/storage.h"
 #include "commands/dbcommands.h"
 #include "commands/progress.h"
@@ -55,8 +65,11 @@
 #include "portability/instr_time.h"
 #include "postmaster/autovacuum.h"
 #include "storage/bufmgr.h"
+#include "storage/dsm_impl.h"
 #include "storage/freespace.h"
 #include "storage/lmgr.h"
+#include "storage/proc.h"
+#include "storage/shm_toc.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/pg_rusage.h"
@@ -127,6 +140,32 @@ typedef struct LVRelStats
 } LVRelStats;
 
 
+/*
+ * State shared with parallel workers vacuuming indexes, in the DSM segment
+ * of the parallel context under PARALLEL_VACUUM_KEY_SHARED.  The TID array
+ * is stored under PARALLEL_VACUUM_KEY_DEAD_TUPLES.
+ */
+#define PARALLEL_VACUUM_KEY_SHARED			1
+#define PARALLEL_VACUUM_KEY_DEAD_TUPLES		2
+
+typedef struct LVSharedIndex
+{
+	Oid			indexoid;
+	bool		has_stats;		/* is stats valid? */
+	IndexBulkDeleteResult stats;	/* kept across passes of the vacuum */
+} LVSharedIndex;
+
+typedef struct LVShared
+{
+	int			elevel;
+	double		old_rel_tuples;
+	int			num_dead_tuples;
+	int			nindexes;
+	pg_atomic_uint32 nextindex; /* next of indexes[] to vacuum */
+	LVSharedIndex indexes[FLEXIBLE_ARRAY_MEMBER];
+} LVShared;
+
+
 /* A few variables that don't seem worth passing around as parameters */
 static int	elevel = -1;
 
@@ -143,6 +182,13 @@ static void lazy_scan_heap(Relation onerel, int options,
 			   bool aggressive);
 static void lazy_vacuum_heap(Relation onerel, LVRelStats *vacrelstats);
 static bool lazy_check_needs_freeze(Buffer buf, bool *hastup);
+static void lazy_vacuum_all_indexes(Relation *Irel, int nindexes,
+						IndexBulkDeleteResult **indstats,
+						LVRelStats *vacrelstats);
+static bool lazy_index_parallel_safe(Relation indrel);
+static void lazy_parallel_vacuum_indexes(LVShared *shared,
+							 LVRelStats *vacrelstats);
+static void lazy_parallel_vacuum_main(dsm_segment *seg, shm_toc *toc);
 static void lazy_vacuum_index(Relation indrel,
 				  IndexBulkDeleteResult **stats,
 				  LVRelStats *vacrelstats);
@@ -712,10 +758,7 @@ lazy_scan_heap(Relation onerel, int options, LVRelStats *vacrelstats,
 										 PROGRESS_VACUUM_PHASE_VACUUM_INDEX);
 
 			/* Remove index entries */
-			for (i = 0; i < nindexes; i++)
-				lazy_vacuum_index(Irel[i],
-								  &indstats[i],
-								  vacrelstats);
+			lazy_vacuum_all_indexes(Irel, nindexes, indstats, vacrelstats);
 
 			/*
 			 * Report that we are now vacuuming the heap.  We also increase
@@ -1291,10 +1334,7 @@ lazy_scan_heap(Relation onerel, int options, LVRelStats *vacrelstats,
 									 PROGRESS_VACUUM_PHASE_VACUUM_INDEX);
 
 		/* Remove index entries */
-		for (i = 0; i < nindexes; i++)
-			lazy_vacuum_index(Irel[i],
-							  &indstats[i],
-							  vacrelstats);
+		lazy_vacuum_all_indexes(Irel, nindexes, indstats, vacrelstats);
 
 		/* Report that we are now vacuuming the heap */
 		hvp_val[0] = PROGRESS_VACUUM_PHASE_VACUUM_HEAP;
@@ -1576,6 +1616,213 @@ lazy_check_needs_freeze(Buffer buf, bool *hastup)
 }
 
 
+/*
+ *	lazy_vacuum_all_indexes() -- vacuum all indexes of the relation.
+ *
+ *		Delete the index entries pointing to the tuples listed in
+ *		vacrelstats->dead_tuples from every index, using parallel workers
+ *		when there are several indexes and max_parallel_maintenance_workers
+ *		allows it.  Autovacuum always works alone, as the cost-based delay
+ *		is not shared with the workers.
+ */
+static void
+lazy_vacuum_all_indexes(Relation *Irel, int nindexes,
+						IndexBulkDeleteResult **indstats,
+						LVRelStats *vacrelstats)
+{
+	ParallelContext *pcxt;
+	LVShared   *shared;
+	ItemPointer dead_tuples;
+	Size		shared_size;
+	Size		dead_tuples_size;
+	int			nparallel = 0;
+	int			nworkers;
+	int			i;
+	int			j;
+
+	for (i = 0; i < nindexes; i++)
+	{
+		if (lazy_index_parallel_safe(Irel[i]))
+			nparallel++;
+	}
+
+	/* The leader vacuums indexes too, so one worker fewer will do */
+	nworkers = Min(max_parallel_maintenance_workers, nparallel - 1);
+
+	/* Workers can't see the local buffers of temporary relations */
+	if (nworkers <= 0 ||
+		dynamic_shared_memory_type == DSM_IMPL_NONE ||
+		!IsUnderPostmaster ||
+		IsAutoVacuumWorkerProcess() ||
+		IsInParallelMode() ||
+		RelationUsesLocalBuffers(Irel[0]))
+	{
+		for (i = 0; i < nindexes; i++)
+			lazy_vacuum_index(Irel[i], &indstats[i], vacrelstats);
+		return;
+	}
+
+	EnterParallelMode();
+	pcxt = CreateParallelContext(lazy_parallel_vacuum_main, nworkers);
+
+	shared_size = add_size(offsetof(LVShared, indexes),
+						   mul_size(nparallel, sizeof(LVSharedIndex)));
+	dead_tuples_size = mul_size(vacrelstats->num_dead_tuples,
+								sizeof(ItemPointerData));
+	shm_toc_estimate_chunk(&pcxt->estimator, shared_size);
+	shm_toc_estimate_chunk(&pcxt->estimator, dead_tuples_size);
+	shm_toc_estimate_keys(&pcxt->estimator, 2);
+
+	InitializeParallelDSM(pcxt);
+
+	shared = (LVShared *) shm_toc_allocate(pcxt->toc, shared_size);
+	shared->elevel = elevel;
+	shared->old_rel_tuples = vacrelstats->old_rel_tuples;
+	shared->num_dead_tuples = vacrelstats->num_dead_tuples;
+	shared->nindexes = nparallel;
+	pg_atomic_init_u32(&shared->nextindex, 0);
+	for (i = 0, j = 0; i < nindexes; i++)
+	{
+		LVSharedIndex *sind;
+
+		if (!lazy_index_parallel_safe(Irel[i]))
+			continue;
+
+		sind = &shared->indexes[j++];
+		sind->indexoid = RelationGetRelid(Irel[i]);
+		sind->has_stats = (indstats[i] != NULL);
+		if (sind->has_stats)
+			memcpy(&sind->stats, indstats[i], sizeof(IndexBulkDeleteResult));
+	}
+	shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_SHARED, shared);
+
+	dead_tuples = (ItemPointer) shm_toc_allocate(pcxt->toc, dead_tuples_size);
+	memcpy(dead_tuples, vacrelstats->dead_tuples, dead_tuples_size);
+	shm_toc_insert(pcxt->toc, PARALLEL_VACUUM_KEY_DEAD_TUPLES, dead_tuples);
+
+	LaunchParallelWorkers(pcxt);
+
+	/* Vacuum the indexes workers can't take, then help with the rest */
+	for (i = 0; i < nindexes; i++)
+	{
+		if (!lazy_index_parallel_safe(Irel[i]))
+			lazy_vacuum_index(Irel[i], &indstats[i], vacrelstats);
+	}
+	lazy_parallel_vacuum_indexes(shared, vacrelstats);
+
+	WaitForParallelWorkersToFinish(pcxt);
+
+	/* Bring the statistics back for the next pass and the cleanup */
+	for (i = 0, j = 0; i < nindexes; i++)
+	{
+		LVSharedIndex *sind;
+
+		if (!lazy_index_parallel_safe(Irel[i]))
+			continue;
+
+		sind = &shared->indexes[j++];
+		if (!sind->has_stats)
+			continue;
+		if (indstats[i] == NULL)
+			indstats[i] = (IndexBulkDeleteResult *)
+				palloc(sizeof(IndexBulkDeleteResult));
+		memcpy(indstats[i], &sind->stats, sizeof(IndexBulkDeleteResult));
+	}
+
+	DestroyParallelContext(pcxt);
+	ExitParallelMode();
+}
+
+/*
+ * Can a parallel worker vacuum this index?  Only the built-in access methods
+ * are known to keep their bulk-delete state in a plain IndexBulkDeleteResult.
+ */
+static bool
+lazy_index_parallel_safe(Relation indrel)
+{
+	switch (indrel->rd_rel->relam)
+	{
+		case BTREE_AM_OID:
+		case HASH_AM_OID:
+		case GIST_AM_OID:
+		case GIN_AM_OID:
+		case SPGIST_AM_OID:
+		case BRIN_AM_OID:
+			return true;
+		default:
+			return false;
+	}
+}
+
+/*
+ * Vacuum indexes from the shared list until none is left.  Used both by the
+ * leader and by the parallel workers.
+ */
+static void
+lazy_parallel_vacuum_indexes(LVShared *shared, LVRelStats *vacrelstats)
+{
+	for (;;)
+	{
+		LVSharedIndex *sind;
+		IndexBulkDeleteResult *stats;
+		Relation	indrel;
+		uint32		idx;
+
+		idx = pg_atomic_fetch_add_u32(&shared->nextindex, 1);
+		if (idx >= shared->nindexes)
+			break;
+		sind = &shared->indexes[idx];
+
+		/* The leader already holds this lock, and we're in its lock group */
+		indrel = index_open(sind->indexoid, RowExclusiveLock);
+
+		stats = sind->has_stats ? &sind->stats : NULL;
+		lazy_vacuum_index(indrel, &stats, vacrelstats);
+		if (stats != NULL)
+		{
+			if (stats != &sind->stats)
+				memcpy(&sind->stats, stats, sizeof(IndexBulkDeleteResult));
+			sind->has_stats = true;
+		}
+
+		index_close(indrel, RowExclusiveLock);
+	}
+}
+
+/*
+ * Main entry point of a parallel worker vacuuming indexes.
+ */
+static void
+lazy_parallel_vacuum_main(dsm_segment *seg, shm_toc *toc)
+{
+	LVShared   *shared;
+	LVRelStats	vacrelstats;
+
+	/* Like the leader, don't hold back the xmin horizon of other vacuums */
+	LWLockAcquire(ProcArrayLock, LW_EXCLUSIVE);
+	MyPgXact->vacuumFlags |= PROC_IN_VACUUM;
+	LWLockRelease(ProcArrayLock);
+
+	shared = (LVShared *) shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_SHARED);
+
+	elevel = shared->elevel;
+	vac_strategy = GetAccessStrategy(BAS_VACUUM);
+
+	/* Each worker does its own cost-based delay */
+	VacuumCostActive = (VacuumCostDelay > 0);
+	VacuumCostBalance = 0;
+
+	memset(&vacrelstats, 0, sizeof(vacrelstats));
+	vacrelstats.hasindex = true;
+	vacrelstats.old_rel_tuples = shared->old_rel_tuples;
+	vacrelstats.num_dead_tuples = shared->num_dead_tuples;
+	vacrelstats.max_dead_tuples = shared->num_dead_tuples;
+	vacrelstats.dead_tuples = (ItemPointer)
+		shm_toc_lookup(toc, PARALLEL_VACUUM_KEY_DEAD_TUPLES);
+
+	lazy_parallel_vacuum_indexes(shared, &vacrelstats);
+}
+
 /*
  *	lazy_vacuum_index() -- vacuum one index relation.
  *
@@ -473,8 +473,13 @@ ExecSupportsBackwardScan(Plan *node)
 				return true;
 			}
 
-		case T_SeqScan:
 		case T_TidScan:
+			/* Ranges are read with a forward-only scan of their blocks */
+			if (TidScanIsRange((TidScan *) node))
+				return false;
+			return TargetListSupportsBackwardScan(node->targetlist);
+
+		case T_SeqScan:
 		case T_FunctionScan:
 		case T_ValuesScan:
 		case T_CteScan:
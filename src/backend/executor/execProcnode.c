@@ -806,6 +806,12 @@ ExecShutdownNode(PlanState *node)
 		case T_GatherState:
 			ExecShutdownGather((GatherState *) node);
 			break;
+		case T_HashState:
+			ExecShutdownHash((HashState *) node);
+			break;
+		case T_BitmapHeapScanState:
+			ExecShutdownBitmapHeapScan((BitmapHeapScanState *) node);
+			break;
 		default:
 			break;
 	}
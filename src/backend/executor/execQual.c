@@ -109,6 +109,11 @@ static Datum ExecMakeFunctionResult(FuncExprState *fcache,
 static Datum ExecMakeFunctionResultNoSets(FuncExprState *fcache,
 							 ExprContext *econtext,
 							 bool *isNull, ExprDoneCond *isDone);
+static Datum ExecMakeFunctionResultConstArg(FuncExprState *fcache,
+							   ExprContext *econtext,
+							   bool *isNull, ExprDoneCond *isDone);
+static ExprStateEvalFunc choose_function_evalfunc(FuncExprState *fcache,
+						 List *args);
 static Datum ExecEvalFunc(FuncExprState *fcache, ExprContext *econtext,
 			 bool *isNull, ExprDoneCond *isDone);
 static Datum ExecEvalOper(FuncExprState *fcache, ExprContext *econtext,
@@ -2047,6 +2052,100 @@ ExecMakeFunctionResultNoSets(FuncExprState *fcache,
 }
 
 
+/*
+ *		ExecMakeFunctionResultConstArg
+ *
+ * Specialized version of ExecMakeFunctionResultNoSets for the common shape
+ * of WHERE and join clauses: a strict builtin function of two arguments,
+ * one of which is a non-null Const, such as "column op constant".  The
+ * constant was stored into the fcinfo once by choose_function_evalfunc, so
+ * per row we only evaluate the other argument, check it for NULL and call
+ * the function.  Builtins are never tracked by pgstat, so that bookkeeping
+ * is skipped as well.
+ */
+static Datum
+ExecMakeFunctionResultConstArg(FuncExprState *fcache,
+							   ExprContext *econtext,
+							   bool *isNull,
+							   ExprDoneCond *isDone)
+{
+	FunctionCallInfo fcinfo = &fcache->fcinfo_data;
+	ExprState  *argstate;
+	int			argno;
+	Datum		result;
+
+	/* Guard against stack overflow due to overly complex expressions */
+	check_stack_depth();
+
+	if (isDone)
+		*isDone = ExprSingleResult;
+
+	argstate = (ExprState *) linitial(fcache->args);
+	argno = 0;
+	if (IsA(argstate->expr, Const))
+	{
+		argstate = (ExprState *) lsecond(fcache->args);
+		argno = 1;
+	}
+
+	fcinfo->arg[argno] = ExecEvalExpr(argstate, econtext,
+									  &fcinfo->argnull[argno], NULL);
+	if (fcinfo->argnull[argno])
+	{
+		*isNull = true;
+		return (Datum) 0;
+	}
+
+	fcinfo->isnull = false;
+	result = FunctionCallInvoke(fcinfo);
+	*isNull = fcinfo->isnull;
+
+	return result;
+}
+
+/*
+ * Pick the evaluation routine of a function or operator whose fcache has
+ * just been set up by init_fcache.
+ */
+static ExprStateEvalFunc
+choose_function_evalfunc(FuncExprState *fcache, List *args)
+{
+	/*
+	 * We need to invoke ExecMakeFunctionResult if either the function itself
+	 * or any of its input expressions can return a set.
+	 */
+	if (fcache->func.fn_retset || expression_returns_set((Node *) args))
+		return (ExprStateEvalFunc) ExecMakeFunctionResult;
+
+	if (fcache->func.fn_strict &&
+		fcache->func.fn_stats == TRACK_FUNC_ALL &&
+		list_length(args) == 2)
+	{
+		Node	   *larg = (Node *) linitial(args);
+		Node	   *rarg = (Node *) lsecond(args);
+		Const	   *con = NULL;
+		int			argno = 0;
+
+		if (IsA(rarg, Const) && !IsA(larg, Const))
+		{
+			con = (Const *) rarg;
+			argno = 1;
+		}
+		else if (IsA(larg, Const) && !IsA(rarg, Const))
+			con = (Const *) larg;
+
+		if (con != NULL && !con->constisnull)
+		{
+			fcache->fcinfo_data.arg[argno] = con->constvalue;
+			fcache->fcinfo_data.argnull[argno] = false;
+			return (ExprStateEvalFunc) ExecMakeFunctionResultConstArg;
+		}
+	}
+
+	return (ExprStateEvalFunc) ExecMakeFunctionResultNoSets;
+}
+
+
 /*
  *		ExecMakeTableFunctionResult
  *
@@ -2420,22 +2519,9 @@ ExecEvalFunc(FuncExprState *fcache,
 	init_fcache(func->funcid, func->inputcollid, fcache,
 				econtext->ecxt_per_query_memory, true);
 
-	/*
-	 * We need to invoke ExecMakeFunctionResult if either the function itself
-	 * or any of its input expressions can return a set.  Otherwise, invoke
-	 * ExecMakeFunctionResultNoSets.  In either case, change the evalfunc
-	 * pointer to go directly there on subsequent uses.
-	 */
-	if (fcache->func.fn_retset || expression_returns_set((Node *) func->args))
-	{
-		fcache->xprstate.evalfunc = (ExprStateEvalFunc) ExecMakeFunctionResult;
-		return ExecMakeFunctionResult(fcache, econtext, isNull, isDone);
-	}
-	else
-	{
-		fcache->xprstate.evalfunc = (ExprStateEvalFunc) ExecMakeFunctionResultNoSets;
-		return ExecMakeFunctionResultNoSets(fcache, econtext, isNull, isDone);
-	}
+	/* Change the evalfunc pointer to go directly there on subsequent uses */
+	fcache->xprstate.evalfunc = choose_function_evalfunc(fcache, func->args);
+	return ExecEvalExpr((ExprState *) fcache, econtext, isNull, isDone);
 }
 
 /* ----------------------------------------------------------------
@@ -2455,22 +2541,9 @@ ExecEvalOper(FuncExprState *fcache,
 	init_fcache(op->opfuncid, op->inputcollid, fcache,
 				econtext->ecxt_per_query_memory, true);
 
-	/*
-	 * We need to invoke ExecMakeFunctionResult if either the function itself
-	 * or any of its input expressions can return a set.  Otherwise, invoke
-	 * ExecMakeFunctionResultNoSets.  In either case, change the evalfunc
-	 * pointer to go directly there on subsequent uses.
-	 */
-	if (fcache->func.fn_retset || expression_returns_set((Node *) op->args))
-	{
-		fcache->xprstate.evalfunc = (ExprStateEvalFunc) ExecMakeFunctionResult;
-		return ExecMakeFunctionResult(fcache, econtext, isNull, isDone);
-	}
-	else
-	{
-		fcache->xprstate.evalfunc = (ExprStateEvalFunc) ExecMakeFunctionResultNoSets;
-		return ExecMakeFunctionResultNoSets(fcache, econtext, isNull, isDone);
-	}
+	/* Change the evalfunc pointer to go directly there on subsequent uses */
+	fcache->xprstate.evalfunc = choose_function_evalfunc(fcache, op->args);
+	return ExecEvalExpr((ExprState *) fcache, econtext, isNull, isDone);
 }
 
 /* ----------------------------------------------------------------
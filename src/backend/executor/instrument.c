@@ -13,18 +13,143 @@
  */
 #include "postgres.h"
 
+#include <time.h>
 #include <unistd.h>
 
 #include "executor/instrument.h"
 
+/*
+ * Use the time stamp counter for timing plan nodes where we know how to read
+ * it, and it is known to tick at a constant rate.  Otherwise, or if it can't
+ * be calibrated, fall back to the usual clock.
+ */
+#if defined(__x86_64__) && defined(__GNUC__) && defined(HAVE__GET_CPUID)
+#define USE_TSC_TIMING
+#include <cpuid.h>
+#endif
+
+/* Busy-wait this long to learn the time stamp counter's rate */
+#define TSC_CALIBRATION_USEC	10000
+
 BufferUsage pgBufferUsage;
 static BufferUsage save_pgBufferUsage;
 
+/* Length of an instr_cycles unit, 0 until InstrInitTiming() */
+static double instr_seconds_per_cycle = 0;
+
+#ifdef USE_TSC_TIMING
+static bool instr_use_tsc = false;
+#endif
+
+/* State of the generator choosing the samples of INSTRUMENT_TIMER_SAMPLED */
+static uint32 instr_sample_state = 1;
+
 static void BufferUsageAdd(BufferUsage *dst, const BufferUsage *add);
 static void BufferUsageAccumDiff(BufferUsage *dst,
 					 const BufferUsage *add, const BufferUsage *sub);
 
 
+#ifdef USE_TSC_TIMING
+/*
+ * Can the time stamp counter serve as a clock?  Only if it is invariant,
+ * that is, ticks at the same rate whatever the frequency and power state of
+ * the CPU.
+ */
+static bool
+tsc_is_invariant(void)
+{
+	unsigned int exx[4] = {0, 0, 0, 0};
+
+	if (!__get_cpuid(0x80000007, &exx[0], &exx[1], &exx[2], &exx[3]))
+		return false;
+
+	return (exx[3] & (1 << 8)) != 0;	/* invariant TSC */
+}
+#endif
+
+/*
+ * Read the clock plan nodes are timed with.
+ */
+static inline instr_cycles
+InstrGetCycles(void)
+{
+#ifndef CLOCK_MONOTONIC
+	instr_time	now;
+#endif
+
+#ifdef USE_TSC_TIMING
+	if (instr_use_tsc)
+		return __builtin_ia32_rdtsc();
+#endif
+
+#ifdef CLOCK_MONOTONIC
+	{
+		struct timespec ts;
+
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return (instr_cycles) ts.tv_sec * 1000000000 + ts.tv_nsec;
+	}
+#else
+	INSTR_TIME_SET_CURRENT(now);
+	return INSTR_TIME_GET_MICROSEC(now);
+#endif
+}
+
+/*
+ * Choose the clock plan nodes are timed with, calibrating the time stamp
+ * counter if that's to be used.
+ *
+ * The postmaster does this at startup for all its children; otherwise it is
+ * done the first time a timer is needed.
+ */
+void
+InstrInitTiming(void)
+{
+	if (instr_seconds_per_cycle != 0)
+		return;
+
+#ifdef USE_TSC_TIMING
+	if (tsc_is_invariant())
+	{
+		instr_time	start;
+		instr_time	elapsed;
+		instr_cycles start_tsc;
+		instr_cycles tsc_elapsed;
+
+		INSTR_TIME_SET_CURRENT(start);
+		start_tsc = __builtin_ia32_rdtsc();
+		do
+		{
+			INSTR_TIME_SET_CURRENT(elapsed);
+			INSTR_TIME_SUBTRACT(elapsed, start);
+		} while (INSTR_TIME_GET_MICROSEC(elapsed) < TSC_CALIBRATION_USEC);
+		tsc_elapsed = __builtin_ia32_rdtsc() - start_tsc;
+
+		/* believe only in a rate of at least 100 MHz */
+		if (tsc_elapsed / INSTR_TIME_GET_DOUBLE(elapsed) >= 1.0e8)
+		{
+			instr_seconds_per_cycle =
+				INSTR_TIME_GET_DOUBLE(elapsed) / tsc_elapsed;
+			instr_use_tsc = true;
+			return;
+		}
+	}
+#endif
+
+#ifdef CLOCK_MONOTONIC
+	instr_seconds_per_cycle = 1.0e-9;
+#else
+	instr_seconds_per_cycle = 1.0e-6;
+#endif
+}
+
+/* Convert an interval of the clock plan nodes are timed with to seconds */
+double
+InstrCyclesToSeconds(instr_cycles cycles)
+{
+	return (double) cycles * instr_seconds_per_cycle;
+}
+
 /* Allocate new instrumentation structure(s) */
 Instrumentation *
 InstrAlloc(int n, int instrument_options)
@@ -37,13 +162,18 @@ InstrAlloc(int n, int instrument_options)
 	{
 		bool		need_buffers = (instrument_options & INSTRUMENT_BUFFERS) != 0;
 		bool		need_timer = (instrument_options & INSTRUMENT_TIMER) != 0;
+		bool		sample_timer = (instrument_options & INSTRUMENT_TIMER_SAMPLED) != 0;
 		int			i;
 
 		for (i = 0; i < n; i++)
 		{
 			instr[i].need_bufusage = need_buffers;
 			instr[i].need_timer = need_timer;
+			instr[i].sample_timer = need_timer && sample_timer;
 		}
+
+		if (need_timer)
+			InstrInitTiming();
 	}
 
 	return instr;
@@ -56,6 +186,33 @@ InstrInit(Instrumentation *instr, int instrument_options)
 	memset(instr, 0, sizeof(Instrumentation));
 	instr->need_bufusage = (instrument_options & INSTRUMENT_BUFFERS) != 0;
 	instr->need_timer = (instrument_options & INSTRUMENT_TIMER) != 0;
+	instr->sample_timer = instr->need_timer &&
+		(instrument_options & INSTRUMENT_TIMER_SAMPLED) != 0;
+
+	if (instr->need_timer)
+		InstrInitTiming();
+}
+
+/*
+ * Should this execution of a node with a sampling timer be timed?
+ *
+ * The first INSTR_TIMER_SAMPLE_PERIOD executions of each cycle are, to get
+ * exact numbers for nodes that aren't run often, as is one in about
+ * INSTR_TIMER_SAMPLE_PERIOD of the rest, chosen at random so as not to
+ * fall in step with the node's own patterns.
+ */
+static inline bool
+InstrSampleTimer(Instrumentation *instr)
+{
+	if (instr->ncalls <= INSTR_TIMER_SAMPLE_PERIOD)
+		return true;
+
+	/* xorshift32 */
+	instr_sample_state ^= instr_sample_state << 13;
+	instr_sample_state ^= instr_sample_state >> 17;
+	instr_sample_state ^= instr_sample_state << 5;
+
+	return instr_sample_state % INSTR_TIMER_SAMPLE_PERIOD == 0;
 }
 
 /* Entry to a plan node */
@@ -64,10 +221,15 @@ InstrStartNode(Instrumentation *instr)
 {
 	if (instr->need_timer)
 	{
-		if (INSTR_TIME_IS_ZERO(instr->starttime))
-			INSTR_TIME_SET_CURRENT(instr->starttime);
-		else
+		instr->ncalls += 1;
+
+		if (instr->starttime != 0)
 			elog(ERROR, "InstrStartNode called twice in a row");
+		else if (!instr->sample_timer || InstrSampleTimer(instr))
+		{
+			instr->starttime = InstrGetCycles();
+			instr->ntimed += 1;
+		}
 	}
 
 	/* save buffer usage totals at node entry, if needed */
@@ -79,21 +241,26 @@ InstrStartNode(Instrumentation *instr)
 void
 InstrStopNode(Instrumentation *instr, double nTuples)
 {
-	instr_time	endtime;
+	instr_cycles endtime;
 
 	/* count the returned tuples */
 	instr->tuplecount += nTuples;
 
-	/* let's update the time only if the timer was requested */
-	if (instr->need_timer)
+	/*
+	 * let's update the time only if the timer was requested, and this
+	 * execution was chosen to be timed
+	 */
+	if (instr->need_timer && (instr->starttime != 0 || !instr->sample_timer))
 	{
-		if (INSTR_TIME_IS_ZERO(instr->starttime))
+		if (instr->starttime == 0)
 			elog(ERROR, "InstrStopNode called without start");
 
-		INSTR_TIME_SET_CURRENT(endtime);
-		INSTR_TIME_ACCUM_DIFF(instr->counter, endtime, instr->starttime);
+		/* the counter is not guaranteed monotonic across CPUs */
+		endtime = InstrGetCycles();
+		if (endtime > instr->starttime)
+			instr->counter += endtime - instr->starttime;
 
-		INSTR_TIME_SET_ZERO(instr->starttime);
+		instr->starttime = 0;
 	}
 
 	/* Add delta of buffer usage since entry to node's totals */
@@ -105,7 +272,7 @@ InstrStopNode(Instrumentation *instr, double nTuples)
 	if (!instr->running)
 	{
 		instr->running = true;
-		instr->firsttuple = INSTR_TIME_GET_DOUBLE(instr->counter);
+		instr->firsttuple = InstrCyclesToSeconds(instr->counter);
 	}
 }
 
@@ -119,11 +286,19 @@ InstrEndLoop(Instrumentation *instr)
 	if (!instr->running)
 		return;
 
-	if (!INSTR_TIME_IS_ZERO(instr->starttime))
+	if (instr->starttime != 0)
 		elog(ERROR, "InstrEndLoop called on running node");
 
 	/* Accumulate per-cycle statistics into totals */
-	totaltime = INSTR_TIME_GET_DOUBLE(instr->counter);
+	totaltime = InstrCyclesToSeconds(instr->counter);
+
+	/*
+	 * Scale up the time of the executions after the first one, if only a
+	 * sample of them was timed.  The first one always is.
+	 */
+	if (instr->ntimed < instr->ncalls && instr->ntimed > 1)
+		totaltime = instr->firsttuple + (totaltime - instr->firsttuple) *
+			(instr->ncalls - 1) / (instr->ntimed - 1);
 
 	instr->startup += instr->firsttuple;
 	instr->total += totaltime;
@@ -132,8 +307,10 @@ InstrEndLoop(Instrumentation *instr)
 
 	/* Reset for next cycle (if any) */
 	instr->running = false;
-	INSTR_TIME_SET_ZERO(instr->starttime);
-	INSTR_TIME_SET_ZERO(instr->counter);
+	instr->starttime = 0;
+	instr->counter = 0;
+	instr->ncalls = 0;
+	instr->ntimed = 0;
 	instr->firsttuple = 0;
 	instr->tuplecount = 0;
 }
@@ -150,7 +327,9 @@ InstrAggNode(Instrumentation *dst, Instrumentation *add)
 	else if (dst->running && add->running && dst->firsttuple > add->firsttuple)
 		dst->firsttuple = add->firsttuple;
 
-	INSTR_TIME_ADD(dst->counter, add->counter);
+	dst->counter += add->counter;
+	dst->ncalls += add->ncalls;
+	dst->ntimed += add->ntimed;
 
 	dst->tuplecount += add->tuplecount;
 	dst->startup += add->startup;
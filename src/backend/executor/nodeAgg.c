@@ -69,10 +69,11 @@
  *	  pass-by-reference, we have to be careful to copy it into a longer-lived
  *	  memory context, and free the prior value to avoid memory leakage.  We
  *	  store transvalues in another set of econtexts, aggstate->aggcontexts
- *	  (one per grouping set, see below), which are also used for the hashtable
- *	  structures in AGG_HASHED mode.  These econtexts are rescanned, not just
- *	  reset, at group boundaries so that aggregate transition functions can
- *	  register shutdown callbacks via AggRegisterCallback.
+ *	  (one per grouping set, see below), or in aggstate->hashcontext for the
+ *	  groups of hashed grouping sets, which also holds the hashtable
+ *	  structures.  These econtexts are rescanned, not just reset, at group
+ *	  boundaries so that aggregate transition functions can register shutdown
+ *	  callbacks via AggRegisterCallback.
  *
  *	  The node's regular econtext (aggstate->ss.ps.ps_ExprContext) is used to
  *	  run finalize functions and compute the output tuple; this context can be
@@ -129,6 +130,16 @@
  *	  sorted data.  (The sorting of the data for the first phase is handled by
  *	  the planner, as it might be satisfied by underlying nodes.)
  *
+ *	  Grouping sets can also be hashed, each into its own hash table, and all
+ *	  the hash tables are filled in a single pass over the input.  In
+ *	  AGG_HASHED mode all the grouping sets are hashed, so the input needs no
+ *	  particular order.  In AGG_MIXED mode some of them are hashed and the
+ *	  rest are handled by sorted phases as above: the hash tables are filled
+ *	  while the first sorted phase reads the input, and their groups are
+ *	  emitted once the last sorted phase is done.  All the hashed grouping
+ *	  sets make up phase 0; sorted phases are numbered from 1, so phase 0 is
+ *	  left unused when nothing is hashed.
+ *
  *	  From the perspective of aggregate transition and final functions, the
  *	  only issue regarding grouping sets is this: a single call site (flinfo)
  *	  of an aggregate function may be used for updating several different
@@ -139,8 +150,6 @@
  *	  sensitive to the grouping set for which the aggregate function is
  *	  currently being called.
  *
- *	  TODO: AGG_HASHED doesn't support multiple grouping sets yet.
- *
  * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
  *
@@ -152,6 +161,7 @@
 
 #include "postgres.h"
 
+#include "access/hash.h"
 #include "access/htup_details.h"
 #include "catalog/objectaccess.h"
 #include "catalog/pg_aggregate.h"
@@ -165,8 +175,10 @@
 #include "optimizer/tlist.h"
 #include "parser/parse_agg.h"
 #include "parser/parse_coerce.h"
+#include "storage/buffile.h"
 #include "utils/acl.h"
 #include "utils/builtins.h"
+#include "utils/fmgroids.h"
 #include "utils/lsyscache.h"
 #include "utils/memutils.h"
 #include "utils/syscache.h"
@@ -183,6 +195,30 @@
  * state, that's stored in AggStatePerAggData instead. This separation allows
  * multiple aggregate results to be produced from a single state value.
  */
+/*
+ * Transition functions of the most common aggregates over pass-by-value
+ * types (count, sum, min and max on integers and float8), which
+ * advance_transition_function evaluates inline instead of paying an fmgr
+ * call per input row.  The inline code must behave exactly like the
+ * corresponding builtin function, including its overflow checks.
+ */
+typedef enum AggTransInline
+{
+	AGG_TRANS_FMGR,				/* call transfn through fmgr */
+	AGG_TRANS_INT8INC,			/* int8inc, int8inc_any */
+	AGG_TRANS_INT8PL,
+	AGG_TRANS_INT2_SUM,
+	AGG_TRANS_INT4_SUM,
+	AGG_TRANS_INT2LARGER,
+	AGG_TRANS_INT2SMALLER,
+	AGG_TRANS_INT4LARGER,
+	AGG_TRANS_INT4SMALLER,
+	AGG_TRANS_INT8LARGER,
+	AGG_TRANS_INT8SMALLER,
+	AGG_TRANS_FLOAT8LARGER,
+	AGG_TRANS_FLOAT8SMALLER
+} AggTransInline;
+
 typedef struct AggStatePerTransData
 {
 	/*
@@ -243,6 +279,9 @@ typedef struct AggStatePerTransData
 	 */
 	FmgrInfo	transfn;
 
+	/* inline evaluation of transfn, or AGG_TRANS_FMGR */
+	AggTransInline transfn_inline;
+
 	/* fmgr lookup data for serialization function */
 	FmgrInfo	serialfn;
 
@@ -425,7 +464,9 @@ typedef struct AggStatePerGroupData
  * taken over the data which has been re-sorted in the mean time.
  *
  * Accordingly, each phase specifies a list of grouping sets and group clause
- * information, plus each phase after the first also has a sort order.
+ * information, plus each sorted phase after the first also has a sort order.
+ * Phase 0 holds the hashed grouping sets, if any; its grouping set data is
+ * indexed like aggstate->perhash.
  */
 typedef struct AggStatePerPhaseData
 {
@@ -441,26 +482,79 @@ typedef struct AggStatePerPhaseData
  * To implement hashed aggregation, we need a hashtable that stores a
  * representative tuple and an array of AggStatePerGroup structs for each
  * distinct set of GROUP BY column values.  We compute the hash key from
- * the GROUP BY columns.
+ * the GROUP BY columns.  The per-group array is the "additional" data of
+ * each TupleHashEntryData.
+ *
+ * AggStatePerHashData - per-hashtable state
+ *
+ * There is one hashtable for each hashed grouping set, or just one when
+ * hashing without grouping sets.
  */
-typedef struct AggHashEntryData *AggHashEntry;
+typedef struct AggStatePerHashData
+{
+	TupleHashTable hashtable;	/* hash table with one entry per group */
+	TupleHashIterator hashiter; /* for iterating through hash table */
+	TupleTableSlot *hashslot;	/* slot for loading hash table */
+	FmgrInfo   *hashfunctions;	/* per-grouping-field hash fns */
+	FmgrInfo   *eqfunctions;	/* per-grouping-field equality fns */
+	List	   *hash_needed;	/* list of columns needed in hash table */
+	Agg		   *aggnode;		/* original Agg node, for numGroups etc. */
+}	AggStatePerHashData;
 
-typedef struct AggHashEntryData
+/*
+ * When the hash table outgrows work_mem, we stop creating new groups.
+ * Input tuples that belong to groups already in the table are still
+ * aggregated; the rest are written, along with their hash value, to one of
+ * several spill files chosen by the hash value.  Once the input is
+ * exhausted and the table has been emitted, each spill file is read back as
+ * a new batch into an emptied hash table.  A batch that again overflows is
+ * spilled into partitions one level deeper, selected by remixing the hash
+ * value with the depth, so each level splits the data differently.
+ *
+ * With hashed grouping sets, all the hash tables share work_mem, and the
+ * tuples are spilled separately for each set whose group is missing.  A
+ * batch belongs to a single grouping set, so it is reprocessed using only
+ * that set's hash table.
+ */
+typedef struct AggHashBatch
 {
-	TupleHashEntryData shared;	/* common header for hash table entries */
-	/* per-aggregate transition status array */
-	AggStatePerGroupData pergroup[FLEXIBLE_ARRAY_MEMBER];
-}	AggHashEntryData;
+	BufFile    *file;			/* spilled input tuples */
+	int			setno;			/* hashed grouping set they belong to */
+	int			depth;			/* spill depth they were written at */
+} AggHashBatch;
 
+typedef struct AggHashSpillData
+{
+	int			npartitions;	/* number of spill files per set and pass */
+	BufFile   **partitions;		/* files being written in this pass, indexed
+								 * by setno * npartitions + partition */
+	BufFile    *input;			/* batch being read, or NULL for outer plan */
+	int			setno;			/* set of the current batch, or -1 */
+	int			depth;			/* depth of the batch being read */
+	List	   *batches;		/* pending AggHashBatch entries */
+}	AggHashSpillData;
+
+/* how often (in input tuples) to check the hash table's memory usage */
+#define HASHAGG_MEM_CHECK_INTERVAL	1024
+
+/* bounds on the number of spill files opened in a single pass */
+#define HASHAGG_MIN_PARTITIONS		4
+#define HASHAGG_MAX_PARTITIONS		32
+
+static void select_current_set(AggState *aggstate, int setno, bool is_hash);
 static void initialize_phase(AggState *aggstate, int newphase);
 static TupleTableSlot *fetch_input_tuple(AggState *aggstate);
 static void initialize_aggregates(AggState *aggstate,
 					  AggStatePerGroup pergroup,
 					  int numReset);
+static AggTransInline choose_transition_inline(AggStatePerTrans pertrans);
+static bool advance_transition_inline(AggStatePerTrans pertrans,
+						  AggStatePerGroup pergroupstate);
 static void advance_transition_function(AggState *aggstate,
 							AggStatePerTrans pertrans,
 							AggStatePerGroup pergroupstate);
-static void advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup);
+static void advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup,
+				   AggStatePerGroup *pergroups);
 static void advance_combine_function(AggState *aggstate,
 						 AggStatePerTrans pertrans,
 						 AggStatePerGroup pergroupstate);
@@ -484,14 +578,26 @@ static void prepare_projection_slot(AggState *aggstate,
 						int currentSet);
 static void finalize_aggregates(AggState *aggstate,
 					AggStatePerAgg peragg,
-					AggStatePerGroup pergroup,
-					int currentSet);
+					AggStatePerGroup pergroup);
 static TupleTableSlot *project_aggregates(AggState *aggstate);
 static Bitmapset *find_unaggregated_cols(AggState *aggstate);
 static bool find_unaggregated_cols_walker(Node *node, Bitmapset **colnos);
-static void build_hash_table(AggState *aggstate);
-static AggHashEntry lookup_hash_entry(AggState *aggstate,
-				  TupleTableSlot *inputslot);
+static void build_hash_table(AggState *aggstate, int setno);
+static void build_hash_tables(AggState *aggstate);
+static void find_hash_columns(AggState *aggstate);
+static TupleHashEntryData *lookup_hash_entry(AggState *aggstate, int setno,
+				  TupleTableSlot *inputslot, bool create);
+static AggStatePerGroup *lookup_hash_entries(AggState *aggstate,
+					uint32 *batch_hashvalue);
+static uint32 hash_spill_hashvalue(AggState *aggstate, int setno,
+					 TupleTableSlot *slot);
+static void hash_spill_tuple(AggState *aggstate, int setno,
+				 TupleTableSlot *slot, uint32 hashvalue);
+static TupleTableSlot *hash_spill_read_tuple(AggState *aggstate,
+					  uint32 *hashvalue);
+static void hash_spill_finish_pass(AggState *aggstate);
+static bool hash_spill_next_batch(AggState *aggstate);
+static void hash_spill_cleanup(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_direct(AggState *aggstate);
 static void agg_fill_hash_table(AggState *aggstate);
 static TupleTableSlot *agg_retrieve_hash_table(AggState *aggstate);
@@ -512,13 +618,30 @@ static int find_compatible_pertrans(AggState *aggstate, Aggref *newagg,
 
 
 /*
- * Switch to phase "newphase", which must either be 0 (to reset) or
+ * Select the current grouping set; affects current_set and curaggcontext.
+ */
+static void
+select_current_set(AggState *aggstate, int setno, bool is_hash)
+{
+	if (is_hash)
+		aggstate->curaggcontext = aggstate->hashcontext;
+	else
+		aggstate->curaggcontext = aggstate->aggcontexts[setno];
+
+	aggstate->current_set = setno;
+}
+
+/*
+ * Switch to phase "newphase", which must either be 0 or 1 (to reset) or
  * current_phase + 1. Juggle the tuplesorts accordingly.
+ *
+ * Phase 0 is for hashing, which we currently handle last in the AGG_MIXED
+ * case, so when entering phase 0, all we need to do is drop open sorts.
  */
 static void
 initialize_phase(AggState *aggstate, int newphase)
 {
-	Assert(newphase == 0 || newphase == aggstate->current_phase + 1);
+	Assert(newphase <= 1 || newphase == aggstate->current_phase + 1);
 
 	/*
 	 * Whatever the previous state, we're now done with whatever input
@@ -530,7 +653,7 @@ initialize_phase(AggState *aggstate, int newphase)
 		aggstate->sort_in = NULL;
 	}
 
-	if (newphase == 0)
+	if (newphase <= 1)
 	{
 		/*
 		 * Discard any existing output tuplesort.
@@ -557,7 +680,7 @@ initialize_phase(AggState *aggstate, int newphase)
 	 * If this isn't the last phase, we need to sort appropriately for the
 	 * next phase in sequence.
 	 */
-	if (newphase < aggstate->numphases - 1)
+	if (newphase > 0 && newphase < aggstate->numphases - 1)
 	{
 		Sort	   *sortnode = aggstate->phases[newphase + 1].sortnode;
 		PlanState  *outerNode = outerPlanState(aggstate);
@@ -578,8 +701,8 @@ initialize_phase(AggState *aggstate, int newphase)
 }
 
 /*
- * Fetch a tuple from either the outer plan (for phase 0) or from the sorter
- * populated by the previous phase.  Copy it to the sorter for the next phase
+ * Fetch a tuple from either the outer plan (for phase 0 or 1) or from the
+ * sorter populated by the previous phase.  Copy it to the sorter for the next phase
  * if any.
  */
 static TupleTableSlot *
@@ -664,7 +787,7 @@ initialize_aggregate(AggState *aggstate, AggStatePerTrans pertrans,
 		MemoryContext oldContext;
 
 		oldContext = MemoryContextSwitchTo(
-		aggstate->aggcontexts[aggstate->current_set]->ecxt_per_tuple_memory);
+		aggstate->curaggcontext->ecxt_per_tuple_memory);
 		pergroupstate->transValue = datumCopy(pertrans->initValue,
 											  pertrans->transtypeByVal,
 											  pertrans->transtypeLen);
@@ -687,8 +810,9 @@ initialize_aggregate(AggState *aggstate, AggStatePerTrans pertrans,
  *
  * If there are multiple grouping sets, we initialize only the first numReset
  * of them (the grouping sets are ordered so that the most specific one, which
- * is reset most often, is first). As a convenience, if numReset is < 1, we
- * reinitialize all sets.
+ * is reset most often, is first). As a convenience, if numReset is 0, we
+ * reinitialize all sets.  numReset is -1 to initialize the per-group states
+ * of a hashtable entry, which belong to the current grouping set only.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
@@ -702,26 +826,172 @@ initialize_aggregates(AggState *aggstate,
 	int			setno = 0;
 	AggStatePerTrans transstates = aggstate->pertrans;
 
-	if (numReset < 1)
+	if (numReset == 0)
 		numReset = numGroupingSets;
 
 	for (transno = 0; transno < aggstate->numtrans; transno++)
 	{
 		AggStatePerTrans pertrans = &transstates[transno];
 
+		if (numReset < 0)
+		{
+			initialize_aggregate(aggstate, pertrans, &pergroup[transno]);
+			continue;
+		}
+
 		for (setno = 0; setno < numReset; setno++)
 		{
 			AggStatePerGroup pergroupstate;
 
 			pergroupstate = &pergroup[transno + (setno * (aggstate->numtrans))];
 
-			aggstate->current_set = setno;
+			select_current_set(aggstate, setno, false);
 
 			initialize_aggregate(aggstate, pertrans, pergroupstate);
 		}
 	}
 }
 
+/*
+ * Decide whether the transition (or combine) function of pertrans can be
+ * evaluated inline by advance_transition_inline().
+ *
+ * Only builtin functions on pass-by-value transition types qualify, and
+ * only with the strictness they are declared with, since the NULL handling
+ * of advance_transition_function depends on it.
+ */
+static AggTransInline
+choose_transition_inline(AggStatePerTrans pertrans)
+{
+	bool		strict = pertrans->transfn.fn_strict;
+
+	if (!pertrans->transtypeByVal)
+		return AGG_TRANS_FMGR;
+
+	switch (pertrans->transfn_oid)
+	{
+		case F_INT8INC:
+		case F_INT8INC_ANY:
+			return strict ? AGG_TRANS_INT8INC : AGG_TRANS_FMGR;
+		case F_INT8PL:
+			return strict ? AGG_TRANS_INT8PL : AGG_TRANS_FMGR;
+		case F_INT2_SUM:
+			return strict ? AGG_TRANS_FMGR : AGG_TRANS_INT2_SUM;
+		case F_INT4_SUM:
+			return strict ? AGG_TRANS_FMGR : AGG_TRANS_INT4_SUM;
+		case F_INT2LARGER:
+			return strict ? AGG_TRANS_INT2LARGER : AGG_TRANS_FMGR;
+		case F_INT2SMALLER:
+			return strict ? AGG_TRANS_INT2SMALLER : AGG_TRANS_FMGR;
+		case F_INT4LARGER:
+			return strict ? AGG_TRANS_INT4LARGER : AGG_TRANS_FMGR;
+		case F_INT4SMALLER:
+			return strict ? AGG_TRANS_INT4SMALLER : AGG_TRANS_FMGR;
+		case F_INT8LARGER:
+			return strict ? AGG_TRANS_INT8LARGER : AGG_TRANS_FMGR;
+		case F_INT8SMALLER:
+			return strict ? AGG_TRANS_INT8SMALLER : AGG_TRANS_FMGR;
+		case F_FLOAT8LARGER:
+			return strict ? AGG_TRANS_FLOAT8LARGER : AGG_TRANS_FMGR;
+		case F_FLOAT8SMALLER:
+			return strict ? AGG_TRANS_FLOAT8SMALLER : AGG_TRANS_FMGR;
+		default:
+			return AGG_TRANS_FMGR;
+	}
+}
+
+/*
+ * Inline counterpart of calling the transition or combine function.
+ *
+ * The caller has already dealt with NULL inputs of strict functions, so
+ * both the transition value and the input are known to be non-NULL here
+ * in that case.  Returns false if the function has to be called through
+ * fmgr after all.
+ */
+static bool
+advance_transition_inline(AggStatePerTrans pertrans,
+						  AggStatePerGroup pergroupstate)
+{
+	FunctionCallInfo fcinfo = &pertrans->transfn_fcinfo;
+	Datum		state = pergroupstate->transValue;
+	Datum		input = fcinfo->arg[1];
+	int64		old64;
+	int64		new64;
+
+	switch (pertrans->transfn_inline)
+	{
+		case AGG_TRANS_INT8INC:
+			old64 = DatumGetInt64(state);
+			new64 = old64 + 1;
+			if (new64 < 0 && old64 > 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("bigint out of range")));
+			pergroupstate->transValue = Int64GetDatum(new64);
+			break;
+		case AGG_TRANS_INT8PL:
+			old64 = DatumGetInt64(state);
+			new64 = old64 + DatumGetInt64(input);
+			/* same sign inputs must give a sum of that sign, as in int8pl */
+			if ((old64 < 0) == (DatumGetInt64(input) < 0) &&
+				(new64 < 0) != (old64 < 0))
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("bigint out of range")));
+			pergroupstate->transValue = Int64GetDatum(new64);
+			break;
+		case AGG_TRANS_INT2_SUM:
+		case AGG_TRANS_INT4_SUM:
+			/* non-strict: NULL input leaves the sum alone */
+			if (fcinfo->argnull[1])
+				break;
+			new64 = pertrans->transfn_inline == AGG_TRANS_INT2_SUM ?
+				(int64) DatumGetInt16(input) : (int64) DatumGetInt32(input);
+			if (!pergroupstate->transValueIsNull)
+				new64 += DatumGetInt64(state);
+			pergroupstate->transValue = Int64GetDatum(new64);
+			pergroupstate->transValueIsNull = false;
+			break;
+		case AGG_TRANS_INT2LARGER:
+			if (DatumGetInt16(input) > DatumGetInt16(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_INT2SMALLER:
+			if (DatumGetInt16(input) < DatumGetInt16(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_INT4LARGER:
+			if (DatumGetInt32(input) > DatumGetInt32(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_INT4SMALLER:
+			if (DatumGetInt32(input) < DatumGetInt32(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_INT8LARGER:
+			if (DatumGetInt64(input) > DatumGetInt64(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_INT8SMALLER:
+			if (DatumGetInt64(input) < DatumGetInt64(state))
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_FLOAT8LARGER:
+			if (float8_cmp_internal(DatumGetFloat8(state),
+									DatumGetFloat8(input)) <= 0)
+				pergroupstate->transValue = input;
+			break;
+		case AGG_TRANS_FLOAT8SMALLER:
+			if (float8_cmp_internal(DatumGetFloat8(state),
+									DatumGetFloat8(input)) >= 0)
+				pergroupstate->transValue = input;
+			break;
+		default:
+			return false;
+	}
+	return true;
+}
+
 /*
  * Given new input value(s), advance the transition function of one aggregate
  * state within one grouping set only (already set in aggstate->current_set)
@@ -768,7 +1038,7 @@ advance_transition_function(AggState *aggstate,
 			 * do not need to pfree the old transValue, since it's NULL.
 			 */
 			oldContext = MemoryContextSwitchTo(
-											   aggstate->aggcontexts[aggstate->current_set]->ecxt_per_tuple_memory);
+											   aggstate->curaggcontext->ecxt_per_tuple_memory);
 			pergroupstate->transValue = datumCopy(fcinfo->arg[1],
 												  pertrans->transtypeByVal,
 												  pertrans->transtypeLen);
@@ -789,6 +1059,10 @@ advance_transition_function(AggState *aggstate,
 		}
 	}
 
+	if (pertrans->transfn_inline != AGG_TRANS_FMGR &&
+		advance_transition_inline(pertrans, pergroupstate))
+		return;
+
 	/* We run the transition functions in per-input-tuple memory context */
 	oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
 
@@ -818,7 +1092,7 @@ advance_transition_function(AggState *aggstate,
 	{
 		if (!fcinfo->isnull)
 		{
-			MemoryContextSwitchTo(aggstate->aggcontexts[aggstate->current_set]->ecxt_per_tuple_memory);
+			MemoryContextSwitchTo(aggstate->curaggcontext->ecxt_per_tuple_memory);
 			if (DatumIsReadWriteExpandedObject(newVal,
 											   false,
 											   pertrans->transtypeLen) &&
@@ -849,17 +1123,23 @@ advance_transition_function(AggState *aggstate,
 /*
  * Advance each aggregate transition state for one input tuple.  The input
  * tuple has been stored in tmpcontext->ecxt_outertuple, so that it is
- * accessible to ExecEvalExpr.  pergroup is the array of per-group structs to
- * use (this might be in a hashtable entry).
+ * accessible to ExecEvalExpr.
+ *
+ * pergroup is the array of per-group structs of the sorted grouping sets of
+ * the current phase, or NULL if nothing is sorted.  pergroups is NULL, or
+ * holds the hashtable entries of each hashed grouping set, as returned by
+ * lookup_hash_entries; the sets whose entry is NULL are skipped.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
 static void
-advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
+advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup,
+				   AggStatePerGroup *pergroups)
 {
 	int			transno;
 	int			setno = 0;
 	int			numGroupingSets = Max(aggstate->phase->numsets, 1);
+	int			numHashes = aggstate->num_hashes;
 	int			numTrans = aggstate->numtrans;
 
 	for (transno = 0; transno < numTrans; transno++)
@@ -908,6 +1188,9 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 					continue;
 			}
 
+			/* Hashed grouping sets never have DISTINCT or ORDER BY aggs */
+			Assert(pergroup != NULL);
+
 			for (setno = 0; setno < numGroupingSets; setno++)
 			{
 				/* OK, put the tuple into the tuplesort object */
@@ -933,13 +1216,32 @@ advance_aggregates(AggState *aggstate, AggStatePerGroup pergroup)
 				fcinfo->argnull[i + 1] = slot->tts_isnull[i];
 			}
 
-			for (setno = 0; setno < numGroupingSets; setno++)
+			if (pergroup)
 			{
-				AggStatePerGroup pergroupstate = &pergroup[transno + (setno * numTrans)];
+				/* advance transition states for sorted grouping */
+				for (setno = 0; setno < numGroupingSets; setno++)
+				{
+					AggStatePerGroup pergroupstate = &pergroup[transno + (setno * numTrans)];
 
-				aggstate->current_set = setno;
+					select_current_set(aggstate, setno, false);
+
+					advance_transition_function(aggstate, pertrans, pergroupstate);
+				}
+			}
 
-				advance_transition_function(aggstate, pertrans, pergroupstate);
+			if (pergroups)
+			{
+				/* advance transition states for hashed grouping */
+				for (setno = 0; setno < numHashes; setno++)
+				{
+					if (pergroups[setno] == NULL)
+						continue;
+
+					select_current_set(aggstate, setno, true);
+
+					advance_transition_function(aggstate, pertrans,
+												&pergroups[setno][transno]);
+				}
 			}
 		}
 	}
@@ -1051,7 +1353,7 @@ advance_combine_function(AggState *aggstate,
 			if (!pertrans->transtypeByVal)
 			{
 				oldContext = MemoryContextSwitchTo(
-												   aggstate->aggcontexts[aggstate->current_set]->ecxt_per_tuple_memory);
+												   aggstate->curaggcontext->ecxt_per_tuple_memory);
 				pergroupstate->transValue = datumCopy(fcinfo->arg[1],
 													pertrans->transtypeByVal,
 													  pertrans->transtypeLen);
@@ -1066,6 +1368,11 @@ advance_combine_function(AggState *aggstate,
 		}
 	}
 
+	if (pertrans->transfn_inline != AGG_TRANS_FMGR &&
+		!pergroupstate->transValueIsNull &&
+		advance_transition_inline(pertrans, pergroupstate))
+		return;
+
 	/* We run the combine functions in per-input-tuple memory context */
 	oldContext = MemoryContextSwitchTo(aggstate->tmpcontext->ecxt_per_tuple_memory);
 
@@ -1096,7 +1403,7 @@ advance_combine_function(AggState *aggstate,
 	{
 		if (!fcinfo->isnull)
 		{
-			MemoryContextSwitchTo(aggstate->aggcontexts[aggstate->current_set]->ecxt_per_tuple_memory);
+			MemoryContextSwitchTo(aggstate->curaggcontext->ecxt_per_tuple_memory);
 			if (DatumIsReadWriteExpandedObject(newVal,
 											   false,
 											   pertrans->transtypeLen) &&
@@ -1551,15 +1858,16 @@ prepare_projection_slot(AggState *aggstate, TupleTableSlot *slot, int currentSet
 /*
  * Compute the final value of all aggregates for one group.
  *
- * This function handles only one grouping set at a time.
+ * This function handles only one grouping set at a time, which must already
+ * be selected as the current set; pergroup points to that set's per-group
+ * structs.
  *
  * Results are stored in the output econtext aggvalues/aggnulls.
  */
 static void
 finalize_aggregates(AggState *aggstate,
 					AggStatePerAgg peraggs,
-					AggStatePerGroup pergroup,
-					int currentSet)
+					AggStatePerGroup pergroup)
 {
 	ExprContext *econtext = aggstate->ss.ps.ps_ExprContext;
 	Datum	   *aggvalues = econtext->ecxt_aggvalues;
@@ -1567,11 +1875,6 @@ finalize_aggregates(AggState *aggstate,
 	int			aggno;
 	int			transno;
 
-	Assert(currentSet == 0 ||
-		   ((Agg *) aggstate->ss.ps.plan)->aggstrategy != AGG_HASHED);
-
-	aggstate->current_set = currentSet;
-
 	/*
 	 * If there were any DISTINCT and/or ORDER BY aggregates, sort their
 	 * inputs and run the transition functions.
@@ -1581,7 +1884,7 @@ finalize_aggregates(AggState *aggstate,
 		AggStatePerTrans pertrans = &aggstate->pertrans[transno];
 		AggStatePerGroup pergroupstate;
 
-		pergroupstate = &pergroup[transno + (currentSet * (aggstate->numtrans))];
+		pergroupstate = &pergroup[transno];
 
 		if (pertrans->numSortCols > 0)
 		{
@@ -1607,7 +1910,7 @@ finalize_aggregates(AggState *aggstate,
 		int			transno = peragg->transno;
 		AggStatePerGroup pergroupstate;
 
-		pergroupstate = &pergroup[transno + (currentSet * (aggstate->numtrans))];
+		pergroupstate = &pergroup[transno];
 
 		if (DO_AGGSPLIT_SKIPFINAL(aggstate->aggsplit))
 			finalize_partialaggregate(aggstate, peragg, pergroupstate,
@@ -1699,31 +2002,54 @@ find_unaggregated_cols_walker(Node *node, Bitmapset **colnos)
 }
 
 /*
- * Initialize the hash table to empty.
+ * Initialize the hash table of hashed grouping set setno to empty.
  *
- * The hash table always lives in the aggcontext memory context.
+ * The hash tables always live in the hashcontext memory context.
  */
 static void
-build_hash_table(AggState *aggstate)
+build_hash_table(AggState *aggstate, int setno)
 {
-	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
+	AggStatePerHash perhash = &aggstate->perhash[setno];
+	Agg		   *aggnode = perhash->aggnode;
 	MemoryContext tmpmem = aggstate->tmpcontext->ecxt_per_tuple_memory;
-	Size		entrysize;
+	Size		additionalsize;
+	long		nbuckets;
+	long		maxbuckets;
 
-	Assert(node->aggstrategy == AGG_HASHED);
-	Assert(node->numGroups > 0);
+	Assert(aggnode->numGroups > 0);
+
+	additionalsize = aggstate->numaggs * sizeof(AggStatePerGroupData);
+
+	/*
+	 * Since the tables can spill, there is no point in presizing them for
+	 * more entries than fit in their share of work_mem.
+	 */
+	nbuckets = aggnode->numGroups;
+	maxbuckets = (work_mem * 1024L) /
+		(hash_agg_entry_size(aggstate->numaggs) * aggstate->num_hashes);
+	if (nbuckets > maxbuckets)
+		nbuckets = Max(maxbuckets, 1);
+
+	perhash->hashtable = BuildTupleHashTable(aggnode->numCols,
+											 aggnode->grpColIdx,
+											 perhash->eqfunctions,
+											 perhash->hashfunctions,
+											 nbuckets,
+											 additionalsize,
+								aggstate->hashcontext->ecxt_per_tuple_memory,
+											 tmpmem);
+}
 
-	entrysize = offsetof(AggHashEntryData, pergroup) +
-		aggstate->numaggs * sizeof(AggStatePerGroupData);
+/*
+ * Initialize the hash tables of all hashed grouping sets to empty.
+ */
+static void
+build_hash_tables(AggState *aggstate)
+{
+	int			setno;
 
-	aggstate->hashtable = BuildTupleHashTable(node->numCols,
-											  node->grpColIdx,
-											  aggstate->phase->eqfunctions,
-											  aggstate->hashfunctions,
-											  node->numGroups,
-											  entrysize,
-							 aggstate->aggcontexts[0]->ecxt_per_tuple_memory,
-											  tmpmem);
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+		build_hash_table(aggstate, setno);
 }
 
 /*
@@ -1736,14 +2062,16 @@ build_hash_table(AggState *aggstate)
  * make the table entries significantly smaller.  To avoid messing up Var
  * numbering, we keep the same tuple descriptor for hashtable entries as the
  * incoming tuples have, but set unwanted columns to NULL in the tuples that
- * go into the table.
+ * go into the table.  With grouping sets, columns grouped only by other
+ * grouping sets are unwanted too, since prepare_projection_slot will null
+ * them anyway.
  *
  * To eliminate duplicates, we build a bitmapset of the needed columns, then
  * convert it to an integer list (cheaper to scan at runtime). The list is
  * in decreasing order so that the first entry is the largest;
  * lookup_hash_entry depends on this to use slot_getsomeattrs correctly.
- * Note that the list is preserved over ExecReScanAgg, so we allocate it in
- * the per-query context (unlike the hash table itself).
+ * Note that the lists are preserved over ExecReScanAgg, so we allocate them
+ * in the per-query context (unlike the hash tables themselves).
  *
  * Note: at present, searching the tlist/qual is not really necessary since
  * the parser should disallow any unaggregated references to ungrouped
@@ -1751,26 +2079,50 @@ build_hash_table(AggState *aggstate)
  * SQL99 semantics that allow use of "functionally dependent" columns that
  * haven't been explicitly grouped by.
  */
-static List *
+static void
 find_hash_columns(AggState *aggstate)
 {
-	Agg		   *node = (Agg *) aggstate->ss.ps.plan;
-	Bitmapset  *colnos;
-	List	   *collist;
-	int			i;
+	Bitmapset  *base_colnos;
+	int			setno;
 
 	/* Find Vars that will be needed in tlist and qual */
-	colnos = find_unaggregated_cols(aggstate);
-	/* Add in all the grouping columns */
-	for (i = 0; i < node->numCols; i++)
-		colnos = bms_add_member(colnos, node->grpColIdx[i]);
-	/* Convert to list, using lcons so largest element ends up first */
-	collist = NIL;
-	while ((i = bms_first_member(colnos)) >= 0)
-		collist = lcons_int(i, collist);
-	bms_free(colnos);
-
-	return collist;
+	base_colnos = find_unaggregated_cols(aggstate);
+
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+	{
+		AggStatePerHash perhash = &aggstate->perhash[setno];
+		Agg		   *aggnode = perhash->aggnode;
+		Bitmapset  *colnos = bms_copy(base_colnos);
+		List	   *collist;
+		int			i;
+
+		/* Drop the columns that are nulled for this grouping set */
+		if (aggstate->phases[0].grouped_cols)
+		{
+			Bitmapset  *grouped_cols = aggstate->phases[0].grouped_cols[setno];
+			ListCell   *lc;
+
+			foreach(lc, aggstate->all_grouped_cols)
+			{
+				int			attnum = lfirst_int(lc);
+
+				if (!bms_is_member(attnum, grouped_cols))
+					colnos = bms_del_member(colnos, attnum);
+			}
+		}
+		/* Add in all the grouping columns */
+		for (i = 0; i < aggnode->numCols; i++)
+			colnos = bms_add_member(colnos, aggnode->grpColIdx[i]);
+		/* Convert to list, using lcons so largest element ends up first */
+		collist = NIL;
+		while ((i = bms_first_member(colnos)) >= 0)
+			collist = lcons_int(i, collist);
+		bms_free(colnos);
+
+		perhash->hash_needed = collist;
+	}
+
+	bms_free(base_colnos);
 }
 
 /*
@@ -1785,26 +2137,29 @@ hash_agg_entry_size(int numAggs)
 	Size		entrysize;
 
 	/* This must match build_hash_table */
-	entrysize = offsetof(AggHashEntryData, pergroup) +
-		numAggs * sizeof(AggStatePerGroupData);
-	entrysize = MAXALIGN(entrysize);
-	/* Account for hashtable overhead (assuming fill factor = 1) */
-	entrysize += 3 * sizeof(void *);
-	return entrysize;
+	entrysize = sizeof(TupleHashEntryData) +
+		MAXALIGN(numAggs * sizeof(AggStatePerGroupData));
+	/* Account for the separate per-group allocation's chunk header */
+	entrysize += 2 * sizeof(void *);
+	return MAXALIGN(entrysize);
 }
 
 /*
  * Find or create a hashtable entry for the tuple group containing the
- * given tuple.
+ * given tuple, in the hash table of hashed grouping set setno, which must
+ * be the current set.  If create is false, return NULL instead of creating
+ * a new entry.
  *
  * When called, CurrentMemoryContext should be the per-query context.
  */
-static AggHashEntry
-lookup_hash_entry(AggState *aggstate, TupleTableSlot *inputslot)
+static TupleHashEntryData *
+lookup_hash_entry(AggState *aggstate, int setno, TupleTableSlot *inputslot,
+				  bool create)
 {
-	TupleTableSlot *hashslot = aggstate->hashslot;
+	AggStatePerHash perhash = &aggstate->perhash[setno];
+	TupleTableSlot *hashslot = perhash->hashslot;
 	ListCell   *l;
-	AggHashEntry entry;
+	TupleHashEntryData *entry;
 	bool		isnew;
 
 	/* if first time through, initialize hashslot by cloning input slot */
@@ -1816,8 +2171,8 @@ lookup_hash_entry(AggState *aggstate, TupleTableSlot *inputslot)
 	}
 
 	/* transfer just the needed columns into hashslot */
-	slot_getsomeattrs(inputslot, linitial_int(aggstate->hash_needed));
-	foreach(l, aggstate->hash_needed)
+	slot_getsomeattrs(inputslot, linitial_int(perhash->hash_needed));
+	foreach(l, perhash->hash_needed)
 	{
 		int			varNumber = lfirst_int(l) - 1;
 
@@ -1826,19 +2181,366 @@ lookup_hash_entry(AggState *aggstate, TupleTableSlot *inputslot)
 	}
 
 	/* find or create the hashtable entry using the filtered tuple */
-	entry = (AggHashEntry) LookupTupleHashEntry(aggstate->hashtable,
-												hashslot,
-												&isnew);
+	if (!create)
+		return LookupTupleHashEntry(perhash->hashtable, hashslot, NULL);
+
+	entry = LookupTupleHashEntry(perhash->hashtable, hashslot, &isnew);
 
 	if (isnew)
 	{
 		/* initialize aggregates for new tuple group */
-		initialize_aggregates(aggstate, entry->pergroup, 0);
+		initialize_aggregates(aggstate,
+							  (AggStatePerGroup) entry->additional, -1);
 	}
 
 	return entry;
 }
 
+/*
+ * Find or create the hashtable entries of the current input tuple (in
+ * tmpcontext->ecxt_outertuple) for all the hashed grouping sets.  When
+ * reprocessing a spilled batch, only the batch's grouping set is looked up,
+ * and batch_hashvalue points to the tuple's hash value read back with it.
+ *
+ * The entries' per-group arrays are returned in aggstate->hash_pergroup,
+ * for advance_aggregates.  Once the hash tables are full, a tuple whose
+ * group is missing from a set's table is spilled for that set instead, and
+ * its array entry is NULL.  Returns NULL if the tuple was spilled for all
+ * the sets looked up.
+ *
+ * When called, CurrentMemoryContext should be the per-query context.
+ */
+static AggStatePerGroup *
+lookup_hash_entries(AggState *aggstate, uint32 *batch_hashvalue)
+{
+	AggStatePerGroup *pergroups = aggstate->hash_pergroup;
+	TupleTableSlot *slot = aggstate->tmpcontext->ecxt_outertuple;
+	AggHashSpill spill = aggstate->hash_spill;
+	bool		found = false;
+	int			setno;
+
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+	{
+		TupleHashEntryData *entry;
+
+		pergroups[setno] = NULL;
+
+		if (spill != NULL && spill->setno >= 0 && setno != spill->setno)
+			continue;
+
+		select_current_set(aggstate, setno, true);
+
+		entry = lookup_hash_entry(aggstate, setno, slot,
+								  !aggstate->hash_spill_mode);
+		if (entry == NULL)
+		{
+			uint32		hashvalue;
+
+			if (batch_hashvalue)
+				hashvalue = *batch_hashvalue;
+			else
+				hashvalue = hash_spill_hashvalue(aggstate, setno, slot);
+			hash_spill_tuple(aggstate, setno, slot, hashvalue);
+			continue;
+		}
+
+		pergroups[setno] = (AggStatePerGroup) entry->additional;
+		found = true;
+	}
+
+	/*
+	 * Every so often, check whether the groups and their transition values
+	 * still fit in work_mem; if not, stop adding groups.
+	 */
+	if (!aggstate->hash_spill_mode &&
+		++aggstate->hash_ntuples % HASHAGG_MEM_CHECK_INTERVAL == 0 &&
+		MemoryContextMemAllocated(aggstate->hashcontext->ecxt_per_tuple_memory,
+								  true) > work_mem * 1024L)
+	{
+		if (aggstate->hash_spill == NULL)
+		{
+			aggstate->hash_spill = (AggHashSpill)
+				MemoryContextAllocZero(aggstate->ss.ps.state->es_query_cxt,
+									   sizeof(AggHashSpillData));
+			aggstate->hash_spill->setno = -1;
+		}
+		aggstate->hash_spill_mode = true;
+		aggstate->hash_ever_spilled = true;
+	}
+
+	return found ? pergroups : NULL;
+}
+
+/*
+ * Compute the hash value used to choose a spill partition for hashed
+ * grouping set setno.  This is the same combination of the grouping
+ * columns' hash functions that the tuple hash table uses, so it only
+ * depends on the group.
+ */
+static uint32
+hash_spill_hashvalue(AggState *aggstate, int setno, TupleTableSlot *slot)
+{
+	AggStatePerHash perhash = &aggstate->perhash[setno];
+	Agg		   *aggnode = perhash->aggnode;
+	uint32		hashkey = 0;
+	int			i;
+
+	for (i = 0; i < aggnode->numCols; i++)
+	{
+		AttrNumber	att = aggnode->grpColIdx[i];
+		Datum		attr;
+		bool		isNull;
+
+		/* rotate hashkey left 1 bit at each step */
+		hashkey = (hashkey << 1) | ((hashkey & 0x80000000) ? 1 : 0);
+
+		attr = slot_getattr(slot, att, &isNull);
+
+		if (!isNull)			/* treat nulls as having hash key 0 */
+		{
+			uint32		hkey;
+
+			hkey = DatumGetUInt32(FunctionCall1(&perhash->hashfunctions[i],
+												attr));
+			hashkey ^= hkey;
+		}
+	}
+
+	return hashkey;
+}
+
+/*
+ * Write an input tuple whose group is not in the hash table of grouping set
+ * setno to that set's spill partition selected by its hash value, opening
+ * the partitions on first use.
+ */
+static void
+hash_spill_tuple(AggState *aggstate, int setno, TupleTableSlot *slot,
+				 uint32 hashvalue)
+{
+	AggHashSpill spill = aggstate->hash_spill;
+	MinimalTuple tuple;
+	uint32		partkey;
+	int			partno;
+	size_t		written;
+
+	if (spill->partitions == NULL)
+	{
+		MemoryContext oldcontext;
+		int			npartitions;
+
+		/*
+		 * Each open file costs a BLCKSZ buffer; use a power of two so the
+		 * partition number is a simple mask of the hash bits.
+		 */
+		npartitions = HASHAGG_MIN_PARTITIONS;
+		while (npartitions < HASHAGG_MAX_PARTITIONS &&
+			   (long) npartitions * 2 * 4 * BLCKSZ <= work_mem * 1024L)
+			npartitions *= 2;
+
+		oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+		spill->npartitions = npartitions;
+		spill->partitions = (BufFile **)
+			palloc0(sizeof(BufFile *) * npartitions * aggstate->num_hashes);
+		MemoryContextSwitchTo(oldcontext);
+	}
+
+	/* remix with the depth so each level partitions the data differently */
+	partkey = DatumGetUInt32(hash_uint32(hashvalue ^ (uint32) spill->depth));
+	partno = setno * spill->npartitions + (partkey & (spill->npartitions - 1));
+
+	if (spill->partitions[partno] == NULL)
+		spill->partitions[partno] = BufFileCreateTemp(false);
+
+	tuple = ExecCopySlotMinimalTuple(slot);
+
+	written = BufFileWrite(spill->partitions[partno],
+						   (void *) &hashvalue, sizeof(uint32));
+	if (written != sizeof(uint32))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+			   errmsg("could not write to hash-agg temporary file: %m")));
+
+	written = BufFileWrite(spill->partitions[partno],
+						   (void *) tuple, tuple->t_len);
+	if (written != tuple->t_len)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+			   errmsg("could not write to hash-agg temporary file: %m")));
+
+	pfree(tuple);
+}
+
+/*
+ * Read the next tuple of the batch being processed into hash_spill_slot.
+ * Returns NULL at the end of the batch.
+ */
+static TupleTableSlot *
+hash_spill_read_tuple(AggState *aggstate, uint32 *hashvalue)
+{
+	AggHashSpill spill = aggstate->hash_spill;
+	uint32		header[2];
+	size_t		nread;
+	MinimalTuple tuple;
+
+	/*
+	 * We check for interrupts here because this is taken as an alternative
+	 * code path to an ExecProcNode() call, which would include such a check.
+	 */
+	CHECK_FOR_INTERRUPTS();
+
+	/*
+	 * Since both the hash value and the MinimalTuple length word are uint32,
+	 * we can read them both in one BufFileRead() call.
+	 */
+	nread = BufFileRead(spill->input, (void *) header, sizeof(header));
+	if (nread == 0)				/* end of file */
+		return ExecClearTuple(aggstate->hash_spill_slot);
+	if (nread != sizeof(header))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+			  errmsg("could not read from hash-agg temporary file: %m")));
+	*hashvalue = header[0];
+	tuple = (MinimalTuple) palloc(header[1]);
+	tuple->t_len = header[1];
+	nread = BufFileRead(spill->input,
+						(void *) ((char *) tuple + sizeof(uint32)),
+						header[1] - sizeof(uint32));
+	if (nread != header[1] - sizeof(uint32))
+		ereport(ERROR,
+				(errcode_for_file_access(),
+			  errmsg("could not read from hash-agg temporary file: %m")));
+	return ExecStoreMinimalTuple(tuple, aggstate->hash_spill_slot, true);
+}
+
+/*
+ * At the end of a fill pass, close the batch we were reading and queue the
+ * partitions written during the pass as new batches, one level deeper.
+ */
+static void
+hash_spill_finish_pass(AggState *aggstate)
+{
+	AggHashSpill spill = aggstate->hash_spill;
+	MemoryContext oldcontext;
+	int			partno;
+
+	if (spill->input)
+	{
+		BufFileClose(spill->input);
+		spill->input = NULL;
+	}
+
+	if (spill->partitions == NULL)
+		return;
+
+	oldcontext = MemoryContextSwitchTo(aggstate->ss.ps.state->es_query_cxt);
+	for (partno = 0; partno < spill->npartitions * aggstate->num_hashes; partno++)
+	{
+		BufFile    *file = spill->partitions[partno];
+		AggHashBatch *batch;
+
+		if (file == NULL)
+			continue;
+
+		if (BufFileSeek(file, 0, 0L, SEEK_SET))
+			ereport(ERROR,
+					(errcode_for_file_access(),
+				  errmsg("could not rewind hash-agg temporary file: %m")));
+
+		batch = (AggHashBatch *) palloc(sizeof(AggHashBatch));
+		batch->file = file;
+		batch->setno = partno / spill->npartitions;
+		batch->depth = spill->depth + 1;
+		spill->batches = lcons(batch, spill->batches);
+
+		spill->partitions[partno] = NULL;
+	}
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Set up to aggregate the next pending batch: empty the hash tables, rebuild
+ * the one of the batch's grouping set, and make the batch's file the input
+ * of the next fill pass.  Returns false if there are no batches left.
+ *
+ * Batches are kept in a stack, so the partitions of a batch that spilled
+ * again are processed before its siblings and the number of temporary files
+ * open at once stays bounded by the recursion depth.
+ */
+static bool
+hash_spill_next_batch(AggState *aggstate)
+{
+	AggHashSpill spill = aggstate->hash_spill;
+	ExprContext *econtext = aggstate->ss.ps.ps_ExprContext;
+	AggHashBatch *batch;
+	int			setno;
+
+	if (spill == NULL || spill->batches == NIL)
+		return false;
+
+	batch = (AggHashBatch *) linitial(spill->batches);
+	spill->batches = list_delete_first(spill->batches);
+
+	spill->input = batch->file;
+	spill->setno = batch->setno;
+	spill->depth = batch->depth;
+	pfree(batch);
+
+	/* forget the groups emitted from the previous batch */
+	ExecClearTuple(aggstate->ss.ss_ScanTupleSlot);
+	ReScanExprContext(aggstate->hashcontext);
+	MemSet(econtext->ecxt_aggvalues, 0, sizeof(Datum) * aggstate->numaggs);
+	MemSet(econtext->ecxt_aggnulls, 0, sizeof(bool) * aggstate->numaggs);
+
+	for (setno = 0; setno < aggstate->num_hashes; setno++)
+		aggstate->perhash[setno].hashtable = NULL;
+	build_hash_table(aggstate, spill->setno);
+	select_current_set(aggstate, spill->setno, true);
+	aggstate->hash_spill_mode = false;
+	aggstate->table_filled = false;
+
+	return true;
+}
+
+/*
+ * Release all spill files, e.g. at rescan or shutdown.
+ */
+static void
+hash_spill_cleanup(AggState *aggstate)
+{
+	AggHashSpill spill = aggstate->hash_spill;
+	ListCell   *lc;
+	int			partno;
+
+	if (spill == NULL)
+		return;
+
+	if (spill->input)
+		BufFileClose(spill->input);
+	if (spill->partitions)
+	{
+		for (partno = 0; partno < spill->npartitions * aggstate->num_hashes;
+			 partno++)
+		{
+			if (spill->partitions[partno])
+				BufFileClose(spill->partitions[partno]);
+		}
+		pfree(spill->partitions);
+	}
+	foreach(lc, spill->batches)
+	{
+		AggHashBatch *batch = (AggHashBatch *) lfirst(lc);
+
+		BufFileClose(batch->file);
+		pfree(batch);
+	}
+	list_free(spill->batches);
+	pfree(spill);
+
+	aggstate->hash_spill = NULL;
+	aggstate->hash_spill_mode = false;
+}
+
 /*
  * ExecAgg -
  *
@@ -1886,6 +2588,8 @@ ExecAgg(AggState *node)
 			case AGG_HASHED:
 				if (!node->table_filled)
 					agg_fill_hash_table(node);
+				/* FALLTHROUGH */
+			case AGG_MIXED:
 				result = agg_retrieve_hash_table(node);
 				break;
 			default:
@@ -1911,6 +2615,7 @@ agg_retrieve_direct(AggState *aggstate)
 	ExprContext *tmpcontext;
 	AggStatePerAgg peragg;
 	AggStatePerGroup pergroup;
+	AggStatePerGroup *hash_pergroups = NULL;
 	TupleTableSlot *outerslot;
 	TupleTableSlot *firstSlot;
 	TupleTableSlot *result;
@@ -1997,6 +2702,22 @@ agg_retrieve_direct(AggState *aggstate)
 				node = aggstate->phase->aggnode;
 				numReset = numGroupingSets;
 			}
+			else if (((Agg *) aggstate->ss.ps.plan)->aggstrategy == AGG_MIXED)
+			{
+				/*
+				 * Mixed mode; we've output all the sorted grouping sets and
+				 * have filled the hash tables along the way, so switch to
+				 * outputting those.
+				 */
+				if (aggstate->hash_spill)
+					hash_spill_finish_pass(aggstate);
+				initialize_phase(aggstate, 0);
+				aggstate->table_filled = true;
+				ResetTupleHashIterator(aggstate->perhash[0].hashtable,
+									   &aggstate->perhash[0].hashiter);
+				select_current_set(aggstate, 0, true);
+				return agg_retrieve_hash_table(aggstate);
+			}
 			else
 			{
 				aggstate->agg_done = true;
@@ -2146,10 +2867,21 @@ agg_retrieve_direct(AggState *aggstate)
 				 */
 				for (;;)
 				{
+					/*
+					 * During the first phase of a mixed aggregation, we
+					 * also need to feed the input tuples to the hashed
+					 * grouping sets.
+					 */
+					if (((Agg *) aggstate->ss.ps.plan)->aggstrategy == AGG_MIXED &&
+						aggstate->current_phase == 1)
+						hash_pergroups = lookup_hash_entries(aggstate, NULL);
+					else
+						hash_pergroups = NULL;
+
 					if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
 						combine_aggregates(aggstate, pergroup);
 					else
-						advance_aggregates(aggstate, pergroup);
+						advance_aggregates(aggstate, pergroup, hash_pergroups);
 
 					/* Reset per-input-tuple context after each tuple */
 					ResetExprContext(tmpcontext);
@@ -2209,7 +2941,10 @@ agg_retrieve_direct(AggState *aggstate)
 
 		prepare_projection_slot(aggstate, econtext->ecxt_outertuple, currentSet);
 
-		finalize_aggregates(aggstate, peragg, pergroup, currentSet);
+		select_current_set(aggstate, currentSet, false);
+
+		finalize_aggregates(aggstate, peragg,
+							pergroup + (currentSet * aggstate->numtrans));
 
 		/*
 		 * If there's no row to project right now, we must continue rather
@@ -2225,14 +2960,20 @@ agg_retrieve_direct(AggState *aggstate)
 }
 
 /*
- * ExecAgg for hashed case: phase 1, read input and build hash table
+ * ExecAgg for hashed case: read input and build hash tables
+ *
+ * This reads either the outer plan, or the spilled batch being reprocessed,
+ * in which case only the batch's grouping set is filled.
  */
 static void
 agg_fill_hash_table(AggState *aggstate)
 {
 	ExprContext *tmpcontext;
-	AggHashEntry entry;
 	TupleTableSlot *outerslot;
+	AggStatePerGroup *pergroups;
+	AggStatePerHash perhash;
+	bool		from_batch;
+	int			setno;
 
 	/*
 	 * get state info from node
@@ -2240,39 +2981,65 @@ agg_fill_hash_table(AggState *aggstate)
 	 * tmpcontext is the per-input-tuple expression context
 	 */
 	tmpcontext = aggstate->tmpcontext;
+	from_batch = (aggstate->hash_spill != NULL &&
+				  aggstate->hash_spill->input != NULL);
 
 	/*
-	 * Process each outer-plan tuple, and then fetch the next one, until we
-	 * exhaust the outer plan.
+	 * Process each input tuple, and then fetch the next one, until we
+	 * exhaust the outer plan or the spilled batch being reprocessed.
 	 */
 	for (;;)
 	{
-		outerslot = fetch_input_tuple(aggstate);
+		uint32		hashvalue = 0;
+
+		if (from_batch)
+			outerslot = hash_spill_read_tuple(aggstate, &hashvalue);
+		else
+			outerslot = fetch_input_tuple(aggstate);
 		if (TupIsNull(outerslot))
 			break;
-		/* set up for advance_aggregates call */
+		/* set up for lookup_hash_entries and advance_aggregates */
 		tmpcontext->ecxt_outertuple = outerslot;
 
-		/* Find or build hashtable entry for this tuple's group */
-		entry = lookup_hash_entry(aggstate, outerslot);
+		/*
+		 * Find or build the hashtable entries for this tuple's groups.  Once
+		 * the tables are full, tuples of groups not already present are
+		 * spilled.
+		 */
+		pergroups = lookup_hash_entries(aggstate,
+										from_batch ? &hashvalue : NULL);
+		if (pergroups == NULL)
+		{
+			ResetExprContext(tmpcontext);
+			continue;
+		}
 
 		/* Advance the aggregates */
 		if (DO_AGGSPLIT_COMBINE(aggstate->aggsplit))
-			combine_aggregates(aggstate, entry->pergroup);
+			combine_aggregates(aggstate, pergroups[0]);
 		else
-			advance_aggregates(aggstate, entry->pergroup);
+			advance_aggregates(aggstate, NULL, pergroups);
 
 		/* Reset per-input-tuple context after each tuple */
 		ResetExprContext(tmpcontext);
 	}
 
+	if (aggstate->hash_spill)
+		hash_spill_finish_pass(aggstate);
+
 	aggstate->table_filled = true;
-	/* Initialize to walk the hash table */
-	ResetTupleHashIterator(aggstate->hashtable, &aggstate->hashiter);
+
+	/* Initialize to walk the first hash table filled */
+	setno = 0;
+	if (aggstate->hash_spill && aggstate->hash_spill->setno >= 0)
+		setno = aggstate->hash_spill->setno;
+	select_current_set(aggstate, setno, true);
+	perhash = &aggstate->perhash[setno];
+	ResetTupleHashIterator(perhash->hashtable, &perhash->hashiter);
 }
 
 /*
- * ExecAgg for hashed case: phase 2, retrieving groups from hash table
+ * ExecAgg for hashed case: retrieving groups from hash tables
  */
 static TupleTableSlot *
 agg_retrieve_hash_table(AggState *aggstate)
@@ -2280,7 +3047,8 @@ agg_retrieve_hash_table(AggState *aggstate)
 	ExprContext *econtext;
 	AggStatePerAgg peragg;
 	AggStatePerGroup pergroup;
-	AggHashEntry entry;
+	AggStatePerHash perhash;
+	TupleHashEntryData *entry;
 	TupleTableSlot *firstSlot;
 	TupleTableSlot *result;
 
@@ -2292,6 +3060,12 @@ agg_retrieve_hash_table(AggState *aggstate)
 	peragg = aggstate->peragg;
 	firstSlot = aggstate->ss.ss_ScanTupleSlot;
 
+	/*
+	 * Note that perhash (and therefore anything accessed through it) can
+	 * change inside the loop, as we change between grouping sets.
+	 */
+	perhash = &aggstate->perhash[aggstate->current_set];
+
 	/*
 	 * We loop retrieving groups until we find one satisfying
 	 * aggstate->ss.ps.qual
@@ -2301,10 +3075,32 @@ agg_retrieve_hash_table(AggState *aggstate)
 		/*
 		 * Find the next entry in the hash table
 		 */
-		entry = (AggHashEntry) ScanTupleHashTable(&aggstate->hashiter);
+		entry = ScanTupleHashTable(perhash->hashtable, &perhash->hashiter);
 		if (entry == NULL)
 		{
-			/* No more entries in hashtable, so done */
+			AggHashSpill spill = aggstate->hash_spill;
+			int			nextset = aggstate->current_set + 1;
+
+			/*
+			 * No more entries in this hashtable.  Move on to the next
+			 * grouping set, unless we were emitting a single spilled batch;
+			 * then, if groups were spilled, move on to the next batch;
+			 * otherwise we're done.
+			 */
+			if ((spill == NULL || spill->setno < 0) &&
+				nextset < aggstate->num_hashes)
+			{
+				select_current_set(aggstate, nextset, true);
+				perhash = &aggstate->perhash[nextset];
+				ResetTupleHashIterator(perhash->hashtable, &perhash->hashiter);
+				continue;
+			}
+			if (hash_spill_next_batch(aggstate))
+			{
+				agg_fill_hash_table(aggstate);
+				perhash = &aggstate->perhash[aggstate->current_set];
+				continue;
+			}
 			aggstate->agg_done = TRUE;
 			return NULL;
 		}
@@ -2322,13 +3118,15 @@ agg_retrieve_hash_table(AggState *aggstate)
 		 * Store the copied first input tuple in the tuple table slot reserved
 		 * for it, so that it can be used in ExecProject.
 		 */
-		ExecStoreMinimalTuple(entry->shared.firstTuple,
+		ExecStoreMinimalTuple(entry->firstTuple,
 							  firstSlot,
 							  false);
 
-		pergroup = entry->pergroup;
+		prepare_projection_slot(aggstate, firstSlot, aggstate->current_set);
 
-		finalize_aggregates(aggstate, peragg, pergroup, 0);
+		pergroup = (AggStatePerGroup) entry->additional;
+
+		finalize_aggregates(aggstate, peragg, pergroup);
 
 		/*
 		 * Use the representative input tuple for any references to
@@ -2364,12 +3162,16 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 				transno,
 				aggno;
 	int			phase;
+	int			phaseidx;
 	ListCell   *l;
 	Bitmapset  *all_grouped_cols = NULL;
 	int			numGroupingSets = 1;
 	int			numPhases;
+	int			numHashes;
 	int			i = 0;
 	int			j = 0;
+	bool		use_hashing = (node->aggstrategy == AGG_HASHED ||
+							   node->aggstrategy == AGG_MIXED);
 
 	/* check for unsupported flags */
 	Assert(!(eflags & (EXEC_FLAG_BACKWARD | EXEC_FLAG_MARK)));
@@ -2386,7 +3188,6 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->numtrans = 0;
 	aggstate->aggsplit = node->aggsplit;
 	aggstate->maxsets = 0;
-	aggstate->hashfunctions = NULL;
 	aggstate->projected_set = -1;
 	aggstate->current_set = 0;
 	aggstate->peragg = NULL;
@@ -2396,18 +3197,30 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->agg_done = false;
 	aggstate->pergroup = NULL;
 	aggstate->grp_firstTuple = NULL;
-	aggstate->hashtable = NULL;
+	aggstate->hashcontext = NULL;
+	aggstate->curaggcontext = NULL;
+	aggstate->num_hashes = 0;
+	aggstate->perhash = NULL;
+	aggstate->hash_pergroup = NULL;
+	aggstate->hash_ntuples = 0;
+	aggstate->hash_spill_mode = false;
+	aggstate->hash_ever_spilled = false;
+	aggstate->hash_spill = NULL;
 	aggstate->sort_in = NULL;
 	aggstate->sort_out = NULL;
 
 	/*
 	 * Calculate the maximum number of grouping sets in any phase; this
-	 * determines the size of some allocations.
+	 * determines the size of some allocations.  Also calculate the number of
+	 * phases, since all hashed grouping sets are handled together in phase
+	 * 0, and the sorted ones each take a phase of their own.  Phase 0 is
+	 * left unused if nothing is hashed.
 	 */
+	numPhases = (use_hashing ? 1 : 2);
+	numHashes = (use_hashing ? 1 : 0);
+
 	if (node->groupingSets)
 	{
-		Assert(node->aggstrategy != AGG_HASHED);
-
 		numGroupingSets = list_length(node->groupingSets);
 
 		foreach(l, node->chain)
@@ -2416,11 +3229,20 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 
 			numGroupingSets = Max(numGroupingSets,
 								  list_length(agg->groupingSets));
+
+			/*
+			 * additional AGG_HASHED aggs become part of phase 0, but all
+			 * others add an extra phase.
+			 */
+			if (agg->aggstrategy != AGG_HASHED)
+				++numPhases;
+			else
+				++numHashes;
 		}
 	}
 
 	aggstate->maxsets = numGroupingSets;
-	aggstate->numphases = numPhases = 1 + list_length(node->chain);
+	aggstate->numphases = numPhases;
 
 	aggstate->aggcontexts = (ExprContext **)
 		palloc0(sizeof(ExprContext *) * numGroupingSets);
@@ -2433,6 +3255,9 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	 * memory context formerly used to hold transition values.  We cheat a
 	 * little by using ExecAssignExprContext() to build all of them.
 	 *
+	 * The hashed grouping sets, if any, share one more ExprContext,
+	 * hashcontext, that holds their hash tables and transition values.
+	 *
 	 * NOTE: the details of what is stored in aggcontexts and what is stored
 	 * in the regular per-query memory context are driven by a simple
 	 * decision: we want to reset the aggcontext at group boundaries (if not
@@ -2447,6 +3272,12 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 		aggstate->aggcontexts[i] = aggstate->ss.ps.ps_ExprContext;
 	}
 
+	if (use_hashing)
+	{
+		ExecAssignExprContext(estate, &aggstate->ss.ps);
+		aggstate->hashcontext = aggstate->ss.ps.ps_ExprContext;
+	}
+
 	ExecAssignExprContext(estate, &aggstate->ss.ps);
 
 	/*
@@ -2454,7 +3285,7 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	 */
 	ExecInitScanTupleSlot(estate, &aggstate->ss);
 	ExecInitResultTupleSlot(estate, &aggstate->ss.ps);
-	aggstate->hashslot = ExecInitExtraTupleSlot(estate);
+	aggstate->hash_spill_slot = ExecInitExtraTupleSlot(estate);
 	aggstate->sort_slot = ExecInitExtraTupleSlot(estate);
 
 	/*
@@ -2491,6 +3322,9 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	if (node->chain)
 		ExecSetSlotDescriptor(aggstate->sort_slot,
 						 aggstate->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
+	if (use_hashing)
+		ExecSetSlotDescriptor(aggstate->hash_spill_slot,
+						 aggstate->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
 
 	/*
 	 * Initialize result tuple type and projection info.
@@ -2519,23 +3353,31 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 
 	/*
 	 * For each phase, prepare grouping set data and fmgr lookup data for
-	 * compare functions.  Accumulate all_grouped_cols in passing.
+	 * compare functions.  Accumulate all_grouped_cols in passing.  The
+	 * hashed grouping sets all go to phase 0, one per perhash entry.
 	 */
-
 	aggstate->phases = palloc0(numPhases * sizeof(AggStatePerPhaseData));
 
-	for (phase = 0; phase < numPhases; ++phase)
+	aggstate->num_hashes = numHashes;
+	if (numHashes)
+	{
+		aggstate->perhash = palloc0(sizeof(AggStatePerHashData) * numHashes);
+		aggstate->phases[0].numsets = 0;
+		aggstate->phases[0].gset_lengths = palloc(numHashes * sizeof(int));
+		aggstate->phases[0].grouped_cols = palloc(numHashes * sizeof(Bitmapset *));
+	}
+
+	phase = 0;
+	for (phaseidx = 0; phaseidx <= list_length(node->chain); ++phaseidx)
 	{
-		AggStatePerPhase phasedata = &aggstate->phases[phase];
 		Agg		   *aggnode;
 		Sort	   *sortnode;
-		int			num_sets;
 
-		if (phase > 0)
+		if (phaseidx > 0)
 		{
-			aggnode = list_nth(node->chain, phase - 1);
+			aggnode = list_nth(node->chain, phaseidx - 1);
 			sortnode = (Sort *) aggnode->plan.lefttree;
-			Assert(IsA(sortnode, Sort));
+			Assert(sortnode == NULL || IsA(sortnode, Sort));
 		}
 		else
 		{
@@ -2543,53 +3385,100 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 			sortnode = NULL;
 		}
 
-		phasedata->numsets = num_sets = list_length(aggnode->groupingSets);
+		Assert(phase <= 1 || sortnode);
 
-		if (num_sets)
+		if (aggnode->aggstrategy == AGG_HASHED
+			|| aggnode->aggstrategy == AGG_MIXED)
 		{
-			phasedata->gset_lengths = palloc(num_sets * sizeof(int));
-			phasedata->grouped_cols = palloc(num_sets * sizeof(Bitmapset *));
+			AggStatePerPhase phasedata = &aggstate->phases[0];
+			AggStatePerHash perhash;
+			Bitmapset  *cols = NULL;
 
-			i = 0;
-			foreach(l, aggnode->groupingSets)
-			{
-				int			current_length = list_length(lfirst(l));
-				Bitmapset  *cols = NULL;
+			Assert(phase == 0);
+			i = phasedata->numsets++;
+			perhash = &aggstate->perhash[i];
 
-				/* planner forces this to be correct */
-				for (j = 0; j < current_length; ++j)
-					cols = bms_add_member(cols, aggnode->grpColIdx[j]);
+			/* phase 0 always points to the "real" Agg in the hash case */
+			phasedata->aggnode = node;
 
-				phasedata->grouped_cols[i] = cols;
-				phasedata->gset_lengths[i] = current_length;
-				++i;
-			}
+			/* but the actual Agg node representing this hash is saved here */
+			perhash->aggnode = aggnode;
+
+			phasedata->gset_lengths[i] = aggnode->numCols;
+
+			for (j = 0; j < aggnode->numCols; ++j)
+				cols = bms_add_member(cols, aggnode->grpColIdx[j]);
 
-			all_grouped_cols = bms_add_members(all_grouped_cols,
-											   phasedata->grouped_cols[0]);
+			phasedata->grouped_cols[i] = cols;
+
+			if (node->groupingSets)
+				all_grouped_cols = bms_add_members(all_grouped_cols, cols);
+			continue;
 		}
 		else
 		{
-			Assert(phase == 0);
+			AggStatePerPhase phasedata = &aggstate->phases[++phase];
+			int			num_sets;
 
-			phasedata->gset_lengths = NULL;
-			phasedata->grouped_cols = NULL;
-		}
+			phasedata->numsets = num_sets = list_length(aggnode->groupingSets);
 
-		/*
-		 * If we are grouping, precompute fmgr lookup data for inner loop.
-		 */
-		if (aggnode->aggstrategy == AGG_SORTED)
-		{
-			Assert(aggnode->numCols > 0);
+			if (num_sets)
+			{
+				phasedata->gset_lengths = palloc(num_sets * sizeof(int));
+				phasedata->grouped_cols = palloc(num_sets * sizeof(Bitmapset *));
+
+				i = 0;
+				foreach(l, aggnode->groupingSets)
+				{
+					int			current_length = list_length(lfirst(l));
+					Bitmapset  *cols = NULL;
+
+					/* planner forces this to be correct */
+					for (j = 0; j < current_length; ++j)
+						cols = bms_add_member(cols, aggnode->grpColIdx[j]);
+
+					phasedata->grouped_cols[i] = cols;
+					phasedata->gset_lengths[i] = current_length;
+					++i;
+				}
+
+				all_grouped_cols = bms_add_members(all_grouped_cols,
+												 phasedata->grouped_cols[0]);
+			}
+			else
+			{
+				Assert(phaseidx == 0);
+
+				phasedata->gset_lengths = NULL;
+				phasedata->grouped_cols = NULL;
+			}
 
-			phasedata->eqfunctions =
-				execTuplesMatchPrepare(aggnode->numCols,
-									   aggnode->grpOperators);
+			/*
+			 * If we are grouping, precompute fmgr lookup data for inner loop.
+			 */
+			if (aggnode->aggstrategy == AGG_SORTED)
+			{
+				Assert(aggnode->numCols > 0);
+
+				phasedata->eqfunctions =
+					execTuplesMatchPrepare(aggnode->numCols,
+										   aggnode->grpOperators);
+			}
+
+			phasedata->aggnode = aggnode;
+			phasedata->sortnode = sortnode;
 		}
+	}
 
-		phasedata->aggnode = aggnode;
-		phasedata->sortnode = sortnode;
+	/*
+	 * Without grouping sets, the single hash table needs no per-set
+	 * projection of grouped columns.
+	 */
+	if (numHashes && node->groupingSets == NIL)
+	{
+		aggstate->phases[0].numsets = 0;
+		aggstate->phases[0].gset_lengths = NULL;
+		aggstate->phases[0].grouped_cols = NULL;
 	}
 
 	/*
@@ -2600,21 +3489,38 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 		aggstate->all_grouped_cols = lcons_int(i, aggstate->all_grouped_cols);
 
 	/*
-	 * Hashing can only appear in the initial phase.
+	 * Prepare the hash and equality functions of each hashed grouping set,
+	 * and a slot for loading its hash table.
 	 */
+	for (i = 0; i < numHashes; ++i)
+	{
+		AggStatePerHash perhash = &aggstate->perhash[i];
 
-	if (node->aggstrategy == AGG_HASHED)
-		execTuplesHashPrepare(node->numCols,
-							  node->grpOperators,
-							  &aggstate->phases[0].eqfunctions,
-							  &aggstate->hashfunctions);
+		execTuplesHashPrepare(perhash->aggnode->numCols,
+							  perhash->aggnode->grpOperators,
+							  &perhash->eqfunctions,
+							  &perhash->hashfunctions);
+		perhash->hashslot = ExecInitExtraTupleSlot(estate);
+	}
 
 	/*
-	 * Initialize current phase-dependent values to initial phase
+	 * Initialize current phase-dependent values to initial phase.  The
+	 * initial phase is 1 (first sort pass) for all strategies that use
+	 * sorting (if hashing is being done too, then phase 0 is processed
+	 * last); but if only hashing is being done, then phase 0 is initial.
 	 */
-
-	aggstate->current_phase = 0;
-	initialize_phase(aggstate, 0);
+	if (node->aggstrategy == AGG_HASHED)
+	{
+		aggstate->current_phase = 0;
+		initialize_phase(aggstate, 0);
+		select_current_set(aggstate, 0, true);
+	}
+	else
+	{
+		aggstate->current_phase = 1;
+		initialize_phase(aggstate, 1);
+		select_current_set(aggstate, 0, false);
+	}
 
 	/*
 	 * Set up aggregate-result storage in the output expr context, and also
@@ -2630,14 +3536,17 @@ ExecInitAgg(Agg *node, EState *estate, int eflags)
 	aggstate->peragg = peraggs;
 	aggstate->pertrans = pertransstates;
 
-	if (node->aggstrategy == AGG_HASHED)
+	if (use_hashing)
 	{
-		build_hash_table(aggstate);
-		aggstate->table_filled = false;
 		/* Compute the columns we actually need to hash on */
-		aggstate->hash_needed = find_hash_columns(aggstate);
+		find_hash_columns(aggstate);
+		build_hash_tables(aggstate);
+		aggstate->table_filled = false;
+		aggstate->hash_pergroup = (AggStatePerGroup *)
+			palloc0(sizeof(AggStatePerGroup) * numHashes);
 	}
-	else
+
+	if (node->aggstrategy != AGG_HASHED)
 	{
 		AggStatePerGroup pergroup;
 
@@ -3090,6 +3999,8 @@ build_pertrans_for_aggref(AggStatePerTrans pertrans,
 					&pertrans->transtypeLen,
 					&pertrans->transtypeByVal);
 
+	pertrans->transfn_inline = choose_transition_inline(pertrans);
+
 	if (OidIsValid(aggserialfn))
 	{
 		build_aggregate_serialfn_expr(aggserialfn,
@@ -3425,6 +4336,9 @@ ExecEndAgg(AggState *node)
 	if (node->sort_out)
 		tuplesort_end(node->sort_out);
 
+	/* and any hash aggregation spill files */
+	hash_spill_cleanup(node);
+
 	for (transno = 0; transno < node->numtrans; transno++)
 	{
 		AggStatePerTrans pertrans = &node->pertrans[transno];
@@ -3439,6 +4353,8 @@ ExecEndAgg(AggState *node)
 	/* And ensure any agg shutdown callbacks have been called */
 	for (setno = 0; setno < numGroupingSets; setno++)
 		ReScanExprContext(node->aggcontexts[setno]);
+	if (node->hashcontext)
+		ReScanExprContext(node->hashcontext);
 
 	/*
 	 * We don't actually free any ExprContexts here (see comment in
@@ -3483,12 +4399,17 @@ ExecReScanAgg(AggState *node)
 		 * If we do have the hash table, and the subplan does not have any
 		 * parameter changes, and none of our own parameter changes affect
 		 * input expressions of the aggregated functions, then we can just
-		 * rescan the existing hash table; no need to build it again.
+		 * rescan the existing hash table; no need to build it again.  That
+		 * doesn't work if the input was spilled, since the table then only
+		 * holds the last batch.
 		 */
 		if (outerPlan->chgParam == NULL &&
-			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams))
+			!bms_overlap(node->ss.ps.chgParam, aggnode->aggParams) &&
+			!node->hash_ever_spilled)
 		{
-			ResetTupleHashIterator(node->hashtable, &node->hashiter);
+			ResetTupleHashIterator(node->perhash[0].hashtable,
+								   &node->perhash[0].hashiter);
+			select_current_set(node, 0, true);
 			return;
 		}
 	}
@@ -3515,9 +4436,9 @@ ExecReScanAgg(AggState *node)
 	 * rather than just reset because transfns may have registered callbacks
 	 * that need to be run now.)
 	 *
-	 * Note that with AGG_HASHED, the hash table is allocated in a sub-context
-	 * of the aggcontext. This used to be an issue, but now, resetting a
-	 * context automatically deletes sub-contexts too.
+	 * Note that with AGG_HASHED, the hash tables are allocated in a
+	 * sub-context of the hashcontext. This used to be an issue, but now,
+	 * resetting a context automatically deletes sub-contexts too.
 	 */
 
 	for (setno = 0; setno < numGroupingSets; setno++)
@@ -3537,13 +4458,20 @@ ExecReScanAgg(AggState *node)
 	MemSet(econtext->ecxt_aggvalues, 0, sizeof(Datum) * node->numaggs);
 	MemSet(econtext->ecxt_aggnulls, 0, sizeof(bool) * node->numaggs);
 
-	if (aggnode->aggstrategy == AGG_HASHED)
+	if (aggnode->aggstrategy == AGG_HASHED ||
+		aggnode->aggstrategy == AGG_MIXED)
 	{
-		/* Rebuild an empty hash table */
-		build_hash_table(node);
+		/* Drop any spill files, and rebuild empty hash tables */
+		hash_spill_cleanup(node);
+		node->hash_ever_spilled = false;
+		node->hash_ntuples = 0;
+		ReScanExprContext(node->hashcontext);
+		build_hash_tables(node);
 		node->table_filled = false;
+		/* iterator will be reset when the table is filled */
 	}
-	else
+
+	if (aggnode->aggstrategy != AGG_HASHED)
 	{
 		/*
 		 * Reset the per-group state (in particular, mark transvalues null)
@@ -3551,8 +4479,8 @@ ExecReScanAgg(AggState *node)
 		MemSet(node->pergroup, 0,
 			 sizeof(AggStatePerGroupData) * node->numaggs * numGroupingSets);
 
-		/* reset to phase 0 */
-		initialize_phase(node, 0);
+		/* reset to phase 1 */
+		initialize_phase(node, 1);
 
 		node->input_done = false;
 		node->projected_set = -1;
@@ -3593,7 +4521,7 @@ AggCheckCallContext(FunctionCallInfo fcinfo, MemoryContext *aggcontext)
 		if (aggcontext)
 		{
 			AggState   *aggstate = ((AggState *) fcinfo->context);
-			ExprContext *cxt = aggstate->aggcontexts[aggstate->current_set];
+			ExprContext *cxt = aggstate->curaggcontext;
 
 			*aggcontext = cxt->ecxt_per_tuple_memory;
 		}
@@ -3682,7 +4610,7 @@ AggRegisterCallback(FunctionCallInfo fcinfo,
 	if (fcinfo->context && IsA(fcinfo->context, AggState))
 	{
 		AggState   *aggstate = (AggState *) fcinfo->context;
-		ExprContext *cxt = aggstate->aggcontexts[aggstate->current_set];
+		ExprContext *cxt = aggstate->curaggcontext;
 
 		RegisterExprContextCallback(cxt, func, arg);
 
@@ -15,6 +15,11 @@
  * but with anything else we might return a tuple that doesn't meet the
  * required index qual conditions.
  *
+ * In a parallel query, the scan may be parallel-aware: then a single
+ * participant runs the subplan, and copies the bitmap it obtained into the
+ * dynamic shared memory segment for every participant to scan a share of
+ * the pages.
+ *
  *
  * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
  * Portions Copyright (c) 1994, Regents of the University of California
@@ -32,6 +37,9 @@
  *		ExecInitBitmapHeapScan		creates and initializes state info.
  *		ExecReScanBitmapHeapScan	prepares to rescan the plan.
  *		ExecEndBitmapHeapScan		releases all storage.
+ *		ExecBitmapHeapEstimate		estimates DSM space needed for a shared bitmap
+ *		ExecBitmapHeapInitializeDSM initialize DSM for a shared bitmap
+ *		ExecBitmapHeapInitializeWorker attach to DSM info in parallel worker
  */
 #include "postgres.h"
 
@@ -39,9 +47,12 @@
 #include "access/transam.h"
 #include "executor/execdebug.h"
 #include "executor/nodeBitmapHeapscan.h"
+#include "miscadmin.h"
 #include "pgstat.h"
 #include "storage/bufmgr.h"
 #include "storage/predicate.h"
+#include "storage/proc.h"
+#include "storage/spin.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/spccache.h"
@@ -49,7 +60,46 @@
 #include "utils/tqual.h"
 
 
+/*
+ * A bitmap shared by the participants of a parallel-aware scan.  It is built
+ * by the first participant to get there; the others wait for it.  As for a
+ * shared hash table, the space for it is reserved before the bitmap is
+ * built, from the planner's estimate: if the bitmap turns out not to fit,
+ * the builder scans all of it privately, and the others scan nothing.
+ */
+typedef enum SharedBitmapState
+{
+	BM_EMPTY,					/* nobody has started building it yet */
+	BM_BUILDING,				/* a participant is building it */
+	BM_READY,					/* copied into shared memory; scan it */
+	BM_FAILED					/* didn't fit; the builder scans it alone */
+} SharedBitmapState;
+
+typedef struct ParallelBitmapHeapState
+{
+	slock_t		mutex;			/* protects state and waiters */
+	SharedBitmapState state;
+
+	Size		bitmap;			/* offset of the TBMSharedIteratorState */
+	Size		size;			/* total size of this struct and the bitmap */
+
+	/* participants waiting for the build to finish */
+	int			nwaiters;
+	int			maxwaiters;
+	PGPROC	   *waiters[FLEXIBLE_ARRAY_MEMBER];
+} ParallelBitmapHeapState;
+
+#define SharedBitmap(pstate) \
+	((TBMSharedIteratorState *) ((char *) (pstate) + (pstate)->bitmap))
+
 static TupleTableSlot *BitmapHeapNext(BitmapHeapScanState *node);
+static void BitmapBeginScan(BitmapHeapScanState *node);
+static bool BitmapClaimShared(BitmapHeapScanState *node);
+static void BitmapPublishShared(BitmapHeapScanState *node);
+static void BitmapAttachShared(BitmapHeapScanState *node);
+static void BitmapEndIterate(BitmapHeapScanState *node);
+static inline TBMIterateResult *BitmapIterate(BitmapHeapScanState *node);
+static inline TBMIterateResult *BitmapPrefetchIterate(BitmapHeapScanState *node);
 static void bitgetpage(HeapScanDesc scan, TBMIterateResult *tbmres);
 
 
@@ -64,13 +114,7 @@ BitmapHeapNext(BitmapHeapScanState *node)
 {
 	ExprContext *econtext;
 	HeapScanDesc scan;
-	TIDBitmap  *tbm;
-	TBMIterator *tbmiterator;
 	TBMIterateResult *tbmres;
-
-#ifdef USE_PREFETCH
-	TBMIterator *prefetch_iterator;
-#endif
 	OffsetNumber targoffset;
 	TupleTableSlot *slot;
 
@@ -80,45 +124,14 @@ BitmapHeapNext(BitmapHeapScanState *node)
 	econtext = node->ss.ps.ps_ExprContext;
 	slot = node->ss.ss_ScanTupleSlot;
 	scan = node->ss.ss_currentScanDesc;
-	tbm = node->tbm;
-	tbmiterator = node->tbmiterator;
-	tbmres = node->tbmres;
-#ifdef USE_PREFETCH
-	prefetch_iterator = node->prefetch_iterator;
-#endif
 
 	/*
 	 * If we haven't yet performed the underlying index scan, do it, and begin
 	 * the iteration over the bitmap.
-	 *
-	 * For prefetching, we use *two* iterators, one for the pages we are
-	 * actually scanning and another that runs ahead of the first for
-	 * prefetching.  node->prefetch_pages tracks exactly how many pages ahead
-	 * the prefetch iterator is.  Also, node->prefetch_target tracks the
-	 * desired prefetch distance, which starts small and increases up to the
-	 * node->prefetch_maximum.  This is to avoid doing a lot of prefetching in
-	 * a scan that stops after a few tuples because of a LIMIT.
 	 */
-	if (tbm == NULL)
-	{
-		tbm = (TIDBitmap *) MultiExecProcNode(outerPlanState(node));
-
-		if (!tbm || !IsA(tbm, TIDBitmap))
-			elog(ERROR, "unrecognized result from subplan");
-
-		node->tbm = tbm;
-		node->tbmiterator = tbmiterator = tbm_begin_iterate(tbm);
-		node->tbmres = tbmres = NULL;
-
-#ifdef USE_PREFETCH
-		if (node->prefetch_maximum > 0)
-		{
-			node->prefetch_iterator = prefetch_iterator = tbm_begin_iterate(tbm);
-			node->prefetch_pages = 0;
-			node->prefetch_target = -1;
-		}
-#endif   /* USE_PREFETCH */
-	}
+	if (!node->initialized)
+		BitmapBeginScan(node);
+	tbmres = node->tbmres;
 
 	for (;;)
 	{
@@ -130,7 +143,7 @@ BitmapHeapNext(BitmapHeapScanState *node)
 		 */
 		if (tbmres == NULL)
 		{
-			node->tbmres = tbmres = tbm_iterate(tbmiterator);
+			node->tbmres = tbmres = BitmapIterate(node);
 			if (tbmres == NULL)
 			{
 				/* no more entries in the bitmap */
@@ -143,10 +156,14 @@ BitmapHeapNext(BitmapHeapScanState *node)
 				/* The main iterator has closed the distance by one page */
 				node->prefetch_pages--;
 			}
-			else if (prefetch_iterator)
+			else if (node->prefetch_iterator)
 			{
-				/* Do not let the prefetch iterator get behind the main one */
-				TBMIterateResult *tbmpre = tbm_iterate(prefetch_iterator);
+				/*
+				 * Do not let the prefetch iterator get behind the main one.
+				 * The prefetch iterator over a shared bitmap can't: it skips
+				 * the pages that are being scanned already.
+				 */
+				TBMIterateResult *tbmpre = tbm_iterate(node->prefetch_iterator);
 
 				if (tbmpre == NULL || tbmpre->blockno != tbmres->blockno)
 					elog(ERROR, "prefetch and main iterators are out of sync");
@@ -234,17 +251,21 @@ BitmapHeapNext(BitmapHeapScanState *node)
 		 * to do on the current page, else we may uselessly prefetch the same
 		 * page we are just about to request for real.
 		 */
-		if (prefetch_iterator)
+		if (node->prefetch_iterator || node->shared_prefetch_iterator)
 		{
 			while (node->prefetch_pages < node->prefetch_target)
 			{
-				TBMIterateResult *tbmpre = tbm_iterate(prefetch_iterator);
+				TBMIterateResult *tbmpre = BitmapPrefetchIterate(node);
 
 				if (tbmpre == NULL)
 				{
 					/* No more pages to prefetch */
-					tbm_end_iterate(prefetch_iterator);
-					node->prefetch_iterator = prefetch_iterator = NULL;
+					if (node->prefetch_iterator)
+						tbm_end_iterate(node->prefetch_iterator);
+					if (node->shared_prefetch_iterator)
+						tbm_end_shared_iterate(node->shared_prefetch_iterator);
+					node->prefetch_iterator = NULL;
+					node->shared_prefetch_iterator = NULL;
 					break;
 				}
 				node->prefetch_pages++;
@@ -305,6 +326,209 @@ BitmapHeapNext(BitmapHeapScanState *node)
 	return ExecClearTuple(slot);
 }
 
+/*
+ * BitmapBeginScan - subroutine for BitmapHeapNext()
+ *
+ * Perform the underlying index scan, unless another participant of a
+ * parallel-aware scan does it for us, and begin the iteration over the
+ * bitmap.
+ *
+ * For prefetching, we use *two* iterators, one for the pages we are
+ * actually scanning and another that runs ahead of the first for
+ * prefetching.  node->prefetch_pages tracks exactly how many pages ahead
+ * the prefetch iterator is.  Also, node->prefetch_target tracks the
+ * desired prefetch distance, which starts small and increases up to the
+ * node->prefetch_maximum.  This is to avoid doing a lot of prefetching in
+ * a scan that stops after a few tuples because of a LIMIT.
+ */
+static void
+BitmapBeginScan(BitmapHeapScanState *node)
+{
+	TIDBitmap  *tbm;
+
+	node->initialized = true;
+	node->tbmres = NULL;
+#ifdef USE_PREFETCH
+	if (node->prefetch_maximum > 0)
+	{
+		node->prefetch_pages = 0;
+		node->prefetch_target = -1;
+	}
+#endif   /* USE_PREFETCH */
+
+	if (node->pstate != NULL && !BitmapClaimShared(node))
+		return;
+
+	tbm = (TIDBitmap *) MultiExecProcNode(outerPlanState(node));
+
+	if (!tbm || !IsA(tbm, TIDBitmap))
+		elog(ERROR, "unrecognized result from subplan");
+
+	node->tbm = tbm;
+
+	if (node->pstate != NULL)
+	{
+		BitmapPublishShared(node);
+		if (node->tbm == NULL)
+			return;
+	}
+
+	node->tbmiterator = tbm_begin_iterate(tbm);
+
+#ifdef USE_PREFETCH
+	if (node->prefetch_maximum > 0)
+		node->prefetch_iterator = tbm_begin_iterate(tbm);
+#endif   /* USE_PREFETCH */
+}
+
+/*
+ * BitmapClaimShared - decide whether we are the one to build the shared
+ * bitmap
+ *
+ * Returns true if the caller should run the subplan and then publish the
+ * bitmap.  Otherwise we wait for the participant that's building it; on
+ * return we are either attached to the shared bitmap, or it couldn't be
+ * shared and there is nothing for us to scan.
+ */
+static bool
+BitmapClaimShared(BitmapHeapScanState *node)
+{
+	ParallelBitmapHeapState *pstate = node->pstate;
+	SharedBitmapState state;
+
+	SpinLockAcquire(&pstate->mutex);
+	state = pstate->state;
+	if (state == BM_EMPTY)
+		pstate->state = BM_BUILDING;
+	else if (state == BM_BUILDING)
+	{
+		/* each participant waits at most once per build */
+		Assert(pstate->nwaiters < pstate->maxwaiters);
+		pstate->waiters[pstate->nwaiters++] = MyProc;
+	}
+	SpinLockRelease(&pstate->mutex);
+
+	if (state == BM_EMPTY)
+		return true;
+
+	while (state == BM_BUILDING)
+	{
+		WaitLatch(MyLatch, WL_LATCH_SET, 0);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		SpinLockAcquire(&pstate->mutex);
+		state = pstate->state;
+		SpinLockRelease(&pstate->mutex);
+	}
+
+	if (state == BM_READY)
+		BitmapAttachShared(node);
+
+	return false;
+}
+
+/*
+ * BitmapPublishShared - copy the bitmap we just built into shared memory,
+ * if it fits, and wake up the participants waiting for it
+ *
+ * If it was shared, we scan the shared copy, too, and free our own.
+ */
+static void
+BitmapPublishShared(BitmapHeapScanState *node)
+{
+	ParallelBitmapHeapState *pstate = node->pstate;
+	SharedBitmapState state = BM_FAILED;
+	int			nwaiters;
+	int			i;
+
+	if (pstate->bitmap + tbm_shared_size(node->tbm) <= pstate->size)
+	{
+		tbm_share(node->tbm, SharedBitmap(pstate));
+		state = BM_READY;
+	}
+
+	/* Nobody registers as a waiter once the build is over. */
+	SpinLockAcquire(&pstate->mutex);
+	pstate->state = state;
+	nwaiters = pstate->nwaiters;
+	SpinLockRelease(&pstate->mutex);
+
+	for (i = 0; i < nwaiters; i++)
+		SetLatch(&pstate->waiters[i]->procLatch);
+
+	if (state == BM_READY)
+	{
+		tbm_free(node->tbm);
+		node->tbm = NULL;
+		BitmapAttachShared(node);
+	}
+}
+
+/*
+ * BitmapAttachShared - begin the iteration over the shared bitmap
+ */
+static void
+BitmapAttachShared(BitmapHeapScanState *node)
+{
+	TBMSharedIteratorState *bitmap = SharedBitmap(node->pstate);
+
+	node->shared_tbmiterator = tbm_attach_shared_iterate(bitmap, false);
+
+#ifdef USE_PREFETCH
+	if (node->prefetch_maximum > 0)
+		node->shared_prefetch_iterator = tbm_attach_shared_iterate(bitmap, true);
+#endif   /* USE_PREFETCH */
+}
+
+/*
+ * BitmapEndIterate - release the bitmap and its iterators, if any
+ */
+static void
+BitmapEndIterate(BitmapHeapScanState *node)
+{
+	if (node->tbmiterator)
+		tbm_end_iterate(node->tbmiterator);
+	if (node->prefetch_iterator)
+		tbm_end_iterate(node->prefetch_iterator);
+	if (node->shared_tbmiterator)
+		tbm_end_shared_iterate(node->shared_tbmiterator);
+	if (node->shared_prefetch_iterator)
+		tbm_end_shared_iterate(node->shared_prefetch_iterator);
+	if (node->tbm)
+		tbm_free(node->tbm);
+	node->tbm = NULL;
+	node->tbmiterator = NULL;
+	node->tbmres = NULL;
+	node->prefetch_iterator = NULL;
+	node->shared_tbmiterator = NULL;
+	node->shared_prefetch_iterator = NULL;
+}
+
+/*
+ * BitmapIterate - get the next page to scan, from whichever bitmap we have
+ */
+static inline TBMIterateResult *
+BitmapIterate(BitmapHeapScanState *node)
+{
+	if (node->shared_tbmiterator)
+		return tbm_shared_iterate(node->shared_tbmiterator);
+	if (node->tbmiterator)
+		return tbm_iterate(node->tbmiterator);
+	return NULL;
+}
+
+/*
+ * BitmapPrefetchIterate - likewise, get the next page to prefetch
+ */
+static inline TBMIterateResult *
+BitmapPrefetchIterate(BitmapHeapScanState *node)
+{
+	if (node->shared_prefetch_iterator)
+		return tbm_shared_iterate(node->shared_prefetch_iterator);
+	return tbm_iterate(node->prefetch_iterator);
+}
+
 /*
  * bitgetpage - subroutine for BitmapHeapNext()
  *
@@ -454,16 +678,12 @@ ExecReScanBitmapHeapScan(BitmapHeapScanState *node)
 	/* rescan to release any page pin */
 	heap_rescan(node->ss.ss_currentScanDesc, NULL);
 
-	if (node->tbmiterator)
-		tbm_end_iterate(node->tbmiterator);
-	if (node->prefetch_iterator)
-		tbm_end_iterate(node->prefetch_iterator);
-	if (node->tbm)
-		tbm_free(node->tbm);
-	node->tbm = NULL;
-	node->tbmiterator = NULL;
-	node->tbmres = NULL;
-	node->prefetch_iterator = NULL;
+	/*
+	 * A shared bitmap is emptied by ExecBitmapHeapReInitializeDSM before the
+	 * workers are relaunched.
+	 */
+	BitmapEndIterate(node);
+	node->initialized = false;
 
 	ExecScanReScan(&node->ss);
 
@@ -510,12 +730,7 @@ ExecEndBitmapHeapScan(BitmapHeapScanState *node)
 	/*
 	 * release bitmap if any
 	 */
-	if (node->tbmiterator)
-		tbm_end_iterate(node->tbmiterator);
-	if (node->prefetch_iterator)
-		tbm_end_iterate(node->prefetch_iterator);
-	if (node->tbm)
-		tbm_free(node->tbm);
+	BitmapEndIterate(node);
 
 	/*
 	 * close heap scan
@@ -567,6 +782,11 @@ ExecInitBitmapHeapScan(BitmapHeapScan *node, EState *estate, int eflags)
 	scanstate->prefetch_target = 0;
 	/* may be updated below */
 	scanstate->prefetch_maximum = target_prefetch_pages;
+	scanstate->initialized = false;
+	scanstate->pstate = NULL;	/* will be set up with the DSM, if at all */
+	scanstate->pstate_len = 0;
+	scanstate->shared_tbmiterator = NULL;
+	scanstate->shared_prefetch_iterator = NULL;
 
 	/*
 	 * Miscellaneous initialization
@@ -653,3 +873,107 @@ ExecInitBitmapHeapScan(BitmapHeapScan *node, EState *estate, int eflags)
 	 */
 	return scanstate;
 }
+
+/* ----------------------------------------------------------------
+ *						Parallel Scan Support
+ * ----------------------------------------------------------------
+ */
+
+/* ----------------------------------------------------------------
+ *		ExecBitmapHeapEstimate
+ *
+ *		estimates the space required for a shared bitmap.
+ *
+ *		Like for a shared hash table, we reserve room for twice as many
+ *		TIDs as the planner expects the subplan to find, but never more
+ *		than a private bitmap is allowed to use.
+ * ----------------------------------------------------------------
+ */
+void
+ExecBitmapHeapEstimate(BitmapHeapScanState *node, ParallelContext *pcxt)
+{
+	Plan	   *outerNode = outerPlan(node->ss.ps.plan);
+
+	node->pstate_len =
+		MAXALIGN(add_size(offsetof(ParallelBitmapHeapState, waiters),
+						  mul_size(pcxt->nworkers + 1, sizeof(PGPROC *))));
+	node->pstate_len =
+		add_size(node->pstate_len,
+				 MAXALIGN(tbm_estimate_shared_size(2.0 * outerNode->plan_rows,
+												   work_mem * 1024L)));
+
+	shm_toc_estimate_chunk(&pcxt->estimator, node->pstate_len);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBitmapHeapInitializeDSM
+ *
+ *		Set up an empty shared bitmap.
+ * ----------------------------------------------------------------
+ */
+void
+ExecBitmapHeapInitializeDSM(BitmapHeapScanState *node, ParallelContext *pcxt)
+{
+	ParallelBitmapHeapState *pstate;
+
+	pstate = shm_toc_allocate(pcxt->toc, node->pstate_len);
+	SpinLockInit(&pstate->mutex);
+	pstate->state = BM_EMPTY;
+	pstate->nwaiters = 0;
+	pstate->maxwaiters = pcxt->nworkers + 1;
+	pstate->bitmap = MAXALIGN(offsetof(ParallelBitmapHeapState, waiters) +
+							  pstate->maxwaiters * sizeof(PGPROC *));
+	pstate->size = node->pstate_len;
+
+	shm_toc_insert(pcxt->toc, node->ss.ps.plan->plan_node_id, pstate);
+	node->pstate = pstate;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBitmapHeapReInitializeDSM
+ *
+ *		Empty the shared bitmap before the workers are relaunched for a
+ *		rescan.  No worker is running at this point.
+ * ----------------------------------------------------------------
+ */
+void
+ExecBitmapHeapReInitializeDSM(BitmapHeapScanState *node,
+							  ParallelContext *pcxt)
+{
+	ParallelBitmapHeapState *pstate = node->pstate;
+
+	pstate->state = BM_EMPTY;
+	pstate->nwaiters = 0;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecBitmapHeapInitializeWorker
+ *
+ *		Copy relevant information from TOC into planstate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecBitmapHeapInitializeWorker(BitmapHeapScanState *node, shm_toc *toc)
+{
+	node->pstate = shm_toc_lookup(toc, node->ss.ps.plan->plan_node_id);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecShutdownBitmapHeapScan
+ *
+ *		Stop iterating over the shared bitmap and forget it; the parallel
+ *		context holding it is being destroyed.
+ * ----------------------------------------------------------------
+ */
+void
+ExecShutdownBitmapHeapScan(BitmapHeapScanState *node)
+{
+	if (node->shared_tbmiterator)
+		tbm_end_shared_iterate(node->shared_tbmiterator);
+	if (node->shared_prefetch_iterator)
+		tbm_end_shared_iterate(node->shared_prefetch_iterator);
+	node->shared_tbmiterator = NULL;
+	node->shared_prefetch_iterator = NULL;
+	node->pstate = NULL;
+}
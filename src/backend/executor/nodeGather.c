@@ -470,7 +470,7 @@ ExecReScanGather(GatherState *node)
 	node->initialized = false;
 
 	if (node->pei)
-		ExecParallelReinitialize(node->pei);
+		ExecParallelReinitialize(node->ps.lefttree, node->pei);
 
 	ExecReScan(node->ps.lefttree);
 }
@@ -17,6 +17,9 @@
  *		MultiExecHash	- generate an in-memory hash table of the relation
  *		ExecInitHash	- initialize node and subnodes
  *		ExecEndHash		- shutdown node and subnodes
+ *		ExecHashEstimate		estimates DSM space needed for a shared table
+ *		ExecHashInitializeDSM	initialize DSM for a shared table
+ *		ExecHashInitializeWorker attach to DSM info in parallel worker
  */
 
 #include "postgres.h"
@@ -32,6 +35,7 @@
 #include "executor/nodeHash.h"
 #include "executor/nodeHashjoin.h"
 #include "miscadmin.h"
+#include "storage/proc.h"
 #include "utils/dynahash.h"
 #include "utils/memutils.h"
 #include "utils/lsyscache.h"
@@ -50,6 +54,38 @@ static void ExecHashRemoveNextSkewBucket(HashJoinTable hashtable);
 
 static void *dense_alloc(HashJoinTable hashtable, Size size);
 
+static bool ExecHashClaimShared(HashState *node);
+static void ExecHashPublishShared(HashState *node);
+static void ExecHashCopyToShared(HashJoinTable hashtable,
+					 SharedHashJoinTable shared);
+static void ExecHashAttachShared(HashJoinTable hashtable,
+					 SharedHashJoinTable shared);
+
+/*
+ * Follow the offsets that link the buckets and tuples of a shared table.
+ */
+static inline Size *
+ExecHashSharedBuckets(SharedHashJoinTable shared)
+{
+	return (Size *) ((char *) shared + shared->buckets);
+}
+
+static inline HashJoinTuple
+ExecHashSharedTuple(SharedHashJoinTable shared, Size offset)
+{
+	if (offset == 0)
+		return NULL;
+	return (HashJoinTuple) ((char *) shared + offset);
+}
+
+static inline HashJoinTuple
+ExecHashNextTuple(HashJoinTable hashtable, HashJoinTuple hashTuple)
+{
+	if (hashtable->shared != NULL)
+		return ExecHashSharedTuple(hashtable->shared, hashTuple->next.shared);
+	return hashTuple->next.unshared;
+}
+
 /* ----------------------------------------------------------------
  *		ExecHash
  *
@@ -79,6 +115,7 @@ MultiExecHash(HashState *node)
 	TupleTableSlot *slot;
 	ExprContext *econtext;
 	uint32		hashvalue;
+	bool		shared_builder = false;
 
 	/* must provide our own instrumentation support */
 	if (node->ps.instrument)
@@ -90,6 +127,23 @@ MultiExecHash(HashState *node)
 	outerNode = outerPlanState(node);
 	hashtable = node->hashtable;
 
+	/*
+	 * If the table is shared among the participants of a parallel query,
+	 * only the first one to get here reads the inner relation.
+	 */
+	if (node->shared != NULL)
+	{
+		shared_builder = ExecHashClaimShared(node);
+
+		if (hashtable->shared != NULL)
+		{
+			/* somebody else built it for us, so we're done */
+			if (node->ps.instrument)
+				InstrStopNode(node->ps.instrument, hashtable->totalTuples);
+			return NULL;
+		}
+	}
+
 	/*
 	 * set expression context
 	 */
@@ -138,6 +192,10 @@ MultiExecHash(HashState *node)
 	if (hashtable->spaceUsed > hashtable->spacePeak)
 		hashtable->spacePeak = hashtable->spaceUsed;
 
+	/* let the other participants have what we built */
+	if (shared_builder)
+		ExecHashPublishShared(node);
+
 	/* must provide our own instrumentation support */
 	if (node->ps.instrument)
 		InstrStopNode(node->ps.instrument, hashtable->totalTuples);
@@ -174,6 +232,7 @@ ExecInitHash(Hash *node, EState *estate, int eflags)
 	hashstate->ps.state = estate;
 	hashstate->hashtable = NULL;
 	hashstate->hashkeys = NIL;	/* will be set by parent HashJoin */
+	hashstate->shared = NULL;	/* will be set up with the DSM, if at all */
 
 	/*
 	 * Miscellaneous initialization
@@ -306,6 +365,7 @@ ExecHashTableCreate(Hash *node, List *hashOperators, bool keepNulls)
 	hashtable->spaceAllowedSkew =
 		hashtable->spaceAllowed * SKEW_WORK_MEM_PERCENT / 100;
 	hashtable->chunks = NULL;
+	hashtable->shared = NULL;
 
 #ifdef HJDEBUG
 	printf("Hashjoin %p: initial nbatch = %d, nbuckets = %d\n",
@@ -703,7 +763,7 @@ ExecHashIncreaseNumBatches(HashJoinTable hashtable)
 				memcpy(copyTuple, hashTuple, hashTupleSize);
 
 				/* and add it back to the appropriate bucket */
-				copyTuple->next = hashtable->buckets[bucketno];
+				copyTuple->next.unshared = hashtable->buckets[bucketno];
 				hashtable->buckets[bucketno] = copyTuple;
 			}
 			else
@@ -807,7 +867,7 @@ ExecHashIncreaseNumBuckets(HashJoinTable hashtable)
 									  &bucketno, &batchno);
 
 			/* add the tuple to the proper bucket */
-			hashTuple->next = hashtable->buckets[bucketno];
+			hashTuple->next.unshared = hashtable->buckets[bucketno];
 			hashtable->buckets[bucketno] = hashTuple;
 
 			/* advance index past the tuple */
@@ -869,7 +929,7 @@ ExecHashTableInsert(HashJoinTable hashtable,
 		HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(hashTuple));
 
 		/* Push it onto the front of the bucket's list */
-		hashTuple->next = hashtable->buckets[bucketno];
+		hashTuple->next.unshared = hashtable->buckets[bucketno];
 		hashtable->buckets[bucketno] = hashTuple;
 
 		/*
@@ -1076,9 +1136,16 @@ ExecScanHashBucket(HashJoinState *hjstate,
 	 * otherwise scan the standard hashtable bucket.
 	 */
 	if (hashTuple != NULL)
-		hashTuple = hashTuple->next;
+		hashTuple = ExecHashNextTuple(hashtable, hashTuple);
 	else if (hjstate->hj_CurSkewBucketNo != INVALID_SKEW_BUCKET_NO)
 		hashTuple = hashtable->skewBucket[hjstate->hj_CurSkewBucketNo]->tuples;
+	else if (hashtable->shared != NULL)
+	{
+		Size	   *buckets = ExecHashSharedBuckets(hashtable->shared);
+
+		hashTuple = ExecHashSharedTuple(hashtable->shared,
+										buckets[hjstate->hj_CurBucketNo]);
+	}
 	else
 		hashTuple = hashtable->buckets[hjstate->hj_CurBucketNo];
 
@@ -1104,7 +1171,7 @@ ExecScanHashBucket(HashJoinState *hjstate,
 			}
 		}
 
-		hashTuple = hashTuple->next;
+		hashTuple = ExecHashNextTuple(hashtable, hashTuple);
 	}
 
 	/*
@@ -1155,7 +1222,7 @@ ExecScanHashTableForUnmatched(HashJoinState *hjstate, ExprContext *econtext)
 		 * bucket.
 		 */
 		if (hashTuple != NULL)
-			hashTuple = hashTuple->next;
+			hashTuple = hashTuple->next.unshared;
 		else if (hjstate->hj_CurBucketNo < hashtable->nbuckets)
 		{
 			hashTuple = hashtable->buckets[hjstate->hj_CurBucketNo];
@@ -1194,7 +1261,7 @@ ExecScanHashTableForUnmatched(HashJoinState *hjstate, ExprContext *econtext)
 				return true;
 			}
 
-			hashTuple = hashTuple->next;
+			hashTuple = hashTuple->next.unshared;
 		}
 	}
 
@@ -1247,7 +1314,8 @@ ExecHashTableResetMatchFlags(HashJoinTable hashtable)
 	/* Reset all flags in the main table ... */
 	for (i = 0; i < hashtable->nbuckets; i++)
 	{
-		for (tuple = hashtable->buckets[i]; tuple != NULL; tuple = tuple->next)
+		for (tuple = hashtable->buckets[i]; tuple != NULL;
+			 tuple = tuple->next.unshared)
 			HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(tuple));
 	}
 
@@ -1257,7 +1325,8 @@ ExecHashTableResetMatchFlags(HashJoinTable hashtable)
 		int			j = hashtable->skewBucketNums[i];
 		HashSkewBucket *skewBucket = hashtable->skewBucket[j];
 
-		for (tuple = skewBucket->tuples; tuple != NULL; tuple = tuple->next)
+		for (tuple = skewBucket->tuples; tuple != NULL;
+			 tuple = tuple->next.unshared)
 			HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(tuple));
 	}
 }
@@ -1509,7 +1578,7 @@ ExecHashSkewTableInsert(HashJoinTable hashtable,
 	HeapTupleHeaderClearMatch(HJTUPLE_MINTUPLE(hashTuple));
 
 	/* Push it onto the front of the skew bucket's list */
-	hashTuple->next = hashtable->skewBucket[bucketNumber]->tuples;
+	hashTuple->next.unshared = hashtable->skewBucket[bucketNumber]->tuples;
 	hashtable->skewBucket[bucketNumber]->tuples = hashTuple;
 
 	/* Account for space used, and back off if we've used too much */
@@ -1558,7 +1627,7 @@ ExecHashRemoveNextSkewBucket(HashJoinTable hashtable)
 	hashTuple = bucket->tuples;
 	while (hashTuple != NULL)
 	{
-		HashJoinTuple nextHashTuple = hashTuple->next;
+		HashJoinTuple nextHashTuple = hashTuple->next.unshared;
 		MinimalTuple tuple;
 		Size		tupleSize;
 
@@ -1584,7 +1653,7 @@ ExecHashRemoveNextSkewBucket(HashJoinTable hashtable)
 			memcpy(copyTuple, hashTuple, tupleSize);
 			pfree(hashTuple);
 
-			copyTuple->next = hashtable->buckets[bucketno];
+			copyTuple->next.unshared = hashtable->buckets[bucketno];
 			hashtable->buckets[bucketno] = copyTuple;
 
 			/* We have reduced skew space, but overall space doesn't change */
@@ -1716,3 +1785,293 @@ dense_alloc(HashJoinTable hashtable, Size size)
 	/* return pointer to the start of the tuple memory */
 	return ptr;
 }
+
+/* ----------------------------------------------------------------
+ *						Parallel Hash Support
+ * ----------------------------------------------------------------
+ */
+
+/*
+ * ExecHashClaimShared
+ *		decide whether we are the one to build the shared hash table
+ *
+ * Returns true if the caller should build its table as usual and then
+ * publish it.  Otherwise we wait for the participant that's building it;
+ * on return the caller's hashtable is either attached to the shared table,
+ * or the table couldn't be shared and the caller must build its own.
+ */
+static bool
+ExecHashClaimShared(HashState *node)
+{
+	SharedHashJoinTable shared = node->shared;
+	SharedHashJoinState state;
+
+	SpinLockAcquire(&shared->mutex);
+	state = shared->state;
+	if (state == SHJ_EMPTY)
+		shared->state = SHJ_BUILDING;
+	else if (state == SHJ_BUILDING)
+	{
+		/* each participant waits at most once per build */
+		Assert(shared->nwaiters < shared->maxwaiters);
+		shared->waiters[shared->nwaiters++] = MyProc;
+	}
+	SpinLockRelease(&shared->mutex);
+
+	if (state == SHJ_EMPTY)
+		return true;
+
+	while (state == SHJ_BUILDING)
+	{
+		WaitLatch(MyLatch, WL_LATCH_SET, 0);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+
+		SpinLockAcquire(&shared->mutex);
+		state = shared->state;
+		SpinLockRelease(&shared->mutex);
+	}
+
+	if (state == SHJ_READY)
+		ExecHashAttachShared(node->hashtable, shared);
+
+	return false;
+}
+
+/*
+ * ExecHashPublishShared
+ *		copy the table we just built into shared memory, if it fits, and
+ *		wake up the participants waiting for it
+ *
+ * Only a single-batch table can be shared, since the other participants
+ * have no access to our batch files.
+ */
+static void
+ExecHashPublishShared(HashState *node)
+{
+	HashJoinTable hashtable = node->hashtable;
+	SharedHashJoinTable shared = node->shared;
+	SharedHashJoinState state = SHJ_FAILED;
+	int			nwaiters;
+	int			i;
+
+	if (hashtable->nbatch == 1)
+	{
+		HashMemoryChunk chunk;
+		Size		space;
+
+		/* there's no skew table without a second batch */
+		Assert(!hashtable->skewEnabled);
+
+		space = MAXALIGN(hashtable->nbuckets * sizeof(Size));
+		for (chunk = hashtable->chunks; chunk != NULL; chunk = chunk->next)
+			space += chunk->used;
+
+		if (shared->data + space <= shared->size)
+		{
+			ExecHashCopyToShared(hashtable, shared);
+			state = SHJ_READY;
+		}
+	}
+
+	/* Nobody registers as a waiter once the build is over. */
+	SpinLockAcquire(&shared->mutex);
+	shared->state = state;
+	nwaiters = shared->nwaiters;
+	SpinLockRelease(&shared->mutex);
+
+	for (i = 0; i < nwaiters; i++)
+		SetLatch(&shared->waiters[i]->procLatch);
+
+	/* We can use the shared copy, too, and free our own. */
+	if (state == SHJ_READY)
+		ExecHashAttachShared(hashtable, shared);
+}
+
+/*
+ * ExecHashCopyToShared
+ *		copy the buckets and tuples of a single-batch table into shared memory
+ *
+ * The caller has checked that there is enough space.  Since the dense
+ * chunks are copied verbatim, all we have to do is rebuild the bucket
+ * chains using offsets.
+ */
+static void
+ExecHashCopyToShared(HashJoinTable hashtable, SharedHashJoinTable shared)
+{
+	HashMemoryChunk chunk;
+	Size	   *buckets;
+	Size		offset;
+
+	shared->nbuckets = hashtable->nbuckets;
+	shared->log2_nbuckets = hashtable->log2_nbuckets;
+	shared->totalTuples = hashtable->totalTuples;
+	shared->buckets = shared->data;
+
+	buckets = ExecHashSharedBuckets(shared);
+	memset(buckets, 0, hashtable->nbuckets * sizeof(Size));
+	offset = shared->buckets + MAXALIGN(hashtable->nbuckets * sizeof(Size));
+
+	for (chunk = hashtable->chunks; chunk != NULL; chunk = chunk->next)
+	{
+		size_t		idx = 0;
+
+		memcpy((char *) shared + offset, chunk->data, chunk->used);
+
+		while (idx < chunk->used)
+		{
+			HashJoinTuple hashTuple = ExecHashSharedTuple(shared, offset + idx);
+			int			bucketno;
+			int			batchno;
+
+			ExecHashGetBucketAndBatch(hashtable, hashTuple->hashvalue,
+									  &bucketno, &batchno);
+
+			/* add the tuple to the proper bucket */
+			hashTuple->next.shared = buckets[bucketno];
+			buckets[bucketno] = offset + idx;
+
+			/* advance index past the tuple */
+			idx += MAXALIGN(HJTUPLE_OVERHEAD +
+							HJTUPLE_MINTUPLE(hashTuple)->t_len);
+		}
+
+		offset += chunk->used;
+	}
+
+	shared->spaceUsed = offset - shared->data;
+}
+
+/*
+ * ExecHashAttachShared
+ *		make a hashtable probe the shared table instead of its own buckets
+ */
+static void
+ExecHashAttachShared(HashJoinTable hashtable, SharedHashJoinTable shared)
+{
+	/* everybody started out the same way as the builder */
+	Assert(hashtable->nbatch == 1);
+
+	/* Release our own buckets and tuples, if any. */
+	MemoryContextReset(hashtable->batchCxt);
+	hashtable->buckets = NULL;
+	hashtable->chunks = NULL;
+
+	hashtable->shared = shared;
+	hashtable->nbuckets = shared->nbuckets;
+	hashtable->log2_nbuckets = shared->log2_nbuckets;
+	hashtable->nbuckets_optimal = shared->nbuckets;
+	hashtable->log2_nbuckets_optimal = shared->log2_nbuckets;
+	hashtable->totalTuples = shared->totalTuples;
+	hashtable->spaceUsed = shared->spaceUsed;
+	if (hashtable->spaceUsed > hashtable->spacePeak)
+		hashtable->spacePeak = hashtable->spaceUsed;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashEstimate
+ *
+ *		estimates the space required for a shared hash table.
+ *
+ *		We reserve twice the planner's idea of the table's size, so that a
+ *		moderate misestimate doesn't force everybody back to private
+ *		tables, but never more than work_mem, which is all a private
+ *		single-batch table would be allowed to use anyway.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashEstimate(HashState *node, ParallelContext *pcxt)
+{
+	Hash	   *plan = (Hash *) node->ps.plan;
+	Plan	   *outerNode = outerPlan(plan);
+	int			nbuckets;
+	int			nbatch;
+	int			num_skew_mcvs;
+	double		ntuples;
+	double		space;
+
+	ExecChooseHashTableSize(outerNode->plan_rows, outerNode->plan_width,
+							OidIsValid(plan->skewTable),
+							&nbuckets, &nbatch, &num_skew_mcvs);
+
+	ntuples = Max(outerNode->plan_rows, 1.0);
+	space = ntuples * (HJTUPLE_OVERHEAD +
+					   MAXALIGN(SizeofMinimalTupleHeader) +
+					   MAXALIGN(outerNode->plan_width));
+	space = 2.0 * (space + nbuckets * sizeof(Size));
+	space = Min(space, work_mem * 1024.0);
+
+	node->shared_len =
+		MAXALIGN(add_size(offsetof(SharedHashJoinTableData, waiters),
+						  mul_size(pcxt->nworkers + 1, sizeof(PGPROC *))));
+	node->shared_len = add_size(node->shared_len, MAXALIGN((Size) space));
+
+	shm_toc_estimate_chunk(&pcxt->estimator, node->shared_len);
+	shm_toc_estimate_keys(&pcxt->estimator, 1);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashInitializeDSM
+ *
+ *		Set up an empty shared hash table.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashInitializeDSM(HashState *node, ParallelContext *pcxt)
+{
+	SharedHashJoinTable shared;
+
+	shared = shm_toc_allocate(pcxt->toc, node->shared_len);
+	SpinLockInit(&shared->mutex);
+	shared->state = SHJ_EMPTY;
+	shared->nwaiters = 0;
+	shared->maxwaiters = pcxt->nworkers + 1;
+	shared->data = MAXALIGN(offsetof(SharedHashJoinTableData, waiters) +
+							shared->maxwaiters * sizeof(PGPROC *));
+	shared->size = node->shared_len;
+
+	shm_toc_insert(pcxt->toc, node->ps.plan->plan_node_id, shared);
+	node->shared = shared;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashReInitializeDSM
+ *
+ *		Empty the shared hash table before the workers are relaunched for
+ *		a rescan.  No worker is running at this point.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashReInitializeDSM(HashState *node, ParallelContext *pcxt)
+{
+	SharedHashJoinTable shared = node->shared;
+
+	shared->state = SHJ_EMPTY;
+	shared->nwaiters = 0;
+}
+
+/* ----------------------------------------------------------------
+ *		ExecHashInitializeWorker
+ *
+ *		Copy relevant information from TOC into planstate.
+ * ----------------------------------------------------------------
+ */
+void
+ExecHashInitializeWorker(HashState *node, shm_toc *toc)
+{
+	node->shared = shm_toc_lookup(toc, node->ps.plan->plan_node_id);
+}
+
+/* ----------------------------------------------------------------
+ *		ExecShutdownHash
+ *
+ *		Forget the shared hash table; the parallel context holding it is
+ *		being destroyed.  A hashtable still attached to it won't be reused by
+ *		ExecReScanHashJoin.
+ * ----------------------------------------------------------------
+ */
+void
+ExecShutdownHash(HashState *node)
+{
+	node->shared = NULL;
+}
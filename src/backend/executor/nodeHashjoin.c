@@ -959,7 +959,12 @@ ExecReScanHashJoin(HashJoinState *node)
 	 */
 	if (node->hj_HashTable != NULL)
 	{
+		/*
+		 * A shared table is never reused: the DSM segment it lives in may be
+		 * gone or about to be refilled by the time we get to use it again.
+		 */
 		if (node->hj_HashTable->nbatch == 1 &&
+			node->hj_HashTable->shared == NULL &&
 			node->js.ps.righttree->chgParam == NULL)
 		{
 			/*
@@ -19,10 +19,14 @@
  *		ExecInitTidScan		creates and initializes state info.
  *		ExecReScanTidScan	rescans the tid relation.
  *		ExecEndTidScan		releases all storage.
+ *		TidScanIsRange		does the scan read a range of tids?
  */
 #include "postgres.h"
 
+#include "access/heapam.h"
+#include "access/relscan.h"
 #include "access/sysattr.h"
+#include "catalog/pg_operator.h"
 #include "catalog/pg_type.h"
 #include "executor/execdebug.h"
 #include "executor/nodeTidscan.h"
@@ -39,8 +43,10 @@
 	 ((Var *) (node))->varlevelsup == 0)
 
 static void TidListCreate(TidScanState *tidstate);
+static void TidRangeScanCreate(TidScanState *tidstate);
 static int	itemptr_comparator(const void *a, const void *b);
 static TupleTableSlot *TidNext(TidScanState *node);
+static TupleTableSlot *TidRangeNext(TidScanState *node);
 
 
 /*
@@ -215,6 +221,105 @@ TidListCreate(TidScanState *tidstate)
 	tidstate->tss_TidPtr = -1;
 }
 
+/*
+ * Start the scan of a CTID range, by evaluating the bounds of the range and
+ * beginning a heap scan of the blocks it covers.
+ *
+ * The range quals are checked as ordinary quals too, so we just have to
+ * get the blocks right here; the offsets are left to the quals.
+ */
+static void
+TidRangeScanCreate(TidScanState *tidstate)
+{
+	BoolExprState *bstate = (BoolExprState *) linitial(tidstate->tss_tidquals);
+	ExprContext *econtext = tidstate->ss.ps.ps_ExprContext;
+	Relation	rel = tidstate->ss.ss_currentRelation;
+	BlockNumber startBlk = 0;
+	BlockNumber endBlk;
+	ListCell   *l;
+
+	/* As in TidListCreate, blocks added after the scan starts are ignored */
+	endBlk = RelationGetNumberOfBlocks(rel);
+
+	foreach(l, bstate->args)
+	{
+		FuncExprState *fexstate = (FuncExprState *) lfirst(l);
+		OpExpr	   *expr = (OpExpr *) fexstate->xprstate.expr;
+		ExprState  *exstate;
+		Oid			opno = expr->opno;
+		ItemPointer itemptr;
+		BlockNumber block;
+		OffsetNumber offset;
+		bool		isNull;
+
+		if (IsCTIDVar(get_leftop((Expr *) expr)))
+			exstate = (ExprState *) lsecond(fexstate->args);
+		else if (IsCTIDVar(get_rightop((Expr *) expr)))
+		{
+			/* pseudoconstant op CTID, so commute the operator */
+			exstate = (ExprState *) linitial(fexstate->args);
+			if (opno == TIDLessOperator)
+				opno = TIDGreaterOperator;
+			else if (opno == TIDLessEqOperator)
+				opno = TIDGreaterEqOperator;
+			else if (opno == TIDGreaterOperator)
+				opno = TIDLessOperator;
+			else if (opno == TIDGreaterEqOperator)
+				opno = TIDLessEqOperator;
+		}
+		else
+			elog(ERROR, "could not identify CTID variable");
+
+		itemptr = (ItemPointer)
+			DatumGetPointer(ExecEvalExprSwitchContext(exstate,
+													  econtext,
+													  &isNull,
+													  NULL));
+		if (isNull)
+		{
+			/* The comparison can't be true, so the range is empty */
+			endBlk = 0;
+			break;
+		}
+
+		/* The bounds needn't be valid TIDs, think of '(10,0)' */
+		block = BlockIdGetBlockNumber(&itemptr->ip_blkid);
+		offset = itemptr->ip_posid;
+
+		switch (opno)
+		{
+			case TIDGreaterOperator:
+			case TIDGreaterEqOperator:
+				startBlk = Max(startBlk, block);
+				break;
+			case TIDLessOperator:
+				/* The block itself only counts if it can have a lower offset */
+				if (block < endBlk)
+					endBlk = (offset > FirstOffsetNumber) ? block + 1 : block;
+				break;
+			case TIDLessEqOperator:
+				if (block < endBlk)
+					endBlk = (offset >= FirstOffsetNumber) ? block + 1 : block;
+				break;
+			default:
+				elog(ERROR, "unrecognized CTID range operator: %u", opno);
+		}
+	}
+
+	if (startBlk < endBlk)
+	{
+		HeapScanDesc scan;
+
+		scan = heap_beginscan_strat(rel, tidstate->ss.ps.state->es_snapshot,
+									0, NULL, true, false);
+		heap_setscanlimits(scan, startBlk, endBlk - startBlk);
+		tidstate->ss.ss_currentScanDesc = scan;
+	}
+
+	/* Mark the scan as started */
+	tidstate->tss_TidPtr = 0;
+}
+
 /*
  * qsort comparator for ItemPointerData items
  */
@@ -270,6 +375,9 @@ TidNext(TidScanState *node)
 	heapRelation = node->ss.ss_currentRelation;
 	slot = node->ss.ss_ScanTupleSlot;
 
+	if (node->tss_isRange)
+		return TidRangeNext(node);
+
 	/*
 	 * First time through, compute the list of TIDs to be visited
 	 */
@@ -354,6 +462,39 @@ TidNext(TidScanState *node)
 	return ExecClearTuple(slot);
 }
 
+/* ----------------------------------------------------------------
+ *		TidRangeNext
+ *
+ *		Retrieve the next tuple of a CTID range scan.  The scan is
+ *		forward-only (see ExecSupportsBackwardScan), as heap scans don't
+ *		support scanning a range of blocks backward.
+ * ----------------------------------------------------------------
+ */
+static TupleTableSlot *
+TidRangeNext(TidScanState *node)
+{
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+	HeapScanDesc scan;
+	HeapTuple	tuple;
+
+	Assert(ScanDirectionIsForward(node->ss.ps.state->es_direction));
+
+	/* First time through, start the scan */
+	if (node->tss_TidPtr < 0)
+		TidRangeScanCreate(node);
+
+	scan = node->ss.ss_currentScanDesc;
+	if (scan == NULL)
+		return ExecClearTuple(slot);	/* empty range */
+
+	tuple = heap_getnext(scan, ForwardScanDirection);
+	if (tuple == NULL)
+		return ExecClearTuple(slot);
+
+	ExecStoreTuple(tuple, slot, scan->rs_cbuf, false);
+	return slot;
+}
+
 /*
  * TidRecheck -- access method routine to recheck a tuple in EvalPlanQual
  */
@@ -408,6 +549,11 @@ ExecReScanTidScan(TidScanState *node)
 	node->tss_NumTids = 0;
 	node->tss_TidPtr = -1;
 
+	/* The range may depend on parameters, so start over */
+	if (node->ss.ss_currentScanDesc)
+		heap_endscan(node->ss.ss_currentScanDesc);
+	node->ss.ss_currentScanDesc = NULL;
+
 	ExecScanReScan(&node->ss);
 }
 
@@ -433,11 +579,26 @@ ExecEndTidScan(TidScanState *node)
 	ExecClearTuple(node->ss.ss_ScanTupleSlot);
 
 	/*
-	 * close the heap relation.
+	 * close the range scan, if any, and the heap relation.
 	 */
+	if (node->ss.ss_currentScanDesc)
+		heap_endscan(node->ss.ss_currentScanDesc);
 	ExecCloseScanRelation(node->ss.ss_currentRelation);
 }
 
+/*
+ * TidScanIsRange -- does the scan read a CTID range?
+ *
+ * The planner represents range quals as a single AND clause in tidquals,
+ * see tidpath.c.
+ */
+bool
+TidScanIsRange(TidScan *node)
+{
+	return list_length(node->tidquals) == 1 &&
+		and_clause(linitial(node->tidquals));
+}
+
 /* ----------------------------------------------------------------
  *		ExecInitTidScan
  *
@@ -484,6 +645,7 @@ ExecInitTidScan(TidScan *node, EState *estate, int eflags)
 	tidstate->tss_tidquals = (List *)
 		ExecInitExpr((Expr *) node->tidquals,
 					 (PlanState *) tidstate);
+	tidstate->tss_isRange = TidScanIsRange(node);
 
 	/*
 	 * tuple table initialization
@@ -504,7 +666,7 @@ ExecInitTidScan(TidScan *node, EState *estate, int eflags)
 	currentRelation = ExecOpenScanRelation(estate, node->scan.scanrelid, eflags);
 
 	tidstate->ss.ss_currentRelation = currentRelation;
-	tidstate->ss.ss_currentScanDesc = NULL;		/* no heap scan here */
+	tidstate->ss.ss_currentScanDesc = NULL;		/* only for ranges, later */
 
 	/*
 	 * get the scan type from the relation descriptor.
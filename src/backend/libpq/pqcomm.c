@@ -44,6 +44,7 @@
  *		StreamClose			- Close a client/backend connection
  *		TouchSocketFiles	- Protect socket files against /tmp cleaners
  *		pq_init			- initialize libpq at backend startup
+ *		pq_switch_port	- switch to another client connection
  *		pq_comm_reset	- reset libpq during error recovery
  *		pq_close		- shutdown libpq at backend exit
  *
@@ -57,6 +58,7 @@
  *		pq_flush		- flush pending output
  *		pq_flush_if_writable - flush pending output if writable without blocking
  *		pq_getbyte_if_available - get a byte if available without blocking
+ *		pq_buffer_has_data - check whether received data is buffered
  *
  * message-level I/O (and old-style-COPY-OUT cruft):
  *		pq_putmessage	- send a normal message (suppressed in COPY OUT mode)
@@ -209,6 +211,33 @@ pq_init(void)
 	AddWaitEventToSet(FeBeWaitSet, WL_POSTMASTER_DEATH, -1, NULL, NULL);
 }
 
+/* --------------------------------
+ *		pq_switch_port - talk to another client connection from now on
+ *
+ * Used by backends serving several pooled sessions (see tcop/sessionpool.c).
+ * Anything still in the buffers is discarded, so the caller must switch
+ * only between messages, or away from a connection that was lost.  The new
+ * socket must already be in nonblocking mode.
+ * --------------------------------
+ */
+void
+pq_switch_port(Port *port)
+{
+	Assert(!DoingCopyOut);
+
+	MyProcPort = port;
+	PqSendPointer = PqSendStart = PqRecvPointer = PqRecvLength = 0;
+	PqCommBusy = false;
+	PqCommReadingMsg = false;
+
+	FreeWaitEventSet(FeBeWaitSet);
+	FeBeWaitSet = CreateWaitEventSet(TopMemoryContext, 3);
+	AddWaitEventToSet(FeBeWaitSet, WL_SOCKET_WRITEABLE, MyProcPort->sock,
+					  NULL, NULL);
+	AddWaitEventToSet(FeBeWaitSet, WL_LATCH_SET, -1, MyLatch, NULL);
+	AddWaitEventToSet(FeBeWaitSet, WL_POSTMASTER_DEATH, -1, NULL, NULL);
+}
+
 /* --------------------------------
  *		socket_comm_reset - reset libpq during error recovery
  *
@@ -1042,6 +1071,16 @@ pq_getbyte_if_available(unsigned char *c)
 	return r;
 }
 
+/* --------------------------------
+ *		pq_buffer_has_data		- is any received data left in the buffer?
+ * --------------------------------
+ */
+bool
+pq_buffer_has_data(void)
+{
+	return PqRecvPointer < PqRecvLength;
+}
+
 /* --------------------------------
  *		pq_getbytes		- get a known number of bytes from connection
  *
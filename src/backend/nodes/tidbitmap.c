@@ -28,6 +28,9 @@
  * into a bitmap, and it can also happen internally when we AND a lossy
  * and a non-lossy page.
  *
+ * A bitmap can also be shared with the workers of a parallel query, which
+ * then iterate over it together, see tbm_share.
+ *
  *
  * Copyright (c) 2003-2016, PostgreSQL Global Development Group
  *
@@ -43,7 +46,8 @@
 #include "access/htup_details.h"
 #include "nodes/bitmapset.h"
 #include "nodes/tidbitmap.h"
-#include "utils/hsearch.h"
+#include "port/atomics.h"
+#include "storage/shmem.h"
 
 /*
  * The maximum number of tuples per page is not large (typically 256 with
@@ -61,9 +65,9 @@
  * for that page in the page table.
  *
  * We actually store both exact pages and lossy chunks in the same hash
- * table, using identical data structures.  (This is because dynahash.c's
- * memory management doesn't allow space to be transferred easily from one
- * hashtable to another.)  Therefore it's best if PAGES_PER_CHUNK is the
+ * table, using identical data structures.  (This is because the hash
+ * table's memory can't be transferred easily from one hashtable to
+ * another.)  Therefore it's best if PAGES_PER_CHUNK is the
  * same as MAX_TUPLES_PER_PAGE, or at least not too different.  But we
  * also want PAGES_PER_CHUNK to be a power of 2 to avoid expensive integer
  * remainder operations.  So, define it like this:
@@ -97,16 +101,47 @@
 typedef struct PagetableEntry
 {
 	BlockNumber blockno;		/* page number (hashtable key) */
+	char		status;			/* hash entry status */
 	bool		ischunk;		/* T = lossy storage, F = exact */
 	bool		recheck;		/* should the tuples be rechecked? */
 	bitmapword	words[Max(WORDS_PER_PAGE, WORDS_PER_CHUNK)];
 } PagetableEntry;
 
 /*
- * dynahash.c is optimized for relatively large, long-lived hash tables.
- * This is not ideal for TIDBitMap, particularly when we are using a bitmap
- * scan on the inside of a nestloop join: a bitmap may well live only long
- * enough to accumulate one entry in such cases.  We therefore avoid creating
+ * Hash a block number for the pagetable.  Block numbers of a heap are dense
+ * and the table's bucket is chosen from the low bits, so mix all bits into
+ * them (this is the MurmurHash3 finalizer).
+ */
+static inline uint32
+hash_blockno(BlockNumber b)
+{
+	uint32		h = b;
+
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+	return h;
+}
+
+/* define hashtable mapping block numbers to PagetableEntry's */
+#define SH_PREFIX pagetable
+#define SH_ELEMENT_TYPE PagetableEntry
+#define SH_KEY_TYPE BlockNumber
+#define SH_KEY blockno
+#define SH_HASH_KEY(tb, key) hash_blockno(key)
+#define SH_EQUAL(tb, a, b) a == b
+#define SH_SCOPE static inline
+#define SH_DEFINE
+#define SH_DECLARE
+#include "lib/simplehash.h"
+
+/*
+ * Even a small hash table costs a bucket array allocation.  This is not
+ * ideal for TIDBitMap, particularly when we are using a bitmap scan on the
+ * inside of a nestloop join: a bitmap may well live only long enough to
+ * accumulate one entry in such cases.  We therefore avoid creating
  * an actual hashtable until we need two pagetable entries.  When just one
  * pagetable entry is needed, we store it in a fixed field of TIDBitMap.
  * (NOTE: we don't get rid of the hashtable if the bitmap later shrinks down
@@ -128,7 +163,7 @@ struct TIDBitmap
 	NodeTag		type;			/* to make it a valid Node */
 	MemoryContext mcxt;			/* memory context containing me */
 	TBMStatus	status;			/* see codes above */
-	HTAB	   *pagetable;		/* hash table of PagetableEntry's */
+	struct pagetable_hash *pagetable;	/* hash table of PagetableEntry's */
 	int			nentries;		/* number of entries in pagetable */
 	int			maxentries;		/* limit on same to meet maxbytes */
 	int			npages;			/* number of exact entries in pagetable */
@@ -156,6 +191,35 @@ struct TBMIterator
 };
 
 
+/*
+ * A shared bitmap is a read-only copy of the entries of a TIDBitmap, sorted
+ * by block number, in memory all the participants of a parallel scan can
+ * read.  Each participant claims an entry, an exact page or a whole lossy
+ * chunk, by atomically advancing the next cursor.  A second cursor does the
+ * same for the participants' prefetching, always staying ahead of the first.
+ */
+struct TBMSharedIteratorState
+{
+	pg_atomic_uint32 next;		/* next entry to scan */
+	pg_atomic_uint32 prefetch_next;		/* next entry to prefetch */
+	int			nentries;		/* number of entries */
+	PagetableEntry entries[FLEXIBLE_ARRAY_MEMBER];	/* sorted entries */
+};
+
+/*
+ * A participant's iterator over a shared bitmap.  Pages of a lossy chunk
+ * it claimed are returned one by one, like by a TBMIterator.
+ */
+struct TBMSharedIterator
+{
+	TBMSharedIteratorState *state;	/* shared bitmap we're iterating over */
+	bool		prefetch;		/* advances prefetch_next rather than next */
+	const PagetableEntry *chunk;	/* claimed lossy chunk, or NULL */
+	int			schunkbit;		/* next bit to check in chunk */
+	TBMIterateResult output;	/* MUST BE LAST (because variable-size) */
+};
+
+
 /* Local function prototypes */
 static void tbm_union_page(TIDBitmap *a, const PagetableEntry *bpage);
 static bool tbm_intersect_page(TIDBitmap *a, PagetableEntry *apage,
@@ -166,6 +230,10 @@ static PagetableEntry *tbm_get_pageentry(TIDBitmap *tbm, BlockNumber pageno);
 static bool tbm_page_is_lossy(const TIDBitmap *tbm, BlockNumber pageno);
 static void tbm_mark_page_lossy(TIDBitmap *tbm, BlockNumber pageno);
 static void tbm_lossify(TIDBitmap *tbm);
+static long tbm_max_entries(long maxbytes);
+static void tbm_sort_pages(TIDBitmap *tbm);
+static int	tbm_extract_page_tuples(const PagetableEntry *page,
+						 TBMIterateResult *output);
 static int	tbm_comparator(const void *left, const void *right);
 
 
@@ -180,29 +248,39 @@ TIDBitmap *
 tbm_create(long maxbytes)
 {
 	TIDBitmap  *tbm;
-	long		nbuckets;
 
 	/* Create the TIDBitmap struct and zero all its fields */
 	tbm = makeNode(TIDBitmap);
 
 	tbm->mcxt = CurrentMemoryContext;
 	tbm->status = TBM_EMPTY;
+	tbm->maxentries = (int) tbm_max_entries(maxbytes);
+
+	return tbm;
+}
+
+/*
+ * tbm_max_entries - number of hashtable entries a bitmap can have within
+ * maxbytes
+ */
+static long
+tbm_max_entries(long maxbytes)
+{
+	long		nbuckets;
 
 	/*
 	 * Estimate number of hashtable entries we can have within maxbytes. This
-	 * estimates the hash overhead at MAXALIGN(sizeof(HASHELEMENT)) plus a
-	 * pointer per hash entry, which is crude but good enough for our purpose.
-	 * Also count an extra Pointer per entry for the arrays created during
-	 * iteration readout.
+	 * estimates the hash cost as sizeof(PagetableEntry), plus a pointer for
+	 * the unused buckets, which is good enough for our purpose.  Also count
+	 * an extra Pointer per entry for the arrays created during iteration
+	 * readout.
 	 */
 	nbuckets = maxbytes /
-		(MAXALIGN(sizeof(HASHELEMENT)) + MAXALIGN(sizeof(PagetableEntry))
-		 + sizeof(Pointer) + sizeof(Pointer));
+		(sizeof(PagetableEntry) + sizeof(Pointer) + sizeof(Pointer));
 	nbuckets = Min(nbuckets, INT_MAX - 1);		/* safety limit */
 	nbuckets = Max(nbuckets, 16);		/* sanity limit */
-	tbm->maxentries = (int) nbuckets;
 
-	return tbm;
+	return nbuckets;
 }
 
 /*
@@ -212,32 +290,26 @@ tbm_create(long maxbytes)
 static void
 tbm_create_pagetable(TIDBitmap *tbm)
 {
-	HASHCTL		hash_ctl;
-
 	Assert(tbm->status != TBM_HASH);
 	Assert(tbm->pagetable == NULL);
 
-	/* Create the hashtable proper */
-	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
-	hash_ctl.keysize = sizeof(BlockNumber);
-	hash_ctl.entrysize = sizeof(PagetableEntry);
-	hash_ctl.hcxt = tbm->mcxt;
-	tbm->pagetable = hash_create("TIDBitmap",
-								 128,	/* start small and extend */
-								 &hash_ctl,
-								 HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	/* Create the hashtable proper, starting small and extending */
+	tbm->pagetable = pagetable_create(tbm->mcxt, 128, NULL);
 
 	/* If entry1 is valid, push it into the hashtable */
 	if (tbm->status == TBM_ONE_PAGE)
 	{
 		PagetableEntry *page;
 		bool		found;
+		char		oldstatus;
 
-		page = (PagetableEntry *) hash_search(tbm->pagetable,
-											  (void *) &tbm->entry1.blockno,
-											  HASH_ENTER, &found);
+		page = pagetable_insert(tbm->pagetable,
+								tbm->entry1.blockno,
+								&found);
 		Assert(!found);
+		oldstatus = page->status;
 		memcpy(page, &tbm->entry1, sizeof(PagetableEntry));
+		page->status = oldstatus;
 	}
 
 	tbm->status = TBM_HASH;
@@ -250,7 +322,7 @@ void
 tbm_free(TIDBitmap *tbm)
 {
 	if (tbm->pagetable)
-		hash_destroy(tbm->pagetable);
+		pagetable_destroy(tbm->pagetable);
 	if (tbm->spages)
 		pfree(tbm->spages);
 	if (tbm->schunks)
@@ -357,12 +429,12 @@ tbm_union(TIDBitmap *a, const TIDBitmap *b)
 		tbm_union_page(a, &b->entry1);
 	else
 	{
-		HASH_SEQ_STATUS status;
+		pagetable_iterator i;
 		PagetableEntry *bpage;
 
 		Assert(b->status == TBM_HASH);
-		hash_seq_init(&status, b->pagetable);
-		while ((bpage = (PagetableEntry *) hash_seq_search(&status)) != NULL)
+		pagetable_start_iterate(b->pagetable, &i);
+		while ((bpage = pagetable_iterate(b->pagetable, &i)) != NULL)
 			tbm_union_page(a, bpage);
 	}
 }
@@ -449,12 +521,12 @@ tbm_intersect(TIDBitmap *a, const TIDBitmap *b)
 	}
 	else
 	{
-		HASH_SEQ_STATUS status;
+		pagetable_iterator i;
 		PagetableEntry *apage;
 
 		Assert(a->status == TBM_HASH);
-		hash_seq_init(&status, a->pagetable);
-		while ((apage = (PagetableEntry *) hash_seq_search(&status)) != NULL)
+		pagetable_start_iterate(a->pagetable, &i);
+		while ((apage = pagetable_iterate(a->pagetable, &i)) != NULL)
 		{
 			if (tbm_intersect_page(a, apage, b))
 			{
@@ -464,9 +536,7 @@ tbm_intersect(TIDBitmap *a, const TIDBitmap *b)
 				else
 					a->npages--;
 				a->nentries--;
-				if (hash_search(a->pagetable,
-								(void *) &apage->blockno,
-								HASH_REMOVE, NULL) == NULL)
+				if (!pagetable_delete(a->pagetable, apage->blockno))
 					elog(ERROR, "hash table corrupted");
 			}
 		}
@@ -605,45 +675,55 @@ tbm_begin_iterate(TIDBitmap *tbm)
 	 * than one iterator.
 	 */
 	if (tbm->status == TBM_HASH && !tbm->iterating)
-	{
-		HASH_SEQ_STATUS status;
-		PagetableEntry *page;
-		int			npages;
-		int			nchunks;
-
-		if (!tbm->spages && tbm->npages > 0)
-			tbm->spages = (PagetableEntry **)
-				MemoryContextAlloc(tbm->mcxt,
-								   tbm->npages * sizeof(PagetableEntry *));
-		if (!tbm->schunks && tbm->nchunks > 0)
-			tbm->schunks = (PagetableEntry **)
-				MemoryContextAlloc(tbm->mcxt,
-								   tbm->nchunks * sizeof(PagetableEntry *));
-
-		hash_seq_init(&status, tbm->pagetable);
-		npages = nchunks = 0;
-		while ((page = (PagetableEntry *) hash_seq_search(&status)) != NULL)
-		{
-			if (page->ischunk)
-				tbm->schunks[nchunks++] = page;
-			else
-				tbm->spages[npages++] = page;
-		}
-		Assert(npages == tbm->npages);
-		Assert(nchunks == tbm->nchunks);
-		if (npages > 1)
-			qsort(tbm->spages, npages, sizeof(PagetableEntry *),
-				  tbm_comparator);
-		if (nchunks > 1)
-			qsort(tbm->schunks, nchunks, sizeof(PagetableEntry *),
-				  tbm_comparator);
-	}
+		tbm_sort_pages(tbm);
 
 	tbm->iterating = true;
 
 	return iterator;
 }
 
+/*
+ * tbm_sort_pages - create and fill the sorted page lists of a bitmap with
+ * a hashtable
+ */
+static void
+tbm_sort_pages(TIDBitmap *tbm)
+{
+	pagetable_iterator i;
+	PagetableEntry *page;
+	int			npages;
+	int			nchunks;
+
+	Assert(tbm->status == TBM_HASH);
+
+	if (!tbm->spages && tbm->npages > 0)
+		tbm->spages = (PagetableEntry **)
+			MemoryContextAlloc(tbm->mcxt,
+							   tbm->npages * sizeof(PagetableEntry *));
+	if (!tbm->schunks && tbm->nchunks > 0)
+		tbm->schunks = (PagetableEntry **)
+			MemoryContextAlloc(tbm->mcxt,
+							   tbm->nchunks * sizeof(PagetableEntry *));
+
+	npages = nchunks = 0;
+	pagetable_start_iterate(tbm->pagetable, &i);
+	while ((page = pagetable_iterate(tbm->pagetable, &i)) != NULL)
+	{
+		if (page->ischunk)
+			tbm->schunks[nchunks++] = page;
+		else
+			tbm->spages[npages++] = page;
+	}
+	Assert(npages == tbm->npages);
+	Assert(nchunks == tbm->nchunks);
+	if (npages > 1)
+		qsort(tbm->spages, npages, sizeof(PagetableEntry *),
+			  tbm_comparator);
+	if (nchunks > 1)
+		qsort(tbm->schunks, nchunks, sizeof(PagetableEntry *),
+			  tbm_comparator);
+}
+
 /*
  * tbm_iterate - scan through next page of a TIDBitmap
  *
@@ -717,8 +797,6 @@ tbm_iterate(TBMIterator *iterator)
 	if (iterator->spageptr < tbm->npages)
 	{
 		PagetableEntry *page;
-		int			ntuples;
-		int			wordnum;
 
 		/* In ONE_PAGE state, we don't allocate an spages[] array */
 		if (tbm->status == TBM_ONE_PAGE)
@@ -726,27 +804,8 @@ tbm_iterate(TBMIterator *iterator)
 		else
 			page = tbm->spages[iterator->spageptr];
 
-		/* scan bitmap to extract individual offset numbers */
-		ntuples = 0;
-		for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
-		{
-			bitmapword	w = page->words[wordnum];
-
-			if (w != 0)
-			{
-				int			off = wordnum * BITS_PER_BITMAPWORD + 1;
-
-				while (w != 0)
-				{
-					if (w & 1)
-						output->offsets[ntuples++] = (OffsetNumber) off;
-					off++;
-					w >>= 1;
-				}
-			}
-		}
 		output->blockno = page->blockno;
-		output->ntuples = ntuples;
+		output->ntuples = tbm_extract_page_tuples(page, output);
 		output->recheck = page->recheck;
 		iterator->spageptr++;
 		return output;
@@ -756,6 +815,37 @@ tbm_iterate(TBMIterator *iterator)
 	return NULL;
 }
 
+/*
+ * tbm_extract_page_tuples - scan the bitmap of an exact page to extract
+ * individual offset numbers into output, returning how many there are
+ */
+static int
+tbm_extract_page_tuples(const PagetableEntry *page, TBMIterateResult *output)
+{
+	int			ntuples = 0;
+	int			wordnum;
+
+	for (wordnum = 0; wordnum < WORDS_PER_PAGE; wordnum++)
+	{
+		bitmapword	w = page->words[wordnum];
+
+		if (w != 0)
+		{
+			int			off = wordnum * BITS_PER_BITMAPWORD + 1;
+
+			while (w != 0)
+			{
+				if (w & 1)
+					output->offsets[ntuples++] = (OffsetNumber) off;
+				off++;
+				w >>= 1;
+			}
+		}
+	}
+
+	return ntuples;
+}
+
 /*
  * tbm_end_iterate - finish an iteration over a TIDBitmap
  *
@@ -769,6 +859,188 @@ tbm_end_iterate(TBMIterator *iterator)
 	pfree(iterator);
 }
 
+/*
+ * tbm_estimate_shared_size - estimate the space tbm_share needs for a bitmap
+ *
+ * The bitmap is to hold about ntuples TIDs in up to maxbytes of memory, as
+ * given to tbm_create.  A bitmap doesn't have more entries than TIDs, nor
+ * many more than maxbytes allow, but it can have fewer; the caller has to
+ * be prepared for tbm_shared_size to tell it needs more space after all.
+ */
+Size
+tbm_estimate_shared_size(double ntuples, long maxbytes)
+{
+	double		nentries;
+
+	nentries = Min(ntuples, (double) tbm_max_entries(maxbytes));
+	nentries = Max(nentries, 1.0);
+
+	return add_size(offsetof(TBMSharedIteratorState, entries),
+					mul_size((Size) nentries, sizeof(PagetableEntry)));
+}
+
+/*
+ * tbm_shared_size - space tbm_share needs to share a TIDBitmap
+ */
+Size
+tbm_shared_size(const TIDBitmap *tbm)
+{
+	return add_size(offsetof(TBMSharedIteratorState, entries),
+					mul_size(tbm->nentries, sizeof(PagetableEntry)));
+}
+
+/*
+ * tbm_share - copy a TIDBitmap to memory shared with parallel workers
+ *
+ * state must point to at least tbm_shared_size(tbm) bytes of shared memory.
+ * Afterwards, the participants of the parallel scan iterate over the copy
+ * together by attaching to it with tbm_attach_shared_iterate; every page is
+ * returned to only one of them.  The bitmap itself becomes read-only, as if
+ * tbm_begin_iterate had been called, and may be freed.
+ */
+void
+tbm_share(TIDBitmap *tbm, TBMSharedIteratorState *state)
+{
+	int			n = 0;
+
+	pg_atomic_init_u32(&state->next, 0);
+	pg_atomic_init_u32(&state->prefetch_next, 0);
+	state->nentries = tbm->nentries;
+
+	if (tbm->status == TBM_ONE_PAGE)
+		state->entries[n++] = tbm->entry1;
+	else if (tbm->status == TBM_HASH)
+	{
+		int			spageptr = 0;
+		int			schunkptr = 0;
+
+		if (!tbm->iterating)
+			tbm_sort_pages(tbm);
+
+		/* merge the sorted page and chunk lists */
+		while (spageptr < tbm->npages || schunkptr < tbm->nchunks)
+		{
+			if (schunkptr >= tbm->nchunks ||
+				(spageptr < tbm->npages &&
+				 tbm->spages[spageptr]->blockno <
+				 tbm->schunks[schunkptr]->blockno))
+				state->entries[n++] = *tbm->spages[spageptr++];
+			else
+				state->entries[n++] = *tbm->schunks[schunkptr++];
+		}
+	}
+	Assert(n == state->nentries);
+
+	tbm->iterating = true;
+}
+
+/*
+ * tbm_attach_shared_iterate - prepare to iterate over a shared bitmap
+ *
+ * With prefetch, the iterator returns the pages the other iterators are
+ * going to return, a little ahead of them, rather than its own share of
+ * them.  Pages already being scanned are skipped.
+ */
+TBMSharedIterator *
+tbm_attach_shared_iterate(TBMSharedIteratorState *state, bool prefetch)
+{
+	TBMSharedIterator *iterator;
+
+	/*
+	 * Create the TBMSharedIterator struct, with enough trailing space to
+	 * serve the needs of the TBMIterateResult sub-struct.
+	 */
+	iterator = (TBMSharedIterator *) palloc(sizeof(TBMSharedIterator) +
+								 MAX_TUPLES_PER_PAGE * sizeof(OffsetNumber));
+	iterator->state = state;
+	iterator->prefetch = prefetch;
+	iterator->chunk = NULL;
+	iterator->schunkbit = 0;
+
+	return iterator;
+}
+
+/*
+ * tbm_shared_iterate - scan through next page of a shared bitmap
+ *
+ * Like tbm_iterate, but pages are only guaranteed to be delivered in
+ * numerical order within each lossy chunk.
+ */
+TBMIterateResult *
+tbm_shared_iterate(TBMSharedIterator *iterator)
+{
+	TBMSharedIteratorState *state = iterator->state;
+	TBMIterateResult *output = &(iterator->output);
+
+	for (;;)
+	{
+		const PagetableEntry *page;
+		uint32		next;
+
+		/* Return the next page of the lossy chunk we claimed, if any */
+		if (iterator->chunk != NULL)
+		{
+			const PagetableEntry *chunk = iterator->chunk;
+			int			schunkbit = iterator->schunkbit;
+
+			while (schunkbit < PAGES_PER_CHUNK)
+			{
+				int			wordnum = WORDNUM(schunkbit);
+				int			bitnum = BITNUM(schunkbit);
+
+				if ((chunk->words[wordnum] & ((bitmapword) 1 << bitnum)) != 0)
+					break;
+				schunkbit++;
+			}
+			if (schunkbit < PAGES_PER_CHUNK)
+			{
+				output->blockno = chunk->blockno + schunkbit;
+				output->ntuples = -1;
+				output->recheck = true;
+				iterator->schunkbit = schunkbit + 1;
+				return output;
+			}
+			iterator->chunk = NULL;
+		}
+
+		/* Claim the next entry */
+		if (iterator->prefetch)
+		{
+			next = pg_atomic_fetch_add_u32(&state->prefetch_next, 1);
+			if (next < (uint32) state->nentries &&
+				next < pg_atomic_read_u32(&state->next))
+				continue;		/* it's being scanned already */
+		}
+		else
+			next = pg_atomic_fetch_add_u32(&state->next, 1);
+
+		if (next >= (uint32) state->nentries)
+			return NULL;		/* nothing more in the bitmap */
+
+		page = &state->entries[next];
+		if (page->ischunk)
+		{
+			iterator->chunk = page;
+			iterator->schunkbit = 0;
+			continue;
+		}
+
+		output->blockno = page->blockno;
+		output->ntuples = tbm_extract_page_tuples(page, output);
+		output->recheck = page->recheck;
+		return output;
+	}
+}
+
+/*
+ * tbm_end_shared_iterate - finish an iteration over a shared bitmap
+ */
+void
+tbm_end_shared_iterate(TBMSharedIterator *iterator)
+{
+	pfree(iterator);
+}
+
 /*
  * tbm_find_pageentry - find a PagetableEntry for the pageno
  *
@@ -791,9 +1063,7 @@ tbm_find_pageentry(const TIDBitmap *tbm, BlockNumber pageno)
 		return page;
 	}
 
-	page = (PagetableEntry *) hash_search(tbm->pagetable,
-										  (void *) &pageno,
-										  HASH_FIND, NULL);
+	page = pagetable_lookup(tbm->pagetable, pageno);
 	if (page == NULL)
 		return NULL;
 	if (page->ischunk)
@@ -834,15 +1104,16 @@ tbm_get_pageentry(TIDBitmap *tbm, BlockNumber pageno)
 		}
 
 		/* Look up or create an entry */
-		page = (PagetableEntry *) hash_search(tbm->pagetable,
-											  (void *) &pageno,
-											  HASH_ENTER, &found);
+		page = pagetable_insert(tbm->pagetable, pageno, &found);
 	}
 
 	/* Initialize it if not present before */
 	if (!found)
 	{
+		char		oldstatus = page->status;
+
 		MemSet(page, 0, sizeof(PagetableEntry));
+		page->status = oldstatus;
 		page->blockno = pageno;
 		/* must count it too */
 		tbm->nentries++;
@@ -869,9 +1140,7 @@ tbm_page_is_lossy(const TIDBitmap *tbm, BlockNumber pageno)
 
 	bitno = pageno % PAGES_PER_CHUNK;
 	chunk_pageno = pageno - bitno;
-	page = (PagetableEntry *) hash_search(tbm->pagetable,
-										  (void *) &chunk_pageno,
-										  HASH_FIND, NULL);
+	page = pagetable_lookup(tbm->pagetable, chunk_pageno);
 	if (page != NULL && page->ischunk)
 	{
 		int			wordnum = WORDNUM(bitno);
@@ -912,9 +1181,7 @@ tbm_mark_page_lossy(TIDBitmap *tbm, BlockNumber pageno)
 	 */
 	if (bitno != 0)
 	{
-		if (hash_search(tbm->pagetable,
-						(void *) &pageno,
-						HASH_REMOVE, NULL) != NULL)
+		if (pagetable_delete(tbm->pagetable, pageno))
 		{
 			/* It was present, so adjust counts */
 			tbm->nentries--;
@@ -923,14 +1190,15 @@ tbm_mark_page_lossy(TIDBitmap *tbm, BlockNumber pageno)
 	}
 
 	/* Look up or create entry for chunk-header page */
-	page = (PagetableEntry *) hash_search(tbm->pagetable,
-										  (void *) &chunk_pageno,
-										  HASH_ENTER, &found);
+	page = pagetable_insert(tbm->pagetable, chunk_pageno, &found);
 
 	/* Initialize it if not present before */
 	if (!found)
 	{
+		char		oldstatus = page->status;
+
 		MemSet(page, 0, sizeof(PagetableEntry));
+		page->status = oldstatus;
 		page->blockno = chunk_pageno;
 		page->ischunk = true;
 		/* must count it too */
@@ -940,7 +1208,10 @@ tbm_mark_page_lossy(TIDBitmap *tbm, BlockNumber pageno)
 	else if (!page->ischunk)
 	{
 		/* chunk header page was formerly non-lossy, make it lossy */
+		char		oldstatus = page->status;
+
 		MemSet(page, 0, sizeof(PagetableEntry));
+		page->status = oldstatus;
 		page->blockno = chunk_pageno;
 		page->ischunk = true;
 		/* we assume it had some tuple bit(s) set, so mark it lossy */
@@ -962,7 +1233,7 @@ tbm_mark_page_lossy(TIDBitmap *tbm, BlockNumber pageno)
 static void
 tbm_lossify(TIDBitmap *tbm)
 {
-	HASH_SEQ_STATUS status;
+	pagetable_iterator i;
 	PagetableEntry *page;
 
 	/*
@@ -977,8 +1248,8 @@ tbm_lossify(TIDBitmap *tbm)
 	Assert(!tbm->iterating);
 	Assert(tbm->status == TBM_HASH);
 
-	hash_seq_init(&status, tbm->pagetable);
-	while ((page = (PagetableEntry *) hash_seq_search(&status)) != NULL)
+	pagetable_start_iterate(tbm->pagetable, &i);
+	while ((page = pagetable_iterate(tbm->pagetable, &i)) != NULL)
 	{
 		if (page->ischunk)
 			continue;			/* already a chunk header */
@@ -996,14 +1267,16 @@ tbm_lossify(TIDBitmap *tbm)
 		if (tbm->nentries <= tbm->maxentries / 2)
 		{
 			/* we have done enough */
-			hash_seq_term(&status);
 			break;
 		}
 
 		/*
 		 * Note: tbm_mark_page_lossy may have inserted a lossy chunk into the
-		 * hashtable.  We can continue the same seq_search scan since we do
-		 * not care whether we visit lossy chunks or not.
+		 * hashtable and may have deleted the non-lossy page.  We can continue
+		 * the same scan, since failing to visit one element or visiting the
+		 * newly inserted element isn't fatal.  The table can't grow here, as
+		 * any insertion was preceded by a deletion or found an existing
+		 * chunk.
 		 */
 	}
 
@@ -679,6 +679,53 @@ create_plain_partial_paths(PlannerInfo *root, RelOptInfo *rel)
 {
 	int			parallel_workers;
 
+	parallel_workers = compute_parallel_worker(rel, rel->pages);
+
+	/* If any limit was set to zero, the user doesn't want a parallel scan. */
+	if (parallel_workers <= 0)
+		return;
+
+	/* Add an unordered partial path based on a parallel sequential scan. */
+	add_partial_path(rel, create_seqscan_path(root, rel, NULL, parallel_workers));
+}
+
+/*
+ * create_partial_bitmap_paths
+ *	  Build a partial access path for a parallel bitmap heap scan of a plain
+ *	  relation, given the bitmap the participants are to share
+ */
+void
+create_partial_bitmap_paths(PlannerInfo *root, RelOptInfo *rel,
+							Path *bitmapqual)
+{
+	int			parallel_workers;
+	double		pages_fetched;
+	double		tuples_fetched;
+	Cost		bitmap_cost;
+
+	/* Size the scan by the heap pages it is going to fetch */
+	pages_fetched = compute_bitmap_pages(root, rel, bitmapqual, 1.0,
+										 &bitmap_cost, &tuples_fetched);
+
+	parallel_workers = compute_parallel_worker(rel, (BlockNumber) pages_fetched);
+
+	if (parallel_workers <= 0)
+		return;
+
+	add_partial_path(rel, (Path *) create_bitmap_heap_path(root, rel,
+									bitmapqual, NULL, 1.0, parallel_workers));
+}
+
+/*
+ * compute_parallel_worker
+ *	  Choose the number of workers for a parallel scan of a relation that
+ *	  reads the given number of its pages, or 0 for no parallel scan
+ */
+int
+compute_parallel_worker(RelOptInfo *rel, BlockNumber pages)
+{
+	int			parallel_workers;
+
 	/*
 	 * If the user has set the parallel_workers reloption, use that; otherwise
 	 * select a default number of workers.
@@ -696,9 +743,9 @@ create_plain_partial_paths(PlannerInfo *root, RelOptInfo *rel)
 		 * might not be worthwhile just for this relation, but when combined
 		 * with all of its inheritance siblings it may well pay off.
 		 */
-		if (rel->pages < (BlockNumber) min_parallel_relation_size &&
+		if (pages < (BlockNumber) min_parallel_relation_size &&
 			rel->reloptkind == RELOPT_BASEREL)
-			return;
+			return 0;
 
 		/*
 		 * Select the number of workers based on the log of the size of the
@@ -709,7 +756,7 @@ create_plain_partial_paths(PlannerInfo *root, RelOptInfo *rel)
 		 */
 		parallel_workers = 1;
 		parallel_threshold = Max(min_parallel_relation_size, 1);
-		while (rel->pages >= (BlockNumber) (parallel_threshold * 3))
+		while (pages >= (BlockNumber) (parallel_threshold * 3))
 		{
 			parallel_workers++;
 			parallel_threshold *= 3;
@@ -723,12 +770,7 @@ create_plain_partial_paths(PlannerInfo *root, RelOptInfo *rel)
 	 */
 	parallel_workers = Min(parallel_workers, max_parallel_workers_per_gather);
 
-	/* If any limit was set to zero, the user doesn't want a parallel scan. */
-	if (parallel_workers <= 0)
-		return;
-
-	/* Add an unordered partial path based on a parallel sequential scan. */
-	add_partial_path(rel, create_seqscan_path(root, rel, NULL, parallel_workers));
+	return parallel_workers;
 }
 
 /*
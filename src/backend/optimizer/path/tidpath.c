@@ -12,6 +12,13 @@
  * this allows
  *		WHERE ctid IN (tid1, tid2, ...)
  *
+ * Failing those, we look for range conditions "CTID < pseudoconstant" (or
+ * >, <=, >=) ANDed at the top level of the restriction clauses.  They are
+ * put together into one AND clause, which nodeTidscan.c implements as a
+ * heap scan of just the range of blocks they allow.  This is what makes
+ *		WHERE ctid >= '(1000,0)' AND ctid < '(2000,0)'
+ * cheap, which is how pg_dump reads a large table in several chunks.
+ *
  * We also support "WHERE CURRENT OF cursor" conditions (CurrentOfExpr),
  * which amount to "CTID = run-time-determined-TID".  These could in
  * theory be translated to a simple comparison of CTID to the result of
@@ -47,6 +54,7 @@
 
 static bool IsTidEqualClause(OpExpr *node, int varno);
 static bool IsTidEqualAnyClause(ScalarArrayOpExpr *node, int varno);
+static bool IsTidRangeClause(OpExpr *node, int varno);
 static List *TidQualFromExpr(Node *expr, int varno);
 static List *TidQualFromRestrictinfo(List *restrictinfo, int varno);
 
@@ -109,6 +117,48 @@ IsTidEqualClause(OpExpr *node, int varno)
 	return true;				/* success */
 }
 
+/*
+ * Check to see if an opclause is of the form
+ *		CTID op pseudoconstant
+ * or
+ *		pseudoconstant op CTID
+ * where op is one of the TID inequality operators.
+ */
+static bool
+IsTidRangeClause(OpExpr *node, int varno)
+{
+	Node	   *arg1,
+			   *arg2,
+			   *other;
+
+	if (node->opno != TIDLessOperator &&
+		node->opno != TIDLessEqOperator &&
+		node->opno != TIDGreaterOperator &&
+		node->opno != TIDGreaterEqOperator)
+		return false;
+	if (list_length(node->args) != 2)
+		return false;
+	arg1 = linitial(node->args);
+	arg2 = lsecond(node->args);
+
+	/* Look for CTID as either argument */
+	if (IsA(arg1, Var) &&
+		((Var *) arg1)->varattno == SelfItemPointerAttributeNumber &&
+		((Var *) arg1)->varno == varno &&
+		((Var *) arg1)->varlevelsup == 0)
+		other = arg2;
+	else if (IsA(arg2, Var) &&
+			 ((Var *) arg2)->varattno == SelfItemPointerAttributeNumber &&
+			 ((Var *) arg2)->varno == varno &&
+			 ((Var *) arg2)->varlevelsup == 0)
+		other = arg1;
+	else
+		return false;
+
+	/* The other argument must be a pseudoconstant */
+	return is_pseudo_constant_clause(other);
+}
+
 /*
  * Check to see if a clause is of the form
  *		CTID = ANY (pseudoconstant_array)
@@ -219,12 +269,15 @@ TidQualFromExpr(Node *expr, int varno)
  *	Extract a set of CTID conditions from the given restrictinfo list
  *
  *	This is essentially identical to the AND case of TidQualFromExpr,
- *	except for the format of the input.
+ *	except for the format of the input.  If there are no such conditions,
+ *	all range conditions on CTID are returned, as a one-element list of
+ *	their AND clause.
  */
 static List *
 TidQualFromRestrictinfo(List *restrictinfo, int varno)
 {
 	List	   *rlst = NIL;
+	List	   *rangequals = NIL;
 	ListCell   *l;
 
 	foreach(l, restrictinfo)
@@ -236,7 +289,16 @@ TidQualFromRestrictinfo(List *restrictinfo, int varno)
 		rlst = TidQualFromExpr((Node *) rinfo->clause, varno);
 		if (rlst)
 			break;
+		if (is_opclause(rinfo->clause) &&
+			IsTidRangeClause((OpExpr *) rinfo->clause, varno))
+			rangequals = lappend(rangequals, rinfo->clause);
 	}
+
+	if (rlst == NIL && rangequals != NIL)
+		rlst = list_make1(make_andclause(rangequals));
+	else
+		list_free(rangequals);
+
 	return rlst;
 }
 
@@ -1663,10 +1663,11 @@ remap_groupColIdx(PlannerInfo *root, List *groupClause)
  *	  for its subpaths.
  *
  *	  What we emit is an Agg plan with some vestigial Agg and Sort nodes
- *	  hanging off the side.  The top Agg implements the last grouping set
- *	  specified in the GroupingSetsPath, and any additional grouping sets
- *	  each give rise to a subsidiary Agg and Sort node in the top Agg's
- *	  "chain" list.  These nodes don't participate in the plan directly,
+ *	  hanging off the side.  The top Agg implements the first rollup
+ *	  specified in the GroupingSetsPath, and any additional rollups each
+ *	  give rise to a subsidiary Agg node in the top Agg's "chain" list,
+ *	  with a Sort node below it if it is a sorted rollup that needs its own
+ *	  input ordering.  These nodes don't participate in the plan directly,
  *	  but they are a convenient way to represent the required data for
  *	  the extra steps.
  *
@@ -1677,18 +1678,15 @@ create_groupingsets_plan(PlannerInfo *root, GroupingSetsPath *best_path)
 {
 	Agg		   *plan;
 	Plan	   *subplan;
-	List	   *rollup_groupclauses = best_path->rollup_groupclauses;
-	List	   *rollup_lists = best_path->rollup_lists;
+	List	   *rollups = best_path->rollups;
 	AttrNumber *grouping_map;
 	int			maxref;
 	List	   *chain;
-	ListCell   *lc,
-			   *lc2;
+	ListCell   *lc;
 
 	/* Shouldn't get here without grouping sets */
 	Assert(root->parse->groupingSets);
-	Assert(rollup_lists != NIL);
-	Assert(list_length(rollup_lists) == list_length(rollup_groupclauses));
+	Assert(rollups != NIL);
 
 	/*
 	 * Agg can project, so no need to be terribly picky about child tlist, but
@@ -1740,44 +1738,65 @@ create_groupingsets_plan(PlannerInfo *root, GroupingSetsPath *best_path)
 	 * costs will be shown by EXPLAIN.
 	 */
 	chain = NIL;
-	if (list_length(rollup_groupclauses) > 1)
+	if (list_length(rollups) > 1)
 	{
-		forboth(lc, rollup_groupclauses, lc2, rollup_lists)
+		bool		is_first_sort = ((RollupData *) linitial(rollups))->is_hashed;
+
+		for_each_cell(lc, lnext(list_head(rollups)))
 		{
-			List	   *groupClause = (List *) lfirst(lc);
-			List	   *gsets = (List *) lfirst(lc2);
+			RollupData *rollup = lfirst(lc);
 			AttrNumber *new_grpColIdx;
-			Plan	   *sort_plan;
+			Plan	   *sort_plan = NULL;
 			Plan	   *agg_plan;
+			AggStrategy strat;
+			int			numGroupCols;
 
-			/* We want to iterate over all but the last rollup list elements */
-			if (lnext(lc) == NULL)
-				break;
+			new_grpColIdx = remap_groupColIdx(root, rollup->groupClause);
 
-			new_grpColIdx = remap_groupColIdx(root, groupClause);
+			/*
+			 * The first sorted rollup after hashed ones reads the sorted
+			 * input directly; others need a sort of their own.
+			 */
+			if (!rollup->is_hashed && !is_first_sort)
+			{
+				sort_plan = (Plan *)
+					make_sort_from_groupcols(rollup->groupClause,
+											 new_grpColIdx,
+											 subplan);
+			}
 
-			sort_plan = (Plan *)
-				make_sort_from_groupcols(groupClause,
-										 new_grpColIdx,
-										 subplan);
+			if (!rollup->is_hashed)
+				is_first_sort = false;
+
+			numGroupCols = list_length((List *) linitial(rollup->gsets));
+
+			if (rollup->is_hashed)
+				strat = AGG_HASHED;
+			else if (numGroupCols == 0)
+				strat = AGG_PLAIN;
+			else
+				strat = AGG_SORTED;
 
 			agg_plan = (Plan *) make_agg(NIL,
 										 NIL,
-										 AGG_SORTED,
+										 strat,
 										 AGGSPLIT_SIMPLE,
-									   list_length((List *) linitial(gsets)),
+										 numGroupCols,
 										 new_grpColIdx,
-										 extract_grouping_ops(groupClause),
-										 gsets,
+									extract_grouping_ops(rollup->groupClause),
+										 rollup->gsets,
 										 NIL,
-										 0,		/* numGroups not needed */
+										 rollup->numGroups,
 										 sort_plan);
 
 			/*
 			 * Nuke stuff we don't need to avoid bloating debug output.
 			 */
-			sort_plan->targetlist = NIL;
-			sort_plan->lefttree = NULL;
+			if (sort_plan)
+			{
+				sort_plan->targetlist = NIL;
+				sort_plan->lefttree = NULL;
+			}
 
 			chain = lappend(chain, agg_plan);
 		}
@@ -1787,25 +1806,28 @@ create_groupingsets_plan(PlannerInfo *root, GroupingSetsPath *best_path)
 	 * Now make the final Agg node
 	 */
 	{
-		List	   *groupClause = (List *) llast(rollup_groupclauses);
-		List	   *gsets = (List *) llast(rollup_lists);
+		RollupData *rollup = linitial(rollups);
 		AttrNumber *top_grpColIdx;
+		AggStrategy strat = best_path->aggstrategy;
 		int			numGroupCols;
 
-		top_grpColIdx = remap_groupColIdx(root, groupClause);
+		top_grpColIdx = remap_groupColIdx(root, rollup->groupClause);
 
-		numGroupCols = list_length((List *) linitial(gsets));
+		numGroupCols = list_length((List *) linitial(rollup->gsets));
+
+		if (strat == AGG_SORTED && numGroupCols == 0)
+			strat = AGG_PLAIN;
 
 		plan = make_agg(build_path_tlist(root, &best_path->path),
 						best_path->qual,
-						(numGroupCols > 0) ? AGG_SORTED : AGG_PLAIN,
+						strat,
 						AGGSPLIT_SIMPLE,
 						numGroupCols,
 						top_grpColIdx,
-						extract_grouping_ops(groupClause),
-						gsets,
+						extract_grouping_ops(rollup->groupClause),
+						rollup->gsets,
 						chain,
-						0,		/* numGroups not needed */
+						rollup->numGroups,
 						subplan);
 
 		/* Copy cost data from Path to Plan */
@@ -3931,6 +3953,16 @@ create_hashjoin_plan(PlannerInfo *root,
 	copy_plan_costsize(&hash_plan->plan, inner_plan);
 	hash_plan->plan.startup_cost = hash_plan->plan.total_cost;
 
+	/*
+	 * Below a Gather, every participant of a partial hash join would build
+	 * its own copy of the same hash table.  If it's expected to fit in a
+	 * single batch, have them share one instead.
+	 */
+	if (enable_parallel_hash &&
+		best_path->jpath.path.parallel_workers > 0 &&
+		best_path->num_batches == 1)
+		hash_plan->plan.parallel_aware = true;
+
 	join_plan = make_hashjoin(tlist,
 							  joinclauses,
 							  otherclauses,
@@ -88,6 +88,16 @@ typedef struct
 	List	   *groupClause;	/* overrides parse->groupClause */
 } standard_qp_extra;
 
+/*
+ * Data specific to grouping sets
+ */
+typedef struct
+{
+	List	   *rollups;		/* list of RollupData, first sorted by input */
+	int		   *tleref_to_colnum_map;	/* workspace for remapping sets */
+	bool		any_hashable;	/* is any rollup hashable? */
+} grouping_sets_data;
+
 /* Local functions */
 static Node *preprocess_expression(PlannerInfo *root, Node *expr, int kind);
 static void preprocess_qual_conditions(PlannerInfo *root, Node *jtnode);
@@ -100,14 +110,16 @@ static double preprocess_limit(PlannerInfo *root,
 				 int64 *offset_est, int64 *count_est);
 static bool limit_needed(Query *parse);
 static void remove_useless_groupby_columns(PlannerInfo *root);
+static grouping_sets_data *preprocess_grouping_sets(PlannerInfo *root);
+static List *remap_to_groupclause_idx(List *groupClause, List *gsets,
+						 int *tleref_to_colnum_map);
 static List *preprocess_groupclause(PlannerInfo *root, List *force);
 static List *extract_rollup_sets(List *groupingSets);
 static List *reorder_grouping_sets(List *groupingSets, List *sortclause);
 static void standard_qp_callback(PlannerInfo *root, void *extra);
 static double get_number_of_groups(PlannerInfo *root,
 					 double path_rows,
-					 List *rollup_lists,
-					 List *rollup_groupclauses);
+					 grouping_sets_data *gd);
 static Size estimate_hashagg_tablesize(Path *path,
 						   const AggClauseCosts *agg_costs,
 						   double dNumGroups);
@@ -115,8 +127,16 @@ static RelOptInfo *create_grouping_paths(PlannerInfo *root,
 					  RelOptInfo *input_rel,
 					  PathTarget *target,
 					  const AggClauseCosts *agg_costs,
-					  List *rollup_lists,
-					  List *rollup_groupclauses);
+					  grouping_sets_data *gd);
+static void consider_groupingsets_paths(PlannerInfo *root,
+							RelOptInfo *grouped_rel,
+							Path *path,
+							bool is_sorted,
+							bool can_hash,
+							PathTarget *target,
+							grouping_sets_data *gd,
+							const AggClauseCosts *agg_costs,
+							double dNumGroups);
 static RelOptInfo *create_window_paths(PlannerInfo *root,
 					RelOptInfo *input_rel,
 					PathTarget *input_target,
@@ -1499,8 +1519,7 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 		AggClauseCosts agg_costs;
 		WindowFuncLists *wflists = NULL;
 		List	   *activeWindows = NIL;
-		List	   *rollup_lists = NIL;
-		List	   *rollup_groupclauses = NIL;
+		grouping_sets_data *gset_data = NULL;
 		standard_qp_extra qp_extra;
 
 		/* A recursive query should always have setOperations */
@@ -1509,84 +1528,7 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 		/* Preprocess grouping sets and GROUP BY clause, if any */
 		if (parse->groupingSets)
 		{
-			int		   *tleref_to_colnum_map;
-			List	   *sets;
-			int			maxref;
-			ListCell   *lc;
-			ListCell   *lc2;
-			ListCell   *lc_set;
-
-			parse->groupingSets = expand_grouping_sets(parse->groupingSets, -1);
-
-			/* Identify max SortGroupRef in groupClause, for array sizing */
-			maxref = 0;
-			foreach(lc, parse->groupClause)
-			{
-				SortGroupClause *gc = lfirst(lc);
-
-				if (gc->tleSortGroupRef > maxref)
-					maxref = gc->tleSortGroupRef;
-			}
-
-			/* Allocate workspace array for remapping */
-			tleref_to_colnum_map = (int *) palloc((maxref + 1) * sizeof(int));
-
-			/* Examine the rollup sets */
-			sets = extract_rollup_sets(parse->groupingSets);
-
-			foreach(lc_set, sets)
-			{
-				List	   *current_sets = (List *) lfirst(lc_set);
-				List	   *groupclause;
-				int			ref;
-
-				/*
-				 * Reorder the current list of grouping sets into correct
-				 * prefix order.  If only one aggregation pass is needed, try
-				 * to make the list match the ORDER BY clause; if more than
-				 * one pass is needed, we don't bother with that.
-				 */
-				current_sets = reorder_grouping_sets(current_sets,
-													 (list_length(sets) == 1
-													  ? parse->sortClause
-													  : NIL));
-
-				/*
-				 * Order the groupClause appropriately.  If the first grouping
-				 * set is empty, this can match regular GROUP BY
-				 * preprocessing, otherwise we have to force the groupClause
-				 * to match that grouping set's order.
-				 */
-				groupclause = preprocess_groupclause(root,
-													 linitial(current_sets));
-
-				/*
-				 * Now that we've pinned down an order for the groupClause for
-				 * this list of grouping sets, we need to remap the entries in
-				 * the grouping sets from sortgrouprefs to plain indices
-				 * (0-based) into the groupClause for this collection of
-				 * grouping sets.
-				 */
-				ref = 0;
-				foreach(lc, groupclause)
-				{
-					SortGroupClause *gc = lfirst(lc);
-
-					tleref_to_colnum_map[gc->tleSortGroupRef] = ref++;
-				}
-
-				foreach(lc, current_sets)
-				{
-					foreach(lc2, (List *) lfirst(lc))
-					{
-						lfirst_int(lc2) = tleref_to_colnum_map[lfirst_int(lc2)];
-					}
-				}
-
-				/* Save the reordered sets and corresponding groupclauses */
-				rollup_lists = lcons(current_sets, rollup_lists);
-				rollup_groupclauses = lcons(groupclause, rollup_groupclauses);
-			}
+			gset_data = preprocess_grouping_sets(root);
 		}
 		else
 		{
@@ -1688,8 +1630,11 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 		/* Set up data needed by standard_qp_callback */
 		qp_extra.tlist = tlist;
 		qp_extra.activeWindows = activeWindows;
-		qp_extra.groupClause =
-			parse->groupingSets ? llast(rollup_groupclauses) : parse->groupClause;
+		if (gset_data)
+			qp_extra.groupClause =
+				((RollupData *) linitial(gset_data->rollups))->groupClause;
+		else
+			qp_extra.groupClause = parse->groupClause;
 
 		/*
 		 * Generate the best unsorted and presorted paths for the scan/join
@@ -1841,8 +1786,7 @@ grouping_planner(PlannerInfo *root, bool inheritance_update,
 												current_rel,
 												grouping_target,
 												&agg_costs,
-												rollup_lists,
-												rollup_groupclauses);
+												gset_data);
 		}
 
 		/*
@@ -2691,6 +2635,149 @@ remove_useless_groupby_columns(PlannerInfo *root)
 	}
 }
 
+/*
+ * preprocess_grouping_sets - expand the grouping sets and divide them into
+ * rollups
+ *
+ * Each rollup is a list of grouping sets that can be computed in a single
+ * sorted pass, with a groupClause ordered to match it.  The first rollup
+ * holds any empty grouping sets, and is the one the input will be sorted
+ * for.  The estimated group counts are filled in by get_number_of_groups.
+ */
+static grouping_sets_data *
+preprocess_grouping_sets(PlannerInfo *root)
+{
+	Query	   *parse = root->parse;
+	grouping_sets_data *gd = palloc0(sizeof(grouping_sets_data));
+	List	   *other_rollups = NIL;
+	List	   *sets;
+	int			maxref;
+	ListCell   *lc;
+	ListCell   *lc_set;
+
+	parse->groupingSets = expand_grouping_sets(parse->groupingSets, -1);
+
+	/* Identify max SortGroupRef in groupClause, for array sizing */
+	maxref = 0;
+	foreach(lc, parse->groupClause)
+	{
+		SortGroupClause *gc = lfirst(lc);
+
+		if (gc->tleSortGroupRef > maxref)
+			maxref = gc->tleSortGroupRef;
+	}
+
+	/* Allocate workspace array for remapping */
+	gd->tleref_to_colnum_map = (int *) palloc((maxref + 1) * sizeof(int));
+
+	/* Examine the rollup sets */
+	sets = extract_rollup_sets(parse->groupingSets);
+
+	foreach(lc_set, sets)
+	{
+		List	   *current_sets = (List *) lfirst(lc_set);
+		RollupData *rollup = makeNode(RollupData);
+
+		/*
+		 * Reorder the current list of grouping sets into correct prefix
+		 * order.  If only one aggregation pass is needed, try to make the
+		 * list match the ORDER BY clause; if more than one pass is needed, we
+		 * don't bother with that.
+		 */
+		current_sets = reorder_grouping_sets(current_sets,
+											 (list_length(sets) == 1
+											  ? parse->sortClause
+											  : NIL));
+
+		/*
+		 * Order the groupClause appropriately.  If the first grouping set is
+		 * empty, this can match regular GROUP BY preprocessing, otherwise we
+		 * have to force the groupClause to match that grouping set's order.
+		 */
+		rollup->groupClause = preprocess_groupclause(root,
+													 linitial(current_sets));
+
+		/*
+		 * Is it hashable?  Empty grouping sets are never hashed, but they
+		 * don't prevent hashing the rest of the rollup; don't bother if
+		 * there's nothing but empty sets, though.
+		 */
+		rollup->hashable = (linitial(current_sets) != NIL &&
+							grouping_is_hashable(rollup->groupClause));
+		gd->any_hashable |= rollup->hashable;
+
+		foreach(lc, current_sets)
+		{
+			GroupingSetData *gs = makeNode(GroupingSetData);
+
+			gs->set = (List *) lfirst(lc);
+			rollup->gsets_data = lappend(rollup->gsets_data, gs);
+		}
+
+		/*
+		 * Now that we've pinned down an order for the groupClause for this
+		 * list of grouping sets, we need to remap the entries in the grouping
+		 * sets from sortgrouprefs to plain indices (0-based) into the
+		 * groupClause for this collection of grouping sets.
+		 */
+		rollup->gsets = remap_to_groupclause_idx(rollup->groupClause,
+												 rollup->gsets_data,
+												 gd->tleref_to_colnum_map);
+		rollup->numGroups = 0.0;
+		rollup->is_hashed = false;
+
+		/*
+		 * The first rollup, which has the empty sets, reads the input; the
+		 * others are sorted separately, in reverse order of extraction.
+		 */
+		if (lc_set == list_head(sets))
+			gd->rollups = list_make1(rollup);
+		else
+			other_rollups = lcons(rollup, other_rollups);
+	}
+
+	gd->rollups = list_concat(gd->rollups, other_rollups);
+
+	return gd;
+}
+
+/*
+ * Given a groupclause and a list of GroupingSetData, return equivalent sets
+ * (without annotation) mapped to indexes into the given groupclause.
+ */
+static List *
+remap_to_groupclause_idx(List *groupClause,
+						 List *gsets,
+						 int *tleref_to_colnum_map)
+{
+	int			ref = 0;
+	List	   *result = NIL;
+	ListCell   *lc;
+
+	foreach(lc, groupClause)
+	{
+		SortGroupClause *gc = lfirst(lc);
+
+		tleref_to_colnum_map[gc->tleSortGroupRef] = ref++;
+	}
+
+	foreach(lc, gsets)
+	{
+		List	   *set = NIL;
+		ListCell   *lc2;
+		GroupingSetData *gs = lfirst(lc);
+
+		foreach(lc2, gs->set)
+		{
+			set = lappend_int(set, tleref_to_colnum_map[lfirst_int(lc2)]);
+		}
+
+		result = lappend(result, set);
+	}
+
+	return result;
+}
+
 /*
  * preprocess_groupclause - do preparatory work on GROUP BY clause
  *
@@ -3161,15 +3248,14 @@ standard_qp_callback(PlannerInfo *root, void *extra)
  * Estimate number of groups produced by grouping clauses (1 if not grouping)
  *
  * path_rows: number of output rows from scan/join step
- * rollup_lists: list of grouping sets, or NIL if not doing grouping sets
- * rollup_groupclauses: list of grouping clauses for grouping sets,
- *		or NIL if not doing grouping sets
+ * gd: grouping sets data including list of rollups, or NULL if not doing
+ *		grouping sets; the estimates of each rollup and grouping set are
+ *		stored in it
  */
 static double
 get_number_of_groups(PlannerInfo *root,
 					 double path_rows,
-					 List *rollup_lists,
-					 List *rollup_groupclauses)
+					 grouping_sets_data *gd)
 {
 	Query	   *parse = root->parse;
 	double		dNumGroups;
@@ -3181,28 +3267,36 @@ get_number_of_groups(PlannerInfo *root,
 		if (parse->groupingSets)
 		{
 			/* Add up the estimates for each grouping set */
-			ListCell   *lc,
-					   *lc2;
+			ListCell   *lc;
+
+			Assert(gd);
 
 			dNumGroups = 0;
-			forboth(lc, rollup_groupclauses, lc2, rollup_lists)
+			foreach(lc, gd->rollups)
 			{
-				List	   *groupClause = (List *) lfirst(lc);
-				List	   *gsets = (List *) lfirst(lc2);
-				ListCell   *lc3;
+				RollupData *rollup = (RollupData *) lfirst(lc);
+				ListCell   *lc2,
+						   *lc3;
 
-				groupExprs = get_sortgrouplist_exprs(groupClause,
+				groupExprs = get_sortgrouplist_exprs(rollup->groupClause,
 													 parse->targetList);
 
-				foreach(lc3, gsets)
-				{
-					List	   *gset = (List *) lfirst(lc3);
+				rollup->numGroups = 0.0;
 
-					dNumGroups += estimate_num_groups(root,
-													  groupExprs,
-													  path_rows,
-													  &gset);
+				forboth(lc2, rollup->gsets, lc3, rollup->gsets_data)
+				{
+					List	   *gset = (List *) lfirst(lc2);
+					GroupingSetData *gs = (GroupingSetData *) lfirst(lc3);
+					double		numGroups = estimate_num_groups(root,
+																groupExprs,
+																path_rows,
+																&gset);
+
+					gs->numGroups = numGroups;
+					rollup->numGroups += numGroups;
 				}
+
+				dNumGroups += rollup->numGroups;
 			}
 		}
 		else
@@ -3217,8 +3311,21 @@ get_number_of_groups(PlannerInfo *root,
 	}
 	else if (parse->groupingSets)
 	{
+		ListCell   *lc;
+
 		/* Empty grouping sets ... one result row for each one */
 		dNumGroups = list_length(parse->groupingSets);
+
+		Assert(gd);
+		foreach(lc, gd->rollups)
+		{
+			RollupData *rollup = (RollupData *) lfirst(lc);
+			ListCell   *lc2;
+
+			foreach(lc2, rollup->gsets_data)
+				((GroupingSetData *) lfirst(lc2))->numGroups = 1;
+			rollup->numGroups = list_length(rollup->gsets_data);
+		}
 	}
 	else if (parse->hasAggs || root->hasHavingQual)
 	{
@@ -3265,9 +3372,8 @@ estimate_hashagg_tablesize(Path *path, const AggClauseCosts *agg_costs,
  * input_rel: contains the source-data Paths
  * target: the pathtarget for the result Paths to compute
  * agg_costs: cost info about all aggregates in query (in AGGSPLIT_SIMPLE mode)
- * rollup_lists: list of grouping sets, or NIL if not doing grouping sets
- * rollup_groupclauses: list of grouping clauses for grouping sets,
- *		or NIL if not doing grouping sets
+ * gd: grouping sets data including list of rollups, or NULL if not doing
+ *		grouping sets
  *
  * Note: all Paths in input_rel are expected to return the target computed
  * by make_group_input_target.
@@ -3282,8 +3388,7 @@ create_grouping_paths(PlannerInfo *root,
 					  RelOptInfo *input_rel,
 					  PathTarget *target,
 					  const AggClauseCosts *agg_costs,
-					  List *rollup_lists,
-					  List *rollup_groupclauses)
+					  grouping_sets_data *gd)
 {
 	Query	   *parse = root->parse;
 	Path	   *cheapest_path = input_rel->cheapest_total_path;
@@ -3391,8 +3496,7 @@ create_grouping_paths(PlannerInfo *root,
 	 */
 	dNumGroups = get_number_of_groups(root,
 									  cheapest_path->rows,
-									  rollup_lists,
-									  rollup_groupclauses);
+									  gd);
 
 	/*
 	 * Determine whether it's possible to perform sort-based implementations
@@ -3407,8 +3511,9 @@ create_grouping_paths(PlannerInfo *root,
 	 * Determine whether we should consider hash-based implementations of
 	 * grouping.
 	 *
-	 * Hashed aggregation only applies if we're grouping.  We currently can't
-	 * hash if there are grouping sets, though.
+	 * Hashed aggregation only applies if we're grouping.  With grouping
+	 * sets, it's enough that some of the rollups are hashable; see
+	 * consider_groupingsets_paths.
 	 *
 	 * Executor doesn't support hashed aggregation with DISTINCT or ORDER BY
 	 * aggregates.  (Doing so would imply storing *all* the input values in
@@ -3421,9 +3526,8 @@ create_grouping_paths(PlannerInfo *root,
 	 * other gating conditions, so we want to do it last.
 	 */
 	can_hash = (parse->groupClause != NIL &&
-				parse->groupingSets == NIL &&
 				agg_costs->numOrderedAggs == 0 &&
-				grouping_is_hashable(parse->groupClause));
+				(gd ? gd->any_hashable : grouping_is_hashable(parse->groupClause)));
 
 	/*
 	 * If grouped_rel->consider_parallel is true, then paths that we generate
@@ -3489,8 +3593,7 @@ create_grouping_paths(PlannerInfo *root,
 		/* Estimate number of partial groups. */
 		dNumPartialGroups = get_number_of_groups(root,
 												 cheapest_partial_path->rows,
-												 NIL,
-												 NIL);
+												 gd);
 
 		/*
 		 * Collect statistics about aggregates for estimating costs of
@@ -3577,9 +3680,9 @@ create_grouping_paths(PlannerInfo *root,
 
 			/*
 			 * Tentatively produce a partial HashAgg Path, depending on if it
-			 * looks as if the hash table will fit in work_mem.
+			 * looks as if the hash table will fit in work_mem or may spill.
 			 */
-			if (hashaggtablesize < work_mem * 1024L)
+			if (hashaggtablesize < work_mem * 1024L || enable_hashagg_disk)
 			{
 				add_partial_path(grouped_rel, (Path *)
 								 create_agg_path(root,
@@ -3625,18 +3728,11 @@ create_grouping_paths(PlannerInfo *root,
 				{
 					/*
 					 * We have grouping sets, possibly with aggregation.  Make
-					 * a GroupingSetsPath.
+					 * GroupingSetsPaths, possibly hashing some of the sets.
 					 */
-					add_path(grouped_rel, (Path *)
-							 create_groupingsets_path(root,
-													  grouped_rel,
-													  path,
-													  target,
-												  (List *) parse->havingQual,
-													  rollup_lists,
-													  rollup_groupclauses,
-													  agg_costs,
-													  dNumGroups));
+					consider_groupingsets_paths(root, grouped_rel,
+												path, true, can_hash, target,
+												gd, agg_costs, dNumGroups);
 				}
 				else if (parse->hasAggs)
 				{
@@ -3732,7 +3828,16 @@ create_grouping_paths(PlannerInfo *root,
 		}
 	}
 
-	if (can_hash)
+	if (can_hash && parse->groupingSets)
+	{
+		/*
+		 * Try for a hash-only groupingsets path over unsorted input.
+		 */
+		consider_groupingsets_paths(root, grouped_rel,
+									cheapest_path, false, true, target,
+									gd, agg_costs, dNumGroups);
+	}
+	else if (can_hash)
 	{
 		hashaggtablesize = estimate_hashagg_tablesize(cheapest_path,
 													  agg_costs,
@@ -3740,11 +3845,12 @@ create_grouping_paths(PlannerInfo *root,
 
 		/*
 		 * Provided that the estimated size of the hashtable does not exceed
-		 * work_mem, we'll generate a HashAgg Path, although if we were unable
-		 * to sort above, then we'd better generate a Path, so that we at
-		 * least have one.
+		 * work_mem, or the hash table is allowed to spill to disk, we'll
+		 * generate a HashAgg Path, although if we were unable to sort above,
+		 * then we'd better generate a Path, so that we at least have one.
 		 */
 		if (hashaggtablesize < work_mem * 1024L ||
+			enable_hashagg_disk ||
 			grouped_rel->pathlist == NIL)
 		{
 			/*
@@ -3766,7 +3872,7 @@ create_grouping_paths(PlannerInfo *root,
 		/*
 		 * Generate a HashAgg Path atop of the cheapest partial path. Once
 		 * again, we'll only do this if it looks as though the hash table
-		 * won't exceed work_mem.
+		 * won't exceed work_mem, unless it may spill.
 		 */
 		if (grouped_rel->partial_pathlist)
 		{
@@ -3776,7 +3882,7 @@ create_grouping_paths(PlannerInfo *root,
 														  &agg_final_costs,
 														  dNumGroups);
 
-			if (hashaggtablesize < work_mem * 1024L)
+			if (hashaggtablesize < work_mem * 1024L || enable_hashagg_disk)
 			{
 				double		total_groups = path->rows * path->parallel_workers;
 
@@ -3829,6 +3935,250 @@ create_grouping_paths(PlannerInfo *root,
 	return grouped_rel;
 }
 
+/*
+ * For a given input path, consider the possible ways of doing grouping sets on
+ * it, by combinations of hashing and sorting.  This can be called multiple
+ * times, so it's important that it not scribble on input.  No result is
+ * returned, but any generated paths are added to grouped_rel.
+ */
+static void
+consider_groupingsets_paths(PlannerInfo *root,
+							RelOptInfo *grouped_rel,
+							Path *path,
+							bool is_sorted,
+							bool can_hash,
+							PathTarget *target,
+							grouping_sets_data *gd,
+							const AggClauseCosts *agg_costs,
+							double dNumGroups)
+{
+	Query	   *parse = root->parse;
+	bool		can_sort = grouping_is_sortable(parse->groupClause);
+
+	/*
+	 * If we're not being offered sorted input, then only consider plans that
+	 * can be done entirely by hashing.
+	 *
+	 * We can hash everything if it looks like it'll fit in work_mem, or the
+	 * hash tables may spill.  But if the input is actually sorted despite not
+	 * being advertised as such, we prefer to make use of that in order to use
+	 * less memory.
+	 *
+	 * If the grouping sets can't be sorted, then ignore the work_mem limit
+	 * and generate a path anyway, since otherwise we'll just fail.
+	 */
+	if (!is_sorted)
+	{
+		List	   *new_rollups = NIL;
+		RollupData *unhashed_rollup = NULL;
+		List	   *sets_data = NIL;
+		List	   *empty_sets_data = NIL;
+		List	   *empty_sets = NIL;
+		ListCell   *lc;
+		ListCell   *l_start = list_head(gd->rollups);
+		AggStrategy strat = AGG_HASHED;
+		Size		hashsize;
+		double		exclude_groups = 0.0;
+
+		Assert(can_hash);
+
+		if (can_sort && pathkeys_contained_in(root->group_pathkeys,
+											  path->pathkeys))
+		{
+			unhashed_rollup = lfirst(l_start);
+			exclude_groups = unhashed_rollup->numGroups;
+			l_start = lnext(l_start);
+		}
+
+		hashsize = estimate_hashagg_tablesize(path,
+											  agg_costs,
+											  dNumGroups - exclude_groups);
+
+		if (hashsize > work_mem * 1024L && !enable_hashagg_disk && can_sort)
+			return;				/* nope, won't fit */
+
+		/*
+		 * We need to burst the existing rollups list into individual grouping
+		 * sets and recompute a groupClause for each set.
+		 */
+		for_each_cell(lc, l_start)
+		{
+			RollupData *rollup = lfirst(lc);
+
+			/*
+			 * If we find an unhashable rollup that's not been skipped by the
+			 * "actually sorted" check above, we can't cope; we'd need sorted
+			 * input (with a different sort order) but we can't get that here.
+			 * So bail out; we'll get a valid path from the is_sorted case
+			 * instead.
+			 *
+			 * The mere presence of empty grouping sets doesn't make a rollup
+			 * unhashable (see preprocess_grouping_sets), we handle those
+			 * specially below.
+			 */
+			if (!rollup->hashable)
+				return;
+
+			sets_data = list_concat(sets_data, list_copy(rollup->gsets_data));
+		}
+		foreach(lc, sets_data)
+		{
+			GroupingSetData *gs = lfirst(lc);
+			List	   *gset = gs->set;
+			RollupData *rollup;
+
+			if (gset == NIL)
+			{
+				/* Empty grouping sets can't be hashed. */
+				empty_sets_data = lappend(empty_sets_data, gs);
+				empty_sets = lappend(empty_sets, NIL);
+			}
+			else
+			{
+				rollup = makeNode(RollupData);
+
+				rollup->groupClause = preprocess_groupclause(root, gset);
+				rollup->gsets_data = list_make1(gs);
+				rollup->gsets = remap_to_groupclause_idx(rollup->groupClause,
+														 rollup->gsets_data,
+												   gd->tleref_to_colnum_map);
+				rollup->numGroups = gs->numGroups;
+				rollup->hashable = true;
+				rollup->is_hashed = true;
+				new_rollups = lappend(new_rollups, rollup);
+			}
+		}
+
+		/*
+		 * If we didn't find anything nonempty to hash, then bail.  We'll
+		 * generate a path from the is_sorted case.
+		 */
+		if (new_rollups == NIL)
+			return;
+
+		/*
+		 * If there were empty grouping sets they should have been in the
+		 * first rollup.
+		 */
+		Assert(!unhashed_rollup || !empty_sets);
+
+		if (unhashed_rollup)
+		{
+			new_rollups = lappend(new_rollups, unhashed_rollup);
+			strat = AGG_MIXED;
+		}
+		else if (empty_sets)
+		{
+			RollupData *rollup = makeNode(RollupData);
+
+			rollup->groupClause = NIL;
+			rollup->gsets_data = empty_sets_data;
+			rollup->gsets = empty_sets;
+			rollup->numGroups = list_length(empty_sets);
+			rollup->hashable = false;
+			rollup->is_hashed = false;
+			new_rollups = lappend(new_rollups, rollup);
+			strat = AGG_MIXED;
+		}
+
+		add_path(grouped_rel, (Path *)
+				 create_groupingsets_path(root,
+										  grouped_rel,
+										  path,
+										  target,
+										  (List *) parse->havingQual,
+										  strat,
+										  new_rollups,
+										  agg_costs));
+		return;
+	}
+
+	/*
+	 * If we have sorted input, consider hashing some of the rollups other
+	 * than the first, which reads the input as it is, to save their sorts.
+	 * We take them in order as long as their hash tables fit in the
+	 * work_mem that is left; the sets of a hashed rollup are each hashed
+	 * separately.
+	 */
+	if (can_hash && gd->any_hashable && list_length(gd->rollups) > 1)
+	{
+		List	   *hash_sets = NIL;
+		List	   *sorted_rollups;
+		List	   *new_rollups = NIL;
+		double		availspace = work_mem * 1024.0;
+		ListCell   *lc;
+
+		sorted_rollups = list_make1(linitial(gd->rollups));
+
+		for_each_cell(lc, lnext(list_head(gd->rollups)))
+		{
+			RollupData *rollup = lfirst(lc);
+
+			if (rollup->hashable)
+			{
+				double		sz = estimate_hashagg_tablesize(path,
+															agg_costs,
+														  rollup->numGroups);
+
+				if (sz <= availspace)
+				{
+					availspace -= sz;
+					hash_sets = list_concat(hash_sets,
+											list_copy(rollup->gsets_data));
+					continue;
+				}
+			}
+			sorted_rollups = lappend(sorted_rollups, rollup);
+		}
+
+		if (hash_sets)
+		{
+			foreach(lc, hash_sets)
+			{
+				GroupingSetData *gs = lfirst(lc);
+				RollupData *rollup = makeNode(RollupData);
+
+				Assert(gs->set != NIL);
+
+				rollup->groupClause = preprocess_groupclause(root, gs->set);
+				rollup->gsets_data = list_make1(gs);
+				rollup->gsets = remap_to_groupclause_idx(rollup->groupClause,
+														 rollup->gsets_data,
+												   gd->tleref_to_colnum_map);
+				rollup->numGroups = gs->numGroups;
+				rollup->hashable = true;
+				rollup->is_hashed = true;
+				new_rollups = lappend(new_rollups, rollup);
+			}
+
+			new_rollups = list_concat(new_rollups, sorted_rollups);
+
+			add_path(grouped_rel, (Path *)
+					 create_groupingsets_path(root,
+											  grouped_rel,
+											  path,
+											  target,
+											  (List *) parse->havingQual,
+											  AGG_MIXED,
+											  new_rollups,
+											  agg_costs));
+		}
+	}
+
+	/*
+	 * Now try the simple sorted case.
+	 */
+	add_path(grouped_rel, (Path *)
+			 create_groupingsets_path(root,
+									  grouped_rel,
+									  path,
+									  target,
+									  (List *) parse->havingQual,
+									  AGG_SORTED,
+									  gd->rollups,
+									  agg_costs));
+}
+
 /*
  * create_window_paths
  *
@@ -4175,8 +4525,12 @@ create_distinct_paths(PlannerInfo *root,
 		/* plus the per-hash-entry overhead */
 		hashentrysize += hash_agg_entry_size(0);
 
-		/* Allow hashing only if hashtable is predicted to fit in work_mem */
-		allow_hash = (hashentrysize * numDistinctRows <= work_mem * 1024L);
+		/*
+		 * Allow hashing only if hashtable is predicted to fit in work_mem,
+		 * or if it can spill to disk.
+		 */
+		allow_hash = (hashentrysize * numDistinctRows <= work_mem * 1024L ||
+					  enable_hashagg_disk);
 	}
 
 	if (allow_hash && grouping_is_hashable(parse->distinctClause))
@@ -5257,7 +5611,7 @@ plan_cluster_use_sort(Oid tableOid, Oid indexOid)
 	indexScanPath = create_index_path(root, indexInfo,
 									  NIL, NIL, NIL, NIL, NIL,
 									  ForwardScanDirection, false,
-									  NULL, 1.0);
+									  NULL, 1.0, false);
 
 	return (seqScanAndSortPath.total_cost < indexScanPath->path.total_cost);
 }
@@ -348,8 +348,6 @@ PGSharedMemoryIsInUse(unsigned long id1, unsigned long id2)
 	return true;
 }
 
-#ifdef USE_ANONYMOUS_SHMEM
-
 #ifdef MAP_HUGETLB
 
 /*
@@ -371,12 +369,14 @@ PGSharedMemoryIsInUse(unsigned long id1, unsigned long id2)
  *
  * Returns the (real or assumed) page size into *hugepagesize,
  * and the hugepage-related mmap flags to use into *mmap_flags.
+ * dsm_impl.c also uses this, to decide which dynamic shared memory
+ * segments are worth backing with huge pages.
  *
  * Currently *mmap_flags is always just MAP_HUGETLB.  Someday, on systems
  * that support it, we might OR in additional bits to specify a particular
  * non-default huge page size.
  */
-static void
+void
 GetHugePageSize(Size *hugepagesize, int *mmap_flags)
 {
 	/*
@@ -424,6 +424,8 @@ GetHugePageSize(Size *hugepagesize, int *mmap_flags)
 
 #endif   /* MAP_HUGETLB */
 
+#ifdef USE_ANONYMOUS_SHMEM
+
 /*
  * Creates an anonymous mmap()ed shared memory segment.
  *
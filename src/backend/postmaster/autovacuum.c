@@ -66,6 +66,7 @@
 #include <sys/time.h>
 #include <unistd.h>
 
+#include "access/gin.h"
 #include "access/heapam.h"
 #include "access/htup_details.h"
 #include "access/multixact.h"
@@ -239,9 +240,27 @@ typedef enum
 {
 	AutoVacForkFailed,			/* failed trying to start a worker */
 	AutoVacRebalance,			/* rebalance the cost limits */
+	AutoVacWorkRequested,		/* a backend queued a work item */
 	AutoVacNumSignals			/* must be last */
 }	AutoVacuumSignal;
 
+/*
+ * Work items are small maintenance tasks on a single relation that backends
+ * hand over to autovacuum instead of doing them themselves, see
+ * AutoVacuumRequestWork().  An item is processed by the next worker that
+ * runs in its database.
+ */
+typedef struct AutoVacuumWorkItem
+{
+	AutoVacuumWorkItemType avw_type;
+	bool		avw_used;		/* below data is valid */
+	bool		avw_active;		/* being processed by a worker */
+	Oid			avw_database;
+	Oid			avw_relation;
+} AutoVacuumWorkItem;
+
+#define NUM_WORKITEMS	256
+
 /*-------------
  * The main autovacuum shmem struct.  On shared memory we store this main
  * struct and the array of WorkerInfo structs.  This struct keeps:
@@ -252,6 +271,7 @@ typedef enum
  * av_runningWorkers the WorkerInfo non-free queue
  * av_startingWorker pointer to WorkerInfo currently being started (cleared by
  *					the worker itself as soon as it's up and running)
+ * av_workItems		work item array
  *
  * This struct is protected by AutovacuumLock, except for av_signal and parts
  * of the worker list (see above).
@@ -264,6 +284,7 @@ typedef struct
 	dlist_head	av_freeWorkers;
 	dlist_head	av_runningWorkers;
 	WorkerInfo	av_startingWorker;
+	AutoVacuumWorkItem av_workItems[NUM_WORKITEMS];
 } AutoVacuumShmemStruct;
 
 static AutoVacuumShmemStruct *AutoVacuumShmem;
@@ -298,6 +319,8 @@ static int	db_comparator(const void *a, const void *b);
 static void autovac_balance_cost(void);
 
 static void do_autovacuum(void);
+static Oid	autovac_workitem_database(void);
+static void perform_work_items(void);
 static void FreeWorkerInfo(int code, Datum arg);
 
 static autovac_table *table_recheck_autovac(Oid relid, HTAB *table_toast_map,
@@ -406,6 +429,7 @@ NON_EXEC_STATIC void
 AutoVacLauncherMain(int argc, char *argv[])
 {
 	sigjmp_buf	local_sigjmp_buf;
+	volatile bool work_requested = false;
 
 	am_autovacuum_launcher = true;
 
@@ -668,6 +692,13 @@ AutoVacLauncherMain(int argc, char *argv[])
 				SendPostmasterSignal(PMSIGNAL_START_AUTOVAC_WORKER);
 				continue;
 			}
+
+			/* backends waiting for work items shouldn't wait for naptime */
+			if (AutoVacuumShmem->av_signal[AutoVacWorkRequested])
+			{
+				AutoVacuumShmem->av_signal[AutoVacWorkRequested] = false;
+				work_requested = true;
+			}
 		}
 
 		/*
@@ -740,7 +771,13 @@ AutoVacLauncherMain(int argc, char *argv[])
 
 		/* We're OK to start a new worker */
 
-		if (dlist_is_empty(&DatabaseList))
+		if (work_requested)
+		{
+			/* do_start_worker picks the database of the work item */
+			work_requested = false;
+			launch_worker(current_time);
+		}
+		else if (dlist_is_empty(&DatabaseList))
 		{
 			/*
 			 * Special case when the list is empty: start a worker right away.
@@ -1236,6 +1273,29 @@ do_start_worker(void)
 			avdb = tmp;
 	}
 
+	/*
+	 * Unless a database is in wraparound danger, go to one that has work
+	 * items waiting: backends rely on them being done soon.
+	 */
+	if (!for_xid_wrap && !for_multi_wrap)
+	{
+		Oid			workdb = autovac_workitem_database();
+
+		if (OidIsValid(workdb))
+		{
+			foreach(cell, dblist)
+			{
+				avw_dbase  *tmp = lfirst(cell);
+
+				if (tmp->adw_datid == workdb)
+				{
+					avdb = tmp;
+					break;
+				}
+			}
+		}
+	}
+
 	/* Found a database -- process it */
 	if (avdb != NULL)
 	{
@@ -1958,6 +2018,18 @@ do_autovacuum(void)
 
 	ReleaseSysCache(tuple);
 
+	/*
+	 * create a memory context to act as fake PortalContext, so that the
+	 * contexts created in the vacuum code are cleaned up for each table and
+	 * work item.
+	 */
+	PortalContext = AllocSetContextCreate(AutovacMemCxt,
+										  "Autovacuum Portal",
+										  ALLOCSET_DEFAULT_SIZES);
+
+	/* work items are waited for, do them before the tables */
+	perform_work_items();
+
 	/* StartTransactionCommand changed elsewhere */
 	MemoryContextSwitchTo(AutovacMemCxt);
 
@@ -2169,14 +2241,6 @@ do_autovacuum(void)
 	 */
 	bstrategy = GetAccessStrategy(BAS_VACUUM);
 
-	/*
-	 * create a memory context to act as fake PortalContext, so that the
-	 * contexts created in the vacuum code are cleaned up for each table.
-	 */
-	PortalContext = AllocSetContextCreate(AutovacMemCxt,
-										  "Autovacuum Portal",
-										  ALLOCSET_DEFAULT_SIZES);
-
 	/*
 	 * Perform operations on collected tables.
 	 */
@@ -2393,6 +2457,9 @@ deleted:
 		VacuumCostLimit = stdVacuumCostLimit;
 	}
 
+	/* and those that were requested meanwhile */
+	perform_work_items();
+
 	/*
 	 * We leak table_toast_map here (among other things), but since we're
 	 * going away soon, it's not a problem.
@@ -2425,6 +2492,117 @@ deleted:
 	CommitTransactionCommand();
 }
 
+/*
+ * autovac_workitem_database
+ *		Return the database of some work item no worker has taken yet, or
+ *		InvalidOid if there is none.
+ */
+static Oid
+autovac_workitem_database(void)
+{
+	Oid			result = InvalidOid;
+	int			i;
+
+	LWLockAcquire(AutovacuumLock, LW_SHARED);
+	for (i = 0; i < NUM_WORKITEMS; i++)
+	{
+		AutoVacuumWorkItem *workitem = &AutoVacuumShmem->av_workItems[i];
+
+		if (workitem->avw_used && !workitem->avw_active)
+		{
+			result = workitem->avw_database;
+			break;
+		}
+	}
+	LWLockRelease(AutovacuumLock);
+
+	return result;
+}
+
+/*
+ * perform_work_items
+ *		Process the work items queued for our database.
+ *
+ * Like a table, each item is done in its own transaction, and a failure only
+ * gets reported.  Must be called in a transaction, which is left open.
+ */
+static void
+perform_work_items(void)
+{
+	int			i;
+
+	for (i = 0; i < NUM_WORKITEMS; i++)
+	{
+		AutoVacuumWorkItem *workitem = &AutoVacuumShmem->av_workItems[i];
+		AutoVacuumWorkItemType type;
+		Oid			relid;
+		char	   *relname;
+
+		LWLockAcquire(AutovacuumLock, LW_EXCLUSIVE);
+		if (!workitem->avw_used || workitem->avw_active ||
+			workitem->avw_database != MyDatabaseId)
+		{
+			LWLockRelease(AutovacuumLock);
+			continue;
+		}
+		workitem->avw_active = true;
+		type = workitem->avw_type;
+		relid = workitem->avw_relation;
+		LWLockRelease(AutovacuumLock);
+
+		/* clean up memory before each iteration */
+		MemoryContextResetAndDeleteChildren(PortalContext);
+
+		/* skip relations dropped since the request */
+		relname = get_rel_name(relid);
+		if (relname != NULL)
+		{
+			PG_TRY();
+			{
+				MemoryContextSwitchTo(TopTransactionContext);
+
+				switch (type)
+				{
+					case AVW_GINCleanupPendingList:
+						ginCleanupPendingListInBackground(relid);
+						break;
+				}
+
+				/* release the locks of the relation right away */
+				CommitTransactionCommand();
+				StartTransactionCommand();
+
+				/* as for tables, a late cancel would make no sense now */
+				QueryCancelPending = false;
+			}
+			PG_CATCH();
+			{
+				HOLD_INTERRUPTS();
+				errcontext("automatic cleanup of pending list of index \"%s\"",
+						   relname);
+				EmitErrorReport();
+
+				/* this resets the PGXACT flags too */
+				AbortOutOfAnyTransaction();
+				FlushErrorState();
+				MemoryContextResetAndDeleteChildren(PortalContext);
+
+				/* restart our transaction for the following operations */
+				StartTransactionCommand();
+				RESUME_INTERRUPTS();
+			}
+			PG_END_TRY();
+		}
+
+		LWLockAcquire(AutovacuumLock, LW_EXCLUSIVE);
+		workitem->avw_used = false;
+		workitem->avw_active = false;
+		LWLockRelease(AutovacuumLock);
+
+		MemoryContextSwitchTo(AutovacMemCxt);
+	}
+}
+
 /*
  * extract_autovac_opts
  *
@@ -2918,6 +3096,65 @@ IsAutoVacuumWorkerProcess(void)
 }
 
 
+/*
+ * AutoVacuumRequestWork
+ *		Queue a work item for autovacuum on a relation of our database.
+ *
+ * Returns false if the work can't be handed over, because autovacuum is off
+ * or the queue is full; the caller has to do it itself then.  A request for
+ * an item that is already queued is merged with it.
+ */
+bool
+AutoVacuumRequestWork(AutoVacuumWorkItemType type, Oid relationId)
+{
+	bool		result = false;
+	bool		queued = false;
+	int			i;
+
+	if (!AutoVacuumingActive() || IsAutoVacuumWorkerProcess())
+		return false;
+
+	LWLockAcquire(AutovacuumLock, LW_EXCLUSIVE);
+	for (i = 0; i < NUM_WORKITEMS; i++)
+	{
+		AutoVacuumWorkItem *workitem = &AutoVacuumShmem->av_workItems[i];
+
+		if (workitem->avw_used &&
+			workitem->avw_type == type &&
+			workitem->avw_database == MyDatabaseId &&
+			workitem->avw_relation == relationId)
+		{
+			result = true;
+			break;
+		}
+	}
+	for (i = 0; !result && i < NUM_WORKITEMS; i++)
+	{
+		AutoVacuumWorkItem *workitem = &AutoVacuumShmem->av_workItems[i];
+
+		if (!workitem->avw_used)
+		{
+			workitem->avw_type = type;
+			workitem->avw_used = true;
+			workitem->avw_active = false;
+			workitem->avw_database = MyDatabaseId;
+			workitem->avw_relation = relationId;
+			result = queued = true;
+		}
+	}
+	LWLockRelease(AutovacuumLock);
+
+	/* wake up the launcher, if a worker doesn't get to it anyway */
+	if (queued)
+	{
+		AutoVacuumShmem->av_signal[AutoVacWorkRequested] = true;
+		if (AutoVacuumShmem->av_launcherpid != 0)
+			kill(AutoVacuumShmem->av_launcherpid, SIGUSR2);
+	}
+
+	return result;
+}
+
 /*
  * AutoVacuumShmemSize
  *		Compute space needed for autovacuum-related shared memory
@@ -2962,6 +3199,8 @@ AutoVacuumShmemInit(void)
 		dlist_init(&AutoVacuumShmem->av_freeWorkers);
 		dlist_init(&AutoVacuumShmem->av_runningWorkers);
 		AutoVacuumShmem->av_startingWorker = NULL;
+		memset(AutoVacuumShmem->av_workItems, 0,
+			   sizeof(AutoVacuumShmem->av_workItems));
 
 		worker = (WorkerInfo) ((char *) AutoVacuumShmem +
 							   MAXALIGN(sizeof(AutoVacuumShmemStruct)));
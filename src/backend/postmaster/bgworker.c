@@ -17,6 +17,7 @@
 #include "miscadmin.h"
 #include "libpq/pqsignal.h"
 #include "access/parallel.h"
+#include "access/xlogparallel.h"
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/postmaster.h"
 #include "storage/barrier.h"
@@ -107,6 +108,7 @@ typedef struct InternalBGWorkerMain
 
 static const InternalBGWorkerMain InternalBGWorkers[] = {
 	{"ParallelWorkerMain", ParallelWorkerMain},
+	{"XLogParallelRedoWorkerMain", XLogParallelRedoWorkerMain},
 	/* Dummy entry marking end of the array. */
 	{NULL, NULL}
 };
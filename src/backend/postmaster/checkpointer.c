@@ -693,6 +693,9 @@ CheckpointWriteDelay(int flags, double progress)
 		 */
 		pgstat_send_bgwriter();
 
+		/* Don't keep buffers staged for the double-write buffer meanwhile */
+		FlushBufferWriteBatch();
+
 		/*
 		 * This sleep used to be connected to bgwriter_delay, typically 200ms.
 		 * That resulted in more frequent wakeups if not much work to do.
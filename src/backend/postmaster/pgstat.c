@@ -3129,6 +3129,46 @@ pgstat_read_current_status(void)
 	localBackendStatusTable = localtable;
 }
 
+/*
+ * Names of wait events registered by extensions, indexed by event id.
+ */
+static const char **ExtensionWaitEventNames = NULL;
+static int	NumExtensionWaitEvents = 0;
+static int	MaxExtensionWaitEvents = 0;
+
+/* ----------
+ * pgstat_register_wait_event() -
+ *
+ *	Register a wait event of class WAIT_EXTENSION and return its id, to be
+ *	passed to pgstat_report_wait_start().  Like LWLock tranches, the names
+ *	live in backend-local memory, so this should be called from _PG_init()
+ *	of a library loaded via shared_preload_libraries: then every backend
+ *	inherits them and assigns the same ids.  The name is not copied.
+ * ----------
+ */
+uint16
+pgstat_register_wait_event(const char *name)
+{
+	if (NumExtensionWaitEvents >= MaxExtensionWaitEvents)
+	{
+		int			newalloc = Max(MaxExtensionWaitEvents * 2, 16);
+
+		if (ExtensionWaitEventNames == NULL)
+			ExtensionWaitEventNames = (const char **)
+				MemoryContextAlloc(TopMemoryContext,
+								   newalloc * sizeof(const char *));
+		else
+			ExtensionWaitEventNames = (const char **)
+				repalloc(ExtensionWaitEventNames,
+						 newalloc * sizeof(const char *));
+		MaxExtensionWaitEvents = newalloc;
+	}
+	if (NumExtensionWaitEvents >= PG_UINT16_MAX)
+		elog(ERROR, "too many extension wait events");
+	ExtensionWaitEventNames[NumExtensionWaitEvents] = name;
+	return (uint16) NumExtensionWaitEvents++;
+}
+
 /* ----------
  * pgstat_get_wait_event_type() -
  *
@@ -3162,6 +3202,9 @@ pgstat_get_wait_event_type(uint32 wait_event_info)
 		case WAIT_BUFFER_PIN:
 			event_type = "BufferPin";
 			break;
+		case WAIT_EXTENSION:
+			event_type = "Extension";
+			break;
 		default:
 			event_type = "???";
 			break;
@@ -3203,6 +3246,12 @@ pgstat_get_wait_event(uint32 wait_event_info)
 		case WAIT_BUFFER_PIN:
 			event_name = "BufferPin";
 			break;
+		case WAIT_EXTENSION:
+			if (eventId < NumExtensionWaitEvents)
+				event_name = ExtensionWaitEventNames[eventId];
+			else
+				event_name = "extension";
+			break;
 		default:
 			event_name = "unknown wait event";
 			break;
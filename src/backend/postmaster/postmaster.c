@@ -99,6 +99,7 @@
 #include "access/xlog.h"
 #include "bootstrap/bootstrap.h"
 #include "catalog/pg_control.h"
+#include "executor/instrument.h"
 #include "lib/ilist.h"
 #include "libpq/auth.h"
 #include "libpq/ip.h"
@@ -119,6 +120,7 @@
 #include "storage/pg_shmem.h"
 #include "storage/pmsignal.h"
 #include "storage/proc.h"
+#include "tcop/sessionpool.h"
 #include "tcop/tcopprot.h"
 #include "utils/builtins.h"
 #include "utils/datetime.h"
@@ -943,6 +945,9 @@ PostmasterMain(int argc, char *argv[])
 	 */
 	InitializeMaxBackends();
 
+	/* Calibrate the clock for timing plan nodes, once for all backends */
+	InstrInitTiming();
+
 	/*
 	 * Establish input sockets.
 	 *
@@ -1193,6 +1198,9 @@ PostmasterMain(int argc, char *argv[])
 	 */
 	RemovePgTempFiles();
 
+	/* Likewise for sockets of session pool backends */
+	SessionPoolInitSocketDir();
+
 	/*
 	 * Forcibly remove the files signaling a standby promotion request.
 	 * Otherwise, the existence of those files triggers a promotion too early,
@@ -5645,7 +5653,14 @@ maybe_start_bgworker(void)
 	slist_mutable_iter iter;
 	TimestampTz now = 0;
 
-	if (FatalError)
+	/*
+	 * Don't start workers while we are still getting rid of the children of
+	 * a crashed cluster.  Once shared memory has been reinitialized and the
+	 * startup process launched, workers that start with the postmaster may
+	 * run during crash recovery just as they do on a regular start; the
+	 * parallel redo workers depend on that.
+	 */
+	if (FatalError && pmState != PM_STARTUP)
 	{
 		StartWorkerNeeded = false;
 		HaveCrashedWorker = false;
@@ -16,7 +16,11 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <time.h>
+#ifdef HAVE_LIBZ
+#include <zlib.h>
+#endif
 
+#include "access/hash.h"
 #include "access/xlog_internal.h"		/* for pg_start/stop_backup */
 #include "catalog/catalog.h"
 #include "catalog/pg_type.h"
@@ -32,6 +36,10 @@
 #include "replication/walsender_private.h"
 #include "storage/fd.h"
 #include "storage/ipc.h"
+#include "storage/proc.h"
+#include "storage/shmem.h"
+#include "storage/spin.h"
+#include "tcop/sessionpool.h"
 #include "utils/builtins.h"
 #include "utils/elog.h"
 #include "utils/ps_status.h"
@@ -47,8 +55,38 @@ typedef struct
 	bool		includewal;
 	uint32		maxrate;
 	bool		sendtblspcmapfile;
+	int			compresslevel;	/* 0 means don't compress */
+	int			nstreams;		/* number of parallel streams */
+	int			stream;			/* this stream's number, 0 for the leader */
+	XLogRecPtr	leaderstart;	/* start point of the leader's backup */
 } basebackup_options;
 
+/*
+ * A base backup can be split across several connections.  The first stream,
+ * the leader, starts and stops the backup as usual and advertises it here;
+ * the other streams attach to it by its start point and each send their
+ * share of the regular files.  The leader doesn't stop the backup before all
+ * of them are done, so that its end point covers every file sent.
+ */
+typedef struct BackupStreamSet
+{
+	PGPROC	   *leader;			/* NULL if the slot is unused */
+	XLogRecPtr	startptr;
+	TimeLineID	starttli;
+	int			nstreams;
+	uint32		attached;		/* bitmask of the helper streams attached */
+	uint32		finished;		/* bitmask of the helper streams done */
+	bool		failed;			/* did any helper stream fail? */
+} BackupStreamSet;
+
+typedef struct BaseBackupCtlData
+{
+	slock_t		mutex;			/* protects all of the sets */
+	BackupStreamSet sets[FLEXIBLE_ARRAY_MEMBER];	/* max_wal_senders */
+} BaseBackupCtlData;
+
+static BaseBackupCtlData *BaseBackupCtl = NULL;
+
 
 static int64 sendDir(char *path, int basepathlen, bool sizeonly,
 		List *tablespaces, bool sendtblspclinks);
@@ -63,6 +101,24 @@ static void send_int8_string(StringInfoData *buf, int64 intval);
 static void SendBackupHeader(List *tablespaces);
 static void base_backup_cleanup(int code, Datum arg);
 static void perform_base_backup(basebackup_options *opt, DIR *tblspcdir);
+static void perform_base_backup_stream(basebackup_options *opt,
+						   DIR *tblspcdir);
+static List *collect_tablespaces(DIR *tblspcdir, bool sizeonly);
+static void set_statrelpath(void);
+static void setup_throttling(uint32 maxrate);
+static void register_backup_streams(XLogRecPtr startptr, TimeLineID starttli,
+						int nstreams);
+static void wait_for_backup_streams(void);
+static void release_backup_streams(void);
+static void attach_backup_stream(basebackup_options *opt,
+					 TimeLineID *starttli);
+static void detach_backup_stream(bool failed);
+static void backup_stream_cleanup(int code, Datum arg);
+static bool stream_owns_file(const char *pathbuf);
+static void start_compression(int level);
+static void end_compression(void);
+static void sendCopyData(const char *data, size_t len);
+static void sendCopyDone(void);
 static void parse_basebackup_options(List *options, basebackup_options *opt);
 static void SendXlogRecPtrResult(XLogRecPtr ptr, TimeLineID tli);
 static int	compareWalFileNames(const void *a, const void *b);
@@ -74,6 +130,20 @@ static bool backup_started_in_recovery = false;
 /* Relative path of temporary statistics directory */
 static char *statrelpath = NULL;
 
+/* Stream set this backend leads or belongs to, or -1 */
+static int	backup_stream_set = -1;
+
+/* Number of streams the backup is split into, and which one is ours */
+static int	backup_nstreams = 1;
+static int	backup_stream = 0;
+
+#ifdef HAVE_LIBZ
+/* Deflate state when the client asked for compression */
+static bool backup_compress = false;
+static z_stream backup_zstream;
+static StringInfoData backup_zbuf;
+#endif
+
 /*
  * Size of each block sent into the tar stream for larger files.
  */
@@ -103,6 +173,7 @@ static int64 throttled_last;
 static void
 base_backup_cleanup(int code, Datum arg)
 {
+	release_backup_streams();
 	do_pg_abort_backup();
 }
 
@@ -121,11 +192,8 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 	TimeLineID	endtli;
 	StringInfo	labelfile;
 	StringInfo	tblspc_map_file = NULL;
-	int			datadirpathlen;
 	List	   *tablespaces = NIL;
 
-	datadirpathlen = strlen(DataDir);
-
 	backup_started_in_recovery = RecoveryInProgress();
 
 	labelfile = makeStringInfo();
@@ -148,19 +216,12 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 		ListCell   *lc;
 		tablespaceinfo *ti;
 
+		if (opt->nstreams > 1)
+			register_backup_streams(startptr, starttli, opt->nstreams);
+
 		SendXlogRecPtrResult(startptr, starttli);
 
-		/*
-		 * Calculate the relative path of temporary statistics directory in
-		 * order to skip the files which are located in that directory later.
-		 */
-		if (is_absolute_path(pgstat_stat_directory) &&
-			strncmp(pgstat_stat_directory, DataDir, datadirpathlen) == 0)
-			statrelpath = psprintf("./%s", pgstat_stat_directory + datadirpathlen + 1);
-		else if (strncmp(pgstat_stat_directory, "./", 2) != 0)
-			statrelpath = psprintf("./%s", pgstat_stat_directory);
-		else
-			statrelpath = pgstat_stat_directory;
+		set_statrelpath();
 
 		/* Add a node for the base directory at the end */
 		ti = palloc0(sizeof(tablespaceinfo));
@@ -171,28 +232,7 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 		SendBackupHeader(tablespaces);
 
 		/* Setup and activate network throttling, if client requested it */
-		if (opt->maxrate > 0)
-		{
-			throttling_sample =
-				(int64) opt->maxrate * (int64) 1024 / THROTTLING_FREQUENCY;
-
-			/*
-			 * The minimum amount of time for throttling_sample bytes to be
-			 * transferred.
-			 */
-			elapsed_min_unit = USECS_PER_SEC / THROTTLING_FREQUENCY;
-
-			/* Enable throttling. */
-			throttling_counter = 0;
-
-			/* The 'real data' starts now (header was ignored). */
-			throttled_last = GetCurrentIntegerTimestamp();
-		}
-		else
-		{
-			/* Disable throttling. */
-			throttling_counter = -1;
-		}
+		setup_throttling(opt->maxrate);
 
 		/* Send off our tablespaces one by one */
 		foreach(lc, tablespaces)
@@ -247,8 +287,12 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 				Assert(lnext(lc) == NULL);
 			}
 			else
-				pq_putemptymessage('c');		/* CopyDone */
+				sendCopyDone();
 		}
+
+		/* The other streams must finish before the backup is stopped */
+		if (opt->nstreams > 1)
+			wait_for_backup_streams();
 	}
 	PG_END_ENSURE_ERROR_CLEANUP(base_backup_cleanup, (Datum) 0);
 
@@ -423,9 +467,7 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 			{
 				CheckXLogRemoved(segno, tli);
 				/* Send the chunk as a CopyData message */
-				if (pq_putmessage('d', buf, cnt))
-					ereport(ERROR,
-							(errmsg("base backup could not send data, aborting backup")));
+				sendCopyData(buf, cnt);
 
 				len += cnt;
 				throttle(cnt);
@@ -484,11 +526,409 @@ perform_base_backup(basebackup_options *opt, DIR *tblspcdir)
 		}
 
 		/* Send CopyDone message for the last tar file */
-		pq_putemptymessage('c');
+		sendCopyDone();
 	}
 	SendXlogRecPtrResult(endptr, endtli);
 }
 
+/*
+ * Send one helper stream of a parallel base backup.
+ *
+ * The backup itself has been started by the leader stream, so all we do is
+ * send the regular files that fall to us, using the same tar layout as the
+ * leader.  backup_label, tablespace_map, pg_control, tablespace links and
+ * WAL are left to the leader.  Unlike the leader we don't report an end
+ * point, as the backup is only stopped once all streams are done.
+ */
+static void
+perform_base_backup_stream(basebackup_options *opt, DIR *tblspcdir)
+{
+	TimeLineID	starttli;
+
+	backup_started_in_recovery = RecoveryInProgress();
+
+	attach_backup_stream(opt, &starttli);
+
+	PG_ENSURE_ERROR_CLEANUP(backup_stream_cleanup, (Datum) 0);
+	{
+		List	   *tablespaces;
+		ListCell   *lc;
+		tablespaceinfo *ti;
+
+		SendXlogRecPtrResult(opt->leaderstart, starttli);
+
+		set_statrelpath();
+
+		tablespaces = collect_tablespaces(tblspcdir, opt->progress);
+
+		/* Add a node for the base directory at the end */
+		ti = palloc0(sizeof(tablespaceinfo));
+		ti->size = opt->progress ? sendDir(".", 1, true, tablespaces, false) : -1;
+		tablespaces = lappend(tablespaces, ti);
+
+		SendBackupHeader(tablespaces);
+
+		setup_throttling(opt->maxrate);
+
+		foreach(lc, tablespaces)
+		{
+			StringInfoData buf;
+
+			ti = (tablespaceinfo *) lfirst(lc);
+
+			/* Send CopyOutResponse message */
+			pq_beginmessage(&buf, 'H');
+			pq_sendbyte(&buf, 0);		/* overall format */
+			pq_sendint(&buf, 0, 2);		/* natts */
+			pq_endmessage(&buf);
+
+			if (ti->path == NULL)
+				sendDir(".", 1, false, tablespaces, false);
+			else
+				sendTablespace(ti->path, false);
+
+			sendCopyDone();
+		}
+	}
+	PG_END_ENSURE_ERROR_CLEANUP(backup_stream_cleanup, (Datum) 0);
+
+	detach_backup_stream(false);
+}
+
+/*
+ * Collect the tablespaces of the cluster the way do_pg_start_backup() does,
+ * for helper streams which don't call it.
+ */
+static List *
+collect_tablespaces(DIR *tblspcdir, bool sizeonly)
+{
+	List	   *tablespaces = NIL;
+#if defined(HAVE_READLINK) || defined(WIN32)
+	int			datadirpathlen = strlen(DataDir);
+	struct dirent *de;
+
+	while ((de = ReadDir(tblspcdir, "pg_tblspc")) != NULL)
+	{
+		char		fullpath[MAXPGPATH];
+		char		linkpath[MAXPGPATH];
+		char	   *relpath = NULL;
+		int			rllen;
+		tablespaceinfo *ti;
+
+		/* Skip special stuff */
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		snprintf(fullpath, sizeof(fullpath), "pg_tblspc/%s", de->d_name);
+
+		rllen = readlink(fullpath, linkpath, sizeof(linkpath));
+		if (rllen < 0)
+		{
+			ereport(WARNING,
+					(errmsg("could not read symbolic link \"%s\": %m",
+							fullpath)));
+			continue;
+		}
+		else if (rllen >= sizeof(linkpath))
+		{
+			ereport(WARNING,
+					(errmsg("symbolic link \"%s\" target is too long",
+							fullpath)));
+			continue;
+		}
+		linkpath[rllen] = '\0';
+
+		if (rllen > datadirpathlen &&
+			strncmp(linkpath, DataDir, datadirpathlen) == 0 &&
+			IS_DIR_SEP(linkpath[datadirpathlen]))
+			relpath = linkpath + datadirpathlen + 1;
+
+		ti = palloc(sizeof(tablespaceinfo));
+		ti->oid = pstrdup(de->d_name);
+		ti->path = pstrdup(linkpath);
+		ti->rpath = relpath ? pstrdup(relpath) : NULL;
+		ti->size = sizeonly ? sendTablespace(fullpath, true) : -1;
+
+		tablespaces = lappend(tablespaces, ti);
+	}
+#endif   /* HAVE_READLINK || WIN32 */
+
+	return tablespaces;
+}
+
+/*
+ * Calculate the relative path of temporary statistics directory in order to
+ * skip the files which are located in that directory later.
+ */
+static void
+set_statrelpath(void)
+{
+	int			datadirpathlen = strlen(DataDir);
+
+	if (is_absolute_path(pgstat_stat_directory) &&
+		strncmp(pgstat_stat_directory, DataDir, datadirpathlen) == 0)
+		statrelpath = psprintf("./%s", pgstat_stat_directory + datadirpathlen + 1);
+	else if (strncmp(pgstat_stat_directory, "./", 2) != 0)
+		statrelpath = psprintf("./%s", pgstat_stat_directory);
+	else
+		statrelpath = pgstat_stat_directory;
+}
+
+/*
+ * Setup and activate network throttling if maxrate is set, else disable it.
+ */
+static void
+setup_throttling(uint32 maxrate)
+{
+	if (maxrate > 0)
+	{
+		throttling_sample =
+			(int64) maxrate * (int64) 1024 / THROTTLING_FREQUENCY;
+
+		/*
+		 * The minimum amount of time for throttling_sample bytes to be
+		 * transferred.
+		 */
+		elapsed_min_unit = USECS_PER_SEC / THROTTLING_FREQUENCY;
+
+		/* Enable throttling. */
+		throttling_counter = 0;
+
+		/* The 'real data' starts now (header was ignored). */
+		throttled_last = GetCurrentIntegerTimestamp();
+	}
+	else
+	{
+		/* Disable throttling. */
+		throttling_counter = -1;
+	}
+}
+
+/*
+ * Report the amount of shared memory needed for parallel base backups.
+ */
+Size
+BaseBackupShmemSize(void)
+{
+	Size		size;
+
+	size = offsetof(BaseBackupCtlData, sets);
+	size = add_size(size, mul_size(max_wal_senders, sizeof(BackupStreamSet)));
+
+	return size;
+}
+
+void
+BaseBackupShmemInit(void)
+{
+	bool		found;
+
+	BaseBackupCtl = (BaseBackupCtlData *)
+		ShmemInitStruct("Base Backup Ctl", BaseBackupShmemSize(), &found);
+
+	if (!found)
+	{
+		MemSet(BaseBackupCtl, 0, BaseBackupShmemSize());
+		SpinLockInit(&BaseBackupCtl->mutex);
+	}
+}
+
+/*
+ * Advertise the backup just started by the leader stream, so that the other
+ * streams can attach to it.
+ */
+static void
+register_backup_streams(XLogRecPtr startptr, TimeLineID starttli,
+						int nstreams)
+{
+	int			i;
+
+	SpinLockAcquire(&BaseBackupCtl->mutex);
+	for (i = 0; i < max_wal_senders; i++)
+	{
+		BackupStreamSet *set = &BaseBackupCtl->sets[i];
+
+		if (set->leader == NULL)
+		{
+			set->leader = MyProc;
+			set->startptr = startptr;
+			set->starttli = starttli;
+			set->nstreams = nstreams;
+			set->attached = 0;
+			set->finished = 0;
+			set->failed = false;
+			backup_stream_set = i;
+			break;
+		}
+	}
+	SpinLockRelease(&BaseBackupCtl->mutex);
+
+	if (backup_stream_set < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+				 errmsg("too many parallel base backups in progress")));
+}
+
+/*
+ * Wait in the leader stream until all the other streams have sent their
+ * files.  If some of them haven't even connected after wal_sender_timeout,
+ * the client is most likely gone, so give up.
+ */
+static void
+wait_for_backup_streams(void)
+{
+	BackupStreamSet *set = &BaseBackupCtl->sets[backup_stream_set];
+	uint32		all;
+	TimestampTz waitstart = GetCurrentTimestamp();
+
+	/* Bits 1 .. nstreams - 1, stream 0 is us */
+	all = (uint32) (((uint64) 1 << set->nstreams) - 2);
+
+	for (;;)
+	{
+		uint32		attached;
+		uint32		finished;
+		bool		failed;
+		int			rc;
+
+		SpinLockAcquire(&BaseBackupCtl->mutex);
+		attached = set->attached;
+		finished = set->finished;
+		failed = set->failed;
+		SpinLockRelease(&BaseBackupCtl->mutex);
+
+		if (failed)
+			ereport(ERROR,
+					(errmsg("parallel base backup stream failed, aborting backup")));
+		if (finished == all)
+			break;
+		if (attached != all && wal_sender_timeout > 0 &&
+			TimestampDifferenceExceeds(waitstart, GetCurrentTimestamp(),
+									   wal_sender_timeout))
+			ereport(ERROR,
+					(errmsg("timed out waiting for parallel base backup streams to connect")));
+
+		rc = WaitLatch(MyLatch,
+					   WL_LATCH_SET | WL_TIMEOUT | WL_POSTMASTER_DEATH,
+					   1000L);
+		if (rc & WL_POSTMASTER_DEATH)
+			proc_exit(1);
+		ResetLatch(MyLatch);
+		CHECK_FOR_INTERRUPTS();
+	}
+
+	release_backup_streams();
+}
+
+/*
+ * Stop advertising the leader's backup.  Helper streams attaching after this
+ * will fail, and ones still running notice it when they're done.
+ */
+static void
+release_backup_streams(void)
+{
+	if (backup_stream_set < 0)
+		return;
+
+	SpinLockAcquire(&BaseBackupCtl->mutex);
+	BaseBackupCtl->sets[backup_stream_set].leader = NULL;
+	SpinLockRelease(&BaseBackupCtl->mutex);
+
+	backup_stream_set = -1;
+}
+
+/*
+ * Attach a helper stream to the leader's backup.
+ */
+static void
+attach_backup_stream(basebackup_options *opt, TimeLineID *starttli)
+{
+	uint32		mybit = (uint32) 1 << opt->stream;
+	BackupStreamSet *set = NULL;
+	bool		duplicate = false;
+	int			i;
+
+	SpinLockAcquire(&BaseBackupCtl->mutex);
+	for (i = 0; i < max_wal_senders; i++)
+	{
+		set = &BaseBackupCtl->sets[i];
+
+		if (set->leader != NULL && set->startptr == opt->leaderstart &&
+			set->nstreams == opt->nstreams)
+		{
+			if (set->attached & mybit)
+				duplicate = true;
+			else
+			{
+				set->attached |= mybit;
+				*starttli = set->starttli;
+				backup_stream_set = i;
+			}
+			break;
+		}
+	}
+	SpinLockRelease(&BaseBackupCtl->mutex);
+
+	if (duplicate)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("parallel base backup stream %d is already running",
+						opt->stream)));
+	if (backup_stream_set < 0)
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("no base backup of %d streams started at %X/%X is in progress",
+						opt->nstreams,
+						(uint32) (opt->leaderstart >> 32),
+						(uint32) opt->leaderstart)));
+}
+
+/*
+ * Tell the leader that this helper stream is done, successfully or not.
+ */
+static void
+detach_backup_stream(bool failed)
+{
+	BackupStreamSet *set;
+	PGPROC	   *leader;
+
+	if (backup_stream_set < 0)
+		return;
+
+	set = &BaseBackupCtl->sets[backup_stream_set];
+
+	SpinLockAcquire(&BaseBackupCtl->mutex);
+	leader = set->leader;
+	if (leader != NULL)
+	{
+		if (failed)
+			set->failed = true;
+		else
+			set->finished |= (uint32) 1 << backup_stream;
+	}
+	SpinLockRelease(&BaseBackupCtl->mutex);
+
+	backup_stream_set = -1;
+
+	if (leader == NULL)
+	{
+		/* The leader has stopped the backup without waiting for us */
+		if (!failed)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("base backup was stopped before all streams were sent")));
+		return;
+	}
+
+	SetLatch(&leader->procLatch);
+}
+
+static void
+backup_stream_cleanup(int code, Datum arg)
+{
+	detach_backup_stream(true);
+}
+
 /*
  * qsort comparison function, to compare log/seg portion of WAL segment
  * filenames, ignoring the timeline portion.
@@ -516,8 +956,13 @@ parse_basebackup_options(List *options, basebackup_options *opt)
 	bool		o_wal = false;
 	bool		o_maxrate = false;
 	bool		o_tablespace_map = false;
+	bool		o_compress = false;
+	bool		o_parallel = false;
+	bool		o_worker = false;
+	bool		o_startpoint = false;
 
 	MemSet(opt, 0, sizeof(*opt));
+	opt->nstreams = 1;
 	foreach(lopt, options)
 	{
 		DefElem    *defel = (DefElem *) lfirst(lopt);
@@ -595,12 +1040,98 @@ parse_basebackup_options(List *options, basebackup_options *opt)
 			opt->sendtblspcmapfile = true;
 			o_tablespace_map = true;
 		}
+		else if (strcmp(defel->defname, "compress") == 0)
+		{
+			long		level;
+
+			if (o_compress)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("duplicate option \"%s\"", defel->defname)));
+
+			level = intVal(defel->arg);
+			if (level < 0 || level > 9)
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("%d is outside the valid range for parameter \"%s\" (%d .. %d)",
+								(int) level, "COMPRESS", 0, 9)));
+#ifndef HAVE_LIBZ
+			if (level > 0)
+				ereport(ERROR,
+						(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+						 errmsg("compression is not supported by this build")));
+#endif
+
+			opt->compresslevel = (int) level;
+			o_compress = true;
+		}
+		else if (strcmp(defel->defname, "parallel") == 0)
+		{
+			long		nstreams;
+
+			if (o_parallel)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("duplicate option \"%s\"", defel->defname)));
+
+			nstreams = intVal(defel->arg);
+			if (nstreams < 1 || nstreams > MAX_BACKUP_STREAMS)
+				ereport(ERROR,
+						(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+						 errmsg("%d is outside the valid range for parameter \"%s\" (%d .. %d)",
+								(int) nstreams, "PARALLEL", 1, MAX_BACKUP_STREAMS)));
+
+			opt->nstreams = (int) nstreams;
+			o_parallel = true;
+		}
+		else if (strcmp(defel->defname, "worker") == 0)
+		{
+			if (o_worker)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("duplicate option \"%s\"", defel->defname)));
+			opt->stream = (int) intVal(defel->arg);
+			o_worker = true;
+		}
+		else if (strcmp(defel->defname, "startpoint") == 0)
+		{
+			uint32		hi,
+						lo;
+
+			if (o_startpoint)
+				ereport(ERROR,
+						(errcode(ERRCODE_SYNTAX_ERROR),
+						 errmsg("duplicate option \"%s\"", defel->defname)));
+			if (sscanf(strVal(defel->arg), "%X/%X", &hi, &lo) != 2)
+				ereport(ERROR,
+						(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+						 errmsg("invalid value for parameter \"%s\": \"%s\"",
+								"STARTPOINT", strVal(defel->arg))));
+			opt->leaderstart = ((uint64) hi) << 32 | lo;
+			o_startpoint = true;
+		}
 		else
 			elog(ERROR, "option \"%s\" not recognized",
 				 defel->defname);
 	}
 	if (opt->label == NULL)
 		opt->label = "base backup";
+
+	if (o_worker != o_startpoint)
+		ereport(ERROR,
+				(errcode(ERRCODE_SYNTAX_ERROR),
+				 errmsg("WORKER and STARTPOINT must be specified together")));
+	if (o_worker)
+	{
+		if (opt->stream < 1 || opt->stream >= opt->nstreams)
+			ereport(ERROR,
+					(errcode(ERRCODE_NUMERIC_VALUE_OUT_OF_RANGE),
+					 errmsg("WORKER must be between 1 and the number of PARALLEL streams minus one")));
+		if (opt->includewal)
+			ereport(ERROR,
+					(errcode(ERRCODE_SYNTAX_ERROR),
+				  errmsg("WAL is sent by the leader stream of a parallel base backup")));
+	}
 }
 
 
@@ -636,7 +1167,16 @@ SendBaseBackup(BaseBackupCmd *cmd)
 		ereport(ERROR,
 				(errmsg("could not open directory \"%s\": %m", "pg_tblspc")));
 
-	perform_base_backup(&opt, dir);
+	backup_nstreams = opt.nstreams;
+	backup_stream = opt.stream;
+	start_compression(opt.compresslevel);
+
+	if (opt.stream == 0)
+		perform_base_backup(&opt, dir);
+	else
+		perform_base_backup_stream(&opt, dir);
+
+	end_compression();
 
 	FreeDir(dir);
 }
@@ -811,7 +1351,7 @@ sendFileWithContent(const char *filename, const char *content)
 
 	_tarWriteHeader(filename, NULL, &statbuf);
 	/* Send the contents as a CopyData message */
-	pq_putmessage('d', content, len);
+	sendCopyData(content, len);
 
 	/* Pad to 512 byte boundary, per tar format requirements */
 	pad = ((len + 511) & ~511) - len;
@@ -820,7 +1360,7 @@ sendFileWithContent(const char *filename, const char *content)
 		char		buf[512];
 
 		MemSet(buf, 0, pad);
-		pq_putmessage('d', buf, pad);
+		sendCopyData(buf, pad);
 	}
 }
 
@@ -985,6 +1525,16 @@ sendDir(char *path, int basepathlen, bool sizeonly, List *tablespaces,
 			continue;
 		}
 
+		/*
+		 * Skip the sockets of session pool backends, which are no use
+		 * anywhere else.
+		 */
+		if (strcmp(de->d_name, SESSION_POOL_DIR) == 0)
+		{
+			size += _tarWriteDir(pathbuf, basepathlen, &statbuf, sizeonly);
+			continue;
+		}
+
 		/*
 		 * We can skip pg_xlog, the WAL segments need to be fetched from the
 		 * WAL archive anyway. But include it as an empty directory anyway, so
@@ -1096,6 +1646,10 @@ sendDir(char *path, int basepathlen, bool sizeonly, List *tablespaces,
 		{
 			bool		sent = false;
 
+			/* In a parallel backup, leave files of other streams alone */
+			if (!stream_owns_file(pathbuf))
+				continue;
+
 			if (!sizeonly)
 				sent = sendFile(pathbuf, pathbuf + basepathlen + 1, &statbuf,
 								true);
@@ -1155,9 +1709,7 @@ sendFile(char *readfilename, char *tarfilename, struct stat * statbuf,
 	while ((cnt = fread(buf, 1, Min(sizeof(buf), statbuf->st_size - len), fp)) > 0)
 	{
 		/* Send the chunk as a CopyData message */
-		if (pq_putmessage('d', buf, cnt))
-			ereport(ERROR,
-			   (errmsg("base backup could not send data, aborting backup")));
+		sendCopyData(buf, cnt);
 
 		len += cnt;
 		throttle(cnt);
@@ -1180,7 +1732,7 @@ sendFile(char *readfilename, char *tarfilename, struct stat * statbuf,
 		while (len < statbuf->st_size)
 		{
 			cnt = Min(sizeof(buf), statbuf->st_size - len);
-			pq_putmessage('d', buf, cnt);
+			sendCopyData(buf, cnt);
 			len += cnt;
 			throttle(cnt);
 		}
@@ -1194,7 +1746,7 @@ sendFile(char *readfilename, char *tarfilename, struct stat * statbuf,
 	if (pad > 0)
 	{
 		MemSet(buf, 0, pad);
-		pq_putmessage('d', buf, pad);
+		sendCopyData(buf, pad);
 	}
 
 	FreeFile(fp);
@@ -1232,7 +1784,7 @@ _tarWriteHeader(const char *filename, const char *linktarget,
 			elog(ERROR, "unrecognized tar error: %d", rc);
 	}
 
-	pq_putmessage('d', h, 512);
+	sendCopyData(h, 512);
 }
 
 /*
@@ -1259,6 +1811,132 @@ _tarWriteDir(const char *pathbuf, int basepathlen, struct stat * statbuf,
 	return 512;
 }
 
+/*
+ * Decide whether a regular file belongs to this stream of a parallel base
+ * backup.  All streams hash the same paths, so each file is sent by exactly
+ * one of them.
+ */
+static bool
+stream_owns_file(const char *pathbuf)
+{
+	uint32		hash;
+
+	if (backup_nstreams <= 1)
+		return true;
+
+	hash = DatumGetUInt32(hash_any((const unsigned char *) pathbuf,
+								   strlen(pathbuf)));
+	return hash % backup_nstreams == backup_stream;
+}
+
+/*
+ * Set up compression of the CopyData stream, if level is non-zero.
+ *
+ * Every CopyData message is compressed on its own and flushed with
+ * Z_SYNC_FLUSH, so that the client gets exactly one message of tar data out
+ * of each one.  The deflate stream is reset at the end of every tar, as the
+ * client decompresses each CopyOut separately.
+ */
+static void
+start_compression(int level)
+{
+#ifdef HAVE_LIBZ
+	/* Clean up after an earlier backup that errored out */
+	if (backup_compress)
+	{
+		deflateEnd(&backup_zstream);
+		backup_compress = false;
+	}
+
+	if (level == 0)
+		return;
+
+	MemSet(&backup_zstream, 0, sizeof(backup_zstream));
+	if (deflateInit2(&backup_zstream, level, Z_DEFLATED, -MAX_WBITS, 8,
+					 Z_DEFAULT_STRATEGY) != Z_OK)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("could not initialize compression library: %s",
+						backup_zstream.msg ? backup_zstream.msg : "out of memory")));
+	initStringInfo(&backup_zbuf);
+	backup_compress = true;
+#else
+	Assert(level == 0);
+#endif
+}
+
+static void
+end_compression(void)
+{
+#ifdef HAVE_LIBZ
+	if (backup_compress)
+	{
+		deflateEnd(&backup_zstream);
+		pfree(backup_zbuf.data);
+		backup_compress = false;
+	}
+#endif
+}
+
+/*
+ * Send a chunk of the tar stream as a CopyData message, compressing it
+ * first if requested.
+ */
+static void
+sendCopyData(const char *data, size_t len)
+{
+	if (len == 0)
+		return;
+
+#ifdef HAVE_LIBZ
+	if (backup_compress)
+	{
+		backup_zstream.next_in = (Bytef *) data;
+		backup_zstream.avail_in = len;
+		resetStringInfo(&backup_zbuf);
+
+		do
+		{
+			int			avail;
+			int			rc;
+
+			enlargeStringInfo(&backup_zbuf, TAR_SEND_SIZE);
+			avail = backup_zbuf.maxlen - backup_zbuf.len - 1;
+			backup_zstream.next_out = (Bytef *) (backup_zbuf.data + backup_zbuf.len);
+			backup_zstream.avail_out = avail;
+
+			rc = deflate(&backup_zstream, Z_SYNC_FLUSH);
+			if (rc != Z_OK && rc != Z_BUF_ERROR)
+				elog(ERROR, "could not compress base backup data: %s",
+					 backup_zstream.msg ? backup_zstream.msg : "unknown error");
+
+			backup_zbuf.len += avail - backup_zstream.avail_out;
+		} while (backup_zstream.avail_out == 0);
+
+		data = backup_zbuf.data;
+		len = backup_zbuf.len;
+	}
+#endif
+
+	if (pq_putmessage('d', data, len))
+		ereport(ERROR,
+				(errmsg("base backup could not send data, aborting backup")));
+}
+
+/*
+ * End a tar stream with CopyDone.
+ */
+static void
+sendCopyDone(void)
+{
+#ifdef HAVE_LIBZ
+	if (backup_compress && deflateReset(&backup_zstream) != Z_OK)
+		elog(ERROR, "could not reset compression stream");
+#endif
+
+	pq_putemptymessage('c');
+}
+
 /*
  * Increment the network transfer counter by the given number of bytes,
  * and sleep if necessary to comply with the requested network transfer
@@ -76,6 +76,8 @@ static void DecodeCommit(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 			 xl_xact_parsed_commit *parsed, TransactionId xid);
 static void DecodeAbort(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 			 xl_xact_parsed_abort *parsed, TransactionId xid);
+static void Decode3PCState(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
+			   xl_xact_3pc_state *xlrec);
 static void DecodePrepare(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 			 xl_xact_parsed_prepare *parsed);
 
@@ -303,6 +305,9 @@ DecodeXactOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 				break;
 
 			}
+		case XLOG_XACT_3PC_STATE:
+			Decode3PCState(ctx, buf, (xl_xact_3pc_state *) XLogRecGetData(r));
+			break;
 		default:
 			elog(ERROR, "unexpected RM_XACT_ID record type: %u", info);
 	}
@@ -375,7 +380,8 @@ DecodeHeap2Op(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 	switch (info)
 	{
 		case XLOG_HEAP2_MULTI_INSERT:
-			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+			if (SnapBuildProcessChange(builder, xid, buf->origptr) &&
+				!ctx->fast_forward)
 				DecodeMultiInsert(ctx, buf);
 			break;
 		case XLOG_HEAP2_NEW_CID:
@@ -430,7 +436,8 @@ DecodeHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 	switch (info)
 	{
 		case XLOG_HEAP_INSERT:
-			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+			if (SnapBuildProcessChange(builder, xid, buf->origptr) &&
+				!ctx->fast_forward)
 				DecodeInsert(ctx, buf);
 			break;
 
@@ -441,12 +448,14 @@ DecodeHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 			 */
 		case XLOG_HEAP_HOT_UPDATE:
 		case XLOG_HEAP_UPDATE:
-			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+			if (SnapBuildProcessChange(builder, xid, buf->origptr) &&
+				!ctx->fast_forward)
 				DecodeUpdate(ctx, buf);
 			break;
 
 		case XLOG_HEAP_DELETE:
-			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+			if (SnapBuildProcessChange(builder, xid, buf->origptr) &&
+				!ctx->fast_forward)
 				DecodeDelete(ctx, buf);
 			break;
 
@@ -474,7 +483,8 @@ DecodeHeapOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 			break;
 
 		case XLOG_HEAP_CONFIRM:
-			if (SnapBuildProcessChange(builder, xid, buf->origptr))
+			if (SnapBuildProcessChange(builder, xid, buf->origptr) &&
+				!ctx->fast_forward)
 				DecodeSpecConfirm(ctx, buf);
 			break;
 
@@ -523,6 +533,7 @@ DecodeLogicalMsgOp(LogicalDecodingContext *ctx, XLogRecordBuffer *buf)
 	message = (xl_logical_message *) XLogRecGetData(r);
 
 	if (message->dbId != ctx->slot->data.database ||
+		ctx->fast_forward ||
 		FilterByOrigin(ctx, origin_id))
 		return;
 
@@ -589,6 +600,7 @@ DecodeCommit(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 	 *	  are restarting or if we haven't assembled a consistent snapshot yet.
 	 * 2) The transaction happened in another database.
 	 * 3) The output plugin is not interested in the origin.
+	 * 4) We are only fast-forwarding the slot and nothing is decoded.
 	 *
 	 * We can't just use ReorderBufferAbort() here, because we need to execute
 	 * the transaction's invalidations.  This currently won't be needed if
@@ -604,6 +616,7 @@ DecodeCommit(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 	 */
 	if (SnapBuildXactNeedsSkip(ctx->snapshot_builder, buf->origptr) ||
 		(parsed->dbId != InvalidOid && parsed->dbId != ctx->slot->data.database) ||
+		ctx->fast_forward ||
 		FilterByOrigin(ctx, origin_id))
 	{
 		if (SnapBuildXactNeedsSkip(ctx->snapshot_builder, buf->origptr)) {
@@ -614,7 +627,7 @@ DecodeCommit(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 			elog(DEBUG1, "Skip transaction  %d at %lx because database id is not matched", 
 				 xid, buf->endptr);
 		}
-		if (FilterByOrigin(ctx, origin_id)) { 
+		if (!ctx->fast_forward && FilterByOrigin(ctx, origin_id)) { 
 			elog(DEBUG1, "Skip transaction  %d at %lx is filtered by origin_id %d", 
 				 xid, buf->endptr, origin_id);
 		}
@@ -699,6 +712,7 @@ DecodePrepare(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 
 	if (SnapBuildXactNeedsSkip(ctx->snapshot_builder, buf->origptr) ||
 		(parsed->dbId != InvalidOid && parsed->dbId != ctx->slot->data.database) ||
+		ctx->fast_forward ||
 		FilterByOrigin(ctx, origin_id))
 	{
 		for (i = 0; i < parsed->nsubxacts; i++)
@@ -737,6 +751,63 @@ DecodePrepare(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 	}
 }
 
+/*
+ * Pass the new 3PC state of a batch of prepared transactions to the output
+ * plugin as a single commit callback, leaving out the transactions it is not
+ * interested in.  No snapshot or cache work is needed: the transactions
+ * themselves were handled when their PREPARE was decoded.
+ */
+static void
+Decode3PCState(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
+			   xl_xact_3pc_state *xlrec)
+{
+	RepOriginId origin_id = XLogRecGetOrigin(buf->record);
+	ReorderBuffer *rb = ctx->reorder;
+	ReorderBufferTXN txn;
+	char	   *ptr = (char *) xlrec + MinSizeOfXact3PCState;
+	int			i;
+
+	if (SnapBuildXactNeedsSkip(ctx->snapshot_builder, buf->origptr) ||
+		ctx->fast_forward ||
+		FilterByOrigin(ctx, origin_id))
+		return;
+
+	memset(&txn, 0, sizeof(txn));
+	txn.xids_3pc = palloc(xlrec->nxacts * sizeof(TransactionId));
+	txn.gids_3pc = palloc(xlrec->nxacts * sizeof(char *));
+
+	for (i = 0; i < xlrec->nxacts; i++)
+	{
+		xl_xact_3pc_state_xact *xact = (xl_xact_3pc_state_xact *) ptr;
+
+		if (xact->dbId == ctx->slot->data.database)
+		{
+			txn.xids_3pc[txn.nxacts_3pc] = xact->xid;
+			txn.gids_3pc[txn.nxacts_3pc] = xact->gid;
+			txn.nxacts_3pc++;
+		}
+		ptr += SizeOfXact3PCStateXact(strlen(xact->gid));
+	}
+
+	if (txn.nxacts_3pc > 0)
+	{
+		txn.xid = txn.xids_3pc[0];
+		txn.first_lsn = buf->origptr;
+		txn.final_lsn = buf->origptr;
+		txn.end_lsn = buf->endptr;
+		txn.commit_time = xlrec->origin_timestamp;
+		txn.origin_id = origin_id;
+		txn.origin_lsn = xlrec->origin_lsn;
+		txn.xact_action = XLOG_XACT_3PC_STATE;
+		strcpy(txn.gid, txn.gids_3pc[0]);
+		strcpy(txn.state_3pc, xlrec->state_3pc);
+		rb->commit(rb, &txn, buf->origptr);
+	}
+
+	pfree(txn.xids_3pc);
+	pfree(txn.gids_3pc);
+}
+
 /*
  * Get the data from the various forms of abort records and pass it on to
  * snapbuild.c and reorderbuffer.c
@@ -759,7 +830,8 @@ DecodeAbort(LogicalDecodingContext *ctx, XLogRecordBuffer *buf,
 	}
 
 	if (TransactionIdIsValid(parsed->twophase_xid)
-			&& (parsed->dbId == ctx->slot->data.database)) {
+			&& (parsed->dbId == ctx->slot->data.database)
+			&& !ctx->fast_forward) {
 
 		strcpy(ctx->reorder->gid, parsed->twophase_gid);
 		*ctx->reorder->state_3pc = '\0';
@@ -34,6 +34,7 @@
 #include "miscadmin.h"
 
 #include "access/xact.h"
+#include "access/xtm.h"
 
 #include "catalog/indexing.h"
 
@@ -79,7 +80,8 @@ LogLogicalMessage(const char *prefix, const char *message, size_t size,
 }
 
 /*
- * Redo is basically just noop for logical decoding messages.
+ * Redo is basically just noop for logical decoding messages, unless
+ * transaction manager wants to see them.
  */
 void
 logicalmsg_redo(XLogReaderState *record)
@@ -90,4 +92,12 @@ logicalmsg_redo(XLogReaderState *record)
 		elog(PANIC, "logicalmsg_redo: unknown op code %u", info);
 
 	/* This is only interesting for logical decoding, see decode.c. */
+	if (TM->ReplayLogicalMessage != NULL)
+	{
+		xl_logical_message *xlrec = (xl_logical_message *) XLogRecGetData(record);
+
+		TM->ReplayLogicalMessage(xlrec->message,
+								 xlrec->message + xlrec->prefix_size,
+								 xlrec->message_size);
+	}
 }
@@ -67,7 +67,6 @@
 #include "storage/sinval.h"
 #include "utils/builtins.h"
 #include "utils/combocid.h"
-#include "utils/memdebug.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/relfilenodemap.h"
@@ -136,29 +135,17 @@ typedef struct ReorderBufferDiskChange
 } ReorderBufferDiskChange;
 
 /*
- * Maximum number of changes kept in memory, per transaction. After that,
- * changes are spooled to disk.
- *
- * The current value should be sufficient to decode the entire transaction
- * without hitting disk in OLTP workloads, while starting to spool to disk in
- * other workloads reasonably fast.
- *
- * At some point in the future it probably makes sense to have a more elaborate
- * resource management here, but it's not entirely clear what that would look
- * like.
+ * Maximum amount of memory, in kB, used by the changes of all transactions
+ * kept in memory. After that, the largest transactions are streamed to the
+ * output plugin or spooled to disk, see ReorderBufferCheckMemoryLimit().
  */
-static const Size max_changes_in_memory = 4096;
+int			logical_decoding_work_mem;
 
 /*
- * We use a very simple form of a slab allocator for frequently allocated
- * objects, simply keeping a fixed number in a linked list when unused,
- * instead pfree()ing them. Without that in many workloads aset.c becomes a
- * major bottleneck, especially when spilling to disk while decoding batch
- * workloads.
+ * Number of changes restored from disk at once, per (sub)transaction, when
+ * replaying a spilled transaction.
  */
-static const Size max_cached_changes = 4096 * 2;
-static const Size max_cached_tuplebufs = 4096 * 2;		/* ~8MB */
-static const Size max_cached_transactions = 512;
+static const Size max_changes_in_memory = 4096;
 
 /* ---------------------------------------
  * primary reorderbuffer support routines
@@ -192,7 +179,14 @@ static void ReorderBufferExecuteInvalidations(ReorderBuffer *rb, ReorderBufferTX
  * Disk serialization support functions
  * ---------------------------------------
  */
-static void ReorderBufferCheckSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
+static Size ReorderBufferChangeSize(ReorderBufferChange *change);
+static void ReorderBufferChangeMemoryUpdate(ReorderBuffer *rb,
+								ReorderBufferTXN *txn,
+								ReorderBufferChange *change, bool addition);
+static void ReorderBufferTXNMemoryReset(ReorderBuffer *rb, ReorderBufferTXN *txn);
+static void ReorderBufferCheckMemoryLimit(ReorderBuffer *rb);
+static bool ReorderBufferCanStream(ReorderBuffer *rb, ReorderBufferTXN *txn);
+static void ReorderBufferStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
 static void ReorderBufferSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn);
 static void ReorderBufferSerializeChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 							 int fd, ReorderBufferChange *change);
@@ -240,6 +234,27 @@ ReorderBufferAllocate(void)
 
 	buffer->context = new_ctx;
 
+	/*
+	 * Changes and transactions are allocated and freed in huge numbers, all
+	 * of the same size, which fragments aset.c badly; slab contexts give
+	 * their memory back as soon as a block's worth has been freed. Tuple
+	 * data mostly lives and dies with its transaction, which is what
+	 * generation contexts are made for.
+	 */
+	buffer->change_context = SlabContextCreate(new_ctx,
+											   "Change",
+											   SLAB_DEFAULT_BLOCK_SIZE,
+											   sizeof(ReorderBufferChange));
+
+	buffer->txn_context = SlabContextCreate(new_ctx,
+											"TXN",
+											SLAB_DEFAULT_BLOCK_SIZE,
+											sizeof(ReorderBufferTXN));
+
+	buffer->tup_context = GenerationContextCreate(new_ctx,
+												  "Tuples",
+												  SLAB_LARGE_BLOCK_SIZE);
+
 	hash_ctl.keysize = sizeof(TransactionId);
 	hash_ctl.entrysize = sizeof(ReorderBufferTXNByIdEnt);
 	hash_ctl.hcxt = buffer->context;
@@ -250,19 +265,13 @@ ReorderBufferAllocate(void)
 	buffer->by_txn_last_xid = InvalidTransactionId;
 	buffer->by_txn_last_txn = NULL;
 
-	buffer->nr_cached_transactions = 0;
-	buffer->nr_cached_changes = 0;
-	buffer->nr_cached_tuplebufs = 0;
-
 	buffer->outbuf = NULL;
 	buffer->outbufsize = 0;
+	buffer->size = 0;
 
 	buffer->current_restart_decoding_lsn = InvalidXLogRecPtr;
 
 	dlist_init(&buffer->toplevel_by_lsn);
-	dlist_init(&buffer->cached_transactions);
-	dlist_init(&buffer->cached_changes);
-	slist_init(&buffer->cached_tuplebufs);
 
 	return buffer;
 }
@@ -283,26 +292,15 @@ ReorderBufferFree(ReorderBuffer *rb)
 }
 
 /*
- * Get an unused, possibly preallocated, ReorderBufferTXN.
+ * Get a new ReorderBufferTXN.
  */
 static ReorderBufferTXN *
 ReorderBufferGetTXN(ReorderBuffer *rb)
 {
 	ReorderBufferTXN *txn;
 
-	/* check the slab cache */
-	if (rb->nr_cached_transactions > 0)
-	{
-		rb->nr_cached_transactions--;
-		txn = (ReorderBufferTXN *)
-			dlist_container(ReorderBufferTXN, node,
-							dlist_pop_head_node(&rb->cached_transactions));
-	}
-	else
-	{
-		txn = (ReorderBufferTXN *)
-			MemoryContextAlloc(rb->context, sizeof(ReorderBufferTXN));
-	}
+	txn = (ReorderBufferTXN *)
+		MemoryContextAlloc(rb->txn_context, sizeof(ReorderBufferTXN));
 
 	memset(txn, 0, sizeof(ReorderBufferTXN));
 
@@ -315,9 +313,6 @@ ReorderBufferGetTXN(ReorderBuffer *rb)
 
 /*
  * Free a ReorderBufferTXN.
- *
- * Deallocation might be delayed for efficiency purposes, for details check
- * the comments above max_cached_changes's definition.
  */
 static void
 ReorderBufferReturnTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
@@ -343,41 +338,19 @@ ReorderBufferReturnTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 		txn->invalidations = NULL;
 	}
 
-	/* check whether to put into the slab cache */
-	if (rb->nr_cached_transactions < max_cached_transactions)
-	{
-		rb->nr_cached_transactions++;
-		dlist_push_head(&rb->cached_transactions, &txn->node);
-		VALGRIND_MAKE_MEM_UNDEFINED(txn, sizeof(ReorderBufferTXN));
-		VALGRIND_MAKE_MEM_DEFINED(&txn->node, sizeof(txn->node));
-	}
-	else
-	{
-		pfree(txn);
-	}
+	pfree(txn);
 }
 
 /*
- * Get an unused, possibly preallocated, ReorderBufferChange.
+ * Get a new ReorderBufferChange.
  */
 ReorderBufferChange *
 ReorderBufferGetChange(ReorderBuffer *rb)
 {
 	ReorderBufferChange *change;
 
-	/* check the slab cache */
-	if (rb->nr_cached_changes)
-	{
-		rb->nr_cached_changes--;
-		change = (ReorderBufferChange *)
-			dlist_container(ReorderBufferChange, node,
-							dlist_pop_head_node(&rb->cached_changes));
-	}
-	else
-	{
-		change = (ReorderBufferChange *)
-			MemoryContextAlloc(rb->context, sizeof(ReorderBufferChange));
-	}
+	change = (ReorderBufferChange *)
+		MemoryContextAlloc(rb->change_context, sizeof(ReorderBufferChange));
 
 	memset(change, 0, sizeof(ReorderBufferChange));
 	return change;
@@ -385,9 +358,6 @@ ReorderBufferGetChange(ReorderBuffer *rb)
 
 /*
  * Free an ReorderBufferChange.
- *
- * Deallocation might be delayed for efficiency purposes, for details check
- * the comments above max_cached_changes's definition.
  */
 void
 ReorderBufferReturnChange(ReorderBuffer *rb, ReorderBufferChange *change)
@@ -433,24 +403,13 @@ ReorderBufferReturnChange(ReorderBuffer *rb, ReorderBufferChange *change)
 			break;
 	}
 
-	/* check whether to put into the slab cache */
-	if (rb->nr_cached_changes < max_cached_changes)
-	{
-		rb->nr_cached_changes++;
-		dlist_push_head(&rb->cached_changes, &change->node);
-		VALGRIND_MAKE_MEM_UNDEFINED(change, sizeof(ReorderBufferChange));
-		VALGRIND_MAKE_MEM_DEFINED(&change->node, sizeof(change->node));
-	}
-	else
-	{
-		pfree(change);
-	}
+	pfree(change);
 }
 
 
 /*
- * Get an unused, possibly preallocated, ReorderBufferTupleBuf fitting at
- * least a tuple of size tuple_len (excluding header overhead).
+ * Get a fresh ReorderBufferTupleBuf fitting at least a tuple of size
+ * tuple_len (excluding header overhead).
  */
 ReorderBufferTupleBuf *
 ReorderBufferGetTupleBuf(ReorderBuffer *rb, Size tuple_len)
@@ -460,70 +419,23 @@ ReorderBufferGetTupleBuf(ReorderBuffer *rb, Size tuple_len)
 
 	alloc_len = tuple_len + SizeofHeapTupleHeader;
 
-	/*
-	 * Most tuples are below MaxHeapTupleSize, so we use a slab allocator for
-	 * those. Thus always allocate at least MaxHeapTupleSize. Note that tuples
-	 * generated for oldtuples can be bigger, as they don't have out-of-line
-	 * toast columns.
-	 */
-	if (alloc_len < MaxHeapTupleSize)
-		alloc_len = MaxHeapTupleSize;
-
-
-	/* if small enough, check the slab cache */
-	if (alloc_len <= MaxHeapTupleSize && rb->nr_cached_tuplebufs)
-	{
-		rb->nr_cached_tuplebufs--;
-		tuple = slist_container(ReorderBufferTupleBuf, node,
-								slist_pop_head_node(&rb->cached_tuplebufs));
-		Assert(tuple->alloc_tuple_size == MaxHeapTupleSize);
-#ifdef USE_ASSERT_CHECKING
-		memset(&tuple->tuple, 0xa9, sizeof(HeapTupleData));
-		VALGRIND_MAKE_MEM_UNDEFINED(&tuple->tuple, sizeof(HeapTupleData));
-#endif
-		tuple->tuple.t_data = ReorderBufferTupleBufData(tuple);
-#ifdef USE_ASSERT_CHECKING
-		memset(tuple->tuple.t_data, 0xa8, tuple->alloc_tuple_size);
-		VALGRIND_MAKE_MEM_UNDEFINED(tuple->tuple.t_data, tuple->alloc_tuple_size);
-#endif
-	}
-	else
-	{
-		tuple = (ReorderBufferTupleBuf *)
-			MemoryContextAlloc(rb->context,
-							   sizeof(ReorderBufferTupleBuf) +
-							   MAXIMUM_ALIGNOF + alloc_len);
-		tuple->alloc_tuple_size = alloc_len;
-		tuple->tuple.t_data = ReorderBufferTupleBufData(tuple);
-	}
+	tuple = (ReorderBufferTupleBuf *)
+		MemoryContextAlloc(rb->tup_context,
+						   sizeof(ReorderBufferTupleBuf) +
+						   MAXIMUM_ALIGNOF + alloc_len);
+	tuple->alloc_tuple_size = alloc_len;
+	tuple->tuple.t_data = ReorderBufferTupleBufData(tuple);
 
 	return tuple;
 }
 
 /*
  * Free an ReorderBufferTupleBuf.
- *
- * Deallocation might be delayed for efficiency purposes, for details check
- * the comments above max_cached_changes's definition.
  */
 void
 ReorderBufferReturnTupleBuf(ReorderBuffer *rb, ReorderBufferTupleBuf *tuple)
 {
-	/* check whether to put into the slab cache, oversized tuples never are */
-	if (tuple->alloc_tuple_size == MaxHeapTupleSize &&
-		rb->nr_cached_tuplebufs < max_cached_tuplebufs)
-	{
-		rb->nr_cached_tuplebufs++;
-		slist_push_head(&rb->cached_tuplebufs, &tuple->node);
-		VALGRIND_MAKE_MEM_UNDEFINED(tuple->tuple.t_data, tuple->alloc_tuple_size);
-		VALGRIND_MAKE_MEM_UNDEFINED(tuple, sizeof(ReorderBufferTupleBuf));
-		VALGRIND_MAKE_MEM_DEFINED(&tuple->node, sizeof(tuple->node));
-		VALGRIND_MAKE_MEM_DEFINED(&tuple->alloc_tuple_size, sizeof(tuple->alloc_tuple_size));
-	}
-	else
-	{
-		pfree(tuple);
-	}
+	pfree(tuple);
 }
 
 /*
@@ -628,8 +540,9 @@ ReorderBufferQueueChange(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn,
 	dlist_push_tail(&txn->changes, &change->node);
 	txn->nentries++;
 	txn->nentries_mem++;
+	ReorderBufferChangeMemoryUpdate(rb, txn, change, true);
 
-	ReorderBufferCheckSerializeTXN(rb, txn);
+	ReorderBufferCheckMemoryLimit(rb);
 }
 
 /*
@@ -761,6 +674,11 @@ ReorderBufferAssignChild(ReorderBuffer *rb, TransactionId xid,
 	}
 	else if (!subtxn->is_known_as_subxact)
 	{
+		/* see ReorderBufferCanStream() */
+		if (subtxn->streamed)
+			elog(ERROR, "streamed transaction %u is a subtransaction of %u",
+				 subxid, xid);
+
 		subtxn->is_known_as_subxact = true;
 		Assert(subtxn->nsubtxns == 0);
 
@@ -824,6 +742,11 @@ ReorderBufferCommitChild(ReorderBuffer *rb, TransactionId xid,
 
 	if (!subtxn->is_known_as_subxact)
 	{
+		/* see ReorderBufferCanStream() */
+		if (subtxn->streamed)
+			elog(ERROR, "streamed transaction %u is a subtransaction of %u",
+				 subxid, xid);
+
 		subtxn->is_known_as_subxact = true;
 		Assert(subtxn->nsubtxns == 0);
 
@@ -1187,6 +1110,9 @@ ReorderBufferCleanupTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 	if (txn->nentries != txn->nentries_mem)
 		ReorderBufferRestoreCleanup(rb, txn);
 
+	/* the changes in memory are gone, too */
+	ReorderBufferTXNMemoryReset(rb, txn);
+
 	/* deallocate */
 	ReorderBufferReturnTXN(rb, txn);
 }
@@ -1360,6 +1286,7 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 	volatile Snapshot snapshot_now;
 	volatile CommandId command_id = FirstCommandId;
 	bool		using_subtxn;
+	bool		streamed;
 	ReorderBufferIterTXNState *volatile iterstate = NULL;
 
 	txn = ReorderBufferTXNByXid(rb, xid, false, NULL, InvalidXLogRecPtr,
@@ -1369,6 +1296,12 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 	if (txn == NULL)
 		return;
 
+	/*
+	 * If parts of the transaction have already been streamed, send the rest
+	 * the same way and finish it with stream_commit instead of commit.
+	 */
+	streamed = txn->streamed;
+
 	txn->final_lsn = commit_lsn;
 	txn->end_lsn = end_lsn;
 	txn->commit_time = commit_time;
@@ -1421,7 +1354,10 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 		else
 			StartTransactionCommand();
 
-		rb->begin(rb, txn);
+		if (streamed)
+			rb->stream_start(rb, txn);
+		else
+			rb->begin(rb, txn);
 
 		iterstate = ReorderBufferIterTXNInit(rb, txn);
 		while ((change = ReorderBufferIterTXNNext(rb, iterstate)) != NULL)
@@ -1489,7 +1425,10 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					if (!IsToastRelation(relation))
 					{
 						ReorderBufferToastReplace(rb, txn, relation, change);
-						rb->apply_change(rb, txn, relation, change);
+						if (streamed)
+							rb->stream_change(rb, txn, relation, change);
+						else
+							rb->apply_change(rb, txn, relation, change);
 
 						/*
 						 * Only clear reassembled toast chunks if we're sure
@@ -1562,10 +1501,16 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 					break;
 
 				case REORDER_BUFFER_CHANGE_MESSAGE:
-					rb->message(rb, txn, change->lsn, true,
-								change->data.msg.prefix,
-								change->data.msg.message_size,
-								change->data.msg.message);
+					if (streamed)
+						rb->stream_message(rb, txn, change->lsn,
+										   change->data.msg.prefix,
+										   change->data.msg.message_size,
+										   change->data.msg.message);
+					else
+						rb->message(rb, txn, change->lsn, true,
+									change->data.msg.prefix,
+									change->data.msg.message_size,
+									change->data.msg.message);
 					break;
 
 				case REORDER_BUFFER_CHANGE_INTERNAL_SNAPSHOT:
@@ -1652,7 +1597,13 @@ ReorderBufferCommit(ReorderBuffer *rb, TransactionId xid,
 		iterstate = NULL;
 
 		/* call commit callback */
-		rb->commit(rb, txn, commit_lsn);
+		if (streamed)
+		{
+			rb->stream_stop(rb, txn, commit_lsn);
+			rb->stream_commit(rb, txn, commit_lsn);
+		}
+		else
+			rb->commit(rb, txn, commit_lsn);
 
 		/* this is just a sanity check against bad output plugin behaviour */
 		if (GetCurrentTransactionIdIfAny() != InvalidTransactionId)
@@ -1767,6 +1718,10 @@ ReorderBufferAbort(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn)
 	/* cosmetic... */
 	txn->final_lsn = lsn;
 
+	/* the client has to throw away what it got of the transaction so far */
+	if (txn->streamed)
+		rb->stream_abort(rb, txn, lsn);
+
 	/* remove potential on-disk data, and deallocate */
 	ReorderBufferCleanupTXN(rb, txn);
 }
@@ -1800,6 +1755,9 @@ ReorderBufferAbortOld(ReorderBuffer *rb, TransactionId oldestRunningXid)
 		{
 			elog(DEBUG1, "aborting old transaction %u", txn->xid);
 
+			if (txn->streamed)
+				rb->stream_abort(rb, txn, txn->first_lsn);
+
 			/* remove potential on-disk data, and deallocate this tx */
 			ReorderBufferCleanupTXN(rb, txn);
 		}
@@ -1836,6 +1794,10 @@ ReorderBufferForget(ReorderBuffer *rb, TransactionId xid, XLogRecPtr lsn)
 	/* cosmetic... */
 	txn->final_lsn = lsn;
 
+	/* we are not interested after all, but the client got some changes */
+	if (txn->streamed)
+		rb->stream_abort(rb, txn, lsn);
+
 	/*
 	 * Process cache invalidation messages if there are any. Even if we're not
 	 * interested in the transaction's contents, it could have manipulated the
@@ -2105,20 +2067,374 @@ ReorderBufferSerializeReserve(ReorderBuffer *rb, Size sz)
 }
 
 /*
- * Check whether the transaction tx should spill its data to disk.
+ * Approximate memory used by a change kept in memory.
+ */
+static Size
+ReorderBufferChangeSize(ReorderBufferChange *change)
+{
+	Size		sz = sizeof(ReorderBufferChange);
+
+	switch (change->action)
+	{
+		case REORDER_BUFFER_CHANGE_INSERT:
+		case REORDER_BUFFER_CHANGE_UPDATE:
+		case REORDER_BUFFER_CHANGE_DELETE:
+		case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_INSERT:
+			if (change->data.tp.newtuple)
+				sz += sizeof(ReorderBufferTupleBuf) +
+					change->data.tp.newtuple->alloc_tuple_size;
+			if (change->data.tp.oldtuple)
+				sz += sizeof(ReorderBufferTupleBuf) +
+					change->data.tp.oldtuple->alloc_tuple_size;
+			break;
+		case REORDER_BUFFER_CHANGE_MESSAGE:
+			sz += strlen(change->data.msg.prefix) + 1 +
+				change->data.msg.message_size;
+			break;
+		case REORDER_BUFFER_CHANGE_INTERNAL_SNAPSHOT:
+			sz += sizeof(SnapshotData) +
+				sizeof(TransactionId) * change->data.snapshot->xcnt +
+				sizeof(TransactionId) * change->data.snapshot->subxcnt;
+			break;
+			/* no data in addition to the struct itself */
+		case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_CONFIRM:
+		case REORDER_BUFFER_CHANGE_INTERNAL_COMMAND_ID:
+		case REORDER_BUFFER_CHANGE_INTERNAL_TUPLECID:
+			break;
+	}
+
+	return sz;
+}
+
+/*
+ * Account for a change being added to or removed from the in-memory changes
+ * of a transaction.
  */
 static void
-ReorderBufferCheckSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+ReorderBufferChangeMemoryUpdate(ReorderBuffer *rb, ReorderBufferTXN *txn,
+								ReorderBufferChange *change, bool addition)
 {
-	/*
-	 * TODO: improve accounting so we cheaply can take subtransactions into
-	 * account here.
-	 */
-	if (txn->nentries_mem >= max_changes_in_memory)
+	Size		sz = ReorderBufferChangeSize(change);
+
+	if (addition)
+	{
+		txn->size += sz;
+		rb->size += sz;
+	}
+	else
+	{
+		Assert(txn->size >= sz && rb->size >= sz);
+		txn->size -= sz;
+		rb->size -= sz;
+	}
+}
+
+/*
+ * Forget about the memory of all in-memory changes of a transaction, after
+ * they have been freed wholesale.
+ */
+static void
+ReorderBufferTXNMemoryReset(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	Assert(rb->size >= txn->size);
+	rb->size -= txn->size;
+	txn->size = 0;
+}
+
+/*
+ * Find the (sub)transaction using the most memory.
+ */
+static ReorderBufferTXN *
+ReorderBufferLargestTXN(ReorderBuffer *rb)
+{
+	HASH_SEQ_STATUS hash_seq;
+	ReorderBufferTXNByIdEnt *ent;
+	ReorderBufferTXN *largest = NULL;
+
+	hash_seq_init(&hash_seq, rb->by_txn);
+	while ((ent = hash_seq_search(&hash_seq)) != NULL)
+	{
+		ReorderBufferTXN *txn = ent->txn;
+
+		if (largest == NULL || txn->size > largest->size)
+			largest = txn;
+	}
+
+	return largest;
+}
+
+/*
+ * Check whether the changes kept in memory exceed logical_decoding_work_mem,
+ * and if so evict the largest transactions until they don't anymore.
+ *
+ * Evicting the largest ones first means a single large transaction is dealt
+ * with at once, while the many small transactions of an OLTP workload stay in
+ * memory until they commit. An evicted transaction is streamed to the output
+ * plugin if possible (see ReorderBufferCanStream()), otherwise it, and its
+ * subtransactions, are spilled to disk.
+ */
+static void
+ReorderBufferCheckMemoryLimit(ReorderBuffer *rb)
+{
+	Size		limit = (Size) logical_decoding_work_mem * 1024L;
+
+	while (rb->size >= limit)
+	{
+		ReorderBufferTXN *txn = ReorderBufferLargestTXN(rb);
+		Size		size_before;
+
+		Assert(txn != NULL && txn->size > 0);
+		size_before = txn->size;
+
+		if (ReorderBufferCanStream(rb, txn))
+			ReorderBufferStreamTXN(rb, txn);
+		else
+		{
+			ReorderBufferSerializeTXN(rb, txn);
+			Assert(txn->nentries_mem == 0 && txn->size == 0);
+		}
+
+		/*
+		 * Streaming may leave a pending speculative insertion behind; don't
+		 * loop forever if that's all the largest transaction has.
+		 */
+		if (txn->size >= size_before)
+			break;
+	}
+}
+
+/*
+ * Can the changes of the running transaction txn be streamed to the output
+ * plugin now?
+ *
+ * Streaming has to be enabled by the plugin and we must have reached the
+ * point from which on the client wants to see transactions; before that we
+ * may be reading parts of the WAL that were already sent.
+ *
+ * Then only toplevel transactions without subtransactions and catalog changes
+ * are streamed: their changes can be decoded with the snapshot alone and they
+ * can never be partially rolled back. With wal_level = logical subxact
+ * assignments are logged right away (see AssignTransactionId()), so a
+ * transaction not known to be a subxact here is really a toplevel one. The
+ * transaction must also not have spilled to disk yet, the changes there
+ * would be sent out of order. Transactions that don't qualify are serialized
+ * as usual, including previously streamed ones, whose remaining changes are
+ * then streamed at commit.
+ */
+static bool
+ReorderBufferCanStream(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	LogicalDecodingContext *ctx = rb->private_data;
+
+	if (!ctx->streaming)
+		return false;
+
+	if (SnapBuildCurrentState(ctx->snapshot_builder) < SNAPBUILD_CONSISTENT ||
+		SnapBuildXactNeedsSkip(ctx->snapshot_builder, ctx->reader->EndRecPtr))
+		return false;
+
+	return !txn->is_known_as_subxact &&
+		txn->nsubtxns == 0 &&
+		!txn->has_catalog_changes &&
+		txn->base_snapshot != NULL &&
+		txn->nentries == txn->nentries_mem;
+}
+
+/*
+ * Stream the changes of a running transaction accumulated in memory so far.
+ *
+ * The changes are decoded like in ReorderBufferCommit(), but sent to the
+ * stream callbacks and freed as we go. A pending speculative insertion and
+ * reassembled toast chunks stay in the transaction, as the confirmation or
+ * the tuple pointing to them may not have been decoded yet. The snapshot
+ * reached becomes the new base snapshot of the transaction, for the next
+ * block or the commit.
+ */
+static void
+ReorderBufferStreamTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
+{
+	volatile Snapshot snapshot_now = txn->base_snapshot;
+	XLogRecPtr	last_lsn = txn->first_lsn;
+	bool		using_subtxn;
+
+	Assert(ReorderBufferCanStream(rb, txn));
+
+	SetupHistoricSnapshot(snapshot_now, NULL);
+
+	/* see ReorderBufferCommit() */
+	using_subtxn = IsTransactionOrTransactionBlock();
+
+	PG_TRY();
+	{
+		ReorderBufferChange *specinsert = NULL;
+
+		if (using_subtxn)
+			BeginInternalSubTransaction("stream");
+		else
+			StartTransactionCommand();
+
+		rb->stream_start(rb, txn);
+
+		while (!dlist_is_empty(&txn->changes))
+		{
+			ReorderBufferChange *change;
+			Relation	relation;
+			Oid			reloid;
+
+			change = dlist_container(ReorderBufferChange, node,
+									 dlist_pop_head_node(&txn->changes));
+			txn->nentries--;
+			txn->nentries_mem--;
+			ReorderBufferChangeMemoryUpdate(rb, txn, change, false);
+			last_lsn = change->lsn;
+
+			switch (change->action)
+			{
+				case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_CONFIRM:
+					/* continue with the confirmed insertion instead */
+					Assert(specinsert != NULL);
+					ReorderBufferReturnChange(rb, change);
+					change = specinsert;
+					specinsert = NULL;
+					change->action = REORDER_BUFFER_CHANGE_INSERT;
+
+					/* intentionally fall through */
+				case REORDER_BUFFER_CHANGE_INSERT:
+				case REORDER_BUFFER_CHANGE_UPDATE:
+				case REORDER_BUFFER_CHANGE_DELETE:
+					/* a pending speculative insertion wasn't successful */
+					if (specinsert != NULL)
+					{
+						ReorderBufferReturnChange(rb, specinsert);
+						specinsert = NULL;
+					}
+
+					reloid = RelidByRelfilenode(change->data.tp.relnode.spcNode,
+											change->data.tp.relnode.relNode);
+
+					/* data-less catalog tuple, see ReorderBufferCommit() */
+					if (reloid == InvalidOid &&
+						change->data.tp.newtuple == NULL &&
+						change->data.tp.oldtuple == NULL)
+						break;
+					else if (reloid == InvalidOid)
+						elog(ERROR, "could not map filenode \"%s\" to relation OID",
+							 relpathperm(change->data.tp.relnode,
+										 MAIN_FORKNUM));
+
+					relation = RelationIdGetRelation(reloid);
+
+					if (relation == NULL)
+						elog(ERROR, "could not open relation with OID %u (for filenode \"%s\")",
+							 reloid,
+							 relpathperm(change->data.tp.relnode,
+										 MAIN_FORKNUM));
+
+					if (RelationIsLogicallyLogged(relation) &&
+						relation->rd_rel->relkind != RELKIND_SEQUENCE)
+					{
+						if (!IsToastRelation(relation))
+						{
+							ReorderBufferToastReplace(rb, txn, relation, change);
+							rb->stream_change(rb, txn, relation, change);
+
+							if (change->data.tp.clear_toast_afterwards)
+								ReorderBufferToastReset(rb, txn);
+						}
+						else if (change->action == REORDER_BUFFER_CHANGE_INSERT)
+						{
+							/* the chunk belongs to the toast hash now */
+							ReorderBufferToastAppendChunk(rb, txn, relation,
+														  change);
+							change = NULL;
+						}
+					}
+
+					RelationClose(relation);
+					break;
+
+				case REORDER_BUFFER_CHANGE_INTERNAL_SPEC_INSERT:
+					/* clear out a pending (and thus failed) speculation */
+					if (specinsert != NULL)
+						ReorderBufferReturnChange(rb, specinsert);
+
+					/* and memorize the pending insertion */
+					specinsert = change;
+					change = NULL;
+					break;
+
+				case REORDER_BUFFER_CHANGE_MESSAGE:
+					rb->stream_message(rb, txn, change->lsn,
+									   change->data.msg.prefix,
+									   change->data.msg.message_size,
+									   change->data.msg.message);
+					break;
+
+				case REORDER_BUFFER_CHANGE_INTERNAL_SNAPSHOT:
+					/* we never stream spilled transactions */
+					Assert(!change->data.snapshot->copied);
+
+					/* the new snapshot replaces the base snapshot */
+					TeardownHistoricSnapshot(false);
+					SnapBuildSnapDecRefcount(txn->base_snapshot);
+
+					txn->base_snapshot = change->data.snapshot;
+					txn->base_snapshot_lsn = change->lsn;
+					change->data.snapshot = NULL;
+
+					snapshot_now = txn->base_snapshot;
+					SetupHistoricSnapshot(snapshot_now, NULL);
+					break;
+
+				case REORDER_BUFFER_CHANGE_INTERNAL_COMMAND_ID:
+				case REORDER_BUFFER_CHANGE_INTERNAL_TUPLECID:
+					elog(ERROR, "catalog change in streamed transaction %u",
+						 txn->xid);
+					break;
+			}
+
+			if (change != NULL)
+				ReorderBufferReturnChange(rb, change);
+		}
+
+		/* keep the pending speculative insertion for the next block */
+		if (specinsert != NULL)
+		{
+			dlist_push_head(&txn->changes, &specinsert->node);
+			txn->nentries++;
+			txn->nentries_mem++;
+			ReorderBufferChangeMemoryUpdate(rb, txn, specinsert, true);
+		}
+
+		rb->stream_stop(rb, txn, last_lsn);
+		txn->streamed = true;
+
+		/* this is just a sanity check against bad output plugin behaviour */
+		if (GetCurrentTransactionIdIfAny() != InvalidTransactionId)
+			elog(ERROR, "output plugin used XID %u",
+				 GetCurrentTransactionId());
+
+		/* cleanup */
+		TeardownHistoricSnapshot(false);
+
+		/* see ReorderBufferCommit() */
+		AbortCurrentTransaction();
+
+		if (using_subtxn)
+			RollbackAndReleaseCurrentSubTransaction();
+	}
+	PG_CATCH();
 	{
-		ReorderBufferSerializeTXN(rb, txn);
-		Assert(txn->nentries_mem == 0);
+		TeardownHistoricSnapshot(true);
+
+		AbortCurrentTransaction();
+
+		if (using_subtxn)
+			RollbackAndReleaseCurrentSubTransaction();
+
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 }
 
 /*
@@ -2189,6 +2505,7 @@ ReorderBufferSerializeTXN(ReorderBuffer *rb, ReorderBufferTXN *txn)
 
 		ReorderBufferSerializeChange(rb, txn, fd, change);
 		dlist_delete(&change->node);
+		ReorderBufferChangeMemoryUpdate(rb, txn, change, false);
 		ReorderBufferReturnChange(rb, change);
 
 		spilled++;
@@ -2388,6 +2705,7 @@ ReorderBufferRestoreChanges(ReorderBuffer *rb, ReorderBufferTXN *txn,
 		ReorderBufferReturnChange(rb, cleanup);
 	}
 	txn->nentries_mem = 0;
+	ReorderBufferTXNMemoryReset(rb, txn);
 	Assert(dlist_is_empty(&txn->changes));
 
 	XLByteToSeg(txn->final_lsn, last_segno);
@@ -2627,6 +2945,7 @@ ReorderBufferRestoreChange(ReorderBuffer *rb, ReorderBufferTXN *txn,
 
 	dlist_push_tail(&txn->changes, &change->node);
 	txn->nentries_mem++;
+	ReorderBufferChangeMemoryUpdate(rb, txn, change, true);
 }
 
 /*
@@ -2972,6 +3291,22 @@ ReorderBufferToastReplace(ReorderBuffer *rb, ReorderBufferTXN *txn,
 	Assert(newtup->tuple.t_len <= MaxHeapTupleSize);
 	Assert(ReorderBufferTupleBufData(newtup) == newtup->tuple.t_data);
 
+	/*
+	 * Tuple buffers are only as large as the tuple they were created for, so
+	 * the reconstructed tuple may not fit; swap in a larger buffer then.
+	 * attrs[] don't point into the old buffer's contents anymore.
+	 */
+	if (tmphtup->t_len > newtup->alloc_tuple_size)
+	{
+		ReorderBufferTupleBuf *oldtup = newtup;
+
+		newtup = ReorderBufferGetTupleBuf(rb, tmphtup->t_len);
+		newtup->tuple.t_self = oldtup->tuple.t_self;
+		newtup->tuple.t_tableOid = oldtup->tuple.t_tableOid;
+		ReorderBufferReturnTupleBuf(rb, oldtup);
+		change->data.tp.newtuple = newtup;
+	}
+
 	memcpy(newtup->tuple.t_data, tmphtup->t_data, tmphtup->t_len);
 	newtup->tuple.t_len = tmphtup->t_len;
 
@@ -72,6 +72,10 @@ Node *replication_parse_result;
 %token K_MAX_RATE
 %token K_WAL
 %token K_TABLESPACE_MAP
+%token K_COMPRESS
+%token K_PARALLEL
+%token K_WORKER
+%token K_STARTPOINT
 %token K_TIMELINE
 %token K_PHYSICAL
 %token K_LOGICAL
@@ -125,7 +129,8 @@ identify_system:
 
 /*
  * BASE_BACKUP [LABEL '<label>'] [PROGRESS] [FAST] [WAL] [NOWAIT]
- * [MAX_RATE %d] [TABLESPACE_MAP]
+ * [MAX_RATE %d] [TABLESPACE_MAP] [COMPRESS %d]
+ * [PARALLEL %d [WORKER %d STARTPOINT '<recptr>']]
  */
 base_backup:
 			K_BASE_BACKUP base_backup_opt_list
@@ -180,6 +185,26 @@ base_backup_opt:
 				  $$ = makeDefElem("tablespace_map",
 								   (Node *)makeInteger(TRUE));
 				}
+			| K_COMPRESS UCONST
+				{
+				  $$ = makeDefElem("compress",
+								   (Node *)makeInteger($2));
+				}
+			| K_PARALLEL UCONST
+				{
+				  $$ = makeDefElem("parallel",
+								   (Node *)makeInteger($2));
+				}
+			| K_WORKER UCONST
+				{
+				  $$ = makeDefElem("worker",
+								   (Node *)makeInteger($2));
+				}
+			| K_STARTPOINT SCONST
+				{
+				  $$ = makeDefElem("startpoint",
+								   (Node *)makeString($2));
+				}
 			;
 
 create_replication_slot:
@@ -36,6 +36,7 @@
 
 #include "postgres.h"
 
+#include <signal.h>
 #include <unistd.h>
 #include <sys/stat.h>
 
@@ -759,6 +760,152 @@ ReplicationSlotsCountDBSlots(Oid dboid, int *nslots, int *nactive)
 	return false;
 }
 
+/*
+ * Acquire the in-use slot s on behalf of the startup process, terminating
+ * the backend using it if there is one.  Returns false if the slot went
+ * away or changed meanwhile, in which case the caller has to look again.
+ */
+static bool
+ReplicationSlotAcquireForRecovery(ReplicationSlot *s, NameData *name)
+{
+	pid_t		active_pid;
+
+	LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+	if (!s->in_use || strcmp(NameStr(*name), NameStr(s->data.name)) != 0)
+	{
+		LWLockRelease(ReplicationSlotControlLock);
+		return false;
+	}
+	SpinLockAcquire(&s->mutex);
+	active_pid = s->active_pid;
+	if (active_pid == 0)
+		s->active_pid = MyProcPid;
+	SpinLockRelease(&s->mutex);
+	LWLockRelease(ReplicationSlotControlLock);
+
+	if (active_pid != 0)
+	{
+		/* the walsender or backend exits once it gets the signal */
+		(void) kill(active_pid, SIGTERM);
+		pg_usleep(100000L);
+		return false;
+	}
+
+	MyReplicationSlot = s;
+	return true;
+}
+
+/*
+ * ReplicationSlotsInvalidateLogical -- invalidate the logical slots of a
+ * standby whose catalog_xmin is no longer protected.
+ *
+ * Called by the startup process when replay removes catalog rows that
+ * logical decoding with a catalog_xmin up to xid could still need, in the
+ * database dboid.  InvalidOid stands for all databases, an invalid xid for
+ * all slots.  Invalidated slots keep their WAL position but cannot be
+ * decoded from anymore; backends using them are terminated.
+ */
+void
+ReplicationSlotsInvalidateLogical(Oid dboid, TransactionId xid)
+{
+	int			i;
+	bool		invalidated = false;
+
+	Assert(MyReplicationSlot == NULL);
+
+	if (max_replication_slots <= 0)
+		return;
+
+restart:
+	for (i = 0; i < max_replication_slots; i++)
+	{
+		ReplicationSlot *s = &ReplicationSlotCtl->replication_slots[i];
+		TransactionId catalog_xmin;
+		NameData	name;
+
+		LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+		if (!s->in_use || !SlotIsLogical(s) ||
+			(OidIsValid(dboid) && s->data.database != dboid))
+		{
+			LWLockRelease(ReplicationSlotControlLock);
+			continue;
+		}
+		SpinLockAcquire(&s->mutex);
+		catalog_xmin = s->effective_catalog_xmin;
+		name = s->data.name;
+		SpinLockRelease(&s->mutex);
+		LWLockRelease(ReplicationSlotControlLock);
+
+		if (!TransactionIdIsValid(catalog_xmin) ||
+			(TransactionIdIsValid(xid) &&
+			 TransactionIdFollows(catalog_xmin, xid)))
+			continue;
+
+		if (!ReplicationSlotAcquireForRecovery(s, &name))
+			goto restart;
+
+		SpinLockAcquire(&s->mutex);
+		s->effective_catalog_xmin = InvalidTransactionId;
+		s->data.catalog_xmin = InvalidTransactionId;
+		SpinLockRelease(&s->mutex);
+
+		ReplicationSlotMarkDirty();
+		ReplicationSlotSave();
+		ReplicationSlotRelease();
+
+		ereport(LOG,
+				(errmsg("invalidating replication slot \"%s\" because it conflicts with recovery",
+						NameStr(name))));
+		invalidated = true;
+	}
+
+	if (invalidated)
+		ReplicationSlotsComputeRequiredXmin(false);
+}
+
+/*
+ * ReplicationSlotsDropDBSlots -- drop the logical slots of a database that
+ * is being dropped by replay on a standby.
+ *
+ * On the primary, dropping a database with slots is refused, but a standby
+ * may have slots of its own that the primary doesn't know about.
+ */
+void
+ReplicationSlotsDropDBSlots(Oid dboid)
+{
+	int			i;
+
+	Assert(MyReplicationSlot == NULL);
+
+	if (max_replication_slots <= 0)
+		return;
+
+restart:
+	for (i = 0; i < max_replication_slots; i++)
+	{
+		ReplicationSlot *s = &ReplicationSlotCtl->replication_slots[i];
+		NameData	name;
+
+		LWLockAcquire(ReplicationSlotControlLock, LW_SHARED);
+		if (!s->in_use || !SlotIsLogical(s) || s->data.database != dboid)
+		{
+			LWLockRelease(ReplicationSlotControlLock);
+			continue;
+		}
+		name = s->data.name;
+		LWLockRelease(ReplicationSlotControlLock);
+
+		if (!ReplicationSlotAcquireForRecovery(s, &name))
+			goto restart;
+
+		ReplicationSlotDropAcquired();
+
+		ereport(LOG,
+				(errmsg("dropped replication slot \"%s\" of dropped database",
+						NameStr(name))));
+	}
+}
+
 
 /*
  * Check whether the server's configuration supports using replication
@@ -827,6 +974,20 @@ ReplicationSlotReserveWal(void)
 			/* and make sure it's fsynced to disk */
 			XLogFlush(flushptr);
 		}
+		else if (SlotIsLogical(slot))
+		{
+			/*
+			 * On a standby we can't log a snapshot ourselves; start at the
+			 * replay position and wait for the next running-xacts record
+			 * of the primary.  If the last replayed record ended at a page
+			 * boundary, the next one starts after the page header.
+			 */
+			slot->data.restart_lsn = GetXLogReplayRecPtr(NULL);
+			if (slot->data.restart_lsn % XLogSegSize == 0)
+				slot->data.restart_lsn += SizeOfXLogLongPHD;
+			else if (slot->data.restart_lsn % XLOG_BLCKSZ == 0)
+				slot->data.restart_lsn += SizeOfXLogShortPHD;
+		}
 		else
 		{
 			slot->data.restart_lsn = GetRedoRecPtr();
@@ -17,11 +17,15 @@
 #include "miscadmin.h"
 
 #include "access/htup_details.h"
+#include "access/xlog.h"
+#include "replication/decode.h"
 #include "replication/slot.h"
 #include "replication/logical.h"
 #include "replication/logicalfuncs.h"
 #include "utils/builtins.h"
+#include "utils/inval.h"
 #include "utils/pg_lsn.h"
+#include "utils/resowner.h"
 
 static void
 check_permissions(void)
@@ -168,6 +172,201 @@ pg_drop_replication_slot(PG_FUNCTION_ARGS)
 	PG_RETURN_VOID();
 }
 
+/*
+ * Move a physical slot's restart_lsn forward to moveto.
+ *
+ * Returns the slot's restart_lsn afterwards, which is never moved backwards.
+ */
+static XLogRecPtr
+pg_physical_replication_slot_advance(XLogRecPtr moveto)
+{
+	XLogRecPtr	startlsn = MyReplicationSlot->data.restart_lsn;
+	XLogRecPtr	retlsn = startlsn;
+
+	if (startlsn < moveto)
+	{
+		SpinLockAcquire(&MyReplicationSlot->mutex);
+		MyReplicationSlot->data.restart_lsn = moveto;
+		SpinLockRelease(&MyReplicationSlot->mutex);
+		retlsn = moveto;
+
+		ReplicationSlotMarkDirty();
+		ReplicationSlotSave();
+
+		ReplicationSlotsComputeRequiredLSN();
+	}
+
+	return retlsn;
+}
+
+/*
+ * Move a logical slot's confirmed_flush forward to moveto.
+ *
+ * The WAL between the slot's restart_lsn and moveto still has to be read so
+ * that the snapshot builder, restart_lsn and catalog_xmin advance correctly,
+ * but it is decoded in fast-forward mode: no changes are assembled and the
+ * output plugin is never called.
+ *
+ * Returns the slot's confirmed_flush afterwards.
+ */
+static XLogRecPtr
+pg_logical_replication_slot_advance(XLogRecPtr moveto)
+{
+	LogicalDecodingContext *ctx;
+	ResourceOwner old_resowner = CurrentResourceOwner;
+	XLogRecPtr	startlsn;
+	XLogRecPtr	retlsn;
+
+	PG_TRY();
+	{
+		ctx = CreateDecodingContext(InvalidXLogRecPtr, NIL, true,
+									logical_read_local_xlog_page,
+									NULL, NULL);
+
+		/*
+		 * Start reading at the slot's restart_lsn, so that transactions
+		 * which were in progress there are tracked properly.
+		 */
+		startlsn = MyReplicationSlot->data.restart_lsn;
+		retlsn = MyReplicationSlot->data.confirmed_flush;
+
+		CurrentResourceOwner = ResourceOwnerCreate(CurrentResourceOwner,
+												   "logical decoding");
+
+		/* invalidate non-timetravel entries */
+		InvalidateSystemCaches();
+
+		while ((startlsn != InvalidXLogRecPtr && startlsn < moveto) ||
+			   (ctx->reader->EndRecPtr != InvalidXLogRecPtr &&
+				ctx->reader->EndRecPtr < moveto))
+		{
+			XLogRecord *record;
+			char	   *errm = NULL;
+
+			record = XLogReadRecord(ctx->reader, startlsn, &errm);
+			if (errm)
+				elog(ERROR, "%s", errm);
+
+			/* continue from the last record on subsequent calls */
+			startlsn = InvalidXLogRecPtr;
+
+			/*
+			 * Nothing reaches the output plugin in fast-forward mode, but the
+			 * snapshot builder and the slot's xmin and restart_lsn still
+			 * follow the WAL.
+			 */
+			if (record != NULL)
+				LogicalDecodingProcessRecord(ctx, ctx->reader);
+
+			CHECK_FOR_INTERRUPTS();
+		}
+
+		CurrentResourceOwner = old_resowner;
+
+		if (ctx->reader->EndRecPtr != InvalidXLogRecPtr && retlsn < moveto)
+		{
+			LogicalConfirmReceivedLocation(moveto);
+
+			/*
+			 * LogicalConfirmReceivedLocation() only writes the slot out when
+			 * xmin or restart_lsn moved; make sure the new confirmed_flush is
+			 * not lost on restart either.
+			 */
+			ReplicationSlotMarkDirty();
+			ReplicationSlotSave();
+
+			retlsn = moveto;
+		}
+
+		/* free context, no shutdown callback in fast-forward mode */
+		FreeDecodingContext(ctx);
+
+		InvalidateSystemCaches();
+	}
+	PG_CATCH();
+	{
+		/* clear all timetravel entries */
+		InvalidateSystemCaches();
+
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
+
+	return retlsn;
+}
+
+/*
+ * SQL function for moving a replication slot forward to upto_lsn without
+ * consuming the changes in between.
+ *
+ * For a logical slot this is much cheaper than pg_logical_slot_get_changes()
+ * with its output thrown away, since nothing is decoded or handed to the
+ * output plugin. The target is capped at the current end of WAL; a slot is
+ * never moved backwards.
+ */
+Datum
+pg_replication_slot_advance(PG_FUNCTION_ARGS)
+{
+	Name		slotname = PG_GETARG_NAME(0);
+	XLogRecPtr	moveto = PG_GETARG_LSN(1);
+	XLogRecPtr	endlsn;
+	XLogRecPtr	minlsn;
+	TupleDesc	tupdesc;
+	Datum		values[2];
+	bool		nulls[2];
+	HeapTuple	tuple;
+	Datum		result;
+
+	Assert(!MyReplicationSlot);
+
+	check_permissions();
+
+	if (XLogRecPtrIsInvalid(moveto))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("invalid target WAL location")));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	/* don't wait for WAL that doesn't exist yet */
+	if (!RecoveryInProgress())
+		moveto = Min(moveto, GetFlushRecPtr());
+	else
+		moveto = Min(moveto, GetXLogReplayRecPtr(NULL));
+
+	ReplicationSlotAcquire(NameStr(*slotname));
+
+	if (XLogRecPtrIsInvalid(MyReplicationSlot->data.restart_lsn))
+		ereport(ERROR,
+				(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+				 errmsg("cannot advance replication slot that has not previously reserved WAL")));
+
+	if (SlotIsLogical(MyReplicationSlot))
+		minlsn = MyReplicationSlot->data.confirmed_flush;
+	else
+		minlsn = MyReplicationSlot->data.restart_lsn;
+
+	if (moveto < minlsn)
+		endlsn = minlsn;
+	else if (SlotIsLogical(MyReplicationSlot))
+		endlsn = pg_logical_replication_slot_advance(moveto);
+	else
+		endlsn = pg_physical_replication_slot_advance(moveto);
+
+	ReplicationSlotRelease();
+
+	values[0] = NameGetDatum(slotname);
+	nulls[0] = false;
+	values[1] = LSNGetDatum(endlsn);
+	nulls[1] = false;
+
+	tuple = heap_form_tuple(tupdesc, values, nulls);
+	result = HeapTupleGetDatum(tuple);
+
+	PG_RETURN_DATUM(result);
+}
+
 /*
  * pg_get_replication_slots - SQL SRF showing active replication slots.
  */
@@ -199,6 +199,7 @@ static void XLogSendPhysical(void);
 static void XLogSendLogical(void);
 static void WalSndDone(WalSndSendDataCallback send_data);
 static XLogRecPtr GetStandbyFlushRecPtr(void);
+static void WalSndUpdateLogicalTimeLine(XLogRecPtr targetPagePtr);
 static void IdentifySystem(void);
 static void CreateReplicationSlot(CreateReplicationSlotCmd *cmd);
 static void DropReplicationSlot(DropReplicationSlotCmd *cmd);
@@ -759,6 +760,9 @@ logical_read_xlog_page(XLogReaderState *state, XLogRecPtr targetPagePtr, int req
 	/* make sure we have enough WAL available */
 	flushptr = WalSndWaitForWal(targetPagePtr + reqLen);
 
+	/* on a standby, the page may be on an older timeline than replay */
+	WalSndUpdateLogicalTimeLine(targetPagePtr);
+
 	/* more than one block available */
 	if (targetPagePtr + XLOG_BLCKSZ <= flushptr)
 		count = XLOG_BLCKSZ;
@@ -775,6 +779,45 @@ logical_read_xlog_page(XLogReaderState *state, XLogRecPtr targetPagePtr, int req
 	return count;
 }
 
+/*
+ * Set up XLogRead() to read the page at targetPagePtr during logical
+ * decoding.
+ *
+ * On a primary everything is read from our own timeline, but a standby
+ * may follow timeline switches of its primary while we decode, and the
+ * WAL we are still reading then belongs to an older one.  As a side-effect,
+ * ThisTimeLineID is updated to the TLI of the last replayed WAL record.
+ */
+static void
+WalSndUpdateLogicalTimeLine(XLogRecPtr targetPagePtr)
+{
+	List	   *history;
+
+	if (RecoveryInProgress())
+		(void) GetXLogReplayRecPtr(&ThisTimeLineID);
+
+	/* nothing to do while the timeline we read from is still valid */
+	if (sendTimeLine == ThisTimeLineID && !sendTimeLineIsHistoric)
+		return;
+	if (sendTimeLineIsHistoric && targetPagePtr < sendTimeLineValidUpto)
+		return;
+
+	history = readTimeLineHistory(ThisTimeLineID);
+	sendTimeLine = tliOfPointInHistory(targetPagePtr, history);
+	if (sendTimeLine == ThisTimeLineID)
+	{
+		sendTimeLineIsHistoric = false;
+		sendTimeLineValidUpto = InvalidXLogRecPtr;
+	}
+	else
+	{
+		sendTimeLineIsHistoric = true;
+		sendTimeLineValidUpto = tliSwitchPoint(sendTimeLine, history,
+											   &sendTimeLineNextTLI);
+	}
+	list_free_deep(history);
+}
+
 /*
  * Create a new replication slot.
  */
@@ -993,7 +1036,7 @@ StartLogicalReplication(StartReplicationCmd *cmd)
 	elog(WARNING, "%d: StartLogicalReplication for slot %s startpoint %lx", MyProcPid, NameStr(MyReplicationSlot->data.name), cmd->startpoint);
 
 	logical_decoding_ctx = CreateDecodingContext(
-											   cmd->startpoint, cmd->options,
+											   cmd->startpoint, cmd->options, false,
 												 logical_read_xlog_page,
 										WalSndPrepareWrite, WalSndWriteData);
 
@@ -2456,7 +2499,8 @@ XLogSendLogical(void)
 		 * If the record we just wanted read is at or beyond the flushed
 		 * point, then we're caught up.
 		 */
-		if (logical_decoding_ctx->reader->EndRecPtr >= GetFlushRecPtr()) {
+		if (logical_decoding_ctx->reader->EndRecPtr >=
+			(RecoveryInProgress() ? GetXLogReplayRecPtr(NULL) : GetFlushRecPtr())) {
 			WalSndCaughtUp = true;
 			LogicalDecodingCaughtUp(logical_decoding_ctx);
 		}
@@ -44,10 +44,12 @@
 #include "postmaster/bgwriter.h"
 #include "storage/buf_internals.h"
 #include "storage/bufmgr.h"
+#include "storage/doublewrite.h"
 #include "storage/ipc.h"
 #include "storage/proc.h"
 #include "storage/smgr.h"
 #include "storage/standby.h"
+#include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/resowner_private.h"
 #include "utils/timestamp.h"
@@ -73,8 +75,13 @@ typedef struct PrivateRefCountEntry
 	int32		refcount;
 } PrivateRefCountEntry;
 
-/* 64 bytes, about the size of a cache line on common systems */
-#define REFCOUNT_ARRAY_ENTRIES 8
+/*
+ * Each set of the private refcount array is 64 bytes, about the size of a
+ * cache line on common systems.
+ */
+#define REFCOUNT_ARRAY_WAYS 8
+#define REFCOUNT_ARRAY_SETS 16
+#define REFCOUNT_ARRAY_ENTRIES (REFCOUNT_ARRAY_WAYS * REFCOUNT_ARRAY_SETS)
 
 /*
  * Status of buffers to checkpoint for a particular tablespace, used
@@ -119,6 +126,9 @@ int			checkpoint_flush_after = 0;
 int			bgwriter_flush_after = 0;
 int			backend_flush_after = 0;
 
+/* Asynchronous writes kept in flight by FlushStagedWrites, 0 = don't */
+int			write_queue_depth = 0;
+
 /*
  * How many buffers PrefetchBuffer callers should try to stay ahead of their
  * ReadBuffer calls by.  This is maintained by the assign hook for
@@ -132,6 +142,34 @@ int			target_prefetch_pages = 0;
 static BufferDesc *InProgressBuf = NULL;
 static bool IsForInput;
 
+/*
+ * With the double-write buffer, or with write_queue_depth set, the
+ * checkpointer and the bgwriter write buffers in batches.  The copies of a
+ * batch share one fsync of the double-write file, and their data file writes
+ * are issued asynchronously, write_queue_depth at a time.
+ * StageBufferWrite() copies a buffer, and writes the copy to the
+ * double-write file if that is used, without keeping the buffer busy.
+ * FlushStagedWrites() writes the copies to the data files once they are
+ * durable, skipping buffers that were modified or written by someone else
+ * in the meantime.
+ */
+#define STAGED_WRITES_MAX	MAX_WRITE_QUEUE_DEPTH
+
+typedef struct StagedWrite
+{
+	int			buf_id;
+	BufferTag	tag;
+	DoubleWriteSlot slot;		/* or InvalidDoubleWriteSlot */
+	bool		io_started;		/* have we set BM_IO_IN_PROGRESS? */
+	bool		write_started;	/* is the write in flight? */
+	SMgrAsyncWrite write;
+} StagedWrite;
+
+static StagedWrite StagedWrites[STAGED_WRITES_MAX];
+static int	NumStagedWrites = 0;
+static char *StagedPages = NULL;
+static WritebackContext *StagedWritebackContext = NULL;
+
 /* local state for LockBufferForCleanup */
 static BufferDesc *PinCountWaitBuf = NULL;
 
@@ -146,30 +184,42 @@ static BufferDesc *PinCountWaitBuf = NULL;
  *
  *
  * To avoid - as we used to - requiring an array with NBuffers entries to keep
- * track of local buffers, we use a small sequentially searched array
+ * track of local buffers, we use a small set-associative array
  * (PrivateRefCountArray) and an overflow hash table (PrivateRefCountHash) to
  * keep track of backend local pins.
  *
- * Until no more than REFCOUNT_ARRAY_ENTRIES buffers are pinned at once, all
- * refcounts are kept track of in the array; after that, new array entries
- * displace old ones into the hash table. That way a frequently used entry
- * can't get "stuck" in the hashtable while infrequent ones clog the array.
+ * A buffer can only live in the set of REFCOUNT_ARRAY_WAYS entries selected
+ * by its buffer number, so a lookup never scans more than one cache line, no
+ * matter how many sets there are.  When a set is full, new entries displace
+ * old ones into the hash table.  That way a frequently used entry can't get
+ * "stuck" in the hashtable while infrequent ones clog the array.
  *
  * Note that in most scenarios the number of pinned buffers will not exceed
- * REFCOUNT_ARRAY_ENTRIES.
+ * REFCOUNT_ARRAY_ENTRIES, and they'll rarely pile up in a single set.
  *
  *
- * To enter a buffer into the refcount tracking mechanism first reserve a free
+ * To enter a buffer into the refcount tracking mechanism first reserve an
  * entry using ReservePrivateRefCountEntry() and then later, if necessary,
  * fill it with NewPrivateRefCountEntry(). That split lets us avoid doing
  * memory allocations in NewPrivateRefCountEntry() which can be important
- * because in some scenarios it's called with a spinlock held...
+ * because in some scenarios it's called with a spinlock held...  Since we
+ * don't know the buffer when reserving, NewPrivateRefCountEntry() parks an
+ * entry displaced from a full set in PrivateRefCountSpare; the next
+ * reservation moves it on into the hash table.
  */
-static struct PrivateRefCountEntry PrivateRefCountArray[REFCOUNT_ARRAY_ENTRIES];
+static PrivateRefCountEntry PrivateRefCountArray[REFCOUNT_ARRAY_SETS][REFCOUNT_ARRAY_WAYS]
+#if defined(pg_attribute_aligned)
+			pg_attribute_aligned(64)
+#endif
+			;
+static PrivateRefCountEntry PrivateRefCountSpare;
 static HTAB *PrivateRefCountHash = NULL;
 static int32 PrivateRefCountOverflowed = 0;
 static uint32 PrivateRefCountClock = 0;
-static PrivateRefCountEntry *ReservedRefCountEntry = NULL;
+static bool PrivateRefCountReserved = false;
+
+#define PrivateRefCountSet(buffer) \
+	(PrivateRefCountArray[(uint32) (buffer) % REFCOUNT_ARRAY_SETS])
 
 static void ReservePrivateRefCountEntry(void);
 static PrivateRefCountEntry *NewPrivateRefCountEntry(Buffer buffer);
@@ -178,87 +228,88 @@ static inline int32 GetPrivateRefCount(Buffer buffer);
 static void ForgetPrivateRefCountEntry(PrivateRefCountEntry *ref);
 
 /*
- * Ensure that the PrivateRefCountArray has sufficient space to store one more
- * entry. This has to be called before using NewPrivateRefCountEntry() to fill
- * a new entry - but it's perfectly fine to not use a reserved entry.
+ * Move an array entry into the overflow hashtable, freeing its slot.
  */
 static void
-ReservePrivateRefCountEntry(void)
+PrivateRefCountSpill(PrivateRefCountEntry *ref)
 {
-	/* Already reserved (or freed), nothing to do */
-	if (ReservedRefCountEntry != NULL)
-		return;
+	PrivateRefCountEntry *hashent;
+	bool		found;
 
-	/*
-	 * First search for a free entry the array, that'll be sufficient in the
-	 * majority of cases.
-	 */
-	{
-		int			i;
+	/* Better be used, otherwise we shouldn't get here. */
+	Assert(ref->buffer != InvalidBuffer);
 
-		for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++)
-		{
-			PrivateRefCountEntry *res;
+	hashent = hash_search(PrivateRefCountHash,
+						  (void *) &(ref->buffer),
+						  HASH_ENTER,
+						  &found);
+	Assert(!found);
+	hashent->refcount = ref->refcount;
 
-			res = &PrivateRefCountArray[i];
+	/* clear the now free array slot */
+	ref->buffer = InvalidBuffer;
+	ref->refcount = 0;
 
-			if (res->buffer == InvalidBuffer)
-			{
-				ReservedRefCountEntry = res;
-				return;
-			}
-		}
-	}
+	PrivateRefCountOverflowed++;
+}
+
+/*
+ * Ensure that NewPrivateRefCountEntry() can store one more entry without
+ * allocating memory. This has to be called before using
+ * NewPrivateRefCountEntry() to fill a new entry - but it's perfectly fine to
+ * not use a reserved entry.
+ */
+static void
+ReservePrivateRefCountEntry(void)
+{
+	/* Already reserved, nothing to do */
+	if (PrivateRefCountReserved)
+		return;
 
 	/*
-	 * No luck. All array entries are full. Move one array entry into the hash
-	 * table.
+	 * If the last NewPrivateRefCountEntry() call had to displace an entry
+	 * from a full set, move that into the hashtable now that we're allowed
+	 * to allocate.
 	 */
-	{
-		/*
-		 * Move entry from the current clock position in the array into the
-		 * hashtable. Use that slot.
-		 */
-		PrivateRefCountEntry *hashent;
-		bool		found;
-
-		/* select victim slot */
-		ReservedRefCountEntry =
-			&PrivateRefCountArray[PrivateRefCountClock++ % REFCOUNT_ARRAY_ENTRIES];
-
-		/* Better be used, otherwise we shouldn't get here. */
-		Assert(ReservedRefCountEntry->buffer != InvalidBuffer);
-
-		/* enter victim array entry into hashtable */
-		hashent = hash_search(PrivateRefCountHash,
-							  (void *) &(ReservedRefCountEntry->buffer),
-							  HASH_ENTER,
-							  &found);
-		Assert(!found);
-		hashent->refcount = ReservedRefCountEntry->refcount;
+	if (PrivateRefCountSpare.buffer != InvalidBuffer)
+		PrivateRefCountSpill(&PrivateRefCountSpare);
 
-		/* clear the now free array slot */
-		ReservedRefCountEntry->buffer = InvalidBuffer;
-		ReservedRefCountEntry->refcount = 0;
-
-		PrivateRefCountOverflowed++;
-	}
+	PrivateRefCountReserved = true;
 }
 
 /*
- * Fill a previously reserved refcount entry.
+ * Fill a new refcount entry, using up the reservation.
  */
 static PrivateRefCountEntry *
 NewPrivateRefCountEntry(Buffer buffer)
 {
-	PrivateRefCountEntry *res;
+	PrivateRefCountEntry *set = PrivateRefCountSet(buffer);
+	PrivateRefCountEntry *res = NULL;
+	int			i;
 
 	/* only allowed to be called when a reservation has been made */
-	Assert(ReservedRefCountEntry != NULL);
+	Assert(PrivateRefCountReserved);
+	PrivateRefCountReserved = false;
+
+	for (i = 0; i < REFCOUNT_ARRAY_WAYS; i++)
+	{
+		if (set[i].buffer == InvalidBuffer)
+		{
+			res = &set[i];
+			break;
+		}
+	}
 
-	/* use up the reserved entry */
-	res = ReservedRefCountEntry;
-	ReservedRefCountEntry = NULL;
+	if (res == NULL)
+	{
+		/*
+		 * The set is full. Displace the entry at the current clock position
+		 * into the spare slot, which the reservation guaranteed to be free.
+		 */
+		res = &set[PrivateRefCountClock++ % REFCOUNT_ARRAY_WAYS];
+		Assert(PrivateRefCountSpare.buffer == InvalidBuffer);
+		PrivateRefCountSpare = *res;
+	}
 
 	/* and fill it */
 	res->buffer = buffer;
@@ -277,6 +328,7 @@ NewPrivateRefCountEntry(Buffer buffer)
 static PrivateRefCountEntry *
 GetPrivateRefCountEntry(Buffer buffer, bool do_move)
 {
+	PrivateRefCountEntry *set;
 	PrivateRefCountEntry *res;
 	int			i;
 
@@ -284,17 +336,19 @@ GetPrivateRefCountEntry(Buffer buffer, bool do_move)
 	Assert(!BufferIsLocal(buffer));
 
 	/*
-	 * First search for references in the array, that'll be sufficient in the
-	 * majority of cases.
+	 * First search for references in the buffer's set of the array, that'll
+	 * be sufficient in the majority of cases.
 	 */
-	for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++)
+	set = PrivateRefCountSet(buffer);
+	for (i = 0; i < REFCOUNT_ARRAY_WAYS; i++)
 	{
-		res = &PrivateRefCountArray[i];
-
-		if (res->buffer == buffer)
-			return res;
+		if (set[i].buffer == buffer)
+			return &set[i];
 	}
 
+	if (PrivateRefCountSpare.buffer == buffer)
+		return &PrivateRefCountSpare;
+
 	/*
 	 * By here we know that the buffer, if already pinned, isn't residing in
 	 * the array.
@@ -319,22 +373,10 @@ GetPrivateRefCountEntry(Buffer buffer, bool do_move)
 	}
 	else
 	{
-		/* move buffer from hashtable into the free array slot */
+		/* move buffer from hashtable into a slot of its set */
 		bool		found;
-		PrivateRefCountEntry *free;
-
-		/* Ensure there's a free array slot */
-		ReservePrivateRefCountEntry();
-
-		/* Use up the reserved slot */
-		Assert(ReservedRefCountEntry != NULL);
-		free = ReservedRefCountEntry;
-		ReservedRefCountEntry = NULL;
-		Assert(free->buffer == InvalidBuffer);
-
-		/* and fill it */
-		free->buffer = buffer;
-		free->refcount = res->refcount;
+		int32		refcount = res->refcount;
+		PrivateRefCountEntry *free = NULL;
 
 		/* delete from hashtable */
 		hash_search(PrivateRefCountHash,
@@ -345,6 +387,26 @@ GetPrivateRefCountEntry(Buffer buffer, bool do_move)
 		Assert(PrivateRefCountOverflowed > 0);
 		PrivateRefCountOverflowed--;
 
+		for (i = 0; i < REFCOUNT_ARRAY_WAYS; i++)
+		{
+			if (set[i].buffer == InvalidBuffer)
+			{
+				free = &set[i];
+				break;
+			}
+		}
+
+		/* no free slot, swap with the entry at the clock position */
+		if (free == NULL)
+		{
+			free = &set[PrivateRefCountClock++ % REFCOUNT_ARRAY_WAYS];
+			PrivateRefCountSpill(free);
+		}
+
+		/* and fill it */
+		free->buffer = buffer;
+		free->refcount = refcount;
+
 		return free;
 	}
 }
@@ -382,17 +444,11 @@ ForgetPrivateRefCountEntry(PrivateRefCountEntry *ref)
 {
 	Assert(ref->refcount == 0);
 
-	if (ref >= &PrivateRefCountArray[0] &&
-		ref < &PrivateRefCountArray[REFCOUNT_ARRAY_ENTRIES])
+	if ((ref >= &PrivateRefCountArray[0][0] &&
+		 ref < &PrivateRefCountArray[0][0] + REFCOUNT_ARRAY_ENTRIES) ||
+		ref == &PrivateRefCountSpare)
 	{
 		ref->buffer = InvalidBuffer;
-
-		/*
-		 * Mark the just used entry as reserved - in many scenarios that
-		 * allows us to avoid ever having to search the array/hash for free
-		 * entries.
-		 */
-		ReservedRefCountEntry = ref;
 	}
 	else
 	{
@@ -438,6 +494,13 @@ static void UnpinBuffer(BufferDesc *buf, bool fixOwner);
 static void BufferSync(int flags);
 static uint32 WaitBufHdrUnlocked(BufferDesc *buf);
 static int	SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *flush_context);
+static bool StageBufferWrite(BufferDesc *buf, WritebackContext *wb_context);
+static void FlushStagedWrites(void);
+static void FinishStagedWrite(StagedWrite *staged);
+static void StagedWriteDone(StagedWrite *staged);
+static void AbortStagedWrites(void);
+static void FinishBufferIO(BufferDesc *buf, bool clear_dirty,
+			   uint32 set_flag_bits);
 static void WaitIO(BufferDesc *buf);
 static bool StartBufferIO(BufferDesc *buf, bool forInput);
 static void TerminateBufferIO(BufferDesc *buf, bool clear_dirty,
@@ -547,42 +610,62 @@ PrefetchBuffer(Relation reln, ForkNumber forkNum, BlockNumber blockNum)
 		LocalPrefetchBuffer(reln->rd_smgr, forkNum, blockNum);
 	}
 	else
-	{
-		BufferTag	newTag;		/* identity of requested block */
-		uint32		newHash;	/* hash value for newTag */
-		LWLock	   *newPartitionLock;	/* buffer partition lock for it */
-		int			buf_id;
-
-		/* create a tag so we can lookup the buffer */
-		INIT_BUFFERTAG(newTag, reln->rd_smgr->smgr_rnode.node,
-					   forkNum, blockNum);
-
-		/* determine its hash code and partition lock ID */
-		newHash = BufTableHashCode(&newTag);
-		newPartitionLock = BufMappingPartitionLock(newHash);
-
-		/* see if the block is in the buffer pool already */
-		LWLockAcquire(newPartitionLock, LW_SHARED);
-		buf_id = BufTableLookup(&newTag, newHash);
-		LWLockRelease(newPartitionLock);
+		PrefetchSharedBuffer(reln->rd_smgr, forkNum, blockNum);
+#endif   /* USE_PREFETCH */
+}
+
+/*
+ * PrefetchSharedBuffer -- PrefetchBuffer for a shared relation known only
+ *		at the smgr level
+ *
+ * This is used by WAL replay, which has no relcache entries to work with.
+ * Returns true if a read was initiated, false if the block was found in
+ * shared buffers (or prefetching is not supported).
+ */
+bool
+PrefetchSharedBuffer(SMgrRelation smgr_reln, ForkNumber forkNum,
+					 BlockNumber blockNum)
+{
+#ifdef USE_PREFETCH
+	BufferTag	newTag;		/* identity of requested block */
+	uint32		newHash;	/* hash value for newTag */
+	LWLock	   *newPartitionLock;	/* buffer partition lock for it */
+	int			buf_id;
 
-		/* If not in buffers, initiate prefetch */
-		if (buf_id < 0)
-			smgrprefetch(reln->rd_smgr, forkNum, blockNum);
+	/* create a tag so we can lookup the buffer */
+	INIT_BUFFERTAG(newTag, smgr_reln->smgr_rnode.node,
+				   forkNum, blockNum);
 
-		/*
-		 * If the block *is* in buffers, we do nothing.  This is not really
-		 * ideal: the block might be just about to be evicted, which would be
-		 * stupid since we know we are going to need it soon.  But the only
-		 * easy answer is to bump the usage_count, which does not seem like a
-		 * great solution: when the caller does ultimately touch the block,
-		 * usage_count would get bumped again, resulting in too much
-		 * favoritism for blocks that are involved in a prefetch sequence. A
-		 * real fix would involve some additional per-buffer state, and it's
-		 * not clear that there's enough of a problem to justify that.
-		 */
+	/* determine its hash code and partition lock ID */
+	newHash = BufTableHashCode(&newTag);
+	newPartitionLock = BufMappingPartitionLock(newHash);
+
+	/* see if the block is in the buffer pool already */
+	LWLockAcquire(newPartitionLock, LW_SHARED);
+	buf_id = BufTableLookup(&newTag, newHash);
+	LWLockRelease(newPartitionLock);
+
+	/* If not in buffers, initiate prefetch */
+	if (buf_id < 0)
+	{
+		smgrprefetch(smgr_reln, forkNum, blockNum);
+		return true;
 	}
+
+	/*
+	 * If the block *is* in buffers, we do nothing.  This is not really
+	 * ideal: the block might be just about to be evicted, which would be
+	 * stupid since we know we are going to need it soon.  But the only
+	 * easy answer is to bump the usage_count, which does not seem like a
+	 * great solution: when the caller does ultimately touch the block,
+	 * usage_count would get bumped again, resulting in too much
+	 * favoritism for blocks that are involved in a prefetch sequence. A
+	 * real fix would involve some additional per-buffer state, and it's
+	 * not clear that there's enough of a problem to justify that.
+	 */
 #endif   /* USE_PREFETCH */
+
+	return false;
 }
 
 
@@ -1290,8 +1373,9 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 	 *
 	 * Clearing BM_VALID here is necessary, clearing the dirtybits is just
 	 * paranoia.  We also reset the usage_count since any recency of use of
-	 * the old content is no longer relevant.  (The usage_count starts out at
-	 * 1 so that the buffer can survive one clock-sweep pass.)
+	 * the old content is no longer relevant.  (The usage_count normally
+	 * starts out at 1 so that the buffer can survive one clock-sweep pass;
+	 * see StrategyInitialUsage for the exceptions.)
 	 *
 	 * Make sure BM_PERMANENT is set for buffers that must be written at every
 	 * checkpoint.  Unlogged buffers only need to be written at shutdown
@@ -1303,9 +1387,10 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 				   BM_CHECKPOINT_NEEDED | BM_IO_ERROR | BM_PERMANENT |
 				   BUF_USAGECOUNT_MASK);
 	if (relpersistence == RELPERSISTENCE_PERMANENT || forkNum == INIT_FORKNUM)
-		buf_state |= BM_TAG_VALID | BM_PERMANENT | BUF_USAGECOUNT_ONE;
+		buf_state |= BM_TAG_VALID | BM_PERMANENT;
 	else
-		buf_state |= BM_TAG_VALID | BUF_USAGECOUNT_ONE;
+		buf_state |= BM_TAG_VALID;
+	buf_state |= StrategyInitialUsage(newHash, strategy);
 
 	UnlockBufHdr(buf, buf_state);
 
@@ -1314,6 +1399,10 @@ BufferAlloc(SMgrRelation smgr, char relpersistence, ForkNumber forkNum,
 		BufTableDelete(&oldTag, oldHash);
 		if (oldPartitionLock != newPartitionLock)
 			LWLockRelease(oldPartitionLock);
+
+		/* remember the old page, unless it was recycled by a ring */
+		if (strategy == NULL)
+			StrategyEvictedBuffer(oldHash);
 	}
 
 	LWLockRelease(newPartitionLock);
@@ -2014,6 +2103,8 @@ BufferSync(int flags)
 		CheckpointWriteDelay(flags, (double) num_processed / num_to_scan);
 	}
 
+	FlushStagedWrites();
+
 	/* issue all pending flushes */
 	IssuePendingWritebacks(&wb_context);
 
@@ -2290,6 +2381,8 @@ BgBufferSync(WritebackContext *wb_context)
 			reusable_buffers++;
 	}
 
+	FlushStagedWrites();
+
 	BgWriterStats.m_buf_written_clean += num_written;
 
 #ifdef BGW_DEBUG
@@ -2389,6 +2482,20 @@ SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
 	 * buffer is clean by the time we've locked it.)
 	 */
 	PinBuffer_Locked(bufHdr);
+
+	/*
+	 * With the double-write buffer or asynchronous writes, the write is done
+	 * as part of a batch.  Not for unlogged buffers, whose LSNs may be fake.
+	 */
+	if ((DoubleWriteEnabled() || write_queue_depth > 0) &&
+		(buf_state & BM_PERMANENT))
+	{
+		if (StageBufferWrite(bufHdr, wb_context))
+			result |= BUF_WRITTEN;
+		UnpinBuffer(bufHdr, true);
+		return result;
+	}
+
 	LWLockAcquire(BufferDescriptorGetContentLock(bufHdr), LW_SHARED);
 
 	FlushBuffer(bufHdr, NULL);
@@ -2404,6 +2511,356 @@ SyncOneBuffer(int buf_id, bool skip_recently_used, WritebackContext *wb_context)
 	return result | BUF_WRITTEN;
 }
 
+/*
+ * StageBufferWrite -- add a buffer to the batch of staged buffers.
+ *
+ * The page is copied and the copy written to the double-write file now, if
+ * that is enabled; the data file write happens in FlushStagedWrites().
+ * Returns false if the buffer needed no write after all.
+ *
+ * The caller must hold a pin on the buffer.  Other processes may need our
+ * staged slots finished before they can get a slot of their own, while
+ * holding content locks, so we never wait for a content lock, or for room
+ * in the double-write buffer, while writes are staged.
+ */
+static bool
+StageBufferWrite(BufferDesc *buf, WritebackContext *wb_context)
+{
+	LWLock	   *content_lock = BufferDescriptorGetContentLock(buf);
+	StagedWrite *staged;
+	DoubleWriteSlot slot;
+	XLogRecPtr	recptr;
+	uint32		buf_state;
+	char	   *page;
+
+	if (NumStagedWrites == STAGED_WRITES_MAX)
+		FlushStagedWrites();
+	StagedWritebackContext = wb_context;
+
+	if (!LWLockConditionalAcquire(content_lock, LW_SHARED))
+	{
+		FlushStagedWrites();
+		LWLockAcquire(content_lock, LW_SHARED);
+	}
+
+	if (!DoubleWriteEnabled())
+		slot = InvalidDoubleWriteSlot;
+	else if ((slot = DoubleWriteReserve(false)) == InvalidDoubleWriteSlot)
+	{
+		/* Making room may need our staged writes, so finish them first */
+		if (NumStagedWrites > 0)
+		{
+			LWLockRelease(content_lock);
+			FlushStagedWrites();
+			LWLockAcquire(content_lock, LW_SHARED);
+		}
+		slot = DoubleWriteReserve(true);
+	}
+
+	/*
+	 * Nothing to do if the buffer is clean by now.  Nor if someone else is
+	 * writing it: that write started after any change not made under a
+	 * share lock, since the writer holds one too.
+	 */
+	buf_state = LockBufHdr(buf);
+	if (!(buf_state & BM_DIRTY) || (buf_state & BM_IO_IN_PROGRESS))
+	{
+		UnlockBufHdr(buf, buf_state);
+		LWLockRelease(content_lock);
+		if (slot != InvalidDoubleWriteSlot)
+			DoubleWriteDone(slot);
+		return false;
+	}
+
+	/* Like FlushBuffer, see the comments there */
+	recptr = BufferGetLSN(buf);
+	buf_state &= ~BM_JUST_DIRTIED;
+	UnlockBufHdr(buf, buf_state);
+
+	XLogFlush(recptr);
+
+	if (StagedPages == NULL)
+		StagedPages = MemoryContextAlloc(TopMemoryContext,
+										 STAGED_WRITES_MAX * BLCKSZ);
+	page = StagedPages + NumStagedWrites * BLCKSZ;
+	memcpy(page, BufHdrGetBlock(buf), BLCKSZ);
+	PageSetChecksumInplace((Page) page, buf->tag.blockNum);
+
+	if (slot != InvalidDoubleWriteSlot)
+		DoubleWriteCopy(slot, &buf->tag, page);
+
+	staged = &StagedWrites[NumStagedWrites++];
+	staged->buf_id = buf->buf_id;
+	staged->tag = buf->tag;
+	staged->slot = slot;
+	staged->io_started = false;
+	staged->write_started = false;
+
+	LWLockRelease(content_lock);
+
+	return true;
+}
+
+/*
+ * FlushStagedWrites -- write the staged buffers to their data files.
+ *
+ * A staged copy may only be written if the buffer still holds the page, and
+ * the page was neither changed nor written since it was copied: BM_DIRTY
+ * without BM_JUST_DIRTIED says so, as both changes and the start of another
+ * write would have set or cleared them.  Buffers that were changed are
+ * written again the ordinary way, after all our slots are finished.
+ *
+ * With write_queue_depth set, up to that many writes are in flight at once.
+ * Since it's the copy that is written, the content lock is released as soon
+ * as the I/O is marked in progress; a change made meanwhile sets
+ * BM_JUST_DIRTIED, which keeps the buffer dirty when the write completes.
+ */
+static void
+FlushStagedWrites(void)
+{
+	int			retry[STAGED_WRITES_MAX];
+	int			nretry = 0;
+	int			ninflight = 0;
+	int			oldest = 0;
+	int			i;
+
+	if (NumStagedWrites == 0)
+		return;
+
+	if (StagedWrites[NumStagedWrites - 1].slot != InvalidDoubleWriteSlot)
+		DoubleWriteFlush(StagedWrites[NumStagedWrites - 1].slot);
+
+	for (i = 0; i < NumStagedWrites; i++)
+	{
+		StagedWrite *staged = &StagedWrites[i];
+		BufferDesc *buf = GetBufferDescriptor(staged->buf_id);
+		LWLock	   *content_lock = BufferDescriptorGetContentLock(buf);
+		SMgrRelation reln;
+		uint32		buf_state;
+
+		ReservePrivateRefCountEntry();
+		ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+
+		buf_state = LockBufHdr(buf);
+		if (!BUFFERTAGS_EQUAL(buf->tag, staged->tag) ||
+			(buf_state & (BM_VALID | BM_DIRTY)) != (BM_VALID | BM_DIRTY))
+		{
+			/* It was written or evicted meanwhile */
+			UnlockBufHdr(buf, buf_state);
+			StagedWriteDone(staged);
+			continue;
+		}
+		PinBuffer_Locked(buf);
+
+		if (!LWLockConditionalAcquire(content_lock, LW_SHARED))
+		{
+			UnpinBuffer(buf, true);
+			StagedWriteDone(staged);
+			retry[nretry++] = i;
+			continue;
+		}
+
+		/* Same as StartBufferIO, but without waiting */
+		if (!LWLockConditionalAcquire(BufferDescriptorGetIOLock(buf),
+									  LW_EXCLUSIVE))
+		{
+			LWLockRelease(content_lock);
+			UnpinBuffer(buf, true);
+			StagedWriteDone(staged);
+			retry[nretry++] = i;
+			continue;
+		}
+		buf_state = LockBufHdr(buf);
+		if ((buf_state & (BM_DIRTY | BM_JUST_DIRTIED | BM_IO_IN_PROGRESS)) !=
+			BM_DIRTY)
+		{
+			UnlockBufHdr(buf, buf_state);
+			LWLockRelease(BufferDescriptorGetIOLock(buf));
+			LWLockRelease(content_lock);
+			UnpinBuffer(buf, true);
+			StagedWriteDone(staged);
+			if (buf_state & BM_DIRTY)
+				retry[nretry++] = i;
+			continue;
+		}
+		buf_state |= BM_IO_IN_PROGRESS;
+		UnlockBufHdr(buf, buf_state);
+		staged->io_started = true;
+
+		LWLockRelease(content_lock);
+
+		reln = smgropen(staged->tag.rnode, InvalidBackendId);
+
+		if (write_queue_depth == 0)
+		{
+			ErrorContextCallback errcallback;
+
+			errcallback.callback = shared_buffer_write_error_callback;
+			errcallback.arg = (void *) buf;
+			errcallback.previous = error_context_stack;
+			error_context_stack = &errcallback;
+
+			smgrwrite(reln,
+					  staged->tag.forkNum,
+					  staged->tag.blockNum,
+					  StagedPages + i * BLCKSZ,
+					  false);
+
+			error_context_stack = errcallback.previous;
+
+			FinishStagedWrite(staged);
+			continue;
+		}
+
+		/* Make room in the queue by finishing the oldest writes */
+		while (ninflight >= write_queue_depth)
+		{
+			while (!StagedWrites[oldest].write_started)
+				oldest++;
+			FinishStagedWrite(&StagedWrites[oldest]);
+			ninflight--;
+		}
+
+		smgrstartwrite(reln,
+					   staged->tag.forkNum,
+					   staged->tag.blockNum,
+					   StagedPages + i * BLCKSZ,
+					   false,
+					   &staged->write);
+		staged->write_started = true;
+		ninflight++;
+	}
+
+	for (; ninflight > 0; ninflight--)
+	{
+		while (!StagedWrites[oldest].write_started)
+			oldest++;
+		FinishStagedWrite(&StagedWrites[oldest]);
+	}
+
+	NumStagedWrites = 0;
+
+	/* All our slots are finished, so the retries may wait now */
+	for (i = 0; i < nretry; i++)
+	{
+		StagedWrite *staged = &StagedWrites[retry[i]];
+		BufferDesc *buf = GetBufferDescriptor(staged->buf_id);
+		uint32		buf_state;
+
+		ReservePrivateRefCountEntry();
+		ResourceOwnerEnlargeBuffers(CurrentResourceOwner);
+
+		buf_state = LockBufHdr(buf);
+		if (!BUFFERTAGS_EQUAL(buf->tag, staged->tag) ||
+			(buf_state & (BM_VALID | BM_DIRTY)) != (BM_VALID | BM_DIRTY))
+		{
+			UnlockBufHdr(buf, buf_state);
+			continue;
+		}
+		PinBuffer_Locked(buf);
+		LWLockAcquire(BufferDescriptorGetContentLock(buf), LW_SHARED);
+		FlushBuffer(buf, NULL);
+		LWLockRelease(BufferDescriptorGetContentLock(buf));
+		UnpinBuffer(buf, true);
+
+		ScheduleBufferTagForWriteback(StagedWritebackContext, &staged->tag);
+	}
+}
+
+/*
+ * FinishStagedWrite -- complete the data file write of a staged buffer.
+ *
+ * Waits for the write if it is in flight, then ends the buffer's I/O and
+ * releases the buffer.
+ */
+static void
+FinishStagedWrite(StagedWrite *staged)
+{
+	BufferDesc *buf = GetBufferDescriptor(staged->buf_id);
+
+	if (staged->write_started)
+	{
+		ErrorContextCallback errcallback;
+
+		errcallback.callback = shared_buffer_write_error_callback;
+		errcallback.arg = (void *) buf;
+		errcallback.previous = error_context_stack;
+		error_context_stack = &errcallback;
+
+		smgrwaitwrite(&staged->write);
+		staged->write_started = false;
+
+		error_context_stack = errcallback.previous;
+	}
+
+	pgBufferUsage.shared_blks_written++;
+
+	FinishBufferIO(buf, true, 0);
+	staged->io_started = false;
+
+	StagedWriteDone(staged);
+	UnpinBuffer(buf, true);
+
+	ScheduleBufferTagForWriteback(StagedWritebackContext, &staged->tag);
+}
+
+/*
+ * StagedWriteDone -- release the double-write slot of a staged buffer.
+ */
+static void
+StagedWriteDone(StagedWrite *staged)
+{
+	if (staged->slot != InvalidDoubleWriteSlot)
+		DoubleWriteDone(staged->slot);
+}
+
+/*
+ * AbortStagedWrites -- forget about the staged writes after an error.
+ *
+ * The kernel may still be reading the copies of writes in flight, so we
+ * wait for those first.  Buffers whose I/O we started get BM_IO_ERROR, like
+ * in AbortBufferIO; they are still pinned, until the resource owner releases
+ * them.
+ */
+static void
+AbortStagedWrites(void)
+{
+	int			i;
+
+	for (i = 0; i < NumStagedWrites; i++)
+	{
+		StagedWrite *staged = &StagedWrites[i];
+
+		if (staged->write_started)
+		{
+			smgrabortwrite(&staged->write);
+			staged->write_started = false;
+		}
+		if (staged->io_started)
+		{
+			BufferDesc *buf = GetBufferDescriptor(staged->buf_id);
+
+			LWLockAcquire(BufferDescriptorGetIOLock(buf), LW_EXCLUSIVE);
+			FinishBufferIO(buf, false, BM_IO_ERROR);
+			staged->io_started = false;
+		}
+	}
+
+	NumStagedWrites = 0;
+}
+
+/*
+ * FlushBufferWriteBatch -- write out the buffers staged by SyncOneBuffer.
+ *
+ * Called at the end of a round of writes, and before the checkpointer
+ * sleeps, so that staged slots aren't held for long.
+ */
+void
+FlushBufferWriteBatch(void)
+{
+	FlushStagedWrites();
+}
+
 /*
  *		AtEOXact_Buffers - clean up at end of transaction.
  *
@@ -2439,6 +2896,7 @@ InitBufferPoolAccess(void)
 	HASHCTL		hash_ctl;
 
 	memset(&PrivateRefCountArray, 0, sizeof(PrivateRefCountArray));
+	memset(&PrivateRefCountSpare, 0, sizeof(PrivateRefCountSpare));
 
 	MemSet(&hash_ctl, 0, sizeof(hash_ctl));
 	hash_ctl.keysize = sizeof(int32);
@@ -2497,7 +2955,7 @@ CheckForBufferLeaks(void)
 	/* check the array */
 	for (i = 0; i < REFCOUNT_ARRAY_ENTRIES; i++)
 	{
-		res = &PrivateRefCountArray[i];
+		res = &PrivateRefCountArray[0][0] + i;
 
 		if (res->buffer != InvalidBuffer)
 		{
@@ -2506,6 +2964,12 @@ CheckForBufferLeaks(void)
 		}
 	}
 
+	if (PrivateRefCountSpare.buffer != InvalidBuffer)
+	{
+		PrintBufferLeakWarning(PrivateRefCountSpare.buffer);
+		RefCountErrors++;
+	}
+
 	/* if necessary search the hash */
 	if (PrivateRefCountOverflowed)
 	{
@@ -2573,12 +3037,21 @@ PrintBufferLeakWarning(Buffer buffer)
 void
 CheckPointBuffers(int flags)
 {
+	DoubleWriteSlot dw_horizon;
+
 	TRACE_POSTGRESQL_BUFFER_CHECKPOINT_START(flags);
 	CheckpointStats.ckpt_write_t = GetCurrentTimestamp();
 	BufferSync(flags);
 	CheckpointStats.ckpt_sync_t = GetCurrentTimestamp();
 	TRACE_POSTGRESQL_BUFFER_CHECKPOINT_SYNC_START();
+
+	/*
+	 * The fsyncs make the data file writes done so far durable, so their
+	 * double-write copies aren't needed afterwards.
+	 */
+	dw_horizon = DoubleWriteSyncStart();
 	smgrsync();
+	DoubleWriteSyncDone(dw_horizon);
 	CheckpointStats.ckpt_sync_end_t = GetCurrentTimestamp();
 	TRACE_POSTGRESQL_BUFFER_CHECKPOINT_DONE();
 }
@@ -2671,6 +3144,7 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 	Block		bufBlock;
 	char	   *bufToWrite;
 	uint32		buf_state;
+	DoubleWriteSlot dwslot = InvalidDoubleWriteSlot;
 
 	/*
 	 * Acquire the buffer's io_in_progress lock.  If StartBufferIO returns
@@ -2742,6 +3216,17 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 	 */
 	bufToWrite = PageSetChecksumCopy((Page) bufBlock, buf->tag.blockNum);
 
+	/*
+	 * With the double-write buffer, the copy must be durable before the data
+	 * file write may begin, so that a torn write can be repaired from it.
+	 */
+	if (DoubleWriteEnabled() && (buf_state & BM_PERMANENT))
+	{
+		dwslot = DoubleWriteReserve(true);
+		DoubleWriteCopy(dwslot, &buf->tag, bufToWrite);
+		DoubleWriteFlush(dwslot);
+	}
+
 	if (track_io_timing)
 		INSTR_TIME_SET_CURRENT(io_start);
 
@@ -2754,6 +3239,9 @@ FlushBuffer(BufferDesc *buf, SMgrRelation reln)
 			  bufToWrite,
 			  false);
 
+	if (dwslot != InvalidDoubleWriteSlot)
+		DoubleWriteDone(dwslot);
+
 	if (track_io_timing)
 	{
 		INSTR_TIME_SET_CURRENT(io_time);
@@ -3897,10 +4385,22 @@ StartBufferIO(BufferDesc *buf, bool forInput)
 static void
 TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
 {
-	uint32		buf_state;
-
 	Assert(buf == InProgressBuf);
 
+	InProgressBuf = NULL;
+
+	FinishBufferIO(buf, clear_dirty, set_flag_bits);
+}
+
+/*
+ * FinishBufferIO: the work of TerminateBufferIO, also used for the I/Os of
+ * staged writes, which aren't tracked by InProgressBuf.
+ */
+static void
+FinishBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
+{
+	uint32		buf_state;
+
 	buf_state = LockBufHdr(buf);
 
 	Assert(buf_state & BM_IO_IN_PROGRESS);
@@ -3912,8 +4412,6 @@ TerminateBufferIO(BufferDesc *buf, bool clear_dirty, uint32 set_flag_bits)
 	buf_state |= set_flag_bits;
 	UnlockBufHdr(buf, buf_state);
 
-	InProgressBuf = NULL;
-
 	LWLockRelease(BufferDescriptorGetIOLock(buf));
 }
 
@@ -3931,6 +4429,10 @@ AbortBufferIO(void)
 {
 	BufferDesc *buf = InProgressBuf;
 
+	/* Forget about the staged writes and release their slots */
+	AbortStagedWrites();
+	DoubleWriteAbort();
+
 	if (buf)
 	{
 		uint32		buf_state;
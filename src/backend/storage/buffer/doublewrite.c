@@ -0,0 +1,784 @@
+/*-------------------------------------------------------------------------
+ *
+ * doublewrite.c
+ *	  Double-write buffer protecting data pages from torn writes.
+ *
+ * A data page written while the system crashes may end up partially
+ * written ("torn").  Normally this is repaired by the full-page image that
+ * the first WAL record touching the page after a checkpoint carries, at the
+ * price of a lot of WAL volume.  With double_write enabled, every write of
+ * a permanent shared buffer instead goes to the double-write file first:
+ * the page is copied into a slot of that file, the file is fsync'd, and
+ * only then is the page written to its data file.  If the data file write
+ * is torn, the slot still holds an intact copy, and DoubleWriteStartup()
+ * puts it back before WAL replay begins, so full-page images are no longer
+ * needed (see UpdateFullPageWrites()).
+ *
+ * Torn pages are recognized by their checksum, so the double-write buffer
+ * is only used when data checksums are enabled.
+ *
+ * The file is a ring of double_write_buffers slots, addressed by an ever
+ * increasing slot sequence number modulo the ring size.  Each slot holds a
+ * header with the sequence number, buffer tag and CRC of the copy, followed
+ * by the page.  A slot goes through these states:
+ *
+ *	reserved - DoubleWriteReserve() handed it out
+ *	written  - DoubleWriteCopy() wrote the copy to the file
+ *	flushed  - DoubleWriteFlush() made the copy durable; the data file write
+ *			   may begin
+ *	done	 - DoubleWriteDone() reported the data file write finished
+ *
+ * Flushing is done in groups: one process fsyncs the file on behalf of all
+ * copies written so far while the others wait for it on
+ * DoubleWriteFlushLock, so concurrent writers share an fsync.
+ *
+ * A done slot may not be overwritten until its data file write is durable
+ * too.  A checkpoint fsyncs all data files, so it makes all slots done
+ * before it started reusable (DoubleWriteSyncStart/DoubleWriteSyncDone).
+ * If the ring fills up before that, a writer needing a slot fsyncs the
+ * data files of the oldest done slots itself.
+ *
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/storage/buffer/doublewrite.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "access/xlog.h"
+#include "common/relpath.h"
+#include "port/pg_crc32c.h"
+#include "storage/bufpage.h"
+#include "storage/doublewrite.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "storage/smgr.h"
+#include "storage/spin.h"
+#include "utils/memutils.h"
+
+
+/*
+ * Header of a slot in the double-write file.  The page follows it at offset
+ * DW_HEADER_SIZE, which keeps the pages sector aligned in the file.
+ */
+typedef struct DoubleWriteSlotHeader
+{
+	DoubleWriteSlot seq;		/* slot sequence number */
+	BufferTag	tag;			/* page the copy belongs to */
+	pg_crc32c	crc;			/* CRC of the header up to here and the page */
+} DoubleWriteSlotHeader;
+
+#define DW_HEADER_SIZE		512
+#define DW_SLOT_SIZE		(DW_HEADER_SIZE + BLCKSZ)
+
+/*
+ * Slots a process may have reserved and not yet reported done: a batch of
+ * the checkpointer or bgwriter plus a single write.
+ */
+#define DW_MAX_PENDING		64
+
+/* Data files fsync'd at most by one round of making room in the ring */
+#define DW_MAX_ROOM_FILES	64
+
+/*
+ * Shared state of a slot.  The fields hold the sequence number of the last
+ * use of the slot that reached the state, so the values left over from
+ * earlier laps of the ring never match the current one.
+ */
+typedef struct DoubleWriteSlotState
+{
+	DoubleWriteSlot written;
+	DoubleWriteSlot flushed;
+	DoubleWriteSlot done;
+	uint64		epoch;			/* flushEpoch when the copy was written */
+	BufferTag	tag;
+} DoubleWriteSlotState;
+
+typedef struct DoubleWriteCtlData
+{
+	/* Spinlock: protects the values below */
+	slock_t		mutex;
+
+	bool		enabled;		/* set once at startup */
+	DoubleWriteSlot nextSlot;	/* next slot to reserve */
+	DoubleWriteSlot reusableUpTo;	/* slots below this may be overwritten */
+	DoubleWriteSlot flushedUpTo;	/* slots below this are all flushed */
+	uint64		flushEpoch;		/* number of fsyncs started */
+
+	DoubleWriteSlotState slots[FLEXIBLE_ARRAY_MEMBER];
+} DoubleWriteCtlData;
+
+typedef struct DoubleWriteFile
+{
+	RelFileNode rnode;
+	ForkNumber	forknum;
+} DoubleWriteFile;
+
+/* Slot of a file read at startup, see DoubleWriteStartup */
+typedef struct DoubleWriteEntry
+{
+	DoubleWriteSlot seq;
+	BufferTag	tag;
+	int			index;			/* position of the slot in the file */
+} DoubleWriteEntry;
+
+/* GUC variables */
+bool		double_write = false;
+int			double_write_buffers = 1024;
+
+static DoubleWriteCtlData *DoubleWriteCtl = NULL;
+
+/* Number of slots in the ring, zero if the double-write buffer is off */
+static int	dwNumSlots = 0;
+
+/* Process local state */
+static int	dwFile = -1;
+static char *dwSlotBuffer = NULL;
+static DoubleWriteSlot dwPending[DW_MAX_PENDING];
+static int	dwNumPending = 0;
+static bool dwExitRegistered = false;
+
+#define DW_SLOT(seq)	(&DoubleWriteCtl->slots[(seq) % dwNumSlots])
+
+static void DoubleWriteOpenFile(void);
+static void DoubleWriteMakeRoom(void);
+static void DoubleWriteAtExit(int code, Datum arg);
+static void DoubleWriteForget(DoubleWriteSlot slot);
+static pg_crc32c DoubleWriteSlotCRC(DoubleWriteSlotHeader *hdr, char *page);
+static int	DoubleWriteEntryCmp(const void *a, const void *b);
+static void DoubleWriteRestorePage(int fd, DoubleWriteEntry *entry, char *buf);
+
+
+/*
+ * DoubleWriteShmemSize --- report amount of shared memory space needed
+ */
+Size
+DoubleWriteShmemSize(void)
+{
+	Size		size;
+
+	size = offsetof(DoubleWriteCtlData, slots);
+	if (double_write)
+		size = add_size(size, mul_size(double_write_buffers,
+									   sizeof(DoubleWriteSlotState)));
+
+	return size;
+}
+
+/*
+ * DoubleWriteShmemInit --- initialize shared memory of the double-write
+ * buffer.  It's off until DoubleWriteStartup() turns it on.
+ */
+void
+DoubleWriteShmemInit(void)
+{
+	bool		found;
+
+	dwNumSlots = double_write ? double_write_buffers : 0;
+	DoubleWriteCtl = (DoubleWriteCtlData *)
+		ShmemInitStruct("Double Write Buffer", DoubleWriteShmemSize(), &found);
+
+	if (!found)
+	{
+		SpinLockInit(&DoubleWriteCtl->mutex);
+		DoubleWriteCtl->enabled = false;
+		DoubleWriteCtl->nextSlot = 1;
+		DoubleWriteCtl->reusableUpTo = 1;
+		DoubleWriteCtl->flushedUpTo = 1;
+		DoubleWriteCtl->flushEpoch = 0;
+		if (dwNumSlots > 0)
+			MemSet(DoubleWriteCtl->slots, 0,
+				   dwNumSlots * sizeof(DoubleWriteSlotState));
+	}
+}
+
+/*
+ * DoubleWriteEnabled --- are writes of permanent buffers double-written?
+ */
+bool
+DoubleWriteEnabled(void)
+{
+	return DoubleWriteCtl != NULL && DoubleWriteCtl->enabled;
+}
+
+/*
+ * DoubleWriteStartup --- set up the double-write buffer at startup, before
+ * WAL replay begins.
+ *
+ * If the system crashed, a data file write may have been torn: every page
+ * that has a copy in the double-write file and fails verification in its
+ * data file is restored from the newest copy.  The caller fsyncs the whole
+ * data directory after a crash anyway, which makes the data file writes of
+ * all copies durable, so the copies may be overwritten once we're up.
+ *
+ * This is done even if double_write is off now, as it may have been on
+ * before the crash.
+ */
+void
+DoubleWriteStartup(bool crashed)
+{
+	int			fd;
+	off_t		fileSize = 0;
+	DoubleWriteSlot maxSeq = 0;
+	bool		enable;
+
+	fd = BasicOpenFile(DOUBLE_WRITE_FILE, O_RDWR | PG_BINARY, 0);
+	if (fd < 0 && errno != ENOENT)
+		ereport(FATAL,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", DOUBLE_WRITE_FILE)));
+
+	if (fd >= 0)
+	{
+		struct stat st;
+		char	   *buf;
+		DoubleWriteEntry *entries;
+		int			nslots;
+		int			nentries = 0;
+		int			i;
+
+		if (fstat(fd, &st) < 0)
+			ereport(FATAL,
+					(errcode_for_file_access(),
+					 errmsg("could not stat file \"%s\": %m",
+							DOUBLE_WRITE_FILE)));
+		fileSize = st.st_size;
+		nslots = (int) (fileSize / DW_SLOT_SIZE);
+
+		buf = palloc(DW_SLOT_SIZE);
+		entries = palloc(Max(nslots, 1) * sizeof(DoubleWriteEntry));
+
+		/* Collect the slots holding a complete copy */
+		for (i = 0; i < nslots; i++)
+		{
+			DoubleWriteSlotHeader *hdr = (DoubleWriteSlotHeader *) buf;
+
+			if (lseek(fd, (off_t) i * DW_SLOT_SIZE, SEEK_SET) < 0 ||
+				read(fd, buf, DW_SLOT_SIZE) != DW_SLOT_SIZE)
+				ereport(FATAL,
+						(errcode_for_file_access(),
+						 errmsg("could not read file \"%s\": %m",
+								DOUBLE_WRITE_FILE)));
+
+			if (hdr->seq == InvalidDoubleWriteSlot ||
+				!EQ_CRC32C(hdr->crc,
+						   DoubleWriteSlotCRC(hdr, buf + DW_HEADER_SIZE)))
+				continue;
+
+			entries[nentries].seq = hdr->seq;
+			entries[nentries].tag = hdr->tag;
+			entries[nentries].index = i;
+			nentries++;
+			maxSeq = Max(maxSeq, hdr->seq);
+		}
+
+		if (crashed && nentries > 0)
+		{
+			ereport(LOG,
+					(errmsg("checking pages of %d double-write buffer slots",
+							nentries)));
+
+			/* Sort by page, newest copy first */
+			qsort(entries, nentries, sizeof(DoubleWriteEntry),
+				  DoubleWriteEntryCmp);
+
+			for (i = 0; i < nentries; i++)
+			{
+				if (i == 0 ||
+					!BUFFERTAGS_EQUAL(entries[i].tag, entries[i - 1].tag))
+					DoubleWriteRestorePage(fd, &entries[i], buf);
+			}
+		}
+
+		pfree(entries);
+		pfree(buf);
+	}
+
+	enable = double_write && DataChecksumsEnabled();
+	if (double_write && !enable)
+		ereport(WARNING,
+				(errmsg("double_write is ignored because data checksums are disabled")));
+
+	if (!enable)
+	{
+		if (fd >= 0)
+		{
+			close(fd);
+			if (unlink(DOUBLE_WRITE_FILE) < 0)
+				ereport(LOG,
+						(errcode_for_file_access(),
+						 errmsg("could not remove file \"%s\": %m",
+								DOUBLE_WRITE_FILE)));
+		}
+		return;
+	}
+
+	if (fd < 0)
+	{
+		fd = BasicOpenFile(DOUBLE_WRITE_FILE, O_RDWR | O_CREAT | PG_BINARY,
+						   S_IRUSR | S_IWUSR);
+		if (fd < 0)
+			ereport(FATAL,
+					(errcode_for_file_access(),
+					 errmsg("could not create file \"%s\": %m",
+							DOUBLE_WRITE_FILE)));
+	}
+	else if (fileSize > (off_t) dwNumSlots * DW_SLOT_SIZE)
+	{
+		/*
+		 * The ring was made smaller.  All copies are obsolete now, so leave
+		 * no slots beyond the ring behind for a future startup to look at.
+		 */
+		if (ftruncate(fd, (off_t) dwNumSlots * DW_SLOT_SIZE) < 0 ||
+			pg_fsync(fd) != 0)
+			ereport(FATAL,
+					(errcode_for_file_access(),
+					 errmsg("could not truncate file \"%s\": %m",
+							DOUBLE_WRITE_FILE)));
+	}
+	dwFile = fd;
+
+	/*
+	 * No copy is needed anymore, so the whole ring is free.  Continue the
+	 * sequence numbers though, to tell new copies from the old ones.
+	 */
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	DoubleWriteCtl->nextSlot = maxSeq + 1;
+	DoubleWriteCtl->reusableUpTo = maxSeq + 1;
+	DoubleWriteCtl->flushedUpTo = maxSeq + 1;
+	DoubleWriteCtl->enabled = true;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+}
+
+/*
+ * Restore the page of a slot from its copy, if the data file page is torn.
+ */
+static void
+DoubleWriteRestorePage(int fd, DoubleWriteEntry *entry, char *buf)
+{
+	BufferTag  *tag = &entry->tag;
+	SMgrRelation reln;
+
+	reln = smgropen(tag->rnode, InvalidBackendId);
+
+	/* The relation may have been dropped or truncated since */
+	if (!smgrexists(reln, tag->forkNum) ||
+		tag->blockNum >= smgrnblocks(reln, tag->forkNum))
+		return;
+
+	smgrread(reln, tag->forkNum, tag->blockNum, buf);
+	if (PageIsVerified((Page) buf, tag->blockNum))
+		return;
+
+	if (lseek(fd, (off_t) entry->index * DW_SLOT_SIZE + DW_HEADER_SIZE,
+			  SEEK_SET) < 0 ||
+		read(fd, buf, BLCKSZ) != BLCKSZ)
+		ereport(FATAL,
+				(errcode_for_file_access(),
+				 errmsg("could not read file \"%s\": %m", DOUBLE_WRITE_FILE)));
+
+	smgrwrite(reln, tag->forkNum, tag->blockNum, buf, true);
+
+	ereport(LOG,
+			(errmsg("restored block %u of relation %s from the double-write buffer",
+					tag->blockNum,
+					relpathperm(tag->rnode, tag->forkNum))));
+}
+
+/*
+ * qsort comparator of startup entries: by page, then newest first
+ */
+static int
+DoubleWriteEntryCmp(const void *a, const void *b)
+{
+	const DoubleWriteEntry *ea = (const DoubleWriteEntry *) a;
+	const DoubleWriteEntry *eb = (const DoubleWriteEntry *) b;
+
+	if (ea->tag.rnode.spcNode != eb->tag.rnode.spcNode)
+		return ea->tag.rnode.spcNode < eb->tag.rnode.spcNode ? -1 : 1;
+	if (ea->tag.rnode.dbNode != eb->tag.rnode.dbNode)
+		return ea->tag.rnode.dbNode < eb->tag.rnode.dbNode ? -1 : 1;
+	if (ea->tag.rnode.relNode != eb->tag.rnode.relNode)
+		return ea->tag.rnode.relNode < eb->tag.rnode.relNode ? -1 : 1;
+	if (ea->tag.forkNum != eb->tag.forkNum)
+		return ea->tag.forkNum < eb->tag.forkNum ? -1 : 1;
+	if (ea->tag.blockNum != eb->tag.blockNum)
+		return ea->tag.blockNum < eb->tag.blockNum ? -1 : 1;
+	if (ea->seq != eb->seq)
+		return ea->seq > eb->seq ? -1 : 1;
+	return 0;
+}
+
+static pg_crc32c
+DoubleWriteSlotCRC(DoubleWriteSlotHeader *hdr, char *page)
+{
+	pg_crc32c	crc;
+
+	INIT_CRC32C(crc);
+	COMP_CRC32C(crc, (char *) hdr, offsetof(DoubleWriteSlotHeader, crc));
+	COMP_CRC32C(crc, page, BLCKSZ);
+	FIN_CRC32C(crc);
+
+	return crc;
+}
+
+static void
+DoubleWriteOpenFile(void)
+{
+	if (dwFile >= 0)
+		return;
+
+	dwFile = BasicOpenFile(DOUBLE_WRITE_FILE, O_RDWR | PG_BINARY, 0);
+	if (dwFile < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not open file \"%s\": %m", DOUBLE_WRITE_FILE)));
+}
+
+/*
+ * DoubleWriteReserve --- reserve a slot for the copy of a page.
+ *
+ * If the ring is full and wait is false, InvalidDoubleWriteSlot is returned.
+ * Otherwise we make room, which may need the data file writes of other
+ * processes to finish, so a process must not wait while it has unfinished
+ * slots of its own.
+ */
+DoubleWriteSlot
+DoubleWriteReserve(bool wait)
+{
+	DoubleWriteSlot slot;
+
+	Assert(DoubleWriteEnabled());
+	Assert(!wait || dwNumPending == 0);
+
+	if (dwNumPending >= DW_MAX_PENDING)
+		elog(ERROR, "too many double-write buffer slots reserved");
+
+	if (!dwExitRegistered)
+	{
+		before_shmem_exit(DoubleWriteAtExit, 0);
+		dwExitRegistered = true;
+	}
+
+	for (;;)
+	{
+		SpinLockAcquire(&DoubleWriteCtl->mutex);
+		if (DoubleWriteCtl->nextSlot - DoubleWriteCtl->reusableUpTo <
+			(uint64) dwNumSlots)
+		{
+			slot = DoubleWriteCtl->nextSlot++;
+			SpinLockRelease(&DoubleWriteCtl->mutex);
+			break;
+		}
+		SpinLockRelease(&DoubleWriteCtl->mutex);
+
+		if (!wait)
+			return InvalidDoubleWriteSlot;
+
+		DoubleWriteMakeRoom();
+	}
+
+	dwPending[dwNumPending++] = slot;
+	return slot;
+}
+
+/*
+ * Free some slots of a full ring by fsyncing the data files of the oldest
+ * done slots.  If the oldest slot isn't done yet, just wait a bit for it.
+ */
+static void
+DoubleWriteMakeRoom(void)
+{
+	DoubleWriteFile files[DW_MAX_ROOM_FILES];
+	int			nfiles = 0;
+	DoubleWriteSlot from;
+	DoubleWriteSlot to;
+	int			i;
+
+	LWLockAcquire(DoubleWriteRoomLock, LW_EXCLUSIVE);
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	from = DoubleWriteCtl->reusableUpTo;
+	if (DoubleWriteCtl->nextSlot - from < (uint64) dwNumSlots)
+	{
+		/* someone else made room while we waited for the lock */
+		SpinLockRelease(&DoubleWriteCtl->mutex);
+		LWLockRelease(DoubleWriteRoomLock);
+		return;
+	}
+
+	/* Free up to a quarter of the ring at once */
+	for (to = from;
+		 to < DoubleWriteCtl->nextSlot && to - from < (uint64) (dwNumSlots + 3) / 4;
+		 to++)
+	{
+		DoubleWriteSlotState *st = DW_SLOT(to);
+
+		if (st->done != to)
+			break;
+
+		/* Aborted before the copy was written, no data file to sync */
+		if (st->written != to)
+			continue;
+
+		for (i = 0; i < nfiles; i++)
+		{
+			if (RelFileNodeEquals(files[i].rnode, st->tag.rnode) &&
+				files[i].forknum == st->tag.forkNum)
+				break;
+		}
+		if (i == nfiles)
+		{
+			if (nfiles == DW_MAX_ROOM_FILES)
+				break;
+			files[nfiles].rnode = st->tag.rnode;
+			files[nfiles].forknum = st->tag.forkNum;
+			nfiles++;
+		}
+	}
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+
+	if (to == from)
+	{
+		LWLockRelease(DoubleWriteRoomLock);
+		pg_usleep(1000L);
+		return;
+	}
+
+	for (i = 0; i < nfiles; i++)
+	{
+		SMgrRelation reln = smgropen(files[i].rnode, InvalidBackendId);
+
+		if (smgrexists(reln, files[i].forknum))
+			smgrimmedsync(reln, files[i].forknum);
+	}
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	if (DoubleWriteCtl->reusableUpTo < to)
+		DoubleWriteCtl->reusableUpTo = to;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+
+	LWLockRelease(DoubleWriteRoomLock);
+}
+
+/*
+ * DoubleWriteCopy --- write the copy of a page to a reserved slot.
+ *
+ * page must be exactly what is going to be written to the data file, with
+ * its checksum set.
+ */
+void
+DoubleWriteCopy(DoubleWriteSlot slot, BufferTag *tag, char *page)
+{
+	DoubleWriteSlotHeader *hdr;
+	DoubleWriteSlotState *st = DW_SLOT(slot);
+	int			written;
+
+	DoubleWriteOpenFile();
+
+	if (dwSlotBuffer == NULL)
+		dwSlotBuffer = MemoryContextAllocZero(TopMemoryContext, DW_SLOT_SIZE);
+
+	hdr = (DoubleWriteSlotHeader *) dwSlotBuffer;
+	hdr->seq = slot;
+	hdr->tag = *tag;
+	memcpy(dwSlotBuffer + DW_HEADER_SIZE, page, BLCKSZ);
+	hdr->crc = DoubleWriteSlotCRC(hdr, dwSlotBuffer + DW_HEADER_SIZE);
+
+	if (lseek(dwFile, (off_t) (slot % dwNumSlots) * DW_SLOT_SIZE,
+			  SEEK_SET) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not seek in file \"%s\": %m",
+						DOUBLE_WRITE_FILE)));
+
+	errno = 0;
+	written = write(dwFile, dwSlotBuffer, DW_SLOT_SIZE);
+	if (written != DW_SLOT_SIZE)
+	{
+		/* if write didn't set errno, assume problem is no disk space */
+		if (errno == 0)
+			errno = ENOSPC;
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write to file \"%s\": %m",
+						DOUBLE_WRITE_FILE)));
+	}
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	st->tag = *tag;
+	st->epoch = DoubleWriteCtl->flushEpoch;
+	st->written = slot;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+}
+
+/*
+ * DoubleWriteFlush --- make the copies written so far durable, including
+ * the one in the given slot.
+ *
+ * Only one process fsyncs the file at a time; the others wait for it and
+ * return right away if their copies were covered by its fsync.
+ */
+void
+DoubleWriteFlush(DoubleWriteSlot slot)
+{
+	DoubleWriteSlotState *st = DW_SLOT(slot);
+
+	for (;;)
+	{
+		DoubleWriteSlot from;
+		DoubleWriteSlot upto;
+		DoubleWriteSlot seq;
+		uint64		epoch;
+		bool		flushed;
+
+		SpinLockAcquire(&DoubleWriteCtl->mutex);
+		flushed = (st->flushed == slot);
+		SpinLockRelease(&DoubleWriteCtl->mutex);
+		if (flushed)
+			return;
+
+		/* Wait for the fsync in progress, if any, and recheck */
+		if (!LWLockAcquireOrWait(DoubleWriteFlushLock, LW_EXCLUSIVE))
+			continue;
+
+		SpinLockAcquire(&DoubleWriteCtl->mutex);
+		if (st->flushed == slot)
+		{
+			SpinLockRelease(&DoubleWriteCtl->mutex);
+			LWLockRelease(DoubleWriteFlushLock);
+			return;
+		}
+		epoch = DoubleWriteCtl->flushEpoch++;
+		from = Max(DoubleWriteCtl->flushedUpTo, DoubleWriteCtl->reusableUpTo);
+		upto = DoubleWriteCtl->nextSlot;
+		SpinLockRelease(&DoubleWriteCtl->mutex);
+
+		if (pg_fsync(dwFile) != 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not fsync file \"%s\": %m",
+							DOUBLE_WRITE_FILE)));
+
+		/* The fsync covered everything written before it started */
+		SpinLockAcquire(&DoubleWriteCtl->mutex);
+		if (DoubleWriteCtl->flushedUpTo < DoubleWriteCtl->reusableUpTo)
+			DoubleWriteCtl->flushedUpTo = DoubleWriteCtl->reusableUpTo;
+		for (seq = from; seq < upto; seq++)
+		{
+			DoubleWriteSlotState *s = DW_SLOT(seq);
+
+			if (s->written == seq && s->epoch <= epoch)
+				s->flushed = seq;
+		}
+		while (DoubleWriteCtl->flushedUpTo < DoubleWriteCtl->nextSlot &&
+			   DW_SLOT(DoubleWriteCtl->flushedUpTo)->flushed ==
+			   DoubleWriteCtl->flushedUpTo)
+			DoubleWriteCtl->flushedUpTo++;
+		SpinLockRelease(&DoubleWriteCtl->mutex);
+
+		LWLockRelease(DoubleWriteFlushLock);
+	}
+}
+
+/*
+ * DoubleWriteDone --- report that the data file write of a slot finished,
+ * or that it won't happen.
+ */
+void
+DoubleWriteDone(DoubleWriteSlot slot)
+{
+	DoubleWriteSlotState *st = DW_SLOT(slot);
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	st->flushed = slot;
+	st->done = slot;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+
+	DoubleWriteForget(slot);
+}
+
+static void
+DoubleWriteForget(DoubleWriteSlot slot)
+{
+	int			i;
+
+	for (i = 0; i < dwNumPending; i++)
+	{
+		if (dwPending[i] == slot)
+		{
+			dwPending[i] = dwPending[--dwNumPending];
+			return;
+		}
+	}
+}
+
+/*
+ * DoubleWriteAbort --- release the slots of writes interrupted by an error.
+ *
+ * A write may have reached its data file partially, but the checkpoint or
+ * the ring that makes the slot reusable fsyncs the data file first anyway,
+ * and the buffer stays dirty to be written again.
+ */
+void
+DoubleWriteAbort(void)
+{
+	while (dwNumPending > 0)
+		DoubleWriteDone(dwPending[dwNumPending - 1]);
+}
+
+static void
+DoubleWriteAtExit(int code, Datum arg)
+{
+	DoubleWriteAbort();
+}
+
+/*
+ * DoubleWriteSyncStart --- called by a checkpoint before it fsyncs the data
+ * files.  Returns the slot up to which all data file writes are done, to be
+ * passed to DoubleWriteSyncDone() once the fsyncs are complete.
+ */
+DoubleWriteSlot
+DoubleWriteSyncStart(void)
+{
+	DoubleWriteSlot horizon;
+
+	if (!DoubleWriteEnabled())
+		return InvalidDoubleWriteSlot;
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	horizon = DoubleWriteCtl->reusableUpTo;
+	while (horizon < DoubleWriteCtl->nextSlot &&
+		   DW_SLOT(horizon)->done == horizon)
+		horizon++;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+
+	return horizon;
+}
+
+/*
+ * DoubleWriteSyncDone --- the data files are durable up to horizon, so the
+ * slots below it may be overwritten.
+ */
+void
+DoubleWriteSyncDone(DoubleWriteSlot horizon)
+{
+	if (horizon == InvalidDoubleWriteSlot)
+		return;
+
+	SpinLockAcquire(&DoubleWriteCtl->mutex);
+	if (DoubleWriteCtl->reusableUpTo < horizon)
+		DoubleWriteCtl->reusableUpTo = horizon;
+	SpinLockRelease(&DoubleWriteCtl->mutex);
+}
@@ -63,6 +63,31 @@ typedef struct
 /* Pointers to shared state */
 static BufferStrategyControl *StrategyControl = NULL;
 
+/* GUC variable */
+int			buffer_replacement_policy = BUFFER_REPLACEMENT_CLOCK;
+
+/*
+ * With the 2Q policy, a page that is read into a buffer starts out on
+ * probation, with a zero usage_count, so that the clock sweep reclaims it
+ * on its next pass unless it is accessed again before that.  A long scan
+ * through normal buffer access thus mostly recycles its own buffers rather
+ * than draining the usage counts of the working set.
+ *
+ * To tell a page that's genuinely being reused from one that's merely being
+ * read for the first time, we remember the buffer tag hash codes of recently
+ * evicted pages in a "ghost" table of NBuffers entries.  Each entry is
+ * addressed by the hash code and holds the hash code itself (with the low
+ * bit set, so that zero means empty), so there are no chains to manage; a
+ * newer eviction simply overwrites an older one, and an occasional false
+ * hit only costs a little cache space.  A page found there when it's read
+ * back in skips probation and gets a head start instead.
+ *
+ * This is NULL unless the 2Q policy was selected at server start.
+ */
+static pg_atomic_uint32 *StrategyGhosts = NULL;
+
+#define GHOST_VALUE(hashcode)	((hashcode) | 1)
+
 /*
  * Private (non-shared) state for managing a ring of shared buffers to re-use.
  * This is currently the only kind of BufferAccessStrategy object, but someday
@@ -425,6 +450,51 @@ StrategyNotifyBgWriter(int bgwprocno)
 }
 
 
+/*
+ * StrategyEvictedBuffer -- note that a page was evicted
+ *
+ * Called by BufferAlloc once a buffer holding a valid page has been taken
+ * over for another one; hashcode is that of the old buffer tag.
+ */
+void
+StrategyEvictedBuffer(uint32 hashcode)
+{
+	if (StrategyGhosts == NULL)
+		return;
+
+	pg_atomic_write_u32(&StrategyGhosts[hashcode % NBuffers],
+						GHOST_VALUE(hashcode));
+}
+
+/*
+ * StrategyInitialUsage -- initial usage_count of a newly read-in page
+ *
+ * Returns the usage_count to give a buffer that BufferAlloc just assigned to
+ * the page whose buffer tag has the given hash code, as buffer state bits.
+ * Pages read through a ring strategy are already kept away from the rest of
+ * the buffer pool, so they're left alone.
+ */
+uint32
+StrategyInitialUsage(uint32 hashcode, BufferAccessStrategy strategy)
+{
+	pg_atomic_uint32 *ghost;
+
+	if (StrategyGhosts == NULL || strategy != NULL)
+		return BUF_USAGECOUNT_ONE;
+
+	ghost = &StrategyGhosts[hashcode % NBuffers];
+	if (pg_atomic_read_u32(ghost) == GHOST_VALUE(hashcode))
+	{
+		/* evicted not long ago and wanted again: it's in the working set */
+		pg_atomic_write_u32(ghost, 0);
+		return 2 * BUF_USAGECOUNT_ONE;
+	}
+
+	/* first time we see it lately, so it has to earn its place */
+	return 0;
+}
+
+
 /*
  * StrategyShmemSize
  *
@@ -444,6 +514,10 @@ StrategyShmemSize(void)
 	/* size of the shared replacement strategy control block */
 	size = add_size(size, MAXALIGN(sizeof(BufferStrategyControl)));
 
+	/* size of the ghost table, if needed */
+	if (buffer_replacement_policy == BUFFER_REPLACEMENT_2Q)
+		size = add_size(size, mul_size(NBuffers, sizeof(pg_atomic_uint32)));
+
 	return size;
 }
 
@@ -507,6 +581,22 @@ StrategyInitialize(bool init)
 	}
 	else
 		Assert(!init);
+
+	if (buffer_replacement_policy == BUFFER_REPLACEMENT_2Q)
+	{
+		StrategyGhosts = (pg_atomic_uint32 *)
+			ShmemInitStruct("Buffer Strategy Ghosts",
+							NBuffers * sizeof(pg_atomic_uint32),
+							&found);
+
+		if (!found)
+		{
+			int			i;
+
+			for (i = 0; i < NBuffers; i++)
+				pg_atomic_init_u32(&StrategyGhosts[i], 0);
+		}
+	}
 }
 
 
@@ -187,6 +187,7 @@ typedef struct vfd
 	/* NB: fileName is malloc'd, and must be free'd when closing the VFD */
 	int			fileFlags;		/* open(2) flags for (re)opening the file */
 	int			fileMode;		/* mode to pass to open(2) */
+	int			nwrites;		/* asynchronous writes in progress */
 } Vfd;
 
 /*
@@ -1106,12 +1107,22 @@ ReleaseLruFile(void)
 
 	if (nfile > 0)
 	{
+		File		file;
+
 		/*
 		 * There are opened files and so there should be at least one used vfd
 		 * in the ring.
 		 */
 		Assert(VfdCache[0].lruMoreRecently != 0);
-		LruDelete(VfdCache[0].lruMoreRecently);
+
+		/* The kernel may still use the FDs of asynchronous writes */
+		file = VfdCache[0].lruMoreRecently;
+		while (file != 0 && VfdCache[file].nwrites > 0)
+			file = VfdCache[file].lruMoreRecently;
+		if (file == 0)
+			return false;
+
+		LruDelete(file);
 		return true;			/* freed a file */
 	}
 	return false;				/* no files available to free */
@@ -1312,6 +1323,7 @@ PathNameOpenFile(FileName fileName, int fileFlags, int fileMode)
 	vfdP->fileSize = 0;
 	vfdP->fdstate = 0x0;
 	vfdP->resowner = NULL;
+	vfdP->nwrites = 0;
 
 	return file;
 }
@@ -1464,6 +1476,8 @@ FileClose(File file)
 
 	vfdP = &VfdCache[file];
 
+	Assert(vfdP->nwrites == 0);
+
 	if (!FileIsNotOpen(file))
 	{
 		/* close the file */
@@ -1781,6 +1795,106 @@ retry:
 	return returnCode;
 }
 
+/*
+ * FileStartWrite - start writing a buffer at the given offset
+ *
+ * With POSIX AIO the write runs in the background, and the buffer must stay
+ * untouched until FileWaitWrite has been called on req; the file is kept
+ * open meanwhile.  Otherwise, or if the system can't queue the write right
+ * now, it is done synchronously and FileWaitWrite just reports the result.
+ *
+ * Returns 0 if the write was started, or -1 with errno set.  Temporary files
+ * are not supported.
+ */
+int
+FileStartWrite(File file, char *buffer, int amount, off_t offset,
+			   FileAsyncWrite *req)
+{
+	int			returnCode;
+
+	Assert(FileIsValid(file));
+	Assert(!(VfdCache[file].fdstate & FD_TEMPORARY));
+
+	DO_DB(elog(LOG, "FileStartWrite: %d (%s) " INT64_FORMAT " %d %p",
+			   file, VfdCache[file].fileName,
+			   (int64) offset, amount, buffer));
+
+	returnCode = FileAccess(file);
+	if (returnCode < 0)
+		return returnCode;
+
+	req->file = file;
+
+#ifdef HAVE_AIO_WRITE
+	MemSet(&req->cb, 0, sizeof(req->cb));
+	req->cb.aio_fildes = VfdCache[file].fd;
+	req->cb.aio_offset = offset;
+	req->cb.aio_buf = buffer;
+	req->cb.aio_nbytes = amount;
+	req->cb.aio_sigevent.sigev_notify = SIGEV_NONE;
+
+	if (aio_write(&req->cb) == 0)
+	{
+		req->async = true;
+		VfdCache[file].nwrites++;
+		return 0;
+	}
+	if (errno != EAGAIN && errno != ENOSYS)
+		return -1;
+	req->async = false;
+#endif
+
+	if (FileSeek(file, offset, SEEK_SET) != offset)
+		return -1;
+	req->result = FileWrite(file, buffer, amount);
+	req->save_errno = errno;
+
+	return 0;
+}
+
+/*
+ * FileWaitWrite - wait for a write started by FileStartWrite
+ *
+ * Returns the number of bytes written, or -1 with errno set, like FileWrite.
+ */
+int
+FileWaitWrite(FileAsyncWrite *req)
+{
+#ifdef HAVE_AIO_WRITE
+	if (req->async)
+	{
+		const struct aiocb *list[1];
+		int			err;
+		int			returnCode;
+
+		list[0] = &req->cb;
+		while ((err = aio_error(&req->cb)) == EINPROGRESS)
+		{
+			if (aio_suspend(list, 1, NULL) != 0 && errno != EINTR)
+				elog(PANIC, "could not wait for write of file \"%s\": %m",
+					 VfdCache[req->file].fileName);
+		}
+
+		returnCode = (int) aio_return(&req->cb);
+		req->async = false;
+		VfdCache[req->file].nwrites--;
+
+		if (returnCode < 0)
+		{
+			errno = err;
+			return -1;
+		}
+		/* like FileWrite, assume a short write ran out of disk space */
+		if ((size_t) returnCode != req->cb.aio_nbytes)
+			errno = ENOSPC;
+		return returnCode;
+	}
+#endif
+
+	errno = req->save_errno;
+	return req->result;
+}
+
 int
 FileSync(File file)
 {
@@ -61,14 +61,32 @@
 #ifdef HAVE_SYS_SHM_H
 #include <sys/shm.h>
 #endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#endif
 
 #include "portability/mem.h"
 #include "storage/dsm_impl.h"
 #include "storage/fd.h"
+#include "storage/pg_shmem.h"
 #include "utils/guc.h"
 #include "utils/memutils.h"
 #include "postmaster/postmaster.h"
 
+/*
+ * NUMA placement is done with the Linux mbind() system call.  We call it
+ * directly, rather than through libnuma, and so need the values of a few
+ * constants from <linux/mempolicy.h>.
+ */
+#if defined(SYS_mbind) && defined(SYS_get_mempolicy) && defined(SYS_getcpu)
+#define USE_DSM_NUMA
+#define DSM_MPOL_PREFERRED		1
+#define DSM_MPOL_INTERLEAVE		3
+#define DSM_MPOL_F_MEMS_ALLOWED	(1 << 2)
+#define DSM_NUMA_MAX_NODES		1024
+#define DSM_NUMA_MASK_BITS		(sizeof(unsigned long) * BITS_PER_BYTE)
+#endif
+
 #ifdef USE_DSM_POSIX
 static bool dsm_impl_posix(dsm_op op, dsm_handle handle, Size request_size,
 			   void **impl_private, void **mapped_address,
@@ -89,6 +107,13 @@ static bool dsm_impl_mmap(dsm_op op, dsm_handle handle, Size request_size,
 			  void **impl_private, void **mapped_address,
 			  Size *mapped_size, int elevel);
 #endif
+#ifdef MAP_HUGETLB
+static bool dsm_impl_want_huge_pages(Size size);
+#endif
+#ifdef USE_DSM_NUMA
+static void dsm_impl_numa_placement(void *address, Size size,
+						const char *name);
+#endif
 static int	errcode_for_dynamic_shared_memory(void);
 
 const struct config_enum_entry dynamic_shared_memory_options[] = {
@@ -108,9 +133,21 @@ const struct config_enum_entry dynamic_shared_memory_options[] = {
 	{NULL, 0, false}
 };
 
+const struct config_enum_entry dynamic_shared_memory_numa_options[] = {
+	{"none", DSM_NUMA_NONE, false},
+#ifdef USE_DSM_NUMA
+	{"local", DSM_NUMA_LOCAL, false},
+	{"interleave", DSM_NUMA_INTERLEAVE, false},
+#endif
+	{NULL, 0, false}
+};
+
 /* Implementation selector. */
 int			dynamic_shared_memory_type;
 
+/* NUMA placement of new segments. */
+int			dynamic_shared_memory_numa = DSM_NUMA_NONE;
+
 /* Size of buffer to be used for zero-filling. */
 #define ZBUFFER_SIZE				8192
 
@@ -390,6 +427,26 @@ dsm_impl_posix(dsm_op op, dsm_handle handle, Size request_size,
 	*mapped_size = request_size;
 	close(fd);
 
+	/*
+	 * Set up how the pages of a new or grown segment should be backed, before
+	 * they are first touched.  POSIX shared memory can't use explicit huge
+	 * pages (those need a hugetlbfs file), but transparent huge pages can be
+	 * asked for if the kernel allows them for shared memory.  Failure is
+	 * harmless here, so we only complain at DEBUG1.
+	 */
+	if (op == DSM_OP_CREATE || op == DSM_OP_RESIZE)
+	{
+#if defined(MAP_HUGETLB) && defined(MADV_HUGEPAGE)
+		if (dsm_impl_want_huge_pages(request_size) &&
+			madvise(address, request_size, MADV_HUGEPAGE) != 0)
+			elog(DEBUG1, "madvise(%zu) with MADV_HUGEPAGE failed for shared memory segment \"%s\": %m",
+				 request_size, name);
+#endif
+#ifdef USE_DSM_NUMA
+		dsm_impl_numa_placement(address, request_size, name);
+#endif
+	}
+
 	return true;
 }
 #endif
@@ -502,7 +559,30 @@ dsm_impl_sysv(dsm_op op, dsm_handle handle, Size request_size,
 			segsize = request_size;
 		}
 
-		if ((ident = shmget(key, segsize, flags)) == -1)
+		/*
+		 * Try huge pages first for a large enough new segment, falling back
+		 * to normal pages whatever the reason for the failure.  Unlike for
+		 * the main segment, huge_pages = on doesn't make this an error: a
+		 * query should not fail because the huge pages ran out.
+		 */
+		ident = -1;
+		errno = 0;
+#if defined(MAP_HUGETLB) && defined(SHM_HUGETLB)
+		if (op == DSM_OP_CREATE && dsm_impl_want_huge_pages(request_size))
+		{
+			ident = shmget(key, segsize, flags | SHM_HUGETLB);
+			if (ident == -1 && errno != EEXIST)
+			{
+				elog(DEBUG1, "shmget(%zu) with SHM_HUGETLB failed, huge pages disabled for shared memory segment \"%s\": %m",
+					 segsize, name);
+				errno = 0;
+			}
+		}
+#endif
+		if (ident == -1 && errno != EEXIST)
+			ident = shmget(key, segsize, flags);
+
+		if (ident == -1)
 		{
 			if (errno != EEXIST)
 			{
@@ -584,6 +664,11 @@ dsm_impl_sysv(dsm_op op, dsm_handle handle, Size request_size,
 	*mapped_address = address;
 	*mapped_size = request_size;
 
+#ifdef USE_DSM_NUMA
+	if (op == DSM_OP_CREATE)
+		dsm_impl_numa_placement(address, request_size, name);
+#endif
+
 	return true;
 }
 #endif
@@ -1034,6 +1119,87 @@ dsm_impl_pin_segment(dsm_handle handle, void *impl_private)
 	}
 }
 
+#ifdef MAP_HUGETLB
+/*
+ * Should a new segment of the given size be backed by huge pages?
+ *
+ * We follow huge_pages, except that segments smaller than a huge page aren't
+ * worth it: they'd waste most of the page.
+ */
+static bool
+dsm_impl_want_huge_pages(Size size)
+{
+	static Size hugepagesize = 0;
+
+	if (huge_pages == HUGE_PAGES_OFF)
+		return false;
+
+	if (hugepagesize == 0)
+	{
+		int			mmap_flags;
+
+		GetHugePageSize(&hugepagesize, &mmap_flags);
+	}
+
+	return size >= hugepagesize;
+}
+#endif
+
+#ifdef USE_DSM_NUMA
+/*
+ * Apply dynamic_shared_memory_numa to a newly mapped segment.
+ *
+ * The policy is attached to the shared memory object itself, so it governs
+ * where its pages are allocated whichever process touches them first.
+ * "local" prefers the NUMA node of the CPU the creating backend runs on,
+ * which suits segments mostly used by their creator; "interleave" spreads
+ * the pages over all the nodes we may allocate from, which suits rings and
+ * tables used by processes all over the machine.  Placement is just an
+ * optimization, so failures are only reported at DEBUG1.
+ */
+static void
+dsm_impl_numa_placement(void *address, Size size, const char *name)
+{
+	unsigned long nodemask[DSM_NUMA_MAX_NODES / DSM_NUMA_MASK_BITS];
+	int			mode;
+
+	if (dynamic_shared_memory_numa == DSM_NUMA_NONE)
+		return;
+
+	memset(nodemask, 0, sizeof(nodemask));
+	if (dynamic_shared_memory_numa == DSM_NUMA_LOCAL)
+	{
+		unsigned int cpu;
+		unsigned int node;
+
+		if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0 ||
+			node >= DSM_NUMA_MAX_NODES)
+		{
+			elog(DEBUG1, "could not determine the NUMA node of this process: %m");
+			return;
+		}
+		nodemask[node / DSM_NUMA_MASK_BITS] |= 1UL << (node % DSM_NUMA_MASK_BITS);
+		mode = DSM_MPOL_PREFERRED;
+	}
+	else
+	{
+		if (syscall(SYS_get_mempolicy, NULL, nodemask,
+					(unsigned long) DSM_NUMA_MAX_NODES, NULL,
+					DSM_MPOL_F_MEMS_ALLOWED) != 0)
+		{
+			elog(DEBUG1, "could not determine the allowed NUMA nodes: %m");
+			return;
+		}
+		mode = DSM_MPOL_INTERLEAVE;
+	}
+
+	if (syscall(SYS_mbind, address, (unsigned long) size, mode, nodemask,
+				(unsigned long) DSM_NUMA_MAX_NODES, 0) != 0)
+		elog(DEBUG1, "could not set NUMA policy of shared memory segment \"%s\": %m",
+			 name);
+}
+#endif
+
 static int
 errcode_for_dynamic_shared_memory(void)
 {
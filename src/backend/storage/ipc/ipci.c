@@ -16,11 +16,13 @@
 
 #include "access/clog.h"
 #include "access/commit_ts.h"
+#include "access/csnlog.h"
 #include "access/heapam.h"
 #include "access/multixact.h"
 #include "access/nbtree.h"
 #include "access/subtrans.h"
 #include "access/twophase.h"
+#include "access/xlogparallel.h"
 #include "commands/async.h"
 #include "miscadmin.h"
 #include "pgstat.h"
@@ -28,11 +30,13 @@
 #include "postmaster/bgworker_internals.h"
 #include "postmaster/bgwriter.h"
 #include "postmaster/postmaster.h"
+#include "replication/basebackup.h"
 #include "replication/slot.h"
 #include "replication/walreceiver.h"
 #include "replication/walsender.h"
 #include "replication/origin.h"
 #include "storage/bufmgr.h"
+#include "storage/doublewrite.h"
 #include "storage/dsm.h"
 #include "storage/ipc.h"
 #include "storage/pg_shmem.h"
@@ -43,6 +47,8 @@
 #include "storage/procsignal.h"
 #include "storage/sinvaladt.h"
 #include "storage/spin.h"
+#include "tcop/sessionpool.h"
+#include "utils/sharedcatcache.h"
 #include "utils/snapmgr.h"
 
 
@@ -115,13 +121,16 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 		size = add_size(size, hash_estimate_size(SHMEM_INDEX_SIZE,
 												 sizeof(ShmemIndexEnt)));
 		size = add_size(size, BufferShmemSize());
+		size = add_size(size, DoubleWriteShmemSize());
 		size = add_size(size, LockShmemSize());
 		size = add_size(size, PredicateLockShmemSize());
 		size = add_size(size, ProcGlobalShmemSize());
 		size = add_size(size, XLOGShmemSize());
+		size = add_size(size, XLogParallelRedoShmemSize());
 		size = add_size(size, CLOGShmemSize());
 		size = add_size(size, CommitTsShmemSize());
 		size = add_size(size, SUBTRANSShmemSize());
+		size = add_size(size, CSNLogShmemSize());
 		size = add_size(size, TwoPhaseShmemSize());
 		size = add_size(size, BackgroundWorkerShmemSize());
 		size = add_size(size, MultiXactShmemSize());
@@ -129,13 +138,16 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 		size = add_size(size, ProcArrayShmemSize());
 		size = add_size(size, BackendStatusShmemSize());
 		size = add_size(size, SInvalShmemSize());
+		size = add_size(size, SharedCatCacheShmemSize());
 		size = add_size(size, PMSignalShmemSize());
 		size = add_size(size, ProcSignalShmemSize());
 		size = add_size(size, CheckpointerShmemSize());
 		size = add_size(size, AutoVacuumShmemSize());
+		size = add_size(size, SessionPoolShmemSize());
 		size = add_size(size, ReplicationSlotsShmemSize());
 		size = add_size(size, ReplicationOriginShmemSize());
 		size = add_size(size, WalSndShmemSize());
+		size = add_size(size, BaseBackupShmemSize());
 		size = add_size(size, WalRcvShmemSize());
 		size = add_size(size, SnapMgrShmemSize());
 		size = add_size(size, BTreeShmemSize());
@@ -203,11 +215,14 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 	 * Set up xlog, clog, and buffers
 	 */
 	XLOGShmemInit();
+	XLogParallelRedoShmemInit();
 	CLOGShmemInit();
 	CommitTsShmemInit();
 	SUBTRANSShmemInit();
+	CSNLogShmemInit();
 	MultiXactShmemInit();
 	InitBufferPool();
+	DoubleWriteShmemInit();
 
 	/*
 	 * Set up lock manager
@@ -233,6 +248,7 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 	 * Set up shared-inval messaging
 	 */
 	CreateSharedInvalidationState();
+	SharedCatCacheShmemInit();
 
 	/*
 	 * Set up interprocess signaling mechanisms
@@ -244,6 +260,7 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 	ReplicationSlotsShmemInit();
 	ReplicationOriginShmemInit();
 	WalSndShmemInit();
+	BaseBackupShmemInit();
 	WalRcvShmemInit();
 
 	/*
@@ -253,6 +270,7 @@ CreateSharedMemoryAndSemaphores(bool makePrivate, int port)
 	BTreeShmemInit();
 	SyncScanShmemInit();
 	AsyncShmemInit();
+	SessionPoolShmemInit();
 
 #ifdef EXEC_BACKEND
 
@@ -46,6 +46,7 @@
 #include <signal.h>
 
 #include "access/clog.h"
+#include "access/csnlog.h"
 #include "access/subtrans.h"
 #include "access/transam.h"
 #include "access/twophase.h"
@@ -91,12 +92,23 @@ typedef struct ProcArrayStruct
 	/* oldest catalog xmin of any replication slot */
 	TransactionId replication_slot_catalog_xmin;
 
+	/*
+	 * Shared xmin horizon for CSN snapshots, see CsnGetSnapshotData.  It
+	 * only moves forward.  csn_xmin_refreshed_at is nextXid as of the last
+	 * time it was recomputed.
+	 */
+	pg_atomic_uint32 csn_xmin;
+	pg_atomic_uint32 csn_xmin_refreshed_at;
+
 	/* indexes into allPgXact[], has PROCARRAY_MAXPROCS entries */
 	int			pgprocnos[FLEXIBLE_ARRAY_MEMBER];
 } ProcArrayStruct;
 
 static ProcArrayStruct *procArray;
 
+/* How many PGXACTs ahead GetSnapshotData prefetches */
+#define SNAPSHOT_PREFETCH_DISTANCE	4
+
 static PGPROC *allProcs;
 static PGXACT *allPgXact;
 
@@ -247,6 +259,11 @@ CreateSharedProcArray(void)
 		procArray->headKnownAssignedXids = 0;
 		SpinLockInit(&procArray->known_assigned_xids_lck);
 		procArray->lastOverflowedXid = InvalidTransactionId;
+		pg_atomic_init_u32(&procArray->csn_xmin, InvalidTransactionId);
+		pg_atomic_init_u32(&procArray->csn_xmin_refreshed_at,
+						   InvalidTransactionId);
+		/* 0 is reserved for snapshots that can't be reused */
+		ShmemVariableCache->xactCompletionCount = 1;
 	}
 
 	allProcs = ProcGlobal->allProcs;
@@ -357,6 +374,9 @@ ProcArrayRemove(PGPROC *proc, TransactionId latestXid)
 		if (TransactionIdPrecedes(ShmemVariableCache->latestCompletedXid,
 								  latestXid))
 			ShmemVariableCache->latestCompletedXid = latestXid;
+
+		/* Same as ProcArrayEndTransactionInternal */
+		ShmemVariableCache->xactCompletionCount++;
 	}
 	else
 	{
@@ -472,6 +492,9 @@ ProcArrayEndTransactionInternal(PGPROC *proc, PGXACT *pgxact,
 	if (TransactionIdPrecedes(ShmemVariableCache->latestCompletedXid,
 							  latestXid))
 		ShmemVariableCache->latestCompletedXid = latestXid;
+
+	/* Invalidate snapshots that could otherwise be reused */
+	ShmemVariableCache->xactCompletionCount++;
 }
 
 /*
@@ -611,11 +634,16 @@ ProcArrayClearTransaction(PGPROC *proc)
 	PGXACT	   *pgxact = &allPgXact[proc->pgprocno];
 
 	/*
-	 * We can skip locking ProcArrayLock here, because this action does not
-	 * actually change anyone's view of the set of running XIDs: our entry is
-	 * duplicate with the gxact that has already been inserted into the
-	 * ProcArray.
+	 * This action does not actually change anyone's view of the set of
+	 * running XIDs: our entry is duplicate with the gxact that has already
+	 * been inserted into the ProcArray.  But our own last snapshot left our
+	 * XID out, so it must not be reused now that the XID belongs to somebody
+	 * else; bumping the completion count needs ProcArrayLock.
 	 */
+	LWLockAcquire(ProcArrayLock, LW_EXCLUSIVE);
+
+	ShmemVariableCache->xactCompletionCount++;
+
 	pgxact->xid = InvalidTransactionId;
 	proc->lxid = InvalidLocalTransactionId;
 	pgxact->xmin = InvalidTransactionId;
@@ -628,6 +656,8 @@ ProcArrayClearTransaction(PGPROC *proc)
 	/* Clear the subtransaction-XID cache too */
 	pgxact->nxids = 0;
 	pgxact->overflowed = false;
+
+	LWLockRelease(ProcArrayLock);
 }
 
 /*
@@ -1484,6 +1514,109 @@ GetMaxSnapshotSubxidCount(void)
 	return TOTAL_MAX_CACHED_SUBXIDS;
 }
 
+/*
+ * Allocate the xip arrays of a snapshot filled by GetSnapshotData.
+ *
+ * We allocate much more storage than is probably needed.  This does open a
+ * possibility for avoiding repeated malloc/free: since maxProcs does not
+ * change at runtime, we can simply reuse the previous xip arrays if any.
+ * (This relies on the fact that all callers pass static SnapshotData
+ * structs.)
+ */
+static void
+AllocateSnapshotXids(Snapshot snapshot)
+{
+	if (snapshot->xip == NULL)
+	{
+		/*
+		 * First call for this snapshot. Snapshot is same size whether or not
+		 * we are in recovery, see later comments.
+		 */
+		snapshot->xip = (TransactionId *)
+			malloc(GetMaxSnapshotXidCount() * sizeof(TransactionId));
+		if (snapshot->xip == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of memory")));
+		Assert(snapshot->subxip == NULL);
+		snapshot->subxip = (TransactionId *)
+			malloc(GetMaxSnapshotSubxidCount() * sizeof(TransactionId));
+		if (snapshot->subxip == NULL)
+			ereport(ERROR,
+					(errcode(ERRCODE_OUT_OF_MEMORY),
+					 errmsg("out of memory")));
+	}
+}
+
+/*
+ * Fill in the "snapshot too old" fields of a newly built snapshot.
+ */
+static void
+GetSnapshotDataInitOldSnapshot(Snapshot snapshot)
+{
+	if (old_snapshot_threshold < 0)
+	{
+		/*
+		 * If not using "snapshot too old" feature, fill related fields with
+		 * dummy values that don't require any locking.
+		 */
+		snapshot->lsn = InvalidXLogRecPtr;
+		snapshot->whenTaken = 0;
+	}
+	else
+	{
+		/*
+		 * Capture the current time and WAL stream location in case this
+		 * snapshot becomes old enough to need to fall back on the special
+		 * "old snapshot" logic.
+		 */
+		snapshot->lsn = GetXLogInsertRecPtr();
+		snapshot->whenTaken = GetSnapshotCurrentTimestamp();
+		MaintainOldSnapshotTimeMapping(snapshot->whenTaken, snapshot->xmin);
+	}
+}
+
+/*
+ * Try to reuse the contents of a snapshot built by a previous call of
+ * PgGetSnapshotData with the same static snapshot.
+ *
+ * If no transaction with an XID has left the proc array since then, the set
+ * of running XIDs is the same (newly assigned XIDs are all past the old
+ * xmax), and so is the snapshot.  We compare the completion count for that.
+ * The global xmin variables are left alone; their old values are still
+ * correct, if conservative.
+ *
+ * ProcArrayLock must be held by the caller, at least in shared mode, so
+ * that the completion count can't change.
+ */
+static bool
+GetSnapshotDataReuse(Snapshot snapshot)
+{
+	if (snapshot->snapXactCompletionCount == 0 ||
+		snapshot->snapXactCompletionCount !=
+		ShmemVariableCache->xactCompletionCount)
+		return false;
+
+	/*
+	 * The snapshot's xmin can't be older than what others already consider
+	 * running, as nothing completed, so it's safe to advertise it.
+	 */
+	if (!TransactionIdIsValid(MyPgXact->xmin))
+		MyPgXact->xmin = TransactionXmin = snapshot->xmin;
+
+	RecentXmin = snapshot->xmin;
+	Assert(TransactionIdPrecedesOrEquals(TransactionXmin, RecentXmin));
+
+	snapshot->curcid = GetCurrentCommandId(false);
+	snapshot->active_count = 0;
+	snapshot->regd_count = 0;
+	snapshot->copied = false;
+
+	GetSnapshotDataInitOldSnapshot(snapshot);
+
+	return true;
+}
+
 Snapshot
 GetSnapshotData(Snapshot snapshot)
 {
@@ -1522,6 +1655,9 @@ GetSnapshotData(Snapshot snapshot)
  *		RecentGlobalDataXmin: the global xmin for non-catalog tables
  *			>= RecentGlobalXmin
  *
+ * If no transaction has completed since the same snapshot struct was last
+ * filled in, its contents are reused, see GetSnapshotDataReuse.
+ *
  * Note: this function should probably not be called with an argument that's
  * not statically allocated (see xip allocation below).
  */
@@ -1532,6 +1668,7 @@ PgGetSnapshotData(Snapshot snapshot)
 	TransactionId xmin;
 	TransactionId xmax;
 	TransactionId globalxmin;
+	uint64		curXactCompletionCount;
 	int			index;
 	int			count = 0;
 	int			subcount = 0;
@@ -1544,34 +1681,9 @@ PgGetSnapshotData(Snapshot snapshot)
 	/*
 	 * Allocating space for maxProcs xids is usually overkill; numProcs would
 	 * be sufficient.  But it seems better to do the malloc while not holding
-	 * the lock, so we can't look at numProcs.  Likewise, we allocate much
-	 * more subxip storage than is probably needed.
-	 *
-	 * This does open a possibility for avoiding repeated malloc/free: since
-	 * maxProcs does not change at runtime, we can simply reuse the previous
-	 * xip arrays if any.  (This relies on the fact that all callers pass
-	 * static SnapshotData structs.)
+	 * the lock, so we can't look at numProcs.
 	 */
-	if (snapshot->xip == NULL)
-	{
-		/*
-		 * First call for this snapshot. Snapshot is same size whether or not
-		 * we are in recovery, see later comments.
-		 */
-		snapshot->xip = (TransactionId *)
-			malloc(GetMaxSnapshotXidCount() * sizeof(TransactionId));
-		if (snapshot->xip == NULL)
-			ereport(ERROR,
-					(errcode(ERRCODE_OUT_OF_MEMORY),
-					 errmsg("out of memory")));
-		Assert(snapshot->subxip == NULL);
-		snapshot->subxip = (TransactionId *)
-			malloc(GetMaxSnapshotSubxidCount() * sizeof(TransactionId));
-		if (snapshot->subxip == NULL)
-			ereport(ERROR,
-					(errcode(ERRCODE_OUT_OF_MEMORY),
-					 errmsg("out of memory")));
-	}
+	AllocateSnapshotXids(snapshot);
 
 	/*
 	 * It is sufficient to get shared lock on ProcArrayLock, even if we are
@@ -1579,6 +1691,14 @@ PgGetSnapshotData(Snapshot snapshot)
 	 */
 	LWLockAcquire(ProcArrayLock, LW_SHARED);
 
+	if (GetSnapshotDataReuse(snapshot))
+	{
+		LWLockRelease(ProcArrayLock);
+		return snapshot;
+	}
+
+	curXactCompletionCount = ShmemVariableCache->xactCompletionCount;
+
 	/* xmax is always latestCompletedXid + 1 */
 	xmax = ShmemVariableCache->latestCompletedXid;
 	Assert(TransactionIdIsNormal(xmax));
@@ -1606,6 +1726,15 @@ PgGetSnapshotData(Snapshot snapshot)
 			volatile PGXACT *pgxact = &allPgXact[pgprocno];
 			TransactionId xid;
 
+			/*
+			 * PGXACTs are in pgprocno order, not in ours, so with many procs
+			 * nearly every entry is a cache miss.  Start fetching the ones
+			 * we'll look at next.
+			 */
+			if (index + SNAPSHOT_PREFETCH_DISTANCE < numProcs)
+				pg_prefetch_mem((const void *)
+					&allPgXact[pgprocnos[index + SNAPSHOT_PREFETCH_DISTANCE]]);
+
 			/*
 			 * Backend is doing logical decoding which manages xmin
 			 * separately, check below.
@@ -1768,6 +1897,18 @@ PgGetSnapshotData(Snapshot snapshot)
 	snapshot->xcnt = count;
 	snapshot->subxcnt = subcount;
 	snapshot->suboverflowed = suboverflowed;
+	snapshot->snapshot_csn = InvalidCommitSeqNo;
+
+	/*
+	 * Snapshots taken during recovery are built from KnownAssignedXids,
+	 * which doesn't maintain the completion count.  Nor do we know what an
+	 * extension's transaction manager does with the snapshot after we
+	 * return it.
+	 */
+	if (snapshot->takenDuringRecovery || TM != &PgTM)
+		snapshot->snapXactCompletionCount = 0;
+	else
+		snapshot->snapXactCompletionCount = curXactCompletionCount;
 
 	snapshot->curcid = GetCurrentCommandId(false);
 
@@ -1779,30 +1920,170 @@ PgGetSnapshotData(Snapshot snapshot)
 	snapshot->regd_count = 0;
 	snapshot->copied = false;
 
-	if (old_snapshot_threshold < 0)
+	GetSnapshotDataInitOldSnapshot(snapshot);
+
+	return snapshot;
+}
+
+/*
+ * Return the shared xmin horizon for CSN snapshots, recomputing it if
+ * enough XIDs have been assigned since it was last computed.
+ *
+ * Any GetOldestXmin result is a lower bound for the XIDs running at that
+ * time or assigned later, so a horizon computed in the past is still a valid
+ * (if conservative) xmin for a snapshot taken now.  Recomputing needs a scan
+ * of the proc array, so only one backend per CSN_XMIN_REFRESH_INTERVAL XIDs
+ * does it.
+ */
+#define CSN_XMIN_REFRESH_INTERVAL	64
+
+static TransactionId
+CsnGetXminHorizon(void)
+{
+	TransactionId nextXid = ShmemVariableCache->nextXid;
+	uint32		refreshed;
+	TransactionId xmin;
+	TransactionId oldestXmin;
+
+	xmin = pg_atomic_read_u32(&procArray->csn_xmin);
+	refreshed = pg_atomic_read_u32(&procArray->csn_xmin_refreshed_at);
+
+	if (TransactionIdIsValid(xmin))
 	{
-		/*
-		 * If not using "snapshot too old" feature, fill related fields with
-		 * dummy values that don't require any locking.
-		 */
-		snapshot->lsn = InvalidXLogRecPtr;
-		snapshot->whenTaken = 0;
+		if (nextXid - refreshed < CSN_XMIN_REFRESH_INTERVAL)
+			return xmin;
+		/* Let somebody else do it if they're already on it */
+		if (!pg_atomic_compare_exchange_u32(&procArray->csn_xmin_refreshed_at,
+											&refreshed, nextXid))
+			return xmin;
 	}
 	else
+		pg_atomic_write_u32(&procArray->csn_xmin_refreshed_at, nextXid);
+
+	oldestXmin = GetOldestXmin(NULL, true);
+
+	/* Never move the horizon backwards, see CsnGetSnapshotData */
+	while (!TransactionIdIsValid(xmin) ||
+		   TransactionIdPrecedes(xmin, oldestXmin))
 	{
-		/*
-		 * Capture the current time and WAL stream location in case this
-		 * snapshot becomes old enough to need to fall back on the special
-		 * "old snapshot" logic.
-		 */
-		snapshot->lsn = GetXLogInsertRecPtr();
-		snapshot->whenTaken = GetSnapshotCurrentTimestamp();
-		MaintainOldSnapshotTimeMapping(snapshot->whenTaken, xmin);
+		if (pg_atomic_compare_exchange_u32(&procArray->csn_xmin, &xmin,
+										   oldestXmin))
+			return oldestXmin;
+	}
+	return xmin;
+}
+
+/*
+ * CsnGetSnapshotData -- GetSnapshotData for csn_snapshots.
+ *
+ * A CSN snapshot is the current value of the CSN counter plus xmin/xmax
+ * bounds; taking one scans nothing and takes no lock.  The xmin is the
+ * shared horizon maintained by CsnGetXminHorizon, so it can lag behind the
+ * xmin PgGetSnapshotData would have computed.
+ *
+ * Our xmin must be advertised before we read the CSN counter: every
+ * transaction that commits after we've read it must still be seen as
+ * running by us, so its changes must not be pruned away.  And since
+ * TruncateCSNLog looks at the shared horizon before the advertised xmins,
+ * we recheck after advertising that the horizon did not move past us.
+ *
+ * Snapshots taken during recovery are built by PgGetSnapshotData.
+ */
+Snapshot
+CsnGetSnapshotData(Snapshot snapshot)
+{
+	TransactionId xmin;
+	TransactionId xmax;
+	TransactionId globalxmin;
+
+	Assert(snapshot != NULL);
+
+	if (!CSNLogActive() || RecoveryInProgress())
+		return PgGetSnapshotData(snapshot);
+
+	/* Callers such as ImportSnapshot fill in the xip arrays themselves */
+	AllocateSnapshotXids(snapshot);
+
+	if (!TransactionIdIsValid(MyPgXact->xmin))
+	{
+		do
+		{
+			xmin = CsnGetXminHorizon();
+			MyPgXact->xmin = TransactionXmin = xmin;
+			pg_memory_barrier();
+		} while (pg_atomic_read_u32(&procArray->csn_xmin) != xmin);
+		globalxmin = xmin;
 	}
+	else
+	{
+		globalxmin = xmin = CsnGetXminHorizon();
+		if (TransactionIdPrecedes(xmin, MyPgXact->xmin))
+			xmin = MyPgXact->xmin;
+		pg_memory_barrier();
+	}
+
+	snapshot->snapshot_csn = GetCurrentCommitSeqNo();
+
+	/*
+	 * Everything that committed with a smaller CSN got its XID before, so
+	 * reading nextXid afterwards gives a valid xmax.
+	 */
+	pg_read_barrier();
+	xmax = ShmemVariableCache->nextXid;
+
+	/*
+	 * The horizon comes from GetOldestXmin, which has already accounted for
+	 * vacuum_defer_cleanup_age and replication slots.
+	 */
+	RecentGlobalXmin = globalxmin;
+	RecentGlobalDataXmin = globalxmin;
+	RecentXmin = xmin;
+
+	snapshot->xmin = xmin;
+	snapshot->xmax = xmax;
+	snapshot->xcnt = 0;
+	snapshot->subxcnt = 0;
+	snapshot->suboverflowed = false;
+	snapshot->takenDuringRecovery = false;
+
+	snapshot->curcid = GetCurrentCommandId(false);
+
+	/*
+	 * This is a new snapshot, so set both refcounts are zero, and mark it as
+	 * not copied in persistent memory.
+	 */
+	snapshot->active_count = 0;
+	snapshot->regd_count = 0;
+	snapshot->copied = false;
+	snapshot->snapXactCompletionCount = 0;
+
+	GetSnapshotDataInitOldSnapshot(snapshot);
 
 	return snapshot;
 }
 
+/*
+ * GetOldestCsnSnapshotXmin -- oldest xmin any CSN snapshot may be using.
+ *
+ * Used to truncate pg_csnlog.  A backend may be about to advertise an xmin
+ * it read from the shared horizon, so we read that first; see the loop in
+ * CsnGetSnapshotData.
+ */
+TransactionId
+GetOldestCsnSnapshotXmin(void)
+{
+	TransactionId horizon;
+	TransactionId result;
+
+	horizon = pg_atomic_read_u32(&procArray->csn_xmin);
+	pg_memory_barrier();
+	result = GetOldestXmin(NULL, false);
+
+	if (TransactionIdIsValid(horizon) && TransactionIdPrecedes(horizon, result))
+		result = horizon;
+	return result;
+}
+
 /*
  * ProcArrayInstallImportedXmin -- install imported xmin into MyPgXact->xmin
  *
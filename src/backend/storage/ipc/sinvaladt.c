@@ -70,6 +70,13 @@
  * of "stuck" backends, we won't need a lot of extra interrupts, since ones
  * that aren't stuck will propagate their interrupts to the next guy.
  *
+ * Most messages only concern the catalogs of one database.  A writer sets
+ * the hasMessages flag only of the backends that might be interested in the
+ * messages it adds, and SICleanupQueue moves a backend whose flag is clear
+ * straight to the end of the queue.  So backends connected to other
+ * databases neither wake up to read such messages, nor hold back the
+ * cleanup of the queue and get signaled or reset because of them.
+ *
  * We would have problems if the MsgNum values overflow an integer, so
  * whenever minMsgNum exceeds MSGNUMWRAPAROUND, we subtract MSGNUMWRAPAROUND
  * from all the MsgNum variables simultaneously.  MSGNUMWRAPAROUND can be
@@ -145,7 +152,7 @@ typedef struct ProcState
 	int			nextMsgNum;		/* next message number to read */
 	bool		resetState;		/* backend needs to reset its state */
 	bool		signaled;		/* backend has been sent catchup signal */
-	bool		hasMessages;	/* backend has unread messages */
+	bool		hasMessages;	/* backend has unread messages of interest */
 
 	/*
 	 * Backend only sends invalidations, never receives them. This only makes
@@ -195,6 +202,7 @@ static SISeg *shmInvalBuffer;	/* pointer to the shared inval buffer */
 static LocalTransactionId nextLocalTransactionId;
 
 static void CleanupInvalidationState(int status, Datum arg);
+static Oid	SIMessageDatabase(const SharedInvalidationMessage *msg);
 
 
 /*
@@ -452,6 +460,7 @@ SIInsertDataEntries(const SharedInvalidationMessage *data, int n)
 		int			numMsgs;
 		int			max;
 		int			i;
+		Oid			dbId;
 
 		n -= nthistime;
 
@@ -475,11 +484,15 @@ SIInsertDataEntries(const SharedInvalidationMessage *data, int n)
 		}
 
 		/*
-		 * Insert new message(s) into proper slot of circular buffer
+		 * Insert new message(s) into proper slot of circular buffer, noting
+		 * whether they all concern a single database
 		 */
 		max = segP->maxMsgNum;
+		dbId = SIMessageDatabase(data);
 		while (nthistime-- > 0)
 		{
+			if (dbId != InvalidOid && SIMessageDatabase(data) != dbId)
+				dbId = InvalidOid;
 			segP->buffer[max % MAXNUMMESSAGES] = *data++;
 			max++;
 		}
@@ -495,11 +508,23 @@ SIInsertDataEntries(const SharedInvalidationMessage *data, int n)
 		 * Releasing SInvalWriteLock will enforce a full memory barrier, so
 		 * these (unlocked) changes will be committed to memory before we exit
 		 * the function.
+		 *
+		 * Messages that only concern one database are of no interest to
+		 * backends connected to another one, so those aren't kicked; see
+		 * SICleanupQueue for how they skip the messages.  A backend that
+		 * hasn't advertised its database yet is told about everything.
 		 */
 		for (i = 0; i < segP->lastBackend; i++)
 		{
 			ProcState  *stateP = &segP->procState[i];
-
+			Oid			procDbId;
+
+			if (dbId != InvalidOid && stateP->proc != NULL)
+			{
+				procDbId = stateP->proc->databaseId;
+				if (procDbId != InvalidOid && procDbId != dbId)
+					continue;
+			}
 			stateP->hasMessages = true;
 		}
 
@@ -675,6 +700,20 @@ SICleanupQueue(bool callerHasWriteLock, int minFree)
 		if (stateP->procPid == 0 || stateP->resetState || stateP->sendOnly)
 			continue;
 
+		/*
+		 * A backend that hasn't been kicked has no messages of interest in
+		 * the queue: they all were for other databases.  No reader can be
+		 * running while we hold SInvalReadLock exclusively, and a reader
+		 * leaves hasMessages set if it stopped short of the end, so we can
+		 * just move the backend past them, without making it wake up and
+		 * read them, or resetting it if it has fallen far behind.
+		 */
+		if (!stateP->hasMessages && n < segP->maxMsgNum)
+		{
+			n = stateP->nextMsgNum = segP->maxMsgNum;
+			stateP->signaled = false;
+		}
+
 		/*
 		 * If we must free some space and this backend is preventing it, force
 		 * him into reset state and then ignore until he catches up.
@@ -752,6 +791,31 @@ SICleanupQueue(bool callerHasWriteLock, int minFree)
 }
 
 
+/*
+ * SIMessageDatabase
+ *		Return the database a message is of interest to, or InvalidOid if it
+ *		may be of interest to any backend.
+ *
+ * This must agree with the tests in LocalExecuteInvalidationMessage.
+ */
+static Oid
+SIMessageDatabase(const SharedInvalidationMessage *msg)
+{
+	if (msg->id >= 0)
+		return msg->cc.dbId;
+	else if (msg->id == SHAREDINVALCATALOG_ID)
+		return msg->cat.dbId;
+	else if (msg->id == SHAREDINVALRELCACHE_ID)
+		return msg->rc.dbId;
+	else if (msg->id == SHAREDINVALRELMAP_ID)
+		return msg->rm.dbId;
+	else if (msg->id == SHAREDINVALSNAPSHOT_ID)
+		return msg->sn.dbId;
+
+	/* smgr entries may exist for relations of any database */
+	return InvalidOid;
+}
+
 /*
  * GetNextLocalTransactionId --- allocate a new LocalTransactionId
  *
@@ -22,6 +22,7 @@
 #include "access/xlog.h"
 #include "access/xloginsert.h"
 #include "miscadmin.h"
+#include "replication/slot.h"
 #include "storage/bufmgr.h"
 #include "storage/lmgr.h"
 #include "storage/proc.h"
@@ -284,6 +285,15 @@ ResolveRecoveryConflictWithSnapshot(TransactionId latestRemovedXid, RelFileNode
 
 	ResolveRecoveryConflictWithVirtualXIDs(backends,
 										 PROCSIG_RECOVERY_CONFLICT_SNAPSHOT);
+
+	/*
+	 * Logical slots on this standby conflict as well.  WAL doesn't tell
+	 * whether the removed rows belonged to a catalog, so any cleanup at or
+	 * past a slot's catalog_xmin invalidates it; hot_standby_feedback makes
+	 * the primary hold back cleanup for the slots and avoids that.  Shared
+	 * catalogs have no database and conflict with the slots of all.
+	 */
+	ReplicationSlotsInvalidateLogical(node.dbNode, latestRemovedXid);
 }
 
 void
@@ -1353,6 +1353,22 @@ LockCheckConflicts(LockMethod lockMethodTable,
 		return STATUS_FOUND;
 	}
 
+	/*
+	 * Relation extension and page locks protect the physical structure of a
+	 * relation, which members of a lock group modify independently when they
+	 * insert in parallel; those conflict within the group just as well.  They
+	 * are held briefly and taken in a consistent order, so the group can't
+	 * deadlock against itself on them; which is just as well, since the
+	 * deadlock detector doesn't follow waits between members of a group.
+	 */
+	if (lock->tag.locktag_type == LOCKTAG_RELATION_EXTEND ||
+		lock->tag.locktag_type == LOCKTAG_PAGE)
+	{
+		PROCLOCK_PRINT("LockCheckConflicts: conflicting (group extension)",
+					   proclock);
+		return STATUS_FOUND;
+	}
+
 	/*
 	 * Locks held in conflicting modes by members of our own lock group are
 	 * not real conflicts; we can subtract those out and see if we still have
@@ -183,6 +183,7 @@
 
 #include "postgres.h"
 
+#include "access/csnlog.h"
 #include "access/htup_details.h"
 #include "access/slru.h"
 #include "access/subtrans.h"
@@ -3843,6 +3844,9 @@ XidIsConcurrent(TransactionId xid)
 	if (TransactionIdFollowsOrEquals(xid, snap->xmax))
 		return true;
 
+	if (CommitSeqNoIsValid(snap->snapshot_csn))
+		return CSNLogXidInSnapshot(xid, snap->snapshot_csn);
+
 	for (i = 0; i < snap->xcnt; i++)
 	{
 		if (xid == snap->xip[i])
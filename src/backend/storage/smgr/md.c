@@ -858,6 +858,93 @@ mdwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 		register_dirty_segment(reln, forknum, v);
 }
 
+/*
+ *	mdstartwrite() -- Start writing the supplied block at the appropriate
+ *		location, see smgrstartwrite().
+ */
+void
+mdstartwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			 char *buffer, bool skipFsync, SMgrAsyncWrite *req)
+{
+	off_t		seekpos;
+	MdfdVec    *v;
+
+	/* This assert is too expensive to have on normally ... */
+#ifdef CHECK_WRITE_VS_EXTEND
+	Assert(blocknum < mdnblocks(reln, forknum));
+#endif
+
+	v = _mdfd_getseg(reln, forknum, blocknum, skipFsync,
+					 EXTENSION_FAIL | EXTENSION_CREATE_RECOVERY);
+
+	seekpos = (off_t) BLCKSZ *(blocknum % ((BlockNumber) RELSEG_SIZE));
+
+	Assert(seekpos < (off_t) BLCKSZ * RELSEG_SIZE);
+
+	req->reln = reln;
+	req->forknum = forknum;
+	req->blocknum = blocknum;
+	req->skipFsync = skipFsync;
+
+	if (FileStartWrite(v->mdfd_vfd, buffer, BLCKSZ, seekpos,
+					   &req->fwrite) < 0)
+		ereport(ERROR,
+				(errcode_for_file_access(),
+				 errmsg("could not write block %u in file \"%s\": %m",
+						blocknum, FilePathName(v->mdfd_vfd))));
+}
+
+/*
+ *	mdwaitwrite() -- Finish a write started by mdstartwrite().
+ *
+ * The segment is registered for fsync only now, so that a checkpoint that
+ * absorbs the request can't miss the write.
+ */
+void
+mdwaitwrite(SMgrAsyncWrite *req)
+{
+	SMgrRelation reln = req->reln;
+	int			nbytes;
+	MdfdVec    *v;
+
+	nbytes = FileWaitWrite(&req->fwrite);
+
+	if (nbytes != BLCKSZ)
+	{
+		if (nbytes < 0)
+			ereport(ERROR,
+					(errcode_for_file_access(),
+					 errmsg("could not write block %u in file \"%s\": %m",
+							req->blocknum,
+							FilePathName(req->fwrite.file))));
+		/* short write: complain appropriately */
+		ereport(ERROR,
+				(errcode(ERRCODE_DISK_FULL),
+				 errmsg("could not write block %u in file \"%s\": wrote only %d of %d bytes",
+						req->blocknum,
+						FilePathName(req->fwrite.file),
+						nbytes, BLCKSZ),
+				 errhint("Check free disk space.")));
+	}
+
+	if (!req->skipFsync && !SmgrIsTemp(reln))
+	{
+		v = _mdfd_getseg(reln, req->forknum, req->blocknum, req->skipFsync,
+						 EXTENSION_FAIL);
+		register_dirty_segment(reln, req->forknum, v);
+	}
+}
+
+/*
+ *	mdabortwrite() -- Wait for a write started by mdstartwrite() to end,
+ *		ignoring its result.
+ */
+void
+mdabortwrite(SMgrAsyncWrite *req)
+{
+	(void) FileWaitWrite(&req->fwrite);
+}
+
 /*
  *	mdnblocks() -- Get the number of blocks stored in a relation.
  *
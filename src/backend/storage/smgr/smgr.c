@@ -55,6 +55,11 @@ typedef struct f_smgr
 						 BlockNumber blocknum, char *buffer, bool skipFsync);
 	void		(*smgr_writeback) (SMgrRelation reln, ForkNumber forknum,
 								  BlockNumber blocknum, BlockNumber nblocks);
+	void		(*smgr_startwrite) (SMgrRelation reln, ForkNumber forknum,
+						 BlockNumber blocknum, char *buffer, bool skipFsync,
+												SMgrAsyncWrite *req);
+	void		(*smgr_waitwrite) (SMgrAsyncWrite *req);
+	void		(*smgr_abortwrite) (SMgrAsyncWrite *req);
 	BlockNumber (*smgr_nblocks) (SMgrRelation reln, ForkNumber forknum);
 	void		(*smgr_truncate) (SMgrRelation reln, ForkNumber forknum,
 											  BlockNumber nblocks);
@@ -68,8 +73,9 @@ typedef struct f_smgr
 static const f_smgr smgrsw[] = {
 	/* magnetic disk */
 	{mdinit, NULL, mdclose, mdcreate, mdexists, mdunlink, mdextend,
-		mdprefetch, mdread, mdwrite, mdwriteback, mdnblocks, mdtruncate,
-		mdimmedsync, mdpreckpt, mdsync, mdpostckpt
+		mdprefetch, mdread, mdwrite, mdwriteback, mdstartwrite, mdwaitwrite,
+		mdabortwrite, mdnblocks, mdtruncate, mdimmedsync, mdpreckpt, mdsync,
+		mdpostckpt
 	}
 };
 
@@ -664,6 +670,43 @@ smgrwriteback(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
 												  nblocks);
 }
 
+/*
+ *	smgrstartwrite() -- Start writing the supplied buffer out.
+ *
+ *		Like smgrwrite(), but the write may go on in the background:
+ *		the buffer must not be changed or freed, nor the relation closed,
+ *		until smgrwaitwrite() has been called on req.  Errors of the
+ *		write itself are reported by smgrwaitwrite().
+ */
+void
+smgrstartwrite(SMgrRelation reln, ForkNumber forknum, BlockNumber blocknum,
+			   char *buffer, bool skipFsync, SMgrAsyncWrite *req)
+{
+	(*(smgrsw[reln->smgr_which].smgr_startwrite)) (reln, forknum, blocknum,
+												   buffer, skipFsync, req);
+}
+
+/*
+ *	smgrwaitwrite() -- Wait for a write started by smgrstartwrite().
+ */
+void
+smgrwaitwrite(SMgrAsyncWrite *req)
+{
+	(*(smgrsw[req->reln->smgr_which].smgr_waitwrite)) (req);
+}
+
+/*
+ *	smgrabortwrite() -- Wait for a write started by smgrstartwrite() to
+ *						end, without checking how it went.
+ *
+ *		This is for cleaning up after an error, so it doesn't throw one.
+ */
+void
+smgrabortwrite(SMgrAsyncWrite *req)
+{
+	(*(smgrsw[req->reln->smgr_which].smgr_abortwrite)) (req);
+}
+
 /*
  *	smgrnblocks() -- Calculate the number of blocks in the
  *					 supplied relation.
@@ -65,6 +65,7 @@
 #include "storage/sinval.h"
 #include "tcop/fastpath.h"
 #include "tcop/pquery.h"
+#include "tcop/sessionpool.h"
 #include "tcop/tcopprot.h"
 #include "tcop/utility.h"
 #include "utils/lsyscache.h"
@@ -2880,6 +2881,19 @@ ProcessInterrupts(void)
 		LockErrorCleanup();
 		/* don't send to client, we already know the connection to be dead. */
 		whereToSendOutput = DestNone;
+
+		/*
+		 * A backend serving pooled sessions must not take the other sessions
+		 * down with this one; the main loop closes it once the error has been
+		 * cleaned up after.
+		 */
+		if (SessionPoolConnection)
+		{
+			ClientConnectionLost = false;
+			ereport(ERROR,
+					(errcode(ERRCODE_CONNECTION_FAILURE),
+					 errmsg("connection to client lost")));
+		}
 		ereport(FATAL,
 				(errcode(ERRCODE_CONNECTION_FAILURE),
 				 errmsg("connection to client lost")));
@@ -3725,6 +3739,7 @@ PostgresMain(int argc, char *argv[],
 	 * it inside InitPostgres() instead.  In particular, anything that
 	 * involves database access should be there, not here.
 	 */
+	SessionPoolConnection = SessionPoolWanted(MyProcPort);
 	InitPostgres(dbname, InvalidOid, username, InvalidOid, NULL);
 
 	/*
@@ -3742,6 +3757,13 @@ PostgresMain(int argc, char *argv[],
 
 	SetProcessingMode(NormalProcessing);
 
+	/*
+	 * Hand the connection over to the session pool, if it is to be pooled.
+	 * This does not return if some other backend takes it over.
+	 */
+	if (SessionPoolConnection)
+		SessionPoolStart();
+
 	/*
 	 * Now all GUC states are fully set up.  Report them to client if
 	 * appropriate.
@@ -4016,9 +4038,33 @@ PostgresMain(int argc, char *argv[],
 		DoingCommandRead = true;
 
 		/*
-		 * (3) read a command (loop blocks here)
+		 * (2b) if we serve pooled sessions, wait for whichever session has
+		 * something for us, unless the current one has to go on.  A new
+		 * session first has to be told that it's ready for a query.
+		 */
+		if (SessionPoolConnection && !ignore_till_sync &&
+			whereToSendOutput == DestRemote)
+		{
+			SessionPoolWaitResult result = SessionPoolWaitForCommand();
+
+			if (result != SESSION_POOL_CONTINUE)
+				drop_unnamed_stmt();
+			if (result == SESSION_POOL_STARTED)
+			{
+				DoingCommandRead = false;
+				send_ready_for_query = true;
+				continue;
+			}
+		}
+
+		/*
+		 * (3) read a command (loop blocks here).  A pooled session whose
+		 * client was lost (see ProcessInterrupts) gets closed instead.
 		 */
-		firstchar = ReadCommand(&input_message);
+		if (SessionPoolConnection && whereToSendOutput != DestRemote)
+			firstchar = EOF;
+		else
+			firstchar = ReadCommand(&input_message);
 
 		/*
 		 * (4) disable async signal conditions again.
@@ -4045,11 +4091,16 @@ PostgresMain(int argc, char *argv[],
 		 * (6) check for any other interesting events that happened while we
 		 * slept.
 		 */
-		if (got_SIGHUP)
+		if (got_SIGHUP && !SessionPoolConnection)
 		{
 			got_SIGHUP = false;
 			ProcessConfigFile(PGC_SIGHUP);
 		}
+		else if (got_SIGHUP && !IsTransactionOrTransactionBlock())
+		{
+			got_SIGHUP = false;
+			SessionPoolReloadConfig();
+		}
 
 		/*
 		 * (7) process the command.  But ignore it if we're skipping till
@@ -4276,6 +4327,14 @@ PostgresMain(int argc, char *argv[],
 				if (whereToSendOutput == DestRemote)
 					whereToSendOutput = DestNone;
 
+				/*
+				 * A backend serving pooled sessions goes on with the others,
+				 * if there are any.  The one switched to was told that we
+				 * are ready for a query when it last went idle.
+				 */
+				if (SessionPoolConnection && SessionPoolCloseSession())
+					break;
+
 				/*
 				 * NOTE: if you are tempted to add more code here, DON'T!
 				 * Whatever you had in mind to do should be set up as an
@@ -0,0 +1,1169 @@
+/*-------------------------------------------------------------------------
+ *
+ * sessionpool.c
+ *	  Multiplexing of client sessions onto a pool of backends.
+ *
+ * With session_pool_size set, client connections are not served by a
+ * backend of their own, but by one of up to session_pool_size backends per
+ * database and role.  A connection starts out the usual way: the postmaster
+ * forks a backend, which authenticates the client and connects to the
+ * database.  That backend then either becomes a pool backend itself, if
+ * the pool for the database and role is not full yet, or hands the client
+ * socket over to the pool backend serving the fewest sessions and exits.
+ * Each pool backend listens on a Unix-domain socket in SESSION_POOL_DIR,
+ * through which it receives the sockets, along with what it needs to know
+ * of the startup packet; the sender keeps the connection until the pool
+ * backend acknowledges it, so that a pool backend exiting meanwhile costs
+ * a retry, not the connection.
+ *
+ * A pool backend runs the ordinary PostgresMain loop, but whenever it waits
+ * for the next command outside of a transaction block, it waits for input
+ * on all of its sessions and switches to the session that has some.  So
+ * sessions get multiplexed at transaction boundaries.  Switching keeps the
+ * settings each session made (see SaveSessionGUCState) and its prepared
+ * statements; modules with session state of their own can keep it with
+ * session_pool_hook.  Other session state, such as temporary tables, WITH
+ * HOLD cursors, LISTEN registrations and session-level advisory locks,
+ * belongs to the backend and so is shared by all its sessions; clients
+ * that need such state can opt out of pooling with session_pooling = off
+ * in their startup packet.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/tcop/sessionpool.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include <unistd.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNIX_SOCKETS
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
+
+#include "access/xact.h"
+#include "commands/prepare.h"
+#include "libpq/libpq.h"
+#include "libpq/pqformat.h"
+#include "miscadmin.h"
+#include "port/atomics.h"
+#include "replication/walsender.h"
+#include "storage/fd.h"
+#include "storage/ipc.h"
+#include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "tcop/sessionpool.h"
+#include "tcop/tcopprot.h"
+#include "utils/builtins.h"
+#include "utils/guc.h"
+#include "utils/hsearch.h"
+#include "utils/memutils.h"
+
+
+/* How often a new connection tries to reach a pool backend */
+#define SESSION_POOL_HANDOFF_ATTEMPTS	3
+
+/* Shared registry of the pool backends, one slot per possible backend */
+typedef struct SessionPoolSlot
+{
+	pid_t		pid;			/* pool backend, or 0 if the slot is free */
+	Oid			databaseId;
+	Oid			roleId;
+	int			nsessions;		/* sessions served or being handed over */
+} SessionPoolSlot;
+
+typedef struct SessionPoolCtlData
+{
+	pg_atomic_uint32 nextSessionId;
+	SessionPoolSlot slots[FLEXIBLE_ARRAY_MEMBER];
+} SessionPoolCtlData;
+
+/* A client session served by this backend */
+typedef struct SessionContext
+{
+	int32		id;				/* see SessionPoolSessionId() */
+	Port	   *port;			/* the client connection */
+	MemoryContext memcxt;		/* holds the saved settings */
+	GucSessionState *gucs;		/* saved settings, while not current */
+	HTAB	   *prepared;		/* saved prepared statements, while not
+								 * current */
+	struct SessionContext *next;
+} SessionContext;
+
+/* GUC variables */
+int			session_pool_size = 0;
+bool		session_pooling = true;
+
+bool		SessionPoolConnection = false;
+
+session_pool_hook_type session_pool_hook = NULL;
+
+static SessionPoolCtlData *SessionPoolCtl = NULL;
+
+/* State of a pool backend */
+static SessionPoolSlot *MySessionPoolSlot = NULL;
+static pgsocket SessionPoolSocket = PGINVALID_SOCKET;
+static char SessionPoolSocketPath[MAXPGPATH];
+static SessionContext *Sessions = NULL;
+static SessionContext *ActiveSession = NULL;
+static MemoryContext SessionPoolContext = NULL;
+static MemoryContext BaseGUCContext = NULL;
+static GucSessionState *BaseGUCState = NULL;
+static WaitEventSet *SessionPoolWaitSet = NULL;
+
+#ifdef HAVE_UNIX_SOCKETS
+static bool SessionPoolBecomeBackend(void);
+static bool SessionPoolHandOff(pid_t pid);
+static bool SessionPoolAcceptSession(void);
+static bool SessionPoolStartSession(SessionContext *session);
+#endif
+static SessionContext *SessionPoolNewSession(Port *port);
+static void SessionPoolLeave(void);
+static void SessionPoolEnter(SessionContext *session);
+static void SessionPoolFreeSession(SessionContext *session);
+static void SessionPoolShmemExit(int code, Datum arg);
+
+
+/*
+ * Report shared-memory space needed by SessionPoolShmemInit.
+ */
+Size
+SessionPoolShmemSize(void)
+{
+	Size		size;
+
+	if (session_pool_size == 0)
+		return 0;
+
+	size = offsetof(SessionPoolCtlData, slots);
+	size = add_size(size, mul_size(MaxBackends, sizeof(SessionPoolSlot)));
+
+	return size;
+}
+
+/*
+ * Allocate and initialize the shared registry of pool backends.
+ */
+void
+SessionPoolShmemInit(void)
+{
+	bool		found;
+
+	if (session_pool_size == 0)
+		return;
+
+	SessionPoolCtl = (SessionPoolCtlData *)
+		ShmemInitStruct("Session Pool Ctl", SessionPoolShmemSize(), &found);
+
+	if (!found)
+	{
+		pg_atomic_init_u32(&SessionPoolCtl->nextSessionId, 0);
+		MemSet(SessionPoolCtl->slots, 0,
+			   mul_size(MaxBackends, sizeof(SessionPoolSlot)));
+	}
+}
+
+/*
+ * Create the directory for the pool backends' sockets, or clean it out.
+ * Called by the postmaster at startup, when no backends can be around.
+ */
+void
+SessionPoolInitSocketDir(void)
+{
+	DIR		   *dir;
+	struct dirent *de;
+
+	if (session_pool_size == 0)
+		return;
+
+	if (mkdir(SESSION_POOL_DIR, S_IRWXU) < 0 && errno != EEXIST)
+		ereport(FATAL,
+				(errcode_for_file_access(),
+				 errmsg("could not create directory \"%s\": %m",
+						SESSION_POOL_DIR)));
+
+	dir = AllocateDir(SESSION_POOL_DIR);
+	while ((de = ReadDir(dir, SESSION_POOL_DIR)) != NULL)
+	{
+		char		path[MAXPGPATH];
+
+		if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0)
+			continue;
+
+		snprintf(path, sizeof(path), "%s/%s", SESSION_POOL_DIR, de->d_name);
+		if (unlink(path) < 0)
+			ereport(LOG,
+					(errcode_for_file_access(),
+					 errmsg("could not remove file \"%s\": %m", path)));
+	}
+	FreeDir(dir);
+}
+
+#ifdef HAVE_UNIX_SOCKETS
+
+/*
+ * Does a setting from the startup packet say session_pooling = off?
+ */
+static bool
+SessionPoolingDisabled(const char *name, const char *value)
+{
+	bool		result;
+
+	return pg_strcasecmp(name, "session_pooling") == 0 &&
+		parse_bool(value, &result) && !result;
+}
+
+#endif   /* HAVE_UNIX_SOCKETS */
+
+/*
+ * Should the connection described by the startup packet be pooled?
+ *
+ * Called before InitPostgres(), which then leaves the startup options to
+ * SessionPoolStart().  Only regular connections speaking the current
+ * protocol can be pooled, and not SSL connections, whose state cannot be
+ * handed over.
+ */
+bool
+SessionPoolWanted(Port *port)
+{
+#ifdef HAVE_UNIX_SOCKETS
+	ListCell   *lc;
+
+	if (session_pool_size == 0 || !IsUnderPostmaster || port == NULL)
+		return false;
+
+	if (am_walsender || PG_PROTOCOL_MAJOR(port->proto) < 3 ||
+		port->ssl_in_use)
+		return false;
+
+	/* guc_options alternates names and values */
+	lc = list_head(port->guc_options);
+	while (lc != NULL)
+	{
+		char	   *name = lfirst(lc);
+		char	   *value;
+
+		lc = lnext(lc);
+		value = lfirst(lc);
+		lc = lnext(lc);
+
+		if (SessionPoolingDisabled(name, value))
+			return false;
+	}
+
+	/* as can -c and -- switches in the options, such as from PGOPTIONS */
+	if (port->cmdline_options != NULL)
+	{
+		char	  **av;
+		int			ac = 0;
+		int			i;
+		bool		disabled = false;
+
+		av = (char **) palloc((1 + (strlen(port->cmdline_options) + 1) / 2) *
+							  sizeof(char *));
+		pg_split_opts(av, &ac, port->cmdline_options);
+
+		for (i = 0; i < ac && !disabled; i++)
+		{
+			const char *opt = NULL;
+			char	   *name;
+			char	   *value;
+
+			if (strcmp(av[i], "-c") == 0 && i + 1 < ac)
+				opt = av[++i];
+			else if (strncmp(av[i], "-c", 2) == 0 ||
+					 strncmp(av[i], "--", 2) == 0)
+				opt = av[i] + 2;
+			if (opt == NULL)
+				continue;
+
+			ParseLongOption(opt, &name, &value);
+			if (value != NULL)
+				disabled = SessionPoolingDisabled(name, value);
+			free(name);
+			if (value)
+				free(value);
+		}
+
+		for (i = 0; i < ac; i++)
+			pfree(av[i]);
+		pfree(av);
+
+		if (disabled)
+			return false;
+	}
+
+	return true;
+#else
+	return false;
+#endif
+}
+
+/*
+ * Hand the new connection over to the session pool.
+ *
+ * Called once InitPostgres() has authenticated the client.  Either makes
+ * this backend a pool backend, serving the connection as its first
+ * session, or passes the connection on to a pool backend and exits.  If
+ * neither works out, the connection is served the usual way.
+ */
+void
+SessionPoolStart(void)
+{
+#ifdef HAVE_UNIX_SOCKETS
+	int			attempt;
+
+	Assert(SessionPoolConnection);
+
+	for (attempt = 0; attempt < SESSION_POOL_HANDOFF_ATTEMPTS; attempt++)
+	{
+		SessionPoolSlot *target = NULL;
+		SessionPoolSlot *freeslot = NULL;
+		pid_t		target_pid = 0;
+		int			npool = 0;
+		int			i;
+
+		LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+
+		for (i = 0; i < MaxBackends; i++)
+		{
+			SessionPoolSlot *slot = &SessionPoolCtl->slots[i];
+
+			if (slot->pid == 0)
+			{
+				if (freeslot == NULL)
+					freeslot = slot;
+				continue;
+			}
+			if (slot->databaseId != MyDatabaseId ||
+				slot->roleId != GetSessionUserId())
+				continue;
+
+			npool++;
+			if (target == NULL || slot->nsessions < target->nsessions)
+				target = slot;
+		}
+
+		if (npool < session_pool_size && freeslot != NULL)
+		{
+			freeslot->pid = MyProcPid;
+			freeslot->databaseId = MyDatabaseId;
+			freeslot->roleId = GetSessionUserId();
+			freeslot->nsessions = 1;
+			MySessionPoolSlot = freeslot;
+			target = NULL;
+		}
+		else if (target != NULL)
+		{
+			target->nsessions++;
+			target_pid = target->pid;
+		}
+
+		LWLockRelease(SessionPoolLock);
+
+		if (MySessionPoolSlot != NULL)
+		{
+			if (SessionPoolBecomeBackend())
+				return;
+			break;
+		}
+
+		if (target == NULL)
+			break;
+
+		if (SessionPoolHandOff(target_pid))
+		{
+			/* the connection is in the pool backend's hands now */
+			whereToSendOutput = DestNone;
+			proc_exit(0);
+		}
+
+		/* the pool backend went away meanwhile; try again */
+		LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+		if (target->pid == target_pid && target->nsessions > 0)
+			target->nsessions--;
+		LWLockRelease(SessionPoolLock);
+	}
+#endif
+
+	/* No luck, so serve the connection without pooling */
+	SessionPoolConnection = false;
+
+	StartTransactionCommand();
+	process_startup_options(MyProcPort, superuser());
+	CommitTransactionCommand();
+}
+
+#ifdef HAVE_UNIX_SOCKETS
+
+/*
+ * Make this backend a pool backend, with MyProcPort as its first session.
+ * MySessionPoolSlot has been claimed already; returns false, having given
+ * it up again, if the socket for receiving sessions can't be set up.
+ */
+static bool
+SessionPoolBecomeBackend(void)
+{
+	struct sockaddr_un addr;
+	pgsocket	sock;
+	MemoryContext oldcontext;
+
+	snprintf(SessionPoolSocketPath, sizeof(SessionPoolSocketPath),
+			 "%s/%d", SESSION_POOL_DIR, (int) MyProcPid);
+
+	MemSet(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strlcpy(addr.sun_path, SessionPoolSocketPath, sizeof(addr.sun_path));
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == PGINVALID_SOCKET)
+	{
+		ereport(LOG,
+				(errcode_for_socket_access(),
+				 errmsg("could not create session pool socket: %m")));
+		goto fail;
+	}
+
+	(void) unlink(SessionPoolSocketPath);
+	if (bind(sock, (struct sockaddr *) & addr, sizeof(addr)) < 0 ||
+		listen(sock, MaxConnections) < 0 ||
+		!pg_set_noblock(sock))
+	{
+		ereport(LOG,
+				(errcode_for_socket_access(),
+				 errmsg("could not set up session pool socket \"%s\": %m",
+						SessionPoolSocketPath)));
+		closesocket(sock);
+		(void) unlink(SessionPoolSocketPath);
+		goto fail;
+	}
+
+	SessionPoolSocket = sock;
+	on_shmem_exit(SessionPoolShmemExit, 0);
+
+	SessionPoolContext = AllocSetContextCreate(TopMemoryContext,
+											   "SessionPool",
+											   ALLOCSET_DEFAULT_SIZES);
+	BaseGUCContext = AllocSetContextCreate(SessionPoolContext,
+										   "SessionPool base settings",
+										   ALLOCSET_DEFAULT_SIZES);
+
+	/* what every session starts from, before its startup options */
+	oldcontext = MemoryContextSwitchTo(BaseGUCContext);
+	BaseGUCState = SaveSessionGUCState(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	ActiveSession = SessionPoolNewSession(MyProcPort);
+
+	StartTransactionCommand();
+	process_startup_options(MyProcPort, superuser());
+	if (session_pool_hook)
+		(*session_pool_hook) (SESSION_POOL_SWITCH_IN, ActiveSession->id);
+	CommitTransactionCommand();
+
+	return true;
+
+fail:
+	LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+	MySessionPoolSlot->pid = 0;
+	LWLockRelease(SessionPoolLock);
+	MySessionPoolSlot = NULL;
+	return false;
+}
+
+/*
+ * Pass MyProcPort on to the pool backend with the given PID.
+ *
+ * Sends the client socket, and the parts of the Port the pool backend needs,
+ * then waits for the pool backend to acknowledge them.  Returns false if
+ * the pool backend could not be reached or went away before taking over.
+ */
+static bool
+SessionPoolHandOff(pid_t pid)
+{
+	struct sockaddr_un addr;
+	pgsocket	sock;
+	StringInfoData buf;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union
+	{
+		struct cmsghdr align;
+		char		data[CMSG_SPACE(sizeof(int))];
+	}			cmsgbuf;
+	int32		len;
+	ssize_t		sent;
+	ListCell   *lc;
+	char		ack;
+	bool		result = false;
+
+	MemSet(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/%d",
+			 SESSION_POOL_DIR, (int) pid);
+
+	sock = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (sock == PGINVALID_SOCKET)
+		return false;
+	if (connect(sock, (struct sockaddr *) & addr, sizeof(addr)) < 0)
+	{
+		closesocket(sock);
+		return false;
+	}
+
+	/* length word first, filled in below */
+	initStringInfo(&buf);
+	len = 0;
+	appendBinaryStringInfo(&buf, (char *) &len, sizeof(len));
+	appendBinaryStringInfo(&buf, (char *) &MyProcPort->proto,
+						   sizeof(ProtocolVersion));
+	appendBinaryStringInfo(&buf, (char *) &MyProcPort->laddr, sizeof(SockAddr));
+	appendBinaryStringInfo(&buf, (char *) &MyProcPort->raddr, sizeof(SockAddr));
+	appendBinaryStringInfo(&buf, (char *) &MyProcPort->SessionStartTime,
+						   sizeof(TimestampTz));
+#define APPEND_STRING(s) \
+	appendBinaryStringInfo(&buf, (s) ? (s) : "", strlen((s) ? (s) : "") + 1)
+	APPEND_STRING(MyProcPort->remote_host);
+	APPEND_STRING(MyProcPort->remote_hostname);
+	APPEND_STRING(MyProcPort->remote_port);
+	APPEND_STRING(MyProcPort->database_name);
+	APPEND_STRING(MyProcPort->user_name);
+	APPEND_STRING(MyProcPort->cmdline_options);
+	foreach(lc, MyProcPort->guc_options)
+		APPEND_STRING((char *) lfirst(lc));
+#undef APPEND_STRING
+	len = buf.len;
+	memcpy(buf.data, &len, sizeof(len));
+
+	/*
+	 * The client must see the authentication response, which is left
+	 * unflushed until the backend is ready for queries, before anything
+	 * the pool backend sends it.
+	 */
+	if (pq_flush() != 0)
+	{
+		pfree(buf.data);
+		closesocket(sock);
+		return false;
+	}
+
+	/* the client socket travels with the first chunk */
+	MemSet(&msg, 0, sizeof(msg));
+	iov.iov_base = buf.data;
+	iov.iov_len = buf.len;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.data;
+	msg.msg_controllen = sizeof(cmsgbuf.data);
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &MyProcPort->sock, sizeof(int));
+
+	sent = sendmsg(sock, &msg, 0);
+	while (sent > 0 && sent < buf.len)
+	{
+		ssize_t		rc = send(sock, buf.data + sent, buf.len - sent, 0);
+
+		if (rc <= 0)
+		{
+			sent = -1;
+			break;
+		}
+		sent += rc;
+	}
+	pfree(buf.data);
+
+	if (sent == len && pg_set_noblock(sock))
+	{
+		for (;;)
+		{
+			ssize_t		rc = recv(sock, &ack, 1, 0);
+
+			if (rc == 1)
+			{
+				result = true;
+				break;
+			}
+			if (rc == 0 || (errno != EAGAIN && errno != EWOULDBLOCK &&
+							errno != EINTR))
+				break;
+
+			rc = WaitLatchOrSocket(MyLatch,
+						   WL_LATCH_SET | WL_SOCKET_READABLE | WL_POSTMASTER_DEATH,
+								   sock, -1L);
+			if (rc & WL_POSTMASTER_DEATH)
+				break;
+			ResetLatch(MyLatch);
+			CHECK_FOR_INTERRUPTS();
+		}
+	}
+
+	closesocket(sock);
+	return result;
+}
+
+/*
+ * Take over a connection offered on SessionPoolSocket.
+ *
+ * Returns true if this made a new session the current one.
+ */
+static bool
+SessionPoolAcceptSession(void)
+{
+	pgsocket	conn;
+	struct msghdr msg;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	union
+	{
+		struct cmsghdr align;
+		char		data[CMSG_SPACE(sizeof(int))];
+	}			cmsgbuf;
+	int32		len;
+	char	   *data = NULL;
+	char	   *ptr;
+	char	   *end;
+	ssize_t		rc;
+	pgsocket	clientsock = PGINVALID_SOCKET;
+	Port	   *port;
+	SessionContext *session;
+	MemoryContext oldcontext;
+	char		ack = 0;
+	bool		failed;
+
+	conn = accept(SessionPoolSocket, NULL, NULL);
+	if (conn == PGINVALID_SOCKET)
+		return false;
+
+	/*
+	 * The sender wrote everything already, so blocking reads are fine.
+	 */
+	if (!pg_set_block(conn))
+		goto fail;
+
+	MemSet(&msg, 0, sizeof(msg));
+	iov.iov_base = &len;
+	iov.iov_len = sizeof(len);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cmsgbuf.data;
+	msg.msg_controllen = sizeof(cmsgbuf.data);
+
+	rc = recvmsg(conn, &msg, 0);
+	if (rc != sizeof(len) || len <= sizeof(len))
+		goto fail;
+	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg))
+	{
+		if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS)
+			memcpy(&clientsock, CMSG_DATA(cmsg), sizeof(int));
+	}
+	if (clientsock == PGINVALID_SOCKET)
+		goto fail;
+
+	len -= sizeof(len);
+	data = palloc(len);
+	for (ptr = data; ptr < data + len; ptr += rc)
+	{
+		rc = recv(conn, ptr, data + len - ptr, 0);
+		if (rc <= 0)
+			goto fail;
+	}
+
+	/* Build a Port the way ConnCreate() does */
+	port = (Port *) calloc(1, sizeof(Port));
+	if (port == NULL)
+		goto fail;
+#if defined(ENABLE_GSS) || defined(ENABLE_SSPI)
+	port->gss = (pg_gssinfo *) calloc(1, sizeof(pg_gssinfo));
+	if (port->gss == NULL)
+	{
+		free(port);
+		goto fail;
+	}
+#endif
+	port->sock = clientsock;
+
+	ptr = data;
+	end = data + len;
+	failed = false;
+#define GET_BINARY(dst, size) \
+	do { \
+		if (end - ptr < (size)) \
+			failed = true; \
+		else \
+		{ \
+			memcpy((dst), ptr, (size)); \
+			ptr += (size); \
+		} \
+	} while (0)
+	GET_BINARY(&port->proto, sizeof(ProtocolVersion));
+	GET_BINARY(&port->laddr, sizeof(SockAddr));
+	GET_BINARY(&port->raddr, sizeof(SockAddr));
+	GET_BINARY(&port->SessionStartTime, sizeof(TimestampTz));
+#undef GET_BINARY
+
+	oldcontext = MemoryContextSwitchTo(TopMemoryContext);
+#define GET_STRING(dst) \
+	do { \
+		char	   *s = ptr; \
+		while (ptr < end && *ptr != '\0') \
+			ptr++; \
+		if (ptr >= end) \
+			failed = true; \
+		else \
+		{ \
+			ptr++; \
+			(dst) = *s ? pstrdup(s) : NULL; \
+		} \
+	} while (0)
+	if (!failed)
+	{
+		GET_STRING(port->remote_host);
+		GET_STRING(port->remote_hostname);
+		GET_STRING(port->remote_port);
+		GET_STRING(port->database_name);
+		GET_STRING(port->user_name);
+		GET_STRING(port->cmdline_options);
+	}
+	while (!failed && ptr < end)
+	{
+		char	   *name = NULL;
+		char	   *value = NULL;
+
+		GET_STRING(name);
+		if (!failed)
+			GET_STRING(value);
+		if (!failed)
+			port->guc_options = lappend(lappend(port->guc_options,
+												name ? name : pstrdup("")),
+										value ? value : pstrdup(""));
+	}
+#undef GET_STRING
+	MemoryContextSwitchTo(oldcontext);
+
+	if (failed || !pg_set_noblock(clientsock))
+	{
+		ereport(LOG,
+				(errmsg("invalid session handed over to session pool")));
+#if defined(ENABLE_GSS) || defined(ENABLE_SSPI)
+		free(port->gss);
+#endif
+		free(port);
+		goto fail;
+	}
+
+	/* It's ours now; let the sender go */
+	(void) send(conn, &ack, 1, 0);
+	closesocket(conn);
+	pfree(data);
+
+	session = SessionPoolNewSession(port);
+	if (!SessionPoolStartSession(session))
+		return false;
+
+	/* Finish the startup sequence, as PostgresMain does */
+	BeginReportingGUCOptions();
+	{
+		StringInfoData buf;
+
+		pq_beginmessage(&buf, 'K');
+		pq_sendint(&buf, (int32) MyProcPid, sizeof(int32));
+		pq_sendint(&buf, (int32) MyCancelKey, sizeof(int32));
+		pq_endmessage(&buf);
+	}
+
+	return true;
+
+fail:
+	if (clientsock != PGINVALID_SOCKET)
+		closesocket(clientsock);
+	closesocket(conn);
+	if (data != NULL)
+		pfree(data);
+	return false;
+}
+
+/*
+ * Switch to a session just taken over, and apply its startup options.
+ *
+ * If that fails, the client is told why, the session is closed and we
+ * switch back to one of the others.
+ */
+static bool
+SessionPoolStartSession(SessionContext *session)
+{
+	volatile bool startup_failed = false;
+
+	StartTransactionCommand();
+	SessionPoolLeave();
+
+	pq_switch_port(session->port);
+	whereToSendOutput = DestRemote;
+	ActiveSession = session;
+
+	PG_TRY();
+	{
+		process_startup_options(session->port, superuser());
+	}
+	PG_CATCH();
+	{
+		/* Tell the client why, and forget about it */
+		HOLD_INTERRUPTS();
+		EmitErrorReport();
+		pq_flush();
+		AbortOutOfAnyTransaction();
+		FlushErrorState();
+		RESUME_INTERRUPTS();
+
+		startup_failed = true;
+	}
+	PG_END_TRY();
+
+	if (startup_failed)
+	{
+		whereToSendOutput = DestNone;
+
+		StartTransactionCommand();
+		ResetSessionGUCState(SaveSessionGUCState(BaseGUCState), BaseGUCState);
+
+		Sessions = session->next;
+		ActiveSession = NULL;
+
+		LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+		MySessionPoolSlot->nsessions--;
+		LWLockRelease(SessionPoolLock);
+
+		SessionPoolEnter(Sessions);
+		CommitTransactionCommand();
+
+		SessionPoolFreeSession(session);
+		return false;
+	}
+
+	if (session_pool_hook)
+		(*session_pool_hook) (SESSION_POOL_SWITCH_IN, session->id);
+	CommitTransactionCommand();
+
+	return true;
+}
+
+#endif   /* HAVE_UNIX_SOCKETS */
+
+/*
+ * Create the context for a session served by this backend, and add it
+ * to the list.
+ */
+static SessionContext *
+SessionPoolNewSession(Port *port)
+{
+	SessionContext *session;
+
+	session = (SessionContext *) MemoryContextAllocZero(SessionPoolContext,
+													  sizeof(SessionContext));
+
+	/* negative, so as not to be mistaken for the PID of another backend */
+	session->id = -(int32) (pg_atomic_fetch_add_u32(&SessionPoolCtl->nextSessionId, 1)
+							% PG_INT32_MAX) - 1;
+	session->port = port;
+	session->memcxt = AllocSetContextCreate(SessionPoolContext,
+											"SessionContext",
+											ALLOCSET_SMALL_SIZES);
+	session->next = Sessions;
+	Sessions = session;
+
+	/* the wait set needs to include the new socket */
+	if (SessionPoolWaitSet != NULL)
+	{
+		FreeWaitEventSet(SessionPoolWaitSet);
+		SessionPoolWaitSet = NULL;
+	}
+
+	return session;
+}
+
+/*
+ * Leave the current session: save its state, and go back to the base state.
+ * Must be called in a transaction.
+ */
+static void
+SessionPoolLeave(void)
+{
+	SessionContext *session = ActiveSession;
+	MemoryContext oldcontext;
+
+	Assert(session != NULL);
+
+	if (session_pool_hook)
+		(*session_pool_hook) (SESSION_POOL_SWITCH_OUT, session->id);
+
+	MemoryContextReset(session->memcxt);
+	oldcontext = MemoryContextSwitchTo(session->memcxt);
+	session->gucs = SaveSessionGUCState(BaseGUCState);
+	MemoryContextSwitchTo(oldcontext);
+	ResetSessionGUCState(session->gucs, BaseGUCState);
+
+	session->prepared = SwitchPreparedStatements(NULL);
+
+	ActiveSession = NULL;
+}
+
+/*
+ * Make a session the current one, restoring its state.  Must be called in
+ * a transaction.
+ */
+static void
+SessionPoolEnter(SessionContext *session)
+{
+	Assert(ActiveSession == NULL);
+
+	pq_switch_port(session->port);
+	whereToSendOutput = DestRemote;
+	ActiveSession = session;
+
+	(void) SwitchPreparedStatements(session->prepared);
+	session->prepared = NULL;
+
+	if (session->gucs != NULL)
+		RestoreSessionGUCState(session->gucs);
+	MemoryContextReset(session->memcxt);
+	session->gucs = NULL;
+
+	if (session_pool_hook)
+		(*session_pool_hook) (SESSION_POOL_SWITCH_IN, session->id);
+}
+
+/*
+ * Release what is left of a session that is already off the list.
+ */
+static void
+SessionPoolFreeSession(SessionContext *session)
+{
+	Port	   *port = session->port;
+
+	closesocket(port->sock);
+#if defined(ENABLE_GSS) || defined(ENABLE_SSPI)
+	free(port->gss);
+#endif
+	free(port);
+
+	MemoryContextDelete(session->memcxt);
+	pfree(session);
+
+	if (SessionPoolWaitSet != NULL)
+	{
+		FreeWaitEventSet(SessionPoolWaitSet);
+		SessionPoolWaitSet = NULL;
+	}
+}
+
+/*
+ * Wait until some session has a command for us, switching to it.
+ *
+ * Called by PostgresMain before reading a command.  Only when the current
+ * session is idle outside of a transaction block, with nothing read ahead,
+ * can other sessions take their turn, or new sessions be taken over.
+ */
+SessionPoolWaitResult
+SessionPoolWaitForCommand(void)
+{
+	Assert(ActiveSession != NULL);
+
+	if (IsTransactionOrTransactionBlock() || pq_buffer_has_data())
+		return SESSION_POOL_CONTINUE;
+
+	for (;;)
+	{
+		WaitEvent	event;
+		SessionContext *session;
+
+		if (SessionPoolWaitSet == NULL)
+		{
+			int			nsessions = 0;
+
+			for (session = Sessions; session != NULL; session = session->next)
+				nsessions++;
+
+			SessionPoolWaitSet = CreateWaitEventSet(TopMemoryContext,
+													nsessions + 3);
+			AddWaitEventToSet(SessionPoolWaitSet, WL_LATCH_SET, -1,
+							  MyLatch, NULL);
+			AddWaitEventToSet(SessionPoolWaitSet, WL_POSTMASTER_DEATH, -1,
+							  NULL, NULL);
+			AddWaitEventToSet(SessionPoolWaitSet, WL_SOCKET_READABLE,
+							  SessionPoolSocket, NULL, NULL);
+			for (session = Sessions; session != NULL; session = session->next)
+				AddWaitEventToSet(SessionPoolWaitSet, WL_SOCKET_READABLE,
+								  session->port->sock, NULL, session);
+		}
+
+		(void) WaitEventSetWait(SessionPoolWaitSet, -1, &event, 1);
+
+		if (event.events & WL_POSTMASTER_DEATH)
+			ereport(FATAL,
+					(errcode(ERRCODE_ADMIN_SHUTDOWN),
+					 errmsg("terminating connection due to unexpected postmaster exit")));
+
+		if (event.events & WL_LATCH_SET)
+		{
+			ResetLatch(MyLatch);
+			ProcessClientReadInterrupt(true);
+			continue;
+		}
+
+		if (!(event.events & WL_SOCKET_READABLE))
+			continue;
+
+		session = (SessionContext *) event.user_data;
+		if (session == NULL)
+		{
+#ifdef HAVE_UNIX_SOCKETS
+			if (SessionPoolAcceptSession())
+				return SESSION_POOL_STARTED;
+#endif
+			continue;
+		}
+
+		if (session == ActiveSession)
+			return SESSION_POOL_CONTINUE;
+
+		StartTransactionCommand();
+		SessionPoolLeave();
+		SessionPoolEnter(session);
+		CommitTransactionCommand();
+
+		return SESSION_POOL_SWITCHED;
+	}
+}
+
+/*
+ * The current session's client has gone away.
+ *
+ * Switches to another session and returns true, or returns false if it was
+ * the last one, in which case the backend should exit as usual.
+ */
+bool
+SessionPoolCloseSession(void)
+{
+	SessionContext *session = ActiveSession;
+	SessionContext **prev;
+	HTAB	   *prepared;
+
+	Assert(session != NULL);
+
+	/* a client can go away in the middle of a transaction block */
+	AbortOutOfAnyTransaction();
+
+	LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+	if (Sessions == session && session->next == NULL)
+	{
+		/* don't let anyone hand us more sessions */
+		MySessionPoolSlot->pid = 0;
+		LWLockRelease(SessionPoolLock);
+		return false;
+	}
+	MySessionPoolSlot->nsessions--;
+	LWLockRelease(SessionPoolLock);
+
+	StartTransactionCommand();
+
+	if (session_pool_hook)
+		(*session_pool_hook) (SESSION_POOL_CLOSE, session->id);
+
+	DropAllPreparedStatements();
+	prepared = SwitchPreparedStatements(NULL);
+	if (prepared != NULL)
+		hash_destroy(prepared);
+
+	ResetSessionGUCState(SaveSessionGUCState(BaseGUCState), BaseGUCState);
+
+	for (prev = &Sessions; *prev != session; prev = &(*prev)->next)
+		;
+	*prev = session->next;
+	ActiveSession = NULL;
+
+	SessionPoolEnter(Sessions);
+	CommitTransactionCommand();
+
+	SessionPoolFreeSession(session);
+
+	return true;
+}
+
+/*
+ * Reread the configuration file.
+ *
+ * The base state of the sessions has to follow the file, so the current
+ * session's settings are set aside while the file is processed.  Must be
+ * called outside of transaction blocks.
+ */
+void
+SessionPoolReloadConfig(void)
+{
+	GucSessionState *state;
+	MemoryContext oldcontext;
+
+	Assert(ActiveSession != NULL);
+
+	StartTransactionCommand();
+
+	MemoryContextReset(ActiveSession->memcxt);
+	oldcontext = MemoryContextSwitchTo(ActiveSession->memcxt);
+	state = SaveSessionGUCState(BaseGUCState);
+	MemoryContextSwitchTo(oldcontext);
+	ResetSessionGUCState(state, BaseGUCState);
+
+	ProcessConfigFile(PGC_SIGHUP);
+
+	MemoryContextReset(BaseGUCContext);
+	oldcontext = MemoryContextSwitchTo(BaseGUCContext);
+	BaseGUCState = SaveSessionGUCState(NULL);
+	MemoryContextSwitchTo(oldcontext);
+
+	RestoreSessionGUCState(state);
+
+	CommitTransactionCommand();
+
+	MemoryContextReset(ActiveSession->memcxt);
+}
+
+/*
+ * Identifier of the current session: the backend's PID, or a negative
+ * number unique among the pooled sessions.
+ */
+int32
+SessionPoolSessionId(void)
+{
+	return ActiveSession != NULL ? ActiveSession->id : (int32) MyProcPid;
+}
+
+/*
+ * Give up our slot, and the socket, at backend exit.
+ */
+static void
+SessionPoolShmemExit(int code, Datum arg)
+{
+	if (MySessionPoolSlot != NULL)
+	{
+		LWLockAcquire(SessionPoolLock, LW_EXCLUSIVE);
+		if (MySessionPoolSlot->pid == MyProcPid)
+			MySessionPoolSlot->pid = 0;
+		LWLockRelease(SessionPoolLock);
+		MySessionPoolSlot = NULL;
+	}
+
+	if (SessionPoolSocket != PGINVALID_SOCKET)
+	{
+		closesocket(SessionPoolSocket);
+		SessionPoolSocket = PGINVALID_SOCKET;
+		(void) unlink(SessionPoolSocketPath);
+	}
+}
@@ -21,9 +21,11 @@
 
 #include "postgres.h"
 
+#include "access/csnlog.h"
 #include "access/transam.h"
 #include "access/xact.h"
 #include "access/xlog.h"
+#include "access/xtm.h"
 #include "funcapi.h"
 #include "miscadmin.h"
 #include "libpq/pqformat.h"
@@ -405,16 +407,53 @@ txid_current_snapshot(PG_FUNCTION_ARGS)
 	StaticAssertStmt(MAX_BACKENDS * 2 <= TXID_SNAPSHOT_MAX_NXIP,
 					 "possible overflow in txid_current_snapshot()");
 
-	/* allocate */
-	nxip = cur->xcnt;
-	snap = palloc(TXID_SNAPSHOT_SIZE(nxip));
+	if (CommitSeqNoIsValid(cur->snapshot_csn))
+	{
+		/*
+		 * A CSN snapshot has no xip array, so collect the XIDs it considers
+		 * running.  Subtransactions and aborted transactions can't be told
+		 * apart here, but txid_visible_in_snapshot gives the right answer
+		 * for them anyway.
+		 */
+		TransactionId xid;
+		uint32		maxxip = 64;
 
-	/* fill */
+		snap = palloc(TXID_SNAPSHOT_SIZE(maxxip));
+		nxip = 0;
+		for (xid = cur->xmin; TransactionIdPrecedes(xid, cur->xmax);)
+		{
+			if (!CsnXidInMVCCSnapshot(xid, cur))
+			{
+				TransactionIdAdvance(xid);
+				continue;
+			}
+			if (nxip == maxxip)
+			{
+				if (maxxip * 2 > TXID_SNAPSHOT_MAX_NXIP)
+					ereport(ERROR,
+							(errcode(ERRCODE_PROGRAM_LIMIT_EXCEEDED),
+							 errmsg("too many transactions in snapshot")));
+				maxxip *= 2;
+				snap = repalloc(snap, TXID_SNAPSHOT_SIZE(maxxip));
+			}
+			snap->xip[nxip++] = convert_xid(xid, &state);
+			TransactionIdAdvance(xid);
+		}
+		snap->nxip = nxip;
+	}
+	else
+	{
+		/* allocate */
+		nxip = cur->xcnt;
+		snap = palloc(TXID_SNAPSHOT_SIZE(nxip));
+
+		/* fill */
+		snap->nxip = nxip;
+		for (i = 0; i < nxip; i++)
+			snap->xip[i] = convert_xid(cur->xip[i], &state);
+	}
 	snap->xmin = convert_xid(cur->xmin, &state);
 	snap->xmax = convert_xid(cur->xmax, &state);
-	snap->nxip = nxip;
-	for (i = 0; i < nxip; i++)
-		snap->xip[i] = convert_xid(cur->xip[i], &state);
 
 	/*
 	 * We want them guaranteed to be in ascending order.  This also removes
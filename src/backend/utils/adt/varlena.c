@@ -95,7 +95,6 @@ typedef struct
 static int	varstrfastcmp_c(Datum x, Datum y, SortSupport ssup);
 static int	bpcharfastcmp_c(Datum x, Datum y, SortSupport ssup);
 static int	varstrfastcmp_locale(Datum x, Datum y, SortSupport ssup);
-static int	varstrcmp_abbrev(Datum x, Datum y, SortSupport ssup);
 static Datum varstr_abbrev_convert(Datum original, SortSupport ssup);
 static bool varstr_abbrev_abort(int memtupcount, SortSupport ssup);
 static int32 text_length(Datum str);
@@ -1903,6 +1902,13 @@ varstr_sortsupport(SortSupport ssup, Oid collid, bool bpchar)
 		 * If possible, plan to use the abbreviated keys optimization.  The
 		 * core code may switch back to authoritative comparator should
 		 * abbreviation be aborted.
+		 *
+		 * Abbreviated keys compare as unsigned integers.  When they are
+		 * equal, the core system will call varstrfastcmp_c()
+		 * (bpcharfastcmp_c() in BpChar case) or varstrfastcmp_locale().
+		 * Even a strcmp() on two non-truncated strxfrm() blobs cannot
+		 * indicate *equality* authoritatively, for the same reason that
+		 * there is a strcoll() tie-breaker call to strcmp() in varstr_cmp().
 		 */
 		if (abbreviate)
 		{
@@ -1910,7 +1916,7 @@ varstr_sortsupport(SortSupport ssup, Oid collid, bool bpchar)
 			initHyperLogLog(&sss->abbr_card, 10);
 			initHyperLogLog(&sss->full_card, 10);
 			ssup->abbrev_full_comparator = ssup->comparator;
-			ssup->comparator = varstrcmp_abbrev;
+			ssup->comparator = ssup_datum_unsigned_cmp;
 			ssup->abbrev_converter = varstr_abbrev_convert;
 			ssup->abbrev_abort = varstr_abbrev_abort;
 		}
@@ -2117,27 +2123,6 @@ done:
 	return result;
 }
 
-/*
- * Abbreviated key comparison func
- */
-static int
-varstrcmp_abbrev(Datum x, Datum y, SortSupport ssup)
-{
-	/*
-	 * When 0 is returned, the core system will call varstrfastcmp_c()
-	 * (bpcharfastcmp_c() in BpChar case) or varstrfastcmp_locale().  Even a
-	 * strcmp() on two non-truncated strxfrm() blobs cannot indicate *equality*
-	 * authoritatively, for the same reason that there is a strcoll()
-	 * tie-breaker call to strcmp() in varstr_cmp().
-	 */
-	if (x > y)
-		return 1;
-	else if (x == y)
-		return 0;
-	else
-		return -1;
-}
-
 /*
  * Conversion routine for sortsupport.  Converts original to abbreviated key
  * representation.  Our encoding strategy is simple -- pack the first 8 bytes
@@ -2176,10 +2161,10 @@ varstr_abbrev_convert(Datum original, SortSupport ssup)
 	 * strings may contain NUL bytes.  Besides, this should be faster, too.
 	 *
 	 * More generally, it's okay that bytea callers can have NUL bytes in
-	 * strings because varstrcmp_abbrev() need not make a distinction between
-	 * terminating NUL bytes, and NUL bytes representing actual NULs in the
-	 * authoritative representation.  Hopefully a comparison at or past one
-	 * abbreviated key's terminating NUL byte will resolve the comparison
+	 * strings because ssup_datum_unsigned_cmp() need not make a distinction
+	 * between terminating NUL bytes, and NUL bytes representing actual NULs
+	 * in the authoritative representation.  Hopefully a comparison at or past
+	 * one abbreviated key's terminating NUL byte will resolve the comparison
 	 * without consulting the authoritative representation; specifically, some
 	 * later non-NUL byte in the longer string can resolve the comparison
 	 * against a subsequent terminating NUL in the shorter string.  There will
@@ -2304,10 +2289,10 @@ done:
 	/*
 	 * Byteswap on little-endian machines.
 	 *
-	 * This is needed so that varstrcmp_abbrev() (an unsigned integer 3-way
-	 * comparator) works correctly on all platforms.  If we didn't do this,
-	 * the comparator would have to call memcmp() with a pair of pointers to
-	 * the first byte of each abbreviated key, which is slower.
+	 * This is needed so that ssup_datum_unsigned_cmp() (an unsigned integer
+	 * 3-way comparator) works correctly on all platforms.  If we didn't do
+	 * this, the comparator would have to call memcmp() with a pair of
+	 * pointers to the first byte of each abbreviated key, which is slower.
 	 */
 	res = DatumBigEndianToNative(res);
 
@@ -35,6 +35,8 @@
 #include "utils/memutils.h"
 #include "utils/rel.h"
 #include "utils/resowner_private.h"
+#include "utils/sharedcatcache.h"
+#include "utils/snapmgr.h"
 #include "utils/syscache.h"
 #include "utils/tqual.h"
 
@@ -1120,6 +1122,8 @@ SearchCatCache(CatCache *cache,
 	Relation	relation;
 	SysScanDesc scandesc;
 	HeapTuple	ntp;
+	bool		use_shared;
+	uint64		shared_generation = 0;
 
 	/* Make sure we're in an xact, even if this ends up being a cache hit */
 	Assert(IsTransactionState());
@@ -1233,9 +1237,45 @@ SearchCatCache(CatCache *cache,
 	 * will eventually age out of the cache, so there's no functional problem.
 	 * This case is rare enough that it's not worth expending extra cycles to
 	 * detect.
+	 *
+	 * Before going to the relation, see whether another backend has already
+	 * loaded the tuple into the shared catcache.
 	 */
+	use_shared = SharedCatCacheUsable(cache);
+	if (use_shared)
+	{
+		ntp = SharedCatCacheLookup(cache, hashValue, cur_skey,
+								   &shared_generation);
+		if (ntp != NULL)
+		{
+			ct = CatalogCacheCreateEntry(cache, ntp,
+										 hashValue, hashIndex,
+										 false);
+			heap_freetuple(ntp);
+			ResourceOwnerEnlargeCatCacheRefs(CurrentResourceOwner);
+			ct->refcount++;
+			ResourceOwnerRememberCatCacheRef(CurrentResourceOwner, &ct->tuple);
+
+			CACHE3_elog(DEBUG2, "SearchCatCache(%s): loaded from shared cache into bucket %d",
+						cache->cc_relname, hashIndex);
+
+#ifdef CATCACHE_STATS
+			cache->cc_newloads++;
+#endif
+
+			return &ct->tuple;
+		}
+	}
+
 	relation = heap_open(cache->cc_reloid, AccessShareLock);
 
+	/*
+	 * A tuple going into the shared catcache must be read with a snapshot
+	 * taken after we looked up the shared generation; see sharedcatcache.c.
+	 */
+	if (use_shared)
+		InvalidateCatalogSnapshot();
+
 	scandesc = systable_beginscan(relation,
 								  cache->cc_indexoid,
 								  IndexScanOK(cache, cur_skey),
@@ -1295,6 +1335,9 @@ SearchCatCache(CatCache *cache,
 		return NULL;
 	}
 
+	if (use_shared)
+		SharedCatCacheInsert(cache, hashValue, &ct->tuple, shared_generation);
+
 	CACHE4_elog(DEBUG2, "SearchCatCache(%s): Contains %d/%d tuples",
 				cache->cc_relname, cache->cc_ntup, CacheHdr->ch_ntup);
 	CACHE3_elog(DEBUG2, "SearchCatCache(%s): put in bucket %d",
@@ -883,6 +883,17 @@ ProcessCommittedInvalidationMessages(SharedInvalidationMessage *msgs,
 		RelationCacheInitFilePostInvalidate();
 }
 
+/*
+ * HasPendingInvalidations
+ *		Has the current transaction, or one of its parents, queued any
+ *		invalidations, ie. changed catalogs in ways others can't see yet?
+ */
+bool
+HasPendingInvalidations(void)
+{
+	return transInvalInfo != NULL;
+}
+
 /*
  * AtEOXact_Inval
  *		Process queued-up invalidation messages at end of main transaction.
@@ -0,0 +1,401 @@
+/*-------------------------------------------------------------------------
+ *
+ * sharedcatcache.c
+ *	  Shared-memory cache of system catalog tuples.
+ *
+ * Every backend keeps its own catcache, which it fills by scanning the
+ * catalogs.  With many backends, and catalogs with many rows, that means a
+ * lot of duplicated memory, and every new backend pays for the catalog
+ * scans again.  When shared_catcache_size is set, a backend missing in its
+ * own catcache first looks for the tuple in this shared table, and adds the
+ * tuples it reads from the catalogs to it.  Tuples are still copied into
+ * the local catcache, so the shared table is only consulted on local
+ * misses; it avoids the catalog scans, not the local copies.
+ *
+ * Entries are keyed by database, cache and hash value of the cache key;
+ * different keys with the same hash value share an entry, and lookups
+ * check the key.  Only positive entries of limited size are kept, and
+ * entries are never evicted: once the table is full, new tuples are only
+ * added after invalidations have made room.
+ *
+ * Invalidation follows the sinval machinery: whoever sends catcache
+ * invalidation messages (a committing transaction, or the startup process
+ * replaying a commit) removes the entries they refer to before the
+ * messages go out, at which point the transaction's changes are already
+ * visible to everyone.  A backend that reads a tuple from the catalogs may
+ * still have done so with a snapshot taken before such a commit; to keep it
+ * from putting the outdated tuple back, each partition has a generation
+ * counter that invalidations bump, and a tuple is only added if the counter
+ * did not change since before the catalog scan, which uses a fresh snapshot.
+ *
+ * A transaction that has changed the catalogs itself bypasses the shared
+ * cache until it ends, as does logical decoding with its historic
+ * snapshots.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/cache/sharedcatcache.c
+ *
+ *-------------------------------------------------------------------------
+ */
+#include "postgres.h"
+
+#include "access/htup_details.h"
+#include "access/transam.h"
+#include "access/valid.h"
+#include "access/xact.h"
+#include "miscadmin.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
+#include "utils/hsearch.h"
+#include "utils/inval.h"
+#include "utils/sharedcatcache.h"
+#include "utils/snapmgr.h"
+
+
+/* Number of partitions of the shared catcache hashtable */
+#define NUM_SHARED_CATCACHE_PARTITIONS	16
+
+/* Larger tuples are not kept in the shared cache */
+#define SHARED_CATCACHE_MAX_TUPLE		512
+
+typedef struct SharedCatCacheKey
+{
+	Oid			dbId;			/* database ID, or 0 if a shared catalog */
+	int			cacheId;		/* catcache ID */
+	uint32		hashValue;		/* hash value of the cache key */
+} SharedCatCacheKey;
+
+typedef struct SharedCatCacheEntry
+{
+	SharedCatCacheKey key;		/* hash key --- must be first */
+	ItemPointerData t_self;		/* the tuple's header fields */
+	Oid			t_tableOid;
+	uint32		t_len;
+	char		data[SHARED_CATCACHE_MAX_TUPLE];	/* tuple contents */
+} SharedCatCacheEntry;
+
+typedef struct SharedCatCachePartition
+{
+	LWLock		lock;			/* protects the partition's entries */
+	uint64		generation;		/* bumped by each invalidation */
+} SharedCatCachePartition;
+
+/* GUC variable */
+int			shared_catcache_size = 0;
+
+static SharedCatCachePartition *SharedCatCachePartitions = NULL;
+static HTAB *SharedCatCacheHash = NULL;
+static LWLockTranche SharedCatCacheLWLockTranche;
+
+static void SharedCatCacheRemove(Oid dbId, int cacheId, uint32 hashValue);
+
+
+static long
+SharedCatCacheNumEntries(void)
+{
+	return ((long) shared_catcache_size * 1024L) / sizeof(SharedCatCacheEntry);
+}
+
+/*
+ * Estimate space needed for the shared catcache
+ */
+Size
+SharedCatCacheShmemSize(void)
+{
+	Size		size;
+
+	if (shared_catcache_size == 0)
+		return 0;
+
+	size = mul_size(NUM_SHARED_CATCACHE_PARTITIONS,
+					sizeof(SharedCatCachePartition));
+	size = add_size(size, hash_estimate_size(SharedCatCacheNumEntries(),
+											 sizeof(SharedCatCacheEntry)));
+
+	return size;
+}
+
+/*
+ * Initialize the shared catcache during shared-memory initialization
+ */
+void
+SharedCatCacheShmemInit(void)
+{
+	HASHCTL		info;
+	long		nentries;
+	bool		found;
+	int			i;
+
+	if (shared_catcache_size == 0)
+		return;
+
+	nentries = SharedCatCacheNumEntries();
+
+	SharedCatCachePartitions = (SharedCatCachePartition *)
+		ShmemInitStruct("Shared Catcache Partitions",
+						NUM_SHARED_CATCACHE_PARTITIONS * sizeof(SharedCatCachePartition),
+						&found);
+	if (!found)
+	{
+		for (i = 0; i < NUM_SHARED_CATCACHE_PARTITIONS; i++)
+		{
+			LWLockInitialize(&SharedCatCachePartitions[i].lock,
+							 LWTRANCHE_SHARED_CATCACHE);
+			SharedCatCachePartitions[i].generation = 0;
+		}
+	}
+
+	SharedCatCacheLWLockTranche.name = "shared_catcache";
+	SharedCatCacheLWLockTranche.array_base = SharedCatCachePartitions;
+	SharedCatCacheLWLockTranche.array_stride = sizeof(SharedCatCachePartition);
+	LWLockRegisterTranche(LWTRANCHE_SHARED_CATCACHE,
+						  &SharedCatCacheLWLockTranche);
+
+	MemSet(&info, 0, sizeof(info));
+	info.keysize = sizeof(SharedCatCacheKey);
+	info.entrysize = sizeof(SharedCatCacheEntry);
+	info.num_partitions = NUM_SHARED_CATCACHE_PARTITIONS;
+
+	SharedCatCacheHash = ShmemInitHash("Shared Catcache Hash",
+									   nentries, nentries,
+									   &info,
+									   HASH_ELEM | HASH_BLOBS | HASH_PARTITION);
+}
+
+/*
+ * SharedCatCacheUsable
+ *		May the given cache use the shared catcache right now?
+ */
+bool
+SharedCatCacheUsable(CatCache *cache)
+{
+	if (SharedCatCacheHash == NULL)
+		return false;
+
+	if (IsBootstrapProcessingMode())
+		return false;
+
+	/* logical decoding looks at the catalogs as of the past */
+	if (HistoricSnapshotActive())
+		return false;
+
+	/*
+	 * Our own catalog changes must neither leak out nor be hidden by the
+	 * committed versions of the tuples.
+	 */
+	if (HasPendingInvalidations())
+		return false;
+
+	/* not connected to a database yet */
+	if (!cache->cc_relisshared && !OidIsValid(MyDatabaseId))
+		return false;
+
+	return true;
+}
+
+static inline void
+SharedCatCacheSetKey(SharedCatCacheKey *key, CatCache *cache,
+					 uint32 hashValue)
+{
+	key->dbId = cache->cc_relisshared ? InvalidOid : MyDatabaseId;
+	key->cacheId = cache->id;
+	key->hashValue = hashValue;
+}
+
+/*
+ * SharedCatCacheLookup
+ *		Look for the tuple matching the search keys in the shared cache.
+ *
+ * Returns a palloc'd copy of the tuple, or NULL if it isn't there.  In
+ * either case *generation is set to the value to be passed to
+ * SharedCatCacheInsert, should the caller read the tuple from the catalog.
+ */
+HeapTuple
+SharedCatCacheLookup(CatCache *cache, uint32 hashValue, ScanKey cur_skey,
+					 uint64 *generation)
+{
+	SharedCatCacheKey key;
+	SharedCatCacheEntry *entry;
+	SharedCatCachePartition *partition;
+	uint32		hashcode;
+	HeapTuple	tuple = NULL;
+
+	SharedCatCacheSetKey(&key, cache, hashValue);
+	hashcode = get_hash_value(SharedCatCacheHash, &key);
+	partition = &SharedCatCachePartitions[hashcode % NUM_SHARED_CATCACHE_PARTITIONS];
+
+	LWLockAcquire(&partition->lock, LW_SHARED);
+
+	entry = (SharedCatCacheEntry *)
+		hash_search_with_hash_value(SharedCatCacheHash, &key, hashcode,
+									HASH_FIND, NULL);
+	if (entry != NULL)
+	{
+		tuple = (HeapTuple) palloc(HEAPTUPLESIZE + entry->t_len);
+		tuple->t_len = entry->t_len;
+		tuple->t_self = entry->t_self;
+		tuple->t_tableOid = entry->t_tableOid;
+		tuple->t_data = (HeapTupleHeader) ((char *) tuple + HEAPTUPLESIZE);
+		memcpy(tuple->t_data, entry->data, entry->t_len);
+	}
+	*generation = partition->generation;
+
+	LWLockRelease(&partition->lock);
+
+	if (tuple != NULL)
+	{
+		bool		res;
+
+		/* the entry may be for another key with the same hash value */
+		HeapKeyTest(tuple,
+					cache->cc_tupdesc,
+					cache->cc_nkeys,
+					cur_skey,
+					res);
+		if (!res)
+		{
+			pfree(tuple);
+			tuple = NULL;
+		}
+	}
+
+	return tuple;
+}
+
+/*
+ * SharedCatCacheInsert
+ *		Add a tuple read from the catalog to the shared cache.
+ *
+ * generation is what SharedCatCacheLookup returned before the catalog was
+ * scanned.  The tuple is not added if it is too large, if the table is
+ * full, or if an invalidation may have made it outdated meanwhile.
+ */
+void
+SharedCatCacheInsert(CatCache *cache, uint32 hashValue, HeapTuple tuple,
+					 uint64 generation)
+{
+	SharedCatCacheKey key;
+	SharedCatCacheEntry *entry;
+	SharedCatCachePartition *partition;
+	uint32		hashcode;
+	bool		found;
+
+	if (tuple->t_len > SHARED_CATCACHE_MAX_TUPLE)
+		return;
+
+	/* paranoia: a version only we can see */
+	if (TransactionIdIsCurrentTransactionId(HeapTupleHeaderGetXmin(tuple->t_data)))
+		return;
+
+	SharedCatCacheSetKey(&key, cache, hashValue);
+	hashcode = get_hash_value(SharedCatCacheHash, &key);
+	partition = &SharedCatCachePartitions[hashcode % NUM_SHARED_CATCACHE_PARTITIONS];
+
+	LWLockAcquire(&partition->lock, LW_EXCLUSIVE);
+
+	if (partition->generation == generation)
+	{
+		entry = (SharedCatCacheEntry *)
+			hash_search_with_hash_value(SharedCatCacheHash, &key, hashcode,
+										HASH_ENTER_NULL, &found);
+		if (entry != NULL)
+		{
+			entry->t_self = tuple->t_self;
+			entry->t_tableOid = tuple->t_tableOid;
+			entry->t_len = tuple->t_len;
+			memcpy(entry->data, tuple->t_data, tuple->t_len);
+		}
+	}
+
+	LWLockRelease(&partition->lock);
+}
+
+/*
+ * SharedCatCacheInvalidate
+ *		Remove the entries affected by the given invalidation messages,
+ *		which are about to be sent.
+ */
+void
+SharedCatCacheInvalidate(const SharedInvalidationMessage *msgs, int n)
+{
+	int			i;
+
+	if (SharedCatCacheHash == NULL)
+		return;
+
+	for (i = 0; i < n; i++)
+	{
+		const SharedInvalidationMessage *msg = &msgs[i];
+
+		if (msg->id >= 0)
+			SharedCatCacheRemove(msg->cc.dbId, msg->cc.id, msg->cc.hashValue);
+		else if (msg->id == SHAREDINVALCATALOG_ID)
+		{
+			/* rare enough that flushing the whole database is fine */
+			SharedCatCacheInvalidateDatabase(msg->cat.dbId);
+		}
+	}
+}
+
+static void
+SharedCatCacheRemove(Oid dbId, int cacheId, uint32 hashValue)
+{
+	SharedCatCacheKey key;
+	SharedCatCachePartition *partition;
+	uint32		hashcode;
+
+	key.dbId = dbId;
+	key.cacheId = cacheId;
+	key.hashValue = hashValue;
+	hashcode = get_hash_value(SharedCatCacheHash, &key);
+	partition = &SharedCatCachePartitions[hashcode % NUM_SHARED_CATCACHE_PARTITIONS];
+
+	LWLockAcquire(&partition->lock, LW_EXCLUSIVE);
+
+	(void) hash_search_with_hash_value(SharedCatCacheHash, &key, hashcode,
+									   HASH_REMOVE, NULL);
+	/* even if there was no entry, a concurrent reader may be about to add it */
+	partition->generation++;
+
+	LWLockRelease(&partition->lock);
+}
+
+/*
+ * SharedCatCacheInvalidateDatabase
+ *		Remove all entries of a database, or of the shared catalogs if dbId
+ *		is InvalidOid.
+ *
+ * Used for catalog-wide invalidations, and when a database is dropped so
+ * that a later database reusing its OID doesn't find its entries.
+ */
+void
+SharedCatCacheInvalidateDatabase(Oid dbId)
+{
+	HASH_SEQ_STATUS status;
+	SharedCatCacheEntry *entry;
+	int			i;
+
+	if (SharedCatCacheHash == NULL)
+		return;
+
+	for (i = 0; i < NUM_SHARED_CATCACHE_PARTITIONS; i++)
+		LWLockAcquire(&SharedCatCachePartitions[i].lock, LW_EXCLUSIVE);
+
+	hash_seq_init(&status, SharedCatCacheHash);
+	while ((entry = (SharedCatCacheEntry *) hash_seq_search(&status)) != NULL)
+	{
+		if (entry->key.dbId == dbId)
+			(void) hash_search(SharedCatCacheHash, &entry->key,
+							   HASH_REMOVE, NULL);
+	}
+
+	for (i = NUM_SHARED_CATCACHE_PARTITIONS; --i >= 0;)
+	{
+		SharedCatCachePartitions[i].generation++;
+		LWLockRelease(&SharedCatCachePartitions[i].lock);
+	}
+}
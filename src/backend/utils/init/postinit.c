@@ -48,6 +48,7 @@
 #include "storage/proc.h"
 #include "storage/sinvaladt.h"
 #include "storage/smgr.h"
+#include "tcop/sessionpool.h"
 #include "tcop/tcopprot.h"
 #include "utils/acl.h"
 #include "utils/fmgroids.h"
@@ -72,7 +73,6 @@ static void StatementTimeoutHandler(void);
 static void LockTimeoutHandler(void);
 static void IdleInTransactionSessionTimeoutHandler(void);
 static bool ThereIsAtLeastOneRole(void);
-static void process_startup_options(Port *port, bool am_superuser);
 static void process_settings(Oid databaseid, Oid roleid);
 
 
@@ -996,9 +996,11 @@ InitPostgres(const char *in_dbname, Oid dboid, const char *username,
 	/*
 	 * Now process any command-line switches and any additional GUC variable
 	 * settings passed in the startup packet.   We couldn't do this before
-	 * because we didn't know if client is a superuser.
+	 * because we didn't know if client is a superuser.  Connections served
+	 * by the session pool get them applied by SessionPoolStart() instead,
+	 * since a pool backend must know its settings without them.
 	 */
-	if (MyProcPort != NULL)
+	if (MyProcPort != NULL && !SessionPoolConnection)
 		process_startup_options(MyProcPort, am_superuser);
 
 	/* Process pg_db_role_setting options */
@@ -1032,7 +1034,7 @@ InitPostgres(const char *in_dbname, Oid dboid, const char *username,
  * Process any command-line switches and any additional GUC variable
  * settings passed in the startup packet.
  */
-static void
+void
 process_startup_options(Port *port, bool am_superuser)
 {
 	GucContext	gucctx;
@@ -27,10 +27,13 @@
 #endif
 
 #include "access/commit_ts.h"
+#include "access/csnlog.h"
 #include "access/gin.h"
 #include "access/transam.h"
 #include "access/twophase.h"
 #include "access/xact.h"
+#include "access/xlogparallel.h"
+#include "access/xlogprefetch.h"
 #include "catalog/namespace.h"
 #include "commands/async.h"
 #include "commands/prepare.h"
@@ -58,17 +61,20 @@
 #include "postmaster/postmaster.h"
 #include "postmaster/syslogger.h"
 #include "postmaster/walwriter.h"
+#include "replication/reorderbuffer.h"
 #include "replication/slot.h"
 #include "replication/syncrep.h"
 #include "replication/walreceiver.h"
 #include "replication/walsender.h"
 #include "storage/bufmgr.h"
+#include "storage/doublewrite.h"
 #include "storage/dsm_impl.h"
 #include "storage/standby.h"
 #include "storage/fd.h"
 #include "storage/pg_shmem.h"
 #include "storage/proc.h"
 #include "storage/predicate.h"
+#include "tcop/sessionpool.h"
 #include "tcop/tcopprot.h"
 #include "tsearch/ts_cache.h"
 #include "utils/builtins.h"
@@ -80,6 +86,7 @@
 #include "utils/portal.h"
 #include "utils/ps_status.h"
 #include "utils/rls.h"
+#include "utils/sharedcatcache.h"
 #include "utils/snapmgr.h"
 #include "utils/tzparser.h"
 #include "utils/xml.h"
@@ -393,6 +400,12 @@ static const struct config_enum_entry force_parallel_mode_options[] = {
 	{NULL, 0, false}
 };
 
+static const struct config_enum_entry buffer_replacement_policy_options[] = {
+	{"clock", BUFFER_REPLACEMENT_CLOCK, false},
+	{"2q", BUFFER_REPLACEMENT_2Q, false},
+	{NULL, 0, false}
+};
+
 /*
  * Options for enum values stored in other modules
  */
@@ -400,6 +413,7 @@ extern const struct config_enum_entry wal_level_options[];
 extern const struct config_enum_entry archive_mode_options[];
 extern const struct config_enum_entry sync_method_options[];
 extern const struct config_enum_entry dynamic_shared_memory_options[];
+extern const struct config_enum_entry dynamic_shared_memory_numa_options[];
 
 /*
  * GUC option variables that are exported from this module
@@ -841,6 +855,15 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_hashagg_disk", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables the planner's use of hashed aggregation plans that are expected to exceed work_mem."),
+			NULL
+		},
+		&enable_hashagg_disk,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"enable_material", PGC_USERSET, QUERY_TUNING_METHOD,
 			gettext_noop("Enables the planner's use of materialization."),
@@ -877,6 +900,15 @@ static struct config_bool ConfigureNamesBool[] =
 		true,
 		NULL, NULL, NULL
 	},
+	{
+		{"enable_parallel_hash", PGC_USERSET, QUERY_TUNING_METHOD,
+			gettext_noop("Enables sharing one hash table among the participants of a parallel hash join."),
+			NULL
+		},
+		&enable_parallel_hash,
+		true,
+		NULL, NULL, NULL
+	},
 
 	{
 		{"geqo", PGC_USERSET, QUERY_TUNING_GEQO,
@@ -917,6 +949,24 @@ static struct config_bool ConfigureNamesBool[] =
 		false,
 		NULL, NULL, NULL
 	},
+	{
+		{"csn_snapshots", PGC_POSTMASTER, LOCK_MANAGEMENT,
+			gettext_noop("Uses commit sequence numbers for MVCC snapshots."),
+			NULL
+		},
+		&csn_snapshots,
+		false,
+		NULL, assign_csn_snapshots, NULL
+	},
+	{
+		{"session_pooling", PGC_BACKEND, CONN_AUTH_SETTINGS,
+			gettext_noop("Lets the session be served by the session pool."),
+			gettext_noop("Only has an effect if session_pool_size is set.")
+		},
+		&session_pooling,
+		true,
+		NULL, NULL, NULL
+	},
 	{
 		{"ssl", PGC_POSTMASTER, CONN_AUTH_SECURITY,
 			gettext_noop("Enables SSL connections."),
@@ -990,6 +1040,18 @@ static struct config_bool ConfigureNamesBool[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"double_write", PGC_POSTMASTER, WAL_SETTINGS,
+			gettext_noop("Writes data pages to a double-write buffer before writing them in place."),
+			gettext_noop("A torn page write is then repaired from the double-write buffer "
+						 "at crash recovery, so full page images are not written to WAL. "
+						 "This option requires data checksums.")
+		},
+		&double_write,
+		false,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_log_hints", PGC_POSTMASTER, WAL_SETTINGS,
 			gettext_noop("Writes full pages to WAL when first modified after a checkpoint, even for a non-critical modifications."),
@@ -1834,6 +1896,16 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"session_pool_size", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
+			gettext_noop("Sets the number of backends serving pooled sessions per database and role."),
+			gettext_noop("Zero disables session pooling.")
+		},
+		&session_pool_size,
+		0, 0, MAX_BACKENDS,
+		NULL, NULL, NULL
+	},
+
 	/*
 	 * We sometimes multiply the number of shared buffers by two without
 	 * checking for overflow, so we mustn't allow more than INT_MAX / 2.
@@ -1860,6 +1932,17 @@ static struct config_int ConfigureNamesInt[] =
 		check_temp_buffers, NULL, NULL
 	},
 
+	{
+		{"shared_catcache_size", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Sets the amount of shared memory used to cache system catalog tuples."),
+			gettext_noop("Zero disables the shared catalog cache."),
+			GUC_UNIT_KB
+		},
+		&shared_catcache_size,
+		0, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"port", PGC_POSTMASTER, CONN_AUTH_SETTINGS,
 			gettext_noop("Sets the TCP port the server listens on."),
@@ -1933,6 +2016,18 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"logical_decoding_work_mem", PGC_USERSET, RESOURCES_MEM,
+			gettext_noop("Sets the maximum memory to be used for logical decoding."),
+			gettext_noop("This much memory can be used by each internal "
+						 "reorder buffer before spilling to disk."),
+			GUC_UNIT_KB
+		},
+		&logical_decoding_work_mem,
+		65536, 64, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
 	/*
 	 * We use the hopefully-safely-small value of 100kB as the compiled-in
 	 * default for max_stack_depth.  InitializeGUCOptions will increase it if
@@ -2290,6 +2385,27 @@ static struct config_int ConfigureNamesInt[] =
 		check_wal_buffers, NULL, NULL
 	},
 
+	{
+		{"double_write_buffers", PGC_POSTMASTER, WAL_SETTINGS,
+			gettext_noop("Sets the number of pages in the double-write buffer."),
+			NULL,
+			GUC_UNIT_BLOCKS
+		},
+		&double_write_buffers,
+		1024, 16, (INT_MAX / BLCKSZ),
+		NULL, NULL, NULL
+	},
+
+	{
+		{"wal_insert_locks", PGC_POSTMASTER, WAL_SETTINGS,
+			gettext_noop("Sets the number of locks allowing concurrent WAL insertions."),
+			gettext_noop("-1 sets it based on the number of CPUs.")
+		},
+		&XLOGInsertLocks,
+		-1, -1, 1024,
+		check_wal_insert_locks, NULL, NULL
+	},
+
 	{
 		{"wal_writer_delay", PGC_SIGHUP, WAL_SETTINGS,
 			gettext_noop("Time between WAL flushes performed in the WAL writer."),
@@ -2463,6 +2579,20 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"write_queue_depth", PGC_SIGHUP, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Number of asynchronous writes the checkpointer and the background writer keep in flight."),
+			gettext_noop("0 writes one page at a time.")
+		},
+		&write_queue_depth,
+#ifdef HAVE_AIO_WRITE
+		0, 0, MAX_WRITE_QUEUE_DEPTH,
+#else
+		0, 0, 0,
+#endif
+		NULL, NULL, NULL
+	},
+
 	{
 		{"max_worker_processes",
 			PGC_POSTMASTER,
@@ -2563,6 +2693,28 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"recovery_parallel_workers", PGC_POSTMASTER, WAL_SETTINGS,
+			gettext_noop("Sets the number of background workers applying WAL during recovery."),
+			gettext_noop("Zero makes the startup process apply all WAL itself. "
+						 "Not used with hot standby.")
+		},
+		&recovery_parallel_workers,
+		0, 0, MAX_PARALLEL_REDO_WORKERS,
+		NULL, NULL, NULL
+	},
+
+	{
+		{"recovery_prefetch_distance", PGC_SIGHUP, WAL_SETTINGS,
+			gettext_noop("Sets how far ahead of replay WAL is read to prefetch referenced blocks during recovery."),
+			gettext_noop("Zero disables prefetching."),
+			GUC_UNIT_KB
+		},
+		&recovery_prefetch_distance,
+		256, 0, MAX_KILOBYTES,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_retrieve_retry_interval", PGC_SIGHUP, REPLICATION_STANDBY,
 			gettext_noop("Sets the time to wait before retrying to retrieve WAL "
@@ -2658,6 +2810,16 @@ static struct config_int ConfigureNamesInt[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"max_parallel_maintenance_workers", PGC_USERSET, RESOURCES_ASYNCHRONOUS,
+			gettext_noop("Sets the maximum number of parallel processes per maintenance operation."),
+			NULL
+		},
+		&max_parallel_maintenance_workers,
+		0, 0, 1024,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"autovacuum_work_mem", PGC_SIGHUP, RESOURCES_MEM,
 			gettext_noop("Sets the maximum memory to be used by each autovacuum worker process."),
@@ -3757,6 +3919,16 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"dynamic_shared_memory_numa", PGC_SUSET, RESOURCES_MEM,
+			gettext_noop("Selects how new dynamic shared memory segments are placed on NUMA nodes."),
+			NULL
+		},
+		&dynamic_shared_memory_numa,
+		DSM_NUMA_NONE, dynamic_shared_memory_numa_options,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"wal_sync_method", PGC_SIGHUP, WAL_SETTINGS,
 			gettext_noop("Selects the method used for forcing WAL updates to disk."),
@@ -3798,6 +3970,16 @@ static struct config_enum ConfigureNamesEnum[] =
 		NULL, NULL, NULL
 	},
 
+	{
+		{"buffer_replacement_policy", PGC_POSTMASTER, RESOURCES_MEM,
+			gettext_noop("Selects the replacement policy of the shared buffer pool."),
+			NULL
+		},
+		&buffer_replacement_policy,
+		BUFFER_REPLACEMENT_CLOCK, buffer_replacement_policy_options,
+		NULL, NULL, NULL
+	},
+
 	{
 		{"force_parallel_mode", PGC_USERSET, QUERY_TUNING_OTHER,
 			gettext_noop("Forces use of parallel query facilities."),
@@ -9261,6 +9443,278 @@ RestoreGUCState(void *gucstate)
 	}
 }
 
+/*
+ * Session GUC state
+ *
+ * A backend serving several pooled client sessions (see tcop/sessionpool.c)
+ * has to keep the settings of its sessions apart.  The settings made by a
+ * session are those whose current or reset value has a session-level
+ * source, ie. PGC_S_CLIENT or above.  When the backend leaves a session it
+ * saves them with SaveSessionGUCState() and puts back the values they had
+ * before any session started, from a state saved once with a NULL base;
+ * when it enters a session again, it restores the saved settings.  Values
+ * are kept as strings, like SerializeGUCState() does, so that check and
+ * assign hooks run as usual.
+ *
+ * None of this is transactional, so it must be done outside transaction
+ * blocks; but it must be done inside a transaction, for the sake of check
+ * hooks that look up catalogs.
+ */
+typedef struct GucSessionValue
+{
+	char	   *name;
+	char	   *value;			/* current value */
+	GucSource	source;
+	GucContext	scontext;
+	char	   *reset_value;	/* reset value, NULL for the boot value */
+	GucSource	reset_source;
+	GucContext	reset_scontext;
+	char	   *sourcefile;		/* for PGC_S_FILE values */
+	int			sourceline;
+} GucSessionValue;
+
+struct GucSessionState
+{
+	int			nvalues;
+	GucSessionValue *values;	/* sorted by name */
+};
+
+static char *
+session_guc_value(struct config_generic * gconf, bool reset)
+{
+	char		buffer[256];
+
+	switch (gconf->vartype)
+	{
+		case PGC_BOOL:
+			{
+				struct config_bool *conf = (struct config_bool *) gconf;
+
+				return pstrdup((reset ? conf->reset_val : *conf->variable) ?
+							   "true" : "false");
+			}
+
+		case PGC_INT:
+			{
+				struct config_int *conf = (struct config_int *) gconf;
+
+				snprintf(buffer, sizeof(buffer), "%d",
+						 reset ? conf->reset_val : *conf->variable);
+				return pstrdup(buffer);
+			}
+
+		case PGC_REAL:
+			{
+				struct config_real *conf = (struct config_real *) gconf;
+
+				snprintf(buffer, sizeof(buffer), "%.*e", REALTYPE_PRECISION,
+						 reset ? conf->reset_val : *conf->variable);
+				return pstrdup(buffer);
+			}
+
+		case PGC_STRING:
+			{
+				struct config_string *conf = (struct config_string *) gconf;
+				char	   *val = reset ? conf->reset_val : *conf->variable;
+
+				/* NULL becomes empty string, as in serialize_variable() */
+				return pstrdup(val ? val : "");
+			}
+
+		case PGC_ENUM:
+			{
+				struct config_enum *conf = (struct config_enum *) gconf;
+
+				return pstrdup(config_enum_lookup_by_value(conf,
+								 reset ? conf->reset_val : *conf->variable));
+			}
+	}
+
+	return NULL;				/* keep compiler quiet */
+}
+
+static int
+session_guc_value_compare(const void *a, const void *b)
+{
+	return guc_name_compare(((const GucSessionValue *) a)->name,
+							((const GucSessionValue *) b)->name);
+}
+
+static GucSessionValue *
+find_session_guc_value(GucSessionState *state, const char *name)
+{
+	GucSessionValue key;
+
+	if (state == NULL || state->nvalues == 0)
+		return NULL;
+
+	key.name = (char *) name;
+	return (GucSessionValue *) bsearch(&key, state->values, state->nvalues,
+									   sizeof(GucSessionValue),
+									   session_guc_value_compare);
+}
+
+/*
+ * SaveSessionGUCState:
+ * With a NULL base, saves all variables that can be set at run time, to
+ * serve as the base state of later calls.  Otherwise saves the variables
+ * the current session has set, skipping those that still have their base
+ * value.  The result is allocated in CurrentMemoryContext.
+ */
+GucSessionState *
+SaveSessionGUCState(GucSessionState *base)
+{
+	GucSessionState *state;
+	int			i;
+
+	state = (GucSessionState *) palloc(sizeof(GucSessionState));
+	state->nvalues = 0;
+	state->values = (GucSessionValue *)
+		palloc(Max(num_guc_variables, 1) * sizeof(GucSessionValue));
+
+	for (i = 0; i < num_guc_variables; i++)
+	{
+		struct config_generic *gconf = guc_variables[i];
+		GucSessionValue *val = &state->values[state->nvalues];
+		GucSessionValue *baseval;
+
+		if (gconf->context == PGC_POSTMASTER ||
+			gconf->context == PGC_INTERNAL ||
+			(gconf->flags & GUC_CUSTOM_PLACEHOLDER))
+			continue;
+
+		if (base != NULL &&
+			gconf->source < PGC_S_CLIENT &&
+			gconf->reset_source < PGC_S_CLIENT)
+			continue;
+
+		val->name = pstrdup(gconf->name);
+		val->value = session_guc_value(gconf, false);
+		val->source = gconf->source;
+		val->scontext = gconf->scontext;
+		val->reset_value = gconf->reset_source == PGC_S_DEFAULT ? NULL :
+			session_guc_value(gconf, true);
+		val->reset_source = gconf->reset_source;
+		val->reset_scontext = gconf->reset_scontext;
+		val->sourcefile = gconf->sourcefile ? pstrdup(gconf->sourcefile) : NULL;
+		val->sourceline = gconf->sourceline;
+
+		baseval = find_session_guc_value(base, val->name);
+		if (baseval != NULL &&
+			baseval->source == val->source &&
+			baseval->reset_source == val->reset_source &&
+			strcmp(baseval->value, val->value) == 0 &&
+			(baseval->reset_value == NULL) == (val->reset_value == NULL) &&
+			(val->reset_value == NULL ||
+			 strcmp(baseval->reset_value, val->reset_value) == 0))
+			continue;
+
+		state->nvalues++;
+	}
+
+	/* guc_variables is sorted already, but placeholders may have moved */
+	qsort(state->values, state->nvalues, sizeof(GucSessionValue),
+		  session_guc_value_compare);
+
+	return state;
+}
+
+/*
+ * Give a variable the saved value, or its boot value if val is NULL.
+ */
+static void
+restore_session_guc_value(const char *name, GucSessionValue *val)
+{
+	struct config_generic *gconf;
+
+	gconf = find_option(name, false, LOG);
+	if (gconf == NULL)
+		return;
+
+	/*
+	 * Let the saved sources take effect even where the current ones are of
+	 * higher priority.  The values were accepted before, so set them with
+	 * full privileges and put back the saved contexts afterwards.
+	 */
+	gconf->source = PGC_S_DEFAULT;
+	gconf->reset_source = PGC_S_DEFAULT;
+
+	if (val == NULL || val->reset_source == PGC_S_DEFAULT)
+		(void) set_config_option(name, NULL,
+								 PGC_POSTMASTER, PGC_S_DEFAULT,
+								 GUC_ACTION_SET, true, LOG, false);
+	else
+		(void) set_config_option(name, val->reset_value,
+								 PGC_POSTMASTER, val->reset_source,
+								 GUC_ACTION_SET, true, LOG, false);
+
+	if (val == NULL)
+		return;
+
+	/* values set with SET don't change the reset value */
+	if (val->source > PGC_S_OVERRIDE)
+		(void) set_config_option(name, val->value,
+								 PGC_POSTMASTER, val->source,
+								 GUC_ACTION_SET, true, LOG, false);
+
+	gconf->scontext = val->scontext;
+	gconf->reset_scontext = val->reset_scontext;
+	if (val->sourcefile != NULL && val->source == PGC_S_FILE)
+		set_config_sourcefile(name, val->sourcefile, val->sourceline);
+}
+
+/*
+ * Restore the values of a saved state, in the order SerializeGUCState()
+ * uses: "role" must come after "session_authorization".
+ */
+static void
+restore_session_guc_state(GucSessionState *state, GucSessionState *base,
+						  bool to_base)
+{
+	bool		save_reporting = reporting_enabled;
+	GucSessionValue *role = NULL;
+	int			i;
+
+	/* the client knows the values it set; don't confuse it */
+	reporting_enabled = false;
+
+	for (i = 0; i < state->nvalues; i++)
+	{
+		GucSessionValue *val = &state->values[i];
+
+		if (guc_name_compare(val->name, "role") == 0)
+			role = val;
+		else
+			restore_session_guc_value(val->name,
+					 to_base ? find_session_guc_value(base, val->name) : val);
+	}
+	if (role != NULL)
+		restore_session_guc_value(role->name,
+				  to_base ? find_session_guc_value(base, role->name) : role);
+
+	reporting_enabled = save_reporting;
+}
+
+/*
+ * ResetSessionGUCState:
+ * Give the variables saved in state their values from base.
+ */
+void
+ResetSessionGUCState(GucSessionState *state, GucSessionState *base)
+{
+	restore_session_guc_state(state, base, true);
+}
+
+/*
+ * RestoreSessionGUCState:
+ * Give the variables saved in state their saved values.
+ */
+void
+RestoreSessionGUCState(GucSessionState *state)
+{
+	restore_session_guc_state(state, NULL, false);
+}
+
 /*
  * A little "long argument" simulation, although not quite GNU
  * compliant. Takes a string of the form "some-option=some value" and
@@ -0,0 +1,710 @@
+/*-------------------------------------------------------------------------
+ *
+ * generation.c
+ *	  Generational allocator definitions.
+ *
+ * Generation is a custom MemoryContext implementation designed for cases of
+ * chunks with similar lifespan.
+ *
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/mmgr/generation.c
+ *
+ *
+ *	This memory context is based on the assumption that the chunks are freed
+ *	roughly in the same order as they were allocated (FIFO), or in groups with
+ *	similar lifespan (generations - hence the name of the context). This is
+ *	typical for various queue-like use cases, i.e. when tuples are constructed,
+ *	processed and then thrown away.
+ *
+ *	The memory context uses a very simple approach to free space management.
+ *	Instead of a complex global freelist, each block tracks a number
+ *	of allocated and freed chunks.  Freed chunks are not reused, and once all
+ *	chunks in a block are freed, the whole block is thrown away.  When the
+ *	chunks allocated in the same block have similar lifespan, this works
+ *	very well and is very cheap.
+ *
+ *	The current implementation only uses a fixed block size - maybe it should
+ *	adapt a min/max block size range, and grow the blocks automatically.
+ *	It already uses dedicated blocks for oversized chunks.
+ *
+ *	About chunk headers:
+ *
+ *	Like in slab.c, each chunk starts with a (MAXALIGN'ed) pointer to its
+ *	block, followed by the StandardChunkHeader mcxt.c expects immediately
+ *	before the chunk's data:
+ *
+ *		[GenerationBlock *][StandardChunkHeader][data]
+ *
+ *	With MEMORY_CONTEXT_CHECKING, requested_size is zero in freed chunks.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "lib/ilist.h"
+#include "utils/memdebug.h"
+#include "utils/memutils.h"
+
+
+/*
+ * Chunks larger than this fraction of the block size get a dedicated block.
+ */
+#define Generation_CHUNK_FRACTION	8
+
+typedef struct GenerationBlock GenerationBlock; /* forward reference */
+
+/*
+ * GenerationContext is a simple memory context not reusing allocated chunks,
+ * and freeing blocks once all chunks are freed.
+ */
+typedef struct GenerationContext
+{
+	MemoryContextData header;	/* Standard memory-context fields */
+
+	/* Generational context parameters */
+	Size		blockSize;		/* standard block size */
+
+	GenerationBlock *block;		/* current (most recently allocated) block */
+	dlist_head	blocks;			/* list of blocks */
+} GenerationContext;
+
+typedef GenerationContext *Generation;
+
+/*
+ * GenerationIsValid
+ *		True iff set is valid generation allocation set.
+ */
+#define GenerationIsValid(set) PointerIsValid(set)
+
+/*
+ * GenerationBlock
+ *		GenerationBlock is the unit of memory that is obtained by generation.c
+ *		from malloc().  It contains one or more chunks, which are the units
+ *		requested by palloc() and freed by pfree().  Chunks cannot be returned
+ *		to malloc() individually, instead pfree() updates the free counter of
+ *		the block and when all chunks in a block are free the whole block is
+ *		returned to malloc().
+ *
+ *		GenerationBlock is the header data for a block --- the usable space
+ *		within the block begins at the next alignment boundary.
+ */
+struct GenerationBlock
+{
+	dlist_node	node;			/* doubly-linked list of blocks */
+	Size		blksize;		/* allocated size of this block */
+	int			nchunks;		/* number of chunks in the block */
+	int			nfree;			/* number of free chunks */
+	char	   *freeptr;		/* start of free space in this block */
+	char	   *endptr;			/* end of space in this block */
+};
+
+#define Generation_BLOCKHDRSZ	MAXALIGN(sizeof(GenerationBlock))
+#define Generation_BLOCKPTRSZ	MAXALIGN(sizeof(GenerationBlock *))
+#define Generation_CHUNKHDRSZ	(Generation_BLOCKPTRSZ + STANDARDCHUNKHEADERSIZE)
+
+#define GenerationPointerGetChunk(ptr) \
+	((char *) (ptr) - Generation_CHUNKHDRSZ)
+#define GenerationChunkGetPointer(chk) \
+	((void *) ((char *) (chk) + Generation_CHUNKHDRSZ))
+#define GenerationChunkGetBlock(chk) \
+	(*(GenerationBlock **) (chk))
+#define GenerationChunkGetHeader(chk) \
+	((StandardChunkHeader *) ((char *) (chk) + Generation_BLOCKPTRSZ))
+
+/*
+ * These functions implement the MemoryContext API for Generation contexts.
+ */
+static void *GenerationAlloc(MemoryContext context, Size size);
+static void GenerationFree(MemoryContext context, void *pointer);
+static void *GenerationRealloc(MemoryContext context, void *pointer, Size size);
+static void GenerationInit(MemoryContext context);
+static void GenerationReset(MemoryContext context);
+static void GenerationDelete(MemoryContext context);
+static Size GenerationGetChunkSpace(MemoryContext context, void *pointer);
+static bool GenerationIsEmpty(MemoryContext context);
+static void GenerationStats(MemoryContext context, int level, bool print,
+				MemoryContextCounters *totals);
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void GenerationCheck(MemoryContext context);
+#endif
+
+/*
+ * This is the virtual function table for Generation contexts.
+ */
+static MemoryContextMethods GenerationMethods = {
+	GenerationAlloc,
+	GenerationFree,
+	GenerationRealloc,
+	GenerationInit,
+	GenerationReset,
+	GenerationDelete,
+	GenerationGetChunkSpace,
+	GenerationIsEmpty,
+	GenerationStats
+#ifdef MEMORY_CONTEXT_CHECKING
+	,GenerationCheck
+#endif
+};
+
+/* ----------
+ * Debug macros
+ * ----------
+ */
+#ifdef HAVE_ALLOCINFO
+#define GenerationFreeInfo(_cxt, _chunk) \
+			fprintf(stderr, "GenerationFree: %s: %p, %zu\n", \
+				(_cxt)->header.name, (_chunk), \
+				GenerationChunkGetHeader(_chunk)->size)
+#define GenerationAllocInfo(_cxt, _chunk) \
+			fprintf(stderr, "GenerationAlloc: %s: %p, %zu\n", \
+				(_cxt)->header.name, (_chunk), \
+				GenerationChunkGetHeader(_chunk)->size)
+#else
+#define GenerationFreeInfo(_cxt, _chunk)
+#define GenerationAllocInfo(_cxt, _chunk)
+#endif
+
+
+/*
+ * Public routines
+ */
+
+
+/*
+ * GenerationContextCreate
+ *		Create a new Generation context.
+ *
+ * parent: parent context, or NULL if top-level context
+ * name: name of context (for debugging only, need not be unique)
+ * blockSize: generation block size
+ *
+ * Notes: the name string will be copied into context-lifespan storage.
+ */
+MemoryContext
+GenerationContextCreate(MemoryContext parent,
+						const char *name,
+						Size blockSize)
+{
+	Generation	set;
+
+	/*
+	 * First, validate allocation parameters.  (If we're going to throw an
+	 * error, we should do so before the context is created, not after.)  We
+	 * somewhat arbitrarily enforce a minimum 1K block size, mostly because
+	 * that's what AllocSet does.
+	 */
+	if (blockSize != MAXALIGN(blockSize) ||
+		blockSize < 1024 ||
+		!AllocHugeSizeIsValid(blockSize))
+		elog(ERROR, "invalid blockSize for memory context: %zu",
+			 blockSize);
+
+	/* Do the type-independent part of context creation */
+	set = (Generation) MemoryContextCreate(T_GenerationContext,
+										   sizeof(GenerationContext),
+										   &GenerationMethods,
+										   parent,
+										   name);
+
+	set->blockSize = blockSize;
+	set->block = NULL;
+	dlist_init(&set->blocks);
+
+	return (MemoryContext) set;
+}
+
+/*
+ * GenerationInit
+ *		Context-type-specific initialization routine.
+ */
+static void
+GenerationInit(MemoryContext context)
+{
+	/*
+	 * GenerationContextCreate fills in the context node once
+	 * MemoryContextCreate returns it; nothing can try to use the context
+	 * before that.
+	 */
+}
+
+/*
+ * GenerationReset
+ *		Frees all memory which is allocated in the given set.
+ *
+ * The code simply frees all the blocks in the context - we don't keep any
+ * keeper blocks or anything like that.
+ */
+static void
+GenerationReset(MemoryContext context)
+{
+	Generation	set = (Generation) context;
+	dlist_mutable_iter miter;
+
+	AssertArg(GenerationIsValid(set));
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	/* Check for corruption and leaks before freeing */
+	GenerationCheck(context);
+#endif
+
+	dlist_foreach_modify(miter, &set->blocks)
+	{
+		GenerationBlock *block = dlist_container(GenerationBlock, node, miter.cur);
+
+		dlist_delete(miter.cur);
+
+#ifdef CLOBBER_FREED_MEMORY
+		wipe_mem(block, block->blksize);
+#endif
+
+		free(block);
+	}
+
+	set->block = NULL;
+
+	Assert(dlist_is_empty(&set->blocks));
+}
+
+/*
+ * GenerationDelete
+ *		Frees all memory which is allocated in the given set, in preparation
+ *		for deletion of the set. We simply call GenerationReset().
+ */
+static void
+GenerationDelete(MemoryContext context)
+{
+	/* just reset the context */
+	GenerationReset(context);
+}
+
+/*
+ * GenerationAlloc
+ *		Returns pointer to allocated memory of given size or NULL if
+ *		request could not be completed; memory is added to the set.
+ *
+ * No request may exceed:
+ *		MAXALIGN_DOWN(SIZE_MAX) - Generation_BLOCKHDRSZ - Generation_CHUNKHDRSZ
+ * All callers use a much-lower limit.
+ */
+static void *
+GenerationAlloc(MemoryContext context, Size size)
+{
+	Generation	set = (Generation) context;
+	GenerationBlock *block;
+	char	   *chunk;
+	StandardChunkHeader *header;
+	Size		chunk_size = MAXALIGN(size);
+
+	AssertArg(GenerationIsValid(set));
+
+	/* is it an over-sized chunk? if yes, allocate special block */
+	if (chunk_size > set->blockSize / Generation_CHUNK_FRACTION)
+	{
+		Size		blksize = chunk_size + Generation_BLOCKHDRSZ +
+		Generation_CHUNKHDRSZ;
+
+		block = (GenerationBlock *) malloc(blksize);
+		if (block == NULL)
+			return NULL;
+
+		block->blksize = blksize;
+		block->nchunks = 1;
+		block->nfree = 0;
+
+		/* the block is completely full */
+		block->freeptr = block->endptr = ((char *) block) + blksize;
+
+		chunk = ((char *) block) + Generation_BLOCKHDRSZ;
+
+		/* add the block to the list of allocated blocks */
+		dlist_push_head(&set->blocks, &block->node);
+	}
+	else
+	{
+		/*
+		 * Not an over-sized chunk. Is there enough space in the current
+		 * block? If not, allocate a new "regular" block.
+		 */
+		block = set->block;
+
+		if ((block == NULL) ||
+			(block->endptr - block->freeptr) < Generation_CHUNKHDRSZ + chunk_size)
+		{
+			Size		blksize = set->blockSize;
+
+			block = (GenerationBlock *) malloc(blksize);
+
+			if (block == NULL)
+				return NULL;
+
+			block->blksize = blksize;
+			block->nchunks = 0;
+			block->nfree = 0;
+
+			block->freeptr = ((char *) block) + Generation_BLOCKHDRSZ;
+			block->endptr = ((char *) block) + blksize;
+
+			/* Mark unallocated space NOACCESS. */
+			VALGRIND_MAKE_MEM_NOACCESS(block->freeptr,
+									   blksize - Generation_BLOCKHDRSZ);
+
+			/* add it to the doubly-linked list of blocks */
+			dlist_push_head(&set->blocks, &block->node);
+
+			/* and also use it as the current allocation block */
+			set->block = block;
+		}
+
+		/* we're supposed to have a block with enough free space now */
+		Assert(block != NULL);
+		Assert((block->endptr - block->freeptr) >= Generation_CHUNKHDRSZ + chunk_size);
+
+		chunk = block->freeptr;
+
+		/* Prepare to initialize the chunk header. */
+		VALGRIND_MAKE_MEM_UNDEFINED(chunk, Generation_CHUNKHDRSZ);
+
+		block->nchunks += 1;
+		block->freeptr += (Generation_CHUNKHDRSZ + chunk_size);
+
+		Assert(block->freeptr <= block->endptr);
+	}
+
+	GenerationChunkGetBlock(chunk) = block;
+	header = GenerationChunkGetHeader(chunk);
+	header->context = (MemoryContext) set;
+	header->size = chunk_size;
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	header->requested_size = size;
+	/* set mark to catch clobber of "unused" space */
+	if (size < chunk_size)
+		set_sentinel(GenerationChunkGetPointer(chunk), size);
+#endif
+#ifdef RANDOMIZE_ALLOCATED_MEMORY
+	/* fill the allocated space with junk */
+	randomize_mem((char *) GenerationChunkGetPointer(chunk), size);
+#endif
+
+	GenerationAllocInfo(set, chunk);
+	return GenerationChunkGetPointer(chunk);
+}
+
+/*
+ * GenerationFree
+ *		Update number of chunks in the block, and if all chunks in the block
+ *		are now free then discard the block.
+ */
+static void
+GenerationFree(MemoryContext context, void *pointer)
+{
+	Generation	set = (Generation) context;
+	char	   *chunk = GenerationPointerGetChunk(pointer);
+	GenerationBlock *block = GenerationChunkGetBlock(chunk);
+	StandardChunkHeader *header = GenerationChunkGetHeader(chunk);
+
+	GenerationFreeInfo(set, chunk);
+
+	Assert(header->context == context);
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	/* Test for someone scribbling on unused space in chunk */
+	if (header->requested_size < header->size)
+		if (!sentinel_ok(pointer, header->requested_size))
+			elog(WARNING, "detected write past chunk end in %s %p",
+				 set->header.name, chunk);
+	/* Reset requested_size to 0 in chunks that are on freelist */
+	header->requested_size = 0;
+#endif
+
+#ifdef CLOBBER_FREED_MEMORY
+	wipe_mem(pointer, header->size);
+#endif
+
+	block->nfree += 1;
+
+	Assert(block->nchunks > 0);
+	Assert(block->nfree <= block->nchunks);
+
+	/* If there are still allocated chunks in the block, we're done. */
+	if (block->nfree < block->nchunks)
+		return;
+
+	/*
+	 * The block is empty, so let's get rid of it. First remove it from the
+	 * list of blocks, then return it to malloc().
+	 */
+	dlist_delete(&block->node);
+
+	/* Also make sure the block is not marked as the current block. */
+	if (set->block == block)
+		set->block = NULL;
+
+	free(block);
+}
+
+/*
+ * GenerationRealloc
+ *		When handling repalloc, we simply allocate a new chunk, copy the data
+ *		and discard the old one. The only exception is when the new size fits
+ *		into the old chunk - in that case we just update chunk header.
+ */
+static void *
+GenerationRealloc(MemoryContext context, void *pointer, Size size)
+{
+	Generation	set = (Generation) context;
+	StandardChunkHeader *header =
+	GenerationChunkGetHeader(GenerationPointerGetChunk(pointer));
+	void	   *newPointer;
+	Size		oldsize = header->size;
+
+	/*
+	 * Unlike AllocSet, chunk sizes are only MAXALIGN'ed, so there is rarely
+	 * room to grow in place; but shrinking (or a no-op) can reuse the chunk.
+	 */
+	if (oldsize >= size)
+	{
+#ifdef MEMORY_CONTEXT_CHECKING
+		Size		oldrequest = header->requested_size;
+
+#ifdef RANDOMIZE_ALLOCATED_MEMORY
+		/* We can only fill the extra space if we know the prior request */
+		if (size > oldrequest)
+			randomize_mem((char *) pointer + oldrequest,
+						  size - oldrequest);
+#endif
+
+		header->requested_size = size;
+
+		/*
+		 * If this is an increase, mark any newly-available part UNDEFINED.
+		 * Otherwise, mark the obsolete part NOACCESS.
+		 */
+		if (size > oldrequest)
+			VALGRIND_MAKE_MEM_UNDEFINED((char *) pointer + oldrequest,
+										size - oldrequest);
+		else
+			VALGRIND_MAKE_MEM_NOACCESS((char *) pointer + size,
+									   oldsize - size);
+
+		/* set mark to catch clobber of "unused" space */
+		if (size < oldsize)
+			set_sentinel(pointer, size);
+#else							/* !MEMORY_CONTEXT_CHECKING */
+
+		/*
+		 * We don't have the information to determine whether we're growing
+		 * the old request or shrinking it, so we conservatively mark the
+		 * entire new allocation DEFINED.
+		 */
+		VALGRIND_MAKE_MEM_NOACCESS(pointer, oldsize);
+		VALGRIND_MAKE_MEM_DEFINED(pointer, size);
+#endif
+
+		return pointer;
+	}
+
+	/* allocate new chunk */
+	newPointer = GenerationAlloc((MemoryContext) set, size);
+
+	/* leave immediately if request was not completed */
+	if (newPointer == NULL)
+		return NULL;
+
+	/*
+	 * GenerationAlloc() just made the region NOACCESS.  Change it to
+	 * UNDEFINED for the moment; memcpy() will then transfer definedness from
+	 * the old allocation to the new.  If we know the old allocation, copy
+	 * just that much.  Otherwise, make the entire old chunk defined to avoid
+	 * errors as we copy the currently-NOACCESS trailing bytes.
+	 */
+	VALGRIND_MAKE_MEM_UNDEFINED(newPointer, size);
+#ifdef MEMORY_CONTEXT_CHECKING
+	oldsize = header->requested_size;
+#else
+	VALGRIND_MAKE_MEM_DEFINED(pointer, oldsize);
+#endif
+
+	/* transfer existing data (certain to fit) */
+	memcpy(newPointer, pointer, oldsize);
+
+	/* free old chunk */
+	GenerationFree((MemoryContext) set, pointer);
+
+	return newPointer;
+}
+
+/*
+ * GenerationGetChunkSpace
+ *		Given a currently-allocated chunk, determine the total space
+ *		it occupies (including all memory-allocation overhead).
+ */
+static Size
+GenerationGetChunkSpace(MemoryContext context, void *pointer)
+{
+	StandardChunkHeader *header =
+	GenerationChunkGetHeader(GenerationPointerGetChunk(pointer));
+
+	return header->size + Generation_CHUNKHDRSZ;
+}
+
+/*
+ * GenerationIsEmpty
+ *		Is a Generation context empty of any allocated space?
+ */
+static bool
+GenerationIsEmpty(MemoryContext context)
+{
+	Generation	set = (Generation) context;
+
+	/* empty blocks are freed right away, so this is exact */
+	return dlist_is_empty(&set->blocks);
+}
+
+/*
+ * GenerationStats
+ *		Compute stats about memory consumption of a Generation context.
+ *
+ * level: recursion level (0 at top level); used for print indentation.
+ * print: true to print stats to stderr.
+ * totals: if not NULL, add stats about this context into *totals.
+ *
+ * XXX freespace only accounts for empty space at the end of the block, not
+ * space of freed chunks (which is unknown).
+ */
+static void
+GenerationStats(MemoryContext context, int level, bool print,
+				MemoryContextCounters *totals)
+{
+	Generation	set = (Generation) context;
+	Size		nblocks = 0;
+	Size		nchunks = 0;
+	Size		nfreechunks = 0;
+	Size		totalspace = 0;
+	Size		freespace = 0;
+	dlist_iter	iter;
+
+	dlist_foreach(iter, &set->blocks)
+	{
+		GenerationBlock *block = dlist_container(GenerationBlock, node, iter.cur);
+
+		nblocks++;
+		nchunks += block->nchunks;
+		nfreechunks += block->nfree;
+		totalspace += block->blksize;
+		freespace += (block->endptr - block->freeptr);
+	}
+
+	if (print)
+	{
+		int			i;
+
+		for (i = 0; i < level; i++)
+			fprintf(stderr, "  ");
+		fprintf(stderr,
+				"%s: %zu total in %zd blocks (%zd chunks); %zu free (%zd chunks); %zu used\n",
+				set->header.name, totalspace, nblocks, nchunks, freespace,
+				nfreechunks, totalspace - freespace);
+	}
+
+	if (totals)
+	{
+		totals->nblocks += nblocks;
+		totals->freechunks += nfreechunks;
+		totals->totalspace += totalspace;
+		totals->freespace += freespace;
+	}
+}
+
+
+#ifdef MEMORY_CONTEXT_CHECKING
+
+/*
+ * GenerationCheck
+ *		Walk through chunks and check consistency of memory.
+ *
+ * NOTE: report errors as WARNING, *not* ERROR or FATAL.  Otherwise you'll
+ * find yourself in an infinite loop when trouble occurs, because this
+ * routine will be entered again when elog cleanup tries to release memory!
+ */
+static void
+GenerationCheck(MemoryContext context)
+{
+	Generation	gen = (Generation) context;
+	char	   *name = gen->header.name;
+	dlist_iter	iter;
+
+	/* walk all blocks in this context */
+	dlist_foreach(iter, &gen->blocks)
+	{
+		GenerationBlock *block = dlist_container(GenerationBlock, node, iter.cur);
+		int			nfree,
+					nchunks;
+		char	   *ptr;
+
+		/*
+		 * nfree > nchunks is surely wrong, and we don't expect to see
+		 * equality either, because such a block should have gotten freed.
+		 */
+		if (block->nfree >= block->nchunks)
+			elog(WARNING, "problem in Generation %s: number of free chunks %d in block %p exceeds %d allocated",
+				 name, block->nfree, block, block->nchunks);
+
+		/* Now walk through the chunks and count them. */
+		nfree = 0;
+		nchunks = 0;
+		ptr = ((char *) block) + Generation_BLOCKHDRSZ;
+
+		while (ptr < block->freeptr)
+		{
+			char	   *chunk = ptr;
+			StandardChunkHeader *header = GenerationChunkGetHeader(chunk);
+
+			/* move to the next chunk */
+			ptr += (header->size + Generation_CHUNKHDRSZ);
+
+			nchunks += 1;
+
+			/* chunks have both block and context pointers, so check both */
+			if (GenerationChunkGetBlock(chunk) != block)
+				elog(WARNING, "problem in Generation %s: bogus block link in block %p, chunk %p",
+					 name, block, chunk);
+
+			if (header->context != context)
+				elog(WARNING, "problem in Generation %s: bogus context link in block %p, chunk %p",
+					 name, block, chunk);
+
+			/* freed chunks have requested_size 0 */
+			if (header->requested_size == 0)
+				nfree += 1;
+			else if (header->requested_size > header->size)
+				elog(WARNING, "problem in Generation %s: req size > alloc size for chunk %p in block %p",
+					 name, chunk, block);
+			else if (header->requested_size < header->size &&
+					 !sentinel_ok(GenerationChunkGetPointer(chunk),
+								  header->requested_size))
+				elog(WARNING, "problem in Generation %s: detected write past chunk end in block %p, chunk %p",
+					 name, block, chunk);
+		}
+
+		/*
+		 * Make sure we got the expected number of allocated and free chunks
+		 * (as tracked in the block header).
+		 */
+		if (nchunks != block->nchunks)
+			elog(WARNING, "problem in Generation %s: number of allocated chunks %d in block %p does not match header %d",
+				 name, nchunks, block, block->nchunks);
+
+		if (nfree != block->nfree)
+			elog(WARNING, "problem in Generation %s: number of free chunks %d in block %p does not match header %d",
+				 name, nfree, block, block->nfree);
+	}
+}
+
+#endif   /* MEMORY_CONTEXT_CHECKING */
@@ -471,6 +471,39 @@ MemoryContextIsEmpty(MemoryContext context)
 	return (*context->methods->is_empty) (context);
 }
 
+/*
+ * MemoryContextMemAllocated
+ *		Total space obtained from malloc by the context, optionally
+ *		including its descendants.
+ *
+ * This walks the context's blocks and freelists, so callers that poll it
+ * inside a loop should do so only every so often.
+ */
+Size
+MemoryContextMemAllocated(MemoryContext context, bool recurse)
+{
+	MemoryContextCounters totals;
+	Size		total;
+
+	AssertArg(MemoryContextIsValid(context));
+
+	memset(&totals, 0, sizeof(totals));
+	(*context->methods->stats) (context, 0, false, &totals);
+	total = totals.totalspace;
+
+	if (recurse)
+	{
+		MemoryContext child;
+
+		for (child = context->firstchild;
+			 child != NULL;
+			 child = child->nextchild)
+			total += MemoryContextMemAllocated(child, true);
+	}
+
+	return total;
+}
+
 /*
  * MemoryContextStats
  *		Print statistics about the named context and all its descendants.
@@ -0,0 +1,771 @@
+/*-------------------------------------------------------------------------
+ *
+ * slab.c
+ *	  SLAB allocator definitions.
+ *
+ * SLAB is a MemoryContext implementation designed for cases where large
+ * numbers of equally-sized objects are allocated (and freed).
+ *
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * IDENTIFICATION
+ *	  src/backend/utils/mmgr/slab.c
+ *
+ *
+ * NOTE:
+ *	The constant allocation size allows significant simplification and various
+ *	optimizations over more general purpose allocators. The blocks are carved
+ *	into chunks of exactly the right size (plus alignment), not wasting any
+ *	memory.
+ *
+ *	The information about free chunks is maintained both at the block level
+ *	and global (context) level. This is possible as the chunk size (and thus
+ *	also the number of chunks per block) is fixed.
+ *
+ *	On each block, free chunks are tracked in a simple linked list. Contents
+ *	of free chunks is replaced with an index of the next free chunk, forming
+ *	a very simple linked list. Each block also contains a counter of free
+ *	chunks. Combined with the local block-level freelist, it makes it trivial
+ *	to eventually free the whole block.
+ *
+ *	At the context level, we use 'freelist' to track blocks ordered by number
+ *	of free chunks, starting with blocks having a single allocated chunk, and
+ *	with completely full blocks on the tail.
+ *
+ *	This also allows various optimizations - for example when searching for
+ *	free chunk, the allocator reuses space from the fullest blocks first, in
+ *	the hope that some of the less full blocks will get completely empty (and
+ *	returned back to the OS).
+ *
+ *	For each block, we maintain pointer to the first free chunk - this is quite
+ *	cheap and allows us to skip all the preceding used chunks, eliminating
+ *	a significant number of lookups in many common usage patterns. In the worst
+ *	case this performs as if the pointer was not maintained.
+ *
+ *	We cache the freelist index for the blocks with the fewest free chunks
+ *	(minFreeChunks), so that we don't have to search the freelist on every
+ *	SlabAlloc() call, which is quite expensive.
+ *
+ *	Completely empty blocks are free()'d right away, so that memory is given
+ *	back once the objects it held have been freed, rather than only when the
+ *	whole context is reset or deleted.
+ *
+ *	About chunk headers:
+ *
+ *	mcxt.c expects a StandardChunkHeader immediately before each chunk's
+ *	data. Slab chunks additionally need to know their block, so each chunk
+ *	starts with a (MAXALIGN'ed) pointer to it, followed by the standard
+ *	header:
+ *
+ *		[SlabBlock *][StandardChunkHeader][data]
+ *
+ *	The context field of the standard header is cleared while the chunk is
+ *	free, which lets SlabCheck() tell free and allocated chunks apart.
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres.h"
+
+#include "lib/ilist.h"
+#include "utils/memdebug.h"
+#include "utils/memutils.h"
+
+
+/*
+ * SlabContext is a specialized implementation of MemoryContext.
+ */
+typedef struct SlabContext
+{
+	MemoryContextData header;	/* Standard memory-context fields */
+	/* Allocation parameters for this context: */
+	Size		chunkSize;		/* chunk size */
+	Size		fullChunkSize;	/* chunk size including header and alignment */
+	Size		blockSize;		/* block size */
+	int			chunksPerBlock; /* number of chunks per block */
+	int			minFreeChunks;	/* min number of free chunks in any block */
+	int			nblocks;		/* number of blocks allocated */
+	/* blocks with free space, grouped by number of free chunks: */
+	dlist_head	freelist[FLEXIBLE_ARRAY_MEMBER];
+} SlabContext;
+
+typedef SlabContext *Slab;
+
+/*
+ * SlabIsValid
+ *		True iff set is valid slab allocation set.
+ */
+#define SlabIsValid(set) PointerIsValid(set)
+
+/*
+ * SlabBlock
+ *		Structure of a single block in SLAB allocator.
+ *
+ * node: doubly-linked list of blocks in global freelist
+ * nfree: number of free chunks in this block
+ * firstFreeChunk: index of the first free chunk
+ */
+typedef struct SlabBlock
+{
+	dlist_node	node;			/* doubly-linked list */
+	int			nfree;			/* number of free chunks */
+	int			firstFreeChunk; /* index of the first free chunk in the block */
+} SlabBlock;
+
+#define SLAB_BLOCKHDRSZ		MAXALIGN(sizeof(SlabBlock))
+#define SLAB_BLOCKPTRSZ		MAXALIGN(sizeof(SlabBlock *))
+#define SLAB_CHUNKHDRSZ		(SLAB_BLOCKPTRSZ + STANDARDCHUNKHEADERSIZE)
+
+#define SlabPointerGetChunk(ptr)	\
+	((char *) (ptr) - SLAB_CHUNKHDRSZ)
+#define SlabChunkGetPointer(chk)	\
+	((void *) ((char *) (chk) + SLAB_CHUNKHDRSZ))
+#define SlabChunkGetBlock(chk)		\
+	(*(SlabBlock **) (chk))
+#define SlabChunkGetHeader(chk)		\
+	((StandardChunkHeader *) ((char *) (chk) + SLAB_BLOCKPTRSZ))
+#define SlabBlockGetChunk(slab, block, idx) \
+	((char *) (block) + SLAB_BLOCKHDRSZ	\
+	 + ((idx) * (slab)->fullChunkSize))
+#define SlabChunkIndex(slab, block, chunk)	\
+	(((char *) (chunk) - (char *) (block) - SLAB_BLOCKHDRSZ) \
+	 / (slab)->fullChunkSize)
+
+/* In a free chunk, the data area stores the index of the next free chunk */
+#define SlabChunkNextFree(chk)		\
+	(*(int32 *) SlabChunkGetPointer(chk))
+
+/*
+ * These functions implement the MemoryContext API for Slab contexts.
+ */
+static void *SlabAlloc(MemoryContext context, Size size);
+static void SlabFree(MemoryContext context, void *pointer);
+static void *SlabRealloc(MemoryContext context, void *pointer, Size size);
+static void SlabInit(MemoryContext context);
+static void SlabReset(MemoryContext context);
+static void SlabDelete(MemoryContext context);
+static Size SlabGetChunkSpace(MemoryContext context, void *pointer);
+static bool SlabIsEmpty(MemoryContext context);
+static void SlabStats(MemoryContext context, int level, bool print,
+		  MemoryContextCounters *totals);
+
+#ifdef MEMORY_CONTEXT_CHECKING
+static void SlabCheck(MemoryContext context);
+#endif
+
+/*
+ * This is the virtual function table for Slab contexts.
+ */
+static MemoryContextMethods SlabMethods = {
+	SlabAlloc,
+	SlabFree,
+	SlabRealloc,
+	SlabInit,
+	SlabReset,
+	SlabDelete,
+	SlabGetChunkSpace,
+	SlabIsEmpty,
+	SlabStats
+#ifdef MEMORY_CONTEXT_CHECKING
+	,SlabCheck
+#endif
+};
+
+/* ----------
+ * Debug macros
+ * ----------
+ */
+#ifdef HAVE_ALLOCINFO
+#define SlabFreeInfo(_cxt, _chunk) \
+			fprintf(stderr, "SlabFree: %s: %p, %zu\n", \
+				(_cxt)->header.name, (_chunk), (_cxt)->chunkSize)
+#define SlabAllocInfo(_cxt, _chunk) \
+			fprintf(stderr, "SlabAlloc: %s: %p, %zu\n", \
+				(_cxt)->header.name, (_chunk), (_cxt)->chunkSize)
+#else
+#define SlabFreeInfo(_cxt, _chunk)
+#define SlabAllocInfo(_cxt, _chunk)
+#endif
+
+
+/*
+ * SlabFindMinFreeChunks
+ *		Find the freelist index of the blocks with the fewest free chunks,
+ *		or 0 if there are no blocks with free space.
+ */
+static int
+SlabFindMinFreeChunks(Slab slab)
+{
+	int			idx;
+
+	for (idx = 1; idx <= slab->chunksPerBlock; idx++)
+	{
+		if (!dlist_is_empty(&slab->freelist[idx]))
+			return idx;
+	}
+
+	return 0;
+}
+
+
+/*
+ * Public routines
+ */
+
+
+/*
+ * SlabContextCreate
+ *		Create a new Slab context.
+ *
+ * parent: parent context, or NULL if top-level context
+ * name: name of context (for debugging only, need not be unique)
+ * blockSize: allocation block size
+ * chunkSize: allocation chunk size
+ *
+ * Notes: the name string will be copied into context-lifespan storage.
+ * The chunkSize may not exceed:
+ *		MAXALIGN_DOWN(SIZE_MAX) - SLAB_BLOCKHDRSZ - SLAB_CHUNKHDRSZ
+ */
+MemoryContext
+SlabContextCreate(MemoryContext parent,
+				  const char *name,
+				  Size blockSize,
+				  Size chunkSize)
+{
+	int			chunksPerBlock;
+	Size		fullChunkSize;
+	Size		freelistSize;
+	Slab		slab;
+	int			i;
+
+	/* the index of the next free chunk must fit into a free chunk */
+	if (chunkSize < sizeof(int32))
+		chunkSize = sizeof(int32);
+
+	/* chunk, including SLAB header (both addresses nicely aligned) */
+	fullChunkSize = SLAB_CHUNKHDRSZ + MAXALIGN(chunkSize);
+
+	/* Make sure the block can store at least one chunk. */
+	if (blockSize < SLAB_BLOCKHDRSZ + fullChunkSize)
+		elog(ERROR, "block size %zu for slab is too small for %zu chunks",
+			 blockSize, chunkSize);
+
+	/* Compute maximum number of chunks per block */
+	chunksPerBlock = (blockSize - SLAB_BLOCKHDRSZ) / fullChunkSize;
+
+	/* The freelist starts with 0, ends with chunksPerBlock. */
+	freelistSize = sizeof(dlist_head) * (chunksPerBlock + 1);
+
+	/* Do the type-independent part of context creation */
+	slab = (Slab) MemoryContextCreate(T_SlabContext,
+									  offsetof(SlabContext, freelist) +
+									  freelistSize,
+									  &SlabMethods,
+									  parent,
+									  name);
+
+	slab->blockSize = blockSize;
+	slab->chunkSize = chunkSize;
+	slab->fullChunkSize = fullChunkSize;
+	slab->chunksPerBlock = chunksPerBlock;
+	slab->minFreeChunks = 0;
+	slab->nblocks = 0;
+
+	for (i = 0; i <= chunksPerBlock; i++)
+		dlist_init(&slab->freelist[i]);
+
+	return (MemoryContext) slab;
+}
+
+/*
+ * SlabInit
+ *		Context-type-specific initialization routine.
+ */
+static void
+SlabInit(MemoryContext context)
+{
+	/*
+	 * SlabContextCreate fills in the context node once MemoryContextCreate
+	 * returns it; nothing can try to use the context before that.
+	 */
+}
+
+/*
+ * SlabReset
+ *		Frees all memory which is allocated in the given set.
+ *
+ * The code simply frees all the blocks in the context - we don't keep any
+ * keeper blocks or anything like that.
+ */
+static void
+SlabReset(MemoryContext context)
+{
+	Slab		slab = (Slab) context;
+	int			i;
+
+	AssertArg(SlabIsValid(slab));
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	/* Check for corruption and leaks before freeing */
+	SlabCheck(context);
+#endif
+
+	/* walk over freelists and free the blocks */
+	for (i = 0; i <= slab->chunksPerBlock; i++)
+	{
+		dlist_mutable_iter miter;
+
+		dlist_foreach_modify(miter, &slab->freelist[i])
+		{
+			SlabBlock  *block = dlist_container(SlabBlock, node, miter.cur);
+
+			dlist_delete(miter.cur);
+
+#ifdef CLOBBER_FREED_MEMORY
+			wipe_mem(block, slab->blockSize);
+#endif
+			free(block);
+			slab->nblocks--;
+		}
+	}
+
+	slab->minFreeChunks = 0;
+
+	Assert(slab->nblocks == 0);
+}
+
+/*
+ * SlabDelete
+ *		Frees all memory which is allocated in the given slab, in preparation
+ *		for deletion of the slab.  We simply call SlabReset().
+ */
+static void
+SlabDelete(MemoryContext context)
+{
+	/* just reset the context */
+	SlabReset(context);
+}
+
+/*
+ * SlabAlloc
+ *		Returns pointer to allocated memory of given size or NULL if
+ *		request could not be completed; memory is added to the slab.
+ */
+static void *
+SlabAlloc(MemoryContext context, Size size)
+{
+	Slab		slab = (Slab) context;
+	SlabBlock  *block;
+	char	   *chunk;
+	StandardChunkHeader *header;
+	int			idx;
+
+	AssertArg(SlabIsValid(slab));
+
+	Assert((slab->minFreeChunks >= 0) &&
+		   (slab->minFreeChunks < slab->chunksPerBlock));
+
+	/* make sure we only allow correct request size */
+	if (size > slab->chunkSize)
+		elog(ERROR, "unexpected alloc chunk size %zu (expected %zu)",
+			 size, slab->chunkSize);
+
+	/*
+	 * If there are no free chunks in any existing block, create a new block
+	 * and put it to the last freelist bucket.
+	 *
+	 * slab->minFreeChunks == 0 means there are no blocks with free chunks,
+	 * thanks to how minFreeChunks is updated at the end of SlabAlloc().
+	 */
+	if (slab->minFreeChunks == 0)
+	{
+		block = (SlabBlock *) malloc(slab->blockSize);
+
+		if (block == NULL)
+			return NULL;
+
+		block->nfree = slab->chunksPerBlock;
+		block->firstFreeChunk = 0;
+
+		/*
+		 * Put all the chunks on a freelist. Walk the chunks and point each
+		 * one to the next one, marking them as free.
+		 */
+		for (idx = 0; idx < slab->chunksPerBlock; idx++)
+		{
+			chunk = SlabBlockGetChunk(slab, block, idx);
+			SlabChunkGetHeader(chunk)->context = NULL;
+			SlabChunkNextFree(chunk) = (idx + 1);
+		}
+
+		/*
+		 * And add it to the last freelist with all chunks empty.
+		 *
+		 * We know there are no blocks in the freelist, otherwise we wouldn't
+		 * need a new block.
+		 */
+		Assert(dlist_is_empty(&slab->freelist[slab->chunksPerBlock]));
+
+		dlist_push_head(&slab->freelist[slab->chunksPerBlock], &block->node);
+
+		slab->minFreeChunks = slab->chunksPerBlock;
+		slab->nblocks += 1;
+	}
+
+	/* grab the block from the freelist (even the new block is there) */
+	block = dlist_head_element(SlabBlock, node,
+							   &slab->freelist[slab->minFreeChunks]);
+
+	/* make sure we actually got a valid block, with matching nfree */
+	Assert(block != NULL);
+	Assert(slab->minFreeChunks == block->nfree);
+	Assert(block->nfree > 0);
+
+	/* we know index of the first free chunk in the block */
+	idx = block->firstFreeChunk;
+
+	/* make sure the chunk index is valid, and that it's marked as empty */
+	Assert((idx >= 0) && (idx < slab->chunksPerBlock));
+
+	/* compute the chunk location block start (after the block header) */
+	chunk = SlabBlockGetChunk(slab, block, idx);
+
+	/*
+	 * Update the block nfree count, and also the minFreeChunks as we've
+	 * decreased nfree for a block with the minimum number of free chunks
+	 * (because that's how we chose the block).
+	 */
+	block->nfree--;
+
+	/*
+	 * Remove the chunk from the freelist head. The index of the next free
+	 * chunk is stored in the chunk itself.
+	 */
+	VALGRIND_MAKE_MEM_DEFINED(SlabChunkGetPointer(chunk), sizeof(int32));
+	block->firstFreeChunk = SlabChunkNextFree(chunk);
+
+	Assert(block->firstFreeChunk >= 0);
+	Assert(block->firstFreeChunk <= slab->chunksPerBlock);
+
+	Assert((block->nfree != 0 &&
+			block->firstFreeChunk < slab->chunksPerBlock) ||
+		   (block->nfree == 0 &&
+			block->firstFreeChunk == slab->chunksPerBlock));
+
+	/* move the whole block to the right place in the freelist */
+	dlist_delete(&block->node);
+	dlist_push_head(&slab->freelist[block->nfree], &block->node);
+
+	/*
+	 * And finally update minFreeChunks, i.e. the index to the block with the
+	 * lowest number of free chunks. That's the block we just allocated from,
+	 * unless it got full - in which case we simply walk the freelist until we
+	 * find a non-empty entry.
+	 */
+	if (block->nfree > 0)
+		slab->minFreeChunks = block->nfree;
+	else if (dlist_is_empty(&slab->freelist[slab->minFreeChunks]))
+		slab->minFreeChunks = SlabFindMinFreeChunks(slab);
+
+	/* Prepare to initialize the chunk header. */
+	VALGRIND_MAKE_MEM_UNDEFINED(chunk, SLAB_CHUNKHDRSZ);
+
+	SlabChunkGetBlock(chunk) = block;
+	header = SlabChunkGetHeader(chunk);
+	header->context = (MemoryContext) slab;
+	header->size = slab->chunkSize;
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	header->requested_size = size;
+	/* slab mark to catch clobber of "unused" space */
+	if (size < slab->fullChunkSize - SLAB_CHUNKHDRSZ)
+		set_sentinel(SlabChunkGetPointer(chunk), size);
+#endif
+#ifdef RANDOMIZE_ALLOCATED_MEMORY
+	/* fill the allocated space with junk */
+	randomize_mem((char *) SlabChunkGetPointer(chunk), size);
+#endif
+
+	SlabAllocInfo(slab, chunk);
+	return SlabChunkGetPointer(chunk);
+}
+
+/*
+ * SlabFree
+ *		Frees allocated memory; memory is removed from the slab.
+ */
+static void
+SlabFree(MemoryContext context, void *pointer)
+{
+	int			idx;
+	int			oldnfree;
+	Slab		slab = (Slab) context;
+	char	   *chunk = SlabPointerGetChunk(pointer);
+	SlabBlock  *block = SlabChunkGetBlock(chunk);
+	StandardChunkHeader *header = SlabChunkGetHeader(chunk);
+
+	SlabFreeInfo(slab, chunk);
+
+	Assert(header->context == context);
+
+#ifdef MEMORY_CONTEXT_CHECKING
+	/* Test for someone scribbling on unused space in chunk */
+	if (header->requested_size < slab->fullChunkSize - SLAB_CHUNKHDRSZ)
+		if (!sentinel_ok(pointer, header->requested_size))
+			elog(WARNING, "detected write past chunk end in %s %p",
+				 slab->header.name, chunk);
+	header->requested_size = 0;
+#endif
+
+	/* compute index of the chunk with respect to block start */
+	idx = SlabChunkIndex(slab, block, chunk);
+
+	/* add chunk to freelist, and update block nfree count */
+	SlabChunkNextFree(chunk) = block->firstFreeChunk;
+	block->firstFreeChunk = idx;
+	oldnfree = block->nfree++;
+
+	Assert(block->nfree > 0);
+	Assert(block->nfree <= slab->chunksPerBlock);
+
+	/* the chunk is free now */
+	header->context = NULL;
+
+#ifdef CLOBBER_FREED_MEMORY
+	/* XXX don't wipe the int32 index, used for block-level freelist */
+	wipe_mem((char *) pointer + sizeof(int32),
+			 slab->chunkSize - sizeof(int32));
+#endif
+
+	/* remove the block from a freelist */
+	dlist_delete(&block->node);
+
+	if (block->nfree == slab->chunksPerBlock)
+	{
+		/*
+		 * The block is now completely empty - give it back right away instead
+		 * of waiting for a reset, which for long-lived contexts may never
+		 * come.
+		 */
+		free(block);
+		slab->nblocks--;
+
+		if (slab->minFreeChunks == oldnfree &&
+			dlist_is_empty(&slab->freelist[oldnfree]))
+			slab->minFreeChunks = SlabFindMinFreeChunks(slab);
+	}
+	else
+	{
+		dlist_push_head(&slab->freelist[block->nfree], &block->node);
+
+		/*
+		 * The block may now be the one with the fewest free chunks, or it may
+		 * have been the last block in the bucket minFreeChunks pointed to.
+		 */
+		if (slab->minFreeChunks == 0 || block->nfree < slab->minFreeChunks)
+			slab->minFreeChunks = block->nfree;
+		else if (slab->minFreeChunks == oldnfree &&
+				 dlist_is_empty(&slab->freelist[oldnfree]))
+			slab->minFreeChunks = block->nfree;
+	}
+
+	Assert(slab->nblocks >= 0);
+}
+
+/*
+ * SlabRealloc
+ *		Change the allocated size of a chunk.
+ *
+ * As Slab is designed for allocating equally-sized chunks of memory, it can't
+ * do an actual chunk size change.  We try to be gentle and allow calls with
+ * size not exceeding the chunk size, as we don't need to do anything; we
+ * simply return the same chunk.
+ *
+ * Any other size results in an error.
+ */
+static void *
+SlabRealloc(MemoryContext context, void *pointer, Size size)
+{
+	Slab		slab = (Slab) context;
+
+	/* can't do actual realloc with slab, but let's try to be gentle */
+	if (size <= slab->chunkSize)
+	{
+#ifdef MEMORY_CONTEXT_CHECKING
+		StandardChunkHeader *header =
+		SlabChunkGetHeader(SlabPointerGetChunk(pointer));
+
+		header->requested_size = size;
+		if (size < slab->fullChunkSize - SLAB_CHUNKHDRSZ)
+			set_sentinel(pointer, size);
+#endif
+		return pointer;
+	}
+
+	elog(ERROR, "slab allocator does not support realloc()");
+	return NULL;				/* keep compiler quiet */
+}
+
+/*
+ * SlabGetChunkSpace
+ *		Given a currently-allocated chunk, determine the total space
+ *		it occupies (including all memory-allocation overhead).
+ */
+static Size
+SlabGetChunkSpace(MemoryContext context, void *pointer)
+{
+	Slab		slab = (Slab) context;
+
+	return slab->fullChunkSize;
+}
+
+/*
+ * SlabIsEmpty
+ *		Is an Slab empty of any allocated space?
+ */
+static bool
+SlabIsEmpty(MemoryContext context)
+{
+	Slab		slab = (Slab) context;
+
+	/* empty blocks are freed right away, so this is exact */
+	return (slab->nblocks == 0);
+}
+
+/*
+ * SlabStats
+ *		Compute stats about memory consumption of an Slab.
+ *
+ * level: recursion level (0 at top level); used for print indentation.
+ * print: true to print stats to stderr.
+ * totals: if not NULL, add stats about this Slab into *totals.
+ */
+static void
+SlabStats(MemoryContext context, int level, bool print,
+		  MemoryContextCounters *totals)
+{
+	Slab		slab = (Slab) context;
+	Size		nblocks = 0;
+	Size		freechunks = 0;
+	Size		totalspace = 0;
+	Size		freespace = 0;
+	int			i;
+
+	for (i = 0; i <= slab->chunksPerBlock; i++)
+	{
+		dlist_iter	iter;
+
+		dlist_foreach(iter, &slab->freelist[i])
+		{
+			SlabBlock  *block = dlist_container(SlabBlock, node, iter.cur);
+
+			nblocks++;
+			totalspace += slab->blockSize;
+			freespace += slab->fullChunkSize * block->nfree;
+			freechunks += block->nfree;
+		}
+	}
+
+	if (print)
+	{
+		for (i = 0; i < level; i++)
+			fprintf(stderr, "  ");
+		fprintf(stderr,
+			"%s: %zu total in %zd blocks; %zu free (%zd chunks); %zu used\n",
+				slab->header.name, totalspace, nblocks, freespace, freechunks,
+				totalspace - freespace);
+	}
+
+	if (totals)
+	{
+		totals->nblocks += nblocks;
+		totals->freechunks += freechunks;
+		totals->totalspace += totalspace;
+		totals->freespace += freespace;
+	}
+}
+
+
+#ifdef MEMORY_CONTEXT_CHECKING
+
+/*
+ * SlabCheck
+ *		Walk through chunks and check consistency of memory.
+ *
+ * NOTE: report errors as WARNING, *not* ERROR or FATAL.  Otherwise you'll
+ * find yourself in an infinite loop when trouble occurs, because this
+ * routine will be entered again when elog cleanup tries to release memory!
+ */
+static void
+SlabCheck(MemoryContext context)
+{
+	int			i;
+	Slab		slab = (Slab) context;
+	char	   *name = slab->header.name;
+
+	Assert(slab->chunksPerBlock > 0);
+
+	/* walk all the freelists */
+	for (i = 0; i <= slab->chunksPerBlock; i++)
+	{
+		int			j,
+					nfree;
+		dlist_iter	iter;
+
+		/* walk all blocks on this freelist */
+		dlist_foreach(iter, &slab->freelist[i])
+		{
+			SlabBlock  *block = dlist_container(SlabBlock, node, iter.cur);
+
+			/*
+			 * Make sure the number of free chunks (in the block header)
+			 * matches position in the freelist.
+			 */
+			if (block->nfree != i)
+				elog(WARNING, "problem in slab %s: number of free chunks %d in block %p does not match freelist %d",
+					 name, block->nfree, block, i);
+
+			/* walk the chunks, counting the free ones */
+			nfree = 0;
+			for (j = 0; j < slab->chunksPerBlock; j++)
+			{
+				char	   *chunk = SlabBlockGetChunk(slab, block, j);
+				StandardChunkHeader *header = SlabChunkGetHeader(chunk);
+
+				if (header->context == NULL)
+				{
+					nfree++;
+					continue;
+				}
+
+				/* allocated chunks should point to this block and slab */
+				if (SlabChunkGetBlock(chunk) != block)
+					elog(WARNING, "problem in slab %s: bogus block link in block %p, chunk %p",
+						 name, block, chunk);
+
+				if (header->context != context)
+					elog(WARNING, "problem in slab %s: bogus slab link in block %p, chunk %p",
+						 name, block, chunk);
+
+				/* there might be sentinel (thanks to alignment) */
+				if (header->requested_size < slab->fullChunkSize - SLAB_CHUNKHDRSZ)
+					if (!sentinel_ok(SlabChunkGetPointer(chunk),
+									 header->requested_size))
+						elog(WARNING, "problem in slab %s: detected write past chunk end in block %p, chunk %p",
+							 name, block, chunk);
+			}
+
+			/*
+			 * Make sure we got the expected number of free chunks (as
+			 * tracked in the block header).
+			 */
+			if (nfree != block->nfree)
+				elog(WARNING, "problem in slab %s: number of free chunks %d in block %p does not match bitmap %d",
+					 name, block->nfree, block, nfree);
+		}
+	}
+}
+
+#endif   /* MEMORY_CONTEXT_CHECKING */
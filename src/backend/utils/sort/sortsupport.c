@@ -84,6 +84,57 @@ PrepareSortSupportComparisonShim(Oid cmpFunc, SortSupport ssup)
 	ssup->comparator = comparison_shim;
 }
 
+/*
+ * Comparator for datums, or abbreviated keys, that compare as unsigned
+ * integers
+ */
+int
+ssup_datum_unsigned_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	if (x > y)
+		return 1;
+	else if (x == y)
+		return 0;
+	else
+		return -1;
+}
+
+#ifdef USE_FLOAT8_BYVAL
+/*
+ * Comparator for pass-by-value datums that compare as int64
+ */
+int
+ssup_datum_signed_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	int64		a = DatumGetInt64(x);
+	int64		b = DatumGetInt64(y);
+
+	if (a > b)
+		return 1;
+	else if (a == b)
+		return 0;
+	else
+		return -1;
+}
+#endif
+
+/*
+ * Comparator for datums that compare as int32
+ */
+int
+ssup_datum_int32_cmp(Datum x, Datum y, SortSupport ssup)
+{
+	int32		a = DatumGetInt32(x);
+	int32		b = DatumGetInt32(y);
+
+	if (a > b)
+		return 1;
+	else if (a == b)
+		return 0;
+	else
+		return -1;
+}
+
 /*
  * Look up and call sortsupport function to setup SortSupport comparator;
  * or if no such function exists or it declines to set up the appropriate
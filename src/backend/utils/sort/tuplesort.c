@@ -481,6 +481,22 @@ struct Tuplesortstate
 #endif
 };
 
+/*
+ * Radix sorting of memtuples on datum1, see tuplesort_radix_sortable().
+ * Fewer tuples than RADIX_SORT_THRESHOLD are quicksorted instead, as are
+ * radix sort buckets that get that small.
+ */
+#define RADIX_SORT_THRESHOLD	64
+
+typedef struct
+{
+	int			nbytes;			/* number of significant key bytes */
+	bool		int32key;		/* datum1 holds an int32? */
+	Datum		xormask;		/* turns datum1 into an unsigned key */
+	bool		tiebreak;		/* must equal keys be sorted further? */
+	Tuplesortstate *state;
+} RadixSortInfo;
+
 #define COMPARETUP(state,a,b)	((*(state)->comparetup) (a, b, state))
 #define COPYTUP(state,stup,tup) ((*(state)->copytup) (state, stup, tup))
 #define WRITETUP(state,tape,stup)	((*(state)->writetup) (state, tape, stup))
@@ -567,6 +583,12 @@ static void dumptuples(Tuplesortstate *state, bool alltuples);
 static void dumpbatch(Tuplesortstate *state, bool alltuples);
 static void make_bounded_heap(Tuplesortstate *state);
 static void sort_bounded_heap(Tuplesortstate *state);
+static void tuplesort_qsort_range(Tuplesortstate *state, SortTuple *begin,
+					  size_t n);
+static bool tuplesort_radix_sortable(Tuplesortstate *state,
+						 RadixSortInfo *info);
+static void radix_sort_tuple(SortTuple *begin, size_t n, int level,
+				 const RadixSortInfo *info);
 static void tuplesort_sort_memtuples(Tuplesortstate *state);
 static void tuplesort_heap_insert(Tuplesortstate *state, SortTuple *tuple,
 					  int tupleindex, bool checkIndex);
@@ -3719,27 +3741,264 @@ sort_bounded_heap(Tuplesortstate *state)
 }
 
 /*
- * Sort all memtuples using specialized qsort() routines.
+ * Sort a range of memtuples with the comparison based qsort() routines.
+ */
+static void
+tuplesort_qsort_range(Tuplesortstate *state, SortTuple *begin, size_t n)
+{
+	if (n < 2)
+		return;
+
+	/* Can we use the single-key sort function? */
+	if (state->onlyKey != NULL)
+		qsort_ssup(begin, n, state->onlyKey);
+	else
+		qsort_tuple(begin, n, state->comparetup, state);
+}
+
+/*
+ * Check whether memtuples can be radix sorted on datum1, and if so, set up
+ * *info for radix_sort_tuple().
+ *
+ * That's possible when the leading sort key compares as a plain integer,
+ * that is its comparator is one of the ssup_datum_*_cmp() functions.  This
+ * covers the common integer and timestamp keys, and the abbreviated keys of
+ * text, uuid and inet.  Such a datum1 is mapped to an unsigned integer that
+ * sorts in the same order, taking the sort direction into account.
+ */
+static bool
+tuplesort_radix_sortable(Tuplesortstate *state, RadixSortInfo *info)
+{
+	SortSupport sortKey = state->sortKeys;
+	Datum		signbit;
+	Datum		allbits;
+
+	/* The hash index case has no sort keys */
+	if (sortKey == NULL)
+		return false;
+
+	/* CLUSTER doesn't set datum1 if the leading index column is an expression */
+	if (state->comparetup == comparetup_cluster &&
+		state->indexInfo->ii_KeyAttrNumbers[0] == 0)
+		return false;
+
+	if (sortKey->comparator == ssup_datum_unsigned_cmp)
+	{
+		info->nbytes = SIZEOF_DATUM;
+		info->int32key = false;
+		signbit = 0;
+		allbits = ~((Datum) 0);
+	}
+#ifdef USE_FLOAT8_BYVAL
+	else if (sortKey->comparator == ssup_datum_signed_cmp)
+	{
+		info->nbytes = SIZEOF_DATUM;
+		info->int32key = false;
+		signbit = ((Datum) 1) << (SIZEOF_DATUM * BITS_PER_BYTE - 1);
+		allbits = ~((Datum) 0);
+	}
+#endif
+	else if (sortKey->comparator == ssup_datum_int32_cmp)
+	{
+		info->nbytes = sizeof(int32);
+		info->int32key = true;
+		signbit = (Datum) 0x80000000;
+		allbits = (Datum) 0xFFFFFFFF;
+	}
+	else
+		return false;
+
+	/* Flipping the sign bit makes signed keys sort as unsigned ones */
+	info->xormask = signbit;
+	if (sortKey->ssup_reverse)
+		info->xormask ^= allbits;
+
+	/*
+	 * Tuples whose keys are equal need no further sorting only if the key is
+	 * the only one and isn't abbreviated.  Otherwise the comparison sort
+	 * orders them by the remaining keys (and checks uniqueness, for btree
+	 * index builds).
+	 */
+	info->tiebreak = (state->onlyKey == NULL);
+	info->state = state;
+
+	return true;
+}
+
+/*
+ * Return the normalized key of a tuple: an unsigned integer that sorts in
+ * the same order as its datum1.
+ */
+static inline Datum
+radix_key(const SortTuple *stup, const RadixSortInfo *info)
+{
+	Datum		key = stup->datum1;
+
+	if (info->int32key)
+		key = (Datum) (uint32) DatumGetInt32(key);
+
+	return key ^ info->xormask;
+}
+
+/*
+ * Sort tuples with non-NULL datum1 on their normalized keys, starting at
+ * byte number "level" of them (counting from the least significant byte).
+ *
+ * This is an in-place MSD radix sort ("American flag sort"): count the
+ * tuples falling in each bucket of the current byte, move every tuple into
+ * its bucket by swapping, then sort each bucket on the next byte.  No memory
+ * beyond memtuples is needed, and the recursion is at most SIZEOF_DATUM
+ * levels deep.  Small buckets are left to the comparison sort, which is
+ * faster there.
+ */
+static void
+radix_sort_tuple(SortTuple *begin, size_t n, int level,
+				 const RadixSortInfo *info)
+{
+	size_t		counts[256];
+	size_t		next[256];
+	size_t		ends[256];
+	size_t		start;
+	int			shift;
+	int			b;
+
+	for (;;)
+	{
+		size_t		i;
+
+		if (n < RADIX_SORT_THRESHOLD)
+		{
+			tuplesort_qsort_range(info->state, begin, n);
+			return;
+		}
+
+		shift = level * BITS_PER_BYTE;
+		memset(counts, 0, sizeof(counts));
+		for (i = 0; i < n; i++)
+			counts[(radix_key(&begin[i], info) >> shift) & 0xFF]++;
+
+		/* Go straight to the next byte if all tuples share this one */
+		b = (radix_key(&begin[0], info) >> shift) & 0xFF;
+		if (counts[b] != n)
+			break;
+		if (level == 0)
+		{
+			/* All keys are equal */
+			if (info->tiebreak)
+				tuplesort_qsort_range(info->state, begin, n);
+			return;
+		}
+		level--;
+	}
+
+	start = 0;
+	for (b = 0; b < 256; b++)
+	{
+		next[b] = start;
+		start += counts[b];
+		ends[b] = start;
+	}
+
+	/* Swap each tuple into its bucket, one bucket after the other */
+	for (b = 0; b < 256; b++)
+	{
+		while (next[b] < ends[b])
+		{
+			SortTuple  *stup = &begin[next[b]];
+			int			d = (radix_key(stup, info) >> shift) & 0xFF;
+
+			if (d == b)
+				next[b]++;
+			else
+			{
+				SortTuple	tmp = *stup;
+
+				*stup = begin[next[d]];
+				begin[next[d]++] = tmp;
+			}
+		}
+	}
+
+	/* Sort the buckets on the following bytes */
+	start = 0;
+	for (b = 0; b < 256; b++)
+	{
+		if (counts[b] > 1)
+		{
+			if (level > 0)
+				radix_sort_tuple(begin + start, counts[b], level - 1, info);
+			else if (info->tiebreak)
+				tuplesort_qsort_range(info->state, begin + start, counts[b]);
+		}
+		start += counts[b];
+	}
+}
+
+/*
+ * Sort all memtuples using radix sort or specialized qsort() routines.
  *
  * Quicksort is used for small in-memory sorts.  Quicksort is also generally
  * preferred to replacement selection for generating runs during external sort
  * operations, although replacement selection is sometimes used for the first
- * run.
+ * run.  When the leading key allows it, larger sorts are instead radix
+ * sorted on datum1, which needs no comparator calls at all.
  */
 static void
 tuplesort_sort_memtuples(Tuplesortstate *state)
 {
-	if (state->memtupcount > 1)
+	RadixSortInfo info;
+	SortTuple  *memtuples = state->memtuples;
+	size_t		n = state->memtupcount;
+	size_t		nnulls = 0;
+	size_t		i;
+
+	if (n < 2)
+		return;
+
+	if (n < RADIX_SORT_THRESHOLD || !tuplesort_radix_sortable(state, &info))
 	{
-		/* Can we use the single-key sort function? */
-		if (state->onlyKey != NULL)
-			qsort_ssup(state->memtuples, state->memtupcount,
-					   state->onlyKey);
-		else
-			qsort_tuple(state->memtuples,
-						state->memtupcount,
-						state->comparetup,
-						state);
+		tuplesort_qsort_range(state, memtuples, n);
+		return;
+	}
+
+	/*
+	 * Gather the tuples with NULL datum1 at the front or the back, according
+	 * to the NULLS FIRST/LAST setting.  They are left for the comparison
+	 * sort to order by the other keys.
+	 */
+	if (state->sortKeys->ssup_nulls_first)
+	{
+		for (i = 0; i < n; i++)
+		{
+			if (memtuples[i].isnull1)
+			{
+				SortTuple	tmp = memtuples[i];
+
+				memtuples[i] = memtuples[nnulls];
+				memtuples[nnulls++] = tmp;
+			}
+		}
+		if (info.tiebreak)
+			tuplesort_qsort_range(state, memtuples, nnulls);
+		radix_sort_tuple(memtuples + nnulls, n - nnulls, info.nbytes - 1,
+						 &info);
+	}
+	else
+	{
+		for (i = n; i > 0; i--)
+		{
+			if (memtuples[i - 1].isnull1)
+			{
+				SortTuple	tmp = memtuples[i - 1];
+
+				nnulls++;
+				memtuples[i - 1] = memtuples[n - nnulls];
+				memtuples[n - nnulls] = tmp;
+			}
+		}
+		radix_sort_tuple(memtuples, n - nnulls, info.nbytes - 1, &info);
+		if (info.tiebreak)
+			tuplesort_qsort_range(state, memtuples + n - nnulls, nnulls);
 	}
 }
 
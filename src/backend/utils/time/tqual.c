@@ -61,6 +61,7 @@
 
 #include "postgres.h"
 
+#include "access/csnlog.h"
 #include "access/htup_details.h"
 #include "access/multixact.h"
 #include "access/subtrans.h"
@@ -80,9 +81,58 @@
 SnapshotData SnapshotSelfData = {HeapTupleSatisfiesSelf};
 SnapshotData SnapshotAnyData = {HeapTupleSatisfiesAny};
 
+/*
+ * Results of TM->IsInSnapshotBatch for xids of the heap page being scanned,
+ * see PrefetchXidsInMVCCSnapshot.  Xids are sorted.
+ */
+static TransactionId PrefetchedXids[2 * MaxHeapTuplesPerPage];
+static bool PrefetchedInSnapshot[2 * MaxHeapTuplesPerPage];
+static int	NumPrefetchedXids = 0;
+static Snapshot PrefetchedSnapshot = NULL;
+static TransactionId PrefetchedXmin;
+static TransactionId PrefetchedXmax;
+
 /* local functions */
 static bool XidInMVCCSnapshot(TransactionId xid, Snapshot snapshot);
 
+/*
+ * XminIsVisibleForAllSnapshots
+ *
+ * Check HEAP_XMIN_ALL_SNAPSHOTS hint set by SetXminVisibleForAllSnapshots.
+ * Like PD_ALL_VISIBLE, the hint can be propagated to a standby before the
+ * inserting transaction is seen as committed by its snapshots, so it is
+ * ignored for snapshots taken during recovery.
+ */
+static inline bool
+XminIsVisibleForAllSnapshots(HeapTupleHeader tuple, Snapshot snapshot)
+{
+	return (tuple->t_infomask2 & HEAP_XMIN_ALL_SNAPSHOTS) != 0 &&
+		!snapshot->takenDuringRecovery;
+}
+
+/*
+ * SetXminVisibleForAllSnapshots
+ *
+ * Ask transaction manager whether committed xmin of the tuple, which is
+ * already found to be visible for our snapshot, is visible for all
+ * snapshots, and if so remember it in the tuple.  This is only useful for
+ * transaction managers keeping their own state of committed transactions,
+ * so that subsequent checks can avoid looking it up.  Like other hint bits
+ * it is set under share lock of the buffer and is not WAL-logged.
+ */
+static inline void
+SetXminVisibleForAllSnapshots(HeapTupleHeader tuple, Buffer buffer,
+							  Snapshot snapshot)
+{
+	if (TM->IsVisibleForAllSnapshots != NULL &&
+		!snapshot->takenDuringRecovery &&
+		TM->IsVisibleForAllSnapshots(HeapTupleHeaderGetRawXmin(tuple)))
+	{
+		tuple->t_infomask2 |= HEAP_XMIN_ALL_SNAPSHOTS;
+		MarkBufferDirtyHint(buffer, true);
+	}
+}
+
 /*
  * SetHintBits()
  *
@@ -1071,12 +1121,13 @@ HeapTupleSatisfiesMVCC(HeapTuple htup, Snapshot snapshot,
 			return false;
 		}
 	}
-	else
+	else if (!HeapTupleHeaderXminFrozen(tuple) &&
+			 !XminIsVisibleForAllSnapshots(tuple, snapshot))
 	{
 		/* xmin is committed, but maybe not according to our snapshot */
-		if (!HeapTupleHeaderXminFrozen(tuple) &&
-			XidInMVCCSnapshot(HeapTupleHeaderGetRawXmin(tuple), snapshot))
+		if (XidInMVCCSnapshot(HeapTupleHeaderGetRawXmin(tuple), snapshot))
 			return false;		/* treat as still in progress */
+		SetXminVisibleForAllSnapshots(tuple, buffer, snapshot);
 	}
 
 	/* by here, the inserting transaction has committed */
@@ -1459,9 +1510,114 @@ HeapTupleIsSurelyDead(HeapTuple htup, TransactionId OldestXmin)
 bool
 XidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 {
+	if (NumPrefetchedXids != 0 && snapshot == PrefetchedSnapshot &&
+		snapshot->xmin == PrefetchedXmin && snapshot->xmax == PrefetchedXmax)
+	{
+		int			l = 0,
+					r = NumPrefetchedXids;
+
+		while (l < r)
+		{
+			int			m = (l + r) >> 1;
+
+			if (PrefetchedXids[m] < xid)
+				l = m + 1;
+			else
+				r = m;
+		}
+		if (l < NumPrefetchedXids && PrefetchedXids[l] == xid)
+			return PrefetchedInSnapshot[l];
+	}
 	return TM->IsInSnapshot(xid, snapshot);
 }
 
+/*
+ * PrefetchXidsInMVCCSnapshot
+ *		Resolve visibility of xmin and xmax of all tuples of the page with
+ *		single call of TM->IsInSnapshotBatch.
+ *
+ * Subsequent XidInMVCCSnapshot calls for this snapshot use the results
+ * until ResetXidsInMVCCSnapshot is called, which heapgetpage does once it is
+ * done with the page and (sub)transaction abort does if an error interrupts
+ * the page scan.  Only xids which HeapTupleSatisfiesMVCC may pass to
+ * XidInMVCCSnapshot are collected.
+ * Caller must hold at least share lock on the buffer.  Returns false if the
+ * transaction manager has no batched callback or there is nothing to
+ * resolve.
+ */
+bool
+PrefetchXidsInMVCCSnapshot(Buffer buffer, Snapshot snapshot)
+{
+	Page		page = BufferGetPage(buffer);
+	OffsetNumber lines = PageGetMaxOffsetNumber(page);
+	OffsetNumber lineoff;
+	int			n = 0;
+	int			i,
+				j;
+
+	NumPrefetchedXids = 0;
+	if (TM->IsInSnapshotBatch == NULL ||
+		snapshot->satisfies != HeapTupleSatisfiesMVCC)
+		return false;
+
+	for (lineoff = FirstOffsetNumber; lineoff <= lines; lineoff++)
+	{
+		ItemId		lpp = PageGetItemId(page, lineoff);
+		HeapTupleHeader tuple;
+		TransactionId xid;
+
+		if (!ItemIdIsNormal(lpp))
+			continue;
+		tuple = (HeapTupleHeader) PageGetItem(page, lpp);
+
+		xid = HeapTupleHeaderGetRawXmin(tuple);
+		if (!HeapTupleHeaderXminInvalid(tuple) &&
+			!HeapTupleHeaderXminFrozen(tuple) &&
+			!XminIsVisibleForAllSnapshots(tuple, snapshot) &&
+			TransactionIdIsNormal(xid) &&
+			!TransactionIdIsCurrentTransactionId(xid))
+			PrefetchedXids[n++] = xid;
+
+		xid = HeapTupleHeaderGetRawXmax(tuple);
+		if (!(tuple->t_infomask & HEAP_XMAX_INVALID) &&
+			!HEAP_XMAX_IS_LOCKED_ONLY(tuple->t_infomask) &&
+			!(tuple->t_infomask & HEAP_XMAX_IS_MULTI) &&
+			TransactionIdIsNormal(xid) &&
+			!TransactionIdIsCurrentTransactionId(xid))
+			PrefetchedXids[n++] = xid;
+	}
+	if (n == 0)
+		return false;
+
+	/* tuples of the page are usually created by few transactions */
+	qsort(PrefetchedXids, n, sizeof(TransactionId), xidComparator);
+	for (i = 1, j = 1; i < n; i++)
+	{
+		if (PrefetchedXids[i] != PrefetchedXids[j - 1])
+			PrefetchedXids[j++] = PrefetchedXids[i];
+	}
+	n = j;
+
+	TM->IsInSnapshotBatch(PrefetchedXids, n, snapshot, PrefetchedInSnapshot);
+
+	PrefetchedSnapshot = snapshot;
+	PrefetchedXmin = snapshot->xmin;
+	PrefetchedXmax = snapshot->xmax;
+	NumPrefetchedXids = n;
+	return true;
+}
+
+/*
+ * ResetXidsInMVCCSnapshot
+ *		Forget results of PrefetchXidsInMVCCSnapshot.
+ */
+void
+ResetXidsInMVCCSnapshot(void)
+{
+	NumPrefetchedXids = 0;
+	PrefetchedSnapshot = NULL;
+}
+
 /*
  * XidInMVCCSnapshot
  *		Is the given XID still-in-progress according to the snapshot?
@@ -1584,6 +1740,32 @@ PgXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
 	return false;
 }
 
+/*
+ * CsnXidInMVCCSnapshot
+ *		Is the given XID still-in-progress according to a CSN snapshot?
+ *
+ * With a CSN snapshot an XID in [xmin, xmax) is running unless it committed
+ * with a CSN preceding the snapshot's.  Subtransactions get the CSN of
+ * their parent at commit, so no pg_subtrans lookup is needed.  Snapshots
+ * without a CSN (taken during recovery, historic, or imported from a
+ * standard snapshot) are checked against their xip arrays as usual.
+ */
+bool
+CsnXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot)
+{
+	if (!CommitSeqNoIsValid(snapshot->snapshot_csn))
+		return PgXidInMVCCSnapshot(xid, snapshot);
+
+	/* Any xid < xmin is not in-progress */
+	if (TransactionIdPrecedes(xid, snapshot->xmin))
+		return false;
+	/* Any xid >= xmax is in-progress */
+	if (TransactionIdFollowsOrEquals(xid, snapshot->xmax))
+		return true;
+
+	return CSNLogXidInSnapshot(xid, snapshot->snapshot_csn);
+}
+
 /*
  * Is the tuple really only locked?  That is, is it not updated?
  *
@@ -203,6 +203,7 @@ static const char *const subdirs[] = {
 	"pg_xlog/archive_status",
 	"pg_clog",
 	"pg_commit_ts",
+	"pg_csnlog",
 	"pg_dynshmem",
 	"pg_notify",
 	"pg_serial",
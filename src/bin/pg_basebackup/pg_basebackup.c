@@ -69,6 +69,8 @@ static bool writerecoveryconf = false;
 static int	standby_message_timeout = 10 * 1000;		/* 10 sec = default */
 static pg_time_t last_progress_report = 0;
 static int32 maxrate = 0;		/* no limit by default */
+static int	server_compresslevel = 0;
+static int	jobs = 1;			/* number of parallel backup streams */
 
 
 /* Progress counters */
@@ -84,6 +86,24 @@ static int	bgpipe[2] = {-1, -1};
 /* Handle to child process */
 static pid_t bgchild = -1;
 
+/* Processes receiving the other streams of a parallel backup */
+static pid_t *stream_children = NULL;
+
+/*
+ * Stream received by this process, 0 for the main one, and the suffix that
+ * goes into the names of its tar files.
+ */
+static int	backup_stream = 0;
+static char stream_suffix[16] = "";
+
+#ifdef HAVE_LIBZ
+/* Decompression state for data compressed by the server */
+static z_stream copy_zstream;
+static bool copy_zstream_init = false;
+static char *copy_zbuf = NULL;
+static size_t copy_zbufsize = 0;
+#endif
+
 /* End position for xlog streaming, empty string if unknown yet */
 static XLogRecPtr xlogendptr;
 
@@ -102,11 +122,17 @@ static void disconnect_and_exit(int code);
 static void verify_dir_is_empty_or_create(char *dirname);
 static void progress_report(int tablespacenum, const char *filename, bool force);
 
+static int	GetCopyData(PGconn *conn, char **buffer);
+static void FreeCopyData(char *buffer);
+static void ResetCopyDecompression(void);
 static void ReceiveTarFile(PGconn *conn, PGresult *res, int rownum);
 static void ReceiveAndUnpackTarFile(PGconn *conn, PGresult *res, int rownum);
 static void GenerateRecoveryConf(PGconn *conn);
 static void WriteRecoveryConf(void);
 static void BaseBackup(void);
+static void StartBackupStreams(char *xlogstart);
+static void BackupStreamMain(char *xlogstart) pg_attribute_noreturn();
+static void WaitForBackupStreams(void);
 
 static bool reached_end_position(XLogRecPtr segendpos, uint32 timeline,
 					 bool segment_finished);
@@ -130,6 +156,15 @@ disconnect_and_exit(int code)
 	 */
 	if (bgchild > 0)
 		kill(bgchild, SIGTERM);
+
+	if (stream_children != NULL)
+	{
+		int			i;
+
+		for (i = 1; i < jobs; i++)
+			if (stream_children[i] > 0)
+				kill(stream_children[i], SIGTERM);
+	}
 #endif
 
 	exit(code);
@@ -250,9 +285,13 @@ usage(void)
 	printf(_("      --xlogdir=XLOGDIR  location for the transaction log directory\n"));
 	printf(_("  -z, --gzip             compress tar output\n"));
 	printf(_("  -Z, --compress=0-9     compress tar output with given compression level\n"));
+	printf(_("      --server-compress=0-9\n"
+			 "                         compress data sent by the server with given level\n"));
 	printf(_("\nGeneral options:\n"));
 	printf(_("  -c, --checkpoint=fast|spread\n"
 			 "                         set fast or spread checkpointing\n"));
+	printf(_("  -j, --jobs=NUM         use this many parallel connections to receive\n"
+			 "                         the backup\n"));
 	printf(_("  -l, --label=LABEL      set backup label\n"));
 	printf(_("  -P, --progress         show progress information\n"));
 	printf(_("  -v, --verbose          output verbose messages\n"));
@@ -733,6 +772,116 @@ parse_max_rate(char *src)
 	return (int32) result;
 }
 
+/*
+ * Read a CopyData message, decompressing it if the server was asked to
+ * compress the backup.  The server compresses every message on its own, so
+ * the decompressed data are exactly one message of tar data.
+ *
+ * Returns like PQgetCopyData in synchronous mode.  Release the buffer with
+ * FreeCopyData.
+ */
+static int
+GetCopyData(PGconn *conn, char **buffer)
+{
+#ifdef HAVE_LIBZ
+	if (server_compresslevel != 0)
+	{
+		for (;;)
+		{
+			char	   *raw;
+			size_t		len = 0;
+			int			r;
+
+			r = PQgetCopyData(conn, &raw, 0);
+			if (r < 0)
+				return r;
+
+			copy_zstream.next_in = (Bytef *) raw;
+			copy_zstream.avail_in = r;
+			do
+			{
+				int			rc;
+
+				if (copy_zbufsize - len < 32768)
+				{
+					copy_zbufsize = Max(copy_zbufsize * 2, 65536);
+					copy_zbuf = pg_realloc(copy_zbuf, copy_zbufsize);
+				}
+				copy_zstream.next_out = (Bytef *) (copy_zbuf + len);
+				copy_zstream.avail_out = copy_zbufsize - len;
+
+				rc = inflate(&copy_zstream, Z_SYNC_FLUSH);
+				if (rc != Z_OK && rc != Z_BUF_ERROR)
+				{
+					fprintf(stderr,
+							_("%s: could not decompress COPY data: %s\n"),
+							progname,
+							copy_zstream.msg ? copy_zstream.msg : "unknown error");
+					disconnect_and_exit(1);
+				}
+				len = copy_zbufsize - copy_zstream.avail_out;
+				if (rc == Z_BUF_ERROR)
+					break;
+			} while (copy_zstream.avail_in > 0 || copy_zstream.avail_out == 0);
+
+			PQfreemem(raw);
+
+			if (len > 0)
+			{
+				*buffer = copy_zbuf;
+				return (int) len;
+			}
+		}
+	}
+#endif
+
+	return PQgetCopyData(conn, buffer, 0);
+}
+
+static void
+FreeCopyData(char *buffer)
+{
+#ifdef HAVE_LIBZ
+	if (server_compresslevel != 0)
+		return;					/* points into copy_zbuf */
+#endif
+
+	PQfreemem(buffer);
+}
+
+/*
+ * Prepare to decompress the next tar stream; the server starts a separate
+ * deflate stream for each of them.
+ */
+static void
+ResetCopyDecompression(void)
+{
+#ifdef HAVE_LIBZ
+	if (server_compresslevel == 0)
+		return;
+
+	if (!copy_zstream_init)
+	{
+		MemSet(&copy_zstream, 0, sizeof(copy_zstream));
+		if (inflateInit2(&copy_zstream, -MAX_WBITS) != Z_OK)
+		{
+			fprintf(stderr,
+					_("%s: could not initialize compression library: %s\n"),
+					progname,
+					copy_zstream.msg ? copy_zstream.msg : "out of memory");
+			disconnect_and_exit(1);
+		}
+		copy_zstream_init = true;
+	}
+	else if (inflateReset(&copy_zstream) != Z_OK)
+	{
+		fprintf(stderr, _("%s: could not reset decompression stream\n"),
+				progname);
+		disconnect_and_exit(1);
+	}
+#endif
+}
+
 /*
  * Write a piece of tar data
  */
@@ -829,7 +978,8 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 #ifdef HAVE_LIBZ
 			if (compresslevel != 0)
 			{
-				snprintf(filename, sizeof(filename), "%s/base.tar.gz", basedir);
+				snprintf(filename, sizeof(filename), "%s/base%s.tar.gz",
+						 basedir, stream_suffix);
 				ztarfile = gzopen(filename, "wb");
 				if (gzsetparams(ztarfile, compresslevel,
 								Z_DEFAULT_STRATEGY) != Z_OK)
@@ -843,7 +993,8 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 			else
 #endif
 			{
-				snprintf(filename, sizeof(filename), "%s/base.tar", basedir);
+				snprintf(filename, sizeof(filename), "%s/base%s.tar",
+						 basedir, stream_suffix);
 				tarfile = fopen(filename, "wb");
 			}
 		}
@@ -856,8 +1007,8 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 #ifdef HAVE_LIBZ
 		if (compresslevel != 0)
 		{
-			snprintf(filename, sizeof(filename), "%s/%s.tar.gz", basedir,
-					 PQgetvalue(res, rownum, 0));
+			snprintf(filename, sizeof(filename), "%s/%s%s.tar.gz", basedir,
+					 PQgetvalue(res, rownum, 0), stream_suffix);
 			ztarfile = gzopen(filename, "wb");
 			if (gzsetparams(ztarfile, compresslevel,
 							Z_DEFAULT_STRATEGY) != Z_OK)
@@ -871,8 +1022,8 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 		else
 #endif
 		{
-			snprintf(filename, sizeof(filename), "%s/%s.tar", basedir,
-					 PQgetvalue(res, rownum, 0));
+			snprintf(filename, sizeof(filename), "%s/%s%s.tar", basedir,
+					 PQgetvalue(res, rownum, 0), stream_suffix);
 			tarfile = fopen(filename, "wb");
 		}
 	}
@@ -904,6 +1055,7 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 	/*
 	 * Get the COPY data stream
 	 */
+	ResetCopyDecompression();
 	res = PQgetResult(conn);
 	if (PQresultStatus(res) != PGRES_COPY_OUT)
 	{
@@ -918,11 +1070,11 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 
 		if (copybuf != NULL)
 		{
-			PQfreemem(copybuf);
+			FreeCopyData(copybuf);
 			copybuf = NULL;
 		}
 
-		r = PQgetCopyData(conn, &copybuf, 0);
+		r = GetCopyData(conn, &copybuf);
 		if (r == -1)
 		{
 			/*
@@ -1115,7 +1267,7 @@ ReceiveTarFile(PGconn *conn, PGresult *res, int rownum)
 	progress_report(rownum, filename, true);
 
 	if (copybuf != NULL)
-		PQfreemem(copybuf);
+		FreeCopyData(copybuf);
 }
 
 
@@ -1168,6 +1320,7 @@ ReceiveAndUnpackTarFile(PGconn *conn, PGresult *res, int rownum)
 	/*
 	 * Get the COPY data
 	 */
+	ResetCopyDecompression();
 	res = PQgetResult(conn);
 	if (PQresultStatus(res) != PGRES_COPY_OUT)
 	{
@@ -1182,11 +1335,11 @@ ReceiveAndUnpackTarFile(PGconn *conn, PGresult *res, int rownum)
 
 		if (copybuf != NULL)
 		{
-			PQfreemem(copybuf);
+			FreeCopyData(copybuf);
 			copybuf = NULL;
 		}
 
-		r = PQgetCopyData(conn, &copybuf, 0);
+		r = GetCopyData(conn, &copybuf);
 
 		if (r == -1)
 		{
@@ -1255,10 +1408,13 @@ ReceiveAndUnpackTarFile(PGconn *conn, PGresult *res, int rownum)
 						 * log directory location was specified, pg_xlog has
 						 * already been created as a symbolic link before
 						 * starting the actual backup. So just ignore creation
-						 * failures on related directories.
+						 * failures on related directories. In a parallel
+						 * backup, every stream creates the directories it
+						 * needs, so any of them may exist already.
 						 */
 						if (!((pg_str_endswith(filename, "/pg_xlog") ||
-							 pg_str_endswith(filename, "/archive_status")) &&
+							 pg_str_endswith(filename, "/archive_status") ||
+							   jobs > 1) &&
 							  errno == EEXIST))
 						{
 							fprintf(stderr,
@@ -1388,7 +1544,7 @@ ReceiveAndUnpackTarFile(PGconn *conn, PGresult *res, int rownum)
 	}
 
 	if (copybuf != NULL)
-		PQfreemem(copybuf);
+		FreeCopyData(copybuf);
 
 	if (basetablespace && writerecoveryconf)
 		WriteRecoveryConf();
@@ -1600,6 +1756,8 @@ BaseBackup(void)
 	char	   *basebkp;
 	char		escaped_label[MAXPGPATH];
 	char	   *maxrate_clause = NULL;
+	char	   *compress_clause = NULL;
+	char	   *parallel_clause = NULL;
 	int			i;
 	char		xlogstart[64];
 	char		xlogend[64];
@@ -1660,6 +1818,10 @@ BaseBackup(void)
 
 	if (maxrate > 0)
 		maxrate_clause = psprintf("MAX_RATE %u", maxrate);
+	if (server_compresslevel > 0)
+		compress_clause = psprintf("COMPRESS %d", server_compresslevel);
+	if (jobs > 1)
+		parallel_clause = psprintf("PARALLEL %d", jobs);
 
 	if (verbose)
 		fprintf(stderr,
@@ -1670,14 +1832,16 @@ BaseBackup(void)
 		fprintf(stderr, "waiting for checkpoint\r");
 
 	basebkp =
-		psprintf("BASE_BACKUP LABEL '%s' %s %s %s %s %s %s",
+		psprintf("BASE_BACKUP LABEL '%s' %s %s %s %s %s %s %s %s",
 				 escaped_label,
 				 showprogress ? "PROGRESS" : "",
 				 includewal && !streamwal ? "WAL" : "",
 				 fastcheckpoint ? "FAST" : "",
 				 includewal ? "NOWAIT" : "",
 				 maxrate_clause ? maxrate_clause : "",
-				 format == 't' ? "TABLESPACE_MAP" : "");
+				 format == 't' ? "TABLESPACE_MAP" : "",
+				 compress_clause ? compress_clause : "",
+				 parallel_clause ? parallel_clause : "");
 
 	if (PQsendQuery(conn, basebkp) == 0)
 	{
@@ -1786,6 +1950,13 @@ BaseBackup(void)
 		StartLogStreamer(xlogstart, starttli, sysidentifier);
 	}
 
+	/*
+	 * The other streams of a parallel backup attach to the one we started,
+	 * identifying it by its start point.
+	 */
+	if (jobs > 1)
+		StartBackupStreams(xlogstart);
+
 	/*
 	 * Start receiving chunks
 	 */
@@ -1836,6 +2007,13 @@ BaseBackup(void)
 		disconnect_and_exit(1);
 	}
 
+	/*
+	 * The server doesn't stop the backup until all streams are sent, but
+	 * the other processes may still be writing out the last of their data.
+	 */
+	if (stream_children != NULL)
+		WaitForBackupStreams();
+
 	if (bgchild > 0)
 	{
 #ifndef WIN32
@@ -1949,6 +2127,162 @@ BaseBackup(void)
 		fprintf(stderr, "%s: base backup completed\n", progname);
 }
 
+/*
+ * Start a process for each additional stream of a parallel backup.
+ */
+static void
+StartBackupStreams(char *xlogstart)
+{
+#ifndef WIN32
+	int			i;
+
+	stream_children = pg_malloc0(jobs * sizeof(pid_t));
+
+	/* Make sure the children don't write out our buffered output again */
+	fflush(stdout);
+	fflush(stderr);
+
+	for (i = 1; i < jobs; i++)
+	{
+		pid_t		pid = fork();
+
+		if (pid == 0)
+		{
+			/* in child process */
+			backup_stream = i;
+			BackupStreamMain(xlogstart);
+		}
+		else if (pid < 0)
+		{
+			fprintf(stderr, _("%s: could not create background process: %s\n"),
+					progname, strerror(errno));
+			disconnect_and_exit(1);
+		}
+		stream_children[i] = pid;
+	}
+#endif
+}
+
+/*
+ * Receive one of the additional streams of a parallel backup, in a child
+ * process.  The stream carries the same tablespaces as the main one, each
+ * tar holding just a share of the regular files; in tar format they are
+ * written to files named like the main ones with the stream number added.
+ */
+static void
+BackupStreamMain(char *xlogstart)
+{
+	PGresult   *res;
+	char	   *basebkp;
+	char	   *maxrate_clause = NULL;
+	char	   *compress_clause = NULL;
+	int			i;
+
+	/*
+	 * The connection, the WAL streamer and the other streams belong to the
+	 * parent. Only the main stream reports progress and gets recovery.conf.
+	 */
+	conn = NULL;
+	bgchild = -1;
+	stream_children = NULL;
+	showprogress = false;
+	writerecoveryconf = false;
+	snprintf(stream_suffix, sizeof(stream_suffix), ".%d", backup_stream);
+
+	conn = GetConnection();
+	if (!conn)
+		/* Error message already written in GetConnection() */
+		exit(1);
+
+	if (maxrate > 0)
+		maxrate_clause = psprintf("MAX_RATE %u", maxrate);
+	if (server_compresslevel > 0)
+		compress_clause = psprintf("COMPRESS %d", server_compresslevel);
+
+	basebkp =
+		psprintf("BASE_BACKUP PARALLEL %d WORKER %d STARTPOINT '%s' %s %s",
+				 jobs, backup_stream, xlogstart,
+				 maxrate_clause ? maxrate_clause : "",
+				 compress_clause ? compress_clause : "");
+
+	if (PQsendQuery(conn, basebkp) == 0)
+	{
+		fprintf(stderr, _("%s: could not send replication command \"%s\": %s"),
+				progname, "BASE_BACKUP", PQerrorMessage(conn));
+		disconnect_and_exit(1);
+	}
+
+	/* The start point, same as the main stream's */
+	res = PQgetResult(conn);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, _("%s: could not start backup stream %d: %s"),
+				progname, backup_stream, PQerrorMessage(conn));
+		disconnect_and_exit(1);
+	}
+	PQclear(res);
+
+	res = PQgetResult(conn);
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+	{
+		fprintf(stderr, _("%s: could not get backup header: %s"),
+				progname, PQerrorMessage(conn));
+		disconnect_and_exit(1);
+	}
+
+	for (i = 0; i < PQntuples(res); i++)
+	{
+		if (format == 't')
+			ReceiveTarFile(conn, res, i);
+		else
+			ReceiveAndUnpackTarFile(conn, res, i);
+	}
+	PQclear(res);
+
+	res = PQgetResult(conn);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		fprintf(stderr, _("%s: final receive failed: %s"),
+				progname, PQerrorMessage(conn));
+		disconnect_and_exit(1);
+	}
+	PQclear(res);
+	PQfinish(conn);
+
+	exit(0);
+}
+
+/*
+ * Wait for the processes receiving the other streams to exit.
+ */
+static void
+WaitForBackupStreams(void)
+{
+#ifndef WIN32
+	int			i;
+
+	for (i = 1; i < jobs; i++)
+	{
+		int			status;
+
+		if (waitpid(stream_children[i], &status, 0) != stream_children[i])
+		{
+			fprintf(stderr, _("%s: could not wait for child process: %s\n"),
+					progname, strerror(errno));
+			disconnect_and_exit(1);
+		}
+		stream_children[i] = -1;
+
+		if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+		{
+			fprintf(stderr, _("%s: receiving backup stream %d failed\n"),
+					progname, i);
+			disconnect_and_exit(1);
+		}
+	}
+#endif
+}
+
 
 int
 main(int argc, char **argv)
@@ -1977,7 +2311,9 @@ main(int argc, char **argv)
 		{"status-interval", required_argument, NULL, 's'},
 		{"verbose", no_argument, NULL, 'v'},
 		{"progress", no_argument, NULL, 'P'},
+		{"jobs", required_argument, NULL, 'j'},
 		{"xlogdir", required_argument, NULL, 1},
+		{"server-compress", required_argument, NULL, 2},
 		{NULL, 0, NULL, 0}
 	};
 	int			c;
@@ -2002,7 +2338,7 @@ main(int argc, char **argv)
 		}
 	}
 
-	while ((c = getopt_long(argc, argv, "D:F:r:RT:xX:l:zZ:d:c:h:p:U:s:S:wWvP",
+	while ((c = getopt_long(argc, argv, "D:F:r:RT:xX:l:zZ:d:c:h:j:p:U:s:S:wWvP",
 							long_options, &option_index)) != -1)
 	{
 		switch (c)
@@ -2074,6 +2410,24 @@ main(int argc, char **argv)
 			case 1:
 				xlog_dir = pg_strdup(optarg);
 				break;
+			case 2:
+				server_compresslevel = atoi(optarg);
+				if (server_compresslevel < 0 || server_compresslevel > 9)
+				{
+					fprintf(stderr, _("%s: invalid compression level \"%s\"\n"),
+							progname, optarg);
+					exit(1);
+				}
+				break;
+			case 'j':
+				jobs = atoi(optarg);
+				if (jobs < 1 || jobs > MAX_BACKUP_STREAMS)
+				{
+					fprintf(stderr, _("%s: invalid number of parallel jobs \"%s\"\n"),
+							progname, optarg);
+					exit(1);
+				}
+				break;
 			case 'l':
 				label = pg_strdup(optarg);
 				break;
@@ -2230,8 +2584,28 @@ main(int argc, char **argv)
 		}
 	}
 
+	if (jobs > 1 && format == 't' && strcmp(basedir, "-") == 0)
+	{
+		fprintf(stderr,
+				_("%s: cannot write a parallel backup to stdout\n"),
+				progname);
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"),
+				progname);
+		exit(1);
+	}
+
+#ifdef WIN32
+	if (jobs > 1)
+	{
+		fprintf(stderr,
+				_("%s: parallel backups are not supported on this platform\n"),
+				progname);
+		exit(1);
+	}
+#endif
+
 #ifndef HAVE_LIBZ
-	if (compresslevel != 0)
+	if (compresslevel != 0 || server_compresslevel != 0)
 	{
 		fprintf(stderr,
 				_("%s: this build does not support compression\n"),
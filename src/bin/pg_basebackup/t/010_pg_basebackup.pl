@@ -2,9 +2,11 @@ use strict;
 use warnings;
 use Cwd;
 use Config;
+use File::Find;
+use Archive::Tar;
 use PostgresNode;
 use TestLib;
-use Test::More tests => 52;
+use Test::More tests => 60;
 
 program_help_ok('pg_basebackup');
 program_version_ok('pg_basebackup');
@@ -67,6 +69,50 @@ $node->command_ok([ 'pg_basebackup', '-D', "$tempdir/tarbackup", '-Ft' ],
 	'tar format');
 ok(-f "$tempdir/tarbackup/base.tar", 'backup tar was created');
 
+# Sorted list of files and directories of a backup.  In tar format, every
+# stream of a parallel backup writes its own archive.
+sub backup_files
+{
+	my ($dir, $format) = @_;
+	my %files;
+
+	if ($format eq 'tar')
+	{
+		foreach my $tar (glob("$dir/*.tar"))
+		{
+			$files{$_} = 1 foreach (Archive::Tar->list_archive($tar));
+		}
+	}
+	else
+	{
+		find(
+			{   wanted => sub {
+					my $name = $File::Find::name;
+					$files{$name} = 1 if $name =~ s!^\Q$dir\E/!!;
+				},
+				no_chdir => 1 },
+			$dir);
+	}
+	return [ sort map { my $name = $_; $name =~ s!/$!!; $name } keys %files ];
+}
+
+foreach my $options ([ '-j', '3' ], [ '--server-compress', '6' ])
+{
+	foreach my $format ('plain', 'tar')
+	{
+		my $serial = $format eq 'tar' ? "$tempdir/tarbackup" : "$tempdir/backup";
+		my $backup = "$tempdir/backup_${format}$options->[0]";
+
+		$node->command_ok(
+			[ 'pg_basebackup', '-D', $backup, "-F$format", @$options ],
+			"pg_basebackup @$options runs in $format format");
+		is_deeply(
+			backup_files($backup, $format),
+			backup_files($serial, $format),
+			"backup with @$options in $format format has the same files as serial one");
+	}
+}
+
 $node->command_fails(
 	[ 'pg_basebackup', '-D', "$tempdir/backup_foo", '-Fp', "-T=/foo" ],
 	'-T with empty old directory fails');
@@ -136,6 +136,7 @@ typedef struct _dumpOptions
 	int			dumpSections;	/* bitmask of chosen sections */
 	bool		aclsSkip;
 	const char *lockWaitTimeout;
+	int			table_chunk_size;	/* MB of table data per chunk, or 0 */
 
 	/* flags for various command-line long options */
 	int			disable_dollar_quoting;
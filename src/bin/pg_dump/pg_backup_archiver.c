@@ -1821,6 +1821,7 @@ buildTocEntryArrays(ArchiveHandle *AH)
 
 	AH->tocsByDumpId = (TocEntry **) pg_malloc0((maxDumpId + 1) * sizeof(TocEntry *));
 	AH->tableDataId = (DumpId *) pg_malloc0((maxDumpId + 1) * sizeof(DumpId));
+	AH->nextTableDataId = (DumpId *) pg_malloc0((maxDumpId + 1) * sizeof(DumpId));
 
 	for (te = AH->toc->next; te != AH->toc; te = te->next)
 	{
@@ -1849,7 +1850,21 @@ buildTocEntryArrays(ArchiveHandle *AH)
 			if (tableId <= 0 || tableId > maxDumpId)
 				exit_horribly(modulename, "bad table dumpId for TABLE DATA item\n");
 
-			AH->tableDataId[tableId] = te->dumpId;
+			/*
+			 * A table dumped in chunks has several TABLE DATA items.
+			 * tableDataId points to the first one, and nextTableDataId
+			 * chains the others in TOC order.
+			 */
+			if (AH->tableDataId[tableId] != 0)
+			{
+				DumpId		dataId = AH->tableDataId[tableId];
+
+				while (AH->nextTableDataId[dataId] != 0)
+					dataId = AH->nextTableDataId[dataId];
+				AH->nextTableDataId[dataId] = te->dumpId;
+			}
+			else
+				AH->tableDataId[tableId] = te->dumpId;
 		}
 	}
 }
@@ -4332,7 +4347,8 @@ fix_dependencies(ArchiveHandle *AH)
 
 /*
  * Change dependencies on table items to depend on table data items instead,
- * but only in POST_DATA items.
+ * but only in POST_DATA items.  If the table was dumped in chunks, the item
+ * is made to depend on all of them.
  */
 static void
 repoint_table_dependencies(ArchiveHandle *AH)
@@ -4340,6 +4356,7 @@ repoint_table_dependencies(ArchiveHandle *AH)
 	TocEntry   *te;
 	int			i;
 	DumpId		olddep;
+	DumpId		dataId;
 
 	for (te = AH->toc->next; te != AH->toc; te = te->next)
 	{
@@ -4354,6 +4371,19 @@ repoint_table_dependencies(ArchiveHandle *AH)
 				te->dependencies[i] = AH->tableDataId[olddep];
 				ahlog(AH, 2, "transferring dependency %d -> %d to %d\n",
 					  te->dumpId, olddep, AH->tableDataId[olddep]);
+
+				for (dataId = AH->nextTableDataId[AH->tableDataId[olddep]];
+					 dataId != 0;
+					 dataId = AH->nextTableDataId[dataId])
+				{
+					te->dependencies = (DumpId *)
+						pg_realloc(te->dependencies,
+								   (te->nDeps + 1) * sizeof(DumpId));
+					te->dependencies[te->nDeps++] = dataId;
+					te->depCount++;
+					ahlog(AH, 2, "transferring dependency %d -> %d to %d\n",
+						  te->dumpId, olddep, dataId);
+				}
 			}
 		}
 	}
@@ -4449,7 +4479,12 @@ reduce_dependencies(ArchiveHandle *AH, TocEntry *te, TocEntry *ready_list)
 static void
 mark_create_done(ArchiveHandle *AH, TocEntry *te)
 {
-	if (AH->tableDataId[te->dumpId] != 0)
+	/*
+	 * Not if the table was dumped in chunks, since the TRUNCATE preceding a
+	 * chunk would remove the rows other workers have loaded.
+	 */
+	if (AH->tableDataId[te->dumpId] != 0 &&
+		AH->nextTableDataId[AH->tableDataId[te->dumpId]] == 0)
 	{
 		TocEntry   *ted = AH->tocsByDumpId[AH->tableDataId[te->dumpId]];
 
@@ -4458,18 +4493,22 @@ mark_create_done(ArchiveHandle *AH, TocEntry *te)
 }
 
 /*
- * Mark the DATA member corresponding to the given TABLE member
+ * Mark the DATA members corresponding to the given TABLE member
  * as not wanted
  */
 static void
 inhibit_data_for_failed_table(ArchiveHandle *AH, TocEntry *te)
 {
+	DumpId		dataId;
+
 	ahlog(AH, 1, "table \"%s\" could not be created, will not restore its data\n",
 		  te->tag);
 
-	if (AH->tableDataId[te->dumpId] != 0)
+	for (dataId = AH->tableDataId[te->dumpId];
+		 dataId != 0;
+		 dataId = AH->nextTableDataId[dataId])
 	{
-		TocEntry   *ted = AH->tocsByDumpId[AH->tableDataId[te->dumpId]];
+		TocEntry   *ted = AH->tocsByDumpId[dataId];
 
 		ted->reqs = 0;
 	}
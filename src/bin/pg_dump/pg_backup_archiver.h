@@ -309,6 +309,8 @@ struct _archiveHandle
 	/* arrays created after the TOC list is complete: */
 	struct _tocEntry **tocsByDumpId;	/* TOCs indexed by dumpId */
 	DumpId	   *tableDataId;	/* TABLE DATA ids, indexed by table dumpId */
+	DumpId	   *nextTableDataId;	/* next TABLE DATA id of a table dumped
+									 * in chunks, indexed by TABLE DATA dumpId */
 
 	struct _tocEntry *currToc;	/* Used when dumping data */
 	int			compression;	/* Compression requested on open Possible
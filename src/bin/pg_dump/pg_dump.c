@@ -33,6 +33,7 @@
 
 #include <unistd.h>
 #include <ctype.h>
+#include <limits.h>
 #ifdef ENABLE_NLS
 #include <locale.h>
 #endif
@@ -224,6 +225,7 @@ static void addBoundaryDependencies(DumpableObject **dobjs, int numObjs,
 static void getDomainConstraints(Archive *fout, TypeInfo *tyinfo);
 static void getTableData(DumpOptions *dopt, TableInfo *tblinfo, int numTables, bool oids);
 static void makeTableDataInfo(DumpOptions *dopt, TableInfo *tbinfo, bool oids);
+static void makeTableDataChunks(DumpOptions *dopt, TableInfo *tbinfo);
 static void buildMatViewRefreshDependencies(Archive *fout);
 static void getTableDataFKConstraints(void);
 static char *format_function_arguments(FuncInfo *finfo, char *funcargs,
@@ -348,6 +350,7 @@ main(int argc, char **argv)
 		{"serializable-deferrable", no_argument, &dopt.serializable_deferrable, 1},
 		{"snapshot", required_argument, NULL, 6},
 		{"strict-names", no_argument, &strict_names, 1},
+		{"table-chunk-size", required_argument, NULL, 7},
 		{"use-set-session-authorization", no_argument, &dopt.use_setsessauth, 1},
 		{"no-security-labels", no_argument, &dopt.no_security_labels, 1},
 		{"no-synchronized-snapshots", no_argument, &dopt.no_synchronized_snapshots, 1},
@@ -532,6 +535,24 @@ main(int argc, char **argv)
 				dumpsnapshot = pg_strdup(optarg);
 				break;
 
+			case 7:				/* table chunk size */
+				{
+					char	   *endptr;
+					long		val;
+
+					errno = 0;
+					val = strtol(optarg, &endptr, 10);
+					if (endptr == optarg || *endptr != '\0' || errno != 0 ||
+						val <= 0 || val > INT_MAX / (1024 * 1024 / BLCKSZ))
+					{
+						write_msg(NULL, "table chunk size must be in range 1..%d\n",
+								  INT_MAX / (1024 * 1024 / BLCKSZ));
+						exit_nicely(1);
+					}
+					dopt.table_chunk_size = (int) val;
+				}
+				break;
+
 			default:
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit_nicely(1);
@@ -686,6 +707,11 @@ main(int argc, char **argv)
 		exit_horribly(NULL,
 		   "Exported snapshots are not supported by this server version.\n");
 
+	/* chunks are dumped with COPY (SELECT ...) */
+	if (dopt.table_chunk_size > 0 && fout->remoteVersion < 80200)
+		exit_horribly(NULL,
+		  "option --table-chunk-size is not supported by this server version\n");
+
 	/*
 	 * Find the last built-in OID, if needed (prior to 8.1)
 	 *
@@ -944,6 +970,7 @@ help(const char *progname)
 	printf(_("  --snapshot=SNAPSHOT          use given snapshot for the dump\n"));
 	printf(_("  --strict-names               require table and/or schema include patterns to\n"
 		 "                               match at least one entity each\n"));
+	printf(_("  --table-chunk-size=MB        dump data of bigger tables in chunks of MB\n"));
 	printf(_("  --use-set-session-authorization\n"
 			 "                               use SET SESSION AUTHORIZATION commands instead of\n"
 			 "                               ALTER OWNER commands to set ownership\n"));
@@ -1710,7 +1737,9 @@ dumpTableData_copy(Archive *fout, void *dcontext)
 		}
 		else
 			appendPQExpBufferStr(q, "* ");
-		appendPQExpBuffer(q, "FROM %s %s) TO stdout;",
+		/* ctid ranges of a chunk don't apply to child tables */
+		appendPQExpBuffer(q, "FROM %s%s %s) TO stdout;",
+						  tbinfo->dataObj->nextChunk ? "ONLY " : "",
 						  fmtQualifiedId(fout->remoteVersion,
 										 tbinfo->dobj.namespace->dobj.name,
 										 classname),
@@ -2116,7 +2145,11 @@ getTableData(DumpOptions *dopt, TableInfo *tblinfo, int numTables, bool oids)
 	for (i = 0; i < numTables; i++)
 	{
 		if (tblinfo[i].dobj.dump & DUMP_COMPONENT_DATA)
+		{
 			makeTableDataInfo(dopt, &(tblinfo[i]), oids);
+			if (dopt->table_chunk_size > 0)
+				makeTableDataChunks(dopt, &(tblinfo[i]));
+		}
 	}
 }
 
@@ -2175,11 +2208,80 @@ makeTableDataInfo(DumpOptions *dopt, TableInfo *tbinfo, bool oids)
 	tdinfo->tdtable = tbinfo;
 	tdinfo->oids = oids;
 	tdinfo->filtercond = NULL;	/* might get set later */
+	tdinfo->relpages = tbinfo->relpages;
+	tdinfo->nextChunk = NULL;
 	addObjectDependency(&tdinfo->dobj, tbinfo->dobj.dumpId);
 
 	tbinfo->dataObj = tdinfo;
 }
 
+/*
+ * Split the data of a big table into chunks of consecutive heap blocks
+ *
+ * Each chunk is a TABLE DATA object of its own, which dumps the rows whose
+ * ctid falls in its range of blocks.  That lets parallel workers dump the
+ * chunks of one table under the same snapshot, and parallel restore load
+ * them concurrently.  The ranges come from relpages, which is only an
+ * estimate, so the first chunk has no lower bound and the last one no upper
+ * bound: every row is still dumped exactly once.
+ *
+ * tbinfo->dataObj stays the first chunk, the others are linked from it.
+ */
+static void
+makeTableDataChunks(DumpOptions *dopt, TableInfo *tbinfo)
+{
+	TableDataInfo *tdinfo = tbinfo->dataObj;
+	int			chunkpages = dopt->table_chunk_size * (1024 * 1024 / BLCKSZ);
+	int			startpage;
+
+	/* Only rows of plain tables can be picked by ctid */
+	if (tdinfo == NULL || tdinfo->dobj.objType != DO_TABLE_DATA ||
+		tbinfo->relkind != RELKIND_RELATION)
+		return;
+	/* COPY WITH OIDS can't have a WHERE condition */
+	if (tdinfo->oids && tbinfo->hasoids)
+		return;
+	if (tdinfo->filtercond != NULL || tbinfo->relpages <= chunkpages)
+		return;
+
+	tdinfo->filtercond = psprintf("WHERE ctid < '(%d,0)'", chunkpages);
+	tdinfo->relpages = chunkpages;
+
+	for (startpage = chunkpages; startpage < tbinfo->relpages;
+		 startpage += chunkpages)
+	{
+		TableDataInfo *chunk;
+
+		chunk = (TableDataInfo *) pg_malloc(sizeof(TableDataInfo));
+		chunk->dobj.objType = DO_TABLE_DATA;
+		chunk->dobj.catId = tdinfo->dobj.catId;
+		AssignDumpId(&chunk->dobj);
+		chunk->dobj.name = tbinfo->dobj.name;
+		chunk->dobj.namespace = tbinfo->dobj.namespace;
+		chunk->tdtable = tbinfo;
+		chunk->oids = tdinfo->oids;
+		chunk->nextChunk = NULL;
+		addObjectDependency(&chunk->dobj, tbinfo->dobj.dumpId);
+
+		if (startpage + chunkpages < tbinfo->relpages)
+		{
+			chunk->filtercond =
+				psprintf("WHERE ctid >= '(%d,0)' AND ctid < '(%d,0)'",
+						 startpage, startpage + chunkpages);
+			chunk->relpages = chunkpages;
+		}
+		else
+		{
+			chunk->filtercond = psprintf("WHERE ctid >= '(%d,0)'",
+										 startpage);
+			chunk->relpages = tbinfo->relpages - startpage;
+		}
+
+		tdinfo->nextChunk = chunk;
+		tdinfo = chunk;
+	}
+}
+
 /*
  * The refresh for a materialized view must be dependent on the refresh for
  * any materialized view that this one is dependent on.
@@ -2318,6 +2420,8 @@ getTableDataFKConstraints(void)
 		{
 			ConstraintInfo *cinfo = (ConstraintInfo *) dobjs[i];
 			TableInfo  *ftable;
+			TableDataInfo *ctdinfo;
+			TableDataInfo *ftdinfo;
 
 			/* Not interesting unless both tables are to be dumped */
 			if (cinfo->contable == NULL ||
@@ -2329,11 +2433,18 @@ getTableDataFKConstraints(void)
 				continue;
 
 			/*
-			 * Okay, make referencing table's TABLE_DATA object depend on the
-			 * referenced table's TABLE_DATA object.
+			 * Okay, make referencing table's TABLE_DATA objects depend on the
+			 * referenced table's TABLE_DATA objects.  There are several of
+			 * them if a table is dumped in chunks.
 			 */
-			addObjectDependency(&cinfo->contable->dataObj->dobj,
-								ftable->dataObj->dobj.dumpId);
+			for (ctdinfo = cinfo->contable->dataObj; ctdinfo != NULL;
+				 ctdinfo = ctdinfo->nextChunk)
+			{
+				for (ftdinfo = ftable->dataObj; ftdinfo != NULL;
+					 ftdinfo = ftdinfo->nextChunk)
+					addObjectDependency(&ctdinfo->dobj,
+										ftdinfo->dobj.dumpId);
+			}
 		}
 	}
 	free(dobjs);
@@ -336,6 +336,9 @@ typedef struct _tableDataInfo
 	TableInfo  *tdtable;		/* link to table to dump */
 	bool		oids;			/* include OIDs in data? */
 	char	   *filtercond;		/* WHERE condition to limit rows dumped */
+	int			relpages;		/* estimated size of the data, in pages */
+	struct _tableDataInfo *nextChunk;	/* next block range of the table, if
+										 * its data is dumped in chunks */
 } TableDataInfo;
 
 typedef struct _indxInfo
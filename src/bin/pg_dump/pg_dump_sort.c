@@ -226,12 +226,12 @@ DOSizeCompare(const void *p1, const void *p2)
 	int			obj2_size = 0;
 
 	if (obj1->objType == DO_TABLE_DATA)
-		obj1_size = ((TableDataInfo *) obj1)->tdtable->relpages;
+		obj1_size = ((TableDataInfo *) obj1)->relpages;
 	if (obj1->objType == DO_INDEX)
 		obj1_size = ((IndxInfo *) obj1)->relpages;
 
 	if (obj2->objType == DO_TABLE_DATA)
-		obj2_size = ((TableDataInfo *) obj2)->tdtable->relpages;
+		obj2_size = ((TableDataInfo *) obj2)->relpages;
 	if (obj2->objType == DO_INDEX)
 		obj2_size = ((IndxInfo *) obj2)->relpages;
 
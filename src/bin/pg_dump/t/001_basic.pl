@@ -4,7 +4,7 @@ use warnings;
 use Config;
 use PostgresNode;
 use TestLib;
-use Test::More tests => 15;
+use Test::More tests => 17;
 
 my $tempdir       = TestLib::tempdir;
 my $tempdir_short = TestLib::tempdir_short;
@@ -48,3 +48,9 @@ command_exit_is([ 'pg_dump', '-j' ],
 
 command_exit_is([ 'pg_dump', '-j3' ],
 	1, 'pg_dump: parallel backup only supported by the directory format');
+
+command_exit_is([ 'pg_dump', '--table-chunk-size=0' ],
+	1, 'pg_dump: table chunk size must be in range');
+
+command_exit_is([ 'pg_dump', '--table-chunk-size=12abc' ],
+	1, 'pg_dump: table chunk size must be in range');
@@ -0,0 +1,56 @@
+use strict;
+use warnings;
+
+use PostgresNode;
+use TestLib;
+use Test::More tests => 9;
+
+my $tempdir = TestLib::tempdir;
+
+my $node = get_new_node('main');
+$node->init;
+$node->start;
+
+# big is about 500 pages, so with 1MB chunks (128 pages) its data is split
+# into several TABLE DATA items.  small stays in one.  big_child inherits from
+# big, and must not be dumped again by the chunks of its parent.
+$node->safe_psql(
+	'postgres', q{
+	CREATE TABLE big (id int PRIMARY KEY, payload text);
+	INSERT INTO big SELECT i, repeat(md5(i::text), 16)
+	  FROM generate_series(1, 7500) i;
+	DELETE FROM big WHERE id % 7 = 0;
+	CREATE TABLE big_child () INHERITS (big);
+	INSERT INTO big_child SELECT i, 'child' FROM generate_series(10001, 10010) i;
+	CREATE TABLE small (id int PRIMARY KEY);
+	INSERT INTO small SELECT generate_series(1, 100);
+	VACUUM ANALYZE;
+});
+
+$node->command_ok(
+	[   'pg_dump', '-Fd', '-j3', '--table-chunk-size=1',
+		'-f', "$tempdir/chunked", 'postgres' ],
+	'parallel dump with table chunks');
+
+$node->command_like(
+	[ 'pg_restore', '-l', "$tempdir/chunked" ],
+	qr/(?:TABLE DATA public big \S+\n.*){4}/s,
+	'big table is dumped in chunks');
+
+$node->command_ok([ 'createdb', 'restored' ], 'create target database');
+
+$node->command_ok(
+	[ 'pg_restore', '-j3', '-d', 'restored', "$tempdir/chunked" ],
+	'parallel restore of table chunks');
+
+foreach my $table ('ONLY big', 'big_child', 'small')
+{
+	my $query =
+	    "SELECT count(*), sum(id), md5(string_agg(payload, ',' ORDER BY id)) "
+	  . "FROM $table";
+	$query =~ s/payload/id::text/ if $table eq 'small';
+
+	is($node->safe_psql('restored', $query),
+		$node->safe_psql('postgres', $query),
+		"table $table is restored completely");
+}
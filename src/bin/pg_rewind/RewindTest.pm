@@ -223,6 +223,18 @@ sub run_pg_rewind
 				"--target-pgdata=$master_pgdata" ],
 			'pg_rewind remote');
 	}
+	elsif ($test_mode eq "compare")
+	{
+
+		# Do rewind using a remote connection as source, finding changed
+		# blocks by comparing them instead of reading the WAL
+		command_ok(
+			[   'pg_rewind',       "--debug",
+				"--compare-blocks",
+				"--source-server", $standby_connstr,
+				"--target-pgdata=$master_pgdata" ],
+			'pg_rewind compare');
+	}
 	else
 	{
 
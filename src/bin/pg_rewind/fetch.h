@@ -36,6 +36,8 @@ extern void libpq_executeFileMap(filemap_t *map);
 
 extern void libpqConnect(const char *connstr);
 extern XLogRecPtr libpqGetCurrentXlogInsertLocation(void);
+extern void libpqRequestCheckpoint(void);
+extern void libpqCompareBlocks(filemap_t *map);
 
 /* in copy_fetch.c */
 extern void copy_executeFileMap(filemap_t *map);
@@ -26,6 +26,7 @@
 filemap_t  *filemap = NULL;
 
 static bool isRelDataFile(const char *path);
+static bool isKeptTargetFile(const char *path);
 static char *datasegpath(RelFileNode rnode, ForkNumber forknum,
 			BlockNumber segno);
 static int	path_cmp(const void *a, const void *b);
@@ -78,6 +79,15 @@ process_source_file(const char *path, file_type_t type, size_t newsize,
 		strcmp(path, "postmaster.opts") == 0)
 		return;
 
+	/*
+	 * When comparing blocks, the source is a different node: don't take its
+	 * configuration and replication slots, like pg_basebackup does. The
+	 * target's slots are removed, as they are not in the file map.
+	 */
+	if (compare_blocks &&
+		(isKeptTargetFile(path) || strncmp(path, "pg_replslot/", 12) == 0))
+		return;
+
 	/*
 	 * Pretend that pg_xlog is a directory, even if it's really a symlink. We
 	 * don't want to mess with the symlink itself, nor complain if it's a
@@ -293,6 +303,9 @@ process_target_file(const char *path, file_type_t type, size_t oldsize,
 		strcmp(path, "postmaster.opts") == 0)
 		return;
 
+	if (compare_blocks && isKeptTargetFile(path))
+		return;
+
 	/*
 	 * Like in process_source_file, pretend that xlog is always a  directory.
 	 */
@@ -633,6 +646,20 @@ isRelDataFile(const char *path)
 	return matched;
 }
 
+/*
+ * Is it a configuration file, which is preserved in the target when
+ * comparing blocks?
+ */
+static bool
+isKeptTargetFile(const char *path)
+{
+	return strcmp(path, "postgresql.conf") == 0 ||
+		strcmp(path, "postgresql.auto.conf") == 0 ||
+		strcmp(path, "pg_hba.conf") == 0 ||
+		strcmp(path, "pg_ident.conf") == 0 ||
+		strcmp(path, "recovery.conf") == 0;
+}
+
 /*
  * A helper function to create the path of a relation file and segment.
  *
@@ -27,6 +27,7 @@
 #include "logging.h"
 
 #include "libpq-fe.h"
+#include "libpq/md5.h"
 #include "catalog/catalog.h"
 #include "catalog/pg_type.h"
 
@@ -143,6 +144,126 @@ libpqGetCurrentXlogInsertLocation(void)
 	return result;
 }
 
+/*
+ * Performs a checkpoint in the source server.
+ */
+void
+libpqRequestCheckpoint(void)
+{
+	PGresult   *res;
+
+	pg_log(PG_PROGRESS, "requesting checkpoint in source server\n");
+
+	res = PQexec(conn, "CHECKPOINT");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("could not perform checkpoint in source server: %s",
+				 PQresultErrorMessage(res));
+	PQclear(res);
+}
+
+/*
+ * Compare blocks of a relation file, which exists in both source and target,
+ * and mark the blocks which differ in the file's page map.
+ *
+ * Hashes of the source blocks are computed by the server, so only 32 bytes
+ * per block are transferred. Blocks beyond the common length are handled by
+ * the file's action (COPY_TAIL or TRUNCATE).
+ */
+static void
+compare_file_blocks(file_entry_t *entry)
+{
+	PGresult   *res;
+	const char *paramValues[2];
+	char		nblocksstr[32];
+	char		localpath[MAXPGPATH];
+	char		buf[BLCKSZ];
+	char		hash[33];
+	BlockNumber nblocks;
+	BlockNumber blkno;
+	int			fd;
+
+	nblocks = Min(entry->oldsize, entry->newsize) / BLCKSZ;
+	if (nblocks == 0)
+		return;
+
+	snprintf(nblocksstr, sizeof(nblocksstr), "%u", nblocks);
+	paramValues[0] = entry->path;
+	paramValues[1] = nblocksstr;
+	res = PQexecParams(conn,
+					   "SELECT md5(pg_read_binary_file($1, blkno * " CppAsString2(BLCKSZ) ", " CppAsString2(BLCKSZ) ", true))\n"
+					   "FROM generate_series(0, $2::int8 - 1) AS blkno ORDER BY blkno",
+					   2, NULL, paramValues, NULL, NULL, 0);
+
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		pg_fatal("could not fetch block hashes of remote file \"%s\": %s",
+				 entry->path, PQresultErrorMessage(res));
+
+	if (PQntuples(res) != nblocks)
+		pg_fatal("unexpected result set while fetching block hashes of remote file \"%s\"\n",
+				 entry->path);
+
+	snprintf(localpath, sizeof(localpath), "%s/%s", datadir_target, entry->path);
+	fd = open(localpath, O_RDONLY | PG_BINARY, 0);
+	if (fd < 0)
+		pg_fatal("could not open file \"%s\" for reading: %s\n",
+				 localpath, strerror(errno));
+
+	for (blkno = 0; blkno < nblocks; blkno++)
+	{
+		/*
+		 * NULL means that the file was removed in the source after we
+		 * created the file map; it will be ignored when fetching blocks.
+		 */
+		if (PQgetisnull(res, blkno, 0))
+			break;
+
+		if (read(fd, buf, BLCKSZ) != BLCKSZ)
+			pg_fatal("could not read file \"%s\": %s\n",
+					 localpath, strerror(errno));
+
+		if (!pg_md5_hash(buf, BLCKSZ, hash))
+			pg_fatal("out of memory\n");
+
+		if (strcmp(hash, PQgetvalue(res, blkno, 0)) != 0)
+			datapagemap_add(&entry->pagemap, blkno);
+	}
+	close(fd);
+	PQclear(res);
+}
+
+/*
+ * Find changed blocks of all relation files by comparing them with the
+ * source. This is used instead of reading the target WAL when the target
+ * did not fork from the source by promotion (--compare-blocks).
+ */
+void
+libpqCompareBlocks(filemap_t *map)
+{
+	file_entry_t *entry;
+	int			i;
+
+	for (i = 0; i < map->narray; i++)
+	{
+		entry = map->array[i];
+
+		if (!entry->isrelfile)
+			continue;
+
+		switch (entry->action)
+		{
+			case FILE_ACTION_NONE:
+			case FILE_ACTION_TRUNCATE:
+			case FILE_ACTION_COPY_TAIL:
+				compare_file_blocks(entry);
+				break;
+
+			default:
+				/* file is copied in toto or removed */
+				break;
+		}
+	}
+}
+
 /*
  * Get a list of all files in the data directory.
  */
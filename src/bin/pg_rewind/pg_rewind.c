@@ -53,6 +53,7 @@ char	   *connstr_source = NULL;
 bool		debug = false;
 bool		showprogress = false;
 bool		dry_run = false;
+bool		compare_blocks = false;
 
 /* Target history */
 TimeLineHistoryEntry *targetHistory;
@@ -67,6 +68,8 @@ usage(const char *progname)
 	printf(_("  -D, --target-pgdata=DIRECTORY  existing data directory to modify\n"));
 	printf(_("      --source-pgdata=DIRECTORY  source data directory to synchronize with\n"));
 	printf(_("      --source-server=CONNSTR    source server to synchronize with\n"));
+	printf(_("  -B, --compare-blocks           find changed blocks by comparing them with source\n"
+			 "                                 server instead of reading target WAL\n"));
 	printf(_("  -n, --dry-run                  stop before modifying anything\n"));
 	printf(_("  -P, --progress                 write progress messages\n"));
 	printf(_("      --debug                    write a lot of debug messages\n"));
@@ -88,6 +91,7 @@ main(int argc, char **argv)
 		{"dry-run", no_argument, NULL, 'n'},
 		{"progress", no_argument, NULL, 'P'},
 		{"debug", no_argument, NULL, 3},
+		{"compare-blocks", no_argument, NULL, 'B'},
 		{NULL, 0, NULL, 0}
 	};
 	int			option_index;
@@ -122,7 +126,7 @@ main(int argc, char **argv)
 		}
 	}
 
-	while ((c = getopt_long(argc, argv, "D:nP", long_options, &option_index)) != -1)
+	while ((c = getopt_long(argc, argv, "BD:nP", long_options, &option_index)) != -1)
 	{
 		switch (c)
 		{
@@ -138,6 +142,10 @@ main(int argc, char **argv)
 				dry_run = true;
 				break;
 
+			case 'B':
+				compare_blocks = true;
+				break;
+
 			case 3:
 				debug = true;
 				break;
@@ -169,6 +177,13 @@ main(int argc, char **argv)
 		exit(1);
 	}
 
+	if (compare_blocks && connstr_source == NULL)
+	{
+		fprintf(stderr, _("%s: --compare-blocks can only be used with --source-server\n"), progname);
+		fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
+		exit(1);
+	}
+
 	if (datadir_target == NULL)
 	{
 		fprintf(stderr, _("%s: no target data directory specified (--target-pgdata)\n"), progname);
@@ -205,6 +220,14 @@ main(int argc, char **argv)
 	if (connstr_source)
 		libpqConnect(connstr_source);
 
+	/*
+	 * When comparing blocks, WAL replay starts from the latest checkpoint of
+	 * the source. Request a fresh one, so that there is less WAL to replay
+	 * and to make sure that its redo point precedes the comparison.
+	 */
+	if (compare_blocks)
+		libpqRequestCheckpoint();
+
 	/*
 	 * Ok, we have all the options and we're ready to start. Read in all the
 	 * information we need from both clusters.
@@ -222,8 +245,24 @@ main(int argc, char **argv)
 	/*
 	 * If both clusters are already on the same timeline, there's nothing to
 	 * do.
+	 *
+	 * Unless blocks are compared: then the target is not required to share
+	 * WAL history with the source, e.g. it can be a node of logical
+	 * replication cluster which was cloned from the source long ago. Blocks
+	 * which differ are found by comparing their hashes, and the source's WAL
+	 * is replayed from its latest checkpoint, like after taking a base
+	 * backup.
 	 */
-	if (ControlFile_target.checkPointCopy.ThisTimeLineID == ControlFile_source.checkPointCopy.ThisTimeLineID)
+	if (compare_blocks)
+	{
+		chkptrec = ControlFile_source.checkPoint;
+		chkpttli = ControlFile_source.checkPointCopy.ThisTimeLineID;
+		chkptredo = ControlFile_source.checkPointCopy.redo;
+		divergerec = InvalidXLogRecPtr;
+		lastcommontliIndex = 0;
+		rewind_needed = true;
+	}
+	else if (ControlFile_target.checkPointCopy.ThisTimeLineID == ControlFile_source.checkPointCopy.ThisTimeLineID)
 	{
 		printf(_("source and target cluster are on the same timeline\n"));
 		rewind_needed = false;
@@ -272,12 +311,19 @@ main(int argc, char **argv)
 		exit(0);
 	}
 
-	findLastCheckpoint(datadir_target, divergerec,
-					   lastcommontliIndex,
-					   &chkptrec, &chkpttli, &chkptredo);
-	printf(_("rewinding from last common checkpoint at %X/%X on timeline %u\n"),
-		   (uint32) (chkptrec >> 32), (uint32) chkptrec,
-		   chkpttli);
+	if (compare_blocks)
+		printf(_("synchronizing with source checkpoint at %X/%X on timeline %u\n"),
+			   (uint32) (chkptrec >> 32), (uint32) chkptrec,
+			   chkpttli);
+	else
+	{
+		findLastCheckpoint(datadir_target, divergerec,
+						   lastcommontliIndex,
+						   &chkptrec, &chkpttli, &chkptredo);
+		printf(_("rewinding from last common checkpoint at %X/%X on timeline %u\n"),
+			   (uint32) (chkptrec >> 32), (uint32) chkptrec,
+			   chkpttli);
+	}
 
 	/*
 	 * Build the filemap, by comparing the source and target data directories.
@@ -295,10 +341,19 @@ main(int argc, char **argv)
 	 * XXX: If we supported rewinding a server that was not shut down cleanly,
 	 * we would need to replay until the end of WAL here.
 	 */
-	pg_log(PG_PROGRESS, "reading WAL in target\n");
-	extractPageMap(datadir_target, chkptrec, lastcommontliIndex,
-				   ControlFile_target.checkPoint);
-	filemap_finalize();
+	if (compare_blocks)
+	{
+		filemap_finalize();
+		pg_log(PG_PROGRESS, "comparing blocks of relation files\n");
+		libpqCompareBlocks(filemap);
+	}
+	else
+	{
+		pg_log(PG_PROGRESS, "reading WAL in target\n");
+		extractPageMap(datadir_target, chkptrec, lastcommontliIndex,
+					   ControlFile_target.checkPoint);
+		filemap_finalize();
+	}
 
 	if (showprogress)
 		calculate_totals();
@@ -386,8 +441,10 @@ sanityChecks(void)
 	/*
 	 * Target cluster need to use checksums or hint bit wal-logging, this to
 	 * prevent from data corruption that could occur because of hint bits.
+	 * Not needed when blocks are compared by content.
 	 */
-	if (ControlFile_target.data_checksum_version != PG_DATA_CHECKSUM_VERSION &&
+	if (!compare_blocks &&
+		ControlFile_target.data_checksum_version != PG_DATA_CHECKSUM_VERSION &&
 		!ControlFile_target.wal_log_hints)
 	{
 		pg_fatal("target server needs to use either data checksums or \"wal_log_hints = on\"\n");
@@ -26,6 +26,7 @@ extern char *connstr_source;
 extern bool debug;
 extern bool showprogress;
 extern bool dry_run;
+extern bool compare_blocks;
 
 /* Target history */
 extern TimeLineHistoryEntry *targetHistory;
@@ -58,6 +58,7 @@
 #include "pgbench.h"
 
 #define ERRCODE_UNDEFINED_TABLE  "42P01"
+#define ERRCLASS_TRANSACTION_ROLLBACK  "40"
 
 /*
  * Multi-platform pthread implementations
@@ -182,6 +183,16 @@ char	   *login = NULL;
 char	   *dbName;
 const char *progname;
 
+int			max_tries = 1;		/* attempts per transaction on retryable errors */
+
+typedef enum HostSelection
+{
+	HOST_ROUND_ROBIN,			/* client i connects to host i % npghosts */
+	HOST_HASH					/* host is chosen by a hash of the client id */
+} HostSelection;
+
+HostSelection host_selection = HOST_ROUND_ROBIN;
+
 #define WSEP '@'				/* weight separator */
 
 volatile bool timer_exceeded = false;	/* flag from signal handler */
@@ -230,10 +241,28 @@ typedef struct StatsData
 	int64		cnt;			/* number of transactions */
 	int64		skipped;		/* number of transactions skipped under --rate
 								 * and --latency-limit */
+	int64		retries;		/* number of retried transaction attempts */
+	int64		failures;		/* number of transactions given up after
+								 * --max-tries attempts */
 	SimpleStats latency;
 	SimpleStats lag;
 } StatsData;
 
+/*
+ * Hosts to run the benchmark against.  -h and -p accept comma-separated
+ * lists, and clients are spread over the hosts according to host_selection.
+ * The per-host stats are only collected when there is more than one host.
+ */
+typedef struct PgBenchHost
+{
+	char	   *host;
+	char	   *port;
+	StatsData	stats;			/* totals for clients connected to this host */
+} PgBenchHost;
+
+static PgBenchHost *pghosts = NULL;
+static int	npghosts = 0;
+
 /*
  * Connection state
  */
@@ -255,6 +284,8 @@ typedef struct
 	instr_time	stmt_begin;		/* used for measuring statement latencies */
 	int			use_file;		/* index in sql_scripts for this client */
 	bool		prepared[MAX_SCRIPTS];	/* whether client prepared the script */
+	int			host;			/* index in pghosts for this client */
+	int			tries;			/* failed attempts of current transaction */
 
 	/* per client collected stats */
 	int64		cnt;			/* transaction count */
@@ -278,6 +309,7 @@ typedef struct
 	instr_time	start_time;		/* thread start time */
 	instr_time	conn_time;
 	StatsData	stats;
+	StatsData  *host_stats;		/* per-host stats, if npghosts > 1 */
 	int64		latency_late;	/* executed but late transactions */
 } TState;
 
@@ -439,12 +471,17 @@ usage(void)
 		 "  -T, --time=NUM           duration of benchmark test in seconds\n"
 		   "  -v, --vacuum-all         vacuum all four standard tables before tests\n"
 		   "  --aggregate-interval=NUM aggregate data over NUM seconds\n"
+		   "  --host-selection=round-robin|hash\n"
+		   "                           how to spread clients over hosts (default: round-robin)\n"
+		   "  --max-tries=NUM          attempts per transaction on serialization failures,\n"
+		   "                           deadlocks and cluster aborts (default: 1)\n"
 		"  --progress-timestamp     use Unix epoch timestamps for progress\n"
 		   "  --sampling-rate=NUM      fraction of transactions to log (e.g., 0.01 for 1%%)\n"
 		   "\nCommon options:\n"
 		   "  -d, --debug              print debugging output\n"
-	  "  -h, --host=HOSTNAME      database server host or socket directory\n"
-		   "  -p, --port=PORT          database server port number\n"
+	  "  -h, --host=HOSTNAME      database server host or socket directory;\n"
+		   "                           a comma-separated list spreads clients over hosts\n"
+		   "  -p, --port=PORT          database server port number, or a list matching -h\n"
 		   "  -U, --username=USERNAME  connect as specified database user\n"
 		 "  -V, --version            output version information, then exit\n"
 		   "  -?, --help               show this help, then exit\n"
@@ -712,6 +749,8 @@ initStats(StatsData *sd, double start_time)
 	sd->start_time = start_time;
 	sd->cnt = 0;
 	sd->skipped = 0;
+	sd->retries = 0;
+	sd->failures = 0;
 	initSimpleStats(&sd->latency);
 	initSimpleStats(&sd->lag);
 }
@@ -769,9 +808,79 @@ tryExecuteStatement(PGconn *con, const char *sql)
 	PQclear(res);
 }
 
-/* set up a connection to the backend */
+/*
+ * Split the possibly comma-separated -h and -p values into pghosts.  A single
+ * port applies to every host; otherwise there must be one port per host.
+ */
+static void
+parseHosts(void)
+{
+	char	   *host = pg_strdup(pghost);
+	char	   *port = pg_strdup(pgport);
+	int			nports = 1;
+	char	   *p;
+	int			i;
+
+	npghosts = 1;
+	for (p = host; *p; p++)
+		if (*p == ',')
+			npghosts++;
+	for (p = port; *p; p++)
+		if (*p == ',')
+			nports++;
+
+	if (nports != 1 && nports != npghosts)
+	{
+		fprintf(stderr, "number of ports (%d) must be one or match the number of hosts (%d)\n",
+				nports, npghosts);
+		exit(1);
+	}
+
+	pghosts = (PgBenchHost *) pg_malloc(sizeof(PgBenchHost) * npghosts);
+	for (i = 0; i < npghosts; i++)
+	{
+		char	   *next = strchr(host, ',');
+
+		if (next != NULL)
+			*next++ = '\0';
+		pghosts[i].host = host;
+		host = next;
+
+		pghosts[i].port = port;
+		if (nports > 1)
+		{
+			next = strchr(port, ',');
+			if (next != NULL)
+				*next++ = '\0';
+			port = next;
+		}
+
+		initStats(&pghosts[i].stats, 0.0);
+	}
+}
+
+/* return the index in pghosts that the given client should connect to */
+static int
+chooseHost(int client_id)
+{
+	uint32		h = (uint32) client_id;
+
+	if (host_selection == HOST_ROUND_ROBIN)
+		return client_id % npghosts;
+
+	/* murmurhash3 finalizer, so that neighbouring clients spread out */
+	h ^= h >> 16;
+	h *= 0x85ebca6b;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35;
+	h ^= h >> 16;
+
+	return h % npghosts;
+}
+
+/* set up a connection to the given entry of pghosts */
 static PGconn *
-doConnect(void)
+doConnect(int host)
 {
 	PGconn	   *conn;
 	static char *password = NULL;
@@ -789,9 +898,9 @@ doConnect(void)
 		const char *values[PARAMS_ARRAY_SIZE];
 
 		keywords[0] = "host";
-		values[0] = pghost;
+		values[0] = pghosts[host].host;
 		keywords[1] = "port";
-		values[1] = pgport;
+		values[1] = pghosts[host].port;
 		keywords[2] = "user";
 		values[2] = login;
 		keywords[3] = "password";
@@ -1761,6 +1870,83 @@ chooseScript(TState *thread)
 	return i - 1;
 }
 
+/*
+ * Is this error worth retrying the transaction for?  That's the case for
+ * everything in the transaction rollback class: serialization failures,
+ * deadlocks, and transactions aborted by the multimaster cluster.
+ */
+static bool
+isRetryableError(PGresult *res)
+{
+	char	   *sqlState = PQresultErrorField(res, PG_DIAG_SQLSTATE);
+
+	return max_tries > 1 && sqlState != NULL &&
+		strncmp(sqlState, ERRCLASS_TRANSACTION_ROLLBACK, 2) == 0;
+}
+
+/*
+ * Roll back the current transaction after a retryable error, and set up the
+ * client to run its script again from the start.  Once the transaction has
+ * failed --max-tries times, count it as failed and move on to the next one.
+ *
+ * Returns false if the client should be disconnected.
+ */
+static bool
+retryTransaction(TState *thread, CState *st)
+{
+	StatsData  *hstats = npghosts > 1 ? &thread->host_stats[st->host] : NULL;
+
+	if (PQtransactionStatus(st->con) != PQTRANS_IDLE)
+	{
+		PGresult   *res = PQexec(st->con, "ROLLBACK");
+
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		{
+			fprintf(stderr, "client %d aborted while rolling back: %s",
+					st->id, PQerrorMessage(st->con));
+			PQclear(res);
+			return false;
+		}
+		PQclear(res);
+	}
+
+	if (debug)
+		fprintf(stderr, "client %d retrying script \"%s\" after error in state %d\n",
+				st->id, sql_script[st->use_file].desc, st->state);
+
+	st->listen = false;
+	st->state = 0;
+
+	if (++st->tries < max_tries)
+	{
+		/* run the same script again, in the same throttling slot */
+		thread->stats.retries++;
+		if (hstats)
+			hstats->retries++;
+		return true;
+	}
+
+	/* give up on this transaction */
+	thread->stats.failures++;
+	if (hstats)
+		hstats->failures++;
+	st->tries = 0;
+
+	if (is_connect)
+	{
+		PQfinish(st->con);
+		st->con = NULL;
+	}
+
+	++st->cnt;
+	if ((st->cnt >= nxacts && duration <= 0) || timer_exceeded)
+		return false;
+
+	st->use_file = chooseScript(thread);
+	st->is_throttled = false;
+	return true;
+}
+
 /* return false iff client should be disconnected */
 static bool
 doCustom(TState *thread, CState *st, StatsData *agg)
@@ -1879,16 +2065,6 @@ top:
 							 INSTR_TIME_GET_DOUBLE(st->stmt_begin));
 		}
 
-		/* transaction finished: calculate latency and log the transaction */
-		if (commands[st->state + 1] == NULL)
-		{
-			if (progress || throttle_delay || latency_limit ||
-				per_script_stats || use_log)
-				processXactStats(thread, st, &now, false, agg);
-			else
-				thread->stats.cnt++;
-		}
-
 		if (commands[st->state]->type == SQL_COMMAND)
 		{
 			/*
@@ -1902,6 +2078,14 @@ top:
 				case PGRES_TUPLES_OK:
 					break;		/* OK */
 				default:
+					if (isRetryableError(res))
+					{
+						PQclear(res);
+						discard_response(st);
+						if (!retryTransaction(thread, st))
+							return clientDone(st);
+						goto top;
+					}
 					fprintf(stderr, "client %d aborted in state %d: %s",
 							st->id, st->state, PQerrorMessage(st->con));
 					PQclear(res);
@@ -1911,8 +2095,20 @@ top:
 			discard_response(st);
 		}
 
+		/* transaction finished: calculate latency and log the transaction */
 		if (commands[st->state + 1] == NULL)
 		{
+			if (progress || throttle_delay || latency_limit ||
+				per_script_stats || use_log || npghosts > 1)
+				processXactStats(thread, st, &now, false, agg);
+			else
+				thread->stats.cnt++;
+		}
+
+		if (commands[st->state + 1] == NULL)
+		{
+			st->tries = 0;
+
 			if (is_connect)
 			{
 				PQfinish(st->con);
@@ -1954,7 +2150,7 @@ top:
 					end;
 
 		INSTR_TIME_SET_CURRENT(start);
-		if ((st->con = doConnect()) == NULL)
+		if ((st->con = doConnect(st->host)) == NULL)
 		{
 			fprintf(stderr, "client %d aborted while establishing connection\n",
 					st->id);
@@ -1981,9 +2177,12 @@ top:
 		goto top;
 	}
 
-	/* Record transaction start time under logging, progress or throttling */
+	/*
+	 * Record transaction start time under logging, progress or throttling.
+	 * A retried transaction keeps the start time of its first attempt.
+	 */
 	if ((use_log || progress || throttle_delay || latency_limit ||
-		 per_script_stats) && st->state == 0)
+		 per_script_stats || npghosts > 1) && st->state == 0 && st->tries == 0)
 	{
 		INSTR_TIME_SET_CURRENT(st->txn_begin);
 
@@ -2299,6 +2498,9 @@ processXactStats(TState *thread, CState *st, instr_time *now,
 	else
 		thread->stats.cnt++;
 
+	if (npghosts > 1)
+		accumStats(&thread->host_stats[st->host], skipped, latency, lag);
+
 	if (use_log)
 		doLog(thread, st, now, agg, skipped, latency, lag);
 
@@ -2407,7 +2609,7 @@ init(bool is_no_vacuum)
 				remaining_sec;
 	int			log_interval = 1;
 
-	if ((con = doConnect()) == NULL)
+	if ((con = doConnect(0)) == NULL)
 		exit(1);
 
 	for (i = 0; i < lengthof(DDLs); i++)
@@ -3276,6 +3478,15 @@ printResults(TState *threads, StatsData *total, instr_time total_time,
 			   total->cnt);
 	}
 
+	if (max_tries > 1)
+	{
+		printf("maximum number of tries: %d\n", max_tries);
+		printf("number of retried transaction attempts: " INT64_FORMAT "\n",
+			   total->retries);
+		printf("number of failed transactions: " INT64_FORMAT "\n",
+			   total->failures);
+	}
+
 	/* Remaining stats are nonsensical if we failed to execute any xacts */
 	if (total->cnt <= 0)
 		return;
@@ -3314,6 +3525,28 @@ printResults(TState *threads, StatsData *total, instr_time total_time,
 	printf("tps = %f (including connections establishing)\n", tps_include);
 	printf("tps = %f (excluding connections establishing)\n", tps_exclude);
 
+	/* Report per-host statistics */
+	if (npghosts > 1)
+	{
+		int			i;
+
+		for (i = 0; i < npghosts; i++)
+		{
+			StatsData  *hs = &pghosts[i].stats;
+
+			printf("host \"%s\" port \"%s\":\n"
+				   " - " INT64_FORMAT " transactions (%.1f%% of total, tps = %f)\n",
+				   pghosts[i].host, pghosts[i].port,
+				   hs->cnt, 100.0 * hs->cnt / total->cnt,
+				   hs->cnt / time_include);
+			if (max_tries > 1)
+				printf(" - " INT64_FORMAT " retried attempts, " INT64_FORMAT " failed transactions\n",
+					   hs->retries, hs->failures);
+			if (hs->cnt > 0)
+				printSimpleStats(" - latency", &hs->latency);
+		}
+	}
+
 	/* Report per-script/command statistics */
 	if (per_script_stats || latency_limit || is_latencies)
 	{
@@ -3402,6 +3635,8 @@ main(int argc, char **argv)
 		{"sampling-rate", required_argument, NULL, 4},
 		{"aggregate-interval", required_argument, NULL, 5},
 		{"progress-timestamp", no_argument, NULL, 6},
+		{"host-selection", required_argument, NULL, 7},
+		{"max-tries", required_argument, NULL, 8},
 		{NULL, 0, NULL, 0}
 	};
 
@@ -3749,6 +3984,29 @@ main(int argc, char **argv)
 				progress_timestamp = true;
 				benchmarking_option_set = true;
 				break;
+			case 7:
+				benchmarking_option_set = true;
+				if (pg_strcasecmp(optarg, "round-robin") == 0)
+					host_selection = HOST_ROUND_ROBIN;
+				else if (pg_strcasecmp(optarg, "hash") == 0)
+					host_selection = HOST_HASH;
+				else
+				{
+					fprintf(stderr, "invalid host selection method: \"%s\"\n",
+							optarg);
+					exit(1);
+				}
+				break;
+			case 8:
+				benchmarking_option_set = true;
+				max_tries = atoi(optarg);
+				if (max_tries <= 0)
+				{
+					fprintf(stderr, "invalid number of tries: \"%s\"\n",
+							optarg);
+					exit(1);
+				}
+				break;
 			default:
 				fprintf(stderr, _("Try \"%s --help\" for more information.\n"), progname);
 				exit(1);
@@ -3802,6 +4060,8 @@ main(int argc, char **argv)
 			dbName = "";
 	}
 
+	parseHosts();
+
 	if (is_init_mode)
 	{
 		if (benchmarking_option_set)
@@ -3906,7 +4166,7 @@ main(int argc, char **argv)
 	}
 
 	/* opening connection... */
-	con = doConnect();
+	con = doConnect(0);
 	if (con == NULL)
 		exit(1);
 
@@ -3978,6 +4238,10 @@ main(int argc, char **argv)
 		}
 	}
 
+	/* spread the clients over the hosts */
+	for (i = 0; i < nclients; i++)
+		state[i].host = chooseHost(i);
+
 	if (!is_no_vacuum)
 	{
 		fprintf(stderr, "starting vacuum...");
@@ -4017,6 +4281,16 @@ main(int argc, char **argv)
 		thread->logfile = NULL; /* filled in later */
 		thread->latency_late = 0;
 		initStats(&thread->stats, 0.0);
+		thread->host_stats = NULL;
+		if (npghosts > 1)
+		{
+			int			h;
+
+			thread->host_stats = (StatsData *)
+				pg_malloc(sizeof(StatsData) * npghosts);
+			for (h = 0; h < npghosts; h++)
+				initStats(&thread->host_stats[h], 0.0);
+		}
 
 		nclients_dealt += thread->nstate;
 	}
@@ -4092,8 +4366,28 @@ main(int argc, char **argv)
 		mergeSimpleStats(&stats.lag, &thread->stats.lag);
 		stats.cnt += thread->stats.cnt;
 		stats.skipped += thread->stats.skipped;
+		stats.retries += thread->stats.retries;
+		stats.failures += thread->stats.failures;
 		latency_late += thread->latency_late;
 		INSTR_TIME_ADD(conn_total_time, thread->conn_time);
+
+		if (npghosts > 1)
+		{
+			int			h;
+
+			for (h = 0; h < npghosts; h++)
+			{
+				StatsData  *hs = &pghosts[h].stats;
+				StatsData  *ths = &thread->host_stats[h];
+
+				mergeSimpleStats(&hs->latency, &ths->latency);
+				mergeSimpleStats(&hs->lag, &ths->lag);
+				hs->cnt += ths->cnt;
+				hs->skipped += ths->skipped;
+				hs->retries += ths->retries;
+				hs->failures += ths->failures;
+			}
+		}
 	}
 	disconnect_all(state, nclients);
 
@@ -4167,7 +4461,7 @@ threadRun(void *arg)
 		/* make connections to the database */
 		for (i = 0; i < nstate; i++)
 		{
-			if ((state[i].con = doConnect()) == NULL)
+			if ((state[i].con = doConnect(state[i].host)) == NULL)
 				goto done;
 		}
 	}
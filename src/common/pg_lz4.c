@@ -0,0 +1,371 @@
+/* ----------
+ * pg_lz4.c -
+ *
+ *		This is an implementation of the LZ4 block format for PostgreSQL.
+ *		It trades some compression ratio against pglz for much faster
+ *		compression and decompression: the compressor does a single greedy
+ *		pass with a small hash table of 4-byte sequences, and the
+ *		decompressor only copies literals and matches.  The output can be
+ *		read by any LZ4 block decompressor and vice versa.
+ *
+ *		Entry routines:
+ *
+ *			int32
+ *			pglz4_compress(const char *source, int32 slen, char *dest,
+ *						   int32 dlen);
+ *
+ *				source is the input data to be compressed.
+ *
+ *				slen is the length of the input data.
+ *
+ *				dest is the output area for the compressed result.
+ *
+ *				dlen is the size of dest.  Compression fails if the result
+ *					doesn't fit; it never does if dest is at least as big
+ *					as PGLZ4_MAX_OUTPUT(slen).
+ *
+ *				The return value is the number of bytes written in the
+ *				buffer dest, or -1 if compression fails; in the latter
+ *				case the contents of dest are undefined.
+ *
+ *			int32
+ *			pglz4_decompress(const char *source, int32 slen, char *dest,
+ *							 int32 rawsize)
+ *
+ *				source is the compressed input.
+ *
+ *				slen is the length of the compressed input.
+ *
+ *				dest is the area where the uncompressed data will be
+ *					written to, at least rawsize bytes long.
+ *
+ *				rawsize is the length of the uncompressed data.
+ *
+ *				The return value is the number of bytes written in the
+ *				buffer dest, or -1 if decompression fails.  Corrupted
+ *				input is detected as far as that is possible; it never
+ *				makes the decompressor read or write out of bounds.
+ *
+ *		The data format:
+ *
+ *			The compressed data is a sequence of sequences, each made of
+ *			a token byte, literal bytes copied as they are, and a match
+ *			copying bytes from the data already decompressed.  The high
+ *			4 bits of the token are the number of literals, the low 4 bits
+ *			the length of the match minus 4.  A length of 15 is continued
+ *			by bytes added to it, up to the first that isn't 255: after the
+ *			token for the literal length, after the match offset for the
+ *			match length.  The literals follow the literal length, and the
+ *			match offset follows the literals, 2 bytes in little-endian
+ *			order, counting back from the current output position.  The
+ *			match may overlap with the bytes it produces.
+ *
+ *			The last sequence has literals only, at least 5 of them, and
+ *			the last match starts at least 12 bytes before the end of the
+ *			data, which is what lets fast decompressors copy in words.
+ *
+ * src/common/pg_lz4.c
+ * ----------
+ */
+#ifndef FRONTEND
+#include "postgres.h"
+#else
+#include "postgres_fe.h"
+#endif
+
+#include "common/pg_lz4.h"
+
+
+/* ----------
+ * Local definitions
+ * ----------
+ */
+#define PGLZ4_MIN_MATCH			4
+#define PGLZ4_LAST_LITERALS		5	/* literals at the end of the data */
+#define PGLZ4_MATCH_LIMIT		12	/* last match starts no closer to end */
+#define PGLZ4_MAX_OFFSET		65535
+#define PGLZ4_HASH_BITS			12
+#define PGLZ4_HASH_SIZE			(1 << PGLZ4_HASH_BITS)
+#define PGLZ4_SKIP_TRIGGER		6	/* search faster after 2^6 misses */
+
+/* Bytes continuing a literal or match length in excess of the token's */
+#define PGLZ4_LENGTH_BYTES(_len) \
+	((_len) >= 15 ? ((_len) - 15) / 255 + 1 : 0)
+
+
+/* ----------
+ * pglz4_read32 -
+ *
+ *		Fetch 4 possibly unaligned bytes.
+ * ----------
+ */
+static inline uint32
+pglz4_read32(const unsigned char *p)
+{
+	uint32		v;
+
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+
+/* ----------
+ * pglz4_hash -
+ *
+ *		Hash table slot of the 4-byte sequence at p.
+ * ----------
+ */
+static inline int
+pglz4_hash(const unsigned char *p)
+{
+	return (int) ((pglz4_read32(p) * 2654435761U) >> (32 - PGLZ4_HASH_BITS));
+}
+
+
+/* ----------
+ * pglz4_put_length -
+ *
+ *		Write the continuation bytes of a length that didn't fit in its
+ *		4 bits of the token, returning the new output position.
+ * ----------
+ */
+static inline unsigned char *
+pglz4_put_length(unsigned char *op, int32 len)
+{
+	while (len >= 255)
+	{
+		*op++ = 255;
+		len -= 255;
+	}
+	*op++ = (unsigned char) len;
+	return op;
+}
+
+
+/* ----------
+ * pglz4_compress -
+ *
+ *		Compresses source into dest, see the top of the file.
+ * ----------
+ */
+int32
+pglz4_compress(const char *source, int32 slen, char *dest, int32 dlen)
+{
+	const unsigned char *base = (const unsigned char *) source;
+	const unsigned char *ip = base;
+	const unsigned char *anchor = base;
+	const unsigned char *iend = base + slen;
+	const unsigned char *mflimit = iend - PGLZ4_MATCH_LIMIT;
+	const unsigned char *matchlimit = iend - PGLZ4_LAST_LITERALS;
+	unsigned char *op = (unsigned char *) dest;
+	unsigned char *oend = op + dlen;
+	unsigned char *token;
+	int32		litlen;
+	int32		hashtab[PGLZ4_HASH_SIZE];
+
+	if (slen < 0)
+		return -1;
+
+	/* Too short input has no room for a match, it is all literals */
+	if (slen > PGLZ4_MATCH_LIMIT)
+	{
+		uint32		misses = 1 << PGLZ4_SKIP_TRIGGER;
+
+		/*
+		 * Slots never filled point at the start of the data, which is
+		 * harmless: a candidate match is always verified.
+		 */
+		memset(hashtab, 0, sizeof(hashtab));
+		ip++;
+
+		while (ip <= mflimit)
+		{
+			const unsigned char *ref;
+			int32		mlen;
+			int32		offset;
+			int			h = pglz4_hash(ip);
+
+			ref = base + hashtab[h];
+			hashtab[h] = (int32) (ip - base);
+
+			if (ref >= ip || ip - ref > PGLZ4_MAX_OFFSET ||
+				pglz4_read32(ref) != pglz4_read32(ip))
+			{
+				/* Step over incompressible data faster and faster */
+				ip += misses++ >> PGLZ4_SKIP_TRIGGER;
+				continue;
+			}
+			misses = 1 << PGLZ4_SKIP_TRIGGER;
+
+			/* Extend the match backwards into the pending literals */
+			while (ip > anchor && ref > base && ip[-1] == ref[-1])
+			{
+				ip--;
+				ref--;
+			}
+
+			/* ... and forwards, leaving the last literals alone */
+			mlen = PGLZ4_MIN_MATCH;
+			while (ip + mlen < matchlimit && ip[mlen] == ref[mlen])
+				mlen++;
+
+			/*
+			 * Check the sequence fits: token, literal length, literals,
+			 * offset and match length.
+			 */
+			litlen = (int32) (ip - anchor);
+			if (oend - op < 1 + PGLZ4_LENGTH_BYTES(litlen) + litlen + 2 +
+				PGLZ4_LENGTH_BYTES(mlen - PGLZ4_MIN_MATCH))
+				return -1;
+
+			token = op++;
+			if (litlen >= 15)
+			{
+				*token = 15 << 4;
+				op = pglz4_put_length(op, litlen - 15);
+			}
+			else
+				*token = (unsigned char) (litlen << 4);
+			memcpy(op, anchor, litlen);
+			op += litlen;
+
+			offset = (int32) (ip - ref);
+			*op++ = (unsigned char) (offset & 0xff);
+			*op++ = (unsigned char) (offset >> 8);
+
+			if (mlen - PGLZ4_MIN_MATCH >= 15)
+			{
+				*token |= 15;
+				op = pglz4_put_length(op, mlen - PGLZ4_MIN_MATCH - 15);
+			}
+			else
+				*token |= (unsigned char) (mlen - PGLZ4_MIN_MATCH);
+
+			ip += mlen;
+			anchor = ip;
+
+			/* Remember a position inside the match, it is cheap */
+			if (ip <= mflimit)
+				hashtab[pglz4_hash(ip - 2)] = (int32) (ip - 2 - base);
+		}
+	}
+
+	/* Emit the remaining data as the literals of the last sequence */
+	litlen = (int32) (iend - anchor);
+	if (oend - op < 1 + PGLZ4_LENGTH_BYTES(litlen) + litlen)
+		return -1;
+	token = op++;
+	if (litlen >= 15)
+	{
+		*token = 15 << 4;
+		op = pglz4_put_length(op, litlen - 15);
+	}
+	else
+		*token = (unsigned char) (litlen << 4);
+	memcpy(op, anchor, litlen);
+	op += litlen;
+
+	return (int32) (op - (unsigned char *) dest);
+}
+
+
+/* ----------
+ * pglz4_get_length -
+ *
+ *		Add the continuation bytes of a length to *len.  Returns false if
+ *		the input ends first, or the length exceeds limit.
+ * ----------
+ */
+static inline bool
+pglz4_get_length(const unsigned char **ip, const unsigned char *iend,
+				 int32 *len, int32 limit)
+{
+	unsigned char b;
+
+	do
+	{
+		if (*ip >= iend)
+			return false;
+		b = *(*ip)++;
+		*len += b;
+		if (*len > limit)
+			return false;
+	} while (b == 255);
+
+	return true;
+}
+
+
+/* ----------
+ * pglz4_decompress -
+ *
+ *		Decompresses source into dest, see the top of the file.
+ * ----------
+ */
+int32
+pglz4_decompress(const char *source, int32 slen, char *dest, int32 rawsize)
+{
+	const unsigned char *ip = (const unsigned char *) source;
+	const unsigned char *iend = ip + slen;
+	unsigned char *op = (unsigned char *) dest;
+	unsigned char *oend = op + rawsize;
+
+	while (ip < iend)
+	{
+		unsigned char token = *ip++;
+		int32		len;
+		int32		offset;
+		const unsigned char *match;
+
+		/* Literals */
+		len = token >> 4;
+		if (len == 15 && !pglz4_get_length(&ip, iend, &len, rawsize))
+			return -1;
+		if (len > iend - ip || len > oend - op)
+			return -1;
+		memcpy(op, ip, len);
+		op += len;
+		ip += len;
+
+		/* The last sequence has no match */
+		if (ip >= iend)
+			break;
+
+		/* Match */
+		if (iend - ip < 2)
+			return -1;
+		offset = ip[0] | (ip[1] << 8);
+		ip += 2;
+		if (offset == 0 || offset > op - (unsigned char *) dest)
+			return -1;
+
+		len = token & 15;
+		if (len == 15 && !pglz4_get_length(&ip, iend, &len, rawsize))
+			return -1;
+		len += PGLZ4_MIN_MATCH;
+		if (len > oend - op)
+			return -1;
+
+		/*
+		 * An overlapping match repeats the bytes it is producing, so it
+		 * can't be copied with memcpy.
+		 */
+		match = op - offset;
+		if (offset >= len)
+		{
+			memcpy(op, match, len);
+			op += len;
+		}
+		else
+		{
+			while (len-- > 0)
+				*op++ = *match++;
+		}
+	}
+
+	/* Check we decompressed the right amount */
+	if (op != oend)
+		return -1;
+
+	return rawsize;
+}
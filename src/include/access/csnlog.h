@@ -0,0 +1,49 @@
+/*
+ * csnlog.h
+ *
+ * PostgreSQL commit-sequence-number log manager
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/csnlog.h
+ */
+#ifndef CSNLOG_H
+#define CSNLOG_H
+
+#include "access/clog.h"
+#include "access/xlogdefs.h"
+
+/*
+ * CommitSeqNo 0 means "not committed (yet)", whether the transaction is
+ * still running, aborted or committed before the csnlog was started.
+ */
+#define InvalidCommitSeqNo			((CommitSeqNo) 0)
+#define FirstNormalCommitSeqNo		((CommitSeqNo) 1)
+#define CommitSeqNoIsValid(csn)		((csn) != InvalidCommitSeqNo)
+
+/* Number of SLRU buffers to use for csnlog */
+#define NUM_CSNLOG_BUFFERS	32
+
+/* GUC variable */
+extern bool csn_snapshots;
+
+extern CommitSeqNo CSNLogGetCommitSeqNo(TransactionId xid);
+extern CommitSeqNo GetCurrentCommitSeqNo(void);
+extern bool CSNLogXidInSnapshot(TransactionId xid, CommitSeqNo snapshot_csn);
+extern bool CSNLogActive(void);
+
+extern Size CSNLogShmemSize(void);
+extern void CSNLogShmemInit(void);
+extern void StartupCSNLog(TransactionId oldestActiveXID);
+extern void ShutdownCSNLog(void);
+extern void CheckPointCSNLog(void);
+extern void ExtendCSNLog(TransactionId newestXact);
+extern void TruncateCSNLog(void);
+
+extern void CsnTransactionIdSetTreeStatus(TransactionId xid, int nsubxids,
+				   TransactionId *subxids, XidStatus status, XLogRecPtr lsn);
+
+extern void assign_csn_snapshots(bool newval, void *extra);
+
+#endif   /* CSNLOG_H */
@@ -81,6 +81,7 @@ typedef bool (*IndexBulkDeleteCallback) (ItemPointer itemptr, void *state);
 
 /* struct definitions appear in relscan.h */
 typedef struct IndexScanDescData *IndexScanDesc;
+typedef struct ParallelIndexScanDescData *ParallelIndexScanDesc;
 typedef struct SysScanDescData *SysScanDesc;
 
 /*
@@ -141,6 +142,15 @@ extern IndexScanDesc index_beginscan_bitmap(Relation indexRelation,
 extern void index_rescan(IndexScanDesc scan,
 			 ScanKey keys, int nkeys,
 			 ScanKey orderbys, int norderbys);
+extern Size index_parallelscan_estimate(Relation indexRelation,
+							Snapshot snapshot, int nworkers);
+extern void index_parallelscan_initialize(Relation heapRelation,
+							  Relation indexRelation, Snapshot snapshot,
+							  int nworkers, ParallelIndexScanDesc target);
+extern void index_parallelrescan(IndexScanDesc scan);
+extern IndexScanDesc index_beginscan_parallel(Relation heapRelation,
+						 Relation indexRelation, int nkeys, int norderbys,
+						 ParallelIndexScanDesc pscan);
 extern void index_endscan(IndexScanDesc scan);
 extern void index_markpos(IndexScanDesc scan);
 extern void index_restrpos(IndexScanDesc scan);
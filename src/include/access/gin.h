@@ -69,6 +69,9 @@ typedef char GinTernaryValue;
 extern PGDLLIMPORT int GinFuzzySearchLimit;
 extern int	gin_pending_list_limit;
 
+/* ginfast.c */
+extern void ginCleanupPendingListInBackground(Oid indexoid);
+
 /* ginutil.c */
 extern void ginGetStats(Relation index, GinStatsData *stats);
 extern void ginUpdateStats(Relation index, const GinStatsData *stats);
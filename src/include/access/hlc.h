@@ -0,0 +1,65 @@
+/*
+ * hlc.h
+ *
+ * Lock-free hybrid logical clock used by distributed transaction managers
+ * to assign unique ascending commit sequence numbers.
+ *
+ * Clock value is physical time in microseconds, which is incremented as
+ * logical counter if it is not greater than last assigned or received value.
+ *
+ * Portions Copyright (c) 1996-2015, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/hlc.h
+ */
+#ifndef HLC_H
+#define HLC_H
+
+#include "port/atomics.h"
+
+/*
+ * Return unique value which is greater than any value previously returned
+ * by HlcNext or passed to HlcSync for this clock and not less than now.
+ */
+static inline uint64
+HlcNext(pg_atomic_uint64 *clock, uint64 now)
+{
+	uint64		last = pg_atomic_read_u64(clock);
+	uint64		next;
+
+	do
+	{
+		next = now > last ? now : last + 1;
+	} while (!pg_atomic_compare_exchange_u64(clock, &last, next));
+
+	return next;
+}
+
+/*
+ * Advance clock to the value received from other node.
+ * Unlike adjusting of system time it doesn't require to wait in case of clock skew.
+ */
+static inline void
+HlcSync(pg_atomic_uint64 *clock, uint64 global)
+{
+	uint64		last = pg_atomic_read_u64(clock);
+
+	while (last < global)
+	{
+		if (pg_atomic_compare_exchange_u64(clock, &last, global))
+			break;
+	}
+}
+
+/*
+ * Get current clock value, never less than last assigned or received one
+ */
+static inline uint64
+HlcRead(pg_atomic_uint64 *clock, uint64 now)
+{
+	uint64		last = pg_atomic_read_u64(clock);
+
+	return now < last ? last : now;
+}
+
+#endif							/* HLC_H */
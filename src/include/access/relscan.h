@@ -37,6 +37,7 @@ typedef struct ParallelHeapScanDescData
 	slock_t		phs_mutex;		/* mutual exclusion for block number fields */
 	BlockNumber phs_startblock; /* starting block number */
 	BlockNumber phs_cblock;		/* current block number */
+	bool		phs_snapshot_any;	/* SnapshotAny, not phs_snapshot_data? */
 	char		phs_snapshot_data[FLEXIBLE_ARRAY_MEMBER];
 }	ParallelHeapScanDescData;
 
@@ -125,8 +126,28 @@ typedef struct IndexScanDescData
 
 	/* state data for traversing HOT chains in index_getnext */
 	bool		xs_continue_hot;	/* T if must keep walking HOT chain */
+
+	/* parallel index scan information, in shared memory */
+	ParallelIndexScanDesc parallel_scan;
+	bool		xs_temp_snap;	/* unregister snapshot at scan end? */
 }	IndexScanDescData;
 
+/*
+ * Shared state for parallel index scan.
+ *
+ * Like for a parallel heap scan, each participant has its own
+ * IndexScanDesc pointing to this structure.  The index AM keeps its own
+ * shared state, such as the next page to read, ps_offset bytes from the
+ * start of it, after the serialized snapshot.
+ */
+typedef struct ParallelIndexScanDescData
+{
+	Oid			ps_relid;		/* OID of the heap relation */
+	Oid			ps_indexid;		/* OID of the index */
+	Size		ps_offset;		/* offset of the AM-specific structure */
+	char		ps_snapshot_data[FLEXIBLE_ARRAY_MEMBER];
+}	ParallelIndexScanDescData;
+
 /* Struct for heap-or-index scans of system tables */
 typedef struct SysScanDescData
 {
@@ -134,6 +134,12 @@ typedef struct VariableCacheData
 	 */
 	TransactionId latestCompletedXid;	/* newest XID that has committed or
 										 * aborted */
+
+	/*
+	 * Number of top-level transactions with an XID that have left the proc
+	 * array, see GetSnapshotDataReuse.  Also protected by ProcArrayLock.
+	 */
+	uint64		xactCompletionCount;
 } VariableCacheData;
 
 typedef VariableCacheData *VariableCache;
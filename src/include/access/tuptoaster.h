@@ -74,6 +74,14 @@
  */
 #define TOAST_INDEX_TARGET		(MaxHeapTupleSize / 16)
 
+/*
+ * Compression methods of compressed datums, as stored in the top bits of
+ * their raw size (see VARCOMPRESSMETHOD_4B_C).  The "compression" attribute
+ * option chooses the method of a column by name.
+ */
+#define TOAST_PGLZ_COMPRESSION_ID	0
+#define TOAST_LZ4_COMPRESSION_ID	1
+
 /*
  * When we store an oversize datum externally, we divide it into chunks
  * containing at most TOAST_MAX_CHUNK_SIZE data bytes.  This number *must*
@@ -199,7 +207,17 @@ extern Datum toast_flatten_tuple_to_datum(HeapTupleHeader tup,
  *	Create a compressed version of a varlena datum, if possible
  * ----------
  */
-extern Datum toast_compress_datum(Datum value);
+extern Datum toast_compress_datum(Datum value, int cmethod);
+
+/* ----------
+ * toast_compression_method -
+ *
+ *	Return the method compressing new values of a column, and check the
+ *	value of the "compression" attribute option
+ * ----------
+ */
+extern int	toast_compression_method(Relation rel, int attnum);
+extern void toast_validate_compression_option(char *value);
 
 /* ----------
  * toast_raw_datum_size -
@@ -74,6 +74,8 @@ extern int FinishAllPreparedTransactions(bool isCommit);
 extern int GetPreparedTransactions(PreparedTransaction* pxacts);
 
 extern void SetPreparedTransactionState(char const* gid, char const* state);
+extern void SetPreparedTransactionsState(int n, char const* const* gids, char const* state);
+extern void SetTwoPhaseFileState(TransactionId xid, char const* state);
 
 extern bool GetPreparedTransactionState(char const* gid, char* state);
 
@@ -135,7 +135,7 @@ void		CallXactCallbacks(XactEvent event);
 #define XLOG_XACT_COMMIT_PREPARED	0x30
 #define XLOG_XACT_ABORT_PREPARED	0x40
 #define XLOG_XACT_ASSIGNMENT		0x50
-/* free opcode 0x60 */
+#define XLOG_XACT_3PC_STATE			0x60
 /* free opcode 0x70 */
 
 /* mask for filtering opcodes out of xl_info */
@@ -184,6 +184,32 @@ typedef struct xl_xact_assignment
 
 #define MinSizeOfXactAssignment offsetof(xl_xact_assignment, xsub)
 
+/*
+ * New 3PC state of a batch of prepared transactions.  Unlike PREPARE, the
+ * record doesn't repeat the 2PC state data of the transactions, only their
+ * identity.
+ */
+typedef struct xl_xact_3pc_state
+{
+	TimestampTz origin_timestamp;
+	XLogRecPtr	origin_lsn;		/* invalid unless the record has an origin */
+	int			nxacts;			/* number of xl_xact_3pc_state_xact */
+	char		state_3pc[MAX_3PC_STATE_SIZE];
+	/* xl_xact_3pc_state_xact follow, each padded to int alignment */
+} xl_xact_3pc_state;
+
+#define MinSizeOfXact3PCState sizeof(xl_xact_3pc_state)
+
+typedef struct xl_xact_3pc_state_xact
+{
+	TransactionId xid;
+	Oid			dbId;
+	char		gid[FLEXIBLE_ARRAY_MEMBER];		/* NUL-terminated */
+} xl_xact_3pc_state_xact;
+
+#define SizeOfXact3PCStateXact(gidlen) \
+	TYPEALIGN(sizeof(int32), offsetof(xl_xact_3pc_state_xact, gid) + (gidlen) + 1)
+
 /*
  * Commit and abort records can contain a lot of information. But a large
  * portion of the records won't need all possible pieces of information. So we
@@ -0,0 +1,34 @@
+/*-------------------------------------------------------------------------
+ *
+ * xlogparallel.h
+ *		Declarations for replaying WAL with several worker processes.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/xlogparallel.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef XLOGPARALLEL_H
+#define XLOGPARALLEL_H
+
+#include "access/xlogreader.h"
+
+#define MAX_PARALLEL_REDO_WORKERS 32
+
+/* GUC */
+extern int	recovery_parallel_workers;
+
+extern Size XLogParallelRedoShmemSize(void);
+extern void XLogParallelRedoShmemInit(void);
+
+extern void XLogParallelRedoStart(bool hotStandby);
+extern bool XLogParallelRedoDispatch(XLogReaderState *record);
+extern void XLogParallelRedoWaitAll(void);
+extern void XLogParallelRedoReachedConsistency(void);
+extern void XLogParallelRedoStop(void);
+
+extern void XLogParallelRedoWorkerMain(Datum main_arg) pg_attribute_noreturn();
+
+#endif   /* XLOGPARALLEL_H */
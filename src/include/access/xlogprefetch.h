@@ -0,0 +1,29 @@
+/*-------------------------------------------------------------------------
+ *
+ * xlogprefetch.h
+ *		Declarations for prefetching blocks referenced by WAL during replay.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/access/xlogprefetch.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef XLOGPREFETCH_H
+#define XLOGPREFETCH_H
+
+#include "access/xlogdefs.h"
+
+/* GUC */
+extern int	recovery_prefetch_distance;
+
+typedef struct XLogPrefetcher XLogPrefetcher;
+
+extern XLogPrefetcher *XLogPrefetcherAllocate(void);
+extern void XLogPrefetcherFree(XLogPrefetcher *prefetcher);
+extern void XLogPrefetcherReadAhead(XLogPrefetcher *prefetcher,
+						XLogRecPtr replayRecPtr, XLogRecPtr replayEndRecPtr,
+						TimeLineID tli, XLogRecPtr readUpto);
+
+#endif   /* XLOGPREFETCH_H */
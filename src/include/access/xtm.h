@@ -94,6 +94,51 @@ typedef struct
 	 */
 	void        (*InitializeSequence)(int64* start, int64* step);
 
+	/*
+	 * Check if tuple deleted by committed transaction xmax is dead for all
+	 * active snapshots although xmax doesn't precede oldest xmin. It allows
+	 * HOT pruning to remove such tuples when transaction manager holds back
+	 * oldest xmin.
+	 */
+	bool        (*IsDeadForAllSnapshots)(TransactionId xmax);
+
+	/*
+	 * Optional batched version of IsInSnapshot: store in result[i] whether
+	 * xids[i] is still-in-progress according to the snapshot.  Xids are
+	 * sorted and distinct.  It is called once per heap page by page-at-a-time
+	 * scans, so the transaction manager can take its locks once for all xids
+	 * of the page.  NULL if not supported.
+	 */
+	void        (*IsInSnapshotBatch)(TransactionId *xids, int n, Snapshot snapshot, bool *result);
+
+	/*
+	 * Optional: check if committed transaction xid is visible for all
+	 * snapshots which can be used now or later, at this node and remote ones.
+	 * If so, HEAP_XMIN_ALL_SNAPSHOTS hint is set on tuples inserted by it and
+	 * subsequent visibility checks of their xmin skip IsInSnapshot.  It is
+	 * the same condition as IsDeadForAllSnapshots checks for xmax, so
+	 * transaction managers can usually pass the same function.  NULL if
+	 * not supported.
+	 */
+	bool        (*IsVisibleForAllSnapshots)(TransactionId xid);
+
+	/*
+	 * Optional: adjust value "next" fetched by nextval from ascending or
+	 * descending non-cycled sequence, for example to move it into the range
+	 * of values reserved by this node in distributed cluster.  Returned value
+	 * should not be less than "next" for ascending sequence and should not
+	 * exceed maxv.  It is called with the sequence buffer exclusively locked.
+	 * NULL if not supported.
+	 */
+	int64       (*AdjustSequenceValue)(Relation seqrel, int64 next, int64 incby, int64 maxv);
+
+	/*
+	 * Optional: called by redo of generic logical message, for example to
+	 * let hot standby maintain visibility state written to WAL by
+	 * transaction manager of primary.  NULL if not supported.
+	 */
+	void        (*ReplayLogicalMessage)(const char *prefix, const char *message, Size size);
+
 }	TransactionManager;
 
 /* Get pointer to transaction manager: actually returns content of TM variable */
@@ -102,6 +147,8 @@ TransactionManager *GetTransactionManager(void);
 extern TransactionManager *TM;	/* Current transaction manager (can be
 								 * substituted by extensions) */
 extern TransactionManager PgTM; /* Standard PostgreSQL transaction manager */
+extern TransactionManager CsnTM;	/* PgTM with CSN based snapshots, see
+									 * csn_snapshots */
 
 /* Standard PostgreSQL function implementing TM interface */
 extern bool PgXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot);
@@ -128,6 +175,12 @@ extern size_t PgGetTransactionStateSize(void);
 extern void PgSerializeTransactionState(void* ctx);
 extern void PgDeserializeTransactionState(void* ctx);
 extern void PgInitializeSequence(int64* start, int64* step);
+extern bool PgIsDeadForAllSnapshots(TransactionId xmax);
+
+/* CSN snapshot functions implementing TM interface */
+extern bool CsnXidInMVCCSnapshot(TransactionId xid, Snapshot snapshot);
+extern Snapshot CsnGetSnapshotData(Snapshot snapshot);
+extern char const *CsnGetTransactionManagerName(void);
 
 
 #endif
@@ -404,6 +404,9 @@ typedef TransactionId MultiXactId;
 
 typedef uint32 MultiXactOffset;
 
+/* Commit sequence number, see access/transam/csnlog.c */
+typedef uint64 CommitSeqNo;
+
 typedef uint32 CommandId;
 
 #define FirstCommandId	((CommandId) 0)
@@ -938,6 +941,16 @@ typedef NameData *Name;
 #define pg_unreachable() abort()
 #endif
 
+/*
+ * Hint that the memory at addr will be read soon, so that the cache line
+ * can be fetched while we're busy with something else.
+ */
+#ifdef __GNUC__
+#define pg_prefetch_mem(addr) __builtin_prefetch(addr)
+#else
+#define pg_prefetch_mem(addr) ((void) 0)
+#endif
+
 
 /* ----------------------------------------------------------------
  *				Section 8:	random stuff
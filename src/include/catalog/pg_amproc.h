@@ -103,6 +103,7 @@ DATA(insert (	1970   701 701 1 355 ));
 DATA(insert (	1970   701 701 2 3133 ));
 DATA(insert (	1970   701 700 1 2195 ));
 DATA(insert (	1974   869 869 1 926 ));
+DATA(insert (	1974   869 869 2 4201 ));
 DATA(insert (	1976   21 21 1 350 ));
 DATA(insert (	1976   21 21 2 3129 ));
 DATA(insert (	1976   21 23 1 2190 ));
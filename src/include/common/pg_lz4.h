@@ -0,0 +1,33 @@
+/* ----------
+ * pg_lz4.h -
+ *
+ *	Definitions for the builtin LZ4 block format compressor
+ *
+ * src/include/common/pg_lz4.h
+ * ----------
+ */
+
+#ifndef _PG_LZ4_H_
+#define _PG_LZ4_H_
+
+
+/* ----------
+ * PGLZ4_MAX_OUTPUT -
+ *
+ *		Macro to compute the buffer size pglz4_compress() needs to be able to
+ *		write the compressed form of even incompressible input.
+ * ----------
+ */
+#define PGLZ4_MAX_OUTPUT(_dlen)			((_dlen) + (_dlen) / 255 + 16)
+
+
+/* ----------
+ * Global function declarations
+ * ----------
+ */
+extern int32 pglz4_compress(const char *source, int32 slen, char *dest,
+			   int32 dlen);
+extern int32 pglz4_decompress(const char *source, int32 slen, char *dest,
+				 int32 rawsize);
+
+#endif   /* _PG_LZ4_H_ */
@@ -16,6 +16,7 @@
 
 #include "nodes/execnodes.h"
 #include "storage/buffile.h"
+#include "storage/spin.h"
 
 /* ----------------------------------------------------------------
  *				hash-join hash table structures
@@ -54,6 +55,15 @@
  * inner batch file.  Subsequently, while reading either inner or outer batch
  * files, we might find tuples that no longer belong to the current batch;
  * if so, we just dump them out to the correct batch file.
+ *
+ * In a parallel query, every participant running a partial hash join would
+ * otherwise build an identical private copy of the inner hash table.  When
+ * the Hash node is parallel-aware, the first participant to get there builds
+ * the table as described above and, if it ends up with a single batch,
+ * copies it into the parallel query's dynamic shared memory segment; the
+ * other participants wait for that and then probe the shared copy instead
+ * of building their own.  If the table does not fit in the space reserved
+ * for it, everybody falls back to building a private table.
  * ----------------------------------------------------------------
  */
 
@@ -63,7 +73,12 @@
 
 typedef struct HashJoinTupleData
 {
-	struct HashJoinTupleData *next;		/* link to next tuple in same bucket */
+	/* link to next tuple in same bucket */
+	union
+	{
+		struct HashJoinTupleData *unshared;
+		Size		shared;		/* offset in SharedHashJoinTableData */
+	}			next;
 	uint32		hashvalue;		/* tuple's hash code */
 	/* Tuple data, in MinimalTuple format, follows on a MAXALIGN boundary */
 }	HashJoinTupleData;
@@ -123,6 +138,43 @@ typedef struct HashMemoryChunkData *HashMemoryChunk;
 #define HASH_CHUNK_SIZE			(32 * 1024L)
 #define HASH_CHUNK_THRESHOLD	(HASH_CHUNK_SIZE / 4)
 
+/*
+ * A hash table shared by the participants of a parallel query.  The DSM
+ * segment holding it may be mapped at a different address in each process,
+ * so the bucket array and the tuple chains hold offsets from the start of
+ * this struct instead of pointers; offset 0 means "no tuple".
+ */
+typedef enum SharedHashJoinState
+{
+	SHJ_EMPTY,					/* nobody has started building it yet */
+	SHJ_BUILDING,				/* a participant is building it */
+	SHJ_READY,					/* built; everybody may probe it */
+	SHJ_FAILED					/* didn't fit; everybody builds privately */
+} SharedHashJoinState;
+
+typedef struct SharedHashJoinTableData
+{
+	slock_t		mutex;			/* protects state and waiters */
+	SharedHashJoinState state;
+
+	/* these are set by the builder before the state becomes SHJ_READY */
+	int			nbuckets;		/* # buckets in the shared table */
+	int			log2_nbuckets;	/* its log2 */
+	double		totalTuples;	/* # tuples obtained from inner plan */
+	Size		spaceUsed;		/* space used by buckets and tuples */
+	Size		buckets;		/* offset of the bucket array */
+
+	Size		data;			/* offset of the space for buckets/tuples */
+	Size		size;			/* total size of this struct and its data */
+
+	/* participants waiting for the build to finish */
+	int			nwaiters;
+	int			maxwaiters;
+	struct PGPROC *waiters[FLEXIBLE_ARRAY_MEMBER];
+}	SharedHashJoinTableData;
+
+typedef struct SharedHashJoinTableData *SharedHashJoinTable;
+
 typedef struct HashJoinTableData
 {
 	int			nbuckets;		/* # buckets in the in-memory hash table */
@@ -186,6 +238,9 @@ typedef struct HashJoinTableData
 
 	/* used for dense allocation of tuples (into linked chunks) */
 	HashMemoryChunk chunks;		/* one list for the whole batch */
+
+	/* shared table we probe instead of buckets/chunks, or NULL */
+	SharedHashJoinTable shared;
 }	HashJoinTableData;
 
 #endif   /* HASHJOIN_H */
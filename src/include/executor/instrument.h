@@ -38,18 +38,35 @@ typedef enum InstrumentOption
 	INSTRUMENT_TIMER = 1 << 0,	/* needs timer (and row counts) */
 	INSTRUMENT_BUFFERS = 1 << 1,	/* needs buffer usage */
 	INSTRUMENT_ROWS = 1 << 2,	/* needs row count */
-	INSTRUMENT_ALL = PG_INT32_MAX
+	INSTRUMENT_TIMER_SAMPLED = 1 << 3,	/* timer may sample executions */
+	INSTRUMENT_ALL = PG_INT32_MAX & ~INSTRUMENT_TIMER_SAMPLED	/* exactly */
 } InstrumentOption;
 
+/*
+ * Plan nodes are timed with a clock cheaper to read than instr_time's where
+ * there is one, the CPU's time stamp counter; instr_cycles is a reading of
+ * that clock, or a difference of readings.  See InstrCyclesToSeconds().
+ */
+typedef uint64 instr_cycles;
+
+/*
+ * With INSTRUMENT_TIMER_SAMPLED, only one in about this many executions of a
+ * node after its first tuple is timed, and the others are estimated.
+ */
+#define INSTR_TIMER_SAMPLE_PERIOD	16
+
 typedef struct Instrumentation
 {
 	/* Parameters set at node creation: */
 	bool		need_timer;		/* TRUE if we need timer data */
 	bool		need_bufusage;	/* TRUE if we need buffer usage data */
+	bool		sample_timer;	/* TRUE if timing a sample is enough */
 	/* Info about current plan cycle: */
 	bool		running;		/* TRUE if we've completed first tuple */
-	instr_time	starttime;		/* Start time of current iteration of node */
-	instr_time	counter;		/* Accumulated runtime for this node */
+	instr_cycles starttime;		/* Start time of current iteration of node */
+	instr_cycles counter;		/* Accumulated runtime for this node */
+	double		ncalls;			/* Executions of the node this cycle */
+	double		ntimed;			/* ... of which were timed */
 	double		firsttuple;		/* Time for first tuple of this cycle */
 	double		tuplecount;		/* Tuples emitted so far this cycle */
 	BufferUsage bufusage_start; /* Buffer usage at start */
@@ -71,6 +88,8 @@ typedef struct WorkerInstrumentation
 
 extern PGDLLIMPORT BufferUsage pgBufferUsage;
 
+extern void InstrInitTiming(void);
+extern double InstrCyclesToSeconds(instr_cycles cycles);
 extern Instrumentation *InstrAlloc(int n, int instrument_options);
 extern void InstrInit(Instrumentation *instr, int instrument_options);
 extern void InstrStartNode(Instrumentation *instr);
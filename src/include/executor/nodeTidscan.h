@@ -20,5 +20,6 @@ extern TidScanState *ExecInitTidScan(TidScan *node, EState *estate, int eflags);
 extern TupleTableSlot *ExecTidScan(TidScanState *node);
 extern void ExecEndTidScan(TidScanState *node);
 extern void ExecReScanTidScan(TidScanState *node);
+extern bool TidScanIsRange(TidScan *node);
 
 #endif   /* NODETIDSCAN_H */
@@ -239,6 +239,7 @@ extern bool enableFsync;
 extern bool allowSystemTableMods;
 extern PGDLLIMPORT int work_mem;
 extern PGDLLIMPORT int maintenance_work_mem;
+extern PGDLLIMPORT int max_parallel_maintenance_workers;
 extern PGDLLIMPORT int replacement_sort_tuples;
 
 extern int	VacuumCostPageHit;
@@ -416,6 +417,7 @@ extern void pg_split_opts(char **argv, int *argcp, const char *optstr);
 extern void InitializeMaxBackends(void);
 extern void InitPostgres(const char *in_dbname, Oid dboid, const char *username,
 			 Oid useroid, char *out_dbname);
+extern void process_startup_options(struct Port *port, bool am_superuser);
 extern void BaseInit(void);
 
 /* in utils/init/miscinit.c */
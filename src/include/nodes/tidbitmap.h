@@ -34,6 +34,10 @@ typedef struct TIDBitmap TIDBitmap;
 /* Likewise, TBMIterator is private */
 typedef struct TBMIterator TBMIterator;
 
+/* ... and so are a bitmap shared with parallel workers and its iterators */
+typedef struct TBMSharedIteratorState TBMSharedIteratorState;
+typedef struct TBMSharedIterator TBMSharedIterator;
+
 /* Result structure for tbm_iterate */
 typedef struct
 {
@@ -63,4 +67,12 @@ extern TBMIterator *tbm_begin_iterate(TIDBitmap *tbm);
 extern TBMIterateResult *tbm_iterate(TBMIterator *iterator);
 extern void tbm_end_iterate(TBMIterator *iterator);
 
+extern Size tbm_estimate_shared_size(double ntuples, long maxbytes);
+extern Size tbm_shared_size(const TIDBitmap *tbm);
+extern void tbm_share(TIDBitmap *tbm, TBMSharedIteratorState *state);
+extern TBMSharedIterator *tbm_attach_shared_iterate(TBMSharedIteratorState *state,
+						  bool prefetch);
+extern TBMIterateResult *tbm_shared_iterate(TBMSharedIterator *iterator);
+extern void tbm_end_shared_iterate(TBMSharedIterator *iterator);
+
 #endif   /* TIDBITMAP_H */
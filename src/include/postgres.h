@@ -146,7 +146,8 @@ typedef union
 	struct						/* Compressed-in-line format */
 	{
 		uint32		va_header;
-		uint32		va_rawsize; /* Original data size (excludes header) */
+		uint32		va_rawsize; /* Original data size (excludes header) and
+								 * compression method, see below */
 		char		va_data[FLEXIBLE_ARRAY_MEMBER];		/* Compressed data */
 	}			va_compressed;
 } varattrib_4b;
@@ -281,8 +282,18 @@ typedef struct
 #define VARDATA_1B(PTR)		(((varattrib_1b *) (PTR))->va_data)
 #define VARDATA_1B_E(PTR)	(((varattrib_1b_e *) (PTR))->va_data)
 
+/*
+ * A varlena is at most 1GB, so the top 2 bits of va_rawsize of a compressed
+ * datum are free to tell which method compressed it.  Datums written before
+ * there was a choice have zeroes there, which is pglz.
+ */
+#define VARLENA_RAWSIZE_BITS	30
+#define VARLENA_RAWSIZE_MASK	((1U << VARLENA_RAWSIZE_BITS) - 1)
+
 #define VARRAWSIZE_4B_C(PTR) \
-	(((varattrib_4b *) (PTR))->va_compressed.va_rawsize)
+	(((varattrib_4b *) (PTR))->va_compressed.va_rawsize & VARLENA_RAWSIZE_MASK)
+#define VARCOMPRESSMETHOD_4B_C(PTR) \
+	(((varattrib_4b *) (PTR))->va_compressed.va_rawsize >> VARLENA_RAWSIZE_BITS)
 
 /* Externally visible macros */
 
@@ -14,6 +14,14 @@
 #ifndef AUTOVACUUM_H
 #define AUTOVACUUM_H
 
+/*
+ * Other processes can request specific work from autovacuum, identified by
+ * AutoVacuumWorkItem elements.
+ */
+typedef enum
+{
+	AVW_GINCleanupPendingList	/* merge the pending list of a GIN index */
+} AutoVacuumWorkItemType;
 
 /* GUC variables */
 extern bool autovacuum_start_daemon;
@@ -53,6 +61,10 @@ extern void AutoVacWorkerFailed(void);
 /* autovacuum cost-delay balancer */
 extern void AutoVacuumUpdateDelay(void);
 
+/* called from backends to hand over maintenance work */
+extern bool AutoVacuumRequestWork(AutoVacuumWorkItemType type,
+					  Oid relationId);
+
 #ifdef EXEC_BACKEND
 extern void AutoVacLauncherMain(int argc, char *argv[]) pg_attribute_noreturn();
 extern void AutoVacWorkerMain(int argc, char *argv[]) pg_attribute_noreturn();
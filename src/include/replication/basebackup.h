@@ -20,6 +20,12 @@
 #define MAX_RATE_LOWER	32
 #define MAX_RATE_UPPER	1048576
 
+/*
+ * Maximum number of streams a base backup can be split into with the
+ * PARALLEL option.
+ */
+#define MAX_BACKUP_STREAMS	32
+
 
 typedef struct
 {
@@ -33,4 +39,7 @@ extern void SendBaseBackup(BaseBackupCmd *cmd);
 
 extern int64 sendTablespace(char *path, bool sizeonly);
 
+extern Size BaseBackupShmemSize(void);
+extern void BaseBackupShmemInit(void);
+
 #endif   /* _BASEBACKUP_H */
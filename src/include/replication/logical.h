@@ -40,6 +40,19 @@ typedef struct LogicalDecodingContext
 	OutputPluginCallbacks callbacks;
 	OutputPluginOptions options;
 
+	/*
+	 * Does the output plugin want changes of large transactions streamed
+	 * before they finish? Set when it provides the stream callbacks, the
+	 * plugin may clear it in its startup callback.
+	 */
+	bool		streaming;
+
+	/*
+	 * Only advance the slot: skip everything producing output and never call
+	 * into the output plugin.
+	 */
+	bool		fast_forward;
+
 	/*
 	 * User specified options
 	 */
@@ -85,6 +98,7 @@ extern LogicalDecodingContext *CreateInitDecodingContext(char *plugin,
 extern LogicalDecodingContext *CreateDecodingContext(
 					  XLogRecPtr start_lsn,
 					  List *output_plugin_options,
+					  bool fast_forward,
 					  XLogPageReadCB read_page,
 					  LogicalOutputPluginWriterPrepareWrite prepare_write,
 					  LogicalOutputPluginWriterWrite do_write);
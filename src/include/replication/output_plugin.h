@@ -94,6 +94,55 @@ typedef void (*LogicalDecodeShutdownCB) (struct LogicalDecodingContext *ctx);
  */
 typedef void (*LogicalDecodeCaughtUpCB) (struct LogicalDecodingContext * ctx);
 
+/*
+ * Called when a block of changes of a still running transaction starts to be
+ * streamed. txn->streamed is false for the first block of a transaction.
+ */
+typedef void (*LogicalDecodeStreamStartCB) (struct LogicalDecodingContext *ctx,
+												   ReorderBufferTXN *txn);
+
+/*
+ * Called when a block of streamed changes ends.
+ */
+typedef void (*LogicalDecodeStreamStopCB) (struct LogicalDecodingContext *ctx,
+												   ReorderBufferTXN *txn);
+
+/*
+ * Called when a transaction that had some of its changes streamed aborts, or
+ * turns out not to be interesting after all. The changes received so far
+ * have to be thrown away.
+ */
+typedef void (*LogicalDecodeStreamAbortCB) (struct LogicalDecodingContext *ctx,
+												   ReorderBufferTXN *txn,
+												   XLogRecPtr abort_lsn);
+
+/*
+ * Called instead of the commit callback (so also for PREPARE, see
+ * txn->xact_action) for a transaction that had changes streamed, after its
+ * remaining changes have been streamed.
+ */
+typedef void (*LogicalDecodeStreamCommitCB) (struct LogicalDecodingContext *ctx,
+												   ReorderBufferTXN *txn,
+												   XLogRecPtr commit_lsn);
+
+/*
+ * Callback for every individual change of a streamed transaction.
+ */
+typedef void (*LogicalDecodeStreamChangeCB) (struct LogicalDecodingContext *ctx,
+												   ReorderBufferTXN *txn,
+												   Relation relation,
+												ReorderBufferChange *change);
+
+/*
+ * Callback for the transactional messages of a streamed transaction.
+ */
+typedef void (*LogicalDecodeStreamMessageCB) (struct LogicalDecodingContext *ctx,
+													ReorderBufferTXN *txn,
+													XLogRecPtr message_lsn,
+													const char *prefix,
+													Size message_size,
+													const char *message);
+
 /*
  * Output plugin callbacks
  */
@@ -107,6 +156,13 @@ typedef struct OutputPluginCallbacks
 	LogicalDecodeFilterByOriginCB filter_by_origin_cb;
 	LogicalDecodeShutdownCB shutdown_cb;
 	LogicalDecodeCaughtUpCB caughtup_cb;
+	/* streaming of in-progress transactions, either all or none are set */
+	LogicalDecodeStreamStartCB stream_start_cb;
+	LogicalDecodeStreamStopCB stream_stop_cb;
+	LogicalDecodeStreamAbortCB stream_abort_cb;
+	LogicalDecodeStreamCommitCB stream_commit_cb;
+	LogicalDecodeStreamChangeCB stream_change_cb;
+	LogicalDecodeStreamMessageCB stream_message_cb;
 } OutputPluginCallbacks;
 
 /* Functions in replication/logical/logical.c */
@@ -21,13 +21,10 @@
 /* an individual tuple, stored in one chunk of memory */
 typedef struct ReorderBufferTupleBuf
 {
-	/* position in preallocated list */
-	slist_node	node;
-
 	/* tuple header, the interesting bit for users of logical decoding */
 	HeapTupleData tuple;
 
-	/* pre-allocated size of tuple buffer, different from tuple size */
+	/* allocated size of tuple buffer, may be larger than the tuple */
 	Size		alloc_tuple_size;
 
 	/* actual tuple data follows */
@@ -154,6 +151,14 @@ typedef struct ReorderBufferTXN
 	char		gid[GIDSIZE];
 	char		state_3pc[MAX_3PC_STATE_SIZE];
 
+	/*
+	 * XLOG_XACT_3PC_STATE is passed as a single commit callback for all the
+	 * prepared transactions getting state_3pc, which are listed here.
+	 */
+	int			nxacts_3pc;
+	TransactionId *xids_3pc;
+	char	  **gids_3pc;
+
 	/* did the TX have catalog changes */
 	bool		has_catalog_changes;
 
@@ -162,6 +167,13 @@ typedef struct ReorderBufferTXN
 	 */
 	bool		is_known_as_subxact;
 
+	/*
+	 * Have changes of this transaction already been streamed to the output
+	 * plugin while it was still running? Only ever set for toplevel
+	 * transactions, see ReorderBufferStreamTXN().
+	 */
+	bool		streamed;
+
 	/*
 	 * LSN of the first data carrying, WAL record with knowledge about this
 	 * xid. This is allowed to *not* be first record adorned with this xid, if
@@ -222,6 +234,12 @@ typedef struct ReorderBufferTXN
 	 */
 	uint64		nentries_mem;
 
+	/*
+	 * Memory used by the in-memory changes of this transaction, in bytes.
+	 * Subtransactions are accounted separately, as above.
+	 */
+	Size		size;
+
 	/*
 	 * List of ReorderBufferChange structs, including new Snapshots and new
 	 * CommandIds
@@ -302,6 +320,44 @@ typedef void (*ReorderBufferMessageCB) (
 												 const char *prefix, Size sz,
 													const char *message);
 
+/* stream start callback signature */
+typedef void (*ReorderBufferStreamStartCB) (
+													ReorderBuffer *rb,
+													ReorderBufferTXN *txn);
+
+/* stream stop callback signature */
+typedef void (*ReorderBufferStreamStopCB) (
+												   ReorderBuffer *rb,
+												   ReorderBufferTXN *txn,
+												   XLogRecPtr last_lsn);
+
+/* stream abort callback signature */
+typedef void (*ReorderBufferStreamAbortCB) (
+													ReorderBuffer *rb,
+													ReorderBufferTXN *txn,
+													XLogRecPtr abort_lsn);
+
+/* stream commit callback signature */
+typedef void (*ReorderBufferStreamCommitCB) (
+													 ReorderBuffer *rb,
+													 ReorderBufferTXN *txn,
+													 XLogRecPtr commit_lsn);
+
+/* stream change callback signature */
+typedef void (*ReorderBufferStreamChangeCB) (
+													 ReorderBuffer *rb,
+													 ReorderBufferTXN *txn,
+													 Relation relation,
+												ReorderBufferChange *change);
+
+/* stream message callback signature */
+typedef void (*ReorderBufferStreamMessageCB) (
+													  ReorderBuffer *rb,
+													  ReorderBufferTXN *txn,
+													  XLogRecPtr message_lsn,
+												 const char *prefix, Size sz,
+													  const char *message);
+
 struct ReorderBuffer
 {
 	/*
@@ -335,6 +391,17 @@ struct ReorderBuffer
 	ReorderBufferCommitCB commit;
 	ReorderBufferMessageCB message;
 
+	/*
+	 * Callbacks to be called while a large transaction is still running, and
+	 * when a transaction streamed that way ends.
+	 */
+	ReorderBufferStreamStartCB stream_start;
+	ReorderBufferStreamStopCB stream_stop;
+	ReorderBufferStreamAbortCB stream_abort;
+	ReorderBufferStreamCommitCB stream_commit;
+	ReorderBufferStreamChangeCB stream_change;
+	ReorderBufferStreamMessageCB stream_message;
+
 	/*
 	 * Pointer that will be passed untouched to the callbacks.
 	 */
@@ -346,34 +413,25 @@ struct ReorderBuffer
 	MemoryContext context;
 
 	/*
-	 * Data structure slab cache.
-	 *
-	 * We allocate/deallocate some structures very frequently, to avoid bigger
-	 * overhead we cache some unused ones here.
-	 *
-	 * The maximum number of cached entries is controlled by const variables
-	 * on top of reorderbuffer.c
+	 * Memory contexts for specific types of objects
 	 */
-
-	/* cached ReorderBufferTXNs */
-	dlist_head	cached_transactions;
-	Size		nr_cached_transactions;
-
-	/* cached ReorderBufferChanges */
-	dlist_head	cached_changes;
-	Size		nr_cached_changes;
-
-	/* cached ReorderBufferTupleBufs */
-	slist_head	cached_tuplebufs;
-	Size		nr_cached_tuplebufs;
+	MemoryContext change_context;
+	MemoryContext txn_context;
+	MemoryContext tup_context;
 
 	XLogRecPtr	current_restart_decoding_lsn;
 
 	/* buffer for disk<->memory conversions */
 	char	   *outbuf;
 	Size		outbufsize;
+
+	/* memory used by the in-memory changes of all transactions, in bytes */
+	Size		size;
 };
 
+/* GUC variables */
+extern PGDLLIMPORT int logical_decoding_work_mem;
+
 
 ReorderBuffer *ReorderBufferAllocate(void);
 void		ReorderBufferFree(ReorderBuffer *);
@@ -314,6 +314,9 @@ extern bool StrategyRejectBuffer(BufferAccessStrategy strategy,
 
 extern int	StrategySyncStart(uint32 *complete_passes, uint32 *num_buf_alloc);
 extern void StrategyNotifyBgWriter(int bgwprocno);
+extern void StrategyEvictedBuffer(uint32 hashcode);
+extern uint32 StrategyInitialUsage(uint32 hashcode,
+					 BufferAccessStrategy strategy);
 
 extern Size StrategyShmemSize(void);
 extern void StrategyInitialize(bool init);
@@ -24,6 +24,9 @@
 
 typedef void *Block;
 
+/* forward declared, to avoid having to expose smgr.h here */
+struct SMgrRelationData;
+
 /* Possible arguments for GetAccessStrategy() */
 typedef enum BufferAccessStrategyType
 {
@@ -34,6 +37,13 @@ typedef enum BufferAccessStrategyType
 	BAS_VACUUM					/* VACUUM */
 } BufferAccessStrategyType;
 
+/* Possible values of buffer_replacement_policy */
+typedef enum BufferReplacementPolicy
+{
+	BUFFER_REPLACEMENT_CLOCK,	/* plain clock sweep */
+	BUFFER_REPLACEMENT_2Q		/* clock sweep with probation and ghosts */
+} BufferReplacementPolicy;
+
 /* Possible modes for ReadBufferExtended() */
 typedef enum
 {
@@ -63,6 +73,10 @@ extern int	target_prefetch_pages;
 extern int	checkpoint_flush_after;
 extern int	backend_flush_after;
 extern int	bgwriter_flush_after;
+extern int	write_queue_depth;
+
+/* in freelist.c */
+extern int	buffer_replacement_policy;
 
 /* in buf_init.c */
 extern PGDLLIMPORT char *BufferBlocks;
@@ -78,6 +92,9 @@ extern PGDLLIMPORT int32 *LocalRefCount;
 /* upper limit for effective_io_concurrency */
 #define MAX_IO_CONCURRENCY 1000
 
+/* upper limit for write_queue_depth */
+#define MAX_WRITE_QUEUE_DEPTH 32
+
 /* special block number for ReadBuffer() */
 #define P_NEW	InvalidBlockNumber		/* grow the file to get a new page */
 
@@ -165,6 +182,8 @@ extern PGDLLIMPORT int32 *LocalRefCount;
 extern bool ComputeIoConcurrency(int io_concurrency, double *target);
 extern void PrefetchBuffer(Relation reln, ForkNumber forkNum,
 			   BlockNumber blockNum);
+extern bool PrefetchSharedBuffer(struct SMgrRelationData *smgr_reln,
+					 ForkNumber forkNum, BlockNumber blockNum);
 extern Buffer ReadBuffer(Relation reln, BlockNumber blockNum);
 extern Buffer ReadBufferExtended(Relation reln, ForkNumber forkNum,
 				   BlockNumber blockNum, ReadBufferMode mode,
@@ -185,6 +204,7 @@ extern void InitBufferPoolBackend(void);
 extern void AtEOXact_Buffers(bool isCommit);
 extern void PrintBufferLeakWarning(Buffer buffer);
 extern void CheckPointBuffers(int flags);
+extern void FlushBufferWriteBatch(void);
 extern BlockNumber BufferGetBlockNumber(Buffer buffer);
 extern BlockNumber RelationGetNumberOfBlocksInFork(Relation relation,
 								ForkNumber forkNum);
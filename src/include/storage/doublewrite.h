@@ -0,0 +1,45 @@
+/*-------------------------------------------------------------------------
+ *
+ * doublewrite.h
+ *	  Double-write buffer protecting data pages from torn writes.
+ *
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/storage/doublewrite.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef DOUBLEWRITE_H
+#define DOUBLEWRITE_H
+
+#include "storage/buf_internals.h"
+
+/* Name of the double-write file, relative to the data directory */
+#define DOUBLE_WRITE_FILE		"pg_doublewrite"
+
+/* Sequence number of a double-write slot; zero is never used */
+typedef uint64 DoubleWriteSlot;
+
+#define InvalidDoubleWriteSlot	((DoubleWriteSlot) 0)
+
+/* GUC variables */
+extern bool double_write;
+extern int	double_write_buffers;
+
+extern Size DoubleWriteShmemSize(void);
+extern void DoubleWriteShmemInit(void);
+extern void DoubleWriteStartup(bool crashed);
+extern bool DoubleWriteEnabled(void);
+
+extern DoubleWriteSlot DoubleWriteReserve(bool wait);
+extern void DoubleWriteCopy(DoubleWriteSlot slot, BufferTag *tag, char *page);
+extern void DoubleWriteFlush(DoubleWriteSlot slot);
+extern void DoubleWriteDone(DoubleWriteSlot slot);
+extern void DoubleWriteAbort(void);
+
+extern DoubleWriteSlot DoubleWriteSyncStart(void);
+extern void DoubleWriteSyncDone(DoubleWriteSlot horizon);
+
+#endif   /* DOUBLEWRITE_H */
@@ -39,8 +39,14 @@
 #define USE_DSM_MMAP
 #endif
 
-/* GUC. */
+/* Placement of dynamic shared memory segments on NUMA nodes. */
+#define DSM_NUMA_NONE			0
+#define DSM_NUMA_LOCAL			1
+#define DSM_NUMA_INTERLEAVE		2
+
+/* GUCs. */
 extern int	dynamic_shared_memory_type;
+extern int	dynamic_shared_memory_numa;
 
 /*
  * Directory for on-disk state.
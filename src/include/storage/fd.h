@@ -40,6 +40,9 @@
 #define FD_H
 
 #include <dirent.h>
+#ifdef HAVE_AIO_WRITE
+#include <aio.h>
+#endif
 
 
 /*
@@ -50,6 +53,21 @@ typedef char *FileName;
 
 typedef int File;
 
+/*
+ * An asynchronous write, started by FileStartWrite and finished by
+ * FileWaitWrite.  Without POSIX AIO the write is done at once.
+ */
+typedef struct FileAsyncWrite
+{
+	File		file;
+	int			result;			/* result of a synchronous write */
+	int			save_errno;
+#ifdef HAVE_AIO_WRITE
+	bool		async;			/* is cb in use? */
+	struct aiocb cb;
+#endif
+} FileAsyncWrite;
+
 
 /* GUC parameter */
 extern int	max_files_per_process;
@@ -71,6 +89,9 @@ extern void FileClose(File file);
 extern int	FilePrefetch(File file, off_t offset, int amount);
 extern int	FileRead(File file, char *buffer, int amount);
 extern int	FileWrite(File file, char *buffer, int amount);
+extern int	FileStartWrite(File file, char *buffer, int amount, off_t offset,
+			   FileAsyncWrite *req);
+extern int	FileWaitWrite(FileAsyncWrite *req);
 extern int	FileSync(File file);
 extern off_t FileSeek(File file, off_t offset, int whence);
 extern int	FileTruncate(File file, off_t offset);
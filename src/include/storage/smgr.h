@@ -16,6 +16,7 @@
 
 #include "fmgr.h"
 #include "storage/block.h"
+#include "storage/fd.h"
 #include "storage/relfilenode.h"
 
 
@@ -76,6 +77,19 @@ typedef SMgrRelationData *SMgrRelation;
 #define SmgrIsTemp(smgr) \
 	RelFileNodeBackendIsTemp((smgr)->smgr_rnode)
 
+/*
+ * A block write started by smgrstartwrite(), to be finished with
+ * smgrwaitwrite().  The SMgrRelation must stay open in between.
+ */
+typedef struct SMgrAsyncWrite
+{
+	SMgrRelation reln;
+	ForkNumber	forknum;
+	BlockNumber blocknum;
+	bool		skipFsync;
+	FileAsyncWrite fwrite;		/* private to the storage manager */
+} SMgrAsyncWrite;
+
 extern void smgrinit(void);
 extern SMgrRelation smgropen(RelFileNode rnode, BackendId backend);
 extern bool smgrexists(SMgrRelation reln, ForkNumber forknum);
@@ -98,6 +112,11 @@ extern void smgrwrite(SMgrRelation reln, ForkNumber forknum,
 		  BlockNumber blocknum, char *buffer, bool skipFsync);
 extern void smgrwriteback(SMgrRelation reln, ForkNumber forknum,
 			  BlockNumber blocknum, BlockNumber nblocks);
+extern void smgrstartwrite(SMgrRelation reln, ForkNumber forknum,
+			   BlockNumber blocknum, char *buffer, bool skipFsync,
+			   SMgrAsyncWrite *req);
+extern void smgrwaitwrite(SMgrAsyncWrite *req);
+extern void smgrabortwrite(SMgrAsyncWrite *req);
 extern BlockNumber smgrnblocks(SMgrRelation reln, ForkNumber forknum);
 extern void smgrtruncate(SMgrRelation reln, ForkNumber forknum,
 			 BlockNumber nblocks);
@@ -126,6 +145,11 @@ extern void mdwrite(SMgrRelation reln, ForkNumber forknum,
 		BlockNumber blocknum, char *buffer, bool skipFsync);
 extern void mdwriteback(SMgrRelation reln, ForkNumber forknum,
 			BlockNumber blocknum, BlockNumber nblocks);
+extern void mdstartwrite(SMgrRelation reln, ForkNumber forknum,
+			 BlockNumber blocknum, char *buffer, bool skipFsync,
+			 SMgrAsyncWrite *req);
+extern void mdwaitwrite(SMgrAsyncWrite *req);
+extern void mdabortwrite(SMgrAsyncWrite *req);
 extern BlockNumber mdnblocks(SMgrRelation reln, ForkNumber forknum);
 extern void mdtruncate(SMgrRelation reln, ForkNumber forknum,
 		   BlockNumber nblocks);
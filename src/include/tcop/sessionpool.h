@@ -0,0 +1,66 @@
+/*-------------------------------------------------------------------------
+ *
+ * sessionpool.h
+ *	  Multiplexing of client sessions onto a pool of backends.
+ *
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/tcop/sessionpool.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef SESSIONPOOL_H
+#define SESSIONPOOL_H
+
+#include "libpq/libpq-be.h"
+
+/* Directory, relative to the data directory, of the pool backends' sockets */
+#define SESSION_POOL_DIR	"pg_sessionpool"
+
+/* GUC variables */
+extern int	session_pool_size;
+extern bool session_pooling;
+
+/* Is this connection served by the session pool? */
+extern bool SessionPoolConnection;
+
+/* Result of SessionPoolWaitForCommand */
+typedef enum
+{
+	SESSION_POOL_CONTINUE,		/* stay with the current session */
+	SESSION_POOL_SWITCHED,		/* switched to another session with input */
+	SESSION_POOL_STARTED		/* switched to a new session, not ready yet */
+} SessionPoolWaitResult;
+
+/*
+ * Hook for modules that keep per-session state of their own.  It is called
+ * with SESSION_POOL_SWITCH_OUT before the backend leaves a session, with
+ * SESSION_POOL_SWITCH_IN once it has entered one (including a new one), and
+ * with SESSION_POOL_CLOSE when the current session ends, always outside of
+ * transaction blocks.  Sessions are identified by SessionPoolSessionId().
+ */
+typedef enum
+{
+	SESSION_POOL_SWITCH_OUT,
+	SESSION_POOL_SWITCH_IN,
+	SESSION_POOL_CLOSE
+} SessionPoolEvent;
+
+typedef void (*session_pool_hook_type) (SessionPoolEvent event,
+													int32 sessionId);
+extern PGDLLIMPORT session_pool_hook_type session_pool_hook;
+
+extern Size SessionPoolShmemSize(void);
+extern void SessionPoolShmemInit(void);
+extern void SessionPoolInitSocketDir(void);
+
+extern bool SessionPoolWanted(Port *port);
+extern void SessionPoolStart(void);
+extern SessionPoolWaitResult SessionPoolWaitForCommand(void);
+extern bool SessionPoolCloseSession(void);
+extern void SessionPoolReloadConfig(void);
+extern int32 SessionPoolSessionId(void);
+
+#endif   /* SESSIONPOOL_H */
@@ -958,6 +958,7 @@ extern Datum cidr_out(PG_FUNCTION_ARGS);
 extern Datum cidr_recv(PG_FUNCTION_ARGS);
 extern Datum cidr_send(PG_FUNCTION_ARGS);
 extern Datum network_cmp(PG_FUNCTION_ARGS);
+extern Datum network_sortsupport(PG_FUNCTION_ARGS);
 extern Datum network_lt(PG_FUNCTION_ARGS);
 extern Datum network_le(PG_FUNCTION_ARGS);
 extern Datum network_eq(PG_FUNCTION_ARGS);
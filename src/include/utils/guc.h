@@ -393,6 +393,13 @@ extern Size EstimateGUCStateSpace(void);
 extern void SerializeGUCState(Size maxsize, char *start_address);
 extern void RestoreGUCState(void *gucstate);
 
+/* Per-session GUC state of pooled sessions */
+typedef struct GucSessionState GucSessionState;
+
+extern GucSessionState *SaveSessionGUCState(GucSessionState *base);
+extern void ResetSessionGUCState(GucSessionState *state, GucSessionState *base);
+extern void RestoreSessionGUCState(GucSessionState *state);
+
 /* Support for messages reported from GUC check hooks */
 
 extern PGDLLIMPORT char *GUC_check_errmsg_string;
@@ -431,6 +438,7 @@ extern void assign_search_path(const char *newval, void *extra);
 
 /* in access/transam/xlog.c */
 extern bool check_wal_buffers(int *newval, void **extra, GucSource source);
+extern bool check_wal_insert_locks(int *newval, void **extra, GucSource source);
 extern void assign_xlog_sync_method(int new_sync_method, void *extra);
 
 #endif   /* GUC_H */
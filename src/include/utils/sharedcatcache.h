@@ -0,0 +1,37 @@
+/*-------------------------------------------------------------------------
+ *
+ * sharedcatcache.h
+ *	  Shared-memory catalog tuple cache.
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ * src/include/utils/sharedcatcache.h
+ *
+ *-------------------------------------------------------------------------
+ */
+#ifndef SHAREDCATCACHE_H
+#define SHAREDCATCACHE_H
+
+#include "access/htup.h"
+#include "access/skey.h"
+#include "storage/sinval.h"
+#include "utils/catcache.h"
+
+/* GUC variable: size of the shared catalog cache in kB, 0 disables it */
+extern int	shared_catcache_size;
+
+extern Size SharedCatCacheShmemSize(void);
+extern void SharedCatCacheShmemInit(void);
+
+extern bool SharedCatCacheUsable(CatCache *cache);
+extern HeapTuple SharedCatCacheLookup(CatCache *cache, uint32 hashValue,
+					 ScanKey cur_skey, uint64 *generation);
+extern void SharedCatCacheInsert(CatCache *cache, uint32 hashValue,
+					 HeapTuple tuple, uint64 generation);
+
+extern void SharedCatCacheInvalidate(const SharedInvalidationMessage *msgs,
+						 int n);
+extern void SharedCatCacheInvalidateDatabase(Oid dbId);
+
+#endif   /* SHAREDCATCACHE_H */
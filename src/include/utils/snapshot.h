@@ -109,6 +109,20 @@ typedef struct SnapshotData
 
 	int64		whenTaken;		/* timestamp when snapshot was taken */
 	XLogRecPtr	lsn;			/* position in the WAL stream when taken */
+
+	/*
+	 * Commit sequence number of a snapshot taken with csn_snapshots enabled,
+	 * or InvalidCommitSeqNo.  When set, xip[] and subxip[] are empty and
+	 * the snapshot sees exactly the XIDs in [xmin, xmax) that committed with
+	 * a smaller CSN.
+	 */
+	CommitSeqNo snapshot_csn;
+
+	/*
+	 * ShmemVariableCache->xactCompletionCount when the snapshot was built,
+	 * or 0 if it must not be reused by GetSnapshotData.
+	 */
+	uint64		snapXactCompletionCount;
 } SnapshotData;
 
 /*
@@ -268,6 +268,17 @@ ApplySortAbbrevFullComparator(Datum datum1, bool isNull1,
 	return compare;
 }
 
+/*
+ * Datum comparators shared by datatypes whose sort keys, or abbreviated keys,
+ * are plain integers.  tuplesort.c recognizes them and can then radix sort
+ * on datum1 instead of calling the comparator.
+ */
+extern int	ssup_datum_unsigned_cmp(Datum x, Datum y, SortSupport ssup);
+#ifdef USE_FLOAT8_BYVAL
+extern int	ssup_datum_signed_cmp(Datum x, Datum y, SortSupport ssup);
+#endif
+extern int	ssup_datum_int32_cmp(Datum x, Datum y, SortSupport ssup);
+
 /* Other functions in utils/sort/sortsupport.c */
 extern void PrepareSortSupportComparisonShim(Oid cmpFunc, SortSupport ssup);
 extern void PrepareSortSupportFromOrderingOp(Oid orderingOp, SortSupport ssup);
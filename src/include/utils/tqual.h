@@ -81,6 +81,9 @@ extern void HeapTupleSetHintBits(HeapTupleHeader tuple, Buffer buffer,
 					 uint16 infomask, TransactionId xid);
 extern bool HeapTupleHeaderIsOnlyLocked(HeapTupleHeader tuple);
 
+extern bool PrefetchXidsInMVCCSnapshot(Buffer buffer, Snapshot snapshot);
+extern void ResetXidsInMVCCSnapshot(void);
+
 /*
  * To avoid leaking too much knowledge about reorderbuffer implementation
  * details this is implemented in reorderbuffer.c not tqual.c.
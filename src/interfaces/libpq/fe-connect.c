@@ -2982,6 +2982,8 @@ closePGconn(PGconn *conn)
 										 * absent */
 	conn->asyncStatus = PGASYNC_IDLE;
 	pqClearAsyncResult(conn);	/* deallocate result */
+	conn->pipelineStatus = PQ_PIPELINE_OFF;
+	pqFreeCommandQueue(conn);	/* forget commands queued in pipeline mode */
 	resetPQExpBuffer(&conn->errorMessage);
 	pg_freeaddrinfo_all(conn->addrlist_family, conn->addrlist);
 	conn->addrlist = NULL;
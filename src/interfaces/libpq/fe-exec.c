@@ -39,7 +39,9 @@ char	   *const pgresStatus[] = {
 	"PGRES_NONFATAL_ERROR",
 	"PGRES_FATAL_ERROR",
 	"PGRES_COPY_BOTH",
-	"PGRES_SINGLE_TUPLE"
+	"PGRES_SINGLE_TUPLE",
+	"PGRES_PIPELINE_SYNC",
+	"PGRES_PIPELINE_ABORTED"
 };
 
 /*
@@ -69,6 +71,11 @@ static PGresult *PQexecFinish(PGconn *conn);
 static int PQsendDescribe(PGconn *conn, char desc_type,
 			   const char *desc_target);
 static int	check_field_number(const PGresult *res, int field_num);
+static PGcmdQueueEntry *pqAllocCmdQueueEntry(PGconn *conn);
+static void pqAppendCmdQueueEntry(PGconn *conn, PGcmdQueueEntry *entry);
+static void pqFreeCmdQueueEntry(PGcmdQueueEntry *entry);
+static void pqPipelineProcessQueue(PGconn *conn);
+static int	pqPipelineFlush(PGconn *conn);
 
 
 /* ----------------
@@ -1134,6 +1141,14 @@ PQsendQuery(PGconn *conn, const char *query)
 	if (!PQsendQueryStart(conn))
 		return 0;
 
+	/* simple query protocol has an implicit Sync after each query */
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+				   libpq_gettext("PQsendQuery not allowed in pipeline mode\n"));
+		return 0;
+	}
+
 	/* check the argument */
 	if (!query)
 	{
@@ -1229,6 +1244,8 @@ PQsendPrepare(PGconn *conn,
 			  const char *stmtName, const char *query,
 			  int nParams, const Oid *paramTypes)
 {
+	PGcmdQueueEntry *entry = NULL;
+
 	if (!PQsendQueryStart(conn))
 		return 0;
 
@@ -1260,6 +1277,13 @@ PQsendPrepare(PGconn *conn,
 		return 0;
 	}
 
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		entry = pqAllocCmdQueueEntry(conn);
+		if (entry == NULL)
+			return 0;			/* error msg already set */
+	}
+
 	/* construct the Parse message */
 	if (pqPutMsgStart('P', false, conn) < 0 ||
 		pqPuts(stmtName, conn) < 0 ||
@@ -1286,6 +1310,19 @@ PQsendPrepare(PGconn *conn,
 	if (pqPutMsgEnd(conn) < 0)
 		goto sendFailed;
 
+	/* In pipeline mode, the application sends the Sync when it likes */
+	if (entry)
+	{
+		entry->queryclass = PGQUERY_PREPARE;
+		entry->query = strdup(query);
+
+		if (pqPipelineFlush(conn) < 0)
+			goto sendFailed;
+
+		pqAppendCmdQueueEntry(conn, entry);
+		return 1;
+	}
+
 	/* construct the Sync message */
 	if (pqPutMsgStart('S', false, conn) < 0 ||
 		pqPutMsgEnd(conn) < 0)
@@ -1312,6 +1349,7 @@ PQsendPrepare(PGconn *conn,
 	return 1;
 
 sendFailed:
+	pqFreeCmdQueueEntry(entry);
 	pqHandleSendFailure(conn);
 	return 0;
 }
@@ -1377,6 +1415,25 @@ PQsendQueryStart(PGconn *conn)
 						  libpq_gettext("no connection to the server\n"));
 		return false;
 	}
+
+	/*
+	 * In pipeline mode the command is queued behind the ones in progress,
+	 * whose state must be left alone; pqPipelineProcessQueue() sets things
+	 * up when its turn comes.  Only a COPY can't be interleaved with.
+	 */
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		if (conn->asyncStatus == PGASYNC_COPY_IN ||
+			conn->asyncStatus == PGASYNC_COPY_OUT ||
+			conn->asyncStatus == PGASYNC_COPY_BOTH)
+		{
+			printfPQExpBuffer(&conn->errorMessage,
+					   libpq_gettext("cannot queue commands during COPY\n"));
+			return false;
+		}
+		return true;
+	}
+
 	/* Can't send while already busy, either. */
 	if (conn->asyncStatus != PGASYNC_IDLE)
 	{
@@ -1414,6 +1471,7 @@ PQsendQueryGuts(PGconn *conn,
 				int resultFormat)
 {
 	int			i;
+	PGcmdQueueEntry *entry = NULL;
 
 	/* This isn't gonna work on a 2.0 server */
 	if (PG_PROTOCOL_MAJOR(conn->pversion) < 3)
@@ -1423,9 +1481,17 @@ PQsendQueryGuts(PGconn *conn,
 		return 0;
 	}
 
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		entry = pqAllocCmdQueueEntry(conn);
+		if (entry == NULL)
+			return 0;			/* error msg already set */
+	}
+
 	/*
 	 * We will send Parse (if needed), Bind, Describe Portal, Execute, Sync,
-	 * using specified statement name and the unnamed portal.
+	 * using specified statement name and the unnamed portal.  In pipeline
+	 * mode the Sync is left to PQpipelineSync().
 	 */
 
 	if (command)
@@ -1535,6 +1601,18 @@ PQsendQueryGuts(PGconn *conn,
 		pqPutMsgEnd(conn) < 0)
 		goto sendFailed;
 
+	if (entry)
+	{
+		entry->queryclass = PGQUERY_EXTENDED;
+		entry->query = command ? strdup(command) : NULL;
+
+		if (pqPipelineFlush(conn) < 0)
+			goto sendFailed;
+
+		pqAppendCmdQueueEntry(conn, entry);
+		return 1;
+	}
+
 	/* construct the Sync message */
 	if (pqPutMsgStart('S', false, conn) < 0 ||
 		pqPutMsgEnd(conn) < 0)
@@ -1564,6 +1642,7 @@ PQsendQueryGuts(PGconn *conn,
 	return 1;
 
 sendFailed:
+	pqFreeCmdQueueEntry(entry);
 	pqHandleSendFailure(conn);
 	return 0;
 }
@@ -1751,10 +1830,34 @@ PQgetResult(PGconn *conn)
 		case PGASYNC_IDLE:
 			res = NULL;			/* query is complete */
 			break;
+		case PGASYNC_PIPELINE_IDLE:
+			res = NULL;			/* query is complete */
+			/* the next call returns results of the next queued command */
+			pqPipelineProcessQueue(conn);
+			break;
 		case PGASYNC_READY:
 			res = pqPrepareAsyncResult(conn);
-			/* Set the state back to BUSY, allowing parsing to proceed. */
-			conn->asyncStatus = PGASYNC_BUSY;
+
+			/*
+			 * In pipeline mode, a command other than a Sync ends with the
+			 * first result that is not a single row; its messages are not
+			 * followed by ReadyForQuery.  The NULL ending its results is
+			 * returned next time, but none is returned after a Sync.
+			 */
+			if (conn->pipelineStatus != PQ_PIPELINE_OFF &&
+				res && res->resultStatus != PGRES_SINGLE_TUPLE &&
+				(conn->queryclass != PGQUERY_SYNC ||
+				 res->resultStatus == PGRES_PIPELINE_SYNC))
+			{
+				conn->asyncStatus = PGASYNC_PIPELINE_IDLE;
+				if (res->resultStatus == PGRES_PIPELINE_SYNC)
+					pqPipelineProcessQueue(conn);
+			}
+			else
+			{
+				/* Set the state back to BUSY, allowing parsing to proceed. */
+				conn->asyncStatus = PGASYNC_BUSY;
+			}
 			break;
 		case PGASYNC_COPY_IN:
 			res = getCopyResult(conn, PGRES_COPY_IN);
@@ -1831,6 +1934,383 @@ getCopyResult(PGconn *conn, ExecStatusType copytype)
 }
 
 
+/* ====== pipeline mode support ======== */
+
+/*
+ * In pipeline mode, don't bother flushing the output buffer until it has
+ * this much data in it; PQpipelineSync and PQflush push out the rest.
+ */
+#define OUTBUFFER_THRESHOLD		65536
+
+/*
+ * PQpipelineStatus
+ *	 Return the current pipeline mode status
+ */
+PGpipelineStatus
+PQpipelineStatus(const PGconn *conn)
+{
+	if (!conn)
+		return PQ_PIPELINE_OFF;
+
+	return conn->pipelineStatus;
+}
+
+/*
+ * PQenterPipelineMode
+ *	 Put the connection in pipeline mode: commands sent with the PQsend*
+ *	 functions are queued, and are not followed by a Sync until
+ *	 PQpipelineSync is called.  Their results are read in order with
+ *	 PQgetResult, a NULL separating the results of each one.
+ *
+ * Returns 1 on success (including if already in pipeline mode), 0 if the
+ * connection is busy.
+ */
+int
+PQenterPipelineMode(PGconn *conn)
+{
+	if (!conn)
+		return 0;
+
+	/* succeed with no action if already in pipeline mode */
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+		return 1;
+
+	if (conn->asyncStatus != PGASYNC_IDLE)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+			 libpq_gettext("cannot enter pipeline mode, connection not idle\n"));
+		return 0;
+	}
+
+	/* This isn't gonna work on a 2.0 server */
+	if (PG_PROTOCOL_MAJOR(conn->pversion) < 3)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+		 libpq_gettext("function requires at least protocol version 3.0\n"));
+		return 0;
+	}
+
+	conn->pipelineStatus = PQ_PIPELINE_ON;
+
+	return 1;
+}
+
+/*
+ * PQexitPipelineMode
+ *	 Return to normal mode, once all results of queued commands, up to and
+ *	 including those of a final PQpipelineSync, have been read.
+ *
+ * Returns 1 on success (including if not in pipeline mode), 0 if there is
+ * still work pending.
+ */
+int
+PQexitPipelineMode(PGconn *conn)
+{
+	if (!conn)
+		return 0;
+
+	if (conn->pipelineStatus == PQ_PIPELINE_OFF)
+		return 1;
+
+	switch (conn->asyncStatus)
+	{
+		case PGASYNC_IDLE:
+		case PGASYNC_PIPELINE_IDLE:
+			/* OK, if nothing is queued */
+			break;
+		case PGASYNC_READY:
+			printfPQExpBuffer(&conn->errorMessage,
+							  libpq_gettext("cannot exit pipeline mode with uncollected results\n"));
+			return 0;
+		case PGASYNC_BUSY:
+			printfPQExpBuffer(&conn->errorMessage,
+					libpq_gettext("cannot exit pipeline mode while busy\n"));
+			return 0;
+		case PGASYNC_COPY_IN:
+		case PGASYNC_COPY_OUT:
+		case PGASYNC_COPY_BOTH:
+			printfPQExpBuffer(&conn->errorMessage,
+				  libpq_gettext("cannot exit pipeline mode while in COPY\n"));
+			return 0;
+	}
+
+	if (conn->cmd_queue_head != NULL)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("cannot exit pipeline mode with uncollected results\n"));
+		return 0;
+	}
+
+	/*
+	 * After an error the server ignores everything up to the next Sync, so
+	 * it must be sent before the connection can be used normally again.
+	 */
+	if (conn->pipelineStatus == PQ_PIPELINE_ABORTED)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("cannot exit pipeline mode before synchronizing an aborted pipeline\n"));
+		return 0;
+	}
+
+	conn->pipelineStatus = PQ_PIPELINE_OFF;
+	conn->asyncStatus = PGASYNC_IDLE;
+
+	/* Flush any pending data in out buffer */
+	if (pqFlush(conn) < 0)
+		return 0;				/* error message is setup already */
+
+	return 1;
+}
+
+/*
+ * PQpipelineSync
+ *	 Send a Sync message, marking the end of a batch of pipelined commands.
+ *	 If all of them succeeded, an implicit transaction they were run in is
+ *	 committed.  After an error, the server skips the commands up to the
+ *	 Sync; they are reported as PGRES_PIPELINE_ABORTED.  The Sync itself
+ *	 is reported by a PGRES_PIPELINE_SYNC result, which is not followed by
+ *	 a NULL.
+ *
+ * The output buffer is flushed, as far as possible in nonblocking mode.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int
+PQpipelineSync(PGconn *conn)
+{
+	PGcmdQueueEntry *entry;
+
+	if (!conn)
+		return 0;
+
+	if (conn->pipelineStatus == PQ_PIPELINE_OFF)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("cannot send pipeline when not in pipeline mode\n"));
+		return 0;
+	}
+
+	if (conn->asyncStatus == PGASYNC_COPY_IN ||
+		conn->asyncStatus == PGASYNC_COPY_OUT ||
+		conn->asyncStatus == PGASYNC_COPY_BOTH)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+				 libpq_gettext("cannot send pipeline while in COPY\n"));
+		return 0;
+	}
+
+	entry = pqAllocCmdQueueEntry(conn);
+	if (entry == NULL)
+		return 0;				/* error msg already set */
+
+	entry->queryclass = PGQUERY_SYNC;
+	entry->query = NULL;
+
+	/* construct the Sync message */
+	if (pqPutMsgStart('S', false, conn) < 0 ||
+		pqPutMsgEnd(conn) < 0)
+		goto sendFailed;
+
+	/*
+	 * Give the data a push.  In nonblock mode, don't complain if we're unable
+	 * to send it all; PQgetResult() will do any additional flushing needed.
+	 */
+	if (pqFlush(conn) < 0)
+		goto sendFailed;
+
+	/* OK, it's launched! */
+	pqAppendCmdQueueEntry(conn, entry);
+	return 1;
+
+sendFailed:
+	pqFreeCmdQueueEntry(entry);
+	pqHandleSendFailure(conn);
+	return 0;
+}
+
+/*
+ * PQsendFlushRequest
+ *	 Send a Flush message, asking the server to send out the results of the
+ *	 commands sent so far without waiting for a Sync.  Like the commands, it
+ *	 is only buffered; use PQflush to make sure it reaches the server.
+ *
+ * Returns 1 on success, 0 on failure.
+ */
+int
+PQsendFlushRequest(PGconn *conn)
+{
+	if (!conn)
+		return 0;
+
+	/* Don't try to send if we know there's no live connection. */
+	if (conn->status != CONNECTION_OK)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("no connection to the server\n"));
+		return 0;
+	}
+
+	/* Can't send while already busy, either, unless enqueuing for later */
+	if (conn->asyncStatus != PGASYNC_IDLE &&
+		conn->pipelineStatus == PQ_PIPELINE_OFF)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+				  libpq_gettext("another command is already in progress\n"));
+		return 0;
+	}
+
+	/* This isn't gonna work on a 2.0 server */
+	if (PG_PROTOCOL_MAJOR(conn->pversion) < 3)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+		 libpq_gettext("function requires at least protocol version 3.0\n"));
+		return 0;
+	}
+
+	if (pqPutMsgStart('H', false, conn) < 0 ||
+		pqPutMsgEnd(conn) < 0)
+		return 0;
+
+	return 1;
+}
+
+/*
+ * Get a command queue entry, to be filled in by the caller.
+ */
+static PGcmdQueueEntry *
+pqAllocCmdQueueEntry(PGconn *conn)
+{
+	PGcmdQueueEntry *entry;
+
+	entry = (PGcmdQueueEntry *) malloc(sizeof(PGcmdQueueEntry));
+	if (entry == NULL)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("out of memory\n"));
+		return NULL;
+	}
+	entry->queryclass = PGQUERY_EXTENDED;
+	entry->query = NULL;
+	entry->next = NULL;
+
+	return entry;
+}
+
+/*
+ * Add a command that has been sent to the end of the queue.  If nothing is
+ * in progress, it becomes the current command at once.
+ */
+static void
+pqAppendCmdQueueEntry(PGconn *conn, PGcmdQueueEntry *entry)
+{
+	if (conn->cmd_queue_tail == NULL)
+		conn->cmd_queue_head = entry;
+	else
+		conn->cmd_queue_tail->next = entry;
+	conn->cmd_queue_tail = entry;
+
+	if (conn->asyncStatus == PGASYNC_IDLE)
+		pqPipelineProcessQueue(conn);
+}
+
+static void
+pqFreeCmdQueueEntry(PGcmdQueueEntry *entry)
+{
+	if (entry == NULL)
+		return;
+	if (entry->query)
+		free(entry->query);
+	free(entry);
+}
+
+/*
+ * Forget all commands queued in pipeline mode; used when the connection is
+ * closed.
+ */
+void
+pqFreeCommandQueue(PGconn *conn)
+{
+	while (conn->cmd_queue_head != NULL)
+	{
+		PGcmdQueueEntry *entry = conn->cmd_queue_head;
+
+		conn->cmd_queue_head = entry->next;
+		pqFreeCmdQueueEntry(entry);
+	}
+	conn->cmd_queue_tail = NULL;
+}
+
+/*
+ * Once the results of the current command have all been returned, make the
+ * next queued one current and prepare to read its results, or go idle if
+ * there is none.
+ */
+static void
+pqPipelineProcessQueue(PGconn *conn)
+{
+	PGcmdQueueEntry *entry;
+
+	/* client still has to read the results of the current command? */
+	if (conn->asyncStatus != PGASYNC_IDLE &&
+		conn->asyncStatus != PGASYNC_PIPELINE_IDLE)
+		return;
+
+	entry = conn->cmd_queue_head;
+	if (entry == NULL)
+	{
+		conn->asyncStatus = PGASYNC_IDLE;
+		return;
+	}
+	conn->cmd_queue_head = entry->next;
+	if (conn->cmd_queue_head == NULL)
+		conn->cmd_queue_tail = NULL;
+
+	/* remember what we are doing, and the query text */
+	conn->queryclass = entry->queryclass;
+	if (conn->last_query)
+		free(conn->last_query);
+	conn->last_query = entry->query;
+	free(entry);
+
+	/* initialize async result-accumulation state */
+	pqClearAsyncResult(conn);
+
+	/* reset single-row processing mode */
+	conn->singleRowMode = false;
+
+	if (conn->pipelineStatus == PQ_PIPELINE_ABORTED &&
+		conn->queryclass != PGQUERY_SYNC)
+	{
+		/*
+		 * The server is skipping everything up to the next Sync, so there
+		 * won't be any response to this command; tell the client so.
+		 */
+		conn->result = PQmakeEmptyPGresult(conn, PGRES_PIPELINE_ABORTED);
+		if (!conn->result)
+		{
+			printfPQExpBuffer(&conn->errorMessage,
+							  libpq_gettext("out of memory\n"));
+			pqSaveErrorResult(conn);
+		}
+		conn->asyncStatus = PGASYNC_READY;
+	}
+	else
+		conn->asyncStatus = PGASYNC_BUSY;
+}
+
+/*
+ * In pipeline mode, send the output buffer only once there is a fair amount
+ * of data in it.
+ */
+static int
+pqPipelineFlush(PGconn *conn)
+{
+	if (conn->outCount >= OUTBUFFER_THRESHOLD)
+		return pqFlush(conn);
+	return 0;
+}
+
+
 /*
  * PQexec
  *	  send a query to the backend and package up the result in a PGresult
@@ -1932,6 +2412,13 @@ PQexecStart(PGconn *conn)
 	if (!conn)
 		return false;
 
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("synchronous command execution functions are not allowed in pipeline mode\n"));
+		return false;
+	}
+
 	/*
 	 * Silently discard any prior query result that application didn't eat.
 	 * This is probably poor design, but it's here for backward compatibility.
@@ -2126,6 +2613,8 @@ PQsendDescribePortal(PGconn *conn, const char *portal)
 static int
 PQsendDescribe(PGconn *conn, char desc_type, const char *desc_target)
 {
+	PGcmdQueueEntry *entry = NULL;
+
 	/* Treat null desc_target as empty string */
 	if (!desc_target)
 		desc_target = "";
@@ -2141,6 +2630,13 @@ PQsendDescribe(PGconn *conn, char desc_type, const char *desc_target)
 		return 0;
 	}
 
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		entry = pqAllocCmdQueueEntry(conn);
+		if (entry == NULL)
+			return 0;			/* error msg already set */
+	}
+
 	/* construct the Describe message */
 	if (pqPutMsgStart('D', false, conn) < 0 ||
 		pqPutc(desc_type, conn) < 0 ||
@@ -2148,6 +2644,18 @@ PQsendDescribe(PGconn *conn, char desc_type, const char *desc_target)
 		pqPutMsgEnd(conn) < 0)
 		goto sendFailed;
 
+	if (entry)
+	{
+		entry->queryclass = PGQUERY_DESCRIBE;
+		entry->query = NULL;
+
+		if (pqPipelineFlush(conn) < 0)
+			goto sendFailed;
+
+		pqAppendCmdQueueEntry(conn, entry);
+		return 1;
+	}
+
 	/* construct the Sync message */
 	if (pqPutMsgStart('S', false, conn) < 0 ||
 		pqPutMsgEnd(conn) < 0)
@@ -2175,6 +2683,7 @@ PQsendDescribe(PGconn *conn, char desc_type, const char *desc_target)
 	return 1;
 
 sendFailed:
+	pqFreeCmdQueueEntry(entry);
 	pqHandleSendFailure(conn);
 	return 0;
 }
@@ -2321,9 +2830,10 @@ PQputCopyEnd(PGconn *conn, const char *errormsg)
 
 		/*
 		 * If we sent the COPY command in extended-query mode, we must issue a
-		 * Sync as well.
+		 * Sync as well, unless the application does that in pipeline mode.
 		 */
-		if (conn->queryclass != PGQUERY_SIMPLE)
+		if (conn->queryclass != PGQUERY_SIMPLE &&
+			conn->pipelineStatus == PQ_PIPELINE_OFF)
 		{
 			if (pqPutMsgStart('S', false, conn) < 0 ||
 				pqPutMsgEnd(conn) < 0)
@@ -2569,6 +3079,13 @@ PQfn(PGconn *conn,
 	/* clear the error string */
 	resetPQExpBuffer(&conn->errorMessage);
 
+	if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+	{
+		printfPQExpBuffer(&conn->errorMessage,
+						  libpq_gettext("PQfn not allowed in pipeline mode\n"));
+		return NULL;
+	}
+
 	if (conn->sock == PGINVALID_SOCKET || conn->asyncStatus != PGASYNC_IDLE ||
 		conn->result != NULL)
 	{
@@ -218,12 +218,36 @@ pqParseInput3(PGconn *conn)
 				case 'E':		/* error return */
 					if (pqGetErrorNotice3(conn, true))
 						return;
+					/* the server skips the rest of the pipeline */
+					if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+						conn->pipelineStatus = PQ_PIPELINE_ABORTED;
 					conn->asyncStatus = PGASYNC_READY;
 					break;
 				case 'Z':		/* backend is ready for new query */
 					if (getReadyForQuery(conn))
 						return;
-					conn->asyncStatus = PGASYNC_IDLE;
+					if (conn->pipelineStatus != PQ_PIPELINE_OFF)
+					{
+						/* report reaching the Sync of a pipeline */
+						conn->result = PQmakeEmptyPGresult(conn,
+														PGRES_PIPELINE_SYNC);
+						if (!conn->result)
+						{
+							printfPQExpBuffer(&conn->errorMessage,
+											  libpq_gettext("out of memory"));
+							pqSaveErrorResult(conn);
+
+							/*
+							 * Mark the Sync done anyway, so that PQgetResult
+							 * doesn't wait for it after the error.
+							 */
+							conn->queryclass = PGQUERY_EXTENDED;
+						}
+						conn->pipelineStatus = PQ_PIPELINE_ON;
+						conn->asyncStatus = PGASYNC_READY;
+					}
+					else
+						conn->asyncStatus = PGASYNC_IDLE;
 					break;
 				case 'I':		/* empty query */
 					if (conn->result == NULL)
@@ -1828,9 +1852,10 @@ pqEndcopy3(PGconn *conn)
 
 		/*
 		 * If we sent the COPY command in extended-query mode, we must issue a
-		 * Sync as well.
+		 * Sync as well, unless the application does that in pipeline mode.
 		 */
-		if (conn->queryclass != PGQUERY_SIMPLE)
+		if (conn->queryclass != PGQUERY_SIMPLE &&
+			conn->pipelineStatus == PQ_PIPELINE_OFF)
 		{
 			if (pqPutMsgStart('S', false, conn) < 0 ||
 				pqPutMsgEnd(conn) < 0)
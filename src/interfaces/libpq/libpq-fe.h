@@ -91,7 +91,10 @@ typedef enum
 	PGRES_NONFATAL_ERROR,		/* notice or warning message */
 	PGRES_FATAL_ERROR,			/* query failed */
 	PGRES_COPY_BOTH,			/* Copy In/Out data transfer in progress */
-	PGRES_SINGLE_TUPLE			/* single tuple from larger resultset */
+	PGRES_SINGLE_TUPLE,			/* single tuple from larger resultset */
+	PGRES_PIPELINE_SYNC,		/* pipeline synchronization point */
+	PGRES_PIPELINE_ABORTED		/* command didn't run because of an error in
+								 * an earlier command of the pipeline */
 } ExecStatusType;
 
 typedef enum
@@ -117,6 +120,17 @@ typedef enum
 	PQSHOW_CONTEXT_ALWAYS		/* always show CONTEXT field */
 } PGContextVisibility;
 
+/*
+ * PGpipelineStatus - Current status of pipeline mode
+ */
+typedef enum
+{
+	PQ_PIPELINE_OFF,			/* not in pipeline mode */
+	PQ_PIPELINE_ON,				/* commands are queued before a Sync */
+	PQ_PIPELINE_ABORTED			/* an error occurred, commands up to the next
+								 * Sync are skipped by the server */
+} PGpipelineStatus;
+
 /*
  * PGPing - The ordering of this enum should not be altered because the
  * values are exposed externally via pg_isready.
@@ -421,6 +435,13 @@ extern PGresult *PQgetResult(PGconn *conn);
 extern int	PQisBusy(PGconn *conn);
 extern int	PQconsumeInput(PGconn *conn);
 
+/* Routines for pipeline mode management */
+extern PGpipelineStatus PQpipelineStatus(const PGconn *conn);
+extern int	PQenterPipelineMode(PGconn *conn);
+extern int	PQexitPipelineMode(PGconn *conn);
+extern int	PQpipelineSync(PGconn *conn);
+extern int	PQsendFlushRequest(PGconn *conn);
+
 /* LISTEN/NOTIFY support */
 extern PGnotify *PQnotifies(PGconn *conn);
 
@@ -220,7 +220,9 @@ typedef enum
 	PGASYNC_READY,				/* result ready for PQgetResult */
 	PGASYNC_COPY_IN,			/* Copy In data transfer in progress */
 	PGASYNC_COPY_OUT,			/* Copy Out data transfer in progress */
-	PGASYNC_COPY_BOTH			/* Copy In/Out data transfer in progress */
+	PGASYNC_COPY_BOTH,			/* Copy In/Out data transfer in progress */
+	PGASYNC_PIPELINE_IDLE		/* pipeline mode: current command is done,
+								 * the next one is not started yet */
 } PGAsyncStatusType;
 
 /* PGQueryClass tracks which query protocol we are now executing */
@@ -229,9 +231,23 @@ typedef enum
 	PGQUERY_SIMPLE,				/* simple Query protocol (PQexec) */
 	PGQUERY_EXTENDED,			/* full Extended protocol (PQexecParams) */
 	PGQUERY_PREPARE,			/* Parse only (PQprepare) */
-	PGQUERY_DESCRIBE			/* Describe Statement or Portal */
+	PGQUERY_DESCRIBE,			/* Describe Statement or Portal */
+	PGQUERY_SYNC				/* Sync at the end of a pipeline */
 } PGQueryClass;
 
+/*
+ * A command sent in pipeline mode whose results have not yet been started
+ * on.  Commands are taken off the queue in order as PQgetResult gets to
+ * them; the command being processed is described by conn->queryclass and
+ * conn->last_query as usual.
+ */
+typedef struct PGcmdQueueEntry
+{
+	PGQueryClass queryclass;	/* what kind of command */
+	char	   *query;			/* SQL command, or NULL if none or unknown */
+	struct PGcmdQueueEntry *next;	/* list link */
+} PGcmdQueueEntry;
+
 /* PGSetenvStatusType defines the state of the PQSetenv state machine */
 /* (this is used only for 2.0-protocol connections) */
 typedef enum
@@ -353,6 +369,9 @@ struct pg_conn
 	PGQueryClass queryclass;
 	char	   *last_query;		/* last SQL command, or NULL if unknown */
 	char		last_sqlstate[6];		/* last reported SQLSTATE */
+	PGpipelineStatus pipelineStatus;	/* status of pipeline mode */
+	PGcmdQueueEntry *cmd_queue_head;	/* commands queued in pipeline mode */
+	PGcmdQueueEntry *cmd_queue_tail;
 	bool		options_valid;	/* true if OK to attempt connection */
 	bool		nonblocking;	/* whether this connection is using nonblock
 								 * sending semantics */
@@ -553,6 +572,7 @@ extern void pqSaveParameterStatus(PGconn *conn, const char *name,
 					  const char *value);
 extern int	pqRowProcessor(PGconn *conn, const char **errmsgp);
 extern void pqHandleSendFailure(PGconn *conn);
+extern void pqFreeCommandQueue(PGconn *conn);
 
 /* === in fe-protocol2.c === */
 
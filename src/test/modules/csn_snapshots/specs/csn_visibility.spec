@@ -0,0 +1,46 @@
+# Visibility of concurrent transactions under CSN snapshots.
+#
+# A snapshot taken before another transaction commits must keep treating
+# it as in progress, however it committed: directly, through
+# subtransactions, or with COMMIT PREPARED.  The parallel step checks
+# that the CSN survives snapshot serialization for workers.
+
+setup
+{
+    CREATE TABLE csn_vis (id int, data text);
+    INSERT INTO csn_vis VALUES (0, 'initial');
+}
+
+teardown
+{
+    DROP TABLE csn_vis;
+}
+
+session "s1"
+step "s1rr"		{ BEGIN ISOLATION LEVEL REPEATABLE READ; SELECT * FROM csn_vis ORDER BY id; }
+step "s1rc"		{ BEGIN ISOLATION LEVEL READ COMMITTED; SELECT * FROM csn_vis ORDER BY id; }
+step "s1sel"	{ SELECT * FROM csn_vis ORDER BY id; }
+step "s1par"	{ SET LOCAL force_parallel_mode = on; SELECT count(*) FROM csn_vis; }
+step "s1c"		{ COMMIT; }
+
+session "s2"
+step "s2b"		{ BEGIN; }
+step "s2ins"	{ INSERT INTO csn_vis VALUES (1, 'committed'); }
+step "s2sub"	{ SAVEPOINT a; INSERT INTO csn_vis VALUES (2, 'subxact'); RELEASE a;
+				  SAVEPOINT b; INSERT INTO csn_vis VALUES (3, 'aborted subxact'); ROLLBACK TO b; }
+step "s2upd"	{ UPDATE csn_vis SET data = 'updated' WHERE id = 0; }
+step "s2c"		{ COMMIT; }
+step "s2p"		{ PREPARE TRANSACTION 'csn_vis'; }
+step "s2cp"		{ COMMIT PREPARED 'csn_vis'; }
+
+# repeatable read keeps its snapshot, read committed takes a new one
+permutation "s1rr" "s2b" "s2ins" "s2upd" "s2c" "s1sel" "s1par" "s1c" "s1sel"
+permutation "s1rc" "s2b" "s2ins" "s2upd" "s2c" "s1sel" "s1par" "s1c"
+
+# transactions in progress when the snapshot is taken stay invisible
+permutation "s2b" "s2ins" "s1rr" "s2sub" "s2c" "s1sel" "s1par" "s1c" "s1sel"
+permutation "s2b" "s2sub" "s1rc" "s1sel" "s2c" "s1sel" "s1c"
+
+# prepared transactions become visible at COMMIT PREPARED
+permutation "s2b" "s2ins" "s2sub" "s2p" "s1rr" "s2cp" "s1sel" "s1par" "s1c" "s1sel"
+permutation "s2b" "s2ins" "s2p" "s1rc" "s1sel" "s2cp" "s1sel" "s1c"
@@ -0,0 +1,77 @@
+--
+-- MVCC with commit sequence number snapshots
+--
+SHOW csn_snapshots;
+
+CREATE TABLE csn_test(id int, data text);
+
+-- subtransactions are committed with their parent, aborted ones never
+BEGIN;
+INSERT INTO csn_test VALUES (1, 'top');
+SAVEPOINT a;
+INSERT INTO csn_test VALUES (2, 'released');
+RELEASE SAVEPOINT a;
+SAVEPOINT b;
+INSERT INTO csn_test VALUES (3, 'rolled back');
+ROLLBACK TO SAVEPOINT b;
+SAVEPOINT c;
+INSERT INTO csn_test VALUES (4, 'nested');
+SAVEPOINT d;
+UPDATE csn_test SET data = data || ' and updated' WHERE id = 1;
+COMMIT;
+SELECT * FROM csn_test ORDER BY id;
+
+-- aborted transactions stay invisible
+BEGIN;
+INSERT INTO csn_test VALUES (5, 'aborted');
+DELETE FROM csn_test WHERE id = 1;
+ROLLBACK;
+SELECT * FROM csn_test ORDER BY id;
+
+-- enough subtransactions to span several pg_csnlog pages
+DO $$
+BEGIN
+    FOR i IN 1..5000 LOOP
+        BEGIN
+            INSERT INTO csn_test VALUES (1000 + i, 'many');
+            IF i % 7 = 0 THEN
+                RAISE EXCEPTION 'abort';
+            END IF;
+        EXCEPTION WHEN raise_exception THEN
+            NULL;
+        END;
+    END LOOP;
+END $$;
+SELECT count(*), min(id), max(id) FROM csn_test WHERE data = 'many';
+
+-- a prepared transaction becomes visible only when committed
+BEGIN;
+INSERT INTO csn_test VALUES (6, 'prepared');
+PREPARE TRANSACTION 'csn_prepared';
+SELECT * FROM csn_test WHERE id = 6;
+COMMIT PREPARED 'csn_prepared';
+SELECT * FROM csn_test WHERE id = 6;
+
+BEGIN;
+INSERT INTO csn_test VALUES (7, 'prepared and rolled back');
+PREPARE TRANSACTION 'csn_prepared';
+ROLLBACK PREPARED 'csn_prepared';
+SELECT * FROM csn_test WHERE id = 7;
+
+-- txid snapshot functions, our own transaction is running until it commits
+BEGIN;
+SELECT txid_current() AS cur_txid \gset
+SELECT txid_visible_in_snapshot(:cur_txid, txid_current_snapshot());
+SELECT txid_snapshot_xmin(txid_current_snapshot()) <= :cur_txid,
+       txid_snapshot_xmax(txid_current_snapshot()) > :cur_txid;
+COMMIT;
+SELECT txid_visible_in_snapshot(:cur_txid, txid_current_snapshot());
+
+-- snapshots serialized for parallel workers carry the CSN
+BEGIN ISOLATION LEVEL REPEATABLE READ;
+SELECT count(*) FROM csn_test;
+SET LOCAL force_parallel_mode = on;
+SELECT count(*) FROM csn_test;
+COMMIT;
+
+DROP TABLE csn_test;
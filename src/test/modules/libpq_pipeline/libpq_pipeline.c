@@ -0,0 +1,736 @@
+/*-------------------------------------------------------------------------
+ *
+ * libpq_pipeline.c
+ *		Verify libpq pipeline execution functionality
+ *
+ * Portions Copyright (c) 1996-2016, PostgreSQL Global Development Group
+ * Portions Copyright (c) 1994, Regents of the University of California
+ *
+ *
+ * IDENTIFICATION
+ *		src/test/modules/libpq_pipeline/libpq_pipeline.c
+ *
+ *-------------------------------------------------------------------------
+ */
+
+#include "postgres_fe.h"
+
+#include <sys/time.h>
+#ifdef HAVE_SYS_SELECT_H
+#include <sys/select.h>
+#endif
+
+#include "catalog/pg_type.h"
+#include "libpq-fe.h"
+
+static void exit_nicely(PGconn *conn) pg_attribute_noreturn();
+static void pg_fatal(const char *fmt,...) pg_attribute_printf(1, 2)
+			pg_attribute_noreturn();
+
+static const char *const drop_table_sql =
+"DROP TABLE IF EXISTS pq_pipeline_demo";
+static const char *const create_table_sql =
+"CREATE UNLOGGED TABLE pq_pipeline_demo(id serial primary key, itemno integer);";
+static const char *const insert_sql =
+"INSERT INTO pq_pipeline_demo(itemno) VALUES ($1)";
+
+/* number of rows inserted by test_pipelined_insert */
+#define NUM_INSERTS 10000
+
+static PGconn *conn;
+
+static void
+exit_nicely(PGconn *conn)
+{
+	PQfinish(conn);
+	exit(1);
+}
+
+static void
+pg_fatal(const char *fmt,...)
+{
+	va_list		args;
+
+	fflush(stdout);
+
+	fprintf(stderr, "libpq_pipeline: ");
+	va_start(args, fmt);
+	vfprintf(stderr, fmt, args);
+	va_end(args);
+	fprintf(stderr, "\n");
+
+	exit_nicely(conn);
+}
+
+/*
+ * Read the next result, which must have the given status.
+ */
+static PGresult *
+expect_result(ExecStatusType status, const char *what)
+{
+	PGresult   *res;
+
+	res = PQgetResult(conn);
+	if (res == NULL)
+		pg_fatal("%s: PQgetResult returned null: %s",
+				 what, PQerrorMessage(conn));
+	if (PQresultStatus(res) != status)
+		pg_fatal("%s: unexpected result status %s, expected %s: %s",
+				 what, PQresStatus(PQresultStatus(res)), PQresStatus(status),
+				 PQerrorMessage(conn));
+	return res;
+}
+
+/*
+ * The results of a command end with a NULL.
+ */
+static void
+expect_null(const char *what)
+{
+	PGresult   *res;
+
+	res = PQgetResult(conn);
+	if (res != NULL)
+		pg_fatal("%s: expected NULL result, got %s",
+				 what, PQresStatus(PQresultStatus(res)));
+}
+
+static void
+test_disallowed_in_pipeline(void)
+{
+	PGresult   *res;
+
+	fprintf(stderr, "test error cases... ");
+
+	if (PQisnonblocking(conn))
+		pg_fatal("Expected blocking connection mode");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("Unable to enter pipeline mode");
+
+	if (PQpipelineStatus(conn) == PQ_PIPELINE_OFF)
+		pg_fatal("Pipeline mode not activated properly");
+
+	/* PQexec should fail in pipeline mode */
+	res = PQexec(conn, "SELECT 1");
+	if (PQresultStatus(res) != PGRES_FATAL_ERROR)
+		pg_fatal("PQexec should fail in pipeline mode but succeeded");
+	PQclear(res);
+
+	/* so should the simple query protocol */
+	if (PQsendQuery(conn, "SELECT 1") != 0)
+		pg_fatal("PQsendQuery should fail in pipeline mode but succeeded");
+
+	/* Entering pipeline mode when already in pipeline mode is OK */
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("re-entering pipeline mode should be a no-op but failed");
+
+	if (PQisBusy(conn) != 0)
+		pg_fatal("PQisBusy should return 0 when idle in pipeline mode, returned 1");
+
+	/* ok, back to normal command mode */
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("couldn't exit idle empty pipeline mode");
+
+	if (PQpipelineStatus(conn) != PQ_PIPELINE_OFF)
+		pg_fatal("Pipeline mode not terminated properly");
+
+	/* exiting pipeline mode when not in pipeline mode should be a no-op */
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("pipeline mode exit when not in pipeline mode should succeed but failed");
+
+	/* can't sync outside of pipeline mode */
+	if (PQpipelineSync(conn) != 0)
+		pg_fatal("PQpipelineSync should fail outside pipeline mode but succeeded");
+
+	/* can't enter pipeline mode while a command is running */
+	if (PQsendQuery(conn, "SELECT 1") != 1)
+		pg_fatal("PQsendQuery failed: %s", PQerrorMessage(conn));
+	if (PQenterPipelineMode(conn) != 0)
+		pg_fatal("entering pipeline mode while busy should fail but succeeded");
+	PQclear(expect_result(PGRES_TUPLES_OK, "busy connection"));
+	expect_null("busy connection");
+
+	/* and the connection is usable normally again */
+	res = PQexec(conn, "SELECT 1");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		pg_fatal("PQexec should succeed after exiting pipeline mode but failed: %s",
+				 PQerrorMessage(conn));
+	PQclear(res);
+
+	fprintf(stderr, "ok\n");
+}
+
+static void
+test_simple_pipeline(void)
+{
+	PGresult   *res;
+	const char *dummy_params[1] = {"1"};
+	Oid			dummy_param_oids[1] = {INT4OID};
+
+	fprintf(stderr, "simple pipeline... ");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	if (PQsendQueryParams(conn, "SELECT $1",
+						  1, dummy_param_oids, dummy_params,
+						  NULL, NULL, 0) != 1)
+		pg_fatal("dispatching SELECT failed: %s", PQerrorMessage(conn));
+
+	/* results aren't collected yet, so we can't exit */
+	if (PQexitPipelineMode(conn) != 0)
+		pg_fatal("exiting pipeline mode with work in progress should fail, but succeeded");
+
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+
+	res = expect_result(PGRES_TUPLES_OK, "SELECT");
+	if (strcmp(PQgetvalue(res, 0, 0), "1") != 0)
+		pg_fatal("unexpected value \"%s\"", PQgetvalue(res, 0, 0));
+	PQclear(res);
+	expect_null("SELECT");
+
+	/* the sync result is not followed by a NULL */
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "sync"));
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	if (PQpipelineStatus(conn) != PQ_PIPELINE_OFF)
+		pg_fatal("Exiting pipeline mode didn't seem to work");
+
+	fprintf(stderr, "ok\n");
+}
+
+static void
+test_multi_pipelines(void)
+{
+	PGresult   *res;
+	const char *dummy_params[1] = {"1"};
+	Oid			dummy_param_oids[1] = {INT4OID};
+	int			i;
+
+	fprintf(stderr, "multi pipeline... ");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	/* queue two pipelines, then read back both */
+	for (i = 0; i < 2; i++)
+	{
+		if (PQsendQueryParams(conn, "SELECT $1", 1, dummy_param_oids,
+							  dummy_params, NULL, NULL, 0) != 1)
+			pg_fatal("dispatching SELECT failed: %s", PQerrorMessage(conn));
+		if (PQsendQueryParams(conn, "SELECT $1 + 1", 1, dummy_param_oids,
+							  dummy_params, NULL, NULL, 0) != 1)
+			pg_fatal("dispatching SELECT failed: %s", PQerrorMessage(conn));
+		if (PQpipelineSync(conn) != 1)
+			pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+	}
+
+	for (i = 0; i < 2; i++)
+	{
+		res = expect_result(PGRES_TUPLES_OK, "first SELECT");
+		if (strcmp(PQgetvalue(res, 0, 0), "1") != 0)
+			pg_fatal("unexpected value \"%s\"", PQgetvalue(res, 0, 0));
+		PQclear(res);
+		expect_null("first SELECT");
+
+		res = expect_result(PGRES_TUPLES_OK, "second SELECT");
+		if (strcmp(PQgetvalue(res, 0, 0), "2") != 0)
+			pg_fatal("unexpected value \"%s\"", PQgetvalue(res, 0, 0));
+		PQclear(res);
+		expect_null("second SELECT");
+
+		PQclear(expect_result(PGRES_PIPELINE_SYNC, "sync"));
+	}
+
+	/* nothing left */
+	expect_null("end of pipelines");
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	fprintf(stderr, "ok\n");
+}
+
+/*
+ * An error in a pipeline makes the server skip everything up to the next
+ * sync, and commands before it in the same implicit transaction are rolled
+ * back.
+ */
+static void
+test_pipeline_abort(void)
+{
+	PGresult   *res;
+	const char *values[1];
+	Oid			types[1] = {INT4OID};
+
+	fprintf(stderr, "aborted pipeline... ");
+
+	res = PQexec(conn, drop_table_sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("dispatching DROP TABLE failed: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	res = PQexec(conn, create_table_sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("dispatching CREATE TABLE failed: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	values[0] = "1";
+	if (PQsendQueryParams(conn, insert_sql, 1, types, values,
+						  NULL, NULL, 0) != 1)
+		pg_fatal("dispatching first insert failed: %s", PQerrorMessage(conn));
+	if (PQsendQueryParams(conn, "SELECT no_such_function($1)", 1, types,
+						  values, NULL, NULL, 0) != 1)
+		pg_fatal("dispatching error select failed: %s", PQerrorMessage(conn));
+	values[0] = "2";
+	if (PQsendQueryParams(conn, insert_sql, 1, types, values,
+						  NULL, NULL, 0) != 1)
+		pg_fatal("dispatching second insert failed: %s", PQerrorMessage(conn));
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+
+	/* a new pipeline after the sync runs normally */
+	values[0] = "3";
+	if (PQsendQueryParams(conn, insert_sql, 1, types, values,
+						  NULL, NULL, 0) != 1)
+		pg_fatal("dispatching third insert failed: %s", PQerrorMessage(conn));
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+
+	PQclear(expect_result(PGRES_COMMAND_OK, "first insert"));
+	expect_null("first insert");
+
+	PQclear(expect_result(PGRES_FATAL_ERROR, "error select"));
+	expect_null("error select");
+	if (PQpipelineStatus(conn) != PQ_PIPELINE_ABORTED)
+		pg_fatal("pipeline should be flagged as aborted but isn't");
+
+	/* aborted pipelines can't be left */
+	if (PQexitPipelineMode(conn) != 0)
+		pg_fatal("exiting an aborted pipeline should fail, but succeeded");
+
+	PQclear(expect_result(PGRES_PIPELINE_ABORTED, "second insert"));
+	expect_null("second insert");
+
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "first sync"));
+	if (PQpipelineStatus(conn) != PQ_PIPELINE_ON)
+		pg_fatal("pipeline should no longer be aborted after a sync");
+
+	PQclear(expect_result(PGRES_COMMAND_OK, "third insert"));
+	expect_null("third insert");
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "second sync"));
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	/* only the insert after the sync made it */
+	res = PQexec(conn, "SELECT itemno FROM pq_pipeline_demo");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		pg_fatal("Expected tuples, got %s: %s",
+				 PQresStatus(PQresultStatus(res)), PQerrorMessage(conn));
+	if (PQntuples(res) != 1 || strcmp(PQgetvalue(res, 0, 0), "3") != 0)
+		pg_fatal("expected only row 3 to be inserted, got %d rows",
+				 PQntuples(res));
+	PQclear(res);
+
+	fprintf(stderr, "ok\n");
+}
+
+/*
+ * An explicit transaction block spans several syncs.
+ */
+static void
+test_transaction(void)
+{
+	PGresult   *res;
+	const char *values[1] = {"42"};
+	Oid			types[1] = {INT4OID};
+
+	fprintf(stderr, "transaction... ");
+
+	res = PQexec(conn, "TRUNCATE pq_pipeline_demo");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("TRUNCATE failed: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	if (PQsendQueryParams(conn, "BEGIN", 0, NULL, NULL, NULL, NULL, 0) != 1 ||
+		PQsendQueryParams(conn, insert_sql, 1, types, values,
+						  NULL, NULL, 0) != 1 ||
+		PQpipelineSync(conn) != 1 ||
+		PQsendQueryParams(conn, "SELECT count(*) FROM pq_pipeline_demo",
+						  0, NULL, NULL, NULL, NULL, 0) != 1 ||
+		PQsendQueryParams(conn, "ROLLBACK", 0, NULL, NULL, NULL, NULL, 0) != 1 ||
+		PQpipelineSync(conn) != 1)
+		pg_fatal("dispatching transaction failed: %s", PQerrorMessage(conn));
+
+	PQclear(expect_result(PGRES_COMMAND_OK, "BEGIN"));
+	expect_null("BEGIN");
+	PQclear(expect_result(PGRES_COMMAND_OK, "insert"));
+	expect_null("insert");
+	/* the transaction block stays open across the sync */
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "first sync"));
+
+	res = expect_result(PGRES_TUPLES_OK, "count");
+	if (strcmp(PQgetvalue(res, 0, 0), "1") != 0)
+		pg_fatal("expected the transaction to see its row, got %s",
+				 PQgetvalue(res, 0, 0));
+	PQclear(res);
+	expect_null("count");
+	PQclear(expect_result(PGRES_COMMAND_OK, "ROLLBACK"));
+	expect_null("ROLLBACK");
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "second sync"));
+	if (PQtransactionStatus(conn) != PQTRANS_IDLE)
+		pg_fatal("expected the transaction to be over after the second sync");
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	fprintf(stderr, "ok\n");
+}
+
+static void
+test_prepared(void)
+{
+	PGresult   *res;
+	Oid			param_oids[2] = {INT4OID, TEXTOID};
+	const char *values[2] = {"7", "seven"};
+
+	fprintf(stderr, "prepared... ");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+	if (PQsendPrepare(conn, "select_one", "SELECT $1, $2::text || '!'",
+					  2, param_oids) != 1)
+		pg_fatal("preparing query failed: %s", PQerrorMessage(conn));
+	if (PQsendDescribePrepared(conn, "select_one") != 1)
+		pg_fatal("failed to send describe prepared: %s", PQerrorMessage(conn));
+	if (PQsendQueryPrepared(conn, "select_one", 2, values,
+							NULL, NULL, 0) != 1)
+		pg_fatal("failed to execute prepared: %s", PQerrorMessage(conn));
+	if (PQsendDescribePortal(conn, "") != 1)
+		pg_fatal("failed to send describe portal: %s", PQerrorMessage(conn));
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+
+	PQclear(expect_result(PGRES_COMMAND_OK, "prepare"));
+	expect_null("prepare");
+
+	res = expect_result(PGRES_COMMAND_OK, "describe prepared");
+	if (PQnfields(res) != 2)
+		pg_fatal("expected 2 columns, got %d", PQnfields(res));
+	if (PQnparams(res) != 2 || PQparamtype(res, 0) != INT4OID)
+		pg_fatal("unexpected parameters in prepared statement description");
+	if (PQftype(res, 1) != TEXTOID)
+		pg_fatal("expected TEXTOID, got %u", PQftype(res, 1));
+	PQclear(res);
+	expect_null("describe prepared");
+
+	res = expect_result(PGRES_TUPLES_OK, "execute prepared");
+	if (strcmp(PQgetvalue(res, 0, 0), "7") != 0 ||
+		strcmp(PQgetvalue(res, 0, 1), "seven!") != 0)
+		pg_fatal("unexpected values \"%s\", \"%s\"",
+				 PQgetvalue(res, 0, 0), PQgetvalue(res, 0, 1));
+	PQclear(res);
+	expect_null("execute prepared");
+
+	/* the unnamed portal lives on until the sync ends the transaction */
+	res = expect_result(PGRES_COMMAND_OK, "describe portal");
+	if (PQnfields(res) != 2)
+		pg_fatal("expected 2 columns, got %d", PQnfields(res));
+	PQclear(res);
+	expect_null("describe portal");
+
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "sync"));
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	fprintf(stderr, "ok\n");
+}
+
+/*
+ * Single-row mode can be used for any of the queued commands.
+ */
+static void
+test_singlerowmode(void)
+{
+	PGresult   *res;
+	int			i;
+	int			nrows;
+
+	fprintf(stderr, "single row mode... ");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	for (i = 0; i < 3; i++)
+	{
+		if (PQsendQueryParams(conn, "SELECT generate_series(1, 3)",
+							  0, NULL, NULL, NULL, NULL, 0) != 1)
+			pg_fatal("failed to send query: %s", PQerrorMessage(conn));
+	}
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+
+	for (i = 0; i < 3; i++)
+	{
+		/* only the second query is read row by row */
+		if (i == 1 && PQsetSingleRowMode(conn) != 1)
+			pg_fatal("PQsetSingleRowMode() failed for query %d", i);
+
+		nrows = 0;
+		while ((res = PQgetResult(conn)) != NULL)
+		{
+			ExecStatusType est = PQresultStatus(res);
+
+			if (est == PGRES_SINGLE_TUPLE)
+			{
+				if (i != 1)
+					pg_fatal("unexpected single row result for query %d", i);
+				nrows++;
+			}
+			else if (est == PGRES_TUPLES_OK)
+			{
+				if (i == 1 && PQntuples(res) != 0)
+					pg_fatal("expected an empty final result for query %d", i);
+				nrows += PQntuples(res);
+			}
+			else
+				pg_fatal("unexpected result status %s for query %d: %s",
+						 PQresStatus(est), i, PQerrorMessage(conn));
+			PQclear(res);
+		}
+		if (nrows != 3)
+			pg_fatal("expected 3 rows from query %d, got %d", i, nrows);
+	}
+
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "sync"));
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	fprintf(stderr, "ok\n");
+}
+
+/*
+ * A flush request makes the server send the results so far without waiting
+ * for a sync.
+ */
+static void
+test_flush_request(void)
+{
+	PGresult   *res;
+
+	fprintf(stderr, "flush request... ");
+
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	if (PQsendQueryParams(conn, "SELECT 1", 0, NULL, NULL, NULL, NULL, 0) != 1)
+		pg_fatal("failed to send query: %s", PQerrorMessage(conn));
+	if (PQsendFlushRequest(conn) != 1)
+		pg_fatal("failed to send flush request: %s", PQerrorMessage(conn));
+	if (PQflush(conn) != 0)
+		pg_fatal("failed to flush: %s", PQerrorMessage(conn));
+
+	/* without the flush request, this would wait forever */
+	res = expect_result(PGRES_TUPLES_OK, "flushed SELECT");
+	PQclear(res);
+	expect_null("flushed SELECT");
+
+	if (PQpipelineSync(conn) != 1)
+		pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+	PQclear(expect_result(PGRES_PIPELINE_SYNC, "sync"));
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+
+	fprintf(stderr, "ok\n");
+}
+
+/*
+ * Queue many more commands than fit in the socket buffers, in nonblocking
+ * mode, reading results while sending so that neither side blocks.
+ */
+static void
+test_pipelined_insert(void)
+{
+	PGresult   *res;
+	int			sock = PQsocket(conn);
+	int			sent = 0;
+	int			received = 0;
+	bool		synced = false;
+	bool		got_sync = false;
+	char		buf[32];
+	const char *values[1] = {buf};
+	Oid			types[1] = {INT4OID};
+
+	fprintf(stderr, "pipelined insert... ");
+
+	res = PQexec(conn, "TRUNCATE pq_pipeline_demo");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("TRUNCATE failed: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	if (PQsetnonblocking(conn, 1) != 0)
+		pg_fatal("failed to set nonblocking mode: %s", PQerrorMessage(conn));
+	if (PQenterPipelineMode(conn) != 1)
+		pg_fatal("failed to enter pipeline mode: %s", PQerrorMessage(conn));
+
+	while (!got_sync)
+	{
+		fd_set		input_mask;
+		fd_set		output_mask;
+
+		FD_ZERO(&input_mask);
+		FD_SET(sock, &input_mask);
+		FD_ZERO(&output_mask);
+		/* once everything is queued, only wait for unsent data to go out */
+		if (!synced || PQflush(conn) == 1)
+			FD_SET(sock, &output_mask);
+
+		if (select(sock + 1, &input_mask, &output_mask, NULL, NULL) < 0)
+			pg_fatal("select() failed: %s", strerror(errno));
+
+		/* read whatever results have arrived */
+		if (FD_ISSET(sock, &input_mask))
+		{
+			if (!PQconsumeInput(conn))
+				pg_fatal("PQconsumeInput failed: %s", PQerrorMessage(conn));
+
+			while (!PQisBusy(conn))
+			{
+				res = PQgetResult(conn);
+				if (res == NULL)
+				{
+					/* end of a command; stop if nothing else is queued */
+					if (received == sent && !synced)
+						break;
+					continue;
+				}
+				if (PQresultStatus(res) == PGRES_PIPELINE_SYNC)
+				{
+					if (received != NUM_INSERTS)
+						pg_fatal("got sync after %d of %d results",
+								 received, NUM_INSERTS);
+					got_sync = true;
+					PQclear(res);
+					break;
+				}
+				if (PQresultStatus(res) != PGRES_COMMAND_OK)
+					pg_fatal("unexpected result status %s: %s",
+							 PQresStatus(PQresultStatus(res)),
+							 PQerrorMessage(conn));
+				received++;
+				PQclear(res);
+			}
+		}
+
+		/* send more commands, or the sync once all are queued */
+		if (FD_ISSET(sock, &output_mask))
+		{
+			while (sent < NUM_INSERTS)
+			{
+				snprintf(buf, sizeof(buf), "%d", sent + 1);
+				if (PQsendQueryParams(conn, insert_sql, 1, types, values,
+									  NULL, NULL, 0) != 1)
+					pg_fatal("failed to send insert %d: %s", sent + 1,
+							 PQerrorMessage(conn));
+				sent++;
+				/* stop once libpq has data it couldn't send */
+				if (PQflush(conn) == 1)
+					break;
+			}
+			if (sent == NUM_INSERTS && !synced)
+			{
+				if (PQpipelineSync(conn) != 1)
+					pg_fatal("pipeline sync failed: %s", PQerrorMessage(conn));
+				synced = true;
+			}
+		}
+	}
+
+	if (PQexitPipelineMode(conn) != 1)
+		pg_fatal("exiting pipeline mode failed: %s", PQerrorMessage(conn));
+	if (PQsetnonblocking(conn, 0) != 0)
+		pg_fatal("failed to clear nonblocking mode: %s", PQerrorMessage(conn));
+
+	res = PQexec(conn, "SELECT count(*), sum(itemno) FROM pq_pipeline_demo");
+	if (PQresultStatus(res) != PGRES_TUPLES_OK)
+		pg_fatal("counting rows failed: %s", PQerrorMessage(conn));
+	snprintf(buf, sizeof(buf), "%d", NUM_INSERTS);
+	if (strcmp(PQgetvalue(res, 0, 0), buf) != 0)
+		pg_fatal("expected %d rows, got %s", NUM_INSERTS, PQgetvalue(res, 0, 0));
+	snprintf(buf, sizeof(buf), "%d", NUM_INSERTS * (NUM_INSERTS + 1) / 2);
+	if (strcmp(PQgetvalue(res, 0, 1), buf) != 0)
+		pg_fatal("expected sum %s, got %s", buf, PQgetvalue(res, 0, 1));
+	PQclear(res);
+
+	fprintf(stderr, "ok\n");
+}
+
+static void
+usage(const char *progname)
+{
+	fprintf(stderr, "%s tests pipeline mode.\n\n", progname);
+	fprintf(stderr, "Usage:\n");
+	fprintf(stderr, "  %s CONNINFO\n", progname);
+}
+
+int
+main(int argc, char **argv)
+{
+	const char *conninfo;
+	PGresult   *res;
+
+	if (argc != 2)
+	{
+		usage(argv[0]);
+		exit(1);
+	}
+	conninfo = argv[1];
+
+	/* Make a connection to the database */
+	conn = PQconnectdb(conninfo);
+	if (PQstatus(conn) != CONNECTION_OK)
+	{
+		fprintf(stderr, "Connection to database failed: %s\n",
+				PQerrorMessage(conn));
+		exit_nicely(conn);
+	}
+
+	/* avoid notices about the table that doesn't exist yet */
+	res = PQexec(conn, "SET client_min_messages = warning");
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("failed to set client_min_messages: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	test_disallowed_in_pipeline();
+	test_simple_pipeline();
+	test_multi_pipelines();
+	test_pipeline_abort();
+	test_transaction();
+	test_prepared();
+	test_singlerowmode();
+	test_flush_request();
+	test_pipelined_insert();
+
+	res = PQexec(conn, drop_table_sql);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pg_fatal("DROP TABLE failed: %s", PQerrorMessage(conn));
+	PQclear(res);
+
+	PQfinish(conn);
+
+	return 0;
+}
@@ -0,0 +1,27 @@
+# Run the libpq pipeline mode tests against a fresh server
+
+use strict;
+use warnings;
+
+use TestLib;
+use Test::More tests => 10;
+use PostgresNode;
+
+my $node = get_new_node('main');
+$node->init;
+$node->start;
+
+my ($out, $err);
+my $result = IPC::Run::run([ "$ENV{TESTDIR}/libpq_pipeline",
+		$node->connstr('postgres') ], '>', \$out, '2>', \$err);
+ok($result, 'libpq_pipeline succeeds');
+diag("libpq_pipeline stderr:\n$err") if !$result;
+
+foreach my $test ('test error cases', 'simple pipeline', 'multi pipeline',
+	'aborted pipeline', 'transaction', 'prepared', 'single row mode',
+	'flush request', 'pipelined insert')
+{
+	like($err, qr/^\Q$test\E\.\.\. ok$/m, "$test");
+}
+
+$node->stop('fast');
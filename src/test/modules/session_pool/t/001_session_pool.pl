@@ -0,0 +1,115 @@
+# Sessions multiplexed onto a pool of backends keep their own state
+
+use strict;
+use warnings;
+
+use TestLib;
+use Test::More tests => 10;
+use PostgresNode;
+
+my $nsessions = 6;
+
+my $node = get_new_node('main');
+$node->init;
+$node->append_conf('postgresql.conf', "session_pool_size = 2\n");
+$node->start;
+
+# Start concurrent sessions.  Each one makes settings and prepares a
+# statement of the same name, then lets the others run by sleeping outside
+# a transaction block, and reports what it sees afterwards.
+my (@handles, @outs);
+foreach my $i (1 .. $nsessions + 1)
+{
+	my $script = qq{
+SHOW work_mem;
+SET work_mem = '${i}MB';
+PREPARE q AS SELECT $i;
+SELECT pg_sleep(1);
+SELECT pg_backend_pid();
+SELECT pg_sleep(1);
+SHOW work_mem;
+EXECUTE q;
+};
+	my $out = '';
+	my @cmd = ('psql', '-XAtq', '-v', 'ON_ERROR_STOP=1',
+		'-d', $node->connstr('postgres'), '-f', '-');
+
+	# the last session opts out of pooling
+	local $ENV{PGOPTIONS} = $i > $nsessions ? '-c session_pooling=off' : '';
+	push @handles, IPC::Run::start(\@cmd, '<', \$script, '>', \$out);
+	push @outs, \$out;
+}
+
+my $ok = 1;
+$ok &&= $_->finish foreach @handles;
+ok($ok, 'all sessions succeed');
+
+my (%pool_pids, @seen_defaults, @kept_state);
+foreach my $i (1 .. $nsessions + 1)
+{
+	my ($default, $sleep1, $pid, $sleep2, $setting, $prepared) =
+	  split /\n/, ${ $outs[ $i - 1 ] };
+	push @seen_defaults, $default;
+	push @kept_state, "$setting $prepared";
+	$pool_pids{$pid} = 1 if $i <= $nsessions;
+	$outs[ $i - 1 ] = $pid;
+}
+
+is(scalar(keys %pool_pids), 2, 'pooled sessions share two backends');
+ok(!exists $pool_pids{ $outs[$nsessions] },
+	'session with session_pooling = off gets a backend of its own');
+is_deeply(\@seen_defaults, [ ('4MB') x ($nsessions + 1) ],
+	'sessions start out with default settings');
+is_deeply(\@kept_state, [ map { "${_}MB $_" } 1 .. $nsessions + 1 ],
+	'sessions keep their settings and prepared statements');
+
+# With a single pool backend, one session idling in psql keeps it around
+# while others come and go.
+$node->append_conf('postgresql.conf', "session_pool_size = 1\n");
+$node->restart;
+
+my $done = "$TestLib::tmp_check/keeper_done";
+my $keeper_script = qq{
+CREATE TABLE keeper AS SELECT pg_backend_pid() AS pid;
+\\! while [ ! -f "$done" ]; do sleep 1; done
+SELECT pg_backend_pid();
+};
+my $keeper_out = '';
+my $keeper = IPC::Run::start(
+	[   'psql', '-XAtq', '-v', 'ON_ERROR_STOP=1',
+		'-d', $node->connstr('postgres'), '-f', '-' ],
+	'<', \$keeper_script, '>', \$keeper_out);
+$node->poll_query_until('postgres',
+	"SELECT EXISTS (SELECT 1 FROM pg_class WHERE relname = 'keeper')")
+  or die "timed out waiting for the keeper session";
+my $keeper_pid = $node->safe_psql('postgres', 'SELECT pid FROM keeper');
+
+my @pids = (
+	$node->safe_psql('postgres',
+		"SET work_mem = '1MB'; PREPARE q AS SELECT 1; SELECT pg_backend_pid()")
+);
+push @pids, $node->safe_psql('postgres', 'SELECT pg_backend_pid()')
+  foreach 1 .. 3;
+is_deeply(\@pids, [ ($keeper_pid) x 4 ],
+	'new sessions are served by the pool backend');
+
+# A session's state doesn't outlive it.
+is($node->safe_psql('postgres', 'SHOW work_mem'), '4MB',
+	'settings are not inherited from earlier sessions');
+my ($ret, $stdout, $stderr) =
+  $node->psql('postgres', 'EXECUTE q', on_error_stop => 0);
+like($stderr, qr/prepared statement "q" does not exist/,
+	'prepared statements are not inherited from earlier sessions');
+
+# Errors end the failing session's transaction only.
+$node->psql('postgres', "BEGIN; SELECT 1/0;", on_error_stop => 0);
+is($node->safe_psql('postgres', 'SELECT 1'), '1',
+	'pool backend recovers from errors in a session');
+
+open my $fh, '>', $done or die "could not create $done: $!";
+close $fh;
+$keeper->finish;
+is($keeper_out, "$keeper_pid\n",
+	'sessions ending do not take the pool backend with them');
+
+$node->stop('fast');
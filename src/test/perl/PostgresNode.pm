@@ -376,6 +376,9 @@ has_archiving => 1. This is disabled by default.
 postgresql.conf can be set up for replication by passing the keyword
 parameter allows_streaming => 1. This is disabled by default.
 
+Additional options for initdb, such as '-k' to enable data checksums, can be
+passed as an array reference in the keyword parameter extra.
+
 The new node is set up in a fast but unsafe configuration where fsync is
 disabled.
 
@@ -392,11 +395,13 @@ sub init
 	  unless defined $params{hba_permit_replication};
 	$params{allows_streaming} = 0 unless defined $params{allows_streaming};
 	$params{has_archiving}    = 0 unless defined $params{has_archiving};
+	$params{extra}            = [] unless defined $params{extra};
 
 	mkdir $self->backup_dir;
 	mkdir $self->archive_dir;
 
-	TestLib::system_or_bail('initdb', '-D', $pgdata, '-A', 'trust', '-N');
+	TestLib::system_or_bail('initdb', '-D', $pgdata, '-A', 'trust', '-N',
+		@{ $params{extra} });
 	TestLib::system_or_bail($ENV{PG_REGRESS}, '--config-auth', $pgdata);
 
 	open my $conf, ">>$pgdata/postgresql.conf";
@@ -0,0 +1,118 @@
+# Test logical decoding on a hot standby
+# A logical slot is created on a standby and decodes the changes replayed
+# from the master, then keeps decoding across the timeline switch when the
+# standby is promoted.
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 5;
+
+# Initialize master node
+my $node_master = get_new_node('master');
+$node_master->init(allows_streaming => 1);
+$node_master->append_conf(
+	'postgresql.conf', qq(
+wal_level = logical
+max_replication_slots = 4
+hot_standby_feedback = on
+));
+$node_master->start;
+
+$node_master->safe_psql('postgres', "CREATE TABLE tab_int (a int)");
+
+# Take backup, and create a standby with the same settings
+my $backup_name = 'my_backup';
+$node_master->backup($backup_name);
+my $node_standby = get_new_node('standby');
+$node_standby->init_from_backup($node_master, $backup_name,
+	has_streaming => 1);
+$node_standby->start;
+
+# Wait until the standby has replayed everything the master wrote
+sub wait_for_replay
+{
+	my $until_lsn = $node_master->safe_psql('postgres',
+		"SELECT pg_current_xlog_location()");
+	$node_standby->poll_query_until('postgres',
+		"SELECT '$until_lsn'::pg_lsn <= pg_last_xlog_replay_location()")
+	  or die "Timed out while waiting for standby to catch up";
+}
+
+wait_for_replay();
+
+# Creating the slot waits for a running-xacts record from the master, so
+# start it in the background and have the master log one by checkpointing
+# until the slot is ready.
+my ($stdout, $stderr);
+my $h = IPC::Run::start(
+	[   'psql', '-X', '-A', '-t', '-d', $node_standby->connstr('postgres'),
+		'-c',
+"SELECT slot_name FROM pg_create_logical_replication_slot('standby_slot', 'test_decoding')"
+	],
+	'>', \$stdout, '2>', \$stderr);
+
+my $ready = 0;
+foreach my $i (1 .. 180)
+{
+	$node_master->safe_psql('postgres', "CHECKPOINT");
+	if ($node_standby->safe_psql('postgres',
+			"SELECT confirmed_flush_lsn IS NOT NULL FROM pg_replication_slots "
+		  . "WHERE slot_name = 'standby_slot'") eq 't')
+	{
+		$ready = 1;
+		last;
+	}
+	sleep 1;
+}
+$h->finish;
+chomp($stdout);
+ok($ready && $stdout eq 'standby_slot', 'logical slot created on standby')
+  or diag "stdout: $stdout\nstderr: $stderr";
+
+# Changes made on the master are decoded on the standby
+$node_master->safe_psql('postgres',
+	"INSERT INTO tab_int VALUES (1), (2)");
+$node_master->safe_psql('postgres', "UPDATE tab_int SET a = 3 WHERE a = 2");
+wait_for_replay();
+
+my $decode_query =
+    "SELECT data FROM pg_logical_slot_get_changes('standby_slot', NULL, NULL, "
+  . "'include-xids', '0', 'skip-empty-xacts', '1')";
+
+my $result = $node_standby->safe_psql('postgres', $decode_query);
+is( $result, qq(BEGIN
+table public.tab_int: INSERT: a[integer]:1
+table public.tab_int: INSERT: a[integer]:2
+COMMIT
+BEGIN
+table public.tab_int: UPDATE: a[integer]:3
+COMMIT), 'changes replayed from master are decoded on standby');
+
+# Nothing is decoded twice
+$result = $node_standby->safe_psql('postgres', $decode_query);
+is($result, '', 'consumed changes are not decoded again');
+
+# Leave some changes of the old timeline undecoded, then promote the
+# standby so that it switches to a new timeline
+$node_master->safe_psql('postgres', "INSERT INTO tab_int VALUES (4)");
+wait_for_replay();
+$node_master->teardown_node;
+$node_standby->promote;
+$node_standby->poll_query_until('postgres',
+	"SELECT pg_is_in_recovery() <> true")
+  or die "Timed out while waiting for promotion";
+
+$result = $node_standby->safe_psql('postgres',
+	"SELECT substr(pg_xlogfile_name(pg_current_xlog_location()), 1, 8)");
+is($result, '00000002', 'standby switched to a new timeline');
+
+# The slot decodes the rest of the old timeline and the new one
+$node_standby->safe_psql('postgres', "INSERT INTO tab_int VALUES (5)");
+$result = $node_standby->safe_psql('postgres', $decode_query);
+is( $result, qq(BEGIN
+table public.tab_int: INSERT: a[integer]:4
+COMMIT
+BEGIN
+table public.tab_int: INSERT: a[integer]:5
+COMMIT), 'decoding continues across the timeline switch');
@@ -0,0 +1,70 @@
+# Torn data pages are repaired from the double-write buffer after a crash
+use strict;
+use warnings;
+use PostgresNode;
+use TestLib;
+use Test::More tests => 5;
+
+my $node = get_new_node('master');
+$node->init(extra => ['-k']);
+$node->append_conf('postgresql.conf', qq{
+double_write = on
+autovacuum = off
+checkpoint_timeout = 1h
+max_wal_size = 1GB
+});
+$node->start;
+
+ok(-f $node->data_dir . '/pg_doublewrite', 'double-write file is created');
+
+# Fill some pages and get them written out through the double-write buffer
+$node->safe_psql('postgres', qq{
+CREATE TABLE dw_test (id int, val int) WITH (fillfactor = 50);
+INSERT INTO dw_test SELECT g, 0 FROM generate_series(1, 10000) g;
+CHECKPOINT;
+});
+my $npages = $node->safe_psql('postgres',
+	"SELECT pg_relation_size('dw_test') / current_setting('block_size')::int");
+
+# The first changes of the pages after a checkpoint carry no full-page
+# images, so a few changes on every page take much less WAL than the pages
+# themselves.
+my $start_lsn =
+  $node->safe_psql('postgres', 'SELECT pg_current_xlog_location()');
+$node->safe_psql('postgres', 'UPDATE dw_test SET val = 1 WHERE id % 50 = 0');
+my $wal_bytes = $node->safe_psql('postgres',
+	"SELECT pg_xlog_location_diff(pg_current_xlog_location(), '$start_lsn')");
+cmp_ok($wal_bytes, '<', $npages * 8192 / 2,
+	'changes after a checkpoint are logged without full-page images');
+
+# Write the pages once more, then change them again so that replay has to
+# apply records to them after the crash.
+$node->safe_psql('postgres', qq{
+CHECKPOINT;
+UPDATE dw_test SET val = 2 WHERE id % 2 = 0;
+});
+my $relpath = $node->safe_psql('postgres',
+	"SELECT pg_relation_filepath('dw_test')");
+$node->stop('immediate');
+
+# Tear the first page of the table: keep its first half only, as if the
+# system had crashed in the middle of writing it.
+my $file = $node->data_dir . "/$relpath";
+open my $fh, '+<', $file or die "could not open $file: $!";
+binmode $fh;
+seek($fh, 4096, 0) or die "could not seek in $file: $!";
+print $fh "\0" x 4096 or die "could not write $file: $!";
+close $fh or die "could not close $file: $!";
+
+$node->start;
+
+like(
+	slurp_file($node->logfile),
+	qr/restored block 0 of relation \Q$relpath\E from the double-write buffer/,
+	'torn page is restored from the double-write buffer');
+is($node->safe_psql('postgres', 'SELECT count(*), sum(val) FROM dw_test'),
+	'10000|10000', 'all changes are recovered on top of the restored page');
+is($node->safe_psql('postgres', 'SELECT max(val) FROM dw_test WHERE ctid < \'(1,0)\''),
+	'2', 'restored page has its changes replayed');
+
+$node->stop;
@@ -120,6 +120,16 @@ select array(select sum(x+y) s
             from generate_series(1,3) y group by y order by s)
   from generate_series(1,3) x;
 
+-- Hashed aggregation producing far more groups than estimated, so that the
+-- hash table has to grow several times while it is being filled.
+explain (costs off)
+select count(*), sum(c), min(c), max(c) from
+  (select g % 10000 as k, count(*) as c
+   from generate_series(1, 30000) g group by 1) ss;
+select count(*), sum(c), min(c), max(c) from
+  (select g % 10000 as k, count(*) as c
+   from generate_series(1, 30000) g group by 1) ss;
+
 --
 -- test for bitwise integer aggregates
 --
@@ -824,3 +834,108 @@ create aggregate my_half_sum(int4)
 select my_sum(one),my_half_sum(one) from (values(1),(2),(3),(4)) t(one);
 
 rollback;
+
+--
+-- Hash Aggregation Spill tests
+--
+
+set enable_sort=false;
+set work_mem='64kB';
+
+-- many groups of a few rows each, so that most of the input is spilled
+explain (costs off)
+  select g % 10000 as c1, sum(g::numeric) as c2, count(*) as c3,
+         array_agg(g) as c4
+  from generate_series(0, 39999) g
+  group by g % 10000;
+
+create table agg_hash_1 as
+  select g % 10000 as c1, sum(g::numeric) as c2, count(*) as c3,
+         array_agg(g) as c4
+  from generate_series(0, 39999) g
+  group by g % 10000;
+
+-- wide text keys and transition values, splitting partitions again
+explain (costs off)
+  select repeat(md5((g % 20000)::text), 4) as c1, max(g) as c2,
+         min(g::text) as c3
+  from generate_series(0, 59999) g
+  group by 1;
+create table agg_hash_2 as
+  select repeat(md5((g % 20000)::text), 4) as c1, max(g) as c2,
+         min(g::text) as c3
+  from generate_series(0, 59999) g
+  group by 1;
+
+-- nulls are a group of their own
+create table agg_hash_3 as
+  select nullif(g % 5000, 0) as c1, count(*) as c2
+  from generate_series(0, 19999) g
+  group by 1;
+
+-- hashed DISTINCT
+create table agg_hash_4 as
+  select distinct g % 10000 as c1, (g % 10000)::text as c2
+  from generate_series(0, 39999) g;
+
+set enable_sort=true;
+set enable_hashagg=false;
+set work_mem='4MB';
+
+create table agg_group_1 as
+  select g % 10000 as c1, sum(g::numeric) as c2, count(*) as c3,
+         array_agg(g) as c4
+  from generate_series(0, 39999) g
+  group by g % 10000;
+
+create table agg_group_2 as
+  select repeat(md5((g % 20000)::text), 4) as c1, max(g) as c2,
+         min(g::text) as c3
+  from generate_series(0, 59999) g
+  group by 1;
+
+create table agg_group_3 as
+  select nullif(g % 5000, 0) as c1, count(*) as c2
+  from generate_series(0, 19999) g
+  group by 1;
+
+create table agg_group_4 as
+  select distinct g % 10000 as c1, (g % 10000)::text as c2
+  from generate_series(0, 39999) g;
+
+reset enable_hashagg;
+reset enable_sort;
+reset work_mem;
+
+-- the array elements may be collected in any order
+(select c1, c2, c3, (select array_agg(e order by e) from unnest(c4) e)
+   from agg_hash_1
+ except
+ select c1, c2, c3, (select array_agg(e order by e) from unnest(c4) e)
+   from agg_group_1)
+union all
+(select c1, c2, c3, (select array_agg(e order by e) from unnest(c4) e)
+   from agg_group_1
+ except
+ select c1, c2, c3, (select array_agg(e order by e) from unnest(c4) e)
+   from agg_hash_1);
+
+(select * from agg_hash_2 except select * from agg_group_2)
+union all
+(select * from agg_group_2 except select * from agg_hash_2);
+
+(select * from agg_hash_3 except select * from agg_group_3)
+union all
+(select * from agg_group_3 except select * from agg_hash_3);
+
+(select * from agg_hash_4 except select * from agg_group_4)
+union all
+(select * from agg_group_4 except select * from agg_hash_4);
+
+select count(*) from agg_hash_1;
+select count(*) from agg_hash_2;
+select count(*) from agg_hash_3;
+select count(*) from agg_hash_4;
+
+drop table agg_group_1, agg_group_2, agg_group_3, agg_group_4;
+drop table agg_hash_1, agg_hash_2, agg_hash_3, agg_hash_4;
@@ -36,6 +36,14 @@ SELECT count(*) FROM bmscantest WHERE a = 1 AND b = 1;
 -- Test bitmap-or.
 SELECT count(*) FROM bmscantest WHERE a = 1 OR b = 1;
 
+-- Same again with exact bitmaps.  The page tables hold an entry for every
+-- page of the table, and bitmap-and removes the pages that drop out.
+reset work_mem;
+
+SELECT count(*) FROM bmscantest WHERE a = 1 AND b = 1;
+
+SELECT count(*) FROM bmscantest WHERE a = 1 OR b = 1;
+
 
 -- clean up
 DROP TABLE bmscantest;
@@ -0,0 +1,69 @@
+--
+-- Compression methods of TOAST
+--
+CREATE TABLE cmdata (id int, pglz text, lz4 text);
+ALTER TABLE cmdata ALTER COLUMN lz4 SET (compression = lz4);
+SELECT attname, attoptions FROM pg_attribute
+  WHERE attrelid = 'cmdata'::regclass AND attnum > 0 ORDER BY attnum;
+
+-- compressed in line, and moved out of line; pglz gives up on data that
+-- doesn't repeat itself early on, where lz4 still finds the repeated digits
+INSERT INTO cmdata SELECT 1, v, v FROM repeat('1234567890', 200) v;
+INSERT INTO cmdata SELECT 2, v, v
+  FROM (SELECT string_agg(md5(g::text), '') v FROM generate_series(1, 10000) g) s;
+SELECT id, length(lz4),
+       pg_column_size(pglz) < length(pglz) AS pglz_compressed,
+       pg_column_size(lz4) < length(lz4) AS lz4_compressed,
+       pg_column_size(lz4) <> pg_column_size(pglz) AS methods_differ
+  FROM cmdata ORDER BY id;
+SELECT id, lz4 = pglz, md5(lz4) = md5(pglz) FROM cmdata ORDER BY id;
+
+-- slices
+SELECT id, substr(lz4, 1, 15), substr(lz4, 1000, 15) = substr(pglz, 1000, 15),
+       substr(lz4, length(lz4) - 9) = substr(pglz, length(pglz) - 9)
+  FROM cmdata ORDER BY id;
+
+-- incompressible data is stored as it is
+INSERT INTO cmdata SELECT 3, v, v
+  FROM (SELECT string_agg(chr(33 + (g * 7919) % 94), '') v
+        FROM generate_series(1, 300) g) s;
+SELECT id, pg_column_size(lz4) >= length(lz4), lz4 = pglz FROM cmdata WHERE id = 3;
+
+-- the method applies to values stored later, existing ones stay readable
+ALTER TABLE cmdata ALTER COLUMN lz4 SET (compression = pglz);
+ALTER TABLE cmdata ALTER COLUMN pglz SET (compression = lz4);
+INSERT INTO cmdata SELECT 4, v, v FROM repeat('1234567890', 200) v;
+SELECT a.id, pg_column_size(a.lz4) = pg_column_size(b.pglz),
+       pg_column_size(a.pglz) = pg_column_size(b.lz4)
+  FROM cmdata a, cmdata b WHERE a.id = 4 AND b.id = 1;
+SELECT count(*) FROM cmdata WHERE lz4 = pglz;
+ALTER TABLE cmdata ALTER COLUMN lz4 RESET (compression);
+ALTER TABLE cmdata ALTER COLUMN pglz RESET (compression);
+
+-- compressed values are copied as they are
+CREATE TABLE cmcopy AS SELECT * FROM cmdata;
+SELECT count(*) FROM cmcopy c JOIN cmdata d USING (id)
+  WHERE c.lz4 = d.lz4 AND c.pglz = d.pglz;
+VACUUM FULL cmdata;
+SELECT id, md5(lz4) = md5(pglz) FROM cmdata ORDER BY id;
+
+-- index tuples are compressed with the method of the column
+CREATE TABLE cmindex (v text);
+ALTER TABLE cmindex ALTER COLUMN v SET (compression = lz4);
+ALTER TABLE cmindex ALTER COLUMN v SET STORAGE main;
+INSERT INTO cmindex SELECT repeat(g::text, 1000) FROM generate_series(1, 9) g;
+CREATE INDEX cmindex_v ON cmindex (v);
+SET enable_seqscan = off;
+SET enable_bitmapscan = off;
+EXPLAIN (COSTS OFF) SELECT v FROM cmindex WHERE v > '5' ORDER BY v;
+SELECT length(v), substr(v, 1, 5), v = repeat(substr(v, 1, 1), 1000)
+  FROM cmindex WHERE v > '5' ORDER BY v;
+RESET enable_seqscan;
+RESET enable_bitmapscan;
+
+-- errors
+ALTER TABLE cmdata ALTER COLUMN lz4 SET (compression = zstd);
+ALTER TABLE cmdata ALTER COLUMN lz4 SET (compression);
+ALTER INDEX cmindex_v SET (compression = lz4);
+
+DROP TABLE cmdata, cmcopy, cmindex;
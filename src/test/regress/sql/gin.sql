@@ -19,6 +19,31 @@ vacuum gin_test_tbl; -- flush the fastupdate buffers
 
 select gin_clean_pending_list('gin_test_idx'); -- nothing to flush
 
+-- Test that inserts leave an overgrown pending list to autovacuum.  The
+-- index is locked by the ALTER INDEX until commit, so the autovacuum worker
+-- can't merge the list behind our back.
+create table gin_pend_tbl(i int4[]) with (autovacuum_enabled = off);
+create index gin_pend_idx on gin_pend_tbl using gin (i)
+  with (fastupdate = on, gin_pending_list_limit = 64);
+begin;
+alter index gin_pend_idx set (gin_pending_list_limit = 64);
+-- about twice the limit: no insert merged the list
+insert into gin_pend_tbl select array[1, 2, g] from generate_series(1, 2000) g;
+select gin_clean_pending_list('gin_pend_idx') > 8 as over_limit;
+select gin_clean_pending_list('gin_pend_idx'); -- nothing to flush
+-- past four times the limit, the inserting backend merges the list itself
+insert into gin_pend_tbl select array[1, 3, g] from generate_series(1, 8000) g;
+select gin_clean_pending_list('gin_pend_idx') between 1 and 32 as backstop;
+commit;
+
+-- vacuum still merges a pending list below the limit
+insert into gin_pend_tbl select array[1, 4, g] from generate_series(1, 100) g;
+vacuum gin_pend_tbl;
+select gin_clean_pending_list('gin_pend_idx'); -- nothing to flush
+
+select count(*) from gin_pend_tbl where i @> array[1];
+drop table gin_pend_tbl;
+
 -- Test vacuuming
 delete from gin_test_tbl where i @> array[2];
 vacuum gin_test_tbl;
@@ -123,3 +123,41 @@ INSERT INTO INET_TBL (c, i) VALUES ('10', '10::/8');
 SELECT inet_merge(c, i) FROM INET_TBL;
 -- fix it by inet_same_family() condition
 SELECT inet_merge(c, i) FROM INET_TBL WHERE inet_same_family(c, i);
+
+-- check sorting of enough values to use abbreviated keys and radix sort:
+-- IPv4 and IPv6 mixed, different netmask lengths, and addresses that share
+-- their network prefix; the order must agree with the comparison operators
+CREATE TEMP TABLE inet_sort AS
+  SELECT format('%s.%s.%s.%s/%s', g % 3 * 100, g % 7, g % 5, g % 11,
+                8 + g % 25)::inet AS i
+  FROM generate_series(1, 600) g
+  UNION ALL
+  SELECT format('%s::%s:%s/%s', to_hex(g % 4 * 4096), to_hex(g % 9),
+                to_hex(g % 13), 16 + g % 113)::inet
+  FROM generate_series(1, 600) g
+  UNION ALL
+  VALUES ('0.0.0.0/0'::inet), ('0.0.0.0'), ('10.0.0.0/8'), ('10.0.0.0/16'),
+         ('10.0.0.0/32'), ('10.0.0.1/8'), ('10.0.0.1/16'), ('10.0.0.1'),
+         ('10.1.0.0/8'), ('10.1.0.0/16'), ('255.255.255.255/0'),
+         ('255.255.255.255'), ('::/0'), ('::'), ('::ffff:10.0.0.1'),
+         ('10::/8'), ('10::/16'), ('10::1/16'), ('10::1'),
+         ('ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff/0'),
+         ('ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff'), (NULL);
+
+SELECT count(*) FILTER (WHERE prev > i) AS inversions, count(*)
+FROM (SELECT i, lag(i) OVER (ORDER BY i) AS prev FROM inet_sort) s;
+SELECT count(*) FILTER (WHERE prev < i) AS inversions, count(*)
+FROM (SELECT i, lag(i) OVER (ORDER BY i DESC) AS prev FROM inet_sort) s;
+SELECT count(*) FILTER (WHERE prev > c) AS inversions, count(*)
+FROM (SELECT c, lag(c) OVER (ORDER BY c) AS prev
+      FROM (SELECT network(i)::cidr AS c FROM inet_sort) n) s;
+
+SELECT rn, i
+FROM (SELECT i, row_number() OVER (ORDER BY i NULLS FIRST) AS rn
+      FROM inet_sort) s
+WHERE i IS NULL OR masklen(i) = 0
+   OR i IN ('10.0.0.0/8', '10.0.0.0/16', '10.0.0.0/32', '10.0.0.1/8',
+            '10.0.0.1/16', '10.0.0.1', '10.1.0.0/8', '10.1.0.0/16',
+            '::', '::ffff:10.0.0.1', '10::/8', '10::/16', '10::1/16',
+            '10::1', 'ffff:ffff:ffff:ffff:ffff:ffff:ffff:ffff')
+ORDER BY rn;
@@ -155,3 +155,25 @@ FROM (VALUES (-2.5::numeric),
              (0.5::numeric),
              (1.5::numeric),
              (2.5::numeric)) t(x);
+
+-- check sorting of enough values to be radix sorted, including negative
+-- values, duplicates, NULLs and the extremes; the order must agree with
+-- the comparison operators
+CREATE TEMP TABLE int4_sort AS
+  SELECT (CASE g % 4 WHEN 0 THEN g WHEN 1 THEN -g
+          WHEN 2 THEN g * 1000003 ELSE -g * 1000003 END)::int4 AS x
+  FROM generate_series(1, 1000) g
+  UNION ALL
+  VALUES ((-2147483647 - 1)::int4), (-2147483647), (-1), (0), (0), (1),
+         (2147483646), (2147483647), (2147483647), (NULL);
+
+SELECT count(*) FILTER (WHERE prev > x) AS inversions, count(*)
+FROM (SELECT x, lag(x) OVER (ORDER BY x) AS prev FROM int4_sort) s;
+SELECT count(*) FILTER (WHERE prev < x) AS inversions, count(*)
+FROM (SELECT x, lag(x) OVER (ORDER BY x DESC) AS prev FROM int4_sort) s;
+
+SELECT rn, x
+FROM (SELECT x, row_number() OVER (ORDER BY x NULLS FIRST) AS rn
+      FROM int4_sort) s
+WHERE rn <= 4 OR rn > 1006 OR x BETWEEN -1 AND 1
+ORDER BY rn;
@@ -225,3 +225,27 @@ FROM (VALUES (-2.5::numeric),
              (0.5::numeric),
              (1.5::numeric),
              (2.5::numeric)) t(x);
+
+-- check sorting of enough values to be radix sorted, including negative
+-- values, duplicates, NULLs and the extremes; the order must agree with
+-- the comparison operators
+CREATE TEMP TABLE int8_sort AS
+  SELECT (CASE g % 4 WHEN 0 THEN g WHEN 1 THEN -g
+          WHEN 2 THEN g * 10000000019 ELSE -g * 10000000019 END)::int8 AS x
+  FROM generate_series(1, 1000) g
+  UNION ALL
+  VALUES ((-9223372036854775807 - 1)::int8), (-9223372036854775807),
+         (-4294967296), (-2147483649), (-1), (0), (0), (1), (2147483648),
+         (4294967296), (9223372036854775807), (9223372036854775807), (NULL);
+
+SELECT count(*) FILTER (WHERE prev > x) AS inversions, count(*)
+FROM (SELECT x, lag(x) OVER (ORDER BY x) AS prev FROM int8_sort) s;
+SELECT count(*) FILTER (WHERE prev < x) AS inversions, count(*)
+FROM (SELECT x, lag(x) OVER (ORDER BY x DESC) AS prev FROM int8_sort) s;
+
+SELECT rn, x
+FROM (SELECT x, row_number() OVER (ORDER BY x NULLS FIRST) AS rn
+      FROM int8_sort) s
+WHERE rn <= 4 OR rn > 1009 OR x BETWEEN -1 AND 1
+   OR abs(x) BETWEEN 2147483648 AND 4294967296
+ORDER BY rn;
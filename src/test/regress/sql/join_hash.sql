@@ -0,0 +1,90 @@
+--
+-- PARALLEL HASH JOIN
+--
+
+-- Serializable isolation would disable parallel query, so explicitly use an
+-- arbitrary other level.
+begin isolation level repeatable read;
+
+-- encourage use of parallel plans
+set parallel_setup_cost=0;
+set parallel_tuple_cost=0;
+set min_parallel_relation_size=0;
+set max_parallel_workers_per_gather=2;
+
+create table join_hash_outer as
+  select g as id, g % 1000 as k from generate_series(1, 20000) g;
+create table join_hash_inner as
+  select g as k, 'inner ' || g as t from generate_series(1, 1000) g;
+-- only the outer relation is scanned in parallel
+alter table join_hash_outer set (parallel_workers = 2);
+alter table join_hash_inner set (parallel_workers = 0);
+analyze join_hash_outer;
+analyze join_hash_inner;
+
+-- the hash table fits in work_mem, so it's built once and shared
+explain (costs off)
+  select count(*), count(distinct t) from join_hash_outer o
+    join join_hash_inner i using (k);
+select count(*), count(distinct t) from join_hash_outer o
+  join join_hash_inner i using (k);
+
+-- the same results from private hash tables
+set enable_parallel_hash = off;
+explain (costs off)
+  select count(*), count(distinct t) from join_hash_outer o
+    join join_hash_inner i using (k);
+select count(*), count(distinct t) from join_hash_outer o
+  join join_hash_inner i using (k);
+reset enable_parallel_hash;
+
+-- semi and anti joins
+select count(*) from join_hash_outer o
+  where exists (select 1 from join_hash_inner i where i.k = o.k);
+select count(*) from join_hash_outer o
+  where not exists (select 1 from join_hash_inner i where i.k = o.k);
+
+-- a hash table expected to need several batches is never shared
+create table join_hash_big as
+  select g as id, repeat('x', 100) as t from generate_series(1, 20000) g;
+alter table join_hash_big set (parallel_workers = 0);
+analyze join_hash_big;
+set work_mem = '64kB';
+explain (costs off)
+  select count(*), count(distinct t) from join_hash_outer o
+    join join_hash_big b using (id);
+select count(*), count(distinct t) from join_hash_outer o
+  join join_hash_big b using (id);
+reset work_mem;
+
+-- an underestimated inner relation outgrows the space reserved for it,
+-- and every participant falls back to a private table
+create table join_hash_bad as
+  select g as k, 'bad ' || g as t from generate_series(1, 10) g;
+alter table join_hash_bad set (parallel_workers = 0,
+                               autovacuum_enabled = false);
+analyze join_hash_bad;
+insert into join_hash_bad
+  select g % 1000, 'bad ' || g from generate_series(11, 20000) g;
+explain (costs off)
+  select count(*), count(distinct t) from join_hash_outer o
+    join join_hash_bad b using (k);
+select count(*), count(distinct t) from join_hash_outer o
+  join join_hash_bad b using (k);
+
+-- rescans rebuild the shared table
+set enable_material = off;
+set enable_mergejoin = off;
+explain (costs off)
+  select count(*) from (values (1), (2), (3)) v(x)
+    left join (select o.id, i.t from join_hash_outer o
+               join join_hash_inner i using (k)) ss
+    on ss.id < v.x * 100 and ss.id > v.x * 100 - 10;
+select count(*) from (values (1), (2), (3)) v(x)
+  left join (select o.id, i.t from join_hash_outer o
+             join join_hash_inner i using (k)) ss
+  on ss.id < v.x * 100 and ss.id > v.x * 100 - 10;
+reset enable_mergejoin;
+reset enable_material;
+
+rollback;
@@ -39,6 +39,64 @@ explain (costs off)
 	select  sum(parallel_restricted(unique1)) from tenk1
 	group by(parallel_restricted(unique1));
 
+-- test parallel index scans.
+set enable_seqscan to off;
+set enable_bitmapscan to off;
+
+explain (costs off)
+	select  count((unique1)) from tenk1 where hundred > 1;
+select  count((unique1)) from tenk1 where hundred > 1;
+
+-- test parallel index scans with array keys.
+explain (costs off)
+	select  count((unique1)) from tenk1 where hundred = any('{0,4,8,12,16,20,24,28,32,36,40,44,48,52,56,60,64,68,72,76,80,84,88,92,96}');
+select  count((unique1)) from tenk1 where hundred = any('{0,4,8,12,16,20,24,28,32,36,40,44,48,52,56,60,64,68,72,76,80,84,88,92,96}');
+
+-- test parallel index-only scans.
+explain (costs off)
+	select  count(*) from tenk1 where thousand > 95;
+select  count(*) from tenk1 where thousand > 95;
+
+reset enable_seqscan;
+reset enable_bitmapscan;
+
+-- test parallel bitmap heap scans.
+set enable_seqscan to off;
+set enable_indexscan to off;
+
+explain (costs off)
+	select  count((unique1)) from tenk1 where hundred > 1;
+select  count((unique1)) from tenk1 where hundred > 1;
+
+explain (costs off)
+	select  count(*) from tenk1 where hundred > 90 or thousand < 50;
+select  count(*) from tenk1 where hundred > 90 or thousand < 50;
+
+-- a bitmap too big for work_mem turns lossy.
+set work_mem = '64kB';
+explain (costs off)
+	select  count((unique1)) from tenk1 where hundred > 1;
+select  count((unique1)) from tenk1 where hundred > 1;
+reset work_mem;
+
+-- a bitmap that outgrows the space reserved for it from the row estimate
+-- is built and scanned by one participant alone.
+create table bmscantest (a int, t text) with (parallel_workers = 4);
+alter table bmscantest alter column t set storage plain;
+insert into bmscantest select g % 50, repeat('x', 1000) from generate_series(1, 500) g;
+create index i_bmtest on bmscantest(a);
+analyze bmscantest;
+insert into bmscantest select 5, repeat('x', 1000) from generate_series(1, 2000) g;
+set cpu_tuple_cost = 1;
+explain (costs off)
+	select  count(*) from bmscantest where a = 5;
+select  count(*) from bmscantest where a = 5;
+reset cpu_tuple_cost;
+drop table bmscantest;
+
+reset enable_seqscan;
+reset enable_indexscan;
+
 set force_parallel_mode=1;
 
 explain (costs off)
@@ -0,0 +1,65 @@
+-- tests for tidscans
+
+CREATE TABLE tidscan(id integer);
+
+-- only insert a few rows, we don't want to spill onto a second table page
+INSERT INTO tidscan VALUES (1), (2), (3);
+
+-- show ctids
+SELECT ctid, * FROM tidscan;
+
+-- ctid equality - implemented as tidscan
+EXPLAIN (COSTS OFF)
+SELECT ctid, * FROM tidscan WHERE ctid = '(0,1)';
+SELECT ctid, * FROM tidscan WHERE ctid = '(0,1)';
+
+EXPLAIN (COSTS OFF)
+SELECT ctid, * FROM tidscan WHERE ctid = '(0,2)' OR '(0,1)' = ctid;
+SELECT ctid, * FROM tidscan WHERE ctid = '(0,2)' OR '(0,1)' = ctid;
+
+DROP TABLE tidscan;
+
+-- ctid ranges, on a table of 20 pages with 5 rows each
+CREATE TABLE tidrangescan(id integer, data text) WITH (fillfactor = 10);
+INSERT INTO tidrangescan
+  SELECT i, repeat('x', 100) FROM generate_series(1, 100) AS s(i);
+
+SELECT ctid, id FROM tidrangescan WHERE id % 20 = 1;
+
+EXPLAIN (COSTS OFF)
+SELECT count(*) FROM tidrangescan WHERE ctid >= '(2,0)' AND ctid < '(4,0)';
+SELECT count(*), min(id), max(id) FROM tidrangescan
+  WHERE ctid >= '(2,0)' AND ctid < '(4,0)';
+
+-- bounds inside a page are rechecked
+SELECT count(*), min(id), max(id) FROM tidrangescan
+  WHERE ctid > '(2,3)' AND ctid <= '(3,2)';
+
+-- one-sided ranges
+SELECT count(*), min(id), max(id) FROM tidrangescan WHERE ctid < '(1,0)';
+SELECT count(*), min(id), max(id) FROM tidrangescan WHERE ctid >= '(19,0)';
+
+-- empty ranges
+SELECT count(*) FROM tidrangescan WHERE ctid >= '(3,0)' AND ctid < '(3,0)';
+SELECT count(*) FROM tidrangescan WHERE ctid >= '(4,0)' AND ctid < '(2,0)';
+
+-- bounds beyond the end of the table
+SELECT count(*), min(id), max(id) FROM tidrangescan
+  WHERE ctid >= '(15,0)' AND ctid < '(1000,0)';
+SELECT count(*) FROM tidrangescan WHERE ctid >= '(1000,0)' AND ctid < '(2000,0)';
+SELECT count(*) FROM tidrangescan WHERE ctid >= '(4294967295,0)';
+
+-- rescans with different bounds
+EXPLAIN (COSTS OFF)
+SELECT v.lo, v.hi, s.*
+  FROM (VALUES ('(0,0)'::tid, '(2,0)'::tid), ('(5,0)', '(6,0)'),
+               ('(6,0)', '(5,0)'), ('(19,0)', '(30,0)')) AS v(lo, hi),
+       LATERAL (SELECT count(*), min(id), max(id) FROM tidrangescan
+                 WHERE ctid >= v.lo AND ctid < v.hi) AS s;
+SELECT v.lo, v.hi, s.*
+  FROM (VALUES ('(0,0)'::tid, '(2,0)'::tid), ('(5,0)', '(6,0)'),
+               ('(6,0)', '(5,0)'), ('(19,0)', '(30,0)')) AS v(lo, hi),
+       LATERAL (SELECT count(*), min(id), max(id) FROM tidrangescan
+                 WHERE ctid >= v.lo AND ctid < v.hi) AS s;
+
+DROP TABLE tidrangescan;
@@ -117,6 +117,22 @@ SELECT q1 FROM int8_tbl EXCEPT ALL SELECT q1 FROM int8_tbl FOR NO KEY UPDATE;
 (SELECT 1,2,3 UNION SELECT 4,5,6) EXCEPT SELECT 4,5,6;
 (SELECT 1,2,3 UNION SELECT 4,5,6 ORDER BY 1,2) EXCEPT SELECT 4,5,6;
 
+-- hashed set operations with many more groups than estimated, so that the
+-- hash table has to grow several times
+explain (costs off)
+select count(*) from
+  (select g from generate_series(1, 20000) g
+   intersect
+   select g from generate_series(5001, 30000) g) ss;
+select count(*) from
+  (select g from generate_series(1, 20000) g
+   intersect
+   select g from generate_series(5001, 30000) g) ss;
+select count(*) from
+  (select g from generate_series(1, 20000) g
+   except
+   select g from generate_series(5001, 30000) g) ss;
+
 --
 -- Mixed types
 --
@@ -111,7 +111,7 @@ sub mkvcbuild
 
 	our @pgcommonallfiles = qw(
 	  config_info.c controldata_utils.c exec.c keywords.c
-	  pg_lzcompress.c pgfnames.c psprintf.c relpath.c rmtree.c
+	  pg_lz4.c pg_lzcompress.c pgfnames.c psprintf.c relpath.c rmtree.c
 	  string.c username.c wait_error.c);
 
 	our @pgcommonfrontendfiles = (
@@ -340,6 +340,7 @@ sub mkvcbuild
 	my $pgrewind = AddSimpleFrontend('pg_rewind', 1);
 	$pgrewind->{name} = 'pg_rewind';
 	$pgrewind->AddFile('src/backend/access/transam/xlogreader.c');
+	$pgrewind->AddFile('src/backend/libpq/md5.c');
 	$pgrewind->AddLibrary('ws2_32.lib');
 	$pgrewind->AddDefine('FRONTEND');
 